@@ -0,0 +1,121 @@
+/**
+ * @file  kmyth_bench.h
+ *
+ * @brief Provides the timing harness and benchmark groups run by the kmyth
+ *        benchmark application (kmyth-bench).
+ *
+ * Each benchmark times repeated calls of a function performing a single
+ * operation, and is reported as one record of the JSON document written
+ * by kmyth-bench, so that runs (e.g., of different releases) can be
+ * compared mechanically.
+ */
+
+#ifndef KMYTH_BENCH_H
+#define KMYTH_BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief A single benchmarked operation
+ *
+ * @param[in]  arg         The argument passed to kmyth_bench_run()
+ *
+ * @return 0 on success, 1 on error
+ */
+typedef int (*kmyth_bench_fn) (void *arg);
+
+/**
+ * @brief Times repeated calls of an operation, until at least the minimum
+ *        benchmark time has elapsed, and writes the result record.
+ *
+ * Benchmarks not matching the name filter (if any) are skipped. In a build
+ * with allocation counting (make KMYTH_ALLOC_STATS=1) the record also has
+ * the allocations, bytes allocated and peak heap of one (the first) call.
+ *
+ * @param[in]  group       The benchmark group (e.g., "cipher")
+ *
+ * @param[in]  name        The benchmark name, unique within its group
+ *
+ * @param[in]  bytes       The number of bytes processed by each operation
+ *                         (0 if throughput does not apply)
+ *
+ * @param[in]  fn          The operation to time
+ *
+ * @param[in]  arg         The argument to pass to fn
+ *
+ * @return 0 on success (or if skipped), 1 if the operation failed
+ */
+int kmyth_bench_run(const char *group, const char *name, size_t bytes,
+                    kmyth_bench_fn fn, void *arg);
+
+/**
+ * @brief Runs the symmetric cipher benchmarks: kmyth_encrypt_data() and
+ *        kmyth_decrypt_data() for each supported cipher and several sizes.
+ *
+ * @return 0 on success, 1 if any benchmark failed
+ */
+int cipher_bench(void);
+
+/**
+ * @brief Runs the base-64 and .ski block parsing (get_block_bytes())
+ *        benchmarks.
+ *
+ * @return 0 on success, 1 if any benchmark failed
+ */
+int formatting_bench(void);
+
+/**
+ * @brief Runs the .ski create_ski_bytes() and parse_ski_bytes()
+ *        benchmarks.
+ *
+ * @return 0 on success, 1 if any benchmark failed
+ */
+int marshalling_bench(void);
+
+/**
+ * @brief Runs the Needham-Schroeder-Lowe nonce exchange benchmarks, for RSA
+ *        (2048-bit) and ECIES (P-256 and X25519) key pairs: a whole
+ *        handshake (both parties), and the server's share of one.
+ *
+ * @return 0 on success, 1 if any benchmark failed
+ */
+int nsl_bench(void);
+
+/**
+ * @brief Runs the end-to-end tpm2_kmyth_seal() and tpm2_kmyth_unseal()
+ *        benchmarks. These require a TPM 2.0 (normally the simulator).
+ *
+ * @return 0 on success, 1 if any benchmark failed
+ */
+int seal_unseal_bench(void);
+
+/**
+ * @brief Runs the TCTI backend benchmarks: the round trip of a minimal TPM
+ *        command (GetRandom) and the connection setup, for each TCTI
+ *        configuration (see init_tcti()). Backends that are unavailable on
+ *        the host are skipped.
+ *
+ * @param[in]  tcti_confs  The TCTI configurations to compare
+ *
+ * @param[in]  tcti_count  The number of TCTI configurations (if 0, the
+ *                         tabrmd, device, mssim, and swtpm defaults are
+ *                         compared)
+ *
+ * @return 0 on success, 1 if any benchmark failed
+ */
+int tcti_bench(const char **tcti_confs, size_t tcti_count);
+
+/**
+ * @brief Runs the process startup benchmarks: the time to start (and run
+ *        the usage of) each application built into the multi-call kmyth
+ *        executable, both as a separate executable and through kmyth.
+ *        Executables that have not been built are skipped.
+ *
+ * @param[in]  bin_dir     The directory the executables were built in
+ *
+ * @return 0 on success, 1 if any benchmark failed
+ */
+int startup_bench(const char *bin_dir);
+
+#endif
@@ -0,0 +1,891 @@
+/**
+ * @file  kmip-bench.c
+ *
+ * Application to load test a KMIP key server the way kmyth clients use it.
+ * A number of workers (threads) each connect to the server with the same
+ * TLS code kmyth-getkey uses, and issue KMIP Get requests for a list of
+ * key IDs, for a fixed duration. How often a worker reconnects, how many
+ * keys each request batches, and whether a reconnect resumes the previous
+ * TLS session are all configurable, so the cost of each of the getkey
+ * networking features can be measured on its own.
+ *
+ * The handshake and request counts, their rates and latency percentiles,
+ * and a latency histogram of each, are written as a JSON document.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <kmip/kmip.h>
+#include <openssl/bio.h>
+#include <openssl/opensslv.h>
+#include <openssl/ssl.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "kmip_util.h"
+#include "kmyth.h"
+#include "kmyth_log.h"
+#include "memory_util.h"
+#include "socket_util.h"
+#include "tls_util.h"
+
+// maximum number of workers (threads)
+#define KMIP_BENCH_MAX_WORKERS 256
+
+// maximum number of key IDs requested
+#define KMIP_BENCH_MAX_IDS 1024
+
+// latency histogram buckets: bucket i counts latencies under 2^i
+// microseconds (the last bucket counts everything slower)
+#define KMIP_BENCH_HISTOGRAM_BUCKETS 24
+
+// the latencies recorded
+typedef enum
+{
+  KMIP_BENCH_HANDSHAKE = 0,
+  KMIP_BENCH_REQUEST,
+  KMIP_BENCH_LATENCY_COUNT
+} kmip_bench_latency;
+
+static const char *kmip_bench_latency_names[KMIP_BENCH_LATENCY_COUNT] = {
+  "handshake", "request"
+};
+
+// The counts of one worker (or, summed, of the run). The latencies are
+// kept, to compute percentiles and histograms over all workers.
+typedef struct
+{
+  uint64_t handshakes;
+  uint64_t resumed;
+  uint64_t handshake_errors;
+  uint64_t requests;
+  uint64_t keys;
+  uint64_t request_errors;
+  uint64_t *latencies[KMIP_BENCH_LATENCY_COUNT];
+  size_t latencies_len[KMIP_BENCH_LATENCY_COUNT];
+  size_t latencies_cap[KMIP_BENCH_LATENCY_COUNT];
+} kmip_bench_result;
+
+// The run's settings, shared (read only) by the workers
+typedef struct
+{
+  size_t workers;
+  double duration_s;
+  size_t reuse;
+  size_t batch;
+  bool resume;
+  char *server;
+  char *client_cert_path;
+  char *ca_cert_path;
+  uint8_t *client_key;
+  size_t client_key_len;
+  char **ids;
+  size_t ids_count;
+  const socket_options *sockopts;
+  char *session_dir;
+  uint64_t start_ns;
+} kmip_bench_config;
+
+typedef struct
+{
+  const kmip_bench_config *config;
+  size_t index;
+  kmip_bench_result result;
+} kmip_bench_worker;
+
+//############################################################################
+// now_ns()
+//############################################################################
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+//############################################################################
+// sleep_until_ns()
+//############################################################################
+static void sleep_until_ns(uint64_t deadline_ns)
+{
+  struct timespec ts = {
+    .tv_sec = (time_t) (deadline_ns / 1000000000ULL),
+    .tv_nsec = (long) (deadline_ns % 1000000000ULL),
+  };
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+  {
+  }
+}
+
+//############################################################################
+// record_latency()
+//############################################################################
+static int record_latency(kmip_bench_result * result,
+                          kmip_bench_latency kind, uint64_t latency_ns)
+{
+  if (result->latencies_len[kind] == result->latencies_cap[kind])
+  {
+    size_t cap = (result->latencies_cap[kind] == 0) ? 1024 :
+      2 * result->latencies_cap[kind];
+    uint64_t *latencies = realloc(result->latencies[kind],
+                                  cap * sizeof(uint64_t));
+
+    if (latencies == NULL)
+    {
+      return 1;
+    }
+    result->latencies[kind] = latencies;
+    result->latencies_cap[kind] = cap;
+  }
+  result->latencies[kind][result->latencies_len[kind]++] = latency_ns;
+
+  return 0;
+}
+
+//############################################################################
+// free_result()
+//############################################################################
+static void free_result(kmip_bench_result * result)
+{
+  for (int kind = 0; kind < KMIP_BENCH_LATENCY_COUNT; kind++)
+  {
+    free(result->latencies[kind]);
+  }
+  memset(result, 0, sizeof(kmip_bench_result));
+}
+
+//############################################################################
+// bench_connect()
+//############################################################################
+static int bench_connect(const kmip_bench_config * config,
+                         const char *session_path, BIO ** bio,
+                         SSL_CTX ** ctx, bool *resumed)
+{
+  // the connection functions split the address at its ':', so each
+  // connection is given its own copy
+  char *server = strdup(config->server);
+
+  if (server == NULL)
+  {
+    return 1;
+  }
+
+  int retval = 0;
+
+  if (session_path == NULL && config->sockopts == NULL)
+  {
+    retval = create_tls_connection(&server, config->client_key,
+                                   config->client_key_len,
+                                   config->client_cert_path,
+                                   config->ca_cert_path, bio, ctx);
+  }
+  else
+  {
+    retval = create_tls_connection_resume(&server, config->client_key,
+                                          config->client_key_len,
+                                          config->client_cert_path,
+                                          config->ca_cert_path,
+                                          (char *) session_path,
+                                          config->sockopts, bio, ctx);
+  }
+  free(server);
+
+  SSL *ssl = NULL;
+
+  *resumed = (retval == 0 && BIO_get_ssl(*bio, &ssl) > 0 && ssl != NULL &&
+              SSL_session_reused(ssl) == 1);
+
+  return retval;
+}
+
+//############################################################################
+// bench_disconnect()
+//############################################################################
+static void bench_disconnect(BIO ** bio, SSL_CTX ** ctx)
+{
+  if (*bio != NULL)
+  {
+    BIO_free_all(*bio);
+    *bio = NULL;
+  }
+  tls_context_release(*ctx);
+  *ctx = NULL;
+}
+
+//############################################################################
+// bench_get()
+//############################################################################
+static int bench_get(BIO * bio, KMIP * kmip_ctx,
+                     const kmip_bench_config * config, size_t first)
+{
+  unsigned char *ids[KMYTH_KMIP_MAX_BATCH_COUNT];
+  size_t id_lens[KMYTH_KMIP_MAX_BATCH_COUNT];
+
+  for (size_t i = 0; i < config->batch; i++)
+  {
+    ids[i] = (unsigned char *) config->ids[(first + i) % config->ids_count];
+    id_lens[i] = strlen((char *) ids[i]);
+  }
+
+  // a single key is requested as kmyth-getkey -m does, several as one
+  // batched request (as kmyth-getkey -k does)
+  unsigned char *request = NULL;
+  size_t request_len = 0;
+  int retval = (config->batch == 1) ?
+    build_kmip_get_request(kmip_ctx, ids[0], id_lens[0], &request,
+                           &request_len) :
+    build_kmip_get_batch_request(kmip_ctx, ids, id_lens, config->batch,
+                                 &request, &request_len);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error building KMIP Get request");
+    free(request);
+    return 1;
+  }
+
+  unsigned char *response = NULL;
+  size_t response_len = 0;
+
+  retval = get_kmip_resp_from_tls_server(bio, request, request_len,
+                                         &response, &response_len);
+  free(request);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error getting KMIP Get response");
+    return 1;
+  }
+
+  unsigned char **resp_ids = NULL;
+  size_t *resp_id_lens = NULL;
+  unsigned char **resp_keys = NULL;
+  size_t *resp_key_lens = NULL;
+  size_t resp_count = 0;
+
+  retval = parse_kmip_get_batch_response(kmip_ctx, response, response_len,
+                                         &resp_ids, &resp_id_lens,
+                                         &resp_keys, &resp_key_lens,
+                                         &resp_count);
+  kmyth_clear_and_free(response, response_len);
+  if (retval == 0 && resp_count != config->batch)
+  {
+    kmyth_log(LOG_ERR, "KMIP Get response has %zu keys, not %zu",
+              resp_count, config->batch);
+    retval = 1;
+  }
+  free_kmip_get_batch(resp_ids, resp_id_lens, resp_keys, resp_key_lens,
+                      resp_count);
+
+  return retval;
+}
+
+//############################################################################
+// run_worker()
+//############################################################################
+static void run_worker(kmip_bench_worker * worker)
+{
+  const kmip_bench_config *config = worker->config;
+  kmip_bench_result *result = &worker->result;
+  char session_path[4096];
+  char *session = NULL;
+
+  // each worker resumes its own session (as each kmyth-getkey client
+  // resumes the one saved next to its sealed key)
+  if (config->resume)
+  {
+    snprintf(session_path, sizeof(session_path), "%s/worker-%zu.session",
+             config->session_dir, worker->index);
+    session = session_path;
+  }
+
+  // the requests are all built and parsed in the one (reused) workspace
+  KMIP kmip_ctx = { 0 };
+  kmip_workspace kmip_ws = { 0 };
+
+  kmip_init(&kmip_ctx, NULL, 0, KMIP_1_0);
+  if (kmip_workspace_init(&kmip_ws, &kmip_ctx) != 0)
+  {
+    kmyth_log(LOG_ERR, "worker %zu setup failed", worker->index);
+    result->handshake_errors++;
+    kmip_destroy(&kmip_ctx);
+    return;
+  }
+
+  uint64_t end_ns = config->start_ns +
+    (uint64_t) (config->duration_s * 1e9);
+  BIO *bio = NULL;
+  SSL_CTX *ctx = NULL;
+  size_t since_connect = 0;
+  size_t next_id = worker->index * config->batch;
+
+  sleep_until_ns(config->start_ns);
+  while (now_ns() < end_ns)
+  {
+    if (bio == NULL)
+    {
+      bool resumed = false;
+      uint64_t start_ns = now_ns();
+
+      if (bench_connect(config, session, &bio, &ctx, &resumed))
+      {
+        result->handshake_errors++;
+        bench_disconnect(&bio, &ctx);
+
+        // (a server refusing connections is not hammered)
+        sleep_until_ns(now_ns() + 10000000ULL);
+        continue;
+      }
+      result->handshakes++;
+      if (resumed)
+      {
+        result->resumed++;
+      }
+      if (record_latency(result, KMIP_BENCH_HANDSHAKE, now_ns() - start_ns))
+      {
+        kmyth_log(LOG_ERR, "unable to record latency ... stopping worker");
+        break;
+      }
+      since_connect = 0;
+    }
+
+    uint64_t start_ns = now_ns();
+    int rc = bench_get(bio, &kmip_ctx, config, next_id);
+    uint64_t latency_ns = now_ns() - start_ns;
+
+    next_id += config->batch;
+    since_connect++;
+    result->requests++;
+    if (rc)
+    {
+      result->request_errors++;
+    }
+    else
+    {
+      result->keys += config->batch;
+      if (record_latency(result, KMIP_BENCH_REQUEST, latency_ns))
+      {
+        kmyth_log(LOG_ERR, "unable to record latency ... stopping worker");
+        break;
+      }
+    }
+
+    // a failed connection is not reused, and a used one is only kept for
+    // its share of requests
+    if (rc || (config->reuse != 0 && since_connect >= config->reuse))
+    {
+      if (rc == 0 && session != NULL && tls_save_session(session, bio))
+      {
+        kmyth_log(LOG_WARNING, "worker %zu unable to save TLS session",
+                  worker->index);
+      }
+      bench_disconnect(&bio, &ctx);
+    }
+  }
+
+  bench_disconnect(&bio, &ctx);
+  if (session != NULL)
+  {
+    unlink(session);
+  }
+  kmip_workspace_free(&kmip_ws);
+  kmip_destroy(&kmip_ctx);
+}
+
+//############################################################################
+// worker_thread()
+//############################################################################
+static void *worker_thread(void *arg)
+{
+  run_worker((kmip_bench_worker *) arg);
+  return NULL;
+}
+
+//############################################################################
+// run_workers()
+//############################################################################
+static int run_workers(kmip_bench_config * config,
+                       kmip_bench_worker * workers)
+{
+  // the workers start together, once all of them have been started
+  config->start_ns = now_ns() + 100000000ULL;
+
+  pthread_t threads[KMIP_BENCH_MAX_WORKERS];
+  size_t started = 0;
+
+  for (; started < config->workers; started++)
+  {
+    if (pthread_create(&threads[started], NULL, worker_thread,
+                       &workers[started]))
+    {
+      kmyth_log(LOG_ERR, "unable to start worker thread ... exiting");
+      break;
+    }
+  }
+  for (size_t i = 0; i < started; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+
+  return (started == config->workers) ? 0 : 1;
+}
+
+//############################################################################
+// compare_u64()
+//############################################################################
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+//############################################################################
+// percentile_ms()
+//############################################################################
+static double percentile_ms(const uint64_t * sorted, size_t len, double p)
+{
+  if (len == 0)
+  {
+    return 0;
+  }
+
+  // nearest rank
+  size_t rank = (size_t) (p / 100.0 * (double) len + 0.999999);
+
+  if (rank == 0)
+  {
+    rank = 1;
+  }
+  if (rank > len)
+  {
+    rank = len;
+  }
+
+  return (double) sorted[rank - 1] / 1e6;
+}
+
+//############################################################################
+// write_histogram()
+//############################################################################
+static void write_histogram(FILE * out, const uint64_t * sorted, size_t len)
+{
+  uint64_t counts[KMIP_BENCH_HISTOGRAM_BUCKETS] = { 0 };
+  int last = -1;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    uint64_t us = sorted[i] / 1000;
+    int bucket = 0;
+
+    while (bucket < KMIP_BENCH_HISTOGRAM_BUCKETS - 1 &&
+           us >= (1ULL << bucket))
+    {
+      bucket++;
+    }
+    counts[bucket]++;
+    last = bucket;
+  }
+
+  // (the buckets above the slowest latency are left out)
+  fprintf(out, "[");
+  for (int bucket = 0; bucket <= last; bucket++)
+  {
+    if (bucket == KMIP_BENCH_HISTOGRAM_BUCKETS - 1)
+    {
+      fprintf(out, "%s{\"lt_us\": null, \"count\": %" PRIu64 "}",
+              (bucket == 0) ? "" : ", ", counts[bucket]);
+    }
+    else
+    {
+      fprintf(out, "%s{\"lt_us\": %llu, \"count\": %" PRIu64 "}",
+              (bucket == 0) ? "" : ", ", 1ULL << bucket, counts[bucket]);
+    }
+  }
+  fprintf(out, "]");
+}
+
+//############################################################################
+// write_report()
+//############################################################################
+static int write_report(FILE * out, const kmip_bench_config * config,
+                        kmip_bench_worker * workers, double elapsed_s)
+{
+  kmip_bench_result total;
+
+  memset(&total, 0, sizeof(total));
+  for (size_t w = 0; w < config->workers; w++)
+  {
+    kmip_bench_result *result = &workers[w].result;
+
+    total.handshakes += result->handshakes;
+    total.resumed += result->resumed;
+    total.handshake_errors += result->handshake_errors;
+    total.requests += result->requests;
+    total.keys += result->keys;
+    total.request_errors += result->request_errors;
+    for (int kind = 0; kind < KMIP_BENCH_LATENCY_COUNT; kind++)
+    {
+      for (size_t i = 0; i < result->latencies_len[kind]; i++)
+      {
+        if (record_latency(&total, (kmip_bench_latency) kind,
+                           result->latencies[kind][i]))
+        {
+          free_result(&total);
+          return 1;
+        }
+      }
+    }
+  }
+
+  fprintf(out, "{\n  \"kmyth_version\": \"%s\",\n  \"openssl_version\": "
+          "\"%s\",\n  \"server\": \"%s\",\n  \"workers\": %zu,\n"
+          "  \"duration_s\": %.3f,\n  \"requests_per_connection\": %zu,\n"
+          "  \"batch\": %zu,\n  \"resume\": %s,\n  \"key_ids\": %zu,\n"
+          "  \"handshakes\": %" PRIu64 ",\n  \"resumed\": %" PRIu64 ",\n"
+          "  \"handshake_errors\": %" PRIu64 ",\n"
+          "  \"handshakes_per_s\": %.2f,\n  \"requests\": %" PRIu64 ",\n"
+          "  \"request_errors\": %" PRIu64 ",\n"
+          "  \"requests_per_s\": %.2f,\n  \"keys_per_s\": %.2f,\n"
+          "  \"latencies\": [", KMYTH_VERSION, OPENSSL_VERSION_TEXT,
+          config->server, config->workers, elapsed_s, config->reuse,
+          config->batch, config->resume ? "true" : "false",
+          config->ids_count, total.handshakes, total.resumed,
+          total.handshake_errors, (double) total.handshakes / elapsed_s,
+          total.requests, total.request_errors,
+          (double) (total.requests - total.request_errors) / elapsed_s,
+          (double) total.keys / elapsed_s);
+
+  for (int kind = 0; kind < KMIP_BENCH_LATENCY_COUNT; kind++)
+  {
+    size_t len = total.latencies_len[kind];
+
+    qsort(total.latencies[kind], len, sizeof(uint64_t), compare_u64);
+    fprintf(out, "%s\n    {\"kind\": \"%s\", \"count\": %zu, "
+            "\"p50_ms\": %.3f, \"p95_ms\": %.3f, \"p99_ms\": %.3f, "
+            "\"max_ms\": %.3f,\n     \"histogram\": ",
+            (kind == 0) ? "" : ",", kmip_bench_latency_names[kind], len,
+            percentile_ms(total.latencies[kind], len, 50),
+            percentile_ms(total.latencies[kind], len, 95),
+            percentile_ms(total.latencies[kind], len, 99),
+            (len > 0) ? (double) total.latencies[kind][len - 1] / 1e6 : 0);
+    write_histogram(out, total.latencies[kind], len);
+    fprintf(out, "}");
+  }
+  fprintf(out, "\n  ]\n}\n");
+
+  int retval = (total.handshake_errors > 0 || total.request_errors > 0 ||
+                total.requests == 0) ? 1 : 0;
+
+  free_result(&total);
+
+  return retval;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s -c <ip:port> -l <client cert> -s <CA cert> (-i <sealed key> | -K <key>)\n"
+          "          -m <key ID> [-m <key ID> ...] [options]\n\n"
+          "options are: \n\n"
+          " -c or --conn_addr   The ip_address:port of the KMIP server.\n"
+          " -l or --client      Path to file containing the client's certificate.\n"
+          " -s or --server      Path to file containing the certificate for the CA that issued the server cert.\n"
+          " -i or --input       Path to file containing the kmyth-sealed client's certificate private key\n"
+          "                     (unsealed once, before the run).\n"
+          " -K or --key         Path to file containing the (PEM, unsealed) client's certificate private key,\n"
+          "                     for test setups without a TPM.\n"
+          " -a or --auth_string With -i, the string used to create the 'authVal' digest.\n"
+          " -w or --owner_auth  With -i, TPM 2.0 storage (owner) hierarchy authorization.\n"
+          " -m or --message     ID of a key to get (may be repeated - the requests cycle through the IDs).\n"
+          " -n or --workers     Number of concurrent workers, each with its own connection. Defaults to 4.\n"
+          " -d or --duration    Duration of the run, in seconds. Defaults to 10.\n"
+          " -r or --reuse       Requests made over a connection before it is closed and a new one made.\n"
+          "                     Defaults to 0 (each worker keeps its connection for the whole run);\n"
+          "                     1 makes a connection per request, as separate kmyth-getkey runs do.\n"
+          " -b or --batch       Keys requested in each (batched) KMIP Get request, 1 to %d. Defaults to 1.\n"
+          " -R or --resume      Resume each worker's previous TLS session when it reconnects (as\n"
+          "                     kmyth-getkey -R does), skipping the full handshake.\n"
+          " -O or --sockopt     Tune the connections to the server (repeatable), as for kmyth-getkey -O.\n"
+          " -o or --output      Path to write the JSON results to. Defaults to stdout.\n"
+          " -v or --verbose     Enable detailed logging.\n"
+          " -h or --help        Help (displays this usage).\n", prog,
+          KMYTH_KMIP_MAX_BATCH_COUNT);
+}
+
+static const struct option longopts[] = {
+  {"conn_addr", required_argument, 0, 'c'},
+  {"client", required_argument, 0, 'l'},
+  {"server", required_argument, 0, 's'},
+  {"input", required_argument, 0, 'i'},
+  {"key", required_argument, 0, 'K'},
+  {"auth_string", required_argument, 0, 'a'},
+  {"owner_auth", required_argument, 0, 'w'},
+  {"message", required_argument, 0, 'm'},
+  {"workers", required_argument, 0, 'n'},
+  {"duration", required_argument, 0, 'd'},
+  {"reuse", required_argument, 0, 'r'},
+  {"batch", required_argument, 0, 'b'},
+  {"resume", no_argument, 0, 'R'},
+  {"sockopt", required_argument, 0, 'O'},
+  {"output", required_argument, 0, 'o'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+int main(int argc, char **argv)
+{
+  // Configure logging messages (only errors, unless verbose)
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+  set_applog_severity_threshold(LOG_ERR);
+
+  kmip_bench_config config = {
+    .workers = 4,
+    .duration_s = 10,
+    .reuse = 0,
+    .batch = 1,
+    .resume = false,
+  };
+  char *ids[KMIP_BENCH_MAX_IDS];
+  char *inPath = NULL;
+  char *keyPath = NULL;
+  char *authString = NULL;
+  char *ownerAuthPasswd = "";
+  char *outPath = NULL;
+  socket_options sockopts;
+  bool sockoptsSet = false;
+  char *end = NULL;
+  unsigned long value = 0;
+
+  config.ids = ids;
+  socket_options_init(&sockopts);
+
+  int options;
+  int option_index;
+
+  while ((options =
+          getopt_long(argc, argv, "a:b:c:d:i:l:m:n:o:r:s:w:K:O:Rvh",
+                      longopts, &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 'c':
+      config.server = optarg;
+      break;
+    case 'l':
+      config.client_cert_path = optarg;
+      break;
+    case 's':
+      config.ca_cert_path = optarg;
+      break;
+    case 'i':
+      inPath = optarg;
+      break;
+    case 'K':
+      keyPath = optarg;
+      break;
+    case 'a':
+      authString = optarg;
+      break;
+    case 'w':
+      ownerAuthPasswd = optarg;
+      break;
+    case 'm':
+      if (config.ids_count == KMIP_BENCH_MAX_IDS || optarg[0] == '\0')
+      {
+        kmyth_log(LOG_ERR, "invalid key ID (%s, at most %d IDs) ... "
+                  "exiting", optarg, KMIP_BENCH_MAX_IDS);
+        return 1;
+      }
+      ids[config.ids_count++] = optarg;
+      break;
+    case 'n':
+      value = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || value == 0 ||
+          value > KMIP_BENCH_MAX_WORKERS)
+      {
+        kmyth_log(LOG_ERR, "invalid number of workers (%s, max %d) ... "
+                  "exiting", optarg, KMIP_BENCH_MAX_WORKERS);
+        return 1;
+      }
+      config.workers = (size_t) value;
+      break;
+    case 'd':
+      config.duration_s = strtod(optarg, &end);
+      if (end == optarg || *end != '\0' || config.duration_s <= 0)
+      {
+        kmyth_log(LOG_ERR, "invalid duration (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'r':
+      value = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0')
+      {
+        kmyth_log(LOG_ERR, "invalid connection reuse (%s) ... exiting",
+                  optarg);
+        return 1;
+      }
+      config.reuse = (size_t) value;
+      break;
+    case 'b':
+      value = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || value == 0 ||
+          value > KMYTH_KMIP_MAX_BATCH_COUNT)
+      {
+        kmyth_log(LOG_ERR, "invalid batch size (%s, max %d) ... exiting",
+                  optarg, KMYTH_KMIP_MAX_BATCH_COUNT);
+        return 1;
+      }
+      config.batch = (size_t) value;
+      break;
+    case 'R':
+      config.resume = true;
+      break;
+    case 'O':
+      if (parse_socket_option(optarg, &sockopts))
+      {
+        kmyth_log(LOG_ERR, "invalid socket option (%s) ... exiting", optarg);
+        return 1;
+      }
+      sockoptsSet = true;
+      break;
+    case 'o':
+      outPath = optarg;
+      break;
+    case 'v':
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  size_t auth_string_len = (authString == NULL) ? 0 : strlen(authString);
+  size_t oa_passwd_len = strlen(ownerAuthPasswd);
+
+  if (config.server == NULL || config.client_cert_path == NULL ||
+      config.ca_cert_path == NULL || config.ids_count == 0 ||
+      (inPath == NULL) == (keyPath == NULL))
+  {
+    kmyth_log(LOG_ERR, "-c, -l, -s, -m and one of -i or -K are required "
+              "... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+  config.sockopts = sockoptsSet ? &sockopts : NULL;
+
+  // the client's key is unsealed (or read) once, and shared by the workers
+  int retval = (inPath != NULL) ?
+    tpm2_kmyth_unseal_file(inPath, &config.client_key, &config.client_key_len,
+                           (uint8_t *) authString, auth_string_len,
+                           (uint8_t *) ownerAuthPasswd, oa_passwd_len, 0) :
+    read_bytes_from_file(keyPath, &config.client_key, &config.client_key_len);
+
+  kmyth_clear(authString, auth_string_len);
+  kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to get the client's private key ... exiting");
+    kmyth_clear_and_free(config.client_key, config.client_key_len);
+    return 1;
+  }
+
+  // a bad key or certificate is reported once, here, rather than by every
+  // worker's every connection
+  SSL_CTX *check_ctx = NULL;
+
+  if (tls_set_context(config.client_key, config.client_key_len,
+                      config.client_cert_path, config.ca_cert_path,
+                      &check_ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to set up TLS context ... exiting");
+    kmyth_clear_and_free(config.client_key, config.client_key_len);
+    return 1;
+  }
+  SSL_CTX_free(check_ctx);
+
+  char session_dir[] = "/tmp/kmip-bench-XXXXXX";
+
+  if (config.resume)
+  {
+    if (mkdtemp(session_dir) == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to create session directory ... exiting");
+      kmyth_clear_and_free(config.client_key, config.client_key_len);
+      return 1;
+    }
+    config.session_dir = session_dir;
+  }
+
+  kmip_bench_worker *workers = calloc(config.workers,
+                                      sizeof(kmip_bench_worker));
+
+  if (workers == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate workers ... exiting");
+    kmyth_clear_and_free(config.client_key, config.client_key_len);
+    if (config.resume)
+    {
+      rmdir(session_dir);
+    }
+    return 1;
+  }
+  for (size_t i = 0; i < config.workers; i++)
+  {
+    workers[i].config = &config;
+    workers[i].index = i;
+  }
+
+  retval = run_workers(&config, workers);
+
+  double elapsed_s = (double) (now_ns() - config.start_ns) / 1e9;
+  FILE *out = stdout;
+
+  if (outPath != NULL && (out = fopen(outPath, "w")) == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open file: %s ... exiting", outPath);
+    retval = 1;
+  }
+  else
+  {
+    retval |= write_report(out, &config, workers, elapsed_s);
+    if (out != stdout)
+    {
+      fclose(out);
+    }
+  }
+
+  for (size_t i = 0; i < config.workers; i++)
+  {
+    free_result(&workers[i].result);
+  }
+  free(workers);
+  if (config.resume)
+  {
+    rmdir(session_dir);
+  }
+  tls_context_cache_clear();
+  kmyth_clear_and_free(config.client_key, config.client_key_len);
+
+  return retval;
+}
@@ -0,0 +1,818 @@
+/**
+ * @file  kmyth-loadtest.c
+ *
+ * Application to load test kmyth against a TPM 2.0 (the simulator, for
+ * CI-like runs, or a real TPM behind the resource manager, for sizing).
+ * A number of workers (threads, or processes) each open their own kmyth
+ * context and issue a mix of seal, unseal and reseal (rewrap) calls, at an
+ * overall target rate or as fast as they can. The latency percentiles,
+ * throughput, and error and retry counts of each kind of call are written
+ * as a JSON document.
+ *
+ * With a target rate, each call is scheduled ahead of time and its latency
+ * is measured from when it was due, so that a TPM falling behind shows up
+ * as latency (not as a lower, self-throttled rate).
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <openssl/opensslv.h>
+#include <openssl/rand.h>
+
+#include "defines.h"
+#include "kmyth.h"
+#include "kmyth_log.h"
+#include "memory_util.h"
+
+// maximum number of workers (threads or processes)
+#define LOADTEST_MAX_WORKERS 256
+
+// the kinds of call issued
+typedef enum
+{
+  LOADTEST_SEAL = 0,
+  LOADTEST_UNSEAL,
+  LOADTEST_RESEAL,
+  LOADTEST_OP_COUNT
+} loadtest_op;
+
+static const char *loadtest_op_names[LOADTEST_OP_COUNT] = {
+  "seal", "unseal", "reseal"
+};
+
+// The counts of one worker (or, summed, of the run). The latencies of
+// each kind of call are kept, to compute percentiles over all workers.
+typedef struct
+{
+  uint64_t calls[LOADTEST_OP_COUNT];
+  uint64_t errors[LOADTEST_OP_COUNT];
+  uint64_t retries;
+  uint64_t retry_wait_ns;
+  uint64_t setup_errors;
+  uint64_t *latencies[LOADTEST_OP_COUNT];
+  size_t latencies_len[LOADTEST_OP_COUNT];
+  size_t latencies_cap[LOADTEST_OP_COUNT];
+} loadtest_result;
+
+// The run's settings, shared (read only) by the workers
+typedef struct
+{
+  size_t workers;
+  bool processes;
+  double duration_s;
+  double rate;
+  size_t data_size;
+  unsigned int mix[LOADTEST_OP_COUNT];
+  const char *tcti_conf;
+  uint64_t start_ns;
+} loadtest_config;
+
+typedef struct
+{
+  const loadtest_config *config;
+  size_t index;
+  loadtest_result result;
+} loadtest_worker;
+
+//############################################################################
+// now_ns()
+//############################################################################
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+//############################################################################
+// sleep_until_ns()
+//############################################################################
+static void sleep_until_ns(uint64_t deadline_ns)
+{
+  struct timespec ts = {
+    .tv_sec = (time_t) (deadline_ns / 1000000000ULL),
+    .tv_nsec = (long) (deadline_ns % 1000000000ULL),
+  };
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+  {
+  }
+}
+
+//############################################################################
+// record_latency()
+//############################################################################
+static int record_latency(loadtest_result * result, loadtest_op op,
+                          uint64_t latency_ns)
+{
+  if (result->latencies_len[op] == result->latencies_cap[op])
+  {
+    size_t cap = (result->latencies_cap[op] == 0) ? 1024 :
+      2 * result->latencies_cap[op];
+    uint64_t *latencies = realloc(result->latencies[op],
+                                  cap * sizeof(uint64_t));
+
+    if (latencies == NULL)
+    {
+      return 1;
+    }
+    result->latencies[op] = latencies;
+    result->latencies_cap[op] = cap;
+  }
+  result->latencies[op][result->latencies_len[op]++] = latency_ns;
+
+  return 0;
+}
+
+//############################################################################
+// free_result()
+//############################################################################
+static void free_result(loadtest_result * result)
+{
+  for (int op = 0; op < LOADTEST_OP_COUNT; op++)
+  {
+    free(result->latencies[op]);
+  }
+  memset(result, 0, sizeof(loadtest_result));
+}
+
+//############################################################################
+// pick_op()
+//############################################################################
+static loadtest_op pick_op(const loadtest_config * config, unsigned int *seed)
+{
+  unsigned int total = 0;
+
+  for (int op = 0; op < LOADTEST_OP_COUNT; op++)
+  {
+    total += config->mix[op];
+  }
+
+  unsigned int pick = (unsigned int) rand_r(seed) % total;
+
+  for (int op = 0; op < LOADTEST_OP_COUNT; op++)
+  {
+    if (pick < config->mix[op])
+    {
+      return (loadtest_op) op;
+    }
+    pick -= config->mix[op];
+  }
+
+  return LOADTEST_SEAL;
+}
+
+//############################################################################
+// run_op()
+//############################################################################
+static int run_op(kmyth_ctx_t * ctx, loadtest_op op, uint8_t * data,
+                  size_t data_size, uint8_t * sealed, size_t sealed_len)
+{
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+  int retval = 1;
+
+  switch (op)
+  {
+  case LOADTEST_SEAL:
+    retval = tpm2_kmyth_seal_ctx(ctx, data, data_size, &output, &output_len,
+                                 NULL, 0, NULL, 0, NULL, 0, NULL, NULL, 0);
+    free(output);
+    break;
+  case LOADTEST_UNSEAL:
+    retval = tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &output,
+                                   &output_len, NULL, 0, NULL, 0, 0);
+    if (retval == 0 &&
+        (output_len != data_size || memcmp(output, data, data_size) != 0))
+    {
+      kmyth_log(LOG_ERR, "unsealed data does not match the sealed data");
+      retval = 1;
+    }
+    kmyth_clear_and_free(output, output_len);
+    break;
+  case LOADTEST_RESEAL:
+    retval = tpm2_kmyth_rewrap(ctx, sealed, sealed_len, &output, &output_len,
+                               NULL, 0, NULL, 0, NULL, 0, NULL, 0);
+    free(output);
+    break;
+  default:
+    break;
+  }
+
+  return retval;
+}
+
+//############################################################################
+// run_worker()
+//############################################################################
+static void run_worker(loadtest_worker * worker)
+{
+  const loadtest_config *config = worker->config;
+  loadtest_result *result = &worker->result;
+  kmyth_ctx_t *ctx = NULL;
+  kmyth_timings_t timings;
+  uint8_t *data = malloc(config->data_size);
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  memset(&timings, 0, sizeof(timings));
+
+  // each worker has its own TPM connection, and its own .ski to unseal
+  // (and reseal), sealed before the run starts
+  if (data == NULL || RAND_bytes(data, (int) config->data_size) != 1 ||
+      kmyth_ctx_create_tcti(&ctx, config->tcti_conf) ||
+      tpm2_kmyth_seal_ctx(ctx, data, config->data_size, &sealed, &sealed_len,
+                          NULL, 0, NULL, 0, NULL, 0, NULL, NULL, 0) ||
+      kmyth_ctx_set_timings(ctx, &timings))
+  {
+    kmyth_log(LOG_ERR, "worker %zu setup failed", worker->index);
+    result->setup_errors++;
+    kmyth_ctx_destroy(&ctx);
+    free(sealed);
+    free(data);
+    return;
+  }
+
+  unsigned int seed = (unsigned int) (worker->index + 1);
+  uint64_t end_ns = config->start_ns +
+    (uint64_t) (config->duration_s * 1e9);
+
+  // with a target rate, the workers take turns: worker w's k-th call is
+  // due at (k * workers + w) / rate seconds into the run
+  double interval_ns = (config->rate > 0) ?
+    1e9 * (double) config->workers / config->rate : 0;
+  double offset_ns = (config->rate > 0) ?
+    1e9 * (double) worker->index / config->rate : 0;
+
+  sleep_until_ns(config->start_ns);
+  for (uint64_t k = 0;; k++)
+  {
+    uint64_t due_ns = now_ns();
+
+    if (interval_ns > 0)
+    {
+      due_ns = config->start_ns +
+        (uint64_t) (offset_ns + (double) k * interval_ns);
+      if (due_ns >= end_ns)
+      {
+        break;
+      }
+      sleep_until_ns(due_ns);
+    }
+    else if (due_ns >= end_ns)
+    {
+      break;
+    }
+
+    loadtest_op op = pick_op(config, &seed);
+    int rc = run_op(ctx, op, data, config->data_size, sealed, sealed_len);
+    uint64_t latency_ns = now_ns() - due_ns;
+
+    result->calls[op]++;
+    if (rc)
+    {
+      result->errors[op]++;
+    }
+    else if (record_latency(result, op, latency_ns))
+    {
+      kmyth_log(LOG_ERR, "unable to record latency ... stopping worker");
+      break;
+    }
+  }
+
+  result->retries = timings.retries;
+  result->retry_wait_ns = timings.retry_wait_ns;
+
+  kmyth_ctx_set_timings(ctx, NULL);
+  kmyth_ctx_destroy(&ctx);
+  free(sealed);
+  kmyth_clear_and_free(data, config->data_size);
+}
+
+//############################################################################
+// worker_thread()
+//############################################################################
+static void *worker_thread(void *arg)
+{
+  run_worker((loadtest_worker *) arg);
+  return NULL;
+}
+
+//############################################################################
+// write_all()
+//############################################################################
+static int write_all(int fd, const void *buf, size_t len)
+{
+  const uint8_t *p = (const uint8_t *) buf;
+
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return 1;
+    }
+    p += n;
+    len -= (size_t) n;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// read_all()
+//############################################################################
+static int read_all(int fd, void *buf, size_t len)
+{
+  uint8_t *p = (uint8_t *) buf;
+
+  while (len > 0)
+  {
+    ssize_t n = read(fd, p, len);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return 1;
+    }
+    p += n;
+    len -= (size_t) n;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// send_result()
+//############################################################################
+static int send_result(int fd, const loadtest_result * result)
+{
+  // the counts (with the latency pointers, meaningless to the reader)
+  // followed by each kind of call's latencies
+  if (write_all(fd, result, sizeof(loadtest_result)))
+  {
+    return 1;
+  }
+  for (int op = 0; op < LOADTEST_OP_COUNT; op++)
+  {
+    if (result->latencies_len[op] > 0 &&
+        write_all(fd, result->latencies[op],
+                  result->latencies_len[op] * sizeof(uint64_t)))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// receive_result()
+//############################################################################
+static int receive_result(int fd, loadtest_result * result)
+{
+  if (read_all(fd, result, sizeof(loadtest_result)))
+  {
+    memset(result, 0, sizeof(loadtest_result));
+    return 1;
+  }
+  for (int op = 0; op < LOADTEST_OP_COUNT; op++)
+  {
+    result->latencies[op] = NULL;
+    result->latencies_cap[op] = result->latencies_len[op];
+    if (result->latencies_len[op] == 0)
+    {
+      continue;
+    }
+    result->latencies[op] = malloc(result->latencies_len[op] *
+                                   sizeof(uint64_t));
+    if (result->latencies[op] == NULL ||
+        read_all(fd, result->latencies[op],
+                 result->latencies_len[op] * sizeof(uint64_t)))
+    {
+      free_result(result);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// run_workers()
+//############################################################################
+static int run_workers(loadtest_config * config, loadtest_worker * workers)
+{
+  // the workers start together, once all of them have been started (and
+  // have had time to set up their TPM connection)
+  config->start_ns = now_ns() + 1000000000ULL;
+
+  if (!config->processes)
+  {
+    pthread_t threads[LOADTEST_MAX_WORKERS];
+    size_t started = 0;
+
+    for (; started < config->workers; started++)
+    {
+      if (pthread_create(&threads[started], NULL, worker_thread,
+                         &workers[started]))
+      {
+        kmyth_log(LOG_ERR, "unable to start worker thread ... exiting");
+        break;
+      }
+    }
+    for (size_t i = 0; i < started; i++)
+    {
+      pthread_join(threads[i], NULL);
+    }
+
+    return (started == config->workers) ? 0 : 1;
+  }
+
+  pid_t pids[LOADTEST_MAX_WORKERS];
+  int fds[LOADTEST_MAX_WORKERS];
+  size_t started = 0;
+
+  fflush(NULL);
+  for (; started < config->workers; started++)
+  {
+    int pipe_fds[2];
+
+    if (pipe(pipe_fds))
+    {
+      kmyth_log(LOG_ERR, "unable to create worker pipe ... exiting");
+      break;
+    }
+
+    pid_t pid = fork();
+
+    if (pid < 0)
+    {
+      kmyth_log(LOG_ERR, "unable to start worker process ... exiting");
+      close(pipe_fds[0]);
+      close(pipe_fds[1]);
+      break;
+    }
+    if (pid == 0)
+    {
+      close(pipe_fds[0]);
+      run_worker(&workers[started]);
+      _exit(send_result(pipe_fds[1], &workers[started].result));
+    }
+    close(pipe_fds[1]);
+    pids[started] = pid;
+    fds[started] = pipe_fds[0];
+  }
+
+  int retval = (started == config->workers) ? 0 : 1;
+
+  for (size_t i = 0; i < started; i++)
+  {
+    int status = 0;
+
+    if (receive_result(fds[i], &workers[i].result))
+    {
+      kmyth_log(LOG_ERR, "no result from worker %zu", i);
+      workers[i].result.setup_errors++;
+    }
+    close(fds[i]);
+    waitpid(pids[i], &status, 0);
+  }
+
+  return retval;
+}
+
+//############################################################################
+// compare_u64()
+//############################################################################
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+//############################################################################
+// percentile_ms()
+//############################################################################
+static double percentile_ms(const uint64_t * sorted, size_t len, double p)
+{
+  if (len == 0)
+  {
+    return 0;
+  }
+
+  // nearest rank
+  size_t rank = (size_t) (p / 100.0 * (double) len + 0.999999);
+
+  if (rank == 0)
+  {
+    rank = 1;
+  }
+  if (rank > len)
+  {
+    rank = len;
+  }
+
+  return (double) sorted[rank - 1] / 1e6;
+}
+
+//############################################################################
+// write_report()
+//############################################################################
+static int write_report(FILE * out, const loadtest_config * config,
+                        loadtest_worker * workers, double elapsed_s)
+{
+  loadtest_result total;
+  uint64_t all_calls = 0;
+  uint64_t all_errors = 0;
+
+  memset(&total, 0, sizeof(total));
+  for (size_t w = 0; w < config->workers; w++)
+  {
+    loadtest_result *result = &workers[w].result;
+
+    total.retries += result->retries;
+    total.retry_wait_ns += result->retry_wait_ns;
+    total.setup_errors += result->setup_errors;
+    for (int op = 0; op < LOADTEST_OP_COUNT; op++)
+    {
+      total.calls[op] += result->calls[op];
+      total.errors[op] += result->errors[op];
+      for (size_t i = 0; i < result->latencies_len[op]; i++)
+      {
+        if (record_latency(&total, (loadtest_op) op,
+                           result->latencies[op][i]))
+        {
+          free_result(&total);
+          return 1;
+        }
+      }
+    }
+  }
+
+  fprintf(out, "{\n  \"kmyth_version\": \"%s\",\n  \"openssl_version\": "
+          "\"%s\",\n  \"tcti\": \"%s\",\n  \"workers\": %zu,\n"
+          "  \"mode\": \"%s\",\n  \"duration_s\": %.3f,\n"
+          "  \"target_rate\": %.2f,\n  \"data_size\": %zu,\n"
+          "  \"mix\": {\"seal\": %u, \"unseal\": %u, \"reseal\": %u},\n"
+          "  \"ops\": [", KMYTH_VERSION, OPENSSL_VERSION_TEXT,
+          (config->tcti_conf != NULL) ? config->tcti_conf : "default",
+          config->workers, config->processes ? "processes" : "threads",
+          elapsed_s, config->rate, config->data_size,
+          config->mix[LOADTEST_SEAL], config->mix[LOADTEST_UNSEAL],
+          config->mix[LOADTEST_RESEAL]);
+
+  bool first = true;
+
+  for (int op = 0; op < LOADTEST_OP_COUNT; op++)
+  {
+    if (total.calls[op] == 0)
+    {
+      continue;
+    }
+
+    size_t len = total.latencies_len[op];
+
+    qsort(total.latencies[op], len, sizeof(uint64_t), compare_u64);
+    fprintf(out, "%s\n    {\"op\": \"%s\", \"calls\": %" PRIu64
+            ", \"errors\": %" PRIu64 ", \"ops_per_s\": %.2f, "
+            "\"p50_ms\": %.3f, \"p95_ms\": %.3f, \"p99_ms\": %.3f, "
+            "\"max_ms\": %.3f}", first ? "" : ",", loadtest_op_names[op],
+            total.calls[op], total.errors[op],
+            (double) (total.calls[op] - total.errors[op]) / elapsed_s,
+            percentile_ms(total.latencies[op], len, 50),
+            percentile_ms(total.latencies[op], len, 95),
+            percentile_ms(total.latencies[op], len, 99),
+            (len > 0) ? (double) total.latencies[op][len - 1] / 1e6 : 0);
+    first = false;
+    all_calls += total.calls[op];
+    all_errors += total.errors[op];
+  }
+
+  fprintf(out, "\n  ],\n  \"calls\": %" PRIu64 ",\n  \"errors\": %" PRIu64
+          ",\n  \"ops_per_s\": %.2f,\n  \"retries\": %" PRIu64
+          ",\n  \"retry_wait_ms\": %.3f,\n  \"setup_errors\": %" PRIu64
+          "\n}\n", all_calls, all_errors,
+          (double) (all_calls - all_errors) / elapsed_s, total.retries,
+          (double) total.retry_wait_ns / 1e6, total.setup_errors);
+
+  free_result(&total);
+
+  return (all_errors > 0 || total.setup_errors > 0) ? 1 : 0;
+}
+
+//############################################################################
+// parse_mix()
+//############################################################################
+static int parse_mix(const char *arg, unsigned int *mix)
+{
+  unsigned int total = 0;
+  const char *p = arg;
+
+  for (int op = 0; op < LOADTEST_OP_COUNT; op++)
+  {
+    char *end = NULL;
+    unsigned long weight = strtoul(p, &end, 10);
+
+    if (end == p || weight > 1000 ||
+        *end != ((op == LOADTEST_OP_COUNT - 1) ? '\0' : ':'))
+    {
+      return 1;
+    }
+    mix[op] = (unsigned int) weight;
+    total += mix[op];
+    p = end + 1;
+  }
+
+  return (total > 0) ? 0 : 1;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are: \n\n"
+          " -n or --workers    Number of concurrent workers, each with its own TPM connection.\n"
+          "                    Defaults to 4.\n"
+          " -p or --processes  Run the workers as processes, instead of threads.\n"
+          " -d or --duration   Duration of the run, in seconds. Defaults to 10.\n"
+          " -r or --rate       Target rate, in calls per second over all workers. Defaults to 0\n"
+          "                    (each worker issues its next call as soon as the last one returns).\n"
+          " -m or --mix        Relative weights of seal:unseal:reseal calls. Defaults to 1:4:1.\n"
+          " -s or --size       Size, in bytes, of the data sealed. Defaults to 64.\n"
+          " -t or --tcti       TCTI configuration (e.g., mssim:host=localhost,port=2321 for the\n"
+          "                    simulator, or device:/dev/tpmrm0). Defaults to the configured TCTI.\n"
+          " -o or --output     Path to write the JSON results to. Defaults to stdout.\n"
+          " -v or --verbose    Enable detailed logging.\n"
+          " -h or --help       Help (displays this usage).\n", prog);
+}
+
+static const struct option longopts[] = {
+  {"workers", required_argument, 0, 'n'},
+  {"processes", no_argument, 0, 'p'},
+  {"duration", required_argument, 0, 'd'},
+  {"rate", required_argument, 0, 'r'},
+  {"mix", required_argument, 0, 'm'},
+  {"size", required_argument, 0, 's'},
+  {"tcti", required_argument, 0, 't'},
+  {"output", required_argument, 0, 'o'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+int main(int argc, char **argv)
+{
+  // Configure logging messages (only errors, unless verbose)
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+  set_applog_severity_threshold(LOG_ERR);
+
+  loadtest_config config = {
+    .workers = 4,
+    .processes = false,
+    .duration_s = 10,
+    .rate = 0,
+    .data_size = 64,
+    .mix = {1, 4, 1},
+    .tcti_conf = NULL,
+  };
+  char *outPath = NULL;
+  char *end = NULL;
+  unsigned long value = 0;
+
+  int options;
+  int option_index;
+
+  while ((options =
+          getopt_long(argc, argv, "n:pd:r:m:s:t:o:vh", longopts,
+                      &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 'n':
+      value = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || value == 0 ||
+          value > LOADTEST_MAX_WORKERS)
+      {
+        kmyth_log(LOG_ERR, "invalid number of workers (%s, max %d) ... "
+                  "exiting", optarg, LOADTEST_MAX_WORKERS);
+        return 1;
+      }
+      config.workers = (size_t) value;
+      break;
+    case 'p':
+      config.processes = true;
+      break;
+    case 'd':
+      config.duration_s = strtod(optarg, &end);
+      if (end == optarg || *end != '\0' || config.duration_s <= 0)
+      {
+        kmyth_log(LOG_ERR, "invalid duration (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'r':
+      config.rate = strtod(optarg, &end);
+      if (end == optarg || *end != '\0' || config.rate < 0)
+      {
+        kmyth_log(LOG_ERR, "invalid rate (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'm':
+      if (parse_mix(optarg, config.mix))
+      {
+        kmyth_log(LOG_ERR, "invalid call mix (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 's':
+      value = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || value == 0 || value > INT32_MAX)
+      {
+        kmyth_log(LOG_ERR, "invalid data size (%s) ... exiting", optarg);
+        return 1;
+      }
+      config.data_size = (size_t) value;
+      break;
+    case 't':
+      config.tcti_conf = optarg;
+      break;
+    case 'o':
+      outPath = optarg;
+      break;
+    case 'v':
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  loadtest_worker *workers = calloc(config.workers, sizeof(loadtest_worker));
+
+  if (workers == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate workers ... exiting");
+    return 1;
+  }
+  for (size_t i = 0; i < config.workers; i++)
+  {
+    workers[i].config = &config;
+    workers[i].index = i;
+  }
+
+  int retval = run_workers(&config, workers);
+  double elapsed_s = (double) (now_ns() - config.start_ns) / 1e9;
+
+  FILE *out = stdout;
+
+  if (outPath != NULL && (out = fopen(outPath, "w")) == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open file: %s ... exiting", outPath);
+    retval = 1;
+  }
+  else
+  {
+    retval |= write_report(out, &config, workers, elapsed_s);
+    if (out != stdout)
+    {
+      fclose(out);
+    }
+  }
+
+  for (size_t i = 0; i < config.workers; i++)
+  {
+    free_result(&workers[i].result);
+  }
+  free(workers);
+
+  return retval;
+}
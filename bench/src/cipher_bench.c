@@ -0,0 +1,128 @@
+//############################################################################
+// cipher_bench.c
+//
+// Benchmarks for kmyth symmetric encryption/decryption in
+// src/cipher/cipher.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/rand.h>
+
+#include "kmyth_bench.h"
+#include "cipher/cipher.h"
+#include "memory_util.h"
+
+extern const cipher_t cipher_list[];
+
+// The data encrypted or decrypted by one benchmarked operation
+typedef struct
+{
+  cipher_t cipher;
+  unsigned char *data;
+  size_t data_size;
+  unsigned char *key;
+  size_t key_size;
+} cipher_bench_arg;
+
+//############################################################################
+// bench_encrypt()
+//############################################################################
+static int bench_encrypt(void *arg)
+{
+  cipher_bench_arg *a = (cipher_bench_arg *) arg;
+  unsigned char *enc_data = NULL;
+  size_t enc_data_size = 0;
+
+  // the (new, random) key is written to the caller supplied key buffer
+  if (kmyth_encrypt_data(a->data, a->data_size, a->cipher, &enc_data,
+                         &enc_data_size, &a->key, &a->key_size))
+  {
+    return 1;
+  }
+  free(enc_data);
+
+  return 0;
+}
+
+//############################################################################
+// bench_decrypt()
+//############################################################################
+static int bench_decrypt(void *arg)
+{
+  cipher_bench_arg *a = (cipher_bench_arg *) arg;
+  unsigned char *result = NULL;
+  size_t result_size = 0;
+
+  if (kmyth_decrypt_data(a->data, a->data_size, a->cipher, a->key,
+                         a->key_size, &result, &result_size))
+  {
+    return 1;
+  }
+  kmyth_clear_and_free(result, result_size);
+
+  return 0;
+}
+
+//############################################################################
+// cipher_bench()
+//############################################################################
+int cipher_bench(void)
+{
+  // sizes are multiples of 8 bytes, as required by the RFC 3394 key wrap
+  size_t sizes[] = { 64, 4096, 1024 * 1024 };
+  size_t max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+  unsigned char *data = malloc(max_size);
+  int retval = 0;
+
+  if (data == NULL || RAND_bytes(data, (int) max_size) != 1)
+  {
+    free(data);
+    return 1;
+  }
+
+  for (size_t c = 0; cipher_list[c].cipher_name != NULL; c++)
+  {
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+      char name[KMYTH_MAX_CIPHER_STR_LEN + 32];
+      unsigned char key[32];
+      cipher_bench_arg enc = {.cipher = cipher_list[c],.data = data,
+        .data_size = sizes[s],.key = key,
+        .key_size = get_key_len_from_cipher(cipher_list[c]) / 8
+      };
+      cipher_bench_arg dec = enc;
+
+      if (enc.key_size == 0 || enc.key_size > sizeof(key))
+      {
+        retval = 1;
+        continue;
+      }
+
+      snprintf(name, sizeof(name), "encrypt/%s", cipher_list[c].cipher_name);
+      retval |= kmyth_bench_run("cipher", name, sizes[s], bench_encrypt,
+                                &enc);
+
+      // decrypt the same data, encrypted once up front (a NULL output
+      // pointer asks the cipher to allocate the ciphertext buffer)
+      dec.data = NULL;
+      if (kmyth_encrypt_data(data, sizes[s], cipher_list[c], &dec.data,
+                             &dec.data_size, &dec.key, &dec.key_size))
+      {
+        kmyth_clear(key, sizeof(key));
+        retval = 1;
+        continue;
+      }
+      snprintf(name, sizeof(name), "decrypt/%s", cipher_list[c].cipher_name);
+      retval |= kmyth_bench_run("cipher", name, sizes[s], bench_decrypt,
+                                &dec);
+      free(dec.data);
+      kmyth_clear(key, sizeof(key));
+    }
+  }
+
+  free(data);
+  return retval;
+}
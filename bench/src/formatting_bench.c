@@ -0,0 +1,170 @@
+//############################################################################
+// formatting_bench.c
+//
+// Benchmarks for kmyth formatting utilities in utils/src/formatting_tools.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/rand.h>
+
+#include "kmyth_bench.h"
+#include "formatting_tools.h"
+
+// The input of one benchmarked operation
+typedef struct
+{
+  uint8_t *data;
+  size_t data_size;
+} formatting_bench_arg;
+
+//############################################################################
+// bench_encode()
+//############################################################################
+static int bench_encode(void *arg)
+{
+  formatting_bench_arg *a = (formatting_bench_arg *) arg;
+  uint8_t *base64_data = NULL;
+  size_t base64_data_size = 0;
+
+  if (encodeBase64Data(a->data, a->data_size, &base64_data,
+                       &base64_data_size))
+  {
+    return 1;
+  }
+  free(base64_data);
+
+  return 0;
+}
+
+//############################################################################
+// bench_decode()
+//############################################################################
+static int bench_decode(void *arg)
+{
+  formatting_bench_arg *a = (formatting_bench_arg *) arg;
+  uint8_t *raw_data = NULL;
+  size_t raw_data_size = 0;
+
+  if (decodeBase64Data(a->data, a->data_size, &raw_data, &raw_data_size))
+  {
+    return 1;
+  }
+  free(raw_data);
+
+  return 0;
+}
+
+//############################################################################
+// bench_get_block_bytes()
+//############################################################################
+static int bench_get_block_bytes(void *arg)
+{
+  formatting_bench_arg *a = (formatting_bench_arg *) arg;
+  char *contents = (char *) a->data;
+  size_t remaining = a->data_size;
+  uint8_t *block = NULL;
+  size_t block_size = 0;
+
+  if (get_block_bytes(&contents, &remaining, &block, &block_size,
+                      KMYTH_DELIM_ENC_DATA, strlen(KMYTH_DELIM_ENC_DATA),
+                      KMYTH_DELIM_END_FILE, strlen(KMYTH_DELIM_END_FILE)))
+  {
+    free(block);
+    return 1;
+  }
+  free(block);
+
+  return 0;
+}
+
+//############################################################################
+// bench_get_block_view()
+//############################################################################
+static int bench_get_block_view(void *arg)
+{
+  formatting_bench_arg *a = (formatting_bench_arg *) arg;
+  uint8_t *contents = a->data;
+  size_t remaining = a->data_size;
+  uint8_t *block = NULL;
+  size_t block_size = 0;
+
+  return get_block_view(&contents, &remaining, &block, &block_size,
+                        KMYTH_DELIM_ENC_DATA, strlen(KMYTH_DELIM_ENC_DATA),
+                        KMYTH_DELIM_END_FILE, strlen(KMYTH_DELIM_END_FILE));
+}
+
+//############################################################################
+// formatting_bench()
+//############################################################################
+int formatting_bench(void)
+{
+  size_t sizes[] = { 64, 4096, 1024 * 1024 };
+  size_t max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+  uint8_t *data = malloc(max_size);
+  int retval = 0;
+
+  if (data == NULL || RAND_bytes(data, (int) max_size) != 1)
+  {
+    free(data);
+    return 1;
+  }
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+  {
+    formatting_bench_arg raw = {.data = data,.data_size = sizes[s] };
+    formatting_bench_arg encoded = { 0 };
+
+    retval |= kmyth_bench_run("formatting", "base64_encode", sizes[s],
+                              bench_encode, &raw);
+
+    if (encodeBase64Data(data, sizes[s], &encoded.data, &encoded.data_size))
+    {
+      retval = 1;
+      continue;
+    }
+
+    // throughput is reported in terms of the decoded size for both the
+    // encoder and the decoder
+    retval |= kmyth_bench_run("formatting", "base64_decode", sizes[s],
+                              bench_decode, &encoded);
+
+    // the encoded data as the (last) encrypted data block of a .ski file
+    size_t block_file_size = strlen(KMYTH_DELIM_ENC_DATA) +
+      encoded.data_size + strlen(KMYTH_DELIM_END_FILE);
+    formatting_bench_arg block_file = {.data = malloc(block_file_size),
+      .data_size = block_file_size
+    };
+
+    if (block_file.data != NULL)
+    {
+      size_t position = 0;
+
+      memcpy(block_file.data, KMYTH_DELIM_ENC_DATA,
+             strlen(KMYTH_DELIM_ENC_DATA));
+      position += strlen(KMYTH_DELIM_ENC_DATA);
+      memcpy(block_file.data + position, encoded.data, encoded.data_size);
+      position += encoded.data_size;
+      memcpy(block_file.data + position, KMYTH_DELIM_END_FILE,
+             strlen(KMYTH_DELIM_END_FILE));
+
+      retval |= kmyth_bench_run("formatting", "get_block_bytes",
+                                encoded.data_size, bench_get_block_bytes,
+                                &block_file);
+      retval |= kmyth_bench_run("formatting", "get_block_view",
+                                encoded.data_size, bench_get_block_view,
+                                &block_file);
+    }
+    else
+    {
+      retval = 1;
+    }
+    free(block_file.data);
+    free(encoded.data);
+  }
+
+  free(data);
+  return retval;
+}
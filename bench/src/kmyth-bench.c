@@ -0,0 +1,279 @@
+/**
+ * @file  kmyth-bench.c
+ *
+ * Top-level application to run the kmyth benchmarks, writing the results
+ * as a JSON document. Incorporates the following benchmark groups:
+ *   - Cipher (benchmarks in cipher_bench.c)
+ *   - Formatting (benchmarks in formatting_bench.c)
+ *   - Marshalling (benchmarks in marshalling_bench.c)
+ *   - NSL (benchmarks in nsl_bench.c)
+ *   - Seal/Unseal, only run with --tpm (benchmarks in seal_unseal_bench.c)
+ *   - TCTI, only run with --tpm (benchmarks in tcti_bench.c)
+ *   - Startup, only run with --startup (benchmarks in startup_bench.c)
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/opensslv.h>
+
+#include "alloc_stats.h"
+#include "defines.h"
+#include "kmyth_bench.h"
+#include "kmyth_log.h"
+
+// a timed batch of calls is grown until it takes at least this long, so
+// that the clock overhead is negligible for fast operations
+#define KMYTH_BENCH_MIN_BATCH_NS 1000000.0
+
+// every benchmark is timed over at least this many batches
+#define KMYTH_BENCH_MIN_BATCHES 3
+
+// maximum number of TCTI configurations compared by the TCTI benchmarks
+#define KMYTH_BENCH_MAX_TCTIS 16
+
+static double min_time = 0.5;
+static const char *filter = NULL;
+static FILE *out = NULL;
+static size_t result_count = 0;
+
+//############################################################################
+// now_ns()
+//############################################################################
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+//############################################################################
+// kmyth_bench_run()
+//############################################################################
+int kmyth_bench_run(const char *group, const char *name, size_t bytes,
+                    kmyth_bench_fn fn, void *arg)
+{
+  if (filter != NULL && strstr(group, filter) == NULL &&
+      strstr(name, filter) == NULL)
+  {
+    return 0;
+  }
+
+  // an untimed call first, to warm up caches and any lazy initialization
+  // (its heap use is what an instrumented build reports)
+  kmyth_alloc_stats alloc_start;
+  kmyth_alloc_stats alloc_end;
+
+  kmyth_alloc_stats_reset_peak();
+  kmyth_alloc_stats_get(&alloc_start);
+
+  int retval = fn(arg);
+
+  kmyth_alloc_stats_get(&alloc_end);
+
+  double total_ns = 0;
+  double best_ns = 0;
+  size_t iterations = 0;
+  size_t batches = 0;
+  size_t batch = 1;
+
+  while (retval == 0 &&
+         (total_ns < min_time * 1e9 || batches < KMYTH_BENCH_MIN_BATCHES))
+  {
+    double start = now_ns();
+
+    for (size_t i = 0; i < batch && retval == 0; i++)
+    {
+      retval = fn(arg);
+    }
+
+    double elapsed = now_ns() - start;
+
+    if (batches == 0 || elapsed / (double) batch < best_ns)
+    {
+      best_ns = elapsed / (double) batch;
+    }
+    total_ns += elapsed;
+    iterations += batch;
+    batches++;
+    if (elapsed < KMYTH_BENCH_MIN_BATCH_NS)
+    {
+      batch *= 2;
+    }
+  }
+
+  double mean_ns = (iterations > 0) ? total_ns / (double) iterations : 0;
+
+  fprintf(out, "%s\n    {\"group\": \"%s\", \"name\": \"%s\", "
+          "\"bytes\": %zu, \"status\": \"%s\", \"iterations\": %zu, "
+          "\"mean_ns\": %.1f, \"min_ns\": %.1f",
+          (result_count > 0) ? "," : "", group, name, bytes,
+          (retval == 0) ? "ok" : "error", iterations, mean_ns, best_ns);
+  if (bytes > 0 && retval == 0)
+  {
+    fprintf(out, ", \"mb_per_s\": %.2f", (double) bytes * 1e3 / mean_ns);
+  }
+  if (kmyth_alloc_stats_enabled())
+  {
+    fprintf(out, ", \"allocs\": %lu, \"alloc_bytes\": %lu, "
+            "\"peak_bytes\": %ld",
+            (unsigned long) (alloc_end.allocs - alloc_start.allocs),
+            (unsigned long) (alloc_end.bytes - alloc_start.bytes),
+            (long) (alloc_end.peak - alloc_start.current));
+  }
+  fprintf(out, "}");
+  fflush(out);
+  result_count++;
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "benchmark %s/%s failed", group, name);
+    return 1;
+  }
+
+  return 0;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are: \n\n"
+          " -s or --min_time   Minimum time, in seconds, to spend timing each benchmark. Defaults to 0.5.\n"
+          " -f or --filter     Only run benchmarks whose group or name contains this string.\n"
+          " -o or --output     Path to write the JSON results to. Defaults to stdout.\n"
+          " -T or --tpm        Also run the end-to-end seal/unseal and TCTI benchmarks (requires a\n"
+          "                    TPM 2.0, normally the simulator).\n"
+          " -t or --tcti       TCTI configuration (e.g., device:/dev/tpmrm0) to compare in the TCTI\n"
+          "                    benchmarks. May be repeated. Defaults to tabrmd, device, mssim, and\n"
+          "                    swtpm (those unavailable are skipped).\n"
+          " -S or --startup    Also run the process startup benchmarks, comparing the separate\n"
+          "                    applications with the multi-call kmyth executable.\n"
+          " -B or --bin_dir    Directory containing the executables for the startup benchmarks.\n"
+          "                    Defaults to bin.\n"
+          " -v or --verbose    Enable detailed logging.\n"
+          " -h or --help       Help (displays this usage).\n", prog);
+}
+
+static const struct option longopts[] = {
+  {"min_time", required_argument, 0, 's'},
+  {"filter", required_argument, 0, 'f'},
+  {"output", required_argument, 0, 'o'},
+  {"tpm", no_argument, 0, 'T'},
+  {"tcti", required_argument, 0, 't'},
+  {"startup", no_argument, 0, 'S'},
+  {"bin_dir", required_argument, 0, 'B'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+int main(int argc, char **argv)
+{
+  // Configure logging messages (only errors, unless verbose)
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+  set_applog_severity_threshold(LOG_ERR);
+
+  char *outPath = NULL;
+  bool runTpm = false;
+  bool runStartup = false;
+  char *binDir = "bin";
+  const char *tctiConfs[KMYTH_BENCH_MAX_TCTIS];
+  size_t tctiCount = 0;
+  char *end = NULL;
+
+  int options;
+  int option_index;
+
+  while ((options =
+          getopt_long(argc, argv, "s:f:o:Tt:SB:vh", longopts,
+                      &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 's':
+      min_time = strtod(optarg, &end);
+      if (end == optarg || *end != '\0' || min_time <= 0)
+      {
+        kmyth_log(LOG_ERR, "invalid minimum time (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'f':
+      filter = optarg;
+      break;
+    case 'o':
+      outPath = optarg;
+      break;
+    case 'T':
+      runTpm = true;
+      break;
+    case 't':
+      if (tctiCount == KMYTH_BENCH_MAX_TCTIS)
+      {
+        kmyth_log(LOG_ERR, "too many TCTI configurations (max %d) ... exiting",
+                  KMYTH_BENCH_MAX_TCTIS);
+        return 1;
+      }
+      tctiConfs[tctiCount++] = optarg;
+      break;
+    case 'S':
+      runStartup = true;
+      break;
+    case 'B':
+      binDir = optarg;
+      break;
+    case 'v':
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  out = stdout;
+  if (outPath != NULL && (out = fopen(outPath, "w")) == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open file: %s ... exiting", outPath);
+    return 1;
+  }
+
+  fprintf(out, "{\n  \"kmyth_version\": \"%s\",\n  \"openssl_version\": "
+          "\"%s\",\n  \"min_time_s\": %.3f,\n  \"results\": [",
+          KMYTH_VERSION, OPENSSL_VERSION_TEXT, min_time);
+
+  int retval = 0;
+
+  retval |= cipher_bench();
+  retval |= formatting_bench();
+  retval |= marshalling_bench();
+  retval |= nsl_bench();
+  if (runTpm)
+  {
+    retval |= seal_unseal_bench();
+    retval |= tcti_bench(tctiConfs, tctiCount);
+  }
+  if (runStartup)
+  {
+    retval |= startup_bench(binDir);
+  }
+
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout)
+  {
+    fclose(out);
+  }
+
+  return retval;
+}
@@ -0,0 +1,159 @@
+//############################################################################
+// marshalling_bench.c
+//
+// Benchmarks for kmyth .ski creation/parsing in src/tpm/marshalling_tools.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/rand.h>
+
+#include "kmyth_bench.h"
+#include "tpm/marshalling_tools.h"
+
+// everything preceding the encrypted data of a (valid) .ski file
+static const char *ski_header =
+  "-----PCR SELECTION LIST-----\n"
+  "AAAAAQALAwAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\n"
+  "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\n"
+  "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\n"
+  "-----STORAGE KEY PUBLIC-----\n"
+  "AToAAQALAAMAcgAgcnAGdT2tfu/ZnZHE4WPOMJSz3gJgW40hgL+QrfFxCYsABgCA\n"
+  "AEMAEAgAAAAAAAEArdcEDo+56w/VbgFyKes4ckyuenee13iZ8v1XKgdqPdtwST4m\n"
+  "Hj9wfrHBxqjkGHX7TFb7uxsRCB6sMoRAyWptkoiOFa0HtD3M3ba7OytC32z4hGoM\n"
+  "nZOR4+vYSWl7fpddPcJKmCAXGCYgKsyDk+DbZPspsTWqCwmNaxuJz2Hp4t1wMnqW\n"
+  "5VB+hA0Wd2/+alM0RMDHMZwGYlq92V227bL0H9iQGMu76xnmLY8U2fqYSC+OOw0n\n"
+  "8zOMxAMLnRz6A5cOjgDFWkEDIk2qxBD4TBssBXIrlaEWFNFQW9pcIt/mJV7/81lr\n"
+  "XJb4L9ZUt3yXy4ONZKg4aW3kfmJQtNthrX7VjQ==\n"
+  "-----STORAGE KEY ENC PRIVATE-----\n"
+  "AP4AIFBZmN3PX8YZNyWYKAJnfPf5QtXMPmXrzExLKot8uh9KABDZW0vb/GLwMj4x\n"
+  "YrRRF3YBQHmTcy5sc7CfvaqKNiyWcFO1s/uRUDF7WDQrlHHUKaNHXUyoPuFsmR/w\n"
+  "p5P6nSWcc/IBTQ24uUVHTqhDcxAgR51PfXefpiyP5oUeG6eOacTAjyuIUufALRdT\n"
+  "IvKmfGRW8ubGIn3W1U/lGs/pi7eOTaSYFBbQrnw9y9VEqEo0IVJgWUmUJ6yF4Gdh\n"
+  "squWofLQ9MBFzrCo3ErrWYtUJjRh0zKPSQKsQXHFyT7caY/Kr6kH61KzY6GR8lgR\n"
+  "qKENvBDt+93KHiPutl59sg==\n"
+  "-----CIPHER SUITE-----\n"
+  "AES/GCM/NoPadding/256\n"
+  "-----SYM KEY PUBLIC-----\n"
+  "AE4ACAALAAAAUgAgcnAGdT2tfu/ZnZHE4WPOMJSz3gJgW40hgL+QrfFxCYsAEAAg\n"
+  "2Q6eibPyxc2Mdz1bwauQJPy8bMWVCUEb1j5ji+I1BHw=\n"
+  "-----SYM KEY ENC PRIVATE-----\n"
+  "AJ4AIOy/btaxKHMDW9wUvCSiKRuBPoVm5E1BL4JSui8L1FKvABBDuE3PdIHsD5Wy\n"
+  "Zay95le0ytJu+Wf9ACc1WBUMtzRZikYUFHrlw+ujJU70gbOrmq6OD0XwVlwfjA+/\n"
+  "AkbYa8d1Mhs1Dxqxp0gnpNPCwFGt0SCipy8WtcdwXlFbZNrBO+Zqw9SbzMGnZGMi\n"
+  "lYUkqJ/V5ZBlLek/ufMxMg==\n"
+  "-----ENC DATA-----\n";
+
+// The input of one benchmarked operation
+typedef struct
+{
+  Ski ski;
+  uint8_t *ski_bytes;
+  size_t ski_bytes_len;
+} marshalling_bench_arg;
+
+//############################################################################
+// bench_create_ski_bytes()
+//############################################################################
+static int bench_create_ski_bytes(void *arg)
+{
+  marshalling_bench_arg *a = (marshalling_bench_arg *) arg;
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  if (create_ski_bytes(a->ski, &output, &output_len))
+  {
+    return 1;
+  }
+  free(output);
+
+  return 0;
+}
+
+//############################################################################
+// bench_create_ski_binary_bytes()
+//############################################################################
+static int bench_create_ski_binary_bytes(void *arg)
+{
+  marshalling_bench_arg *a = (marshalling_bench_arg *) arg;
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  if (create_ski_binary_bytes(a->ski, &output, &output_len))
+  {
+    return 1;
+  }
+  free(output);
+
+  return 0;
+}
+
+//############################################################################
+// bench_parse_ski_bytes()
+//############################################################################
+static int bench_parse_ski_bytes(void *arg)
+{
+  marshalling_bench_arg *a = (marshalling_bench_arg *) arg;
+  Ski ski = get_default_ski();
+
+  if (parse_ski_bytes(a->ski_bytes, a->ski_bytes_len, &ski, 0))
+  {
+    return 1;
+  }
+  free_ski(&ski);
+
+  return 0;
+}
+
+//############################################################################
+// marshalling_bench()
+//############################################################################
+int marshalling_bench(void)
+{
+  size_t sizes[] = { 64, 4096, 1024 * 1024 };
+  int retval = 0;
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+  {
+    marshalling_bench_arg text = {.ski = get_default_ski() };
+    marshalling_bench_arg binary = { 0 };
+
+    // a .ski holding (random) encrypted data of the benchmarked size
+    if (parse_ski_header_bytes((uint8_t *) ski_header, strlen(ski_header),
+                               &text.ski, 0))
+    {
+      return 1;
+    }
+    text.ski.enc_data = malloc(sizes[s]);
+    text.ski.enc_data_size = sizes[s];
+    if (text.ski.enc_data == NULL ||
+        RAND_bytes(text.ski.enc_data, (int) sizes[s]) != 1 ||
+        create_ski_bytes(text.ski, &text.ski_bytes, &text.ski_bytes_len) ||
+        create_ski_binary_bytes(text.ski, &binary.ski_bytes,
+                                &binary.ski_bytes_len))
+    {
+      free(text.ski_bytes);
+      free_ski(&text.ski);
+      return 1;
+    }
+    binary.ski = text.ski;
+
+    retval |= kmyth_bench_run("marshalling", "create_ski_bytes", sizes[s],
+                              bench_create_ski_bytes, &text);
+    retval |= kmyth_bench_run("marshalling", "parse_ski_bytes", sizes[s],
+                              bench_parse_ski_bytes, &text);
+    retval |= kmyth_bench_run("marshalling", "create_ski_binary_bytes",
+                              sizes[s], bench_create_ski_binary_bytes,
+                              &binary);
+    retval |= kmyth_bench_run("marshalling", "parse_ski_binary_bytes",
+                              sizes[s], bench_parse_ski_bytes, &binary);
+
+    free(text.ski_bytes);
+    free(binary.ski_bytes);
+    free_ski(&text.ski);
+  }
+
+  return retval;
+}
@@ -0,0 +1,131 @@
+//############################################################################
+// seal_unseal_bench.c
+//
+// End-to-end benchmarks for kmyth seal/unseal in
+// src/tpm/kmyth_seal_unseal_impl.c (requires a TPM 2.0)
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/rand.h>
+
+#include "kmyth_bench.h"
+#include "kmyth.h"
+
+// The input of one benchmarked operation (ctx is NULL for the one-shot
+// calls, which set up their own TPM connection)
+typedef struct
+{
+  kmyth_ctx_t *ctx;
+  uint8_t *data;
+  size_t data_size;
+} seal_unseal_bench_arg;
+
+//############################################################################
+// bench_seal()
+//############################################################################
+static int bench_seal(void *arg)
+{
+  seal_unseal_bench_arg *a = (seal_unseal_bench_arg *) arg;
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+  int retval;
+
+  if (a->ctx == NULL)
+  {
+    retval = tpm2_kmyth_seal(a->data, a->data_size, &output, &output_len,
+                             NULL, 0, NULL, 0, NULL, 0, NULL, NULL, 0);
+  }
+  else
+  {
+    retval = tpm2_kmyth_seal_ctx(a->ctx, a->data, a->data_size, &output,
+                                 &output_len, NULL, 0, NULL, 0, NULL, 0,
+                                 NULL, NULL, 0);
+  }
+  free(output);
+
+  return retval;
+}
+
+//############################################################################
+// bench_unseal()
+//############################################################################
+static int bench_unseal(void *arg)
+{
+  seal_unseal_bench_arg *a = (seal_unseal_bench_arg *) arg;
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+  int retval;
+
+  if (a->ctx == NULL)
+  {
+    retval = tpm2_kmyth_unseal(a->data, a->data_size, &output, &output_len,
+                               NULL, 0, NULL, 0, 0);
+  }
+  else
+  {
+    retval = tpm2_kmyth_unseal_ctx(a->ctx, a->data, a->data_size, &output,
+                                   &output_len, NULL, 0, NULL, 0, 0);
+  }
+  free(output);
+
+  return retval;
+}
+
+//############################################################################
+// seal_unseal_bench()
+//############################################################################
+int seal_unseal_bench(void)
+{
+  size_t sizes[] = { 64, 1024 * 1024 };
+  size_t max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+  uint8_t *data = malloc(max_size);
+  kmyth_ctx_t *ctx = NULL;
+  int retval = 0;
+
+  if (data == NULL || RAND_bytes(data, (int) max_size) != 1 ||
+      kmyth_ctx_create(&ctx))
+  {
+    free(data);
+    return 1;
+  }
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+  {
+    seal_unseal_bench_arg raw = {.data = data,.data_size = sizes[s] };
+    seal_unseal_bench_arg sealed = { 0 };
+
+    retval |= kmyth_bench_run("seal_unseal", "seal", sizes[s], bench_seal,
+                              &raw);
+    raw.ctx = ctx;
+    retval |= kmyth_bench_run("seal_unseal", "seal_ctx", sizes[s],
+                              bench_seal, &raw);
+
+    // storage key loaded from the context's pool instead of created
+    retval |= kmyth_ctx_set_sk_pool(ctx, 1);
+    retval |= kmyth_bench_run("seal_unseal", "seal_ctx_sk_pool", sizes[s],
+                              bench_seal, &raw);
+    retval |= kmyth_ctx_set_sk_pool(ctx, 0);
+
+    // unseal the same .ski, sealed once up front
+    if (tpm2_kmyth_seal_ctx(ctx, data, sizes[s], &sealed.data,
+                            &sealed.data_size, NULL, 0, NULL, 0, NULL, 0,
+                            NULL, NULL, 0))
+    {
+      retval = 1;
+      continue;
+    }
+    retval |= kmyth_bench_run("seal_unseal", "unseal", sizes[s],
+                              bench_unseal, &sealed);
+    sealed.ctx = ctx;
+    retval |= kmyth_bench_run("seal_unseal", "unseal_ctx", sizes[s],
+                              bench_unseal, &sealed);
+    free(sealed.data);
+  }
+
+  kmyth_ctx_destroy(&ctx);
+  free(data);
+  return retval;
+}
@@ -0,0 +1,121 @@
+//############################################################################
+// startup_bench.c
+//
+// Process startup benchmarks for the kmyth applications, comparing each
+// separate executable (which loads the libkmyth-*.so shared libraries) with
+// the multi-call kmyth executable (which links them statically)
+//############################################################################
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "kmyth_bench.h"
+#include "kmyth_log.h"
+
+extern char **environ;
+
+// The applications built into the multi-call executable
+static const char *startup_apps[] = {
+  "kmyth-seal",
+  "kmyth-unseal",
+  "kmyth-reseal",
+  "kmyth-getkey",
+};
+
+// The process started by one benchmarked operation
+typedef struct
+{
+  char path[256];
+  char *argv0;
+  posix_spawn_file_actions_t *actions;
+} startup_bench_arg;
+
+//############################################################################
+// bench_spawn()
+//############################################################################
+static int bench_spawn(void *arg)
+{
+  startup_bench_arg *a = (startup_bench_arg *) arg;
+
+  // run without arguments, each application only prints its usage, so the
+  // time is that of starting (loading, relocating and initializing) it
+  char *argv[] = { a->argv0, NULL };
+  pid_t pid;
+  int status = 0;
+
+  if (posix_spawn(&pid, a->path, a->actions, NULL, argv, environ) != 0)
+  {
+    return 1;
+  }
+  if (waitpid(pid, &status, 0) != pid)
+  {
+    return 1;
+  }
+
+  return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : 1;
+}
+
+//############################################################################
+// startup_bench()
+//############################################################################
+int startup_bench(const char *bin_dir)
+{
+  posix_spawn_file_actions_t actions;
+
+  // the usage output is discarded
+  if (posix_spawn_file_actions_init(&actions) != 0)
+  {
+    return 1;
+  }
+  if (posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                       O_WRONLY, 0) != 0 ||
+      posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO,
+                                       STDERR_FILENO) != 0)
+  {
+    posix_spawn_file_actions_destroy(&actions);
+    return 1;
+  }
+
+  int retval = 0;
+
+  for (size_t i = 0; i < sizeof(startup_apps) / sizeof(startup_apps[0]); i++)
+  {
+    startup_bench_arg separate = {.argv0 = (char *) startup_apps[i],
+      .actions = &actions
+    };
+    startup_bench_arg multicall = separate;
+    char name[64];
+
+    snprintf(separate.path, sizeof(separate.path), "%s/%s", bin_dir,
+             startup_apps[i]);
+    snprintf(multicall.path, sizeof(multicall.path), "%s/kmyth", bin_dir);
+
+    // applications that have not been built are skipped
+    if (access(separate.path, X_OK) == 0)
+    {
+      snprintf(name, sizeof(name), "separate/%s", startup_apps[i]);
+      retval |= kmyth_bench_run("startup", name, 0, bench_spawn, &separate);
+    }
+    else
+    {
+      kmyth_log(LOG_WARNING, "%s not built, skipping", separate.path);
+    }
+
+    // the multi-call executable runs the application it is started as
+    if (access(multicall.path, X_OK) == 0)
+    {
+      snprintf(name, sizeof(name), "multicall/%s", startup_apps[i]);
+      retval |= kmyth_bench_run("startup", name, 0, bench_spawn, &multicall);
+    }
+    else
+    {
+      kmyth_log(LOG_WARNING, "%s not built, skipping", multicall.path);
+    }
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+  return retval;
+}
@@ -0,0 +1,90 @@
+//############################################################################
+// tcti_bench.c
+//
+// Per-command latency benchmarks for each TPM 2.0 TCTI backend selectable
+// with init_tcti() in src/tpm/tpm2_interface.c (requires a TPM 2.0)
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <tss2/tss2_sys.h>
+
+#include "kmyth_bench.h"
+#include "kmyth_log.h"
+#include "tpm2_interface.h"
+
+// TCTI configurations benchmarked if none are given on the command line
+static const char *default_tcti_confs[] = {
+  "tabrmd",
+  "device",
+  "mssim",
+  "swtpm",
+};
+
+//############################################################################
+// bench_connect()
+//############################################################################
+static int bench_connect(void *arg)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  if (init_tpm2_connection_tcti(&sapi_ctx, (const char *) arg))
+  {
+    return 1;
+  }
+
+  return free_tpm2_resources(&sapi_ctx);
+}
+
+//############################################################################
+// bench_get_random()
+//############################################################################
+static int bench_get_random(void *arg)
+{
+  // GetRandom does almost no work in the TPM, so it times the round trip
+  // through the TCTI (and any broker or kernel resource manager behind it)
+  TPM2B_DIGEST randomBytes = {.size = 0, };
+  TSS2_RC rc = Tss2_Sys_GetRandom((TSS2_SYS_CONTEXT *) arg, NULL, 8,
+                                  &randomBytes, NULL);
+
+  return (rc == TSS2_RC_SUCCESS) ? 0 : 1;
+}
+
+//############################################################################
+// tcti_bench()
+//############################################################################
+int tcti_bench(const char **tcti_confs, size_t tcti_count)
+{
+  if (tcti_count == 0)
+  {
+    tcti_confs = default_tcti_confs;
+    tcti_count = sizeof(default_tcti_confs) / sizeof(default_tcti_confs[0]);
+  }
+
+  int retval = 0;
+
+  for (size_t i = 0; i < tcti_count; i++)
+  {
+    TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+    // backends that are not available on this host are skipped
+    if (init_tpm2_connection_tcti(&sapi_ctx, tcti_confs[i]))
+    {
+      kmyth_log(LOG_WARNING, "TCTI %s unavailable, skipping", tcti_confs[i]);
+      continue;
+    }
+
+    char name[128];
+
+    snprintf(name, sizeof(name), "get_random_%s", tcti_confs[i]);
+    retval |= kmyth_bench_run("tcti", name, 0, bench_get_random, sapi_ctx);
+    free_tpm2_resources(&sapi_ctx);
+
+    snprintf(name, sizeof(name), "connect_%s", tcti_confs[i]);
+    retval |= kmyth_bench_run("tcti", name, 0, bench_connect,
+                              (void *) tcti_confs[i]);
+  }
+
+  return retval;
+}
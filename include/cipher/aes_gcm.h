@@ -6,6 +6,7 @@
 #ifndef AES_GCM_H
 #define AES_GCM_H
 
+#include <stdbool.h>
 #include <stdlib.h>
 
 /// Length of the AES/GCM tag.
@@ -84,4 +85,233 @@ int aes_gcm_decrypt(unsigned char *key,
                     size_t inData_len, unsigned char **outData,
                     size_t * outData_len);
 
+/**
+ * @brief Encrypts data with AES-GCM, as aes_gcm_encrypt() does, but into a
+ *        caller supplied buffer (see the cipher_buf declaration in
+ *        cipher.h).
+ *
+ * @param[in]  key          The hex bytes containing the key -
+ *                          pass in pointer to key buffer
+ *
+ * @param[in]  key_len      The length of the key in bytes
+ *                          (must be 16, 24, or 32)
+ *
+ * @param[in]  inData       The plaintext data to be encrypted
+ *
+ * @param[in]  inData_len   The length, in bytes, of the plaintext data
+ *
+ * @param[out] outData      Output buffer for IV||ciphertext||tag, which needs
+ *                          GCM_IV_LEN + inData_len + GCM_TAG_LEN bytes, or
+ *                          NULL to only query that size
+ *
+ * @param[in]  outData_size The size, in bytes, of the outData buffer
+ *
+ * @param[out] outData_len  The length in bytes of the output (or the size
+ *                          required) - pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_encrypt_buf(unsigned char *key,
+                        size_t key_len,
+                        unsigned char *inData, size_t inData_len,
+                        unsigned char *outData, size_t outData_size,
+                        size_t * outData_len);
+
+/**
+ * @brief Decrypts data with AES-GCM, as aes_gcm_decrypt() does, but into a
+ *        caller supplied buffer (see the cipher_buf declaration in
+ *        cipher.h).
+ *
+ * @param[in]  key          The hex bytes containing the key -
+ *                          pass in pointer to key buffer
+ *
+ * @param[in]  key_len      The length of the key in bytes
+ *                          (must be 16, 24, or 32)
+ *
+ * @param[in]  inData       The IV, ciphertext, and tag,
+ *                          formatted IV||ciphertext||tag
+ *
+ * @param[in]  inData_len   The length in bytes of inData
+ *
+ * @param[out] outData      Output buffer for the plaintext, which needs
+ *                          inData_len - (GCM_IV_LEN + GCM_TAG_LEN) bytes, or
+ *                          NULL to only query that size (cleared if the tag
+ *                          does not verify)
+ *
+ * @param[in]  outData_size The size, in bytes, of the outData buffer
+ *
+ * @param[out] outData_len  The length in bytes of the output (or the size
+ *                          required) - pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error (including a tag mismatch)
+ */
+int aes_gcm_decrypt_buf(unsigned char *key,
+                        size_t key_len,
+                        unsigned char *inData, size_t inData_len,
+                        unsigned char *outData, size_t outData_size,
+                        size_t * outData_len);
+
+/**
+ * @brief Decrypts data with AES-GCM, as aes_gcm_decrypt() does, but in place
+ *        (see the cipher_in_place declaration in cipher.h): the plaintext
+ *        overwrites the start of the input buffer.
+ *
+ * @param[in]  key           The hex bytes containing the key -
+ *                           pass in pointer to key buffer
+ *
+ * @param[in]  key_len       The length of the key in bytes
+ *                           (must be 16, 24, or 32)
+ *
+ * @param[in,out] data       The IV, ciphertext, and tag, formatted
+ *                           IV||ciphertext||tag, overwritten by the
+ *                           plaintext (cleared if the tag does not verify)
+ *
+ * @param[in]  data_len      The length in bytes of data
+ *
+ * @param[out] plaintext_len The length in bytes of the plaintext
+ *                           (data_len - (GCM_IV_LEN + GCM_TAG_LEN)) -
+ *                           pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error (including a tag mismatch)
+ */
+int aes_gcm_decrypt_in_place(unsigned char *key,
+                             size_t key_len,
+                             unsigned char *data, size_t data_len,
+                             size_t * plaintext_len);
+
+/**
+ * @brief Sets up an incremental (streaming) AES-GCM encryption or decryption.
+ *
+ * The stream has the same IV||data||tag form as the aes_gcm_encrypt()
+ * output. When encrypting, the IV is generated here and emitted ahead of
+ * the first ciphertext bytes, and the tag is emitted by
+ * aes_gcm_stream_final(). When decrypting, the IV is taken from the start
+ * of the stream and its last GCM_TAG_LEN bytes are held back so that they
+ * can be verified as the tag by aes_gcm_stream_final().
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  encrypt     true to encrypt, false to decrypt
+ *
+ * @param[out] state       The streaming state -
+ *                         passed as pointer to the state pointer
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_init(unsigned char *key,
+                        size_t key_len, bool encrypt, void **state);
+
+/**
+ * @brief Processes the next chunk of an AES-GCM stream.
+ *
+ * @param[in]  state       The streaming state from aes_gcm_stream_init()
+ *
+ * @param[in]  inData      The next chunk of input data
+ *
+ * @param[in]  inData_len  The length, in bytes, of the chunk
+ *                         (must not exceed INT_MAX)
+ *
+ * @param[out] outData     Output buffer of at least
+ *                         inData_len + GCM_IV_LEN bytes
+ *
+ * @param[out] outData_len The number of bytes written to outData -
+ *                         pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_stream_update(void *state,
+                          unsigned char *inData,
+                          size_t inData_len,
+                          unsigned char *outData, size_t * outData_len);
+
+/**
+ * @brief Completes an AES-GCM stream, writing (encryption) or verifying
+ *        (decryption) the tag, and releases the streaming state.
+ *
+ * @param[in]  state       The streaming state from aes_gcm_stream_init()
+ *
+ * @param[out] outData     Output buffer of at least GCM_IV_LEN + GCM_TAG_LEN
+ *                         bytes (the IV is emitted here if no data was
+ *                         ever passed to aes_gcm_stream_update())
+ *
+ * @param[out] outData_len The number of bytes written to outData -
+ *                         pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error (including a tag mismatch)
+ */
+int aes_gcm_stream_final(void *state,
+                         unsigned char *outData, size_t * outData_len);
+
+/**
+ * @brief Encrypts one separately authenticated chunk of a larger data set
+ *        with AES-GCM, into a caller supplied buffer.
+ *
+ * The output has the same IV||data||tag form as the aes_gcm_encrypt()
+ * output. The additional authenticated data (e.g., the chunk's position
+ * within the data set) is not included in the output, but must be
+ * presented unchanged to aes_gcm_decrypt_chunk().
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  aad         The additional authenticated data
+ *
+ * @param[in]  aad_len     The length, in bytes, of the additional
+ *                         authenticated data
+ *
+ * @param[in]  inData      The plaintext chunk to be encrypted
+ *
+ * @param[in]  inData_len  The length, in bytes, of the plaintext chunk
+ *
+ * @param[out] outData     Output buffer of at least
+ *                         GCM_IV_LEN + inData_len + GCM_TAG_LEN bytes
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_gcm_encrypt_chunk(unsigned char *key,
+                          size_t key_len,
+                          unsigned char *aad, size_t aad_len,
+                          unsigned char *inData, size_t inData_len,
+                          unsigned char *outData);
+
+/**
+ * @brief Decrypts (and verifies) one chunk produced by
+ *        aes_gcm_encrypt_chunk(), into a caller supplied buffer.
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  aad         The additional authenticated data the chunk
+ *                         was encrypted with
+ *
+ * @param[in]  aad_len     The length, in bytes, of the additional
+ *                         authenticated data
+ *
+ * @param[in]  inData      The IV, ciphertext, and tag,
+ *                         formatted IV||ciphertext||tag
+ *
+ * @param[in]  inData_len  The length in bytes of inData
+ *
+ * @param[out] outData     Output buffer of at least
+ *                         inData_len - (GCM_IV_LEN + GCM_TAG_LEN) bytes
+ *                         (cleared if the tag does not verify)
+ *
+ * @return 0 on success, 1 on error (including a tag mismatch)
+ */
+int aes_gcm_decrypt_chunk(unsigned char *key,
+                          size_t key_len,
+                          unsigned char *aad, size_t aad_len,
+                          unsigned char *inData, size_t inData_len,
+                          unsigned char *outData);
+
 #endif
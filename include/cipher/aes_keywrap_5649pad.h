@@ -70,4 +70,136 @@ int aes_keywrap_5649pad_decrypt(unsigned char *key,
                                 size_t inData_len, unsigned char **outData,
                                 size_t * outData_len);
 
+/**
+ * @brief Performs AES key wrap with padding (RFC 5649), as aes_keywrap_5649pad_encrypt() does,
+ *        but into a caller supplied buffer (see the cipher_buf declaration
+ *        in cipher.h).
+ *
+ * @param[in]  key          The hex bytes containing the key -
+ *                          pass in pointer to key value
+ *
+ * @param[in]  key_len      The length (in bytes) of the AES key
+ *                          (must be 16, 24, or 32)
+ *
+ * @param[in]  inData       The plaintext data to be wrapped
+ *
+ * @param[in]  inData_len   The length of the plaintext data in bytes
+ *
+ * @param[out] outData      Output ciphertext buffer, which needs inData_len
+ *                          (rounded up to a multiple of eight) plus 8
+ *                          bytes, or NULL to only query that size
+ *
+ * @param[in]  outData_size The size, in bytes, of the outData buffer
+ *
+ * @param[out] outData_len  The length of the output ciphertext (or the size
+ *                          required) - pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_keywrap_5649pad_encrypt_buf(unsigned char *key,
+                                    size_t key_len,
+                                    unsigned char *inData,
+                                    size_t inData_len,
+                                    unsigned char *outData,
+                                    size_t outData_size, size_t * outData_len);
+
+/**
+ * @brief Performs AES key unwrap with padding (RFC 5649), as aes_keywrap_5649pad_decrypt()
+ *        does, but into a caller supplied buffer (see the cipher_buf
+ *        declaration in cipher.h).
+ *
+ * @param[in]  key          The hex bytes containing the key -
+ *                          pass in pointer to key value
+ *
+ * @param[in]  key_len      The length (in bytes) of the AES key
+ *                          (must be 16, 24, or 32)
+ *
+ * @param[in]  inData       The encrypted data to be unwrapped
+ *
+ * @param[in]  inData_len   The length of the encrypted data in bytes
+ *
+ * @param[out] outData      Output plaintext buffer, which needs
+ *                          inData_len - 8 bytes (the padding, if any, is
+ *                          not included in the output length), or NULL to
+ *                          only query that size
+ *
+ * @param[in]  outData_size The size, in bytes, of the outData buffer
+ *
+ * @param[out] outData_len  The length of the output plaintext (or the size
+ *                          required) - pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error
+ */
+int aes_keywrap_5649pad_decrypt_buf(unsigned char *key,
+                                    size_t key_len,
+                                    unsigned char *inData,
+                                    size_t inData_len,
+                                    unsigned char *outData,
+                                    size_t outData_size, size_t * outData_len);
+
+/**
+ * @brief Wraps a batch of inputs (e.g., many data keys) under one key, as
+ *        aes_keywrap_5649pad_encrypt() would for each input in turn, but
+ *        setting up the cipher context and key schedule only once.
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key value
+ *
+ * @param[in]  key_len     The length (in bytes) of the AES key
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  count       The number of inputs in the batch
+ *
+ * @param[in]  inData      Array of count plaintext inputs
+ *
+ * @param[in]  inData_len  Array of the lengths, in bytes, of the inputs
+ *
+ * @param[out] outData     Array of count pointers, each set to the wrapped
+ *                         input (allocated here, to be freed by the caller)
+ *
+ * @param[out] outData_len Array of the lengths, in bytes, of the outputs
+ *
+ * @return 0 on success, 1 on error (on error, no output is returned)
+ */
+int aes_keywrap_5649pad_encrypt_batch(unsigned char *key,
+                                      size_t key_len,
+                                      size_t count,
+                                      unsigned char **inData,
+                                      size_t *inData_len,
+                                      unsigned char **outData,
+                                      size_t *outData_len);
+
+/**
+ * @brief Unwraps a batch of inputs wrapped under one key, as
+ *        aes_keywrap_5649pad_decrypt() would for each input in turn, but
+ *        setting up the cipher context and key schedule only once.
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key value
+ *
+ * @param[in]  key_len     The length (in bytes) of the AES key
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  count       The number of inputs in the batch
+ *
+ * @param[in]  inData      Array of count wrapped (ciphertext) inputs
+ *
+ * @param[in]  inData_len  Array of the lengths, in bytes, of the inputs
+ *
+ * @param[out] outData     Array of count pointers, each set to the unwrapped
+ *                         input (allocated here, to be freed by the caller)
+ *
+ * @param[out] outData_len Array of the lengths, in bytes, of the outputs
+ *
+ * @return 0 on success, 1 on error (on error, including any input that
+ *         fails its integrity check, no output is returned)
+ */
+int aes_keywrap_5649pad_decrypt_batch(unsigned char *key,
+                                      size_t key_len,
+                                      size_t count,
+                                      unsigned char **inData,
+                                      size_t *inData_len,
+                                      unsigned char **outData,
+                                      size_t *outData_len);
+
 #endif
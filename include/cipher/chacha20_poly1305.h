@@ -0,0 +1,184 @@
+/**
+ * @file chacha20_poly1305.h
+ *
+ * @brief Provides access to OpenSSL's ChaCha20-Poly1305 implementation for
+ *        kmyth.
+ *
+ * ChaCha20-Poly1305 (RFC 8439) is an AEAD cipher that, unlike AES/GCM, does
+ * not depend on hardware AES support to perform well, so it is the better
+ * choice on hosts (e.g., many ARM boards) without AES instructions.
+ */
+#ifndef CHACHA20_POLY1305_H
+#define CHACHA20_POLY1305_H
+
+#include <stdlib.h>
+
+/// Length of the ChaCha20-Poly1305 tag (fixed at 16 bytes by RFC 8439).
+#define CHACHA20_POLY1305_TAG_LEN 16
+
+/// Length of the nonce (IV) used by ChaCha20-Poly1305 (the 12 byte nonce
+/// specified by RFC 8439).
+#define CHACHA20_POLY1305_IV_LEN 12
+
+/// Length of the ChaCha20-Poly1305 key (the only key length it supports).
+#define CHACHA20_POLY1305_KEY_LEN 32
+
+/**
+ * @brief This function uses the ChaCha20-Poly1305 implementation from
+ *        OpenSSL to encrypt data.
+ *
+ * <pre>
+ * The outData block has the form
+ *    IV||data||tag
+ * where
+ *      the IV is 12 (CHACHA20_POLY1305_IV_LEN) bytes in length and
+ *      the tag is 16 (CHACHA20_POLY1305_TAG_LEN) bytes in length.
+ * </pre>
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes (must be 32)
+ *
+ * @param[in]  inData      The plaintext data to be encrypted -
+ *                         pass in pointer to input plaintext data buffer)
+ *
+ * @param[in]  inData_len  The length, in bytes, of the plaintext data
+ *
+ * @param[out] outData     The output ciphertext (including the IV and tag) -
+ *                         pass in pointer to address of ciphertext buffer
+ *
+ * @param[out] outData_len The length in bytes of outData -
+ *                         pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error
+ */
+int chacha20_poly1305_encrypt(unsigned char *key,
+                              size_t key_len,
+                              unsigned char *inData,
+                              size_t inData_len, unsigned char **outData,
+                              size_t * outData_len);
+
+/**
+ * @brief This function uses the ChaCha20-Poly1305 implementation from
+ *        OpenSSL to decrypt data.
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes (must be 32)
+ *
+ * @param[in]  inData      The IV, ciphertext, and tag,
+ *                         formatted IV||ciphertext||tag -
+ *                         pass in pointer to input values
+ *
+ * @param[in]  inData_len  The length in bytes of the IV, ciphertext and tag
+ *
+ * @param[out] outData     The output plaintext -
+ *                         passed as pointer to address of output buffer
+ *
+ * @param[out] outData_len The length in bytes of outData
+ *                         passed as pointer to length value
+ *
+ * @return 0 on success, 1 on error
+ */
+int chacha20_poly1305_decrypt(unsigned char *key,
+                              size_t key_len,
+                              unsigned char *inData,
+                              size_t inData_len, unsigned char **outData,
+                              size_t * outData_len);
+
+/**
+ * @brief Encrypts data with ChaCha20-Poly1305, as
+ *        chacha20_poly1305_encrypt() does, but into a caller supplied
+ *        buffer (see the cipher_buf declaration in cipher.h).
+ *
+ * @param[in]  key          The hex bytes containing the key -
+ *                          pass in pointer to key buffer
+ *
+ * @param[in]  key_len      The length of the key in bytes (must be 32)
+ *
+ * @param[in]  inData       The plaintext data to be encrypted
+ *
+ * @param[in]  inData_len   The length, in bytes, of the plaintext data
+ *
+ * @param[out] outData      Output buffer for IV||ciphertext||tag, which needs
+ *                          CHACHA20_POLY1305_IV_LEN + inData_len +
+ *                          CHACHA20_POLY1305_TAG_LEN bytes, or NULL to only
+ *                          query that size
+ *
+ * @param[in]  outData_size The size, in bytes, of the outData buffer
+ *
+ * @param[out] outData_len  The length in bytes of the output (or the size
+ *                          required) - pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error
+ */
+int chacha20_poly1305_encrypt_buf(unsigned char *key,
+                                  size_t key_len,
+                                  unsigned char *inData, size_t inData_len,
+                                  unsigned char *outData, size_t outData_size,
+                                  size_t * outData_len);
+
+/**
+ * @brief Decrypts data with ChaCha20-Poly1305, as
+ *        chacha20_poly1305_decrypt() does, but into a caller supplied
+ *        buffer (see the cipher_buf declaration in cipher.h).
+ *
+ * @param[in]  key          The hex bytes containing the key -
+ *                          pass in pointer to key buffer
+ *
+ * @param[in]  key_len      The length of the key in bytes (must be 32)
+ *
+ * @param[in]  inData       The IV, ciphertext, and tag,
+ *                          formatted IV||ciphertext||tag
+ *
+ * @param[in]  inData_len   The length in bytes of inData
+ *
+ * @param[out] outData      Output buffer for the plaintext, which needs
+ *                          inData_len - (CHACHA20_POLY1305_IV_LEN +
+ *                          CHACHA20_POLY1305_TAG_LEN) bytes, or NULL to only
+ *                          query that size (cleared if the tag does not
+ *                          verify)
+ *
+ * @param[in]  outData_size The size, in bytes, of the outData buffer
+ *
+ * @param[out] outData_len  The length in bytes of the output (or the size
+ *                          required) - pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error (including a tag mismatch)
+ */
+int chacha20_poly1305_decrypt_buf(unsigned char *key,
+                                  size_t key_len,
+                                  unsigned char *inData, size_t inData_len,
+                                  unsigned char *outData, size_t outData_size,
+                                  size_t * outData_len);
+
+/**
+ * @brief Decrypts data with ChaCha20-Poly1305, as
+ *        chacha20_poly1305_decrypt() does, but in place (see the
+ *        cipher_in_place declaration in cipher.h): the plaintext overwrites
+ *        the start of the input buffer.
+ *
+ * @param[in]  key           The hex bytes containing the key -
+ *                           pass in pointer to key buffer
+ *
+ * @param[in]  key_len       The length of the key in bytes (must be 32)
+ *
+ * @param[in,out] data       The IV, ciphertext, and tag, formatted
+ *                           IV||ciphertext||tag, overwritten by the
+ *                           plaintext (cleared if the tag does not verify)
+ *
+ * @param[in]  data_len      The length in bytes of data
+ *
+ * @param[out] plaintext_len The length in bytes of the plaintext -
+ *                           pass as pointer to length value
+ *
+ * @return 0 on success, 1 on error (including a tag mismatch)
+ */
+int chacha20_poly1305_decrypt_in_place(unsigned char *key,
+                                       size_t key_len,
+                                       unsigned char *data, size_t data_len,
+                                       size_t * plaintext_len);
+
+#endif
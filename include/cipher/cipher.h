@@ -8,11 +8,27 @@
 #ifndef CIPHER_H
 #define CIPHER_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 // default cipher option used if the user does not specify symmetric cipher
 #define KMYTH_DEFAULT_CIPHER "AES/GCM/NoPadding/256"
 
+// cipher option asking for the fastest cipher on the host (see
+// kmyth_get_auto_cipher())
+#define KMYTH_AUTO_CIPHER "auto"
+
+// ciphers chosen by kmyth_get_auto_cipher() with and without hardware AES
+#define KMYTH_AUTO_CIPHER_AES "AES/GCM/NoPadding/256"
+#define KMYTH_AUTO_CIPHER_NO_AES "ChaCha20/Poly1305/NoPadding/256"
+
+// maximum length of a cipher name (as stored in the .ski CIPHER SUITE block)
+#define KMYTH_MAX_CIPHER_STR_LEN 128
+
+// maximum number of bytes, beyond the size of its input, that a single
+// streaming cipher update (or final) call may write to its output buffer
+#define KMYTH_CIPHER_STREAM_MAX_OVERHEAD 32
+
 /**
  * All data encryption methods must be implemented with encrypt/decrypt
  * functions matching this declaration.
@@ -45,6 +61,180 @@ typedef int (*cipher) (unsigned char *key,
                        size_t inData_len,
                        unsigned char **outData, size_t * outData_len);
 
+/**
+ * Ciphers may also implement encrypt/decrypt functions matching this
+ * declaration, which write their output to a caller supplied buffer
+ * (e.g., on the stack) instead of allocating it. The output format is the
+ * same as for the corresponding allocating (cipher) function.
+ *
+ * Passing a NULL outData is a size query: *outData_len is set to the output
+ * buffer size required for the given input (for decryption, an upper bound
+ * on the output length) and 0 is returned without any key being used. If
+ * outData_size is smaller than that size, *outData_len is likewise set to
+ * the size required, but 1 is returned.
+ *
+ * @param[in]  key          The hex bytes containing the key -
+ *                          pass in pointer to key buffer
+ *
+ * @param[in]  key_len      The length of the key in bytes
+ *
+ * @param[in]  inData       The data to be encrypted/decrypted -
+ *                          pass in pointer to input data buffer
+ *
+ * @param[in]  inData_len   The length of the data in bytes
+ *
+ * @param[out] outData      Caller supplied output buffer, or NULL to only
+ *                          query the size required
+ *
+ * @param[in]  outData_size The size of the outData buffer in bytes
+ *
+ * @param[out] outData_len  The number of bytes written to outData (or the
+ *                          size required) - passed as pointer to length value
+ *
+ * @return 0 on success, 1 on error.
+ */
+typedef int (*cipher_buf) (unsigned char *key,
+                           size_t key_len,
+                           unsigned char *inData,
+                           size_t inData_len,
+                           unsigned char *outData,
+                           size_t outData_size, size_t * outData_len);
+
+/**
+ * Authenticated ciphers may also implement a decrypt function matching this
+ * declaration, which decrypts in place: the plaintext overwrites the start
+ * of the input buffer, so no second buffer the size of the data is needed.
+ * The input format is the same as for the corresponding (cipher) decrypt
+ * function. If decryption fails (e.g., the tag does not verify), any
+ * plaintext written is cleared.
+ *
+ * @param[in]  key          The hex bytes containing the key -
+ *                          pass in pointer to key buffer
+ *
+ * @param[in]  key_len      The length of the key in bytes
+ *
+ * @param[in,out] data      The data to be decrypted, overwritten by the
+ *                          plaintext
+ *
+ * @param[in]  data_len     The length of the data in bytes
+ *
+ * @param[out] plaintext_len The length of the plaintext at the start of
+ *                          data - passed as pointer to length value
+ *
+ * @return 0 on success, 1 on error.
+ */
+typedef int (*cipher_in_place) (unsigned char *key,
+                                size_t key_len,
+                                unsigned char *data,
+                                size_t data_len, size_t * plaintext_len);
+
+/**
+ * Ciphers meant for wrapping many small inputs (e.g., data keys) under one
+ * key may also implement encrypt/decrypt functions matching this
+ * declaration, which process a batch of inputs with a single cipher context
+ * and key schedule. Each output is in the same format as the output of the
+ * corresponding (cipher) function for that input.
+ *
+ * @param[in]  key          The hex bytes containing the key -
+ *                          pass in pointer to key buffer
+ *
+ * @param[in]  key_len      The length of the key in bytes
+ *
+ * @param[in]  count        The number of inputs in the batch
+ *
+ * @param[in]  inData       Array of count inputs to be encrypted/decrypted
+ *
+ * @param[in]  inData_len   Array of the lengths of the inputs in bytes
+ *
+ * @param[out] outData      Array of count pointers, each set to the output
+ *                          for the corresponding input (allocated by the
+ *                          function, to be freed by the caller)
+ *
+ * @param[out] outData_len  Array of the lengths of the outputs in bytes
+ *
+ * @return 0 on success, 1 on error (in which case no output is returned).
+ */
+typedef int (*cipher_batch) (unsigned char *key,
+                             size_t key_len,
+                             size_t count,
+                             unsigned char **inData,
+                             size_t *inData_len,
+                             unsigned char **outData, size_t *outData_len);
+
+/**
+ * Ciphers that can process their input incrementally (so that arbitrarily
+ * large data can be encrypted/decrypted with bounded memory) additionally
+ * implement init/update/final functions matching these declarations.
+ *
+ * The concatenated output of a streaming encryption must be identical in
+ * format to the output of the cipher's one-shot encrypt function, and vice
+ * versa for decryption, so that data encrypted either way can be decrypted
+ * either way. Any extra information (e.g., IVs or tags) is therefore
+ * written to, or consumed from, the data stream itself.
+ *
+ * The final function must be called exactly once for every successful call
+ * to the init function, even to abandon an incomplete stream, as it always
+ * releases the streaming state.
+ *
+ * When decrypting, the output of the update calls has not been
+ * authenticated until the final call succeeds. Callers must discard all of
+ * it if the final call (or any update call) fails.
+ *
+ * @param[in]  key         The hex bytes containing the key -
+ *                         pass in pointer to key buffer
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *
+ * @param[in]  encrypt     true to set up an encryption stream,
+ *                         false to set up a decryption stream
+ *
+ * @param[out] state       The cipher-specific streaming state -
+ *                         passed as pointer to the state pointer
+ *
+ * @return 0 on success, 1 on error.
+ */
+typedef int (*cipher_stream_init) (unsigned char *key,
+                                   size_t key_len, bool encrypt, void **state);
+
+/**
+ * @param[in]  state       The streaming state returned by the init function
+ *
+ * @param[in]  inData      The next chunk of data to be encrypted/decrypted
+ *
+ * @param[in]  inData_len  The length of the chunk in bytes
+ *
+ * @param[out] outData     Caller supplied output buffer, which must be at
+ *                         least inData_len + KMYTH_CIPHER_STREAM_MAX_OVERHEAD
+ *                         bytes in length
+ *
+ * @param[out] outData_len The number of bytes written to outData -
+ *                         passed as pointer to length value
+ *
+ * @return 0 on success, 1 on error.
+ */
+typedef int (*cipher_stream_update) (void *state,
+                                     unsigned char *inData,
+                                     size_t inData_len,
+                                     unsigned char *outData,
+                                     size_t * outData_len);
+
+/**
+ * @param[in]  state       The streaming state returned by the init function,
+ *                         always released by this call
+ *
+ * @param[out] outData     Caller supplied output buffer, which must be at
+ *                         least KMYTH_CIPHER_STREAM_MAX_OVERHEAD bytes in
+ *                         length
+ *
+ * @param[out] outData_len The number of bytes written to outData -
+ *                         passed as pointer to length value
+ *
+ * @return 0 on success, 1 on error (including failed authentication)
+ */
+typedef int (*cipher_stream_final) (void *state,
+                                    unsigned char *outData,
+                                    size_t * outData_len);
+
 /**
  * cipher_t:
  *
@@ -64,6 +254,34 @@ typedef struct
 
   /** @brief A pointer to the appropriate decryption function. */
   cipher decrypt_fn;
+
+  /**
+   * @brief Pointers to the encryption/decryption functions writing to a
+   *        caller supplied buffer.
+   */
+  cipher_buf encrypt_buf_fn;
+  cipher_buf decrypt_buf_fn;
+
+  /**
+   * @brief Pointer to the in place decryption function, or NULL if the
+   *        cipher does not support decrypting in place.
+   */
+  cipher_in_place decrypt_in_place_fn;
+
+  /**
+   * @brief Pointers to the batch encryption/decryption functions, or NULL
+   *        if the cipher does not support batches.
+   */
+  cipher_batch encrypt_batch_fn;
+  cipher_batch decrypt_batch_fn;
+
+  /**
+   * @brief Pointers to the streaming (init/update/final) functions,
+   *        or NULL if the cipher does not support streaming.
+   */
+  cipher_stream_init stream_init_fn;
+  cipher_stream_update stream_update_fn;
+  cipher_stream_final stream_final_fn;
 } cipher_t;
 
 /**
@@ -78,6 +296,22 @@ typedef struct
  */
 cipher_t kmyth_get_cipher_t_from_string(char *cipher_string);
 
+/**
+ * @brief Picks the fastest cipher in cipher_list for the host, based on
+ *        its CPU features: AES/GCM where the CPU has AES and carry-less
+ *        multiply instructions (AES-NI and PCLMULQDQ on x86, or the ARMv8
+ *        AES and PMULL extensions), and ChaCha20-Poly1305 otherwise.
+ *
+ * The features are only probed once per process.
+ *
+ * @param[in]  streaming     true if the cipher must support streaming or
+ *                           chunked data (ChaCha20-Poly1305 does neither,
+ *                           so AES/GCM is always chosen)
+ *
+ * @return The chosen cipher_t structure
+ */
+cipher_t kmyth_get_auto_cipher(bool streaming);
+
 /**
  * @brief This function takes a cipher_t structure and parses the
  *        cipher_name string to return the key length in bits.
@@ -147,4 +381,220 @@ int kmyth_decrypt_data(unsigned char *enc_data,
                        size_t key_size,
                        unsigned char **result, size_t * result_size);
 
+/**
+ * @brief Performs the symmetric encryption specified by the caller (with a
+ *        new random key, as for kmyth_encrypt_data()), writing the result
+ *        to a caller supplied buffer.
+ *
+ * A NULL enc_data (with enc_data_capacity 0) queries the size of the
+ * result buffer required, returned in enc_data_size, as for the cipher's
+ * encrypt_buf_fn. No key is created by a size query.
+ *
+ * @param[in]  data              Input data to be encrypted
+ *
+ * @param[in]  data_size         Size, in bytes, of the input plaintext data
+ *
+ * @param[in]  enc_cipher        Struct (cipher_t) specifying cipher to use
+ *
+ * @param[out] enc_data          Caller supplied buffer for the encrypted
+ *                               data, or NULL to query the size required
+ *
+ * @param[in]  enc_data_capacity Size, in bytes, of the enc_data buffer
+ *
+ * @param[out] enc_data_size     Size of the encrypted result (or of the
+ *                               buffer required)
+ *
+ * @param[out] enc_key           The new key - pass in pointer to a key
+ *                               buffer of enc_key_size bytes
+ *
+ * @param[in]  enc_key_size      The length of the key in bytes
+ *                               (must be 16, 24, or 32)
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_encrypt_data_buf(unsigned char *data,
+                           size_t data_size,
+                           cipher_t enc_cipher,
+                           unsigned char *enc_data,
+                           size_t enc_data_capacity,
+                           size_t * enc_data_size,
+                           unsigned char *enc_key, size_t enc_key_size);
+
+/**
+ * @brief Performs the symmetric decryption specified by the caller, writing
+ *        the result to a caller supplied buffer.
+ *
+ * A NULL result (with result_capacity 0) queries the size of the result
+ * buffer required, returned in result_size, as for the cipher's
+ * decrypt_buf_fn. The size depends only on enc_data_size, so the key may
+ * be NULL for a size query.
+ *
+ * @param[in]  enc_data        Input data to be decrypted
+ *
+ * @param[in]  enc_data_size   Size, in bytes, of the input data
+ *
+ * @param[in]  cipher_spec     Struct (cipher_t) specifying cipher to use
+ *
+ * @param[in]  key             Key that was used to encrypt enc_data
+ *
+ * @param[in]  key_size        Size, in bytes, of the key
+ *
+ * @param[out] result          Caller supplied buffer for the decrypted data,
+ *                             or NULL to query the size required
+ *
+ * @param[in]  result_capacity Size, in bytes, of the result buffer
+ *
+ * @param[out] result_size     Size of the decrypted data (or of the buffer
+ *                             required)
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_decrypt_data_buf(unsigned char *enc_data,
+                           size_t enc_data_size,
+                           cipher_t cipher_spec,
+                           unsigned char *key,
+                           size_t key_size,
+                           unsigned char *result,
+                           size_t result_capacity, size_t * result_size);
+
+/**
+ * @brief Creates a new random key and uses it to encrypt a batch of inputs
+ *        (e.g., many data keys) with the cipher specified by the caller, as
+ *        kmyth_encrypt_data() would for a single input.
+ *
+ * @param[in]  count         The number of inputs in the batch
+ *
+ * @param[in]  data          Array of count inputs to be encrypted
+ *
+ * @param[in]  data_sizes    Array of the sizes, in bytes, of the inputs
+ *
+ * @param[in]  enc_cipher    Struct (cipher_t) specifying cipher to use,
+ *                           which must support batches
+ *
+ * @param[out] enc_data      Array of count pointers, each set to the
+ *                           encrypted input (allocated here, to be freed by
+ *                           the caller)
+ *
+ * @param[out] enc_data_sizes Array of the sizes, in bytes, of the outputs
+ *
+ * @param[out] enc_key       The hex bytes containing the new key -
+ *                           pass in pointer to the address of a key buffer
+ *                           of enc_key_size bytes
+ *
+ * @param[in]  enc_key_size  The length of the key in bytes
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_encrypt_data_batch(size_t count,
+                             unsigned char **data,
+                             size_t *data_sizes,
+                             cipher_t enc_cipher,
+                             unsigned char **enc_data,
+                             size_t *enc_data_sizes,
+                             unsigned char **enc_key, size_t * enc_key_size);
+
+/**
+ * @brief Decrypts a batch of inputs, all encrypted under one key, with the
+ *        cipher specified by the caller, as kmyth_decrypt_data() would for
+ *        a single input.
+ *
+ * @param[in]  count         The number of inputs in the batch
+ *
+ * @param[in]  enc_data      Array of count inputs to be decrypted
+ *
+ * @param[in]  enc_data_sizes Array of the sizes, in bytes, of the inputs
+ *
+ * @param[in]  cipher_spec   Struct (cipher_t) specifying cipher to use,
+ *                           which must support batches
+ *
+ * @param[in]  key           Key that was used to encrypt the inputs
+ *
+ * @param[in]  key_size      Size, in bytes, of the key
+ *
+ * @param[out] result        Array of count pointers, each set to the
+ *                           decrypted input (allocated here, to be freed by
+ *                           the caller)
+ *
+ * @param[out] result_sizes  Array of the sizes, in bytes, of the outputs
+ *
+ * @return 0 on success, 1 on error (including any input that does not
+ *         decrypt)
+ */
+int kmyth_decrypt_data_batch(size_t count,
+                             unsigned char **enc_data,
+                             size_t *enc_data_sizes,
+                             cipher_t cipher_spec,
+                             unsigned char *key,
+                             size_t key_size,
+                             unsigned char **result, size_t *result_sizes);
+
+/**
+ * @brief Performs the symmetric decryption specified by the caller in place,
+ *        overwriting the start of enc_data with the decrypted data (see the
+ *        cipher_in_place declaration).
+ *
+ * @param[in,out] enc_data     Input data to be decrypted, overwritten by
+ *                             the decrypted data
+ *
+ * @param[in]  enc_data_size   Size, in bytes, of the input data
+ *
+ * @param[in]  cipher_spec     Struct (cipher_t) specifying cipher to use,
+ *                             which must support in place decryption
+ *
+ * @param[in]  key             Key that was used to encrypt enc_data
+ *
+ * @param[in]  key_size        Size, in bytes, of the key
+ *
+ * @param[out] result_size     Size of the decrypted data
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_decrypt_data_in_place(unsigned char *enc_data,
+                                size_t enc_data_size,
+                                cipher_t cipher_spec,
+                                unsigned char *key,
+                                size_t key_size, size_t * result_size);
+
+/**
+ * @brief Creates a new random key and uses it to set up a streaming
+ *        encryption with the cipher specified by the caller.
+ *
+ * @param[in]  enc_cipher    Struct (cipher_t) specifying cipher to use,
+ *                           which must support streaming
+ *
+ * @param[out] enc_key       The hex bytes containing the new key -
+ *                           pass in pointer to the address of a key buffer
+ *                           of enc_key_size bytes
+ *
+ * @param[in]  enc_key_size  The length of the key in bytes
+ *
+ * @param[out] state         The streaming state, to be passed to the
+ *                           cipher's stream_update_fn/stream_final_fn
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_encrypt_stream_init(cipher_t enc_cipher,
+                              unsigned char **enc_key,
+                              size_t * enc_key_size, void **state);
+
+/**
+ * @brief Sets up a streaming decryption with the cipher and key specified
+ *        by the caller.
+ *
+ * @param[in]  cipher_spec   Struct (cipher_t) specifying cipher to use,
+ *                           which must support streaming
+ *
+ * @param[in]  key           Key that was used to encrypt the data
+ *
+ * @param[in]  key_size      Size, in bytes, of the key
+ *
+ * @param[out] state         The streaming state, to be passed to the
+ *                           cipher's stream_update_fn/stream_final_fn
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_decrypt_stream_init(cipher_t cipher_spec,
+                              unsigned char *key,
+                              size_t key_size, void **state);
+
 #endif /* CIPHER_H */
@@ -0,0 +1,87 @@
+/**
+ * @file  cipher_ctx.h
+ *
+ * @brief Provides cached OpenSSL cipher objects and per-thread cipher
+ *        contexts for the kmyth cipher implementations.
+ *
+ * Looking up an OpenSSL cipher (and, under OpenSSL 3, fetching its
+ * implementation from a provider) and allocating a cipher context for
+ * every encryption or decryption is a significant part of the cost of
+ * wrapping small inputs. The ciphers are therefore fetched once per
+ * process, and each thread keeps one context per cipher, which is
+ * re-initialized rather than re-allocated for each use.
+ */
+#ifndef CIPHER_CTX_H
+#define CIPHER_CTX_H
+
+#include <stdlib.h>
+
+#include <openssl/evp.h>
+
+/**
+ * @brief The families of OpenSSL ciphers used by kmyth. The AES families are
+ *        used with 16, 24, or 32 byte (AES-128, AES-192, or AES-256) keys,
+ *        ChaCha20-Poly1305 only with 32 byte keys.
+ */
+typedef enum
+{
+  KMYTH_CIPHER_AES_GCM = 0,
+  KMYTH_CIPHER_AES_WRAP,
+  KMYTH_CIPHER_AES_WRAP_PAD,
+  KMYTH_CIPHER_CHACHA20_POLY1305,
+  KMYTH_CIPHER_FAMILY_COUNT
+} kmyth_cipher_family;
+
+/**
+ * @brief Gets the OpenSSL cipher for a cipher family and key length. The
+ *        cipher is looked up (fetched) only once per process.
+ *
+ * @param[in]  family      The cipher family
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *                         (must be 16, 24, or 32)
+ *
+ * @return the cipher, or NULL if it is not available (including for a key
+ *         length the cipher family does not support)
+ */
+const EVP_CIPHER *kmyth_get_evp_cipher(kmyth_cipher_family family,
+                                       size_t key_len);
+
+/**
+ * @brief Gets a cipher context, initialized for a cipher family and key
+ *        length (and, for the key wrap ciphers, with wrapping allowed),
+ *        but with no key or IV set.
+ *
+ * The calling thread's cached context for the cipher is returned if it is
+ * not already in use, otherwise a new context is allocated. Either way, the
+ * context must be returned with kmyth_cipher_ctx_release(), not freed.
+ *
+ * @param[in]  family      The cipher family
+ *
+ * @param[in]  key_len     The length of the key in bytes
+ *                         (must be 16, 24, or 32)
+ *
+ * @param[in]  enc         1 to encrypt, 0 to decrypt
+ *
+ * @return the cipher context, or NULL on error
+ */
+EVP_CIPHER_CTX *kmyth_cipher_ctx_acquire(kmyth_cipher_family family,
+                                         size_t key_len, int enc);
+
+/**
+ * @brief Returns a cipher context obtained from kmyth_cipher_ctx_acquire().
+ *        Any key set in the context is overwritten before it is cached for
+ *        reuse.
+ *
+ * @param[in]  family      The cipher family the context was acquired for
+ *
+ * @param[in]  key_len     The key length the context was acquired for
+ *
+ * @param[in]  ctx         The cipher context (may be NULL)
+ *
+ * @return None
+ */
+void kmyth_cipher_ctx_release(kmyth_cipher_family family, size_t key_len,
+                              EVP_CIPHER_CTX * ctx);
+
+#endif
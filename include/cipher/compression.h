@@ -0,0 +1,228 @@
+/**
+ * @file  compression.h
+ *
+ * @brief Provides the optional compression stage kmyth applies to data
+ *        before encrypting it (and, when unsealing, after decrypting it).
+ *
+ * Compressed data is marked by a tag appended to the cipher name in the .ski
+ * cipher suite block (e.g., "AES/GCM/NoPadding/256+zstd"), so a kmyth that
+ * does not know the tag rejects the .ski instead of returning compressed
+ * data.
+ */
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// separator between the cipher name and the compression tag in the .ski
+// cipher suite block
+#define KMYTH_COMPRESSION_TAG_SEPARATOR '+'
+
+// name (and .ski cipher suite tag) of zstd compression
+#define KMYTH_COMPRESSION_ZSTD_NAME "zstd"
+
+// name asking for no compression
+#define KMYTH_COMPRESSION_NONE_NAME "none"
+
+// zstd compression level used when sealing
+#define KMYTH_COMPRESSION_ZSTD_LEVEL 3
+
+// inputs smaller than this (in bytes) are never compressed - the saving on
+// small inputs does not justify the extra work
+#define KMYTH_COMPRESSION_MIN_SIZE 4096
+
+/**
+ * @brief Compression algorithms that can be applied to data before it is
+ *        encrypted
+ */
+typedef enum kmyth_compression_e
+{
+  KMYTH_COMPRESSION_NONE = 0,
+  KMYTH_COMPRESSION_ZSTD,
+} kmyth_compression_t;
+
+/**
+ * @brief Looks up a compression algorithm by name (as used on the command
+ *        line and as the .ski cipher suite tag).
+ *
+ * @param[in]  name        Name of the compression algorithm
+ *                         ("zstd" or "none")
+ *
+ * @param[out] compression The matching algorithm
+ *
+ * @return 0 on success, 1 if the name is not recognized
+ */
+int kmyth_get_compression_from_string(const char *name,
+                                      kmyth_compression_t * compression);
+
+/**
+ * @brief Returns the name of a compression algorithm.
+ *
+ * @param[in]  compression The compression algorithm
+ *
+ * @return The algorithm name, or NULL for KMYTH_COMPRESSION_NONE (or an
+ *         unknown value)
+ */
+const char *kmyth_get_compression_name(kmyth_compression_t compression);
+
+/**
+ * @brief Compresses data in one piece.
+ *
+ * @param[in]  compression The compression algorithm (not
+ *                         KMYTH_COMPRESSION_NONE)
+ *
+ * @param[in]  inData      The data to be compressed
+ *
+ * @param[in]  inData_len  The length, in bytes, of inData
+ *
+ * @param[out] outData     The compressed data (allocated here, to be freed
+ *                         by the caller) - pass in pointer to address of
+ *                         output buffer
+ *
+ * @param[out] outData_len The length, in bytes, of outData
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_compress_data(kmyth_compression_t compression,
+                        uint8_t * inData, size_t inData_len,
+                        uint8_t ** outData, size_t *outData_len);
+
+/**
+ * @brief Decompresses data compressed by kmyth_compress_data().
+ *
+ * @param[in]  compression The compression algorithm (not
+ *                         KMYTH_COMPRESSION_NONE)
+ *
+ * @param[in]  inData      The compressed data
+ *
+ * @param[in]  inData_len  The length, in bytes, of inData
+ *
+ * @param[out] outData     The decompressed data (allocated here, to be
+ *                         freed by the caller) - pass in pointer to address
+ *                         of output buffer
+ *
+ * @param[out] outData_len The length, in bytes, of outData
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_decompress_data(kmyth_compression_t compression,
+                          uint8_t * inData, size_t inData_len,
+                          uint8_t ** outData, size_t *outData_len);
+
+/**
+ * @brief Sets up incremental compression, for data that is not held in
+ *        memory all at once (e.g., a streaming seal).
+ *
+ * @param[in]  compression The compression algorithm (not
+ *                         KMYTH_COMPRESSION_NONE)
+ *
+ * @param[out] state       The compression state, to be passed to
+ *                         kmyth_compress_stream_update() and released by
+ *                         kmyth_compress_stream_free()
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_compress_stream_init(kmyth_compression_t compression,
+                               void **state);
+
+/**
+ * @brief Compresses the next piece of a data stream. Each call consumes
+ *        as much input, and writes as much output, as it can - the caller
+ *        repeats the call (with the input that remains) until all of the
+ *        input is used, and, at the end of the stream, until done is set.
+ *
+ * @param[in]  state       State from kmyth_compress_stream_init()
+ *
+ * @param[in]  inData      The next input data (may be NULL if inData_len
+ *                         is 0)
+ *
+ * @param[in]  inData_len  The length, in bytes, of inData
+ *
+ * @param[out] inData_used The number of bytes of inData consumed
+ *
+ * @param[in]  end         true if inData is the last of the stream
+ *
+ * @param[out] outData     Buffer for the compressed output
+ *
+ * @param[in]  outData_size The size, in bytes, of outData
+ *
+ * @param[out] outData_len The number of bytes written to outData
+ *
+ * @param[out] done        Set once (with end set) the compressed stream
+ *                         is complete
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_compress_stream_update(void *state,
+                                 uint8_t * inData, size_t inData_len,
+                                 size_t *inData_used, bool end,
+                                 uint8_t * outData, size_t outData_size,
+                                 size_t *outData_len, bool *done);
+
+/**
+ * @brief Releases the state set up by kmyth_compress_stream_init().
+ *
+ * @param[in]  state       State from kmyth_compress_stream_init() (may
+ *                         be NULL)
+ */
+void kmyth_compress_stream_free(void *state);
+
+/**
+ * @brief Sets up incremental decompression (e.g., for a streaming unseal).
+ *
+ * @param[in]  compression The compression algorithm (not
+ *                         KMYTH_COMPRESSION_NONE)
+ *
+ * @param[out] state       The decompression state, to be passed to
+ *                         kmyth_decompress_stream_update() and released by
+ *                         kmyth_decompress_stream_free()
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_decompress_stream_init(kmyth_compression_t compression,
+                                 void **state);
+
+/**
+ * @brief Decompresses the next piece of a compressed stream. As for
+ *        kmyth_compress_stream_update(), the caller repeats the call until
+ *        all of its input is used. Once all of the stream has been passed
+ *        in, done must be set (otherwise the stream was truncated).
+ *
+ * @param[in]  state       State from kmyth_decompress_stream_init()
+ *
+ * @param[in]  inData      The next compressed data
+ *
+ * @param[in]  inData_len  The length, in bytes, of inData
+ *
+ * @param[out] inData_used The number of bytes of inData consumed
+ *
+ * @param[out] outData     Buffer for the decompressed output
+ *
+ * @param[in]  outData_size The size, in bytes, of outData
+ *
+ * @param[out] outData_len The number of bytes written to outData
+ *
+ * @param[out] done        Set once the end of the compressed stream has
+ *                         been reached (and all of its output written)
+ *
+ * @return 0 on success, 1 on error (including data following the end of
+ *         the compressed stream)
+ */
+int kmyth_decompress_stream_update(void *state,
+                                   uint8_t * inData, size_t inData_len,
+                                   size_t *inData_used,
+                                   uint8_t * outData, size_t outData_size,
+                                   size_t *outData_len, bool *done);
+
+/**
+ * @brief Releases the state set up by kmyth_decompress_stream_init().
+ *
+ * @param[in]  state       State from kmyth_decompress_stream_init() (may
+ *                         be NULL)
+ */
+void kmyth_decompress_stream_free(void *state);
+
+#endif
@@ -0,0 +1,40 @@
+/**
+ * @file  nonce_drbg.h
+ *
+ * @brief Provides the per-thread random bit generators used for the
+ *        (public) nonces and IVs produced by kmyth.
+ *
+ * RAND_bytes() looks up the process-wide RAND method, under a lock, on
+ * every call, which makes it a point of contention when many threads
+ * (e.g., the parallel seal engine, or a server handling many clients)
+ * each need a few bytes for an IV or nonce. Instead, each thread keeps its
+ * own AES-256 CTR-DRBG, seeded (and periodically reseeded) from OpenSSL's
+ * primary DRBG, and freed when the thread exits. A DRBG in a forked child
+ * is discarded and re-instantiated, so that the parent and child never
+ * produce the same output.
+ *
+ * Secret values (keys) continue to come from RAND_bytes() or
+ * RAND_priv_bytes(), not from these generators.
+ */
+#ifndef NONCE_DRBG_H
+#define NONCE_DRBG_H
+
+#include <stddef.h>
+
+/**
+ * @brief Fills a buffer with random bytes (for a nonce or IV) from the
+ *        calling thread's DRBG.
+ *
+ * If the thread's DRBG cannot be created (or an engine has replaced
+ * OpenSSL's own RAND method), the bytes are obtained from RAND_bytes()
+ * instead.
+ *
+ * @param[out] buf         The buffer to fill
+ *
+ * @param[in]  len         The number of random bytes to write to buf
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_nonce_bytes(unsigned char *buf, size_t len);
+
+#endif
@@ -81,7 +81,24 @@
  * applicable, we define an upper limit (MAX_RETRIES) to prevent infinite
  * retry attempts.
  */
-#define MAX_RETRIES 3
+#define MAX_RETRIES 8
+
+/**
+ * Delays before retrying a TPM command the TPM was too busy to execute
+ * (TPM_RC_RETRY, TPM_RC_YIELDED or TPM_RC_TESTING). The delay starts at
+ * KMYTH_RETRY_BASE_US, doubles with each retry up to KMYTH_RETRY_MAX_US,
+ * and is randomized to between half and all of that value so that
+ * contending clients do not retry in lockstep.
+ */
+#define KMYTH_RETRY_BASE_US 1000
+#define KMYTH_RETRY_MAX_US 100000
+
+/**
+ * Longest (in milliseconds) a TPM response is waited for at once while a
+ * deadline is set (see set_tpm2_deadline()) - the most a deadline or
+ * cancellation can be overrun by waiting on the TPM.
+ */
+#define KMYTH_DEADLINE_POLL_MS 50
 
 /**
  * In TPM 2.0, the size value for a key or data value (unique parameter)
@@ -156,7 +173,9 @@
  *
  * Note: all options may not be supported on actual TPM 2.0 devices
  *
- * Should be consistent for key hierarchy
+ * Used for the SRK, and as the default for storage keys (SKs) - the SK
+ * algorithm can be changed at runtime (see kmyth_ctx_set_sk_alg()) to
+ * TPM2_ALG_ECC, which uses KMYTH_ECC_CURVE
  *
  * @brief Kmyth public key algorithm selection
  */
@@ -320,8 +339,128 @@
 #define KMYTH_KDF TPM2_ALG_KDF1_SP800_108
 
 /**
- * @brief kmyth-getkey receive buffer size (in bytes)
+ * @brief kmyth-getkey initial receive buffer size (in bytes) - the buffer
+ *        grows, up to KMYTH_GETKEY_MAX_RESPONSE_SIZE, for larger responses
  */
 #define KMYTH_GETKEY_RX_BUFFER_SIZE 16384
 
+/**
+ * @brief maximum size (in bytes) of a key server response kmyth accepts
+ */
+#define KMYTH_GETKEY_MAX_RESPONSE_SIZE (1024 * 1024)
+
+/**
+ * @brief size (in bytes) of a KMIP TTLV header: a 3 byte tag, a 1 byte
+ *        type and a 4 byte (big-endian) length of the value that follows
+ */
+#define KMYTH_KMIP_TTLV_HEADER_SIZE 8
+
+/**
+ * @brief maximum number of -m (--message) options kmyth-getkey accepts
+ */
+#define KMYTH_GETKEY_MAX_MESSAGES 64
+
+/**
+ * @brief suffix of the file, next to the sealed client key, that
+ *        kmyth-getkey --resume saves the (kmyth-sealed) TLS session in
+ */
+#define KMYTH_GETKEY_SESSION_EXT ".tls_session"
+
+/**
+ * @brief default maximum age (in seconds) of a key in the kmyth-getkey
+ *        --cache directory that is used in place of getting it from the
+ *        key server
+ */
+#define KMYTH_GETKEY_CACHE_MAX_AGE (24 * 60 * 60)
+
+/**
+ * @brief name, in the kmyth-getkey --cache directory, of the key got
+ *        without a message (key ID)
+ */
+#define KMYTH_GETKEY_CACHE_DEFAULT_NAME "default"
+
+/**
+ * @brief maximum number of Get operations batched into one KMIP request
+ *        (keeping the response within the default KMIP message size limit)
+ */
+#define KMYTH_KMIP_MAX_BATCH_COUNT 16
+
+/**
+ * The size of the blocks that input data is read in when sealing/unsealing
+ * streaming file descriptors (memory use is a small multiple of this,
+ * whatever the total data size). The leading (non-data) part of an
+ * input .ski file must also fit within a single block.
+ *
+ * @brief Kmyth streaming seal/unseal read block size (in bytes)
+ */
+#define KMYTH_STREAM_BLOCK_SIZE 65536
+
+/**
+ * The default size of the separately authenticated plaintext chunks that
+ * the encrypted data of a chunked .ski is split into. Unsealing a byte
+ * range only has to decrypt the chunks overlapping it.
+ *
+ * @brief Kmyth chunked seal default chunk size (in bytes)
+ */
+#define KMYTH_DEFAULT_CHUNK_SIZE 65536
+
+/**
+ * @brief kmyth-agent default UNIX domain socket path
+ */
+#define KMYTH_AGENT_DEFAULT_SOCKET_PATH "/run/kmyth/agent.sock"
+
+/**
+ * The time-to-live that kmyth-agent applies to a cached (unsealed) entry
+ * when none is requested, and the most that a client may request.
+ *
+ * @brief kmyth-agent default/maximum cache entry TTL (in seconds)
+ */
+#define KMYTH_AGENT_DEFAULT_TTL 300
+
+/**
+ * @brief Maximum number of entries held in the kmyth-agent cache
+ */
+#define KMYTH_AGENT_MAX_ENTRIES 1024
+
+/**
+ * @brief Maximum number of (additional) client UIDs kmyth-agent accepts
+ */
+#define KMYTH_AGENT_MAX_UIDS 16
+
+/**
+ * @brief kmyth-agent client request/response read timeout (in seconds)
+ */
+#define KMYTH_AGENT_IO_TIMEOUT 5
+
+/**
+ * Requests for a file that is already being unsealed wait for that unseal,
+ * so this bounds the distinct .ski files being unsealed at once.
+ *
+ * @brief Maximum number of unseals kmyth-agent runs at once
+ */
+#define KMYTH_AGENT_MAX_FLIGHTS 16
+
+/**
+ * While this many clients are waiting for an unseal (or all of the unseals
+ * allowed are running), kmyth-agent stops accepting connections, leaving
+ * new clients queued on its socket.
+ *
+ * @brief Maximum number of clients waiting on kmyth-agent unseals
+ */
+#define KMYTH_AGENT_MAX_WAITING 256
+
+/**
+ * @brief Maximum number of .ski files kmyth-agent re-seals on a PCR change
+ */
+#define KMYTH_AGENT_MAX_RESEAL 16
+
+/**
+ * When kmyth-agent watches a measurement count file, it still asks the TPM
+ * for its PCR update counter once in this many checks, to see extends that
+ * the file does not count.
+ *
+ * @brief kmyth-agent checks per TPM query, with a measurement count file
+ */
+#define KMYTH_AGENT_WATCH_TPM_EVERY 10
+
 #endif // DEFINES_H
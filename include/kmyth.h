@@ -8,7 +8,9 @@
 #ifndef KMYTH_H
 #define KMYTH_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -100,6 +102,68 @@ extern "C"
                         uint8_t * owner_auth_bytes, size_t oa_bytes_len,
                         uint8_t bool_policy_or);
 
+/**
+ * @brief Variant of tpm2_kmyth_unseal() that writes the unsealed data into
+ *        a caller supplied buffer (e.g., locked or otherwise managed
+ *        memory), rather than returning an allocated copy. The final
+ *        decryption writes straight into buf, so no other heap buffer ever
+ *        holds the plaintext (other than the decompression input, for
+ *        compressed data).
+ *
+ * A NULL buf (with cap 0) queries the size of buffer required, which is
+ * worked out from the .ski's cipher and encrypted data length without
+ * using the TPM. For a padded cipher the size is an upper bound, and
+ * len returns the actual length once unsealed. The size of compressed data
+ * is not known until it is unsealed, so it cannot be queried - a too small
+ * buffer is reported, with the size needed, as for any other data.
+ *
+ * Unlike tpm2_kmyth_unseal(), this does not use the unseal cache.
+ *
+ * @param[in]  input             .ski formatted data to be unsealed
+ *
+ * @param[in]  input_len         The size of input in bytes
+ *
+ * @param[out] buf               Buffer for the unsealed data, or NULL to
+ *                               query the size required. On error it is
+ *                               cleared.
+ *
+ * @param[in]  cap               Size, in bytes, of buf
+ *
+ * @param[out] len               Length of the unsealed data, or the size
+ *                               required (for a size query, or if buf is
+ *                               too small)
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 on success, 1 on error (including a buf too small)
+ */
+  int tpm2_kmyth_unseal_into(uint8_t * input, size_t input_len,
+                             uint8_t * buf, size_t cap, size_t *len,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             uint8_t bool_policy_or);
+
+/**
+ * @brief Enables (or disables) a process-wide cache of the results of
+ *        tpm2_kmyth_unseal(), for processes that unseal the same .ski
+ *        data repeatedly. Results are cached by a hash of the .ski bytes
+ *        and the authorization values, in locked memory that is wiped
+ *        when they are dropped.
+ *
+ *        Every cached unseal still reads the TPM's PCR update counter and
+ *        reset and restart counts (a PCR_Read and a ReadClock). A result
+ *        is only returned from the cache while those are unchanged: after
+ *        any PCR is extended, or the TPM is reset or restarted, every
+ *        cached result is dropped and the next unseal goes to the TPM
+ *        (and its policy check) again. Off (0) by default.
+ *
+ * @param[in]  max_entries       Maximum number of cached results (up to
+ *                               64), or 0 to disable (and empty) the cache
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_set_unseal_cache(size_t max_entries);
+
 /**
  * @brief High-level function implementing kmyth-seal for files using TPM 2.0.
  *        The kmyth-seal input data is read from the specified file.
@@ -180,6 +244,1898 @@ extern "C"
                              uint8_t * auth_bytes, size_t auth_bytes_len,
                              uint8_t * owner_auth_bytes, size_t oa_bytes_len,
                              uint8_t policy_or);
+
+/**
+ * @brief Gets the PCRs a .ski was sealed to (its PCR selection), e.g., to
+ *        seal other data under the same PCR policy. No TPM is needed.
+ *
+ * @param[in]  ski_bytes         The .ski (text or binary format)
+ *
+ * @param[in]  ski_bytes_len     Number of bytes in ski_bytes
+ *
+ * @param[out] pcrs              The PCR indices, in ascending order (to be
+ *                               freed with free()), or NULL if the .ski
+ *                               was sealed to no PCRs
+ *
+ * @param[out] pcrs_len          The number of PCR indices
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_get_ski_pcrs(uint8_t * ski_bytes, size_t ski_bytes_len,
+                         int **pcrs, size_t *pcrs_len);
+
+/**
+ * @brief Opaque, reusable Kmyth TPM 2.0 context.
+ *
+ * A kmyth_ctx_t holds the connection to the TPM 2.0 resource manager
+ * (TCTI and SAPI contexts) and the resolved storage root key (SRK) handle
+ * so that they can be reused across multiple seal/unseal calls, instead of
+ * being re-initialized for every operation. A context must not be used by
+ * more than one thread at a time.
+ */
+  typedef struct kmyth_ctx_s kmyth_ctx_t;
+
+/**
+ * @brief Creates a Kmyth TPM 2.0 context, connecting to the TPM 2.0
+ *        resource manager (and starting the TPM, if it is an emulator).
+ *
+ * @param[out] ctx               Newly created context -
+ *                               passed as pointer to a NULL context pointer
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_create(kmyth_ctx_t ** ctx);
+
+/**
+ * @brief Creates a Kmyth TPM 2.0 context connected through a specific TCTI
+ *        (e.g., "device:/dev/tpmrm1" or "tabrmd"), instead of the one
+ *        configured by the KMYTH_TCTI environment variable.
+ *
+ * @param[out] ctx               Newly created context -
+ *                               passed as pointer to a NULL context pointer
+ *
+ * @param[in]  tcti_conf         TCTI configuration string, or NULL for the
+ *                               configured (or default) TCTI
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_create_tcti(kmyth_ctx_t ** ctx, const char *tcti_conf);
+
+/**
+ * @brief Destroys a Kmyth TPM 2.0 context created by kmyth_ctx_create(),
+ *        releasing the TPM 2.0 connection and any resources it holds.
+ *
+ * @param[in]  ctx               Context to be destroyed - passed as pointer
+ *                               to context pointer, which is set to NULL
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_destroy(kmyth_ctx_t ** ctx);
+
+/**
+ * @brief .ski output formats selectable with kmyth_ctx_set_ski_format():
+ *        the (default) PEM-style text format, or the compact binary format.
+ *        Unsealing accepts either format, detecting it from the input.
+ */
+#define KMYTH_SKI_FORMAT_TEXT 0
+#define KMYTH_SKI_FORMAT_BINARY 1
+
+/**
+ * @brief Selects the .ski format written by the context-based seal calls
+ *        (KMYTH_SKI_FORMAT_TEXT, unless changed). The streaming seal
+ *        (tpm2_kmyth_seal_stream()) only supports the text format.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  ski_format        KMYTH_SKI_FORMAT_TEXT or
+ *                               KMYTH_SKI_FORMAT_BINARY
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_ski_format(kmyth_ctx_t * ctx, int ski_format);
+
+/**
+ * @brief Storage key (SK) algorithms selectable with kmyth_ctx_set_sk_alg():
+ *        RSA-2048 (the default) or ECC NIST P-256. An ECC storage key is
+ *        generated by the TPM in a fraction of the time an RSA key takes.
+ *        The algorithm is recorded (in the storage key's public area) in
+ *        the .ski, so unsealing accepts either.
+ */
+#define KMYTH_SK_ALG_RSA 0
+#define KMYTH_SK_ALG_ECC 1
+
+/**
+ * @brief Selects the algorithm of the storage key created by the
+ *        context-based seal calls (KMYTH_SK_ALG_RSA, unless changed).
+ *        Re-sealing keeps the algorithm of the input .ski.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  sk_alg            KMYTH_SK_ALG_RSA or KMYTH_SK_ALG_ECC
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_sk_alg(kmyth_ctx_t * ctx, int sk_alg);
+
+/**
+ * @brief Maximum number of storage keys a context's storage key pool can
+ *        hold (see kmyth_ctx_set_sk_pool())
+ */
+#define KMYTH_SK_POOL_MAX 8
+
+/**
+ * @brief Enables (or resizes) the context's storage key pool. Creating the
+ *        storage key (SK) is the most expensive TPM operation in a seal.
+ *        With the pool enabled, the storage keys created by the
+ *        context-based seal calls (and by kmyth_ctx_precreate_sk()) are
+ *        kept, as TPM-wrapped public/private blobs, and a later seal with
+ *        the same authorization value, PCR policy, SRK and storage key
+ *        algorithm loads a pooled key instead of creating a new one.
+ *        Sealed data objects are still created fresh for every seal. The
+ *        least recently used key is dropped when the pool is full.
+ *        Disabled (0) by default.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  max_sks           Number of storage keys to keep
+ *                               (0 to KMYTH_SK_POOL_MAX, 0 disables and
+ *                               empties the pool)
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_sk_pool(kmyth_ctx_t * ctx, size_t max_sks);
+
+/**
+ * @brief Creates a storage key for the given sealing parameters and adds
+ *        it to the context's storage key pool (which must be enabled with
+ *        kmyth_ctx_set_sk_pool()), without sealing anything. Intended to
+ *        be called while the application is otherwise idle, so that later
+ *        seals with the same parameters only have to load the key (if
+ *        one is already pooled, it is only checked to still load). The
+ *        parameters are as described for tpm2_kmyth_seal().
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_precreate_sk(kmyth_ctx_t * ctx,
+                             uint8_t * auth_bytes,
+                             size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes,
+                             size_t oa_bytes_len,
+                             int *pcrs, size_t pcrs_len,
+                             char *expected_policy);
+
+/**
+ * @brief Range of TPM persistent handles that storage keys can be made
+ *        persistent at (see kmyth_ctx_set_persistent_sk()). Unseal only
+ *        looks for persistent storage keys in this range.
+ */
+#define KMYTH_PERSISTENT_SK_FIRST 0x81000100
+#define KMYTH_PERSISTENT_SK_LAST 0x810001FF
+
+/**
+ * @brief Makes the storage key (SK) created (or loaded from the pool) by
+ *        the context-based seal calls persistent at the given handle, so
+ *        that unsealing data sealed under it no longer has to load it.
+ *        Unseal calls always look for a persistent copy of the .ski's
+ *        storage key first, and fall back to loading it. A different key
+ *        already persistent at the handle is evicted. Persistent (NV)
+ *        slots are scarce - use kmyth_ctx_list_persistent_sks() and
+ *        kmyth_ctx_evict_persistent_sk() to manage them.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  handle            Persistent handle (KMYTH_PERSISTENT_SK_FIRST
+ *                               to KMYTH_PERSISTENT_SK_LAST), or 0 to stop
+ *                               making storage keys persistent (the default)
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_persistent_sk(kmyth_ctx_t * ctx, uint32_t handle);
+
+/**
+ * @brief Lists the persistent handles in use in the Kmyth persistent
+ *        storage key range.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[out] handles           Array receiving the handles
+ *
+ * @param[in]  max_handles       Number of entries in handles
+ *
+ * @param[out] count             Number of handles in use (which may be more
+ *                               than max_handles, if only that many were
+ *                               returned)
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_list_persistent_sks(kmyth_ctx_t * ctx, uint32_t * handles,
+                                    size_t max_handles, size_t *count);
+
+/**
+ * @brief Evicts a persistent storage key, freeing its persistent slot.
+ *        Data sealed under it can still be unsealed (by loading the key
+ *        from the .ski).
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  handle            Persistent handle of the storage key
+ *
+ * @param[in]  owner_auth_bytes  TPM owner (storage) hierarchy password
+ *
+ * @param[in]  oa_bytes_len      Number of bytes in owner_auth_bytes
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_evict_persistent_sk(kmyth_ctx_t * ctx, uint32_t handle,
+                                    uint8_t * owner_auth_bytes,
+                                    size_t oa_bytes_len);
+
+/**
+ * @brief Range of TPM NV index handles that .ski data can be stored at
+ *        (see kmyth_ctx_store_nv()), within the owner-defined NV range.
+ */
+#define KMYTH_NV_SKI_FIRST 0x01800100
+#define KMYTH_NV_SKI_LAST 0x018001FF
+
+/**
+ * @brief Stores binary format .ski data (see KMYTH_SKI_FORMAT_BINARY) in a
+ *        TPM NV index, so that tpm2_kmyth_unseal_nv() can unseal it with
+ *        no file I/O at all (e.g., from an initramfs). The index is
+ *        defined (or, if it exists with another size, re-defined) to
+ *        exactly the size of the data, which must not exceed the TPM's
+ *        largest NV index - only small payloads (a key or a password,
+ *        say) fit. NV space is scarce and NV writes wear the TPM, so this
+ *        suits data that is rarely re-sealed.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  nv_index          NV index handle (KMYTH_NV_SKI_FIRST to
+ *                               KMYTH_NV_SKI_LAST)
+ *
+ * @param[in]  ski_bytes         The binary format .ski data
+ *
+ * @param[in]  ski_bytes_len     The size, in bytes, of ski_bytes
+ *
+ * @param[in]  owner_auth_bytes  TPM owner (storage) hierarchy password
+ *
+ * @param[in]  oa_bytes_len      Number of bytes in owner_auth_bytes
+ *
+ * @return 0 on success, 1 on error (including data too large for an NV
+ *         index, or for the TPM's remaining NV space)
+ */
+  int kmyth_ctx_store_nv(kmyth_ctx_t * ctx, uint32_t nv_index,
+                         uint8_t * ski_bytes, size_t ski_bytes_len,
+                         uint8_t * owner_auth_bytes, size_t oa_bytes_len);
+
+/**
+ * @brief Removes (undefines) an NV index written by kmyth_ctx_store_nv(),
+ *        freeing its NV space.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  nv_index          NV index handle (KMYTH_NV_SKI_FIRST to
+ *                               KMYTH_NV_SKI_LAST)
+ *
+ * @param[in]  owner_auth_bytes  TPM owner (storage) hierarchy password
+ *
+ * @param[in]  oa_bytes_len      Number of bytes in owner_auth_bytes
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_remove_nv(kmyth_ctx_t * ctx, uint32_t nv_index,
+                          uint8_t * owner_auth_bytes, size_t oa_bytes_len);
+
+/**
+ * @brief Enables (non-zero) or disables (0, the default) caching of the
+ *        saved contexts of the TPM objects (storage keys and sealed
+ *        wrapping keys) the context loads. Loading the same .ski's objects
+ *        again then takes a cheap TPM2_ContextLoad instead of a TPM2_Load
+ *        (which decrypts and checks the object's private blob). Cached
+ *        contexts are dropped when the TPM is reset or restarted. Suited
+ *        to long-lived contexts (e.g., kmyth-agent) that unseal the same
+ *        files repeatedly - filling the cache costs a TPM2_ContextSave per
+ *        object loaded.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  enabled           Whether to cache object contexts
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_object_cache(kmyth_ctx_t * ctx, int enabled);
+
+/**
+ * @brief Sets the number of workers used by the batch calls
+ *        (tpm2_kmyth_seal_batch() and tpm2_kmyth_unseal_batch()) for the
+ *        host-side work on their inputs - encryption/decryption and .ski
+ *        formatting/parsing - and by the other calls for encrypting and
+ *        decrypting the chunks of chunked data (see
+ *        tpm2_kmyth_seal_chunked()). TPM commands are always issued one at
+ *        a time, over the context's own connection. Defaults to 1 (no
+ *        threads).
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  jobs              Number of workers (1 to KMYTH_MAX_JOBS)
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_jobs(kmyth_ctx_t * ctx, size_t jobs);
+
+/**
+ * @brief Sets whether the .ski output of seals made with a context records
+ *        the name of the storage root key (SRK) it was sealed under. The
+ *        SRK name identifies the TPM that can unseal the data, which is
+ *        used to route unseal requests in a kmyth_pool_t. Unsealing
+ *        detects .ski data sealed under another TPM's SRK before loading
+ *        anything. Off by default, as older versions of Kmyth cannot parse
+ *        the recorded name.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  enabled           Non-zero to record the SRK name
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_record_srk(kmyth_ctx_t * ctx, int enabled);
+
+/**
+ * @brief Sets whether unseals made with a context first check the TPM's
+ *        current PCR values against the sealed data's policy. The PCRs are
+ *        read once (once per PCR selection for a batch) and the policy
+ *        digest is computed on the host, so data whose PCRs have changed
+ *        is rejected before any TPM sessions or objects are set up for it.
+ *        Off by default, as it costs a PCR read when the PCRs do match.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  enabled           Non-zero to check the PCRs first
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_policy_precheck(kmyth_ctx_t * ctx, int enabled);
+
+/**
+ * @brief Sets the chunk size used by tpm2_kmyth_seal_file_ctx(), which then
+ *        writes a chunked .ski (as tpm2_kmyth_seal_chunked() does) whose
+ *        chunks are encrypted by the workers set with kmyth_ctx_set_jobs().
+ *        Chunked data is decrypted in parallel in the same way, whatever
+ *        this setting. Defaults to 0 (unchunked output).
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  chunk_size        The size, in bytes, of each (but the last)
+ *                               plaintext chunk, or 0 to not chunk the data
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_chunk_size(kmyth_ctx_t * ctx, size_t chunk_size);
+
+/**
+ * @brief Sets the compression applied to data before it is encrypted when
+ *        sealing (including streaming seals). Inputs smaller than
+ *        KMYTH_COMPRESSION_MIN_SIZE bytes (or, unless streamed, that do not
+ *        get any smaller) are sealed uncompressed. Compressed data is marked in the .ski cipher
+ *        suite, and is decompressed when unsealed whatever this setting.
+ *        Chunked data cannot be compressed. Defaults to no compression.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  compression       Compression algorithm name ("zstd"), or
+ *                               "none" or NULL to not compress
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_compression(kmyth_ctx_t * ctx, const char *compression);
+
+/**
+ * @brief Returned, instead of 1, by the seal, unseal and rewrap calls
+ *        taking a context (tpm2_kmyth_seal_ctx(), tpm2_kmyth_unseal_ctx(),
+ *        their _into, _batch, _stream and _file variants, and
+ *        tpm2_kmyth_rewrap*()) that failed once the context's deadline had
+ *        passed, or the context had been cancelled. The context may be used
+ *        again: if a TPM command was abandoned mid-way, the context's next
+ *        call first waits (within its own deadline) for the TPM to finish
+ *        that command, and drops its response. Objects the failed call
+ *        could not flush past its deadline stay loaded until the context is
+ *        destroyed, so a context that keeps timing out is better replaced
+ *        (e.g., released to its pool with discard set).
+ */
+#define KMYTH_ERR_TIMEOUT 2
+
+/**
+ * @brief Sets the deadline the calls made with a context must be done by,
+ *        and clears any earlier cancellation (see kmyth_ctx_cancel()).
+ *        Past the deadline, no further TPM command is sent, busy TPM
+ *        commands are not retried, and a command the TPM is still working
+ *        on is abandoned within KMYTH_DEADLINE_POLL_MS (50) milliseconds
+ *        (see KMYTH_ERR_TIMEOUT for reusing the context after that).
+ *        Defaults to no deadline.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  deadline_ns       Absolute CLOCK_MONOTONIC time, in
+ *                               nanoseconds, or 0 for no deadline
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_deadline(kmyth_ctx_t * ctx, uint64_t deadline_ns);
+
+/**
+ * @brief Cancels the call being made with a context (and any made later,
+ *        until kmyth_ctx_set_deadline() is called again), as though its
+ *        deadline had passed. Unlike the other kmyth_ctx_*() calls, it may
+ *        be made from any thread, while another uses the context. A TPM
+ *        command already sent is only abandoned early if a deadline is
+ *        also set - otherwise the call stops before its next command.
+ *        Either way, the context may be used again once
+ *        kmyth_ctx_set_deadline() is called (see KMYTH_ERR_TIMEOUT).
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_cancel(kmyth_ctx_t * ctx);
+
+/**
+ * @brief Phases of the seal/unseal calls timed into a kmyth_timings_t
+ *        attached to a context with kmyth_ctx_set_timings().
+ */
+  typedef enum kmyth_phase_e
+  {
+    KMYTH_PHASE_CONNECT,        /**< connecting to the resource manager */
+    KMYTH_PHASE_SRK,            /**< finding (or re-deriving) the SRK */
+    KMYTH_PHASE_POLICY,         /**< starting/applying policy sessions */
+    KMYTH_PHASE_CREATE,         /**< Tss2_Sys_Create (SK, sealed data) */
+    KMYTH_PHASE_LOAD,           /**< Tss2_Sys_Load (SK, sealed data) */
+    KMYTH_PHASE_UNSEAL,         /**< Tss2_Sys_Unseal */
+    KMYTH_PHASE_ENCRYPT,        /**< symmetric encryption of the input */
+    KMYTH_PHASE_DECRYPT,        /**< symmetric decryption of the .ski data */
+    KMYTH_PHASE_COUNT
+  } kmyth_phase_t;
+
+/**
+ * @brief Maximum number of distinct TPM command codes recorded in a
+ *        kmyth_timings_t (commands beyond this are only counted in
+ *        dropped_commands)
+ */
+#define KMYTH_TIMINGS_MAX_COMMANDS 32
+
+/**
+ * @brief Monotonic clock durations, in nanoseconds, accumulated by the
+ *        seal/unseal calls made with a context (see kmyth_ctx_set_timings()).
+ *
+ * Each phase is recorded as the total time spent in it and the number of
+ * times it was entered. Every command sent to the TPM over the context's
+ * connection is also recorded, by command code, from the time it is sent
+ * until its response has been received. In the batch calls, host-side
+ * work overlapped with a TPM command (see kmyth_ctx_set_jobs()) is included
+ * in the time of that command. Commands the TPM was too busy to execute
+ * are retried after a delay, which is counted separately.
+ */
+  typedef struct kmyth_timings_s
+  {
+    /** @brief time spent in each phase, indexed by kmyth_phase_t */
+    uint64_t phase_ns[KMYTH_PHASE_COUNT];
+
+    /** @brief number of times each phase was entered */
+    uint64_t phase_calls[KMYTH_PHASE_COUNT];
+
+    /** @brief number of valid entries in commands */
+    size_t command_count;
+
+    /** @brief number of commands not recorded (commands array full) */
+    uint64_t dropped_commands;
+
+    /** @brief number of commands retried because the TPM was busy */
+    uint64_t retries;
+
+    /** @brief time spent waiting (backing off) before those retries */
+    uint64_t retry_wait_ns;
+
+    /**
+     * @brief heap use of the seal/unseal calls, counted only by a build
+     *        instrumented with make KMYTH_ALLOC_STATS=1 (see alloc_stats.h):
+     *        the number of calls measured, the blocks they allocated and
+     *        freed, the bytes they allocated, and the most bytes any one
+     *        call held at once beyond what was allocated when it started
+     */
+    uint64_t alloc_calls;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t alloc_bytes;
+    uint64_t peak_alloc_bytes;
+
+    /** @brief per TPM command code timings, in order of first use */
+    struct
+    {
+      uint32_t command_code;
+      uint64_t calls;
+      uint64_t total_ns;
+      uint64_t max_ns;
+    } commands[KMYTH_TIMINGS_MAX_COMMANDS];
+  } kmyth_timings_t;
+
+/**
+ * @brief Attaches timings to a context, so that the seal/unseal calls
+ *        made with it accumulate their per-phase and per TPM command
+ *        durations into it. The time taken by kmyth_ctx_create() to
+ *        connect to the TPM is added when the timings are first attached.
+ *        Timings are not reset - zero the struct to start over.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  timings           Timings to accumulate into (must outlive
+ *                               its use by ctx), or NULL to stop timing
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_set_timings(kmyth_ctx_t * ctx, kmyth_timings_t * timings);
+
+/**
+ * @brief Returns a short, printable name for a timed phase
+ *        (e.g., "unseal"), or NULL for an invalid phase.
+ */
+  const char *kmyth_phase_name(kmyth_phase_t phase);
+
+/**
+ * @brief Writes a human readable table of the recorded timings (one line
+ *        per phase entered and per TPM command code) to out.
+ *
+ * @param[in]  out               Stream to write to (e.g., stderr)
+ *
+ * @param[in]  timings           Timings to report
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_timings_print(FILE * out, const kmyth_timings_t * timings);
+
+/**
+ * @brief Context-based variant of tpm2_kmyth_seal(). Uses the TPM 2.0
+ *        connection and cached SRK handle held by ctx instead of setting
+ *        up (and tearing down) a new connection.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_seal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_ctx(kmyth_ctx_t * ctx,
+                          uint8_t * input, size_t input_len,
+                          uint8_t ** output, size_t *output_len,
+                          uint8_t * auth_bytes, size_t auth_bytes_len,
+                          uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                          int *pcrs, size_t pcrs_len, char *cipher_string,
+                          char *expected_policy, uint8_t bool_trial_only);
+
+/**
+ * @brief Context-based variant of tpm2_kmyth_unseal().
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_ctx(kmyth_ctx_t * ctx,
+                            uint8_t * input, size_t input_len,
+                            uint8_t ** output, size_t *output_len,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            uint8_t bool_policy_or);
+
+/**
+ * @brief Context-based variant of tpm2_kmyth_unseal_into(). The chunks of
+ *        chunked data are decrypted into buf by the context's workers.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *                               (may be NULL for a size query)
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal_into().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_into_ctx(kmyth_ctx_t * ctx,
+                                 uint8_t * input, size_t input_len,
+                                 uint8_t * buf, size_t cap, size_t *len,
+                                 uint8_t * auth_bytes, size_t auth_bytes_len,
+                                 uint8_t * owner_auth_bytes,
+                                 size_t oa_bytes_len, uint8_t bool_policy_or);
+
+/**
+ * @brief Context-based variant of tpm2_kmyth_seal_file(). If the context
+ *        has a chunk size set (see kmyth_ctx_set_chunk_size()), the output
+ *        is a chunked .ski.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_seal_file().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_file_ctx(kmyth_ctx_t * ctx,
+                               char *input_path,
+                               uint8_t ** output, size_t *output_len,
+                               uint8_t * auth_bytes, size_t auth_bytes_len,
+                               uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                               int *pcrs, size_t pcrs_len, char *cipher_string,
+                               char *expected_policy, uint8_t bool_trial_only);
+
+/**
+ * @brief Context-based variant of tpm2_kmyth_unseal_file().
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal_file().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_file_ctx(kmyth_ctx_t * ctx,
+                                 char *input_path,
+                                 uint8_t ** output, size_t *output_length,
+                                 uint8_t * auth_bytes, size_t auth_bytes_len,
+                                 uint8_t * owner_auth_bytes,
+                                 size_t oa_bytes_len, uint8_t policy_or);
+
+/**
+ * @brief Variant of tpm2_kmyth_unseal_file_ctx() unsealing the .ski data
+ *        stored in a TPM NV index by kmyth_ctx_store_nv(). The data is
+ *        read with as few NV reads as the TPM's transfer limit allows.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  nv_index          NV index handle (KMYTH_NV_SKI_FIRST to
+ *                               KMYTH_NV_SKI_LAST)
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal_file().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_nv(kmyth_ctx_t * ctx, uint32_t nv_index,
+                           uint8_t ** output, size_t *output_length,
+                           uint8_t * auth_bytes, size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                           uint8_t policy_or);
+
+/**
+ * @brief Seals a batch of inputs under a single, shared storage key.
+ *
+ * The storage key, authorization value, and policy digest are created once
+ * and reused for every input, as is the policy session authorizing the
+ * sealing of each wrapping key. Each input still gets its own wrapping key
+ * and its own .ski formatted output (the .ski format is unchanged). A
+ * failure on one input is recorded in its result and does not stop the
+ * rest of the batch. The inputs are encrypted, and their outputs formatted,
+ * by the number of workers set with kmyth_ctx_set_jobs().
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  count             Number of inputs in the batch
+ *
+ * @param[in]  inputs            Array of count input (plaintext) buffers
+ *
+ * @param[in]  input_lens        Array of count input buffer lengths
+ *
+ * @param[out] outputs           Array of count output pointers. On success
+ *                               for item i, outputs[i] holds the .ski
+ *                               formatted result (to be freed by the caller),
+ *                               otherwise it is set to NULL
+ *
+ * @param[out] output_lens       Array of count output lengths (0 on error)
+ *
+ * @param[out] results           Array of count per-item results
+ *                               (0 on success, 1 on error)
+ *
+ * All other parameters are as described for tpm2_kmyth_seal(), and apply
+ * to every item in the batch.
+ *
+ * @return 0 if every item was sealed, 1 if the batch could not be started
+ *         or any item failed
+ */
+  int tpm2_kmyth_seal_batch(kmyth_ctx_t * ctx, size_t count,
+                            uint8_t ** inputs, size_t *input_lens,
+                            uint8_t ** outputs, size_t *output_lens,
+                            int *results,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            int *pcrs, size_t pcrs_len,
+                            char *cipher_string, char *expected_policy);
+
+/**
+ * @brief Unseals a batch of .ski formatted inputs over a single Kmyth
+ *        context.
+ *
+ * Inputs sealed under the same storage key (identical sk_pub/sk_priv) are
+ * grouped so that each distinct storage key is loaded into the TPM only
+ * once, and every wrapping key in the group is unsealed under it. A failure
+ * on one input is recorded in its result and does not stop the rest of the
+ * batch. The inputs are parsed, and their data decrypted, by the number of
+ * workers set with kmyth_ctx_set_jobs().
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  count             Number of inputs in the batch
+ *
+ * @param[in]  inputs            Array of count .ski formatted input buffers
+ *
+ * @param[in]  input_lens        Array of count input buffer lengths
+ *
+ * @param[out] outputs           Array of count output pointers. On success
+ *                               for item i, outputs[i] holds the unsealed
+ *                               data (to be freed by the caller), otherwise
+ *                               it is set to NULL
+ *
+ * @param[out] output_lens       Array of count output lengths (0 on error)
+ *
+ * @param[out] results           Array of count per-item results
+ *                               (0 on success, 1 on error)
+ *
+ * @param[in]  auth_bytes        As described for tpm2_kmyth_unseal(),
+ *                               applied to all items
+ *
+ * @param[in]  auth_bytes_len    Length of auth_bytes
+ *
+ * @param[in]  owner_auth_bytes  As described for tpm2_kmyth_unseal()
+ *
+ * @param[in]  oa_bytes_len      Length of owner_auth_bytes
+ *
+ * @param[in]  bool_policy_or    As described for tpm2_kmyth_unseal(),
+ *                               applied to all items
+ *
+ * @return 0 if every item was unsealed, 1 if the batch could not be started
+ *         or any item failed
+ */
+  int tpm2_kmyth_unseal_batch(kmyth_ctx_t * ctx, size_t count,
+                              uint8_t ** inputs, size_t *input_lens,
+                              uint8_t ** outputs, size_t *output_lens,
+                              int *results,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                              uint8_t bool_policy_or);
+
+/**
+ * @brief Seals data read from a file descriptor, writing the .ski formatted
+ *        result to another file descriptor, using bounded memory.
+ *
+ * The input is read, encrypted, and written out in blocks of
+ * KMYTH_STREAM_BLOCK_SIZE bytes, so data of any size can be sealed. The
+ * output is identical in format to that of tpm2_kmyth_seal(), and can be
+ * unsealed by either unseal path. Only ciphers supporting streaming
+ * (currently the AES/GCM ciphers) can be used.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  in_fd             File descriptor to read the data to be
+ *                               sealed from (until end-of-file)
+ *
+ * @param[in]  out_fd            File descriptor to write the .ski formatted
+ *                               result to. On error, anything already
+ *                               written is incomplete and must be discarded.
+ *
+ * All other parameters are as described for tpm2_kmyth_seal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_stream(kmyth_ctx_t * ctx, int in_fd, int out_fd,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             int *pcrs, size_t pcrs_len,
+                             char *cipher_string, char *expected_policy);
+
+/**
+ * @brief Unseals .ski formatted data read from a file descriptor, writing
+ *        the result to another file descriptor, using bounded memory.
+ *
+ * The encrypted data is read, decrypted, and written out in blocks of
+ * KMYTH_STREAM_BLOCK_SIZE bytes, so data of any size can be unsealed. The
+ * input may have been produced by either seal path, but must use a cipher
+ * supporting streaming (currently the AES/GCM ciphers).
+ *
+ * Note: decrypted data is written out before the integrity of the whole
+ * input has been verified, which only happens once the end of the input is
+ * reached. If this function returns an error, everything written to out_fd
+ * must be discarded.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  in_fd             File descriptor to read the .ski formatted
+ *                               input from (until end-of-file)
+ *
+ * @param[in]  out_fd            File descriptor to write the unsealed data
+ *                               to
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_stream(kmyth_ctx_t * ctx, int in_fd, int out_fd,
+                               uint8_t * auth_bytes, size_t auth_bytes_len,
+                               uint8_t * owner_auth_bytes,
+                               size_t oa_bytes_len, uint8_t bool_policy_or);
+
+/**
+ * @brief Seals data into a chunked .ski: a variant in which the encrypted
+ *        data is split into separately authenticated chunks, so that any
+ *        byte range of it can later be unsealed without decrypting the
+ *        rest (see tpm2_kmyth_unseal_range()).
+ *
+ * Each chunk of (at most) chunk_size plaintext bytes is encrypted under
+ * the same wrapping key and a fresh IV, with the chunk index (format
+ * version, chunk size, and total data length) and the chunk's number
+ * authenticated alongside it, so chunks cannot be reordered, dropped, or
+ * mixed between files undetected. Only AES/GCM ciphers can be used.
+ *
+ * A chunked .ski can also be unsealed as a whole by tpm2_kmyth_unseal(),
+ * but not by tpm2_kmyth_unseal_stream().
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  chunk_size        The size, in bytes, of each (but the last)
+ *                               plaintext chunk, or zero for the default
+ *                               (KMYTH_DEFAULT_CHUNK_SIZE)
+ *
+ * All other parameters are as described for tpm2_kmyth_seal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_chunked(kmyth_ctx_t * ctx,
+                              uint8_t * input, size_t input_len,
+                              size_t chunk_size,
+                              uint8_t ** output, size_t *output_len,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes,
+                              size_t oa_bytes_len,
+                              int *pcrs, size_t pcrs_len,
+                              char *cipher_string, char *expected_policy);
+
+/**
+ * @brief Unseals a byte range of the data sealed in a chunked .ski (see
+ *        tpm2_kmyth_seal_chunked()).
+ *
+ * The wrapping key is unsealed once, and then only the chunks overlapping
+ * the requested range are base64 decoded, verified, and decrypted.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  input             The chunked .ski formatted bytes
+ *
+ * @param[in]  input_len         The number of input bytes
+ *
+ * @param[in]  offset            Offset, within the sealed data, of the first
+ *                               byte to unseal
+ *
+ * @param[in]  length            Number of bytes to unseal (the range must
+ *                               lie within the sealed data)
+ *
+ * @param[out] output            The unsealed bytes (allocated here, the
+ *                               caller must free them)
+ *
+ * @param[out] output_len        The number of output bytes (length)
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_range(kmyth_ctx_t * ctx,
+                              uint8_t * input, size_t input_len,
+                              size_t offset, size_t length,
+                              uint8_t ** output, size_t *output_len,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes,
+                              size_t oa_bytes_len, uint8_t bool_policy_or);
+
+/**
+ * @brief Re-seals .ski formatted data under a new storage key and
+ *        authorization policy (PCR selection), without decrypting it.
+ *
+ * Only the wrapping key is unsealed, and it is then sealed again, under
+ * the new policy. The encrypted data (including any chunk index) is copied
+ * to the output unchanged, so the cost does not depend on the size of the
+ * sealed data. The cipher, and so the wrapping key, stays the same, and
+ * the output is in the same (text or binary) format as the input.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  input             The .ski formatted data to be re-sealed
+ *
+ * @param[in]  input_len         The size, in bytes, of input
+ *
+ * @param[out] output            The re-sealed .ski formatted data
+ *
+ * @param[out] output_len        The size, in bytes, of output
+ *
+ * @param[in]  pcrs              The PCRs to which the data is re-sealed
+ *
+ * @param[in]  pcrs_len          The number of PCRs in pcrs
+ *
+ * @param[in]  expected_policy   Alternative policy digest for the new
+ *                               policy (as for tpm2_kmyth_seal()), or NULL
+ *
+ * @param[in]  bool_policy_or    Whether the input was sealed with a
+ *                               policy-OR (as for tpm2_kmyth_unseal())
+ *
+ * The authorization parameters are as described for tpm2_kmyth_seal(),
+ * and are used both to unseal the input and to re-seal it.
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_rewrap(kmyth_ctx_t * ctx,
+                        uint8_t * input, size_t input_len,
+                        uint8_t ** output, size_t *output_len,
+                        uint8_t * auth_bytes, size_t auth_bytes_len,
+                        uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                        int *pcrs, size_t pcrs_len, char *expected_policy,
+                        uint8_t bool_policy_or);
+
+/**
+ * @brief Re-seals a batch of .ski formatted inputs under a new PCR policy
+ *        over a single Kmyth context, as tpm2_kmyth_rewrap() does for one.
+ *
+ * The wrapping keys are recovered as by tpm2_kmyth_unseal_batch() (each
+ * distinct storage key they were sealed under is loaded once). The new
+ * policy (including any expected_policy branch) is then computed, and a
+ * new storage key created, just once for the whole batch (once per storage
+ * key algorithm, if the inputs use more than one), and every wrapping key
+ * is re-sealed under it over one policy session. The inputs are parsed,
+ * and the outputs formatted, by the number of workers set with
+ * kmyth_ctx_set_jobs(). A failure on one input is recorded in its result
+ * and does not stop the rest of the batch.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  count             Number of inputs in the batch
+ *
+ * @param[in]  inputs            Array of count .ski formatted input buffers
+ *
+ * @param[in]  input_lens        Array of count input buffer lengths
+ *
+ * @param[out] outputs           Array of count output pointers. On success
+ *                               for item i, outputs[i] holds the re-sealed
+ *                               .ski (to be freed by the caller), otherwise
+ *                               it is set to NULL
+ *
+ * @param[out] output_lens       Array of count output lengths (0 on error)
+ *
+ * @param[out] results           Array of count per-item results
+ *                               (0 on success, 1 on error)
+ *
+ * All other parameters are as described for tpm2_kmyth_rewrap(), and are
+ * applied to all items.
+ *
+ * @return 0 if every item was re-sealed, 1 if the batch could not be
+ *         started or any item failed
+ */
+  int tpm2_kmyth_rewrap_batch(kmyth_ctx_t * ctx, size_t count,
+                              uint8_t ** inputs, size_t *input_lens,
+                              uint8_t ** outputs, size_t *output_lens,
+                              int *results,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                              int *pcrs, size_t pcrs_len,
+                              char *expected_policy, uint8_t bool_policy_or);
+
+/**
+ * @brief Maximum number of TPM connections (devices) in a kmyth_pool_t
+ */
+#define KMYTH_POOL_MAX 8
+
+/**
+ * @brief Opaque pool of Kmyth contexts, each connected to a different TPM
+ *        (e.g., a discrete and a firmware TPM, or several virtual TPMs),
+ *        used to spread seal/unseal work over all of them.
+ *
+ * Each request is sent to the least loaded device - the one with the
+ * fewest requests queued or in progress. Seals made through a pool record
+ * the name of the SRK they were sealed under (see
+ * kmyth_ctx_set_record_srk()), so unseal requests for them are routed to
+ * the TPM holding that SRK. Data sealed without a recorded SRK is tried on
+ * the least loaded device first, then on the others.
+ *
+ * Unlike a kmyth_ctx_t, a pool may be used by several threads at once:
+ * requests for different devices then run in parallel, and those for the
+ * same device are run one at a time.
+ */
+  typedef struct kmyth_pool_s kmyth_pool_t;
+
+/**
+ * @brief Creates a pool of Kmyth contexts, one for each TCTI configuration
+ *        given (see kmyth_ctx_create_tcti()).
+ *
+ * @param[out] pool              Newly created pool -
+ *                               passed as pointer to a NULL pool pointer
+ *
+ * @param[in]  tcti_confs        Array of count TCTI configuration strings,
+ *                               one per device
+ *
+ * @param[in]  count             Number of devices (1 to KMYTH_POOL_MAX), or
+ *                               0 for a single device using the configured
+ *                               (or default) TCTI
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_pool_create(kmyth_pool_t ** pool, const char **tcti_confs,
+                        size_t count);
+
+/**
+ * @brief Destroys a pool created by kmyth_pool_create(), and all of its
+ *        contexts. No requests may be in progress.
+ *
+ * @param[in]  pool              Pool to be destroyed - passed as pointer to
+ *                               pool pointer, which is set to NULL
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_pool_destroy(kmyth_pool_t ** pool);
+
+/**
+ * @brief Returns the number of devices in a pool (0 if pool is NULL).
+ */
+  size_t kmyth_pool_size(kmyth_pool_t * pool);
+
+/**
+ * @brief Returns the context of one of the devices in a pool, so that it
+ *        can be configured (e.g., with kmyth_ctx_set_jobs()). It must not
+ *        be used while requests are in progress on the pool.
+ *
+ * @param[in]  pool              Pool created by kmyth_pool_create()
+ *
+ * @param[in]  index             Device index (0 to kmyth_pool_size() - 1)
+ *
+ * @return The device's context, or NULL if index is out of range
+ */
+  kmyth_ctx_t *kmyth_pool_get_ctx(kmyth_pool_t * pool, size_t index);
+
+/**
+ * @brief Pool variant of tpm2_kmyth_seal_ctx(), sealing on the least
+ *        loaded device.
+ *
+ * @param[in]  pool              Pool created by kmyth_pool_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_seal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_pool(kmyth_pool_t * pool,
+                           uint8_t * input, size_t input_len,
+                           uint8_t ** output, size_t *output_len,
+                           uint8_t * auth_bytes, size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                           int *pcrs, size_t pcrs_len, char *cipher_string,
+                           char *expected_policy);
+
+/**
+ * @brief Pool variant of tpm2_kmyth_unseal_ctx(), unsealing on the device
+ *        holding the SRK the input was sealed under.
+ *
+ * @param[in]  pool              Pool created by kmyth_pool_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_unseal_pool(kmyth_pool_t * pool,
+                             uint8_t * input, size_t input_len,
+                             uint8_t ** output, size_t *output_len,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             uint8_t bool_policy_or);
+
+/**
+ * @brief Pool variant of tpm2_kmyth_seal_batch(). The batch is split into
+ *        one contiguous share per device, sealed in parallel (each share
+ *        under its own storage key).
+ *
+ * @param[in]  pool              Pool created by kmyth_pool_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_seal_batch().
+ *
+ * @return 0 if every item was sealed, 1 if the batch could not be started
+ *         or any item failed
+ */
+  int tpm2_kmyth_seal_batch_pool(kmyth_pool_t * pool, size_t count,
+                                 uint8_t ** inputs, size_t *input_lens,
+                                 uint8_t ** outputs, size_t *output_lens,
+                                 int *results,
+                                 uint8_t * auth_bytes, size_t auth_bytes_len,
+                                 uint8_t * owner_auth_bytes,
+                                 size_t oa_bytes_len,
+                                 int *pcrs, size_t pcrs_len,
+                                 char *cipher_string, char *expected_policy);
+
+/**
+ * @brief Pool variant of tpm2_kmyth_unseal_batch(). Each item is routed
+ *        to the device holding the SRK it was sealed under (items that do
+ *        not record one are spread over the least loaded devices), and the
+ *        devices' shares are unsealed in parallel. Items without a recorded
+ *        SRK that fail are retried on the other devices.
+ *
+ * @param[in]  pool              Pool created by kmyth_pool_create()
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal_batch().
+ *
+ * @return 0 if every item was unsealed, 1 if the batch could not be
+ *         started or any item failed
+ */
+  int tpm2_kmyth_unseal_batch_pool(kmyth_pool_t * pool, size_t count,
+                                   uint8_t ** inputs, size_t *input_lens,
+                                   uint8_t ** outputs, size_t *output_lens,
+                                   int *results,
+                                   uint8_t * auth_bytes,
+                                   size_t auth_bytes_len,
+                                   uint8_t * owner_auth_bytes,
+                                   size_t oa_bytes_len,
+                                   uint8_t bool_policy_or);
+
+/**
+ * @brief Maximum number of contexts a kmyth_ctx_pool_t can hold
+ */
+#define KMYTH_CTX_POOL_MAX 64
+
+/**
+ * @brief Opaque checkout pool of Kmyth contexts connected to one TPM, for
+ *        multi-threaded use of the library.
+ *
+ * Thread safety: a kmyth_ctx_t (like the SAPI context it holds) must only
+ * be used by one thread at a time. Everything else the seal/unseal calls
+ * share is safe to use from any thread - the logger settings, the cipher
+ * table and one-time cipher set up, the unseal cache and the secure heap
+ * are all internally synchronized, and the functions that create their own
+ * context (e.g., tpm2_kmyth_seal() and tpm2_kmyth_unseal()) may be called
+ * concurrently. (Logger settings should still be made before threads
+ * start logging, so every message is logged the same way.)
+ *
+ * A worker thread checks a context out of the pool for each request (or
+ * run of requests), uses it with the _ctx functions, and returns it, so no
+ * caller-side lock is needed. Contexts are created as they are first
+ * needed, up to the pool's limit, after which a checkout waits for one to
+ * be returned. Each has its own TPM connection (the resource manager
+ * serializes their commands at the TPM, but parsing and bulk encryption
+ * run in parallel) and keeps its cached SRK handle across checkouts.
+ */
+  typedef struct kmyth_ctx_pool_s kmyth_ctx_pool_t;
+
+/**
+ * @brief Set up run on each context a kmyth_ctx_pool_t creates (e.g., to
+ *        call kmyth_ctx_set_jobs()). Returns 0 on success, 1 on error.
+ */
+  typedef int (*kmyth_ctx_pool_init_fn) (kmyth_ctx_t * ctx, void *arg);
+
+/**
+ * @brief Creates an (empty) checkout pool of Kmyth contexts.
+ *
+ * @param[out] pool              Newly created pool -
+ *                               passed as pointer to a NULL pool pointer
+ *
+ * @param[in]  tcti_conf         TCTI configuration for the contexts (see
+ *                               kmyth_ctx_create_tcti()), or NULL for the
+ *                               configured (or default) TCTI
+ *
+ * @param[in]  max_ctxs          Most contexts the pool may hold at once
+ *                               (1 to KMYTH_CTX_POOL_MAX)
+ *
+ * @param[in]  init              Set up run on each new context, or NULL
+ *
+ * @param[in]  init_arg          Argument passed to init
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_pool_create(kmyth_ctx_pool_t ** pool, const char *tcti_conf,
+                            size_t max_ctxs, kmyth_ctx_pool_init_fn init,
+                            void *init_arg);
+
+/**
+ * @brief Destroys a pool created by kmyth_ctx_pool_create(), and its
+ *        contexts. Every context must have been returned to it.
+ *
+ * @param[in]  pool              Pool to be destroyed - passed as pointer to
+ *                               pool pointer, which is set to NULL
+ *
+ * @return 0 on success, 1 on error (including contexts not returned)
+ */
+  int kmyth_ctx_pool_destroy(kmyth_ctx_pool_t ** pool);
+
+/**
+ * @brief Checks a context out of a pool, for the calling thread's use
+ *        only, until it is returned with kmyth_ctx_pool_release(). Waits
+ *        if all of the pool's contexts are checked out.
+ *
+ * @param[in]  pool              Pool created by kmyth_ctx_pool_create()
+ *
+ * @param[out] ctx               The context checked out
+ *
+ * @return 0 on success, 1 on error (e.g., a new context could not connect)
+ */
+  int kmyth_ctx_pool_acquire(kmyth_ctx_pool_t * pool, kmyth_ctx_t ** ctx);
+
+/**
+ * @brief Returns a context checked out by kmyth_ctx_pool_acquire().
+ *
+ * @param[in]  pool              Pool the context was checked out of
+ *
+ * @param[in]  ctx               The context
+ *
+ * @param[in]  discard           Non-zero to destroy the context rather
+ *                               than keep it (e.g., after its TPM
+ *                               connection failed) - a new one is created
+ *                               when next needed
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_ctx_pool_release(kmyth_ctx_pool_t * pool, kmyth_ctx_t * ctx,
+                             int discard);
+
+/**
+ * @brief Maximum number of workers a kmyth_async_t can run
+ */
+#define KMYTH_ASYNC_MAX_WORKERS KMYTH_CTX_POOL_MAX
+
+/**
+ * @brief Opaque engine running seal/unseal requests in the background,
+ *        for callers built around an event loop (e.g., libuv or asio).
+ *
+ * A request is submitted (kmyth_seal_async() or kmyth_unseal_async())
+ * without blocking, and run by one of the engine's workers on a context
+ * checked out of a kmyth_ctx_pool_t. When it is done, the engine's file
+ * descriptor (kmyth_async_fd()) becomes readable, and the caller's loop
+ * then calls kmyth_async_complete(), which runs the callbacks of the
+ * completed requests on the loop's own thread. One thread can so keep as
+ * many requests in flight as it likes, while at most the number of
+ * workers are run at once.
+ */
+  typedef struct kmyth_async_s kmyth_async_t;
+
+  struct kmyth_async_req_s;
+
+/**
+ * @brief Callback run by kmyth_async_complete() for a completed request,
+ *        with its result, output and output_len set.
+ */
+  typedef void (*kmyth_async_callback_t)(struct kmyth_async_req_s * req);
+
+/**
+ * @brief A seal or unseal request for a kmyth_async_t. It is owned by the
+ *        caller (and so may be part of a larger structure), and it and
+ *        everything it points to must be left untouched from its submission
+ *        until its callback runs.
+ */
+  typedef struct kmyth_async_req_s
+  {
+    /** @brief data to be sealed, or .ski data to be unsealed */
+    uint8_t *input;
+    size_t input_len;
+
+    /** @brief authorizations, as described for tpm2_kmyth_seal() */
+    uint8_t *auth_bytes;
+    size_t auth_bytes_len;
+    uint8_t *owner_auth_bytes;
+    size_t oa_bytes_len;
+
+    /** @brief (seal only) as described for tpm2_kmyth_seal() */
+    int *pcrs;
+    size_t pcrs_len;
+    char *cipher_string;
+    char *expected_policy;
+
+    /** @brief (unseal only) as described for tpm2_kmyth_unseal() */
+    uint8_t bool_policy_or;
+
+    /** @brief deadline, as for kmyth_ctx_set_deadline() (0 for none) -
+     *         a request past it fails with KMYTH_ERR_TIMEOUT */
+    uint64_t deadline_ns;
+
+    /** @brief the caller's own data, untouched by the engine */
+    void *user_data;
+
+    /** @brief 0 on success, 1 (or KMYTH_ERR_TIMEOUT) on error - set
+     *         before the callback runs */
+    int result;
+
+    /** @brief the sealed or unsealed data (on success), which the caller
+     *         frees - set before the callback runs */
+    uint8_t *output;
+    size_t output_len;
+
+    /** @brief used by the engine while the request is in progress */
+    kmyth_async_callback_t callback;
+    int op;
+    struct kmyth_async_req_s *next;
+  } kmyth_async_req_t;
+
+/**
+ * @brief Creates an engine for asynchronous seal/unseal requests, and
+ *        starts its workers.
+ *
+ * @param[out] async             Newly created engine -
+ *                               passed as pointer to a NULL engine pointer
+ *
+ * @param[in]  pool              Pool the workers check contexts out of
+ *                               (created by kmyth_ctx_pool_create()), which
+ *                               must outlive the engine. Requests run at
+ *                               once are limited by its size too.
+ *
+ * @param[in]  workers           Number of workers (1 to
+ *                               KMYTH_ASYNC_MAX_WORKERS)
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_async_create(kmyth_async_t ** async, kmyth_ctx_pool_t * pool,
+                         size_t workers);
+
+/**
+ * @brief Destroys an engine created by kmyth_async_create(). The requests
+ *        still in progress are finished first, and their callbacks run on
+ *        the calling thread - which must not be inside a callback.
+ *
+ * @param[in]  async             Engine to be destroyed - passed as pointer
+ *                               to engine pointer, which is set to NULL
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_async_destroy(kmyth_async_t ** async);
+
+/**
+ * @brief Returns the engine's file descriptor (an eventfd), readable while
+ *        there are completed requests whose callbacks kmyth_async_complete()
+ *        has not run yet. It is to be polled (for POLLIN), not read.
+ *
+ * @param[in]  async             Engine created by kmyth_async_create()
+ *
+ * @return The file descriptor, or -1 if async is NULL
+ */
+  int kmyth_async_fd(kmyth_async_t * async);
+
+/**
+ * @brief Submits a seal request (see tpm2_kmyth_seal_ctx()) to the engine,
+ *        without waiting for it to run.
+ *
+ * @param[in]  async             Engine created by kmyth_async_create()
+ *
+ * @param[in]  req               The request
+ *
+ * @param[in]  callback          Run, by kmyth_async_complete(), once the
+ *                               request is done
+ *
+ * @return 0 on success, 1 on error (the request was not submitted, and
+ *         its callback will not run)
+ */
+  int kmyth_seal_async(kmyth_async_t * async, kmyth_async_req_t * req,
+                       kmyth_async_callback_t callback);
+
+/**
+ * @brief Submits an unseal request (see tpm2_kmyth_unseal_ctx()) to the
+ *        engine, without waiting for it to run.
+ *
+ * Parameters and return value are as described for kmyth_seal_async().
+ */
+  int kmyth_unseal_async(kmyth_async_t * async, kmyth_async_req_t * req,
+                         kmyth_async_callback_t callback);
+
+/**
+ * @brief Runs, on the calling thread, the callbacks of completed requests
+ *        (in the order they completed). Never blocks. A callback may submit
+ *        new requests.
+ *
+ * @param[in]  async             Engine created by kmyth_async_create()
+ *
+ * @param[in]  max               Most callbacks to run (0 for every request
+ *                               completed so far) - the file descriptor
+ *                               stays readable while any are left
+ *
+ * @return The number of callbacks run
+ */
+  size_t kmyth_async_complete(kmyth_async_t * async, size_t max);
+
+/**
+ * @brief Returns the number of requests submitted whose callbacks have not
+ *        run yet (0 if async is NULL).
+ */
+  size_t kmyth_async_in_flight(kmyth_async_t * async);
+
+/**
+ * @brief Opaque handle to an opened keyring: many named keys (or other
+ *        small secrets) sealed in one .ski under one wrapping key (see
+ *        tpm2_kmyth_seal_keyring()).
+ *
+ * Opening a keyring unseals the wrapping key once and decrypts only the
+ * keyring's index; each entry is decrypted only when it is looked up. An
+ * opened keyring holds the unsealed wrapping key until it is closed.
+ */
+  typedef struct kmyth_keyring_s kmyth_keyring_t;
+
+/**
+ * @brief Seals a keyring: a set of named values (e.g., data keys) sealed
+ *        together in one .ski, so that they can all be used after a single
+ *        TPM unseal (see tpm2_kmyth_keyring_open()).
+ *
+ * Each value is encrypted on its own, under the same wrapping key, and an
+ * (encrypted) index sorted by name records where each is. Only AES/GCM
+ * ciphers can be used. A keyring .ski cannot be unsealed by
+ * tpm2_kmyth_unseal(), but can be re-sealed by tpm2_kmyth_rewrap().
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  count             Number of entries (at least one)
+ *
+ * @param[in]  names             Array of count entry names: unique,
+ *                               non-empty strings of at most 255 bytes
+ *
+ * @param[in]  values            Array of count entry values
+ *
+ * @param[in]  value_lens        Array of the (non-zero) lengths, in bytes,
+ *                               of the values
+ *
+ * All other parameters are as described for tpm2_kmyth_seal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_seal_keyring(kmyth_ctx_t * ctx, size_t count,
+                              const char **names, uint8_t ** values,
+                              size_t *value_lens,
+                              uint8_t ** output, size_t *output_len,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes,
+                              size_t oa_bytes_len,
+                              int *pcrs, size_t pcrs_len,
+                              char *cipher_string, char *expected_policy);
+
+/**
+ * @brief Opens a keyring .ski (see tpm2_kmyth_seal_keyring()), unsealing
+ *        its wrapping key and decrypting its index.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  input             The keyring .ski formatted bytes
+ *
+ * @param[in]  input_len         The number of input bytes
+ *
+ * @param[out] keyring           The opened keyring, to be closed with
+ *                               kmyth_keyring_close() - passed as pointer
+ *                               to a NULL keyring pointer
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_keyring_open(kmyth_ctx_t * ctx,
+                              uint8_t * input, size_t input_len,
+                              kmyth_keyring_t ** keyring,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes,
+                              size_t oa_bytes_len, uint8_t bool_policy_or);
+
+/**
+ * @brief Adds entries to (or replaces entries of) a keyring .ski without
+ *        re-sealing it: the wrapping key is unsealed once, only the new
+ *        values (and the index) are encrypted, and the other entries and
+ *        the .ski's storage key and symmetric key blocks are kept as they
+ *        are.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  input             The keyring .ski formatted bytes
+ *
+ * @param[in]  input_len         The number of input bytes
+ *
+ * @param[in]  count             The number of entries to add or replace
+ *
+ * @param[in]  names             The entry names - an entry with the name of
+ *                               an existing one replaces it
+ *
+ * @param[in]  values            The entry values
+ *
+ * @param[in]  value_lens        The lengths, in bytes, of the values
+ *
+ * @param[out] output            The updated keyring .ski formatted bytes
+ *                               (allocated here, the caller must free it)
+ *
+ * @param[out] output_len        The number of output bytes
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_keyring_update(kmyth_ctx_t * ctx,
+                                uint8_t * input, size_t input_len,
+                                size_t count, const char **names,
+                                uint8_t ** values, size_t *value_lens,
+                                uint8_t ** output, size_t *output_len,
+                                uint8_t * auth_bytes, size_t auth_bytes_len,
+                                uint8_t * owner_auth_bytes,
+                                size_t oa_bytes_len, uint8_t bool_policy_or);
+
+/**
+ * @brief As tpm2_kmyth_keyring_update(), for a keyring .ski file, which is
+ *        replaced atomically (it holds either the old or the updated
+ *        keyring, whatever happens during the update).
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  path              Path to the keyring .ski file
+ *
+ * All other parameters are as described for tpm2_kmyth_keyring_update().
+ *
+ * @return 0 on success, 1 on error
+ */
+  int tpm2_kmyth_keyring_update_file(kmyth_ctx_t * ctx, char *path,
+                                     size_t count, const char **names,
+                                     uint8_t ** values, size_t *value_lens,
+                                     uint8_t * auth_bytes,
+                                     size_t auth_bytes_len,
+                                     uint8_t * owner_auth_bytes,
+                                     size_t oa_bytes_len,
+                                     uint8_t bool_policy_or);
+
+/**
+ * @brief Returns the number of entries in an opened keyring (0 if keyring
+ *        is NULL).
+ */
+  size_t kmyth_keyring_count(kmyth_keyring_t * keyring);
+
+/**
+ * @brief Returns the name of an entry of an opened keyring, so that its
+ *        entries can be iterated over (in name order) without decrypting
+ *        any of them.
+ *
+ * @param[in]  keyring           Keyring opened by tpm2_kmyth_keyring_open()
+ *
+ * @param[in]  index             Entry index (0 to kmyth_keyring_count() - 1)
+ *
+ * @return the entry name (owned by the keyring), or NULL if index is out
+ *         of range
+ */
+  const char *kmyth_keyring_name(kmyth_keyring_t * keyring, size_t index);
+
+/**
+ * @brief Looks up an entry of an opened keyring by name, and decrypts its
+ *        value (and no other).
+ *
+ * @param[in]  keyring           Keyring opened by tpm2_kmyth_keyring_open()
+ *
+ * @param[in]  name              The entry name
+ *
+ * @param[out] value             The entry value (allocated here, the caller
+ *                               must free it)
+ *
+ * @param[out] value_len         The length, in bytes, of value
+ *
+ * @return 0 on success, 1 on error (including no entry of that name)
+ */
+  int kmyth_keyring_get(kmyth_keyring_t * keyring, const char *name,
+                        uint8_t ** value, size_t *value_len);
+
+/**
+ * @brief As kmyth_keyring_get(), but looks up the entry by its index (as
+ *        for kmyth_keyring_name()).
+ */
+  int kmyth_keyring_get_index(kmyth_keyring_t * keyring, size_t index,
+                              uint8_t ** value, size_t *value_len);
+
+/**
+ * @brief Closes a keyring opened by tpm2_kmyth_keyring_open(), clearing its
+ *        wrapping key.
+ *
+ * @param[in]  keyring           Keyring to be closed - passed as pointer to
+ *                               keyring pointer, which is set to NULL
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_keyring_close(kmyth_keyring_t ** keyring);
+
+/**
+ * @brief Maximum number of callbacks a kmyth_pcr_watcher_t can hold
+ */
+#define KMYTH_PCR_WATCHER_MAX_CALLBACKS 8
+
+/**
+ * @brief A change seen by a kmyth_pcr_watcher_t: the TPM's PCR update
+ *        counter (and reset and restart counts) before and after it.
+ */
+  typedef struct
+  {
+    uint32_t old_pcr_update_counter;
+    uint32_t new_pcr_update_counter;
+    uint32_t old_reset_count;
+    uint32_t new_reset_count;
+    uint32_t old_restart_count;
+    uint32_t new_restart_count;
+  } kmyth_pcr_change_t;
+
+/**
+ * @brief Callback run by a kmyth_pcr_watcher_t for each change it sees,
+ *        with the argument it was registered with.
+ */
+  typedef void (*kmyth_pcr_change_callback_t)(const kmyth_pcr_change_t *
+                                              change, void *arg);
+
+/**
+ * @brief Opaque watcher of a TPM's PCR update counter, for long-running
+ *        processes whose cached results depend on the PCRs.
+ *
+ * Rather than reading PCR values on every request, a watcher reads the
+ * TPM's PCR update counter (which every PCR extend or reset increments)
+ * and its reset and restart counts, once per check. When they change, the
+ * unseal cache (see kmyth_set_unseal_cache()) is emptied and every
+ * registered callback is run, in registration order.
+ *
+ * Optionally, a measurement count file (such as IMA's
+ * runtime_measurements_count) is read instead at each check, and the TPM
+ * is only asked when the count grew (or every few intervals, for extends
+ * not recorded in that log).
+ *
+ * Checks are made either by calling kmyth_pcr_watcher_check() (e.g., from
+ * an event loop), or by a thread started with kmyth_pcr_watcher_start(),
+ * which runs the callbacks on that thread.
+ */
+  typedef struct kmyth_pcr_watcher_s kmyth_pcr_watcher_t;
+
+/**
+ * @brief Creates a PCR change watcher, with its own connection to the TPM.
+ *
+ * @param[out] watcher           Newly created watcher -
+ *                               passed as pointer to a NULL watcher pointer
+ *
+ * @param[in]  tcti_conf         TCTI configuration of the TPM to watch (see
+ *                               kmyth_ctx_create_tcti()), or NULL for the
+ *                               configured (or default) TCTI
+ *
+ * @param[in]  interval_ms       Time, in milliseconds, between checks made
+ *                               by the watcher's thread (at least 1)
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_pcr_watcher_create(kmyth_pcr_watcher_t ** watcher,
+                               const char *tcti_conf,
+                               unsigned int interval_ms);
+
+/**
+ * @brief Registers a callback to run on each change the watcher sees.
+ *
+ * @param[in]  watcher           Watcher created by kmyth_pcr_watcher_create()
+ *
+ * @param[in]  callback          The callback
+ *
+ * @param[in]  arg               Argument passed to the callback
+ *
+ * @return 0 on success, 1 on error (e.g., KMYTH_PCR_WATCHER_MAX_CALLBACKS
+ *         are already registered)
+ */
+  int kmyth_pcr_watcher_add_callback(kmyth_pcr_watcher_t * watcher,
+                                     kmyth_pcr_change_callback_t callback,
+                                     void *arg);
+
+/**
+ * @brief Has the watcher read a measurement count file at each check, and
+ *        only ask the TPM when the count changed. Measurements that are
+ *        extended without being counted in that file are still seen within
+ *        tpm_every intervals.
+ *
+ * @param[in]  watcher           Watcher created by kmyth_pcr_watcher_create()
+ *
+ * @param[in]  path              Path of the count file (a decimal count,
+ *                               e.g. /sys/kernel/security/ima/
+ *                               runtime_measurements_count), or NULL to
+ *                               ask the TPM at every check again
+ *
+ * @param[in]  tpm_every         Number of checks after which the TPM is
+ *                               asked anyway, or 0 for never
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_pcr_watcher_set_count_file(kmyth_pcr_watcher_t * watcher,
+                                       const char *path,
+                                       unsigned int tpm_every);
+
+/**
+ * @brief Checks for a change once, running the callbacks if there was one.
+ *        The first check only records the TPM's counts. Not to be called
+ *        while the watcher's thread is running.
+ *
+ * @param[in]  watcher           Watcher created by kmyth_pcr_watcher_create()
+ *
+ * @param[out] changed           1 if a change was seen, else 0 (may be NULL)
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_pcr_watcher_check(kmyth_pcr_watcher_t * watcher, int *changed);
+
+/**
+ * @brief Starts a thread checking for changes at the watcher's interval.
+ *
+ * @param[in]  watcher           Watcher created by kmyth_pcr_watcher_create()
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_pcr_watcher_start(kmyth_pcr_watcher_t * watcher);
+
+/**
+ * @brief Stops the watcher's thread (if running), waiting for it to exit.
+ *
+ * @param[in]  watcher           Watcher created by kmyth_pcr_watcher_create()
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_pcr_watcher_stop(kmyth_pcr_watcher_t * watcher);
+
+/**
+ * @brief Stops and destroys a watcher created by kmyth_pcr_watcher_create(),
+ *        closing its TPM connection.
+ *
+ * @param[in]  watcher           Watcher to be destroyed - passed as pointer
+ *                               to watcher pointer, which is set to NULL
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_pcr_watcher_destroy(kmyth_pcr_watcher_t ** watcher);
+
+/**
+ * @brief Operations counted by the library-wide metrics (see
+ *        kmyth_metrics_snapshot()). Each seal, unseal or reseal call is
+ *        counted once, as the outermost operation it was made for (e.g.,
+ *        the unseal within a tpm2_kmyth_rewrap() is part of its reseal).
+ */
+  typedef enum kmyth_op_e
+  {
+    KMYTH_OP_SEAL,              /**< tpm2_kmyth_seal*() */
+    KMYTH_OP_UNSEAL,            /**< tpm2_kmyth_unseal*() */
+    KMYTH_OP_RESEAL,            /**< tpm2_kmyth_rewrap*() */
+    KMYTH_OP_COUNT
+  } kmyth_op_t;
+
+/**
+ * @brief Reasons a failed operation is counted under, taken from the last
+ *        failure seen while it ran
+ */
+  typedef enum kmyth_failure_e
+  {
+    KMYTH_FAILURE_INPUT,        /**< malformed input (e.g., .ski data) */
+    KMYTH_FAILURE_AUTH,         /**< TPM authorization or policy refused */
+    KMYTH_FAILURE_TPM,          /**< any other TPM error response */
+    KMYTH_FAILURE_CIPHER,       /**< encryption or decryption failed */
+    KMYTH_FAILURE_TIMEOUT,      /**< deadline passed, or cancelled */
+    KMYTH_FAILURE_OTHER,        /**< anything else */
+    KMYTH_FAILURE_COUNT
+  } kmyth_failure_t;
+
+/**
+ * @brief Caches whose lookups are counted by the library-wide metrics
+ */
+  typedef enum kmyth_cache_e
+  {
+    KMYTH_CACHE_UNSEAL,         /**< see kmyth_set_unseal_cache() */
+    KMYTH_CACHE_OBJECT_CONTEXT, /**< see kmyth_ctx_set_object_cache() */
+    KMYTH_CACHE_POLICY_SESSION, /**< a connection's idle policy sessions */
+    KMYTH_CACHE_COUNT
+  } kmyth_cache_t;
+
+/**
+ * @brief Number of operation latency histogram buckets (see
+ *        kmyth_metrics_bucket_bound_ns())
+ */
+#define KMYTH_METRICS_BUCKETS 12
+
+/**
+ * @brief Maximum number of ciphers reported in a kmyth_metrics_t
+ */
+#define KMYTH_METRICS_MAX_CIPHERS 16
+
+/**
+ * @brief Environment variable naming the Prometheus textfile that
+ *        kmyth_metrics_export_at_exit() adds the process's metrics to
+ */
+#define KMYTH_METRICS_FILE_ENV "KMYTH_METRICS_FILE"
+
+/**
+ * @brief A snapshot of the library-wide metrics: counts accumulated by
+ *        every thread of the process since it started (or since
+ *        kmyth_metrics_reset()), whether or not timings are attached to
+ *        the contexts used.
+ */
+  typedef struct kmyth_metrics_s
+  {
+    /** @brief operations made, by kmyth_op_t */
+    uint64_t calls[KMYTH_OP_COUNT];
+
+    /** @brief operations failed, by kmyth_op_t and kmyth_failure_t */
+    uint64_t failures[KMYTH_OP_COUNT][KMYTH_FAILURE_COUNT];
+
+    /**
+     * @brief operations (by kmyth_op_t) that took longer than the bound
+     *        of the previous bucket, and no longer than this bucket's
+     */
+    uint64_t latency_buckets[KMYTH_OP_COUNT][KMYTH_METRICS_BUCKETS];
+
+    /** @brief total time taken by the operations, by kmyth_op_t */
+    uint64_t latency_ns[KMYTH_OP_COUNT];
+
+    /** @brief TPM commands completed, and those with an error response */
+    uint64_t tpm_commands;
+    uint64_t tpm_errors;
+
+    /** @brief TPM commands retried because the TPM was busy */
+    uint64_t tpm_retries;
+
+    /** @brief cache lookups answered and missed, by kmyth_cache_t */
+    uint64_t cache_hits[KMYTH_CACHE_COUNT];
+    uint64_t cache_misses[KMYTH_CACHE_COUNT];
+
+    /** @brief number of valid entries in ciphers */
+    size_t cipher_count;
+
+    /** @brief bytes of data encrypted and decrypted, by cipher */
+    struct
+    {
+      const char *name;
+      uint64_t encrypted_bytes;
+      uint64_t decrypted_bytes;
+    } ciphers[KMYTH_METRICS_MAX_CIPHERS];
+  } kmyth_metrics_t;
+
+/**
+ * @brief Returns the upper bound, in nanoseconds, of an operation latency
+ *        histogram bucket (UINT64_MAX for the last, unbounded, bucket).
+ */
+  uint64_t kmyth_metrics_bucket_bound_ns(size_t bucket);
+
+/**
+ * @brief Copies the library-wide metrics (each count is read atomically,
+ *        but not all of them at the same instant).
+ *
+ * @param[out] metrics           The snapshot
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_metrics_snapshot(kmyth_metrics_t * metrics);
+
+/**
+ * @brief Sets every library-wide metric back to zero.
+ *
+ * @return None
+ */
+  void kmyth_metrics_reset(void);
+
+/**
+ * @brief Writes metrics in the Prometheus text exposition format.
+ *
+ * @param[in]  out               Stream to write to
+ *
+ * @param[in]  metrics           Metrics to write (e.g., from
+ *                               kmyth_metrics_snapshot())
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_metrics_write_prometheus(FILE * out,
+                                     const kmyth_metrics_t * metrics);
+
+/**
+ * @brief Writes the library-wide metrics to a Prometheus textfile (e.g.,
+ *        for node_exporter's textfile collector), replacing the file
+ *        atomically. Concurrent writers are serialized with a lock on
+ *        path.lock.
+ *
+ * @param[in]  path              Path of the textfile (*.prom)
+ *
+ * @param[in]  accumulate        If non-zero, the counts already in the file
+ *                               are added to, so that the counters of
+ *                               short-lived processes (e.g., the kmyth
+ *                               command line tools) keep growing from run
+ *                               to run. Otherwise the file is overwritten.
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_metrics_write_textfile(const char *path, int accumulate);
+
+/**
+ * @brief If KMYTH_METRICS_FILE is set, has the process's metrics added to
+ *        that textfile (see kmyth_metrics_write_textfile()) when it exits.
+ *
+ * @return 0 on success (including when KMYTH_METRICS_FILE is not set),
+ *         1 on error
+ */
+  int kmyth_metrics_export_at_exit(void);
+
 #ifdef __cplusplus
 }
 #endif
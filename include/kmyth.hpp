@@ -0,0 +1,390 @@
+/**
+ * @file  kmyth.hpp
+ *
+ * @brief Header-only C++ (C++20) wrapper for the TPM 2.0 seal/unseal API
+ *        declared in kmyth.h.
+ *
+ * kmyth::Context owns a kmyth context (and so its TPM connection) and
+ * destroys it when it goes out of scope. Inputs are passed as spans (or
+ * string views), straight through to the C API without being copied.
+ * Results are move-only owners of the buffer the C API filled in:
+ *   - kmyth::Buffer holds sealed (.ski) data, released with free()
+ *   - kmyth::SecretBuffer holds unsealed data, in the secure heap (see
+ *     kmyth_secure_alloc()), wiped and released when it is destroyed
+ *
+ * Errors are thrown as kmyth::Error (with the details in the kmyth log).
+ */
+
+#ifndef KMYTH_HPP
+#define KMYTH_HPP
+
+#if __cplusplus < 202002L
+#error "kmyth.hpp requires C++20 (std::span)"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#include "kmyth.h"
+#include "memory_util.h"
+
+namespace kmyth
+{
+
+/**
+ * @brief Exception thrown when a kmyth call fails
+ */
+  class Error : public std::runtime_error
+  {
+  public:
+    using std::runtime_error::runtime_error;
+  };
+
+/**
+ * @brief Views the characters of a string (e.g., a password) as bytes
+ */
+  inline std::span<const uint8_t> as_bytes(std::string_view s) noexcept
+  {
+    return { reinterpret_cast<const uint8_t *>(s.data()), s.size() };
+  }
+
+  namespace detail
+  {
+    // The C API takes its inputs through non-const pointers, but only
+    // reads them. An empty span is passed on as NULL.
+    inline uint8_t *in(std::span<const uint8_t> s) noexcept
+    {
+      return s.empty() ? nullptr : const_cast<uint8_t *>(s.data());
+    }
+
+    inline int *in(std::span<const int> s) noexcept
+    {
+      return s.empty() ? nullptr : const_cast<int *>(s.data());
+    }
+  }
+
+/**
+ * @brief Move-only owner of a buffer allocated (with malloc()) by the C
+ *        API, such as a .ski formatted seal result
+ */
+  class Buffer
+  {
+  public:
+    Buffer() noexcept = default;
+
+    // takes ownership of data (allocated with malloc())
+    Buffer(uint8_t *data, size_t size) noexcept : data_(data), size_(size)
+    {
+    }
+
+    ~Buffer()
+    {
+      free(data_);
+    }
+
+    Buffer(Buffer && other) noexcept
+      : data_(std::exchange(other.data_, nullptr)),
+        size_(std::exchange(other.size_, 0))
+    {
+    }
+
+    Buffer &operator=(Buffer && other) noexcept
+    {
+      if (this != &other)
+      {
+        free(data_);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+      }
+      return *this;
+    }
+
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
+    uint8_t *data() noexcept
+    {
+      return data_;
+    }
+    const uint8_t *data() const noexcept
+    {
+      return data_;
+    }
+    size_t size() const noexcept
+    {
+      return size_;
+    }
+    bool empty() const noexcept
+    {
+      return size_ == 0;
+    }
+    std::span<const uint8_t> span() const noexcept
+    {
+      return { data_, size_ };
+    }
+    operator std::span<const uint8_t>() const noexcept
+    {
+      return span();
+    }
+
+  private:
+    uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+  };
+
+/**
+ * @brief Move-only owner of unsealed (plaintext) data, held in the secure
+ *        heap and wiped when it is destroyed
+ */
+  class SecretBuffer
+  {
+  public:
+    SecretBuffer() noexcept = default;
+
+    // allocates a zero filled secure buffer of size bytes
+    explicit SecretBuffer(size_t size) : size_(size)
+    {
+      if (size > 0)
+      {
+        data_ = static_cast<uint8_t *>(kmyth_secure_alloc(size));
+        if (data_ == nullptr)
+        {
+          throw std::bad_alloc();
+        }
+      }
+    }
+
+    ~SecretBuffer()
+    {
+      kmyth_secure_free(data_);
+    }
+
+    SecretBuffer(SecretBuffer && other) noexcept
+      : data_(std::exchange(other.data_, nullptr)),
+        size_(std::exchange(other.size_, 0))
+    {
+    }
+
+    SecretBuffer &operator=(SecretBuffer && other) noexcept
+    {
+      if (this != &other)
+      {
+        kmyth_secure_free(data_);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+      }
+      return *this;
+    }
+
+    SecretBuffer(const SecretBuffer &) = delete;
+    SecretBuffer &operator=(const SecretBuffer &) = delete;
+
+    uint8_t *data() noexcept
+    {
+      return data_;
+    }
+    const uint8_t *data() const noexcept
+    {
+      return data_;
+    }
+    size_t size() const noexcept
+    {
+      return size_;
+    }
+    bool empty() const noexcept
+    {
+      return size_ == 0;
+    }
+    std::span<const uint8_t> span() const noexcept
+    {
+      return { data_, size_ };
+    }
+    operator std::span<const uint8_t>() const noexcept
+    {
+      return span();
+    }
+
+    // shrinks the data to its first size bytes, wiping the rest
+    void truncate(size_t size) noexcept
+    {
+      if (size < size_)
+      {
+        kmyth_clear(data_ + size, size_ - size);
+        size_ = size;
+      }
+    }
+
+  private:
+    uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+  };
+
+/**
+ * @brief Move-only owner of a kmyth context (see kmyth_ctx_create()),
+ *        which keeps one TPM connection open across its seals and unseals
+ */
+  class Context
+  {
+  public:
+    Context()
+    {
+      if (kmyth_ctx_create(&ctx_))
+      {
+        throw Error("unable to create kmyth context");
+      }
+    }
+
+    // connects to the TPM described by tcti_conf (see
+    // kmyth_ctx_create_tcti())
+    explicit Context(const char *tcti_conf)
+    {
+      if (kmyth_ctx_create_tcti(&ctx_, tcti_conf))
+      {
+        throw Error("unable to create kmyth context");
+      }
+    }
+
+    ~Context()
+    {
+      kmyth_ctx_destroy(&ctx_);
+    }
+
+    Context(Context && other) noexcept
+      : ctx_(std::exchange(other.ctx_, nullptr))
+    {
+    }
+
+    Context &operator=(Context && other) noexcept
+    {
+      if (this != &other)
+      {
+        kmyth_ctx_destroy(&ctx_);
+        ctx_ = std::exchange(other.ctx_, nullptr);
+      }
+      return *this;
+    }
+
+    Context(const Context &) = delete;
+    Context &operator=(const Context &) = delete;
+
+    // the underlying context, for the kmyth_ctx_set_*() calls and the rest
+    // of the C API
+    kmyth_ctx_t *get() const noexcept
+    {
+      return ctx_;
+    }
+
+    /**
+     * @brief Seals input (see tpm2_kmyth_seal_ctx()). A NULL cipher
+     *        selects the default cipher.
+     */
+    Buffer seal(std::span<const uint8_t> input,
+                std::span<const uint8_t> auth = {},
+                std::span<const uint8_t> owner_auth = {},
+                std::span<const int> pcrs = {},
+                const char *cipher = nullptr,
+                const char *expected_policy = nullptr)
+    {
+      uint8_t *output = nullptr;
+      size_t output_len = 0;
+
+      if (tpm2_kmyth_seal_ctx(ctx_, detail::in(input), input.size(),
+                              &output, &output_len,
+                              detail::in(auth), auth.size(),
+                              detail::in(owner_auth), owner_auth.size(),
+                              detail::in(pcrs), pcrs.size(),
+                              const_cast<char *>(cipher),
+                              const_cast<char *>(expected_policy), 0))
+      {
+        throw Error("unable to seal data");
+      }
+      return Buffer(output, output_len);
+    }
+
+    Buffer seal(std::string_view input,
+                std::span<const uint8_t> auth = {},
+                std::span<const uint8_t> owner_auth = {},
+                std::span<const int> pcrs = {},
+                const char *cipher = nullptr,
+                const char *expected_policy = nullptr)
+    {
+      return seal(as_bytes(input), auth, owner_auth, pcrs, cipher,
+                  expected_policy);
+    }
+
+    /**
+     * @brief Unseals .ski data (see tpm2_kmyth_unseal_into_ctx()) straight
+     *        into a secure buffer. Compressed data, whose size is not known
+     *        until it is unsealed, is copied in from the C API's result.
+     */
+    SecretBuffer unseal(std::span<const uint8_t> ski,
+                        std::span<const uint8_t> auth = {},
+                        std::span<const uint8_t> owner_auth = {},
+                        bool policy_or = false)
+    {
+      size_t needed = 0;
+
+      if (tpm2_kmyth_unseal_into_ctx(nullptr, detail::in(ski), ski.size(),
+                                     nullptr, 0, &needed, nullptr, 0,
+                                     nullptr, 0, policy_or) == 0)
+      {
+        SecretBuffer result(needed);
+        size_t len = 0;
+
+        if (tpm2_kmyth_unseal_into_ctx(ctx_, detail::in(ski), ski.size(),
+                                       result.data(), needed, &len,
+                                       detail::in(auth), auth.size(),
+                                       detail::in(owner_auth),
+                                       owner_auth.size(), policy_or))
+        {
+          throw Error("unable to unseal data");
+        }
+        result.truncate(len);
+        return result;
+      }
+
+      uint8_t *output = nullptr;
+      size_t output_len = 0;
+
+      if (tpm2_kmyth_unseal_ctx(ctx_, detail::in(ski), ski.size(),
+                                &output, &output_len,
+                                detail::in(auth), auth.size(),
+                                detail::in(owner_auth), owner_auth.size(),
+                                policy_or))
+      {
+        throw Error("unable to unseal data");
+      }
+
+      SecretBuffer result;
+
+      try
+      {
+        result = SecretBuffer(output_len);
+      }
+      catch (...)
+      {
+        kmyth_clear_and_free(output, output_len);
+        throw;
+      }
+      if (output_len > 0)
+      {
+        memcpy(result.data(), output, output_len);
+      }
+      kmyth_clear_and_free(output, output_len);
+      return result;
+    }
+
+  private:
+    kmyth_ctx_t *ctx_ = nullptr;
+  };
+
+}                               // namespace kmyth
+
+#endif /* KMYTH_HPP */
@@ -0,0 +1,249 @@
+/**
+ * @file endpoint_util.h
+ *
+ * @brief Utility functions for getting a response from any one of several
+ *        (replicated) servers: failing over on errors, hedging slow
+ *        requests with a second request to another server, and steering
+ *        later requests by the latency each server has shown.
+ */
+
+#ifndef ENDPOINT_UTIL_H
+#define ENDPOINT_UTIL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Most endpoints (server addresses) an endpoint set holds
+ */
+#define ENDPOINT_MAX_COUNT 16
+
+/**
+ * @brief Number of recent latency samples kept for each endpoint
+ */
+#define ENDPOINT_LATENCY_SAMPLES 32
+
+/**
+ * @brief Fewest latency samples an endpoint needs before its observed p95
+ *        latency is used as its hedging delay
+ */
+#define ENDPOINT_HEDGE_MIN_SAMPLES 5
+
+/**
+ * @brief Hedging delay (in milliseconds) used for an endpoint with too few
+ *        latency samples
+ */
+#define ENDPOINT_HEDGE_DEFAULT_MS 500
+
+/**
+ * @brief Latency statistics of one endpoint: its most recent latencies
+ *        (a ring of samples, in microseconds) and its consecutive failures
+ */
+typedef struct endpoint_stats
+{
+  uint32_t samples[ENDPOINT_LATENCY_SAMPLES];
+  size_t sample_count;
+  unsigned int failures;
+} endpoint_stats;
+
+/**
+ * @brief A set of endpoints serving the same requests, and their statistics
+ */
+typedef struct endpoint_set
+{
+  char *addresses[ENDPOINT_MAX_COUNT];
+  endpoint_stats stats[ENDPOINT_MAX_COUNT];
+  size_t count;
+} endpoint_set;
+
+/**
+ * @brief How endpoint_fetch() spreads a request over the endpoints
+ */
+typedef struct endpoint_policy
+{
+  // send a second (hedging) request, to the next endpoint, when the first
+  // has not been answered in time
+  bool hedge;
+
+  // milliseconds to wait for the first request before hedging it (0 for
+  // the first endpoint's observed p95 latency)
+  int hedge_delay_ms;
+} endpoint_policy;
+
+/**
+ * <pre>
+ * A request to one endpoint, run by endpoint_fetch() - on a thread of its
+ * own, when there are several endpoints, so possibly at the same time as a
+ * request (with the same arg) to another. It must not use the endpoint set.
+ * </pre>
+ *
+ * @param[in]  address  The endpoint's address (a copy, which the function
+ *                      may modify).
+ *
+ * @param[in]  arg      The argument passed to endpoint_fetch().
+ *
+ * @param[out] result   The response.
+ *
+ * @return 0 on success, 1 on error
+ */
+typedef int (*endpoint_fetch_fn) (char *address, void *arg, void **result);
+
+/**
+ * <pre>
+ * Frees a response (of a request answered after another endpoint's was),
+ * or, for endpoint_fetch()'s arg_free, the argument.
+ * </pre>
+ *
+ * @param[in]  ptr  The response or argument.
+ */
+typedef void (*endpoint_free_fn) (void *ptr);
+
+/**
+ * <pre>
+ * This function sets up an empty endpoint set.
+ * </pre>
+ *
+ * @param[out] set  The endpoint set.
+ */
+void endpoint_set_init(endpoint_set * set);
+
+/**
+ * <pre>
+ * This function frees an endpoint set's addresses.
+ * </pre>
+ *
+ * @param[in]  set  The endpoint set.
+ */
+void endpoint_set_free(endpoint_set * set);
+
+/**
+ * <pre>
+ * This function adds endpoints to a set, from a comma separated list of
+ * addresses (e.g., "kmip1:5696,kmip2:5696"). An address already in the set
+ * is not added again.
+ * </pre>
+ *
+ * @param[in]  set   The endpoint set.
+ *
+ * @param[in]  list  The addresses.
+ *
+ * @return 0 on success, 1 on error (an empty address, or too many)
+ */
+int endpoint_set_add(endpoint_set * set, const char *list);
+
+/**
+ * <pre>
+ * This function records the outcome of a request to an endpoint: its
+ * latency, if it succeeded, or (otherwise) one more consecutive failure.
+ * </pre>
+ *
+ * @param[in]  set         The endpoint set.
+ *
+ * @param[in]  index       The endpoint's index in the set.
+ *
+ * @param[in]  success     Whether the request succeeded.
+ *
+ * @param[in]  latency_us  The request's latency (in microseconds).
+ */
+void endpoint_record(endpoint_set * set, size_t index, bool success,
+                     uint64_t latency_us);
+
+/**
+ * <pre>
+ * This function gets a percentile of an endpoint's recent latencies.
+ * </pre>
+ *
+ * @param[in]  stats       The endpoint's statistics.
+ *
+ * @param[in]  percentile  The percentile (1 to 100).
+ *
+ * @return The latency (in microseconds), or 0 if there are no samples
+ */
+uint64_t endpoint_latency(const endpoint_stats * stats,
+                          unsigned int percentile);
+
+/**
+ * <pre>
+ * This function orders a set's endpoints for a request: first by their
+ * consecutive failures, then by their p95 latency (an endpoint with no
+ * samples yet is tried first, to learn its latency), then as they were
+ * given.
+ * </pre>
+ *
+ * @param[in]  set    The endpoint set.
+ *
+ * @param[out] order  The endpoints' indexes, in the order to try them
+ *                    (set->count of them).
+ */
+void endpoint_order(const endpoint_set * set, size_t *order);
+
+/**
+ * <pre>
+ * This function loads the statistics saved (by endpoint_stats_save()) for
+ * the set's endpoints. Saved statistics of other endpoints are ignored.
+ * </pre>
+ *
+ * @param[in]  set   The endpoint set.
+ *
+ * @param[in]  path  The statistics file.
+ *
+ * @return 0 on success, 1 on error (including a missing file)
+ */
+int endpoint_stats_load(endpoint_set * set, const char *path);
+
+/**
+ * <pre>
+ * This function saves the set's statistics (replacing the file atomically).
+ * </pre>
+ *
+ * @param[in]  set   The endpoint set.
+ *
+ * @param[in]  path  The statistics file.
+ *
+ * @return 0 on success, 1 on error
+ */
+int endpoint_stats_save(const endpoint_set * set, const char *path);
+
+/**
+ * <pre>
+ * This function gets a response from the first endpoint, in
+ * endpoint_order(), that answers. A request that fails moves straight on to
+ * the next endpoint. With hedging, a request not answered within the hedging
+ * delay is also sent to the next endpoint, and whichever is answered first
+ * is used.
+ *
+ * The function returns as soon as it has a response, leaving any other
+ * request to finish on its own: its response is then freed (with
+ * result_free), and, once no request is left running, so is arg (with
+ * arg_free), so arg must be allocated for this call alone. Such a request
+ * is recorded as taking as long as it had when the response came in. (A
+ * set of one endpoint is asked on the calling thread.)
+ * </pre>
+ *
+ * @param[in]  set          The endpoint set (with at least one endpoint),
+ *                          whose statistics are updated.
+ *
+ * @param[in]  policy       The hedging policy (NULL for none).
+ *
+ * @param[in]  fetch        The request.
+ *
+ * @param[in]  result_free  Frees an unused response.
+ *
+ * @param[in]  arg          The request's argument.
+ *
+ * @param[in]  arg_free     Frees the argument (NULL if it need not be).
+ *
+ * @param[out] result       The response.
+ *
+ * @param[out] index        The index of the endpoint that gave it (may be
+ *                          NULL).
+ *
+ * @return 0 on success, 1 if every endpoint failed
+ */
+int endpoint_fetch(endpoint_set * set, const endpoint_policy * policy,
+                   endpoint_fetch_fn fetch, endpoint_free_fn result_free,
+                   void *arg, endpoint_free_fn arg_free, void **result,
+                   size_t *index);
+
+#endif /* ENDPOINT_UTIL_H */
@@ -7,9 +7,141 @@
 #ifndef SOCKET_UTIL_H
 #define SOCKET_UTIL_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @brief Default delay (in milliseconds) before a client starts connecting
+ *        to the next of a host's addresses, while earlier attempts are
+ *        still pending
+ */
+#define SOCKET_CONNECT_STAGGER_DEFAULT_MS 250
+
+/**
+ * @brief Most connection attempts a client keeps pending at once
+ */
+#define SOCKET_CONNECT_MAX_ATTEMPTS 16
+
+/**
+ * @brief Tuning options for TCP sockets. All are off (the system defaults)
+ *        after socket_options_init().
+ *
+ * The handshakes kmyth speaks (NSL, ECDH and KMIP) are exchanges of small
+ * messages, so disabling Nagle's algorithm (nodelay) avoids a delay on
+ * every round trip, and timeouts stop an unresponsive peer from holding a
+ * connection (or a server worker) indefinitely.
+ */
+typedef struct socket_options
+{
+  // disable Nagle's algorithm (TCP_NODELAY)
+  bool nodelay;
+
+  // seconds idle before keepalive probes start (0 to leave keepalive off)
+  int keepalive_idle;
+
+  // seconds between keepalive probes (0 for the system default)
+  int keepalive_interval;
+
+  // unanswered probes before the connection is dropped (0 for the system
+  // default)
+  int keepalive_count;
+
+  // let several (server) processes bind the same port (SO_REUSEPORT)
+  bool reuseport;
+
+  // TCP Fast Open: a server's pending request queue length, or, for a
+  // client, any non-zero value to send data with the connection request
+  int fastopen;
+
+  // milliseconds to wait for a connection to be established, to any of
+  // the host's addresses (0 to wait as long as the system does)
+  int connect_timeout_ms;
+
+  // milliseconds before the next of the host's addresses is also tried,
+  // while earlier attempts are pending (0 for
+  // SOCKET_CONNECT_STAGGER_DEFAULT_MS)
+  int connect_stagger_ms;
+
+  // milliseconds a send or receive may block (0 for no limit)
+  int io_timeout_ms;
+
+  // monotonic clock time (CLOCK_MONOTONIC, in nanoseconds) by which the
+  // connection must be established and its I/O done (0 for none) - each
+  // send or receive may block for no longer than the time left
+  uint64_t deadline_ns;
+} socket_options;
+
+/**
+ * <pre>
+ * This function sets all socket options to their defaults (off).
+ * </pre>
+ *
+ * @param[out] opts  The socket options.
+ */
+void socket_options_init(socket_options * opts);
+
+/**
+ * <pre>
+ * This function parses one socket option, as given on a command line, into
+ * opts. The option is one of:
+ *
+ *   nodelay
+ *   keepalive=<idle>[,<interval>[,<count>]]
+ *   reuseport
+ *   fastopen[=<queue length>]
+ *   connect-timeout=<milliseconds>
+ *   connect-stagger=<milliseconds>
+ *   io-timeout=<milliseconds>
+ * </pre>
+ *
+ * @param[in]  spec  The option.
+ *
+ * @param[out] opts  The socket options, updated with the option.
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_socket_option(const char *spec, socket_options * opts);
+
+/**
+ * <pre>
+ * This function applies the per-connection options (nodelay, keepalive and
+ * the I/O timeout) to a socket - e.g., one returned by accept(2), or one
+ * opened by another library.
+ * </pre>
+ *
+ * @param[in]  socket_fd  The socket file descriptor.
+ *
+ * @param[in]  opts       The socket options (NULL for none).
+ *
+ * @return 0 on success, 1 on error
+ */
+int apply_socket_options(int socket_fd, const socket_options * opts);
+
+/**
+ * <pre>
+ * This function sets a socket's send and receive timeouts to the I/O
+ * timeout, or to the time left before the deadline, if that is shorter. It
+ * is called before each exchange over a connection with a deadline, so
+ * that the exchanges as a whole cannot outlast it.
+ * </pre>
+ *
+ * @param[in]  socket_fd  The socket file descriptor.
+ *
+ * @param[in]  opts       The socket options.
+ *
+ * @return 0 on success, 1 on error (errno is ETIMEDOUT if the deadline has
+ *         passed)
+ */
+int socket_arm_deadline(int socket_fd, const socket_options * opts);
+
 /**
  * <pre>
  * This function sets up a client socket for sending messages.
+ *
+ * When the node has several addresses, connections are started to each in
+ * turn, SOCKET_CONNECT_STAGGER_DEFAULT_MS apart (or as soon as the earlier
+ * attempts fail), and the first established is used.
  * </pre>
  *
  * @param[in]  node       The IP address or hostname to connect to.
@@ -22,6 +154,25 @@
  */
 int setup_client_socket(const char *node, const char *service, int *socket_fd);
 
+/**
+ * <pre>
+ * This function sets up a client socket, as setup_client_socket() does,
+ * with the given options applied.
+ * </pre>
+ *
+ * @param[in]  node       The IP address or hostname to connect to.
+ *
+ * @param[in]  service    The port number or service to bind to.
+ *
+ * @param[in]  opts       The socket options (NULL for none).
+ *
+ * @param[out] socket_fd  The new socket file descriptor.
+ *
+ * @return 0 on success, 1 on error
+ */
+int setup_client_socket_opts(const char *node, const char *service,
+                             const socket_options * opts, int *socket_fd);
+
 /**
  * <pre>
  * This function sets up a server socket for receiving connections.
@@ -35,4 +186,52 @@ int setup_client_socket(const char *node, const char *service, int *socket_fd);
  */
 int setup_server_socket(const char *service, int *socket_fd);
 
+/**
+ * <pre>
+ * This function sets up a server socket, as setup_server_socket() does,
+ * with the given options applied. The per-connection options are inherited
+ * by the connections accepted on it.
+ * </pre>
+ *
+ * @param[in]  service    The port number to bind to.
+ *
+ * @param[in]  opts       The socket options (NULL for none).
+ *
+ * @param[out] socket_fd  The new socket file descriptor.
+ *
+ * @return 0 on success, 1 on error
+ */
+int setup_server_socket_opts(const char *service, const socket_options * opts,
+                             int *socket_fd);
+
+/**
+ * <pre>
+ * This function sets up a UNIX domain (local) server socket for receiving
+ * connections. A stale socket left at path is replaced.
+ * </pre>
+ *
+ * @param[in]  path       The filesystem path to bind the socket to.
+ *
+ * @param[in]  mode       The permissions applied to the socket file.
+ *
+ * @param[out] socket_fd  The new socket file descriptor.
+ *
+ * @return 0 on success, 1 on error
+ */
+int setup_unix_server_socket(const char *path, mode_t mode, int *socket_fd);
+
+/**
+ * <pre>
+ * This function sets up a UNIX domain (local) client socket connected to
+ * the server socket at path.
+ * </pre>
+ *
+ * @param[in]  path       The filesystem path of the server socket.
+ *
+ * @param[out] socket_fd  The new socket file descriptor.
+ *
+ * @return 0 on success, 1 on error
+ */
+int setup_unix_client_socket(const char *path, int *socket_fd);
+
 #endif
@@ -9,6 +9,15 @@
 
 /* // OpenSSL libraries for TLS connection */
 #include <openssl/bio.h>
+#include <openssl/ssl.h>
+
+#include "socket_util.h"
+
+/**
+ * @brief Number of TLS contexts (one per client key, client certificate
+ *        and CA triple) tls_context_acquire() keeps
+ */
+#define TLS_CONTEXT_CACHE_SIZE 8
 
 /**
  * <pre>
@@ -47,6 +56,183 @@ int create_tls_connection(char **server_ip,
                           char *client_cert_path, char *ca_cert_path,
                           BIO ** tls_bio, SSL_CTX ** tls_ctx);
 
+/**
+ * <pre>
+ * This function creates a mutually authenticated TLS connection, as
+ * create_tls_connection() does, first offering the server the TLS session
+ * saved (by tls_save_session()) in session_path, if there is one. If the
+ * server resumes it, the full handshake is skipped. The TLS context comes
+ * from tls_context_acquire(), so is shared with other connections made
+ * with the same key and certificates.
+ *</pre>
+ *
+ * @param[in]  server_ip               IP address and port of the server
+ *
+ * @param[in]  client_private_key      client's private key
+ *
+ * @param[in]  client_private_key_len  length (in bytes) of client_private_key
+ *
+ * @param[in]  client_cert_path        path to the client's certificate
+ *
+ * @param[in]  ca_cert_path            path to the certificate for the
+ *                                     CA that issued the server certificate
+ *
+ * @param[in]  session_path            path to the saved TLS session (may be
+ *                                     NULL, or not yet exist)
+ *
+ * @param[in]  sockopts                options for the connection's socket
+ *                                     (NULL to leave OpenSSL to connect it)
+ *
+ * @param[out] tls_bio                 BIO containing the TLS connection
+ *
+ * @param[out] tls_ctx                 SSL_CTX containing TLS context info
+ *
+ * @return 0 on success, 1 on error
+ */
+int create_tls_connection_resume(char **server_ip,
+                                 unsigned char *client_private_key,
+                                 size_t client_private_key_len,
+                                 char *client_cert_path, char *ca_cert_path,
+                                 char *session_path,
+                                 const socket_options * sockopts,
+                                 BIO ** tls_bio, SSL_CTX ** tls_ctx);
+
+/**
+ * <pre>
+ * This function creates a mutually authenticated TLS connection, as
+ * create_tls_connection_resume() does, offering the server a session
+ * already in memory (e.g., from tls_session_from_bytes()).
+ *
+ * With early_data set, if the session allows early data (TLS 1.3 0-RTT),
+ * the handshake is left undone, for the first KMIP Get request (see
+ * get_keys_from_kmip_server()) to be sent along with it, saving a round
+ * trip. Early data can be replayed by an attacker, so this is only for
+ * idempotent requests, to servers that guard against replays. Should the
+ * server reject the early data, the request is sent again after the
+ * handshake.
+ *</pre>
+ *
+ * @param[in]  server_ip               IP address and port of the server
+ *
+ * @param[in]  client_private_key      client's private key
+ *
+ * @param[in]  client_private_key_len  length (in bytes) of client_private_key
+ *
+ * @param[in]  client_cert_path        path to the client's certificate
+ *
+ * @param[in]  ca_cert_path            path to the certificate for the
+ *                                     CA that issued the server certificate
+ *
+ * @param[in]  session                 the TLS session to offer (may be NULL)
+ *
+ * @param[in]  early_data              if true, send the first request as
+ *                                     early data when the session allows it
+ *
+ * @param[in]  sockopts                options for the connection's socket
+ *                                     (NULL to leave OpenSSL to connect it)
+ *
+ * @param[out] tls_bio                 BIO containing the TLS connection
+ *
+ * @param[out] tls_ctx                 SSL_CTX containing TLS context info
+ *
+ * @return 0 on success, 1 on error
+ */
+int create_tls_connection_session(char **server_ip,
+                                  unsigned char *client_private_key,
+                                  size_t client_private_key_len,
+                                  char *client_cert_path, char *ca_cert_path,
+                                  SSL_SESSION * session, bool early_data,
+                                  const socket_options * sockopts,
+                                  BIO ** tls_bio, SSL_CTX ** tls_ctx);
+
+/**
+ * <pre>
+ * This function reads a (PEM encoded) TLS session saved by
+ * tls_save_session(), if it can still be resumed.
+ * </pre>
+ *
+ * @param[in]  session_path  path to the saved TLS session
+ *
+ * @param[out] session       the session read (to be freed with
+ *                           SSL_SESSION_free()), NULL on error
+ *
+ * @return 0 on success, 1 on error (including a missing file or a session
+ *         that can no longer be resumed)
+ */
+int tls_load_session(char *session_path, SSL_SESSION ** session);
+
+/**
+ * <pre>
+ * This function saves the (resumable) session of a TLS connection, so
+ * later connections can resume it. The file is only readable by its
+ * owner, as the session holds the resumption secret. With TLS 1.3 the
+ * session ticket arrives after the handshake, so this should be called
+ * once the connection has been used.
+ * </pre>
+ *
+ * @param[in]  session_path  path of the file to write the session to
+ *
+ * @param[in]  tls_bio       BIO containing the TLS connection
+ *
+ * @return 0 on success, 1 on error (including there being no resumable
+ *         session)
+ */
+int tls_save_session(char *session_path, BIO * tls_bio);
+
+/**
+ * <pre>
+ * This function gets the (resumable) session of a TLS connection. With
+ * TLS 1.3 the session ticket arrives after the handshake, so this should
+ * be called once the connection has been used.
+ * </pre>
+ *
+ * @param[in]  tls_bio  BIO containing the TLS connection
+ *
+ * @param[out] session  the session (to be freed with SSL_SESSION_free()),
+ *                      NULL on error
+ *
+ * @return 0 on success, 1 on error (including there being no resumable
+ *         session)
+ */
+int tls_get_session(BIO * tls_bio, SSL_SESSION ** session);
+
+/**
+ * <pre>
+ * This function encodes a TLS session (in DER), e.g., to be sealed for
+ * storage. The encoding holds the resumption secret.
+ * </pre>
+ *
+ * @param[in]  session    the session
+ *
+ * @param[out] bytes      the encoded session (to be freed with
+ *                        kmyth_clear_and_free())
+ *
+ * @param[out] bytes_len  length (in bytes) of the encoded session
+ *
+ * @return 0 on success, 1 on error
+ */
+int tls_session_to_bytes(SSL_SESSION * session, unsigned char **bytes,
+                         size_t *bytes_len);
+
+/**
+ * <pre>
+ * This function decodes a TLS session encoded by tls_session_to_bytes(),
+ * if it can still be resumed.
+ * </pre>
+ *
+ * @param[in]  bytes      the encoded session
+ *
+ * @param[in]  bytes_len  length (in bytes) of the encoded session
+ *
+ * @param[out] session    the session (to be freed with SSL_SESSION_free()),
+ *                        NULL on error
+ *
+ * @return 0 on success, 1 on error (including a session that can no
+ *         longer be resumed)
+ */
+int tls_session_from_bytes(const unsigned char *bytes, size_t bytes_len,
+                           SSL_SESSION ** session);
+
 /**
  * <pre>
  * This function populates an SSL_CTX* structure with necessary data to 
@@ -76,6 +262,60 @@ int tls_set_context(unsigned char *client_private_key,
                     size_t client_private_key_len,
                     char *client_cert_path, char *ca_cert_path, SSL_CTX ** ctx);
 
+/**
+ * <pre>
+ * This function provides a TLS context, as tls_set_context() does, but
+ * shares one context among all callers with the same client private key,
+ * client certificate and CA certificate, so the key, certificates and
+ * trust store are only loaded once. The contexts are cached (the key only
+ * as its SHA-256 digest) until tls_context_cache_clear(), or until the
+ * least recently used is replaced by another. Safe to call from several
+ * threads.
+ *
+ * Certificate files are matched by path - a replaced file is only read
+ * again once the cache is cleared.
+ * </pre>
+ *
+ * @param[in]  client_private_key      client's private key
+ *
+ * @param[in]  client_private_key_len  length (in bytes) of client_private_key
+ *
+ * @param[in]  client_cert_path        path to the client's certificate
+ *
+ * @param[in]  ca_cert_path            path to the certificate for the
+ *                                     CA that issued the server certificate
+ *
+ * @param[out] ctx                     the shared SSL_CTX, holding a
+ *                                     reference for the caller (released
+ *                                     with tls_context_release(), or
+ *                                     SSL_CTX_free())
+ *
+ * @return 0 on success, 1 on error
+ */
+int tls_context_acquire(unsigned char *client_private_key,
+                        size_t client_private_key_len,
+                        char *client_cert_path, char *ca_cert_path,
+                        SSL_CTX ** ctx);
+
+/**
+ * <pre>
+ * This function releases the caller's reference to a TLS context from
+ * tls_context_acquire() (the context is freed once neither the cache nor
+ * any caller holds it).
+ * </pre>
+ *
+ * @param[in]  ctx  the TLS context (may be NULL)
+ */
+void tls_context_release(SSL_CTX * ctx);
+
+/**
+ * <pre>
+ * This function empties the TLS context cache. Contexts still held by
+ * callers remain usable until released.
+ * </pre>
+ */
+void tls_context_cache_clear(void);
+
 /**
  * <pre>
  * This function handles generic OpenSSL cleanup boilerplate.
@@ -85,6 +325,27 @@ int tls_set_context(unsigned char *client_private_key,
  */
 int tls_cleanup(void);
 
+/**
+ * <pre>
+ * This function sets (or clears) the deadline of a connection made by
+ * create_tls_connection_resume(), replacing that of its socket options:
+ * before each later exchange over it (by the functions below), its socket
+ * timeouts are cut to the time left, and once the deadline has passed the
+ * exchange fails. A connection that is kept (e.g., for several requests)
+ * can so be given a deadline for each request.
+ * </pre>
+ *
+ * @param[in]  bio          OpenSSL BIO structure with the connection
+ *                          already instantiated
+ *
+ * @param[in]  deadline_ns  monotonic clock time (CLOCK_MONOTONIC, in
+ *                          nanoseconds) the exchanges must be done by, or 0
+ *                          for none
+ *
+ * @return 0 if success, 1 if error
+ */
+int tls_set_deadline(BIO * bio, uint64_t deadline_ns);
+
 /**
  * <pre>
  * This function takes an existing TLS connection (in the form of OpenSSL BIO and SSL_CTX 
@@ -103,8 +364,6 @@ int tls_cleanup(void);
  *
  * @param[out] resp_size       size of the returned message
  *
- * @param[in]  verbose         if true, extra debug messages displayed
- * 
  * @return 0 if success, 1 if error
  */
 int get_resp_from_tls_server(BIO * bio,
@@ -113,6 +372,50 @@ int get_resp_from_tls_server(BIO * bio,
                              unsigned char **resp,
                              size_t * resp_size);
 
+/**
+ * <pre>
+ * This function reads one complete KMIP message from a connection: the
+ * 8 byte TTLV header, then exactly the length of value it declares, however
+ * the message is split across TLS records.
+ * </pre>
+ *
+ * @param[in]  bio          OpenSSL BIO structure with the connection
+ *                          already instantiated
+ *
+ * @param[in]  max_len      maximum size (in bytes) of the message accepted
+ *
+ * @param[out] msg          the KMIP message read (header included)
+ *
+ * @param[out] msg_len      size (in bytes) of the KMIP message read
+ *
+ * @return 0 if success, 1 if error
+ */
+int tls_read_kmip_message(BIO * bio, size_t max_len,
+                          unsigned char **msg, size_t * msg_len);
+
+/**
+ * <pre>
+ * This function takes an existing TLS connection, sends a (KMIP) request to
+ * the server and reads back the complete KMIP response message.
+ * </pre>
+ *
+ * @param[in]  bio             OpenSSL BIO structure with the connection
+ *                             already instantiated
+ *
+ * @param[in]  req             the encoded KMIP request to send the server
+ *
+ * @param[in]  req_size        length of the request
+ *
+ * @param[out] resp            the KMIP response message from the server
+ *
+ * @param[out] resp_size       size of the returned message
+ *
+ * @return 0 if success, 1 if error
+ */
+int get_kmip_resp_from_tls_server(BIO * bio,
+                                  unsigned char *req, size_t req_size,
+                                  unsigned char **resp, size_t * resp_size);
+
 /**
  * <pre>
  * This function takes an existing TLS connection (in the form of OpenSSL BIO and SSL_CTX
@@ -135,4 +438,31 @@ int get_resp_from_tls_server(BIO * bio,
 int get_key_from_kmip_server(BIO * bio,
                              char *message, size_t message_length,
                              unsigned char **key, size_t * key_size);
+
+/**
+ * <pre>
+ * This function takes an existing TLS connection to a KMIP server, along
+ * with a list of symmetric key IDs, and retrieves all of the keys using
+ * batched KMIP Get requests (up to KMYTH_KMIP_MAX_BATCH_COUNT keys per
+ * round trip).
+ * </pre>
+ *
+ * @param[in]  bio        OpenSSL BIO structure with the connection
+ *                        already instantiated
+ *
+ * @param[in]  ids        the IDs of the keys to retrieve
+ *
+ * @param[in]  count      number of keys to retrieve
+ *
+ * @param[out] keys       the retrieved keys, in the same order as ids
+ *                        (an array of count entries, allocated by the
+ *                        caller)
+ *
+ * @param[out] key_sizes  sizes of the retrieved keys (an array of count
+ *                        entries, allocated by the caller)
+ *
+ * @return 0 if success, 1 if error
+ */
+int get_keys_from_kmip_server(BIO * bio, char **ids, size_t count,
+                              unsigned char **keys, size_t * key_sizes);
 #endif
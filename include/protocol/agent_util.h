@@ -0,0 +1,297 @@
+/**
+ * @file agent_util.h
+ *
+ * @brief Utility functions supporting kmyth-agent, the unsealed data cache
+ *        daemon, and its clients.
+ *
+ * Clients talk to kmyth-agent over a UNIX domain socket, one request per
+ * connection. A request is a single text line, optionally accompanied by
+ * an open (readable) file descriptor for a .ski file, passed as
+ * SCM_RIGHTS ancillary data:
+ *
+ * <UL>
+ *   <LI> "UNSEAL <ttl> <policy_or>\n" (with fd) - respond with the unsealed
+ *        contents of the .ski file, unsealing it only if it is not already
+ *        cached. A ttl of 0 selects the agent's default. </LI>
+ *   <LI> "INVALIDATE\n" (with fd) - drop any cached entry for the file </LI>
+ *   <LI> "FLUSH\n" - drop every cached entry </LI>
+ * </UL>
+ *
+ * The response is "OK <length>\n" followed by length bytes of data (0 for
+ * INVALIDATE and FLUSH), or "ERR <reason>\n".
+ *
+ * Passing an open file descriptor, rather than a path, means that a client
+ * can only obtain the contents of .ski files that it is itself able to
+ * open. Cache entries are keyed by the file's identity (device, inode,
+ * size, and modification time), so a modified or replaced .ski file is
+ * never served from the cache.
+ *
+ * kmyth-getkey --daemon answers requests framed the same way: the line
+ * "GET\n" or "GET <key ID>\n" (with no file descriptor), responded to with
+ * the key the server returned.
+ */
+
+#ifndef AGENT_UTIL_H
+#define AGENT_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <sys/stat.h>
+
+/**
+ * @brief Maximum length of a kmyth-agent request or response header line
+ *        (including the terminating newline)
+ */
+#define KMYTH_AGENT_MAX_LINE_LEN 64
+
+/**
+ * @brief kmyth-agent request types
+ */
+typedef enum
+{
+  KMYTH_AGENT_UNSEAL = 0,
+  KMYTH_AGENT_INVALIDATE,
+  KMYTH_AGENT_FLUSH
+} kmyth_agent_cmd;
+
+/**
+ * @brief A parsed kmyth-agent request
+ */
+typedef struct
+{
+  kmyth_agent_cmd cmd;
+  unsigned int ttl;
+  uint8_t policy_or;
+} kmyth_agent_request;
+
+/**
+ * @brief Identity of a .ski file, as used to key the cache
+ */
+typedef struct
+{
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+} agent_file_id;
+
+/**
+ * @brief A cached (unsealed) entry
+ */
+typedef struct agent_cache_entry_s
+{
+  agent_file_id id;
+  uint8_t *data;
+  size_t data_len;
+  time_t expiry;
+  struct agent_cache_entry_s *next;
+} agent_cache_entry;
+
+/**
+ * @brief The kmyth-agent cache (a list of entries, most recently added
+ *        first)
+ */
+typedef struct
+{
+  agent_cache_entry *head;
+  size_t count;
+  size_t max_count;
+} agent_cache;
+
+/**
+ * <pre>
+ * This function initializes an (empty) cache.
+ * </pre>
+ *
+ * @param[out] cache      The cache to be initialized.
+ *
+ * @param[in]  max_count  The maximum number of entries held - when full,
+ *                        adding an entry evicts the one closest to expiry.
+ *
+ * @return None
+ */
+void agent_cache_init(agent_cache * cache, size_t max_count);
+
+/**
+ * <pre>
+ * This function fills in the cache identity of a file from its status.
+ * </pre>
+ *
+ * @param[in]  st         The file status (e.g., from fstat()).
+ *
+ * @param[out] id         The file identity.
+ *
+ * @return None
+ */
+void agent_file_id_from_stat(const struct stat *st, agent_file_id * id);
+
+/**
+ * <pre>
+ * This function compares two file identities.
+ * </pre>
+ * @param[in]  a          A file identity.
+ * @param[in]  b          Another file identity.
+ * @return 1 if they identify the same (unmodified) file, 0 otherwise
+ */
+int agent_file_id_equal(const agent_file_id * a, const agent_file_id * b);
+
+/**
+ * <pre>
+ * This function looks up the (unexpired) cache entry for a file.
+ * </pre>
+ *
+ * @param[in]  cache      The cache.
+ *
+ * @param[in]  id         The identity of the .ski file.
+ *
+ * @param[in]  now        The current (monotonic) time, in seconds.
+ *
+ * @return the cache entry, or NULL if the file is not cached
+ */
+agent_cache_entry *agent_cache_lookup(agent_cache * cache,
+                                      const agent_file_id * id, time_t now);
+
+/**
+ * <pre>
+ * This function adds an entry to the cache, replacing any existing entry
+ * for the same file. The cache takes ownership of the data, which is
+ * cleared when the entry is evicted.
+ * </pre>
+ *
+ * @param[in]  cache      The cache.
+ *
+ * @param[in]  id         The identity of the .ski file.
+ *
+ * @param[in]  data       The unsealed data (allocated with
+ *                        kmyth_secure_alloc()).
+ *
+ * @param[in]  data_len   The size, in bytes, of data.
+ *
+ * @param[in]  expiry     The (monotonic) time, in seconds, at which the
+ *                        entry expires.
+ *
+ * @return 0 on success, 1 on error (the data is wiped and released)
+ */
+int agent_cache_insert(agent_cache * cache, const agent_file_id * id,
+                       uint8_t * data, size_t data_len, time_t expiry);
+
+/**
+ * <pre>
+ * This function evicts the cache entry (if any) for a file.
+ * </pre>
+ *
+ * @param[in]  cache      The cache.
+ *
+ * @param[in]  id         The identity of the .ski file.
+ *
+ * @return 1 if an entry was evicted, 0 if the file was not cached
+ */
+int agent_cache_invalidate(agent_cache * cache, const agent_file_id * id);
+
+/**
+ * <pre>
+ * This function evicts every expired cache entry.
+ * </pre>
+ *
+ * @param[in]  cache      The cache.
+ *
+ * @param[in]  now        The current (monotonic) time, in seconds.
+ *
+ * @return the earliest expiry time of the remaining entries, or 0 if the
+ *         cache is empty
+ */
+time_t agent_cache_evict_expired(agent_cache * cache, time_t now);
+
+/**
+ * <pre>
+ * This function evicts every cache entry.
+ * </pre>
+ *
+ * @param[in]  cache      The cache.
+ *
+ * @return None
+ */
+void agent_cache_clear(agent_cache * cache);
+
+/**
+ * <pre>
+ * This function parses a kmyth-agent request line.
+ * </pre>
+ *
+ * @param[in]  line       The request line (without its newline).
+ *
+ * @param[out] request    The parsed request.
+ *
+ * @return 0 on success, 1 on error
+ */
+int agent_parse_request(const char *line, kmyth_agent_request * request);
+
+/**
+ * <pre>
+ * This function receives a kmyth-agent request line, and the file
+ * descriptor passed with it (if any).
+ * </pre>
+ *
+ * @param[in]  socket_fd  The connected client socket.
+ *
+ * @param[out] line       Buffer (KMYTH_AGENT_MAX_LINE_LEN bytes) for the
+ *                        request line, returned without its newline.
+ *
+ * @param[out] passed_fd  The file descriptor passed by the client, or -1.
+ *
+ * @return 0 on success, 1 on error
+ */
+int agent_recv_request(int socket_fd, char *line, int *passed_fd);
+
+/**
+ * <pre>
+ * This function sends a successful kmyth-agent response.
+ * </pre>
+ *
+ * @param[in]  socket_fd  The connected client socket.
+ *
+ * @param[in]  data       The response data (may be NULL if data_len is 0).
+ *
+ * @param[in]  data_len   The size, in bytes, of data.
+ *
+ * @return 0 on success, 1 on error
+ */
+int agent_send_ok(int socket_fd, uint8_t * data, size_t data_len);
+
+/**
+ * <pre>
+ * This function sends a kmyth-agent error response.
+ * </pre>
+ *
+ * @param[in]  socket_fd  The connected client socket.
+ *
+ * @param[in]  reason     Short description of the error.
+ *
+ * @return 0 on success, 1 on error
+ */
+int agent_send_error(int socket_fd, const char *reason);
+
+/**
+ * <pre>
+ * This function sends a request to kmyth-agent and receives its response.
+ * </pre>
+ *
+ * @param[in]  socket_path  The kmyth-agent socket path.
+ *
+ * @param[in]  request      The request line (including its newline).
+ *
+ * @param[in]  ski_fd       Open .ski file descriptor to pass with the
+ *                          request, or -1.
+ *
+ * @param[out] data         The response data (allocated, NULL if empty).
+ *
+ * @param[out] data_len     The size, in bytes, of data.
+ *
+ * @return 0 on success, 1 on error (including an error response)
+ */
+int agent_request(const char *socket_path, const char *request, int ski_fd,
+                  uint8_t ** data, size_t *data_len);
+
+#endif
@@ -0,0 +1,176 @@
+/**
+ * @file boot_util.h
+ *
+ * @brief Utility functions unsealing the keys needed at boot, in priority
+ *        order, from a boot manifest.
+ *
+ * Each (non-blank, non-comment) line of a boot manifest lists a key:
+ *
+ * <pre>
+ *   <priority> <.ski file> <target>
+ * </pre>
+ *
+ * where a lower priority (0 to KMYTH_BOOT_MAX_PRIORITY) is unsealed
+ * sooner, the .ski file path contains no whitespace, and the target is one
+ * of:
+ *
+ * <UL>
+ *   <LI> "file:<path>" - write the key to this file </LI>
+ *   <LI> "exec:<command>" - run this (shell) command, the rest of the line,
+ *        handing it the key in a sealed memory file (see handoff_util.h)
+ *        </LI>
+ *   <LI> "send:<socket>" - pass the key, in a sealed memory file, to the
+ *        process listening on this UNIX domain socket </LI>
+ *   <LI> "agent" - cache the key in kmyth-agent (started with --boot) </LI>
+ * </UL>
+ *
+ * The keys sharing a priority form a tier, unsealed as one batch over a
+ * single set of TPM contexts. While a tier is unsealed, the keys of the
+ * tier before it are delivered to their targets and the .ski files of the
+ * tier after it are read, so the first (most urgent) keys are delivered
+ * after one small batch, rather than after every key has been unsealed.
+ */
+
+#ifndef BOOT_UTIL_H
+#define BOOT_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kmyth.h"
+
+/**
+ * @brief Largest priority a boot manifest entry may have
+ */
+#define KMYTH_BOOT_MAX_PRIORITY 999
+
+/**
+ * @brief Boot manifest entry targets (as bits, so that a reader can select
+ *        those it delivers to)
+ */
+typedef enum
+{
+  KMYTH_BOOT_TARGET_FILE = 0x1,
+  KMYTH_BOOT_TARGET_EXEC = 0x2,
+  KMYTH_BOOT_TARGET_SEND = 0x4,
+  KMYTH_BOOT_TARGET_AGENT = 0x8
+} kmyth_boot_target;
+
+/**
+ * @brief A boot manifest entry
+ */
+typedef struct
+{
+  unsigned int priority;
+  char *ski_path;
+  kmyth_boot_target target;
+
+  // the target's path, command or socket (NULL for the agent)
+  char *target_arg;
+
+  // the entry's position in the manifest (which orders a tier)
+  size_t order;
+} kmyth_boot_entry;
+
+/**
+ * @brief A boot manifest, its entries sorted by priority (keeping the
+ *        manifest's order within a priority)
+ */
+typedef struct
+{
+  kmyth_boot_entry *entries;
+  size_t count;
+} kmyth_boot_manifest;
+
+/**
+ * @brief What a boot unseal achieved, and how long it took
+ */
+typedef struct
+{
+  size_t delivered;
+  size_t failed;
+  size_t tiers;
+
+  // from the start of boot_unseal() to the first key delivered (-1 if none
+  // was), and to the end, in microseconds
+  int64_t first_key_us;
+  int64_t total_us;
+} kmyth_boot_report;
+
+/**
+ * <pre>
+ * This function delivers an unsealed key to its target. The key is cleared
+ * once it returns, so it must copy anything it keeps.
+ * </pre>
+ */
+typedef int (*kmyth_boot_deliver_fn) (const kmyth_boot_entry * entry,
+                                      uint8_t * key, size_t key_len,
+                                      void *arg);
+
+/**
+ * <pre>
+ * This function reads a boot manifest.
+ * </pre>
+ *
+ * @param[in]  path       The path of the boot manifest.
+ *
+ * @param[in]  targets    The targets (kmyth_boot_target bits) of the
+ *                        entries to keep - any other entries are skipped.
+ *
+ * @param[out] manifest   The manifest (to be released with
+ *                        boot_manifest_free()).
+ *
+ * @return 0 on success, 1 on error (including a malformed line)
+ */
+int boot_manifest_read(const char *path, unsigned int targets,
+                       kmyth_boot_manifest * manifest);
+
+/**
+ * <pre>
+ * This function releases a boot manifest.
+ * </pre>
+ *
+ * @param[in]  manifest   The manifest.
+ *
+ * @return None
+ */
+void boot_manifest_free(kmyth_boot_manifest * manifest);
+
+/**
+ * <pre>
+ * This function unseals the keys of a boot manifest, a tier at a time in
+ * priority order, delivering each one as soon as its tier is done. A key
+ * that cannot be unsealed or delivered is reported, but does not stop the
+ * others.
+ * </pre>
+ *
+ * @param[in]  pool              The TPM contexts to unseal with.
+ *
+ * @param[in]  manifest          The boot manifest.
+ *
+ * @param[in]  deliver           Called (from a single thread) with each
+ *                               unsealed key.
+ *
+ * @param[in]  deliver_arg       Passed to every call of deliver.
+ *
+ * @param[in]  auth_bytes        As for tpm2_kmyth_unseal_batch_pool().
+ *
+ * @param[in]  auth_bytes_len    The length, in bytes, of auth_bytes.
+ *
+ * @param[in]  owner_auth_bytes  As for tpm2_kmyth_unseal_batch_pool().
+ *
+ * @param[in]  oa_bytes_len      The length, in bytes, of owner_auth_bytes.
+ *
+ * @param[in]  bool_policy_or    As for tpm2_kmyth_unseal_batch_pool().
+ *
+ * @param[out] report            What was delivered, and when.
+ *
+ * @return 0 if every key was delivered, 1 otherwise
+ */
+int boot_unseal(kmyth_pool_t * pool, kmyth_boot_manifest * manifest,
+                kmyth_boot_deliver_fn deliver, void *deliver_arg,
+                uint8_t * auth_bytes, size_t auth_bytes_len,
+                uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                uint8_t bool_policy_or, kmyth_boot_report * report);
+
+#endif
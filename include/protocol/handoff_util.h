@@ -0,0 +1,92 @@
+/**
+ * @file handoff_util.h
+ *
+ * @brief Utility functions handing an unsealed (or retrieved) key to its
+ *        consumer without it ever being written to a file.
+ *
+ * The key is placed in an anonymous, sealed memory file (memfd_create(2)):
+ * its size and contents are fixed (F_SEAL_SHRINK, F_SEAL_GROW, F_SEAL_WRITE)
+ * and the seals themselves can no longer be changed (F_SEAL_SEAL), so the
+ * consumer can trust what it maps. The memory file is then either:
+ *
+ * <UL>
+ *   <LI> inherited by a command that kmyth runs, which finds the file
+ *        descriptor number in the KMYTH_HANDOFF_FD_ENV and the key size in
+ *        the KMYTH_HANDOFF_SIZE_ENV environment variables, or </LI>
+ *   <LI> passed (as SCM_RIGHTS ancillary data) to a process waiting on a
+ *        UNIX domain socket, along with the line "KEY <size>\n" </LI>
+ * </UL>
+ *
+ * Either way, the consumer can mmap(2) the key (read-only) rather than
+ * reading a copy of it.
+ */
+
+#ifndef HANDOFF_UTIL_H
+#define HANDOFF_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Environment variable giving a handoff command the key's file
+ *        descriptor number
+ */
+#define KMYTH_HANDOFF_FD_ENV "KMYTH_KEY_FD"
+
+/**
+ * @brief Environment variable giving a handoff command the key's size, in
+ *        bytes
+ */
+#define KMYTH_HANDOFF_SIZE_ENV "KMYTH_KEY_SIZE"
+
+/**
+ * <pre>
+ * This function creates a sealed memory file holding a key.
+ * </pre>
+ *
+ * @param[in]  name       Name for the memory file (only used for debugging,
+ *                        e.g., in /proc/<pid>/fd).
+ *
+ * @param[in]  data       The key (may be NULL if data_len is 0).
+ *
+ * @param[in]  data_len   The size, in bytes, of data.
+ *
+ * @param[out] fd         The (close-on-exec) memory file descriptor, to be
+ *                        closed by the caller.
+ *
+ * @return 0 on success, 1 on error
+ */
+int handoff_create_memfd(const char *name, uint8_t * data, size_t data_len,
+                         int *fd);
+
+/**
+ * <pre>
+ * This function runs a (shell) command that inherits a key memory file,
+ * and waits for it to finish.
+ * </pre>
+ *
+ * @param[in]  fd         The memory file descriptor (from
+ *                        handoff_create_memfd()).
+ *
+ * @param[in]  command    The command, run by /bin/sh -c.
+ *
+ * @return 0 if the command ran and exited successfully, 1 otherwise
+ */
+int handoff_exec(int fd, const char *command);
+
+/**
+ * <pre>
+ * This function passes a key memory file to the process listening on a
+ * UNIX domain socket.
+ * </pre>
+ *
+ * @param[in]  fd           The memory file descriptor (from
+ *                          handoff_create_memfd()).
+ *
+ * @param[in]  socket_path  The path of the consumer's socket.
+ *
+ * @return 0 on success, 1 on error
+ */
+int handoff_send(int fd, const char *socket_path);
+
+#endif
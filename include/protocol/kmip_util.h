@@ -7,6 +7,81 @@
 #ifndef KMYTH_KMIP_UTIL_H
 #define KMYTH_KMIP_UTIL_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Initial size (in bytes) of the slab that a KMIP workspace
+ *        allocates decoded message structures from
+ */
+#define KMIP_WORKSPACE_SLAB_SIZE 8192
+
+/**
+ * @brief Buffers reused for every KMIP message built or parsed with one
+ *        KMIP context.
+ *
+ * A workspace is attached to a context through the context's state
+ * pointer, which libkmip's own allocators ignore. Each message built with
+ * the context is then encoded into the same (growing) buffer, and lays its
+ * batch items out in the same slabs. The structures that libkmip decodes a
+ * message into are allocated from a slab that is wiped and recycled, as a
+ * whole, once the message has been parsed (and that grows, for the next
+ * message, when a message overflows it).
+ */
+typedef struct
+{
+  KMIP *ctx;
+  uint8_t *encoding;
+  size_t encoding_size;
+  void *items;
+  size_t items_size;
+  void *batch_items;
+  size_t batch_items_size;
+  uint8_t *slab;
+  size_t slab_size;
+  size_t slab_used;
+  size_t slab_wanted;
+  void *(*calloc_func) (void *state, size_t num, size_t size);
+  void *(*realloc_func) (void *state, void *ptr, size_t size);
+  void (*free_func) (void *state, void *ptr);
+} kmip_workspace;
+
+/**
+ * <pre>
+ * This function creates a workspace and attaches it to a KMIP context, so
+ * that the message builders and parsers below reuse its buffers.
+ * </pre>
+ *
+ * @param[out] ws           the workspace
+ *
+ * @param[in]  ctx          the KMIP context (initialized, with no state of
+ *                          its own), which must outlive the workspace
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmip_workspace_init(kmip_workspace * ws, KMIP * ctx);
+
+/**
+ * <pre>
+ * This function resets a workspace's KMIP context and wipes the
+ * workspace's buffers, keeping them for the next message.
+ * </pre>
+ *
+ * @param[in]  ws           the workspace
+ */
+void kmip_workspace_reset(kmip_workspace * ws);
+
+/**
+ * <pre>
+ * This function detaches a workspace from its KMIP context, and wipes and
+ * frees its buffers.
+ * </pre>
+ *
+ * @param[in]  ws           the workspace (may be NULL, or uninitialized if
+ *                          zeroed)
+ */
+void kmip_workspace_free(kmip_workspace * ws);
+
 /**
  * <pre>
  * This function builds a basic KMIP Get request message.
@@ -28,6 +103,32 @@ int build_kmip_get_request(KMIP * ctx,
                            unsigned char *id, size_t id_len,
                            unsigned char **request, size_t *request_len);
 
+/**
+ * <pre>
+ * This function builds a KMIP Get request message batching several Get
+ * operations, one per ID, so that all of the keys can be retrieved in a
+ * single round trip.
+ * </pre>
+ *
+ * @param[in]  ctx          the KMIP context used to build the message
+ *
+ * @param[in]  ids          the IDs of the KMIP objects to retrieve
+ *
+ * @param[in]  id_lens      lengths (in bytes) of the IDs to retrieve
+ *
+ * @param[in]  count        number of IDs (batch items) in the request
+ *
+ * @param[out] request      the KMIP Get request message
+ *
+ * @param[out] request_len  length (in bytes) of the request message
+ *
+ * @return 0 on success, 1 on error
+ */
+int build_kmip_get_batch_request(KMIP * ctx,
+                                 unsigned char **ids, size_t *id_lens,
+                                 size_t count,
+                                 unsigned char **request, size_t *request_len);
+
 /**
  * <pre>
  * This function parses a basic KMIP Get request message.
@@ -49,6 +150,33 @@ int parse_kmip_get_request(KMIP * ctx,
                            unsigned char *request, size_t request_len,
                            unsigned char **id, size_t *id_len);
 
+/**
+ * <pre>
+ * This function parses a KMIP Get request message holding one or more
+ * (batched) Get operations. The ID lists are freed with
+ * free_kmip_get_batch().
+ * </pre>
+ *
+ * @param[in]  ctx          the KMIP context used to parse the message
+ *
+ * @param[in]  request      the KMIP Get request message
+ *
+ * @param[in]  request_len  length (in bytes) of the request message
+ *
+ * @param[out] ids          the IDs of the KMIP objects to retrieve,
+ *                          in batch order
+ *
+ * @param[out] id_lens      lengths (in bytes) of the IDs to retrieve
+ *
+ * @param[out] count        number of IDs (batch items) in the request
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_kmip_get_batch_request(KMIP * ctx,
+                                 unsigned char *request, size_t request_len,
+                                 unsigned char ***ids, size_t **id_lens,
+                                 size_t *count);
+
 /**
  * <pre>
  * This function builds a KMIP Get response message.
@@ -75,6 +203,37 @@ int build_kmip_get_response(KMIP * ctx,
                             unsigned char *key, size_t key_len,
                             unsigned char **response, size_t *response_len);
 
+/**
+ * <pre>
+ * This function builds a KMIP Get response message with one (successful)
+ * batch item per key, answering a batched Get request.
+ * </pre>
+ *
+ * @param[in]  ctx           the KMIP context used to build the message
+ *
+ * @param[in]  ids           the key IDs
+ *
+ * @param[in]  id_lens       lengths (in bytes) of the key IDs
+ *
+ * @param[in]  keys          the symmetric keys
+ *
+ * @param[in]  key_lens      lengths (in bytes) of the keys
+ *
+ * @param[in]  count         number of keys (batch items) in the response
+ *
+ * @param[out] response      the KMIP Get response message
+ *
+ * @param[out] response_len  length (in bytes) of the response message
+ *
+ * @return 0 on success, 1 on error
+ */
+int build_kmip_get_batch_response(KMIP * ctx,
+                                  unsigned char **ids, size_t *id_lens,
+                                  unsigned char **keys, size_t *key_lens,
+                                  size_t count,
+                                  unsigned char **response,
+                                  size_t *response_len);
+
 /**
  * <pre>
  * This function parses a KMIP Get response message.
@@ -101,4 +260,56 @@ int parse_kmip_get_response(KMIP * ctx,
                             unsigned char **id, size_t *id_len,
                             unsigned char **key, size_t *key_len);
 
+/**
+ * <pre>
+ * This function parses a KMIP Get response message holding one or more
+ * (batched) Get results. It fails if any of the batched Gets failed. The
+ * ID and key lists are freed with free_kmip_get_batch().
+ * </pre>
+ *
+ * @param[in]  ctx           the KMIP context used to parse the message
+ *
+ * @param[in]  response      the KMIP Get response message
+ *
+ * @param[in]  response_len  length (in bytes) of the response message
+ *
+ * @param[out] ids           the retrieved key IDs, in batch order
+ *
+ * @param[out] id_lens       lengths (in bytes) of the retrieved key IDs
+ *
+ * @param[out] keys          the retrieved keys
+ *
+ * @param[out] key_lens      lengths (in bytes) of the retrieved keys
+ *
+ * @param[out] count         number of keys (batch items) in the response
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_kmip_get_batch_response(KMIP * ctx,
+                                  unsigned char *response,
+                                  size_t response_len,
+                                  unsigned char ***ids, size_t **id_lens,
+                                  unsigned char ***keys, size_t **key_lens,
+                                  size_t *count);
+
+/**
+ * <pre>
+ * This function frees the ID and key lists returned by the batch parsing
+ * functions, clearing the keys first. Any of the lists may be NULL.
+ * </pre>
+ *
+ * @param[in]  ids       the list of IDs
+ *
+ * @param[in]  id_lens   lengths (in bytes) of the IDs
+ *
+ * @param[in]  keys      the list of keys
+ *
+ * @param[in]  key_lens  lengths (in bytes) of the keys
+ *
+ * @param[in]  count     number of entries in the lists
+ */
+void free_kmip_get_batch(unsigned char **ids, size_t *id_lens,
+                         unsigned char **keys, size_t *key_lens,
+                         size_t count);
+
 #endif
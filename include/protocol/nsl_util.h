@@ -7,9 +7,84 @@
 #ifndef NSL_UTIL_H
 #define NSL_UTIL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/**
+ * @brief Length (in bytes) of a server's session ticket key
+ */
+#define NSL_TICKET_KEY_LEN 32
+
+/**
+ * @brief Default lifetime (in seconds) of a session ticket
+ */
+#define NSL_TICKET_LIFETIME_DEFAULT 3600
+
+/**
+ * @brief Length (in bytes) of the header ahead of each NSL message - the
+ *        message length, as a big-endian 32-bit integer
+ */
+#define NSL_FRAME_HEADER_LEN 4
+
+/**
+ * @brief Longest (in bytes) NSL message accepted
+ */
+#define NSL_FRAME_MAX_LEN (1024 * 1024)
+
+/**
+ * @brief A growable message buffer. Its allocation is kept (and reused)
+ *        across messages, and cleared whenever it is replaced or freed.
+ */
+typedef struct
+{
+  unsigned char *data;
+  size_t size;
+  size_t len;
+} nsl_buffer;
+
+/**
+ * @brief An NSL connection: the socket, and the buffers reused for every
+ *        message sent, received and decrypted over it.
+ *
+ * Each message is sent as a frame - NSL_FRAME_HEADER_LEN bytes of length
+ * followed by the message itself - so that it is received whole, however
+ * the stream happens to be split. Messages are built straight into the
+ * send buffer, and parsed (into views of the receive and scratch buffers)
+ * without further copies.
+ */
+typedef struct
+{
+  int socket_fd;
+  nsl_buffer send;
+  nsl_buffer recv;
+  nsl_buffer scratch;
+} nsl_connection;
+
+/**
+ * @brief A session ticket, as kept by a client to resume sessions with a
+ *        server without repeating the full NSL negotiation.
+ *
+ * The ticket itself is opaque to the client: it holds the expiry time and
+ * the resumption secret, encrypted under the server's ticket key. The
+ * client derives the same resumption secret from the session key of the
+ * negotiation that the ticket was issued with. A ticket may be used for
+ * any number of sessions until it expires.
+ */
+typedef struct
+{
+  unsigned char *ticket;
+  size_t ticket_len;
+  unsigned char *secret;
+  size_t secret_len;
+  time_t expiry;
+} nsl_session_ticket;
+
 /**
  * <pre>
- * This function encrypts plaintext using the provided EVP keypair context.
+ * This function encrypts plaintext using the provided EVP keypair context:
+ * with RSA for an RSA key, or with ECIES (ephemeral ECDH, HKDF-SHA256 and
+ * AES-256-GCM) for an EC (e.g., P-256) or X25519 key.
  * </pre>
  *
  * @param[in]  ctx    EVP keypair context used for encryption
@@ -24,13 +99,15 @@
  *
  * @return 0 on success, 1 on error
  */
-int encrypt_with_key_pair(EVP_PKEY_CTX ctx,
+int encrypt_with_key_pair(EVP_PKEY_CTX * ctx,
                           const unsigned char *p, size_t p_len,
                           unsigned char **c, size_t *c_len);
 
 /**
  * <pre>
- * This function decrypts ciphertext using the provided EVP keypair context.
+ * This function decrypts ciphertext using the provided EVP keypair context,
+ * with RSA or ECIES according to the key's type (see
+ * encrypt_with_key_pair()).
  * </pre>
  *
  * @param[in]  ctx    EVP keypair context used for decryption
@@ -45,10 +122,98 @@ int encrypt_with_key_pair(EVP_PKEY_CTX ctx,
  *
  * @return 0 on success, 1 on error
  */
-int decrypt_with_key_pair(EVP_PKEY_CTX ctx,
+int decrypt_with_key_pair(EVP_PKEY_CTX * ctx,
                           const unsigned char *c, size_t c_len,
                           unsigned char **p, size_t *p_len);
 
+/**
+ * <pre>
+ * This function appends space to a message buffer, growing it (at least
+ * doubling its size, and clearing the old allocation) as needed.
+ * </pre>
+ *
+ * @param[in,out] buf  the message buffer
+ *
+ * @param[in]     len  the number of bytes to append
+ *
+ * @return a pointer to the appended (uninitialized) space, valid until the
+ *         buffer next grows, or NULL on error
+ */
+unsigned char *nsl_buffer_append(nsl_buffer * buf, size_t len);
+
+/**
+ * <pre>
+ * This function clears and frees a message buffer.
+ * </pre>
+ *
+ * @param[in,out] buf  the message buffer
+ */
+void nsl_buffer_free(nsl_buffer * buf);
+
+/**
+ * <pre>
+ * This function sets up a connection, with empty message buffers.
+ * </pre>
+ *
+ * @param[out] conn       the connection
+ *
+ * @param[in]  socket_fd  the socket the connection's messages are sent and
+ *                        received on
+ */
+void nsl_connection_init(nsl_connection * conn, int socket_fd);
+
+/**
+ * <pre>
+ * This function clears and frees a connection's message buffers (the
+ * socket is left open).
+ * </pre>
+ *
+ * @param[in,out] conn  the connection
+ */
+void nsl_connection_free(nsl_connection * conn);
+
+/**
+ * <pre>
+ * This function starts a new message in a connection's send buffer, which
+ * the message payload is then appended to.
+ * </pre>
+ *
+ * @param[in,out] conn  the connection
+ *
+ * @return 0 on success, 1 on error
+ */
+int nsl_frame_begin(nsl_connection * conn);
+
+/**
+ * <pre>
+ * This function sends the message in a connection's send buffer, preceded
+ * by its length.
+ * </pre>
+ *
+ * @param[in,out] conn  the connection
+ *
+ * @return 0 on success, 1 on error
+ */
+int nsl_send_frame(nsl_connection * conn);
+
+/**
+ * <pre>
+ * This function receives a whole message into a connection's receive
+ * buffer.
+ * </pre>
+ *
+ * @param[in,out] conn         the connection
+ *
+ * @param[out]    payload      the message, valid until the next message is
+ *                             received on the connection
+ *
+ * @param[out]    payload_len  length (in bytes) of the message
+ *
+ * @return 0 on success, 1 on error
+ */
+int nsl_recv_frame(nsl_connection * conn, unsigned char **payload,
+                   size_t *payload_len);
+
 /**
  * <pre>
  * This function builds the nonce request for the initial NSL handshake.
@@ -64,16 +229,15 @@ int decrypt_with_key_pair(EVP_PKEY_CTX ctx,
  *
  * @param[in]  id_len       length (in bytes) of the ID string
  *
- * @param[out] request      the encrypted request message
- *
- * @param[out] request_len  length (in bytes) of the request message
+ * @param[out] request      buffer the encrypted request message is appended
+ *                          to
  *
  * @return 0 on success, 1 on error
  */
 int build_nonce_request(EVP_PKEY_CTX * ctx,
                         unsigned char *nonce, size_t nonce_len,
                         unsigned char *id, size_t id_len,
-                        unsigned char **request, size_t *request_len);
+                        nsl_buffer * request);
 
 /**
  * <pre>
@@ -86,6 +250,9 @@ int build_nonce_request(EVP_PKEY_CTX * ctx,
  *
  * @param[in]  request_len  length (in bytes) of the request message
  *
+ * @param[out] message      buffer the request is decrypted into (the
+ *                          nonce and ID point into it)
+ *
  * @param[out] nonce        the nonce
  *
  * @param[out] nonce_len    length (in bytes) of the nonce string
@@ -98,6 +265,7 @@ int build_nonce_request(EVP_PKEY_CTX * ctx,
  */
 int parse_nonce_request(EVP_PKEY_CTX * ctx,
                         unsigned char *request, size_t request_len,
+                        nsl_buffer * message,
                         unsigned char **nonce, size_t *nonce_len,
                         unsigned char **id, size_t *id_len);
 
@@ -120,9 +288,8 @@ int parse_nonce_request(EVP_PKEY_CTX * ctx,
  *
  * @param[in]  id_len        length (in bytes) of the ID string
  *
- * @param[out] response      the response message
- *
- * @param[out] response_len  length (in bytes) of the response message
+ * @param[out] response      buffer the encrypted response message is
+ *                           appended to
  *
  * @return 0 on success, 1 on error
  */
@@ -130,7 +297,7 @@ int build_nonce_response(EVP_PKEY_CTX * ctx,
                          unsigned char *nonce_a, size_t nonce_a_len,
                          unsigned char *nonce_b, size_t nonce_b_len,
                          unsigned char *id, size_t id_len,
-                         unsigned char **response, size_t *response_len);
+                         nsl_buffer * response);
 
 /**
  * <pre>
@@ -143,6 +310,9 @@ int build_nonce_response(EVP_PKEY_CTX * ctx,
  *
  * @param[in]  response_len  length (in bytes) of the response message
  *
+ * @param[out] message       buffer the response is decrypted into (the
+ *                           nonces and ID point into it)
+ *
  * @param[out] nonce_a       nonce A
  *
  * @param[out] nonce_a_len   length (in bytes) of nonce A
@@ -159,6 +329,7 @@ int build_nonce_response(EVP_PKEY_CTX * ctx,
  */
 int parse_nonce_response(EVP_PKEY_CTX * ctx,
                          unsigned char *response, size_t response_len,
+                         nsl_buffer * message,
                          unsigned char **nonce_a, size_t *nonce_a_len,
                          unsigned char **nonce_b, size_t *nonce_b_len,
                          unsigned char **id, size_t *id_len);
@@ -174,16 +345,14 @@ int parse_nonce_response(EVP_PKEY_CTX * ctx,
  *
  * @param[in]  nonce_len         length (in bytes) of the nonce
  *
- * @param[out] confirmation      the confirmation message
- *
- * @param[out] confirmation_len  length (in bytes) of the confirmation message
+ * @param[out] confirmation      buffer the encrypted confirmation message is
+ *                               appended to
  *
  * @return 0 on success, 1 on error
  */
 int build_nonce_confirmation(EVP_PKEY_CTX * ctx,
                              unsigned char *nonce, size_t nonce_len,
-                             unsigned char **confirmation,
-                             size_t *confirmation_len);
+                             nsl_buffer * confirmation);
 
 /**
  * <pre>
@@ -196,6 +365,9 @@ int build_nonce_confirmation(EVP_PKEY_CTX * ctx,
  *
  * @param[in]  confirmation_len  length (in bytes) of the confirmation message
  *
+ * @param[out] message           buffer the confirmation is decrypted into
+ *                               (the nonce points into it)
+ *
  * @param[out] nonce             the nonce being confirmed
  *
  * @param[out] nonce_len         length (in bytes) of the nonce
@@ -204,8 +376,8 @@ int build_nonce_confirmation(EVP_PKEY_CTX * ctx,
  */
 int parse_nonce_confirmation(EVP_PKEY_CTX * ctx,
                              unsigned char *confirmation,
-                             size_t confirmation_len, unsigned char **nonce,
-                             size_t *nonce_len);
+                             size_t confirmation_len, nsl_buffer * message,
+                             unsigned char **nonce, size_t *nonce_len);
 
 /**
  * <pre>
@@ -328,4 +500,135 @@ int negotiate_server_session_key(int socket_fd,
                                  unsigned char *id, size_t id_len,
                                  unsigned char **session_key,
                                  size_t *session_key_len);
+/**
+ * <pre>
+ * This function creates a (random) key with which a server encrypts the
+ * session tickets it issues.
+ * </pre>
+ *
+ * @param[out] ticket_key      the ticket key
+ *
+ * @param[out] ticket_key_len  length (in bytes) of the ticket key
+ *
+ * @return 0 on success, 1 on error
+ */
+int create_ticket_key(unsigned char **ticket_key, size_t *ticket_key_len);
+
+/**
+ * <pre>
+ * This function runs the server side of a session key negotiation in which
+ * clients may use session tickets. A client may:
+ *   - run the full NSL negotiation (as for negotiate_server_session_key()),
+ *   - run the full NSL negotiation and be issued a session ticket, or
+ *   - resume a session with a ticket: the session key is then agreed in a
+ *     single round trip, using only symmetric cryptography.
+ * </pre>
+ *
+ * @param[in]  socket_fd        the open socket file descriptor
+ *
+ * @param[in]  public_key_ctx   the EVP_PKEY_CTX containing the remote public key
+ *
+ * @param[in]  private_key_ctx  the EVP_PKEY_CTX containing the local private key
+ *
+ * @param[in]  id               the local ID
+ *
+ * @param[in]  id_len           length (in bytes) of the local ID
+ *
+ * @param[in]  ticket_key       the key session tickets are encrypted with
+ *                              (from create_ticket_key())
+ *
+ * @param[in]  ticket_key_len   length (in bytes) of the ticket key
+ *
+ * @param[in]  ticket_lifetime  lifetime (in seconds) of the tickets issued
+ *
+ * @param[out] session_key      the session key
+ *
+ * @param[out] session_key_len  length (in bytes) of the session key
+ *
+ * @param[out] resumed          whether the session was resumed with a ticket
+ *
+ * @return 0 on success, 1 on error
+ */
+int accept_server_session_key(int socket_fd,
+                              EVP_PKEY_CTX * public_key_ctx,
+                              EVP_PKEY_CTX * private_key_ctx,
+                              unsigned char *id, size_t id_len,
+                              unsigned char *ticket_key,
+                              size_t ticket_key_len, time_t ticket_lifetime,
+                              unsigned char **session_key,
+                              size_t *session_key_len, bool *resumed);
+
+/**
+ * <pre>
+ * This function runs the client side NSL negotiation, as for
+ * negotiate_client_session_key(), and then receives a session ticket from
+ * the server (which must be using accept_server_session_key()).
+ * </pre>
+ *
+ * @param[in]  socket_fd        the open socket file descriptor
+ *
+ * @param[in]  public_key_ctx   the EVP_PKEY_CTX containing the remote public key
+ *
+ * @param[in]  private_key_ctx  the EVP_PKEY_CTX containing the local private key
+ *
+ * @param[in]  id               the local ID
+ *
+ * @param[in]  id_len           length (in bytes) of the local ID
+ *
+ * @param[in]  expected_id      the expected ID
+ *
+ * @param[in]  expected_id_len  length (in bytes) of the expected ID
+ *
+ * @param[out] session_key      the session key
+ *
+ * @param[out] session_key_len  length (in bytes) of the session key
+ *
+ * @param[out] ticket           the session ticket (to be released with
+ *                              free_session_ticket())
+ *
+ * @return 0 on success, 1 on error
+ */
+int negotiate_client_session_ticket(int socket_fd,
+                                    EVP_PKEY_CTX * public_key_ctx,
+                                    EVP_PKEY_CTX * private_key_ctx,
+                                    unsigned char *id, size_t id_len,
+                                    unsigned char *expected_id,
+                                    size_t expected_id_len,
+                                    unsigned char **session_key,
+                                    size_t *session_key_len,
+                                    nsl_session_ticket * ticket);
+
+/**
+ * <pre>
+ * This function resumes a session with a session ticket, obtaining a fresh
+ * session key in a single round trip.
+ * </pre>
+ *
+ * @param[in]  socket_fd        the open socket file descriptor
+ *
+ * @param[in]  ticket           the session ticket (from
+ *                              negotiate_client_session_ticket())
+ *
+ * @param[out] session_key      the session key
+ *
+ * @param[out] session_key_len  length (in bytes) of the session key
+ *
+ * @return 0 on success, 1 on error (e.g., the ticket has expired, in which
+ *         case a new one must be negotiated)
+ */
+int resume_client_session_key(int socket_fd, nsl_session_ticket * ticket,
+                              unsigned char **session_key,
+                              size_t *session_key_len);
+
+/**
+ * <pre>
+ * This function clears and releases a session ticket.
+ * </pre>
+ *
+ * @param[in]  ticket           the session ticket
+ *
+ * @return None
+ */
+void free_session_ticket(nsl_session_ticket * ticket);
+
 #endif
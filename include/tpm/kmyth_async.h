@@ -0,0 +1,64 @@
+/**
+ * @file  kmyth_async.h
+ *
+ * @brief Provides the internals of the engine for asynchronous seal/unseal
+ *        requests. The engine functions themselves are declared in kmyth.h,
+ *        and implemented in src/tpm/kmyth_async.c
+ */
+
+#ifndef KMYTH_ASYNC_H
+#define KMYTH_ASYNC_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "kmyth.h"
+
+/**
+ * @brief The operations a kmyth_async_req_t can request
+ */
+typedef enum kmyth_async_op_e
+{
+  KMYTH_ASYNC_SEAL,
+  KMYTH_ASYNC_UNSEAL
+} kmyth_async_op_t;
+
+/**
+ * @brief Engine for asynchronous seal/unseal requests (see kmyth_async_t in
+ *        kmyth.h)
+ */
+struct kmyth_async_s
+{
+  /** @brief pool the workers check contexts out of */
+  kmyth_ctx_pool_t *pool;
+
+  /** @brief worker threads, and the number started */
+  pthread_t workers[KMYTH_ASYNC_MAX_WORKERS];
+  size_t worker_count;
+
+  /** @brief eventfd signalled as requests complete */
+  int event_fd;
+
+  /** @brief requests waiting for a worker, oldest first */
+  kmyth_async_req_t *queue_head;
+  kmyth_async_req_t *queue_tail;
+
+  /** @brief requests whose callbacks are yet to run, oldest first */
+  kmyth_async_req_t *done_head;
+  kmyth_async_req_t *done_tail;
+
+  /** @brief requests submitted whose callbacks have not run yet */
+  size_t in_flight;
+
+  /** @brief set when the engine is being destroyed: the workers stop once
+   *         the queue is empty */
+  bool stopping;
+
+  /** @brief guards the queues and counts, and (with queued) lets an idle
+   *         worker wait for a request */
+  pthread_mutex_t lock;
+  pthread_cond_t queued;
+};
+
+#endif /* KMYTH_ASYNC_H */
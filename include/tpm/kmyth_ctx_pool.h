@@ -0,0 +1,48 @@
+/**
+ * @file  kmyth_ctx_pool.h
+ *
+ * @brief Provides the internals of the checkout pool of Kmyth contexts,
+ *        which lets several threads use one TPM at once, each with a
+ *        context of its own. The pool functions themselves are declared in
+ *        kmyth.h, and implemented in src/tpm/kmyth_ctx_pool.c
+ */
+
+#ifndef KMYTH_CTX_POOL_H
+#define KMYTH_CTX_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "kmyth.h"
+
+/**
+ * @brief Checkout pool of Kmyth contexts (see kmyth_ctx_pool_t in kmyth.h)
+ */
+struct kmyth_ctx_pool_s
+{
+  /** @brief TCTI configuration the contexts connect with (NULL for the
+   *         configured, or default, TCTI) */
+  char *tcti_conf;
+
+  /** @brief optional set up run on each context as it is created */
+  kmyth_ctx_pool_init_fn init;
+  void *init_arg;
+
+  /** @brief most contexts the pool may create */
+  size_t max_ctxs;
+
+  /** @brief contexts created, and not yet discarded (idle or checked out) */
+  size_t created;
+
+  /** @brief contexts waiting to be checked out, most recently used last */
+  kmyth_ctx_t *idle[KMYTH_CTX_POOL_MAX];
+  size_t idle_len;
+
+  /** @brief guards the pool state, and (with available) lets a checkout
+   *         wait for a context to be returned */
+  pthread_mutex_t lock;
+  pthread_cond_t available;
+};
+
+#endif /* KMYTH_CTX_POOL_H */
@@ -0,0 +1,190 @@
+/**
+ * @file  kmyth_keyring.h
+ *
+ * @brief Provides the internals of the sealed keyring, which holds many
+ *        named keys under one sealed wrapping key. The keyring functions
+ *        themselves are declared in kmyth.h, and implemented in
+ *        src/tpm/kmyth_keyring.c (packing and lookup) and
+ *        src/tpm/kmyth_seal_unseal_impl.c (sealing and opening).
+ *
+ * A keyring .ski is an ordinary .ski whose encrypted data is a keyring
+ * container:
+ *
+ * <pre>
+ *   header:  magic (KMYTH_KEYRING_MAGIC), then (big-endian) a four byte
+ *            format version, a four byte entry count and a four byte
+ *            encrypted index size
+ *   index:   AES/GCM encrypted (IV||ciphertext||tag), with the header as
+ *            additional authenticated data; for each entry, sorted by
+ *            name: a two byte name length, the name, an eight byte offset
+ *            (of the entry's value within the values) and a four byte value
+ *            length
+ *   values:  each AES/GCM encrypted on its own, with the entry's name as
+ *            additional authenticated data, so values cannot be swapped
+ *            between entries
+ * </pre>
+ *
+ * Opening a keyring decrypts only the index, and each value is decrypted
+ * only when it is looked up. As a value does not depend on its position,
+ * updating a keyring encrypts only the new values (and the index), copying
+ * the others as they are.
+ */
+
+#ifndef KMYTH_KEYRING_H
+#define KMYTH_KEYRING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kmyth.h"
+
+/**
+ * @brief Magic bytes at the start of a keyring container
+ */
+#define KMYTH_KEYRING_MAGIC "KMYTHKRG"
+
+/**
+ * @brief Length, in bytes, of KMYTH_KEYRING_MAGIC
+ */
+#define KMYTH_KEYRING_MAGIC_LEN 8
+
+/**
+ * @brief Version number of the keyring container format
+ */
+#define KMYTH_KEYRING_VERSION 1
+
+/**
+ * @brief Size, in bytes, of the keyring container header
+ */
+#define KMYTH_KEYRING_HEADER_SIZE (KMYTH_KEYRING_MAGIC_LEN + 12)
+
+/**
+ * @brief Maximum length, in bytes, of a keyring entry name
+ */
+#define KMYTH_KEYRING_MAX_NAME_LEN 255
+
+/**
+ * @brief Opened keyring (see kmyth_keyring_t in kmyth.h)
+ */
+struct kmyth_keyring_s
+{
+  /** @brief number of entries */
+  size_t count;
+
+  /** @brief entry names (NUL terminated), in sorted order */
+  char **names;
+
+  /** @brief offset of each entry's encrypted value within values */
+  size_t *offsets;
+
+  /** @brief (plaintext) length of each entry's value */
+  size_t *value_lens;
+
+  /** @brief the unsealed wrapping key */
+  uint8_t *key;
+  size_t key_len;
+
+  /** @brief the keyring container (the .ski's encrypted data) */
+  uint8_t *data;
+  size_t data_size;
+
+  /** @brief the encrypted values, within data */
+  uint8_t *values;
+  size_t values_size;
+};
+
+/**
+ * @brief Checks whether (.ski encrypted) data is a keyring container.
+ *
+ * @param[in]  data              The encrypted data
+ *
+ * @param[in]  data_size         The size, in bytes, of data
+ *
+ * @return true if data starts with the keyring magic bytes
+ */
+bool is_keyring_data(uint8_t * data, size_t data_size);
+
+/**
+ * @brief Packs (and encrypts) named values into a keyring container.
+ *
+ * @param[in]  key               The wrapping key (AES/GCM, so 16, 24 or 32
+ *                               bytes)
+ *
+ * @param[in]  key_len           The length, in bytes, of key
+ *
+ * @param[in]  count             The number of entries
+ *
+ * @param[in]  names             The entry names, which must be unique,
+ *                               non-empty and at most
+ *                               KMYTH_KEYRING_MAX_NAME_LEN bytes long
+ *
+ * @param[in]  values            The entry values
+ *
+ * @param[in]  value_lens        The lengths, in bytes, of the (non-empty)
+ *                               values
+ *
+ * @param[out] data              The keyring container (allocated here, to
+ *                               be freed by the caller)
+ *
+ * @param[out] data_size         The size, in bytes, of data
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_keyring_pack(uint8_t * key, size_t key_len, size_t count,
+                       const char **names, uint8_t ** values,
+                       size_t *value_lens,
+                       uint8_t ** data, size_t *data_size);
+
+/**
+ * @brief Opens a keyring container, decrypting (and checking) its index.
+ *
+ * @param[in]  key               The wrapping key (copied into the keyring)
+ *
+ * @param[in]  key_len           The length, in bytes, of key
+ *
+ * @param[in]  data              The keyring container - on success, the
+ *                               keyring takes ownership of it
+ *
+ * @param[in]  data_size         The size, in bytes, of data
+ *
+ * @param[out] keyring           The opened keyring - passed as pointer to a
+ *                               keyring pointer
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_keyring_load(uint8_t * key, size_t key_len,
+                       uint8_t * data, size_t data_size,
+                       kmyth_keyring_t ** keyring);
+
+/**
+ * @brief Builds an updated copy of an opened keyring container, adding
+ *        (or replacing) entries. Only the new values and the index are
+ *        encrypted - the other entries are copied as they are.
+ *
+ * @param[in]  keyring           The opened keyring (unchanged)
+ *
+ * @param[in]  count             The number of entries to add or replace
+ *
+ * @param[in]  names             The entry names (as for kmyth_keyring_pack())
+ *                               - an entry with the name of an existing one
+ *                               replaces it
+ *
+ * @param[in]  values            The entry values
+ *
+ * @param[in]  value_lens        The lengths, in bytes, of the (non-empty)
+ *                               values
+ *
+ * @param[out] data              The updated keyring container (allocated
+ *                               here, to be freed by the caller)
+ *
+ * @param[out] data_size         The size, in bytes, of data
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_keyring_update(kmyth_keyring_t * keyring, size_t count,
+                         const char **names, uint8_t ** values,
+                         size_t *value_lens,
+                         uint8_t ** data, size_t *data_size);
+
+#endif /* KMYTH_KEYRING_H */
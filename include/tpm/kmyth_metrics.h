@@ -0,0 +1,98 @@
+/**
+ * @file  kmyth_metrics.h
+ *
+ * @brief Provides the recording side of the library-wide metrics, whose
+ *        snapshot and export functions are declared in kmyth.h.
+ *
+ * Every count is a relaxed atomic, so recording never takes a lock. An
+ * operation is counted by bracketing it with kmyth_metrics_op_begin() and
+ * kmyth_metrics_op_end(); operations nested within another (on the same
+ * thread) are part of the outer one and are not counted again. The reason
+ * an operation failed is the last one noted (with
+ * kmyth_metrics_note_failure(), or from a TPM error response) by its
+ * thread while it ran.
+ */
+
+#ifndef KMYTH_METRICS_H
+#define KMYTH_METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kmyth.h"
+
+/**
+ * @brief Starts counting an operation.
+ *
+ * @return The operation's start time (to pass to kmyth_metrics_op_end())
+ */
+uint64_t kmyth_metrics_op_begin(void);
+
+/**
+ * @brief Counts an operation started with kmyth_metrics_op_begin() (unless
+ *        it was nested within another).
+ *
+ * @param[in]  op                The operation
+ *
+ * @param[in]  start_ns          Start time returned by kmyth_metrics_op_begin()
+ *
+ * @param[in]  retval            Result of the operation (non-zero counts it
+ *                               as a failure)
+ *
+ * @return None
+ */
+void kmyth_metrics_op_end(kmyth_op_t op, uint64_t start_ns, int retval);
+
+/**
+ * @brief Notes why the calling thread's current operation is failing.
+ *
+ * @param[in]  reason            The reason
+ *
+ * @return None
+ */
+void kmyth_metrics_note_failure(kmyth_failure_t reason);
+
+/**
+ * @brief Counts a completed TPM command, noting an error response as a
+ *        failure (see kmyth_metrics_note_failure()).
+ *
+ * @param[in]  tpm_rc            Response code of the command
+ *
+ * @return None
+ */
+void kmyth_metrics_count_tpm_response(uint32_t tpm_rc);
+
+/**
+ * @brief Counts a TPM command retried because the TPM was busy.
+ *
+ * @return None
+ */
+void kmyth_metrics_count_tpm_retry(void);
+
+/**
+ * @brief Counts a cache lookup.
+ *
+ * @param[in]  cache             The cache looked in
+ *
+ * @param[in]  hit               Whether the lookup was answered
+ *
+ * @return None
+ */
+void kmyth_metrics_count_cache(kmyth_cache_t cache, bool hit);
+
+/**
+ * @brief Counts data encrypted or decrypted with a cipher.
+ *
+ * @param[in]  cipher_name       Name of the cipher (from cipher_list[])
+ *
+ * @param[in]  encrypt           true for encrypted data, false for decrypted
+ *
+ * @param[in]  bytes             Size, in bytes, of the (plaintext) data
+ *
+ * @return None
+ */
+void kmyth_metrics_count_cipher_bytes(const char *cipher_name, bool encrypt,
+                                      size_t bytes);
+
+#endif /* KMYTH_METRICS_H */
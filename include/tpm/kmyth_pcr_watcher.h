@@ -0,0 +1,87 @@
+/**
+ * @file  kmyth_pcr_watcher.h
+ *
+ * @brief Provides the internals of the PCR change watcher, which notices
+ *        PCR extends (and TPM resets and restarts) without reading any PCR
+ *        values. The watcher functions themselves are declared in kmyth.h,
+ *        and implemented in src/tpm/kmyth_pcr_watcher.c
+ */
+
+#ifndef KMYTH_PCR_WATCHER_H
+#define KMYTH_PCR_WATCHER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tss2/tss2_sys.h>
+
+#include "kmyth.h"
+#include "kmyth_unseal_cache.h"
+
+/**
+ * @brief A registered change callback
+ */
+typedef struct
+{
+  kmyth_pcr_change_callback_t callback;
+  void *arg;
+} kmyth_pcr_watcher_callback;
+
+/**
+ * @brief PCR change watcher (see kmyth_pcr_watcher_t in kmyth.h)
+ */
+struct kmyth_pcr_watcher_s
+{
+  /** @brief the watcher's own connection to the watched TPM */
+  TSS2_SYS_CONTEXT *sapi_ctx;
+
+  /** @brief time, in milliseconds, between checks while running */
+  unsigned int interval_ms;
+
+  /** @brief registered callbacks, run in registration order */
+  kmyth_pcr_watcher_callback callbacks[KMYTH_PCR_WATCHER_MAX_CALLBACKS];
+  size_t callbacks_len;
+
+  /** @brief measurement count file (e.g., IMA's), or NULL to use none */
+  char *count_path;
+
+  /** @brief with a count file, the TPM is still checked every tpm_every
+   *         intervals (0 for never) */
+  unsigned int tpm_every;
+
+  /** @brief intervals since the TPM was last checked */
+  unsigned int skipped;
+
+  /** @brief last measurement count read from count_path */
+  uint64_t last_count;
+
+  /** @brief the TPM counts as of the last check, once known */
+  kmyth_unseal_cache_epoch last_epoch;
+  bool have_epoch;
+
+  /** @brief guards the callbacks and the check state, and (with wake)
+   *         lets kmyth_pcr_watcher_stop() interrupt the thread's wait */
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+
+  /** @brief background thread (see kmyth_pcr_watcher_start()) */
+  pthread_t thread;
+  bool running;
+  bool stopping;
+};
+
+/**
+ * @brief Reads a measurement count file (a decimal count, as in IMA's
+ *        runtime_measurements_count).
+ *
+ * @param[in]  path              Path of the count file
+ *
+ * @param[out] count             The count
+ *
+ * @return 0 on success, 1 on error
+ */
+int read_measurement_count(const char *path, uint64_t * count);
+
+#endif /* KMYTH_PCR_WATCHER_H */
@@ -0,0 +1,48 @@
+/**
+ * @file  kmyth_pool.h
+ *
+ * @brief Provides the internals of the Kmyth context pool, which spreads
+ *        seal/unseal work over several TPM connections. The pool functions
+ *        themselves are declared in kmyth.h, and implemented in
+ *        src/tpm/kmyth_pool.c
+ */
+
+#ifndef KMYTH_POOL_H
+#define KMYTH_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tss2/tss2_sys.h>
+
+#include "kmyth.h"
+
+/**
+ * @brief Kmyth context pool (see kmyth_pool_t in kmyth.h)
+ */
+struct kmyth_pool_s
+{
+  /** @brief number of devices (contexts) in the pool */
+  size_t count;
+
+  /** @brief context connected to each device */
+  kmyth_ctx_t *ctxs[KMYTH_POOL_MAX];
+
+  /** @brief serializes the requests run on each device's context */
+  pthread_mutex_t ctx_locks[KMYTH_POOL_MAX];
+
+  /** @brief guards the scheduling state (load, served and srk_names) */
+  pthread_mutex_t lock;
+
+  /** @brief number of requests queued or in progress on each device */
+  size_t load[KMYTH_POOL_MAX];
+
+  /** @brief number of requests completed on each device */
+  uint64_t served[KMYTH_POOL_MAX];
+
+  /** @brief SRK name of each device, size 0 until looked up */
+  TPM2B_NAME srk_names[KMYTH_POOL_MAX];
+};
+
+#endif /* KMYTH_POOL_H */
@@ -10,11 +10,130 @@
 #ifndef KMYTH_SEAL_UNSEAL_IMPL_H
 #define KMYTH_SEAL_UNSEAL_IMPL_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include <tss2/tss2_sys.h>
 
+#include "kmyth.h"
+#include "tpm2_interface.h"
+#include "cipher/compression.h"
+
+/**
+ * @brief Storage key kept in a context's storage key pool (see
+ *        kmyth_ctx_set_sk_pool() in kmyth.h), along with the parameters
+ *        it was created for. It is only reused for seals with exactly
+ *        the same parameters.
+ */
+typedef struct kmyth_pooled_sk_s
+{
+  /** @brief parent (SRK) handle the storage key was created under */
+  TPM2_HANDLE srk_handle;
+
+  /** @brief public key algorithm of the storage key */
+  TPMI_ALG_PUBLIC sk_alg;
+
+  /** @brief authorization value of the storage key */
+  TPM2B_AUTH authVal;
+
+  /** @brief authorization policy digest of the storage key */
+  TPM2B_DIGEST authPolicy;
+
+  /** @brief storage key private area, as returned by Tss2_Sys_Create() */
+  TPM2B_PRIVATE sk_priv;
+
+  /** @brief storage key public area, as returned by Tss2_Sys_Create() */
+  TPM2B_PUBLIC sk_pub;
+} kmyth_pooled_sk_t;
+
+/**
+ * @brief Kmyth TPM 2.0 context (see kmyth_ctx_t in kmyth.h)
+ */
+struct kmyth_ctx_s
+{
+  /** @brief SAPI context for the connection to the TPM 2.0 resource manager */
+  TSS2_SYS_CONTEXT *sapi_ctx;
+
+  /** @brief resolved storage root key (SRK) handle, 0 until looked up */
+  TPM2_HANDLE srk_handle;
+
+  /** @brief name of the SRK (identifies the TPM), size 0 until looked up */
+  TPM2B_NAME srk_name;
+
+  /** @brief record the SRK name in sealed .ski output */
+  bool record_srk_name;
+
+  /** @brief check the PCRs against the policy before unsealing */
+  bool policy_precheck;
+
+  /** @brief .ski format written when sealing (KMYTH_SKI_FORMAT_*) */
+  int ski_format;
+
+  /** @brief public key algorithm of storage keys created when sealing */
+  TPMI_ALG_PUBLIC sk_alg;
+
+  /** @brief number of workers for batch and chunked host-side work */
+  size_t jobs;
+
+  /** @brief chunk size of file seals (0 for unchunked output) */
+  size_t chunk_size;
+
+  /** @brief compression applied to (large enough) data before sealing */
+  kmyth_compression_t compression;
+
+  /** @brief pooled storage keys, least recently used first */
+  kmyth_pooled_sk_t sk_pool[KMYTH_SK_POOL_MAX];
+
+  /** @brief number of storage keys the pool may hold (0 disables it) */
+  size_t sk_pool_size;
+
+  /** @brief number of storage keys currently in the pool */
+  size_t sk_pool_count;
+
+  /** @brief handle seal makes storage keys persistent at (0 if not) */
+  TPM2_HANDLE persistent_sk_handle;
+
+  /** @brief persistent storage key handle last used by unseal, or 0 */
+  TPM2_HANDLE persistent_sk_hint;
+
+  /** @brief largest NV index the TPM supports, 0 until looked up */
+  uint32_t nv_index_max;
+
+  /** @brief largest single NV read or write, 0 until looked up */
+  uint32_t nv_buffer_max;
+
+  /** @brief timings recorded into (see kmyth_ctx_set_timings()), or NULL */
+  kmyth_timings_t *timings;
+
+  /** @brief time taken to connect, not yet added to any timings */
+  uint64_t connect_ns;
+
+  /** @brief deadline the connection is held to (see
+   *         kmyth_ctx_set_deadline() and kmyth_ctx_cancel()) */
+  CALL_DEADLINE deadline;
+};
+
+/**
+ * @brief Gets the name of the storage root key (SRK) of the TPM a context
+ *        is connected to, looking up the SRK (as for a seal or unseal)
+ *        if the context has not already done so.
+ *
+ * @param[in]  ctx               Kmyth context created by kmyth_ctx_create()
+ *
+ * @param[in]  owner_auth_bytes  Owner (storage hierarchy) authorization,
+ *                               needed only if the SRK must be re-derived
+ *
+ * @param[in]  oa_bytes_len      Length of owner_auth_bytes
+ *
+ * @param[out] srk_name          Name of the SRK
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_ctx_get_srk_name(kmyth_ctx_t * ctx,
+                           uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                           TPM2B_NAME * srk_name);
+
 /**
  * @brief Seal data using TPM 2.0.
  *
@@ -79,6 +198,76 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
                          TPM2B_DIGEST sdo_policyBranch2,
                          TPM2B_PUBLIC * sdo_public,
                          TPM2B_PRIVATE * sdo_private);
+
+/**
+ * @brief Seal data using TPM 2.0, optionally reusing a caller-supplied
+ *        policy session.
+ *
+ * Same as tpm2_kmyth_seal_data(), except that if sealData_session is not
+ * NULL the policy is applied to that (already started) policy session and
+ * the session is left open afterwards, so that it can be reused to seal
+ * further data under the same storage key. If sealData_session is NULL, a
+ * policy session is started and flushed internally.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context, must be initialized
+ *                               and passed in as pointer to the SAPI context
+ *
+ * @param[in]  sealData_session  Policy session to reuse, or NULL
+ *
+ * @param[in/out] host_work      Host-side work to run while the TPM creates
+ *                               the sealed data object (see
+ *                               execute_tpm2_async()), or NULL
+ *
+ * All other parameters are as described for tpm2_kmyth_seal_data().
+ *
+ * @return 0 on success, 1 on error
+ */
+int tpm2_kmyth_seal_data_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                                 SESSION * sealData_session,
+                                 uint8_t * sdo_data,
+                                 size_t sdo_dataSize,
+                                 TPM2_HANDLE sk_handle,
+                                 TPM2B_AUTH sk_authVal,
+                                 TPML_PCR_SELECTION sk_pcrList,
+                                 TPM2B_AUTH sdo_authVal,
+                                 TPML_PCR_SELECTION sdo_pcrList,
+                                 TPM2B_DIGEST sdo_authPolicy,
+                                 TPM2B_DIGEST sdo_policyBranch1,
+                                 TPM2B_DIGEST sdo_policyBranch2,
+                                 TPM2B_PUBLIC * sdo_public,
+                                 TPM2B_PRIVATE * sdo_private,
+                                 HOST_WORK * host_work);
+
+/**
+ * @brief Seal data using TPM 2.0, with the TPM2B/TPML inputs passed by
+ *        reference.
+ *
+ * Same as tpm2_kmyth_seal_data_session(), but none of the (several
+ * hundred byte) authorization, PCR selection or policy structures are
+ * copied onto the stack for the call. The batch sealing paths use this
+ * directly; the by-value functions above are wrappers around it.
+ *
+ * All parameters are as described for tpm2_kmyth_seal_data_session(), and
+ * none of the structures passed as const pointers are modified.
+ *
+ * @return 0 on success, 1 on error
+ */
+int tpm2_kmyth_seal_data_ref(TSS2_SYS_CONTEXT * sapi_ctx,
+                             SESSION * sealData_session,
+                             uint8_t * sdo_data,
+                             size_t sdo_dataSize,
+                             TPM2_HANDLE sk_handle,
+                             const TPM2B_AUTH * sk_authVal,
+                             const TPML_PCR_SELECTION * sk_pcrList,
+                             const TPM2B_AUTH * sdo_authVal,
+                             const TPML_PCR_SELECTION * sdo_pcrList,
+                             const TPM2B_DIGEST * sdo_authPolicy,
+                             const TPM2B_DIGEST * sdo_policyBranch1,
+                             const TPM2B_DIGEST * sdo_policyBranch2,
+                             TPM2B_PUBLIC * sdo_public,
+                             TPM2B_PRIVATE * sdo_private,
+                             HOST_WORK * host_work);
+
 /**
  * @brief Unseal data using TPM 2.0.
  *
@@ -118,7 +307,9 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
  * @param[in]  policyBranch2  2 of 2 optional policy branch arguments
  *                            needed for compound policy calculations
  *
- * @param[out] result         The kmyth-unsealed result
+ * @param[out] result         The kmyth-unsealed result, allocated from the
+ *                            secure heap (to be released with
+ *                            kmyth_secure_free())
  *                            (passed as pointer to byte buffer)
  *
  * @param[out] result_size    The size of the kmyth-unsealed (unencrypted)
@@ -137,4 +328,57 @@ int tpm2_kmyth_unseal_data(TSS2_SYS_CONTEXT * sapi_ctx,
                            TPM2B_DIGEST policyBranch2,
                            uint8_t ** result, size_t *result_size);
 
+/**
+ * @brief Unseal data using TPM 2.0, overlapping host-side work with the
+ *        TPM commands.
+ *
+ * Same as tpm2_kmyth_unseal_data(), except that the host work passed in
+ * is run while the TPM processes the first command that is successfully
+ * issued (see execute_tpm2_async()). Callers should use finish_host_work()
+ * to run the work if it was not consumed (e.g., on an early error).
+ *
+ * @param[in/out] host_work   Host-side work to overlap with the TPM
+ *                            commands, or NULL
+ *
+ * All other parameters are as described for tpm2_kmyth_unseal_data().
+ *
+ * @return 0 on success, 1 on error
+ */
+int tpm2_kmyth_unseal_data_overlap(TSS2_SYS_CONTEXT * sapi_ctx,
+                                   TPM2_HANDLE sk_handle,
+                                   TPM2B_PUBLIC sdo_public,
+                                   TPM2B_PRIVATE sdo_private,
+                                   TPM2B_AUTH authVal,
+                                   TPML_PCR_SELECTION pcrList,
+                                   TPM2B_DIGEST authPolicy,
+                                   TPM2B_DIGEST policyBranch1,
+                                   TPM2B_DIGEST policyBranch2,
+                                   uint8_t ** result, size_t *result_size,
+                                   HOST_WORK * host_work);
+
+/**
+ * @brief Unseal data using TPM 2.0, with the TPM2B/TPML inputs passed by
+ *        reference.
+ *
+ * Same as tpm2_kmyth_unseal_data_overlap(), without copying the sealed
+ * data object or the authorization and policy structures for the call.
+ * The sealed data object's public and private areas are passed as
+ * (non-const) pointers, as for load_kmyth_object(), but are not modified.
+ *
+ * All parameters are as described for tpm2_kmyth_unseal_data_overlap().
+ *
+ * @return 0 on success, 1 on error
+ */
+int tpm2_kmyth_unseal_data_ref(TSS2_SYS_CONTEXT * sapi_ctx,
+                               TPM2_HANDLE sk_handle,
+                               TPM2B_PUBLIC * sdo_public,
+                               TPM2B_PRIVATE * sdo_private,
+                               const TPM2B_AUTH * authVal,
+                               const TPML_PCR_SELECTION * pcrList,
+                               const TPM2B_DIGEST * authPolicy,
+                               const TPM2B_DIGEST * policyBranch1,
+                               const TPM2B_DIGEST * policyBranch2,
+                               uint8_t ** result, size_t *result_size,
+                               HOST_WORK * host_work);
+
 #endif /* KMYTH_SEAL_UNSEAL_IMPL_H */
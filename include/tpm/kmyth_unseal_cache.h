@@ -0,0 +1,157 @@
+/**
+ * @file  kmyth_unseal_cache.h
+ *
+ * @brief Provides the internals of the (opt-in, process-wide) unseal
+ *        cache used by tpm2_kmyth_unseal(). The cache is enabled with
+ *        kmyth_set_unseal_cache(), declared in kmyth.h.
+ *
+ * Entries are keyed by a hash of the .ski bytes together with the
+ * authorization values (and policy-OR flag) they were unsealed with, so a
+ * caller presenting different authorization does not hit another caller's
+ * entry. The plaintext is held in locked, wiped-on-release memory.
+ *
+ * The TPM's PCR update counter (from a PCR_Read) and its reset and restart
+ * counts (from a ReadClock) are read before every lookup. The entries are
+ * only good for the counts they were unsealed under: once any PCR is
+ * extended (or the TPM is reset or restarted) all of them are dropped, so
+ * the next unseal goes back to the TPM and its policy check.
+ */
+
+#ifndef KMYTH_UNSEAL_CACHE_H
+#define KMYTH_UNSEAL_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tss2/tss2_sys.h>
+
+/**
+ * @brief Maximum number of entries the unseal cache can be set to hold
+ */
+#define KMYTH_UNSEAL_CACHE_MAX 64
+
+/**
+ * @brief Size, in bytes, of an unseal cache key (a SHA-256 digest)
+ */
+#define KMYTH_UNSEAL_CACHE_KEY_LEN 32
+
+/**
+ * @brief The TPM state an unsealed result is good for: the PCR update
+ *        counter, and the TPM reset and restart counts
+ */
+typedef struct
+{
+  uint32_t pcr_update_counter;
+  uint32_t reset_count;
+  uint32_t restart_count;
+} kmyth_unseal_cache_epoch;
+
+/**
+ * @brief Reports whether the unseal cache is enabled.
+ *
+ * @return true if enabled, false otherwise
+ */
+bool kmyth_unseal_cache_enabled(void);
+
+/**
+ * @brief Reads the TPM's PCR update counter and reset and restart counts.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context for the TPM
+ *
+ * @param[out] epoch             The TPM's current counts
+ *
+ * @return 0 on success, 1 on error
+ */
+int get_unseal_cache_epoch(TSS2_SYS_CONTEXT * sapi_ctx,
+                           kmyth_unseal_cache_epoch * epoch);
+
+/**
+ * @brief Computes the cache key of an unseal request.
+ *
+ * @param[in]  input             .ski bytes
+ *
+ * @param[in]  input_len         Length, in bytes, of input
+ *
+ * @param[in]  auth_bytes        Object authorization (may be NULL)
+ *
+ * @param[in]  auth_bytes_len    Length, in bytes, of auth_bytes
+ *
+ * @param[in]  owner_auth_bytes  Owner (storage hierarchy) authorization
+ *                               (may be NULL)
+ *
+ * @param[in]  oa_bytes_len      Length, in bytes, of owner_auth_bytes
+ *
+ * @param[in]  bool_policy_or    Policy-OR flag of the request
+ *
+ * @param[out] key               The cache key
+ *                               (KMYTH_UNSEAL_CACHE_KEY_LEN bytes)
+ *
+ * @return 0 on success, 1 on error
+ */
+int get_unseal_cache_key(const uint8_t * input, size_t input_len,
+                         const uint8_t * auth_bytes, size_t auth_bytes_len,
+                         const uint8_t * owner_auth_bytes,
+                         size_t oa_bytes_len, uint8_t bool_policy_or,
+                         uint8_t * key);
+
+/**
+ * @brief Looks up an unsealed result. If the TPM's counts have changed
+ *        since the cached results were unsealed, they are all dropped
+ *        first.
+ *
+ * @param[in]  key               The request's cache key
+ *
+ * @param[in]  epoch             The TPM's current counts
+ *
+ * @param[out] output            A copy of the cached plaintext (allocated,
+ *                               to be freed by the caller), on a hit
+ *
+ * @param[out] output_len        Length, in bytes, of output
+ *
+ * @return 0 on a hit, 1 on a miss (or error)
+ */
+int kmyth_unseal_cache_lookup(const uint8_t * key,
+                              const kmyth_unseal_cache_epoch * epoch,
+                              uint8_t ** output, size_t *output_len);
+
+/**
+ * @brief Caches an unsealed result, evicting the least recently used
+ *        entry if the cache is full. Nothing is cached if the cache is
+ *        disabled, or if the TPM's counts no longer match the cache's.
+ *
+ * @param[in]  key               The request's cache key
+ *
+ * @param[in]  epoch             The TPM's counts, read before unsealing
+ *
+ * @param[in]  data              The plaintext
+ *
+ * @param[in]  data_len          Length, in bytes, of data
+ *
+ * @return None
+ */
+void kmyth_unseal_cache_insert(const uint8_t * key,
+                               const kmyth_unseal_cache_epoch * epoch,
+                               const uint8_t * data, size_t data_len);
+
+/**
+ * @brief Drops every cached result, e.g. once a PCR watcher has seen the
+ *        TPM's counts change.
+ *
+ * @return None
+ */
+void kmyth_unseal_cache_flush(void);
+
+/**
+ * @brief Gets the numbers of cache hits and misses since the cache was
+ *        last enabled.
+ *
+ * @param[out] hits              Number of lookups answered from the cache
+ *
+ * @param[out] misses            Number of lookups that were not
+ *
+ * @return None
+ */
+void kmyth_unseal_cache_counts(uint64_t * hits, uint64_t * misses);
+
+#endif /* KMYTH_UNSEAL_CACHE_H */
@@ -8,6 +8,7 @@
 #ifndef MARSHALLING_TOOLS_H
 #define MARSHALLING_TOOLS_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -16,6 +17,7 @@
 #include "formatting_tools.h"
 
 #include "cipher/cipher.h"
+#include "cipher/compression.h"
 
 typedef struct Ski_s
 {
@@ -32,6 +34,10 @@ typedef struct Ski_s
   //The cipher used to encrypt the data
   cipher_t cipher;
 
+  //The compression applied to the data before it was encrypted (recorded
+  //as a tag on the cipher suite block)
+  kmyth_compression_t compression;
+
   //Wrapping key pub/priv TPM2 components
   TPM2B_PUBLIC wk_pub;
   TPM2B_PRIVATE wk_priv;
@@ -40,13 +46,59 @@ typedef struct Ski_s
   uint8_t *enc_data;
   size_t enc_data_size;
 
+  //Chunk index: when chunk_size is non-zero the encrypted data holds
+  //chunked_data_len bytes of plaintext, split into separately encrypted
+  //chunks of (at most) chunk_size bytes each
+  size_t chunk_size;
+  size_t chunked_data_len;
+
+  //Name of the storage root key the storage key was created under, which
+  //identifies the TPM that can unseal the data (size 0 if not recorded)
+  TPM2B_NAME srk_name;
+
 } Ski;
 
+/**
+ * @brief Version number of the chunk index (chunked .ski) format
+ */
+#define KMYTH_CHUNK_INDEX_VERSION 1
+
+/**
+ * @brief Size, in bytes, of a packed chunk index (see pack_ski_chunk_index())
+ */
+#define KMYTH_CHUNK_INDEX_SIZE 16
+
+/**
+ * @brief Magic bytes at the start of a binary .ski file. They are followed
+ *        by a one byte format version and then a sequence of records, each
+ *        a one byte tag, a four byte (big-endian) length, and the raw
+ *        (e.g., Tss2_MU marshalled) block contents.
+ */
+#define KMYTH_SKI_BINARY_MAGIC "KSKI"
+
+/**
+ * @brief Size, in bytes, of the binary .ski magic
+ */
+#define KMYTH_SKI_BINARY_MAGIC_SIZE 4
+
+/**
+ * @brief Version number of the binary .ski format
+ */
+#define KMYTH_SKI_BINARY_VERSION 1
+
+/**
+ * @brief Size, in bytes, of a binary .ski record header (tag and length)
+ */
+#define KMYTH_SKI_BINARY_RECORD_HEADER_SIZE 5
+
 /**
  * @brief Parses a .ski formatted byte array into a ski struct. 
  *        The output is only modified on success, otherwise the 
  *        pointer is untouched
  *
+ * Both the text and the binary (see create_ski_binary_bytes()) .ski
+ * formats are accepted - the format is detected from the input.
+ *
  * @param[in]  input          The bytes in .ski format
  *
  * @param[in]  input_length   The number of bytes
@@ -58,6 +110,164 @@ typedef struct Ski_s
 int parse_ski_bytes(uint8_t * input, size_t input_length, Ski * output,
                     uint8_t bool_policy_or);
 
+/**
+ * @brief Gets the storage root key (SRK) name recorded in a .ski formatted
+ *        byte array (text or binary), without parsing the rest of it.
+ *
+ * @param[in]  input          The bytes in .ski format
+ *
+ * @param[in]  input_length   The number of bytes
+ *
+ * @param[out] srk_name       The recorded SRK name, or size 0 if none is
+ *                            recorded
+ *
+ * @return 0 on success (whether or not a name is recorded), 1 if the
+ *         recorded name is malformed
+ */
+int get_ski_srk_name(uint8_t * input, size_t input_length,
+                     TPM2B_NAME * srk_name);
+
+/**
+ * @brief Checks whether a byte array is in the binary .ski format (i.e.,
+ *        starts with KMYTH_SKI_BINARY_MAGIC).
+ *
+ * @param[in]  input          The bytes to check
+ *
+ * @param[in]  input_length   The number of bytes
+ *
+ * @return true if the input is a binary .ski, false otherwise
+ */
+bool is_binary_ski_bytes(uint8_t * input, size_t input_length);
+
+/**
+ * @brief Parses a binary .ski formatted byte array into a ski struct. The
+ *        output is only modified on success, otherwise the pointer is
+ *        untouched.
+ *
+ * The records must appear in file order, each at most once. The policy
+ * branch records must both be present or both absent, and only the chunk
+ * index and storage root key name records are otherwise optional.
+ *
+ * @param[in]  input          The bytes in binary .ski format
+ *
+ * @param[in]  input_length   The number of bytes
+ *
+ * @param[out] output         The new ski struct
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_ski_binary_bytes(uint8_t * input, size_t input_length,
+                           Ski * output);
+
+/**
+ * @brief Parses the leading (header) part of a .ski formatted byte array,
+ *        everything but the encrypted data, into a ski struct. The output
+ *        is only modified on success, otherwise the pointer is untouched.
+ *
+ * This supports processing the encrypted data incrementally, without ever
+ * holding all of it in memory (see create_ski_header_bytes()).
+ *
+ * @param[in]  input          The .ski bytes up to and including the
+ *                            encrypted data delimiter (the input must end
+ *                            with KMYTH_DELIM_ENC_DATA)
+ *
+ * @param[in]  input_length   The number of bytes
+ *
+ * @param[out] output         The new ski struct (with empty enc_data)
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_ski_header_bytes(uint8_t * input, size_t input_length,
+                           Ski * output, uint8_t bool_policy_or);
+
+/**
+ * @brief Maximum size, in bytes, of a .ski header (everything before the
+ *        encrypted data) - reading this much of a .ski file is always
+ *        enough for parse_ski_metadata()
+ */
+#define KMYTH_SKI_METADATA_MAX_SIZE (64 * 1024)
+
+/**
+ * @brief Parses the metadata of a .ski formatted byte array (text or
+ *        binary) - everything but the encrypted data - into a ski struct,
+ *        without decoding (or even needing) the encrypted data. The output
+ *        is only modified on success, otherwise the pointer is untouched.
+ *
+ * Unlike parse_ski_header_bytes(), the input may be any prefix of a .ski
+ * that includes its header, such as the first KMYTH_SKI_METADATA_MAX_SIZE
+ * bytes of the file, and whether the policy branch blocks are present is
+ * detected from the input. This allows the PCR selection, cipher and
+ * policy digests of many .ski files to be inspected cheaply.
+ *
+ * @param[in]  input          The leading bytes of a .ski, up to (at least)
+ *                            the encrypted data delimiter (text) or record
+ *                            header (binary)
+ *
+ * @param[in]  input_length   The number of bytes
+ *
+ * @param[out] output         The new ski struct (with empty enc_data)
+ *
+ * @param[out] header_length  The size, in bytes, of the header (the offset
+ *                            of the encrypted data within the .ski) - may
+ *                            be NULL
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_ski_metadata(uint8_t * input, size_t input_length, Ski * output,
+                       size_t *header_length);
+
+/**
+ * @brief Parses a chunked .ski formatted byte array (one including a chunk
+ *        index block) into a ski struct, without decoding the encrypted
+ *        data. The output is only modified on success, otherwise the
+ *        pointer is untouched.
+ *
+ * Instead, the (base64 encoded) encrypted data block is passed back as a
+ * view into the input, so that individual chunks can be decoded from it on
+ * demand (see decodeBase64Range()).
+ *
+ * @param[in]  input             The bytes in .ski format
+ *
+ * @param[in]  input_length      The number of bytes
+ *
+ * @param[out] output            The new ski struct (with empty enc_data)
+ *
+ * @param[in]  bool_policy_or    Flag indicating if the policy branch
+ *                               blocks are present
+ *
+ * @param[out] enc_data64        Pointer to the start of the base64 encoded
+ *                               encrypted data (within the input)
+ *
+ * @param[out] enc_data64_size   Size, in bytes, of the base64 encoded
+ *                               encrypted data
+ *
+ * @return 0 on success, 1 on error
+ */
+int parse_chunked_ski_bytes(uint8_t * input, size_t input_length,
+                            Ski * output, uint8_t bool_policy_or,
+                            uint8_t ** enc_data64, size_t *enc_data64_size);
+
+/**
+ * @brief Packs the chunk index of a chunked .ski (format version, chunk
+ *        size, and total plaintext length, all big-endian) into
+ *        KMYTH_CHUNK_INDEX_SIZE bytes.
+ *
+ * The packed index is what is stored in the chunk index block, and is
+ * also authenticated along with each encrypted chunk.
+ *
+ * @param[in]  chunk_size        The size, in bytes, of each (but the last)
+ *                               plaintext chunk
+ *
+ * @param[in]  chunked_data_len  The total plaintext size, in bytes
+ *
+ * @param[out] output            Buffer of (at least) KMYTH_CHUNK_INDEX_SIZE
+ *                               bytes to hold the packed index
+ *
+ * @return 0 on success, 1 on error
+ */
+int pack_ski_chunk_index(size_t chunk_size, size_t chunked_data_len,
+                         uint8_t * output);
+
 /**
  * @brief Creates a byte array in .ski format from a ski struct
  *
@@ -71,6 +281,72 @@ int parse_ski_bytes(uint8_t * input, size_t input_length, Ski * output,
  */
 int create_ski_bytes(Ski input, uint8_t ** output, size_t *output_length);
 
+/**
+ * @brief Creates a byte array in .ski format from a ski struct, written to
+ *        a caller supplied buffer rather than an allocated one.
+ *
+ * The .ski size is exactly determined by the sizes of its blocks, so
+ * calling this with a NULL output (a size query) returns the size needed
+ * without writing anything. Either way, the blocks are written directly
+ * into the output in a single pass.
+ *
+ * @param[in]  input          The ski struct to be converted
+ *
+ * @param[out] output         Buffer to hold the bytes in .ski format
+ *                            (NULL to only query the size)
+ *
+ * @param[in]  output_size    The size, in bytes, of the output buffer
+ *
+ * @param[out] output_length  The number of bytes in (or needed for) the
+ *                            .ski output - set even if the buffer is too
+ *                            small
+ *
+ * @return 0 on success, 1 on error (including a buffer too small)
+ */
+int create_ski_bytes_buf(Ski input, uint8_t * output, size_t output_size,
+                         size_t *output_length);
+
+/**
+ * @brief Creates a byte array in the compact binary .ski format from a ski
+ *        struct.
+ *
+ * The blocks are those of the text format, in the same order, but stored
+ * as (tag, length, value) records holding the raw block contents instead
+ * of base64 encoded text (see KMYTH_SKI_BINARY_MAGIC). The cipher suite
+ * record holds the cipher name without a terminator.
+ *
+ * @param[in]  input          The ski struct to be converted
+ *
+ * @param[out] output         The bytes in binary .ski format
+ *
+ * @param[out] output_length  The number of bytes in output
+ *
+ * @return 0 on success, 1 on error
+ */
+int create_ski_binary_bytes(Ski input, uint8_t ** output,
+                            size_t *output_length);
+
+/**
+ * @brief Creates the leading (header) part of a .ski formatted byte array
+ *        from a ski struct: every block but the encrypted data, followed by
+ *        the encrypted data delimiter (KMYTH_DELIM_ENC_DATA).
+ *
+ * A complete .ski file is this header, followed by the base64 encoded
+ * encrypted data, followed by KMYTH_DELIM_END_FILE. The enc_data member of
+ * the input is not used. If the input has a non-zero chunk_size, the chunk
+ * index block is included ahead of the encrypted data delimiter.
+ *
+ * @param[in]  input          The ski struct to be converted
+ *
+ * @param[out] output         The .ski header bytes
+ *
+ * @param[out] output_length  The number of bytes in output
+ *
+ * @return 0 on success, 1 on error
+ */
+int create_ski_header_bytes(Ski input, uint8_t ** output,
+                            size_t *output_length);
+
 /**
  * @brief Frees the contents of a ski struct
  *
@@ -86,6 +362,16 @@ void free_ski(Ski * ski);
  */
 Ski get_default_ski(void);
 
+/**
+ * @brief Initializes a ski struct in place to the same 'empty' state as
+ *        get_default_ski(), without returning the (large) struct by value
+ *
+ * @param[out] ski            The struct to be initialized
+ *
+ * @return None
+ */
+void init_default_ski(Ski * ski);
+
 /**
  * @brief Marshals TPM2 structures that need to be written to the .ski file
  *        into byte arrays.
@@ -664,6 +950,167 @@ int unpack_digest(TPM2B_DIGEST * digest_out,
                   uint8_t * packed_data_in,
                   size_t packed_data_in_size, size_t packed_data_in_offset);
 
+/**
+ * @brief An output cursor that TPM 2.0 structures are marshalled into one
+ *        after another, so that several of them (e.g., every TPM object of
+ *        a .ski) share a single buffer.
+ *
+ * The buffer is either the caller's (which is never grown, so marshalling
+ * more than fits is an error) or, if the cursor is initialized without one,
+ * owned by the cursor and grown as needed. offset is the number of bytes
+ * marshalled so far.
+ */
+typedef struct
+{
+  uint8_t *buf;
+  size_t size;
+  size_t offset;
+  bool owned;
+} marshal_cursor;
+
+/**
+ * @brief An input view that TPM 2.0 structures are unmarshalled from one
+ *        after another. offset is the number of bytes unmarshalled so far.
+ */
+typedef struct
+{
+  uint8_t *data;
+  size_t size;
+  size_t offset;
+} unmarshal_view;
+
+/**
+ * @brief Initializes a marshal cursor, at the start of its buffer.
+ *
+ * @param[out] cursor    The cursor to initialize
+ *
+ * @param[in]  buf       The caller's buffer to marshal into, or NULL for a
+ *                       buffer owned (and grown) by the cursor
+ *
+ * @param[in]  size      Size, in bytes, of buf (ignored if buf is NULL)
+ *
+ * @return None
+ */
+void marshal_cursor_init(marshal_cursor * cursor, uint8_t * buf,
+                         size_t size);
+
+/**
+ * @brief Releases a marshal cursor's buffer (if the cursor owns it).
+ *
+ * @param[in]  cursor    The cursor to free
+ *
+ * @return None
+ */
+void marshal_cursor_free(marshal_cursor * cursor);
+
+/**
+ * @brief Marshals a PCR selection list at a cursor, advancing the cursor
+ *        past it.
+ *
+ * @param[in]  cursor         The cursor to marshal at
+ *
+ * @param[in]  pcr_select_in  The PCR selection list to marshal
+ *
+ * @return 0 if success, 1 if error (the cursor is not advanced)
+ */
+int cursor_pack_pcr(marshal_cursor * cursor,
+                    TPML_PCR_SELECTION * pcr_select_in);
+
+/**
+ * @brief Marshals a public blob at a cursor (see cursor_pack_pcr()).
+ *
+ * @param[in]  cursor         The cursor to marshal at
+ *
+ * @param[in]  public_blob_in The public blob to marshal
+ *
+ * @return 0 if success, 1 if error (the cursor is not advanced)
+ */
+int cursor_pack_public(marshal_cursor * cursor, TPM2B_PUBLIC * public_blob_in);
+
+/**
+ * @brief Marshals a private blob at a cursor (see cursor_pack_pcr()).
+ *
+ * @param[in]  cursor          The cursor to marshal at
+ *
+ * @param[in]  private_blob_in The private blob to marshal
+ *
+ * @return 0 if success, 1 if error (the cursor is not advanced)
+ */
+int cursor_pack_private(marshal_cursor * cursor,
+                        TPM2B_PRIVATE * private_blob_in);
+
+/**
+ * @brief Marshals a digest at a cursor (see cursor_pack_pcr()).
+ *
+ * @param[in]  cursor         The cursor to marshal at
+ *
+ * @param[in]  digest_in      The digest to marshal
+ *
+ * @return 0 if success, 1 if error (the cursor is not advanced)
+ */
+int cursor_pack_digest(marshal_cursor * cursor, TPM2B_DIGEST * digest_in);
+
+/**
+ * @brief Initializes an unmarshal view, at the start of its data.
+ *
+ * @param[out] view      The view to initialize
+ *
+ * @param[in]  data      The marshalled data (not copied, so it must outlive
+ *                       the view)
+ *
+ * @param[in]  size      Size, in bytes, of data
+ *
+ * @return None
+ */
+void unmarshal_view_init(unmarshal_view * view, uint8_t * data, size_t size);
+
+/**
+ * @brief Unmarshals a PCR selection list from a view, advancing the view
+ *        past it.
+ *
+ * @param[in]  view           The view to unmarshal from
+ *
+ * @param[out] pcr_select_out The unmarshalled PCR selection list
+ *
+ * @return 0 if success, 1 if error (the view is not advanced)
+ */
+int view_unpack_pcr(unmarshal_view * view,
+                    TPML_PCR_SELECTION * pcr_select_out);
+
+/**
+ * @brief Unmarshals a public blob from a view (see view_unpack_pcr()).
+ *
+ * @param[in]  view            The view to unmarshal from
+ *
+ * @param[out] public_blob_out The unmarshalled public blob
+ *
+ * @return 0 if success, 1 if error (the view is not advanced)
+ */
+int view_unpack_public(unmarshal_view * view, TPM2B_PUBLIC * public_blob_out);
+
+/**
+ * @brief Unmarshals a private blob from a view (see view_unpack_pcr()).
+ *
+ * @param[in]  view             The view to unmarshal from
+ *
+ * @param[out] private_blob_out The unmarshalled private blob
+ *
+ * @return 0 if success, 1 if error (the view is not advanced)
+ */
+int view_unpack_private(unmarshal_view * view,
+                        TPM2B_PRIVATE * private_blob_out);
+
+/**
+ * @brief Unmarshals a digest from a view (see view_unpack_pcr()).
+ *
+ * @param[in]  view           The view to unmarshal from
+ *
+ * @param[out] digest_out     The unmarshalled digest
+ *
+ * @return 0 if success, 1 if error (the view is not advanced)
+ */
+int view_unpack_digest(unmarshal_view * view, TPM2B_DIGEST * digest_out);
+
 /**
  * There are a number of fixed TPM properties (tagged properties)
  * that are returned as 32-bit integers into which up to four 8-byte
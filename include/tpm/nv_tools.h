@@ -0,0 +1,136 @@
+/**
+ * @file  nv_tools.h
+ *
+ * @brief Provides TPM 2.0 non-volatile (NV) index utility functions for
+ *        Kmyth, used to keep a (small, binary format) .ski in the TPM
+ *        itself, so that it can be unsealed without any file I/O.
+ *
+ * A Kmyth NV index is an ordinary index (KMYTH_NV_SKI_FIRST to
+ * KMYTH_NV_SKI_LAST) sized to exactly the .ski it holds. It is written
+ * with owner (storage hierarchy) authorization, and read with its own,
+ * empty, authorization value: the .ski is no more secret in NV than it is
+ * in a file, as its wrapping key is sealed to the storage key's policy.
+ */
+
+#ifndef NV_TOOLS_H
+#define NV_TOOLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tss2/tss2_sys.h>
+
+/**
+ * @brief Gets the TPM's NV size limits.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context, must be
+ *                               initialized
+ *
+ * @param[out] index_max         The largest NV index, in bytes, the TPM
+ *                               supports (TPM2_PT_NV_INDEX_MAX)
+ *
+ * @param[out] buffer_max        The most bytes a single NV_Read or NV_Write
+ *                               can transfer (TPM2_PT_NV_BUFFER_MAX)
+ *
+ * @return 0 if success, 1 if error
+ */
+int get_nv_limits(TSS2_SYS_CONTEXT * sapi_ctx, uint32_t * index_max,
+                  uint32_t * buffer_max);
+
+/**
+ * @brief Gets the size of a defined NV index.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context, must be
+ *                               initialized
+ *
+ * @param[in]  nv_index          The NV index handle
+ *
+ * @param[out] data_size         The size, in bytes, of the index's data
+ *
+ * @return 0 if success, 1 if error (including an undefined index)
+ */
+int get_nv_index_size(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE nv_index,
+                      uint16_t * data_size);
+
+/**
+ * @brief Defines a Kmyth NV index of the given size (owner writable and
+ *        readable with an empty authorization value), first undefining any
+ *        existing index of another size at the handle.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context, must be
+ *                               initialized
+ *
+ * @param[in]  owner_auth        Storage (owner) hierarchy authorization
+ *
+ * @param[in]  nv_index          The NV index handle (KMYTH_NV_SKI_FIRST to
+ *                               KMYTH_NV_SKI_LAST)
+ *
+ * @param[in]  data_size         The size, in bytes, of the index's data
+ *
+ * @return 0 if success, 1 if error (including a lack of NV space)
+ */
+int define_nv_index(TSS2_SYS_CONTEXT * sapi_ctx, TPM2B_AUTH owner_auth,
+                    TPM2_HANDLE nv_index, uint16_t data_size);
+
+/**
+ * @brief Undefines a Kmyth NV index, freeing its NV space.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context, must be
+ *                               initialized
+ *
+ * @param[in]  owner_auth        Storage (owner) hierarchy authorization
+ *
+ * @param[in]  nv_index          The NV index handle (KMYTH_NV_SKI_FIRST to
+ *                               KMYTH_NV_SKI_LAST)
+ *
+ * @return 0 if success, 1 if error
+ */
+int undefine_nv_index(TSS2_SYS_CONTEXT * sapi_ctx, TPM2B_AUTH owner_auth,
+                      TPM2_HANDLE nv_index);
+
+/**
+ * @brief Writes data to (the start of) an NV index, in writes of at most
+ *        buffer_max bytes.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context, must be
+ *                               initialized
+ *
+ * @param[in]  owner_auth        Storage (owner) hierarchy authorization
+ *
+ * @param[in]  nv_index          The NV index handle
+ *
+ * @param[in]  data              The data
+ *
+ * @param[in]  data_len          The length, in bytes, of data (at most the
+ *                               index's size)
+ *
+ * @param[in]  buffer_max        The largest write (see get_nv_limits())
+ *
+ * @return 0 if success, 1 if error
+ */
+int write_nv_index(TSS2_SYS_CONTEXT * sapi_ctx, TPM2B_AUTH owner_auth,
+                   TPM2_HANDLE nv_index, const uint8_t * data,
+                   size_t data_len, uint32_t buffer_max);
+
+/**
+ * @brief Reads the whole of an NV index, in reads of at most buffer_max
+ *        bytes.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context, must be
+ *                               initialized
+ *
+ * @param[in]  nv_index          The NV index handle
+ *
+ * @param[in]  buffer_max        The largest read (see get_nv_limits())
+ *
+ * @param[out] data              The index's data (allocated here, to be
+ *                               freed by the caller)
+ *
+ * @param[out] data_len          The length, in bytes, of data
+ *
+ * @return 0 if success, 1 if error
+ */
+int read_nv_index(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE nv_index,
+                  uint32_t buffer_max, uint8_t ** data, size_t *data_len);
+
+#endif /* NV_TOOLS_H */
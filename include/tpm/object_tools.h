@@ -65,6 +65,10 @@ int init_kmyth_object_sensitive(TPM2B_AUTH object_auth,
  *                           <LI> true = object is a key </LI>
  *                           <LI> false = object is a blob </LI>
  *                         </UL>
+ *
+ * @param[in]  keyAlg      Public key algorithm for a key object
+ *                         (TPM2_ALG_RSA or TPM2_ALG_ECC) - ignored for a
+ *                         blob, which always uses KMYTH_DATA_PUBKEY_ALG
  * 
  * @param[in]  auth_policy Authorization policy digest for object -
  *                         passed as a pointer to this buffer
@@ -74,7 +78,8 @@ int init_kmyth_object_sensitive(TPM2B_AUTH object_auth,
  *
  * @return 0 if success, 1 if error. 
  */
-int init_kmyth_object_template(bool isKey, TPM2B_DIGEST auth_policy,
+int init_kmyth_object_template(bool isKey, TPMI_ALG_PUBLIC keyAlg,
+                               TPM2B_DIGEST auth_policy,
                                TPMT_PUBLIC * pubArea);
 
 /**
@@ -312,6 +317,12 @@ int init_kmyth_object_unique(TPMI_ALG_PUBLIC objectType,
  *                                     sized buffer containing the
  *                                     object's public area contents
  *
+ * @param[in/out] host_work            Host-side work to run while the TPM
+ *                                     creates the object (see
+ *                                     execute_tpm2_async()) - may be NULL.
+ *                                     Not used when creating a primary
+ *                                     object.
+ *
  * @return 0 if success, 1 if error. 
  */
 int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
@@ -324,7 +335,29 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                         TPML_PCR_SELECTION object_pcrSelect,
                         TPM2_HANDLE object_dest_handle,
                         TPM2B_PRIVATE * object_private,
-                        TPM2B_PUBLIC * object_public);
+                        TPM2B_PUBLIC * object_public, HOST_WORK * host_work);
+
+/**
+ * @brief Same as create_kmyth_object(), except that the object's inputs
+ *        (and the parent's authorization) are passed by pointer rather
+ *        than copied onto the stack, for callers that create many objects.
+ *
+ * All parameters are as described for create_kmyth_object().
+ *
+ * @return 0 if success, 1 if error.
+ */
+int create_kmyth_object_ref(TSS2_SYS_CONTEXT * sapi_ctx,
+                            SESSION * createObjectAuthSession,
+                            TPM2_HANDLE parent_handle,
+                            const TPM2B_AUTH * parent_auth,
+                            const TPML_PCR_SELECTION * parent_pcrList,
+                            const TPM2B_SENSITIVE_CREATE * object_sensitive,
+                            const TPM2B_PUBLIC * object_template,
+                            const TPML_PCR_SELECTION * object_pcrSelect,
+                            TPM2_HANDLE object_dest_handle,
+                            TPM2B_PRIVATE * object_private,
+                            TPM2B_PUBLIC * object_public,
+                            HOST_WORK * host_work);
 
 /**
  * @brief Loads an object (e.g., key) into the TPM 2.0.
@@ -395,6 +428,10 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
  *                                   object - passed as a pointer to the
  *                                   handle value.
  *
+ * @param[in/out] host_work          Host-side work to run while the TPM
+ *                                   loads the object (see
+ *                                   execute_tpm2_async()) - may be NULL
+ *
  * @return 0 if success, 1 if error. 
  */
 int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
@@ -403,7 +440,8 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                       TPM2B_AUTH parent_auth,
                       TPML_PCR_SELECTION parent_pcrList,
                       TPM2B_PRIVATE * in_private,
-                      TPM2B_PUBLIC * in_public, TPM2_HANDLE * object_handle);
+                      TPM2B_PUBLIC * in_public, TPM2_HANDLE * object_handle,
+                      HOST_WORK * host_work);
 
 /**
  * @brief Unseals a Kmyth TPM data object 
@@ -438,6 +476,10 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
  *
  * @param[out] object_sensitive           The unsealed (unencrypted) result.
  *
+ * @param[in/out] host_work               Host-side work to run while the TPM
+ *                                        unseals the object (see
+ *                                        execute_tpm2_async()) - may be NULL
+ *
  * @return 0 if success, 1 if error. 
  */
 int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
@@ -447,6 +489,7 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                         TPM2B_DIGEST policyBranch1,
                         TPM2B_DIGEST policyBranch2,
                         TPML_PCR_SELECTION object_pcrList,
-                        TPM2B_SENSITIVE_DATA * object_sensitive);
+                        TPM2B_SENSITIVE_DATA * object_sensitive,
+                        HOST_WORK * host_work);
 
 #endif /* OBJECT_TOOLS_H */
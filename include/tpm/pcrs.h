@@ -51,4 +51,62 @@ int init_pcr_selection(TSS2_SYS_CONTEXT * sapi_ctx,
  */
 int get_pcr_count(TSS2_SYS_CONTEXT * sapi_ctx, int *pcrCount);
 
+/**
+ * @brief Reads the values of the PCRs in a PCR selection from the TPM.
+ *
+ *        The TPM returns at most eight PCR values per PCR_Read command, so
+ *        larger selections take more than one command. If the PCRs change
+ *        between those commands (the TPM's PCR update counter changes), the
+ *        read is restarted, so that the values returned are one consistent
+ *        snapshot.
+ *
+ * @param[in]  sapi_ctx        System API (SAPI) context, must be initialized
+ *                             and passed in as pointer to the SAPI context
+ *
+ * @param[in]  pcrs_struct     TPM 2.0 PCR Selection List struct specifying
+ *                             the PCRs to read
+ *
+ * @param[out] pcrValues       Array the PCR values are returned in, in
+ *                             selection order (bank by bank, lowest PCR
+ *                             index first)
+ *
+ * @param[in]  pcrValues_size  Number of entries available in the pcrValues
+ *                             array
+ *
+ * @param[out] pcrValues_len   Number of PCR values returned (passed in as a
+ *                             pointer to a size_t value)
+ *
+ * @return 0 if success, 1 if error
+ */
+int read_pcr_values(TSS2_SYS_CONTEXT * sapi_ctx,
+                    TPML_PCR_SELECTION pcrs_struct,
+                    TPM2B_DIGEST * pcrValues,
+                    size_t pcrValues_size, size_t *pcrValues_len);
+
+/**
+ * @brief Parses a set of (expected) PCR values, written as
+ *        <PCR index>=<hex PCR value> fields separated by blanks or commas
+ *        (e.g., "0=<64 hex digits>, 7=<64 hex digits>"), into the PCR
+ *        selection and values that compute_policy_digest() takes. The
+ *        selection uses the Kmyth PCR bank, as init_pcr_selection() does.
+ *
+ * @param[in]  line           The PCR value set (modified by parsing)
+ *
+ * @param[in]  pcr_count      Number of PCRs implemented by the TPM, which
+ *                            sets the size of the selection mask
+ *
+ * @param[out] pcrList        The selection of the PCRs given values
+ *
+ * @param[out] pcrValues      Array (of TPM2_MAX_PCRS entries) the values are
+ *                            returned in, in increasing PCR index order
+ *
+ * @param[out] pcrValues_len  Number of PCR values returned
+ *
+ * @return 0 if success, 1 if error (a malformed field, a PCR index out of
+ *         range, or one given twice)
+ */
+int parse_pcr_value_set(char *line, size_t pcr_count,
+                        TPML_PCR_SELECTION * pcrList,
+                        TPM2B_DIGEST * pcrValues, size_t *pcrValues_len);
+
 #endif /* PRCS_H */
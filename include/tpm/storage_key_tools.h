@@ -38,6 +38,54 @@ int get_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
                    TPM2_HANDLE * srk_handle,
                    TPM2B_AUTH * storage_hierarchy_auth);
 
+/**
+ * @brief Get storage root key (SRK) handle, using a previously retrieved
+ *        handle value as a hint.
+ *
+ * If a non-zero hint is passed in, it is verified with a single ReadPublic
+ * (see check_if_srk()). Only if that check fails (e.g., the SRK has been
+ * evicted or the handle now references a different object) is the full
+ * persistent handle scan performed by get_srk_handle().
+ *
+ * @param[in]     sapi_ctx               System API (SAPI) context,
+ *                                       must be initialized and
+ *                                       passed in as pointer to the SAPI
+ *                                       context
+ *
+ * @param[in/out] srk_handle             On input, cached SRK handle (hint)
+ *                                       or zero if none is available. On
+ *                                       output, the verified TPM 2.0 handle
+ *                                       for the SRK - passed as pointer to
+ *                                       SRK handle value
+ *
+ * @param[out]    storage_hierarchy_auth TPM2B_AUTH struct providing
+ *                                       authorization for restricted TPM 2.0
+ *                                       storage hierarchy commands - pointer
+ *                                       to TPM2_AUTH passed.
+ *
+ * @return 0 if success, 1 if error
+ */
+int get_cached_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
+                          TPM2_HANDLE * srk_handle,
+                          TPM2B_AUTH * storage_hierarchy_auth);
+
+/**
+ * @brief Get the TPM name of the storage root key (SRK). As the SRK is
+ *        derived from the TPM's storage primary seed, its name identifies
+ *        the TPM (and storage hierarchy) that objects created under it
+ *        can be loaded into.
+ *
+ * @param[in]  sapi_ctx   System API (SAPI) context, must be initialized
+ *
+ * @param[in]  srk_handle Handle of the SRK (see get_cached_srk_handle())
+ *
+ * @param[out] srk_name   Name of the SRK (size 0 on error)
+ *
+ * @return 0 if success, 1 if error
+ */
+int get_srk_name(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE srk_handle,
+                 TPM2B_NAME * srk_name);
+
 /**
  * @brief Try to get handle of a Storage Root Key (SRK) that is already loaded
  *        into the TPM's persistent storage.
@@ -127,6 +175,9 @@ int put_srk_into_persistent_storage(TSS2_SYS_CONTEXT * sapi_ctx,
  * @param[in]  sk_authPolicy Authorization policy digest to be associated
  *                           with the created storage key
  *
+ * @param[in]  sk_alg        Public key algorithm of the storage key
+ *                           (TPM2_ALG_RSA or TPM2_ALG_ECC)
+ *
  * @param[out] sk_handle     TPM 2.0 handle that references the created
  *                           and loaded storage key (SK) -
  *                           passed as a pointer to the handle value
@@ -145,7 +196,84 @@ int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
                        TPM2B_AUTH sk_authVal,
                        TPML_PCR_SELECTION sk_pcrList,
                        TPM2B_DIGEST sk_authPolicy,
+                       TPMI_ALG_PUBLIC sk_alg,
                        TPM2_HANDLE * sk_handle,
                        TPM2B_PRIVATE * sk_private, TPM2B_PUBLIC * sk_public);
 
+/**
+ * @brief Looks for a storage key (SK), made persistent by make_sk_persistent(),
+ *        whose public area matches the one given (e.g., from a .ski file).
+ *        Only handles in the Kmyth persistent SK range
+ *        (KMYTH_PERSISTENT_SK_FIRST to KMYTH_PERSISTENT_SK_LAST) are checked.
+ *
+ * @param[in]  sapi_ctx      System API (SAPI) context, must be initialized
+ *                           and passed in as pointer to the SAPI context
+ *
+ * @param[in]  sk_public     "Public" structure of the storage key
+ *
+ * @param[in/out] sk_handle  On input, a handle to check first (e.g., the
+ *                           one found last time), or 0. On output, the
+ *                           persistent handle of the storage key, or 0 if
+ *                           it is not persistent.
+ *
+ * @return 0 if success (whether or not the key was found), 1 if error.
+ */
+int find_persistent_sk(TSS2_SYS_CONTEXT * sapi_ctx,
+                       TPM2B_PUBLIC sk_public, TPM2_HANDLE * sk_handle);
+
+/**
+ * @brief Makes a loaded storage key (SK) persistent (Tss2_Sys_EvictControl()),
+ *        so that it no longer needs to be loaded to unseal data sealed under
+ *        it. Another storage key already persistent at the handle is evicted
+ *        first. Nothing is done if the same key is already there.
+ *
+ * @param[in]  sapi_ctx           System API (SAPI) context, must be
+ *                                initialized and passed in as pointer to
+ *                                the SAPI context
+ *
+ * @param[in]  owner_auth         Owner (storage) hierarchy authorization
+ *
+ * @param[in]  sk_handle          Transient handle of the loaded storage key
+ *                                (left loaded)
+ *
+ * @param[in]  persistent_handle  Handle to make the storage key persistent
+ *                                at, in the Kmyth persistent SK range
+ *
+ * @return 0 if success, 1 if error.
+ */
+int make_sk_persistent(TSS2_SYS_CONTEXT * sapi_ctx,
+                       TPM2B_AUTH owner_auth,
+                       TPM2_HANDLE sk_handle, TPM2_HANDLE persistent_handle);
+
+/**
+ * @brief Evicts (Tss2_Sys_EvictControl()) a persistent storage key (SK),
+ *        freeing its persistent (NV) slot.
+ *
+ * @param[in]  sapi_ctx           System API (SAPI) context, must be
+ *                                initialized and passed in as pointer to
+ *                                the SAPI context
+ *
+ * @param[in]  owner_auth         Owner (storage) hierarchy authorization
+ *
+ * @param[in]  persistent_handle  Persistent handle of the storage key, in the
+ *                                Kmyth persistent SK range
+ *
+ * @return 0 if success, 1 if error.
+ */
+int evict_persistent_sk(TSS2_SYS_CONTEXT * sapi_ctx,
+                        TPM2B_AUTH owner_auth, TPM2_HANDLE persistent_handle);
+
+/**
+ * @brief Lists the persistent handles in use in the Kmyth persistent SK
+ *        range.
+ *
+ * @param[in]  sapi_ctx      System API (SAPI) context, must be initialized
+ *                           and passed in as pointer to the SAPI context
+ *
+ * @param[out] sk_handles    List of the persistent handles
+ *
+ * @return 0 if success, 1 if error.
+ */
+int list_persistent_sks(TSS2_SYS_CONTEXT * sapi_ctx, TPML_HANDLE * sk_handles);
+
 #endif /* STORAGE_KEY_TOOLS_H */
@@ -14,6 +14,8 @@
 
 #include <tss2/tss2_sys.h>
 
+#include "kmyth.h"
+
 /**
  * @brief Array of manufacturer strings known to identify software TPM simulators.
  */
@@ -80,9 +82,47 @@ typedef struct
 } SESSION;
 
 /**
- * @brief Initializes TPM 2.0 connection to resource manager. 
+ * @brief Host-side work that can be overlapped with an in-flight TPM
+ *        command (see execute_tpm2_async()). fn is set to NULL once the
+ *        work has been run.
+ */
+typedef struct
+{
+  void (*fn) (void *arg);
+  void *arg;
+} HOST_WORK;
+
+/**
+ * @brief When the commands sent over a connection must be done by (see
+ *        set_tpm2_deadline()): an absolute monotonic clock time, in
+ *        nanoseconds (0 for none), and a flag that, once set (atomically,
+ *        possibly by another thread), cancels them at once.
+ */
+typedef struct
+{
+  uint64_t deadline_ns;
+  int cancelled;
+} CALL_DEADLINE;
+
+/**
+ * @brief Environment variable holding the TCTI configuration used by
+ *        init_tpm2_connection() (see init_tcti())
+ */
+#define KMYTH_TCTI_ENV "KMYTH_TCTI"
+
+/**
+ * @brief TCTI configuration used if none is specified: the TPM2 Access
+ *        Broker and Resource Manager (tpm2-abrmd)
+ */
+#define KMYTH_TCTI_DEFAULT "tabrmd"
+
+/**
+ * @brief Initializes TPM 2.0 connection, using the TCTI configuration in the
+ *        KMYTH_TCTI environment variable (if set) or else the resource
+ *        manager daemon (see init_tcti()).
  *
- * Will error if resource manager is not running. 
+ * Will error if the configured TCTI (by default, the resource manager) is
+ * not available.
  *
  * @param[out] sapi_ctx  System API context, must be initialized to NULL
  *
@@ -90,6 +130,79 @@ typedef struct
  */
 int init_tpm2_connection(TSS2_SYS_CONTEXT ** sapi_ctx);
 
+/**
+ * @brief Initializes TPM 2.0 connection using a specific TCTI configuration.
+ *
+ * @param[out] sapi_ctx   System API context, must be initialized to NULL
+ *
+ * @param[in]  tcti_conf  TCTI configuration string (see init_tcti()), or
+ *                        NULL to use the KMYTH_TCTI environment variable
+ *                        or the default
+ *
+ * @return 0 if success, 1 if error
+ */
+int init_tpm2_connection_tcti(TSS2_SYS_CONTEXT ** sapi_ctx,
+                              const char *tcti_conf);
+
+/**
+ * @brief Initializes a TCTI context for the backend selected by a
+ *        configuration string of the form <backend>[:<backend config>],
+ *        the same form used by the tpm2-tools TCTI option. Supported
+ *        backends are:
+ *        <UL>
+ *          <LI> tabrmd - TPM2 Access Broker and Resource Manager (D-Bus),
+ *                        e.g. "tabrmd" or "tabrmd:bus_type=session" </LI>
+ *          <LI> device - TPM character device, by default the kernel
+ *                        resource manager, e.g. "device" (/dev/tpmrm0) or
+ *                        "device:/dev/tpm0" </LI>
+ *          <LI> mssim  - Microsoft/IBM TPM 2.0 simulator, e.g. "mssim" or
+ *                        "mssim:host=localhost,port=2321" </LI>
+ *          <LI> swtpm  - swtpm simulator, e.g. "swtpm" or
+ *                        "swtpm:host=localhost,port=2321" </LI>
+ *          <LI> delay  - wraps another TCTI (normally a simulator's),
+ *                        making each command take at least a configured
+ *                        time (in ms, '*' for any command not listed), to
+ *                        model a faster or slower TPM and so separate
+ *                        kmyth's own (host) time from the TPM's, e.g.
+ *                        "delay:*=2,CreatePrimary=150,Create=60@mssim"
+ *                        (the wrapped TCTI follows the '@', and defaults
+ *                        to KMYTH_TCTI_DEFAULT) </LI>
+ *        </UL>
+ *
+ * @param[out] tcti_ctx   TPM Command Transmission Interface (TCTI) context,
+ *                        must be passed in as a NULL
+ *
+ * @param[in]  tcti_conf  TCTI configuration string, or NULL to use the
+ *                        KMYTH_TCTI environment variable or the default
+ *
+ * @return 0 if success, 1 if error
+ */
+int init_tcti(TSS2_TCTI_CONTEXT ** tcti_ctx, const char *tcti_conf);
+
+/**
+ * @brief Returns the name (e.g., "Unseal") of a TPM command kmyth issues.
+ *
+ * @param[in]  command_code  TPM command code
+ *
+ * @return The command's name, or "unknown"
+ */
+const char *get_tpm2_command_name(uint32_t command_code);
+
+/**
+ * @brief Looks up a TPM command code by its name (as returned by
+ *        get_tpm2_command_name()), or parses it as a number (e.g., 0x157).
+ *
+ * @param[in]  name          Command name (need not be NUL terminated)
+ *
+ * @param[in]  name_len      Length, in bytes, of name
+ *
+ * @param[out] command_code  The command code
+ *
+ * @return 0 if success, 1 if error
+ */
+int get_tpm2_command_code(const char *name, size_t name_len,
+                          uint32_t * command_code);
+
 /**
  * @brief Initializes a TCTI context to talk to resource manager.
  *        Will not work if resource manager is not turned on and connected
@@ -172,6 +285,75 @@ int get_tpm2_properties(TSS2_SYS_CONTEXT * sapi_ctx,
  */
 int get_tpm2_impl_type(TSS2_SYS_CONTEXT * sapi_ctx, bool *isEmulator);
 
+/**
+ * @brief Parts of the TPM capability snapshot (see get_tpm2_snapshot()),
+ *        which may be combined (bitwise OR)
+ */
+#define KMYTH_SNAPSHOT_PROPERTIES 0x1   // fixed properties (never change)
+#define KMYTH_SNAPSHOT_PERSISTENT 0x2   // persistent object handles
+#define KMYTH_SNAPSHOT_SESSIONS   0x4   // loaded HMAC and policy sessions
+#define KMYTH_SNAPSHOT_ALL        0x7
+
+/**
+ * @brief TPM capability data consulted repeatedly by kmyth, gathered once
+ *        per connection rather than queried on every use
+ */
+typedef struct
+{
+  // TPM2_PT_MANUFACTURER (KMYTH_SNAPSHOT_PROPERTIES)
+  uint32_t manufacturer;
+
+  // TPM2_PT_PCR_COUNT (KMYTH_SNAPSHOT_PROPERTIES)
+  uint32_t pcr_count;
+
+  // persistent object handles (KMYTH_SNAPSHOT_PERSISTENT)
+  TPML_HANDLE persistent_handles;
+
+  // loaded HMAC session handles (KMYTH_SNAPSHOT_SESSIONS)
+  TPML_HANDLE hmac_sessions;
+
+  // loaded policy session handles (KMYTH_SNAPSHOT_SESSIONS)
+  TPML_HANDLE policy_sessions;
+} CAP_SNAPSHOT;
+
+/**
+ * @brief Gets TPM capability data from the snapshot kept for a connection
+ *        set up by init_tpm2_connection(). Parts of the snapshot are only
+ *        queried from the TPM the first time they are needed, and again
+ *        after they have been invalidated by refresh_tpm2_snapshot(). The
+ *        connection itself invalidates the handle lists when it sends a
+ *        command that may change them (e.g., StartAuthSession, FlushContext
+ *        of a session, EvictControl). For any other context, the requested
+ *        parts are queried from the TPM on every call.
+ *
+ * @param[in]  sapi_ctx  System API (SAPI) context, must be initialized -
+ *                       passed in as a pointer to the context struct
+ *
+ * @param[in]  parts     Parts of the snapshot needed (KMYTH_SNAPSHOT_* flags)
+ *
+ * @param[out] snapshot  Snapshot copy - only the requested parts are set
+ *
+ * @return 0 if success, 1 if error
+ */
+int get_tpm2_snapshot(TSS2_SYS_CONTEXT * sapi_ctx, uint32_t parts,
+                      CAP_SNAPSHOT * snapshot);
+
+/**
+ * @brief Invalidates parts of a connection's TPM capability snapshot, so
+ *        that the next get_tpm2_snapshot() call requesting them queries the
+ *        TPM again. Needed after the TPM state is changed other than over
+ *        the connection (e.g., by another process).
+ *
+ * @param[in]  sapi_ctx  System API (SAPI) context, must be initialized -
+ *                       passed in as a pointer to the context struct
+ *
+ * @param[in]  parts     Parts of the snapshot to invalidate
+ *                       (KMYTH_SNAPSHOT_* flags)
+ *
+ * @return None
+ */
+void refresh_tpm2_snapshot(TSS2_SYS_CONTEXT * sapi_ctx, uint32_t parts);
+
 /**
  * @brief Translates error string from hex into human readable.
  *
@@ -429,6 +611,11 @@ int compute_rpHash(TPM2_RC rspCode,
  * @brief Computes the authorization HMAC value required for command and
  *        response authorization.
  *
+ * The HMAC is keyed with the session's sessionKey || auth_authValue. Each
+ * thread keeps its HMAC context keyed between calls, so consecutive
+ * commands authorized with the same key (the create, load and unseal of a
+ * seal or unseal) do not redo the key setup.
+ *
  * @param[in]  auth_session           Authorization session parameters stucture
  *
  * @param[in]  auth_pHash             Command or response parameter hash
@@ -452,8 +639,93 @@ int compute_authHMAC(SESSION auth_session,
                      TPM2B_AUTH * auth_HMAC);
 
 /**
- * @brief Creates a trial policy (authorization session) and uses it to
- *        create an authorization policy (authPolicy) digest to associate
+ * @brief Computes, in software on the host, the PCR digest that a TPM 2.0
+ *        PolicyPCR command checks: the hash of the selected PCR values,
+ *        concatenated in selection order.
+ *
+ * @param[in]  pcrValues      Array of selected PCR values, in selection
+ *                            order (bank by bank, lowest PCR index first)
+ *
+ * @param[in]  pcrValues_len  Number of PCR values in the array
+ *
+ * @param[out] pcrDigest_out  PCR digest result - passed as a pointer to
+ *                            the hash value
+ *
+ * @return 0 if success, 1 if error.
+ */
+int compute_pcr_digest(const TPM2B_DIGEST * pcrValues,
+                       size_t pcrValues_len, TPM2B_DIGEST * pcrDigest_out);
+
+/**
+ * @brief Computes, in software on the host, the authorization policy
+ *        digest that results from applying the Kmyth authorization policy
+ *        (see apply_policy()) to a fresh policy session:
+ *
+ *        PolicyAuthValue, followed (if the PCR selection list is not empty)
+ *        by PolicyPCR over the specified PCR values.
+ *
+ *        The result is the same value a TPM trial session would produce
+ *        (see create_trial_policy_digest()), but no TPM commands are sent.
+ *
+ * @param[in]  tp_pcrList        PCR Selection List structure specifying
+ *                               which PCRs to apply to authorization policy
+ *
+ * @param[in]  pcrValues         Values of the selected PCRs, in selection
+ *                               order (ignored if tp_pcrList is empty)
+ *
+ * @param[in]  pcrValues_len     Number of PCR values in the array
+ *
+ * @param[out] policyDigest_out  Authorization policy digest result -
+ *                               passed as a pointer to the hash value
+ *
+ * @return 0 if success, 1 if error.
+ */
+int compute_policy_digest(TPML_PCR_SELECTION tp_pcrList,
+                          const TPM2B_DIGEST * pcrValues,
+                          size_t pcrValues_len,
+                          TPM2B_DIGEST * policyDigest_out);
+
+/**
+ * @brief Computes, in software on the host, the authorization policy
+ *        digest that results from applying PolicyOR over a list of policy
+ *        branch digests (see apply_policy_or()). As on the TPM, the result
+ *        does not depend on the policy digest in place before PolicyOR.
+ *
+ * @param[in]  pHashList         List of (two to eight) policy branch digests
+ *
+ * @param[out] policyDigest_out  Authorization policy digest result -
+ *                               passed as a pointer to the hash value
+ *
+ * @return 0 if success, 1 if error.
+ */
+int compute_policy_or_digest(TPML_DIGEST pHashList,
+                             TPM2B_DIGEST * policyDigest_out);
+
+/**
+ * @brief Checks, in software on the host, whether a policy session that
+ *        reaches pcrPolicy (see compute_policy_digest()) would satisfy an
+ *        object's authorization policy - directly, or through PolicyOR
+ *        over the two branches if the object was sealed with a policy-OR.
+ *
+ *        Used to reject an unseal whose PCRs no longer match before any
+ *        TPM objects are loaded for it.
+ *
+ * @param[in]  pcrPolicy         Policy digest for the current PCR values
+ *
+ * @param[in]  authPolicy        The object's authPolicy digest
+ *
+ * @param[in]  policyBranch1     First policy-OR branch (size 0 if none)
+ *
+ * @param[in]  policyBranch2     Second policy-OR branch (size 0 if none)
+ *
+ * @return 0 if the policy would be satisfied, 1 otherwise
+ */
+int check_policy_digest(TPM2B_DIGEST pcrPolicy, TPM2B_DIGEST authPolicy,
+                        TPM2B_DIGEST policyBranch1,
+                        TPM2B_DIGEST policyBranch2);
+
+/**
+ * @brief Creates the authorization policy (authPolicy) digest to associate
  *        with an object (in the Kmyth case, the storage key we create
  *        to wrap sensitive keys or data). Use of the object (i.e., the
  *        storage key) will require ability to re-create this digest. More
@@ -462,6 +734,12 @@ int compute_authHMAC(SESSION auth_session,
  *        criteria) to match the state they are in when the authPolicy digest
  *        is created by this function.
  *
+ *        The selected PCR values are read from the TPM (see
+ *        read_pcr_values()) and the digest is computed on the host (see
+ *        compute_policy_digest()). If Kmyth is built with
+ *        KMYTH_POLICY_TRIAL_CHECK defined, the result is also checked
+ *        against a TPM trial session (see create_trial_policy_digest()).
+ *
  * @param[in]  sapi_ctx          System API (SAPI) context, must be initialized
  *                               and passed in as pointer to the SAPI context
  * 
@@ -477,6 +755,52 @@ int create_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
                          TPML_PCR_SELECTION tp_pcrList,
                          TPM2B_DIGEST * policyDigest_out);
 
+/**
+ * @brief Creates a trial policy (authorization session) and uses it to
+ *        create the same authorization policy digest as
+ *        create_policy_digest(), by having the TPM apply the Kmyth
+ *        authorization policy steps. This costs several TPM round trips,
+ *        so it is only used to cross-check the host-computed digest.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context, must be initialized
+ *                               and passed in as pointer to the SAPI context
+ * 
+ * @param[in]  tp_pcrList        PCR Selection List structure specifying
+ *                               which PCRs to apply to authorization policy
+ *
+ * @param[out] policyDigest_out  Authorization policy digest result -
+ *                               passed as a pointer to the hash value
+ *
+ * @return 0 if success, 1 if error. 
+ */
+int create_trial_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
+                               TPML_PCR_SELECTION tp_pcrList,
+                               TPM2B_DIGEST * policyDigest_out);
+
+/**
+ * @brief Creates the compound (PolicyOR) authorization policy digest that
+ *        can be satisfied by either of two policy branches. The digest is
+ *        computed on the host (see compute_policy_or_digest()). If Kmyth is
+ *        built with KMYTH_POLICY_TRIAL_CHECK defined, the result is also
+ *        checked against a TPM trial session.
+ *
+ * @param[in]  sapi_ctx          System API (SAPI) context, must be initialized
+ *                               and passed in as pointer to the SAPI context
+ *                               (only used for the trial session cross-check)
+ *
+ * @param[in]  policy1           The first policy branch digest
+ *
+ * @param[in]  policy2           The second policy branch digest
+ *
+ * @param[out] policyDigest_out  Authorization policy digest result -
+ *                               passed as a pointer to the hash value
+ *
+ * @return 0 if success, 1 if error.
+ */
+int create_policy_or_digest(TSS2_SYS_CONTEXT * sapi_ctx,
+                            TPM2B_DIGEST policy1, TPM2B_DIGEST policy2,
+                            TPM2B_DIGEST * policyDigest_out);
+
 /**
  * @brief Creates a session used to authorize kmyth objects
  *
@@ -514,6 +838,113 @@ int create_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
 int start_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
                               SESSION * session, TPM2_SE session_type);
 
+/**
+ * @brief Obtains a policy session for authorizing kmyth objects. A session
+ *        released to the connection's pool by release_policy_session() is
+ *        reset with TPM2_PolicyRestart and reused, avoiding the cost of
+ *        TPM2_StartAuthSession. A new session is created (with
+ *        create_auth_session()) only if the pool is empty or the restart
+ *        fails.
+ *
+ * @param[in]  sapi_ctx      System API (SAPI) context, must be initialized
+ *                           and passed in as pointer to the SAPI context
+ *
+ * @param[out] policySession Pointer to policy session parameters struct
+ *                           initialized by this function
+ *
+ * @return 0 if success, 1 if error
+ */
+int acquire_policy_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                           SESSION * policySession);
+
+/**
+ * @brief Releases a policy session obtained with acquire_policy_session().
+ *        A session is kept open in the connection's pool (with its rolled
+ *        nonces) for the next acquire_policy_session() call, unless it
+ *        failed, the pool is full, or the connection has no pool, in which
+ *        case it is flushed.
+ *
+ * @param[in]  sapi_ctx      System API (SAPI) context, must be initialized
+ *                           and passed in as pointer to the SAPI context
+ *
+ * @param[in]  policySession Pointer to policy session parameters struct
+ *
+ * @param[in]  failed        Whether a command using the session failed (its
+ *                           state is then unknown, so it is not reused)
+ *
+ * @return 0 if success, 1 if error
+ */
+int release_policy_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                           SESSION * policySession, bool failed);
+
+/**
+ * @brief Loads a TPM object from the connection's object context cache.
+ *        After an object (e.g., storage key or sealed data object) is
+ *        loaded with Tss2_Sys_Load(), save_object_context() keeps its
+ *        saved context (Tss2_Sys_ContextSave()), keyed by a hash of the
+ *        object's public and private blobs. Loading it again is then a
+ *        Tss2_Sys_ContextLoad(), which skips the TPM's decryption and
+ *        integrity check of the private blob. The cache is emptied if the
+ *        TPM's reset or restart count changes, as saved contexts do not
+ *        survive either. The cache is off until enabled with
+ *        set_object_context_cache(), and nothing is ever found without one.
+ *
+ * @param[in]  sapi_ctx       System API (SAPI) context, must be initialized
+ *                            and passed in as pointer to the SAPI context
+ *
+ * @param[in]  in_private     Private blob of the object
+ *
+ * @param[in]  in_public      Public blob of the object
+ *
+ * @param[out] object_handle  Transient handle the object was loaded at
+ *
+ * @return 0 if the object was loaded from the cache, 1 if not (the object
+ *         must then be loaded from its blobs)
+ */
+int load_cached_object_context(TSS2_SYS_CONTEXT * sapi_ctx,
+                               TPM2B_PRIVATE * in_private,
+                               TPM2B_PUBLIC * in_public,
+                               TPM2_HANDLE * object_handle);
+
+/**
+ * @brief Enables or disables (emptying) the object context cache (see
+ *        load_cached_object_context()) of a connection set up by
+ *        init_tpm2_connection(). Worthwhile for a long-lived connection
+ *        that loads the same objects repeatedly, as filling the cache
+ *        costs a Tss2_Sys_ContextSave() per object loaded.
+ *
+ * @param[in]  sapi_ctx       System API (SAPI) context from
+ *                            init_tpm2_connection()
+ *
+ * @param[in]  enabled        Whether to cache object contexts
+ *
+ * @return 0 if success, 1 if error
+ */
+int set_object_context_cache(TSS2_SYS_CONTEXT * sapi_ctx, bool enabled);
+
+/**
+ * @brief Saves the context of an object just loaded from its blobs into
+ *        the connection's object context cache (see
+ *        load_cached_object_context()), replacing the least recently used
+ *        entry if the cache is full. Failures are not errors - the object
+ *        is just not cached.
+ *
+ * @param[in]  sapi_ctx       System API (SAPI) context, must be initialized
+ *                            and passed in as pointer to the SAPI context
+ *
+ * @param[in]  in_private     Private blob the object was loaded from
+ *
+ * @param[in]  in_public      Public blob the object was loaded from
+ *
+ * @param[in]  object_handle  Transient handle of the loaded object (which
+ *                            stays loaded)
+ *
+ * @return None
+ */
+void save_object_context(TSS2_SYS_CONTEXT * sapi_ctx,
+                         TPM2B_PRIVATE * in_private,
+                         TPM2B_PUBLIC * in_public, TPM2_HANDLE object_handle);
+
 /**
  * @brief Executes the Kmyth-specific authorization policy steps and updates
  *        the authorization policy session context for the specified TPM 2.0
@@ -584,8 +1015,9 @@ int unseal_apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
  * @return 0 if success, 1 if error.
  */
 int apply_policy_or(TSS2_SYS_CONTEXT * sapi_ctx,
-                    TPM2_HANDLE policySessionHandle, TPM2B_DIGEST * policy1,
-                    TPM2B_DIGEST * policy2, TPML_DIGEST * pHashList);
+                    TPM2_HANDLE policySessionHandle,
+                    const TPM2B_DIGEST * policy1,
+                    const TPM2B_DIGEST * policy2, TPML_DIGEST * pHashList);
 
 /**
  * @brief Creates a random initial nonce value that the caller can send to the
@@ -594,7 +1026,7 @@ int apply_policy_or(TSS2_SYS_CONTEXT * sapi_ctx,
  * An authorization session uses two nonces, the caller provides one with a
  * command and the TPM provides one with the response to the command. This
  * function creates an new caller nonce for the authorization session using
- * random bytes obtained from the OpenSSL RAND_bytes() function.
+ * random bytes from the calling thread's nonce DRBG (see nonce_drbg.h).
  * 
  * @param[out] nonceOut  The created nonce value (passed as a pointer to
  *                       the TPM2B_NONCE struct containing the nonce value)
@@ -619,6 +1051,156 @@ int create_caller_nonce(TPM2B_NONCE * nonceOut);
  */
 int rollNonces(SESSION * session, TPM2B_NONCE newNonce);
 
+/**
+ * @brief Executes a prepared TPM 2.0 command (the command parameters and
+ *        any authorizations must already have been set in the SAPI
+ *        context) using the asynchronous SAPI calls. Any host-side work
+ *        passed in is run while the TPM processes the command.
+ *
+ * The host work is consumed (run and its function pointer cleared) only
+ * when the command is successfully sent to the TPM - callers should use
+ * finish_host_work() to run work that was not consumed.
+ *
+ * @param[in]  sapi_ctx:   System API (SAPI) context, with a command
+ *                         prepared (e.g., Tss2_Sys_Unseal_Prepare())
+ *
+ * @param[in/out] host_work: Host-side work to overlap with the TPM
+ *                         command (may be NULL)
+ *
+ * @return TSS2_RC_SUCCESS if success, otherwise the TSS2 response code
+ */
+TSS2_RC execute_tpm2_async(TSS2_SYS_CONTEXT * sapi_ctx, HOST_WORK * host_work);
+
+/**
+ * @brief Runs host-side work, if it has not already been consumed by
+ *        execute_tpm2_async().
+ *
+ * @param[in/out] host_work: Host-side work (may be NULL)
+ *
+ * @return None
+ */
+void finish_host_work(HOST_WORK * host_work);
+
+/**
+ * @brief Decides whether a TPM command should be sent again because the
+ *        TPM was too busy to execute it (TPM_RC_RETRY, TPM_RC_YIELDED or
+ *        TPM_RC_TESTING), and if so waits before the retry. The wait grows
+ *        exponentially with each attempt (see KMYTH_RETRY_BASE_US and
+ *        KMYTH_RETRY_MAX_US), with random jitter, and at most MAX_RETRIES
+ *        retries are allowed. Retries and the time spent waiting are added
+ *        to the timings attached to the connection, if any.
+ *
+ * Typical use, with the command (and its authorizations) prepared again
+ * for each attempt:
+ *
+ *   unsigned int attempt = 0;
+ *   do { rc = Tss2_Sys_...(sapi_ctx, ...); }
+ *   while (retry_tpm2_command(sapi_ctx, rc, &attempt));
+ *
+ * @param[in]  sapi_ctx:   System API (SAPI) context the command was sent on
+ *
+ * @param[in]  rc:         Response code from the command
+ *
+ * @param[in/out] attempt: Number of retries made so far (start at 0)
+ *
+ * @return true if the command should be sent again, false otherwise
+ */
+bool retry_tpm2_command(TSS2_SYS_CONTEXT * sapi_ctx, TSS2_RC rc,
+                        unsigned int *attempt);
+
+/**
+ * @brief Returns the current time of the monotonic clock, in nanoseconds
+ *        (the time base of the kmyth_timings_t durations).
+ *
+ * @return Current monotonic clock time, in nanoseconds
+ */
+uint64_t get_timing_ns(void);
+
+/**
+ * @brief Attaches timings to a connection set up by init_tpm2_connection().
+ *        Every command then sent over the connection is recorded, by
+ *        command code, into the timings.
+ *
+ * @param[in]  sapi_ctx: System API (SAPI) context from
+ *                       init_tpm2_connection()
+ *
+ * @param[in]  timings:  Timings to record into, or NULL to stop recording
+ *
+ * @return 0 if success, 1 if error
+ */
+int set_tpm2_timings(TSS2_SYS_CONTEXT * sapi_ctx, kmyth_timings_t * timings);
+
+/**
+ * @brief Retrieves the timings attached to a connection with
+ *        set_tpm2_timings().
+ *
+ * @param[in]  sapi_ctx: System API (SAPI) context (may be NULL)
+ *
+ * @return Attached timings, or NULL if none
+ */
+kmyth_timings_t *get_tpm2_timings(TSS2_SYS_CONTEXT * sapi_ctx);
+
+/**
+ * @brief Attaches a deadline to a connection set up by
+ *        init_tpm2_connection(). Once it has passed (or been cancelled),
+ *        no further command is sent over the connection, and
+ *        retry_tpm2_command() stops retrying. While a deadline_ns is set,
+ *        a response is waited for in slices of at most
+ *        KMYTH_DEADLINE_POLL_MS, so that a command the TPM is still
+ *        working on is abandoned (and, where the TCTI can, cancelled)
+ *        within that long of the deadline passing or the cancellation -
+ *        which leaves the connection unusable until reset with
+ *        reset_tpm2_connection().
+ *
+ * @param[in]  sapi_ctx: System API (SAPI) context from
+ *                       init_tpm2_connection()
+ *
+ * @param[in]  deadline: Deadline to observe (must outlive its use by the
+ *                       connection), or NULL for none
+ *
+ * @return 0 if success, 1 if error
+ */
+int set_tpm2_deadline(TSS2_SYS_CONTEXT * sapi_ctx, CALL_DEADLINE * deadline);
+
+/**
+ * @brief Makes a connection on which a command was abandoned at its
+ *        deadline (see set_tpm2_deadline()) usable again. The SAPI context
+ *        is set up afresh, and the abandoned command's response is read
+ *        (waiting, within any deadline then set, for the TPM to finish it)
+ *        and dropped before the next command is sent. A connection with no
+ *        abandoned command is left as it is.
+ *
+ * @param[in]  sapi_ctx: System API (SAPI) context from
+ *                       init_tpm2_connection()
+ *
+ * @return 0 if success, 1 if error
+ */
+int reset_tpm2_connection(TSS2_SYS_CONTEXT * sapi_ctx);
+
+/**
+ * @brief Checks whether a deadline has passed, or been cancelled.
+ *
+ * @param[in]  deadline: Deadline to check (may be NULL, for none)
+ *
+ * @return true if it has passed or been cancelled, false otherwise
+ */
+bool tpm2_deadline_expired(const CALL_DEADLINE * deadline);
+
+/**
+ * @brief Adds the time elapsed since start_ns (from get_timing_ns()) to
+ *        a phase of the timings.
+ *
+ * @param[in/out] timings:  Timings to update (nothing is done if NULL)
+ *
+ * @param[in]  phase:       Phase to add the elapsed time to
+ *
+ * @param[in]  start_ns:    Time (from get_timing_ns()) the phase started
+ *
+ * @return None
+ */
+void add_phase_timing(kmyth_timings_t * timings, kmyth_phase_t phase,
+                      uint64_t start_ns);
+
 /**
  * @brief Generates nonce for the session and TPM
  *
@@ -3,11 +3,18 @@
  *
  * @brief Provides global constants, macros, and utilities that support
  *        detailed, configurable, and standardized logging features for Kmyth.
+ *
+ * Messages may be logged, and the settings (set_app_name(), etc.) changed,
+ * from any number of threads at once: each message is formatted in a
+ * per-thread buffer and logged with one consistent snapshot of the
+ * settings.
  */
 
 #ifndef KMYTH_LOG_H
 #define KMYTH_LOG_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <syslog.h>
 
@@ -122,6 +129,46 @@
  */
 #define DEFAULT_MAX_LOG_MSG_LEN 128
 
+/**
+ * @brief Kmyth application log file formats - options:
+ *        <UL>
+ *          <LI> KMYTH_APPLOG_FORMAT_TEXT = one human readable line per
+ *               message </LI>
+ *          <LI> KMYTH_APPLOG_FORMAT_JSON = one JSON object per line (JSON
+ *               lines), for ingestion by log pipelines without parsing.
+ *               Each has the keys ts (RFC 3339, UTC, microseconds),
+ *               severity, app, version, file, func, line and msg, plus
+ *               operation_id and duration_ns when set. </LI>
+ *        </UL>
+ *
+ * The format only applies to the log file - messages written to stddest
+ * (stdout/stderr) are always text.
+ */
+#define KMYTH_APPLOG_FORMAT_TEXT 0
+#define KMYTH_APPLOG_FORMAT_JSON 1
+#define KMYTH_APPLOG_FORMAT_DEFAULT KMYTH_APPLOG_FORMAT_TEXT
+
+/**
+ * @brief maximum length (in chars) of a log message's operation ID
+ *        (note: this does not include the string's null termination character)
+ */
+#define MAX_LOG_OPERATION_ID_LEN 64
+
+/**
+ * @brief default number of messages that can be queued for the writer
+ *        thread in async logging mode (see start_async_logging())
+ */
+#define DEFAULT_ASYNC_LOG_CAPACITY 256
+
+/**
+ * @brief default rate limit (see set_log_rate_limit()) for the messages
+ *        logged from each call site: 0 messages per second (rate limiting
+ *        disabled), with a burst of DEFAULT_LOG_RATE_BURST messages once
+ *        it is enabled
+ */
+#define DEFAULT_LOG_RATE_LIMIT 0
+#define DEFAULT_LOG_RATE_BURST 10
+
 //--------------------------Templates-----------------------------------------
 
 struct log_params
@@ -135,8 +182,11 @@ struct log_params
   int applog_max_msg_len;
   int applog_output_mode;
   int applog_severity_threshold;
+  int applog_format;
   int syslog_facility;
   int syslog_severity_threshold;
+  int log_rate_limit;
+  int log_rate_burst;
 };
 
 //--------------------------Function Declarations-----------------------------
@@ -197,6 +247,28 @@ void set_applog_max_msg_len(int new_max_log_msg_len);
  */
 void set_applog_output_mode(int new_output_mode);
 
+/**
+ * @brief sets the format of the application log file
+ *
+ * @param[in]  new_format  KMYTH_APPLOG_FORMAT_TEXT or
+ *                         KMYTH_APPLOG_FORMAT_JSON
+ *
+ * @return None
+ */
+void set_applog_format(int new_format);
+
+/**
+ * @brief sets the operation ID included with the calling thread's
+ *        subsequent log messages (e.g., to correlate those logged while
+ *        handling one request)
+ *
+ * @param[in]  operation_id  the operation ID (truncated to
+ *                           MAX_LOG_OPERATION_ID_LEN), or NULL to clear it
+ *
+ * @return None
+ */
+void set_log_operation_id(const char *operation_id);
+
 /**
  * @brief sets "severity threshold" for application logging
  *
@@ -248,6 +320,27 @@ void set_applog_severity_threshold(int new_syslog_facility);
  */
 void set_syslog_severity_threshold(int new_severity_threshold);
 
+/**
+ * @brief sets the rate limit applied to the messages logged from each call
+ *        site (source file and line).
+ *
+ * Each call site has a token bucket, holding up to burst tokens and
+ * refilled at messages_per_sec tokens per second: a message is logged if
+ * it can take a token, and otherwise suppressed (before it is formatted).
+ * The next message logged from a call site that has had messages
+ * suppressed is preceded by a summary noting how many were.
+ *
+ * @param[in]  messages_per_sec  the sustained rate (1 or more) allowed
+ *                               from each call site, or 0 to disable rate
+ *                               limiting
+ *
+ * @param[in]  burst             the number of messages (1 or more) a call
+ *                               site may log at once, above that rate
+ *
+ * @return None
+ */
+void set_log_rate_limit(int messages_per_sec, int burst);
+
 /**
  * @brief 
  *
@@ -332,9 +425,144 @@ void log_event(const char *src_file,
                const char *message, ...);
 
 /**
- * @brief macro used to specify common initial three kmyth_log() parameters
+ * @brief Records a log for kmyth, as for log_event(), along with the
+ *        duration of the operation being reported
+ *
+ * @param[in] src_file    The source file recording the log
+ *
+ * @param[in] src_func    The source function recording the log
+ *
+ * @param[in] src_line    The line in the source file recording the log
+ *
+ * @param[in] severity    Indicates the "severity level" of the message
+ *
+ * @param[in] duration_ns The duration (in nanoseconds) being reported
+ *
+ * @param[in] message     format specification for string of log to be
+ *                        recorded
+ *
+ * @param[in] ...         arguments for message format spec
+ *
+ * @return None
+ */
+void log_event_duration(const char *src_file,
+                        const char *src_func, const int src_line,
+                        int severity, int64_t duration_ns,
+                        const char *message, ...);
+
+/**
+ * @brief starts async logging: log_event() then only formats each message
+ *        (and writes any stdout/stderr output) on the calling thread, and
+ *        queues it for a writer thread that keeps the log file and the
+ *        syslog connection open.
+ *
+ * The queue is a bounded, lock-free ring - a message logged while it is
+ * full is dropped (and counted) rather than blocking the caller, and the
+ * number dropped is noted in the log. The log file, and its format, are
+ * those set (with set_applog_path() and set_applog_format()) when async
+ * logging is started. Logging stops, and
+ * everything queued is written, when the application exits.
+ *
+ * @param[in]  capacity  number of messages that can be queued (rounded up
+ *                       to a power of two), or 0 for
+ *                       DEFAULT_ASYNC_LOG_CAPACITY
+ *
+ * @return 0 on success (or if already started), 1 on error (logging then
+ *         remains synchronous)
+ */
+int start_async_logging(size_t capacity);
+
+/**
+ * @brief stops async logging, after writing everything queued, and
+ *        returns to synchronous logging. Must not be called while other
+ *        threads are logging.
+ *
+ * @return None
+ */
+void stop_async_logging(void);
+
+/**
+ * @brief waits until every message queued (before the call) in async
+ *        logging mode has been written. Does nothing otherwise.
+ *
+ * @return None
+ */
+void flush_async_logging(void);
+
+/**
+ * @brief gets the async logging counters (accumulated over every time async
+ *        logging has been started)
+ *
+ * @param[out] queued   number of messages queued (may be NULL)
+ *
+ * @param[out] written  number of queued messages written (may be NULL)
+ *
+ * @param[out] dropped  number of messages dropped because the queue was
+ *                      full (may be NULL)
+ *
+ * @return None
+ */
+void get_async_logging_stats(uint64_t * queued, uint64_t * written,
+                             uint64_t * dropped);
+
+/**
+ * @brief the least severe (largest) severity value that is logged anywhere,
+ *        i.e., the larger of the application log and syslog severity
+ *        thresholds. Kept up to date by set_applog_severity_threshold() and
+ *        set_syslog_severity_threshold(), so that kmyth_log() can skip a
+ *        disabled message with a single comparison.
+ */
+extern int kmyth_log_severity_limit;
+
+/**
+ * @brief reads kmyth_log_severity_limit, which another thread may be
+ *        changing (with a relaxed atomic load - a message logged while the
+ *        threshold changes may or may not be skipped)
+ */
+#define KMYTH_LOG_SEVERITY_LIMIT                                            \
+  __atomic_load_n(&kmyth_log_severity_limit, __ATOMIC_RELAXED)
+
+/**
+ * @brief evaluates to 0 for messages compiled out of the build, so that
+ *        (with KMYTH_LOG_STRIP_DEBUG defined, e.g., for release builds) the
+ *        compiler drops LOG_DEBUG kmyth_log() calls and their arguments
+ *        entirely
+ */
+#ifdef KMYTH_LOG_STRIP_DEBUG
+#define KMYTH_LOG_COMPILED(severity) (LOG_PRI(severity) < LOG_DEBUG)
+#else
+#define KMYTH_LOG_COMPILED(severity) 1
+#endif
+
+/**
+ * @brief macro used to specify common initial three kmyth_log() parameters.
+ *        A message above kmyth_log_severity_limit is skipped without
+ *        formatting it (or evaluating its arguments).
+ */
+#define kmyth_log(severity, ...)                                            \
+  do                                                                        \
+  {                                                                         \
+    if (KMYTH_LOG_COMPILED(severity) &&                                     \
+        LOG_PRI(severity) <= KMYTH_LOG_SEVERITY_LIMIT)                      \
+    {                                                                       \
+      log_event(__FILE__, __func__, __LINE__, (severity), __VA_ARGS__);     \
+    }                                                                       \
+  } while (0)
+
+/**
+ * @brief as kmyth_log(), but also records the duration (in nanoseconds) of
+ *        the operation being reported
  */
-#define kmyth_log(...) log_event(__FILE__, __func__, __LINE__, __VA_ARGS__)
+#define kmyth_log_duration(severity, duration_ns, ...)                      \
+  do                                                                        \
+  {                                                                         \
+    if (KMYTH_LOG_COMPILED(severity) &&                                     \
+        LOG_PRI(severity) <= KMYTH_LOG_SEVERITY_LIMIT)                      \
+    {                                                                       \
+      log_event_duration(__FILE__, __func__, __LINE__, (severity),          \
+                         (duration_ns), __VA_ARGS__);                       \
+    }                                                                       \
+  } while (0)
 
 #ifdef __cplusplus
 }
@@ -6,60 +6,174 @@
 
 #include "kmyth_log.h"
 
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <time.h>
 
+// the longest message set_applog_max_msg_len() allows
+#define ASYNC_LOG_MAX_MSG_LEN 1024
 
-static struct log_params log_settings = {
-  .app_name = DEFAULT_APP_NAME,
-  .app_name_len = strlen(DEFAULT_APP_NAME),
-  .app_version = DEFAULT_APP_VERSION,
-  .app_version_len = strlen(DEFAULT_APP_VERSION),
-  .applog_path = DEFAULT_APPLOG_PATH,
-  .applog_path_len = strlen(DEFAULT_APPLOG_PATH),
-  .applog_max_msg_len = DEFAULT_MAX_LOG_MSG_LEN,
-  .applog_output_mode = KMYTH_APPLOG_OUTPUT_MODE_DEFAULT,
-  .applog_severity_threshold = KMYTH_APPLOG_SEVERITY_THRESHOLD_DEFAULT,
-  .syslog_facility = SYSLOG_FACILITY_DEFAULT,
-  .syslog_severity_threshold = SYSLOG_SEVERITY_THRESHOLD_DEFAULT,
+// source locations are copied into a queued message, as the caller's
+// strings are not necessarily static (e.g., those from an SGX ocall)
+#define ASYNC_LOG_MAX_SRC_LEN 128
+
+// number of call sites whose log rate is tracked (a power of two), and the
+// number of slots searched for a call site before it is logged unlimited
+#define LOG_RATE_SITES 256
+#define LOG_RATE_PROBES 8
+
+// the operation ID (if any) included with this thread's log messages
+static _Thread_local char log_operation_id[MAX_LOG_OPERATION_ID_LEN + 1];
+
+// The logging settings are published as immutable snapshots, so that a
+// thread logging a message reads one consistent set of settings without
+// taking a lock. A set_*() call copies the current snapshot, changes the
+// copy, and publishes it in place of the original. A replaced snapshot may
+// still be in use by a thread logging a message, so it is never freed - it
+// is kept (reachable) on the new snapshot's retired list instead. The
+// settings are normally only changed a handful of times, at start up.
+typedef struct log_settings_snapshot
+{
+  struct log_params params;
+  const struct log_settings_snapshot *retired;
+} log_settings_snapshot;
+
+static const log_settings_snapshot default_log_settings = {
+  .params = {
+             .app_name = DEFAULT_APP_NAME,
+             .app_name_len = strlen(DEFAULT_APP_NAME),
+             .app_version = DEFAULT_APP_VERSION,
+             .app_version_len = strlen(DEFAULT_APP_VERSION),
+             .applog_path = DEFAULT_APPLOG_PATH,
+             .applog_path_len = strlen(DEFAULT_APPLOG_PATH),
+             .applog_max_msg_len = DEFAULT_MAX_LOG_MSG_LEN,
+             .applog_output_mode = KMYTH_APPLOG_OUTPUT_MODE_DEFAULT,
+             .applog_severity_threshold =
+             KMYTH_APPLOG_SEVERITY_THRESHOLD_DEFAULT,
+             .applog_format = KMYTH_APPLOG_FORMAT_DEFAULT,
+             .syslog_facility = SYSLOG_FACILITY_DEFAULT,
+             .syslog_severity_threshold = SYSLOG_SEVERITY_THRESHOLD_DEFAULT,
+             .log_rate_limit = DEFAULT_LOG_RATE_LIMIT,
+             .log_rate_burst = DEFAULT_LOG_RATE_BURST,
+             },
+  .retired = NULL,
 };
 
+static _Atomic(const log_settings_snapshot *) log_settings =
+  &default_log_settings;
+
+// serializes the set_*() calls (each replaces the current snapshot)
+static pthread_mutex_t log_settings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// the formatted message being logged by this thread
+static _Thread_local char log_event_out[ASYNC_LOG_MAX_MSG_LEN + 1];
+
+int kmyth_log_severity_limit =
+  (KMYTH_APPLOG_SEVERITY_THRESHOLD_DEFAULT >
+   SYSLOG_SEVERITY_THRESHOLD_DEFAULT) ?
+  KMYTH_APPLOG_SEVERITY_THRESHOLD_DEFAULT : SYSLOG_SEVERITY_THRESHOLD_DEFAULT;
+
+//############################################################################
+// get_log_settings()
+//############################################################################
+static const struct log_params *get_log_settings(void)
+{
+  return &atomic_load_explicit(&log_settings, memory_order_acquire)->params;
+}
+
+//############################################################################
+// edit_log_settings()
+//   - returns a (private) copy of the current settings to be changed and
+//     then passed to publish_log_settings(), or NULL on error
+//############################################################################
+static struct log_params *edit_log_settings(const char *caller)
+{
+  pthread_mutex_lock(&log_settings_lock);
+
+  log_settings_snapshot *next = malloc(sizeof(log_settings_snapshot));
+
+  if (next == NULL)
+  {
+    pthread_mutex_unlock(&log_settings_lock);
+    fprintf(stderr, "%s(): unable to allocate settings - unchanged\n",
+            caller);
+    return NULL;
+  }
+
+  const log_settings_snapshot *current =
+    atomic_load_explicit(&log_settings, memory_order_relaxed);
+
+  next->params = current->params;
+  next->retired = current;
+
+  return &next->params;
+}
+
+//############################################################################
+// publish_log_settings()
+//############################################################################
+static void publish_log_settings(struct log_params *params)
+{
+  // params is the first member of the snapshot edit_log_settings() made
+  log_settings_snapshot *next = (log_settings_snapshot *) params;
+  int limit = (params->applog_severity_threshold >
+               params->syslog_severity_threshold) ?
+    params->applog_severity_threshold : params->syslog_severity_threshold;
+
+  __atomic_store_n(&kmyth_log_severity_limit, limit, __ATOMIC_RELAXED);
+  atomic_store_explicit(&log_settings, next, memory_order_release);
+
+  pthread_mutex_unlock(&log_settings_lock);
+}
+
 //############################################################################
 // set_app_name()
 //############################################################################
 void set_app_name(const char *new_app_name)
 {
+  struct log_params *settings = edit_log_settings(__func__);
   bool truncated = false;
   size_t temp_len = 0;
 
+  if (settings == NULL)
+  {
+    return;
+  }
+
   temp_len = strnlen(new_app_name, MAX_APP_NAME_LEN + 1);
   if (temp_len <= MAX_APP_NAME_LEN)
   {
-    log_settings.app_name_len = temp_len;
+    settings->app_name_len = temp_len;
   }
   else
   {
     // truncate application name if it is too long
-    log_settings.app_name_len = MAX_APP_NAME_LEN;
+    settings->app_name_len = MAX_APP_NAME_LEN;
     truncated = true;
   }
 
-  strncpy(log_settings.app_name, new_app_name, log_settings.app_name_len);
+  strncpy(settings->app_name, new_app_name, settings->app_name_len);
 
   // ensure application name string is null terminated
-  log_settings.app_name[log_settings.app_name_len] = '\0';
+  settings->app_name[settings->app_name_len] = '\0';
 
   // if application name was truncated, notify user 
   if (truncated == true)
   {
     fprintf(stderr, "set_app_name(): input \"%s\" ", new_app_name);
-    fprintf(stderr, "truncated to \"%s\"\n", log_settings.app_name);
+    fprintf(stderr, "truncated to \"%s\"\n", settings->app_name);
   }
+
+  publish_log_settings(settings);
 }
 
 //############################################################################
@@ -67,33 +181,41 @@ void set_app_name(const char *new_app_name)
 //############################################################################
 void set_app_version(const char *new_app_version)
 {
+  struct log_params *settings = edit_log_settings(__func__);
   bool truncated = false;
   size_t temp_len = 0;
 
+  if (settings == NULL)
+  {
+    return;
+  }
+
   temp_len = strnlen(new_app_version, MAX_APP_VERSION_LEN + 1);
   if (temp_len <= MAX_APP_VERSION_LEN)
   {
-    log_settings.app_version_len = temp_len;
+    settings->app_version_len = temp_len;
   }
   else
   {
     // truncate application version string if it is too long
-    log_settings.app_version_len = MAX_APP_VERSION_LEN;
+    settings->app_version_len = MAX_APP_VERSION_LEN;
     truncated = true;
   }
 
-  strncpy(log_settings.app_version,
-          new_app_version, log_settings.app_version_len);
+  strncpy(settings->app_version,
+          new_app_version, settings->app_version_len);
 
   // ensure application name string is null terminated
-  log_settings.app_version[log_settings.app_version_len] = '\0';
+  settings->app_version[settings->app_version_len] = '\0';
 
   // if application name was truncated, notify user 
   if (truncated == true)
   {
     fprintf(stderr, "set_app_version(): input \"%s\" ", new_app_version);
-    fprintf(stderr, "truncated to \"%s\"\n", log_settings.app_version);
+    fprintf(stderr, "truncated to \"%s\"\n", settings->app_version);
   }
+
+  publish_log_settings(settings);
 }
 
 //############################################################################
@@ -106,12 +228,19 @@ void set_applog_path(const char *new_applog_path)
   temp_len = strnlen(new_applog_path, MAX_APPLOG_PATH_LEN + 1);
   if (temp_len <= MAX_APPLOG_PATH_LEN)
   {
-    log_settings.applog_path_len = temp_len;
-    strncpy(log_settings.applog_path,
-            new_applog_path, log_settings.applog_path_len);
+    struct log_params *settings = edit_log_settings(__func__);
+
+    if (settings == NULL)
+    {
+      return;
+    }
+    settings->applog_path_len = temp_len;
+    strncpy(settings->applog_path,
+            new_applog_path, settings->applog_path_len);
 
     // ensure log directory string is null terminated
-    log_settings.applog_path[log_settings.applog_path_len] = '\0';
+    settings->applog_path[settings->applog_path_len] = '\0';
+    publish_log_settings(settings);
   }
   else
   {
@@ -119,27 +248,36 @@ void set_applog_path(const char *new_applog_path)
     fprintf(stderr, "set_applog_path(): ");
     fprintf(stderr, "input \"%s\" exceeds maximum length ", new_applog_path);
     fprintf(stderr, "(%d) - application log path ", MAX_APPLOG_PATH_LEN);
-    fprintf(stderr, "remains \"%s\"\n", log_settings.applog_path);
+    fprintf(stderr, "remains \"%s\"\n", get_log_settings()->applog_path);
   }
 }
 
 
 //############################################################################
 // set_applog_max_msg_len()
-//   - valid values: 0 thru 1024
+//   - valid values: 0 thru ASYNC_LOG_MAX_MSG_LEN (1024)
 //############################################################################
 void set_applog_max_msg_len(int new_max_log_msg_len)
 {
-  if ((new_max_log_msg_len >= 0) && (new_max_log_msg_len <= 1024))
+  if ((new_max_log_msg_len >= 0) &&
+      (new_max_log_msg_len <= ASYNC_LOG_MAX_MSG_LEN))
   {
-    log_settings.applog_max_msg_len = new_max_log_msg_len;
+    struct log_params *settings = edit_log_settings(__func__);
+
+    if (settings == NULL)
+    {
+      return;
+    }
+    settings->applog_max_msg_len = new_max_log_msg_len;
+    publish_log_settings(settings);
   }
   else
   {
     // do nothing if invalid, but warn user
     fprintf(stderr, "set_applog_max_msg_len(): ");
     fprintf(stderr, "input (%d) invalid ", new_max_log_msg_len);
-    fprintf(stderr, "- unchanged (%d)\n", log_settings.applog_max_msg_len);
+    fprintf(stderr, "- unchanged (%d)\n",
+            get_log_settings()->applog_max_msg_len);
   }
 }
 
@@ -151,15 +289,65 @@ void set_applog_output_mode(int new_output_mode)
 {
   if ((new_output_mode >= 0) && (new_output_mode <= 2))
   {
-    log_settings.applog_output_mode = new_output_mode;
+    struct log_params *settings = edit_log_settings(__func__);
+
+    if (settings == NULL)
+    {
+      return;
+    }
+    settings->applog_output_mode = new_output_mode;
+    publish_log_settings(settings);
   }
   else
   {
     // do nothing if invalid, but warn user
     fprintf(stderr, "set_applog_output_mode(): ");
     fprintf(stderr, "input (%d) invalid ", new_output_mode);
-    fprintf(stderr, "- unchanged (%d)\n", log_settings.applog_output_mode);
+    fprintf(stderr, "- unchanged (%d)\n",
+            get_log_settings()->applog_output_mode);
+  }
+}
+
+//############################################################################
+// set_applog_format()
+//   - valid values: KMYTH_APPLOG_FORMAT_TEXT or KMYTH_APPLOG_FORMAT_JSON
+//############################################################################
+void set_applog_format(int new_format)
+{
+  if ((new_format == KMYTH_APPLOG_FORMAT_TEXT) ||
+      (new_format == KMYTH_APPLOG_FORMAT_JSON))
+  {
+    struct log_params *settings = edit_log_settings(__func__);
+
+    if (settings == NULL)
+    {
+      return;
+    }
+    settings->applog_format = new_format;
+    publish_log_settings(settings);
   }
+  else
+  {
+    // do nothing if invalid, but warn user
+    fprintf(stderr, "set_applog_format(): ");
+    fprintf(stderr, "input (%d) invalid ", new_format);
+    fprintf(stderr, "- unchanged (%d)\n", get_log_settings()->applog_format);
+  }
+}
+
+//############################################################################
+// set_log_operation_id()
+//############################################################################
+void set_log_operation_id(const char *operation_id)
+{
+  if (operation_id == NULL)
+  {
+    log_operation_id[0] = '\0';
+    return;
+  }
+
+  strncpy(log_operation_id, operation_id, MAX_LOG_OPERATION_ID_LEN);
+  log_operation_id[MAX_LOG_OPERATION_ID_LEN] = '\0';
 }
 
 //############################################################################
@@ -170,14 +358,21 @@ void set_applog_severity_threshold(int new_severity_threshold)
 {
   if ((new_severity_threshold >= 0) && (new_severity_threshold <= 7))
   {
-    log_settings.applog_severity_threshold = new_severity_threshold;
+    struct log_params *settings = edit_log_settings(__func__);
+
+    if (settings == NULL)
+    {
+      return;
+    }
+    settings->applog_severity_threshold = new_severity_threshold;
+    publish_log_settings(settings);
   }
   else
   {
     // do nothing if invalid, but warn user
     fprintf(stderr, "set_applog_severity_threshold(): ");
     fprintf(stderr, "input (%d) invalid - unchanged ", new_severity_threshold);
-    fprintf(stderr, "(%d)\n", log_settings.applog_severity_threshold);
+    fprintf(stderr, "(%d)\n", get_log_settings()->applog_severity_threshold);
   }
 }
 
@@ -192,7 +387,14 @@ void set_syslog_facility(int new_syslog_facility)
   if ((LOG_FAC(new_syslog_facility) >= 0) &&
       (LOG_FAC(new_syslog_facility) <= (LOG_NFACILITIES - 1)))
   {
-    log_settings.syslog_facility = new_syslog_facility;
+    struct log_params *settings = edit_log_settings(__func__);
+
+    if (settings == NULL)
+    {
+      return;
+    }
+    settings->syslog_facility = new_syslog_facility;
+    publish_log_settings(settings);
   }
   else
   {
@@ -200,7 +402,7 @@ void set_syslog_facility(int new_syslog_facility)
     fprintf(stderr, "set_syslog_facility(): ");
     fprintf(stderr, "input (%d) ", LOG_FAC(new_syslog_facility));
     fprintf(stderr, "invalid - unchanged ");
-    fprintf(stderr, "(%d)\n", LOG_FAC(log_settings.syslog_facility));
+    fprintf(stderr, "(%d)\n", LOG_FAC(get_log_settings()->syslog_facility));
   }
 }
 
@@ -212,14 +414,50 @@ void set_syslog_severity_threshold(int new_severity_threshold)
 {
   if ((new_severity_threshold >= 0) && (new_severity_threshold <= 7))
   {
-    log_settings.syslog_severity_threshold = new_severity_threshold;
+    struct log_params *settings = edit_log_settings(__func__);
+
+    if (settings == NULL)
+    {
+      return;
+    }
+    settings->syslog_severity_threshold = new_severity_threshold;
+    publish_log_settings(settings);
   }
   else
   {
     // do nothing if invalid, but warn user
     fprintf(stderr, "set_syslog_severity_threshold(): ");
     fprintf(stderr, "input (%d) invalid - unchanged ", new_severity_threshold);
-    fprintf(stderr, "(%d)\n", log_settings.syslog_severity_threshold);
+    fprintf(stderr, "(%d)\n", get_log_settings()->syslog_severity_threshold);
+  }
+}
+
+//############################################################################
+// set_log_rate_limit()
+//   - valid values: messages_per_sec >= 0 (0 disables), burst >= 1
+//############################################################################
+void set_log_rate_limit(int messages_per_sec, int burst)
+{
+  if ((messages_per_sec >= 0) && (burst >= 1))
+  {
+    struct log_params *settings = edit_log_settings(__func__);
+
+    if (settings == NULL)
+    {
+      return;
+    }
+    settings->log_rate_limit = messages_per_sec;
+    settings->log_rate_burst = burst;
+    publish_log_settings(settings);
+  }
+  else
+  {
+    // do nothing if invalid, but warn user
+    fprintf(stderr, "set_log_rate_limit(): ");
+    fprintf(stderr, "input (%d/s, burst %d) invalid - unchanged ",
+            messages_per_sec, burst);
+    fprintf(stderr, "(%d/s, burst %d)\n", get_log_settings()->log_rate_limit,
+            get_log_settings()->log_rate_burst);
   }
 }
 
@@ -286,33 +524,628 @@ FILE *get_stddest(int severity_val_in)
 }
 
 //############################################################################
-// log_event()
+// print_stddest_entry()
 //############################################################################
-void log_event(const char *src_file,
-               const char *src_func,
-               const int src_line, int severity, const char *message, ...)
+static void print_stddest_entry(const struct log_params *settings,
+                                FILE * stddest, const char *severity_string,
+                                const char *src_file, const char *src_func,
+                                int src_line, const char *out)
 {
+  // the full prefix and source location are only shown in verbose mode
+  if (settings->applog_severity_threshold > LOG_INFO)
+  {
+    fprintf(stddest, "%s-%s %s - %s(%s:%d) %s\n",
+            settings->app_name, settings->app_version,
+            severity_string, src_file, src_func, src_line, out);
+  }
+  else
+  {
+    fprintf(stddest, "%s - %s\n", severity_string, out);
+  }
+}
 
-  // format log message (vsnprintf() count parameter includes null terminator)
-  char out[log_settings.applog_max_msg_len + 1];
-  va_list args;
+//############################################################################
+// print_json_string()
+//############################################################################
+static void print_json_string(FILE * logfile, const char *str)
+{
+  // written a character at a time (into the stream's buffer), so escaping
+  // needs no copy of the string
+  fputc('"', logfile);
+  for (const unsigned char *c = (const unsigned char *) str; *c != '\0'; c++)
+  {
+    switch (*c)
+    {
+    case '"':
+      fputs("\\\"", logfile);
+      break;
+    case '\\':
+      fputs("\\\\", logfile);
+      break;
+    case '\n':
+      fputs("\\n", logfile);
+      break;
+    case '\r':
+      fputs("\\r", logfile);
+      break;
+    case '\t':
+      fputs("\\t", logfile);
+      break;
+    default:
+      if (*c < 0x20)
+      {
+        fprintf(logfile, "\\u%04x", (unsigned int) *c);
+      }
+      else
+      {
+        fputc(*c, logfile);
+      }
+    }
+  }
+  fputc('"', logfile);
+}
 
-  va_start(args, message);
-  vsnprintf(out, (size_t)log_settings.applog_max_msg_len + 1, message, args);
-  va_end(args);
+//############################################################################
+// print_logfile_entry()
+//############################################################################
+static void print_logfile_entry(const struct log_params *settings,
+                                FILE * logfile, int format,
+                                const char *severity_string,
+                                const struct timespec *ts,
+                                const char *src_file, const char *src_func,
+                                int src_line, const char *operation_id,
+                                int64_t duration_ns, const char *out)
+{
+  char timestamp[32];
+  struct tm tm_ts;
 
-  // force severity to a valid value by masking (only use three lowest bits)
-  severity = LOG_PRI(severity);
+  if (format == KMYTH_APPLOG_FORMAT_JSON)
+  {
+    // one object per line, with an RFC 3339 (UTC, microsecond) timestamp
+    strftime(timestamp, sizeof(timestamp), "%FT%T",
+             gmtime_r(&ts->tv_sec, &tm_ts));
+    fprintf(logfile, "{\"ts\":\"%s.%06ldZ\",\"severity\":\"%s\",\"app\":",
+            timestamp, ts->tv_nsec / 1000, severity_string);
+    print_json_string(logfile, settings->app_name);
+    fputs(",\"version\":", logfile);
+    print_json_string(logfile, settings->app_version);
+    fputs(",\"file\":", logfile);
+    print_json_string(logfile, src_file);
+    fputs(",\"func\":", logfile);
+    print_json_string(logfile, src_func);
+    fprintf(logfile, ",\"line\":%d,\"msg\":", src_line);
+    print_json_string(logfile, out);
+    if (operation_id != NULL && operation_id[0] != '\0')
+    {
+      fputs(",\"operation_id\":", logfile);
+      print_json_string(logfile, operation_id);
+    }
+    if (duration_ns >= 0)
+    {
+      fprintf(logfile, ",\"duration_ns\":%lld", (long long) duration_ns);
+    }
+    fputs("}\n", logfile);
+    return;
+  }
+
+  // yyyy-mm-dd hh:mm:ss
+  strftime(timestamp, 20, "%F %T", localtime_r(&ts->tv_sec, &tm_ts));
+
+  fprintf(logfile, "%s-%s %s %s - %s(%s:%d) %s",
+          settings->app_name, settings->app_version,
+          severity_string, timestamp, src_file, src_func, src_line, out);
+  if (operation_id != NULL && operation_id[0] != '\0')
+  {
+    fprintf(logfile, " [%s]", operation_id);
+  }
+  if (duration_ns >= 0)
+  {
+    fprintf(logfile, " (%.3f ms)", (double) duration_ns / 1e6);
+  }
+  fputc('\n', logfile);
+}
+
+// One message queued for the async logging writer thread. A slot's seq
+// is its ring position while free and one more than that once the
+// message in it is ready to be written.
+typedef struct
+{
+  atomic_size_t seq;
+  char src_file[ASYNC_LOG_MAX_SRC_LEN + 1];
+  char src_func[ASYNC_LOG_MAX_SRC_LEN + 1];
+  int src_line;
+  int severity;
+  bool to_logfile;
+  struct timespec ts;
+  char operation_id[MAX_LOG_OPERATION_ID_LEN + 1];
+  int64_t duration_ns;
+  char out[ASYNC_LOG_MAX_MSG_LEN + 1];
+} async_log_record;
+
+// Async logging state: a bounded, lock-free ring of records (any number
+// of logging threads claim slots with a compare-and-swap on head) that
+// is drained, in order, by a single writer thread
+static struct
+{
+  async_log_record *ring;
+  size_t capacity;
+  atomic_size_t head;
+  size_t tail;
+  atomic_bool running;
+  atomic_bool stopping;
+  sem_t pending;
+  pthread_t writer;
+  FILE *logfile;
+  int logfile_format;
+  atomic_uint_least64_t queued;
+  atomic_uint_least64_t written;
+  atomic_uint_least64_t dropped;
+  uint64_t dropped_reported;
+  pthread_mutex_t flush_lock;
+  pthread_cond_t flushed;
+  bool exit_hook_set;
+} async_log = {
+  .flush_lock = PTHREAD_MUTEX_INITIALIZER,
+  .flushed = PTHREAD_COND_INITIALIZER,
+};
+
+//############################################################################
+// write_async_records()
+//############################################################################
+static void write_async_records(void)
+{
+  bool wrote = false;
+
+  for (;;)
+  {
+    async_log_record *record =
+      &async_log.ring[async_log.tail & (async_log.capacity - 1)];
+
+    if (atomic_load_explicit(&record->seq, memory_order_acquire) !=
+        async_log.tail + 1)
+    {
+      break;
+    }
+
+    syslog(record->severity, "%s", record->out);
+    if (record->to_logfile)
+    {
+      char *severity_string = NULL;
+
+      get_severity_str(record->severity, &severity_string);
+      print_logfile_entry(get_log_settings(), async_log.logfile,
+                          async_log.logfile_format,
+                          severity_string, &record->ts,
+                          record->src_file, record->src_func,
+                          record->src_line, record->operation_id,
+                          record->duration_ns, record->out);
+      free(severity_string);
+    }
+
+    // hand the slot back to the producers, for the next lap of the ring
+    atomic_store_explicit(&record->seq, async_log.tail + async_log.capacity,
+                          memory_order_release);
+    async_log.tail++;
+    atomic_fetch_add(&async_log.written, 1);
+    wrote = true;
+  }
+
+  // note any messages dropped (while the ring was full) since the last
+  // time, so that the gap in the log is visible
+  uint64_t dropped = atomic_load(&async_log.dropped);
+
+  if (dropped != async_log.dropped_reported)
+  {
+    char out[64];
+
+    snprintf(out, sizeof(out), "%lu log messages dropped (queue full)",
+             (unsigned long) (dropped - async_log.dropped_reported));
+    syslog(LOG_WARNING, "%s", out);
+    if (async_log.logfile != NULL)
+    {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_REALTIME, &ts);
+      print_logfile_entry(get_log_settings(), async_log.logfile,
+                          async_log.logfile_format, "WARNING", &ts,
+                          __FILE__, __func__, __LINE__, NULL, -1, out);
+    }
+    async_log.dropped_reported = dropped;
+    wrote = true;
+  }
+
+  if (wrote)
+  {
+    if (async_log.logfile != NULL)
+    {
+      fflush(async_log.logfile);
+    }
+    pthread_mutex_lock(&async_log.flush_lock);
+    pthread_cond_broadcast(&async_log.flushed);
+    pthread_mutex_unlock(&async_log.flush_lock);
+  }
+}
+
+//############################################################################
+// async_log_writer()
+//############################################################################
+static void *async_log_writer(void *arg)
+{
+  (void) arg;
+
+  // every queued message posts the semaphore once, but each wake up writes
+  // everything that is ready, so some wake ups find nothing to do
+  while (!atomic_load(&async_log.stopping))
+  {
+    while (sem_wait(&async_log.pending) != 0)
+    {
+    }
+    write_async_records();
+  }
+  write_async_records();
+
+  return NULL;
+}
+
+//############################################################################
+// start_async_logging()
+//############################################################################
+int start_async_logging(size_t capacity)
+{
+  if (atomic_load(&async_log.running))
+  {
+    return 0;
+  }
+
+  // the ring's capacity is rounded up to a power of two, so that a
+  // position maps to its slot with a mask
+  size_t slots = 1;
+
+  if (capacity == 0)
+  {
+    capacity = DEFAULT_ASYNC_LOG_CAPACITY;
+  }
+  while (slots < capacity && slots <= SIZE_MAX / 2)
+  {
+    slots *= 2;
+  }
+
+  async_log.ring = calloc(slots, sizeof(async_log_record));
+  if (async_log.ring == NULL)
+  {
+    fprintf(stderr, "start_async_logging(): unable to allocate log queue\n");
+    return 1;
+  }
+  for (size_t i = 0; i < slots; i++)
+  {
+    atomic_init(&async_log.ring[i].seq, i);
+  }
+  async_log.capacity = slots;
+  atomic_store(&async_log.head, 0);
+  async_log.tail = 0;
+  atomic_store(&async_log.stopping, false);
+  async_log.dropped_reported = atomic_load(&async_log.dropped);
+
+  if (sem_init(&async_log.pending, 0, 0) != 0)
+  {
+    fprintf(stderr, "start_async_logging(): unable to create semaphore\n");
+    free(async_log.ring);
+    async_log.ring = NULL;
+    return 1;
+  }
+
+  // the log file and syslog connection stay open until logging stops
+  // (the log file, and its format, are those set when async logging is
+  // started)
+  const struct log_params *settings = get_log_settings();
+
+  async_log.logfile = fopen(settings->applog_path, "a");
+  async_log.logfile_format = settings->applog_format;
+  setlogmask(LOG_UPTO(settings->syslog_severity_threshold));
+  openlog(settings->app_name,
+          LOG_CONS | LOG_PID | LOG_NDELAY, settings->syslog_facility);
+
+  if (pthread_create(&async_log.writer, NULL, async_log_writer, NULL) != 0)
+  {
+    fprintf(stderr, "start_async_logging(): unable to start writer\n");
+    closelog();
+    if (async_log.logfile != NULL)
+    {
+      fclose(async_log.logfile);
+      async_log.logfile = NULL;
+    }
+    sem_destroy(&async_log.pending);
+    free(async_log.ring);
+    async_log.ring = NULL;
+    return 1;
+  }
+
+  // flush whatever is still queued when the application exits
+  if (!async_log.exit_hook_set && atexit(stop_async_logging) == 0)
+  {
+    async_log.exit_hook_set = true;
+  }
+
+  atomic_store(&async_log.running, true);
+
+  return 0;
+}
+
+//############################################################################
+// stop_async_logging()
+//############################################################################
+void stop_async_logging(void)
+{
+  if (!atomic_exchange(&async_log.running, false))
+  {
+    return;
+  }
+
+  atomic_store(&async_log.stopping, true);
+  sem_post(&async_log.pending);
+  pthread_join(async_log.writer, NULL);
 
-  // log to centralized syslog facility
-  setlogmask(LOG_UPTO(log_settings.syslog_severity_threshold));
-  openlog(log_settings.app_name,
-          LOG_CONS | LOG_PID | LOG_NDELAY, log_settings.syslog_facility);
-  syslog(severity, "%s", out);
   closelog();
+  if (async_log.logfile != NULL)
+  {
+    fclose(async_log.logfile);
+    async_log.logfile = NULL;
+  }
+  sem_destroy(&async_log.pending);
+  free(async_log.ring);
+  async_log.ring = NULL;
+  async_log.capacity = 0;
+}
+
+//############################################################################
+// flush_async_logging()
+//############################################################################
+void flush_async_logging(void)
+{
+  if (!atomic_load(&async_log.running))
+  {
+    return;
+  }
+
+  uint64_t target = atomic_load(&async_log.queued);
+
+  pthread_mutex_lock(&async_log.flush_lock);
+  while (atomic_load(&async_log.written) < target &&
+         atomic_load(&async_log.running))
+  {
+    pthread_cond_wait(&async_log.flushed, &async_log.flush_lock);
+  }
+  pthread_mutex_unlock(&async_log.flush_lock);
+}
+
+//############################################################################
+// get_async_logging_stats()
+//############################################################################
+void get_async_logging_stats(uint64_t * queued, uint64_t * written,
+                             uint64_t * dropped)
+{
+  if (queued != NULL)
+  {
+    *queued = atomic_load(&async_log.queued);
+  }
+  if (written != NULL)
+  {
+    *written = atomic_load(&async_log.written);
+  }
+  if (dropped != NULL)
+  {
+    *dropped = atomic_load(&async_log.dropped);
+  }
+}
+
+//############################################################################
+// log_event_async()
+//############################################################################
+static void log_event_async(const struct log_params *settings,
+                            const char *src_file, const char *src_func,
+                            int src_line, int severity, int64_t duration_ns,
+                            const char *out)
+{
+  bool applog = (severity <= settings->applog_severity_threshold);
+  bool to_logfile = (applog && async_log.logfile != NULL);
+
+  // the console output is written straight away, so that it stays in
+  // order with the application's own output
+  if (applog && (settings->applog_output_mode == 0 ||
+                 (settings->applog_output_mode == 1 &&
+                  async_log.logfile == NULL)))
+  {
+    char *severity_string = NULL;
+
+    get_severity_str(severity, &severity_string);
+    print_stddest_entry(settings, get_stddest(severity), severity_string,
+                        src_file, src_func, src_line, out);
+    free(severity_string);
+  }
+
+  // nothing to queue if syslog would discard the message anyway
+  if (!to_logfile && severity > settings->syslog_severity_threshold)
+  {
+    return;
+  }
+
+  size_t pos = atomic_load_explicit(&async_log.head, memory_order_relaxed);
+  async_log_record *record = NULL;
+
+  for (;;)
+  {
+    record = &async_log.ring[pos & (async_log.capacity - 1)];
+
+    size_t seq = atomic_load_explicit(&record->seq, memory_order_acquire);
+
+    if (seq == pos)
+    {
+      if (atomic_compare_exchange_weak_explicit(&async_log.head, &pos,
+                                                pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if ((ptrdiff_t) (seq - pos) < 0)
+    {
+      // the ring is full - drop the message rather than block
+      atomic_fetch_add(&async_log.dropped, 1);
+      return;
+    }
+    else
+    {
+      pos = atomic_load_explicit(&async_log.head, memory_order_relaxed);
+    }
+  }
+
+  strncpy(record->src_file, src_file, ASYNC_LOG_MAX_SRC_LEN);
+  record->src_file[ASYNC_LOG_MAX_SRC_LEN] = '\0';
+  strncpy(record->src_func, src_func, ASYNC_LOG_MAX_SRC_LEN);
+  record->src_func[ASYNC_LOG_MAX_SRC_LEN] = '\0';
+  record->src_line = src_line;
+  record->severity = severity;
+  record->to_logfile = to_logfile;
+  clock_gettime(CLOCK_REALTIME, &record->ts);
+  memcpy(record->operation_id, log_operation_id,
+         sizeof(record->operation_id));
+  record->duration_ns = duration_ns;
+  strncpy(record->out, out, ASYNC_LOG_MAX_MSG_LEN);
+  record->out[ASYNC_LOG_MAX_MSG_LEN] = '\0';
+  atomic_store_explicit(&record->seq, pos + 1, memory_order_release);
+
+  atomic_fetch_add(&async_log.queued, 1);
+  sem_post(&async_log.pending);
+}
+
+// The token bucket limiting the rate of the messages logged from one call
+// site (tokens are messages)
+typedef struct
+{
+  bool used;
+  char src_file[ASYNC_LOG_MAX_SRC_LEN + 1];
+  int src_line;
+  double tokens;
+  int64_t refilled_ns;
+  uint64_t suppressed;
+} log_rate_site;
+
+// Rate limiting state: an open addressed table of call sites
+static struct
+{
+  pthread_mutex_t lock;
+  log_rate_site sites[LOG_RATE_SITES];
+} log_rate = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+//############################################################################
+// log_rate_allow()
+//   - takes a token from the call site's bucket, returning false (and
+//     counting the message as suppressed) if there is none, or true (and
+//     the number of messages suppressed since the last one logged)
+//############################################################################
+static bool log_rate_allow(const struct log_params *settings,
+                           const char *src_file, int src_line,
+                           uint64_t * suppressed)
+{
+  struct timespec now;
+  uint32_t hash = 2166136261u;
+  bool allow = true;
+
+  *suppressed = 0;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  int64_t now_ns = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+  // FNV-1a hash of the call site
+  for (const unsigned char *c = (const unsigned char *) src_file;
+       *c != '\0'; c++)
+  {
+    hash = (hash ^ *c) * 16777619u;
+  }
+  hash = (hash ^ (uint32_t) src_line) * 16777619u;
+
+  pthread_mutex_lock(&log_rate.lock);
+  for (size_t probe = 0; probe < LOG_RATE_PROBES; probe++)
+  {
+    log_rate_site *site =
+      &log_rate.sites[(hash + probe) & (LOG_RATE_SITES - 1)];
+
+    if (!site->used)
+    {
+      // the first message from this call site starts with a full bucket
+      site->used = true;
+      strncpy(site->src_file, src_file, ASYNC_LOG_MAX_SRC_LEN);
+      site->src_file[ASYNC_LOG_MAX_SRC_LEN] = '\0';
+      site->src_line = src_line;
+      site->tokens = settings->log_rate_burst;
+      site->refilled_ns = now_ns;
+      site->suppressed = 0;
+    }
+    else if (site->src_line != src_line ||
+             strncmp(site->src_file, src_file, ASYNC_LOG_MAX_SRC_LEN) != 0)
+    {
+      continue;
+    }
+
+    // refill the bucket for the time since it was last refilled
+    site->tokens += (double) (now_ns - site->refilled_ns) * 1e-9 *
+      settings->log_rate_limit;
+    if (site->tokens > settings->log_rate_burst)
+    {
+      site->tokens = settings->log_rate_burst;
+    }
+    site->refilled_ns = now_ns;
+
+    if (site->tokens >= 1.0)
+    {
+      site->tokens -= 1.0;
+      *suppressed = site->suppressed;
+      site->suppressed = 0;
+    }
+    else
+    {
+      site->suppressed++;
+      allow = false;
+    }
+    break;
+  }
+  pthread_mutex_unlock(&log_rate.lock);
+
+  // a call site not tracked (the table is full around its slot) is logged
+  // without a limit
+  return allow;
+}
+
+//############################################################################
+// log_event_entry()
+//############################################################################
+static void log_event_entry(const struct log_params *settings,
+                            const char *src_file, const char *src_func,
+                            int src_line, int severity, int64_t duration_ns,
+                            const char *out)
+{
+  if (atomic_load(&async_log.running))
+  {
+    log_event_async(settings, src_file, src_func, src_line, severity,
+                    duration_ns, out);
+    return;
+  }
+
+  // log to centralized syslog facility (unless syslog would discard it)
+  if (severity <= settings->syslog_severity_threshold)
+  {
+    setlogmask(LOG_UPTO(settings->syslog_severity_threshold));
+    openlog(settings->app_name,
+            LOG_CONS | LOG_PID | LOG_NDELAY, settings->syslog_facility);
+    syslog(severity, "%s", out);
+    closelog();
+  }
 
   // application logging
-  if (severity <= log_settings.applog_severity_threshold)
+  if (severity <= settings->applog_severity_threshold)
   {
     char *severity_string = NULL;
 
@@ -320,20 +1153,17 @@ void log_event(const char *src_file,
     get_severity_str(severity, &severity_string);
     FILE *stddest = get_stddest(severity);
 
-    char timestamp[20];
-    time_t ts = time(0);
+    struct timespec ts;
 
-    // Populate the timestamp string
-    // yyyy-mm-dd hh:mm:ss
-    strftime(timestamp, 20, "%F %T", localtime(&ts));
+    clock_gettime(CLOCK_REALTIME, &ts);
 
     // open log file for writing -- logfile is NULL if not available to user
-    FILE *logfile = fopen(log_settings.applog_path, "a");
+    FILE *logfile = fopen(settings->applog_path, "a");
 
     // This switch decides what to print and where.
     // When printing to logfile, timestamps are included, when printing to
     // stddest, they are not.
-    switch (log_settings.applog_output_mode)
+    switch (settings->applog_output_mode)
     {
       // output mode 0:
       //   print to both stddest (stdout/stderr) and log file (if available)
@@ -348,22 +1178,15 @@ void log_event(const char *src_file,
       //       with source location information. User can turn on detailed
       //       logging by using the --verbose (or -v) command line option.
     case 0:
-      if (log_settings.applog_severity_threshold > LOG_INFO)
-      {
-        fprintf(stddest, "%s-%s %s - %s(%s:%d) %s\n",
-                log_settings.app_name, log_settings.app_version,
-                severity_string, src_file, src_func, src_line, out);
-      }
-      else
-      {
-        fprintf(stddest, "%s - %s\n", severity_string, out);
-      }
+      print_stddest_entry(settings, stddest, severity_string,
+                          src_file, src_func, src_line, out);
 
       if (logfile != NULL)
       {
-        fprintf(logfile, "%s-%s %s %s - %s(%s:%d) %s\n",
-                log_settings.app_name, log_settings.app_version,
-                severity_string, timestamp, src_file, src_func, src_line, out);
+        print_logfile_entry(settings, logfile, settings->applog_format,
+                            severity_string, &ts,
+                            src_file, src_func, src_line, log_operation_id,
+                            duration_ns, out);
         fclose(logfile);
       }
       break;
@@ -394,22 +1217,15 @@ void log_event(const char *src_file,
     default:
       if (logfile == NULL)
       {
-        if (log_settings.applog_severity_threshold > LOG_INFO)
-        {
-          fprintf(stddest, "%s-%s %s - %s(%s:%d) %s\n",
-                  log_settings.app_name, log_settings.app_version,
-                  severity_string, src_file, src_func, src_line, out);
-        }
-        else
-        {
-          fprintf(stddest, "%s - %s\n", severity_string, out);
-        }
+        print_stddest_entry(settings, stddest, severity_string,
+                            src_file, src_func, src_line, out);
       }
       else
       {
-        fprintf(logfile, "%s-%s %s %s - %s(%s:%d) %s\n",
-                log_settings.app_name, log_settings.app_version,
-                severity_string, timestamp, src_file, src_func, src_line, out);
+        print_logfile_entry(settings, logfile, settings->applog_format,
+                            severity_string, &ts,
+                            src_file, src_func, src_line, log_operation_id,
+                            duration_ns, out);
         fclose(logfile);
       }
     }
@@ -418,3 +1234,87 @@ void log_event(const char *src_file,
     free(severity_string);
   }
 }
+
+//############################################################################
+// log_event_va()
+//############################################################################
+static void log_event_va(const char *src_file, const char *src_func,
+                         const int src_line, int severity,
+                         int64_t duration_ns, const char *message,
+                         va_list args)
+{
+  // skip a disabled message before doing any work for it (as kmyth_log()
+  // does, for callers of log_event() not using that macro)
+  if (!KMYTH_LOG_COMPILED(severity) ||
+      LOG_PRI(severity) > KMYTH_LOG_SEVERITY_LIMIT)
+  {
+    return;
+  }
+
+  // the whole message is logged with one snapshot of the settings, however
+  // they are changed meanwhile
+  const struct log_params *settings = get_log_settings();
+
+  // a message over its call site's rate limit is dropped before it is
+  // formatted
+  uint64_t suppressed = 0;
+
+  if (settings->log_rate_limit > 0 &&
+      !log_rate_allow(settings, src_file, src_line, &suppressed))
+  {
+    return;
+  }
+
+  // force severity to a valid value by masking (only use three lowest bits)
+  severity = LOG_PRI(severity);
+
+  if (suppressed > 0)
+  {
+    char summary[ASYNC_LOG_MAX_SRC_LEN + 96];
+
+    snprintf(summary, sizeof(summary),
+             "%llu messages from %s:%d suppressed (rate limited)",
+             (unsigned long long) suppressed, src_file, src_line);
+    log_event_entry(settings, src_file, src_func, src_line, severity, -1,
+                    summary);
+  }
+
+  // format log message into this thread's buffer (vsnprintf() count
+  // parameter includes null terminator)
+  char *out = log_event_out;
+
+  vsnprintf(out, (size_t) settings->applog_max_msg_len + 1, message, args);
+
+  log_event_entry(settings, src_file, src_func, src_line, severity,
+                  duration_ns, out);
+}
+
+//############################################################################
+// log_event()
+//############################################################################
+void log_event(const char *src_file,
+               const char *src_func,
+               const int src_line, int severity, const char *message, ...)
+{
+  va_list args;
+
+  va_start(args, message);
+  log_event_va(src_file, src_func, src_line, severity, -1, message, args);
+  va_end(args);
+}
+
+//############################################################################
+// log_event_duration()
+//############################################################################
+void log_event_duration(const char *src_file,
+                        const char *src_func,
+                        const int src_line, int severity,
+                        int64_t duration_ns, const char *message, ...)
+{
+  va_list args;
+
+  va_start(args, message);
+  log_event_va(src_file, src_func, src_line, severity,
+               (duration_ns < 0) ? 0 : duration_ns, message, args);
+  va_end(args);
+}
@@ -25,8 +25,8 @@ extern "C"
  * @brief Restores EVP_PKEY private key struct from DER formatted input.
  *
  * @param[in] ec_der_bytes_in      Pointer to byte array that contains
- *                                 the marshalled (DER format) EC private
- *                                 key input
+ *                                 the marshalled (DER format) EC (or
+ *                                 Ed25519) private key input
  *
  * @param[in] ec_der_bytes_in_len  Pointer to size of the byte array
  *                                 containing the marshalled (DER format)
@@ -44,12 +44,43 @@ extern "C"
  */
 #define KMYTH_EC_NID NID_secp521r1
 
+/**
+ * @brief Identifiers for the key agreement groups that the 'retrieve key'
+ *        protocol can negotiate. The client picks the group (by the type of
+ *        its ephemeral key) and names it in the 'Client Hello' message; the
+ *        server generates its ephemeral key in the same group.
+ *
+ *        KMYTH_ECDH_GROUP_EC uses the curve given by KMYTH_EC_NID, with
+ *        public keys exchanged as uncompressed points. KMYTH_ECDH_GROUP_X25519
+ *        uses X25519 (RFC 7748), with public keys exchanged as their raw
+ *        32-byte encoding.
+ */
+#define KMYTH_ECDH_GROUP_EC 0x01
+#define KMYTH_ECDH_GROUP_X25519 0x02
+
+/**
+ * @brief The key agreement group used for ephemeral keys generated by the
+ *        client (enclave). Building with KMYTH_ECDH_X25519 defined selects
+ *        X25519.
+ */
+#ifdef KMYTH_ECDH_X25519
+#define KMYTH_ECDH_DEFAULT_GROUP KMYTH_ECDH_GROUP_X25519
+#else
+#define KMYTH_ECDH_DEFAULT_GROUP KMYTH_ECDH_GROUP_EC
+#endif
+
 /**
  * @brief Specify the size (in bytes) required for the ECDH 'shared
- *        secret' key agreement result
+ *        secret' key agreement result (KMYTH_ECDH_GROUP_EC)
  */
 #define KMYTH_ECDH_SHARED_SECRET_SIZE 66
 
+/**
+ * @brief Size (in bytes) of an X25519 public key, and of the X25519
+ *        'shared secret' key agreement result
+ */
+#define KMYTH_X25519_KEY_SIZE 32
+
 /**
  * @brief Specify the cryptographic hash algorithm to be used by the
  *        ECDH-based Kmyth 'retrieve key from server' protocol 
@@ -68,15 +99,76 @@ extern "C"
 /**
  * @brief Creates an ephemeral elliptic curve key pair (containing both the
  *        private and public components) for a participant's contribution
- *        in an ECDH key agreement protocol. The elliptic curve defined
- *        by KMYTH_EC_NID is used.
+ *        in an ECDH key agreement protocol.
+ *
+ * @param[in]  group               Key agreement group (KMYTH_ECDH_GROUP_EC,
+ *                                 for the elliptic curve defined by
+ *                                 KMYTH_EC_NID, or KMYTH_ECDH_GROUP_X25519)
  *
  * @param[out] ephemeral_key_pair  Pointer to pointer to ephemeral key pair
  *                                 (EVP_PKEY struct) created by this function
  *
  * @return 0 on success, 1 on error
  */
-  int create_ecdh_ephemeral_keypair(EVP_PKEY ** ephemeral_key_pair);
+  int create_ecdh_ephemeral_keypair(uint8_t group,
+                                    EVP_PKEY ** ephemeral_key_pair);
+
+/**
+ * @brief Identifies the key agreement group of an ephemeral key
+ *
+ * @param[in]  eph_key             Pointer to ephemeral key (pair or public
+ *                                 key only)
+ *
+ * @param[out] group               Key agreement group of the key
+ *                                 (KMYTH_ECDH_GROUP_EC or
+ *                                 KMYTH_ECDH_GROUP_X25519)
+ *
+ * @return 0 on success, 1 on error (key of an unsupported type)
+ */
+  int get_ecdh_group(EVP_PKEY * eph_key, uint8_t * group);
+
+/**
+ * @brief Encodes the public part of an ephemeral key as the octet string
+ *        exchanged in the 'Client Hello' and 'Server Hello' messages
+ *        (an uncompressed point for KMYTH_ECDH_GROUP_EC, the raw 32-byte
+ *        key for KMYTH_ECDH_GROUP_X25519)
+ *
+ * @param[in]  eph_key             Pointer to ephemeral key (pair or public
+ *                                 key only)
+ *
+ * @param[out] pubkey_bytes        Pointer to byte array allocated by this
+ *                                 function to hold the encoded public key.
+ *                                 The caller must free it.
+ *
+ * @param[out] pubkey_len          Pointer to length (in bytes) of the
+ *                                 encoded public key
+ *
+ * @return 0 on success, 1 on error
+ */
+  int ecdh_pubkey_to_octets(EVP_PKEY * eph_key,
+                            unsigned char ** pubkey_bytes,
+                            size_t * pubkey_len);
+
+/**
+ * @brief Decodes (and checks) an ephemeral public key received, as an
+ *        octet string, in a 'Client Hello' or 'Server Hello' message
+ *
+ * @param[in]  group               Key agreement group the public key
+ *                                 belongs to
+ *
+ * @param[in]  pubkey_bytes        Encoded public key
+ *
+ * @param[in]  pubkey_len          Length (in bytes) of the encoded public key
+ *
+ * @param[out] eph_pubkey          Pointer to pointer to the EVP_PKEY struct
+ *                                 created by this function
+ *
+ * @return 0 on success, 1 on error
+ */
+  int ecdh_octets_to_pubkey(uint8_t group,
+                            const unsigned char * pubkey_bytes,
+                            size_t pubkey_len,
+                            EVP_PKEY ** eph_pubkey);
 
 /**
  * @brief Computes shared secret value, using ECDH, from a local private
@@ -98,7 +190,9 @@ extern "C"
  *
  * @param[out] shared_secret        computed X component of the remote peer's
  *                                  'public key' point dotted with the local
- *                                  'private key' point
+ *                                  'private key' point (for X25519, the
+ *                                  32-byte X25519 result). Both keys must
+ *                                  belong to the same key agreement group.
  *
  * @param[out] shared_secret_len    Pointer to the length (in bytes) of the
  *                                  shared secret result
@@ -168,7 +262,9 @@ extern "C"
 
 /**
  * @brief Generates a signature over the data in an input buffer passed
- *        in to the function, using a specified EC private key
+ *        in to the function, using a specified EC private key. The key
+ *        type selects the scheme: ECDSA (over a KMYTH_ECDH_MD digest) for
+ *        an EC key, or Ed25519 (over the data itself) for an Ed25519 key.
  *
  * @param[in]  ec_sign_pkey    Pointer to EC_KEY containing an elliptic
  *                             curve private key to be used for signing
@@ -195,9 +291,38 @@ extern "C"
                      unsigned char ** sig_out,
                      unsigned int * sig_out_len);
 
+/**
+ * @brief Generates a signature, as for ec_sign_buffer(), into a buffer
+ *        provided by the caller rather than a newly allocated one.
+ *
+ * @param[in]  ec_sign_pkey    Pointer to the private signing key
+ *
+ * @param[in]  buf_in          Input buffer containing data to be signed
+ *
+ * @param[in]  buf_in_len      Length (in bytes) of input data buffer
+ *
+ * @param[out] sig_out         Buffer the signature is written into, which
+ *                             must not overlap buf_in
+ *
+ * @param[in]  sig_out_size    Size (in bytes) of sig_out - at least
+ *                             EVP_PKEY_size(ec_sign_pkey)
+ *
+ * @param[out] sig_out_len     Pointer to the length (in bytes) of the
+ *                             output signature
+ *
+ * @return 0 on success, 1 on error
+ */
+  int ec_sign_buffer_into(EVP_PKEY * ec_sign_pkey,
+                          unsigned char * buf_in,
+                          size_t buf_in_len,
+                          unsigned char * sig_out,
+                          size_t sig_out_size,
+                          size_t * sig_out_len);
+
 /**
  * @brief Validates a signature over the data in an input buffer passed
- *        in to the function, using a specified EC private key
+ *        in to the function, using a specified EC private key (ECDSA or
+ *        Ed25519, per the key type, as for ec_sign_buffer())
  *
  * @param[in]  ec_verify_pkey    Pointer to EC_KEY containing an elliptic
  *                               curve public key to be used for signature
@@ -8,6 +8,8 @@
 
 #define _KMYTH_ENCLAVE_COMMON_H_
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -49,6 +51,55 @@ extern "C"
 #define	LOG_DEBUG	7
 #endif
 
+// size of the buffer that log records are collected in, inside the enclave
+#define KMYTH_SGX_LOG_BUFFER_SIZE 4096
+
+// maximum length of the source file and function names in a log record
+#define KMYTH_SGX_LOG_NAME_MAX_LEN 255
+
+// size of the plaintext pieces that large data is sealed in (and so the most
+// of it the enclave holds at once while sealing or unsealing it)
+#define KMYTH_SGX_SEAL_CHUNK_SIZE (64 * 1024)
+
+/**
+ * @brief Header of a log record passed out of the enclave (in a batch, by
+ *        log_events_ocall()). It is followed by the source file name, the
+ *        function name and the message, each with the given length and
+ *        then a terminating null byte.
+ */
+typedef struct kmyth_sgx_log_record_s
+{
+  int32_t src_line;
+  int32_t severity;
+  uint16_t src_file_len;
+  uint16_t src_func_len;
+  uint16_t msg_len;
+  uint16_t reserved;
+} kmyth_sgx_log_record_t;
+
+/**
+ * @brief Logs an event. Outside of an enclave, it is logged immediately.
+ *        Inside one, it is added to the enclave's log buffer, which is
+ *        passed out (in one OCALL) when it fills, when an event of
+ *        LOG_ERR (or higher) severity is logged, and before an ECALL that
+ *        logs returns (see kmyth_enclave_log_flush()).
+ *
+ * @param[in] src_file         Source code filename string
+ *
+ * @param[in] src_func         Function name string
+ *
+ * @param[in] src_line         Integer specifying source code line number
+ *
+ * @param[in] severity         Integer representing the severity
+ *                             level of the event to be logged.
+ *
+ * @param[in] msg              String containing the message to be logged.
+ *
+ * @return                     None
+ */
+void kmyth_sgx_log_event(const char *src_file, const char *src_func,
+                         int src_line, int severity, const char *msg);
+
 // macro for generic logging call
 #define kmyth_sgx_log(severity, message)\
 {\
@@ -57,9 +108,10 @@ extern "C"
   const int src_line = __LINE__;\
   int log_level = severity;\
   const char *log_msg = message;\
-  log_event_ocall(src_file, src_func, src_line, log_level, log_msg);\
+  kmyth_sgx_log_event(src_file, src_func, src_line, log_level, log_msg);\
 }
 
+#include "kmyth_sgx_stats.h"
 #include "ec_key_cert_marshal.h"
 #include "ec_key_cert_unmarshal.h"
 #include "ecdh_util.h"
@@ -0,0 +1,63 @@
+/**
+ * @file kmyth_sgx_stats.h
+ *
+ * @brief Provides the instrumentation counters a kmyth enclave reports
+ *        (through the kmyth_enclave_get_stats() ECALL), shared by the
+ *        trusted and untrusted code
+ */
+
+#ifndef _KMYTH_SGX_STATS_H_
+#define _KMYTH_SGX_STATS_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief The ECALLs that do the enclave's work, indexing their call
+ *        counters. (The ECALLs that only compute sizes or manage the
+ *        unsealed data table are not counted.)
+ */
+typedef enum kmyth_sgx_ecall_id_e
+{
+  KMYTH_SGX_ECALL_SEAL = 0,
+  KMYTH_SGX_ECALL_SEAL_BATCH,
+  KMYTH_SGX_ECALL_SEAL_CHUNKED,
+  KMYTH_SGX_ECALL_UNSEAL,
+  KMYTH_SGX_ECALL_UNSEAL_BATCH,
+  KMYTH_SGX_ECALL_UNSEAL_CHUNKED,
+  KMYTH_SGX_ECALL_FILL_ECDH_POOL,
+  KMYTH_SGX_ECALL_RETRIEVE_KEY,
+  KMYTH_SGX_ECALL_RETRIEVE_KEYS,
+  KMYTH_SGX_ECALL_COUNT
+} kmyth_sgx_ecall_id_t;
+
+/**
+ * @brief Counters kept inside the enclave, since it was created:
+ *
+ *        - the number of entries in the unsealed data table and the bytes
+ *          of data they hold, now and at most
+ *        - the bytes OpenSSL holds allocated on the enclave heap, now and
+ *          at most (only if 'crypto_tracked' is set - the enclave could
+ *          not install its allocation hooks otherwise)
+ *        - the number of times each ECALL was entered
+ */
+typedef struct kmyth_sgx_enclave_stats_s
+{
+  uint64_t unseal_entries;
+  uint64_t unseal_bytes;
+  uint64_t unseal_peak_bytes;
+  uint64_t crypto_bytes;
+  uint64_t crypto_peak_bytes;
+  uint64_t crypto_tracked;
+  uint64_t ecall_calls[KMYTH_SGX_ECALL_COUNT];
+} kmyth_sgx_enclave_stats_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif                          // _KMYTH_SGX_STATS_H_
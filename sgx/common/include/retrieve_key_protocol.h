@@ -44,6 +44,35 @@ extern "C"
  */
 #define KMYTH_ECDH_MAX_MSG_SIZE 16384
 
+/**
+ * @brief Version of the 'retrieve key' protocol, carried in the first byte
+ *        of the 'Client Hello' and 'Server Hello' message bodies. A peer
+ *        rejects a 'Hello' message of any other version.
+ */
+#define KMYTH_ECDH_PROTOCOL_VERSION 1
+
+/**
+ * @brief Size (in bytes) of the fields leading the 'Client Hello' and
+ *        'Server Hello' message bodies: the protocol version, then the key
+ *        agreement group (KMYTH_ECDH_GROUP_EC or KMYTH_ECDH_GROUP_X25519)
+ *        that the ephemeral public keys in the message belong to.
+ */
+#define KMYTH_ECDH_HELLO_PREFIX_LEN 2
+
+/**
+ * @brief Size (in bytes) of the sequence number leading the body of each
+ *        'Key Request' and 'Key Response' message.
+ *
+ *        Once the session keys have been agreed, a client may send any
+ *        number of 'Key Request' messages over the connection. The first
+ *        request of a session is numbered 0 and each one after it is
+ *        numbered one higher; a response carries the number of the request
+ *        it answers. Each peer rejects a message that does not carry the
+ *        number it expects next, so that a request or response cannot be
+ *        replayed (or reordered) within the session.
+ */
+#define KMYTH_ECDH_SEQ_LEN 4
+
 /**
  * @brief Struct encapasulating a "header" for these protocol messages.
  *        The header only contains a two-byte size, but the attempt is
@@ -88,24 +117,146 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
                                      X509_NAME ** identity_out);
 
 /**
- * @brief Computes an elliptic curve signature over the input byte array
- *        using the provided signing key. The input buffer is then modified
- *        to append the signature bytes to the end of the original bytes.
- * 
- * @param[out] sign_key   Pointer to an EVP_PKEY struct containing the
- *                        private elliptic curve key to use when computing
- *                        the signature.
+ * @brief Cursor writing a 'retrieve key' protocol message body into a
+ *        single buffer. The buffer is sized up front for the message
+ *        fields plus the largest signature the signing key can make, so
+ *        that the fields and then the signature are written into it in
+ *        place, with no further allocation or copying.
+ */
+typedef struct ECDHMessageBuilder {
+  uint8_t *buf;
+  size_t size;
+  size_t len;
+  bool overflow;
+} ECDHMessageBuilder;
+
+/**
+ * @brief Cursor reading the fields of a received 'retrieve key' protocol
+ *        message body in place. Each length-prefixed field is returned as
+ *        a view (a pointer into the message and a length) rather than a
+ *        copy, and every read is checked against the message length.
+ */
+typedef struct ECDHMessageParser {
+  const uint8_t *buf;
+  size_t size;
+  size_t pos;
+} ECDHMessageParser;
+
+/**
+ * @brief Allocates a message builder's buffer.
  *
- * @param[inout] msg      Pointer to ECDHMessage struct containing the
- *                        message to be signed. On return from this function,
- *                        memory is re-allocated to make room for the
- *                        signature bytes and the computed signature bytes
- *                        are appended to the tail end of the input message.
+ * @param[out] builder    The message builder
  *
- * @return 0 on success, 1 on error
+ * @param[in]  body_len   Length (in bytes) of the fields that will be
+ *                        written, not counting the signature
+ *
+ * @param[in]  sign_key   The key the message will be signed with
+ *
+ * @return 0 on success, 1 on error (including a message that could exceed
+ *         UINT16_MAX bytes)
+ */
+  int msg_builder_init(ECDHMessageBuilder * builder, size_t body_len,
+                       EVP_PKEY * sign_key);
+
+/**
+ * @brief Writes a one-byte field at the builder's cursor.
+ */
+  void msg_builder_put_u8(ECDHMessageBuilder * builder, uint8_t val);
+
+/**
+ * @brief Writes a four-byte (big-endian) unsigned integer field at the
+ *        builder's cursor.
  */
-  int append_msg_signature(EVP_PKEY * sign_key,
-                           ECDHMessage * msg);
+  void msg_builder_put_u32(ECDHMessageBuilder * builder, uint32_t val);
+
+/**
+ * @brief Writes a field - a two-byte (big-endian) length, then that many
+ *        bytes - at the builder's cursor.
+ */
+  void msg_builder_put_field(ECDHMessageBuilder * builder,
+                             const uint8_t * bytes, size_t len);
+
+/**
+ * @brief Signs the fields written so far and writes the signature (as a
+ *        length-prefixed field) after them, then passes the buffer to the
+ *        output message. The builder's buffer is freed on error.
+ *
+ * @param[inout] builder  The message builder
+ *
+ * @param[in]  sign_key   The key to sign the message with
+ *
+ * @param[out] msg_out    The signed message, which takes ownership of the
+ *                        builder's buffer
+ *
+ * @return 0 on success, 1 on error (including fields written beyond the
+ *         length given to msg_builder_init())
+ */
+  int msg_builder_sign(ECDHMessageBuilder * builder, EVP_PKEY * sign_key,
+                       ECDHMessage * msg_out);
+
+/**
+ * @brief Frees (clearing) a message builder's buffer, for a message that
+ *        will not be signed.
+ */
+  void msg_builder_free(ECDHMessageBuilder * builder);
+
+/**
+ * @brief Starts a message parser at the beginning of a message body.
+ */
+  void msg_parser_init(ECDHMessageParser * parser, const uint8_t * buf,
+                       size_t size);
+
+/**
+ * @brief Reads a four-byte (big-endian) unsigned integer field at the
+ *        parser's cursor.
+ *
+ * @return 0 on success, 1 if the message is too short
+ */
+  int msg_parser_get_u32(ECDHMessageParser * parser, uint32_t * val);
+
+/**
+ * @brief Reads a field - a two-byte (big-endian) length, then that many
+ *        bytes - at the parser's cursor, as a view into the message.
+ *
+ * @return 0 on success, 1 if the message is too short
+ */
+  int msg_parser_get_field(ECDHMessageParser * parser,
+                           const uint8_t ** bytes, size_t *len);
+
+/**
+ * @brief Reads the signature field that ends a message, as a view into the
+ *        message, and the length of the (signed) fields before it.
+ *
+ * @param[inout] parser    The message parser
+ *
+ * @param[out] signed_len  Length (in bytes) of the message fields covered
+ *                         by the signature
+ *
+ * @param[out] sig         The signature
+ *
+ * @param[out] sig_len     Length (in bytes) of the signature
+ *
+ * @return 0 on success, 1 if the message is too short or has bytes
+ *         following the signature
+ */
+  int msg_parser_get_signature(ECDHMessageParser * parser,
+                               size_t *signed_len,
+                               const uint8_t ** sig, size_t *sig_len);
+
+/**
+ * @brief Checks the protocol version leading a received 'Client Hello' or
+ *        'Server Hello' message body, and gets the key agreement group
+ *        that follows it.
+ *
+ * @param[in]  msg_in     Pointer to ECDHMessage struct containing the
+ *                        'Hello' message
+ *
+ * @param[out] group      Key agreement group named by the message
+ *
+ * @return 0 on success, 1 on error (message too short, or an unsupported
+ *         version or group)
+ */
+  int check_hello_msg_prefix(ECDHMessage * msg_in, uint8_t * group);
 
 /**
  * @brief Builds the 'Client Hello' message, which initiates the ECDH
@@ -116,11 +267,13 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *        struct from the client's signing certificate and then
  *        marshalled into a DER-formatted byte array
  * 
- *        The client's ephemeral public key is marshalled into a
- *        DER-formatted byte array
+ *        The client's ephemeral public key is encoded as an octet string
+ *        (an uncompressed point, or the raw key for X25519)
  * 
  *        The body of the 'Client Hello' message contains the
  *        following fields concatenated in the below order:
+ *          - protocol version (one byte)
+ *          - key agreement group, per the client's ephemeral key (one byte)
  *          - size (length) of client identity bytes
  *          - client identity bytes
  *          - size (length) of client ephemeral public key bytes
@@ -156,7 +309,7 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *                                 ephemeral elliptic curve public key
  *                                 generated for this retrieve key protocol
  *                                 session by the ECDH client. The public key
- *                                 is extracted, DER formatted, and
+ *                                 is extracted, encoded, and
  *                                 incorporated into the 'Client Hello'
  *                                 message composed by this function.
  * 
@@ -179,10 +332,12 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  * 
  *        A received 'Client Hello' message contains the
  *        following fields concatenated in the below order:
+ *          - protocol version (one byte)
+ *          - key agreement group (one byte)
  *          - client_id_len (two-byte unsigned integer)
  *          - client_id_bytes (DER-formatted X509_NAME byte array)
  *          - client_ephemeral_len (two-byte unsigned integer)
- *          - client_ephemeral_bytes (DER-formatted EC_KEY byte array)
+ *          - client_ephemeral_bytes (octet string)
  *          - message signature (byte array)
  * 
  *        The message is first parsed (read) into size/byte array variable
@@ -199,7 +354,9 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *          - client ephemeral public key contribution as an EC_KEY struct
  * 
  *        Finally, some sanity checks are performed on the received
- *        ephemeral public key (using EC_KEY_check_key())
+ *        ephemeral public key (using EC_KEY_check_key(), for the
+ *        KMYTH_ECDH_GROUP_EC group). The server must generate its own
+ *        ephemeral key in the group of the returned key.
  * 
  * @param[in]  msg_in              Pointer to ECDHMessage struct containing
  *                                 the 'Client Hello' message to be parsed
@@ -231,6 +388,8 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  * 
  *        The body of the 'Server Hello' message contains the
  *        following fields concatenated in the below order:
+ *          - protocol version
+ *          - key agreement group (that of both ephemeral keys)
  *          - server_id_len
  *          - server_id_bytes
  *          - client_ephemeral_len
@@ -272,7 +431,7 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *                                 ephemeral elliptic curve public key
  *                                 generated for this retrieve key protocol
  *                                 session by the ECDH server-side peer. The
- *                                 public key is extracted, DER formatted,
+ *                                 public key is extracted, encoded,
  *                                 and incorporated into the 'Server Hello'
  *                                 message composed by this function.
  * 
@@ -298,12 +457,15 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  * 
  *        A received 'Server Hello' message contains the
  *        following fields concatenated in the below order:
+ *          - protocol version (one byte)
+ *          - key agreement group (one byte, must be that of the client's
+ *            ephemeral key)
  *          - server_id_len (two-byte, big-endian unsigned integer)
  *          - server_id_bytes (DER-formatted X509_NAME byte array)
  *          - client_ephemeral_len (two-byte, big-endian unsigned integer)
- *          - client_ephemeral_bytes (DER-formatted EC_KEY byte array)
+ *          - client_ephemeral_bytes (octet string)
  *          - server_ephemeral_len (two-byte, big-endian unsigned integer)
- *          - server_ephemeral_bytes (DER-formatted EC_KEY byte array)
+ *          - server_ephemeral_bytes (octet string)
  *          - message signature (byte array)
  * 
  *        The message is split into body and signature components.
@@ -356,13 +518,15 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  * 
  *        The body of the 'Key Request' message contains the
  *        following fields concatenated in the below order:
+ *          - sequence number of the request within the session
  *          - length (in bytes) of the KMIP key request
  *          - KMIP key request bytes
  *          - length (in bytes) of the server public ephemeral
  *          - server public ephemeral bytes
  * 
- *        The unsigned integer "length" values have been specified as
- *        two-byte values (uint16_t) stored in the byte array in
+ *        The sequence number is a four-byte value (uint32_t) and the
+ *        unsigned integer "length" values have been specified as
+ *        two-byte values (uint16_t), all stored in the byte array in
  *        big-endian (network) byte order. This is done to make these
  *        parameters a well-defined, machine-independent size so that
  *        they can be deterministically parsed by the message recipient.
@@ -396,6 +560,9 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *                                 (EVP_PKEY) received in the preceding
  *                                 'Server Hello' message.
  * 
+ * @param[in]  msg_seq             Sequence number of this request within
+ *                                 the session (see KMYTH_ECDH_SEQ_LEN).
+ * 
  * @param[out] msg_out             Pointer to an ECDHMessage struct that the
  *                                 'Key Request' message result of this
  *                                 function can be placed into and 'returned'
@@ -407,6 +574,7 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
                               ByteBuffer * msg_enc_key,
                               ByteBuffer * req_key_id,
                               EVP_PKEY * server_eph_pubkey,
+                              uint32_t msg_seq,
                               ECDHMessage * msg_out);
 
 /**
@@ -414,15 +582,17 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  * 
  *        A received 'Key Request' message contains the
  *        following fields concatenated in the below order:
+ *          - sequence number (four-byte, big-endian unsigned integer)
  *          - KMIP key request size (two-byte, big-endian unsigned integer)
  *          - KMIP key request (byte array)
  *          - server ephemeral size (two-byte, big-endian unsigned integer)
- *          - server_ephemeral_bytes (DER-formatted EC_KEY byte array)
+ *          - server_ephemeral_bytes (octet string)
  *          - message signature size (two-byte, big-endian unsigned integer)
  *          - message signature (byte array)
  * 
  *        The elliptic curve signature (over the body of the message) is first
- *        verified (using the public key provided as an input parameter)
+ *        verified (using the public key provided as an input parameter),
+ *        then the sequence number is checked against the one expected.
  * 
  * @param[in]  client_sign_cert    Pointer to X509 formatted public cert
  *                                 (paired with the ECDH client signing key)
@@ -451,6 +621,9 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *                                 the 'Key Request' message being parsed and
  *                                 validated by this function.
  * 
+ * @param[in]  msg_seq             Sequence number the request must carry
+ *                                 (see KMYTH_ECDH_SEQ_LEN).
+ * 
  * @param[out] server_eph_pubkey   Pointer to pointer to EVP_PKEY struct that
  *                                 public key contribution of the ECDH
  *                                 server-side peer that is shared in the
@@ -468,6 +641,7 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
                            ByteBuffer * msg_dec_key,
                            ECDHMessage * msg_in,
                            EVP_PKEY * server_eph_pubkey,
+                           uint32_t msg_seq,
                            ByteBuffer * kmip_request);
 
 /**
@@ -476,11 +650,13 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  * 
  *        The body of the 'Key Response' message contains the
  *        following fields concatenated in the below order:
+ *          - sequence number of the request being answered
  *          - length (in bytes) of the KMIP 'get key' response
  *          - KMIP key 'get key' response bytes
  * 
- *        The unsigned integer "length" value have is specified as a
- *        two-byte value (uint16_t) in big-endian (network) byte order.
+ *        The sequence number is a four-byte value (uint32_t) and the
+ *        unsigned integer "length" value is a two-byte value (uint16_t),
+ *        both in big-endian (network) byte order.
  *        This is done to format this parameter in a well-defined,
  *        machine-indepenedent way that can be deterministically parsed
  *        by the message recipient.
@@ -507,6 +683,9 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *                                 message and returned to the ECDH client
  *                                 that initiated the retrieve key protocol.
  * 
+ * @param[in]  msg_seq             Sequence number of the 'Key Request'
+ *                                 message being answered.
+ * 
  * @param[out] msg_out             Pointer to an ECDHMessage struct that the
  *                                 'Key Response' message result of this
  *                                 function can be placed into and 'returned'
@@ -517,6 +696,7 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
   int compose_key_response_msg(EVP_PKEY * server_sign_key,
                                ByteBuffer * msg_enc_key,
                                ByteBuffer * kmip_response,
+                               uint32_t msg_seq,
                                ECDHMessage * msg_out);
 
 /**
@@ -524,13 +704,15 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  * 
  *        A received 'Key Response' message contains the
  *        following fields concatenated in the below order:
+ *          - sequence number (four-byte, big-endian unsigned integer)
  *          - KMIP 'get key' key response size (two-byte, big-endian unsigned integer)
  *          - KMIP 'get key' response (byte array)
  *          - message signature size (two-byte, big-endian unsigned integer)
  *          - message signature (byte array)
  * 
  *        The elliptic curve signature (over the body of the message) is first
- *        verified (using the public key provided as an input parameter)
+ *        verified (using the public key provided as an input parameter),
+ *        then the sequence number is checked against that of the request.
  * 
  * @param[in]  server_sign_cert    Pointer to X509 formatted public
  *                                 certificate paired to the server-side
@@ -560,13 +742,15 @@ int extract_identity_bytes_from_x509(X509 * cert_in,
  *                                 result that the retrieve key protocol's
  *                                 objective is to get from a remote server.
  *
- * @param[out] kmip_response
+ * @param[in]  msg_seq             Sequence number of the 'Key Request'
+ *                                 message the response must answer.
  *
  * @return 0 on success, 1 on error
  */
   int parse_key_response_msg(X509 * server_sign_cert,
                              ByteBuffer * msg_dec_key,
                              ECDHMessage * msg_in,
+                             uint32_t msg_seq,
                              ByteBuffer * kmip_response);
 
 #ifdef __cplusplus
@@ -16,10 +16,12 @@ int marshal_ec_pkey_to_der(EVP_PKEY *ec_pkey_in,
                            unsigned char **ec_der_bytes_out,
                            int *ec_der_bytes_out_len)
 {
-  // validate that key to be marshalled is elliptic curve (EC) type
+  // validate that key to be marshalled is an elliptic curve (EC or
+  // Ed25519) signing key
   EVP_PKEY *pkey_ptr = ec_pkey_in;
 
-  if (EVP_PKEY_base_id(pkey_ptr) != EVP_PKEY_EC)
+  if ((EVP_PKEY_base_id(pkey_ptr) != EVP_PKEY_EC) &&
+      (EVP_PKEY_base_id(pkey_ptr) != EVP_PKEY_ED25519))
   {
     kmyth_sgx_log(LOG_ERR, "PKEY to be marshalled is not of EC type");
     return EXIT_FAILURE;
@@ -24,7 +24,8 @@ int unmarshal_ec_der_to_pkey(uint8_t *ec_der_bytes_in,
   const unsigned char *buf_in = (const unsigned char *) ec_der_bytes_in;
   long buf_len = (long) ec_der_bytes_in_len;
 
-  *ec_pkey_out = d2i_PrivateKey(EVP_PKEY_EC, NULL, &buf_in, buf_len);
+  // the key type (EC or Ed25519) is taken from the DER encoding
+  *ec_pkey_out = d2i_AutoPrivateKey(NULL, &buf_in, buf_len);
   if (*ec_pkey_out == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "DER to PKEY format conversion failed");
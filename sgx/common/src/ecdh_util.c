@@ -12,8 +12,34 @@
 /*****************************************************************************
  * create_ecdh_ephemeral_keypair()
  ****************************************************************************/
-int create_ecdh_ephemeral_keypair(EVP_PKEY ** ephemeral_key_pair)
+int create_ecdh_ephemeral_keypair(uint8_t group,
+                                  EVP_PKEY ** ephemeral_key_pair)
 {
+  // X25519 keys need no parameters - generate the key pair directly
+  if (group == KMYTH_ECDH_GROUP_X25519)
+  {
+    EVP_PKEY_CTX *xctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL);
+    if (xctx == NULL)
+    {
+      kmyth_sgx_log(LOG_ERR, "create X25519 key generation context failed");
+      return EXIT_FAILURE;
+    }
+    if ((EVP_PKEY_keygen_init(xctx) != 1) ||
+        (EVP_PKEY_keygen(xctx, ephemeral_key_pair) != 1))
+    {
+      kmyth_sgx_log(LOG_ERR, "X25519 key generation failed");
+      EVP_PKEY_CTX_free(xctx);
+      return EXIT_FAILURE;
+    }
+    EVP_PKEY_CTX_free(xctx);
+    return EXIT_SUCCESS;
+  }
+  if (group != KMYTH_ECDH_GROUP_EC)
+  {
+    kmyth_sgx_log(LOG_ERR, "unsupported key agreement group");
+    return EXIT_FAILURE;
+  }
+
   // create parameter generation context for creating ephemeral key pair
   EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
   if (pctx == NULL)
@@ -89,6 +115,158 @@ int create_ecdh_ephemeral_keypair(EVP_PKEY ** ephemeral_key_pair)
   return EXIT_SUCCESS;
 }
 
+/*****************************************************************************
+ * get_ecdh_group()
+ ****************************************************************************/
+int get_ecdh_group(EVP_PKEY * eph_key, uint8_t * group)
+{
+  switch (EVP_PKEY_id(eph_key))
+  {
+  case EVP_PKEY_EC:
+    *group = KMYTH_ECDH_GROUP_EC;
+    return EXIT_SUCCESS;
+  case EVP_PKEY_X25519:
+    *group = KMYTH_ECDH_GROUP_X25519;
+    return EXIT_SUCCESS;
+  default:
+    kmyth_sgx_log(LOG_ERR, "ephemeral key of unsupported type");
+    return EXIT_FAILURE;
+  }
+}
+
+/*****************************************************************************
+ * ecdh_pubkey_to_octets()
+ ****************************************************************************/
+int ecdh_pubkey_to_octets(EVP_PKEY * eph_key,
+                          unsigned char ** pubkey_bytes,
+                          size_t * pubkey_len)
+{
+  uint8_t group = 0;
+
+  *pubkey_bytes = NULL;
+  *pubkey_len = 0;
+
+  if (EXIT_SUCCESS != get_ecdh_group(eph_key, &group))
+  {
+    return EXIT_FAILURE;
+  }
+
+  // X25519 public keys are exchanged as-is (no point encoding)
+  if (group == KMYTH_ECDH_GROUP_X25519)
+  {
+    *pubkey_bytes = malloc(KMYTH_X25519_KEY_SIZE);
+    if (*pubkey_bytes == NULL)
+    {
+      kmyth_sgx_log(LOG_ERR, "error allocating public key byte buffer");
+      return EXIT_FAILURE;
+    }
+    *pubkey_len = KMYTH_X25519_KEY_SIZE;
+    if ((EVP_PKEY_get_raw_public_key(eph_key, *pubkey_bytes, pubkey_len) != 1)
+        || (*pubkey_len != KMYTH_X25519_KEY_SIZE))
+    {
+      kmyth_sgx_log(LOG_ERR, "error extracting X25519 public key");
+      free(*pubkey_bytes);
+      *pubkey_bytes = NULL;
+      *pubkey_len = 0;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  EC_KEY *ec_key = EVP_PKEY_get1_EC_KEY(eph_key);
+  if (ec_key == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "error extracting EC_KEY from EVP_PKEY struct");
+    return EXIT_FAILURE;
+  }
+  *pubkey_len = EC_KEY_key2buf(ec_key,
+                               POINT_CONVERSION_UNCOMPRESSED,
+                               pubkey_bytes,
+                               NULL);
+  EC_KEY_free(ec_key);
+  if ((*pubkey_bytes == NULL) || (*pubkey_len == 0))
+  {
+    kmyth_sgx_log(LOG_ERR, "EC_KEY to octet string conversion failed");
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * ecdh_octets_to_pubkey()
+ ****************************************************************************/
+int ecdh_octets_to_pubkey(uint8_t group,
+                          const unsigned char * pubkey_bytes,
+                          size_t pubkey_len,
+                          EVP_PKEY ** eph_pubkey)
+{
+  // free any public key left from a previous session
+  if (*eph_pubkey != NULL)
+  {
+    EVP_PKEY_free(*eph_pubkey);
+    *eph_pubkey = NULL;
+  }
+
+  if (group == KMYTH_ECDH_GROUP_X25519)
+  {
+    if (pubkey_len != KMYTH_X25519_KEY_SIZE)
+    {
+      kmyth_sgx_log(LOG_ERR, "X25519 public key of invalid length");
+      return EXIT_FAILURE;
+    }
+    *eph_pubkey = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL,
+                                              pubkey_bytes, pubkey_len);
+    if (*eph_pubkey == NULL)
+    {
+      kmyth_sgx_log(LOG_ERR, "unmarshal of X25519 public key failed");
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+  if (group != KMYTH_ECDH_GROUP_EC)
+  {
+    kmyth_sgx_log(LOG_ERR, "unsupported key agreement group");
+    return EXIT_FAILURE;
+  }
+
+  // initialize an EC_KEY struct for the right elliptic curve
+  EC_KEY *ec_key = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
+  if (ec_key == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "error initializing EC_KEY struct");
+    return EXIT_FAILURE;
+  }
+
+  // convert octet string to EC_KEY struct, then check the received key
+  if (1 != EC_KEY_oct2key(ec_key, pubkey_bytes, pubkey_len, NULL))
+  {
+    kmyth_sgx_log(LOG_ERR, "unmarshal of ephemeral public key failed");
+    EC_KEY_free(ec_key);
+    return EXIT_FAILURE;
+  }
+  if (1 != EC_KEY_check_key(ec_key))
+  {
+    kmyth_sgx_log(LOG_ERR, "checks on received ephemeral public key failed");
+    EC_KEY_free(ec_key);
+    return EXIT_FAILURE;
+  }
+
+  // encapsulate ephemeral public key in EVP_PKEY struct
+  *eph_pubkey = EVP_PKEY_new();
+  if ((*eph_pubkey == NULL) || (1 != EVP_PKEY_set1_EC_KEY(*eph_pubkey, ec_key)))
+  {
+    kmyth_sgx_log(LOG_ERR, "error encapsulating EC_KEY within EVP_PKEY");
+    EVP_PKEY_free(*eph_pubkey);
+    *eph_pubkey = NULL;
+    EC_KEY_free(ec_key);
+    return EXIT_FAILURE;
+  }
+  EC_KEY_free(ec_key);
+
+  return EXIT_SUCCESS;
+}
+
 /*****************************************************************************
  * compute_ecdh_shared_secret()
  ****************************************************************************/
@@ -99,7 +277,19 @@ int compute_ecdh_shared_secret(EVP_PKEY *local_eph_keypair,
 {
   EVP_PKEY_CTX *ctx = NULL;
   int retval = 0;
-  
+
+  // both contributions must come from the same key agreement group
+  uint8_t local_group = 0;
+  uint8_t peer_group = 0;
+
+  if ((EXIT_SUCCESS != get_ecdh_group(local_eph_keypair, &local_group)) ||
+      (EXIT_SUCCESS != get_ecdh_group(peer_eph_pubkey, &peer_group)) ||
+      (local_group != peer_group))
+  {
+    kmyth_sgx_log(LOG_ERR, "ephemeral keys from different groups");
+    return EXIT_FAILURE;
+  }
+
   // create the context for the shared secret derivation
   ctx = EVP_PKEY_CTX_new(local_eph_keypair, NULL);
   if (ctx == NULL)
@@ -295,12 +485,22 @@ int compute_ecdh_session_key(unsigned char * secret_in_bytes,
 }
 
 /*****************************************************************************
- * ec_sign_buffer()
+ * ec_sign_buffer_into()
  ****************************************************************************/
-int ec_sign_buffer(EVP_PKEY * ec_sign_pkey,
-                   unsigned char *buf_in, size_t buf_in_len,
-                   unsigned char **sig_out, unsigned int *sig_out_len)
+int ec_sign_buffer_into(EVP_PKEY * ec_sign_pkey,
+                        unsigned char *buf_in, size_t buf_in_len,
+                        unsigned char *sig_out, size_t sig_out_size,
+                        size_t *sig_out_len)
 {
+  // the signature can be no longer than the key's maximum signature size
+  int max_sig_len = EVP_PKEY_size(ec_sign_pkey);
+
+  if (max_sig_len <= 0 || sig_out_size < (size_t) max_sig_len)
+  {
+    kmyth_sgx_log(LOG_ERR, "signature buffer too small for signing key");
+    return EXIT_FAILURE;
+  }
+
   // create message digest context
   EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
 
@@ -310,15 +510,28 @@ int ec_sign_buffer(EVP_PKEY * ec_sign_pkey,
     return EXIT_FAILURE;
   }
 
-  // configure signing context
+  // Ed25519 signs the message itself (no separate digest), in one shot
+  if (EVP_PKEY_id(ec_sign_pkey) == EVP_PKEY_ED25519)
+  {
+    *sig_out_len = sig_out_size;
+    if ((EVP_DigestSignInit(mdctx, NULL, NULL, NULL, ec_sign_pkey) != 1) ||
+        (EVP_DigestSign(mdctx, sig_out, sig_out_len, buf_in, buf_in_len) != 1))
+    {
+      kmyth_sgx_log(LOG_ERR, "signature creation failed");
+      EVP_MD_CTX_free(mdctx);
+      return EXIT_FAILURE;
+    }
+    EVP_MD_CTX_free(mdctx);
+    return EXIT_SUCCESS;
+  }
+
+  // configure signing context, and hash data into it
   if (EVP_SignInit(mdctx, KMYTH_ECDH_MD) != 1)
   {
     kmyth_sgx_log(LOG_ERR, "config of message digest signature context failed");
     EVP_MD_CTX_free(mdctx);
     return EXIT_FAILURE;
   }
-
-  // hash data into the signature context
   if (EVP_SignUpdate(mdctx, buf_in, buf_in_len) != 1)
   {
     kmyth_sgx_log(LOG_ERR, "error hashing data into signature context");
@@ -326,35 +539,59 @@ int ec_sign_buffer(EVP_PKEY * ec_sign_pkey,
     return EXIT_FAILURE;
   }
 
+  // sign the data (create signature)
+  unsigned int sig_len = 0;
+
+  if (EVP_SignFinal(mdctx, sig_out, &sig_len, ec_sign_pkey) != 1)
+  {
+    kmyth_sgx_log(LOG_ERR, "signature creation failed");
+    EVP_MD_CTX_free(mdctx);
+    return EXIT_FAILURE;
+  }
+  *sig_out_len = sig_len;
+
+  // done - clean-up context
+  EVP_MD_CTX_free(mdctx);
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * ec_sign_buffer()
+ ****************************************************************************/
+int ec_sign_buffer(EVP_PKEY * ec_sign_pkey,
+                   unsigned char *buf_in, size_t buf_in_len,
+                   unsigned char **sig_out, unsigned int *sig_out_len)
+{
   // allocate memory for signature
   int max_sig_len = EVP_PKEY_size(ec_sign_pkey);
 
   if (max_sig_len <= 0)
   {
     kmyth_sgx_log(LOG_ERR, "invalid value for maximum signature length");
-    EVP_MD_CTX_free(mdctx);
     return EXIT_FAILURE;
   }
   *sig_out = calloc((size_t)max_sig_len, sizeof(unsigned char));
   if (*sig_out == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "malloc of signature buffer failed");
-    EVP_MD_CTX_free(mdctx);
     return EXIT_FAILURE;
   }
 
-  // sign the data (create signature)
-  if (EVP_SignFinal(mdctx, *sig_out,
-                    (unsigned int *) sig_out_len, ec_sign_pkey) != 1)
+  size_t sig_len = 0;
+
+  if (EXIT_SUCCESS != ec_sign_buffer_into(ec_sign_pkey,
+                                          buf_in,
+                                          buf_in_len,
+                                          *sig_out,
+                                          (size_t) max_sig_len,
+                                          &sig_len))
   {
-    kmyth_sgx_log(LOG_ERR, "signature creation failed");
     free(*sig_out);
-    EVP_MD_CTX_free(mdctx);
+    *sig_out = NULL;
     return EXIT_FAILURE;
   }
-
-  // done - clean-up context
-  EVP_MD_CTX_free(mdctx);
+  *sig_out_len = (unsigned int) sig_len;
 
   return EXIT_SUCCESS;
 }
@@ -375,6 +612,21 @@ int ec_verify_buffer(EVP_PKEY * ec_verify_pkey,
     return EXIT_FAILURE;
   }
 
+  // Ed25519 verifies the message itself (no separate digest), in one shot
+  if (EVP_PKEY_id(ec_verify_pkey) == EVP_PKEY_ED25519)
+  {
+    if ((EVP_DigestVerifyInit(mdctx, NULL, NULL, NULL, ec_verify_pkey) != 1)
+        || (EVP_DigestVerify(mdctx, sig_in, sig_in_len,
+                             buf_in, buf_in_len) != 1))
+    {
+      kmyth_sgx_log(LOG_ERR, "signature verification failed");
+      EVP_MD_CTX_free(mdctx);
+      return EXIT_FAILURE;
+    }
+    EVP_MD_CTX_free(mdctx);
+    return EXIT_SUCCESS;
+  }
+
   // 'initialize' (e.g., load public key)
   if (EVP_DigestVerifyInit(mdctx, NULL, KMYTH_ECDH_MD, NULL,
                                         ec_verify_pkey) != 1)
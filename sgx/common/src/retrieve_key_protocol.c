@@ -34,58 +34,254 @@ int extract_identity_bytes_from_x509(X509 *cert_in, X509_NAME **identity_out)
 }
 
 /*****************************************************************************
- * append_msg_signature()
+ * msg_builder_init()
  ****************************************************************************/
-int append_msg_signature(EVP_PKEY * sign_key,
-                         ECDHMessage * msg)
+int msg_builder_init(ECDHMessageBuilder * builder, size_t body_len,
+                     EVP_PKEY * sign_key)
 {
-  // compute message signature
-  unsigned char *signature_bytes = NULL;
-  unsigned int signature_len = 0;
+  memset(builder, 0, sizeof(ECDHMessageBuilder));
 
-  if (EXIT_SUCCESS != ec_sign_buffer(sign_key,
-                                     msg->body,
-                                     msg->hdr.msg_size,
-                                     &signature_bytes,
-                                     &signature_len))
+  // room for the fields, then the signature size and (largest) signature
+  int max_sig_len = EVP_PKEY_size(sign_key);
+
+  if (max_sig_len <= 0)
+  {
+    kmyth_sgx_log(LOG_ERR, "invalid value for maximum signature length");
+    return EXIT_FAILURE;
+  }
+  if (body_len > UINT16_MAX - 2 - (size_t) max_sig_len)
+  {
+    kmyth_sgx_log(LOG_ERR, "computed output message size too large");
+    return EXIT_FAILURE;
+  }
+  builder->size = body_len + 2 + (size_t) max_sig_len;
+  builder->buf = calloc(builder->size, sizeof(unsigned char));
+  if (builder->buf == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "error allocating memory for message buffer");
+    builder->size = 0;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * msg_builder_reserve()
+ ****************************************************************************/
+static uint8_t *msg_builder_reserve(ECDHMessageBuilder * builder, size_t len)
+{
+  if (builder->overflow || len > builder->size - builder->len)
+  {
+    builder->overflow = true;
+    return NULL;
+  }
+
+  uint8_t *pos = builder->buf + builder->len;
+
+  builder->len += len;
+  return pos;
+}
+
+/*****************************************************************************
+ * msg_builder_put_u8()
+ ****************************************************************************/
+void msg_builder_put_u8(ECDHMessageBuilder * builder, uint8_t val)
+{
+  uint8_t *pos = msg_builder_reserve(builder, 1);
+
+  if (pos != NULL)
+  {
+    *pos = val;
+  }
+}
+
+/*****************************************************************************
+ * msg_builder_put_u32()
+ ****************************************************************************/
+void msg_builder_put_u32(ECDHMessageBuilder * builder, uint32_t val)
+{
+  uint8_t *pos = msg_builder_reserve(builder, 4);
+
+  if (pos != NULL)
+  {
+    uint32_t be_val = htobe32(val);
+
+    memcpy(pos, &be_val, 4);
+  }
+}
+
+/*****************************************************************************
+ * msg_builder_put_field()
+ ****************************************************************************/
+void msg_builder_put_field(ECDHMessageBuilder * builder,
+                           const uint8_t * bytes, size_t len)
+{
+  if (len > UINT16_MAX)
+  {
+    builder->overflow = true;
+    return;
+  }
+
+  uint8_t *pos = msg_builder_reserve(builder, 2 + len);
+
+  if (pos != NULL)
+  {
+    uint16_t be_len = htobe16((uint16_t) len);
+
+    memcpy(pos, &be_len, 2);
+    if (len > 0)
+    {
+      memcpy(pos + 2, bytes, len);
+    }
+  }
+}
+
+/*****************************************************************************
+ * msg_builder_sign()
+ ****************************************************************************/
+int msg_builder_sign(ECDHMessageBuilder * builder, EVP_PKEY * sign_key,
+                     ECDHMessage * msg_out)
+{
+  // the signature is written, after its size, straight into the space
+  // msg_builder_init() left for it
+  size_t sig_len = 0;
+
+  if (builder->overflow || builder->size - builder->len < 2)
+  {
+    kmyth_sgx_log(LOG_ERR, "message fields overflow message buffer");
+    msg_builder_free(builder);
+    return EXIT_FAILURE;
+  }
+  if (EXIT_SUCCESS != ec_sign_buffer_into(sign_key,
+                                          builder->buf,
+                                          builder->len,
+                                          builder->buf + builder->len + 2,
+                                          builder->size - builder->len - 2,
+                                          &sig_len))
   {
     kmyth_sgx_log(LOG_ERR, "error signing buffer");
+    msg_builder_free(builder);
+    return EXIT_FAILURE;
+  }
+
+  uint16_t be_len = htobe16((uint16_t) sig_len);
+
+  memcpy(builder->buf + builder->len, &be_len, 2);
+  builder->len += 2 + sig_len;
+
+  msg_out->hdr.msg_size = (uint16_t) builder->len;
+  msg_out->body = builder->buf;
+  memset(builder, 0, sizeof(ECDHMessageBuilder));
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * msg_builder_free()
+ ****************************************************************************/
+void msg_builder_free(ECDHMessageBuilder * builder)
+{
+  kmyth_clear_and_free(builder->buf, builder->size);
+  memset(builder, 0, sizeof(ECDHMessageBuilder));
+}
+
+/*****************************************************************************
+ * msg_parser_init()
+ ****************************************************************************/
+void msg_parser_init(ECDHMessageParser * parser, const uint8_t * buf,
+                     size_t size)
+{
+  parser->buf = buf;
+  parser->size = size;
+  parser->pos = 0;
+}
+
+/*****************************************************************************
+ * msg_parser_get_u32()
+ ****************************************************************************/
+int msg_parser_get_u32(ECDHMessageParser * parser, uint32_t * val)
+{
+  if (parser->size - parser->pos < 4)
+  {
+    kmyth_sgx_log(LOG_ERR, "message too short");
     return EXIT_FAILURE;
   }
+  memcpy(val, parser->buf + parser->pos, 4);
+  *val = be32toh(*val);
+  parser->pos += 4;
 
-  // resize input message buffer to make room for appended signature
-  //   - signature size (2 byte unsigned integer)
-  //   - signature value (byte array)
-  size_t orig_buf_len = msg->hdr.msg_size;
-  size_t new_buf_len = msg->hdr.msg_size + (size_t)2 + signature_len;
-  if(new_buf_len > UINT16_MAX)
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * msg_parser_get_field()
+ ****************************************************************************/
+int msg_parser_get_field(ECDHMessageParser * parser,
+                         const uint8_t ** bytes, size_t *len)
+{
+  if (parser->size - parser->pos < 2)
   {
-    kmyth_sgx_log(LOG_ERR, "new buffer length exceeds UINT16_MAX");
-    msg->hdr.msg_size = 0;
-    free(signature_bytes);
+    kmyth_sgx_log(LOG_ERR, "message too short");
     return EXIT_FAILURE;
   }
-  
-  msg->body = realloc(msg->body, new_buf_len);
-  if (msg->body == NULL)
+  *len = ((size_t) parser->buf[parser->pos] << 8) |
+    parser->buf[parser->pos + 1];
+  if (parser->size - parser->pos - 2 < *len)
   {
-    kmyth_sgx_log(LOG_ERR, "realloc error for resized input buffer");
-    msg->hdr.msg_size = 0;
-    free(signature_bytes);
+    kmyth_sgx_log(LOG_ERR, "message field overruns message");
     return EXIT_FAILURE;
   }
-  
-  msg->hdr.msg_size = (uint16_t)new_buf_len;
-  unsigned char *buf_ptr = msg->body + orig_buf_len;
-  
-  // append signature size bytes
-  uint16_t temp_val = htobe16((uint16_t) signature_len);
-  memcpy(buf_ptr, &temp_val, 2);
-  buf_ptr += 2;
+  *bytes = parser->buf + parser->pos + 2;
+  parser->pos += 2 + *len;
 
-  // finally, append signature bytes
-  memcpy(buf_ptr, signature_bytes, signature_len);
-  free(signature_bytes);
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * msg_parser_get_signature()
+ ****************************************************************************/
+int msg_parser_get_signature(ECDHMessageParser * parser,
+                             size_t *signed_len,
+                             const uint8_t ** sig, size_t *sig_len)
+{
+  *signed_len = parser->pos;
+  if (EXIT_SUCCESS != msg_parser_get_field(parser, sig, sig_len))
+  {
+    return EXIT_FAILURE;
+  }
+
+  // check that number of parsed bytes matches message length
+  if (parser->pos != parser->size)
+  {
+    kmyth_sgx_log(LOG_ERR, "parsed byte count mismatches input message length");
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * check_hello_msg_prefix()
+ ****************************************************************************/
+int check_hello_msg_prefix(ECDHMessage * msg_in, uint8_t * group)
+{
+  if (msg_in->hdr.msg_size < KMYTH_ECDH_HELLO_PREFIX_LEN)
+  {
+    kmyth_sgx_log(LOG_ERR, "'Hello' message too short");
+    return EXIT_FAILURE;
+  }
+  if (msg_in->body[0] != KMYTH_ECDH_PROTOCOL_VERSION)
+  {
+    kmyth_sgx_log(LOG_ERR, "unsupported 'retrieve key' protocol version");
+    return EXIT_FAILURE;
+  }
+  *group = msg_in->body[1];
+  if ((*group != KMYTH_ECDH_GROUP_EC) && (*group != KMYTH_ECDH_GROUP_X25519))
+  {
+    kmyth_sgx_log(LOG_ERR, "unsupported key agreement group");
+    return EXIT_FAILURE;
+  }
 
   return EXIT_SUCCESS;
 }
@@ -131,83 +327,63 @@ int compose_client_hello_msg(EVP_PKEY * client_sign_key,
   }
   X509_NAME_free(client_id);
 
+  // the type of the client's ephemeral key selects the key agreement group
+  uint8_t group = 0;
+
+  if (EXIT_SUCCESS != get_ecdh_group(client_eph_pubkey, &group))
+  {
+    kmyth_clear_and_free(client_id_bytes, client_id_len);
+    return EXIT_FAILURE;
+  }
+
   // Convert client's ephemeral public key to octet string
   unsigned char *client_eph_pubkey_bytes = NULL;
   size_t client_eph_pubkey_len = 0;
-  
-  EC_KEY *client_eph_ec_pubkey = EVP_PKEY_get1_EC_KEY(client_eph_pubkey);
-  if (client_eph_ec_pubkey == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error extracting EC_KEY from EVP_PKEY struct");
-    free(client_id_bytes);
-    return EXIT_FAILURE;
-  } 
-  
-  client_eph_pubkey_len = EC_KEY_key2buf(client_eph_ec_pubkey,
-                                         POINT_CONVERSION_UNCOMPRESSED,
-                                         &client_eph_pubkey_bytes,
-                                         NULL);
-  if ((client_eph_pubkey_bytes == NULL) || (client_eph_pubkey_len == 0))
-  {
-    kmyth_sgx_log(LOG_ERR, "EC_KEY to octet string conversion failed");
+
+  if (EXIT_SUCCESS != ecdh_pubkey_to_octets(client_eph_pubkey,
+                                            &client_eph_pubkey_bytes,
+                                            &client_eph_pubkey_len))
+  {
     kmyth_clear_and_free(client_id_bytes, client_id_len);
-    EC_KEY_free(client_eph_ec_pubkey);
     return EXIT_FAILURE;
   }
-  EC_KEY_free(client_eph_ec_pubkey);
 
-  // allocate memory for 'Client Hello' message body byte array
+  // write the 'Client Hello' message body into one buffer:
+  //  - Protocol version (one byte)
+  //  - Key agreement group (one byte)
   //  - Client ID size (two-byte unsigned integer)
   //  - Client ID value (byte array)
   //  - Client ephemeral public key size (two-byte unsigned integer)
   //  - Client ephemeral public key value (byte array)
-  msg_out->hdr.msg_size  = (uint16_t)(2 + client_id_len + 2 + client_eph_pubkey_len);
+  ECDHMessageBuilder builder;
 
-  msg_out->body = calloc(msg_out->hdr.msg_size, sizeof(unsigned char));
-  if (msg_out->body == NULL)
+  if (EXIT_SUCCESS != msg_builder_init(&builder,
+                                       KMYTH_ECDH_HELLO_PREFIX_LEN +
+                                       2 + client_id_len +
+                                       2 + client_eph_pubkey_len,
+                                       client_sign_key))
   {
-    kmyth_sgx_log(LOG_ERR, "error allocating memory for message buffer");
     kmyth_clear_and_free(client_id_bytes, client_id_len);
     kmyth_clear_and_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
     return EXIT_FAILURE;
   }
-
-  // initialize:
-  //   - 2-byte unsigned integer to facilitate length value format conversions
-  //   - index to newly allocated, empty message buffer
-  uint16_t temp_val = 0;
-  size_t index = 0;
-
-  // insert client identity length bytes
-  temp_val = htobe16((uint16_t) client_id_len);
-  memcpy(msg_out->body, &temp_val, 2);
-  index += 2;
-
-  // append client identity bytes
-  memcpy(msg_out->body+index, client_id_bytes, client_id_len);
-  index += client_id_len;
+  msg_builder_put_u8(&builder, KMYTH_ECDH_PROTOCOL_VERSION);
+  msg_builder_put_u8(&builder, group);
+  msg_builder_put_field(&builder, client_id_bytes, client_id_len);
+  msg_builder_put_field(&builder, client_eph_pubkey_bytes,
+                        client_eph_pubkey_len);
   kmyth_clear_and_free(client_id_bytes, client_id_len);
-
-  // append client_ephemeral public key length bytes
-  temp_val = htobe16((uint16_t) client_eph_pubkey_len);
-  memcpy(msg_out->body+index, &temp_val, 2);
-  index += 2;
-
-  // append client ephemeral public key bytes
-  memcpy(msg_out->body+index,
-         client_eph_pubkey_bytes,
-         client_eph_pubkey_len);
   kmyth_clear_and_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
 
   // append signature to tail end of message
-  if (EXIT_SUCCESS != append_msg_signature(client_sign_key, msg_out))
+  if (EXIT_SUCCESS != msg_builder_sign(&builder, client_sign_key, msg_out))
   {
     kmyth_sgx_log(LOG_ERR, "error appending message signature");
     return EXIT_FAILURE;
   }
 
   return EXIT_SUCCESS;
-}                                 
+}
 
 /*****************************************************************************
  * parse_client_hello_msg()
@@ -216,74 +392,52 @@ int parse_client_hello_msg(ECDHMessage * msg_in,
                            X509 * client_sign_cert,
                            EVP_PKEY ** client_eph_pubkey)
 {
-  // parse out fields in 'Client Hello' message buffer
-  size_t buf_index = 0;
-
-  // get client identity field size
-  uint16_t client_id_len = (uint16_t)(msg_in->body[buf_index] << 8);
-  client_id_len = (uint16_t)(client_id_len + msg_in->body[buf_index+1]);
-  buf_index += 2;
-  
-  // get client identity field bytes
-  uint8_t *client_id_bytes = malloc(client_id_len);
-  if (client_id_bytes == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error allocating memory for client identity");
-    return EXIT_FAILURE;
-  }
-  memcpy(client_id_bytes, msg_in->body+buf_index, client_id_len);
-  buf_index += client_id_len;
+  // get protocol version and key agreement group
+  uint8_t group = 0;
 
-  // get client ephemeral contribution field size
-  uint16_t client_eph_pub_len = (uint16_t)(msg_in->body[buf_index] << 8);
-  client_eph_pub_len = (uint16_t)(client_eph_pub_len + msg_in->body[buf_index+1]);
-  buf_index += 2;
-
-  // get client ephemeral contribution field bytes
-  unsigned char *client_eph_pub_bytes = malloc(client_eph_pub_len);
-  if (client_eph_pub_bytes == NULL)
+  if (EXIT_SUCCESS != check_hello_msg_prefix(msg_in, &group))
   {
-    kmyth_sgx_log(LOG_ERR, "error allocating client ephemeral byte buffer");
-    free(client_id_bytes);
+    kmyth_sgx_log(LOG_ERR, "'Client Hello' - unsupported version or group");
     return EXIT_FAILURE;
   }
-  memcpy(client_eph_pub_bytes, msg_in->body+buf_index, client_eph_pub_len);
-  buf_index += client_eph_pub_len;
-
-  // buffer index now points just past end of message body
-  // capture this index so we can access message body as part of input buffer
-  size_t msg_body_size = buf_index;
 
-  // get message signature size
-  uint16_t msg_sig_len = (uint16_t)(msg_in->body[buf_index] << 8);
-  msg_sig_len = (uint16_t)(msg_sig_len + msg_in->body[buf_index+1]);
-  buf_index += 2;
+  // parse out views of the fields in the 'Client Hello' message buffer
+  ECDHMessageParser parser;
+  const uint8_t *client_id_bytes = NULL;
+  size_t client_id_len = 0;
+  const uint8_t *client_eph_pub_bytes = NULL;
+  size_t client_eph_pub_len = 0;
+  size_t msg_body_size = 0;
+  const uint8_t *msg_sig_bytes = NULL;
+  size_t msg_sig_len = 0;
 
-  // get message signature bytes
-  uint8_t *msg_sig_bytes = malloc(msg_sig_len);
-  if (msg_sig_bytes == NULL)
+  msg_parser_init(&parser, msg_in->body, msg_in->hdr.msg_size);
+  parser.pos = KMYTH_ECDH_HELLO_PREFIX_LEN;
+  if ((EXIT_SUCCESS != msg_parser_get_field(&parser,
+                                            &client_id_bytes,
+                                            &client_id_len)) ||
+      (EXIT_SUCCESS != msg_parser_get_field(&parser,
+                                            &client_eph_pub_bytes,
+                                            &client_eph_pub_len)) ||
+      (EXIT_SUCCESS != msg_parser_get_signature(&parser,
+                                                &msg_body_size,
+                                                &msg_sig_bytes,
+                                                &msg_sig_len)))
   {
-    kmyth_sgx_log(LOG_ERR, "error allocating message signature byte buffer");
-    free(client_id_bytes);
-    free(client_eph_pub_bytes);
+    kmyth_sgx_log(LOG_ERR, "'Client Hello' message malformed");
     return EXIT_FAILURE;
   }
-  memcpy(msg_sig_bytes, msg_in->body+buf_index, msg_sig_len);
 
   // convert client identity bytes in message to X509_NAME struct
   X509_NAME *client_id = NULL;
 
-  if (EXIT_SUCCESS != unmarshal_der_to_x509_name((const uint8_t *) client_id_bytes,
-                                                 (size_t) client_id_len,
+  if (EXIT_SUCCESS != unmarshal_der_to_x509_name(client_id_bytes,
+                                                 client_id_len,
                                                  &(client_id)))
   {
     kmyth_sgx_log(LOG_ERR, "error unmarshaling client identity bytes");
-    free(client_id_bytes);
-    free(client_eph_pub_bytes);
-    free(msg_sig_bytes);
     return EXIT_FAILURE;
   }
-  free(client_id_bytes);
 
   // extract expected client identity (X509_NAME struct) from pre-loaded cert
   X509_NAME *expected_client_id = NULL;
@@ -293,8 +447,6 @@ int parse_client_hello_msg(ECDHMessage * msg_in,
   {
     kmyth_sgx_log(LOG_ERR, "failed to extract client ID from certificate");
     X509_NAME_free(client_id);
-    free(client_eph_pub_bytes);
-    free(msg_sig_bytes);
     return EXIT_FAILURE;
   }
 
@@ -305,8 +457,6 @@ int parse_client_hello_msg(ECDHMessage * msg_in,
     kmyth_sgx_log(LOG_ERR, "'Client Hello' - unexpected client identity");
     X509_NAME_free(client_id);
     X509_NAME_free(expected_client_id);
-    free(client_eph_pub_bytes);
-    free(msg_sig_bytes);
     return EXIT_FAILURE;
   }
   X509_NAME_free(client_id);
@@ -318,9 +468,6 @@ int parse_client_hello_msg(ECDHMessage * msg_in,
   if (client_sign_pubkey == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error extracting public signature key from cert");
-    EVP_PKEY_free(client_sign_pubkey);
-    free(client_eph_pub_bytes);
-    free(msg_sig_bytes);
     return EXIT_FAILURE;
   }
 
@@ -328,68 +475,26 @@ int parse_client_hello_msg(ECDHMessage * msg_in,
   if (EXIT_SUCCESS != ec_verify_buffer(client_sign_pubkey,
                                        msg_in->body,
                                        msg_body_size,
-                                       msg_sig_bytes,
-                                       msg_sig_len))
+                                       (unsigned char *) msg_sig_bytes,
+                                       (unsigned int) msg_sig_len))
   {
     kmyth_sgx_log(LOG_ERR, "signature over 'Client Hello' message invalid");
     EVP_PKEY_free(client_sign_pubkey);
-    free(client_eph_pub_bytes);
-    free(msg_sig_bytes);
     return EXIT_FAILURE;
   }
   EVP_PKEY_free(client_sign_pubkey);
-  free(msg_sig_bytes);
-
-  // check that the buffer parameter for the public key (EVP_PKEY struct)
-  // was not yet allocated. If it was (e.g., from a previous session), 
-  // free the allocated memory and reset it to a NULL pointer before
-  // creating an empty EVP_PKEY struct.
-  if (*client_eph_pubkey != NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "resetting previously allocated EVP_PKEY struct");
-    free(*client_eph_pubkey);
-    *client_eph_pubkey = NULL;
-  }
-  *client_eph_pubkey = EVP_PKEY_new();
 
-  // initialize an EC_KEY struct for the right elliptic curve
-  EC_KEY *client_eph_ec_pubkey = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
-  if (client_eph_ec_pubkey == NULL)
+  // convert (and check) received client ephemeral public key, in the
+  // group the client selected
+  if (EXIT_SUCCESS != ecdh_octets_to_pubkey(group,
+                                            client_eph_pub_bytes,
+                                            client_eph_pub_len,
+                                            client_eph_pubkey))
   {
-    kmyth_sgx_log(LOG_ERR, "error initializing output EC_KEY struct");
-    free(client_eph_pub_bytes);
-    return EXIT_FAILURE;
-  } 
-
-  // convert DER-formatted byte array to EC_KEY struct
-  if (1 != EC_KEY_oct2key(client_eph_ec_pubkey,
-                          client_eph_pub_bytes,
-                          client_eph_pub_len,
-                          NULL))
-  {
-    kmyth_sgx_log(LOG_ERR, "unmarshal of client ephemeral public key failed");
-    free(client_eph_pub_bytes);
-    return EXIT_FAILURE;
-  }
-  free(client_eph_pub_bytes);
-
-  // check parsed, received ephemeral public key
-  if (1 != EC_KEY_check_key(client_eph_ec_pubkey))
-  {
-    kmyth_sgx_log(LOG_ERR, "checks on client ephemeral public key failed");
+    kmyth_sgx_log(LOG_ERR, "invalid client ephemeral public key");
     return EXIT_FAILURE;
   }
 
-  // encapsulate client ephemeral public key in EVP_PKEY struct
-  if (1 != EVP_PKEY_set1_EC_KEY(*client_eph_pubkey,
-                                client_eph_ec_pubkey))
-  {
-    kmyth_sgx_log(LOG_ERR, "error encapsulating EC_KEY within EVP_PKEY");
-    EC_KEY_free(client_eph_ec_pubkey);
-    return EXIT_FAILURE;
-  }
-  EC_KEY_free(client_eph_ec_pubkey);
-
   return EXIT_SUCCESS;
 }                                 
 
@@ -403,7 +508,7 @@ int compose_server_hello_msg(EVP_PKEY * server_sign_key,
                              ECDHMessage * msg_out)
 {
   // extract server (TLS proxy) ID (subject name) bytes from cert
-  X509_NAME *server_id = X509_NAME_new();
+  X509_NAME *server_id = NULL;
 
   if (EXIT_SUCCESS != extract_identity_bytes_from_x509(server_sign_cert,
                                                        &server_id))
@@ -434,113 +539,80 @@ int compose_server_hello_msg(EVP_PKEY * server_sign_key,
   }
   X509_NAME_free(server_id);
 
+  // the server's ephemeral key must be in the group the client selected
+  uint8_t group = 0;
+  uint8_t client_group = 0;
+
+  if ((EXIT_SUCCESS != get_ecdh_group(server_eph_pubkey, &group)) ||
+      (EXIT_SUCCESS != get_ecdh_group(client_eph_pubkey, &client_group)) ||
+      (group != client_group))
+  {
+    kmyth_sgx_log(LOG_ERR, "server/client ephemeral key group mismatch");
+    kmyth_clear_and_free(server_id_bytes, server_id_len);
+    return EXIT_FAILURE;
+  }
+
   // Convert client-side ephemeral public key to octet string
   unsigned char *client_eph_pubkey_bytes = NULL;
   size_t client_eph_pubkey_len = 0;
 
-  EC_KEY *client_eph_ec_pubkey = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
-  client_eph_ec_pubkey = EVP_PKEY_get1_EC_KEY(client_eph_pubkey);
-  client_eph_pubkey_len = EC_KEY_key2buf(client_eph_ec_pubkey,
-                                         POINT_CONVERSION_UNCOMPRESSED,
-                                         &client_eph_pubkey_bytes,
-                                         NULL);
-  if ((client_eph_pubkey_bytes == NULL) || (client_eph_pubkey_len == 0))
+  if (EXIT_SUCCESS != ecdh_pubkey_to_octets(client_eph_pubkey,
+                                            &client_eph_pubkey_bytes,
+                                            &client_eph_pubkey_len))
   {
-    kmyth_sgx_log(LOG_ERR, "EC_KEY to octet string conversion failed");
     kmyth_clear_and_free(server_id_bytes, server_id_len);
-    kmyth_clear_and_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
-    EC_KEY_free(client_eph_ec_pubkey);
     return EXIT_FAILURE;
   }
-  EC_KEY_free(client_eph_ec_pubkey);
 
   // Convert server's ephemeral public key to octet string
   unsigned char *server_eph_pubkey_bytes = NULL;
   size_t server_eph_pubkey_len = 0;
 
-  EC_KEY *server_eph_ec_pubkey = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
-  server_eph_ec_pubkey = EVP_PKEY_get1_EC_KEY(server_eph_pubkey);
-  server_eph_pubkey_len = EC_KEY_key2buf(server_eph_ec_pubkey,
-                                         POINT_CONVERSION_UNCOMPRESSED,
-                                         &server_eph_pubkey_bytes,
-                                         NULL);
-  if ((server_eph_pubkey_bytes == NULL) || (server_eph_pubkey_len == 0))
+  if (EXIT_SUCCESS != ecdh_pubkey_to_octets(server_eph_pubkey,
+                                            &server_eph_pubkey_bytes,
+                                            &server_eph_pubkey_len))
   {
-    kmyth_sgx_log(LOG_ERR, "EC_KEY to octet string conversion failed");
     kmyth_clear_and_free(server_id_bytes, server_id_len);
     kmyth_clear_and_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
-    kmyth_clear_and_free(server_eph_pubkey_bytes, server_eph_pubkey_len);
-    EC_KEY_free(server_eph_ec_pubkey);
     return EXIT_FAILURE;
   }
-  EC_KEY_free(server_eph_ec_pubkey);
 
-  // allocate memory for 'Server Hello' message body byte array
+  // write the 'Server Hello' message body into one buffer:
+  //  - Protocol version (one byte)
+  //  - Key agreement group (one byte)
   //  - Server ID size (two-byte unsigned integer)
   //  - Server ID value (DER-formatted X509_NAME byte array)
   //  - Client ephemeral size (two-byte unsigned integer)
-  //  - Client ephemeral value (DER formatted EC_KEY byte array) 
+  //  - Client ephemeral value (octet string) 
   //  - Server ephemeral size (two-byte unsigned integer)
-  //  - Server ephemeral value (DER formatted EC_KEY byte array)
-  // TODO: Check for overflow
-  size_t msg_out_size = 2 + server_id_len + 2 + client_eph_pubkey_len + 2 + server_eph_pubkey_len;
-  if(msg_out_size > UINT16_MAX)
-  {
-    kmyth_sgx_log(LOG_ERR, "computed output message size too large");
-    kmyth_clear_and_free(server_id_bytes, server_id_len);
-    kmyth_clear_and_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
-    kmyth_clear_and_free(server_eph_pubkey_bytes, server_eph_pubkey_len);
-    return EXIT_FAILURE;
-  }
-  msg_out->hdr.msg_size = (uint16_t)msg_out_size;
+  //  - Server ephemeral value (octet string)
+  ECDHMessageBuilder builder;
 
-  msg_out->body = malloc(msg_out->hdr.msg_size);
-  if (msg_out->body == NULL)
+  if (EXIT_SUCCESS != msg_builder_init(&builder,
+                                       KMYTH_ECDH_HELLO_PREFIX_LEN +
+                                       2 + server_id_len +
+                                       2 + client_eph_pubkey_len +
+                                       2 + server_eph_pubkey_len,
+                                       server_sign_key))
   {
-    kmyth_sgx_log(LOG_ERR, "error allocating memory for message body buffer");
     kmyth_clear_and_free(server_id_bytes, server_id_len);
     kmyth_clear_and_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
     kmyth_clear_and_free(server_eph_pubkey_bytes, server_eph_pubkey_len);
     return EXIT_FAILURE;
   }
-
-  // initialize:
-  //   - 2-byte unsigned integer to facilitate length value format conversions
-  //   - index to newly allocated, empty message buffer
-  uint16_t temp_val = 0;
-  unsigned char *buf = msg_out->body;
-
-  // insert server identity length bytes
-  temp_val = htobe16((uint16_t) server_id_len);
-  memcpy(buf, &temp_val, 2);
-  buf += 2;
-
-  // append server identity bytes
-  memcpy(buf, server_id_bytes, server_id_len);
-  free(server_id_bytes);
-  buf += server_id_len;
-
-  // append client ephemeral public key length bytes
-  temp_val = htobe16((uint16_t) client_eph_pubkey_len);
-  memcpy(buf, &temp_val, 2);
-  buf += 2;
-
-  // append client ephemeral public key bytes
-  memcpy(buf, client_eph_pubkey_bytes, client_eph_pubkey_len);
-  free(client_eph_pubkey_bytes);
-  buf += client_eph_pubkey_len;
-
-  // append server ephemeral public key length bytes
-  temp_val = htobe16((uint16_t) server_eph_pubkey_len);
-  memcpy(buf, &temp_val, 2);
-  buf += 2;
-
-  // append server ephemeral bytes
-  memcpy(buf, server_eph_pubkey_bytes, server_eph_pubkey_len);
+  msg_builder_put_u8(&builder, KMYTH_ECDH_PROTOCOL_VERSION);
+  msg_builder_put_u8(&builder, group);
+  msg_builder_put_field(&builder, server_id_bytes, server_id_len);
+  msg_builder_put_field(&builder, client_eph_pubkey_bytes,
+                        client_eph_pubkey_len);
+  msg_builder_put_field(&builder, server_eph_pubkey_bytes,
+                        server_eph_pubkey_len);
+  kmyth_clear_and_free(server_id_bytes, server_id_len);
+  kmyth_clear_and_free(client_eph_pubkey_bytes, client_eph_pubkey_len);
   kmyth_clear_and_free(server_eph_pubkey_bytes, server_eph_pubkey_len);
 
   // append signature
-  if (EXIT_SUCCESS != append_msg_signature(server_sign_key, msg_out))
+  if (EXIT_SUCCESS != msg_builder_sign(&builder, server_sign_key, msg_out))
   {
     kmyth_sgx_log(LOG_ERR, "error appending message signature");
     return EXIT_FAILURE;
@@ -557,104 +629,61 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
                            EVP_PKEY * client_eph_pubkey,
                            EVP_PKEY ** server_eph_pubkey)
 {
-  // parse message body fields into variables
-  size_t buf_index = 0;
-
-  // get size of server identity field (server_id_len)
-  uint16_t server_id_len = (uint16_t)(msg_in->body[buf_index] << 8);
-  server_id_len = (uint16_t)(server_id_len + msg_in->body[buf_index+1]);
-  buf_index += 2;
+  // get protocol version and key agreement group - the server must have
+  // used the group of the client's ephemeral key
+  uint8_t group = 0;
+  uint8_t client_group = 0;
 
-  // get server identity field bytes (server_id)
-  uint8_t *server_id_bytes = malloc(server_id_len);
-  if (server_id_bytes == NULL)
+  if ((EXIT_SUCCESS != check_hello_msg_prefix(msg_in, &group)) ||
+      (EXIT_SUCCESS != get_ecdh_group(client_eph_pubkey, &client_group)) ||
+      (group != client_group))
   {
-    kmyth_sgx_log(LOG_ERR, "error allocating memory for server identity");
+    kmyth_sgx_log(LOG_ERR, "'Server Hello' - unexpected version or group");
     return EXIT_FAILURE;
   }
-  memcpy(server_id_bytes, msg_in->body+buf_index, server_id_len);
-  buf_index += server_id_len;
 
-  // get size of client ephemeral contribution field (client_eph_pub_len)
-  uint16_t client_eph_pub_len = (uint16_t)(msg_in->body[buf_index] << 8);
-  client_eph_pub_len = (uint16_t)(client_eph_pub_len + msg_in->body[buf_index+1]);
-  buf_index += 2;
-
-  // get client ephemeral contribution field bytes (client_eph_pub_bytes)
-  unsigned char *client_eph_pub_bytes = malloc(client_eph_pub_len);
-  if (client_eph_pub_bytes == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error allocating client ephemeral byte buffer");
-    free(server_id_bytes);
-    return EXIT_FAILURE;
-  }
-  memcpy(client_eph_pub_bytes, msg_in->body+buf_index, client_eph_pub_len);
-  buf_index += client_eph_pub_len;
-
-  // get size of server ephemeral contribution field (server_eph_pub_len)
-  uint16_t server_eph_pub_len = (uint16_t)(msg_in->body[buf_index] << 8);
-  server_eph_pub_len = (uint16_t)(server_eph_pub_len + msg_in->body[buf_index+1]);
-  buf_index += 2;
-
-  // get server ephemeral contribution field bytes (server_eph_pub_bytes)
-  unsigned char *server_eph_pub_bytes = malloc(server_eph_pub_len);
-  if (server_eph_pub_bytes == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error allocating server ephemeral byte buffer");
-    free(server_id_bytes);
-    free(client_eph_pub_bytes);
-    return EXIT_FAILURE;
-  }
-  memcpy(server_eph_pub_bytes, msg_in->body+buf_index, server_eph_pub_len);
-  buf_index += server_eph_pub_len;
-
-  // buffer index now points just past end of message body
-  // capture this index so we can access message body as part of input buffer
-  size_t msg_body_size = buf_index;
-
-  // get size of message signature
-  uint16_t msg_sig_len = (uint16_t)(msg_in->body[buf_index] << 8);
-  msg_sig_len = (uint16_t)(msg_sig_len + msg_in->body[buf_index+1]);
-  buf_index += 2;
-
-  // get message signature bytes
-  uint8_t *msg_sig_bytes = malloc(msg_sig_len);
-  if (msg_sig_bytes == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error allocating message signature byte buffer");
-    free(server_id_bytes);
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    return EXIT_FAILURE;
-  }
-  memcpy(msg_sig_bytes, msg_in->body+buf_index, msg_sig_len);
-  buf_index += msg_sig_len;
-
-  // check that number of parsed bytes matches message length input parameter
-  if (buf_index != msg_in->hdr.msg_size)
-  {
-    kmyth_sgx_log(LOG_ERR, "parsed byte count mismatches input message length");
-    free(server_id_bytes);
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
+  // parse out views of the fields in the 'Server Hello' message buffer
+  ECDHMessageParser parser;
+  const uint8_t *server_id_bytes = NULL;
+  size_t server_id_len = 0;
+  const uint8_t *client_eph_pub_bytes = NULL;
+  size_t client_eph_pub_len = 0;
+  const uint8_t *server_eph_pub_bytes = NULL;
+  size_t server_eph_pub_len = 0;
+  size_t msg_body_size = 0;
+  const uint8_t *msg_sig_bytes = NULL;
+  size_t msg_sig_len = 0;
+
+  msg_parser_init(&parser, msg_in->body, msg_in->hdr.msg_size);
+  parser.pos = KMYTH_ECDH_HELLO_PREFIX_LEN;
+  if ((EXIT_SUCCESS != msg_parser_get_field(&parser,
+                                            &server_id_bytes,
+                                            &server_id_len)) ||
+      (EXIT_SUCCESS != msg_parser_get_field(&parser,
+                                            &client_eph_pub_bytes,
+                                            &client_eph_pub_len)) ||
+      (EXIT_SUCCESS != msg_parser_get_field(&parser,
+                                            &server_eph_pub_bytes,
+                                            &server_eph_pub_len)) ||
+      (EXIT_SUCCESS != msg_parser_get_signature(&parser,
+                                                &msg_body_size,
+                                                &msg_sig_bytes,
+                                                &msg_sig_len)))
+  {
+    kmyth_sgx_log(LOG_ERR, "'Server Hello' message malformed");
     return EXIT_FAILURE;
   }
 
   // convert server identity bytes in message to X509_NAME struct
   X509_NAME *rcvd_server_id = NULL;
-  if (EXIT_SUCCESS != unmarshal_der_to_x509_name((const uint8_t *) server_id_bytes,
-                                                 (size_t) server_id_len,
+
+  if (EXIT_SUCCESS != unmarshal_der_to_x509_name(server_id_bytes,
+                                                 server_id_len,
                                                  &rcvd_server_id))
   {
     kmyth_sgx_log(LOG_ERR, "error unmarshaling server identity bytes");
-    free(server_id_bytes);
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
     return EXIT_FAILURE;
   }
-  free(server_id_bytes);
 
   // extract expected server identity (X509_NAME struct) from pre-loaded cert
   X509_NAME *expected_server_id = NULL;
@@ -663,9 +692,7 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
                                                        &expected_server_id))
   {
     kmyth_sgx_log(LOG_ERR, "failed to extract ID from certificate");
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
+    X509_NAME_free(rcvd_server_id);
     return EXIT_FAILURE;
   }
 
@@ -674,11 +701,12 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
   if (0 != X509_NAME_cmp(rcvd_server_id, expected_server_id))
   {
     kmyth_sgx_log(LOG_ERR, "'Server Hello' - unexpected server identity");
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
+    X509_NAME_free(rcvd_server_id);
+    X509_NAME_free(expected_server_id);
     return EXIT_FAILURE;
   }
+  X509_NAME_free(rcvd_server_id);
+  X509_NAME_free(expected_server_id);
 
   // extract server's public signing key (needed to verify signature over
   // message) from X509 certificate
@@ -686,9 +714,6 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
   if (server_sign_pubkey == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error extracting public signature key from cert");
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
     return EXIT_FAILURE;
   }
 
@@ -696,107 +721,115 @@ int parse_server_hello_msg(ECDHMessage * msg_in,
   if (EXIT_SUCCESS != ec_verify_buffer(server_sign_pubkey,
                                        msg_in->body,
                                        msg_body_size,
-                                       msg_sig_bytes,
-                                       msg_sig_len))
+                                       (unsigned char *) msg_sig_bytes,
+                                       (unsigned int) msg_sig_len))
   {
     kmyth_sgx_log(LOG_ERR, "signature over 'Server Hello' message invalid");
     EVP_PKEY_free(server_sign_pubkey);
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
     return EXIT_FAILURE;
   }
-
-  // done with signature, clean-up memory
-  free(msg_sig_bytes);
   EVP_PKEY_free(server_sign_pubkey);
 
   // convert received client ephemeral public bytes to EVP_PKEY struct format
-  EC_KEY *rcvd_client_eph_ec_pub = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
-  if (rcvd_client_eph_ec_pub == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error initializing EC_KEY struct");
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    return EXIT_FAILURE;
-  } 
-  if (1 != EC_KEY_oct2key(rcvd_client_eph_ec_pub,
-                          client_eph_pub_bytes,
-                          client_eph_pub_len,
-                          NULL))
+  EVP_PKEY *rcvd_client_eph_pub = NULL;
+
+  if (EXIT_SUCCESS != ecdh_octets_to_pubkey(group,
+                                            client_eph_pub_bytes,
+                                            client_eph_pub_len,
+                                            &rcvd_client_eph_pub))
   {
     kmyth_sgx_log(LOG_ERR, "unmarshal of client ephemeral public key failed");
-    free(client_eph_pub_bytes);
-    free(server_eph_pub_bytes);
-    EC_KEY_free(rcvd_client_eph_ec_pub);
     return EXIT_FAILURE;
   }
-  free(client_eph_pub_bytes);
-  EVP_PKEY *rcvd_client_eph_pub = EVP_PKEY_new();
-  if (1 != EVP_PKEY_set1_EC_KEY(rcvd_client_eph_pub, rcvd_client_eph_ec_pub))
-  {
-    kmyth_sgx_log(LOG_ERR, "error encapsulating EC_KEY in EVP_PKEY");
-    free(server_eph_pub_bytes);
-    EC_KEY_free(rcvd_client_eph_ec_pub);
-    EVP_PKEY_free(rcvd_client_eph_pub);
-    return EXIT_FAILURE;
-  }
-  EC_KEY_free(rcvd_client_eph_ec_pub);
-
 
   // check received client ephemeral public matches expected value
   if (1 != EVP_PKEY_cmp((const EVP_PKEY *) rcvd_client_eph_pub,
                         (const EVP_PKEY *) client_eph_pubkey))
   {
     kmyth_sgx_log(LOG_ERR, "client ephemeral public mismatch");
-    free(server_eph_pub_bytes);
     EVP_PKEY_free(rcvd_client_eph_pub);
     return EXIT_FAILURE;
   }
   EVP_PKEY_free(rcvd_client_eph_pub);
 
-  // convert DER-formatted byte array to EC_KEY struct
-  EC_KEY *server_eph_ec_pubkey = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
-  if (1 != EC_KEY_oct2key(server_eph_ec_pubkey,
-                          server_eph_pub_bytes,
-                          server_eph_pub_len,
-                          NULL))
+  // convert (and check) received server ephemeral public key
+  if (EXIT_SUCCESS != ecdh_octets_to_pubkey(group,
+                                            server_eph_pub_bytes,
+                                            server_eph_pub_len,
+                                            server_eph_pubkey))
   {
-    kmyth_sgx_log(LOG_ERR, "unmarshal of server ephemeral public key failed");
-    free(server_eph_pub_bytes);
-    EC_KEY_free(server_eph_ec_pubkey);
+    kmyth_sgx_log(LOG_ERR, "invalid server ephemeral public key");
     return EXIT_FAILURE;
   }
-  free(server_eph_pub_bytes);
 
-  // check parsed, received ephemeral public key
-  if (1 != EC_KEY_check_key(server_eph_ec_pubkey))
+  return EXIT_SUCCESS;
+}                                 
+
+/*****************************************************************************
+ * encrypt_signed_msg()
+ ****************************************************************************/
+static int encrypt_signed_msg(ByteBuffer * msg_enc_key,
+                              ECDHMessage * pt_msg,
+                              ECDHMessage * msg_out)
+{
+  // if output message buffer allocated, free and set to NULL
+  if (msg_out->body != NULL)
   {
-    kmyth_sgx_log(LOG_ERR, "checks on received ephemeral public key failed");
-    EC_KEY_free(server_eph_ec_pubkey);
-    return EXIT_FAILURE;
+    free(msg_out->body);
+    msg_out->hdr.msg_size = 0;
+    msg_out->body = NULL;
   }
 
-  // create empty EVP_PKEY struct, if previously allocated, free memory first
-  if (*server_eph_pubkey != NULL)
+  size_t ct_len = 0;
+
+  if (EXIT_SUCCESS != aes_gcm_encrypt(msg_enc_key->buffer,
+                                      msg_enc_key->size,
+                                      pt_msg->body,
+                                      pt_msg->hdr.msg_size,
+                                      &(msg_out->body),
+                                      &ct_len))
   {
-    EVP_PKEY_free(*server_eph_pubkey);
-    *server_eph_pubkey = NULL;
+    return EXIT_FAILURE;
   }
-  *server_eph_pubkey = EVP_PKEY_new();
+  if (ct_len > KMYTH_ECDH_MAX_MSG_SIZE)
+  {
+    kmyth_sgx_log(LOG_ERR, "encrypted message exceeds size limit");
+    free(msg_out->body);
+    msg_out->body = NULL;
+    return EXIT_FAILURE;
+  }
+  msg_out->hdr.msg_size = (uint16_t) ct_len;
+
+  return EXIT_SUCCESS;
+}
 
-  // encapsulate server ephemeral public key in EVP_PKEY struct
-  if (1 != EVP_PKEY_set1_EC_KEY(*server_eph_pubkey,
-                                server_eph_ec_pubkey))
+/*****************************************************************************
+ * decrypt_signed_msg()
+ ****************************************************************************/
+static int decrypt_signed_msg(ByteBuffer * msg_dec_key,
+                              ECDHMessage * msg_in,
+                              uint8_t ** pt_bytes,
+                              size_t *pt_len)
+{
+  *pt_bytes = NULL;
+  *pt_len = 0;
+  if (EXIT_SUCCESS != aes_gcm_decrypt(msg_dec_key->buffer,
+                                      msg_dec_key->size,
+                                      msg_in->body,
+                                      msg_in->hdr.msg_size,
+                                      pt_bytes,
+                                      pt_len))
   {
-    kmyth_sgx_log(LOG_ERR, "error encapsulating EC_KEY within EVP_PKEY");
-    EC_KEY_free(server_eph_ec_pubkey);
+    if (*pt_bytes != NULL)
+    {
+      kmyth_clear_and_free(*pt_bytes, *pt_len);
+      *pt_bytes = NULL;
+    }
     return EXIT_FAILURE;
   }
-  EC_KEY_free(server_eph_ec_pubkey);
 
   return EXIT_SUCCESS;
-}                                 
+}
 
 /*****************************************************************************
  * compose_key_request_msg()
@@ -805,6 +838,7 @@ int compose_key_request_msg(EVP_PKEY * client_sign_key,
                             ByteBuffer * msg_enc_key,
                             ByteBuffer * req_key_id,
                             EVP_PKEY * server_eph_pubkey,
+                            uint32_t msg_seq,
                             ECDHMessage * msg_out)
 {
   // create KMIP key request
@@ -834,92 +868,57 @@ int compose_key_request_msg(EVP_PKEY * client_sign_key,
   unsigned char *server_eph_pubkey_bytes = NULL;
   size_t server_eph_pubkey_len = 0;
 
-  EC_KEY *server_eph_ec_pubkey = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
-  server_eph_ec_pubkey = EVP_PKEY_get1_EC_KEY(server_eph_pubkey);
-  server_eph_pubkey_len = EC_KEY_key2buf(server_eph_ec_pubkey,
-                                         POINT_CONVERSION_UNCOMPRESSED,
-                                         &server_eph_pubkey_bytes,
-                                         NULL);
-  if ((server_eph_pubkey_bytes == NULL) || (server_eph_pubkey_len == 0))
+  if (EXIT_SUCCESS != ecdh_pubkey_to_octets(server_eph_pubkey,
+                                            &server_eph_pubkey_bytes,
+                                            &server_eph_pubkey_len))
   {
-    kmyth_sgx_log(LOG_ERR, "EC_KEY to octet string conversion failed");
     free(kmip_key_request_bytes);
-    EC_KEY_free(server_eph_ec_pubkey);
     return EXIT_FAILURE;
   }
-  EC_KEY_free(server_eph_ec_pubkey);
 
-  // allocate memory for 'Key Request' message body byte array
+  // write the 'Key Request' message body into one buffer:
+  //  - Sequence number (four-byte unsigned integer)
   //  - KMIP key request size (two-byte unsigned integer)
   //  - KMIP key request bytes (byte array)
   //  - Server ephemeral size (two-byte unsigned integer)
-  //  - Server ephemeral value (DER formatted EC_KEY byte array)
-  ECDHMessage pt_msg = { 0 };
-  // TODO: Check for overflow
-  pt_msg.hdr.msg_size = (uint16_t)(2 + kmip_key_request_len +
-				   2 + server_eph_pubkey_len);
-  pt_msg.body = calloc(pt_msg.hdr.msg_size, sizeof(unsigned char));
-  if (pt_msg.body == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error allocating memory for message body buffer");
+  //  - Server ephemeral value (octet string)
+  ECDHMessageBuilder builder;
+
+  if (EXIT_SUCCESS != msg_builder_init(&builder,
+                                       KMYTH_ECDH_SEQ_LEN +
+                                       2 + kmip_key_request_len +
+                                       2 + server_eph_pubkey_len,
+                                       client_sign_key))
+  {
     free(kmip_key_request_bytes);
     free(server_eph_pubkey_bytes);
     return EXIT_FAILURE;
   }
-
-  // initialize variables used to construct message body:
-  //   - 2-byte unsigned integer to facilitate length value format conversions
-  //   - index to newly allocated, empty message buffer
-  uint16_t temp_val = 0;
-  unsigned char *buf_ptr = pt_msg.body;
-
-  // insert kmip key request size  
-  temp_val = htobe16((uint16_t) kmip_key_request_len);
-  memcpy(buf_ptr, &temp_val, 2);
-  buf_ptr += 2;
-
-  // insert KMIP key request bytes
-  memcpy(buf_ptr, kmip_key_request_bytes, kmip_key_request_len);
+  msg_builder_put_u32(&builder, msg_seq);
+  msg_builder_put_field(&builder, kmip_key_request_bytes,
+                        kmip_key_request_len);
+  msg_builder_put_field(&builder, server_eph_pubkey_bytes,
+                        server_eph_pubkey_len);
   free(kmip_key_request_bytes);
-  buf_ptr += kmip_key_request_len;
-
-  // append server ephemeral public key length bytes
-  temp_val = htobe16((uint16_t) server_eph_pubkey_len);
-  memcpy(buf_ptr, &temp_val, 2);
-  buf_ptr += 2;
-
-  // append server ephemeral bytes
-  memcpy(buf_ptr, server_eph_pubkey_bytes, server_eph_pubkey_len);
   free(server_eph_pubkey_bytes);
 
   // append signature
-  if (EXIT_SUCCESS != append_msg_signature(client_sign_key, &pt_msg))
+  ECDHMessage pt_msg = { { 0 }, NULL };
+
+  if (EXIT_SUCCESS != msg_builder_sign(&builder, client_sign_key, &pt_msg))
   {
     kmyth_sgx_log(LOG_ERR, "error appending message signature");
     return EXIT_FAILURE;
   }
 
-  // if output message buffer allocated, free and set to NULL
-  if (msg_out->body != NULL)
-  {
-    free(msg_out->body);
-    msg_out->hdr.msg_size = 0;
-    msg_out->body = NULL;
-  }
-
   // encrypt signed 'Key Request' message using the specified key
-  if (EXIT_SUCCESS != aes_gcm_encrypt(msg_enc_key->buffer,
-                                      msg_enc_key->size,
-                                      pt_msg.body,
-                                      pt_msg.hdr.msg_size,
-                                      &(msg_out->body),
-                                      (size_t *) &(msg_out->hdr.msg_size)))
+  if (EXIT_SUCCESS != encrypt_signed_msg(msg_enc_key, &pt_msg, msg_out))
   {
     kmyth_sgx_log(LOG_ERR, "failed to encrypt the 'Key Request' message");
-    free(pt_msg.body);
+    kmyth_clear_and_free(pt_msg.body, pt_msg.hdr.msg_size);
     return EXIT_FAILURE;
   }
-  free(pt_msg.body);
+  kmyth_clear_and_free(pt_msg.body, pt_msg.hdr.msg_size);
 
   return EXIT_SUCCESS;
 }
@@ -931,160 +930,100 @@ int parse_key_request_msg(X509 * client_sign_cert,
                           ByteBuffer * msg_dec_key,
                           ECDHMessage * msg_in,
                           EVP_PKEY * server_eph_pubkey,
+                          uint32_t msg_seq,
                           ByteBuffer * kmip_request)
 {
+  kmip_request->buffer = NULL;
+  kmip_request->size = 0;
+
   // decrypt message using input message encryption key
-  ECDHMessage pt_msg = { { 0 }, NULL };
+  uint8_t *pt_bytes = NULL;
+  size_t pt_len = 0;
 
-  if (EXIT_SUCCESS != aes_gcm_decrypt(msg_dec_key->buffer,
-                                      msg_dec_key->size,
-                                      msg_in->body,
-                                      msg_in->hdr.msg_size,
-                                      &(pt_msg.body),
-                                      (size_t *) &(pt_msg.hdr.msg_size)))
+  if (EXIT_SUCCESS != decrypt_signed_msg(msg_dec_key, msg_in,
+                                         &pt_bytes, &pt_len))
   {
     kmyth_sgx_log(LOG_ERR, "failed to decrypt the 'Key Request' message");
-    if (pt_msg.body != NULL)
-    {
-      free(pt_msg.body);
-    }
-    return EXIT_FAILURE;
-  }
-
-  // parse message body fields into variables
-  size_t buf_index = 0;
-
-  // get size (in bytes) of KMIP 'get key' request field
-  kmip_request->size = (uint16_t)(pt_msg.body[buf_index] << 8);
-  kmip_request->size = (uint16_t)(kmip_request->size + pt_msg.body[buf_index+1]);
-  buf_index += 2;
-
-  // get KMIP 'get key' request bytes
-  kmip_request->buffer = malloc(kmip_request->size);
-  if (kmip_request->buffer == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error allocating KMIP request byte buffer");
     return EXIT_FAILURE;
   }
-  memcpy(kmip_request->buffer, pt_msg.body+buf_index, kmip_request->size);
-  buf_index += kmip_request->size;
 
-  // get size of server-side ephemeral public key field
-  uint16_t server_eph_pub_len = (uint16_t)(pt_msg.body[buf_index] << 8);
-  server_eph_pub_len = (uint16_t)(server_eph_pub_len + pt_msg.body[buf_index+1]);
-  buf_index += 2;
+  // parse out views of the fields in the decrypted message - the sequence
+  // number is checked once the signature has been verified
+  ECDHMessageParser parser;
+  uint32_t rcvd_msg_seq = 0;
+  const uint8_t *kmip_request_bytes = NULL;
+  size_t kmip_request_len = 0;
+  const uint8_t *server_eph_pub_bytes = NULL;
+  size_t server_eph_pub_len = 0;
+  size_t msg_body_size = 0;
+  const uint8_t *msg_sig_bytes = NULL;
+  size_t msg_sig_len = 0;
 
-  // get server-side ephemeral public key field bytes
-  unsigned char *server_eph_pub_bytes = malloc(server_eph_pub_len);
-  if (server_eph_pub_bytes == NULL)
+  msg_parser_init(&parser, pt_bytes, pt_len);
+  if ((EXIT_SUCCESS != msg_parser_get_u32(&parser, &rcvd_msg_seq)) ||
+      (EXIT_SUCCESS != msg_parser_get_field(&parser,
+                                            &kmip_request_bytes,
+                                            &kmip_request_len)) ||
+      (EXIT_SUCCESS != msg_parser_get_field(&parser,
+                                            &server_eph_pub_bytes,
+                                            &server_eph_pub_len)) ||
+      (EXIT_SUCCESS != msg_parser_get_signature(&parser,
+                                                &msg_body_size,
+                                                &msg_sig_bytes,
+                                                &msg_sig_len)))
   {
-    kmyth_sgx_log(LOG_ERR, "error allocating server ephemeral byte buffer");
-    free(kmip_request->buffer);
-    kmyth_clear(kmip_request, sizeof(ByteBuffer));
+    kmyth_sgx_log(LOG_ERR, "'Key Request' message malformed");
+    kmyth_clear_and_free(pt_bytes, pt_len);
     return EXIT_FAILURE;
   }
-  memcpy(server_eph_pub_bytes, pt_msg.body+buf_index, server_eph_pub_len);
-  buf_index += server_eph_pub_len;
-
-  // buffer index now points just past end of message body
-  // capture this index so we can access message body as part of input buffer
-  size_t msg_body_size = buf_index;
 
-  // get size of message signature
-  uint16_t msg_sig_len = (uint16_t)(pt_msg.body[buf_index] << 8);
-  msg_sig_len = (uint16_t)(msg_sig_len + pt_msg.body[buf_index+1]);
-  buf_index += 2;
-
-  // get message signature bytes
-  uint8_t *msg_sig_bytes = malloc(msg_sig_len);
-  if (msg_sig_bytes == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error allocating message signature byte buffer");
-    free(kmip_request->buffer);
-    kmyth_clear(kmip_request, sizeof(ByteBuffer));
-    free(server_eph_pub_bytes);
-    return EXIT_FAILURE;
-  }
-  memcpy(msg_sig_bytes, pt_msg.body+buf_index, msg_sig_len);
-  buf_index += msg_sig_len;
-
-  // check that number of parsed bytes matches message length input parameter
-  if (buf_index != pt_msg.hdr.msg_size)
-  {
-    kmyth_sgx_log(LOG_ERR, "parsed byte count mismatches input message length");
-    free(kmip_request->buffer);
-    kmyth_clear(kmip_request, sizeof(ByteBuffer));
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
-    return EXIT_FAILURE;
-  }
-
-  // extract server's public signing key (needed to verify signature over
+  // extract client's public signing key (needed to verify signature over
   // message) from X509 certificate
   EVP_PKEY *msg_sign_pubkey = X509_get_pubkey(client_sign_cert);
   if (msg_sign_pubkey == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error extracting public signature key from cert");
-    free(kmip_request->buffer);
-    kmyth_clear(kmip_request, sizeof(ByteBuffer));
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
+    kmyth_clear_and_free(pt_bytes, pt_len);
     return EXIT_FAILURE;
   }
 
   // check message signature
   if (EXIT_SUCCESS != ec_verify_buffer(msg_sign_pubkey,
-                                       pt_msg.body,
+                                       pt_bytes,
                                        msg_body_size,
-                                       msg_sig_bytes,
-                                       msg_sig_len))
+                                       (unsigned char *) msg_sig_bytes,
+                                       (unsigned int) msg_sig_len))
   {
     kmyth_sgx_log(LOG_ERR, "signature over 'Key Request' message invalid");
-    free(kmip_request->buffer);
-    kmyth_clear(kmip_request, sizeof(ByteBuffer));
-    free(server_eph_pub_bytes);
-    free(msg_sig_bytes);
+    EVP_PKEY_free(msg_sign_pubkey);
+    kmyth_clear_and_free(pt_bytes, pt_len);
     return EXIT_FAILURE;
   }
+  EVP_PKEY_free(msg_sign_pubkey);
 
-  // done with signature, clean-up memory
-  free(msg_sig_bytes);
-
-  // convert received client ephemeral public bytes to EVP_PKEY struct format
-  EC_KEY *rcvd_server_eph_ec_pub = EC_KEY_new_by_curve_name(KMYTH_EC_NID);
-  if (rcvd_server_eph_ec_pub == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error initializing EC_KEY struct");
-    free(kmip_request->buffer);
-    kmyth_clear(kmip_request, sizeof(ByteBuffer));
-    free(server_eph_pub_bytes);
-    return EXIT_FAILURE;
-  } 
-  if (1 != EC_KEY_oct2key(rcvd_server_eph_ec_pub,
-                          server_eph_pub_bytes,
-                          server_eph_pub_len,
-                          NULL))
+  // a replayed (or reordered) request carries an unexpected sequence number
+  if (rcvd_msg_seq != msg_seq)
   {
-    kmyth_sgx_log(LOG_ERR, "unmarshal of server ephemeral public key failed");
-    free(kmip_request->buffer);
-    kmyth_clear(kmip_request, sizeof(ByteBuffer));
-    free(server_eph_pub_bytes);
-    EC_KEY_free(rcvd_server_eph_ec_pub);
+    kmyth_sgx_log(LOG_ERR, "unexpected 'Key Request' sequence number");
+    kmyth_clear_and_free(pt_bytes, pt_len);
     return EXIT_FAILURE;
   }
-  free(server_eph_pub_bytes);
 
-  EVP_PKEY *rcvd_server_eph_pub = EVP_PKEY_new();
-  if (1 != EVP_PKEY_set1_EC_KEY(rcvd_server_eph_pub, rcvd_server_eph_ec_pub))
+  // convert received server ephemeral public bytes to EVP_PKEY struct format
+  // (in the group of the expected server ephemeral public key)
+  uint8_t group = 0;
+  EVP_PKEY *rcvd_server_eph_pub = NULL;
+
+  if ((EXIT_SUCCESS != get_ecdh_group(server_eph_pubkey, &group)) ||
+      (EXIT_SUCCESS != ecdh_octets_to_pubkey(group,
+                                             server_eph_pub_bytes,
+                                             server_eph_pub_len,
+                                             &rcvd_server_eph_pub)))
   {
-    kmyth_sgx_log(LOG_ERR, "error encapsulating EC_KEY in EVP_PKEY");
-    free(kmip_request->buffer);
-    kmyth_clear(kmip_request, sizeof(ByteBuffer));
-    EC_KEY_free(rcvd_server_eph_ec_pub);
-    EVP_PKEY_free(rcvd_server_eph_pub);
+    kmyth_sgx_log(LOG_ERR, "unmarshal of server ephemeral public key failed");
+    kmyth_clear_and_free(pt_bytes, pt_len);
     return EXIT_FAILURE;
   }
-  EC_KEY_free(rcvd_server_eph_ec_pub);
 
   // check received server ephemeral public matches expected value
   // (Note: EVP_PKEY_cmp() compares public parameters and components)
@@ -1092,13 +1031,25 @@ int parse_key_request_msg(X509 * client_sign_cert,
                         (const EVP_PKEY *) server_eph_pubkey))
   {
     kmyth_sgx_log(LOG_ERR, "server ephemeral public mismatch");
-    free(kmip_request->buffer);
-    kmyth_clear(kmip_request, sizeof(ByteBuffer));
     EVP_PKEY_free(rcvd_server_eph_pub);
+    kmyth_clear_and_free(pt_bytes, pt_len);
     return EXIT_FAILURE;
   }
   EVP_PKEY_free(rcvd_server_eph_pub);
 
+  // the KMIP request is the only field the caller keeps, so it is the only
+  // one copied out of the decrypted message
+  kmip_request->buffer = malloc(kmip_request_len);
+  if (kmip_request->buffer == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "error allocating KMIP request byte buffer");
+    kmyth_clear_and_free(pt_bytes, pt_len);
+    return EXIT_FAILURE;
+  }
+  memcpy(kmip_request->buffer, kmip_request_bytes, kmip_request_len);
+  kmip_request->size = kmip_request_len;
+  kmyth_clear_and_free(pt_bytes, pt_len);
+
   return EXIT_SUCCESS;
 }
 
@@ -1108,59 +1059,37 @@ int parse_key_request_msg(X509 * client_sign_cert,
 int compose_key_response_msg(EVP_PKEY * server_sign_key,
                              ByteBuffer * msg_enc_key,
                              ByteBuffer * kmip_response,
+                             uint32_t msg_seq,
                              ECDHMessage * msg_out)
 {
-  // allocate memory for 'Key Response' message body byte array
+  // write the 'Key Response' message body into one buffer:
+  //  - Sequence number (four-byte unsigned integer), that of the request
+  //    being answered
   //  - KMIP 'get key' response size (two-byte unsigned integer)
   //  - KMIP 'get key' response bytes (byte array)
-  ECDHMessage pt_msg = { { 0 }, NULL };
-  // TODO: Confirm this doesn't overflow
-  pt_msg.hdr.msg_size = (uint16_t)(2 + kmip_response->size);
+  ECDHMessageBuilder builder;
 
-  pt_msg.body = calloc(pt_msg.hdr.msg_size, sizeof(unsigned char));
-  if (pt_msg.body == NULL)
+  if (EXIT_SUCCESS != msg_builder_init(&builder,
+                                       KMYTH_ECDH_SEQ_LEN +
+                                       2 + kmip_response->size,
+                                       server_sign_key))
   {
-    kmyth_sgx_log(LOG_ERR, "error allocating memory for message body buffer");
     return EXIT_FAILURE;
   }
-
-  // initialize variables used to compose message body:
-  //   - 2-byte unsigned integer to facilitate length value format conversions
-  //   - index to newly allocated, empty message buffer
-  uint16_t temp_val = 0;
-  unsigned char *buf_ptr = pt_msg.body;
-
-  // insert KMIP 'get key' response size
-  temp_val = htobe16((uint16_t) kmip_response->size);
-  memcpy(buf_ptr, &temp_val, 2);
-  buf_ptr += 2;
-
-  // insert KMIP 'get key' response bytes
-  memcpy(buf_ptr, kmip_response->buffer, kmip_response->size);
+  msg_builder_put_u32(&builder, msg_seq);
+  msg_builder_put_field(&builder, kmip_response->buffer, kmip_response->size);
 
   // append signature to unencrypted 'Key Response' message
-  if (EXIT_SUCCESS != append_msg_signature(server_sign_key, &pt_msg))
+  ECDHMessage pt_msg = { { 0 }, NULL };
+
+  if (EXIT_SUCCESS != msg_builder_sign(&builder, server_sign_key, &pt_msg))
   {
     kmyth_sgx_log(LOG_ERR, "error appending message signature");
-    kmyth_clear_and_free(pt_msg.body, pt_msg.hdr.msg_size);
     return EXIT_FAILURE;
   }
 
-  // if output message buffer allocated, free and set to NULL
-  if (msg_out->body != NULL)
-  {
-    free(msg_out->body);
-    msg_out->hdr.msg_size = 0;
-    msg_out->body = NULL;
-  }
-
   // encrypt signed 'Key Response' message using the specified key
-  if (EXIT_SUCCESS != aes_gcm_encrypt(msg_enc_key->buffer,
-                                      msg_enc_key->size,
-                                      pt_msg.body,
-                                      pt_msg.hdr.msg_size,
-                                      &(msg_out->body),
-                                      (size_t *) &(msg_out->hdr.msg_size)))
+  if (EXIT_SUCCESS != encrypt_signed_msg(msg_enc_key, &pt_msg, msg_out))
   {
     kmyth_sgx_log(LOG_ERR, "failed to encrypt the 'Key Response' message");
     kmyth_clear_and_free(pt_msg.body, pt_msg.hdr.msg_size);
@@ -1177,72 +1106,45 @@ int compose_key_response_msg(EVP_PKEY * server_sign_key,
 int parse_key_response_msg(X509 * server_sign_cert,
                            ByteBuffer * msg_dec_key,
                            ECDHMessage * msg_in,
+                           uint32_t msg_seq,
                            ByteBuffer * kmip_response)
 {
+  kmip_response->buffer = NULL;
+  kmip_response->size = 0;
+
   // decrypt message using input message decryption key
-  ECDHMessage pt_msg = { { 0 }, NULL };
+  uint8_t *pt_bytes = NULL;
+  size_t pt_len = 0;
 
-  if (EXIT_SUCCESS != aes_gcm_decrypt(msg_dec_key->buffer,
-                                      msg_dec_key->size,
-                                      msg_in->body,
-                                      msg_in->hdr.msg_size,
-                                      &(pt_msg.body),
-                                      (size_t *) &(pt_msg.hdr.msg_size)))
+  if (EXIT_SUCCESS != decrypt_signed_msg(msg_dec_key, msg_in,
+                                         &pt_bytes, &pt_len))
   {
     kmyth_sgx_log(LOG_ERR, "failed to decrypt the 'Key Response' message");
-    if (pt_msg.body != NULL)
-    {
-      kmyth_clear_and_free(pt_msg.body, pt_msg.hdr.msg_size);
-    }
-    return EXIT_FAILURE;
-  }
-
-  // parse message body fields into variables
-  size_t buf_index = 0;
-
-  // get size (in bytes) of KMIP 'get key' request field
-  kmip_response->size = (uint16_t)((pt_msg.body)[buf_index] << 8);
-  kmip_response->size = (uint16_t)(kmip_response->size + (pt_msg.body)[buf_index+1]);
-  buf_index += 2;
-
-  // get KMIP 'get key' response bytes
-  kmip_response->buffer = malloc(kmip_response->size);
-  if (kmip_response->buffer == NULL)
-  {
-    kmyth_sgx_log(LOG_ERR, "error allocating KMIP response byte buffer");
     return EXIT_FAILURE;
   }
-  memcpy(kmip_response->buffer, (pt_msg.body)+buf_index, kmip_response->size);
-  buf_index += kmip_response->size;
-
-  // buffer index now points just past end of message body
-  // capture this index so we can access message body as part of input buffer
-  size_t msg_body_size = buf_index;
 
-  // get size of message signature
-  uint16_t msg_sig_len = (uint16_t)((pt_msg.body)[buf_index] << 8);
-  msg_sig_len = (uint16_t)(msg_sig_len + (pt_msg.body)[buf_index+1]);
-  buf_index += 2;
+  // parse out views of the fields in the decrypted message - the sequence
+  // number is checked once the signature has been verified
+  ECDHMessageParser parser;
+  uint32_t rcvd_msg_seq = 0;
+  const uint8_t *kmip_response_bytes = NULL;
+  size_t kmip_response_len = 0;
+  size_t msg_body_size = 0;
+  const uint8_t *msg_sig_bytes = NULL;
+  size_t msg_sig_len = 0;
 
-  // get message signature bytes
-  uint8_t *msg_sig_bytes = malloc(msg_sig_len);
-  if (msg_sig_bytes == NULL)
+  msg_parser_init(&parser, pt_bytes, pt_len);
+  if ((EXIT_SUCCESS != msg_parser_get_u32(&parser, &rcvd_msg_seq)) ||
+      (EXIT_SUCCESS != msg_parser_get_field(&parser,
+                                            &kmip_response_bytes,
+                                            &kmip_response_len)) ||
+      (EXIT_SUCCESS != msg_parser_get_signature(&parser,
+                                                &msg_body_size,
+                                                &msg_sig_bytes,
+                                                &msg_sig_len)))
   {
-    kmyth_sgx_log(LOG_ERR, "error allocating message signature byte buffer");
-    free(kmip_response->buffer);
-    kmyth_clear(kmip_response, sizeof(ByteBuffer));
-    return EXIT_FAILURE;
-  }
-  memcpy(msg_sig_bytes, (pt_msg.body)+buf_index, msg_sig_len);
-  buf_index += msg_sig_len;
-
-  // check that number of parsed bytes matches message length input parameter
-  if (buf_index != pt_msg.hdr.msg_size)
-  {
-    kmyth_sgx_log(LOG_ERR, "parsed byte count mismatches input message length");
-    free(kmip_response->buffer);
-    kmyth_clear(kmip_response, sizeof(ByteBuffer));
-    free(msg_sig_bytes);
+    kmyth_sgx_log(LOG_ERR, "'Key Response' message malformed");
+    kmyth_clear_and_free(pt_bytes, pt_len);
     return EXIT_FAILURE;
   }
 
@@ -1252,30 +1154,44 @@ int parse_key_response_msg(X509 * server_sign_cert,
   if (msg_sign_pubkey == NULL)
   {
     kmyth_sgx_log(LOG_ERR, "error extracting public signature key from cert");
-    free(kmip_response->buffer);
-    kmyth_clear(kmip_response, sizeof(ByteBuffer));
-    free(msg_sig_bytes);
+    kmyth_clear_and_free(pt_bytes, pt_len);
     return EXIT_FAILURE;
   }
 
   // check message signature
   if (EXIT_SUCCESS != ec_verify_buffer(msg_sign_pubkey,
-                                       pt_msg.body,
+                                       pt_bytes,
                                        msg_body_size,
-                                       msg_sig_bytes,
-                                       msg_sig_len))
+                                       (unsigned char *) msg_sig_bytes,
+                                       (unsigned int) msg_sig_len))
   {
-    kmyth_sgx_log(LOG_ERR, "signature over 'Key Request' message invalid");
-    free(kmip_response->buffer);
-    kmyth_clear(kmip_response, sizeof(ByteBuffer));
-    free(msg_sig_bytes);
+    kmyth_sgx_log(LOG_ERR, "signature over 'Key Response' message invalid");
     EVP_PKEY_free(msg_sign_pubkey);
+    kmyth_clear_and_free(pt_bytes, pt_len);
     return EXIT_FAILURE;
   }
-
-  // done with signature, clean-up memory
-  free(msg_sig_bytes);
   EVP_PKEY_free(msg_sign_pubkey);
 
+  // a replayed (or reordered) response carries an unexpected sequence number
+  if (rcvd_msg_seq != msg_seq)
+  {
+    kmyth_sgx_log(LOG_ERR, "unexpected 'Key Response' sequence number");
+    kmyth_clear_and_free(pt_bytes, pt_len);
+    return EXIT_FAILURE;
+  }
+
+  // the KMIP response is the only field the caller keeps, so it is the
+  // only one copied out of the decrypted message
+  kmip_response->buffer = malloc(kmip_response_len);
+  if (kmip_response->buffer == NULL)
+  {
+    kmyth_sgx_log(LOG_ERR, "error allocating KMIP response byte buffer");
+    kmyth_clear_and_free(pt_bytes, pt_len);
+    return EXIT_FAILURE;
+  }
+  memcpy(kmip_response->buffer, kmip_response_bytes, kmip_response_len);
+  kmip_response->size = kmip_response_len;
+  kmyth_clear_and_free(pt_bytes, pt_len);
+
   return EXIT_SUCCESS;
 }
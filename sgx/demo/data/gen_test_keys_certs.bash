@@ -1,12 +1,34 @@
+# Usage: gen_test_keys_certs.bash [ec|ed25519]
+#
+# The argument selects the type of the client (enclave) and proxy signing
+# keys used for the 'retrieve key' protocol messages: ECDSA over secp521r1
+# (the default) or Ed25519. The CA and (TLS) server keys are always EC.
+SIGN_ALG=${1:-ec}
+
+gen_sign_key () {
+  if [ "$SIGN_ALG" = "ed25519" ]; then
+    openssl genpkey -algorithm ed25519 -out $1
+  else
+    openssl ecparam -name secp521r1 -genkey -noout -out $1
+  fi
+}
+
+# Ed25519 does not take a separate digest
+if [ "$SIGN_ALG" = "ed25519" ]; then
+  SIGN_MD=""
+else
+  SIGN_MD="-sha256"
+fi
+
 openssl ecparam -name secp521r1 -genkey -noout -out ca_priv_test.pem
 openssl req -new -x509 -key ca_priv_test.pem -subj "/C=US/O=Kmyth/CN=TestCA" -out ca_cert_test.pem -days 365
 
-openssl ecparam -name secp521r1 -genkey -noout -out client_priv_test.pem
-openssl req -new -sha256 -key client_priv_test.pem -subj "/C=US/O=Kmyth/CN=TestClient" -out client_cert_test.csr
+gen_sign_key client_priv_test.pem
+openssl req -new $SIGN_MD -key client_priv_test.pem -subj "/C=US/O=Kmyth/CN=TestClient" -out client_cert_test.csr
 openssl x509 -req -in client_cert_test.csr -CA ca_cert_test.pem -CAkey ca_priv_test.pem -CAcreateserial -out client_cert_test.pem -days 365 -sha256
 
-openssl ecparam -name secp521r1 -genkey -noout -out proxy_priv_test.pem
-openssl req -new -sha256 -key proxy_priv_test.pem -subj "/C=US/O=Kmyth/CN=TestProxy" -out proxy_cert_test.csr
+gen_sign_key proxy_priv_test.pem
+openssl req -new $SIGN_MD -key proxy_priv_test.pem -subj "/C=US/O=Kmyth/CN=TestProxy" -out proxy_cert_test.csr
 openssl x509 -req -in proxy_cert_test.csr -CA ca_cert_test.pem -CAkey ca_priv_test.pem -CAcreateserial -out proxy_cert_test.pem -days 365 -sha256
 
 openssl ecparam -name secp521r1 -genkey -noout -out server_priv_test.pem
@@ -7,15 +7,20 @@
  * 
  *        The demo server will return a KMIP response containing a defined
  *        demonstration ID and value, if a valid KMIP request for a key
- *        with that same demonstration ID is received.
+ *        with that same demonstration ID is received. Alternatively, the
+ *        keys served can be loaded from a key file.
  */
 
 #ifndef KMYTH_DEMO_KMIP_SERVER_H
 #define KMYTH_DEMO_KMIP_SERVER_H
 
 #include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
 
+#include "demo_key_store.h"
 #include "demo_tls_util.h"
+#include "tls_util.h"
 
 /**
  * @brief Define fixed "Key ID" value for demonstration (test) key to be served
@@ -33,6 +38,46 @@
                           0xFF, 0x7A, 0x79, 0x1D, 0xFE, 0x0A, 0xC0, 0xCE, \
                           0xDC, 0xD3, 0x08, 0x48, 0x24, 0xE7, 0xA0, 0x08 }
 
+/**
+ * @brief Default and maximum number of connection handling threads
+ */
+#define DEMO_SERVER_DEFAULT_THREADS 1
+#define DEMO_SERVER_MAX_THREADS 256
+
+/**
+ * @brief Maximum number of accepted connections waiting for a free thread
+ */
+#define DEMO_SERVER_QUEUE_LEN 128
+
+/**
+ * @brief Session ID context the server's TLS sessions are tied to (a
+ *        session of a client certificate verified connection can only be
+ *        resumed with one set)
+ */
+#define DEMO_SERVER_SESSION_ID_CTX "kmyth-demo-kmip-server"
+
+/**
+ * @brief Length of the fixed TTLV header (tag, type and length) that
+ *        starts each KMIP message
+ */
+#define DEMO_KMIP_HEADER_LEN 8
+
+/**
+ * @brief Bounded queue handing accepted (not yet handshaked) TLS
+ *        connections from the accepting thread to the connection handling
+ *        threads.
+ */
+typedef struct DemoConnQueue
+{
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  BIO *conns[DEMO_SERVER_QUEUE_LEN];
+  size_t head;
+  size_t count;
+  bool closed;
+} DemoConnQueue;
+
 /**
  * @brief This struct consolidates configuration and state information for a
  *        very simplified KMIP server replacement 'node' used to demonstrate
@@ -43,8 +88,12 @@
 typedef struct DemoServer
 {
   TLSPeer tlsconn;
-  unsigned char demo_key_id[DEMO_OP_KEY_ID_LEN];
-  unsigned char demo_key_val[DEMO_OP_KEY_VAL_LEN];
+  char *key_file_path;
+  DemoKeyStore key_store;
+  int num_threads;
+  int session_limit;
+  int max_early_data;
+  DemoConnQueue queue;
 } DemoServer;
 
 /**
@@ -57,6 +106,12 @@ static const struct option demo_kmip_server_longopts[] = {
   {"ca-cert", required_argument, 0, 'C'},
   // network options
   {"port", required_argument, 0, 'p'},
+  // key store and concurrency options
+  {"keys", required_argument, 0, 'f'},
+  {"threads", required_argument, 0, 't'},
+  {"early-data", required_argument, 0, 'E'},
+  // Test options
+  {"maxconn", required_argument, 0, 'm'},
   // Misc
   {"help", no_argument, 0, 'h'},
   {0, 0, 0, 0}
@@ -0,0 +1,198 @@
+/**
+ * @file  proxy_metrics.h
+ *
+ * @brief Provides latency histograms and session / error counters for the
+ *        TLS proxy test application, and a listener serving them (in the
+ *        Prometheus text exposition format) on a separate port.
+ */
+
+#ifndef KMYTH_PROXY_METRICS_H
+#define KMYTH_PROXY_METRICS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Number of (finite) histogram buckets. Their upper bounds, in
+ *        microseconds, are listed in proxy_metrics.c.
+ */
+#define PROXY_METRICS_NUM_BUCKETS 14
+
+/**
+ * @brief Maximum size (in bytes) of a rendered metrics page
+ */
+#define PROXY_METRICS_MAX_PAGE_SIZE 16384
+
+/**
+ * @brief The timed stages of a proxy session
+ */
+typedef enum ProxyMetricsStage
+{
+  PROXY_METRICS_ECDH_SETUP,     // 'Client Hello' processing to session keys
+  PROXY_METRICS_UPSTREAM_TLS,   // new TLS connection to the remote server
+  PROXY_METRICS_KMIP_REQUEST,   // KMIP request sent to response received
+  PROXY_METRICS_NUM_STAGES
+} ProxyMetricsStage;
+
+/**
+ * @brief The kinds of session errors counted
+ */
+typedef enum ProxyMetricsError
+{
+  PROXY_METRICS_ERR_ECDH_SETUP,
+  PROXY_METRICS_ERR_KEY_REQUEST,
+  PROXY_METRICS_ERR_UPSTREAM_TLS,
+  PROXY_METRICS_ERR_KMIP_REQUEST,
+  PROXY_METRICS_ERR_KEY_RESPONSE,
+  PROXY_METRICS_NUM_ERRORS
+} ProxyMetricsError;
+
+/**
+ * @brief A latency histogram: the number of observations falling in each
+ *        bucket (not cumulative - the overflow bucket last), and their
+ *        sum (in microseconds).
+ */
+typedef struct ProxyHistogram
+{
+  uint64_t buckets[PROXY_METRICS_NUM_BUCKETS + 1];
+  uint64_t sum_us;
+} ProxyHistogram;
+
+/**
+ * @brief The proxy's counters. They are held in memory shared with the
+ *        proxy's forked children, and updated with relaxed atomic adds, so
+ *        that every session (in either concurrency model) is counted
+ *        without a lock.
+ */
+typedef struct ProxyMetricsData
+{
+  ProxyHistogram latency[PROXY_METRICS_NUM_STAGES];
+  uint64_t errors[PROXY_METRICS_NUM_ERRORS];
+  uint64_t sessions_total;
+  int64_t sessions_active;
+} ProxyMetricsData;
+
+/**
+ * @brief The proxy's metrics, and the listener (if a port was given)
+ *        serving them. With no port, 'data' is NULL and recording a
+ *        metric does nothing.
+ */
+typedef struct ProxyMetrics
+{
+  char *port;
+  ProxyMetricsData *data;
+  int listen_fd;
+  pthread_t server;
+  bool server_running;
+} ProxyMetrics;
+
+/**
+ * @brief Initializes (without starting) the proxy's metrics.
+ *
+ * @param[out] metrics          Metrics to initialize
+ *
+ * @return None
+ */
+void proxy_metrics_init(ProxyMetrics * metrics);
+
+/**
+ * @brief Allocates the shared counters and starts the listener serving
+ *        them on metrics->port. Does nothing if no port was given.
+ *
+ * @param[in,out] metrics       Metrics to start
+ *
+ * @return 0 on success, 1 on failure
+ */
+int proxy_metrics_start(ProxyMetrics * metrics);
+
+/**
+ * @brief Releases a forked child's copy of the listener (the listener
+ *        thread only runs in the parent). The child keeps updating the
+ *        shared counters.
+ *
+ * @param[in,out] metrics       Metrics inherited by a forked child
+ *
+ * @return None
+ */
+void proxy_metrics_detach(ProxyMetrics * metrics);
+
+/**
+ * @brief Stops the listener (if running), and releases the counters and
+ *        the port.
+ *
+ * @param[in,out] metrics       Metrics to clean up
+ *
+ * @return None
+ */
+void proxy_metrics_cleanup(ProxyMetrics * metrics);
+
+/**
+ * @brief Reads the (monotonic) clock at the start of a timed stage.
+ *
+ * @param[out] start            The start time
+ *
+ * @return None
+ */
+void proxy_metrics_start_timer(struct timespec *start);
+
+/**
+ * @brief Records the time taken by a stage, since
+ *        proxy_metrics_start_timer().
+ *
+ * @param[in]  metrics          The proxy's metrics
+ *
+ * @param[in]  stage            The stage
+ *
+ * @param[in]  start            The stage's start time
+ *
+ * @return None
+ */
+void proxy_metrics_observe(ProxyMetrics * metrics, ProxyMetricsStage stage,
+                           const struct timespec *start);
+
+/**
+ * @brief Counts a session error.
+ *
+ * @param[in]  metrics          The proxy's metrics
+ *
+ * @param[in]  error            The kind of error
+ *
+ * @return None
+ */
+void proxy_metrics_error(ProxyMetrics * metrics, ProxyMetricsError error);
+
+/**
+ * @brief Counts a session as started (and active).
+ *
+ * @param[in]  metrics          The proxy's metrics
+ *
+ * @return None
+ */
+void proxy_metrics_session_start(ProxyMetrics * metrics);
+
+/**
+ * @brief Counts a session as ended (no longer active).
+ *
+ * @param[in]  metrics          The proxy's metrics
+ *
+ * @return None
+ */
+void proxy_metrics_session_end(ProxyMetrics * metrics);
+
+/**
+ * @brief Renders the metrics in the Prometheus text exposition format.
+ *
+ * @param[in]  data             The counters
+ *
+ * @param[out] buf              Buffer for the page
+ *
+ * @param[in]  buf_size         Size (in bytes) of buf
+ *
+ * @return The length of the page (truncated to fit buf)
+ */
+size_t proxy_metrics_render(const ProxyMetricsData * data, char *buf,
+                            size_t buf_size);
+
+#endif // KMYTH_PROXY_METRICS_H
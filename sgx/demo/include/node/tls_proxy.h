@@ -8,7 +8,12 @@
 #ifndef KMYTH_TLS_PROXY_H
 #define KMYTH_TLS_PROXY_H
 
+#include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <time.h>
 
 #include "retrieve_key_protocol.h"
 
@@ -16,6 +21,79 @@
 #include "demo_tls_util.h"
 #include "tls_util.h"
 
+#include <kmyth/parallel_util.h>
+
+#include "proxy_metrics.h"
+
+/**
+ * @brief Maximum number of idle (already connected) TLS connections to the
+ *        remote KMIP server that the proxy keeps for re-use.
+ */
+#define PROXY_MAX_UPSTREAM_CONNS 16
+
+/**
+ * @brief Default time (in seconds) an upstream TLS connection may sit idle
+ *        in the pool before the proxy closes it.
+ */
+#define PROXY_DEFAULT_MAX_IDLE_SECS 60
+
+/**
+ * @brief Interval (in seconds) between health / idle time checks of the
+ *        pooled upstream TLS connections.
+ */
+#define PROXY_UPSTREAM_CHECK_SECS 1
+
+/**
+ * @brief Maximum number of worker threads supported in event-driven mode
+ */
+#define PROXY_MAX_WORKERS 64
+
+/**
+ * @brief Maximum number of epoll events handled per epoll_wait() call
+ */
+#define PROXY_MAX_EPOLL_EVENTS 64
+
+/**
+ * @brief Timeout (in milliseconds) for each epoll_wait() call, so that
+ *        idle workers notice when the ECDH session limit has been reached.
+ */
+#define PROXY_EPOLL_TIMEOUT_MS 1000
+
+/**
+ * @brief An idle, connected TLS client BIO to the remote KMIP server, and
+ *        the (monotonic clock) time at which it was last used.
+ */
+typedef struct ProxyUpstreamConn
+{
+  BIO *bio;
+  time_t idle_since;
+} ProxyUpstreamConn;
+
+/**
+ * @brief Pool of connected TLS client BIOs to the remote KMIP server.
+ *        All of the proxy's workers borrow connections from (and return
+ *        them to) this pool, rather than doing a TLS handshake for every
+ *        ECDH session. In the fork-per-connection model, each child is
+ *        handed one warm connection at fork time.
+ *
+ *        If warm_count is non-zero, a maintainer thread keeps that many
+ *        connections ready ahead of demand. Idle connections that fail a
+ *        health check, or have been idle longer than max_idle_secs, are
+ *        closed.
+ */
+typedef struct ProxyUpstreamPool
+{
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup;
+  ProxyUpstreamConn idle[PROXY_MAX_UPSTREAM_CONNS];
+  size_t idle_count;
+  size_t warm_count;
+  int max_idle_secs;
+  pthread_t maintainer;
+  bool maintainer_running;
+  bool stopping;
+} ProxyUpstreamPool;
+
 /**
  * @brief This struct consolidates complete (overall) state information
  *        required for a 'TLS Proxy' node to complete the kmyth
@@ -27,8 +105,62 @@ typedef struct TLSProxy
 {
   TLSPeer tlsconn;
   ECDHPeer ecdhconn;
+  bool event_mode;
+  int num_workers;
+  int num_procs;
+  bool ktls;
+  ProxyUpstreamPool upstream;
+  socket_options sockopts;
+  pthread_mutex_t session_lock;
+  int session_count;
+  bool stopping;
+  ProxyMetrics metrics;
 } TLSProxy;
 
+/**
+ * @brief State for one worker thread of the proxy in event-driven mode.
+ *        Each worker runs its own epoll loop over the (shared) ECDH listen
+ *        socket and the ECDH client sessions that it has accepted.
+ */
+typedef struct ProxyWorker
+{
+  TLSProxy *proxy;
+  pthread_t thread;
+  int epoll_fd;
+  size_t active_sessions;
+  bool failed;
+} ProxyWorker;
+
+/**
+ * @brief Protocol phase of a single ECDH client session handled by the
+ *        proxy in event-driven mode. The session returns to
+ *        PROXY_SESSION_WAIT_KEY_REQUEST after each 'Key Response', until
+ *        the client closes the connection.
+ */
+typedef enum ProxySessionState
+{
+  PROXY_SESSION_WAIT_CLIENT_HELLO,
+  PROXY_SESSION_WAIT_KEY_REQUEST,
+  PROXY_SESSION_DONE
+} ProxySessionState;
+
+/**
+ * @brief State for a single ECDH client session handled by the proxy in
+ *        event-driven mode. The session's ECDHPeer shares (does not own)
+ *        the proxy's ECDH configuration (keys and certificates).
+ *
+ *        Protocol messages are received incrementally: hdr_buf collects the
+ *        two-byte message length and rx_count tracks the number of header
+ *        plus body bytes received so far for the message being read.
+ */
+typedef struct ProxySession
+{
+  ECDHPeer ecdhconn;
+  ProxySessionState state;
+  uint8_t hdr_buf[2];
+  size_t rx_count;
+} ProxySession;
+
 /**
  * @brief Command-line options for the 'TLS proxy' application
  */
@@ -43,6 +175,16 @@ static const struct option proxy_longopts[] = {
   {"ca-path", required_argument, 0, 'C'},
   {"client-key", required_argument, 0, 'R'},
   {"client-cert", required_argument, 0, 'U'},
+  // Concurrency options
+  {"event", no_argument, 0, 'e'},
+  {"workers", required_argument, 0, 'w'},
+  {"prefork", required_argument, 0, 'f'},
+  {"warm", required_argument, 0, 'W'},
+  {"max-idle", required_argument, 0, 'T'},
+  {"sockopt", required_argument, 0, 'O'},
+  {"ktls", no_argument, 0, 'K'},
+  // Monitoring options
+  {"metrics-port", required_argument, 0, 'M'},
   // Test options
   {"maxconn", required_argument, 0, 'm'},
   // Misc
@@ -74,7 +74,9 @@ typedef struct RetrieveKeyProtocol
 /**
  * @brief This struct consolidates state information for an ECDH session
  *        used to support completion of the kmyth 'retrieve key' protocol
- *        with a peer.
+ *        with a peer. A client may send several 'Key Request' messages
+ *        over one session: key_request_seq is the sequence number the
+ *        next one must carry.
  */
 typedef struct ECDHSession
 {
@@ -84,6 +86,7 @@ typedef struct ECDHSession
   ByteBuffer shared_secret;
   ByteBuffer request_symkey;
   ByteBuffer response_symkey;
+  uint32_t key_request_seq;
   RetrieveKeyProtocol proto;
 } ECDHSession;
 
@@ -125,6 +128,18 @@ void demo_ecdh_init(bool clientMode, ECDHPeer * ecdhconn);
  */
 void demo_ecdh_cleanup(ECDHPeer * ecdhconn);
 
+/**
+ * @brief Clear and free the messages of a completed 'Key Request'/'Key
+ *        Response' exchange, so that the next request over the same
+ *        session can be received.
+ *
+ * @param[out] ecdhconn   Pointer to ECDHPeer struct whose protocol state
+ *                        is being reset
+ * 
+ * @return none
+ */
+void demo_ecdh_reset_key_request(ECDHPeer * ecdhconn);
+
 /**
  * @brief Processing that must occur in response to an error, prior to exit.
  *
@@ -228,6 +243,19 @@ int demo_ecdh_send_msg(int socket_fd, ECDHMessage * msg);
  */
 int demo_ecdh_recv_client_hello_msg(ECDHPeer * ecdh_svr);
 
+/**
+ * @brief Validate and parse a 'retrieve key' protocol 'Client Hello'
+ *        message that has already been received (into the session's
+ *        protocol state) from an ECDH peer.
+ *
+ * @param[inout] ecdh_svr  Pointer to ECDHPeer struct containing
+ *                         configuration and state information for
+ *                         a 'retrieve key' protocol session
+ * 
+ * @return none
+ */
+int demo_ecdh_process_client_hello_msg(ECDHPeer * ecdh_svr);
+
 /**
  * @brief Compose and send a 'retrieve key' 'Server Hello' protocol
  *        message to an ECDH peer.
@@ -266,4 +294,17 @@ int demo_ecdh_get_session_key(ECDHPeer * ecdh_svr);
  */
 int demo_ecdh_recv_key_request_msg(ECDHPeer * ecdh_svr);
 
+/**
+ * @brief Decrypt and parse a 'retrieve key' 'Key Request' protocol message
+ *        that has already been received (into the session's protocol
+ *        state) from an ECDH peer (client).
+ *
+ * @param[inout] ecdh_svr  Pointer to ECDHPeer struct containing
+ *                         configuration and state information for
+ *                         a 'retrieve key' protocol session
+ * 
+ * @return none
+ */
+int demo_ecdh_process_key_request_msg(ECDHPeer * ecdh_svr);
+
 #endif    // _KMYTH_DEMO_ECDH_UTIL_H_
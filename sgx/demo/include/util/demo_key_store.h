@@ -0,0 +1,127 @@
+/**
+ * @file  demo_key_store.h
+ *
+ * @brief Provides constants, structs, and function declarations for the
+ *        in-memory key store served by the demonstration KMIP server.
+ *
+ *        The store is a hash table (open addressing, linear probing)
+ *        indexed by key ID. It is filled in before the server starts
+ *        handling connections and is read-only afterwards, so lookups
+ *        from concurrent server threads need no locking.
+ */
+
+#ifndef _KMYTH_DEMO_KEY_STORE_H_
+#define _KMYTH_DEMO_KEY_STORE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kmyth/kmyth_log.h>
+#include <kmyth/memory_util.h>
+
+/**
+ * @brief Initial number of slots in a key store hash table
+ */
+#define DEMO_KEY_STORE_MIN_SLOTS 64
+
+/**
+ * @brief Maximum length (in characters) of a line in a key store file
+ */
+#define DEMO_KEY_STORE_MAX_LINE 4096
+
+/**
+ * @brief A single key ID / key value pair held in the key store. An empty
+ *        hash table slot has a NULL 'id'.
+ */
+typedef struct DemoKeyEntry
+{
+  unsigned char *id;
+  size_t id_len;
+  unsigned char *val;
+  size_t val_len;
+} DemoKeyEntry;
+
+/**
+ * @brief Hash-indexed (by key ID) table of key store entries.
+ *        'slot_count' is always a power of two.
+ */
+typedef struct DemoKeyStore
+{
+  DemoKeyEntry *slots;
+  size_t slot_count;
+  size_t key_count;
+} DemoKeyStore;
+
+/**
+ * @brief Initializes an empty key store.
+ *
+ * @param[out] store   Pointer to DemoKeyStore struct being initialized
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on error
+ */
+int demo_key_store_init(DemoKeyStore * store);
+
+/**
+ * @brief Clears and frees all key material held in a key store.
+ *
+ * @param[out] store   Pointer to DemoKeyStore struct being cleaned up
+ *
+ * @return none
+ */
+void demo_key_store_cleanup(DemoKeyStore * store);
+
+/**
+ * @brief Adds (a copy of) a key to the key store, replacing any key
+ *        already stored under the same ID.
+ *
+ * @param[inout] store    Pointer to DemoKeyStore struct to add the key to
+ *
+ * @param[in]    id       Key ID bytes
+ *
+ * @param[in]    id_len   Length (in bytes) of key ID
+ *
+ * @param[in]    val      Key value bytes
+ *
+ * @param[in]    val_len  Length (in bytes) of key value
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on error
+ */
+int demo_key_store_insert(DemoKeyStore * store,
+                          const unsigned char *id, size_t id_len,
+                          const unsigned char *val, size_t val_len);
+
+/**
+ * @brief Loads keys from a text file into the key store. Each non-empty
+ *        line that does not start with '#' holds a key ID and a
+ *        hexadecimal key value, separated by whitespace:
+ *
+ *        <key ID> <hex key value>
+ *
+ * @param[inout] store   Pointer to DemoKeyStore struct to add the keys to
+ *
+ * @param[in]    path    Path of the key file to load
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on error
+ */
+int demo_key_store_load_file(DemoKeyStore * store, const char *path);
+
+/**
+ * @brief Looks up a key by its ID.
+ *
+ * @param[in]  store    Pointer to DemoKeyStore struct to search
+ *
+ * @param[in]  id       Key ID bytes
+ *
+ * @param[in]  id_len   Length (in bytes) of key ID
+ *
+ * @return pointer to the matching entry, or NULL if the ID is not stored
+ */
+const DemoKeyEntry *demo_key_store_lookup(const DemoKeyStore * store,
+                                          const unsigned char *id,
+                                          size_t id_len);
+
+#endif    // _KMYTH_DEMO_KEY_STORE_H_
@@ -9,7 +9,9 @@
 #include <getopt.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <openssl/bio.h>
 #include <openssl/pem.h>
@@ -29,6 +31,8 @@
 #include "socket_util.h"
 
 #include "kmyth_enclave_common.h"
+#include "enclave_util.h"
+#include "sgx_stats_impl.h"
 
 #include "kmyth_sgx_retrieve_key_demo_enclave_u.h"
 
@@ -53,26 +57,260 @@
 #define SERVER_HOST "localhost"
 #define SERVER_PORT "7000"
 #define KEY_ID "7"
-#define KEY_ID_LEN 1
+
+/* Maximum number of keys (-k options) retrieved over one session */
+#define MAX_KEY_IDS 64
+
+/* Maximum number of application threads (-t option) making ECALLs; the
+ * enclave needs a TCS for each (see the enclave's TCSNum) */
+#define MAX_THREADS 8
+
+/*****************************************************************************
+ * One application thread's 'retrieve key' ECALLs: the inputs shared by all
+ * the threads, the number of iterations this thread makes, and its results.
+ *****************************************************************************/
+typedef struct DemoWorker
+{
+  sgx_enclave_id_t eid;
+  unsigned char *client_ec_sign_key_bytes;
+  int client_ec_sign_key_bytes_len;
+  unsigned char *client_ec_cert_bytes;
+  int client_ec_cert_bytes_len;
+  unsigned char *server_ec_cert_bytes;
+  int server_ec_cert_bytes_len;
+  unsigned char *key_ids;
+  size_t key_ids_len;
+  size_t *key_id_lens;
+  size_t key_count;
+  unsigned long pool_size;
+  unsigned long iterations;
+
+  sgx_status_t sgx_ret;
+  int retval;
+  unsigned long completed;
+  double total_usec;
+  double min_usec;
+  double max_usec;
+} DemoWorker;
+
+/*****************************************************************************
+ * demo_usage
+ *
+ * prog [in] - Program name
+ *****************************************************************************/
+static void demo_usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "Retrieves a key from the demo key server (through the TLS proxy)\n"
+          "into the SGX enclave.\n\n"
+          "options are:\n\n"
+          " -k or --key-id      ID of a key to retrieve. Repeat the option (up to\n"
+          "                     %d times) to retrieve several keys over a single\n"
+          "                     session with the proxy. Defaults to \"%s\".\n"
+          " -n or --iterations  Retrieve the key this many times, reporting the\n"
+          "                     latency of the 'retrieve key' ECALL (the proxy and\n"
+          "                     server must accept as many connections). Defaults\n"
+          "                     to 1.\n"
+          " -p or --pool        Keep this many ephemeral ECDH key pairs generated\n"
+          "                     ahead of time in the enclave, refilling the pool\n"
+          "                     (untimed) before each 'retrieve key' ECALL.\n"
+          "                     Defaults to 0 (no pool).\n"
+          " -t or --threads     Split the iterations between this many threads\n"
+          "                     (up to %d), each making its own ECALLs, and\n"
+          "                     report the aggregate keys retrieved per second.\n"
+          "                     Defaults to 1.\n"
+          " -c or --cache       Cache the retrieved keys in the enclave for this\n"
+          "                     many seconds, answering repeated requests\n"
+          "                     without contacting the proxy. Defaults to 0\n"
+          "                     (no cache).\n"
+          " -s or --stats       Report the enclave's instrumentation counters\n"
+          "                     (unsealed data table and OpenSSL heap usage,\n"
+          "                     and calls to and cycles spent in each ECALL).\n"
+          " -h or --help        Help (displays this usage).\n\n"
+          "Enclaves built with SGX_SWITCHLESS=1 start the number of switchless\n"
+          "OCALL workers given by the %s environment variable\n"
+          "(default %d).\n", prog, MAX_KEY_IDS, KEY_ID, MAX_THREADS,
+          KMYTH_SGX_SWITCHLESS_WORKERS_ENV,
+          KMYTH_SGX_SWITCHLESS_WORKERS);
+}
 
 /*****************************************************************************
- * initialize_enclave
+ * elapsed_usec
  *
- * enclave_fn [in] - Enclave filename
+ * start [in] - Start time
  *
- * eid [out]       - Enclave ID
+ * end [in]   - End time
  *
- * returns initialization status
+ * returns the time from start to end, in microseconds
  *****************************************************************************/
-static sgx_status_t initialize_enclave(const char *enclave_fn,
-                                       sgx_enclave_id_t * eid)
+static double elapsed_usec(const struct timespec *start,
+                           const struct timespec *end)
 {
-  sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+  return (double) (end->tv_sec - start->tv_sec) * 1e6 +
+    (double) (end->tv_nsec - start->tv_nsec) / 1e3;
+}
 
-  ret = sgx_create_enclave(enclave_fn, SGX_DEBUG_FLAG, NULL, NULL, eid, NULL);
-  return ret;
+/*****************************************************************************
+ * demo_print_stats
+ *
+ * stats [in] - The enclave's instrumentation counters
+ *
+ * prints the counters, and the mean cycles per call of each ECALL called
+ *****************************************************************************/
+static void demo_print_stats(const kmyth_sgx_stats_t * stats)
+{
+  fprintf(stdout, "enclave unsealed data table: %lu entries, %lu bytes "
+          "(peak %lu bytes)\n", stats->enclave.unseal_entries,
+          stats->enclave.unseal_bytes, stats->enclave.unseal_peak_bytes);
+  if (stats->enclave.crypto_tracked)
+  {
+    fprintf(stdout, "enclave OpenSSL heap: %lu bytes (peak %lu bytes)\n",
+            stats->enclave.crypto_bytes, stats->enclave.crypto_peak_bytes);
+  }
+  else
+  {
+    fprintf(stdout, "enclave OpenSSL heap: not tracked\n");
+  }
+  for (int i = 0; i < KMYTH_SGX_ECALL_COUNT; i++)
+  {
+    if (stats->enclave.ecall_calls[i] == 0)
+    {
+      continue;
+    }
+    fprintf(stdout, "enclave ECALL %s: %lu calls", kmyth_sgx_ecall_name(i),
+            stats->enclave.ecall_calls[i]);
+    if (stats->ecall_timed_calls[i] > 0)
+    {
+      fprintf(stdout, ", %lu cycles (mean %lu per timed call)",
+              stats->ecall_cycles[i],
+              stats->ecall_cycles[i] / stats->ecall_timed_calls[i]);
+    }
+    fprintf(stdout, "\n");
+  }
+}
+
+/*****************************************************************************
+ * demo_worker
+ *
+ * arg [in/out] - The thread's DemoWorker
+ *
+ * makes (and times) the thread's 'retrieve key' ECALLs, stopping at the
+ * first failure
+ *****************************************************************************/
+static void *demo_worker(void *arg)
+{
+  DemoWorker *worker = (DemoWorker *) arg;
+  const char *server_host = SERVER_HOST;
+  int server_host_len = strlen(server_host) + 1;
+  const char *server_port = SERVER_PORT;
+  int server_port_len = strlen(server_port) + 1;
+
+  worker->sgx_ret = SGX_SUCCESS;
+  worker->retval = 0;
+
+  // each iteration is timed, so that the latency of the ECALL (and of
+  // the OCALLs it makes) can be compared across builds - e.g., with and
+  // without switchless OCALLs
+  for (unsigned long i = 0; i < worker->iterations; i++)
+  {
+    struct timespec start;
+    struct timespec finish;
+
+    // top up the enclave's ephemeral key pool while nothing else is
+    // waiting on the enclave, so that the ECALL doesn't generate a key pair
+    if (worker->pool_size > 0)
+    {
+      uint64_t fill_start = kmyth_sgx_stats_ecall_start();
+
+      worker->sgx_ret = kmyth_enclave_fill_ecdh_pool(worker->eid,
+                                                     &worker->retval,
+                                                     worker->pool_size);
+      kmyth_sgx_stats_ecall_done(KMYTH_SGX_ECALL_FILL_ECDH_POOL, fill_start);
+      if (worker->sgx_ret || worker->retval)
+      {
+        break;
+      }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t ecall_start = kmyth_sgx_stats_ecall_start();
+
+    if (worker->key_count == 1)
+    {
+      worker->sgx_ret =
+        kmyth_enclave_retrieve_key_from_server(worker->eid,
+                                               &worker->retval,
+                                               worker->client_ec_sign_key_bytes,
+                                               worker->client_ec_sign_key_bytes_len,
+                                               worker->client_ec_cert_bytes,
+                                               worker->client_ec_cert_bytes_len,
+                                               worker->server_ec_cert_bytes,
+                                               worker->server_ec_cert_bytes_len,
+                                               server_host,
+                                               server_host_len,
+                                               server_port,
+                                               server_port_len,
+                                               worker->key_ids,
+                                               worker->key_ids_len);
+      kmyth_sgx_stats_ecall_done(KMYTH_SGX_ECALL_RETRIEVE_KEY, ecall_start);
+    }
+    else
+    {
+      worker->sgx_ret =
+        kmyth_enclave_retrieve_keys_from_server(worker->eid,
+                                                &worker->retval,
+                                                worker->client_ec_sign_key_bytes,
+                                                worker->client_ec_sign_key_bytes_len,
+                                                worker->client_ec_cert_bytes,
+                                                worker->client_ec_cert_bytes_len,
+                                                worker->server_ec_cert_bytes,
+                                                worker->server_ec_cert_bytes_len,
+                                                server_host,
+                                                server_host_len,
+                                                server_port,
+                                                server_port_len,
+                                                worker->key_ids,
+                                                worker->key_ids_len,
+                                                worker->key_id_lens,
+                                                worker->key_count);
+      kmyth_sgx_stats_ecall_done(KMYTH_SGX_ECALL_RETRIEVE_KEYS, ecall_start);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    if (worker->sgx_ret || worker->retval)
+    {
+      break;
+    }
+
+    double usec = elapsed_usec(&start, &finish);
+
+    if (worker->completed == 0 || usec < worker->min_usec)
+    {
+      worker->min_usec = usec;
+    }
+    if (usec > worker->max_usec)
+    {
+      worker->max_usec = usec;
+    }
+    worker->total_usec += usec;
+    worker->completed++;
+  }
+
+  return NULL;
 }
 
+static const struct option demo_longopts[] = {
+  {"key-id", required_argument, 0, 'k'},
+  {"iterations", required_argument, 0, 'n'},
+  {"pool", required_argument, 0, 'p'},
+  {"threads", required_argument, 0, 't'},
+  {"cache", required_argument, 0, 'c'},
+  {"stats", no_argument, 0, 's'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
 int main(int argc, char **argv)
 {
   // setup default logging parameters
@@ -82,6 +320,107 @@ int main(int argc, char **argv)
   set_applog_severity_threshold(DEMO_LOG_LEVEL);
   set_applog_output_mode(0);
 
+  // parse command line options
+  unsigned long iterations = 1;
+  unsigned long pool_size = 0;
+  unsigned long thread_count = 1;
+  unsigned long cache_ttl = 0;
+  int report_stats = 0;
+  char *key_id_strs[MAX_KEY_IDS] = { NULL };
+  size_t key_count = 0;
+  char *end = NULL;
+  int option = 0;
+
+  while ((option = getopt_long(argc, argv, "k:n:p:t:c:sh", demo_longopts, NULL)) != -1)
+  {
+    switch (option)
+    {
+    case 'k':
+      if (key_count == MAX_KEY_IDS || strlen(optarg) == 0)
+      {
+        demo_log(LOG_ERR, "invalid (or too many) key IDs (%s)", optarg);
+        return EXIT_FAILURE;
+      }
+      key_id_strs[key_count++] = optarg;
+      break;
+    case 'n':
+      errno = 0;
+      iterations = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || iterations == 0)
+      {
+        demo_log(LOG_ERR, "invalid number of iterations (%s)", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'p':
+      errno = 0;
+      pool_size = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0')
+      {
+        demo_log(LOG_ERR, "invalid ephemeral key pool size (%s)", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 't':
+      errno = 0;
+      thread_count = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || thread_count == 0 ||
+          thread_count > MAX_THREADS)
+      {
+        demo_log(LOG_ERR, "invalid number of threads (%s)", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'c':
+      errno = 0;
+      cache_ttl = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0')
+      {
+        demo_log(LOG_ERR, "invalid key cache lifetime (%s)", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 's':
+      report_stats = 1;
+      break;
+    case 'h':
+      demo_usage(argv[0]);
+      return EXIT_SUCCESS;
+    default:
+      demo_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (key_count == 0)
+  {
+    key_id_strs[key_count++] = KEY_ID;
+  }
+
+  // the key IDs are passed into the enclave concatenated, along with the
+  // length of each one
+  size_t key_id_lens[MAX_KEY_IDS] = { 0 };
+  size_t key_ids_len = 0;
+
+  for (size_t i = 0; i < key_count; i++)
+  {
+    key_id_lens[i] = strlen(key_id_strs[i]);
+    key_ids_len += key_id_lens[i];
+  }
+
+  unsigned char *key_ids = malloc(key_ids_len);
+
+  if (key_ids == NULL)
+  {
+    demo_log(LOG_ERR, "error allocating key ID buffer");
+    return EXIT_FAILURE;
+  }
+  for (size_t i = 0, offset = 0; i < key_count; i++)
+  {
+    memcpy(key_ids + offset, key_id_strs[i], key_id_lens[i]);
+    offset += key_id_lens[i];
+  }
+
   // read client (enclave) private EC signing key from file (.pem formatted)
   EVP_PKEY *client_ec_sign_key = NULL;
   BIO *client_ec_sign_key_bio = BIO_new_file(CLIENT_PRIVATE_KEY_FILE, "r");
@@ -200,7 +539,7 @@ int main(int argc, char **argv)
   sgx_enclave_id_t eid = 0;
   sgx_status_t sgx_ret = SGX_ERROR_UNEXPECTED;
 
-  sgx_ret = initialize_enclave(ENCLAVE_PATH, &eid);
+  sgx_ret = kmyth_sgx_create_enclave(ENCLAVE_PATH, &eid);
 
   if (sgx_ret != SGX_SUCCESS)
   {
@@ -210,42 +549,164 @@ int main(int argc, char **argv)
   }
   demo_log(LOG_DEBUG, "initialized SGX enclave - EID = 0x%016lx", eid);
 
-  // make ECALL to retrieve key into enclave from the key server
+  // the cached keys are held in the enclave's unsealed data table
+  if (cache_ttl > 0)
+  {
+    int cache_ret = -1;
+
+    kmyth_unsealed_data_table_initialize(eid, &cache_ret);
+    if (cache_ret == 0)
+    {
+      sgx_ret = kmyth_enclave_set_key_cache(eid, &cache_ret, key_count,
+                                            cache_ttl);
+    }
+    if (sgx_ret != SGX_SUCCESS || cache_ret != 0)
+    {
+      demo_log(LOG_ERR, "failed to enable the enclave key cache");
+      sgx_destroy_enclave(eid);
+      return EXIT_FAILURE;
+    }
+  }
+
+  // make ECALLs to retrieve keys into enclave from the key server, with
+  // the iterations split between the threads (the first ones taking any
+  // remainder)
   demo_log(LOG_DEBUG, "invoking 'retrieve key' ECALL ...");
-  int retval = -1;
+  if (thread_count > iterations)
+  {
+    thread_count = iterations;
+  }
 
-  const char *server_host = SERVER_HOST;
-  int server_host_len = strlen(server_host) + 1;
-  const char *server_port = SERVER_PORT;
-  int server_port_len = strlen(server_port) + 1;
+  DemoWorker workers[MAX_THREADS];
+  pthread_t threads[MAX_THREADS];
+  unsigned long started = 0;
+  struct timespec run_start;
+  struct timespec run_finish;
 
-  sgx_ret = kmyth_enclave_retrieve_key_from_server(eid,
-                                                   &retval,
-                                                   client_ec_sign_key_bytes,
-                                                   client_ec_sign_key_bytes_len,
-                                                   client_ec_cert_bytes,
-                                                   client_ec_cert_bytes_len,
-                                                   server_ec_cert_bytes,
-                                                   server_ec_cert_bytes_len,
-                                                   server_host,
-                                                   server_host_len,
-                                                   server_port,
-                                                   server_port_len,
-                                                   (unsigned char *) KEY_ID,
-                                                   KEY_ID_LEN);
+  memset(workers, 0, sizeof(workers));
+  clock_gettime(CLOCK_MONOTONIC, &run_start);
+  for (unsigned long t = 0; t < thread_count; t++)
+  {
+    DemoWorker *worker = &workers[t];
+
+    worker->eid = eid;
+    worker->client_ec_sign_key_bytes = client_ec_sign_key_bytes;
+    worker->client_ec_sign_key_bytes_len = client_ec_sign_key_bytes_len;
+    worker->client_ec_cert_bytes = client_ec_cert_bytes;
+    worker->client_ec_cert_bytes_len = client_ec_cert_bytes_len;
+    worker->server_ec_cert_bytes = server_ec_cert_bytes;
+    worker->server_ec_cert_bytes_len = server_ec_cert_bytes_len;
+    worker->key_ids = key_ids;
+    worker->key_ids_len = key_ids_len;
+    worker->key_id_lens = key_id_lens;
+    worker->key_count = key_count;
+    worker->pool_size = pool_size;
+    worker->iterations = iterations / thread_count +
+      ((t < iterations % thread_count) ? 1 : 0);
+
+    // a single thread makes its ECALLs from the main thread
+    if (thread_count == 1)
+    {
+      demo_worker(worker);
+    }
+    else if (pthread_create(&threads[t], NULL, demo_worker, worker) != 0)
+    {
+      demo_log(LOG_ERR, "failed to start thread %lu", t);
+      worker->sgx_ret = SGX_ERROR_UNEXPECTED;
+      break;
+    }
+    started++;
+  }
+  for (unsigned long t = 0; (thread_count > 1) && (t < started); t++)
+  {
+    pthread_join(threads[t], NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &run_finish);
+
+  // combine the threads' results
+  sgx_status_t sgx_ret_all = SGX_SUCCESS;
+  int retval_all = 0;
+  double total_usec = 0.0;
+  double min_usec = 0.0;
+  double max_usec = 0.0;
+  unsigned long completed = 0;
+
+  for (unsigned long t = 0; t < thread_count; t++)
+  {
+    DemoWorker *worker = &workers[t];
+
+    if (worker->sgx_ret != SGX_SUCCESS || worker->retval != 0)
+    {
+      sgx_ret_all = worker->sgx_ret;
+      retval_all = worker->retval ? worker->retval : -1;
+    }
+    if (worker->completed == 0)
+    {
+      continue;
+    }
+    if (completed == 0 || worker->min_usec < min_usec)
+    {
+      min_usec = worker->min_usec;
+    }
+    if (worker->max_usec > max_usec)
+    {
+      max_usec = worker->max_usec;
+    }
+    total_usec += worker->total_usec;
+    completed += worker->completed;
+  }
+  sgx_ret = sgx_ret_all;
+
+  int retval = retval_all;
+  kmyth_sgx_stats_t stats;
+  int stats_ret = report_stats ? kmyth_sgx_get_stats(eid, &stats) : 0;
 
   free(client_ec_sign_key_bytes);
   free(client_ec_cert_bytes);
   free(server_ec_cert_bytes);
+  free(key_ids);
+
+  if (cache_ttl > 0)
+  {
+    int cache_ret = -1;
 
+    kmyth_unsealed_data_table_cleanup(eid, &cache_ret);
+  }
   sgx_destroy_enclave(eid);
 
-  if (sgx_ret)
+  if (sgx_ret || retval)
   {
-    demo_log(LOG_ERR, "kmyth_enclave_retrieve_key_from_server() failed");
+    demo_log(LOG_ERR, "'retrieve key' ECALL failed");
     return EXIT_FAILURE;
   }
 
+  if (iterations > 1)
+  {
+    fprintf(stdout,
+            "retrieve key ECALL latency (%lu iterations, %s OCALLs): "
+            "mean %.1f us, min %.1f us, max %.1f us\n", completed,
+#ifdef KMYTH_SGX_SWITCHLESS
+            "switchless",
+#else
+            "ordinary",
+#endif
+            total_usec / (double) completed, min_usec, max_usec);
+  }
+  if (thread_count > 1)
+  {
+    double run_usec = elapsed_usec(&run_start, &run_finish);
+
+    fprintf(stdout,
+            "retrieve key throughput (%lu threads): %.1f keys/s\n",
+            thread_count,
+            (double) (completed * key_count) * 1e6 / run_usec);
+  }
+
+  if (report_stats && stats_ret == 0)
+  {
+    demo_print_stats(&stats);
+  }
+
   demo_log(LOG_DEBUG, "retrieve key demo complete");
 
   return EXIT_SUCCESS;
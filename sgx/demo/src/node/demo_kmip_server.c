@@ -1,6 +1,6 @@
 /**
  * @file demo_kmip_server.c
- * 
+ *
  * @brief A very simplified KMIP server application used only to demonstrate
  *        the kmyth use of a TLS proxy to retrieve a key from a KMIP server.
  */
@@ -11,14 +11,18 @@
 #define DEMO_LOG_LEVEL LOG_DEBUG
 #endif
 
-static unsigned char demo_op_key_val[DEMO_OP_KEY_VAL_LEN] = DEMO_OP_KEY_VAL;
-
 /*****************************************************************************
  * demo_kmip_server_init()
  ****************************************************************************/
 static void demo_kmip_server_init(DemoServer * demo_server)
 {
   secure_memset(demo_server, 0, sizeof(DemoServer));
+
+  demo_server->num_threads = DEMO_SERVER_DEFAULT_THREADS;
+
+  pthread_mutex_init(&(demo_server->queue.lock), NULL);
+  pthread_cond_init(&(demo_server->queue.not_empty), NULL);
+  pthread_cond_init(&(demo_server->queue.not_full), NULL);
 }
 
 /*****************************************************************************
@@ -26,6 +30,25 @@ static void demo_kmip_server_init(DemoServer * demo_server)
  ****************************************************************************/
 static void demo_kmip_server_cleanup(DemoServer * demo_server)
 {
+  // close any connections that were accepted but never handled
+  while (demo_server->queue.count > 0)
+  {
+    BIO_free_all(demo_server->queue.conns[demo_server->queue.head]);
+    demo_server->queue.head = (demo_server->queue.head + 1) %
+                              DEMO_SERVER_QUEUE_LEN;
+    demo_server->queue.count--;
+  }
+  pthread_mutex_destroy(&(demo_server->queue.lock));
+  pthread_cond_destroy(&(demo_server->queue.not_empty));
+  pthread_cond_destroy(&(demo_server->queue.not_full));
+
+  demo_key_store_cleanup(&(demo_server->key_store));
+
+  if (demo_server->key_file_path != NULL)
+  {
+    free(demo_server->key_file_path);
+  }
+
   demo_tls_cleanup(&(demo_server->tlsconn));
 
   demo_kmip_server_init(demo_server);
@@ -55,8 +78,22 @@ static void demo_kmip_server_usage(const char *prog)
     "  -C or --ca       Certification Authority (CA) certificate file name"
     "Network Information --\n"
     "  -p or --port     The port number the server will listen on\n"
+    "Key Store and Concurrency Options --\n"
+    "  -f or --keys     File of keys to serve, one '<key ID> <hex key value>'\n"
+    "                   per line (by default, only the demo key is served)\n"
+    "  -t or --threads  Number of connection handling threads (default %d)\n"
+    "  -E or --early-data  Accept up to this many bytes of TLS 1.3 early data\n"
+    "                   (0-RTT) from a client resuming a session, answering\n"
+    "                   the KMIP requests in it before the handshake completes\n"
+    "                   (disabled by default). Each session ticket is only\n"
+    "                   accepted with early data once, so it cannot be replayed.\n"
+    "Test Options --\n"
+    "  -m or --maxconn  The number of connections the server will accept before\n"
+    "                   exiting (unlimited by default, or if the value is not a\n"
+    "                   positive integer).\n"
     "Misc --\n"
-    "  -h or --help     Help (displays this usage)\n\n", prog);
+    "  -h or --help     Help (displays this usage)\n\n", prog,
+    DEMO_SERVER_DEFAULT_THREADS);
 }
 
 /*****************************************************************************
@@ -79,7 +116,7 @@ static void demo_kmip_server_get_options(DemoServer * demo_server,
   demo_server->tlsconn.host = NULL;
 
   while ((options =
-          getopt_long(argc, argv, "k:c:C:p:m:h",
+          getopt_long(argc, argv, "k:c:C:p:f:t:E:m:h",
                       demo_kmip_server_longopts, &option_index)) != -1)
   {
     switch (options)
@@ -98,6 +135,20 @@ static void demo_kmip_server_get_options(DemoServer * demo_server,
     case 'p':
       demo_server->tlsconn.port = strdup(optarg);
       break;
+    // key store and concurrency
+    case 'f':
+      demo_server->key_file_path = strdup(optarg);
+      break;
+    case 't':
+      demo_server->num_threads = atoi(optarg);
+      break;
+    case 'E':
+      demo_server->max_early_data = atoi(optarg);
+      break;
+    // Test
+    case 'm':
+      demo_server->session_limit = atoi(optarg);
+      break;
     // Misc
     case 'h':
       demo_kmip_server_usage(argv[0]);
@@ -135,6 +186,26 @@ static void demo_kmip_server_check_options(DemoServer * demo_server)
     fprintf(stderr, "file path for server's certificate required\n");
     err = true;
   }
+  if ((demo_server->num_threads < 1) ||
+      (demo_server->num_threads > DEMO_SERVER_MAX_THREADS))
+  {
+    fprintf(stderr, "number of threads must be between 1 and %d\n",
+                    DEMO_SERVER_MAX_THREADS);
+    err = true;
+  }
+  if ((demo_server->max_early_data < 0) ||
+      (demo_server->max_early_data > KMYTH_TLS_MAX_MSG_SIZE))
+  {
+    fprintf(stderr, "early data limit must be between 0 and %d bytes\n",
+                    KMYTH_TLS_MAX_MSG_SIZE);
+    err = true;
+  }
+
+  // like the proxy, treat a non-positive limit as 'unlimited'
+  if (demo_server->session_limit < 0)
+  {
+    demo_server->session_limit = 0;
+  }
 
   if (err)
   {
@@ -143,6 +214,36 @@ static void demo_kmip_server_check_options(DemoServer * demo_server)
   }
 }
 
+/*****************************************************************************
+ * demo_kmip_server_load_keys()
+ ****************************************************************************/
+static int demo_kmip_server_load_keys(DemoServer * demo_server)
+{
+  DemoKeyStore *store = &(demo_server->key_store);
+
+  if (EXIT_SUCCESS != demo_key_store_init(store))
+  {
+    return EXIT_FAILURE;
+  }
+
+  if (demo_server->key_file_path != NULL)
+  {
+    return demo_key_store_load_file(store, demo_server->key_file_path);
+  }
+
+  // specify demonstration key to be served
+  unsigned char demo_key_id[DEMO_OP_KEY_ID_LEN] = DEMO_OP_KEY_ID;
+  unsigned char demo_key_val[DEMO_OP_KEY_VAL_LEN] = DEMO_OP_KEY_VAL;
+
+  int ret = demo_key_store_insert(store,
+                                  demo_key_id, DEMO_OP_KEY_ID_LEN,
+                                  demo_key_val, DEMO_OP_KEY_VAL_LEN);
+
+  kmyth_clear(demo_key_val, DEMO_OP_KEY_VAL_LEN);
+
+  return ret;
+}
+
 /*****************************************************************************
  * demo_kmip_server_setup()
  ****************************************************************************/
@@ -152,13 +253,12 @@ static void demo_kmip_server_setup(DemoServer *demo_server)
   demo_server->tlsconn.isClient = false;
   demo_server->tlsconn.host = NULL;
 
-  // specify demonstration key to be served
-  memcpy(demo_server->demo_key_id,
-         (unsigned char[DEMO_OP_KEY_ID_LEN]) DEMO_OP_KEY_ID,
-         DEMO_OP_KEY_ID_LEN);
-  memcpy(demo_server->demo_key_val,
-         (unsigned char[DEMO_OP_KEY_VAL_LEN]) DEMO_OP_KEY_VAL,
-         DEMO_OP_KEY_VAL_LEN);
+  // load the keys to be served (read-only once the server is running)
+  if (EXIT_SUCCESS != demo_kmip_server_load_keys(demo_server))
+  {
+    kmyth_log(LOG_ERR, "failed to load the demo server key store");
+    demo_kmip_server_error(demo_server);
+  }
 
   // some OpenSSL setup
   SSL_load_error_strings();
@@ -184,6 +284,31 @@ static void demo_kmip_server_setup(DemoServer *demo_server)
     demo_kmip_server_error(demo_server);
   }
 
+  // clients (which present certificates) may resume their sessions
+  if (1 != SSL_CTX_set_session_id_context(demo_server->tlsconn.ctx,
+                          (const unsigned char *) DEMO_SERVER_SESSION_ID_CTX,
+                          strlen(DEMO_SERVER_SESSION_ID_CTX)))
+  {
+    log_openssl_error("SSL_CTX_set_session_id_context()");
+    demo_kmip_server_error(demo_server);
+  }
+
+  // With early data, the session tickets issued allow it. OpenSSL guards
+  // against replays of it by only accepting early data with a ticket once
+  // (tracked in the server session cache, which must stay enabled, and is
+  // shared by the connection handling threads).
+  if (demo_server->max_early_data > 0)
+  {
+    if (1 != SSL_CTX_set_max_early_data(demo_server->tlsconn.ctx,
+                                        (uint32_t) demo_server->max_early_data))
+    {
+      log_openssl_error("SSL_CTX_set_max_early_data()");
+      demo_kmip_server_error(demo_server);
+    }
+    kmyth_log(LOG_DEBUG, "accepting up to %d bytes of TLS early data",
+                         demo_server->max_early_data);
+  }
+
   // prepare the server's to accept TLS connections from client
   if (EXIT_SUCCESS != demo_tls_config_server_accept(&demo_server->tlsconn))
   {
@@ -193,54 +318,55 @@ static void demo_kmip_server_setup(DemoServer *demo_server)
 }
 
 /*****************************************************************************
- * demo_kmip_server_receive_get_key_request()
+ * demo_kmip_server_wait_for_request()
  ****************************************************************************/
-static int demo_kmip_server_receive_get_key_request(DemoServer *demo_server,
-                                                    unsigned char **req_bytes,
-                                                    size_t *req_len)
+static bool demo_kmip_server_wait_for_request(BIO * conn_bio)
 {
-  kmyth_log(LOG_DEBUG, "waiting to accept TLS connection with client");
-  if (BIO_do_handshake(demo_server->tlsconn.bio) <= 0)
+  SSL *ssl = NULL;
+  unsigned char peek_byte = 0;
+
+  BIO_get_ssl(conn_bio, &ssl);  // internal pointer, not a new allocation
+  if (ssl == NULL)
   {
-    kmyth_log(LOG_ERR, "error completing TLS handshake");
-    return EXIT_FAILURE;
+    log_openssl_error("BIO_get_ssl()");
+    return false;
   }
-  kmyth_log(LOG_DEBUG, "TLS client connection - completed handshake");
 
-  // get KMIP 'get key' request from TLS client
-  unsigned char buf[KMYTH_TLS_MAX_MSG_SIZE] = { 0 };
+  // block until the next request starts to arrive - a client that is
+  // finished closes the connection instead
+  return (SSL_peek(ssl, &peek_byte, 1) > 0);
+}
 
-  int bytes_read = BIO_read(demo_server->tlsconn.bio,
-                            buf,
-                            KMYTH_TLS_MAX_MSG_SIZE);
-  if (bytes_read <= 0)
+/*****************************************************************************
+ * demo_kmip_server_receive_get_key_request()
+ ****************************************************************************/
+static int demo_kmip_server_receive_get_key_request(BIO * conn_bio,
+                                                    unsigned char **req_bytes,
+                                                    size_t *req_len)
+{
+  // get (complete) KMIP 'get key' request from TLS client
+  if (tls_read_kmip_message(conn_bio, KMYTH_TLS_MAX_MSG_SIZE,
+                            req_bytes, req_len))
   {
     kmyth_log(LOG_ERR, "error reading KMIP 'get key' request");
     return EXIT_FAILURE;
   }
 
-  // allocate buffer to hold received KMIP 'get key' request bytes
-  *req_len = (size_t) bytes_read;
-  *req_bytes = malloc(*req_len);
-
-  // copy received KMIP request from temporary buffer to newly allocated one
-  memcpy(*req_bytes, buf, bytes_read);
-  kmyth_clear(buf, bytes_read);
-
   kmyth_log(LOG_DEBUG, "received KMIP Request: 0x%02X%02X ... %02X%02X "
-                       "(%d bytes)",
+                       "(%zu bytes)",
                        (*req_bytes)[0], (*req_bytes)[1],
                        (*req_bytes)[*req_len-2],
                        (*req_bytes)[*req_len-1],
                        *req_len);
-    
+
   return EXIT_SUCCESS;
 }
 
 int validate_kmip_get_key_request(unsigned char * kmip_key_req_bytes,
                                   size_t kmip_key_req_len,
-                                  unsigned char ** kmip_key_req_id_bytes,
-                                  size_t * kmip_key_req_id_len)
+                                  unsigned char *** kmip_key_req_ids,
+                                  size_t ** kmip_key_req_id_lens,
+                                  size_t * kmip_key_req_id_count)
 {
   KMIP kmip_ctx = { 0 };
   kmip_init(&kmip_ctx, NULL, 0, KMIP_2_0);
@@ -252,68 +378,89 @@ int validate_kmip_get_key_request(unsigned char * kmip_key_req_bytes,
     return EXIT_FAILURE;
   }
 
-  if (EXIT_SUCCESS != parse_kmip_get_request(&kmip_ctx,
-                                             kmip_key_req_bytes,
-                                             kmip_key_req_len,
-                                             kmip_key_req_id_bytes,
-                                             kmip_key_req_id_len))
+  // a request may batch several 'get key' operations (one per key ID)
+  if (EXIT_SUCCESS != parse_kmip_get_batch_request(&kmip_ctx,
+                                                   kmip_key_req_bytes,
+                                                   kmip_key_req_len,
+                                                   kmip_key_req_ids,
+                                                   kmip_key_req_id_lens,
+                                                   kmip_key_req_id_count))
   {
     kmyth_log(LOG_ERR, "KMIP 'get key' request parsing failed");
     kmip_destroy(&kmip_ctx);
     return EXIT_FAILURE;
   }
+  kmip_destroy(&kmip_ctx);
 
-  if ((*kmip_key_req_id_len == 0) || (*kmip_key_req_id_bytes == NULL))
-  {
-    kmyth_log(LOG_ERR, "KMIP request specifies invalid (empty) key ID");
-    kmip_destroy(&kmip_ctx);
-    return EXIT_FAILURE;
-  }
-  char *id_str = malloc(*kmip_key_req_id_len + 1);
-  memcpy(id_str, (char *) *kmip_key_req_id_bytes, *kmip_key_req_id_len);
-  *(id_str+*kmip_key_req_id_len) = '\0';
-
-if (*kmip_key_req_id_len != strlen(DEMO_OP_KEY_ID_STR))
+  for (size_t i = 0; i < *kmip_key_req_id_count; i++)
   {
-    kmyth_log(LOG_ERR, "unexpected KMIP ID string length (%d instead of %d)",
-                       *kmip_key_req_id_len, strlen(DEMO_OP_KEY_ID_STR));
-    free(id_str);
-    kmip_destroy(&kmip_ctx);
-    return EXIT_FAILURE;
-  }
+    unsigned char *id_bytes = (*kmip_key_req_ids)[i];
+    size_t id_len = (*kmip_key_req_id_lens)[i];
 
-  if (strncmp(id_str, DEMO_OP_KEY_ID_STR, *kmip_key_req_id_len) != 0)
-  {
-    kmyth_log(LOG_ERR, "unexpected KMIP ID value ('%s' instead of '%s')",
-                       id_str, DEMO_OP_KEY_ID_STR);
-    free(id_str);
-    kmip_destroy(&kmip_ctx);
-    return EXIT_FAILURE;
+    if ((id_len == 0) || (id_bytes == NULL))
+    {
+      kmyth_log(LOG_ERR, "KMIP request specifies invalid (empty) key ID");
+      return EXIT_FAILURE;
+    }
   }
 
-  kmyth_log(LOG_DEBUG, "validated KMIP request for key ID = %s", id_str);
-  free(id_str);
-
-  kmip_destroy(&kmip_ctx);
-
   return EXIT_SUCCESS;
 }
 
-int compose_kmip_get_key_response(unsigned char *key_id,
-                                  size_t key_id_len,
+int compose_kmip_get_key_response(const DemoKeyStore * key_store,
+                                  unsigned char **key_ids,
+                                  size_t *key_id_lens,
+                                  size_t key_id_count,
                                   unsigned char **response_bytes,
                                   size_t *response_len)
 {
   KMIP kmip_ctx = { 0 };
   kmip_init(&kmip_ctx, NULL, 0, KMIP_2_0);
 
-  if (EXIT_SUCCESS != build_kmip_get_response(&kmip_ctx,
-                                              key_id,
-                                              key_id_len,
-                                              demo_op_key_val,
-                                              DEMO_OP_KEY_VAL_LEN,
-                                              response_bytes,
-                                              response_len))
+  // every key ID is answered with the value held for it in the key store
+  unsigned char **key_vals = calloc(key_id_count, sizeof(unsigned char *));
+  size_t *key_val_lens = calloc(key_id_count, sizeof(size_t));
+
+  if ((key_vals == NULL) || (key_val_lens == NULL))
+  {
+    kmyth_log(LOG_ERR, "error allocating KMIP 'get key' response key list");
+    free(key_vals);
+    free(key_val_lens);
+    kmip_destroy(&kmip_ctx);
+    return EXIT_FAILURE;
+  }
+  for (size_t i = 0; i < key_id_count; i++)
+  {
+    const DemoKeyEntry *entry = demo_key_store_lookup(key_store,
+                                                      key_ids[i],
+                                                      key_id_lens[i]);
+
+    if (entry == NULL)
+    {
+      kmyth_log(LOG_ERR, "KMIP request for unknown key ID ('%.*s')",
+                         (int) key_id_lens[i], (char *) key_ids[i]);
+      free(key_vals);
+      free(key_val_lens);
+      kmip_destroy(&kmip_ctx);
+      return EXIT_FAILURE;
+    }
+    kmyth_log(LOG_DEBUG, "validated KMIP request for key ID = %.*s",
+                         (int) key_id_lens[i], (char *) key_ids[i]);
+    key_vals[i] = entry->val;
+    key_val_lens[i] = entry->val_len;
+  }
+
+  int ret = build_kmip_get_batch_response(&kmip_ctx,
+                                          key_ids,
+                                          key_id_lens,
+                                          key_vals,
+                                          key_val_lens,
+                                          key_id_count,
+                                          response_bytes,
+                                          response_len);
+  free(key_vals);
+  free(key_val_lens);
+  if (EXIT_SUCCESS != ret)
   {
     kmyth_log(LOG_ERR, "error building KMIP 'get key' response");
     kmip_destroy(&kmip_ctx);
@@ -332,14 +479,12 @@ int compose_kmip_get_key_response(unsigned char *key_id,
   return EXIT_SUCCESS;
 }
 
-int send_kmip_get_key_response(DemoServer *server,
+int send_kmip_get_key_response(BIO * conn_bio,
                                unsigned char *kmip_key_resp_bytes,
                                size_t kmip_key_resp_len)
 {
-  struct TLSMessageHeader tls_hdr;
-
   // send the KMIP 'get key' response bytes
-  int bytes_written = BIO_write(server->tlsconn.bio,
+  int bytes_written = BIO_write(conn_bio,
                                 kmip_key_resp_bytes,
                                 kmip_key_resp_len);
   if (bytes_written != kmip_key_resp_len)
@@ -354,93 +499,416 @@ int send_kmip_get_key_response(DemoServer *server,
   return EXIT_SUCCESS;
 }
 
-
-int main(int argc, char **argv)
+/*****************************************************************************
+ * demo_kmip_server_answer_request()
+ ****************************************************************************/
+static int demo_kmip_server_answer_request(DemoServer * demo_server,
+                                           unsigned char *kmip_req_bytes,
+                                           size_t kmip_req_len,
+                                           unsigned char **kmip_resp_bytes,
+                                           size_t *kmip_resp_len)
 {
-  DemoServer demo_server;
+  // validate and parse out key ID(s) of 'get key' request just received
+  unsigned char **req_ids = NULL;
+  size_t *req_id_lens = NULL;
+  size_t req_id_count = 0;
 
-  // setup default logging parameters
-  set_app_name("             server ");
-  set_app_version("");
-  set_applog_path("../sgx/sgx_retrievekey_demo.log");
-  set_applog_severity_threshold(DEMO_LOG_LEVEL);
-  set_applog_output_mode(0);
+  if (EXIT_SUCCESS != validate_kmip_get_key_request(kmip_req_bytes,
+                                                    kmip_req_len,
+                                                    &req_ids,
+                                                    &req_id_lens,
+                                                    &req_id_count))
+  {
+    kmyth_log(LOG_ERR, "failed to validate KMIP 'get key' request");
+    free_kmip_get_batch(req_ids, req_id_lens, NULL, NULL, req_id_count);
+    return EXIT_FAILURE;
+  }
 
-  // process command-line options
-  demo_kmip_server_get_options(&demo_server, argc, argv);
-  demo_kmip_server_check_options(&demo_server);
+  // create KMIP 'get key' response to be returned to client
+  if (EXIT_SUCCESS != compose_kmip_get_key_response(&(demo_server->key_store),
+                                                    req_ids,
+                                                    req_id_lens,
+                                                    req_id_count,
+                                                    kmip_resp_bytes,
+                                                    kmip_resp_len))
+  {
+    kmyth_log(LOG_ERR, "failed to compose KMIP 'get key' response");
+    free_kmip_get_batch(req_ids, req_id_lens, NULL, NULL, req_id_count);
+    if (*kmip_resp_bytes != NULL)
+    {
+      kmyth_clear_and_free(*kmip_resp_bytes, *kmip_resp_len);
+      *kmip_resp_bytes = NULL;
+    }
+    return EXIT_FAILURE;
+  }
+  free_kmip_get_batch(req_ids, req_id_lens, NULL, NULL, req_id_count);
 
-  // some initializtion for demo KMIP server
-  demo_kmip_server_setup(&demo_server);
+  return EXIT_SUCCESS;
+}
 
+/*****************************************************************************
+ * demo_kmip_server_handle_request()
+ ****************************************************************************/
+static int demo_kmip_server_handle_request(DemoServer * demo_server,
+                                           BIO * conn_bio)
+{
   // receive KMIP 'get key' request via client connection
   unsigned char *kmip_req_bytes = NULL;
   size_t kmip_req_len = 0;
 
-  if (EXIT_SUCCESS != demo_kmip_server_receive_get_key_request(&demo_server,
+  if (EXIT_SUCCESS != demo_kmip_server_receive_get_key_request(conn_bio,
                                                                &kmip_req_bytes,
                                                                &kmip_req_len))
   {
     kmyth_log(LOG_ERR, "error receiving KMIP 'get key' request");
-    if (kmip_req_bytes != NULL)
+    return EXIT_FAILURE;
+  }
+
+  unsigned char *kmip_resp_bytes = NULL;
+  size_t kmip_resp_len = 0;
+  int ret = demo_kmip_server_answer_request(demo_server,
+                                            kmip_req_bytes,
+                                            kmip_req_len,
+                                            &kmip_resp_bytes,
+                                            &kmip_resp_len);
+
+  free(kmip_req_bytes);
+  if (EXIT_SUCCESS != ret)
+  {
+    return EXIT_FAILURE;
+  }
+
+  // send KMIP 'get key' response just created
+  if (EXIT_SUCCESS != send_kmip_get_key_response(conn_bio,
+                                                 kmip_resp_bytes,
+                                                 kmip_resp_len))
+  {
+    kmyth_log(LOG_ERR, "error returning KMIP 'get key' response");
+    kmyth_clear_and_free(kmip_resp_bytes, kmip_resp_len);
+    return EXIT_FAILURE;
+  }
+  kmyth_clear_and_free(kmip_resp_bytes, kmip_resp_len);
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * demo_kmip_server_handle_early_data()
+ ****************************************************************************/
+static int demo_kmip_server_handle_early_data(DemoServer * demo_server,
+                                              BIO * conn_bio,
+                                              size_t *request_count)
+{
+  SSL *ssl = NULL;
+
+  BIO_get_ssl(conn_bio, &ssl);  // internal pointer, not a new allocation
+  if (ssl == NULL)
+  {
+    log_openssl_error("BIO_get_ssl()");
+    return EXIT_FAILURE;
+  }
+
+  // the early data (never more than the limit set) is gathered until it
+  // holds a whole request, which is answered straight away (as 0.5-RTT
+  // data, ahead of the client's Finished message)
+  size_t buf_size = (size_t) demo_server->max_early_data;
+  unsigned char *buf = malloc(buf_size);
+  size_t buf_len = 0;
+  int status = SSL_READ_EARLY_DATA_SUCCESS;
+
+  if (buf == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating early data buffer");
+    return EXIT_FAILURE;
+  }
+
+  while (status != SSL_READ_EARLY_DATA_FINISH)
+  {
+    size_t read_len = 0;
+
+    status = SSL_read_early_data(ssl, buf + buf_len, buf_size - buf_len,
+                                 &read_len);
+    if (status == SSL_READ_EARLY_DATA_ERROR)
     {
-      free(kmip_req_bytes);
+      log_openssl_error("SSL_read_early_data()");
+      kmyth_clear_and_free(buf, buf_size);
+      return EXIT_FAILURE;
     }
-    demo_kmip_server_error(&demo_server);
+    buf_len += read_len;
+
+    while (buf_len >= DEMO_KMIP_HEADER_LEN)
+    {
+      size_t req_len = DEMO_KMIP_HEADER_LEN + (((size_t) buf[4] << 24) |
+                                               ((size_t) buf[5] << 16) |
+                                               ((size_t) buf[6] << 8) |
+                                               (size_t) buf[7]);
+      if (req_len > buf_len)
+      {
+        break;
+      }
+
+      unsigned char *kmip_resp_bytes = NULL;
+      size_t kmip_resp_len = 0;
+      size_t written = 0;
+
+      if (EXIT_SUCCESS != demo_kmip_server_answer_request(demo_server,
+                                                          buf, req_len,
+                                                          &kmip_resp_bytes,
+                                                          &kmip_resp_len))
+      {
+        kmyth_clear_and_free(buf, buf_size);
+        return EXIT_FAILURE;
+      }
+      if (1 != SSL_write_early_data(ssl, kmip_resp_bytes, kmip_resp_len,
+                                    &written))
+      {
+        log_openssl_error("SSL_write_early_data()");
+        kmyth_clear_and_free(kmip_resp_bytes, kmip_resp_len);
+        kmyth_clear_and_free(buf, buf_size);
+        return EXIT_FAILURE;
+      }
+      kmyth_clear_and_free(kmip_resp_bytes, kmip_resp_len);
+      kmyth_log(LOG_DEBUG, "answered KMIP request sent as early data "
+                           "(%zu bytes)", req_len);
+      (*request_count)++;
+
+      memmove(buf, buf + req_len, buf_len - req_len);
+      buf_len -= req_len;
+    }
+
+    // (a request too long for the buffer could never be completed)
+    if (buf_len == buf_size)
+    {
+      kmyth_log(LOG_ERR, "KMIP request exceeds the early data limit");
+      kmyth_clear_and_free(buf, buf_size);
+      return EXIT_FAILURE;
+    }
+  }
+  kmyth_clear_and_free(buf, buf_size);
+
+  // early data must hold whole requests
+  if (buf_len > 0)
+  {
+    kmyth_log(LOG_ERR, "early data ends part way through a KMIP request");
     return EXIT_FAILURE;
   }
 
-  // validate and parse out key ID of 'get key' request just received
-  unsigned char *req_id_bytes = NULL;
-  size_t req_id_len = 0;
+  kmyth_log(LOG_DEBUG, "TLS early data %s",
+                       (SSL_get_early_data_status(ssl) ==
+                        SSL_EARLY_DATA_ACCEPTED) ? "accepted" :
+                                                   "not sent (or rejected)");
 
-  if (EXIT_SUCCESS != validate_kmip_get_key_request(kmip_req_bytes,
-                                                    kmip_req_len,
-                                                    &req_id_bytes,
-                                                    &req_id_len))
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * demo_kmip_server_handle_connection()
+ ****************************************************************************/
+static void demo_kmip_server_handle_connection(DemoServer * demo_server,
+                                               BIO * conn_bio)
+{
+  size_t request_count = 0;
+
+  // any early data is read (and answered) before the handshake completes
+  if ((demo_server->max_early_data > 0) &&
+      (EXIT_SUCCESS != demo_kmip_server_handle_early_data(demo_server,
+                                                          conn_bio,
+                                                          &request_count)))
   {
-    kmyth_log(LOG_ERR, "failed to validate KMIP 'get key' request");
-    free(kmip_req_bytes);
-    if (req_id_bytes != NULL)
+    kmyth_log(LOG_ERR, "closing TLS connection after failed early data");
+    return;
+  }
+
+  if (BIO_do_handshake(conn_bio) <= 0)
+  {
+    kmyth_log(LOG_ERR, "error completing TLS handshake");
+    log_openssl_error("BIO_do_handshake()");
+    return;
+  }
+  kmyth_log(LOG_DEBUG, "TLS client connection - completed handshake");
+
+  // a client (e.g., a proxy re-using pooled connections) may send any
+  // number of requests over one connection
+  while (demo_kmip_server_wait_for_request(conn_bio))
+  {
+    if (EXIT_SUCCESS != demo_kmip_server_handle_request(demo_server,
+                                                        conn_bio))
     {
-      free(req_id_bytes);
+      kmyth_log(LOG_ERR, "closing TLS connection after failed request");
+      return;
     }
-    demo_kmip_server_error(&demo_server);
-    return EXIT_FAILURE;
+    request_count++;
   }
-  free(kmip_req_bytes);
-  
-  // create KMIP 'get key' response to be returned to client
-  unsigned char *kmip_resp_bytes = NULL;
-  size_t kmip_resp_len = 0;
 
-  if (EXIT_SUCCESS != compose_kmip_get_key_response(req_id_bytes,
-                                                    req_id_len,
-                                                    &kmip_resp_bytes,
-                                                    &kmip_resp_len))
+  kmyth_log(LOG_DEBUG, "TLS client closed connection (%zu request(s))",
+                       request_count);
+}
+
+/*****************************************************************************
+ * demo_kmip_server_worker()
+ ****************************************************************************/
+static void *demo_kmip_server_worker(void *server_arg)
+{
+  DemoServer *demo_server = (DemoServer *) server_arg;
+  DemoConnQueue *queue = &(demo_server->queue);
+
+  while (true)
   {
-    kmyth_log(LOG_ERR, "failed to compose KMIP 'get key' response");
-    free(req_id_bytes);
-    if (kmip_resp_bytes != NULL)
+    pthread_mutex_lock(&(queue->lock));
+    while ((queue->count == 0) && !queue->closed)
     {
-      kmyth_clear_and_free(kmip_resp_bytes, kmip_resp_len);
+      pthread_cond_wait(&(queue->not_empty), &(queue->lock));
     }
-    demo_kmip_server_error(&demo_server);
+    if (queue->count == 0)
+    {
+      // queue is closed and drained
+      pthread_mutex_unlock(&(queue->lock));
+      break;
+    }
+    BIO *conn_bio = queue->conns[queue->head];
+
+    queue->head = (queue->head + 1) % DEMO_SERVER_QUEUE_LEN;
+    queue->count--;
+    pthread_cond_signal(&(queue->not_full));
+    pthread_mutex_unlock(&(queue->lock));
+
+    demo_kmip_server_handle_connection(demo_server, conn_bio);
+    BIO_free_all(conn_bio);
+  }
+
+  return NULL;
+}
+
+/*****************************************************************************
+ * demo_kmip_server_enqueue()
+ ****************************************************************************/
+static void demo_kmip_server_enqueue(DemoServer * demo_server, BIO * conn_bio)
+{
+  DemoConnQueue *queue = &(demo_server->queue);
+
+  pthread_mutex_lock(&(queue->lock));
+  while (queue->count == DEMO_SERVER_QUEUE_LEN)
+  {
+    pthread_cond_wait(&(queue->not_full), &(queue->lock));
+  }
+  queue->conns[(queue->head + queue->count) % DEMO_SERVER_QUEUE_LEN] =
+    conn_bio;
+  queue->count++;
+  pthread_cond_signal(&(queue->not_empty));
+  pthread_mutex_unlock(&(queue->lock));
+}
+
+/*****************************************************************************
+ * demo_kmip_server_close_queue()
+ ****************************************************************************/
+static void demo_kmip_server_close_queue(DemoServer * demo_server)
+{
+  DemoConnQueue *queue = &(demo_server->queue);
+
+  pthread_mutex_lock(&(queue->lock));
+  queue->closed = true;
+  pthread_cond_broadcast(&(queue->not_empty));
+  pthread_mutex_unlock(&(queue->lock));
+}
+
+/*****************************************************************************
+ * demo_kmip_server_run()
+ ****************************************************************************/
+static int demo_kmip_server_run(DemoServer * demo_server)
+{
+  pthread_t threads[DEMO_SERVER_MAX_THREADS];
+  int started = 0;
+  int ret = EXIT_SUCCESS;
+
+  // a client that drops its connection mid-write must not take down the
+  // whole server
+  signal(SIGPIPE, SIG_IGN);
+
+  while (started < demo_server->num_threads)
+  {
+    if (pthread_create(&threads[started], NULL,
+                       demo_kmip_server_worker, demo_server) != 0)
+    {
+      kmyth_log(LOG_ERR, "failed to start connection handling thread");
+      break;
+    }
+    started++;
+  }
+  if (started == 0)
+  {
     return EXIT_FAILURE;
   }
-  free(req_id_bytes);
+  kmyth_log(LOG_DEBUG, "serving %zu key(s) with %d thread(s)",
+                       demo_server->key_store.key_count, started);
 
-  // send KMIP 'get key' response just created
-  if (EXIT_SUCCESS != send_kmip_get_key_response(&demo_server,
-                                                 kmip_resp_bytes,
-                                                 kmip_resp_len))
+  int session_count = 0;
+
+  while ((demo_server->session_limit == 0) ||
+         (session_count < demo_server->session_limit))
   {
-    kmyth_log(LOG_ERR, "error returning KMIP 'get key' response");
-    kmyth_clear_and_free(kmip_resp_bytes, kmip_resp_len);
+    kmyth_log(LOG_DEBUG, "waiting to accept TLS connection with client");
+    if (BIO_do_accept(demo_server->tlsconn.bio) <= 0)
+    {
+      kmyth_log(LOG_ERR, "error accepting client connection");
+      log_openssl_error("BIO_do_accept()");
+      ret = EXIT_FAILURE;
+      break;
+    }
+
+    // detach the accepted connection (SSL BIO chained to the new socket)
+    // from the accept BIO, leaving it ready for the next connection
+    BIO *conn_bio = BIO_pop(demo_server->tlsconn.bio);
+
+    if (conn_bio == NULL)
+    {
+      kmyth_log(LOG_ERR, "failed to detach accepted client connection");
+      ret = EXIT_FAILURE;
+      break;
+    }
+    session_count++;
+    kmyth_log(LOG_DEBUG, "accepted TLS client connection (#%d)",
+                         session_count);
+
+    demo_kmip_server_enqueue(demo_server, conn_bio);
+  }
+
+  // let the threads finish the connections already accepted, then exit
+  demo_kmip_server_close_queue(demo_server);
+  for (int i = 0; i < started; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+
+  return ret;
+}
+
+int main(int argc, char **argv)
+{
+  DemoServer demo_server;
+
+  // setup default logging parameters
+  set_app_name("             server ");
+  set_app_version("");
+  set_applog_path("../sgx/sgx_retrievekey_demo.log");
+  set_applog_severity_threshold(DEMO_LOG_LEVEL);
+  set_applog_output_mode(0);
+
+  demo_kmip_server_init(&demo_server);
+
+  // process command-line options
+  demo_kmip_server_get_options(&demo_server, argc, argv);
+  demo_kmip_server_check_options(&demo_server);
+
+  // some initializtion for demo KMIP server
+  demo_kmip_server_setup(&demo_server);
+
+  // accept client connections, handing them to the connection threads
+  if (EXIT_SUCCESS != demo_kmip_server_run(&demo_server))
+  {
+    kmyth_log(LOG_ERR, "error serving KMIP 'get key' requests");
     demo_kmip_server_error(&demo_server);
     return EXIT_FAILURE;
   }
-  kmyth_clear_and_free(kmip_resp_bytes, kmip_resp_len);
 
   demo_kmip_server_cleanup(&demo_server);
 
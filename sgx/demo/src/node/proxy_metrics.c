@@ -0,0 +1,461 @@
+/**
+ * @file proxy_metrics.c
+ * @brief Latency histograms, session / error counters, and a Prometheus
+ *        text endpoint for the ECDHE/TLS proxy application.
+ */
+
+#include "proxy_metrics.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <kmyth/kmyth_log.h>
+
+#include "socket_util.h"
+
+// upper bounds (in microseconds) of the finite histogram buckets
+static const uint64_t proxy_metrics_bounds_us[PROXY_METRICS_NUM_BUCKETS] = {
+  100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+  100000, 250000, 500000, 1000000, 2500000
+};
+
+// metric names (and help text), indexed by ProxyMetricsStage
+static const char *const proxy_metrics_stage_names[PROXY_METRICS_NUM_STAGES] = {
+  "kmyth_proxy_ecdh_setup_seconds",
+  "kmyth_proxy_upstream_tls_seconds",
+  "kmyth_proxy_kmip_request_seconds"
+};
+
+static const char *const proxy_metrics_stage_help[PROXY_METRICS_NUM_STAGES] = {
+  "Time to complete an ECDH session setup with a client.",
+  "Time to connect a new TLS session to the remote KMIP server.",
+  "Time from sending a KMIP request to receiving its response."
+};
+
+// error labels, indexed by ProxyMetricsError
+static const char *const proxy_metrics_error_names[PROXY_METRICS_NUM_ERRORS] = {
+  "ecdh_setup",
+  "key_request",
+  "upstream_tls",
+  "kmip_request",
+  "key_response"
+};
+
+// time allowed for a metrics request to arrive
+#define PROXY_METRICS_RECV_TIMEOUT_SECS 2
+
+// pending metrics connections (scrapes are served one at a time)
+#define PROXY_METRICS_LISTEN_BACKLOG 8
+
+/*****************************************************************************
+ * proxy_metrics_init()
+ ****************************************************************************/
+void proxy_metrics_init(ProxyMetrics * metrics)
+{
+  memset(metrics, 0, sizeof(ProxyMetrics));
+  metrics->listen_fd = -1;
+}
+
+/*****************************************************************************
+ * proxy_metrics_snapshot()
+ ****************************************************************************/
+static void proxy_metrics_snapshot(const ProxyMetricsData * data,
+                                   ProxyMetricsData * snap)
+{
+  // each counter is read atomically, though not all at the same instant
+  for (int i = 0; i < PROXY_METRICS_NUM_STAGES; i++)
+  {
+    for (int j = 0; j <= PROXY_METRICS_NUM_BUCKETS; j++)
+    {
+      snap->latency[i].buckets[j] =
+        __atomic_load_n(&(data->latency[i].buckets[j]), __ATOMIC_RELAXED);
+    }
+    snap->latency[i].sum_us =
+      __atomic_load_n(&(data->latency[i].sum_us), __ATOMIC_RELAXED);
+  }
+  for (int i = 0; i < PROXY_METRICS_NUM_ERRORS; i++)
+  {
+    snap->errors[i] = __atomic_load_n(&(data->errors[i]), __ATOMIC_RELAXED);
+  }
+  snap->sessions_total =
+    __atomic_load_n(&(data->sessions_total), __ATOMIC_RELAXED);
+  snap->sessions_active =
+    __atomic_load_n(&(data->sessions_active), __ATOMIC_RELAXED);
+}
+
+/*****************************************************************************
+ * proxy_metrics_append()
+ ****************************************************************************/
+static void proxy_metrics_append(char *buf, size_t buf_size, size_t *len,
+                                 const char *format, ...)
+{
+  if (*len >= buf_size)
+  {
+    return;
+  }
+
+  va_list args;
+
+  va_start(args, format);
+  int n = vsnprintf(buf + *len, buf_size - *len, format, args);
+
+  va_end(args);
+
+  if (n > 0)
+  {
+    *len += (size_t) n;
+  }
+  if (*len >= buf_size)
+  {
+    // truncated - keep the terminating NUL inside the buffer
+    *len = buf_size - 1;
+  }
+}
+
+/*****************************************************************************
+ * proxy_metrics_render()
+ ****************************************************************************/
+size_t proxy_metrics_render(const ProxyMetricsData * data, char *buf,
+                            size_t buf_size)
+{
+  ProxyMetricsData snap;
+  size_t len = 0;
+
+  if (buf_size == 0)
+  {
+    return 0;
+  }
+  buf[0] = '\0';
+  proxy_metrics_snapshot(data, &snap);
+
+  proxy_metrics_append(buf, buf_size, &len,
+                       "# HELP kmyth_proxy_sessions_active "
+                       "ECDH client sessions in progress.\n"
+                       "# TYPE kmyth_proxy_sessions_active gauge\n"
+                       "kmyth_proxy_sessions_active %lld\n"
+                       "# HELP kmyth_proxy_sessions_total "
+                       "ECDH client sessions accepted.\n"
+                       "# TYPE kmyth_proxy_sessions_total counter\n"
+                       "kmyth_proxy_sessions_total %llu\n",
+                       (long long) snap.sessions_active,
+                       (unsigned long long) snap.sessions_total);
+
+  proxy_metrics_append(buf, buf_size, &len,
+                       "# HELP kmyth_proxy_errors_total "
+                       "Failed ECDH client sessions, by failed stage.\n"
+                       "# TYPE kmyth_proxy_errors_total counter\n");
+  for (int i = 0; i < PROXY_METRICS_NUM_ERRORS; i++)
+  {
+    proxy_metrics_append(buf, buf_size, &len,
+                         "kmyth_proxy_errors_total{stage=\"%s\"} %llu\n",
+                         proxy_metrics_error_names[i],
+                         (unsigned long long) snap.errors[i]);
+  }
+
+  for (int i = 0; i < PROXY_METRICS_NUM_STAGES; i++)
+  {
+    const char *name = proxy_metrics_stage_names[i];
+    const ProxyHistogram *hist = &(snap.latency[i]);
+    uint64_t cumulative = 0;
+
+    proxy_metrics_append(buf, buf_size, &len,
+                         "# HELP %s %s\n# TYPE %s histogram\n",
+                         name, proxy_metrics_stage_help[i], name);
+    for (int j = 0; j < PROXY_METRICS_NUM_BUCKETS; j++)
+    {
+      cumulative += hist->buckets[j];
+      proxy_metrics_append(buf, buf_size, &len,
+                           "%s_bucket{le=\"%g\"} %llu\n", name,
+                           (double) proxy_metrics_bounds_us[j] / 1e6,
+                           (unsigned long long) cumulative);
+    }
+    cumulative += hist->buckets[PROXY_METRICS_NUM_BUCKETS];
+
+    // the "+Inf" bucket holds every observation, so it is also the count
+    proxy_metrics_append(buf, buf_size, &len,
+                         "%s_bucket{le=\"+Inf\"} %llu\n"
+                         "%s_sum %.6f\n"
+                         "%s_count %llu\n",
+                         name, (unsigned long long) cumulative,
+                         name, (double) hist->sum_us / 1e6,
+                         name, (unsigned long long) cumulative);
+  }
+
+  return len;
+}
+
+/*****************************************************************************
+ * proxy_metrics_serve_client()
+ ****************************************************************************/
+static void proxy_metrics_serve_client(ProxyMetrics * metrics, int client_fd)
+{
+  char request[1024];
+  struct timeval timeout = { PROXY_METRICS_RECV_TIMEOUT_SECS, 0 };
+
+  setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  // any request is answered with the metrics page - read (and ignore) the
+  // request line and headers first, so that closing the connection does
+  // not reset it before the client reads the response
+  size_t received = 0;
+
+  while (received < sizeof(request) - 1)
+  {
+    ssize_t n = recv(client_fd, request + received,
+                     sizeof(request) - 1 - received, 0);
+
+    if (n <= 0)
+    {
+      break;
+    }
+    received += (size_t) n;
+    request[received] = '\0';
+    if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+    {
+      break;
+    }
+  }
+
+  char *page = malloc(PROXY_METRICS_MAX_PAGE_SIZE);
+
+  if (page == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate metrics page");
+    return;
+  }
+
+  size_t page_len = proxy_metrics_render(metrics->data, page,
+                                         PROXY_METRICS_MAX_PAGE_SIZE);
+  char header[160];
+  int header_len = snprintf(header, sizeof(header),
+                            "HTTP/1.0 200 OK\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: %zu\r\n"
+                            "Connection: close\r\n\r\n", page_len);
+
+  if (send(client_fd, header, (size_t) header_len, MSG_NOSIGNAL) ==
+      header_len)
+  {
+    size_t sent = 0;
+
+    while (sent < page_len)
+    {
+      ssize_t n = send(client_fd, page + sent, page_len - sent, MSG_NOSIGNAL);
+
+      if (n <= 0)
+      {
+        break;
+      }
+      sent += (size_t) n;
+    }
+  }
+
+  free(page);
+}
+
+/*****************************************************************************
+ * proxy_metrics_server()
+ ****************************************************************************/
+static void *proxy_metrics_server(void *metrics_arg)
+{
+  ProxyMetrics *metrics = (ProxyMetrics *) metrics_arg;
+
+  // requests are served one at a time - scrapes are infrequent, and this
+  // keeps the listener off the proxy's session handling threads
+  while (__atomic_load_n(&(metrics->server_running), __ATOMIC_ACQUIRE))
+  {
+    int client_fd = accept(metrics->listen_fd, NULL, NULL);
+
+    if (client_fd == -1)
+    {
+      if ((errno == EINTR) || (errno == ECONNABORTED))
+      {
+        continue;
+      }
+      if (__atomic_load_n(&(metrics->server_running), __ATOMIC_ACQUIRE))
+      {
+        kmyth_log(LOG_ERR, "metrics socket accept failed");
+      }
+      break;
+    }
+
+    proxy_metrics_serve_client(metrics, client_fd);
+    close(client_fd);
+  }
+
+  return NULL;
+}
+
+/*****************************************************************************
+ * proxy_metrics_start()
+ ****************************************************************************/
+int proxy_metrics_start(ProxyMetrics * metrics)
+{
+  if (metrics->port == NULL)
+  {
+    return EXIT_SUCCESS;
+  }
+
+  // shared (rather than private) memory, so that the children forked for
+  // each session update the counters the parent serves
+  void *data = mmap(NULL, sizeof(ProxyMetricsData), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (data == MAP_FAILED)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate shared metrics counters");
+    return EXIT_FAILURE;
+  }
+  memset(data, 0, sizeof(ProxyMetricsData));
+  metrics->data = (ProxyMetricsData *) data;
+
+  if (setup_server_socket(metrics->port, &(metrics->listen_fd)))
+  {
+    kmyth_log(LOG_ERR, "failed to set up metrics socket on port %s",
+              metrics->port);
+    metrics->listen_fd = -1;
+    return EXIT_FAILURE;
+  }
+  if (listen(metrics->listen_fd, PROXY_METRICS_LISTEN_BACKLOG))
+  {
+    kmyth_log(LOG_ERR, "failed to listen on metrics socket");
+    return EXIT_FAILURE;
+  }
+
+  metrics->server_running = true;
+  if (pthread_create(&(metrics->server), NULL, proxy_metrics_server, metrics))
+  {
+    kmyth_log(LOG_ERR, "failed to start metrics listener thread");
+    metrics->server_running = false;
+    return EXIT_FAILURE;
+  }
+
+  kmyth_log(LOG_DEBUG, "serving metrics on port %s", metrics->port);
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * proxy_metrics_detach()
+ ****************************************************************************/
+void proxy_metrics_detach(ProxyMetrics * metrics)
+{
+  // the listener thread was not copied by fork() - only its socket was
+  metrics->server_running = false;
+  if (metrics->listen_fd != -1)
+  {
+    close(metrics->listen_fd);
+    metrics->listen_fd = -1;
+  }
+}
+
+/*****************************************************************************
+ * proxy_metrics_cleanup()
+ ****************************************************************************/
+void proxy_metrics_cleanup(ProxyMetrics * metrics)
+{
+  if (metrics->server_running)
+  {
+    // shutting the listen socket down wakes the listener from accept()
+    __atomic_store_n(&(metrics->server_running), false, __ATOMIC_RELEASE);
+    shutdown(metrics->listen_fd, SHUT_RDWR);
+    pthread_join(metrics->server, NULL);
+  }
+  if (metrics->listen_fd != -1)
+  {
+    close(metrics->listen_fd);
+  }
+  if (metrics->data != NULL)
+  {
+    munmap(metrics->data, sizeof(ProxyMetricsData));
+  }
+  free(metrics->port);
+
+  proxy_metrics_init(metrics);
+}
+
+/*****************************************************************************
+ * proxy_metrics_start_timer()
+ ****************************************************************************/
+void proxy_metrics_start_timer(struct timespec *start)
+{
+  clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+/*****************************************************************************
+ * proxy_metrics_observe()
+ ****************************************************************************/
+void proxy_metrics_observe(ProxyMetrics * metrics, ProxyMetricsStage stage,
+                           const struct timespec *start)
+{
+  if ((metrics->data == NULL) || (stage >= PROXY_METRICS_NUM_STAGES))
+  {
+    return;
+  }
+
+  struct timespec finish;
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  int64_t elapsed_us = (int64_t) (finish.tv_sec - start->tv_sec) * 1000000L
+    + (finish.tv_nsec - start->tv_nsec) / 1000L;
+  uint64_t us = (elapsed_us > 0) ? (uint64_t) elapsed_us : 0;
+  int bucket = 0;
+
+  while ((bucket < PROXY_METRICS_NUM_BUCKETS) &&
+         (us > proxy_metrics_bounds_us[bucket]))
+  {
+    bucket++;
+  }
+
+  ProxyHistogram *hist = &(metrics->data->latency[stage]);
+
+  __atomic_add_fetch(&(hist->buckets[bucket]), 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&(hist->sum_us), us, __ATOMIC_RELAXED);
+}
+
+/*****************************************************************************
+ * proxy_metrics_error()
+ ****************************************************************************/
+void proxy_metrics_error(ProxyMetrics * metrics, ProxyMetricsError error)
+{
+  if ((metrics->data == NULL) || (error >= PROXY_METRICS_NUM_ERRORS))
+  {
+    return;
+  }
+
+  __atomic_add_fetch(&(metrics->data->errors[error]), 1, __ATOMIC_RELAXED);
+}
+
+/*****************************************************************************
+ * proxy_metrics_session_start()
+ ****************************************************************************/
+void proxy_metrics_session_start(ProxyMetrics * metrics)
+{
+  if (metrics->data == NULL)
+  {
+    return;
+  }
+
+  __atomic_add_fetch(&(metrics->data->sessions_total), 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&(metrics->data->sessions_active), 1, __ATOMIC_RELAXED);
+}
+
+/*****************************************************************************
+ * proxy_metrics_session_end()
+ ****************************************************************************/
+void proxy_metrics_session_end(ProxyMetrics * metrics)
+{
+  if (metrics->data == NULL)
+  {
+    return;
+  }
+
+  __atomic_sub_fetch(&(metrics->data->sessions_active), 1, __ATOMIC_RELAXED);
+}
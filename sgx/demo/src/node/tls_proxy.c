@@ -11,6 +11,11 @@
 
 #define NUM_POLL_FDS 2
 
+#define PROXY_RECV_DONE 0
+#define PROXY_RECV_AGAIN 1
+#define PROXY_RECV_ERROR -1
+#define PROXY_RECV_CLOSED 2
+
 /*****************************************************************************
  * proxy_init()
  ****************************************************************************/
@@ -24,6 +29,388 @@ static void proxy_init(TLSProxy * proxy)
 
   // initialize proxy's TLS interface as a client
   demo_tls_init(true, &(proxy->tlsconn));
+
+  // default to the fork-per-connection model with a single event worker
+  proxy->num_workers = 1;
+
+  // idle upstream connections are closed after this long by default
+  proxy->upstream.max_idle_secs = PROXY_DEFAULT_MAX_IDLE_SECS;
+
+  // sockets are left with the system defaults unless tuned (-O)
+  socket_options_init(&(proxy->sockopts));
+
+  // no metrics are kept unless a port to serve them on is given (-M)
+  proxy_metrics_init(&(proxy->metrics));
+
+  pthread_mutex_init(&(proxy->upstream.lock), NULL);
+  pthread_cond_init(&(proxy->upstream.wakeup), NULL);
+  pthread_mutex_init(&(proxy->session_lock), NULL);
+}
+
+/*****************************************************************************
+ * proxy_now()
+ ****************************************************************************/
+static time_t proxy_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec;
+}
+
+/*****************************************************************************
+ * proxy_upstream_check_ktls()
+ ****************************************************************************/
+static void proxy_upstream_check_ktls(BIO * bio)
+{
+  SSL *ssl = NULL;
+
+  BIO_get_ssl(bio, &ssl);  // internal pointer, not a new allocation
+  if (ssl == NULL)
+  {
+    return;
+  }
+
+  // OpenSSL falls back to its own record layer (per direction) where the
+  // kernel lacks the 'tls' module or the negotiated cipher suite
+  bool ktls_send = BIO_get_ktls_send(SSL_get_wbio(ssl));
+  bool ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(ssl));
+
+  if (ktls_send && ktls_recv)
+  {
+    kmyth_log(LOG_DEBUG, "kernel TLS offload active for TLS connection");
+  }
+  else
+  {
+    kmyth_log(LOG_WARNING, "kernel TLS offload inactive for TLS connection "
+                           "(send: %s, receive: %s, cipher: %s)",
+                           ktls_send ? "yes" : "no", ktls_recv ? "yes" : "no",
+                           SSL_get_cipher_name(ssl));
+  }
+}
+
+/*****************************************************************************
+ * proxy_upstream_connect()
+ ****************************************************************************/
+static BIO *proxy_upstream_connect(TLSProxy * proxy)
+{
+  // connect a new BIO chain, using the proxy's TLS client configuration
+  // and (shared) TLS context
+  TLSPeer conn = proxy->tlsconn;
+  struct timespec start;
+
+  conn.bio = NULL;
+  proxy_metrics_start_timer(&start);
+
+  if (demo_tls_config_client_connect(&conn))
+  {
+    kmyth_log(LOG_ERR, "failed to configure TLS client connection");
+    if (conn.bio != NULL)
+    {
+      BIO_free_all(conn.bio);
+    }
+    return NULL;
+  }
+
+  if (demo_tls_client_connect(&conn))
+  {
+    kmyth_log(LOG_ERR, "TLS connection failed");
+    BIO_free_all(conn.bio);
+    return NULL;
+  }
+
+  // the connection is made by OpenSSL, so only the per-connection socket
+  // options apply to it
+  if (apply_socket_options(BIO_get_fd(conn.bio, NULL), &(proxy->sockopts)))
+  {
+    kmyth_log(LOG_ERR, "failed to tune TLS connection socket");
+    BIO_free_all(conn.bio);
+    return NULL;
+  }
+
+  proxy_metrics_observe(&(proxy->metrics), PROXY_METRICS_UPSTREAM_TLS, &start);
+
+  if (proxy->ktls)
+  {
+    proxy_upstream_check_ktls(conn.bio);
+  }
+
+  return conn.bio;
+}
+
+/*****************************************************************************
+ * proxy_upstream_discard()
+ ****************************************************************************/
+static void proxy_upstream_discard(BIO * bio, bool quiet)
+{
+  // a quiet discard releases this process' copy of a connection without
+  // sending a TLS 'close notify' alert, so that another process that
+  // shares the connection (e.g., a forked child) can keep using it
+  if (quiet)
+  {
+    SSL *ssl = NULL;
+
+    BIO_get_ssl(bio, &ssl);  // internal pointer, not a new allocation
+    if (ssl != NULL)
+    {
+      SSL_set_quiet_shutdown(ssl, 1);
+    }
+  }
+
+  BIO_free_all(bio);
+}
+
+/*****************************************************************************
+ * proxy_upstream_is_healthy()
+ ****************************************************************************/
+static bool proxy_upstream_is_healthy(BIO * bio)
+{
+  // the server should never initiate traffic on an idle connection, so
+  // anything readable (a 'close notify' alert, EOF, or an error) means the
+  // connection can no longer be used for a KMIP request
+  struct pollfd pfd;
+
+  pfd.fd = BIO_get_fd(bio, NULL);
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  if (pfd.fd < 0)
+  {
+    return false;
+  }
+
+  if (poll(&pfd, 1, 0) != 0)
+  {
+    return false;
+  }
+
+  return true;
+}
+
+/*****************************************************************************
+ * proxy_upstream_prune_locked()
+ ****************************************************************************/
+static void proxy_upstream_prune_locked(TLSProxy * proxy)
+{
+  ProxyUpstreamPool *pool = &(proxy->upstream);
+  time_t now = proxy_now();
+  size_t kept = 0;
+
+  // close idle connections that are too old or no longer usable, keeping
+  // the remaining ones in their original (oldest first) order
+  for (size_t i = 0; i < pool->idle_count; i++)
+  {
+    ProxyUpstreamConn *conn = &(pool->idle[i]);
+
+    if ((now - conn->idle_since > pool->max_idle_secs) ||
+        !proxy_upstream_is_healthy(conn->bio))
+    {
+      kmyth_log(LOG_DEBUG, "closing stale idle TLS connection");
+      proxy_upstream_discard(conn->bio, false);
+      continue;
+    }
+    pool->idle[kept] = *conn;
+    kept++;
+  }
+
+  for (size_t i = kept; i < pool->idle_count; i++)
+  {
+    pool->idle[i].bio = NULL;
+  }
+  pool->idle_count = kept;
+}
+
+/*****************************************************************************
+ * proxy_upstream_pop_locked()
+ ****************************************************************************/
+static BIO *proxy_upstream_pop_locked(TLSProxy * proxy)
+{
+  ProxyUpstreamPool *pool = &(proxy->upstream);
+  BIO *bio = NULL;
+
+  proxy_upstream_prune_locked(proxy);
+
+  // most recently used connection first
+  if (pool->idle_count > 0)
+  {
+    pool->idle_count--;
+    bio = pool->idle[pool->idle_count].bio;
+    pool->idle[pool->idle_count].bio = NULL;
+  }
+
+  return bio;
+}
+
+/*****************************************************************************
+ * proxy_upstream_push_locked()
+ ****************************************************************************/
+static bool proxy_upstream_push_locked(TLSProxy * proxy, BIO * bio)
+{
+  ProxyUpstreamPool *pool = &(proxy->upstream);
+
+  if (pool->idle_count >= PROXY_MAX_UPSTREAM_CONNS)
+  {
+    return false;
+  }
+
+  pool->idle[pool->idle_count].bio = bio;
+  pool->idle[pool->idle_count].idle_since = proxy_now();
+  pool->idle_count++;
+
+  return true;
+}
+
+/*****************************************************************************
+ * proxy_upstream_borrow()
+ ****************************************************************************/
+static BIO *proxy_upstream_borrow(TLSProxy * proxy, bool * reused)
+{
+  pthread_mutex_lock(&(proxy->upstream.lock));
+  BIO *bio = proxy_upstream_pop_locked(proxy);
+
+  pthread_cond_signal(&(proxy->upstream.wakeup));
+  pthread_mutex_unlock(&(proxy->upstream.lock));
+
+  *reused = (bio != NULL);
+  if (bio == NULL)
+  {
+    bio = proxy_upstream_connect(proxy);
+  }
+
+  return bio;
+}
+
+/*****************************************************************************
+ * proxy_upstream_return()
+ ****************************************************************************/
+static void proxy_upstream_return(TLSProxy * proxy, BIO * bio)
+{
+  pthread_mutex_lock(&(proxy->upstream.lock));
+  bool pooled = proxy_upstream_push_locked(proxy, bio);
+
+  pthread_mutex_unlock(&(proxy->upstream.lock));
+
+  // pool is full - just close the connection
+  if (!pooled)
+  {
+    proxy_upstream_discard(bio, false);
+  }
+}
+
+/*****************************************************************************
+ * proxy_upstream_clear()
+ ****************************************************************************/
+static void proxy_upstream_clear(TLSProxy * proxy, bool quiet)
+{
+  ProxyUpstreamPool *pool = &(proxy->upstream);
+
+  pthread_mutex_lock(&(pool->lock));
+  while (pool->idle_count > 0)
+  {
+    pool->idle_count--;
+    proxy_upstream_discard(pool->idle[pool->idle_count].bio, quiet);
+    pool->idle[pool->idle_count].bio = NULL;
+  }
+  pthread_mutex_unlock(&(pool->lock));
+}
+
+/*****************************************************************************
+ * proxy_upstream_maintainer()
+ ****************************************************************************/
+static void *proxy_upstream_maintainer(void *proxy_arg)
+{
+  TLSProxy *proxy = (TLSProxy *) proxy_arg;
+  ProxyUpstreamPool *pool = &(proxy->upstream);
+
+  pthread_mutex_lock(&(pool->lock));
+  while (!pool->stopping)
+  {
+    proxy_upstream_prune_locked(proxy);
+
+    // top the pool up to the configured number of warm connections,
+    // handshaking outside of the lock so borrowers are not held up
+    if (pool->idle_count < pool->warm_count)
+    {
+      pthread_mutex_unlock(&(pool->lock));
+      BIO *bio = proxy_upstream_connect(proxy);
+
+      pthread_mutex_lock(&(pool->lock));
+
+      if (bio == NULL)
+      {
+        kmyth_log(LOG_ERR, "failed to warm up a TLS connection");
+      }
+      else if (!proxy_upstream_push_locked(proxy, bio))
+      {
+        proxy_upstream_discard(bio, false);
+      }
+      else
+      {
+        continue;
+      }
+    }
+
+    // sleep until a connection is borrowed, or it is time for the next
+    // health / idle time check
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += PROXY_UPSTREAM_CHECK_SECS;
+    pthread_cond_timedwait(&(pool->wakeup), &(pool->lock), &deadline);
+  }
+  pthread_mutex_unlock(&(pool->lock));
+
+  return NULL;
+}
+
+/*****************************************************************************
+ * proxy_upstream_start()
+ ****************************************************************************/
+static int proxy_upstream_start(TLSProxy * proxy)
+{
+  ProxyUpstreamPool *pool = &(proxy->upstream);
+
+  if (pool->warm_count == 0)
+  {
+    return EXIT_SUCCESS;
+  }
+
+  kmyth_log(LOG_DEBUG, "keeping %zu warm TLS connection(s) to %s:%s",
+                       pool->warm_count, proxy->tlsconn.host,
+                       proxy->tlsconn.port);
+
+  pool->stopping = false;
+  if (pthread_create(&(pool->maintainer), NULL,
+                     proxy_upstream_maintainer, proxy) != 0)
+  {
+    kmyth_log(LOG_ERR, "failed to start TLS connection pool thread");
+    return EXIT_FAILURE;
+  }
+  pool->maintainer_running = true;
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * proxy_upstream_stop()
+ ****************************************************************************/
+static void proxy_upstream_stop(TLSProxy * proxy)
+{
+  ProxyUpstreamPool *pool = &(proxy->upstream);
+
+  if (!pool->maintainer_running)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&(pool->lock));
+  pool->stopping = true;
+  pthread_cond_signal(&(pool->wakeup));
+  pthread_mutex_unlock(&(pool->lock));
+
+  pthread_join(pool->maintainer, NULL);
+  pool->maintainer_running = false;
 }
 
 /*****************************************************************************
@@ -31,10 +418,18 @@ static void proxy_init(TLSProxy * proxy)
  ****************************************************************************/
 static void proxy_cleanup(TLSProxy * proxy)
 {
+  proxy_upstream_stop(proxy);
+  proxy_upstream_clear(proxy, false);
+  pthread_cond_destroy(&(proxy->upstream.wakeup));
+  pthread_mutex_destroy(&(proxy->upstream.lock));
+  pthread_mutex_destroy(&(proxy->session_lock));
+
   demo_ecdh_cleanup(&(proxy->ecdhconn));
 
   demo_tls_cleanup(&(proxy->tlsconn));
 
+  proxy_metrics_cleanup(&(proxy->metrics));
+
   proxy_init(proxy);
 }
 
@@ -67,10 +462,34 @@ static void proxy_usage(const char *prog)
     "                          (if not specified, the default system CA chain will be used instead)\n"
     "  -R or --client-key      Local (client) private key (for TLS connection) PEM file name\n"
     "  -U or --client-cert     Local (client) certificate (for TLS connection) PEM file name\n"
+    "Concurrency Options --\n"
+    "  -e or --event    Handle ECDH sessions in a single process, multiplexed with epoll,\n"
+    "                   instead of forking a child process for each connection.\n"
+    "  -w or --workers  Number of event loop worker threads (with -e, default 1).\n"
+    "  -f or --prefork  Handle ECDH sessions in this many pre-forked worker processes\n"
+    "                   (1 to %d), each running the event loop of -e, with its own\n"
+    "                   listening socket (SO_REUSEPORT) and remote server connections.\n"
+    "  -W or --warm     Number of TLS connections to the remote server to keep\n"
+    "                   connected and ready ahead of demand (default 0).\n"
+    "  -T or --max-idle Seconds an idle TLS connection to the remote server is kept\n"
+    "                   (default %d).\n"
+    "  -O or --sockopt  Tune the ECDH listening socket, and the connections to the\n"
+    "                   remote server (repeatable): nodelay,\n"
+    "                   keepalive=<idle>[,<interval>[,<count>]], reuseport,\n"
+    "                   fastopen[=<queue length>] or io-timeout=<ms>.\n"
+    "  -K or --ktls     Have the kernel encrypt and decrypt the TLS records of\n"
+    "                   connections to the remote server, once their handshake\n"
+    "                   is done (kernel TLS, needing the kernel 'tls' module).\n"
+    "Monitoring Options --\n"
+    "  -M or --metrics-port  Serve session counts, error counts and latency\n"
+    "                        histograms (Prometheus text format) over HTTP on\n"
+    "                        this port (disabled by default).\n"
     "Test Options --\n"
     "  -m or --maxconn  The number of connections the server will accept before exiting (unlimited by default, or if the value is not a positive integer).\n"
+    "                   With -f, each worker process accepts this many.\n"
     "Misc --\n"
-    "  -h or --help     Help (displays this usage).\n\n", prog);
+    "  -h or --help     Help (displays this usage).\n\n", prog,
+    KMYTH_MAX_JOBS, PROXY_DEFAULT_MAX_IDLE_SECS);
 }
 
 /*****************************************************************************
@@ -91,7 +510,7 @@ static void proxy_get_options(TLSProxy * proxy, int argc, char **argv)
   int option_index = 0;
 
   while ((options =
-          getopt_long(argc, argv, "r:c:u:p:I:P:C:R:U:m:h",
+          getopt_long(argc, argv, "r:c:u:p:I:P:C:R:U:ew:f:W:T:O:KM:m:h",
                       proxy_longopts, &option_index)) != -1)
   {
     switch (options)
@@ -146,6 +565,35 @@ static void proxy_get_options(TLSProxy * proxy, int argc, char **argv)
     case 'U':
       proxy->tlsconn.local_cert_path = strdup(optarg);
       break;
+    // Concurrency
+    case 'e':
+      proxy->event_mode = true;
+      break;
+    case 'w':
+      proxy->num_workers = atoi(optarg);
+      break;
+    case 'f':
+      proxy->num_procs = atoi(optarg);
+      break;
+    case 'W':
+      proxy->upstream.warm_count = (size_t) atoi(optarg);
+      break;
+    case 'T':
+      proxy->upstream.max_idle_secs = atoi(optarg);
+      break;
+    case 'O':
+      if (parse_socket_option(optarg, &(proxy->sockopts)))
+      {
+        proxy_error(proxy);
+      }
+      break;
+    case 'K':
+      proxy->ktls = true;
+      break;
+    // Monitoring
+    case 'M':
+      proxy->metrics.port = strdup(optarg);
+      break;
     // Test
     case 'm':
       proxy->ecdhconn.config.session_limit = atoi(optarg);
@@ -179,6 +627,29 @@ static void proxy_check_options(TLSProxy * proxy)
     fprintf(stderr, "Remote port number argument (-P) is required.\n");
     err = true;
   }
+  if ((proxy->num_workers < 1) || (proxy->num_workers > PROXY_MAX_WORKERS))
+  {
+    fprintf(stderr, "Number of workers (-w) must be between 1 and %d.\n",
+                    PROXY_MAX_WORKERS);
+    err = true;
+  }
+  if ((proxy->num_procs < 0) || (proxy->num_procs > KMYTH_MAX_JOBS))
+  {
+    fprintf(stderr, "Number of worker processes (-f) must be between 1 and "
+                    "%d.\n", KMYTH_MAX_JOBS);
+    err = true;
+  }
+  if (proxy->upstream.warm_count > PROXY_MAX_UPSTREAM_CONNS)
+  {
+    fprintf(stderr, "Number of warm connections (-W) must not exceed %d.\n",
+                    PROXY_MAX_UPSTREAM_CONNS);
+    err = true;
+  }
+  if (proxy->upstream.max_idle_secs < 0)
+  {
+    fprintf(stderr, "Maximum idle time (-T) must not be negative.\n");
+    err = true;
+  }
   if (err)
   {
     kmyth_log(LOG_ERR, "Invalid command-line arguments.");
@@ -199,6 +670,20 @@ static int proxy_create_tls_client(TLSProxy * proxy)
     return EXIT_FAILURE;
   }
 
+  // the kernel takes over a connection's record layer after the handshake,
+  // so the proxy's (unchanged) BIO reads and writes of KMIP messages become
+  // plain socket I/O, with no copies through OpenSSL's record buffers
+  if (proxy->ktls)
+  {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    SSL_CTX_set_options(tls_clnt->ctx, SSL_OP_ENABLE_KTLS);
+    kmyth_log(LOG_DEBUG, "kernel TLS offload enabled");
+#else
+    kmyth_log(LOG_ERR, "OpenSSL was built without kernel TLS support");
+    return EXIT_FAILURE;
+#endif
+  }
+
   if (demo_tls_config_client_connect(tls_clnt))
   {
     kmyth_log(LOG_ERR, "failed to configure TLS client connection");
@@ -234,15 +719,18 @@ static int proxy_create_ecdh_server(TLSProxy * proxy)
 
   kmyth_log(LOG_DEBUG, "setting up server socket on port %s",
                        ecdh_svr->config.port);
-  if (setup_server_socket(ecdh_svr->config.port,
-                         &(ecdh_svr->config.listen_socket_fd)))
+  if (setup_server_socket_opts(ecdh_svr->config.port, &(proxy->sockopts),
+                              &(ecdh_svr->config.listen_socket_fd)))
   {
     kmyth_log(LOG_ERR, "failed to setup server socket on port %s",
                        ecdh_svr->config.port);
     return EXIT_FAILURE;
   }
 
-  if (listen(ecdh_svr->config.listen_socket_fd, 1))
+  // the event-driven mode accepts bursts of connections, so give it
+  // a full accept queue
+  if (listen(ecdh_svr->config.listen_socket_fd,
+             proxy->event_mode ? SOMAXCONN : 1))
   {
     kmyth_log(LOG_ERR, "server socket listen (for client connection) failed");
     close(ecdh_svr->config.listen_socket_fd);
@@ -253,30 +741,52 @@ static int proxy_create_ecdh_server(TLSProxy * proxy)
 }
 
 /*****************************************************************************
- * proxy_setup_ecdh_session()
+ * proxy_complete_ecdh_session_setup()
  ****************************************************************************/
-static int proxy_setup_ecdh_session(TLSProxy * proxy)
+static int proxy_complete_ecdh_session_setup(TLSProxy * proxy,
+                                             ECDHPeer * ecdh_svr)
 {
-  ECDHPeer *ecdh_svr = &(proxy->ecdhconn);
   int ret = -1;
+  struct timespec start;
 
-  // create proxy's session-unique (ephemeral) public/private key pair
-  // (proxy contribution to ECDH key agreement)
-  ret = create_ecdh_ephemeral_keypair(&(ecdh_svr->session.local_eph_keypair));
+  proxy_metrics_start_timer(&start);
+
+  // the proxy's share of the handshake CPU time (signature verification and
+  // signing, key generation and agreement) is reported for benchmarking
+  struct timespec cpu_start;
+  struct timespec cpu_finish;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+
+  // validate the (already received) 'Client Hello'
+  ret = demo_ecdh_process_client_hello_msg(ecdh_svr);
   if (ret != EXIT_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "proxy failed to create ECDH ephemeral key pair");
+    kmyth_log(LOG_ERR, "proxy failed to process 'Client Hello' message");
     return EXIT_FAILURE;
   }
-  kmyth_log(LOG_DEBUG, "proxy created ECDH ephemeral key pair");
 
-  // exchange 'Client Hello'/'Server Hello' messages with the client
-  ret = demo_ecdh_recv_client_hello_msg(ecdh_svr);
+  // create proxy's session-unique (ephemeral) public/private key pair
+  // (proxy contribution to ECDH key agreement), in the key agreement
+  // group the client selected
+  uint8_t group = 0;
+
+  ret = get_ecdh_group(ecdh_svr->session.remote_eph_pubkey, &group);
+  if (ret == EXIT_SUCCESS)
+  {
+    EVP_PKEY_free(ecdh_svr->session.local_eph_keypair);
+    ecdh_svr->session.local_eph_keypair = NULL;
+    ret = create_ecdh_ephemeral_keypair(group,
+                                        &(ecdh_svr->session.local_eph_keypair));
+  }
   if (ret != EXIT_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "proxy failed to receive 'Client Hello' message");
+    kmyth_log(LOG_ERR, "proxy failed to create ECDH ephemeral key pair");
     return EXIT_FAILURE;
   }
+  kmyth_log(LOG_DEBUG, "proxy created ECDH ephemeral key pair");
+
+  // reply with a 'Server Hello' message
   ret = demo_ecdh_send_server_hello_msg(ecdh_svr);
   if (ret != EXIT_SUCCESS)
   {
@@ -292,55 +802,125 @@ static int proxy_setup_ecdh_session(TLSProxy * proxy)
     return EXIT_FAILURE;
   }
 
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_finish);
+  kmyth_log(LOG_INFO, "ECDH handshake CPU time: %ld us (%s signatures)",
+            (long) ((cpu_finish.tv_sec - cpu_start.tv_sec) * 1000000L +
+                    (cpu_finish.tv_nsec - cpu_start.tv_nsec) / 1000L),
+            (EVP_PKEY_id(ecdh_svr->config.local_sign_key) == EVP_PKEY_ED25519)
+            ? "Ed25519" : "ECDSA");
+
+  proxy_metrics_observe(&(proxy->metrics), PROXY_METRICS_ECDH_SETUP, &start);
+
   return EXIT_SUCCESS;
 }
 
 /*****************************************************************************
- * proxy_get_client_key_request()
+ * proxy_setup_ecdh_session()
  ****************************************************************************/
-static int proxy_get_client_key_request(TLSProxy * proxy)
+static int proxy_setup_ecdh_session(TLSProxy * proxy)
 {
-  int ret = -1;
-
   ECDHPeer *ecdh_svr = &(proxy->ecdhconn);
 
-  // receive key request message from ECDH client
-  ByteBuffer *kmip_req = &(ecdh_svr->session.proto.kmip_request);
-
-  demo_ecdh_recv_key_request_msg(ecdh_svr);
+  // receive 'Client Hello' message from the client
+  if (EXIT_SUCCESS != demo_ecdh_recv_msg(ecdh_svr->session.session_socket_fd,
+                                         &(ecdh_svr->session.proto.client_hello)))
+  {
+    kmyth_log(LOG_ERR, "proxy failed to receive 'Client Hello' message");
+    return EXIT_FAILURE;
+  }
 
-  return EXIT_SUCCESS;
+  return proxy_complete_ecdh_session_setup(proxy, ecdh_svr);
 }
 
 /*****************************************************************************
- * proxy_get_kmip_response()
+ * proxy_get_client_key_request()
  ****************************************************************************/
-static int proxy_get_kmip_response(TLSProxy * proxy)
+static int proxy_get_client_key_request(TLSProxy * proxy, bool * closed)
 {
-  // create TLS connection with server
   ECDHPeer *ecdh_svr = &(proxy->ecdhconn);
-  TLSPeer *tls_clnt = &(proxy->tlsconn);
+  unsigned char peek_byte = 0;
+  ssize_t bytes_read = 0;
 
-  if (demo_tls_client_connect(tls_clnt))
+  // a client with no more keys to request closes the connection (between
+  // requests), which ends the session
+  do
   {
-    kmyth_log(LOG_ERR, "TLS connection failed");
-    return EXIT_FAILURE;
+    bytes_read = recv(ecdh_svr->session.session_socket_fd,
+                      &peek_byte, 1, MSG_PEEK);
   }
-
-  // send KMIP request then receive KMIP response from server
-  ByteBuffer *kmip_req = &(ecdh_svr->session.proto.kmip_request);
-  ByteBuffer *kmip_resp = &(ecdh_svr->session.proto.kmip_response);
-
-  if (get_resp_from_tls_server(tls_clnt->bio,
-                               kmip_req->buffer,
-                               kmip_req->size,
-                               &(kmip_resp->buffer),
-                               &(kmip_resp->size)))
+  while ((bytes_read < 0) && (errno == EINTR));
+  *closed = (bytes_read == 0);
+  if (*closed)
+  {
+    return EXIT_SUCCESS;
+  }
+
+  // receive key request message from ECDH client
+  demo_ecdh_reset_key_request(ecdh_svr);
+
+  return demo_ecdh_recv_key_request_msg(ecdh_svr);
+}
+
+/*****************************************************************************
+ * proxy_get_kmip_response()
+ ****************************************************************************/
+static int proxy_get_kmip_response(TLSProxy * proxy, ECDHPeer * ecdh_svr)
+{
+  // get TLS connection with server (an idle one, if available)
+  bool reused = false;
+  BIO *bio = proxy_upstream_borrow(proxy, &reused);
+
+  if (bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "TLS connection failed");
+    proxy_metrics_error(&(proxy->metrics), PROXY_METRICS_ERR_UPSTREAM_TLS);
+    return EXIT_FAILURE;
+  }
+
+  // send KMIP request then receive KMIP response from server
+  ByteBuffer *kmip_req = &(ecdh_svr->session.proto.kmip_request);
+  ByteBuffer *kmip_resp = &(ecdh_svr->session.proto.kmip_response);
+  struct timespec start;
+
+  proxy_metrics_start_timer(&start);
+
+  int ret = get_kmip_resp_from_tls_server(bio,
+                                          kmip_req->buffer,
+                                          kmip_req->size,
+                                          &(kmip_resp->buffer),
+                                          &(kmip_resp->size));
+
+  // the server may have closed an idle connection - retry once on a new one
+  if ((ret != 0) && reused)
+  {
+    kmyth_log(LOG_DEBUG, "idle TLS connection failed, reconnecting");
+    BIO_free_all(bio);
+    bio = proxy_upstream_connect(proxy);
+    if (bio == NULL)
+    {
+      kmyth_log(LOG_ERR, "TLS connection failed");
+      proxy_metrics_error(&(proxy->metrics), PROXY_METRICS_ERR_UPSTREAM_TLS);
+      return EXIT_FAILURE;
+    }
+    proxy_metrics_start_timer(&start);
+    ret = get_kmip_resp_from_tls_server(bio,
+                                        kmip_req->buffer,
+                                        kmip_req->size,
+                                        &(kmip_resp->buffer),
+                                        &(kmip_resp->size));
+  }
+
+  if (ret != 0)
   {
     kmyth_log(LOG_ERR, "KMIP 'get key' failed");
+    proxy_metrics_error(&(proxy->metrics), PROXY_METRICS_ERR_KMIP_REQUEST);
+    BIO_free_all(bio);
     return EXIT_FAILURE;
   }
 
+  proxy_metrics_observe(&(proxy->metrics), PROXY_METRICS_KMIP_REQUEST, &start);
+  proxy_upstream_return(proxy, bio);
+
   kmyth_log(LOG_DEBUG, "Received KMIP response: 0x%02X%02X ... %02X%02X "
                        "(%zu bytes)",
                        kmip_resp->buffer[0], kmip_resp->buffer[1],
@@ -354,24 +934,25 @@ static int proxy_get_kmip_response(TLSProxy * proxy)
 /*****************************************************************************
  * proxy_send_key_response_message()
  ****************************************************************************/
-static int proxy_send_key_response_message(TLSProxy * proxy)
+static int proxy_send_key_response_message(ECDHPeer * ecdh_svr)
 {
   int ret = -1;
 
-  ECDHPeer *ecdh_svr = &(proxy->ecdhconn);
-
   ByteBuffer *kmip_resp = &(ecdh_svr->session.proto.kmip_response);
   ECDHMessage *key_resp = &(ecdh_svr->session.proto.key_response);
 
+  // the response carries the sequence number of the request it answers
   ret = compose_key_response_msg(ecdh_svr->config.local_sign_key,
                                  &(ecdh_svr->session.response_symkey),
                                  kmip_resp,
+                                 ecdh_svr->session.key_request_seq,
                                  key_resp);
   if (ret != EXIT_SUCCESS)
   {
     kmyth_log(LOG_ERR, "failed to compose 'Key Response' message");
     return EXIT_FAILURE;
   }
+  ecdh_svr->session.key_request_seq++;
 
   kmyth_log(LOG_DEBUG, "composed 'Key Response': %02X%02X ... %02X%02X "
                        "(%d bytes)",
@@ -438,36 +1019,54 @@ static void proxy_handle_session(TLSProxy * proxy)
   if (pfds[0].revents & POLLIN)
   {
     kmyth_log(LOG_DEBUG, "ECDH receive event initiates session setup");
+    proxy_metrics_session_start(&(proxy->metrics));
 
     // execute session setup (e.g., key agreement) protocol phase
     if (EXIT_SUCCESS == proxy_setup_ecdh_session(proxy))
     {
-      // obtain key retrieval request from client-side of ECDH session
-      if (EXIT_SUCCESS == proxy_get_client_key_request(proxy))
+      // serve the client's key requests until it closes the connection
+      bool closed = false;
+
+      while (true)
       {
-        // pass KMIP request to / receive KMIP response from key server over TLS
-        if (EXIT_SUCCESS == proxy_get_kmip_response(proxy))
+        // obtain key retrieval request from client-side of ECDH session
+        if (EXIT_SUCCESS != proxy_get_client_key_request(proxy, &closed))
+        {
+          kmyth_log(LOG_DEBUG, "failed to receive 'Key Request' message");
+          proxy_metrics_error(&(proxy->metrics),
+                              PROXY_METRICS_ERR_KEY_REQUEST);
+          break;
+        }
+        if (closed)
         {
-          // return 'retrieve key' response to the client that submitted request
-          if (EXIT_SUCCESS != proxy_send_key_response_message(proxy))
-          {
-            kmyth_log(LOG_DEBUG, "failed to send 'Key Response' message");
-          }
+          kmyth_log(LOG_DEBUG, "client closed session after %u key requests",
+                    ecdh_svr->session.key_request_seq);
+          break;
         }
-        else
+
+        // pass KMIP request to / receive KMIP response from key server over TLS
+        if (EXIT_SUCCESS != proxy_get_kmip_response(proxy, ecdh_svr))
         {
           kmyth_log(LOG_DEBUG, "failed to retrieve KMIP 'get key' response");
+          break;
+        }
+
+        // return 'retrieve key' response to the client that submitted request
+        if (EXIT_SUCCESS != proxy_send_key_response_message(ecdh_svr))
+        {
+          kmyth_log(LOG_DEBUG, "failed to send 'Key Response' message");
+          proxy_metrics_error(&(proxy->metrics),
+                              PROXY_METRICS_ERR_KEY_RESPONSE);
+          break;
         }
-      }
-      else
-      {
-        kmyth_log(LOG_DEBUG, "failed to receive 'Key Request' message");
       }
     }
     else
     {
       kmyth_log(LOG_DEBUG, "failed to setup ECDH session (with client)");
+      proxy_metrics_error(&(proxy->metrics), PROXY_METRICS_ERR_ECDH_SETUP);
     }
+    proxy_metrics_session_end(&(proxy->metrics));
   }
 
   if (pfds[1].revents & POLLIN)
@@ -520,23 +1119,55 @@ static int proxy_manage_ecdh_client_connections(TLSProxy * proxy)
     kmyth_log(LOG_DEBUG, "accepted ECDH 'client' connection (session #%d)",
                          session_count);
 
+    // hand a warm upstream connection (if any) to the child, holding the
+    // pool lock across the fork so the child's copy of the pool is
+    // consistent
+    pthread_mutex_lock(&(proxy->upstream.lock));
+    BIO *warm_bio = proxy_upstream_pop_locked(proxy);
+
+    pthread_cond_signal(&(proxy->upstream.wakeup));
     int ret = fork();
+
+    pthread_mutex_unlock(&(proxy->upstream.lock));
     if (ret == -1)
     {
       kmyth_log(LOG_ERR, "server fork failed");
+      if (warm_bio != NULL)
+      {
+        proxy_upstream_return(proxy, warm_bio);
+      }
       close(ecdh_svr->config.listen_socket_fd);
       return EXIT_FAILURE;
     }
     else if (ret == 0)
     {
       // forked child process handles accepted connection from ECDH client
+      // (the metrics listener, like the pool maintainer, stays with the
+      // parent)
       close(ecdh_svr->config.listen_socket_fd);
+      proxy_metrics_detach(&(proxy->metrics));
+
+      // the pool maintainer thread only exists in the parent, and the
+      // other idle connections stay with the parent
+      proxy->upstream.maintainer_running = false;
+      proxy_upstream_clear(proxy, true);
+      if (warm_bio != NULL)
+      {
+        proxy_upstream_return(proxy, warm_bio);
+      }
+
       kmyth_log(LOG_DEBUG, "proxy (child) handling ECDH session #%d",
                            session_count);
       return EXIT_SUCCESS;
     }
     else
     {
+      // the child now owns the warm connection
+      if (warm_bio != NULL)
+      {
+        proxy_upstream_discard(warm_bio, true);
+      }
+
       // parent process loops to accept more connections or exits
       // if session limit has been reached
       close(clnt_conn->session_socket_fd);
@@ -556,6 +1187,484 @@ static int proxy_manage_ecdh_client_connections(TLSProxy * proxy)
   }
 }
 
+/*****************************************************************************
+ * proxy_session_new()
+ ****************************************************************************/
+static ProxySession *proxy_session_new(TLSProxy * proxy, int socket_fd)
+{
+  ProxySession *session = calloc(1, sizeof(ProxySession));
+
+  if (session == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate ECDH session state");
+    return NULL;
+  }
+
+  demo_ecdh_init(false, &(session->ecdhconn));
+
+  // keys and certificates are shared with (and owned by) the proxy
+  session->ecdhconn.config = proxy->ecdhconn.config;
+  session->ecdhconn.session.session_socket_fd = socket_fd;
+  session->state = PROXY_SESSION_WAIT_CLIENT_HELLO;
+
+  return session;
+}
+
+/*****************************************************************************
+ * proxy_session_free()
+ ****************************************************************************/
+static void proxy_session_free(ProxySession * session)
+{
+  // drop the shared configuration so that cleanup does not free it
+  secure_memset(&(session->ecdhconn.config), 0, sizeof(ECDHConfig));
+
+  // closes the session socket, and clears session keys and messages
+  demo_ecdh_cleanup(&(session->ecdhconn));
+
+  free(session);
+}
+
+/*****************************************************************************
+ * proxy_session_recv_msg()
+ ****************************************************************************/
+static int proxy_session_recv_msg(ProxySession * session, ECDHMessage * msg)
+{
+  int socket_fd = session->ecdhconn.session.session_socket_fd;
+  size_t hdr_len = sizeof(session->hdr_buf);
+  ssize_t bytes_read = 0;
+
+  // read whatever part of the message is available without blocking
+  while (true)
+  {
+    if (session->rx_count < hdr_len)
+    {
+      bytes_read = recv(socket_fd,
+                        session->hdr_buf + session->rx_count,
+                        hdr_len - session->rx_count,
+                        MSG_DONTWAIT);
+    }
+    else
+    {
+      size_t body_count = session->rx_count - hdr_len;
+
+      if (body_count == msg->hdr.msg_size)
+      {
+        session->rx_count = 0;
+        return PROXY_RECV_DONE;
+      }
+      bytes_read = recv(socket_fd,
+                        msg->body + body_count,
+                        msg->hdr.msg_size - body_count,
+                        MSG_DONTWAIT);
+    }
+
+    if (bytes_read == 0)
+    {
+      // between key requests, the client closing the connection ends the
+      // session
+      if ((session->rx_count == 0) &&
+          (session->state == PROXY_SESSION_WAIT_KEY_REQUEST))
+      {
+        return PROXY_RECV_CLOSED;
+      }
+      kmyth_log(LOG_ERR, "ECDH connection is closed");
+      return PROXY_RECV_ERROR;
+    }
+    if (bytes_read < 0)
+    {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      {
+        return PROXY_RECV_AGAIN;
+      }
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      kmyth_log(LOG_ERR, "ECDH socket read error");
+      return PROXY_RECV_ERROR;
+    }
+    session->rx_count += bytes_read;
+
+    // once the header is complete, set up the message body buffer
+    if (session->rx_count == hdr_len)
+    {
+      msg->hdr.msg_size = session->hdr_buf[0] << 8;
+      msg->hdr.msg_size += session->hdr_buf[1];
+      if ((msg->hdr.msg_size == 0) ||
+          (msg->hdr.msg_size > KMYTH_ECDH_MAX_MSG_SIZE))
+      {
+        kmyth_log(LOG_ERR, "invalid length in ECDH message header");
+        return PROXY_RECV_ERROR;
+      }
+      msg->body = calloc(msg->hdr.msg_size, sizeof(unsigned char));
+      if (msg->body == NULL)
+      {
+        kmyth_log(LOG_ERR, "failed to allocate received message buffer");
+        return PROXY_RECV_ERROR;
+      }
+    }
+  }
+}
+
+/*****************************************************************************
+ * proxy_session_advance()
+ ****************************************************************************/
+static int proxy_session_advance(TLSProxy * proxy, ProxySession * session)
+{
+  ECDHPeer *ecdh_svr = &(session->ecdhconn);
+  RetrieveKeyProtocol *proto = &(ecdh_svr->session.proto);
+  int ret = -1;
+
+  while (session->state != PROXY_SESSION_DONE)
+  {
+    switch (session->state)
+    {
+    case PROXY_SESSION_WAIT_CLIENT_HELLO:
+      ret = proxy_session_recv_msg(session, &(proto->client_hello));
+      if (ret == PROXY_RECV_ERROR)
+      {
+        proxy_metrics_error(&(proxy->metrics), PROXY_METRICS_ERR_ECDH_SETUP);
+      }
+      if (ret != PROXY_RECV_DONE)
+      {
+        return ret;
+      }
+
+      // execute session setup (e.g., key agreement) protocol phase
+      if (EXIT_SUCCESS != proxy_complete_ecdh_session_setup(proxy, ecdh_svr))
+      {
+        kmyth_log(LOG_DEBUG, "failed to setup ECDH session (with client)");
+        proxy_metrics_error(&(proxy->metrics), PROXY_METRICS_ERR_ECDH_SETUP);
+        return PROXY_RECV_ERROR;
+      }
+      session->state = PROXY_SESSION_WAIT_KEY_REQUEST;
+      break;
+
+    case PROXY_SESSION_WAIT_KEY_REQUEST:
+      ret = proxy_session_recv_msg(session, &(proto->key_request));
+      if (ret == PROXY_RECV_CLOSED)
+      {
+        kmyth_log(LOG_DEBUG, "client closed session after %u key requests",
+                  ecdh_svr->session.key_request_seq);
+        session->state = PROXY_SESSION_DONE;
+        break;
+      }
+      if (ret == PROXY_RECV_ERROR)
+      {
+        proxy_metrics_error(&(proxy->metrics), PROXY_METRICS_ERR_KEY_REQUEST);
+      }
+      if (ret != PROXY_RECV_DONE)
+      {
+        return ret;
+      }
+      if (EXIT_SUCCESS != demo_ecdh_process_key_request_msg(ecdh_svr))
+      {
+        kmyth_log(LOG_DEBUG, "failed to receive 'Key Request' message");
+        proxy_metrics_error(&(proxy->metrics), PROXY_METRICS_ERR_KEY_REQUEST);
+        return PROXY_RECV_ERROR;
+      }
+
+      // pass KMIP request to / receive KMIP response from key server over TLS
+      if (EXIT_SUCCESS != proxy_get_kmip_response(proxy, ecdh_svr))
+      {
+        kmyth_log(LOG_DEBUG, "failed to retrieve KMIP 'get key' response");
+        return PROXY_RECV_ERROR;
+      }
+
+      // return 'retrieve key' response to the client that submitted request
+      if (EXIT_SUCCESS != proxy_send_key_response_message(ecdh_svr))
+      {
+        kmyth_log(LOG_DEBUG, "failed to send 'Key Response' message");
+        proxy_metrics_error(&(proxy->metrics), PROXY_METRICS_ERR_KEY_RESPONSE);
+        return PROXY_RECV_ERROR;
+      }
+
+      // wait for the client's next request (or for it to close the session)
+      demo_ecdh_reset_key_request(ecdh_svr);
+      break;
+
+    default:
+      return PROXY_RECV_ERROR;
+    }
+  }
+
+  return PROXY_RECV_DONE;
+}
+
+/*****************************************************************************
+ * proxy_event_accept()
+ ****************************************************************************/
+static int proxy_event_accept(ProxyWorker * worker)
+{
+  TLSProxy *proxy = worker->proxy;
+  ECDHConfig *config = &(proxy->ecdhconn.config);
+
+  // accept all pending connections (the listen socket is non-blocking)
+  while (true)
+  {
+    int socket_fd = accept(config->listen_socket_fd, NULL, NULL);
+
+    if (socket_fd == -1)
+    {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      {
+        return EXIT_SUCCESS;
+      }
+      if ((errno == EINTR) || (errno == ECONNABORTED))
+      {
+        continue;
+      }
+      kmyth_log(LOG_ERR, "socket accept failed");
+      return EXIT_FAILURE;
+    }
+
+    pthread_mutex_lock(&(proxy->session_lock));
+    if (proxy->stopping)
+    {
+      pthread_mutex_unlock(&(proxy->session_lock));
+      close(socket_fd);
+      return EXIT_SUCCESS;
+    }
+    proxy->session_count++;
+    int session_num = proxy->session_count;
+
+    if ((config->session_limit != 0) &&
+        (proxy->session_count >= config->session_limit))
+    {
+      kmyth_log(LOG_DEBUG, "proxy ECDH session count reached limit (%d)",
+                           config->session_limit);
+      proxy->stopping = true;
+    }
+    pthread_mutex_unlock(&(proxy->session_lock));
+
+    kmyth_log(LOG_DEBUG, "accepted ECDH 'client' connection (session #%d)",
+                         session_num);
+
+    ProxySession *session = proxy_session_new(proxy, socket_fd);
+
+    if (session == NULL)
+    {
+      close(socket_fd);
+      continue;
+    }
+
+    struct epoll_event ev = { 0 };
+
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = session;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, socket_fd, &ev))
+    {
+      kmyth_log(LOG_ERR, "failed to add ECDH session to epoll set");
+      proxy_session_free(session);
+      continue;
+    }
+    worker->active_sessions++;
+    proxy_metrics_session_start(&(proxy->metrics));
+  }
+}
+
+/*****************************************************************************
+ * proxy_event_worker()
+ ****************************************************************************/
+static void *proxy_event_worker(void *worker_arg)
+{
+  ProxyWorker *worker = (ProxyWorker *) worker_arg;
+  TLSProxy *proxy = worker->proxy;
+  struct epoll_event events[PROXY_MAX_EPOLL_EVENTS];
+  bool listening = true;
+
+  while (listening || (worker->active_sessions > 0))
+  {
+    int num_events = epoll_wait(worker->epoll_fd,
+                                events,
+                                PROXY_MAX_EPOLL_EVENTS,
+                                PROXY_EPOLL_TIMEOUT_MS);
+
+    if (num_events < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      kmyth_log(LOG_ERR, "epoll_wait failed");
+      worker->failed = true;
+      break;
+    }
+
+    for (int i = 0; i < num_events; i++)
+    {
+      ProxySession *session = (ProxySession *) events[i].data.ptr;
+
+      // a NULL pointer marks the (shared) listen socket
+      if (session == NULL)
+      {
+        if (listening && (EXIT_SUCCESS != proxy_event_accept(worker)))
+        {
+          worker->failed = true;
+          listening = false;
+        }
+        continue;
+      }
+
+      // run the session's protocol state machine as far as the data
+      // received so far allows, then drop the session if it finished
+      if (PROXY_RECV_AGAIN != proxy_session_advance(proxy, session))
+      {
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL,
+                  session->ecdhconn.session.session_socket_fd, NULL);
+        proxy_session_free(session);
+        worker->active_sessions--;
+        proxy_metrics_session_end(&(proxy->metrics));
+      }
+    }
+
+    // stop accepting new sessions once the session limit is reached
+    if (listening)
+    {
+      pthread_mutex_lock(&(proxy->session_lock));
+      if (proxy->stopping)
+      {
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL,
+                  proxy->ecdhconn.config.listen_socket_fd, NULL);
+        listening = false;
+      }
+      pthread_mutex_unlock(&(proxy->session_lock));
+    }
+  }
+
+  return NULL;
+}
+
+/*****************************************************************************
+ * proxy_run_event_loop()
+ ****************************************************************************/
+static int proxy_run_event_loop(TLSProxy * proxy)
+{
+  int listen_fd = proxy->ecdhconn.config.listen_socket_fd;
+  int flags = fcntl(listen_fd, F_GETFL, 0);
+
+  if ((flags == -1) || (fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1))
+  {
+    kmyth_log(LOG_ERR, "failed to make ECDH listen socket non-blocking");
+    return EXIT_FAILURE;
+  }
+
+  // a client or server that drops its connection mid-write must not take
+  // down every other session handled by this process
+  signal(SIGPIPE, SIG_IGN);
+
+  ProxyWorker workers[PROXY_MAX_WORKERS];
+  int num_workers = proxy->num_workers;
+  int ret = EXIT_SUCCESS;
+
+  secure_memset(workers, 0, sizeof(workers));
+
+  // every worker waits on the listen socket - EPOLLEXCLUSIVE avoids waking
+  // all of them for each new connection
+  for (int i = 0; i < num_workers; i++)
+  {
+    workers[i].proxy = proxy;
+    workers[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (workers[i].epoll_fd == -1)
+    {
+      kmyth_log(LOG_ERR, "failed to create epoll instance");
+      num_workers = i;
+      ret = EXIT_FAILURE;
+      break;
+    }
+
+    struct epoll_event ev = { 0 };
+
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(workers[i].epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev))
+    {
+      kmyth_log(LOG_ERR, "failed to add ECDH listen socket to epoll set");
+      close(workers[i].epoll_fd);
+      num_workers = i;
+      ret = EXIT_FAILURE;
+      break;
+    }
+  }
+
+  if (ret == EXIT_SUCCESS)
+  {
+    kmyth_log(LOG_DEBUG, "handling ECDH sessions with %d event worker(s)",
+                         num_workers);
+
+    // the calling thread is one of the workers
+    int started = 1;
+
+    while (started < num_workers)
+    {
+      if (pthread_create(&(workers[started].thread), NULL,
+                         proxy_event_worker, &(workers[started])) != 0)
+      {
+        kmyth_log(LOG_ERR, "failed to start event worker thread");
+        break;
+      }
+      started++;
+    }
+
+    proxy_event_worker(&(workers[0]));
+
+    for (int i = 1; i < started; i++)
+    {
+      pthread_join(workers[i].thread, NULL);
+    }
+  }
+
+  for (int i = 0; i < num_workers; i++)
+  {
+    if (workers[i].failed)
+    {
+      ret = EXIT_FAILURE;
+    }
+    close(workers[i].epoll_fd);
+  }
+
+  close(listen_fd);
+  proxy->ecdhconn.config.listen_socket_fd = UNSET_FD;
+
+  return ret;
+}
+
+/*****************************************************************************
+ * proxy_prefork_worker()
+ ****************************************************************************/
+static int proxy_prefork_worker(size_t index, void *proxy_arg)
+{
+  TLSProxy *proxy = (TLSProxy *) proxy_arg;
+  int ret = EXIT_FAILURE;
+
+  // the worker keeps the keys and TLS context it was forked with, but
+  // its own connections to the remote server (the metrics listener stays
+  // with the parent), and listens on a socket of its own for the kernel
+  // to spread the ECDH clients over
+  proxy_metrics_detach(&(proxy->metrics));
+  proxy->event_mode = true;
+  proxy->sockopts.reuseport = true;
+
+  kmyth_log(LOG_DEBUG, "proxy worker process %zu started", index);
+
+  if (EXIT_SUCCESS != proxy_upstream_start(proxy))
+  {
+    kmyth_log(LOG_ERR, "failed to setup worker's TLS connection pool");
+  }
+  else if (EXIT_SUCCESS != proxy_create_ecdh_server(proxy))
+  {
+    kmyth_log(LOG_ERR, "failed to setup worker's ECDH server interface");
+  }
+  else
+  {
+    ret = proxy_run_event_loop(proxy);
+  }
+
+  proxy_cleanup(proxy);
+
+  return ret;
+}
+
 /*****************************************************************************
  * main()
  ****************************************************************************/
@@ -578,6 +1687,13 @@ int main(int argc, char **argv)
   proxy_get_options(&proxy, argc, argv);
   proxy_check_options(&proxy);
 
+  // start serving metrics first, so that they cover the whole run
+  if (EXIT_SUCCESS != proxy_metrics_start(&(proxy.metrics)))
+  {
+    kmyth_log(LOG_ERR, "failed to setup proxy's metrics listener");
+    proxy_error(&proxy);
+  }
+
   // setup proxy's TLS client interface
   if (EXIT_SUCCESS != proxy_create_tls_client(&proxy))
   {
@@ -585,6 +1701,28 @@ int main(int argc, char **argv)
     proxy_error(&proxy);
   }
 
+  // hand the ECDH client sessions to pre-forked workers, if requested
+  if (proxy.num_procs > 0)
+  {
+    kmyth_log(LOG_DEBUG, "handling ECDH sessions with %d worker process(es)",
+                         proxy.num_procs);
+
+    int ret = kmyth_prefork((size_t) proxy.num_procs, proxy_prefork_worker,
+                            &proxy);
+
+    proxy_cleanup(&proxy);
+    kmyth_log(LOG_DEBUG, "worker processes terminated ...");
+
+    return ret;
+  }
+
+  // start keeping warm connections to the remote server, if requested
+  if (EXIT_SUCCESS != proxy_upstream_start(&proxy))
+  {
+    kmyth_log(LOG_ERR, "failed to setup proxy's TLS connection pool");
+    proxy_error(&proxy);
+  }
+
   // setup proxy's ECDH server interface
   if (EXIT_SUCCESS != proxy_create_ecdh_server(&proxy))
   {
@@ -592,6 +1730,17 @@ int main(int argc, char **argv)
     proxy_error(&proxy);
   }
 
+  // multiplex ECDH client sessions in this process, if requested
+  if (proxy.event_mode)
+  {
+    int ret = proxy_run_event_loop(&proxy);
+
+    proxy_cleanup(&proxy);
+    kmyth_log(LOG_DEBUG, "event loop terminated ...");
+
+    return ret;
+  }
+
   // accept connections from ECDH client(s)
   if (EXIT_SUCCESS != proxy_manage_ecdh_client_connections(&proxy))
   {
@@ -88,31 +88,46 @@ void demo_ecdh_cleanup(ECDHPeer * ecdhconn)
                          ecdhconn->session.proto.server_hello.hdr.msg_size);
   }
 
-  if (ecdhconn->session.proto.kmip_request.buffer != NULL)
+  demo_ecdh_reset_key_request(ecdhconn);
+
+  demo_ecdh_init(false, ecdhconn);
+}
+
+/*****************************************************************************
+ * demo_ecdh_reset_key_request()
+ ****************************************************************************/
+void demo_ecdh_reset_key_request(ECDHPeer * ecdhconn)
+{
+  RetrieveKeyProtocol *proto = &(ecdhconn->session.proto);
+
+  if (proto->kmip_request.buffer != NULL)
   {
-    kmyth_clear_and_free(ecdhconn->session.proto.kmip_request.buffer,
-                         ecdhconn->session.proto.kmip_request.size);
+    kmyth_clear_and_free(proto->kmip_request.buffer,
+                         proto->kmip_request.size);
   }
 
-  if (ecdhconn->session.proto.key_request.body != NULL)
+  if (proto->key_request.body != NULL)
   {
-    kmyth_clear_and_free(ecdhconn->session.proto.key_request.body,
-                         ecdhconn->session.proto.key_request.hdr.msg_size);
+    kmyth_clear_and_free(proto->key_request.body,
+                         proto->key_request.hdr.msg_size);
   }
 
-  if (ecdhconn->session.proto.kmip_response.buffer != NULL)
+  if (proto->kmip_response.buffer != NULL)
   {
-    kmyth_clear_and_free(ecdhconn->session.proto.kmip_response.buffer,
-                         ecdhconn->session.proto.kmip_response.size);
+    kmyth_clear_and_free(proto->kmip_response.buffer,
+                         proto->kmip_response.size);
   }
   
-  if (ecdhconn->session.proto.key_response.body != NULL)
+  if (proto->key_response.body != NULL)
   {
-    kmyth_clear_and_free(ecdhconn->session.proto.key_response.body,
-                         ecdhconn->session.proto.key_response.hdr.msg_size);
+    kmyth_clear_and_free(proto->key_response.body,
+                         proto->key_response.hdr.msg_size);
   }
-  
-  demo_ecdh_init(ecdhconn, false);
+
+  secure_memset(&(proto->kmip_request), 0, sizeof(ByteBuffer));
+  secure_memset(&(proto->key_request), 0, sizeof(ECDHMessage));
+  secure_memset(&(proto->kmip_response), 0, sizeof(ByteBuffer));
+  secure_memset(&(proto->key_response), 0, sizeof(ECDHMessage));
 }
 
 /*****************************************************************************
@@ -367,6 +382,18 @@ int demo_ecdh_recv_client_hello_msg(ECDHPeer * ecdh_svr)
     return EXIT_FAILURE;
   }
 
+  return demo_ecdh_process_client_hello_msg(ecdh_svr);
+}
+
+/*****************************************************************************
+ * demo_ecdh_process_client_hello_msg()
+ ****************************************************************************/
+int demo_ecdh_process_client_hello_msg(ECDHPeer * ecdh_svr)
+{
+  int ret = -1;
+
+  struct ECDHMessage *msg = &(ecdh_svr->session.proto.client_hello);
+
   kmyth_log(LOG_DEBUG, "received 'Client Hello': %02X%02X ... %02X%02X "
                       "(%d bytes)",
                       msg->body[0], msg->body[1],
@@ -509,6 +536,18 @@ int demo_ecdh_recv_key_request_msg(ECDHPeer * ecdh_svr)
     return EXIT_FAILURE;
   }
 
+  return demo_ecdh_process_key_request_msg(ecdh_svr);
+}
+
+/*****************************************************************************
+ * demo_ecdh_process_key_request_msg()
+ ****************************************************************************/
+int demo_ecdh_process_key_request_msg(ECDHPeer * ecdh_svr)
+{
+  int ret = -1;
+
+  struct ECDHMessage *msg = &(ecdh_svr->session.proto.key_request);
+
   kmyth_log(LOG_DEBUG, "received 'Key Request' (CT): %02X%02X ... %02X%02X"
                        " (%d bytes)",
                        msg->body[0], msg->body[1],
@@ -523,6 +562,7 @@ int demo_ecdh_recv_key_request_msg(ECDHPeer * ecdh_svr)
                               &(ecdh_svr->session.request_symkey),
                               msg,
                               ecdh_svr->session.local_eph_keypair,
+                              ecdh_svr->session.key_request_seq,
                               kmip_req);
   if (ret != EXIT_SUCCESS)
   {
@@ -0,0 +1,304 @@
+/**
+ * @file demo_key_store.c
+ * @brief In-memory, hash-indexed key store supporting the demonstration
+ *        KMIP server.
+ */
+
+#include "demo_key_store.h"
+
+/*****************************************************************************
+ * demo_key_store_hash()
+ ****************************************************************************/
+static size_t demo_key_store_hash(const unsigned char *id, size_t id_len)
+{
+  // 64-bit FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  for (size_t i = 0; i < id_len; i++)
+  {
+    hash ^= id[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  return (size_t) hash;
+}
+
+/*****************************************************************************
+ * demo_key_store_find_slot()
+ ****************************************************************************/
+static DemoKeyEntry *demo_key_store_find_slot(const DemoKeyStore * store,
+                                              const unsigned char *id,
+                                              size_t id_len)
+{
+  size_t mask = store->slot_count - 1;
+  size_t index = demo_key_store_hash(id, id_len) & mask;
+
+  // the table is never more than half full, so probing always ends at
+  // either the matching entry or an empty slot
+  while (store->slots[index].id != NULL)
+  {
+    DemoKeyEntry *entry = &(store->slots[index]);
+
+    if ((entry->id_len == id_len) && (memcmp(entry->id, id, id_len) == 0))
+    {
+      return entry;
+    }
+    index = (index + 1) & mask;
+  }
+
+  return &(store->slots[index]);
+}
+
+/*****************************************************************************
+ * demo_key_store_grow()
+ ****************************************************************************/
+static int demo_key_store_grow(DemoKeyStore * store)
+{
+  DemoKeyStore grown = {
+    .slot_count = store->slot_count * 2,
+    .key_count = store->key_count
+  };
+
+  grown.slots = calloc(grown.slot_count, sizeof(DemoKeyEntry));
+  if (grown.slots == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate key store hash table");
+    return EXIT_FAILURE;
+  }
+
+  // entries move to the new table as-is (key material is not copied)
+  for (size_t i = 0; i < store->slot_count; i++)
+  {
+    DemoKeyEntry *entry = &(store->slots[i]);
+
+    if (entry->id != NULL)
+    {
+      *demo_key_store_find_slot(&grown, entry->id, entry->id_len) = *entry;
+    }
+  }
+
+  free(store->slots);
+  *store = grown;
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * demo_key_store_init()
+ ****************************************************************************/
+int demo_key_store_init(DemoKeyStore * store)
+{
+  store->slot_count = DEMO_KEY_STORE_MIN_SLOTS;
+  store->key_count = 0;
+  store->slots = calloc(store->slot_count, sizeof(DemoKeyEntry));
+  if (store->slots == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate key store hash table");
+    store->slot_count = 0;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * demo_key_store_cleanup()
+ ****************************************************************************/
+void demo_key_store_cleanup(DemoKeyStore * store)
+{
+  if (store->slots != NULL)
+  {
+    for (size_t i = 0; i < store->slot_count; i++)
+    {
+      DemoKeyEntry *entry = &(store->slots[i]);
+
+      if (entry->id != NULL)
+      {
+        free(entry->id);
+        kmyth_clear_and_free(entry->val, entry->val_len);
+      }
+    }
+    free(store->slots);
+  }
+
+  store->slots = NULL;
+  store->slot_count = 0;
+  store->key_count = 0;
+}
+
+/*****************************************************************************
+ * demo_key_store_insert()
+ ****************************************************************************/
+int demo_key_store_insert(DemoKeyStore * store,
+                          const unsigned char *id, size_t id_len,
+                          const unsigned char *val, size_t val_len)
+{
+  if ((id == NULL) || (id_len == 0) || (val == NULL) || (val_len == 0))
+  {
+    kmyth_log(LOG_ERR, "invalid (empty) key store entry");
+    return EXIT_FAILURE;
+  }
+
+  // keep the load factor at or below one half
+  if (2 * (store->key_count + 1) > store->slot_count)
+  {
+    if (EXIT_SUCCESS != demo_key_store_grow(store))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  unsigned char *val_copy = malloc(val_len);
+
+  if (val_copy == NULL)
+  {
+    kmyth_log(LOG_ERR, "failed to allocate key store value");
+    return EXIT_FAILURE;
+  }
+  memcpy(val_copy, val, val_len);
+
+  DemoKeyEntry *entry = demo_key_store_find_slot(store, id, id_len);
+
+  if (entry->id != NULL)
+  {
+    kmyth_log(LOG_WARNING, "replacing duplicate key store entry");
+    kmyth_clear_and_free(entry->val, entry->val_len);
+  }
+  else
+  {
+    entry->id = malloc(id_len);
+    if (entry->id == NULL)
+    {
+      kmyth_log(LOG_ERR, "failed to allocate key store ID");
+      kmyth_clear_and_free(val_copy, val_len);
+      return EXIT_FAILURE;
+    }
+    memcpy(entry->id, id, id_len);
+    entry->id_len = id_len;
+    store->key_count++;
+  }
+  entry->val = val_copy;
+  entry->val_len = val_len;
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * demo_key_store_hex_nibble()
+ ****************************************************************************/
+static int demo_key_store_hex_nibble(char c)
+{
+  if ((c >= '0') && (c <= '9'))
+  {
+    return c - '0';
+  }
+  if ((c >= 'a') && (c <= 'f'))
+  {
+    return c - 'a' + 10;
+  }
+  if ((c >= 'A') && (c <= 'F'))
+  {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+/*****************************************************************************
+ * demo_key_store_load_file()
+ ****************************************************************************/
+int demo_key_store_load_file(DemoKeyStore * store, const char *path)
+{
+  FILE *key_file = fopen(path, "r");
+
+  if (key_file == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open key file (%s)", path);
+    return EXIT_FAILURE;
+  }
+
+  char line[DEMO_KEY_STORE_MAX_LINE];
+  unsigned char val[DEMO_KEY_STORE_MAX_LINE / 2];
+  size_t line_num = 0;
+  int ret = EXIT_SUCCESS;
+
+  while (fgets(line, sizeof(line), key_file) != NULL)
+  {
+    line_num++;
+
+    // split the line into ID and hex value fields
+    char *save_ptr = NULL;
+    char *id_str = strtok_r(line, " \t\r\n", &save_ptr);
+
+    if ((id_str == NULL) || (id_str[0] == '#'))
+    {
+      continue;
+    }
+
+    char *hex_str = strtok_r(NULL, " \t\r\n", &save_ptr);
+    size_t hex_len = (hex_str == NULL) ? 0 : strlen(hex_str);
+
+    if ((hex_len == 0) || (hex_len % 2 != 0))
+    {
+      kmyth_log(LOG_ERR, "invalid key value (%s, line %zu)", path, line_num);
+      ret = EXIT_FAILURE;
+      break;
+    }
+
+    size_t val_len = hex_len / 2;
+
+    for (size_t i = 0; i < val_len; i++)
+    {
+      int hi = demo_key_store_hex_nibble(hex_str[2 * i]);
+      int lo = demo_key_store_hex_nibble(hex_str[2 * i + 1]);
+
+      if ((hi < 0) || (lo < 0))
+      {
+        kmyth_log(LOG_ERR, "invalid hex key value (%s, line %zu)",
+                           path, line_num);
+        ret = EXIT_FAILURE;
+        break;
+      }
+      val[i] = (unsigned char) ((hi << 4) | lo);
+    }
+
+    if (ret == EXIT_SUCCESS)
+    {
+      ret = demo_key_store_insert(store,
+                                  (unsigned char *) id_str, strlen(id_str),
+                                  val, val_len);
+    }
+    kmyth_clear(val, val_len);
+    if (ret != EXIT_SUCCESS)
+    {
+      break;
+    }
+  }
+
+  kmyth_clear(line, sizeof(line));
+  fclose(key_file);
+
+  if (ret == EXIT_SUCCESS)
+  {
+    kmyth_log(LOG_DEBUG, "loaded key store file (%s): %zu keys",
+                         path, store->key_count);
+  }
+
+  return ret;
+}
+
+/*****************************************************************************
+ * demo_key_store_lookup()
+ ****************************************************************************/
+const DemoKeyEntry *demo_key_store_lookup(const DemoKeyStore * store,
+                                          const unsigned char *id,
+                                          size_t id_len)
+{
+  if ((store->slots == NULL) || (id == NULL) || (id_len == 0))
+  {
+    return NULL;
+  }
+
+  DemoKeyEntry *entry = demo_key_store_find_slot(store, id, id_len);
+
+  return (entry->id != NULL) ? entry : NULL;
+}
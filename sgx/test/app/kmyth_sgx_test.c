@@ -9,8 +9,11 @@
 #include "sgx_urts.h"
 #include "sgx_attributes.h"
 
+#include "enclave_util.h"
+#include "kmyth_enclave_common.h"
 #include "log_ocall.h"
 #include "sgx_seal_unseal_impl.h"
+#include "sgx_stats_impl.h"
 
 #include "kmyth_sgx_test_enclave_u.h"
 
@@ -33,7 +36,7 @@ int init_suite(void)
 {
   sgx_status_t retval;
 
-  retval = sgx_create_enclave(ENCLAVE_PATH, SGX_DEBUG_FLAG, NULL, NULL, &eid, NULL);
+  retval = kmyth_sgx_create_enclave(ENCLAVE_PATH, &eid);
   if (retval != SGX_SUCCESS)
   {
     return 1;
@@ -188,6 +191,93 @@ void test_unseal_and_export(void)
   return;
 }
 
+void test_unseal_table_remove_and_evict(void)
+{
+  uint8_t **cipher_data = NULL;
+  uint64_t *handles = NULL;
+  size_t num_ciphertexts = 64;
+
+  size_t plain_size = sizeof(size_t);
+  size_t cipher_size = 0;
+
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  int sgx_ret_int;
+  uint32_t sgx_ret_uint32_t;
+  size_t sgx_ret_size_t;
+  bool result = false;
+
+  enc_get_sealed_size(eid, &sgx_ret_int, plain_size,
+                      (uint32_t *) & cipher_size);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  cipher_data = (uint8_t **) malloc(num_ciphertexts * sizeof(uint8_t *));
+  handles = (uint64_t *) malloc(num_ciphertexts * sizeof(uint64_t));
+  for (size_t i = 0; i < num_ciphertexts; i++)
+  {
+    cipher_data[i] = (uint8_t *) malloc(cipher_size);
+    enc_seal_data(eid, &sgx_ret_int, (uint8_t *) & i, plain_size,
+                  cipher_data[i], cipher_size, key_policy, attribute_mask);
+    CU_ASSERT(sgx_ret_int == 0);
+  }
+
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  // Removing an entry clears it from the table; removing it again fails.
+  kmyth_unseal_into_enclave(eid, &result, cipher_size, cipher_data[0],
+                            handles);
+  CU_ASSERT(result == true);
+  kmyth_unsealed_data_table_remove(eid, &result, handles[0]);
+  CU_ASSERT(result == true);
+  kmyth_sgx_test_get_data_size(eid, &sgx_ret_uint32_t, handles[0]);
+  CU_ASSERT(sgx_ret_uint32_t == 0);
+  kmyth_unsealed_data_table_remove(eid, &result, handles[0]);
+  CU_ASSERT(result == false);
+
+  kmyth_sgx_test_get_unseal_table_size(eid, &sgx_ret_size_t);
+  CU_ASSERT(sgx_ret_size_t == 0);
+
+  // Fill the table past its limit: older entries are evicted, the newest
+  // entry is always kept.
+  kmyth_unsealed_data_table_set_max_entries(eid, &sgx_ret_int, 1);
+  CU_ASSERT(sgx_ret_int == 0);
+  for (size_t i = 0; i < num_ciphertexts; i++)
+  {
+    kmyth_unseal_into_enclave(eid, &result, cipher_size, cipher_data[i],
+                              handles + i);
+    CU_ASSERT(result == true);
+    kmyth_sgx_test_get_data_size(eid, &sgx_ret_uint32_t, handles[i]);
+    CU_ASSERT(sgx_ret_uint32_t == plain_size);
+  }
+  kmyth_sgx_test_get_unseal_table_size(eid, &sgx_ret_size_t);
+  CU_ASSERT(sgx_ret_size_t > 0);
+  CU_ASSERT(sgx_ret_size_t < num_ciphertexts);
+
+  // Lowering the limit to zero (unlimited) keeps the remaining entries.
+  size_t remaining = sgx_ret_size_t;
+
+  kmyth_unsealed_data_table_set_max_entries(eid, &sgx_ret_int, 0);
+  CU_ASSERT(sgx_ret_int == 0);
+  kmyth_sgx_test_get_unseal_table_size(eid, &sgx_ret_size_t);
+  CU_ASSERT(sgx_ret_size_t == remaining);
+
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  for (size_t i = 0; i < num_ciphertexts; i++)
+  {
+    free(cipher_data[i]);
+  }
+  free(cipher_data);
+  free(handles);
+  return;
+}
+
 void test_seal_unseal_nkl(void)
 {
   const char *data = "Test of the NKL seal and unseal";
@@ -225,14 +315,229 @@ void test_seal_unseal_nkl(void)
 
   CU_ASSERT(memcmp(cipher_data_decrypted, data, data_len) == 0);
 
+  // the binary format unseals to the same data
+  uint8_t *sgx_seal_binary = NULL;
+  size_t sgx_seal_binary_len = 0;
+
+  CU_ASSERT(kmyth_sgx_seal_nkl_binary
+            (eid, (uint8_t *) data, data_len, &sgx_seal_binary,
+             &sgx_seal_binary_len, key_policy, attribute_mask) == 0);
+  CU_ASSERT(is_nkl_binary(sgx_seal_binary, sgx_seal_binary_len));
+  CU_ASSERT(kmyth_sgx_unseal_nkl
+            (eid, sgx_seal_binary, sgx_seal_binary_len, &handle) == 0);
+  memset(cipher_data_decrypted, 0, data_len);
+  kmyth_sgx_test_export_from_enclave(eid, &sgx_ret_size, handle, data_len,
+                                     cipher_data_decrypted);
+  CU_ASSERT(sgx_ret_size == data_len);
+  CU_ASSERT(memcmp(cipher_data_decrypted, data, data_len) == 0);
+
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  free(sgx_seal);
+  free(sgx_seal_binary);
+  free(cipher_data_decrypted);
+  return;
+}
+
+void test_seal_unseal_nkl_batch(void)
+{
+  const char *data[] = { "first batch item", "second", "the third item" };
+  size_t count = 3;
+  uint8_t *inputs[3];
+  size_t input_lens[3];
+  uint8_t *sgx_seals[3];
+  size_t sgx_seal_lens[3];
+  int status[3];
+  uint64_t handles[3];
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  int sgx_ret_int;
+  size_t sgx_ret_size;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    inputs[i] = (uint8_t *) data[i];
+    input_lens[i] = strlen(data[i]);
+  }
+
+  CU_ASSERT(kmyth_sgx_seal_nkl_batch
+            (eid, count, inputs, input_lens, sgx_seals, sgx_seal_lens, status,
+             key_policy, attribute_mask) == 0);
+  for (size_t i = 0; i < count; i++)
+  {
+    CU_ASSERT(status[i] == 0);
+    CU_ASSERT(sgx_seals[i] != NULL);
+  }
+
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  CU_ASSERT(kmyth_sgx_unseal_nkl_batch
+            (eid, count, sgx_seals, sgx_seal_lens, handles, status) == 0);
+
+  kmyth_sgx_test_get_unseal_table_size(eid, &sgx_ret_size);
+  CU_ASSERT(sgx_ret_size == count);
+
+  // each handle exports the data sealed from the matching input
+  for (size_t i = 0; i < count; i++)
+  {
+    uint8_t *decrypted = (uint8_t *) malloc(input_lens[i]);
+
+    CU_ASSERT(status[i] == 0);
+    kmyth_sgx_test_export_from_enclave(eid, &sgx_ret_size, handles[i],
+                                       input_lens[i], decrypted);
+    CU_ASSERT(sgx_ret_size == input_lens[i]);
+    CU_ASSERT(memcmp(decrypted, data[i], input_lens[i]) == 0);
+    free(decrypted);
+  }
+
+  // a corrupt item fails on its own, without failing the rest of its batch
+  sgx_seal_lens[1] = 10;
+  CU_ASSERT(kmyth_sgx_unseal_nkl_batch
+            (eid, count, sgx_seals, sgx_seal_lens, handles, status) == 1);
+  CU_ASSERT(status[0] == 0);
+  CU_ASSERT(status[1] != 0);
+  CU_ASSERT(status[2] == 0);
+
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    free(sgx_seals[i]);
+  }
+  return;
+}
+
+void test_seal_unseal_nkl_chunked(void)
+{
+  // more than one (and not a whole number of) chunks
+  size_t data_len = 3 * KMYTH_SGX_SEAL_CHUNK_SIZE + 100;
+  uint8_t *data = (uint8_t *) malloc(data_len);
+  uint8_t *sgx_seal = NULL;
+  size_t sgx_seal_len = 0;
+  uint64_t handle;
+  uint16_t key_policy = SGX_KEYPOLICY_MRSIGNER;
+  sgx_attributes_t attribute_mask;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  int sgx_ret_int;
+  size_t sgx_ret_size;
+
+  for (size_t i = 0; i < data_len; i++)
+  {
+    data[i] = (uint8_t) (i * 7);
+  }
+
+  CU_ASSERT(kmyth_sgx_seal_nkl
+            (eid, data, data_len, &sgx_seal, &sgx_seal_len, key_policy,
+             attribute_mask) == 0);
+  CU_ASSERT(memcmp(sgx_seal, KMYTH_DELIM_NKL_CHUNKED_DATA,
+                   strlen(KMYTH_DELIM_NKL_CHUNKED_DATA)) == 0);
+
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+
+  CU_ASSERT(kmyth_sgx_unseal_nkl(eid, sgx_seal, sgx_seal_len, &handle) == 0);
+
+  uint8_t *cipher_data_decrypted = (uint8_t *) malloc(data_len);
+
+  kmyth_sgx_test_export_from_enclave(eid, &sgx_ret_size, handle, data_len,
+                                     cipher_data_decrypted);
+  CU_ASSERT(sgx_ret_size == data_len);
+  CU_ASSERT(memcmp(cipher_data_decrypted, data, data_len) == 0);
+
+  // a payload cut short (in its last chunk) is rejected
+  size_t data_size = 0;
+  uint8_t *sealed = NULL;
+  bool ret = true;
+
+  enc_get_sealed_chunked_size(eid, &sgx_ret_int, data_len, &data_size);
+  CU_ASSERT(sgx_ret_int == 0);
+  sealed = (uint8_t *) malloc(data_size);
+  enc_seal_data_chunked(eid, &sgx_ret_int, data, data_len, sealed, data_size,
+                        key_policy, attribute_mask);
+  CU_ASSERT(sgx_ret_int == 0);
+  kmyth_unseal_chunked_into_enclave(eid, &ret, sealed, data_size - 1,
+                                    &handle);
+  CU_ASSERT(ret == false);
+  kmyth_unseal_chunked_into_enclave(eid, &ret, sealed, data_size, &handle);
+  CU_ASSERT(ret == true);
+
   kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
   CU_ASSERT(sgx_ret_int == 0);
 
+  free(sealed);
   free(sgx_seal);
+  free(data);
   free(cipher_data_decrypted);
   return;
 }
 
+void test_enclave_stats(void)
+{
+  const char *data = "Test of the enclave stats";
+  size_t data_len = strlen(data);
+  uint8_t *sgx_seal = NULL;
+  size_t sgx_seal_len = 0;
+  uint64_t handle;
+  sgx_attributes_t attribute_mask;
+  kmyth_sgx_stats_t before;
+  kmyth_sgx_stats_t after;
+  int sgx_ret_int;
+
+  attribute_mask.flags = 0;
+  attribute_mask.xfrm = 0;
+
+  kmyth_unsealed_data_table_initialize(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+  CU_ASSERT(kmyth_sgx_get_stats(eid, &before) == 0);
+
+  CU_ASSERT(kmyth_sgx_seal_nkl
+            (eid, (uint8_t *) data, data_len, &sgx_seal, &sgx_seal_len,
+             SGX_KEYPOLICY_MRSIGNER, attribute_mask) == 0);
+  CU_ASSERT(kmyth_sgx_unseal_nkl(eid, sgx_seal, sgx_seal_len, &handle) == 0);
+  CU_ASSERT(kmyth_sgx_get_stats(eid, &after) == 0);
+
+  // one entry (holding the data) was added, by one call each to the seal
+  // and unseal ECALLs, both timed by the wrapper
+  CU_ASSERT(after.enclave.unseal_entries ==
+            before.enclave.unseal_entries + 1);
+  CU_ASSERT(after.enclave.unseal_bytes ==
+            before.enclave.unseal_bytes + data_len);
+  CU_ASSERT(after.enclave.unseal_peak_bytes >= after.enclave.unseal_bytes);
+  CU_ASSERT(after.enclave.ecall_calls[KMYTH_SGX_ECALL_SEAL] ==
+            before.enclave.ecall_calls[KMYTH_SGX_ECALL_SEAL] + 1);
+  CU_ASSERT(after.enclave.ecall_calls[KMYTH_SGX_ECALL_UNSEAL] ==
+            before.enclave.ecall_calls[KMYTH_SGX_ECALL_UNSEAL] + 1);
+  CU_ASSERT(after.ecall_timed_calls[KMYTH_SGX_ECALL_UNSEAL] ==
+            before.ecall_timed_calls[KMYTH_SGX_ECALL_UNSEAL] + 1);
+  CU_ASSERT(after.ecall_cycles[KMYTH_SGX_ECALL_UNSEAL] >
+            before.ecall_cycles[KMYTH_SGX_ECALL_UNSEAL]);
+  if (after.enclave.crypto_tracked)
+  {
+    CU_ASSERT(after.enclave.crypto_peak_bytes >= after.enclave.crypto_bytes);
+  }
+
+  // cleaning up the table removes the entry, but not the peak it reached
+  kmyth_unsealed_data_table_cleanup(eid, &sgx_ret_int);
+  CU_ASSERT(sgx_ret_int == 0);
+  CU_ASSERT(kmyth_sgx_get_stats(eid, &after) == 0);
+  CU_ASSERT(after.enclave.unseal_entries == 0);
+  CU_ASSERT(after.enclave.unseal_bytes == 0);
+  CU_ASSERT(after.enclave.unseal_peak_bytes >= data_len);
+
+  free(sgx_seal);
+  return;
+}
+
 int main(void)
 {
 
@@ -263,12 +568,38 @@ int main(void)
     CU_cleanup_registry();
     return CU_get_error();
   }
+  if (NULL ==
+      CU_add_test(kmyth_sgx_test_suite, "Test enclave unseal table eviction",
+                  test_unseal_table_remove_and_evict))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
   if (NULL == CU_add_test(kmyth_sgx_test_suite, "Test seal/unseal nkl",
                           test_seal_unseal_nkl))
   {
     CU_cleanup_registry();
     return CU_get_error();
   }
+  if (NULL == CU_add_test(kmyth_sgx_test_suite, "Test seal/unseal nkl batch",
+                          test_seal_unseal_nkl_batch))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (NULL ==
+      CU_add_test(kmyth_sgx_test_suite, "Test seal/unseal nkl chunked",
+                  test_seal_unseal_nkl_chunked))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (NULL == CU_add_test(kmyth_sgx_test_suite, "Test enclave stats",
+                          test_enclave_stats))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
 
   CU_basic_run_tests();
 
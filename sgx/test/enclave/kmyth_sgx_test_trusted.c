@@ -81,17 +81,7 @@ Out:
 
 uint32_t kmyth_sgx_test_get_data_size(uint64_t handle)
 {
-  unseal_data_t *slot = kmyth_unsealed_data_table;
-
-  while (slot != NULL && slot->handle != handle)
-  {
-    slot = slot->next;
-  }
-  if (slot != NULL)
-  {
-    return slot->data_size;
-  }
-  return 0;
+  return (uint32_t) get_unseal_table_data_size(handle);
 }
 
 size_t kmyth_sgx_test_export_from_enclave(uint64_t handle, uint32_t data_size,
@@ -107,13 +97,5 @@ size_t kmyth_sgx_test_export_from_enclave(uint64_t handle, uint32_t data_size,
 
 size_t kmyth_sgx_test_get_unseal_table_size(void)
 {
-  size_t count = 0;
-  unseal_data_t *slot = kmyth_unsealed_data_table;
-
-  while (slot != NULL)
-  {
-    count++;
-    slot = slot->next;
-  }
-  return count;
+  return get_unseal_table_entry_count();
 }
@@ -11,6 +11,11 @@ extern "C"
 #endif
 
 #include "kmyth_enclave_memory_util.h"
+#include "kmyth_enclave_log_util.h"
+#include "kmyth_enclave_ecdh_pool.h"
+#include "kmyth_enclave_cred_cache.h"
+#include "kmyth_enclave_key_cache.h"
+#include "kmyth_enclave_stats.h"
 
 #include "sgx_retrieve_key_impl.h"
 
@@ -24,21 +29,53 @@ extern "C"
 
 #include ENCLAVE_HEADER_TRUSTED
 
+/**
+ * @brief Number of independently locked stripes the unsealed data table is
+ *        split into (a power of two, 2^KMYTH_UNSEAL_TABLE_STRIPE_BITS)
+ */
+#define KMYTH_UNSEAL_TABLE_STRIPE_BITS 4
+#define KMYTH_UNSEAL_TABLE_STRIPES (1 << KMYTH_UNSEAL_TABLE_STRIPE_BITS)
+
+/**
+ * @brief Initial number of slots in a stripe of the unsealed data table
+ */
+#define KMYTH_UNSEAL_TABLE_MIN_SLOTS 16
+
+  /**
+   * @brief An unsealed data table entry. A NULL 'data' pointer marks an
+   *        empty hash table slot. 'seq' orders entries by insertion time.
+   */
   typedef struct unseal_data_s
   {
     uint64_t handle;
+    uint64_t seq;
     size_t data_size;
     uint8_t *data;
-    struct unseal_data_s *next;
   } unseal_data_t;
 
-  extern unseal_data_t *kmyth_unsealed_data_table;
+  /**
+   * @brief The additional MAC text of each piece of chunk-sealed data,
+   *        binding the piece to its place in its payload: 'stream_id' is
+   *        random for each payload, 'index' numbers the 'count' pieces from
+   *        0, and 'total_size' is the size of the whole payload.
+   */
+  typedef struct seal_chunk_header_s
+  {
+    uint8_t stream_id[16];
+    uint64_t total_size;
+    uint32_t index;
+    uint32_t count;
+  } seal_chunk_header_t;
 
   size_t retrieve_from_unseal_table(uint64_t handle, uint8_t ** buf);
 
   bool insert_into_unseal_table(uint8_t * data, uint32_t data_size,
                                 uint64_t * handle);
 
+  size_t get_unseal_table_entry_count(void);
+
+  size_t get_unseal_table_data_size(uint64_t handle);
+
 #ifdef __cplusplus
 }
 #endif
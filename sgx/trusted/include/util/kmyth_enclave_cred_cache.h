@@ -0,0 +1,76 @@
+/**
+ * @file  kmyth_enclave_cred_cache.h
+ *
+ * @brief Provides a cache, inside a kmyth SGX enclave, of the parsed
+ *        signing keys and certificates passed in to 'retrieve key'
+ *        sessions, so that a session reusing them skips their ASN.1
+ *        parsing
+ */
+
+#ifndef _KMYTH_ENCLAVE_CRED_CACHE_H_
+#define _KMYTH_ENCLAVE_CRED_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Maximum number of parsed keys and certificates held in the cache
+ *        (the least recently added is evicted to make room)
+ */
+#define KMYTH_ENCLAVE_CRED_CACHE_SIZE 8
+
+/**
+ * @brief Gets the private key a DER encoding holds - parsed on first use,
+ *        and from the cache (keyed by the SHA-256 hash of the DER bytes)
+ *        after that.
+ *
+ * @param[in]  der_bytes    DER encoded private key
+ *
+ * @param[in]  der_len      Length (in bytes) of der_bytes
+ *
+ * @param[out] pkey         The private key, a reference the caller frees
+ *                          (EVP_PKEY_free) as it would a parsed one
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_enclave_cred_cache_get_pkey(uint8_t * der_bytes, size_t der_len,
+                                        EVP_PKEY ** pkey);
+
+/**
+ * @brief Gets the certificate a DER encoding holds - parsed on first use,
+ *        and from the cache (keyed by the SHA-256 hash of the DER bytes)
+ *        after that. A cached certificate also keeps the subject name
+ *        (identity) and public key decoded from it.
+ *
+ * @param[in]  der_bytes    DER encoded certificate
+ *
+ * @param[in]  der_len      Length (in bytes) of der_bytes
+ *
+ * @param[out] cert         The certificate, a reference the caller frees
+ *                          (X509_free) as it would a parsed one
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_enclave_cred_cache_get_x509(uint8_t * der_bytes, size_t der_len,
+                                        X509 ** cert);
+
+/**
+ * @brief Frees (clearing any private keys of) all the cache entries.
+ *
+ * @return                  None
+ */
+  void kmyth_enclave_cred_cache_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif                          /* _KMYTH_ENCLAVE_CRED_CACHE_H_ */
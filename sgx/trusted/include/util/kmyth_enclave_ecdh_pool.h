@@ -0,0 +1,62 @@
+/**
+ * @file  kmyth_enclave_ecdh_pool.h
+ *
+ * @brief Provides a pool of ephemeral ECDH key pairs generated ahead of
+ *        time inside a kmyth SGX enclave, so that a 'retrieve key' session
+ *        does not wait for its key pair to be generated
+ */
+
+#ifndef _KMYTH_ENCLAVE_ECDH_POOL_H_
+#define _KMYTH_ENCLAVE_ECDH_POOL_H_
+
+#include <stddef.h>
+
+#include <openssl/evp.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Maximum number of ephemeral key pairs held in the pool
+ */
+#define KMYTH_ECDH_EPHEMERAL_POOL_SIZE 16
+
+/**
+ * @brief Generates ephemeral key pairs until the pool holds the number
+ *        requested (or is full). Key pairs are generated without holding
+ *        the pool's lock, so sessions can take key pairs meanwhile.
+ *
+ * @param[in]  count        The number of key pairs the pool should hold
+ *                          (limited to KMYTH_ECDH_EPHEMERAL_POOL_SIZE)
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_enclave_ecdh_pool_fill(size_t count);
+
+/**
+ * @brief Takes an ephemeral key pair from the pool - or, if the pool is
+ *        empty, generates one. Each key pair is used for a single session
+ *        and is never returned to the pool: the caller frees it (which
+ *        clears the private key) once the shared secret is computed.
+ *
+ * @param[out] keypair      The ephemeral key pair
+ *
+ * @return 0 on success, 1 on error
+ */
+  int kmyth_enclave_ecdh_pool_take(EVP_PKEY ** keypair);
+
+/**
+ * @brief Frees (clearing the private keys of) all the key pairs in the
+ *        pool.
+ *
+ * @return                  None
+ */
+  void kmyth_enclave_ecdh_pool_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif                          /* _KMYTH_ENCLAVE_ECDH_POOL_H_ */
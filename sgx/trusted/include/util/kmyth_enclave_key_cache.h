@@ -0,0 +1,102 @@
+/**
+ * @file  kmyth_enclave_key_cache.h
+ *
+ * @brief Provides an optional cache, inside a kmyth SGX enclave, of the
+ *        keys retrieved from the key server, so that a 'retrieve key'
+ *        ECALL repeating a recent request is answered without contacting
+ *        the server again. The keys themselves are held in the unsealed
+ *        data table; the cache maps each KMIP key ID to its table entry
+ *        and expiry time.
+ */
+
+#ifndef _KMYTH_ENCLAVE_KEY_CACHE_H_
+#define _KMYTH_ENCLAVE_KEY_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Maximum number of retrieved keys held in the cache
+ */
+#define KMYTH_ENCLAVE_KEY_CACHE_SIZE 32
+
+/**
+ * @brief Enables (or disables) the cache. Disabling it, or lowering its
+ *        size, removes (clearing and freeing) the keys over the limit,
+ *        oldest first.
+ *
+ * @param[in]  max_entries  Maximum number of cached keys (limited to
+ *                          KMYTH_ENCLAVE_KEY_CACHE_SIZE), or 0 to disable
+ *                          the cache
+ *
+ * @param[in]  ttl_seconds  Time (in seconds) a key stays cached after it
+ *                          is retrieved, or 0 to disable the cache
+ *
+ * @return                  None
+ */
+  void kmyth_enclave_key_cache_configure(size_t max_entries,
+                                         uint64_t ttl_seconds);
+
+/**
+ * @brief Reports whether the cache is enabled (and so whether a 'retrieve
+ *        key' ECALL needs to read the time to use it).
+ *
+ * @return true if the cache is enabled, false otherwise
+ */
+  bool kmyth_enclave_key_cache_enabled(void);
+
+/**
+ * @brief Looks for an unexpired cached key. An expired key found for the
+ *        key ID is removed from the unsealed data table (which clears and
+ *        frees it).
+ *
+ * @param[in]  key_id       KMIP key ID
+ *
+ * @param[in]  key_id_len   Length (in bytes) of key_id
+ *
+ * @param[in]  now          The current time
+ *
+ * @param[out] handle       The key's unsealed data table handle (if found)
+ *
+ * @return true if the key is cached, false otherwise
+ */
+  bool kmyth_enclave_key_cache_lookup(const unsigned char *key_id,
+                                      size_t key_id_len, time_t now,
+                                      uint64_t * handle);
+
+/**
+ * @brief Caches a retrieved key: a copy of it is added to the unsealed
+ *        data table, replacing any key cached under the same ID. If the
+ *        cache is full, its oldest key is removed first. Nothing is cached
+ *        if the cache is disabled or the unsealed data table is not
+ *        initialized.
+ *
+ * @param[in]  key_id       KMIP key ID
+ *
+ * @param[in]  key_id_len   Length (in bytes) of key_id
+ *
+ * @param[in]  key          The retrieved key
+ *
+ * @param[in]  key_len      Length (in bytes) of key
+ *
+ * @param[in]  now          The current time
+ *
+ * @return                  None
+ */
+  void kmyth_enclave_key_cache_insert(const unsigned char *key_id,
+                                      size_t key_id_len,
+                                      const unsigned char *key,
+                                      size_t key_len, time_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif                          /* _KMYTH_ENCLAVE_KEY_CACHE_H_ */
@@ -0,0 +1,32 @@
+/**
+ * @file  kmyth_enclave_log_util.h
+ *
+ * @brief Provides the log buffer that collects the log records made inside
+ *        a kmyth SGX enclave, so that they leave the enclave a batch (one
+ *        OCALL) at a time
+ */
+
+#ifndef _KMYTH_ENCLAVE_LOG_UTIL_H_
+#define _KMYTH_ENCLAVE_LOG_UTIL_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Passes the log records collected in the calling thread's log
+ *        buffer out of the enclave (in one OCALL), and empties the buffer.
+ *        An ECALL that logs must call this before it returns, so that its
+ *        records are neither held back until a later ECALL nor lost with
+ *        the thread's (thread-local) buffer.
+ *
+ * @return                  None
+ */
+  void kmyth_enclave_log_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif                          /* _KMYTH_ENCLAVE_LOG_UTIL_H_ */
@@ -0,0 +1,64 @@
+/**
+ * @file  kmyth_enclave_stats.h
+ *
+ * @brief Provides the instrumentation counters kept inside a kmyth SGX
+ *        enclave (reported by the kmyth_enclave_get_stats() ECALL)
+ */
+
+#ifndef _KMYTH_ENCLAVE_STATS_H_
+#define _KMYTH_ENCLAVE_STATS_H_
+
+#include <stddef.h>
+
+#include "kmyth_sgx_stats.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Counts a call to one of the enclave's ECALLs. Each counted ECALL
+ *        calls this once, on entry.
+ *
+ * @param[in]  id           The ECALL
+ *
+ * @return                  None
+ */
+  void kmyth_enclave_stats_count_ecall(kmyth_sgx_ecall_id_t id);
+
+/**
+ * @brief Counts an entry added to the unsealed data table.
+ *
+ * @param[in]  data_size    The size, in bytes, of the entry's data
+ *
+ * @return                  None
+ */
+  void kmyth_enclave_stats_unseal_added(size_t data_size);
+
+/**
+ * @brief Counts an entry removed from the unsealed data table (whether
+ *        it was removed, evicted, retrieved or cleaned up).
+ *
+ * @param[in]  data_size    The size, in bytes, of the entry's data
+ *
+ * @return                  None
+ */
+  void kmyth_enclave_stats_unseal_removed(size_t data_size);
+
+/**
+ * @brief Reads the counters. Each one is read atomically, but they are not
+ *        read together, so ECALLs running on other threads meanwhile can
+ *        leave them slightly inconsistent with each other.
+ *
+ * @param[out] stats        The counters
+ *
+ * @return                  None
+ */
+  void kmyth_enclave_stats_get(kmyth_sgx_enclave_stats_t * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif                          /* _KMYTH_ENCLAVE_STATS_H_ */
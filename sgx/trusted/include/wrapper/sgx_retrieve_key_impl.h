@@ -24,10 +24,128 @@ extern "C"
 #include <kmip/kmip.h>
 
 #include "kmyth_enclave_trusted.h"
+#include "kmyth_enclave_common.h"
+
+/**
+ * @brief State of a 'retrieve key' protocol session, over which any
+ *        number of keys can be requested once the session keys have been
+ *        agreed with the server.
+ */
+  typedef struct RetrieveKeySession
+  {
+    // connection to the key server (TLS proxy), or -1 if none
+    int socket_fd;
+
+    // the connection's (untrusted) receive buffer, which the untrusted
+    // side receives each message into, and the (trusted) copy of the
+    // message last received - each message is copied in once, so that it
+    // cannot change while it is validated and used
+    unsigned char *recv_buf;
+    unsigned char *recv_msg;
+
+    // enclave's (client's) signing key and the server's certificate, held
+    // (not owned) by the session
+    EVP_PKEY *client_sign_privkey;
+    X509 *server_sign_cert;
+
+    // server's ephemeral public key and the agreed session keys
+    EVP_PKEY *server_eph_pubkey;
+    ByteBuffer request_key;
+    ByteBuffer response_key;
+
+    // sequence number of the next 'Key Request' message
+    uint32_t next_seq;
+  } RetrieveKeySession;
+
+/**
+ * @brief Connects to a "remote" key server and agrees on the session keys
+ *        (the 'Client Hello'/'Server Hello' exchange) used to request keys
+ *        from it.
+ *
+ * @param[in]  client_sign_privkey    Pointer to enclave's (client's)
+ *                                    private signing key, which must stay
+ *                                    valid until the session is closed.
+ *
+ * @param[in]  client_sign_cert       Pointer to enclave's (client's)
+ *                                    certificate.
+ *
+ * @param[in]  server_sign_cert       Pointer to remote's (server's)
+ *                                    certificate, which must stay valid
+ *                                    until the session is closed.
+ *
+ * @param[in]  server_host            String IP address or hostname used to
+ *                                    connect to the key server.
+ *
+ * @param[in]  server_host_len        Length (in bytes) of server_host string.
+ *
+ * @param[in]  server_port            TCP port number string used to specify
+ *                                    TCP port to connect to the key server.
+ *
+ * @param[in]  server_port_len        Length (in bytes) of server_port string.
+ *
+ * @param[out] session                Pointer to the session to be opened.
+ *                                    On error, nothing is left to close.
+ *
+ * @return 0 on success, 1 on error
+ */
+  int enclave_retrieve_key_session_open(EVP_PKEY * client_sign_privkey,
+                                        X509 * client_sign_cert,
+                                        X509 * server_sign_cert,
+                                        const char *server_host,
+                                        size_t server_host_len,
+                                        const char *server_port,
+                                        size_t server_port_len,
+                                        RetrieveKeySession * session);
+
+/**
+ * @brief Retrieves a designated key over an open session (one 'Key
+ *        Request'/'Key Response' exchange). After an error, the session
+ *        can only be closed.
+ *
+ * @param[in]  session                Pointer to the open session.
+ *
+ * @param[in]  req_key_id             ID string used to specify the key to be
+ *                                    retrieved (not null-terminated).
+ *
+ * @param[in]  req_key_id_len         Length (in bytes) of the ID string.
+ *
+ * @param[out] retrieved_key_id       Pointer to the key ID string returned in
+ *                                    the key server's response (not
+ *                                    null-terminated).
+ *
+ * @param[out] retrieved_key_id_len   Pointer to the length (in bytes) of the
+ *                                    ID string for the retrieved key.
+ *
+ * @param[out] retrieved_key          Pointer to the retrieved key result
+ *                                    (byte array).
+ *
+ * @param[out] retrieved_key_len      Pointer to the length (in bytes) of the
+ *                                    retrieved key result.
+ *
+ * @return 0 on success, 1 on error
+ */
+  int enclave_retrieve_key_session_get(RetrieveKeySession * session,
+                                       unsigned char *req_key_id,
+                                       size_t req_key_id_len,
+                                       uint8_t **retrieved_key_id,
+                                       size_t *retrieved_key_id_len,
+                                       uint8_t **retrieved_key,
+                                       size_t *retrieved_key_len);
+
+/**
+ * @brief Clears the session keys and closes the connection to the key
+ *        server, which tells it that no more requests will follow.
+ *
+ * @param[in]  session                Pointer to the session to be closed.
+ *
+ * @return None
+ */
+  void enclave_retrieve_key_session_close(RetrieveKeySession * session);
 
 /**
  * @brief Retrieve a designated key from a "remote" key server securely
- *        into the enclave.
+ *        into the enclave (opening a session, requesting the one key over
+ *        it, and closing it).
  *
  *        TODO: The parameters to this function will have to be augmented
  *              to support actual retrieval from the remote server. This
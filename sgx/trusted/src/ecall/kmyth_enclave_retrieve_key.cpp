@@ -11,24 +11,118 @@
 #include ENCLAVE_HEADER_TRUSTED
 
 // This is the function that gets converted into the ecall.
-int kmyth_enclave_retrieve_key_from_server(uint8_t * client_private_bytes,
-                                           size_t client_private_bytes_len,
-                                           uint8_t * client_cert_bytes,
-                                           size_t client_cert_bytes_len,
-                                           uint8_t * server_cert_bytes,
-                                           size_t server_cert_bytes_len,
-                                           const char * server_host,
-                                           size_t server_host_len,
-                                           const char * server_port,
-                                           size_t server_port_len,
-                                           unsigned char *key_id,
-                                           size_t key_id_len)
+int kmyth_enclave_fill_ecdh_pool(size_t count)
+{
+  kmyth_enclave_stats_count_ecall(KMYTH_SGX_ECALL_FILL_ECDH_POOL);
+
+  int ret_val = kmyth_enclave_ecdh_pool_fill(count);
+
+  // pass out the log records buffered during the ECALL
+  kmyth_enclave_log_flush();
+
+  return ret_val;
+}
+
+// This is the function that gets converted into the ecall.
+int kmyth_enclave_set_key_cache(size_t max_entries, uint64_t ttl_seconds)
+{
+  kmyth_enclave_key_cache_configure(max_entries, ttl_seconds);
+
+  return EXIT_SUCCESS;
+}
+
+// Reads the (untrusted) time the key cache's entries expire by - the only
+// OCALL an ECALL answered from the cache makes.
+static int key_cache_time(time_t * now)
+{
+  time_t timer = 0;
+
+  if (time_ocall(now, &timer) != SGX_SUCCESS || *now == (time_t) - 1)
+  {
+    kmyth_sgx_log(LOG_ERR, "failed to read the time for the key cache");
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static int retrieve_keys_from_server(uint8_t * client_private_bytes,
+                                     size_t client_private_bytes_len,
+                                     uint8_t * client_cert_bytes,
+                                     size_t client_cert_bytes_len,
+                                     uint8_t * server_cert_bytes,
+                                     size_t server_cert_bytes_len,
+                                     const char * server_host,
+                                     size_t server_host_len,
+                                     const char * server_port,
+                                     size_t server_port_len,
+                                     unsigned char *key_ids,
+                                     size_t key_ids_len,
+                                     size_t *key_id_lens,
+                                     size_t key_count)
 {
-  // unmarshal client private signing key
+  // check that the key IDs exactly fill the (concatenated) key ID buffer
+  size_t key_ids_total = 0;
+
+  for (size_t i = 0; i < key_count; i++)
+  {
+    if (key_id_lens[i] == 0 || key_id_lens[i] > key_ids_len - key_ids_total)
+    {
+      kmyth_sgx_log(LOG_ERR, "requested key IDs overrun the key ID buffer");
+      kmyth_enclave_clear(client_private_bytes, client_private_bytes_len);
+      return EXIT_FAILURE;
+    }
+    key_ids_total += key_id_lens[i];
+  }
+  if (key_count == 0 || key_ids_total != key_ids_len)
+  {
+    kmyth_sgx_log(LOG_ERR, "requested key IDs mismatch the key ID buffer");
+    kmyth_enclave_clear(client_private_bytes, client_private_bytes_len);
+    return EXIT_FAILURE;
+  }
+
+  // answer what the key cache can, and contact the key server only for
+  // the rest (if any)
+  bool use_cache = kmyth_enclave_key_cache_enabled();
+  time_t now = 0;
+  bool *cached = (bool *) calloc(key_count, sizeof(bool));
+  size_t cached_count = 0;
+
+  if (cached == NULL)
+  {
+    kmyth_enclave_clear(client_private_bytes, client_private_bytes_len);
+    return EXIT_FAILURE;
+  }
+  if (use_cache && key_cache_time(&now) != EXIT_SUCCESS)
+  {
+    use_cache = false;
+  }
+  for (size_t i = 0, offset = 0; use_cache && (i < key_count); i++)
+  {
+    uint64_t handle = 0;
+
+    cached[i] = kmyth_enclave_key_cache_lookup(key_ids + offset,
+                                               key_id_lens[i], now, &handle);
+    if (cached[i])
+    {
+      cached_count++;
+    }
+    offset += key_id_lens[i];
+  }
+  if (cached_count == key_count)
+  {
+    kmyth_sgx_log(LOG_DEBUG, "answered all requested keys from the cache");
+    kmyth_enclave_clear(client_private_bytes, client_private_bytes_len);
+    free(cached);
+    return EXIT_SUCCESS;
+  }
+
+  // unmarshal client private signing key (or take it from the cache, if a
+  // previous session unmarshalled the same key)
   EVP_PKEY *client_sign_privkey = NULL;
-  int ret_val = unmarshal_ec_der_to_pkey(client_private_bytes,
-                                         client_private_bytes_len,
-                                         &client_sign_privkey);
+  int ret_val = kmyth_enclave_cred_cache_get_pkey(client_private_bytes,
+                                                  client_private_bytes_len,
+                                                  &client_sign_privkey);
 
   if (ret_val)
   {
@@ -36,6 +130,7 @@ int kmyth_enclave_retrieve_key_from_server(uint8_t * client_private_bytes,
     kmyth_enclave_clear(client_private_bytes, client_private_bytes_len);
     kmyth_enclave_clear(client_sign_privkey, sizeof(client_sign_privkey));
     EVP_PKEY_free(client_sign_privkey);
+    free(cached);
     return EXIT_FAILURE;
   }
   kmyth_sgx_log(LOG_DEBUG, "unmarshalled client signing key");
@@ -46,15 +141,16 @@ int kmyth_enclave_retrieve_key_from_server(uint8_t * client_private_bytes,
   // unmarshal client cert (contains information linked to client identity)
   X509 *client_cert = NULL;
 
-  ret_val = unmarshal_ec_der_to_x509(client_cert_bytes,
-                                     client_cert_bytes_len,
-                                     &client_cert);
+  ret_val = kmyth_enclave_cred_cache_get_x509(client_cert_bytes,
+                                              client_cert_bytes_len,
+                                              &client_cert);
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "unmarshal of client cert failed");
     kmyth_enclave_clear(client_sign_privkey, sizeof(client_sign_privkey));
     EVP_PKEY_free(client_sign_privkey);
     X509_free(client_cert);
+    free(cached);
     return EXIT_FAILURE;
   }
   kmyth_sgx_log(LOG_DEBUG, "unmarshalled client cert");
@@ -62,9 +158,9 @@ int kmyth_enclave_retrieve_key_from_server(uint8_t * client_private_bytes,
   // unmarshal server cert (containing public key for signature verification)
   X509 *server_cert = NULL;
 
-  ret_val = unmarshal_ec_der_to_x509(server_cert_bytes,
-                                     server_cert_bytes_len,
-                                     &server_cert);
+  ret_val = kmyth_enclave_cred_cache_get_x509(server_cert_bytes,
+                                              server_cert_bytes_len,
+                                              &server_cert);
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "unmarshal of server cert failed");
@@ -72,90 +168,179 @@ int kmyth_enclave_retrieve_key_from_server(uint8_t * client_private_bytes,
     EVP_PKEY_free(client_sign_privkey);
     X509_free(client_cert);
     X509_free(server_cert);
+    free(cached);
     return EXIT_FAILURE;
   }
   kmyth_sgx_log(LOG_DEBUG, "unmarshalled server cert");
 
-  unsigned char *retrieve_key_result = NULL;
-  size_t retrieve_key_result_len = 0;
-  unsigned char *retrieve_key_result_id = NULL;
-  size_t retrieve_key_result_id_len = 0;
-
-  ret_val =
-    enclave_retrieve_key(client_sign_privkey,
-                         client_cert,
-                         server_cert,
-                         server_host,
-                         server_host_len,
-                         server_port,
-                         server_port_len,
-                         key_id,
-                         key_id_len,
-                         &retrieve_key_result_id,
-                         &retrieve_key_result_id_len,
-                         &retrieve_key_result,
-                         &retrieve_key_result_len);
+  // agree on the session keys once, then request each key over the session
+  RetrieveKeySession session;
+
+  ret_val = enclave_retrieve_key_session_open(client_sign_privkey,
+                                              client_cert,
+                                              server_cert,
+                                              server_host,
+                                              server_host_len,
+                                              server_port,
+                                              server_port_len,
+                                              &session);
+  X509_free(client_cert);
   if (ret_val != EXIT_SUCCESS)
   {
-    kmyth_sgx_log(LOG_ERR,
-                  "enclave_retrieve_key() wrapper function call failed");
+    kmyth_sgx_log(LOG_ERR, "failed to open a 'retrieve key' session");
     kmyth_enclave_clear(client_sign_privkey, sizeof(client_sign_privkey));
     EVP_PKEY_free(client_sign_privkey);
-    X509_free(client_cert);
     X509_free(server_cert);
-    kmyth_enclave_clear(retrieve_key_result, retrieve_key_result_len);
-    kmyth_enclave_clear(retrieve_key_result_id, retrieve_key_result_id_len);
-    free(retrieve_key_result);
-    free(retrieve_key_result_id);
+    free(cached);
     return EXIT_FAILURE;
   }
 
-  // done with unmarshalled, client-side 'retrieve key' inputs (keys/certs)
-  kmyth_enclave_clear(client_sign_privkey, sizeof(client_sign_privkey));
-  EVP_PKEY_free(client_sign_privkey);
-  X509_free(client_cert);
-  X509_free(server_cert);
-
+  unsigned char *key_id = key_ids;
   char msg[MAX_LOG_MSG_LEN] = { 0 };
 
-  snprintf(msg, MAX_LOG_MSG_LEN, "Retrieved key (ID: %.*s) into enclave",
-           (int) retrieve_key_result_id_len, retrieve_key_result_id);
-  kmyth_sgx_log(LOG_DEBUG, msg);
-
-  snprintf(msg, MAX_LOG_MSG_LEN,
-           "Retrieved key value: 0x%02X%02X..%02X%02X",
-           retrieve_key_result[0], retrieve_key_result[1],
-           retrieve_key_result[retrieve_key_result_len - 2],
-           retrieve_key_result[retrieve_key_result_len - 1]);
-  kmyth_sgx_log(LOG_DEBUG, msg);
-
-  // Verification that the Key ID received in the response from the key server
-  // matches the requested Key ID eliminates the need to return this parameter
-  // to the ECALL caller. A successful ECALL return indicates that the
-  // returned key ID matches the input value that the caller provided.
-  char rcvd_key_id[retrieve_key_result_id_len + 1] = { 0 };
-  memcpy(rcvd_key_id, retrieve_key_result_id, retrieve_key_result_id_len);
-  rcvd_key_id[retrieve_key_result_id_len] = '\0';
-
-  if (strcmp((const char*) rcvd_key_id, (const char*) key_id) != 0)
+  for (size_t i = 0; (ret_val == EXIT_SUCCESS) && (i < key_count); i++)
   {
-    kmyth_sgx_log(LOG_ERR, "retrieved key ID mismatches requested key ID");
+    unsigned char *retrieve_key_result = NULL;
+    size_t retrieve_key_result_len = 0;
+    unsigned char *retrieve_key_result_id = NULL;
+    size_t retrieve_key_result_id_len = 0;
+
+    if (cached[i])
+    {
+      key_id += key_id_lens[i];
+      continue;
+    }
+
+    // a successful return also means the key ID received in the response
+    // from the key server matches the requested key ID
+    ret_val = enclave_retrieve_key_session_get(&session,
+                                               key_id,
+                                               key_id_lens[i],
+                                               &retrieve_key_result_id,
+                                               &retrieve_key_result_id_len,
+                                               &retrieve_key_result,
+                                               &retrieve_key_result_len);
+    if (ret_val != EXIT_SUCCESS)
+    {
+      kmyth_sgx_log(LOG_ERR,
+                    "enclave_retrieve_key_session_get() call failed");
+    }
+    else
+    {
+      snprintf(msg, MAX_LOG_MSG_LEN, "Retrieved key (ID: %.*s) into enclave",
+               (int) retrieve_key_result_id_len, retrieve_key_result_id);
+      kmyth_sgx_log(LOG_DEBUG, msg);
+
+      snprintf(msg, MAX_LOG_MSG_LEN,
+               "Retrieved key value: 0x%02X%02X..%02X%02X",
+               retrieve_key_result[0], retrieve_key_result[1],
+               retrieve_key_result[retrieve_key_result_len - 2],
+               retrieve_key_result[retrieve_key_result_len - 1]);
+      kmyth_sgx_log(LOG_DEBUG, msg);
+
+      if (use_cache)
+      {
+        kmyth_enclave_key_cache_insert(key_id, key_id_lens[i],
+                                       retrieve_key_result,
+                                       retrieve_key_result_len, now);
+      }
+    }
+
+    // free memory for 'retrieve key' results
+    // Note: probably should instead return a pointer to these buffers so
+    //       they can be cleared and freed later. Presumably the key was
+    //       retrieved for some purpose.
     kmyth_enclave_clear(retrieve_key_result, retrieve_key_result_len);
     kmyth_enclave_clear(retrieve_key_result_id, retrieve_key_result_id_len);
     free(retrieve_key_result);
     free(retrieve_key_result_id);
-    return EXIT_FAILURE;
+
+    key_id += key_id_lens[i];
   }
-  kmyth_sgx_log(LOG_DEBUG, "Retrieved/requested key ID match");
 
-  // free memory for 'retrieve key' wrapper function results
-  // Note: probably should instead return a pointer to these buffers so they
-  //       can be cleared and freed later. Presumably the key was retrieved
-  //       for some purpose.
-  kmyth_enclave_clear(retrieve_key_result, retrieve_key_result_len);
-  kmyth_enclave_clear(retrieve_key_result_id, retrieve_key_result_id_len);
-  free(retrieve_key_result);
-  free(retrieve_key_result_id);
+  // done with the session and the unmarshalled, client-side 'retrieve key'
+  // inputs (keys/certs)
+  enclave_retrieve_key_session_close(&session);
+  kmyth_enclave_clear(client_sign_privkey, sizeof(client_sign_privkey));
+  EVP_PKEY_free(client_sign_privkey);
+  X509_free(server_cert);
+  free(cached);
 
-  return EXIT_SUCCESS;
+  return ret_val;
+}
+
+// This is the function that gets converted into the ecall.
+int kmyth_enclave_retrieve_key_from_server(uint8_t * client_private_bytes,
+                                           size_t client_private_bytes_len,
+                                           uint8_t * client_cert_bytes,
+                                           size_t client_cert_bytes_len,
+                                           uint8_t * server_cert_bytes,
+                                           size_t server_cert_bytes_len,
+                                           const char * server_host,
+                                           size_t server_host_len,
+                                           const char * server_port,
+                                           size_t server_port_len,
+                                           unsigned char *key_id,
+                                           size_t key_id_len)
+{
+  kmyth_enclave_stats_count_ecall(KMYTH_SGX_ECALL_RETRIEVE_KEY);
+
+  int ret_val = retrieve_keys_from_server(client_private_bytes,
+                                          client_private_bytes_len,
+                                          client_cert_bytes,
+                                          client_cert_bytes_len,
+                                          server_cert_bytes,
+                                          server_cert_bytes_len,
+                                          server_host,
+                                          server_host_len,
+                                          server_port,
+                                          server_port_len,
+                                          key_id,
+                                          key_id_len,
+                                          &key_id_len,
+                                          1);
+
+  // pass out the log records buffered during the ECALL
+  kmyth_enclave_log_flush();
+
+  return ret_val;
+}
+
+// This is the function that gets converted into the ecall.
+int kmyth_enclave_retrieve_keys_from_server(uint8_t * client_private_bytes,
+                                            size_t client_private_bytes_len,
+                                            uint8_t * client_cert_bytes,
+                                            size_t client_cert_bytes_len,
+                                            uint8_t * server_cert_bytes,
+                                            size_t server_cert_bytes_len,
+                                            const char * server_host,
+                                            size_t server_host_len,
+                                            const char * server_port,
+                                            size_t server_port_len,
+                                            unsigned char *key_ids,
+                                            size_t key_ids_len,
+                                            size_t *key_id_lens,
+                                            size_t key_count)
+{
+  kmyth_enclave_stats_count_ecall(KMYTH_SGX_ECALL_RETRIEVE_KEYS);
+
+  int ret_val = retrieve_keys_from_server(client_private_bytes,
+                                          client_private_bytes_len,
+                                          client_cert_bytes,
+                                          client_cert_bytes_len,
+                                          server_cert_bytes,
+                                          server_cert_bytes_len,
+                                          server_host,
+                                          server_host_len,
+                                          server_port,
+                                          server_port_len,
+                                          key_ids,
+                                          key_ids_len,
+                                          key_id_lens,
+                                          key_count);
+
+  // pass out the log records buffered during the ECALL
+  kmyth_enclave_log_flush();
+
+  return ret_val;
 }
@@ -7,8 +7,34 @@
 #include "sgx_utils.h"
 #include "sgx_attributes.h"
 
+#include "kmyth_enclave_trusted.h"
 #include ENCLAVE_HEADER_TRUSTED
 
+// Fills in the defaults for (and applies the enclave's KSS use to) the
+// sealing key policy and attribute mask
+static void set_seal_key_policy(uint16_t * key_policy,
+                                sgx_attributes_t * attribute_mask)
+{
+  // This combination is recommended by the SGX Developer Guide, so
+  // we use it as default.
+  if (attribute_mask->flags == 0)
+  {
+    attribute_mask->flags = SGX_FLAGS_INITTED | SGX_FLAGS_DEBUG;
+  }
+
+  // If the enclave uses the key separation and sharing (KSS) features
+  // we need that to be reflected in the policy of the sealing key
+  // as well.
+  const sgx_report_t *report = sgx_self_report();
+
+  if (report->body.attributes.flags & SGX_FLAGS_KSS)
+  {
+    *key_policy |=
+      (SGX_KEYPOLICY_CONFIGID | SGX_KEYPOLICY_ISVFAMILYID |
+       SGX_KEYPOLICY_ISVEXTPRODID);
+  }
+}
+
 // EDL checks that `size` is outside the enclave (speculative-safe)
 int enc_get_sealed_size(uint32_t in_size, uint32_t * size)
 {
@@ -27,11 +53,11 @@ int enc_get_sealed_size(uint32_t in_size, uint32_t * size)
   return 0;
 }
 
-// EDL checks that `in_data` is outside the enclave (speculative-safe)
-// `out_data` is user_check
-int enc_seal_data(const uint8_t * in_data, uint32_t in_size, uint8_t * out_data,
-                  uint32_t out_size, uint16_t key_policy,
-                  sgx_attributes_t attribute_mask)
+// Seals one input - the work of enc_seal_data(), also done for each input
+// of enc_seal_data_batch() (without counting as a call to the former)
+static int seal_data(const uint8_t * in_data, uint32_t in_size,
+                     uint8_t * out_data, uint32_t out_size,
+                     uint16_t key_policy, sgx_attributes_t attribute_mask)
 {
   if (in_data == NULL || out_data == NULL)
   {
@@ -58,24 +84,7 @@ int enc_seal_data(const uint8_t * in_data, uint32_t in_size, uint8_t * out_data,
   // Retire validity check of `out_data` and checks in `malloc` against `sealedsz`, influenced by `in_size`
   sgx_lfence();
 
-  // This combination is recommended by the SGX Developer Guide, so
-  // we use it as default.
-  if (attribute_mask.flags == 0)
-  {
-    attribute_mask.flags = SGX_FLAGS_INITTED | SGX_FLAGS_DEBUG;
-  }
-
-  // If the enclave uses the key separation and sharing (KSS) features
-  // we need that to be reflected in the policy of the sealing key
-  // as well.
-  const sgx_report_t *report = sgx_self_report();
-
-  if (report->body.attributes.flags & SGX_FLAGS_KSS)
-  {
-    key_policy |=
-      (SGX_KEYPOLICY_CONFIGID | SGX_KEYPOLICY_ISVFAMILYID |
-       SGX_KEYPOLICY_ISVEXTPRODID);
-  }
+  set_seal_key_policy(&key_policy, &attribute_mask);
 
   // This 0 value is currently unused by SGX.
   const sgx_misc_select_t misc_mask = 0;
@@ -95,3 +104,196 @@ Out:
     free(buf);
   return ret;
 }
+
+// EDL checks that `in_data` is outside the enclave (speculative-safe)
+// `out_data` is user_check
+int enc_seal_data(const uint8_t * in_data, uint32_t in_size, uint8_t * out_data,
+                  uint32_t out_size, uint16_t key_policy,
+                  sgx_attributes_t attribute_mask)
+{
+  kmyth_enclave_stats_count_ecall(KMYTH_SGX_ECALL_SEAL);
+  return seal_data(in_data, in_size, out_data, out_size, key_policy,
+                   attribute_mask);
+}
+
+// EDL checks that `in_data`, `in_sizes`, `out_sizes` and `status` are
+// outside the enclave (and copies them in, or out); `out_data` is
+// user_check, and each sealed output is checked by seal_data
+int enc_seal_data_batch(const uint8_t * in_data, size_t in_total,
+                        const uint32_t * in_sizes, uint8_t * out_data,
+                        size_t out_total, uint32_t * out_sizes, int *status,
+                        size_t count, uint16_t key_policy,
+                        sgx_attributes_t attribute_mask)
+{
+  kmyth_enclave_stats_count_ecall(KMYTH_SGX_ECALL_SEAL_BATCH);
+  if (count == 0)
+  {
+    return 0;
+  }
+  if (in_data == NULL || in_sizes == NULL || out_data == NULL
+      || out_sizes == NULL || status == NULL)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  if (!sgx_is_outside_enclave(out_data, out_total))
+    return SGX_ERROR_INVALID_PARAMETER;
+
+  size_t in_offset = 0;
+  size_t out_offset = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    out_sizes[i] = 0;
+    status[i] = SGX_ERROR_INVALID_PARAMETER;
+    if (in_sizes[i] > in_total - in_offset)
+    {
+      // the remaining inputs cannot be located either
+      for (size_t j = i + 1; j < count; j++)
+      {
+        out_sizes[j] = 0;
+        status[j] = SGX_ERROR_INVALID_PARAMETER;
+      }
+      break;
+    }
+
+    // Retire the bounds check on `in_sizes[i]` before it is used
+    sgx_lfence();
+
+    uint32_t sealedsz = sgx_calc_sealed_data_size(0, in_sizes[i]);
+
+    if (sealedsz != UINT32_MAX && sealedsz <= out_total - out_offset)
+    {
+      status[i] = seal_data(in_data + in_offset, in_sizes[i],
+                            out_data + out_offset, sealedsz, key_policy,
+                            attribute_mask);
+      if (status[i] == 0)
+      {
+        out_sizes[i] = sealedsz;
+        out_offset += sealedsz;
+      }
+    }
+    in_offset += in_sizes[i];
+  }
+
+  return 0;
+}
+
+// EDL checks that `size` is outside the enclave (speculative-safe)
+int enc_get_sealed_chunked_size(size_t in_size, size_t *size)
+{
+  if (size == NULL)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  *size = 0;
+
+  // the unsealed data table holds at most UINT32_MAX bytes per entry
+  if (in_size == 0 || in_size > UINT32_MAX)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  size_t count = (in_size - 1) / KMYTH_SGX_SEAL_CHUNK_SIZE + 1;
+  uint32_t last_size =
+    (uint32_t) (in_size - (count - 1) * KMYTH_SGX_SEAL_CHUNK_SIZE);
+  uint32_t full_sealed_size =
+    sgx_calc_sealed_data_size(sizeof(seal_chunk_header_t),
+                              KMYTH_SGX_SEAL_CHUNK_SIZE);
+  uint32_t last_sealed_size =
+    sgx_calc_sealed_data_size(sizeof(seal_chunk_header_t), last_size);
+
+  if (full_sealed_size == UINT32_MAX || last_sealed_size == UINT32_MAX)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  *size = (count - 1) * (size_t) full_sealed_size + last_sealed_size;
+  return 0;
+}
+
+// `in_data` and `out_data` are user_check: each piece is copied into the
+// enclave before it is sealed, and sealed into an enclave buffer before it
+// is copied out
+int enc_seal_data_chunked(const uint8_t * in_data, size_t in_size,
+                          uint8_t * out_data, size_t out_size,
+                          uint16_t key_policy, sgx_attributes_t attribute_mask)
+{
+  kmyth_enclave_stats_count_ecall(KMYTH_SGX_ECALL_SEAL_CHUNKED);
+
+  size_t sealed_size = 0;
+
+  if (in_data == NULL || out_data == NULL
+      || enc_get_sealed_chunked_size(in_size, &sealed_size) != 0
+      || sealed_size > out_size)
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  if (!sgx_is_outside_enclave(in_data, in_size)
+      || !sgx_is_outside_enclave(out_data, sealed_size))
+  {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  // Retire the checks on `in_data`, `out_data` and their sizes
+  sgx_lfence();
+
+  seal_chunk_header_t header;
+
+  header.total_size = in_size;
+  header.count = (uint32_t) ((in_size - 1) / KMYTH_SGX_SEAL_CHUNK_SIZE + 1);
+  if (sgx_read_rand(header.stream_id, sizeof(header.stream_id)) !=
+      SGX_SUCCESS)
+  {
+    return SGX_ERROR_UNEXPECTED;
+  }
+
+  uint32_t max_sealed_size =
+    sgx_calc_sealed_data_size(sizeof(seal_chunk_header_t),
+                              KMYTH_SGX_SEAL_CHUNK_SIZE);
+  uint8_t *chunk = (uint8_t *) malloc(KMYTH_SGX_SEAL_CHUNK_SIZE);
+  sgx_sealed_data_t *buf = (sgx_sealed_data_t *) malloc(max_sealed_size);
+  int ret = 0;
+
+  if (chunk == NULL || buf == NULL)
+  {
+    free(chunk);
+    free(buf);
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+
+  set_seal_key_policy(&key_policy, &attribute_mask);
+
+  // This 0 value is currently unused by SGX.
+  const sgx_misc_select_t misc_mask = 0;
+  size_t in_offset = 0;
+  size_t out_offset = 0;
+
+  for (header.index = 0; header.index < header.count; header.index++)
+  {
+    uint32_t chunk_size = KMYTH_SGX_SEAL_CHUNK_SIZE;
+
+    if (in_size - in_offset < chunk_size)
+    {
+      chunk_size = (uint32_t) (in_size - in_offset);
+    }
+
+    uint32_t sealedsz =
+      sgx_calc_sealed_data_size(sizeof(seal_chunk_header_t), chunk_size);
+
+    memcpy(chunk, in_data + in_offset, chunk_size);
+    ret = sgx_seal_data_ex(key_policy, attribute_mask, misc_mask,
+                           sizeof(seal_chunk_header_t),
+                           (const uint8_t *) &header, chunk_size, chunk,
+                           sealedsz, buf);
+    if (ret != SGX_SUCCESS)
+    {
+      break;
+    }
+    memcpy(out_data + out_offset, buf, sealedsz);
+    in_offset += chunk_size;
+    out_offset += sealedsz;
+  }
+
+  kmyth_enclave_clear_and_free(chunk, KMYTH_SGX_SEAL_CHUNK_SIZE);
+  free(buf);
+  return ret;
+}
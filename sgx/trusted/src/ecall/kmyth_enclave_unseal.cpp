@@ -6,14 +6,49 @@
 
 #include "sgx_trts.h"
 #include "sgx_tseal.h"
+#include "sgx_lfence.h"
 #include "sgx_thread.h"
 
 #include "kmyth_enclave_trusted.h"
 #include ENCLAVE_HEADER_TRUSTED
 
-unseal_data_t *kmyth_unsealed_data_table = NULL;
+/**
+ * @brief One stripe of the unsealed data table: an open-addressing (linear
+ *        probing) hash table, keyed by data handle, with its own lock.
+ *        A handle always maps to the same stripe, so operations on
+ *        different stripes never contend with each other.
+ *
+ *        'next_seq' numbers insertions, so that the oldest entry can be
+ *        found for eviction. 'max_count' is the stripe's share of the
+ *        table's maximum size (0 for unlimited).
+ */
+typedef struct unseal_table_stripe_s
+{
+  sgx_thread_mutex_t lock;
+  unseal_data_t *slots;
+  size_t slot_count;
+  size_t count;
+  size_t max_count;
+  uint64_t next_seq;
+} unseal_table_stripe_t;
+
+static unseal_table_stripe_t
+  kmyth_unsealed_data_table[KMYTH_UNSEAL_TABLE_STRIPES];
 static bool kmyth_unsealed_data_table_initialized = false;
-static sgx_thread_mutex_t kmyth_unsealed_data_table_lock;
+
+/**
+ * @brief Reports whether the unseal table is initialized. ECALLs on other
+ *        threads read the flag without holding a stripe lock, so it is
+ *        read (and written) atomically, ordered against the stripes it
+ *        guards.
+ *
+ * @return true if the table is initialized, false otherwise
+ */
+static inline bool unseal_table_ready(void)
+{
+  return __atomic_load_n(&kmyth_unsealed_data_table_initialized,
+                         __ATOMIC_ACQUIRE);
+}
 
 /**
  * @brief Derives the data handle by taking the first 64 bits of the
@@ -69,38 +104,318 @@ static bool derive_handle(uint32_t data_size, uint8_t * data, uint64_t * handle)
   return true;
 }
 
+/**
+ * @brief Mixes the bits of a data handle, so that both the stripe index
+ *        (high bits) and the slot index within a stripe (low bits) are
+ *        well distributed.
+ */
+static uint64_t unseal_table_hash(uint64_t handle)
+{
+  handle ^= handle >> 33;
+  handle *= 0xff51afd7ed558ccdULL;
+  handle ^= handle >> 33;
+  return handle;
+}
+
+static unseal_table_stripe_t *unseal_table_stripe(uint64_t handle)
+{
+  return &kmyth_unsealed_data_table[unseal_table_hash(handle) >>
+                                    (64 - KMYTH_UNSEAL_TABLE_STRIPE_BITS)];
+}
+
+static size_t unseal_table_home(const unseal_table_stripe_t * stripe,
+                                uint64_t handle)
+{
+  return (size_t) unseal_table_hash(handle) & (stripe->slot_count - 1);
+}
+
+/**
+ * @brief Finds the slot holding a handle. The stripe lock must be held.
+ *
+ * @returns the slot index, or stripe->slot_count if the handle is not found.
+ */
+static size_t unseal_table_find(const unseal_table_stripe_t * stripe,
+                                uint64_t handle)
+{
+  if (stripe->count == 0)
+  {
+    return stripe->slot_count;
+  }
+
+  size_t mask = stripe->slot_count - 1;
+  size_t index = unseal_table_home(stripe, handle);
+
+  while (stripe->slots[index].data != NULL)
+  {
+    if (stripe->slots[index].handle == handle)
+    {
+      return index;
+    }
+    index = (index + 1) & mask;
+  }
+  return stripe->slot_count;
+}
+
+/**
+ * @brief Places an entry in the first free slot of its probe sequence.
+ *        The stripe lock must be held and the stripe must have a free slot.
+ */
+static void unseal_table_place(unseal_table_stripe_t * stripe,
+                               const unseal_data_t * entry)
+{
+  size_t mask = stripe->slot_count - 1;
+  size_t index = unseal_table_home(stripe, entry->handle);
+
+  while (stripe->slots[index].data != NULL)
+  {
+    index = (index + 1) & mask;
+  }
+  stripe->slots[index] = *entry;
+}
+
+/**
+ * @brief Doubles the number of slots in a stripe. The stripe lock must
+ *        be held.
+ *
+ * @returns true on success, false on failure.
+ */
+static bool unseal_table_grow(unseal_table_stripe_t * stripe)
+{
+  size_t old_slot_count = stripe->slot_count;
+  unseal_data_t *old_slots = stripe->slots;
+  size_t new_slot_count = (old_slot_count == 0) ?
+    KMYTH_UNSEAL_TABLE_MIN_SLOTS : 2 * old_slot_count;
+  unseal_data_t *new_slots =
+    (unseal_data_t *) calloc(new_slot_count, sizeof(unseal_data_t));
+
+  if (new_slots == NULL)
+  {
+    return false;
+  }
+
+  stripe->slots = new_slots;
+  stripe->slot_count = new_slot_count;
+  for (size_t i = 0; i < old_slot_count; i++)
+  {
+    if (old_slots[i].data != NULL)
+    {
+      unseal_table_place(stripe, &old_slots[i]);
+    }
+  }
+  free(old_slots);
+  return true;
+}
+
+/**
+ * @brief Empties a slot, shifting later entries of the same probe sequence
+ *        back so that lookups never need 'deleted' markers. The slot's data
+ *        is not freed. The stripe lock must be held.
+ */
+static void unseal_table_remove_at(unseal_table_stripe_t * stripe,
+                                   size_t index)
+{
+  size_t mask = stripe->slot_count - 1;
+  size_t hole = index;
+  size_t next = (hole + 1) & mask;
+
+  kmyth_enclave_stats_unseal_removed(stripe->slots[index].data_size);
+  while (stripe->slots[next].data != NULL)
+  {
+    size_t home = unseal_table_home(stripe, stripe->slots[next].handle);
+
+    // the entry can move into the hole unless its home slot lies
+    // (cyclically) after the hole, up to and including its current slot
+    if (((next - home) & mask) >= ((next - hole) & mask))
+    {
+      stripe->slots[hole] = stripe->slots[next];
+      hole = next;
+    }
+    next = (next + 1) & mask;
+  }
+
+  kmyth_enclave_secure_memset(&stripe->slots[hole], 0, sizeof(unseal_data_t));
+  stripe->count--;
+}
+
+/**
+ * @brief Clears, frees, and removes the oldest entry in a stripe. The
+ *        stripe lock must be held and the stripe must not be empty.
+ */
+static void unseal_table_evict_oldest(unseal_table_stripe_t * stripe)
+{
+  size_t oldest = stripe->slot_count;
+
+  for (size_t i = 0; i < stripe->slot_count; i++)
+  {
+    if ((stripe->slots[i].data != NULL) &&
+        ((oldest == stripe->slot_count) ||
+         (stripe->slots[i].seq < stripe->slots[oldest].seq)))
+    {
+      oldest = i;
+    }
+  }
+
+  kmyth_enclave_clear_and_free(stripe->slots[oldest].data,
+                               stripe->slots[oldest].data_size);
+  unseal_table_remove_at(stripe, oldest);
+}
+
 int kmyth_unsealed_data_table_initialize(void)
 {
-  if (sgx_thread_mutex_init(&kmyth_unsealed_data_table_lock, NULL))
+  for (size_t i = 0; i < KMYTH_UNSEAL_TABLE_STRIPES; i++)
   {
-    return -1;
+    unseal_table_stripe_t *stripe = &kmyth_unsealed_data_table[i];
+
+    stripe->slots = NULL;
+    stripe->slot_count = 0;
+    stripe->count = 0;
+    stripe->max_count = 0;
+    stripe->next_seq = 0;
+    if (sgx_thread_mutex_init(&stripe->lock, NULL))
+    {
+      return -1;
+    }
   }
-  kmyth_unsealed_data_table_initialized = true;
+  __atomic_store_n(&kmyth_unsealed_data_table_initialized, true,
+                   __ATOMIC_RELEASE);
   return 0;
 }
 
 int kmyth_unsealed_data_table_cleanup(void)
 {
-  sgx_thread_mutex_lock(&kmyth_unsealed_data_table_lock);
-  unseal_data_t *slot = kmyth_unsealed_data_table;
-  unseal_data_t *next_slot;
+  int ret = 0;
 
-  while (slot != NULL)
+  for (size_t i = 0; i < KMYTH_UNSEAL_TABLE_STRIPES; i++)
   {
-    next_slot = slot->next;
-    free(slot->data);
-    free(slot);
-    slot = next_slot;
+    unseal_table_stripe_t *stripe = &kmyth_unsealed_data_table[i];
+
+    sgx_thread_mutex_lock(&stripe->lock);
+    for (size_t j = 0; j < stripe->slot_count; j++)
+    {
+      if (stripe->slots[j].data != NULL)
+      {
+        kmyth_enclave_stats_unseal_removed(stripe->slots[j].data_size);
+        kmyth_enclave_clear_and_free(stripe->slots[j].data,
+                                     stripe->slots[j].data_size);
+      }
+    }
+    free(stripe->slots);
+    stripe->slots = NULL;
+    stripe->slot_count = 0;
+    stripe->count = 0;
+    sgx_thread_mutex_unlock(&stripe->lock);
+    if (sgx_thread_mutex_destroy(&stripe->lock))
+    {
+      ret = -1;
+    }
   }
-  sgx_thread_mutex_unlock(&kmyth_unsealed_data_table_lock);
-  return sgx_thread_mutex_destroy(&kmyth_unsealed_data_table_lock);
+  __atomic_store_n(&kmyth_unsealed_data_table_initialized, false,
+                   __ATOMIC_RELEASE);
+  return ret;
 }
 
-bool kmyth_unseal_into_enclave(size_t data_size, uint8_t * data,
-                               uint64_t * handle)
+bool kmyth_unsealed_data_table_remove(uint64_t handle)
+{
+  if (!unseal_table_ready())
+  {
+    return false;
+  }
+
+  unseal_table_stripe_t *stripe = unseal_table_stripe(handle);
+
+  sgx_thread_mutex_lock(&stripe->lock);
+  size_t index = unseal_table_find(stripe, handle);
+
+  if (index == stripe->slot_count)
+  {
+    sgx_thread_mutex_unlock(&stripe->lock);
+    return false;
+  }
+  kmyth_enclave_clear_and_free(stripe->slots[index].data,
+                               stripe->slots[index].data_size);
+  unseal_table_remove_at(stripe, index);
+  sgx_thread_mutex_unlock(&stripe->lock);
+  return true;
+}
+
+int kmyth_unsealed_data_table_set_max_entries(size_t max_entries)
+{
+  if (!unseal_table_ready())
+  {
+    return -1;
+  }
+
+  // each stripe gets an equal share of the limit (rounded up), since
+  // handles spread evenly across stripes
+  size_t max_count = (max_entries + KMYTH_UNSEAL_TABLE_STRIPES - 1) /
+    KMYTH_UNSEAL_TABLE_STRIPES;
+
+  for (size_t i = 0; i < KMYTH_UNSEAL_TABLE_STRIPES; i++)
+  {
+    unseal_table_stripe_t *stripe = &kmyth_unsealed_data_table[i];
+
+    sgx_thread_mutex_lock(&stripe->lock);
+    stripe->max_count = max_count;
+    while ((max_count != 0) && (stripe->count > max_count))
+    {
+      unseal_table_evict_oldest(stripe);
+    }
+    sgx_thread_mutex_unlock(&stripe->lock);
+  }
+  return 0;
+}
+
+size_t get_unseal_table_entry_count(void)
 {
+  size_t count = 0;
 
-  if (!kmyth_unsealed_data_table_initialized)
+  if (!unseal_table_ready())
+  {
+    return 0;
+  }
+
+  for (size_t i = 0; i < KMYTH_UNSEAL_TABLE_STRIPES; i++)
+  {
+    unseal_table_stripe_t *stripe = &kmyth_unsealed_data_table[i];
+
+    sgx_thread_mutex_lock(&stripe->lock);
+    count += stripe->count;
+    sgx_thread_mutex_unlock(&stripe->lock);
+  }
+  return count;
+}
+
+size_t get_unseal_table_data_size(uint64_t handle)
+{
+  if (!unseal_table_ready())
+  {
+    return 0;
+  }
+
+  unseal_table_stripe_t *stripe = unseal_table_stripe(handle);
+  size_t data_size = 0;
+
+  sgx_thread_mutex_lock(&stripe->lock);
+  size_t index = unseal_table_find(stripe, handle);
+
+  if (index != stripe->slot_count)
+  {
+    data_size = stripe->slots[index].data_size;
+  }
+  sgx_thread_mutex_unlock(&stripe->lock);
+  return data_size;
+}
+
+/**
+ * @brief Unseals one blob into the unsealed data table - the work of the
+ *        kmyth_unseal_into_enclave() ECALL, also done for each blob of
+ *        kmyth_unseal_batch_into_enclave() (without counting as a call to
+ *        the former).
+ */
+static bool unseal_into_enclave(size_t data_size, uint8_t * data,
+                                uint64_t * handle)
+{
+  if (!unseal_table_ready())
   {
     return false;
   }
@@ -140,12 +455,198 @@ bool kmyth_unseal_into_enclave(size_t data_size, uint8_t * data,
   return insert_into_unseal_table(plaintext_data, plaintext_data_size, handle);
 }
 
+bool kmyth_unseal_into_enclave(size_t data_size, uint8_t * data,
+                               uint64_t * handle)
+{
+  kmyth_enclave_stats_count_ecall(KMYTH_SGX_ECALL_UNSEAL);
+  return unseal_into_enclave(data_size, data, handle);
+}
+
+int kmyth_unseal_batch_into_enclave(uint8_t * data, size_t data_total,
+                                    const size_t *data_sizes,
+                                    uint64_t * handles, int *status,
+                                    size_t count)
+{
+  kmyth_enclave_stats_count_ecall(KMYTH_SGX_ECALL_UNSEAL_BATCH);
+  if (count == 0)
+  {
+    return 0;
+  }
+  if (!unseal_table_ready() || data == NULL
+      || data_sizes == NULL || handles == NULL || status == NULL)
+  {
+    return -1;
+  }
+
+  size_t offset = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    handles[i] = 0;
+    status[i] = 1;
+    if (data_sizes[i] > data_total - offset)
+    {
+      // the remaining blobs cannot be located either
+      for (size_t j = i + 1; j < count; j++)
+      {
+        handles[j] = 0;
+        status[j] = 1;
+      }
+      break;
+    }
+
+    // the blobs are packed together, so make sure that the lengths each
+    // one declares stay within its own bytes before unsealing it
+    sgx_sealed_data_t *blob = (sgx_sealed_data_t *) (data + offset);
+
+    if (data_sizes[i] >= sizeof(sgx_sealed_data_t)
+        && sgx_calc_sealed_data_size(sgx_get_add_mac_txt_len(blob),
+                                     sgx_get_encrypt_txt_len(blob))
+        == data_sizes[i])
+    {
+      status[i] = unseal_into_enclave(data_sizes[i], data + offset,
+                                      &handles[i]) ? 0 : 1;
+    }
+    offset += data_sizes[i];
+  }
+
+  return 0;
+}
+
+// `data` is user_check: each piece is copied into the enclave (header
+// first, to find its size) before it is checked and unsealed
+bool kmyth_unseal_chunked_into_enclave(const uint8_t * data, size_t data_size,
+                                       uint64_t * handle)
+{
+  kmyth_enclave_stats_count_ecall(KMYTH_SGX_ECALL_UNSEAL_CHUNKED);
+  if (!unseal_table_ready())
+  {
+    return false;
+  }
+
+  if (data_size == 0 || data == NULL || handle == NULL
+      || !sgx_is_outside_enclave(data, data_size))
+  {
+    return false;
+  }
+
+  // Retire the check on `data`
+  sgx_lfence();
+
+  uint32_t max_sealed_size =
+    sgx_calc_sealed_data_size(sizeof(seal_chunk_header_t),
+                              KMYTH_SGX_SEAL_CHUNK_SIZE);
+  sgx_sealed_data_t *sealed = (sgx_sealed_data_t *) malloc(max_sealed_size);
+  uint8_t *chunk = (uint8_t *) malloc(KMYTH_SGX_SEAL_CHUNK_SIZE);
+  uint8_t *plaintext_data = NULL;
+  seal_chunk_header_t first = { };
+  seal_chunk_header_t header;
+  size_t offset = 0;
+  size_t plaintext_offset = 0;
+  uint32_t index = 0;
+  bool ok = (sealed != NULL && chunk != NULL);
+
+  while (ok && offset < data_size)
+  {
+    // copy the fixed part in once, so the lengths checked are the lengths
+    // used, then the rest of the piece
+    ok = (data_size - offset >= sizeof(sgx_sealed_data_t));
+    if (!ok)
+    {
+      break;
+    }
+    memcpy(sealed, data + offset, sizeof(sgx_sealed_data_t));
+
+    uint32_t mac_len = sgx_get_add_mac_txt_len(sealed);
+    uint32_t chunk_size = sgx_get_encrypt_txt_len(sealed);
+    uint32_t sealed_size = sgx_calc_sealed_data_size(mac_len, chunk_size);
+
+    ok = (mac_len == sizeof(seal_chunk_header_t)
+          && chunk_size <= KMYTH_SGX_SEAL_CHUNK_SIZE
+          && sealed_size <= max_sealed_size
+          && sealed_size <= data_size - offset);
+    if (!ok)
+    {
+      break;
+    }
+
+    // Retire the checks on the lengths before they are used
+    sgx_lfence();
+
+    memcpy((uint8_t *) sealed + sizeof(sgx_sealed_data_t),
+           data + offset + sizeof(sgx_sealed_data_t),
+           sealed_size - sizeof(sgx_sealed_data_t));
+    ok = (sgx_unseal_data(sealed, (uint8_t *) & header, &mac_len, chunk,
+                          &chunk_size) == SGX_SUCCESS);
+    if (!ok)
+    {
+      break;
+    }
+
+    // the (authenticated) header must place this piece next in the
+    // payload the first piece began
+    if (index == 0)
+    {
+      first = header;
+      ok = (header.count > 0 && header.total_size > 0
+            && header.total_size <= UINT32_MAX
+            && (header.total_size - 1) / KMYTH_SGX_SEAL_CHUNK_SIZE + 1
+            == header.count);
+      plaintext_data = ok ? (uint8_t *) malloc(header.total_size) : NULL;
+      ok = (plaintext_data != NULL);
+    }
+    else
+    {
+      ok = (memcmp(header.stream_id, first.stream_id,
+                   sizeof(first.stream_id)) == 0
+            && header.total_size == first.total_size
+            && header.count == first.count);
+    }
+    ok = ok && header.index == index && index < first.count
+      && chunk_size == ((index + 1 < first.count) ?
+                        KMYTH_SGX_SEAL_CHUNK_SIZE :
+                        first.total_size - plaintext_offset);
+    if (!ok)
+    {
+      break;
+    }
+    memcpy(plaintext_data + plaintext_offset, chunk, chunk_size);
+    plaintext_offset += chunk_size;
+    offset += sealed_size;
+    index++;
+  }
+
+  // every piece must be present, and nothing may follow the last one
+  ok = ok && index > 0 && index == first.count && offset == data_size;
+
+  free(sealed);
+  if (chunk != NULL)
+  {
+    kmyth_enclave_clear_and_free(chunk, KMYTH_SGX_SEAL_CHUNK_SIZE);
+  }
+  if (!ok)
+  {
+    if (plaintext_data != NULL)
+    {
+      kmyth_enclave_clear_and_free(plaintext_data, first.total_size);
+    }
+    return false;
+  }
+
+  // handle gets set in insert_into_unseal_table
+  return insert_into_unseal_table(plaintext_data, (uint32_t) first.total_size,
+                                  handle);
+}
+
 bool insert_into_unseal_table(uint8_t * data, uint32_t data_size,
                               uint64_t * handle)
 {
-  if (!kmyth_unsealed_data_table_initialized)
+  if (!unseal_table_ready())
   {
-    if( data != NULL) free(data);
+    if (data != NULL && data_size != UINT32_MAX)
+    {
+      kmyth_enclave_clear_and_free(data, data_size);
+    }
     return false;
   }
 
@@ -157,75 +658,69 @@ bool insert_into_unseal_table(uint8_t * data, uint32_t data_size,
     return false;
   }
 
-  unseal_data_t *new_slot = (unseal_data_t *) malloc(sizeof(unseal_data_t));
+  unseal_data_t new_entry;
 
-  if (new_slot == NULL)
+  if (!derive_handle(data_size, data, &new_entry.handle))
   {
-    if (data != NULL) free(data);
+    kmyth_enclave_clear_and_free(data, data_size);
     return false;
   }
+  new_entry.data_size = data_size;
+  new_entry.data = data;
+
+  unseal_table_stripe_t *stripe = unseal_table_stripe(new_entry.handle);
 
-  if (!derive_handle(data_size, data, &new_slot->handle))
+  sgx_thread_mutex_lock(&stripe->lock);
+
+  // make room: evict the oldest entry if the stripe is at its limit, and
+  // keep the load factor at or below one half
+  if ((stripe->max_count != 0) && (stripe->count >= stripe->max_count))
   {
-    if (data != NULL) free(data);
-    free(new_slot);
-    return false;
+    unseal_table_evict_oldest(stripe);
   }
-
-  new_slot->data_size = data_size;
-  new_slot->data = data;
-  if (new_slot->data == NULL)
+  if (2 * (stripe->count + 1) > stripe->slot_count)
   {
-    if (data != NULL) free(data);
-    free(new_slot);
-    return false;
+    if (!unseal_table_grow(stripe))
+    {
+      sgx_thread_mutex_unlock(&stripe->lock);
+      kmyth_enclave_clear_and_free(data, data_size);
+      return false;
+    }
   }
 
-  sgx_thread_mutex_lock(&kmyth_unsealed_data_table_lock);
-  new_slot->next = kmyth_unsealed_data_table;
-  kmyth_unsealed_data_table = new_slot;
-  sgx_thread_mutex_unlock(&kmyth_unsealed_data_table_lock);
-  *handle = new_slot->handle;
+  new_entry.seq = stripe->next_seq++;
+  unseal_table_place(stripe, &new_entry);
+  stripe->count++;
+  kmyth_enclave_stats_unseal_added(data_size);
+  sgx_thread_mutex_unlock(&stripe->lock);
+
+  *handle = new_entry.handle;
   return true;
 }
 
 size_t retrieve_from_unseal_table(uint64_t handle, uint8_t ** buf)
 {
-  if (!kmyth_unsealed_data_table_initialized)
+  if (!unseal_table_ready())
   {
     return 0;
   }
 
-  unseal_data_t *slot = kmyth_unsealed_data_table;
-  unseal_data_t *prev_slot = NULL;
+  unseal_table_stripe_t *stripe = unseal_table_stripe(handle);
 
-  sgx_thread_mutex_lock(&kmyth_unsealed_data_table_lock);
-  while (slot != NULL && slot->handle != handle)
-  {
-    prev_slot = slot;
-    slot = slot->next;
-  }
+  sgx_thread_mutex_lock(&stripe->lock);
+  size_t index = unseal_table_find(stripe, handle);
 
-  if (slot == NULL)
+  if (index == stripe->slot_count)
   {
-    sgx_thread_mutex_unlock(&kmyth_unsealed_data_table_lock);
+    sgx_thread_mutex_unlock(&stripe->lock);
     return 0;
   }
 
-  if (prev_slot != NULL)
-  {
-    prev_slot->next = slot->next;
-  }
-  else
-  {
-    kmyth_unsealed_data_table = slot->next;
-  }
-  sgx_thread_mutex_unlock(&kmyth_unsealed_data_table_lock);
-  *buf = (uint8_t *) malloc(slot->data_size);
-  memcpy(*buf, slot->data, slot->data_size);
-  size_t data_size = slot->data_size;
+  // the caller takes ownership of the entry's data buffer
+  *buf = stripe->slots[index].data;
+  size_t data_size = stripe->slots[index].data_size;
 
-  free(slot->data);
-  free(slot);
+  unseal_table_remove_at(stripe, index);
+  sgx_thread_mutex_unlock(&stripe->lock);
   return data_size;
 }
@@ -0,0 +1,187 @@
+/**
+ * kmyth_enclave_cred_cache.c:
+ *
+ * C library caching the parsed signing keys and certificates passed in to
+ * a kmyth SGX enclave's 'retrieve key' sessions
+ */
+
+#include "kmyth_enclave_trusted.h"
+
+#include <openssl/sha.h>
+
+#include "sgx_thread.h"
+
+// A cache entry: a private key ('cert' is NULL) or a certificate ('pkey' is
+// NULL), and the hash of the DER encoding it was parsed from.
+typedef struct kmyth_enclave_cred_s
+{
+  unsigned char hash[SHA256_DIGEST_LENGTH];
+  EVP_PKEY *pkey;
+  X509 *cert;
+} kmyth_enclave_cred_t;
+
+// The cache, shared by the enclave's threads. When it is full, entries are
+// replaced in the order they were added.
+static kmyth_enclave_cred_t
+  kmyth_enclave_cred_cache[KMYTH_ENCLAVE_CRED_CACHE_SIZE];
+static size_t kmyth_enclave_cred_cache_next = 0;
+static sgx_thread_mutex_t kmyth_enclave_cred_cache_lock =
+  SGX_THREAD_MUTEX_INITIALIZER;
+
+//############################################################################
+// kmyth_enclave_cred_free()
+//############################################################################
+static void kmyth_enclave_cred_free(kmyth_enclave_cred_t * cred)
+{
+  EVP_PKEY_free(cred->pkey);
+  X509_free(cred->cert);
+  kmyth_enclave_clear(cred, sizeof(kmyth_enclave_cred_t));
+}
+
+//############################################################################
+// kmyth_enclave_cred_cache_find()
+//############################################################################
+static kmyth_enclave_cred_t *kmyth_enclave_cred_cache_find(const unsigned char
+                                                           *hash,
+                                                           bool is_cert)
+{
+  for (size_t i = 0; i < KMYTH_ENCLAVE_CRED_CACHE_SIZE; i++)
+  {
+    kmyth_enclave_cred_t *cred = &kmyth_enclave_cred_cache[i];
+
+    if ((is_cert ? (cred->cert != NULL) : (cred->pkey != NULL))
+        && memcmp(cred->hash, hash, SHA256_DIGEST_LENGTH) == 0)
+    {
+      return cred;
+    }
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// kmyth_enclave_cred_cache_get()
+//############################################################################
+static int kmyth_enclave_cred_cache_get(uint8_t * der_bytes, size_t der_len,
+                                        EVP_PKEY ** pkey, X509 ** cert)
+{
+  unsigned char hash[SHA256_DIGEST_LENGTH];
+  bool is_cert = (cert != NULL);
+
+  if (der_bytes == NULL || der_len == 0
+      || SHA256(der_bytes, der_len, hash) == NULL)
+  {
+    return EXIT_FAILURE;
+  }
+
+  // a cached entry is shared: the caller gets its own reference to it
+  sgx_thread_mutex_lock(&kmyth_enclave_cred_cache_lock);
+
+  kmyth_enclave_cred_t *cred = kmyth_enclave_cred_cache_find(hash, is_cert);
+
+  if (cred != NULL)
+  {
+    if (is_cert)
+    {
+      X509_up_ref(cred->cert);
+      *cert = cred->cert;
+    }
+    else
+    {
+      EVP_PKEY_up_ref(cred->pkey);
+      *pkey = cred->pkey;
+    }
+  }
+  sgx_thread_mutex_unlock(&kmyth_enclave_cred_cache_lock);
+  if (cred != NULL)
+  {
+    kmyth_sgx_log(LOG_DEBUG, is_cert ? "took certificate from cache" :
+                  "took private key from cache");
+    return EXIT_SUCCESS;
+  }
+
+  // parsed without holding the cache's lock
+  kmyth_enclave_cred_t parsed = { {0}, NULL, NULL };
+
+  memcpy(parsed.hash, hash, SHA256_DIGEST_LENGTH);
+  if (is_cert)
+  {
+    if (EXIT_SUCCESS != unmarshal_ec_der_to_x509(der_bytes, der_len,
+                                                 &parsed.cert))
+    {
+      X509_free(parsed.cert);
+      return EXIT_FAILURE;
+    }
+
+    // decode (and so cache) the public key while the certificate is new
+    if (X509_get0_pubkey(parsed.cert) == NULL)
+    {
+      X509_free(parsed.cert);
+      return EXIT_FAILURE;
+    }
+    *cert = parsed.cert;
+    X509_up_ref(parsed.cert);
+  }
+  else
+  {
+    if (EXIT_SUCCESS != unmarshal_ec_der_to_pkey(der_bytes, der_len,
+                                                 &parsed.pkey))
+    {
+      EVP_PKEY_free(parsed.pkey);
+      return EXIT_FAILURE;
+    }
+    *pkey = parsed.pkey;
+    EVP_PKEY_up_ref(parsed.pkey);
+  }
+
+  // another thread may have added the same entry in the meantime
+  sgx_thread_mutex_lock(&kmyth_enclave_cred_cache_lock);
+  if (kmyth_enclave_cred_cache_find(hash, is_cert) == NULL)
+  {
+    cred = &kmyth_enclave_cred_cache[kmyth_enclave_cred_cache_next];
+    kmyth_enclave_cred_cache_next =
+      (kmyth_enclave_cred_cache_next + 1) % KMYTH_ENCLAVE_CRED_CACHE_SIZE;
+    kmyth_enclave_cred_free(cred);
+    *cred = parsed;
+    parsed.pkey = NULL;
+    parsed.cert = NULL;
+  }
+  sgx_thread_mutex_unlock(&kmyth_enclave_cred_cache_lock);
+  kmyth_enclave_cred_free(&parsed);
+
+  return EXIT_SUCCESS;
+}
+
+//############################################################################
+// kmyth_enclave_cred_cache_get_pkey()
+//############################################################################
+int kmyth_enclave_cred_cache_get_pkey(uint8_t * der_bytes, size_t der_len,
+                                      EVP_PKEY ** pkey)
+{
+  *pkey = NULL;
+  return kmyth_enclave_cred_cache_get(der_bytes, der_len, pkey, NULL);
+}
+
+//############################################################################
+// kmyth_enclave_cred_cache_get_x509()
+//############################################################################
+int kmyth_enclave_cred_cache_get_x509(uint8_t * der_bytes, size_t der_len,
+                                      X509 ** cert)
+{
+  *cert = NULL;
+  return kmyth_enclave_cred_cache_get(der_bytes, der_len, NULL, cert);
+}
+
+//############################################################################
+// kmyth_enclave_cred_cache_clear()
+//############################################################################
+void kmyth_enclave_cred_cache_clear(void)
+{
+  sgx_thread_mutex_lock(&kmyth_enclave_cred_cache_lock);
+  for (size_t i = 0; i < KMYTH_ENCLAVE_CRED_CACHE_SIZE; i++)
+  {
+    kmyth_enclave_cred_free(&kmyth_enclave_cred_cache[i]);
+  }
+  kmyth_enclave_cred_cache_next = 0;
+  sgx_thread_mutex_unlock(&kmyth_enclave_cred_cache_lock);
+}
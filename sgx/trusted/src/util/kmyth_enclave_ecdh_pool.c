@@ -0,0 +1,102 @@
+/**
+ * kmyth_enclave_ecdh_pool.c:
+ *
+ * C library holding ephemeral ECDH key pairs generated ahead of time
+ * inside a kmyth SGX enclave
+ */
+
+#include "kmyth_enclave_trusted.h"
+
+#include "sgx_thread.h"
+
+// The pool, shared by the enclave's threads. Key pairs are taken from (and
+// added to) the end of the array.
+static EVP_PKEY *kmyth_enclave_ecdh_pool[KMYTH_ECDH_EPHEMERAL_POOL_SIZE];
+static size_t kmyth_enclave_ecdh_pool_count = 0;
+static sgx_thread_mutex_t kmyth_enclave_ecdh_pool_lock =
+  SGX_THREAD_MUTEX_INITIALIZER;
+
+//############################################################################
+// kmyth_enclave_ecdh_pool_fill()
+//############################################################################
+int kmyth_enclave_ecdh_pool_fill(size_t count)
+{
+  if (count > KMYTH_ECDH_EPHEMERAL_POOL_SIZE)
+  {
+    count = KMYTH_ECDH_EPHEMERAL_POOL_SIZE;
+  }
+
+  while (true)
+  {
+    sgx_thread_mutex_lock(&kmyth_enclave_ecdh_pool_lock);
+    bool filled = (kmyth_enclave_ecdh_pool_count >= count);
+
+    sgx_thread_mutex_unlock(&kmyth_enclave_ecdh_pool_lock);
+    if (filled)
+    {
+      return EXIT_SUCCESS;
+    }
+
+    EVP_PKEY *keypair = NULL;
+
+    if (EXIT_SUCCESS != create_ecdh_ephemeral_keypair(KMYTH_ECDH_DEFAULT_GROUP,
+                                                      &keypair))
+    {
+      kmyth_sgx_log(LOG_ERR, "failed to generate pooled ephemeral key pair");
+      EVP_PKEY_free(keypair);
+      return EXIT_FAILURE;
+    }
+
+    // another thread may have filled the pool in the meantime
+    sgx_thread_mutex_lock(&kmyth_enclave_ecdh_pool_lock);
+    if (kmyth_enclave_ecdh_pool_count < count)
+    {
+      kmyth_enclave_ecdh_pool[kmyth_enclave_ecdh_pool_count++] = keypair;
+      keypair = NULL;
+    }
+    sgx_thread_mutex_unlock(&kmyth_enclave_ecdh_pool_lock);
+    EVP_PKEY_free(keypair);
+  }
+}
+
+//############################################################################
+// kmyth_enclave_ecdh_pool_take()
+//############################################################################
+int kmyth_enclave_ecdh_pool_take(EVP_PKEY ** keypair)
+{
+  *keypair = NULL;
+
+  sgx_thread_mutex_lock(&kmyth_enclave_ecdh_pool_lock);
+  if (kmyth_enclave_ecdh_pool_count > 0)
+  {
+    kmyth_enclave_ecdh_pool_count--;
+    *keypair = kmyth_enclave_ecdh_pool[kmyth_enclave_ecdh_pool_count];
+    kmyth_enclave_ecdh_pool[kmyth_enclave_ecdh_pool_count] = NULL;
+  }
+  sgx_thread_mutex_unlock(&kmyth_enclave_ecdh_pool_lock);
+
+  if (*keypair != NULL)
+  {
+    kmyth_sgx_log(LOG_DEBUG, "took ephemeral key pair from pool");
+    return EXIT_SUCCESS;
+  }
+
+  // an empty pool only costs the session the time it would have spent
+  // without one
+  return create_ecdh_ephemeral_keypair(KMYTH_ECDH_DEFAULT_GROUP, keypair);
+}
+
+//############################################################################
+// kmyth_enclave_ecdh_pool_clear()
+//############################################################################
+void kmyth_enclave_ecdh_pool_clear(void)
+{
+  sgx_thread_mutex_lock(&kmyth_enclave_ecdh_pool_lock);
+  while (kmyth_enclave_ecdh_pool_count > 0)
+  {
+    kmyth_enclave_ecdh_pool_count--;
+    EVP_PKEY_free(kmyth_enclave_ecdh_pool[kmyth_enclave_ecdh_pool_count]);
+    kmyth_enclave_ecdh_pool[kmyth_enclave_ecdh_pool_count] = NULL;
+  }
+  sgx_thread_mutex_unlock(&kmyth_enclave_ecdh_pool_lock);
+}
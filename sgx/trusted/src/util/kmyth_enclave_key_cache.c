@@ -0,0 +1,247 @@
+/**
+ * kmyth_enclave_key_cache.c:
+ *
+ * C library caching, by KMIP key ID, the keys a kmyth SGX enclave retrieves
+ * from the key server (holding them in the unsealed data table)
+ */
+
+#include "kmyth_enclave_trusted.h"
+
+#include "sgx_thread.h"
+
+// A cache entry: a key ID ('key_id' is NULL for an empty entry) and the
+// unsealed data table entry holding its key, along with the time the key
+// was retrieved and the time it expires.
+typedef struct kmyth_enclave_cached_key_s
+{
+  unsigned char *key_id;
+  size_t key_id_len;
+  uint64_t handle;
+  time_t added;
+  time_t expires;
+} kmyth_enclave_cached_key_t;
+
+// The cache, shared by the enclave's threads. It is disabled while
+// 'kmyth_enclave_key_cache_max' is 0.
+static kmyth_enclave_cached_key_t
+  kmyth_enclave_key_cache[KMYTH_ENCLAVE_KEY_CACHE_SIZE];
+static size_t kmyth_enclave_key_cache_max = 0;
+static uint64_t kmyth_enclave_key_cache_ttl = 0;
+static sgx_thread_mutex_t kmyth_enclave_key_cache_lock =
+  SGX_THREAD_MUTEX_INITIALIZER;
+
+//############################################################################
+// kmyth_enclave_cached_key_free()
+//############################################################################
+// Removes an entry, along with its key (if the unsealed data table still
+// holds it). The cache lock must be held.
+static void kmyth_enclave_cached_key_free(kmyth_enclave_cached_key_t * entry)
+{
+  kmyth_unsealed_data_table_remove(entry->handle);
+  kmyth_enclave_clear_and_free(entry->key_id, entry->key_id_len);
+  kmyth_enclave_clear(entry, sizeof(kmyth_enclave_cached_key_t));
+}
+
+//############################################################################
+// kmyth_enclave_cached_key_live()
+//############################################################################
+// Reports whether an entry's key can still be used: it has not expired
+// (nor, as the time is untrusted, was it added in the future), and the
+// unsealed data table has not dropped it. The cache lock must be held.
+static bool kmyth_enclave_cached_key_live(const kmyth_enclave_cached_key_t *
+                                          entry, time_t now)
+{
+  return (now >= entry->added) && (now < entry->expires)
+    && (get_unseal_table_data_size(entry->handle) != 0);
+}
+
+//############################################################################
+// kmyth_enclave_key_cache_count()
+//############################################################################
+// Counts the entries in use, finding the oldest one. The cache lock must be
+// held.
+static size_t kmyth_enclave_key_cache_count(size_t *oldest)
+{
+  size_t count = 0;
+
+  *oldest = KMYTH_ENCLAVE_KEY_CACHE_SIZE;
+  for (size_t i = 0; i < KMYTH_ENCLAVE_KEY_CACHE_SIZE; i++)
+  {
+    kmyth_enclave_cached_key_t *entry = &kmyth_enclave_key_cache[i];
+
+    if (entry->key_id == NULL)
+    {
+      continue;
+    }
+    count++;
+    if ((*oldest == KMYTH_ENCLAVE_KEY_CACHE_SIZE) ||
+        (entry->added < kmyth_enclave_key_cache[*oldest].added))
+    {
+      *oldest = i;
+    }
+  }
+
+  return count;
+}
+
+//############################################################################
+// kmyth_enclave_key_cache_configure()
+//############################################################################
+void kmyth_enclave_key_cache_configure(size_t max_entries,
+                                       uint64_t ttl_seconds)
+{
+  if (max_entries > KMYTH_ENCLAVE_KEY_CACHE_SIZE)
+  {
+    max_entries = KMYTH_ENCLAVE_KEY_CACHE_SIZE;
+  }
+  if (ttl_seconds > INT32_MAX)
+  {
+    ttl_seconds = INT32_MAX;
+  }
+  if (ttl_seconds == 0)
+  {
+    max_entries = 0;
+  }
+
+  sgx_thread_mutex_lock(&kmyth_enclave_key_cache_lock);
+  size_t oldest = 0;
+
+  while (kmyth_enclave_key_cache_count(&oldest) > max_entries)
+  {
+    kmyth_enclave_cached_key_free(&kmyth_enclave_key_cache[oldest]);
+  }
+  __atomic_store_n(&kmyth_enclave_key_cache_max, max_entries,
+                   __ATOMIC_RELAXED);
+  kmyth_enclave_key_cache_ttl = ttl_seconds;
+  sgx_thread_mutex_unlock(&kmyth_enclave_key_cache_lock);
+}
+
+//############################################################################
+// kmyth_enclave_key_cache_enabled()
+//############################################################################
+bool kmyth_enclave_key_cache_enabled(void)
+{
+  return __atomic_load_n(&kmyth_enclave_key_cache_max, __ATOMIC_RELAXED) > 0;
+}
+
+//############################################################################
+// kmyth_enclave_key_cache_lookup()
+//############################################################################
+bool kmyth_enclave_key_cache_lookup(const unsigned char *key_id,
+                                    size_t key_id_len, time_t now,
+                                    uint64_t * handle)
+{
+  bool found = false;
+
+  sgx_thread_mutex_lock(&kmyth_enclave_key_cache_lock);
+  for (size_t i = 0; i < KMYTH_ENCLAVE_KEY_CACHE_SIZE; i++)
+  {
+    kmyth_enclave_cached_key_t *entry = &kmyth_enclave_key_cache[i];
+
+    if (entry->key_id == NULL || entry->key_id_len != key_id_len
+        || memcmp(entry->key_id, key_id, key_id_len) != 0)
+    {
+      continue;
+    }
+    if (kmyth_enclave_cached_key_live(entry, now))
+    {
+      *handle = entry->handle;
+      found = true;
+    }
+    else
+    {
+      kmyth_enclave_cached_key_free(entry);
+    }
+    break;
+  }
+  sgx_thread_mutex_unlock(&kmyth_enclave_key_cache_lock);
+
+  return found;
+}
+
+//############################################################################
+// kmyth_enclave_key_cache_insert()
+//############################################################################
+void kmyth_enclave_key_cache_insert(const unsigned char *key_id,
+                                    size_t key_id_len,
+                                    const unsigned char *key,
+                                    size_t key_len, time_t now)
+{
+  if (!kmyth_enclave_key_cache_enabled() || key_id_len == 0
+      || key_len == 0 || key_len >= UINT32_MAX)
+  {
+    return;
+  }
+
+  // the unsealed data table takes ownership of (and, when the entry is
+  // removed, clears) its copy of the key
+  unsigned char *id_copy = (unsigned char *) malloc(key_id_len);
+  uint8_t *key_copy = (uint8_t *) malloc(key_len);
+  uint64_t handle = 0;
+
+  if (id_copy == NULL || key_copy == NULL)
+  {
+    free(id_copy);
+    free(key_copy);
+    return;
+  }
+  memcpy(id_copy, key_id, key_id_len);
+  memcpy(key_copy, key, key_len);
+  if (!insert_into_unseal_table(key_copy, (uint32_t) key_len, &handle))
+  {
+    kmyth_enclave_clear_and_free(id_copy, key_id_len);
+    return;
+  }
+
+  sgx_thread_mutex_lock(&kmyth_enclave_key_cache_lock);
+
+  // drop any entry for the same key ID, then any that have expired, and
+  // then (if still full) the oldest
+  size_t free_index = KMYTH_ENCLAVE_KEY_CACHE_SIZE;
+
+  for (size_t i = 0; i < KMYTH_ENCLAVE_KEY_CACHE_SIZE; i++)
+  {
+    kmyth_enclave_cached_key_t *entry = &kmyth_enclave_key_cache[i];
+
+    if (entry->key_id != NULL
+        && ((entry->key_id_len == key_id_len
+             && memcmp(entry->key_id, key_id, key_id_len) == 0)
+            || !kmyth_enclave_cached_key_live(entry, now)))
+    {
+      kmyth_enclave_cached_key_free(entry);
+    }
+    if (entry->key_id == NULL && free_index == KMYTH_ENCLAVE_KEY_CACHE_SIZE)
+    {
+      free_index = i;
+    }
+  }
+
+  size_t oldest = 0;
+
+  while (kmyth_enclave_key_cache_max > 0 &&
+         kmyth_enclave_key_cache_count(&oldest) >=
+         kmyth_enclave_key_cache_max)
+  {
+    kmyth_enclave_cached_key_free(&kmyth_enclave_key_cache[oldest]);
+    free_index = oldest;
+  }
+
+  if (kmyth_enclave_key_cache_max == 0)
+  {
+    // disabled meanwhile
+    sgx_thread_mutex_unlock(&kmyth_enclave_key_cache_lock);
+    kmyth_unsealed_data_table_remove(handle);
+    kmyth_enclave_clear_and_free(id_copy, key_id_len);
+    return;
+  }
+
+  kmyth_enclave_cached_key_t *entry = &kmyth_enclave_key_cache[free_index];
+
+  entry->key_id = id_copy;
+  entry->key_id_len = key_id_len;
+  entry->handle = handle;
+  entry->added = now;
+  entry->expires = (now > INT64_MAX - (int64_t) kmyth_enclave_key_cache_ttl) ?
+    (time_t) INT64_MAX : now + (time_t) kmyth_enclave_key_cache_ttl;
+  sgx_thread_mutex_unlock(&kmyth_enclave_key_cache_lock);
+}
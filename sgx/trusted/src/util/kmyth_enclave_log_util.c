@@ -0,0 +1,120 @@
+/**
+ * kmyth_enclave_log_util.c:
+ *
+ * C library collecting the log records made inside a kmyth SGX enclave,
+ * so that they leave the enclave a batch at a time
+ */
+
+#include "kmyth_enclave_trusted.h"
+
+#include <string.h>
+
+// The log buffer. Each enclave thread (TCS) has its own, so that ECALLs
+// made concurrently neither wait on one another to log nor hold a lock
+// across log_events_ocall(). Records are appended in the order they are
+// made, and passed out - in that order - by log_events_ocall(). Thread-local
+// data does not outlive an ECALL on an unbound TCS, which is why every
+// ECALL that logs flushes the buffer before it returns.
+static __thread uint8_t kmyth_enclave_log_buffer[KMYTH_SGX_LOG_BUFFER_SIZE];
+static __thread size_t kmyth_enclave_log_buffer_len = 0;
+
+//############################################################################
+// kmyth_enclave_log_string_len()
+//############################################################################
+static size_t kmyth_enclave_log_string_len(const char *s, size_t max_len)
+{
+  size_t len = 0;
+
+  if (s == NULL)
+  {
+    return 0;
+  }
+  while (len < max_len && s[len] != '\0')
+  {
+    len++;
+  }
+
+  return len;
+}
+
+//############################################################################
+// kmyth_enclave_log_put_string()
+//############################################################################
+static void kmyth_enclave_log_put_string(const char *s, size_t len)
+{
+  if (len > 0)
+  {
+    memcpy(kmyth_enclave_log_buffer + kmyth_enclave_log_buffer_len, s, len);
+  }
+  kmyth_enclave_log_buffer[kmyth_enclave_log_buffer_len + len] = '\0';
+  kmyth_enclave_log_buffer_len += len + 1;
+}
+
+//############################################################################
+// kmyth_enclave_log_flush_buffer()
+//############################################################################
+static void kmyth_enclave_log_flush_buffer(void)
+{
+  if (kmyth_enclave_log_buffer_len == 0)
+  {
+    return;
+  }
+
+  // there is nowhere to report a failed log OCALL, so its records are lost
+  log_events_ocall(kmyth_enclave_log_buffer, kmyth_enclave_log_buffer_len);
+  kmyth_enclave_log_buffer_len = 0;
+}
+
+//############################################################################
+// kmyth_sgx_log_event()
+//############################################################################
+void kmyth_sgx_log_event(const char *src_file, const char *src_func,
+                         int src_line, int severity, const char *msg)
+{
+  kmyth_sgx_log_record_t record;
+  size_t src_file_len =
+    kmyth_enclave_log_string_len(src_file, KMYTH_SGX_LOG_NAME_MAX_LEN);
+  size_t src_func_len =
+    kmyth_enclave_log_string_len(src_func, KMYTH_SGX_LOG_NAME_MAX_LEN);
+
+  // the message is truncated, if need be, so that the record fits in an
+  // empty buffer
+  size_t msg_max_len = KMYTH_SGX_LOG_BUFFER_SIZE - sizeof(record) -
+    src_file_len - src_func_len - 3;
+  size_t msg_len = kmyth_enclave_log_string_len(msg, msg_max_len);
+  size_t record_len = sizeof(record) + src_file_len + src_func_len +
+    msg_len + 3;
+
+  memset(&record, 0, sizeof(record));
+  record.src_line = (int32_t) src_line;
+  record.severity = (int32_t) severity;
+  record.src_file_len = (uint16_t) src_file_len;
+  record.src_func_len = (uint16_t) src_func_len;
+  record.msg_len = (uint16_t) msg_len;
+
+  if (record_len > KMYTH_SGX_LOG_BUFFER_SIZE - kmyth_enclave_log_buffer_len)
+  {
+    kmyth_enclave_log_flush_buffer();
+  }
+  memcpy(kmyth_enclave_log_buffer + kmyth_enclave_log_buffer_len, &record,
+         sizeof(record));
+  kmyth_enclave_log_buffer_len += sizeof(record);
+  kmyth_enclave_log_put_string(src_file, src_file_len);
+  kmyth_enclave_log_put_string(src_func, src_func_len);
+  kmyth_enclave_log_put_string(msg, msg_len);
+
+  // errors are passed out straight away, in case the enclave goes no
+  // further
+  if (severity <= LOG_ERR)
+  {
+    kmyth_enclave_log_flush_buffer();
+  }
+}
+
+//############################################################################
+// kmyth_enclave_log_flush()
+//############################################################################
+void kmyth_enclave_log_flush(void)
+{
+  kmyth_enclave_log_flush_buffer();
+}
@@ -0,0 +1,214 @@
+/**
+ * kmyth_enclave_stats.c:
+ *
+ * C library keeping the instrumentation counters of a kmyth SGX enclave
+ */
+
+#include "kmyth_enclave_trusted.h"
+
+#include <openssl/crypto.h>
+
+// Bytes in front of each OpenSSL allocation, recording its size (kept at
+// 16 so that the memory handed out stays as aligned as malloc()'s)
+#define KMYTH_ENCLAVE_STATS_ALLOC_HEADER 16
+
+// The counters, shared by the enclave's threads. They are only ever
+// updated atomically, so no lock is needed.
+static kmyth_sgx_enclave_stats_t kmyth_enclave_stats;
+
+//############################################################################
+// stats_raise_peak()
+//############################################################################
+static void stats_raise_peak(uint64_t * peak, uint64_t value)
+{
+  uint64_t current = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+  while (value > current &&
+         !__atomic_compare_exchange_n(peak, &current, value, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+  }
+}
+
+//############################################################################
+// stats_crypto_malloc()
+//############################################################################
+static void *stats_crypto_malloc(size_t num, const char *file, int line)
+{
+  (void) file;
+  (void) line;
+
+  if (num > SIZE_MAX - KMYTH_ENCLAVE_STATS_ALLOC_HEADER)
+  {
+    return NULL;
+  }
+
+  uint8_t *block = (uint8_t *) malloc(num + KMYTH_ENCLAVE_STATS_ALLOC_HEADER);
+
+  if (block == NULL)
+  {
+    return NULL;
+  }
+  *(size_t *) block = num;
+  stats_raise_peak(&kmyth_enclave_stats.crypto_peak_bytes,
+                   __atomic_add_fetch(&kmyth_enclave_stats.crypto_bytes,
+                                      (uint64_t) num, __ATOMIC_RELAXED));
+
+  return block + KMYTH_ENCLAVE_STATS_ALLOC_HEADER;
+}
+
+//############################################################################
+// stats_crypto_free()
+//############################################################################
+static void stats_crypto_free(void *ptr, const char *file, int line)
+{
+  (void) file;
+  (void) line;
+
+  if (ptr == NULL)
+  {
+    return;
+  }
+
+  uint8_t *block = (uint8_t *) ptr - KMYTH_ENCLAVE_STATS_ALLOC_HEADER;
+
+  __atomic_sub_fetch(&kmyth_enclave_stats.crypto_bytes,
+                     (uint64_t) * (size_t *) block, __ATOMIC_RELAXED);
+  free(block);
+}
+
+//############################################################################
+// stats_crypto_realloc()
+//############################################################################
+static void *stats_crypto_realloc(void *ptr, size_t num, const char *file,
+                                  int line)
+{
+  if (ptr == NULL)
+  {
+    return stats_crypto_malloc(num, file, line);
+  }
+  if (num == 0)
+  {
+    stats_crypto_free(ptr, file, line);
+    return NULL;
+  }
+  if (num > SIZE_MAX - KMYTH_ENCLAVE_STATS_ALLOC_HEADER)
+  {
+    return NULL;
+  }
+
+  uint8_t *block = (uint8_t *) ptr - KMYTH_ENCLAVE_STATS_ALLOC_HEADER;
+  size_t old_num = *(size_t *) block;
+
+  block = (uint8_t *) realloc(block, num + KMYTH_ENCLAVE_STATS_ALLOC_HEADER);
+  if (block == NULL)
+  {
+    return NULL;
+  }
+  *(size_t *) block = num;
+  if (num > old_num)
+  {
+    stats_raise_peak(&kmyth_enclave_stats.crypto_peak_bytes,
+                     __atomic_add_fetch(&kmyth_enclave_stats.crypto_bytes,
+                                        (uint64_t) (num - old_num),
+                                        __ATOMIC_RELAXED));
+  }
+  else
+  {
+    __atomic_sub_fetch(&kmyth_enclave_stats.crypto_bytes,
+                       (uint64_t) (old_num - num), __ATOMIC_RELAXED);
+  }
+
+  return block + KMYTH_ENCLAVE_STATS_ALLOC_HEADER;
+}
+
+//############################################################################
+// kmyth_enclave_stats_init()
+//############################################################################
+// OpenSSL only accepts allocation hooks before it has allocated anything,
+// so they are installed as the enclave is initialized. If it is too late
+// (or the library refuses them), the OpenSSL heap is simply not reported.
+__attribute__((constructor))
+static void kmyth_enclave_stats_init(void)
+{
+  if (CRYPTO_set_mem_functions(stats_crypto_malloc, stats_crypto_realloc,
+                               stats_crypto_free))
+  {
+    __atomic_store_n(&kmyth_enclave_stats.crypto_tracked, 1,
+                     __ATOMIC_RELAXED);
+  }
+}
+
+//############################################################################
+// kmyth_enclave_stats_count_ecall()
+//############################################################################
+void kmyth_enclave_stats_count_ecall(kmyth_sgx_ecall_id_t id)
+{
+  if (id < KMYTH_SGX_ECALL_COUNT)
+  {
+    __atomic_add_fetch(&kmyth_enclave_stats.ecall_calls[id], 1,
+                       __ATOMIC_RELAXED);
+  }
+}
+
+//############################################################################
+// kmyth_enclave_stats_unseal_added()
+//############################################################################
+void kmyth_enclave_stats_unseal_added(size_t data_size)
+{
+  __atomic_add_fetch(&kmyth_enclave_stats.unseal_entries, 1,
+                     __ATOMIC_RELAXED);
+  stats_raise_peak(&kmyth_enclave_stats.unseal_peak_bytes,
+                   __atomic_add_fetch(&kmyth_enclave_stats.unseal_bytes,
+                                      (uint64_t) data_size,
+                                      __ATOMIC_RELAXED));
+}
+
+//############################################################################
+// kmyth_enclave_stats_unseal_removed()
+//############################################################################
+void kmyth_enclave_stats_unseal_removed(size_t data_size)
+{
+  __atomic_sub_fetch(&kmyth_enclave_stats.unseal_entries, 1,
+                     __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&kmyth_enclave_stats.unseal_bytes, (uint64_t) data_size,
+                     __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// kmyth_enclave_stats_get()
+//############################################################################
+void kmyth_enclave_stats_get(kmyth_sgx_enclave_stats_t * stats)
+{
+  stats->unseal_entries =
+    __atomic_load_n(&kmyth_enclave_stats.unseal_entries, __ATOMIC_RELAXED);
+  stats->unseal_bytes =
+    __atomic_load_n(&kmyth_enclave_stats.unseal_bytes, __ATOMIC_RELAXED);
+  stats->unseal_peak_bytes =
+    __atomic_load_n(&kmyth_enclave_stats.unseal_peak_bytes,
+                    __ATOMIC_RELAXED);
+  stats->crypto_bytes =
+    __atomic_load_n(&kmyth_enclave_stats.crypto_bytes, __ATOMIC_RELAXED);
+  stats->crypto_peak_bytes =
+    __atomic_load_n(&kmyth_enclave_stats.crypto_peak_bytes,
+                    __ATOMIC_RELAXED);
+  stats->crypto_tracked =
+    __atomic_load_n(&kmyth_enclave_stats.crypto_tracked, __ATOMIC_RELAXED);
+  for (size_t i = 0; i < KMYTH_SGX_ECALL_COUNT; i++)
+  {
+    stats->ecall_calls[i] =
+      __atomic_load_n(&kmyth_enclave_stats.ecall_calls[i], __ATOMIC_RELAXED);
+  }
+}
+
+// This is the function that gets converted into the ecall.
+int kmyth_enclave_get_stats(kmyth_sgx_enclave_stats_t * stats)
+{
+  if (stats == NULL)
+  {
+    return EXIT_FAILURE;
+  }
+  kmyth_enclave_stats_get(stats);
+
+  return EXIT_SUCCESS;
+}
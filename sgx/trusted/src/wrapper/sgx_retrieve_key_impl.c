@@ -6,58 +6,96 @@
 
 #include "sgx_retrieve_key_impl.h"
 
+#include "sgx_trts.h"
+#include "sgx_lfence.h"
+
 #include "cipher/aes_gcm.h"
 
 #include "kmip_util.h"
 
 //############################################################################
-// enclave_retrieve_key()
+// session_recv_msg()
 //############################################################################
-int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
-                         X509 * client_sign_cert,
-                         X509 * server_sign_cert,
-                         const char *server_host,
-                         size_t server_host_len,
-                         const char *server_port,
-                         size_t server_port_len,
-                         unsigned char *req_key_id,
-                         size_t req_key_id_len,
-                         uint8_t **retrieved_key_id,
-                         size_t *retrieved_key_id_len,
-                         uint8_t **retrieved_key,
-                         size_t *retrieved_key_len)
+static int session_recv_msg(RetrieveKeySession * session, size_t msg_len,
+                            ECDHMessage * msg)
+{
+  // the length comes from untrusted code, so it is checked (and the check
+  // fenced) before the message is read from the receive buffer
+  if (msg_len == 0 || msg_len > KMYTH_ECDH_MAX_MSG_SIZE)
+  {
+    kmyth_sgx_log(LOG_ERR, "received ECDH message length invalid");
+    return EXIT_FAILURE;
+  }
+  sgx_lfence();
+
+  memcpy(session->recv_msg, session->recv_buf, msg_len);
+  msg->hdr.msg_size = (uint16_t) msg_len;
+  msg->body = session->recv_msg;
+
+  return EXIT_SUCCESS;
+}
+
+//############################################################################
+// enclave_retrieve_key_session_open()
+//############################################################################
+int enclave_retrieve_key_session_open(EVP_PKEY * client_sign_privkey,
+                                      X509 * client_sign_cert,
+                                      X509 * server_sign_cert,
+                                      const char *server_host,
+                                      size_t server_host_len,
+                                      const char *server_port,
+                                      size_t server_port_len,
+                                      RetrieveKeySession * session)
 {
   int ret_val;
   sgx_status_t ret_ocall;
 
   char lmsg[MAX_LOG_MSG_LEN] = { 0 };
 
-  // setup socket to support enclave connection to key server
-  int enclave_client_socket_fd = -1;
+  memset(session, 0, sizeof(RetrieveKeySession));
+  session->socket_fd = -1;
+  session->client_sign_privkey = client_sign_privkey;
+  session->server_sign_cert = server_sign_cert;
 
+  // setup socket to support enclave connection to key server
   ret_ocall = setup_socket_ocall(&ret_val,
                                  server_host,
                                  server_host_len,
                                  server_port,
                                  server_port_len,
-                                 &(enclave_client_socket_fd));
+                                 &(session->socket_fd),
+                                 &(session->recv_buf));
   if (ret_ocall != SGX_SUCCESS || ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "client socket setup failed.");
+    session->socket_fd = -1;
+    session->recv_buf = NULL;
     return EXIT_FAILURE;
   }
 
-  // create public and private components of the client's ephemeral
-  // contribution to the session key
+  // the receive buffer must not overlap the enclave, or the untrusted side
+  // could have the enclave's own memory 'received' into
+  session->recv_msg = (unsigned char *) malloc(KMYTH_ECDH_MAX_MSG_SIZE);
+  if (session->recv_buf == NULL || session->recv_msg == NULL
+      || !sgx_is_outside_enclave(session->recv_buf, KMYTH_ECDH_MAX_MSG_SIZE))
+  {
+    kmyth_sgx_log(LOG_ERR, "invalid ECDH receive buffer");
+    enclave_retrieve_key_session_close(session);
+    return EXIT_FAILURE;
+  }
+
+  // get public and private components of the client's ephemeral
+  // contribution to the session key (pre-generated, if the pool has one)
   EVP_PKEY * enclave_ephemeral_keypair = NULL;
-  ret_val = create_ecdh_ephemeral_keypair(&(enclave_ephemeral_keypair));
+  ret_val = kmyth_enclave_ecdh_pool_take(&(enclave_ephemeral_keypair));
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "client ECDH ephemeral creation failed");
     EVP_PKEY_free(enclave_ephemeral_keypair);
+    enclave_retrieve_key_session_close(session);
     return EXIT_FAILURE;
   }
-  kmyth_sgx_log(LOG_DEBUG, "created client-side ephemeral key pair");
+  kmyth_sgx_log(LOG_DEBUG, "got client-side ephemeral key pair");
 
   // compose 'Client Hello' message (client to server key agreement 'request')
   ECDHMessage client_hello_msg = { { 0 }, NULL };
@@ -71,6 +109,7 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
     kmyth_sgx_log(LOG_ERR, "error creating 'Client Hello' message");
     EVP_PKEY_free(enclave_ephemeral_keypair);
     free(client_hello_msg.body);
+    enclave_retrieve_key_session_close(session);
     return EXIT_FAILURE;
   }
 
@@ -84,19 +123,21 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
 
   // exchange 'Client Hello' and 'Server Hello' messages
   ECDHMessage server_hello_msg = { { 0 }, NULL };
+  size_t server_hello_len = 0;
 
   ret_ocall = ecdh_exchange_ocall(&ret_val,
                                   client_hello_msg.body,
                                   client_hello_msg.hdr.msg_size,
-                                  &(server_hello_msg.body),
-                                  (size_t *) &(server_hello_msg.hdr.msg_size),
-                                  enclave_client_socket_fd);
-  if (ret_ocall != SGX_SUCCESS || ret_val != EXIT_SUCCESS)
+                                  session->recv_buf,
+                                  &server_hello_len,
+                                  session->socket_fd);
+  if (ret_ocall != SGX_SUCCESS || ret_val != EXIT_SUCCESS
+      || session_recv_msg(session, server_hello_len, &server_hello_msg))
   {
     kmyth_sgx_log(LOG_ERR, "key agreement message exchange unsuccessful");
     EVP_PKEY_free(enclave_ephemeral_keypair);
     free(client_hello_msg.body);
-    free_ocall((void **) &(server_hello_msg.body));
+    enclave_retrieve_key_session_close(session);
     return EXIT_FAILURE;
   }
 
@@ -109,19 +150,16 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
   kmyth_sgx_log(LOG_DEBUG, lmsg);
 
   // parse out and validate received 'Server Hello' message fields
-  EVP_PKEY * server_ephemeral_pubkey = NULL;
-
   ret_val = parse_server_hello_msg(&(server_hello_msg),
                                    server_sign_cert,
                                    enclave_ephemeral_keypair,
-                                   &(server_ephemeral_pubkey));
+                                   &(session->server_eph_pubkey));
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "'Server Hello' message parse/validate error");
     EVP_PKEY_free(enclave_ephemeral_keypair);
-    EVP_PKEY_free(server_ephemeral_pubkey);
     free(client_hello_msg.body);
-    free_ocall((void **) &(server_hello_msg.body));
+    enclave_retrieve_key_session_close(session);
     return EXIT_FAILURE;
   }
 
@@ -129,16 +167,15 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
   ByteBuffer secret = { 0, NULL };
 
   ret_val = compute_ecdh_shared_secret(enclave_ephemeral_keypair,
-                                       server_ephemeral_pubkey,
+                                       session->server_eph_pubkey,
                                        &(secret.buffer),
                                        &(secret.size));
   if (ret_val)
   {
     kmyth_sgx_log(LOG_ERR, "shared secret computation failed");
     EVP_PKEY_free(enclave_ephemeral_keypair);
-    EVP_PKEY_free(server_ephemeral_pubkey);
     free(client_hello_msg.body);
-    free_ocall((void **) &(server_hello_msg.body));
+    enclave_retrieve_key_session_close(session);
     return EXIT_FAILURE;
   }
   EVP_PKEY_free(enclave_ephemeral_keypair);
@@ -153,74 +190,88 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
   kmyth_sgx_log(LOG_DEBUG, lmsg);
 
   // generate session key result for ECDH key agreement (client side)
-  ByteBuffer request_session_key = { 0, NULL };
-  ByteBuffer response_session_key = { 0, NULL };
-
   ret_val = compute_ecdh_session_key(secret.buffer,
                                      secret.size,
                                      client_hello_msg.body,
                                      client_hello_msg.hdr.msg_size,
                                      server_hello_msg.body,
                                      server_hello_msg.hdr.msg_size,
-                                     &(request_session_key.buffer),
-                                     &(request_session_key.size),
-                                     &(response_session_key.buffer),
-                                     &(response_session_key.size));
+                                     &(session->request_key.buffer),
+                                     &(session->request_key.size),
+                                     &(session->response_key.buffer),
+                                     &(session->response_key.size));
+  kmyth_enclave_clear_and_free(secret.buffer, secret.size);
+  free(client_hello_msg.body);
   if (ret_val)
   {
     kmyth_sgx_log(LOG_ERR, "session key computation failed");
-    kmyth_enclave_clear_and_free(secret.buffer, secret.size);
-    EVP_PKEY_free(server_ephemeral_pubkey);
-    free(client_hello_msg.body);
-    free_ocall((void **) &(server_hello_msg.body));
+    enclave_retrieve_key_session_close(session);
     return EXIT_FAILURE;
   }
-  kmyth_enclave_clear_and_free(secret.buffer, secret.size);
-  free(client_hello_msg.body);
-  free_ocall((void **) &(server_hello_msg.body));
 
   snprintf(lmsg, MAX_LOG_MSG_LEN,
            "'Key Request' key: 0x%02X%02X...%02X%02X (%ld bytes)",
-           request_session_key.buffer[0], request_session_key.buffer[1],
-           request_session_key.buffer[request_session_key.size-2],
-           request_session_key.buffer[request_session_key.size-1],
-           request_session_key.size);
+           session->request_key.buffer[0], session->request_key.buffer[1],
+           session->request_key.buffer[session->request_key.size-2],
+           session->request_key.buffer[session->request_key.size-1],
+           session->request_key.size);
   kmyth_sgx_log(LOG_DEBUG, lmsg);
 
   snprintf(lmsg, MAX_LOG_MSG_LEN,
            "'Key Response' key: 0x%02X%02X...%02X%02X (%ld bytes)",
-           response_session_key.buffer[0],
-           response_session_key.buffer[1],
-           response_session_key.buffer[response_session_key.size-2],
-           response_session_key.buffer[response_session_key.size-1],
-           response_session_key.size);
+           session->response_key.buffer[0],
+           session->response_key.buffer[1],
+           session->response_key.buffer[session->response_key.size-2],
+           session->response_key.buffer[session->response_key.size-1],
+           session->response_key.size);
   kmyth_sgx_log(LOG_DEBUG, lmsg);
 
+  return EXIT_SUCCESS;
+}
+
+//############################################################################
+// enclave_retrieve_key_session_get()
+//############################################################################
+int enclave_retrieve_key_session_get(RetrieveKeySession * session,
+                                     unsigned char *req_key_id,
+                                     size_t req_key_id_len,
+                                     uint8_t **retrieved_key_id,
+                                     size_t *retrieved_key_id_len,
+                                     uint8_t **retrieved_key,
+                                     size_t *retrieved_key_len)
+{
+  int ret_val;
+  sgx_status_t ret_ocall;
+
+  char lmsg[MAX_LOG_MSG_LEN] = { 0 };
+
+  // a session whose sequence numbers have run out cannot safely be reused
+  if (session->next_seq == UINT32_MAX)
+  {
+    kmyth_sgx_log(LOG_ERR, "'Key Request' sequence numbers exhausted");
+    return EXIT_FAILURE;
+  }
+
   // compose 'Key Request' message (client to server request to retrieve key)
   ECDHMessage key_request_msg = { { 0 }, NULL };
   ByteBuffer kmip_key_id = { req_key_id_len, req_key_id };
 
-  ret_val = compose_key_request_msg(client_sign_privkey,
-                                    &(request_session_key),
+  ret_val = compose_key_request_msg(session->client_sign_privkey,
+                                    &(session->request_key),
                                     &kmip_key_id,
-                                    server_ephemeral_pubkey,
+                                    session->server_eph_pubkey,
+                                    session->next_seq,
                                     &key_request_msg);
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "error creating 'Key Request' message");
-    kmyth_enclave_clear_and_free(request_session_key.buffer,
-                                 request_session_key.size);
-    kmyth_enclave_clear_and_free(response_session_key.buffer,
-                                 response_session_key.size);
-    EVP_PKEY_free(server_ephemeral_pubkey);
     free(key_request_msg.body);
     return EXIT_FAILURE;
   }
-  kmyth_enclave_clear_and_free(request_session_key.buffer,
-                               request_session_key.size);
 
   snprintf(lmsg, MAX_LOG_MSG_LEN,
-           "composed Key Request: 0x%02X%02X...%02X%02X (%d bytes)",
+           "composed Key Request %u: 0x%02X%02X...%02X%02X (%d bytes)",
+           session->next_seq,
            key_request_msg.body[0],
            key_request_msg.body[1],
            key_request_msg.body[key_request_msg.hdr.msg_size-2],
@@ -232,12 +283,10 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
   ret_ocall = ecdh_send_msg_ocall(&ret_val,
                                   key_request_msg.body,
                                   key_request_msg.hdr.msg_size,
-                                  enclave_client_socket_fd);
+                                  session->socket_fd);
   if (ret_ocall != SGX_SUCCESS || ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "failed to send the 'Key Request' message");
-    kmyth_enclave_clear_and_free(response_session_key.buffer,
-                                 response_session_key.size);
     free(key_request_msg.body);
     return EXIT_FAILURE;
   }
@@ -245,17 +294,16 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
 
   // receive 'Key Response' message from TLS proxy (server)
   ECDHMessage key_response_msg = { { 0 }, NULL };
+  size_t key_response_len = 0;
 
   ret_ocall = ecdh_recv_msg_ocall(&ret_val,
-                                  &(key_response_msg.body),
-                                  (size_t *) &(key_response_msg.hdr.msg_size),
-                                  enclave_client_socket_fd);
-  if (ret_ocall != SGX_SUCCESS || ret_val != EXIT_SUCCESS)
+                                  session->recv_buf,
+                                  &key_response_len,
+                                  session->socket_fd);
+  if (ret_ocall != SGX_SUCCESS || ret_val != EXIT_SUCCESS
+      || session_recv_msg(session, key_response_len, &key_response_msg))
   {
     kmyth_sgx_log(LOG_ERR, "failed to receive the 'Key Response' message");
-    kmyth_enclave_clear_and_free(response_session_key.buffer,
-                                 response_session_key.size);
-    free_ocall((void **) &(key_response_msg.body));
     return EXIT_FAILURE;
   }
 
@@ -267,25 +315,22 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
            key_response_msg.hdr.msg_size);
   kmyth_sgx_log(LOG_DEBUG, lmsg);
 
-  // parse out and validate received 'Key Response' message fields
+  // parse out and validate received 'Key Response' message fields (the
+  // response must answer this request, so it carries the same number)
   ByteBuffer kmip_response = { 0, NULL };
 
-  ret_val = parse_key_response_msg(server_sign_cert,
-                                   &(response_session_key),
+  ret_val = parse_key_response_msg(session->server_sign_cert,
+                                   &(session->response_key),
                                    &key_response_msg,
+                                   session->next_seq,
                                    &kmip_response);
   if (ret_val != EXIT_SUCCESS)
   {
     kmyth_sgx_log(LOG_ERR, "'Key Response' message parse/validate error");
-    kmyth_enclave_clear_and_free(response_session_key.buffer,
-                                 response_session_key.size);
     kmyth_enclave_clear_and_free(kmip_response.buffer, kmip_response.size);
-    free_ocall((void **) &(key_response_msg.body));
     return EXIT_FAILURE;
   }
-  kmyth_enclave_clear_and_free(response_session_key.buffer,
-                               response_session_key.size);
-  free_ocall((void **) &(key_response_msg.body));
+  session->next_seq++;
 
   snprintf(lmsg, MAX_LOG_MSG_LEN,
            "KMIP 'get key' response = 0x%02X%02X...%02X%02X (%ld bytes)",
@@ -340,4 +385,69 @@ int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
 
   return EXIT_SUCCESS;
 }
- 
+
+//############################################################################
+// enclave_retrieve_key_session_close()
+//############################################################################
+void enclave_retrieve_key_session_close(RetrieveKeySession * session)
+{
+  kmyth_enclave_clear_and_free(session->request_key.buffer,
+                               session->request_key.size);
+  kmyth_enclave_clear_and_free(session->response_key.buffer,
+                               session->response_key.size);
+  EVP_PKEY_free(session->server_eph_pubkey);
+
+  // closing the connection tells the server no more requests will follow
+  if (session->socket_fd >= 0)
+  {
+    close_socket_ocall(session->socket_fd, session->recv_buf);
+  }
+  kmyth_enclave_clear_and_free(session->recv_msg, KMYTH_ECDH_MAX_MSG_SIZE);
+
+  memset(session, 0, sizeof(RetrieveKeySession));
+  session->socket_fd = -1;
+}
+
+//############################################################################
+// enclave_retrieve_key()
+//############################################################################
+int enclave_retrieve_key(EVP_PKEY * client_sign_privkey,
+                         X509 * client_sign_cert,
+                         X509 * server_sign_cert,
+                         const char *server_host,
+                         size_t server_host_len,
+                         const char *server_port,
+                         size_t server_port_len,
+                         unsigned char *req_key_id,
+                         size_t req_key_id_len,
+                         uint8_t **retrieved_key_id,
+                         size_t *retrieved_key_id_len,
+                         uint8_t **retrieved_key,
+                         size_t *retrieved_key_len)
+{
+  RetrieveKeySession session;
+
+  if (EXIT_SUCCESS != enclave_retrieve_key_session_open(client_sign_privkey,
+                                                        client_sign_cert,
+                                                        server_sign_cert,
+                                                        server_host,
+                                                        server_host_len,
+                                                        server_port,
+                                                        server_port_len,
+                                                        &session))
+  {
+    return EXIT_FAILURE;
+  }
+
+  int ret_val = enclave_retrieve_key_session_get(&session,
+                                                 req_key_id,
+                                                 req_key_id_len,
+                                                 retrieved_key_id,
+                                                 retrieved_key_id_len,
+                                                 retrieved_key,
+                                                 retrieved_key_len);
+
+  enclave_retrieve_key_session_close(&session);
+
+  return ret_val;
+}
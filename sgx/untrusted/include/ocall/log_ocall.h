@@ -8,6 +8,9 @@
 #ifndef _KMYTH_LOG_OCALL_H_
 #define _KMYTH_LOG_OCALL_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <kmyth/kmyth_log.h>
 
 #ifdef __cplusplus
@@ -16,28 +19,22 @@ extern "C"
 #endif
 
 /**
- * @brief Supports calling logger from within enclave. Must pass information
- *        about the event out explicitly since we must invoke the logging API
- *        from untrusted space.
- *
- * @param[in] src_file         Source code filename string
- *
- * @param[in] src_func         Function name string
- *
- * @param[in] src_line         Integer specifying source code line number
+ * @brief Supports calling logger from within enclave. Log records are
+ *        collected in a buffer inside the enclave and passed out, a batch
+ *        at a time, since we must invoke the logging API from untrusted
+ *        space. The records are logged in order; a malformed record ends
+ *        the batch.
  *
- * @param[in] severity         Integer representing the severity
- *                             level of the event to be logged.
+ * @param[in] records          The batch of log records, each a
+ *                             kmyth_sgx_log_record_t followed by the
+ *                             (null-terminated) source code filename,
+ *                             function name and message strings.
  *
- * @param[in] msg              String containing the message to be logged.
+ * @param[in] records_len      Length (in bytes) of the batch of records.
  *
  * @return                     None
  */
-  void log_event_ocall(const char *src_file,
-                       const char *src_func,
-                       int src_line,
-                       int severity,
-                       const char *msg);
+  void log_events_ocall(const uint8_t * records, size_t records_len);
 
 #ifdef __cplusplus
 }
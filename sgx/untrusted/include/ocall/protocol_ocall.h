@@ -50,24 +50,35 @@ extern "C"
  *                                        number for a socket connected to
  *                                        the remote key server.
  *
+ * @param[out] recv_buf                   Pointer used to return the address
+ *                                        of the (untrusted) buffer, of
+ *                                        KMYTH_ECDH_MAX_MSG_SIZE bytes, that
+ *                                        every message on the connection is
+ *                                        received into.
+ *
  * @return 0 on success, 1 on failure
  */
   int setup_socket_ocall(const char *server_host,
                          size_t server_host_len,
                          const char *server_port,
                          size_t server_port_len,
-                         int *socket_fd);
+                         int *socket_fd,
+                         unsigned char **recv_buf);
 
 /**
- * @brief Closes a socket connected to the external key server.
+ * @brief Closes a socket connected to the external key server, and frees
+ *        its receive buffer.
  *
  * @param[in] socket_fd                   File descriptor
  *                                        number for a socket connected to
  *                                        the remote key server.
  *
+ * @param[in] recv_buf                    The connection's receive buffer
+ *                                        (from setup_socket_ocall()).
+ *
  * @return None
  */
-  void close_socket_ocall(int socket_fd);
+  void close_socket_ocall(int socket_fd, unsigned char *recv_buf);
 
 /**
  * @brief Gets the current calendar time.
@@ -95,13 +106,9 @@ extern "C"
  * @param[in]  client_hello_len    Length (in bytes) of the 'Client Hello'
  *                                 message to be sent to remote peer
  *
- * @param[out] server_hello        Pointer to 'Server Hello' message (byte
- *                                 array) obtained from the remote peer
- *                                 (TLS proxy for the server) - a pointer
- *                                 to an unallocated buffer (NULL pointer)
- *                                 should be passed to this function, which
- *                                 will allocate memory for and then populate
- *                                 it with the 'Server Hello' message payload
+ * @param[out] recv_buf            The connection's receive buffer (from
+ *                                 setup_socket_ocall()), which the 'Server
+ *                                 Hello' message payload is received into
  *
  * @param[out] server_hello_len    Pointer to length (in bytes) of the 'Server
  *                                 Hello' message to be received from the
@@ -115,7 +122,7 @@ extern "C"
  */
   int ecdh_exchange_ocall(unsigned char *client_hello,
                           size_t client_hello_len,
-                          unsigned char **server_hello,
+                          unsigned char *recv_buf,
                           size_t *server_hello_len,
                           int socket_fd);
 
@@ -139,22 +146,21 @@ extern "C"
 /**
  * @brief Receive a message over the ECDH network connection.
  *
- * @param[out]  encrypted_msg             Pointer used to return the address
- *                                        of an allocated buffer containing
- *                                        the received encrypted message.
+ * @param[out] recv_buf         The connection's receive buffer (from
+ *                              setup_socket_ocall()), which the message
+ *                              is received into.
  *
- * @param[out] encrypted_msg_len          Pointer to length (in bytes)
- *                                        of the encrypted message.
+ * @param[out] msg_len          Pointer to length (in bytes) of the
+ *                              received message.
  *
- * @param[in] socket_fd                   File descriptor number for
- *                                        a network socket with an
- *                                        active ECDH session.
+ * @param[in]  socket_fd        File descriptor number for a network
+ *                              socket with an active ECDH session.
  *
  * @return 0 on success, 1 on failure
  */
-  int ecdh_recv_ocall(unsigned char **encrypted_msg,
-                      size_t *encrypted_msg_len,
-                      int socket_fd);
+  int ecdh_recv_msg_ocall(unsigned char *recv_buf,
+                          size_t *msg_len,
+                          int socket_fd);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,53 @@
+/**
+ * @file enclave_util.h
+ *
+ * @brief Provides headers for creating a kmyth enclave, with untrusted
+ *        worker threads for its switchless OCALLs when the kmyth OCALLs are
+ *        built switchless (SGX_SWITCHLESS=1)
+ */
+
+#ifndef _KMYTH_ENCLAVE_UTIL_H_
+#define _KMYTH_ENCLAVE_UTIL_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "sgx_urts.h"
+
+/**
+ * @brief Default number of untrusted worker threads serving switchless
+ *        OCALLs (set at build time by SGX_SWITCHLESS_WORKERS)
+ */
+#ifndef KMYTH_SGX_SWITCHLESS_WORKERS
+#define KMYTH_SGX_SWITCHLESS_WORKERS 2
+#endif
+
+/**
+ * @brief Environment variable overriding, at run time, the number of
+ *        untrusted worker threads serving switchless OCALLs
+ */
+#define KMYTH_SGX_SWITCHLESS_WORKERS_ENV "KMYTH_SGX_SWITCHLESS_WORKERS"
+
+/**
+ * @brief Creates (loads) a kmyth enclave. If the kmyth OCALLs were built
+ *        switchless, the enclave is created with a pool of untrusted
+ *        worker threads to serve them - KMYTH_SGX_SWITCHLESS_WORKERS, or
+ *        the number given in the KMYTH_SGX_SWITCHLESS_WORKERS_ENV
+ *        environment variable.
+ *
+ * @param[in]  enclave_fn  Enclave (signed shared object) filename
+ *
+ * @param[out] eid         Enclave ID
+ *
+ * @return SGX_SUCCESS on success, an SGX error on failure
+ */
+sgx_status_t kmyth_sgx_create_enclave(const char *enclave_fn,
+                                      sgx_enclave_id_t * eid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _KMYTH_ENCLAVE_UTIL_H_
@@ -14,6 +14,7 @@ extern "C"
 #endif
 
 #include <arpa/inet.h>
+#include <errno.h>
 
 #include <kmyth/kmyth_log.h>
 #include <kmyth/memory_util.h>
@@ -21,9 +22,51 @@ extern "C"
 
 #include "kmyth_enclave_common.h"
 
-
+/**
+ * @brief Receives an ECDH message (its size header, then its body) into a
+ *        newly allocated buffer. Short reads are retried until the whole
+ *        message has arrived.
+ *
+ * @param[in]  socket_fd   Socket connected to the peer
+ *
+ * @param[out] buf         The message body, to be freed by the caller
+ *
+ * @param[out] len         Length (in bytes) of the message body
+ *
+ * @return 0 on success, 1 on failure
+ */
 int recv_ecdh_msg(int socket_fd, unsigned char **buf, size_t *len);
 
+/**
+ * @brief Receives an ECDH message (its size header, then its body) into a
+ *        caller-provided buffer, so that no buffer is allocated per message.
+ *        Short reads are retried until the whole message has arrived.
+ *
+ * @param[in]  socket_fd   Socket connected to the peer
+ *
+ * @param[out] buf         Buffer for the message body
+ *
+ * @param[in]  buf_size    Size (in bytes) of buf - a longer message fails
+ *
+ * @param[out] len         Length (in bytes) of the message body
+ *
+ * @return 0 on success, 1 on failure
+ */
+int recv_ecdh_msg_into(int socket_fd, unsigned char *buf, size_t buf_size,
+                       size_t *len);
+
+/**
+ * @brief Sends an ECDH message (its size header, then its body). Short
+ *        writes are retried until the whole message has been sent.
+ *
+ * @param[in]  socket_fd   Socket connected to the peer
+ *
+ * @param[in]  buf         The message body
+ *
+ * @param[in]  len         Length (in bytes) of the message body
+ *
+ * @return 0 on success, 1 on failure
+ */
 int send_ecdh_msg(int socket_fd, unsigned char *buf, size_t len);
 
 #ifdef __cplusplus
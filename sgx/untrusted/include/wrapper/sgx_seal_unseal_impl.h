@@ -17,6 +17,13 @@ extern "C"
 {
 #endif
 
+/**
+ * @brief Most input (or sealed) bytes passed into the enclave by one batch
+ *        ECALL; larger batches are split into several ECALLs, so that the
+ *        enclave heap holds at most this much of a batch at once.
+ */
+#define KMYTH_SGX_BATCH_MAX_BYTES (1024 * 1024)
+
   /**
    * @brief High-level function implementing sgx-seal using SGX.
    *
@@ -41,7 +48,31 @@ extern "C"
                          uint16_t key_policy, sgx_attributes_t attribute_mask);
 
   /**
-   * @brief High-level function implementing sgx-unseal using SGX
+   * @brief Implements sgx-seal as kmyth_sgx_seal_nkl() does, but writes the
+   *        binary nkl format (a header, then the raw sealed data), which
+   *        kmyth_sgx_unseal_nkl() passes to the enclave without decoding it.
+   *
+   * @param[in]  input             Raw bytes to be sgx-sealed
+   *
+   * @param[in]  input_len         Number of bytes in input
+   *
+   * @param[out] output            Bytes in binary nkl format of sealed data
+   *
+   * @param[out] output_len        Number of bytes in output
+   *
+   * @return 0 on success, 1 on error
+   */
+  int kmyth_sgx_seal_nkl_binary(sgx_enclave_id_t eid,
+                                uint8_t * input,
+                                size_t input_len,
+                                uint8_t ** output,
+                                size_t *output_len,
+                                uint16_t key_policy,
+                                sgx_attributes_t attribute_mask);
+
+  /**
+   * @brief High-level function implementing sgx-unseal using SGX. The input
+   *        may be in either the (base64) text or the binary nkl format.
    *
    * @param[in]  input             Raw data to be sgx-unsealed
    *
@@ -55,6 +86,64 @@ extern "C"
                            uint8_t * input,
                            size_t input_len, uint64_t * handle);
 
+  /**
+   * @brief Seals several inputs into nkl format, as kmyth_sgx_seal_nkl()
+   *        would, crossing into the enclave once per batch (of up to
+   *        KMYTH_SGX_BATCH_MAX_BYTES) rather than twice per input.
+   *
+   * @param[in]  count             Number of inputs
+   *
+   * @param[in]  inputs            Raw bytes of each input to be sgx-sealed
+   *
+   * @param[in]  input_lens        Number of bytes in each input
+   *
+   * @param[out] outputs           Bytes in nkl format of each sealed input
+   *                               (NULL if it failed), to be freed by the
+   *                               caller
+   *
+   * @param[out] output_lens       Number of bytes in each output
+   *
+   * @param[out] status            Result for each input: 0 if it was sealed,
+   *                               1 otherwise
+   *
+   * @return 0 if every input was sealed, 1 otherwise
+   */
+  int kmyth_sgx_seal_nkl_batch(sgx_enclave_id_t eid,
+                               size_t count,
+                               uint8_t ** inputs,
+                               size_t *input_lens,
+                               uint8_t ** outputs,
+                               size_t *output_lens,
+                               int *status,
+                               uint16_t key_policy,
+                               sgx_attributes_t attribute_mask);
+
+  /**
+   * @brief Unseals several nkl-format inputs into the enclave, as
+   *        kmyth_sgx_unseal_nkl() would, crossing into the enclave once per
+   *        batch (of up to KMYTH_SGX_BATCH_MAX_BYTES) rather than once per
+   *        input.
+   *
+   * @param[in]  count             Number of inputs
+   *
+   * @param[in]  inputs            Raw data of each input to be sgx-unsealed
+   *
+   * @param[in]  input_lens        The size of each input in bytes
+   *
+   * @param[out] handles           The handle result of each sgx-unseal
+   *
+   * @param[out] status            Result for each input: 0 if it was
+   *                               unsealed, 1 otherwise
+   *
+   * @return 0 if every input was unsealed, 1 otherwise
+   */
+  int kmyth_sgx_unseal_nkl_batch(sgx_enclave_id_t eid,
+                                 size_t count,
+                                 uint8_t ** inputs,
+                                 size_t *input_lens,
+                                 uint64_t * handles,
+                                 int *status);
+
 #ifdef __cplusplus
 }
 #endif
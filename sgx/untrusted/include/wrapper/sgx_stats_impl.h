@@ -0,0 +1,84 @@
+/**
+ * @file  sgx_stats_impl.h
+ *
+ * @brief Provides access to a kmyth enclave's instrumentation counters,
+ *        along with the cycles spent in its ECALLs as measured by the
+ *        untrusted code making them
+ */
+
+#ifndef SGX_STATS_IMPL_H
+#define SGX_STATS_IMPL_H
+
+#include "sgx_urts.h"
+
+#include <stdint.h>
+
+#include "kmyth_sgx_stats.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief An enclave's counters, and the timed calls to (and cycles spent
+ *        in) each of its ECALLs. The cycles are counted outside the
+ *        enclave, around the ECALL: the time stamp counter cannot be read
+ *        inside an SGX1 enclave. They include the enclave transitions and
+ *        any OCALLs the ECALL makes.
+ */
+typedef struct kmyth_sgx_stats_s
+{
+  kmyth_sgx_enclave_stats_t enclave;
+  uint64_t ecall_timed_calls[KMYTH_SGX_ECALL_COUNT];
+  uint64_t ecall_cycles[KMYTH_SGX_ECALL_COUNT];
+} kmyth_sgx_stats_t;
+
+  /**
+   * @brief Reads the time stamp counter before an ECALL is timed.
+   *
+   * @return The time stamp counter
+   */
+  uint64_t kmyth_sgx_stats_ecall_start(void);
+
+  /**
+   * @brief Counts a timed ECALL, and the cycles it took, once it returns.
+   *        The counts are kept for the process (across enclaves, and
+   *        threads).
+   *
+   * @param[in]  id                The ECALL
+   *
+   * @param[in]  start             The time stamp counter before the ECALL
+   *                               (from kmyth_sgx_stats_ecall_start())
+   *
+   * @return None
+   */
+  void kmyth_sgx_stats_ecall_done(kmyth_sgx_ecall_id_t id, uint64_t start);
+
+  /**
+   * @brief Gets an enclave's instrumentation counters (with the
+   *        kmyth_enclave_get_stats() ECALL), along with the ECALL cycles
+   *        counted in this process.
+   *
+   * @param[in]  eid               The enclave
+   *
+   * @param[out] stats             The counters
+   *
+   * @return 0 on success, 1 on failure
+   */
+  int kmyth_sgx_get_stats(sgx_enclave_id_t eid, kmyth_sgx_stats_t * stats);
+
+  /**
+   * @brief Names an ECALL (for reporting its counters).
+   *
+   * @param[in]  id                The ECALL
+   *
+   * @return The ECALL's name, or "unknown"
+   */
+  const char *kmyth_sgx_ecall_name(kmyth_sgx_ecall_id_t id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
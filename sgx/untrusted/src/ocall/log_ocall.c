@@ -7,14 +7,62 @@
 
 #include "log_ocall.h"
 
+#include <string.h>
+
+#include "kmyth_enclave_common.h"
+
 /*****************************************************************************
- * log_event_ocall
+ * kmyth_sgx_log_event
  ****************************************************************************/
-void log_event_ocall(const char *src_file,
-                     const char *src_func,
-                     int src_line,
-                     int severity,
-                     const char *msg)
+void kmyth_sgx_log_event(const char *src_file,
+                         const char *src_func,
+                         int src_line,
+                         int severity,
+                         const char *msg)
 {
   log_event(src_file, src_func, src_line, severity, msg);
 }
+
+/*****************************************************************************
+ * log_events_ocall
+ ****************************************************************************/
+void log_events_ocall(const uint8_t * records, size_t records_len)
+{
+  size_t offset = 0;
+
+  while (records_len - offset >= sizeof(kmyth_sgx_log_record_t))
+  {
+    kmyth_sgx_log_record_t record;
+
+    memcpy(&record, records + offset, sizeof(record));
+    offset += sizeof(record);
+
+    // the three strings must be within the batch, and null-terminated
+    size_t strings_len = (size_t) record.src_file_len + record.src_func_len +
+      record.msg_len + 3;
+
+    if (strings_len > records_len - offset)
+    {
+      break;
+    }
+
+    const char *src_file = (const char *) records + offset;
+    const char *src_func = src_file + record.src_file_len + 1;
+    const char *msg = src_func + record.src_func_len + 1;
+
+    if (src_file[record.src_file_len] != '\0' ||
+        src_func[record.src_func_len] != '\0' || msg[record.msg_len] != '\0')
+    {
+      break;
+    }
+    log_event(src_file, src_func, (int) record.src_line,
+              (int) record.severity, msg);
+    offset += strings_len;
+  }
+
+  if (offset != records_len)
+  {
+    log_event(__FILE__, __func__, __LINE__, LOG_ERR,
+              "malformed log record from enclave");
+  }
+}
@@ -17,9 +17,11 @@ int setup_socket_ocall(const char *server_host,
                        size_t server_host_len,
                        const char *server_port,
                        size_t server_port_len,
-                       int *socket_fd)
+                       int *socket_fd,
+                       unsigned char **recv_buf)
 {
   *socket_fd = UNSET_FD;
+  *recv_buf = NULL;
 
   if ((server_host_len = 0) || (server_port_len = 0))
   {
@@ -37,18 +39,30 @@ int setup_socket_ocall(const char *server_host,
     return EXIT_FAILURE;
   }
 
+  // the connection's messages are all received into this one buffer,
+  // which the enclave reads them from
+  *recv_buf = malloc(KMYTH_ECDH_MAX_MSG_SIZE);
+  if (*recv_buf == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate ECDH receive buffer.");
+    close(*socket_fd);
+    *socket_fd = UNSET_FD;
+    return EXIT_FAILURE;
+  }
+
   return EXIT_SUCCESS;
 }
 
 /*****************************************************************************
  * close_socket_ocall()
  ****************************************************************************/
-void close_socket_ocall(int socket_fd)
+void close_socket_ocall(int socket_fd, unsigned char *recv_buf)
 {
   if (socket_fd != UNSET_FD)
   {
     close(socket_fd);
   }
+  free(recv_buf);
 }
 
 /*****************************************************************************
@@ -64,7 +78,7 @@ time_t time_ocall(time_t * timer)
  ****************************************************************************/
 int ecdh_exchange_ocall(unsigned char *client_hello,
                         size_t client_hello_len,
-                        unsigned char **server_hello,
+                        unsigned char *recv_buf,
                         size_t *server_hello_len,
                         int socket_fd)
 {
@@ -79,7 +93,8 @@ int ecdh_exchange_ocall(unsigned char *client_hello,
   }
 
   kmyth_log(LOG_DEBUG, "Receiving TLS proxy's 'Server Hello' message");
-  ret = recv_ecdh_msg(socket_fd, server_hello, server_hello_len);
+  ret = recv_ecdh_msg_into(socket_fd, recv_buf, KMYTH_ECDH_MAX_MSG_SIZE,
+                           server_hello_len);
   if (ret != EXIT_SUCCESS)
   {
     kmyth_log(LOG_ERR, "failed to receive TLS proxy's 'Server Hello' message");
@@ -108,11 +123,14 @@ int ecdh_send_msg_ocall(unsigned char *msg,
 /*****************************************************************************
  * ecdh_recv_msg_ocall()
  ****************************************************************************/
-int ecdh_recv_msg_ocall(unsigned char **msg,
+int ecdh_recv_msg_ocall(unsigned char *recv_buf,
                         size_t *msg_len,
                         int socket_fd)
 {
-  if (EXIT_SUCCESS != recv_ecdh_msg(socket_fd, msg, msg_len))
+  if (EXIT_SUCCESS != recv_ecdh_msg_into(socket_fd,
+                                         recv_buf,
+                                         KMYTH_ECDH_MAX_MSG_SIZE,
+                                         msg_len))
   {
     kmyth_log(LOG_ERR, "error receiving ECDH message");
     return EXIT_FAILURE;
@@ -0,0 +1,63 @@
+/**
+ * @file  enclave_util.c
+ *
+ * @brief Provides implementation of kmyth enclave creation, with untrusted
+ *        worker threads for its switchless OCALLs when the kmyth OCALLs are
+ *        built switchless
+ */
+
+#include "enclave_util.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <kmyth/kmyth_log.h>
+
+#ifdef KMYTH_SGX_SWITCHLESS
+#include "sgx_uswitchless.h"
+#endif
+
+/*****************************************************************************
+ * kmyth_sgx_create_enclave()
+ ****************************************************************************/
+sgx_status_t kmyth_sgx_create_enclave(const char *enclave_fn,
+                                      sgx_enclave_id_t * eid)
+{
+#ifdef KMYTH_SGX_SWITCHLESS
+  unsigned long workers = KMYTH_SGX_SWITCHLESS_WORKERS;
+  const char *workers_env = getenv(KMYTH_SGX_SWITCHLESS_WORKERS_ENV);
+
+  if (workers_env != NULL && *workers_env != '\0')
+  {
+    char *end = NULL;
+
+    errno = 0;
+    workers = strtoul(workers_env, &end, 10);
+    if (errno || *end != '\0' || workers == 0 || workers > UINT32_MAX)
+    {
+      kmyth_log(LOG_ERR, "invalid number of switchless OCALL workers (%s)",
+                workers_env);
+      return SGX_ERROR_INVALID_PARAMETER;
+    }
+  }
+
+  // Only the OCALLs are switchless, so no trusted workers are started. An
+  // untrusted worker sleeps, rather than spinning, once it has been idle
+  // for the configured number of retries.
+  sgx_uswitchless_config_t us_config = SGX_USWITCHLESS_CONFIG_INITIALIZER;
+  const void *enclave_ex_p[32] = { 0 };
+
+  us_config.num_uworkers = (uint32_t) workers;
+  us_config.num_tworkers = 0;
+  enclave_ex_p[SGX_CREATE_ENCLAVE_EX_SWITCHLESS_BIT_IDX] = &us_config;
+
+  kmyth_log(LOG_DEBUG, "creating enclave with %lu switchless OCALL workers",
+            workers);
+  return sgx_create_enclave_ex(enclave_fn, SGX_DEBUG_FLAG, NULL, NULL, eid,
+                               NULL, SGX_CREATE_ENCLAVE_EX_SWITCHLESS,
+                               enclave_ex_p);
+#else
+  return sgx_create_enclave(enclave_fn, SGX_DEBUG_FLAG, NULL, NULL, eid, NULL);
+#endif
+}
@@ -8,23 +8,71 @@
 #include "msg_util.h"
 
 /*****************************************************************************
- * recv_ecdh_msg()
+ * read_full()
  ****************************************************************************/
-int recv_ecdh_msg(int socket_fd, unsigned char **buf, size_t *len)
+static int read_full(int socket_fd, void *buf, size_t len)
+{
+  unsigned char *pos = (unsigned char *) buf;
+
+  // a stream socket may return fewer bytes than asked for (or be
+  // interrupted), so keep reading until all of them have arrived
+  while (len > 0)
+  {
+    ssize_t bytes_read = read(socket_fd, pos, len);
+
+    if (bytes_read < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (bytes_read <= 0)
+    {
+      kmyth_log(LOG_ERR, "ECDH connection is closed");
+      return EXIT_FAILURE;
+    }
+    pos += bytes_read;
+    len -= (size_t) bytes_read;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * write_full()
+ ****************************************************************************/
+static int write_full(int socket_fd, const void *buf, size_t len)
+{
+  const unsigned char *pos = (const unsigned char *) buf;
+
+  while (len > 0)
+  {
+    ssize_t bytes_sent = write(socket_fd, pos, len);
+
+    if (bytes_sent < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (bytes_sent <= 0)
+    {
+      return EXIT_FAILURE;
+    }
+    pos += bytes_sent;
+    len -= (size_t) bytes_sent;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * recv_ecdh_msg_header()
+ ****************************************************************************/
+static int recv_ecdh_msg_header(int socket_fd, size_t *len)
 {
   // read message header (and do some sanity checks)
   struct ECDHMessageHeader header;
 
   secure_memset(&header, 0, sizeof(header));
-  ssize_t bytes_read = read(socket_fd, &header, sizeof(header));
-  if (bytes_read <= 0)
+  if (read_full(socket_fd, &header, sizeof(header)))
   {
-    kmyth_log(LOG_ERR, "ECDH connection is closed");
-    return EXIT_FAILURE;
-  }
-  else if ((size_t)bytes_read != sizeof(header))
-  {
-    kmyth_log(LOG_ERR, "read invalid number of ECDH message header bytes");
     return EXIT_FAILURE;
   }
   *len = ntohs(header.msg_size);
@@ -34,6 +82,19 @@ int recv_ecdh_msg(int socket_fd, unsigned char **buf, size_t *len)
     return EXIT_FAILURE;
   }
 
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * recv_ecdh_msg()
+ ****************************************************************************/
+int recv_ecdh_msg(int socket_fd, unsigned char **buf, size_t *len)
+{
+  if (recv_ecdh_msg_header(socket_fd, len))
+  {
+    return EXIT_FAILURE;
+  }
+
   // allocate memory for ECDH message receive buffer
   *buf = calloc(*len, sizeof(unsigned char));
   if (*buf == NULL)
@@ -43,19 +104,31 @@ int recv_ecdh_msg(int socket_fd, unsigned char **buf, size_t *len)
   }
 
   // receive message bytes
-  bytes_read = read(socket_fd, *buf, *len);
-  if (bytes_read <= 0)
+  if (read_full(socket_fd, *buf, *len))
   {
-    kmyth_log(LOG_ERR, "ECDH connection is closed");
     return EXIT_FAILURE;
   }
-  else if ((size_t)bytes_read != *len)
+
+  return EXIT_SUCCESS;
+}
+
+/*****************************************************************************
+ * recv_ecdh_msg_into()
+ ****************************************************************************/
+int recv_ecdh_msg_into(int socket_fd, unsigned char *buf, size_t buf_size,
+                       size_t *len)
+{
+  if (recv_ecdh_msg_header(socket_fd, len))
+  {
+    return EXIT_FAILURE;
+  }
+  if (*len > buf_size)
   {
-    kmyth_log(LOG_ERR, "read incorrect number of ECDH message bytes");
+    kmyth_log(LOG_ERR, "ECDH message exceeds receive buffer size");
     return EXIT_FAILURE;
   }
 
-  return EXIT_SUCCESS;
+  return read_full(socket_fd, buf, *len);
 }
 
 /*****************************************************************************
@@ -74,16 +147,13 @@ int send_ecdh_msg(int socket_fd, unsigned char *buf, size_t len)
   secure_memset(&header, 0, sizeof(header));
   header.msg_size = htons(len);
 
-  ssize_t bytes_sent = write(socket_fd, &header, sizeof(header));
-  if ((bytes_sent <= 0) || ((size_t)bytes_sent != sizeof(header)))
+  if (write_full(socket_fd, &header, sizeof(header)))
   {
     kmyth_log(LOG_ERR, "sending ECDH message header failed");
     return EXIT_FAILURE;
   }
 
-  bytes_sent = write(socket_fd, buf, len);
-
-  if ((bytes_sent <= 0) | ((size_t)bytes_sent != len))
+  if (write_full(socket_fd, buf, len))
   {
     kmyth_log(LOG_ERR, "sending ECDH message payload failed");
     return EXIT_FAILURE;
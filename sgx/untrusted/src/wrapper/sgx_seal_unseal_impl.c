@@ -8,6 +8,7 @@
 #include "sgx_urts.h"
 
 #include "sgx_seal_unseal_impl.h"
+#include "sgx_stats_impl.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -15,9 +16,142 @@
 
 #include <kmyth/kmyth_log.h>
 #include <kmyth/formatting_tools.h>
+#include <kmyth/memory_util.h>
+
+#include "kmyth_enclave_common.h"
 
 #include ENCLAVE_HEADER_UNTRUSTED
 
+//############################################################################
+// sealed_size()
+//############################################################################
+static size_t sealed_size(size_t input_len)
+{
+  // what sgx_calc_sealed_data_size(0, input_len) gives inside the enclave
+  return sizeof(sgx_sealed_data_t) + input_len;
+}
+
+//############################################################################
+// nkl_sealed_view()
+//############################################################################
+static int nkl_sealed_view(uint8_t * input, size_t input_len,
+                           uint8_t ** data, size_t *data_size, bool *chunked,
+                           uint8_t ** decoded)
+{
+  *decoded = NULL;
+
+  // binary data is passed on in place
+  if (is_nkl_binary(input, input_len))
+  {
+    uint8_t flags = 0;
+
+    if (get_nkl_binary_view(input, input_len, data, data_size, &flags))
+    {
+      return 1;
+    }
+    *chunked = (flags & KMYTH_NKL_BINARY_CHUNKED) != 0;
+    return 0;
+  }
+
+  *chunked = (input_len >= strlen(KMYTH_DELIM_NKL_CHUNKED_DATA)
+              && memcmp(input, KMYTH_DELIM_NKL_CHUNKED_DATA,
+                        strlen(KMYTH_DELIM_NKL_CHUNKED_DATA)) == 0);
+
+  const char *delim =
+    *chunked ? KMYTH_DELIM_NKL_CHUNKED_DATA : KMYTH_DELIM_NKL_DATA;
+  uint8_t *block = NULL;
+  size_t blocksize = 0;
+
+  if (get_block_bytes
+      ((char **) &input, &input_len, &block, &blocksize,
+       (char *) delim, strlen(delim),
+       (char *) KMYTH_DELIM_END_NKL, strlen(KMYTH_DELIM_END_NKL)))
+  {
+    kmyth_log(LOG_ERR, "error getting block bytes ... exiting");
+    return 1;
+  }
+
+  if (decodeBase64Data(block, blocksize, (unsigned char **) decoded,
+                       data_size))
+  {
+    kmyth_log(LOG_ERR, "error Base64 decode of block bytes ... exiting");
+    free(block);
+    return 1;
+  }
+
+  free(block);
+  *data = *decoded;
+  return 0;
+}
+
+//############################################################################
+// seal_to_buffer()
+//############################################################################
+static int seal_to_buffer(sgx_enclave_id_t eid, uint8_t * input,
+                          size_t input_len, size_t offset, uint8_t ** buf,
+                          size_t *buf_len, size_t *data_size, bool *chunked,
+                          uint16_t key_policy,
+                          sgx_attributes_t attribute_mask)
+{
+  int ret = 1;
+  sgx_status_t sgx_ret;
+
+  // data larger than a chunk is sealed a chunk at a time, rather than
+  // copied into the enclave whole
+  *chunked = (input_len > KMYTH_SGX_SEAL_CHUNK_SIZE);
+  *data_size = 0;
+  if (*chunked)
+  {
+    sgx_ret = enc_get_sealed_chunked_size(eid, &ret, input_len, data_size);
+  }
+  else
+  {
+    uint32_t size = 0;
+
+    sgx_ret = enc_get_sealed_size(eid, &ret, (uint32_t) input_len, &size);
+    *data_size = size;
+  }
+  if (sgx_ret != SGX_SUCCESS || ret != 0)
+  {
+    kmyth_log(LOG_ERR, "error getting sealed size ... exiting");
+    return 1;
+  }
+
+  // the sealed data is written after 'offset' bytes left for a header
+  *buf_len = offset + *data_size;
+  *buf = (uint8_t *) malloc(*buf_len);
+  if (*buf == NULL)
+  {
+    return 1;
+  }
+
+  uint64_t start = kmyth_sgx_stats_ecall_start();
+
+  if (*chunked)
+  {
+    sgx_ret = enc_seal_data_chunked(eid, &ret, input, input_len,
+                                    *buf + offset, *data_size, key_policy,
+                                    attribute_mask);
+    kmyth_sgx_stats_ecall_done(KMYTH_SGX_ECALL_SEAL_CHUNKED, start);
+  }
+  else
+  {
+    sgx_ret = enc_seal_data(eid, &ret, input, (uint32_t) input_len,
+                            *buf + offset, (uint32_t) * data_size,
+                            key_policy, attribute_mask);
+    kmyth_sgx_stats_ecall_done(KMYTH_SGX_ECALL_SEAL, start);
+  }
+  if (sgx_ret != SGX_SUCCESS || ret != 0)
+  {
+    kmyth_log(LOG_ERR, "error to seal data ... exiting");
+    free(*buf);
+    *buf = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
 //############################################################################
 // kmyth_sgx_seal_nkl()
 //############################################################################
@@ -26,31 +160,23 @@ int kmyth_sgx_seal_nkl(sgx_enclave_id_t eid, uint8_t * input, size_t input_len,
                        uint16_t key_policy, sgx_attributes_t attribute_mask)
 {
   uint8_t *data = NULL;
+  size_t data_len = 0;
   size_t data_size = 0;
-  int ret;
+  bool chunked = false;
 
-  if(input_len > UINT32_MAX)
+  if (input_len == 0 || input_len > UINT32_MAX)
   {
     return 1;
   }
 
-  enc_get_sealed_size(eid, &ret, (uint32_t)input_len, (uint32_t *) & data_size);
-  if (ret == 0)
+  if (seal_to_buffer(eid, input, input_len, 0, &data, &data_len, &data_size,
+                     &chunked, key_policy, attribute_mask))
   {
-    data = (uint8_t *) malloc(data_size);
-    if (data == NULL) return 1;
-
-    enc_seal_data(eid, &ret, input, (uint32_t)input_len, data, (uint32_t)data_size, key_policy,
-                  attribute_mask);
-    if (ret == 1)
-    {
-      kmyth_log(LOG_ERR, "error to seal data ... exiting");
-      free(data);
-      return 1;
-    }
+    return 1;
   }
 
-  if (create_nkl_bytes(data, data_size, output, output_len))
+  if ((chunked ? create_nkl_chunked_bytes : create_nkl_bytes)
+      (data, data_size, output, output_len))
   {
     kmyth_log(LOG_ERR, "error writing data to .nkl format ... exiting");
     free(data);
@@ -62,43 +188,318 @@ int kmyth_sgx_seal_nkl(sgx_enclave_id_t eid, uint8_t * input, size_t input_len,
 }
 
 //############################################################################
-// kmyth_sgx_unseal_nkl()
+// kmyth_sgx_seal_nkl_binary()
 //############################################################################
-int kmyth_sgx_unseal_nkl(sgx_enclave_id_t eid, uint8_t * input,
-                         size_t input_len, uint64_t * handle)
+int kmyth_sgx_seal_nkl_binary(sgx_enclave_id_t eid, uint8_t * input,
+                              size_t input_len, uint8_t ** output,
+                              size_t *output_len, uint16_t key_policy,
+                              sgx_attributes_t attribute_mask)
 {
-  uint8_t *block = NULL;
-  size_t blocksize = 0;
+  size_t data_size = 0;
+  bool chunked = false;
 
-  if (get_block_bytes
-      ((char **) &input, &input_len, &block, &blocksize,
-       (char *) KMYTH_DELIM_NKL_DATA, strlen(KMYTH_DELIM_NKL_DATA),
-       (char *) KMYTH_DELIM_END_NKL, strlen(KMYTH_DELIM_END_NKL)))
+  if (input_len == 0 || input_len > UINT32_MAX)
+  {
+    return 1;
+  }
+
+  // sealed straight into the output, after the header
+  if (seal_to_buffer(eid, input, input_len, KMYTH_NKL_BINARY_HEADER_LEN,
+                     output, output_len, &data_size, &chunked, key_policy,
+                     attribute_mask))
   {
-    kmyth_log(LOG_ERR, "error getting block bytes ... exiting");
     return 1;
   }
+  create_nkl_binary_header(data_size, chunked ? KMYTH_NKL_BINARY_CHUNKED : 0,
+                           *output);
+
+  return 0;
+}
 
+//############################################################################
+// kmyth_sgx_unseal_nkl()
+//############################################################################
+int kmyth_sgx_unseal_nkl(sgx_enclave_id_t eid, uint8_t * input,
+                         size_t input_len, uint64_t * handle)
+{
   uint8_t *data = NULL;
   size_t data_size = 0;
-  bool ret;
+  uint8_t *decoded = NULL;
+  bool chunked = false;
+  bool ret = false;
 
-  if (decodeBase64Data(block, blocksize, (unsigned char **) &data, &data_size))
+  if (nkl_sealed_view(input, input_len, &data, &data_size, &chunked,
+                      &decoded))
   {
-    kmyth_log(LOG_ERR, "error Base64 decode of block bytes ... exiting");
-    free(block);
     return 1;
   }
 
-  free(block);
-  kmyth_unseal_into_enclave(eid, &ret, data_size, data, handle);
+  uint64_t start = kmyth_sgx_stats_ecall_start();
+
+  if (chunked)
+  {
+    // the enclave copies in (and unseals) one chunk at a time
+    kmyth_unseal_chunked_into_enclave(eid, &ret, data, data_size, handle);
+    kmyth_sgx_stats_ecall_done(KMYTH_SGX_ECALL_UNSEAL_CHUNKED, start);
+  }
+  else
+  {
+    kmyth_unseal_into_enclave(eid, &ret, data_size, data, handle);
+    kmyth_sgx_stats_ecall_done(KMYTH_SGX_ECALL_UNSEAL, start);
+  }
+  free(decoded);
   if (ret == false)
   {
     kmyth_log(LOG_ERR, "error to unseal block bytes ... exiting");
-    free(data);
     return 1;
   }
 
-  free(data);
   return 0;
 }
+
+//############################################################################
+// kmyth_sgx_seal_nkl_batch()
+//############################################################################
+int kmyth_sgx_seal_nkl_batch(sgx_enclave_id_t eid, size_t count,
+                             uint8_t ** inputs, size_t *input_lens,
+                             uint8_t ** outputs, size_t *output_lens,
+                             int *status, uint16_t key_policy,
+                             sgx_attributes_t attribute_mask)
+{
+  int failed = 0;
+  size_t first = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    outputs[i] = NULL;
+    output_lens[i] = 0;
+    status[i] = 1;
+  }
+
+  while (first < count)
+  {
+    // pack as many inputs as fit in one batch (but at least one)
+    size_t n = 0;
+    size_t in_total = 0;
+    size_t out_total = 0;
+
+    while (first + n < count &&
+           (n == 0 ||
+            in_total + input_lens[first + n] <= KMYTH_SGX_BATCH_MAX_BYTES))
+    {
+      if (input_lens[first + n] > UINT32_MAX - sizeof(sgx_sealed_data_t))
+      {
+        break;
+      }
+      in_total += input_lens[first + n];
+      out_total += sealed_size(input_lens[first + n]);
+      n++;
+    }
+    if (n == 0)
+    {
+      // an input too large to seal: skip it
+      kmyth_log(LOG_ERR, "input %zu too large to seal", first);
+      failed = 1;
+      first++;
+      continue;
+    }
+
+    uint8_t *in_data = malloc(in_total > 0 ? in_total : 1);
+    uint8_t *out_data = malloc(out_total);
+    uint32_t *in_sizes = calloc(n, sizeof(uint32_t));
+    uint32_t *out_sizes = calloc(n, sizeof(uint32_t));
+    int *batch_status = calloc(n, sizeof(int));
+
+    if (in_data == NULL || out_data == NULL || in_sizes == NULL ||
+        out_sizes == NULL || batch_status == NULL)
+    {
+      kmyth_log(LOG_ERR, "error allocating seal batch buffers ... exiting");
+      free(in_data);
+      free(out_data);
+      free(in_sizes);
+      free(out_sizes);
+      free(batch_status);
+      return 1;
+    }
+
+    size_t offset = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+      memcpy(in_data + offset, inputs[first + i], input_lens[first + i]);
+      offset += input_lens[first + i];
+      in_sizes[i] = (uint32_t) input_lens[first + i];
+    }
+
+    int ret = 1;
+    uint64_t start = kmyth_sgx_stats_ecall_start();
+    sgx_status_t sgx_ret = enc_seal_data_batch(eid, &ret, in_data, in_total,
+                                               in_sizes, out_data, out_total,
+                                               out_sizes, batch_status, n,
+                                               key_policy, attribute_mask);
+
+    kmyth_sgx_stats_ecall_done(KMYTH_SGX_ECALL_SEAL_BATCH, start);
+
+    kmyth_clear(in_data, in_total);
+    free(in_data);
+    free(in_sizes);
+    if (sgx_ret != SGX_SUCCESS || ret != 0)
+    {
+      kmyth_log(LOG_ERR, "error to seal data batch ... exiting");
+      free(out_data);
+      free(out_sizes);
+      free(batch_status);
+      return 1;
+    }
+
+    // sealed outputs are packed in input order, skipping failed inputs
+    offset = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+      if (batch_status[i] != 0 ||
+          create_nkl_bytes(out_data + offset, out_sizes[i],
+                           &outputs[first + i], &output_lens[first + i]))
+      {
+        kmyth_log(LOG_ERR, "error sealing input %zu", first + i);
+        failed = 1;
+      }
+      else
+      {
+        status[first + i] = 0;
+      }
+      offset += out_sizes[i];
+    }
+
+    free(out_data);
+    free(out_sizes);
+    free(batch_status);
+    first += n;
+  }
+
+  return failed;
+}
+
+//############################################################################
+// kmyth_sgx_unseal_nkl_batch()
+//############################################################################
+int kmyth_sgx_unseal_nkl_batch(sgx_enclave_id_t eid, size_t count,
+                               uint8_t ** inputs, size_t *input_lens,
+                               uint64_t * handles, int *status)
+{
+  int failed = 0;
+  size_t first = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    handles[i] = 0;
+    status[i] = 1;
+  }
+
+  while (first < count)
+  {
+    // decode as many blobs as fit in one batch (but at least one)
+    size_t n = 0;
+    size_t data_total = 0;
+    size_t capacity = 0;
+    uint8_t *data = NULL;
+    size_t *data_sizes = calloc(count - first, sizeof(size_t));
+    size_t *index = calloc(count - first, sizeof(size_t));
+
+    if (data_sizes == NULL || index == NULL)
+    {
+      kmyth_log(LOG_ERR, "error allocating unseal batch buffers ... exiting");
+      free(data_sizes);
+      free(index);
+      return 1;
+    }
+
+    while (first < count && (n == 0 || data_total < KMYTH_SGX_BATCH_MAX_BYTES))
+    {
+      uint8_t *blob = NULL;
+      size_t blob_size = 0;
+      uint8_t *decoded = NULL;
+      bool chunked = false;
+
+      if (nkl_sealed_view(inputs[first], input_lens[first], &blob,
+                          &blob_size, &chunked, &decoded) || chunked)
+      {
+        // chunked data is only unsealed on its own
+        free(decoded);
+        failed = 1;
+        first++;
+        continue;
+      }
+      if (data_total + blob_size > capacity)
+      {
+        size_t new_capacity = 2 * (data_total + blob_size);
+        uint8_t *new_data = realloc(data, new_capacity);
+
+        if (new_data == NULL)
+        {
+          kmyth_log(LOG_ERR, "error growing unseal batch buffer ... exiting");
+          free(decoded);
+          free(data);
+          free(data_sizes);
+          free(index);
+          return 1;
+        }
+        data = new_data;
+        capacity = new_capacity;
+      }
+      memcpy(data + data_total, blob, blob_size);
+      free(decoded);
+      data_total += blob_size;
+      data_sizes[n] = blob_size;
+      index[n] = first;
+      n++;
+      first++;
+    }
+
+    if (n > 0)
+    {
+      uint64_t *batch_handles = calloc(n, sizeof(uint64_t));
+      int *batch_status = calloc(n, sizeof(int));
+      int ret = -1;
+      sgx_status_t sgx_ret = SGX_ERROR_OUT_OF_MEMORY;
+
+      if (batch_handles != NULL && batch_status != NULL)
+      {
+        uint64_t start = kmyth_sgx_stats_ecall_start();
+
+        sgx_ret = kmyth_unseal_batch_into_enclave(eid, &ret, data, data_total,
+                                                  data_sizes, batch_handles,
+                                                  batch_status, n);
+        kmyth_sgx_stats_ecall_done(KMYTH_SGX_ECALL_UNSEAL_BATCH, start);
+      }
+      if (sgx_ret != SGX_SUCCESS || ret != 0)
+      {
+        kmyth_log(LOG_ERR, "error to unseal block batch ... exiting");
+        free(batch_handles);
+        free(batch_status);
+        free(data);
+        free(data_sizes);
+        free(index);
+        return 1;
+      }
+      for (size_t i = 0; i < n; i++)
+      {
+        if (batch_status[i] != 0)
+        {
+          kmyth_log(LOG_ERR, "error unsealing blob %zu", index[i]);
+          failed = 1;
+          continue;
+        }
+        handles[index[i]] = batch_handles[i];
+        status[index[i]] = 0;
+      }
+      free(batch_handles);
+      free(batch_status);
+    }
+
+    free(data);
+    free(data_sizes);
+    free(index);
+  }
+
+  return failed;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file  sgx_stats_impl.c
+ * @brief Implements access to a kmyth enclave's instrumentation counters,
+ *        and the untrusted side's timing of its ECALLs
+ */
+
+#include "sgx_stats_impl.h"
+
+#include <string.h>
+#include <x86intrin.h>
+
+#include <kmyth/kmyth_log.h>
+
+#include ENCLAVE_HEADER_UNTRUSTED
+
+// The ECALLs' names, indexed by kmyth_sgx_ecall_id_t
+static const char *const kmyth_sgx_ecall_names[KMYTH_SGX_ECALL_COUNT] = {
+  "enc_seal_data",
+  "enc_seal_data_batch",
+  "enc_seal_data_chunked",
+  "kmyth_unseal_into_enclave",
+  "kmyth_unseal_batch_into_enclave",
+  "kmyth_unseal_chunked_into_enclave",
+  "kmyth_enclave_fill_ecdh_pool",
+  "kmyth_enclave_retrieve_key_from_server",
+  "kmyth_enclave_retrieve_keys_from_server"
+};
+
+// The process's timed ECALLs, updated atomically by the threads making them
+static uint64_t kmyth_sgx_ecall_timed_calls[KMYTH_SGX_ECALL_COUNT];
+static uint64_t kmyth_sgx_ecall_cycles[KMYTH_SGX_ECALL_COUNT];
+
+//############################################################################
+// kmyth_sgx_stats_ecall_start()
+//############################################################################
+uint64_t kmyth_sgx_stats_ecall_start(void)
+{
+  return (uint64_t) __rdtsc();
+}
+
+//############################################################################
+// kmyth_sgx_stats_ecall_done()
+//############################################################################
+void kmyth_sgx_stats_ecall_done(kmyth_sgx_ecall_id_t id, uint64_t start)
+{
+  uint64_t cycles = (uint64_t) __rdtsc() - start;
+
+  if (id < KMYTH_SGX_ECALL_COUNT)
+  {
+    __atomic_add_fetch(&kmyth_sgx_ecall_timed_calls[id], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&kmyth_sgx_ecall_cycles[id], cycles, __ATOMIC_RELAXED);
+  }
+}
+
+//############################################################################
+// kmyth_sgx_get_stats()
+//############################################################################
+int kmyth_sgx_get_stats(sgx_enclave_id_t eid, kmyth_sgx_stats_t * stats)
+{
+  int ret = 1;
+
+  memset(stats, 0, sizeof(kmyth_sgx_stats_t));
+
+  sgx_status_t sgx_ret = kmyth_enclave_get_stats(eid, &ret, &stats->enclave);
+
+  if (sgx_ret != SGX_SUCCESS || ret != 0)
+  {
+    kmyth_log(LOG_ERR, "error getting enclave stats ... exiting");
+    return 1;
+  }
+
+  for (size_t i = 0; i < KMYTH_SGX_ECALL_COUNT; i++)
+  {
+    stats->ecall_timed_calls[i] =
+      __atomic_load_n(&kmyth_sgx_ecall_timed_calls[i], __ATOMIC_RELAXED);
+    stats->ecall_cycles[i] =
+      __atomic_load_n(&kmyth_sgx_ecall_cycles[i], __ATOMIC_RELAXED);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_sgx_ecall_name()
+//############################################################################
+const char *kmyth_sgx_ecall_name(kmyth_sgx_ecall_id_t id)
+{
+  if (id >= KMYTH_SGX_ECALL_COUNT)
+  {
+    return "unknown";
+  }
+  return kmyth_sgx_ecall_names[id];
+}
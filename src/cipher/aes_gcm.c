@@ -6,10 +6,16 @@
 
 #include "cipher/aes_gcm.h"
 
+#include <limits.h>
+#include <string.h>
+
 #include <openssl/evp.h>
-#include <openssl/rand.h>
 
 #include "memory_util.h"
+#include "cipher/cipher_ctx.h"
+#include "cipher/nonce_drbg.h"
+
+#include "alloc_stats.h"
 
 //############################################################################
 // aes_gcm_encrypt()
@@ -19,282 +25,603 @@ int aes_gcm_encrypt(unsigned char *key,
                     unsigned char *inData, size_t inData_len,
                     unsigned char **outData, size_t * outData_len)
 {
+  size_t out_size = 0;
 
-  // validate non-NULL and non-empty encryption key specified
-  if (key == NULL || key_len == 0)
+  // validate the parameters, and get the output size, before allocating
+  if (key == NULL || key_len == 0 ||
+      aes_gcm_encrypt_buf(key, key_len, inData, inData_len,
+                          NULL, 0, &out_size))
   {
     return 1;
   }
 
-  // validate non-NULL input plaintext buffer specified
-  if (inData == NULL)
+  *outData = malloc(out_size);
+  if (*outData == NULL) // failed malloc
   {
     return 1;
   }
 
-  // Validate inData isn't too long
-  if (inData_len > INT_MAX)
+  if (aes_gcm_encrypt_buf(key, key_len, inData, inData_len,
+                          *outData, out_size, outData_len))
   {
+    free(*outData);
+    *outData = NULL;
     return 1;
   }
-  // output data buffer (outData) will contain the concatenation of:
-  //   - GCM_IV_LEN (12) byte IV
-  //   - resultant ciphertext (same length as the input plaintext)
-  //   - GCM_TAG_LEN (16) byte tag
-  *outData_len = GCM_IV_LEN + inData_len + GCM_TAG_LEN;
-  if (*outData == NULL) free( *outData );
-  *outData = malloc(*outData_len);
-  if (*outData == NULL) // failed malloc
+
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_decrypt()
+//############################################################################
+int aes_gcm_decrypt(unsigned char *key,
+                    size_t key_len,
+                    unsigned char *inData, size_t inData_len,
+                    unsigned char **outData, size_t * outData_len)
+{
+  size_t out_size = 0;
+
+  // validate the parameters, and get the output size, before allocating
+  if (key == NULL || key_len == 0 ||
+      aes_gcm_decrypt_buf(key, key_len, inData, inData_len,
+                          NULL, 0, &out_size))
   {
     return 1;
   }
-  unsigned char *iv = *outData;
-  unsigned char *ciphertext = iv + GCM_IV_LEN;
-  unsigned char *tag = ciphertext + inData_len;
-
-  // variable to hold length of resulting CT - OpenSSL insists this be an int
-  int ciphertext_len = 0;
 
-  // initialize the cipher context to match cipher suite being used
-  EVP_CIPHER_CTX *ctx;
+  // Setting here to save some cleanup on error conditions.
+  *outData_len = 0;
+  *outData = malloc(out_size);
+  if (*outData == NULL && out_size > 0)
+  {
+    return 1;
+  }
 
-  if (!(ctx = EVP_CIPHER_CTX_new()))
+  if (aes_gcm_decrypt_buf(key, key_len, inData, inData_len,
+                          *outData, out_size, outData_len))
   {
-    if (*outData != NULL) free(*outData);
+    kmyth_clear_and_free(*outData, out_size);
     *outData = NULL;
+    *outData_len = 0;
     return 1;
   }
-  int init_result = 0;
 
-  switch (key_len)
+  return 0;
+}
+
+/**
+ * @brief Streaming state for AES/GCM (see aes_gcm_stream_init())
+ */
+typedef struct
+{
+  EVP_CIPHER_CTX *ctx;
+  bool encrypt;
+
+  // encryption: IV generated at init, emitted ahead of the first ciphertext
+  // decryption: IV accumulated from the start of the input stream
+  unsigned char iv[GCM_IV_LEN];
+  size_t iv_len;
+
+  // decryption only: trailing input bytes held back as the candidate tag
+  unsigned char tag[GCM_TAG_LEN];
+  size_t tag_len;
+} aes_gcm_stream_t;
+
+//############################################################################
+// aes_gcm_stream_free()
+//############################################################################
+static void aes_gcm_stream_free(aes_gcm_stream_t * stream)
+{
+  if (stream == NULL)
   {
-  case 16:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL);
-    break;
-  case 24:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_192_gcm(), NULL, NULL, NULL);
-    break;
-  case 32:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL);
-    break;
-  default:
-    break;
+    return;
   }
-  if (!init_result)
+  EVP_CIPHER_CTX_free(stream->ctx);
+  kmyth_clear_and_free(stream, sizeof(aes_gcm_stream_t));
+}
+
+//############################################################################
+// aes_gcm_stream_crypt()
+//############################################################################
+static int aes_gcm_stream_crypt(aes_gcm_stream_t * stream,
+                                unsigned char *inData, size_t inData_len,
+                                unsigned char *outData, size_t * outData_len)
+{
+  // OpenSSL insists on int lengths
+  int len = 0;
+
+  *outData_len = 0;
+  if (inData_len == 0)
+  {
+    return 0;
+  }
+  if (stream->encrypt)
+  {
+    if (!EVP_EncryptUpdate(stream->ctx, outData, &len, inData,
+                           (int) inData_len))
+    {
+      return 1;
+    }
+  }
+  else
+  {
+    if (!EVP_DecryptUpdate(stream->ctx, outData, &len, inData,
+                           (int) inData_len))
+    {
+      return 1;
+    }
+  }
+
+  // GCM is a stream mode: output length must always match input length
+  if (len < 0 || (size_t) len != inData_len)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
+  *outData_len = (size_t) len;
 
-  // create the IV
-  if (RAND_bytes(iv, GCM_IV_LEN) != 1)
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_stream_init()
+//############################################################################
+int aes_gcm_stream_init(unsigned char *key,
+                        size_t key_len, bool encrypt, void **state)
+{
+  // validate non-NULL and non-empty key specified
+  if (key == NULL || key_len == 0 || state == NULL)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // set the IV length in the cipher context
-  if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL))
+  // a stream keeps its own context for its lifetime, but still uses the
+  // cached cipher
+  const EVP_CIPHER *evp_cipher =
+    kmyth_get_evp_cipher(KMYTH_CIPHER_AES_GCM, key_len);
+
+  if (evp_cipher == NULL)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // set the key and IV in the cipher context
-  if (!EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv))
+  aes_gcm_stream_t *stream = calloc(1, sizeof(aes_gcm_stream_t));
+
+  if (stream == NULL)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
+  stream->encrypt = encrypt;
 
-  // encrypt the input plaintext, put result in the output ciphertext buffer
-  if (!EVP_EncryptUpdate(ctx, ciphertext, &ciphertext_len, inData, (int)inData_len))
+  if (!(stream->ctx = EVP_CIPHER_CTX_new()))
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    aes_gcm_stream_free(stream);
     return 1;
   }
 
-  // verify that the resultant CT length matches the input PT length
-  if ((size_t) ciphertext_len != inData_len)
+  // set the cipher and the key now - when decrypting, the IV is set once it
+  // has been read from the start of the stream
+  if (!EVP_CipherInit_ex(stream->ctx, evp_cipher, NULL, NULL, NULL,
+                         encrypt ? 1 : 0)
+      || !EVP_CIPHER_CTX_ctrl(stream->ctx, EVP_CTRL_GCM_SET_IVLEN,
+                              GCM_IV_LEN, NULL)
+      || !EVP_CipherInit_ex(stream->ctx, NULL, NULL, key, NULL, -1))
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    aes_gcm_stream_free(stream);
     return 1;
   }
 
-  // OpenSSL requires a "finalize" operation. For AES/GCM no data is written.
-  if (!EVP_EncryptFinal_ex(ctx, tag, &ciphertext_len))
+  if (encrypt)
+  {
+    // create the IV (it is written out by the first update call)
+    if (kmyth_nonce_bytes(stream->iv, GCM_IV_LEN)
+        || !EVP_CipherInit_ex(stream->ctx, NULL, NULL, NULL, stream->iv, -1))
+    {
+      aes_gcm_stream_free(stream);
+      return 1;
+    }
+  }
+
+  *state = stream;
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_stream_update()
+//############################################################################
+int aes_gcm_stream_update(void *state,
+                          unsigned char *inData,
+                          size_t inData_len,
+                          unsigned char *outData, size_t * outData_len)
+{
+  aes_gcm_stream_t *stream = (aes_gcm_stream_t *) state;
+
+  if (stream == NULL || outData == NULL || outData_len == NULL)
+  {
+    return 1;
+  }
+  if (inData == NULL && inData_len > 0)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
+  if (inData_len > INT_MAX)
+  {
+    return 1;
+  }
+  *outData_len = 0;
+
+  size_t len = 0;
 
-  // get the AES/GCM tag value, appending it to the output ciphertext
-  if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LEN, tag))
+  if (stream->encrypt)
+  {
+    // the stream starts with the IV, emitted on the first call only
+    if (stream->iv_len == 0)
+    {
+      memcpy(outData, stream->iv, GCM_IV_LEN);
+      stream->iv_len = GCM_IV_LEN;
+      *outData_len = GCM_IV_LEN;
+    }
+    if (aes_gcm_stream_crypt(stream, inData, inData_len,
+                             outData + *outData_len, &len))
+    {
+      return 1;
+    }
+    *outData_len += len;
+    return 0;
+  }
+
+  // decryption: first collect the IV from the start of the stream
+  if (stream->iv_len < GCM_IV_LEN)
+  {
+    size_t iv_part = GCM_IV_LEN - stream->iv_len;
+
+    if (iv_part > inData_len)
+    {
+      iv_part = inData_len;
+    }
+    memcpy(stream->iv + stream->iv_len, inData, iv_part);
+    stream->iv_len += iv_part;
+    inData += iv_part;
+    inData_len -= iv_part;
+
+    if (stream->iv_len < GCM_IV_LEN)
+    {
+      return 0;
+    }
+    if (!EVP_DecryptInit_ex(stream->ctx, NULL, NULL, NULL, stream->iv))
+    {
+      return 1;
+    }
+  }
+
+  // the last GCM_TAG_LEN bytes seen so far might be the tag, so hold them
+  // back and only decrypt what precedes them
+  size_t total = stream->tag_len + inData_len;
+
+  if (total <= GCM_TAG_LEN)
+  {
+    memcpy(stream->tag + stream->tag_len, inData, inData_len);
+    stream->tag_len = total;
+    return 0;
+  }
+  size_t release = total - GCM_TAG_LEN;
+  size_t from_held = (release < stream->tag_len) ? release : stream->tag_len;
+  size_t from_input = release - from_held;
+
+  if (aes_gcm_stream_crypt(stream, stream->tag, from_held, outData, &len))
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
+  *outData_len = len;
+  memmove(stream->tag, stream->tag + from_held, stream->tag_len - from_held);
+  stream->tag_len -= from_held;
 
-  // now that the encryption is complete, clean-up cipher context
-  EVP_CIPHER_CTX_free(ctx);
+  if (aes_gcm_stream_crypt(stream, inData, from_input,
+                           outData + *outData_len, &len))
+  {
+    return 1;
+  }
+  *outData_len += len;
+  memcpy(stream->tag + stream->tag_len, inData + from_input,
+         inData_len - from_input);
+  stream->tag_len += inData_len - from_input;
 
   return 0;
 }
 
 //############################################################################
-// aes_gcm_decrypt()
+// aes_gcm_stream_final()
 //############################################################################
-int aes_gcm_decrypt(unsigned char *key,
-                    size_t key_len,
-                    unsigned char *inData, size_t inData_len,
-                    unsigned char **outData, size_t * outData_len)
+int aes_gcm_stream_final(void *state,
+                         unsigned char *outData, size_t * outData_len)
 {
-  // validate non-NULL and non-empty decryption key specified
-  if (key == NULL || key_len == 0)
+  aes_gcm_stream_t *stream = (aes_gcm_stream_t *) state;
+
+  if (stream == NULL)
+  {
+    return 1;
+  }
+  if (outData == NULL || outData_len == NULL)
   {
+    aes_gcm_stream_free(stream);
     return 1;
   }
+  *outData_len = 0;
+
+  // variable to hold length returned by EVP library - OpenSSL insists on int
+  int len = 0;
+
+  if (stream->encrypt)
+  {
+    // an empty stream (no update calls) still needs its IV emitted
+    if (stream->iv_len == 0)
+    {
+      memcpy(outData, stream->iv, GCM_IV_LEN);
+      stream->iv_len = GCM_IV_LEN;
+      *outData_len = GCM_IV_LEN;
+    }
+
+    // For AES/GCM no data is written by the "finalize" operation
+    if (!EVP_EncryptFinal_ex(stream->ctx, outData + *outData_len, &len)
+        || len != 0
+        || !EVP_CIPHER_CTX_ctrl(stream->ctx, EVP_CTRL_GCM_GET_TAG,
+                                GCM_TAG_LEN, outData + *outData_len))
+    {
+      aes_gcm_stream_free(stream);
+      return 1;
+    }
+    *outData_len += GCM_TAG_LEN;
+    aes_gcm_stream_free(stream);
+    return 0;
+  }
 
-  // validate non-NULL and non-empty input ciphertext buffer specified
-  if (inData == NULL || inData_len == 0)
+  // a truncated stream cannot contain both an IV and a tag
+  if (stream->iv_len != GCM_IV_LEN || stream->tag_len != GCM_TAG_LEN)
   {
+    aes_gcm_stream_free(stream);
     return 1;
   }
-  if (inData_len < GCM_IV_LEN + GCM_TAG_LEN)
+
+  // validate that the held back tag matches the one computed
+  if (!EVP_CIPHER_CTX_ctrl(stream->ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LEN,
+                           stream->tag)
+      || EVP_DecryptFinal_ex(stream->ctx, outData, &len) <= 0 || len != 0)
   {
+    aes_gcm_stream_free(stream);
     return 1;
   }
-  if (inData_len > INT_MAX)
+
+  aes_gcm_stream_free(stream);
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_chunk_crypt()
+//############################################################################
+static int aes_gcm_chunk_crypt(unsigned char *key, size_t key_len,
+                               int encrypt,
+                               unsigned char *aad, size_t aad_len,
+                               unsigned char *iv,
+                               unsigned char *inData, size_t inData_len,
+                               unsigned char *outData, unsigned char *tag)
+{
+  if (key == NULL || (aad == NULL && aad_len > 0) ||
+      inData_len > INT_MAX || aad_len > INT_MAX)
   {
     return 1;
   }
-  
-  // Setting here to save some cleanup on error conditions.
-  *outData_len = 0;
-  *outData = NULL;
-  
-  size_t expected_out_len = inData_len - (GCM_IV_LEN + GCM_TAG_LEN);
-  // output data buffer (outData) will contain only the plaintext, which
-  // should be sized as the input minus the lengths of the IV and tag fields
 
-  // input data buffer (inData) will contain the concatenation of:
-  //   - GCM_IV_LEN (12) byte IV
-  //   - resultant ciphertext (same length as the input plaintext)
-  //   - GCM_TAG_LEN (16) byte tag
-  unsigned char *iv = inData;
-  unsigned char *ciphertext = inData + GCM_IV_LEN;
-  unsigned char *tag = ciphertext + expected_out_len;
+  EVP_CIPHER_CTX *ctx =
+    kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_GCM, key_len, encrypt);
+
+  if (ctx == NULL)
+  {
+    return 1;
+  }
 
-  // variables to hold/accumulate length returned by EVP library calls
-  //   - OpenSSL insists this be an int
+  // OpenSSL insists on int lengths
   int len = 0;
-  size_t plaintext_len = 0;
+  int final_len = 0;
+
+  if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL) ||
+      !EVP_CipherInit_ex(ctx, NULL, NULL, key, iv, encrypt) ||
+      (!encrypt &&
+       !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LEN, tag)) ||
+      (aad_len > 0 &&
+       !EVP_CipherUpdate(ctx, NULL, &len, aad, (int) aad_len)) ||
+      (inData_len > 0 &&
+       !EVP_CipherUpdate(ctx, outData, &len, inData, (int) inData_len)) ||
+      EVP_CipherFinal_ex(ctx, outData, &final_len) <= 0 || final_len != 0 ||
+      (encrypt &&
+       !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LEN, tag)))
+  {
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_GCM, key_len, ctx);
+    return 1;
+  }
 
-  // initialize the cipher context to match cipher suite being used
-  EVP_CIPHER_CTX *ctx;
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_GCM, key_len, ctx);
+  return 0;
+}
 
-  if (!(ctx = EVP_CIPHER_CTX_new()))
+//############################################################################
+// aes_gcm_encrypt_chunk()
+//############################################################################
+int aes_gcm_encrypt_chunk(unsigned char *key,
+                          size_t key_len,
+                          unsigned char *aad, size_t aad_len,
+                          unsigned char *inData, size_t inData_len,
+                          unsigned char *outData)
+{
+  if (inData == NULL || inData_len == 0 || outData == NULL)
+  {
+    return 1;
+  }
+
+  // output is the IV, the ciphertext, and then the tag
+  unsigned char *iv = outData;
+  unsigned char *ciphertext = iv + GCM_IV_LEN;
+  unsigned char *tag = ciphertext + inData_len;
+
+  if (kmyth_nonce_bytes(iv, GCM_IV_LEN))
   {
-    free(*outData);
     return 1;
   }
-  int init_result = 0;
 
-  switch (key_len)
+  return aes_gcm_chunk_crypt(key, key_len, 1, aad, aad_len, iv,
+                             inData, inData_len, ciphertext, tag);
+}
+
+//############################################################################
+// aes_gcm_decrypt_chunk()
+//############################################################################
+int aes_gcm_decrypt_chunk(unsigned char *key,
+                          size_t key_len,
+                          unsigned char *aad, size_t aad_len,
+                          unsigned char *inData, size_t inData_len,
+                          unsigned char *outData)
+{
+  if (inData == NULL || outData == NULL ||
+      inData_len <= GCM_IV_LEN + GCM_TAG_LEN)
   {
-  case 16:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL);
-    break;
-  case 24:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_192_gcm(), NULL, NULL, NULL);
-    break;
-  case 32:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL);
-    break;
-  default:
-    break;
+    return 1;
   }
-  if (!init_result)
+
+  size_t plaintext_len = inData_len - (GCM_IV_LEN + GCM_TAG_LEN);
+  unsigned char *iv = inData;
+  unsigned char *ciphertext = iv + GCM_IV_LEN;
+  unsigned char *tag = ciphertext + plaintext_len;
+
+  if (aes_gcm_chunk_crypt(key, key_len, 0, aad, aad_len, iv,
+                          ciphertext, plaintext_len, outData, tag))
   {
-    EVP_CIPHER_CTX_free(ctx);
+    // don't leave unauthenticated plaintext behind
+    kmyth_clear(outData, plaintext_len);
     return 1;
   }
 
-  // set tag to expected tag passed in with input data
-  if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LEN, tag))
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_encrypt_buf()
+//############################################################################
+int aes_gcm_encrypt_buf(unsigned char *key,
+                        size_t key_len,
+                        unsigned char *inData, size_t inData_len,
+                        unsigned char *outData, size_t outData_size,
+                        size_t * outData_len)
+{
+  // validate non-NULL input plaintext buffer of a length OpenSSL accepts
+  if (inData == NULL || inData_len > INT_MAX || outData_len == NULL)
   {
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // set the IV length in the cipher context
-  if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL))
+  // output data buffer (outData) will contain the concatenation of:
+  //   - GCM_IV_LEN (12) byte IV
+  //   - resultant ciphertext (same length as the input plaintext)
+  //   - GCM_TAG_LEN (16) byte tag
+  *outData_len = GCM_IV_LEN + inData_len + GCM_TAG_LEN;
+  if (outData == NULL)
+  {
+    return 0;
+  }
+  if (outData_size < *outData_len)
   {
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // set the key and IV in the cipher context
-  if (!EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv))
+  unsigned char *iv = outData;
+  unsigned char *ciphertext = iv + GCM_IV_LEN;
+  unsigned char *tag = ciphertext + inData_len;
+
+  // create the IV
+  if (kmyth_nonce_bytes(iv, GCM_IV_LEN))
   {
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  *outData = malloc(expected_out_len);
-  if(*outData == NULL)
+  return aes_gcm_chunk_crypt(key, key_len, 1, NULL, 0, iv,
+                             inData, inData_len, ciphertext, tag);
+}
+
+//############################################################################
+// aes_gcm_decrypt_buf()
+//############################################################################
+int aes_gcm_decrypt_buf(unsigned char *key,
+                        size_t key_len,
+                        unsigned char *inData, size_t inData_len,
+                        unsigned char *outData, size_t outData_size,
+                        size_t * outData_len)
+{
+  // validate non-NULL input ciphertext buffer, long enough to hold (at
+  // least) the IV and tag, of a length OpenSSL accepts
+  if (inData == NULL || inData_len < GCM_IV_LEN + GCM_TAG_LEN ||
+      inData_len > INT_MAX || outData_len == NULL)
   {
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
-    
-  // decrypt the input ciphertext, put result in the output plaintext buffer
-  if (!EVP_DecryptUpdate(ctx, *outData, &len, ciphertext, (int)expected_out_len) || len < 0)
+
+  // output data buffer (outData) will contain only the plaintext, which
+  // should be sized as the input minus the lengths of the IV and tag fields
+  size_t plaintext_len = inData_len - (GCM_IV_LEN + GCM_TAG_LEN);
+
+  *outData_len = plaintext_len;
+  if (outData == NULL)
+  {
+    return 0;
+  }
+  if (outData_size < plaintext_len)
   {
-    kmyth_clear_and_free(*outData, expected_out_len);
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
-  plaintext_len += (size_t)len;
 
-  // 'Finalize' Decrypt:
-  //   - validate that resultant tag matches the expected tag passed in
-  //   - should produce no more plaintext bytes in our case
-  if (EVP_DecryptFinal_ex(ctx, *outData + plaintext_len, &len) <= 0 || len < 0)
+  // input data buffer (inData) will contain the concatenation of:
+  //   - GCM_IV_LEN (12) byte IV
+  //   - resultant ciphertext (same length as the input plaintext)
+  //   - GCM_TAG_LEN (16) byte tag
+  unsigned char *iv = inData;
+  unsigned char *ciphertext = inData + GCM_IV_LEN;
+  unsigned char *tag = ciphertext + plaintext_len;
+
+  if (aes_gcm_chunk_crypt(key, key_len, 0, NULL, 0, iv,
+                          ciphertext, plaintext_len, outData, tag))
   {
-    kmyth_clear_and_free(*outData, expected_out_len);
-    EVP_CIPHER_CTX_free(ctx);
+    // don't leave unauthenticated plaintext behind
+    kmyth_clear(outData, plaintext_len);
+    *outData_len = 0;
     return 1;
   }
-  plaintext_len += (size_t)len;
 
-  // verify that the resultant PT length matches the input CT length
-  if ((size_t)plaintext_len != expected_out_len)
+  return 0;
+}
+
+//############################################################################
+// aes_gcm_decrypt_in_place()
+//############################################################################
+int aes_gcm_decrypt_in_place(unsigned char *key,
+                             size_t key_len,
+                             unsigned char *data, size_t data_len,
+                             size_t * plaintext_len)
+{
+  if (data == NULL ||
+      data_len < GCM_IV_LEN + GCM_TAG_LEN ||
+      plaintext_len == NULL)
   {
-    kmyth_clear_and_free(*outData, expected_out_len);
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
-  // now that the decryption is complete, clean-up cipher context used
-  EVP_CIPHER_CTX_free(ctx);
+  // OpenSSL only allows the output to overlap the input exactly, so the
+  // ciphertext is decrypted where it sits (after the IV) and the plaintext
+  // then moved to the start of the buffer
+  unsigned char *ciphertext = data + GCM_IV_LEN;
+
+  if (aes_gcm_decrypt_buf(key, key_len, data, data_len,
+                          ciphertext, data_len, plaintext_len))
+  {
+    return 1;
+  }
+  memmove(data, ciphertext, *plaintext_len);
 
-  *outData_len = expected_out_len;
   return 0;
 }
@@ -9,6 +9,10 @@
 #include <openssl/evp.h>
 
 #include "defines.h"
+#include "memory_util.h"
+#include "cipher/cipher_ctx.h"
+
+#include "alloc_stats.h"
 
 //############################################################################
 // aes_keywrap_3394nopad_encrypt()
@@ -25,72 +29,127 @@ int aes_keywrap_3394nopad_encrypt(unsigned char *key,
     return 1;
   }
 
-  // validate non-NULL, non-empty input plaintext buffer with a size that is
-  // a multiple of eight (8) bytes greater than or equal to 16 was specified
-  if (inData == NULL || inData_len == 0)
+  // validate the input, and get the output size, before allocating
+  size_t out_size = 0;
+
+  if (aes_keywrap_3394nopad_encrypt_buf(key, key_len, inData, inData_len,
+                                        NULL, 0, &out_size))
   {
     return 1;
   }
-  if (inData_len < 16 || inData_len % 8 != 0)
+
+  // setup output ciphertext data buffer (outData), if not provided
+  if (*outData == NULL)
   {
+    *outData = malloc(out_size);
+    if (*outData == NULL) return 1;
+  }
+
+  if (aes_keywrap_3394nopad_encrypt_buf(key, key_len, inData, inData_len,
+                                        *outData, out_size, outData_len))
+  {
+    free(*outData);
+    *outData = NULL;
     return 1;
   }
-  if (inData_len > INT_MAX)
+
+  return 0;
+}
+
+//############################################################################
+// aes_keywrap_3394nopad_decrypt()
+//############################################################################
+int aes_keywrap_3394nopad_decrypt(unsigned char *key,
+                                  size_t key_len,
+                                  unsigned char *inData,
+                                  size_t inData_len, unsigned char **outData,
+                                  size_t * outData_len)
+{
+  // validate non-NULL and non-empty decryption key specified
+  if (key == NULL || key_len == 0)
   {
     return 1;
   }
-  
-  // setup output ciphertext data buffer (outData):
-  //   - an 8-byte integrity check value is prepended to input plaintext
-  //   - the ciphertext output is the same length as the expanded plaintext
-  *outData_len = inData_len + 8;
+
+  // validate the input, and get the output size, before allocating
+  size_t out_size = 0;
+
+  if (aes_keywrap_3394nopad_decrypt_buf(key, key_len, inData, inData_len,
+                                        NULL, 0, &out_size))
+  {
+    return 1;
+  }
+
+  // setup output plaintext data buffer (outData), if not provided
   if (*outData == NULL)
   {
-    *outData = malloc(*outData_len);
+    *outData = malloc(out_size);
     if (*outData == NULL) return 1;
   }
-  // initialize the cipher context to match cipher suite being used
-  //   - OpenSSL requires the WRAP_ALLOW flag be explicitly set to use key
-  //     wrap modes through EVP.
-  EVP_CIPHER_CTX *ctx;
 
-  if (!(ctx = EVP_CIPHER_CTX_new()))
+  if (aes_keywrap_3394nopad_decrypt_buf(key, key_len, inData, inData_len,
+                                        *outData, out_size, outData_len))
   {
     free(*outData);
     *outData = NULL;
     return 1;
   }
-  EVP_CIPHER_CTX_set_flags(ctx, EVP_CIPHER_CTX_FLAG_WRAP_ALLOW);
-  int init_result = 0;
 
-  switch (key_len)
+  return 0;
+}
+
+//############################################################################
+// aes_keywrap_3394nopad_encrypt_buf()
+//############################################################################
+int aes_keywrap_3394nopad_encrypt_buf(unsigned char *key,
+                                      size_t key_len,
+                                      unsigned char *inData,
+                                      size_t inData_len,
+                                      unsigned char *outData,
+                                      size_t outData_size,
+                                      size_t * outData_len)
+{
+  // validate non-NULL, non-empty input plaintext buffer with a size that is
+  // a multiple of eight (8) bytes greater than or equal to 16 was specified
+  if (inData == NULL || inData_len == 0 || outData_len == NULL)
   {
-  case 16:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_128_wrap(), NULL, NULL, NULL);
-    break;
-  case 24:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_192_wrap(), NULL, NULL, NULL);
-    break;
-  case 32:
-    init_result = EVP_EncryptInit_ex(ctx, EVP_aes_256_wrap(), NULL, NULL, NULL);
-    break;
-  default:
-    break;
+    return 1;
   }
-  if (!init_result)
+  if (inData_len < 16 || inData_len % 8 != 0)
+  {
+    return 1;
+  }
+  if (inData_len > INT_MAX)
+  {
+    return 1;
+  }
+
+  // output ciphertext data buffer (outData):
+  //   - an 8-byte integrity check value is prepended to input plaintext
+  //   - the ciphertext output is the same length as the expanded plaintext
+  *outData_len = inData_len + 8;
+  if (outData == NULL)
+  {
+    return 0;
+  }
+  if (outData_size < *outData_len)
+  {
+    return 1;
+  }
+
+  // get a (cached) cipher context for the cipher suite being used
+  EVP_CIPHER_CTX *ctx =
+    kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_WRAP, key_len, 1);
+
+  if (ctx == NULL)
   {
-    free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
   // set the encryption key in the cipher context
-  if (!EVP_EncryptInit_ex(ctx, NULL, NULL, key, NULL))
+  if (key == NULL || !EVP_EncryptInit_ex(ctx, NULL, NULL, key, NULL))
   {
-    free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP, key_len, ctx);
     return 1;
   }
 
@@ -103,21 +162,17 @@ int aes_keywrap_3394nopad_encrypt(unsigned char *key,
   int tmp_len = 0;
 
   // encrypt (wrap) the input PT, put result in the output CT buffer
-  if (!EVP_EncryptUpdate(ctx, *outData, &tmp_len, inData, (int)inData_len))
+  if (!EVP_EncryptUpdate(ctx, outData, &tmp_len, inData, (int)inData_len))
   {
-    free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP, key_len, ctx);
     return 1;
   }
   ciphertext_len = tmp_len;
 
   // OpenSSL requires a "finalize" operation
-  if (!EVP_EncryptFinal_ex(ctx, (*outData) + ciphertext_len, &tmp_len))
+  if (!EVP_EncryptFinal_ex(ctx, outData + ciphertext_len, &tmp_len))
   {
-    free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP, key_len, ctx);
     return 1;
   }
   ciphertext_len += tmp_len;
@@ -126,40 +181,34 @@ int aes_keywrap_3394nopad_encrypt(unsigned char *key,
   // eight bytes for prepended integrity check value)
   if (ciphertext_len != *outData_len)
   {
-    free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP, key_len, ctx);
     return 1;
   }
 
   // now that the encryption is complete, clean-up cipher context
-  EVP_CIPHER_CTX_free(ctx);
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP, key_len, ctx);
 
   return 0;
 }
 
 //############################################################################
-// aes_keywrap_3394nopad_decrypt()
+// aes_keywrap_3394nopad_decrypt_buf()
 //############################################################################
-int aes_keywrap_3394nopad_decrypt(unsigned char *key,
-                                  size_t key_len,
-                                  unsigned char *inData,
-                                  size_t inData_len, unsigned char **outData,
-                                  size_t * outData_len)
+int aes_keywrap_3394nopad_decrypt_buf(unsigned char *key,
+                                      size_t key_len,
+                                      unsigned char *inData,
+                                      size_t inData_len,
+                                      unsigned char *outData,
+                                      size_t outData_size,
+                                      size_t * outData_len)
 {
-  // validate non-NULL and non-empty decryption key specified
-  if (key == NULL || key_len == 0)
-  {
-    return 1;
-  }
-
   // verify non-NULL and non-empty input ciphertext buffer of a valid length
   // (multiple of eight bytes greater than or equal to 24 bytes)
   //
   // Note: 8 bytes (64 bits) is the size of a semiblock (half of the block
   //       size) for the AES block cipher and this no-pad version of AES keywrap
   //       requires the plaintext consist of an integer number of semiblocks.
-  if (inData == NULL || inData_len == 0)
+  if (inData == NULL || inData_len == 0 || outData_len == NULL)
   {
     return 1;
   }
@@ -175,57 +224,34 @@ int aes_keywrap_3394nopad_decrypt(unsigned char *key,
   {
     return 1;
   }
+
   // output data buffer (outData) will contain the decrypted plaintext, which
-  // should be the same size as the input ciphertext data (original plaintext
-  // plus prepended 8-byte integrity check value)
-  if (*outData == NULL)
+  // should be the size of the input ciphertext data minus the 8-byte
+  // integrity check value
+  *outData_len = inData_len - 8;
+  if (outData == NULL)
   {
-    *outData = malloc(inData_len);
-    if (*outData == NULL) return 1;
+    return 0;
   }
-
-  // initialize the cipher context to match cipher suite being used
-  //   - OpenSSL requires the WRAP_ALLOW flag be explicitly set to use key
-  //     wrap modes through EVP.
-  EVP_CIPHER_CTX *ctx;
-
-  if (!(ctx = EVP_CIPHER_CTX_new()))
+  if (outData_size < *outData_len)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
     return 1;
   }
-  EVP_CIPHER_CTX_set_flags(ctx, EVP_CIPHER_CTX_FLAG_WRAP_ALLOW);
-  int init_result = 0;
+  *outData_len = 0;
 
-  switch (key_len)
-  {
-  case 16:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_128_wrap(), NULL, NULL, NULL);
-    break;
-  case 24:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_192_wrap(), NULL, NULL, NULL);
-    break;
-  case 32:
-    init_result = EVP_DecryptInit_ex(ctx, EVP_aes_256_wrap(), NULL, NULL, NULL);
-    break;
-  default:
-    break;
-  }
-  if (!init_result)
+  // get a (cached) cipher context for the cipher suite being used
+  EVP_CIPHER_CTX *ctx =
+    kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_WRAP, key_len, 0);
+
+  if (ctx == NULL)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
   // set the decryption key in the cipher context
-  if (!EVP_DecryptInit_ex(ctx, NULL, NULL, key, NULL))
+  if (key == NULL || !EVP_DecryptInit_ex(ctx, NULL, NULL, key, NULL))
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP, key_len, ctx);
     return 1;
   }
 
@@ -233,40 +259,163 @@ int aes_keywrap_3394nopad_decrypt(unsigned char *key,
   // the output plaintext length we actually end up matches the expected result
   //   - tmp_len: integer variable used to get output size from EVP functions
   int tmp_len = 0;
+  size_t plaintext_len = 0;
 
   // decrypt the input ciphertext, put result (with the prepended integrity
   // check value validated and removed) in the output plaintext buffer
-  if (!EVP_DecryptUpdate(ctx, *outData, &tmp_len, inData, (int)inData_len) || tmp_len < 0)
+  if (!EVP_DecryptUpdate(ctx, outData, &tmp_len, inData, (int)inData_len) || tmp_len < 0)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP, key_len, ctx);
     return 1;
   }
-  *outData_len = (size_t)tmp_len;
+  plaintext_len = (size_t)tmp_len;
 
   // "finalize" decryption
-  if (!EVP_DecryptFinal_ex(ctx, *outData + *outData_len, &tmp_len) || tmp_len < 0)
+  if (!EVP_DecryptFinal_ex(ctx, outData + plaintext_len, &tmp_len) || tmp_len < 0)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP, key_len, ctx);
     return 1;
   }
-  *outData_len += (size_t)tmp_len;
+  plaintext_len += (size_t)tmp_len;
 
   // verify that the resultant PT length matches the input CT length minus
   // the length of the 8-byte integrity check value
-  if (*outData_len != inData_len - 8)
+  if (plaintext_len != inData_len - 8)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP, key_len, ctx);
     return 1;
   }
 
-  // now that the encryption is complete, clean-up cipher context
-  EVP_CIPHER_CTX_free(ctx);
+  // now that the decryption is complete, clean-up cipher context
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP, key_len, ctx);
 
+  *outData_len = plaintext_len;
   return 0;
 }
+
+//############################################################################
+// aes_keywrap_3394nopad_crypt_batch()
+//############################################################################
+static int aes_keywrap_3394nopad_crypt_batch(unsigned char *key,
+                                             size_t key_len,
+                                             int enc,
+                                             size_t count,
+                                             unsigned char **inData,
+                                             size_t *inData_len,
+                                             unsigned char **outData,
+                                             size_t *outData_len)
+{
+  if (key == NULL || key_len == 0 || count == 0 || inData == NULL ||
+      inData_len == NULL || outData == NULL || outData_len == NULL)
+  {
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    outData[i] = NULL;
+    outData_len[i] = 0;
+  }
+
+  // get a (cached) cipher context, and set the key in it, once for the batch
+  EVP_CIPHER_CTX *ctx =
+    kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_WRAP, key_len, enc);
+
+  if (ctx == NULL)
+  {
+    return 1;
+  }
+  if (!EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, enc))
+  {
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP, key_len, ctx);
+    return 1;
+  }
+
+  size_t i = 0;
+
+  for (; i < count; i++)
+  {
+    // validate the input, and get the output size, before allocating
+    size_t out_size = 0;
+    int size_error = enc ?
+      aes_keywrap_3394nopad_encrypt_buf(key, key_len, inData[i], inData_len[i],
+                                        NULL, 0, &out_size) :
+      aes_keywrap_3394nopad_decrypt_buf(key, key_len, inData[i], inData_len[i],
+                                        NULL, 0, &out_size);
+
+    if (size_error)
+    {
+      break;
+    }
+    outData[i] = malloc(out_size);
+    if (outData[i] == NULL)
+    {
+      break;
+    }
+
+    // wrap/unwrap the input, re-initializing the context without a key (so
+    // keeping the key schedule) first, and verify the output length is as
+    // expected
+    int len = 0;
+    int final_len = 0;
+
+    if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, NULL, enc) ||
+        !EVP_CipherUpdate(ctx, outData[i], &len, inData[i],
+                          (int) inData_len[i]) || len < 0 ||
+        !EVP_CipherFinal_ex(ctx, outData[i] + len, &final_len) ||
+        final_len < 0 ||
+        (size_t) len + (size_t) final_len != out_size)
+    {
+      kmyth_clear_and_free(outData[i], out_size);
+      outData[i] = NULL;
+      break;
+    }
+    outData_len[i] = (size_t) len + (size_t) final_len;
+  }
+
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP, key_len, ctx);
+
+  if (i == count)
+  {
+    return 0;
+  }
+
+  // on error, return no output (clearing any keys already unwrapped)
+  for (size_t j = 0; j < i; j++)
+  {
+    kmyth_clear_and_free(outData[j], outData_len[j]);
+    outData[j] = NULL;
+    outData_len[j] = 0;
+  }
+
+  return 1;
+}
+
+//############################################################################
+// aes_keywrap_3394nopad_encrypt_batch()
+//############################################################################
+int aes_keywrap_3394nopad_encrypt_batch(unsigned char *key,
+                                        size_t key_len,
+                                        size_t count,
+                                        unsigned char **inData,
+                                        size_t *inData_len,
+                                        unsigned char **outData,
+                                        size_t *outData_len)
+{
+  return aes_keywrap_3394nopad_crypt_batch(key, key_len, 1, count, inData,
+                                           inData_len, outData, outData_len);
+}
+
+//############################################################################
+// aes_keywrap_3394nopad_decrypt_batch()
+//############################################################################
+int aes_keywrap_3394nopad_decrypt_batch(unsigned char *key,
+                                        size_t key_len,
+                                        size_t count,
+                                        unsigned char **inData,
+                                        size_t *inData_len,
+                                        unsigned char **outData,
+                                        size_t *outData_len)
+{
+  return aes_keywrap_3394nopad_crypt_batch(key, key_len, 0, count, inData,
+                                           inData_len, outData, outData_len);
+}
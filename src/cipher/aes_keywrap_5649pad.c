@@ -9,6 +9,10 @@
 #include <openssl/evp.h>
 
 #include "defines.h"
+#include "memory_util.h"
+#include "cipher/cipher_ctx.h"
+
+#include "alloc_stats.h"
 
 
 //##########################################################################
@@ -26,8 +30,94 @@ int aes_keywrap_5649pad_encrypt(unsigned char *key,
     return 1;
   }
 
+  // validate the input, and get the output size, before allocating
+  size_t out_size = 0;
+
+  if (aes_keywrap_5649pad_encrypt_buf(key, key_len, inData, inData_len,
+                                      NULL, 0, &out_size))
+  {
+    return 1;
+  }
+
+  // setup output ciphertext data buffer (outData), if not provided
+  if (*outData == NULL)
+  {
+    *outData = malloc(out_size);
+  }
+  if (*outData == NULL)
+  {
+    return 1;
+  }
+
+  if (aes_keywrap_5649pad_encrypt_buf(key, key_len, inData, inData_len,
+                                      *outData, out_size, outData_len))
+  {
+    free(*outData);
+    *outData = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+//##########################################################################
+// aes_keywrap_5649pad_decrypt()
+//##########################################################################
+int aes_keywrap_5649pad_decrypt(unsigned char *key,
+                                size_t key_len,
+                                unsigned char *inData,
+                                size_t inData_len, unsigned char **outData,
+                                size_t * outData_len)
+{
+  // validate non-NULL and non-empty decryption key specified
+  if (key == NULL || key_len == 0)
+  {
+    return 1;
+  }
+
+  // validate the input, and get the output size, before allocating
+  size_t out_size = 0;
+
+  if (aes_keywrap_5649pad_decrypt_buf(key, key_len, inData, inData_len,
+                                      NULL, 0, &out_size))
+  {
+    return 1;
+  }
+
+  // setup output plaintext data buffer (outData), if not provided
+  if (*outData == NULL)
+  {
+    *outData = malloc(out_size);
+  }
+  if (*outData == NULL)
+  {
+    return 1;
+  }
+
+  if (aes_keywrap_5649pad_decrypt_buf(key, key_len, inData, inData_len,
+                                      *outData, out_size, outData_len))
+  {
+    free(*outData);
+    *outData = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+//##########################################################################
+// aes_keywrap_5649pad_encrypt_buf()
+//##########################################################################
+int aes_keywrap_5649pad_encrypt_buf(unsigned char *key,
+                                    size_t key_len,
+                                    unsigned char *inData,
+                                    size_t inData_len,
+                                    unsigned char *outData,
+                                    size_t outData_size,
+                                    size_t * outData_len)
+{
   // verify non-NULL, non-empty input plaintext buffer of valid size
-  if (inData == NULL || inData_len == 0)
+  if (inData == NULL || inData_len == 0 || outData_len == NULL)
   {
     return 1;
   }
@@ -36,70 +126,37 @@ int aes_keywrap_5649pad_encrypt(unsigned char *key,
     return 1;
   }
 
-  // setup output ciphertext data buffer (outData)
+  // size the output ciphertext data buffer (outData)
   //   1. determine how many 8-byte blocks are required to hold the data
   //   2. add 8 to account for the 4 byte IV and 4 byte counter
-  //   3. allocate memory based on the size calculation
   size_t offset = 8;
   if(inData_len % 8 != 0)
   {
     offset += 8 - (inData_len % 8);
   }
   *outData_len = inData_len + offset;
-  if (*outData == NULL)
+  if (outData == NULL)
   {
-    *outData = malloc(*outData_len);
+    return 0;
   }
-  if (*outData == NULL)
+  if (outData_size < *outData_len)
   {
     return 1;
   }
 
-  // initialize the cipher context to match cipher suite being used
-  //   - OpenSSL requires the WRAP_ALLOW flag be explicitly set to use key
-  //     wrap modes through EVP.
-  EVP_CIPHER_CTX *ctx;
+  // get a (cached) cipher context for the cipher suite being used
+  EVP_CIPHER_CTX *ctx =
+    kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_WRAP_PAD, key_len, 1);
 
-  if (!(ctx = EVP_CIPHER_CTX_new()))
+  if (ctx == NULL)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    return 1;
-  }
-  EVP_CIPHER_CTX_set_flags(ctx, EVP_CIPHER_CTX_FLAG_WRAP_ALLOW);
-  int init_result = 0;
-
-  switch (key_len)
-  {
-  case 16:
-    init_result =
-      EVP_EncryptInit_ex(ctx, EVP_aes_128_wrap_pad(), NULL, NULL, NULL);
-    break;
-  case 24:
-    init_result =
-      EVP_EncryptInit_ex(ctx, EVP_aes_192_wrap_pad(), NULL, NULL, NULL);
-    break;
-  case 32:
-    init_result =
-      EVP_EncryptInit_ex(ctx, EVP_aes_256_wrap_pad(), NULL, NULL, NULL);
-    break;
-  default:
-    break;
-  }
-  if (!init_result)
-  {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
 
   // set the encryption key in the cipher context
-  if (!EVP_EncryptInit_ex(ctx, NULL, NULL, key, NULL))
+  if (key == NULL || !EVP_EncryptInit_ex(ctx, NULL, NULL, key, NULL))
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP_PAD, key_len, ctx);
     return 1;
   }
 
@@ -112,21 +169,17 @@ int aes_keywrap_5649pad_encrypt(unsigned char *key,
   int tmp_len = 0;
 
   // encrypt (wrap) the input PT, put result in the output CT buffer
-  if (!EVP_EncryptUpdate(ctx, *outData, &tmp_len, inData, (int)inData_len))
+  if (!EVP_EncryptUpdate(ctx, outData, &tmp_len, inData, (int)inData_len))
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP_PAD, key_len, ctx);
     return 1;
   }
   ciphertext_len = tmp_len;
 
   // OpenSSL requires a "finalize" operation
-  if (!EVP_EncryptFinal_ex(ctx, (*outData) + ciphertext_len, &tmp_len))
+  if (!EVP_EncryptFinal_ex(ctx, outData + ciphertext_len, &tmp_len))
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP_PAD, key_len, ctx);
     return 1;
   }
   ciphertext_len += tmp_len;
@@ -135,40 +188,34 @@ int aes_keywrap_5649pad_encrypt(unsigned char *key,
   // plus 4-byte IV plus 4-byte counter + any necessary padding)
   if (ciphertext_len != *outData_len)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP_PAD, key_len, ctx);
     return 1;
   }
 
   // now that the encryption is complete, clean-up cipher context
-  EVP_CIPHER_CTX_free(ctx);
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP_PAD, key_len, ctx);
 
   return 0;
 }
 
 //##########################################################################
-// aes_keywrap_5649pad_decrypt()
+// aes_keywrap_5649pad_decrypt_buf()
 //##########################################################################
-int aes_keywrap_5649pad_decrypt(unsigned char *key,
-                                size_t key_len,
-                                unsigned char *inData,
-                                size_t inData_len, unsigned char **outData,
-                                size_t * outData_len)
+int aes_keywrap_5649pad_decrypt_buf(unsigned char *key,
+                                    size_t key_len,
+                                    unsigned char *inData,
+                                    size_t inData_len,
+                                    unsigned char *outData,
+                                    size_t outData_size,
+                                    size_t * outData_len)
 {
-  // validate non-NULL and non-empty decryption key specified
-  if (key == NULL || key_len == 0)
-  {
-    return 1;
-  }
-
   // verify non-NULL and non-empty input ciphertext buffer of a valid length
   // (multiple of eight bytes greater than or equal to 8 bytes but less than
   // specification maximum)
   //
   // Note: 8 bytes (64 bits) is the size of a semiblock (half of the block
   //       size) for the AES codebook
-  if (inData == NULL || inData_len == 0)
+  if (inData == NULL || inData_len == 0 || outData_len == NULL)
   {
     return 1;
   }
@@ -186,88 +233,183 @@ int aes_keywrap_5649pad_decrypt(unsigned char *key,
   }
 
   // output data buffer (outData) will contain the decrypted plaintext, which
-  // should be the same size as the input ciphertext data (original plaintext
-  // plus prepended 4-byte integrity check value and 4-byte semiblock count
-  // plus any appended padding bytes)
-  if (*outData == NULL)
+  // is at most the size of the input ciphertext data minus the prepended
+  // 4-byte integrity check value and 4-byte semiblock count (any appended
+  // padding bytes are removed)
+  *outData_len = inData_len - 8;
+  if (outData == NULL)
   {
-    *outData = malloc(inData_len);
+    return 0;
   }
-  if (*outData == NULL)
+  if (outData_size < *outData_len)
   {
     return 1;
   }
+  *outData_len = 0;
 
-  // OpenSSL requires WRAP_ALLOW flag be explicitly set
-  // when using key wrap modes with EVP.
-  EVP_CIPHER_CTX *ctx;
+  // get a (cached) cipher context for the cipher suite being used
+  EVP_CIPHER_CTX *ctx =
+    kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_WRAP_PAD, key_len, 0);
 
-  if (!(ctx = EVP_CIPHER_CTX_new()))
+  if (ctx == NULL)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
     return 1;
   }
-  EVP_CIPHER_CTX_set_flags(ctx, EVP_CIPHER_CTX_FLAG_WRAP_ALLOW);
 
-  int init_result = 0;
-
-  switch (key_len)
+  if (key == NULL || !EVP_DecryptInit_ex(ctx, NULL, NULL, key, NULL))
   {
-  case 16:
-    init_result =
-      EVP_DecryptInit_ex(ctx, EVP_aes_128_wrap_pad(), NULL, NULL, NULL);
-    break;
-  case 24:
-    init_result =
-      EVP_DecryptInit_ex(ctx, EVP_aes_192_wrap_pad(), NULL, NULL, NULL);
-    break;
-  case 32:
-    init_result =
-      EVP_DecryptInit_ex(ctx, EVP_aes_256_wrap_pad(), NULL, NULL, NULL);
-    break;
-  default:
-    break;
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP_PAD, key_len, ctx);
+    return 1;
   }
 
-  if (!init_result)
+  int tmp_len = 0;
+  size_t plaintext_len = 0;
+
+  if (!EVP_DecryptUpdate(ctx, outData, &tmp_len, inData, (int)inData_len) || tmp_len < 0)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP_PAD, key_len, ctx);
     return 1;
   }
 
-  if (!EVP_DecryptInit_ex(ctx, NULL, NULL, key, NULL))
+  plaintext_len = (size_t)tmp_len;
+  if (!EVP_DecryptFinal_ex(ctx, outData + plaintext_len, &tmp_len) || tmp_len < 0)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP_PAD, key_len, ctx);
     return 1;
   }
 
-  int tmp_len = 0;
+  plaintext_len += (size_t)tmp_len;
+
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP_PAD, key_len, ctx);
+
+  *outData_len = plaintext_len;
+  return 0;
+}
 
-  if (!EVP_DecryptUpdate(ctx, *outData, &tmp_len, inData, (int)inData_len) || tmp_len < 0)
+//##########################################################################
+// aes_keywrap_5649pad_crypt_batch()
+//##########################################################################
+static int aes_keywrap_5649pad_crypt_batch(unsigned char *key,
+                                           size_t key_len,
+                                           int enc,
+                                           size_t count,
+                                           unsigned char **inData,
+                                           size_t *inData_len,
+                                           unsigned char **outData,
+                                           size_t *outData_len)
+{
+  if (key == NULL || key_len == 0 || count == 0 || inData == NULL ||
+      inData_len == NULL || outData == NULL || outData_len == NULL)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
     return 1;
   }
+  for (size_t i = 0; i < count; i++)
+  {
+    outData[i] = NULL;
+    outData_len[i] = 0;
+  }
+
+  // get a (cached) cipher context, and set the key in it, once for the batch
+  EVP_CIPHER_CTX *ctx =
+    kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_WRAP_PAD, key_len, enc);
 
-  *outData_len = (size_t)tmp_len;
-  if (!EVP_DecryptFinal_ex(ctx, *outData + *outData_len, &tmp_len) || tmp_len < 0)
+  if (ctx == NULL)
   {
-    if (*outData != NULL) free(*outData);
-    *outData = NULL;
-    EVP_CIPHER_CTX_free(ctx);
+    return 1;
+  }
+  if (!EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, enc))
+  {
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP_PAD, key_len, ctx);
     return 1;
   }
 
-  *outData_len += (size_t)tmp_len;
+  size_t i = 0;
 
-  EVP_CIPHER_CTX_free(ctx);
+  for (; i < count; i++)
+  {
+    // validate the input, and get the output size, before allocating
+    size_t out_size = 0;
+    int size_error = enc ?
+      aes_keywrap_5649pad_encrypt_buf(key, key_len, inData[i], inData_len[i],
+                                      NULL, 0, &out_size) :
+      aes_keywrap_5649pad_decrypt_buf(key, key_len, inData[i], inData_len[i],
+                                      NULL, 0, &out_size);
+
+    if (size_error)
+    {
+      break;
+    }
+    outData[i] = malloc(out_size);
+    if (outData[i] == NULL)
+    {
+      break;
+    }
+
+    // wrap/unwrap the input, re-initializing the context without a key (so
+    // keeping the key schedule) first, and verify the output length is as
+    // expected (unwrapping removes any padding, so may give less)
+    int len = 0;
+    int final_len = 0;
+
+    if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, NULL, enc) ||
+        !EVP_CipherUpdate(ctx, outData[i], &len, inData[i],
+                          (int) inData_len[i]) || len < 0 ||
+        !EVP_CipherFinal_ex(ctx, outData[i] + len, &final_len) ||
+        final_len < 0 ||
+        (size_t) len + (size_t) final_len > out_size ||
+        (enc && (size_t) len + (size_t) final_len != out_size))
+    {
+      kmyth_clear_and_free(outData[i], out_size);
+      outData[i] = NULL;
+      break;
+    }
+    outData_len[i] = (size_t) len + (size_t) final_len;
+  }
 
-  return 0;
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_WRAP_PAD, key_len, ctx);
+
+  if (i == count)
+  {
+    return 0;
+  }
+
+  // on error, return no output (clearing any keys already unwrapped)
+  for (size_t j = 0; j < i; j++)
+  {
+    kmyth_clear_and_free(outData[j], outData_len[j]);
+    outData[j] = NULL;
+    outData_len[j] = 0;
+  }
+
+  return 1;
+}
+
+//##########################################################################
+// aes_keywrap_5649pad_encrypt_batch()
+//##########################################################################
+int aes_keywrap_5649pad_encrypt_batch(unsigned char *key,
+                                      size_t key_len,
+                                      size_t count,
+                                      unsigned char **inData,
+                                      size_t *inData_len,
+                                      unsigned char **outData,
+                                      size_t *outData_len)
+{
+  return aes_keywrap_5649pad_crypt_batch(key, key_len, 1, count, inData,
+                                         inData_len, outData, outData_len);
+}
+
+//##########################################################################
+// aes_keywrap_5649pad_decrypt_batch()
+//##########################################################################
+int aes_keywrap_5649pad_decrypt_batch(unsigned char *key,
+                                      size_t key_len,
+                                      size_t count,
+                                      unsigned char **inData,
+                                      size_t *inData_len,
+                                      unsigned char **outData,
+                                      size_t *outData_len)
+{
+  return aes_keywrap_5649pad_crypt_batch(key, key_len, 0, count, inData,
+                                         inData_len, outData, outData_len);
 }
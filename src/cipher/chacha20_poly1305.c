@@ -0,0 +1,266 @@
+/**
+ * @file  chacha20_poly1305.c
+ *
+ * @brief Implements ChaCha20-Poly1305 for kmyth.
+ */
+
+#include "cipher/chacha20_poly1305.h"
+
+#include <limits.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+
+#include "memory_util.h"
+#include "cipher/cipher_ctx.h"
+#include "cipher/nonce_drbg.h"
+
+#include "alloc_stats.h"
+
+//############################################################################
+// chacha20_poly1305_encrypt()
+//############################################################################
+int chacha20_poly1305_encrypt(unsigned char *key,
+                              size_t key_len,
+                              unsigned char *inData, size_t inData_len,
+                              unsigned char **outData, size_t * outData_len)
+{
+  size_t out_size = 0;
+
+  // validate the parameters, and get the output size, before allocating
+  if (key == NULL || key_len == 0 ||
+      chacha20_poly1305_encrypt_buf(key, key_len, inData, inData_len,
+                                    NULL, 0, &out_size))
+  {
+    return 1;
+  }
+
+  *outData = malloc(out_size);
+  if (*outData == NULL) // failed malloc
+  {
+    return 1;
+  }
+
+  if (chacha20_poly1305_encrypt_buf(key, key_len, inData, inData_len,
+                                    *outData, out_size, outData_len))
+  {
+    free(*outData);
+    *outData = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// chacha20_poly1305_decrypt()
+//############################################################################
+int chacha20_poly1305_decrypt(unsigned char *key,
+                              size_t key_len,
+                              unsigned char *inData, size_t inData_len,
+                              unsigned char **outData, size_t * outData_len)
+{
+  size_t out_size = 0;
+
+  // validate the parameters, and get the output size, before allocating
+  if (key == NULL || key_len == 0 ||
+      chacha20_poly1305_decrypt_buf(key, key_len, inData, inData_len,
+                                    NULL, 0, &out_size))
+  {
+    return 1;
+  }
+
+  // Setting here to save some cleanup on error conditions.
+  *outData_len = 0;
+  *outData = malloc(out_size);
+  if (*outData == NULL && out_size > 0)
+  {
+    return 1;
+  }
+
+  if (chacha20_poly1305_decrypt_buf(key, key_len, inData, inData_len,
+                                    *outData, out_size, outData_len))
+  {
+    kmyth_clear_and_free(*outData, out_size);
+    *outData = NULL;
+    *outData_len = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// chacha20_poly1305_crypt()
+//############################################################################
+static int chacha20_poly1305_crypt(unsigned char *key, size_t key_len,
+                                   int encrypt,
+                                   unsigned char *iv,
+                                   unsigned char *inData, size_t inData_len,
+                                   unsigned char *outData, unsigned char *tag)
+{
+  if (key == NULL || key_len != CHACHA20_POLY1305_KEY_LEN ||
+      inData_len > INT_MAX)
+  {
+    return 1;
+  }
+
+  EVP_CIPHER_CTX *ctx =
+    kmyth_cipher_ctx_acquire(KMYTH_CIPHER_CHACHA20_POLY1305, key_len,
+                             encrypt);
+
+  if (ctx == NULL)
+  {
+    return 1;
+  }
+
+  // OpenSSL insists on int lengths
+  int len = 0;
+  int final_len = 0;
+
+  if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN,
+                           CHACHA20_POLY1305_IV_LEN, NULL) ||
+      !EVP_CipherInit_ex(ctx, NULL, NULL, key, iv, encrypt) ||
+      (!encrypt &&
+       !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG,
+                            CHACHA20_POLY1305_TAG_LEN, tag)) ||
+      (inData_len > 0 &&
+       !EVP_CipherUpdate(ctx, outData, &len, inData, (int) inData_len)) ||
+      EVP_CipherFinal_ex(ctx, outData, &final_len) <= 0 || final_len != 0 ||
+      (encrypt &&
+       !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG,
+                            CHACHA20_POLY1305_TAG_LEN, tag)))
+  {
+    kmyth_cipher_ctx_release(KMYTH_CIPHER_CHACHA20_POLY1305, key_len, ctx);
+    return 1;
+  }
+
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_CHACHA20_POLY1305, key_len, ctx);
+  return 0;
+}
+
+//############################################################################
+// chacha20_poly1305_encrypt_buf()
+//############################################################################
+int chacha20_poly1305_encrypt_buf(unsigned char *key,
+                                  size_t key_len,
+                                  unsigned char *inData, size_t inData_len,
+                                  unsigned char *outData, size_t outData_size,
+                                  size_t * outData_len)
+{
+  // validate non-NULL input plaintext buffer of a length OpenSSL accepts
+  if (inData == NULL || inData_len > INT_MAX || outData_len == NULL)
+  {
+    return 1;
+  }
+
+  // output data buffer (outData) will contain the concatenation of:
+  //   - CHACHA20_POLY1305_IV_LEN (12) byte IV
+  //   - resultant ciphertext (same length as the input plaintext)
+  //   - CHACHA20_POLY1305_TAG_LEN (16) byte tag
+  *outData_len =
+    CHACHA20_POLY1305_IV_LEN + inData_len + CHACHA20_POLY1305_TAG_LEN;
+  if (outData == NULL)
+  {
+    return 0;
+  }
+  if (outData_size < *outData_len)
+  {
+    return 1;
+  }
+
+  unsigned char *iv = outData;
+  unsigned char *ciphertext = iv + CHACHA20_POLY1305_IV_LEN;
+  unsigned char *tag = ciphertext + inData_len;
+
+  // create the IV - a random 96 bit nonce, as for AES/GCM
+  if (kmyth_nonce_bytes(iv, CHACHA20_POLY1305_IV_LEN))
+  {
+    return 1;
+  }
+
+  return chacha20_poly1305_crypt(key, key_len, 1, iv,
+                                 inData, inData_len, ciphertext, tag);
+}
+
+//############################################################################
+// chacha20_poly1305_decrypt_buf()
+//############################################################################
+int chacha20_poly1305_decrypt_buf(unsigned char *key,
+                                  size_t key_len,
+                                  unsigned char *inData, size_t inData_len,
+                                  unsigned char *outData, size_t outData_size,
+                                  size_t * outData_len)
+{
+  // validate non-NULL input ciphertext buffer, long enough to hold (at
+  // least) the IV and tag, of a length OpenSSL accepts
+  if (inData == NULL ||
+      inData_len < CHACHA20_POLY1305_IV_LEN + CHACHA20_POLY1305_TAG_LEN ||
+      inData_len > INT_MAX || outData_len == NULL)
+  {
+    return 1;
+  }
+
+  // output data buffer (outData) will contain only the plaintext, which
+  // should be sized as the input minus the lengths of the IV and tag fields
+  size_t plaintext_len =
+    inData_len - (CHACHA20_POLY1305_IV_LEN + CHACHA20_POLY1305_TAG_LEN);
+
+  *outData_len = plaintext_len;
+  if (outData == NULL)
+  {
+    return 0;
+  }
+  if (outData_size < plaintext_len)
+  {
+    return 1;
+  }
+
+  // input data buffer (inData) will contain the concatenation of:
+  //   - CHACHA20_POLY1305_IV_LEN (12) byte IV
+  //   - resultant ciphertext (same length as the input plaintext)
+  //   - CHACHA20_POLY1305_TAG_LEN (16) byte tag
+  unsigned char *iv = inData;
+  unsigned char *ciphertext = inData + CHACHA20_POLY1305_IV_LEN;
+  unsigned char *tag = ciphertext + plaintext_len;
+
+  if (chacha20_poly1305_crypt(key, key_len, 0, iv,
+                              ciphertext, plaintext_len, outData, tag))
+  {
+    // don't leave unauthenticated plaintext behind
+    kmyth_clear(outData, plaintext_len);
+    *outData_len = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// chacha20_poly1305_decrypt_in_place()
+//############################################################################
+int chacha20_poly1305_decrypt_in_place(unsigned char *key,
+                                       size_t key_len,
+                                       unsigned char *data, size_t data_len,
+                                       size_t * plaintext_len)
+{
+  if (data == NULL ||
+      data_len < CHACHA20_POLY1305_IV_LEN + CHACHA20_POLY1305_TAG_LEN ||
+      plaintext_len == NULL)
+  {
+    return 1;
+  }
+
+  // as for AES/GCM, the ciphertext is decrypted where it sits (after the
+  // IV), and the plaintext then moved to the start of the buffer
+  unsigned char *ciphertext = data + CHACHA20_POLY1305_IV_LEN;
+
+  if (chacha20_poly1305_decrypt_buf(key, key_len, data, data_len,
+                                    ciphertext, data_len, plaintext_len))
+  {
+    return 1;
+  }
+  memmove(data, ciphertext, *plaintext_len);
+
+  return 0;
+}
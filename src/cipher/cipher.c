@@ -5,6 +5,7 @@
 
 #include "cipher/cipher.h"
 
+#include <pthread.h>
 #include <string.h>
 
 #include <openssl/rand.h>
@@ -14,6 +15,16 @@
 #include "cipher/aes_gcm.h"
 #include "cipher/aes_keywrap_3394nopad.h"
 #include "cipher/aes_keywrap_5649pad.h"
+#include "cipher/chacha20_poly1305.h"
+#include "cipher/cipher_ctx.h"
+#include "tpm/kmyth_metrics.h"
+
+#if defined(__linux__) && (defined(__aarch64__) || defined(__arm__))
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "alloc_stats.h"
 
 // Check for supported OpenSSL version
 //   - OpenSSL v1.1.x required for AES KeyWrap RFC5649 w/ padding
@@ -31,39 +42,88 @@
 const cipher_t cipher_list[] = {
   {.cipher_name = "AES/GCM/NoPadding/256",
    .encrypt_fn = aes_gcm_encrypt,
-   .decrypt_fn = aes_gcm_decrypt},
+   .decrypt_fn = aes_gcm_decrypt,
+   .encrypt_buf_fn = aes_gcm_encrypt_buf,
+   .decrypt_buf_fn = aes_gcm_decrypt_buf,
+   .decrypt_in_place_fn = aes_gcm_decrypt_in_place,
+   .stream_init_fn = aes_gcm_stream_init,
+   .stream_update_fn = aes_gcm_stream_update,
+   .stream_final_fn = aes_gcm_stream_final},
 
   {.cipher_name = "AES/GCM/NoPadding/192",
    .encrypt_fn = aes_gcm_encrypt,
-   .decrypt_fn = aes_gcm_decrypt},
+   .decrypt_fn = aes_gcm_decrypt,
+   .encrypt_buf_fn = aes_gcm_encrypt_buf,
+   .decrypt_buf_fn = aes_gcm_decrypt_buf,
+   .decrypt_in_place_fn = aes_gcm_decrypt_in_place,
+   .stream_init_fn = aes_gcm_stream_init,
+   .stream_update_fn = aes_gcm_stream_update,
+   .stream_final_fn = aes_gcm_stream_final},
 
   {.cipher_name = "AES/GCM/NoPadding/128",
    .encrypt_fn = aes_gcm_encrypt,
-   .decrypt_fn = aes_gcm_decrypt},
+   .decrypt_fn = aes_gcm_decrypt,
+   .encrypt_buf_fn = aes_gcm_encrypt_buf,
+   .decrypt_buf_fn = aes_gcm_decrypt_buf,
+   .decrypt_in_place_fn = aes_gcm_decrypt_in_place,
+   .stream_init_fn = aes_gcm_stream_init,
+   .stream_update_fn = aes_gcm_stream_update,
+   .stream_final_fn = aes_gcm_stream_final},
+
+  {.cipher_name = "ChaCha20/Poly1305/NoPadding/256",
+   .encrypt_fn = chacha20_poly1305_encrypt,
+   .decrypt_fn = chacha20_poly1305_decrypt,
+   .encrypt_buf_fn = chacha20_poly1305_encrypt_buf,
+   .decrypt_buf_fn = chacha20_poly1305_decrypt_buf,
+   .decrypt_in_place_fn = chacha20_poly1305_decrypt_in_place},
 
   {.cipher_name = "AES/KeyWrap/RFC3394NoPadding/256",
    .encrypt_fn = aes_keywrap_3394nopad_encrypt,
-   .decrypt_fn = aes_keywrap_3394nopad_decrypt},
+   .decrypt_fn = aes_keywrap_3394nopad_decrypt,
+   .encrypt_buf_fn = aes_keywrap_3394nopad_encrypt_buf,
+   .decrypt_buf_fn = aes_keywrap_3394nopad_decrypt_buf,
+   .encrypt_batch_fn = aes_keywrap_3394nopad_encrypt_batch,
+   .decrypt_batch_fn = aes_keywrap_3394nopad_decrypt_batch},
 
   {.cipher_name = "AES/KeyWrap/RFC3394NoPadding/192",
    .encrypt_fn = aes_keywrap_3394nopad_encrypt,
-   .decrypt_fn = aes_keywrap_3394nopad_decrypt},
+   .decrypt_fn = aes_keywrap_3394nopad_decrypt,
+   .encrypt_buf_fn = aes_keywrap_3394nopad_encrypt_buf,
+   .decrypt_buf_fn = aes_keywrap_3394nopad_decrypt_buf,
+   .encrypt_batch_fn = aes_keywrap_3394nopad_encrypt_batch,
+   .decrypt_batch_fn = aes_keywrap_3394nopad_decrypt_batch},
 
   {.cipher_name = "AES/KeyWrap/RFC3394NoPadding/128",
    .encrypt_fn = aes_keywrap_3394nopad_encrypt,
-   .decrypt_fn = aes_keywrap_3394nopad_decrypt},
+   .decrypt_fn = aes_keywrap_3394nopad_decrypt,
+   .encrypt_buf_fn = aes_keywrap_3394nopad_encrypt_buf,
+   .decrypt_buf_fn = aes_keywrap_3394nopad_decrypt_buf,
+   .encrypt_batch_fn = aes_keywrap_3394nopad_encrypt_batch,
+   .decrypt_batch_fn = aes_keywrap_3394nopad_decrypt_batch},
 
   {.cipher_name = "AES/KeyWrap/RFC5649Padding/256",
    .encrypt_fn = aes_keywrap_5649pad_encrypt,
-   .decrypt_fn = aes_keywrap_5649pad_decrypt},
+   .decrypt_fn = aes_keywrap_5649pad_decrypt,
+   .encrypt_buf_fn = aes_keywrap_5649pad_encrypt_buf,
+   .decrypt_buf_fn = aes_keywrap_5649pad_decrypt_buf,
+   .encrypt_batch_fn = aes_keywrap_5649pad_encrypt_batch,
+   .decrypt_batch_fn = aes_keywrap_5649pad_decrypt_batch},
 
   {.cipher_name = "AES/KeyWrap/RFC5649Padding/192",
    .encrypt_fn = aes_keywrap_5649pad_encrypt,
-   .decrypt_fn = aes_keywrap_5649pad_decrypt},
+   .decrypt_fn = aes_keywrap_5649pad_decrypt,
+   .encrypt_buf_fn = aes_keywrap_5649pad_encrypt_buf,
+   .decrypt_buf_fn = aes_keywrap_5649pad_decrypt_buf,
+   .encrypt_batch_fn = aes_keywrap_5649pad_encrypt_batch,
+   .decrypt_batch_fn = aes_keywrap_5649pad_decrypt_batch},
 
   {.cipher_name = "AES/KeyWrap/RFC5649Padding/128",
    .encrypt_fn = aes_keywrap_5649pad_encrypt,
-   .decrypt_fn = aes_keywrap_5649pad_decrypt},
+   .decrypt_fn = aes_keywrap_5649pad_decrypt,
+   .encrypt_buf_fn = aes_keywrap_5649pad_encrypt_buf,
+   .decrypt_buf_fn = aes_keywrap_5649pad_decrypt_buf,
+   .encrypt_batch_fn = aes_keywrap_5649pad_encrypt_batch,
+   .decrypt_batch_fn = aes_keywrap_5649pad_decrypt_batch},
 
   {.cipher_name = NULL,
    .encrypt_fn = NULL,
@@ -102,6 +162,56 @@ cipher_t kmyth_get_cipher_t_from_string(char *cipher_string)
   return cipher;
 }
 
+// set once by probe_cpu_aes()
+static bool cpu_has_aes = true;
+static pthread_once_t cpu_aes_once = PTHREAD_ONCE_INIT;
+
+//############################################################################
+// probe_cpu_aes()
+//############################################################################
+static void probe_cpu_aes(void)
+{
+  // AES/GCM needs both AES rounds and the carry-less multiply (for GHASH)
+  // in hardware to beat ChaCha20-Poly1305. Hosts that can't be probed keep
+  // the AES/GCM default.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  __builtin_cpu_init();
+  cpu_has_aes = __builtin_cpu_supports("aes") &&
+    __builtin_cpu_supports("pclmul");
+#elif defined(__linux__) && defined(__aarch64__)
+  unsigned long hwcap = getauxval(AT_HWCAP);
+
+  cpu_has_aes = (hwcap & HWCAP_AES) && (hwcap & HWCAP_PMULL);
+#elif defined(__linux__) && defined(__arm__)
+  unsigned long hwcap2 = getauxval(AT_HWCAP2);
+
+  cpu_has_aes = (hwcap2 & HWCAP2_AES) && (hwcap2 & HWCAP2_PMULL);
+#endif
+}
+
+//############################################################################
+// kmyth_get_auto_cipher()
+//############################################################################
+cipher_t kmyth_get_auto_cipher(bool streaming)
+{
+  pthread_once(&cpu_aes_once, probe_cpu_aes);
+
+  if (!cpu_has_aes && !streaming)
+  {
+    cipher_t cipher = kmyth_get_cipher_t_from_string(KMYTH_AUTO_CIPHER_NO_AES);
+
+    // OpenSSL may have been built without ChaCha20-Poly1305
+    if (cipher.cipher_name != NULL &&
+        kmyth_get_evp_cipher(KMYTH_CIPHER_CHACHA20_POLY1305,
+                             CHACHA20_POLY1305_KEY_LEN) != NULL)
+    {
+      return cipher;
+    }
+  }
+
+  return kmyth_get_cipher_t_from_string(KMYTH_AUTO_CIPHER_AES);
+}
+
 size_t get_key_len_from_cipher(cipher_t cipher)
 {
   if (cipher.cipher_name == NULL)
@@ -173,8 +283,10 @@ int kmyth_encrypt_data(unsigned char *data,
                              *enc_key_size,
                              data, data_size, enc_data, enc_data_size))
   {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_CIPHER);
     return 1;
   }
+  kmyth_metrics_count_cipher_bytes(cipher_spec.cipher_name, true, data_size);
 
   return 0;
 }
@@ -209,6 +321,295 @@ int kmyth_decrypt_data(unsigned char *enc_data,
   *result_size = 0;
   if (cipher_spec.decrypt_fn(key, key_size, enc_data,
                              enc_data_size, result, result_size))
+  {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_CIPHER);
+    return 1;
+  }
+  kmyth_metrics_count_cipher_bytes(cipher_spec.cipher_name, false,
+                                   *result_size);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_encrypt_data_buf
+//############################################################################
+int kmyth_encrypt_data_buf(unsigned char *data,
+                           size_t data_size,
+                           cipher_t cipher_spec,
+                           unsigned char *enc_data,
+                           size_t enc_data_capacity,
+                           size_t * enc_data_size,
+                           unsigned char *enc_key, size_t enc_key_size)
+{
+  if (cipher_spec.cipher_name == NULL || cipher_spec.encrypt_buf_fn == NULL)
+  {
+    return 1;
+  }
+  if (data == NULL || data_size == 0 || enc_data_size == NULL)
+  {
+    return 1;
+  }
+  if (enc_key == NULL || enc_key_size == 0 || enc_key_size > INT_MAX)
+  {
+    return 1;
+  }
+
+  // a size query needs no key
+  if (enc_data != NULL &&
+      !RAND_bytes(enc_key, (int) enc_key_size))
+  {
+    return 1;
+  }
+
+  *enc_data_size = 0;
+  if (cipher_spec.encrypt_buf_fn(enc_key, enc_key_size, data, data_size,
+                                 enc_data, enc_data_capacity, enc_data_size))
+  {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_CIPHER);
+    return 1;
+  }
+  if (enc_data != NULL)
+  {
+    kmyth_metrics_count_cipher_bytes(cipher_spec.cipher_name, true,
+                                     data_size);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_decrypt_data_buf
+//############################################################################
+int kmyth_decrypt_data_buf(unsigned char *enc_data,
+                           size_t enc_data_size,
+                           cipher_t cipher_spec,
+                           unsigned char *key,
+                           size_t key_size,
+                           unsigned char *result,
+                           size_t result_capacity, size_t * result_size)
+{
+  if (enc_data == NULL || enc_data_size == 0)
+  {
+    return 1;
+  }
+  if (cipher_spec.cipher_name == NULL || cipher_spec.decrypt_buf_fn == NULL)
+  {
+    return 1;
+  }
+  // (a size query does not need the key)
+  if (result != NULL && (key == NULL || key_size == 0))
+  {
+    return 1;
+  }
+  if (result_size == NULL)
+  {
+    return 1;
+  }
+
+  *result_size = 0;
+  if (cipher_spec.decrypt_buf_fn(key, key_size, enc_data, enc_data_size,
+                                 result, result_capacity, result_size))
+  {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_CIPHER);
+    return 1;
+  }
+  if (result != NULL)
+  {
+    kmyth_metrics_count_cipher_bytes(cipher_spec.cipher_name, false,
+                                     *result_size);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_encrypt_data_batch
+//############################################################################
+int kmyth_encrypt_data_batch(size_t count,
+                             unsigned char **data,
+                             size_t *data_sizes,
+                             cipher_t cipher_spec,
+                             unsigned char **enc_data,
+                             size_t *enc_data_sizes,
+                             unsigned char **enc_key, size_t * enc_key_size)
+{
+  if (cipher_spec.cipher_name == NULL || cipher_spec.encrypt_batch_fn == NULL)
+  {
+    return 1;
+  }
+  if (count == 0 || data == NULL || data_sizes == NULL)
+  {
+    return 1;
+  }
+  if (enc_data == NULL || enc_data_sizes == NULL)
+  {
+    return 1;
+  }
+  if (enc_key == NULL || *enc_key == NULL || enc_key_size == NULL)
+  {
+    return 1;
+  }
+  if (*enc_key_size == 0 || *enc_key_size > INT_MAX)
+  {
+    return 1;
+  }
+  // create one symmetric key (wrapping key) of the desired size for the batch
+  if (!RAND_bytes(*enc_key, (int) (*enc_key_size)))
+  {
+    return 1;
+  }
+
+  if (cipher_spec.encrypt_batch_fn(*enc_key, *enc_key_size, count,
+                                   data, data_sizes,
+                                   enc_data, enc_data_sizes))
+  {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_CIPHER);
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    kmyth_metrics_count_cipher_bytes(cipher_spec.cipher_name, true,
+                                     data_sizes[i]);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_decrypt_data_batch
+//############################################################################
+int kmyth_decrypt_data_batch(size_t count,
+                             unsigned char **enc_data,
+                             size_t *enc_data_sizes,
+                             cipher_t cipher_spec,
+                             unsigned char *key,
+                             size_t key_size,
+                             unsigned char **result, size_t *result_sizes)
+{
+  if (cipher_spec.cipher_name == NULL || cipher_spec.decrypt_batch_fn == NULL)
+  {
+    return 1;
+  }
+  if (count == 0 || enc_data == NULL || enc_data_sizes == NULL)
+  {
+    return 1;
+  }
+  if (key == NULL || key_size == 0)
+  {
+    return 1;
+  }
+  if (result == NULL || result_sizes == NULL)
+  {
+    return 1;
+  }
+
+  if (cipher_spec.decrypt_batch_fn(key, key_size, count,
+                                   enc_data, enc_data_sizes,
+                                   result, result_sizes))
+  {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_CIPHER);
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    kmyth_metrics_count_cipher_bytes(cipher_spec.cipher_name, false,
+                                     result_sizes[i]);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_decrypt_data_in_place
+//############################################################################
+int kmyth_decrypt_data_in_place(unsigned char *enc_data,
+                                size_t enc_data_size,
+                                cipher_t cipher_spec,
+                                unsigned char *key,
+                                size_t key_size, size_t * result_size)
+{
+  if (enc_data == NULL || enc_data_size == 0)
+  {
+    return 1;
+  }
+  if (cipher_spec.cipher_name == NULL ||
+      cipher_spec.decrypt_in_place_fn == NULL)
+  {
+    return 1;
+  }
+  if (key == NULL || key_size == 0)
+  {
+    return 1;
+  }
+  if (result_size == NULL)
+  {
+    return 1;
+  }
+
+  *result_size = 0;
+  if (cipher_spec.decrypt_in_place_fn(key, key_size, enc_data,
+                                      enc_data_size, result_size))
+  {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_CIPHER);
+    return 1;
+  }
+  kmyth_metrics_count_cipher_bytes(cipher_spec.cipher_name, false,
+                                   *result_size);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_encrypt_stream_init
+//############################################################################
+int kmyth_encrypt_stream_init(cipher_t cipher_spec,
+                              unsigned char **enc_key,
+                              size_t * enc_key_size, void **state)
+{
+  if (cipher_spec.cipher_name == NULL || cipher_spec.stream_init_fn == NULL)
+  {
+    return 1;
+  }
+  if (enc_key == NULL || *enc_key == NULL || state == NULL)
+  {
+    return 1;
+  }
+  if (*enc_key_size == 0 || *enc_key_size > INT_MAX)
+  {
+    return 1;
+  }
+  // create symmetric key (wrapping key) of the desired size
+  if (!RAND_bytes(*enc_key, (int) (*enc_key_size)))
+  {
+    return 1;
+  }
+
+  if (cipher_spec.stream_init_fn(*enc_key, *enc_key_size, true, state))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_decrypt_stream_init
+//############################################################################
+int kmyth_decrypt_stream_init(cipher_t cipher_spec,
+                              unsigned char *key,
+                              size_t key_size, void **state)
+{
+  if (cipher_spec.cipher_name == NULL || cipher_spec.stream_init_fn == NULL)
+  {
+    return 1;
+  }
+  if (key == NULL || key_size == 0 || state == NULL)
+  {
+    return 1;
+  }
+
+  if (cipher_spec.stream_init_fn(key, key_size, false, state))
   {
     return 1;
   }
@@ -0,0 +1,259 @@
+/**
+ * @file  cipher_ctx.c
+ *
+ * @brief Implements the cached OpenSSL cipher objects and per-thread cipher
+ *        contexts used by the kmyth cipher implementations.
+ */
+
+#include "cipher/cipher_ctx.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include <openssl/opensslv.h>
+
+#include "alloc_stats.h"
+
+// the supported key lengths are 16, 24, and 32 bytes
+#define KMYTH_CIPHER_KEY_LEN_COUNT 3
+#define KMYTH_CIPHER_MAX_KEY_LEN 32
+
+static const EVP_CIPHER
+  *evp_ciphers[KMYTH_CIPHER_FAMILY_COUNT][KMYTH_CIPHER_KEY_LEN_COUNT];
+static pthread_once_t evp_ciphers_once = PTHREAD_ONCE_INIT;
+
+// The cipher contexts cached by a thread, freed when the thread exits
+typedef struct
+{
+  EVP_CIPHER_CTX *ctx[KMYTH_CIPHER_FAMILY_COUNT][KMYTH_CIPHER_KEY_LEN_COUNT];
+  bool in_use[KMYTH_CIPHER_FAMILY_COUNT][KMYTH_CIPHER_KEY_LEN_COUNT];
+} cipher_ctx_cache;
+
+static pthread_key_t cache_key;
+static bool cache_key_created = false;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+//############################################################################
+// key_len_index()
+//############################################################################
+static int key_len_index(size_t key_len)
+{
+  switch (key_len)
+  {
+  case 16:
+    return 0;
+  case 24:
+    return 1;
+  case 32:
+    return 2;
+  default:
+    return -1;
+  }
+}
+
+//############################################################################
+// init_evp_ciphers()
+//############################################################################
+static void init_evp_ciphers(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  // fetch the implementations once, rather than on every initialization
+  static const char *names[KMYTH_CIPHER_FAMILY_COUNT]
+    [KMYTH_CIPHER_KEY_LEN_COUNT] = {
+    {"AES-128-GCM", "AES-192-GCM", "AES-256-GCM"},
+    {"AES-128-WRAP", "AES-192-WRAP", "AES-256-WRAP"},
+    {"AES-128-WRAP-PAD", "AES-192-WRAP-PAD", "AES-256-WRAP-PAD"},
+    {NULL, NULL, "ChaCha20-Poly1305"}
+  };
+
+  for (size_t f = 0; f < KMYTH_CIPHER_FAMILY_COUNT; f++)
+  {
+    for (size_t k = 0; k < KMYTH_CIPHER_KEY_LEN_COUNT; k++)
+    {
+      if (names[f][k] != NULL)
+      {
+        evp_ciphers[f][k] = EVP_CIPHER_fetch(NULL, names[f][k], NULL);
+      }
+    }
+  }
+#else
+  evp_ciphers[KMYTH_CIPHER_AES_GCM][0] = EVP_aes_128_gcm();
+  evp_ciphers[KMYTH_CIPHER_AES_GCM][1] = EVP_aes_192_gcm();
+  evp_ciphers[KMYTH_CIPHER_AES_GCM][2] = EVP_aes_256_gcm();
+  evp_ciphers[KMYTH_CIPHER_AES_WRAP][0] = EVP_aes_128_wrap();
+  evp_ciphers[KMYTH_CIPHER_AES_WRAP][1] = EVP_aes_192_wrap();
+  evp_ciphers[KMYTH_CIPHER_AES_WRAP][2] = EVP_aes_256_wrap();
+  evp_ciphers[KMYTH_CIPHER_AES_WRAP_PAD][0] = EVP_aes_128_wrap_pad();
+  evp_ciphers[KMYTH_CIPHER_AES_WRAP_PAD][1] = EVP_aes_192_wrap_pad();
+  evp_ciphers[KMYTH_CIPHER_AES_WRAP_PAD][2] = EVP_aes_256_wrap_pad();
+#ifndef OPENSSL_NO_CHACHA
+  evp_ciphers[KMYTH_CIPHER_CHACHA20_POLY1305][2] = EVP_chacha20_poly1305();
+#endif
+#endif
+}
+
+//############################################################################
+// free_cipher_ctx_cache()
+//############################################################################
+static void free_cipher_ctx_cache(void *arg)
+{
+  cipher_ctx_cache *cache = (cipher_ctx_cache *) arg;
+
+  for (size_t f = 0; f < KMYTH_CIPHER_FAMILY_COUNT; f++)
+  {
+    for (size_t k = 0; k < KMYTH_CIPHER_KEY_LEN_COUNT; k++)
+    {
+      EVP_CIPHER_CTX_free(cache->ctx[f][k]);
+    }
+  }
+  free(cache);
+}
+
+//############################################################################
+// create_cache_key()
+//############################################################################
+static void create_cache_key(void)
+{
+  cache_key_created =
+    (pthread_key_create(&cache_key, free_cipher_ctx_cache) == 0);
+}
+
+//############################################################################
+// get_cipher_ctx_cache()
+//############################################################################
+static cipher_ctx_cache *get_cipher_ctx_cache(void)
+{
+  pthread_once(&cache_key_once, create_cache_key);
+  if (!cache_key_created)
+  {
+    return NULL;
+  }
+
+  cipher_ctx_cache *cache = pthread_getspecific(cache_key);
+
+  if (cache == NULL)
+  {
+    cache = calloc(1, sizeof(cipher_ctx_cache));
+    if (cache != NULL && pthread_setspecific(cache_key, cache) != 0)
+    {
+      free(cache);
+      cache = NULL;
+    }
+  }
+
+  return cache;
+}
+
+//############################################################################
+// kmyth_get_evp_cipher()
+//############################################################################
+const EVP_CIPHER *kmyth_get_evp_cipher(kmyth_cipher_family family,
+                                       size_t key_len)
+{
+  int k = key_len_index(key_len);
+
+  if (family >= KMYTH_CIPHER_FAMILY_COUNT || k < 0)
+  {
+    return NULL;
+  }
+
+  pthread_once(&evp_ciphers_once, init_evp_ciphers);
+
+  return evp_ciphers[family][k];
+}
+
+//############################################################################
+// kmyth_cipher_ctx_acquire()
+//############################################################################
+EVP_CIPHER_CTX *kmyth_cipher_ctx_acquire(kmyth_cipher_family family,
+                                         size_t key_len, int enc)
+{
+  const EVP_CIPHER *cipher = kmyth_get_evp_cipher(family, key_len);
+
+  if (cipher == NULL)
+  {
+    return NULL;
+  }
+
+  int k = key_len_index(key_len);
+  cipher_ctx_cache *cache = get_cipher_ctx_cache();
+  EVP_CIPHER_CTX *ctx = NULL;
+
+  if (cache != NULL && !cache->in_use[family][k])
+  {
+    // a cached context already holds the cipher, so only its direction
+    // needs to be (re)set
+    ctx = cache->ctx[family][k];
+    if (ctx != NULL && EVP_CipherInit_ex(ctx, NULL, NULL, NULL, NULL, enc))
+    {
+      cache->in_use[family][k] = true;
+      return ctx;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    cache->ctx[family][k] = NULL;
+  }
+
+  ctx = EVP_CIPHER_CTX_new();
+  if (ctx == NULL)
+  {
+    return NULL;
+  }
+
+  // OpenSSL requires the WRAP_ALLOW flag be explicitly set to use key
+  // wrap modes through EVP
+  if (family == KMYTH_CIPHER_AES_WRAP || family == KMYTH_CIPHER_AES_WRAP_PAD)
+  {
+    EVP_CIPHER_CTX_set_flags(ctx, EVP_CIPHER_CTX_FLAG_WRAP_ALLOW);
+  }
+
+  if (!EVP_CipherInit_ex(ctx, cipher, NULL, NULL, NULL, enc))
+  {
+    EVP_CIPHER_CTX_free(ctx);
+    return NULL;
+  }
+
+  // a context allocated while the cached one is in use is not cached
+  if (cache != NULL && !cache->in_use[family][k])
+  {
+    cache->ctx[family][k] = ctx;
+    cache->in_use[family][k] = true;
+  }
+
+  return ctx;
+}
+
+//############################################################################
+// kmyth_cipher_ctx_release()
+//############################################################################
+void kmyth_cipher_ctx_release(kmyth_cipher_family family, size_t key_len,
+                              EVP_CIPHER_CTX * ctx)
+{
+  if (ctx == NULL)
+  {
+    return;
+  }
+
+  int k = key_len_index(key_len);
+  cipher_ctx_cache *cache = NULL;
+
+  if (family < KMYTH_CIPHER_FAMILY_COUNT && k >= 0 && cache_key_created)
+  {
+    cache = pthread_getspecific(cache_key);
+  }
+
+  if (cache != NULL && cache->ctx[family][k] == ctx)
+  {
+    cache->in_use[family][k] = false;
+
+    // don't leave the last key used in the cached context
+    unsigned char zero_key[KMYTH_CIPHER_MAX_KEY_LEN] = { 0 };
+
+    if (EVP_CipherInit_ex(ctx, NULL, NULL, zero_key, NULL, -1))
+    {
+      return;
+    }
+    cache->ctx[family][k] = NULL;
+  }
+
+  EVP_CIPHER_CTX_free(ctx);
+}
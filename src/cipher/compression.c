@@ -0,0 +1,310 @@
+/**
+ * @file  compression.c
+ *
+ * @brief Implements the optional (zstd) compression stage for kmyth.
+ */
+
+#include "cipher/compression.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zstd.h>
+
+#include "memory_util.h"
+
+#include "alloc_stats.h"
+
+// state of an incremental decompression - once the end of the compressed
+// stream has been reached, any further input is an error
+typedef struct
+{
+  ZSTD_DCtx *dctx;
+  bool finished;
+} kmyth_decompress_state;
+
+//############################################################################
+// kmyth_get_compression_from_string()
+//############################################################################
+int kmyth_get_compression_from_string(const char *name,
+                                      kmyth_compression_t * compression)
+{
+  if (name == NULL || compression == NULL)
+  {
+    return 1;
+  }
+
+  if (strcmp(name, KMYTH_COMPRESSION_ZSTD_NAME) == 0)
+  {
+    *compression = KMYTH_COMPRESSION_ZSTD;
+    return 0;
+  }
+  if (strcmp(name, KMYTH_COMPRESSION_NONE_NAME) == 0)
+  {
+    *compression = KMYTH_COMPRESSION_NONE;
+    return 0;
+  }
+
+  return 1;
+}
+
+//############################################################################
+// kmyth_get_compression_name()
+//############################################################################
+const char *kmyth_get_compression_name(kmyth_compression_t compression)
+{
+  if (compression == KMYTH_COMPRESSION_ZSTD)
+  {
+    return KMYTH_COMPRESSION_ZSTD_NAME;
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// kmyth_compress_data()
+//############################################################################
+int kmyth_compress_data(kmyth_compression_t compression,
+                        uint8_t * inData, size_t inData_len,
+                        uint8_t ** outData, size_t *outData_len)
+{
+  if (compression != KMYTH_COMPRESSION_ZSTD || inData == NULL ||
+      inData_len == 0 || outData == NULL || outData_len == NULL)
+  {
+    return 1;
+  }
+
+  size_t out_size = ZSTD_compressBound(inData_len);
+  uint8_t *out = malloc(out_size);
+
+  if (out == NULL)
+  {
+    return 1;
+  }
+
+  // the one piece (ZSTD_compress) frame records its content size, which
+  // kmyth_decompress_data() relies on
+  size_t out_len = ZSTD_compress(out, out_size, inData, inData_len,
+                                 KMYTH_COMPRESSION_ZSTD_LEVEL);
+
+  if (ZSTD_isError(out_len))
+  {
+    free(out);
+    return 1;
+  }
+
+  *outData = out;
+  *outData_len = out_len;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_decompress_data()
+//############################################################################
+int kmyth_decompress_data(kmyth_compression_t compression,
+                          uint8_t * inData, size_t inData_len,
+                          uint8_t ** outData, size_t *outData_len)
+{
+  if (compression != KMYTH_COMPRESSION_ZSTD || inData == NULL ||
+      inData_len == 0 || outData == NULL || outData_len == NULL)
+  {
+    return 1;
+  }
+
+  // the input must be exactly one frame, of known (non-zero) content size
+  unsigned long long content_size =
+    ZSTD_getFrameContentSize(inData, inData_len);
+  size_t frame_size = ZSTD_findFrameCompressedSize(inData, inData_len);
+
+  if (content_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+      content_size == ZSTD_CONTENTSIZE_ERROR ||
+      content_size == 0 || content_size > SIZE_MAX ||
+      ZSTD_isError(frame_size) || frame_size != inData_len)
+  {
+    return 1;
+  }
+
+  size_t out_size = (size_t) content_size;
+  uint8_t *out = malloc(out_size);
+
+  if (out == NULL)
+  {
+    return 1;
+  }
+
+  size_t out_len = ZSTD_decompress(out, out_size, inData, inData_len);
+
+  if (ZSTD_isError(out_len) || out_len != out_size)
+  {
+    kmyth_clear_and_free(out, out_size);
+    return 1;
+  }
+
+  *outData = out;
+  *outData_len = out_len;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_compress_stream_init()
+//############################################################################
+int kmyth_compress_stream_init(kmyth_compression_t compression, void **state)
+{
+  if (compression != KMYTH_COMPRESSION_ZSTD || state == NULL)
+  {
+    return 1;
+  }
+
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+
+  if (cctx == NULL ||
+      ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                          KMYTH_COMPRESSION_ZSTD_LEVEL)))
+  {
+    ZSTD_freeCCtx(cctx);
+    return 1;
+  }
+
+  *state = cctx;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_compress_stream_update()
+//############################################################################
+int kmyth_compress_stream_update(void *state,
+                                 uint8_t * inData, size_t inData_len,
+                                 size_t *inData_used, bool end,
+                                 uint8_t * outData, size_t outData_size,
+                                 size_t *outData_len, bool *done)
+{
+  if (state == NULL || (inData == NULL && inData_len != 0) ||
+      inData_used == NULL || outData == NULL || outData_size == 0 ||
+      outData_len == NULL || done == NULL)
+  {
+    return 1;
+  }
+
+  ZSTD_inBuffer in = {.src = inData,.size = inData_len,.pos = 0 };
+  ZSTD_outBuffer out = {.dst = outData,.size = outData_size,.pos = 0 };
+  size_t remaining = ZSTD_compressStream2((ZSTD_CCtx *) state, &out, &in,
+                                          end ? ZSTD_e_end : ZSTD_e_continue);
+
+  if (ZSTD_isError(remaining))
+  {
+    return 1;
+  }
+
+  *inData_used = in.pos;
+  *outData_len = out.pos;
+  *done = (end && remaining == 0);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_compress_stream_free()
+//############################################################################
+void kmyth_compress_stream_free(void *state)
+{
+  ZSTD_freeCCtx((ZSTD_CCtx *) state);
+}
+
+//############################################################################
+// kmyth_decompress_stream_init()
+//############################################################################
+int kmyth_decompress_stream_init(kmyth_compression_t compression,
+                                 void **state)
+{
+  if (compression != KMYTH_COMPRESSION_ZSTD || state == NULL)
+  {
+    return 1;
+  }
+
+  kmyth_decompress_state *dstate = calloc(1, sizeof(kmyth_decompress_state));
+
+  if (dstate == NULL)
+  {
+    return 1;
+  }
+  dstate->dctx = ZSTD_createDCtx();
+  if (dstate->dctx == NULL)
+  {
+    free(dstate);
+    return 1;
+  }
+  dstate->finished = false;
+
+  *state = dstate;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_decompress_stream_update()
+//############################################################################
+int kmyth_decompress_stream_update(void *state,
+                                   uint8_t * inData, size_t inData_len,
+                                   size_t *inData_used,
+                                   uint8_t * outData, size_t outData_size,
+                                   size_t *outData_len, bool *done)
+{
+  kmyth_decompress_state *dstate = (kmyth_decompress_state *) state;
+
+  if (dstate == NULL || (inData == NULL && inData_len != 0) ||
+      inData_used == NULL || outData == NULL || outData_size == 0 ||
+      outData_len == NULL || done == NULL)
+  {
+    return 1;
+  }
+
+  *inData_used = 0;
+  *outData_len = 0;
+  if (dstate->finished)
+  {
+    // nothing may follow the end of the compressed stream
+    *done = true;
+    return (inData_len != 0);
+  }
+
+  ZSTD_inBuffer in = {.src = inData,.size = inData_len,.pos = 0 };
+  ZSTD_outBuffer out = {.dst = outData,.size = outData_size,.pos = 0 };
+  size_t remaining = ZSTD_decompressStream(dstate->dctx, &out, &in);
+
+  if (ZSTD_isError(remaining))
+  {
+    return 1;
+  }
+
+  *inData_used = in.pos;
+  *outData_len = out.pos;
+  if (remaining == 0)
+  {
+    dstate->finished = true;
+    if (in.pos != in.size)
+    {
+      return 1;
+    }
+  }
+  *done = dstate->finished;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_decompress_stream_free()
+//############################################################################
+void kmyth_decompress_stream_free(void *state)
+{
+  kmyth_decompress_state *dstate = (kmyth_decompress_state *) state;
+
+  if (dstate == NULL)
+  {
+    return;
+  }
+  ZSTD_freeDCtx(dstate->dctx);
+  free(dstate);
+}
@@ -0,0 +1,282 @@
+/**
+ * @file  nonce_drbg.c
+ *
+ * @brief Implements the per-thread random bit generators used for the
+ *        nonces and IVs produced by kmyth.
+ */
+
+#include "cipher/nonce_drbg.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/opensslv.h>
+#include <openssl/rand.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/rand_drbg.h>
+#endif
+
+#include "alloc_stats.h"
+
+// a thread's DRBG is reseeded from the primary DRBG after this many
+// requests, or this many seconds, as OpenSSL's own per-thread DRBGs are
+#define NONCE_DRBG_RESEED_REQUESTS (1U << 16)
+#define NONCE_DRBG_RESEED_SECONDS (7 * 60)
+
+// security strength, in bits, of the AES-256 CTR-DRBG
+#define NONCE_DRBG_STRENGTH 256
+
+// the most bytes requested of a DRBG at once (well below the maximum
+// request size of any SP 800-90A DRBG)
+#define NONCE_DRBG_MAX_REQUEST 4096
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_RAND_CTX nonce_drbg;
+static EVP_RAND *ctr_drbg = NULL;
+#else
+typedef RAND_DRBG nonce_drbg;
+#endif
+
+// The DRBG of a thread, freed when the thread exits
+typedef struct
+{
+  nonce_drbg *drbg;
+
+  // the fork generation the DRBG was instantiated in
+  unsigned long generation;
+
+  // the DRBG could not be instantiated (in this generation)
+  bool unavailable;
+} nonce_drbg_state;
+
+static pthread_key_t state_key;
+static bool state_key_created = false;
+static bool use_rand_bytes = false;
+static pthread_once_t state_key_once = PTHREAD_ONCE_INIT;
+
+// incremented in the child process of every fork()
+static unsigned long fork_generation = 0;
+
+//############################################################################
+// free_drbg()
+//############################################################################
+static void free_drbg(nonce_drbg * drbg)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  EVP_RAND_CTX_free(drbg);
+#else
+  RAND_DRBG_free(drbg);
+#endif
+}
+
+//############################################################################
+// free_drbg_state()
+//############################################################################
+static void free_drbg_state(void *arg)
+{
+  nonce_drbg_state *state = (nonce_drbg_state *) arg;
+
+  free_drbg(state->drbg);
+  free(state);
+}
+
+//############################################################################
+// fork_child()
+//############################################################################
+static void fork_child(void)
+{
+  // only the forking thread exists in the child, and it re-instantiates
+  // its DRBG (inherited from the parent) before using it again
+  __atomic_fetch_add(&fork_generation, 1, __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// create_state_key()
+//############################################################################
+static void create_state_key(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  // the implementation is fetched (from the default library context, so
+  // any configured provider, e.g. FIPS, is used) once per process
+  ctr_drbg = EVP_RAND_fetch(NULL, "CTR-DRBG", NULL);
+  use_rand_bytes = (ctr_drbg == NULL);
+#else
+  // if an engine has replaced OpenSSL's RAND method, its output is used
+  use_rand_bytes = (RAND_get_rand_method() != RAND_OpenSSL());
+#endif
+
+  if (pthread_atfork(NULL, NULL, fork_child) != 0)
+  {
+    use_rand_bytes = true;
+  }
+
+  state_key_created =
+    (pthread_key_create(&state_key, free_drbg_state) == 0);
+}
+
+//############################################################################
+// new_drbg()
+//############################################################################
+static nonce_drbg *new_drbg(unsigned long generation)
+{
+  // the personalization string makes every instantiation distinct, even
+  // across processes sharing a seed
+  char pers[96];
+  int pers_len = snprintf(pers, sizeof(pers), "kmyth nonce %ld %lu %lu",
+                          (long) getpid(), (unsigned long) pthread_self(),
+                          generation);
+
+  if (pers_len < 0 || (size_t) pers_len >= sizeof(pers))
+  {
+    return NULL;
+  }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  EVP_RAND_CTX *drbg = EVP_RAND_CTX_new(ctr_drbg, RAND_get0_primary(NULL));
+
+  if (drbg == NULL)
+  {
+    return NULL;
+  }
+
+  unsigned int reseed_requests = NONCE_DRBG_RESEED_REQUESTS;
+  time_t reseed_seconds = NONCE_DRBG_RESEED_SECONDS;
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_construct_utf8_string(OSSL_DRBG_PARAM_CIPHER,
+                                     (char *) "AES-256-CTR", 0),
+    OSSL_PARAM_construct_uint(OSSL_DRBG_PARAM_RESEED_REQUESTS,
+                              &reseed_requests),
+    OSSL_PARAM_construct_time_t(OSSL_DRBG_PARAM_RESEED_TIME_INTERVAL,
+                                &reseed_seconds),
+    OSSL_PARAM_construct_end()
+  };
+
+  if (!EVP_RAND_instantiate(drbg, NONCE_DRBG_STRENGTH, 0,
+                            (unsigned char *) pers, (size_t) pers_len,
+                            params))
+  {
+    EVP_RAND_CTX_free(drbg);
+    return NULL;
+  }
+#else
+  RAND_DRBG *drbg = RAND_DRBG_new(NID_aes_256_ctr, 0,
+                                  RAND_DRBG_get0_master());
+
+  if (drbg == NULL)
+  {
+    return NULL;
+  }
+
+  if (!RAND_DRBG_set_reseed_interval(drbg, NONCE_DRBG_RESEED_REQUESTS) ||
+      !RAND_DRBG_set_reseed_time_interval(drbg, NONCE_DRBG_RESEED_SECONDS) ||
+      !RAND_DRBG_instantiate(drbg, (unsigned char *) pers,
+                             (size_t) pers_len))
+  {
+    RAND_DRBG_free(drbg);
+    return NULL;
+  }
+#endif
+
+  return drbg;
+}
+
+//############################################################################
+// get_drbg()
+//############################################################################
+static nonce_drbg *get_drbg(void)
+{
+  pthread_once(&state_key_once, create_state_key);
+  if (!state_key_created || use_rand_bytes)
+  {
+    return NULL;
+  }
+
+  nonce_drbg_state *state = pthread_getspecific(state_key);
+
+  if (state == NULL)
+  {
+    state = calloc(1, sizeof(nonce_drbg_state));
+    if (state == NULL)
+    {
+      return NULL;
+    }
+    if (pthread_setspecific(state_key, state) != 0)
+    {
+      free(state);
+      return NULL;
+    }
+    state->generation = __atomic_load_n(&fork_generation, __ATOMIC_RELAXED);
+  }
+
+  unsigned long generation =
+    __atomic_load_n(&fork_generation, __ATOMIC_RELAXED);
+
+  // a DRBG inherited across a fork() would repeat the parent's output
+  if (state->generation != generation)
+  {
+    free_drbg(state->drbg);
+    state->drbg = NULL;
+    state->unavailable = false;
+    state->generation = generation;
+  }
+
+  if (state->drbg == NULL && !state->unavailable)
+  {
+    state->drbg = new_drbg(generation);
+    state->unavailable = (state->drbg == NULL);
+  }
+
+  return state->drbg;
+}
+
+//############################################################################
+// kmyth_nonce_bytes()
+//############################################################################
+int kmyth_nonce_bytes(unsigned char *buf, size_t len)
+{
+  if (buf == NULL && len > 0)
+  {
+    return 1;
+  }
+
+  nonce_drbg *drbg = get_drbg();
+
+  for (size_t offset = 0; offset < len; offset += NONCE_DRBG_MAX_REQUEST)
+  {
+    size_t chunk = len - offset;
+
+    if (chunk > NONCE_DRBG_MAX_REQUEST)
+    {
+      chunk = NONCE_DRBG_MAX_REQUEST;
+    }
+
+    int ok;
+
+    if (drbg == NULL)
+    {
+      ok = RAND_bytes(buf + offset, (int) chunk);
+    }
+    else
+    {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+      ok = EVP_RAND_generate(drbg, buf + offset, chunk, 0, 0, NULL, 0);
+#else
+      ok = RAND_DRBG_bytes(drbg, buf + offset, chunk);
+#endif
+    }
+
+    if (ok != 1)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
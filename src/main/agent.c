@@ -0,0 +1,1219 @@
+/*
+ * Kmyth Agent - unsealed data cache daemon - TPM 2.0
+ *
+ * Serves the unsealed contents of .ski files to local clients over a UNIX
+ * domain socket, unsealing each file with the TPM only when it is not
+ * already cached.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "agent_util.h"
+#include "boot_util.h"
+#include "defines.h"
+#include "file_io.h"
+#include "kmyth.h"
+#include "kmyth_log.h"
+#include "memory_util.h"
+#include "socket_util.h"
+
+static volatile sig_atomic_t agent_running = 1;
+
+// The .ski files re-sealed after a PCR change (see agent_on_pcr_change()),
+// each with whether it is currently sealed with a policy-OR.
+typedef struct
+{
+  char *paths[KMYTH_AGENT_MAX_RESEAL];
+  uint8_t policy_or[KMYTH_AGENT_MAX_RESEAL];
+  size_t len;
+} agent_reseal_list;
+
+// An unseal running on a worker thread. Requests for the same file (with
+// the same policy-OR flag) arriving meanwhile wait for its result, rather
+// than unsealing the file again. Only the worker touches ski_bytes, result,
+// data and data_len until it reports the flight done.
+typedef struct
+{
+  bool active;
+  agent_file_id id;
+  uint8_t policy_or;
+  uint64_t generation;
+  unsigned int ttl;
+  size_t waiters;
+  kmyth_pool_t *pool;
+  uint8_t *ski_bytes;
+  size_t ski_bytes_len;
+  uint8_t *auth_bytes;
+  size_t auth_bytes_len;
+  uint8_t *owner_auth_bytes;
+  size_t oa_bytes_len;
+  int result;
+  uint8_t *data;
+  size_t data_len;
+  int done_fd;
+  uint32_t index;
+  pthread_t thread;
+} agent_flight;
+
+// A client waiting for a flight's result
+typedef struct
+{
+  int fd;
+  size_t flight;
+} agent_waiter;
+
+// The unseals in progress, and their waiting clients. Workers report a
+// finished flight by writing its index to the done pipe. The generation
+// is bumped whenever cached entries are dropped, so that a flight started
+// before then does not cache its (possibly stale) result.
+typedef struct
+{
+  agent_flight flights[KMYTH_AGENT_MAX_FLIGHTS];
+  size_t flights_len;
+  agent_waiter waiters[KMYTH_AGENT_MAX_WAITING];
+  size_t waiters_len;
+  int done_pipe[2];
+  uint64_t generation;
+} agent_inflight;
+
+// What the boot manifest's keys are cached in (see agent_boot_deliver())
+typedef struct
+{
+  agent_cache *cache;
+  unsigned int ttl;
+} agent_boot_state;
+
+// State the PCR watchers' callback works on. The watchers are checked from
+// the main loop, so the callback runs there too.
+typedef struct
+{
+  agent_cache *cache;
+  agent_inflight *inflight;
+  bool reseal_pending;
+} agent_watch_state;
+
+static void handle_signal(int signum)
+{
+  (void) signum;
+  agent_running = 0;
+}
+
+//############################################################################
+// agent_now()
+//############################################################################
+static time_t agent_now(void)
+{
+  struct timespec ts = { 0 };
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+//############################################################################
+// agent_now_ms()
+//############################################################################
+static int64_t agent_now_ms(void)
+{
+  struct timespec ts = { 0 };
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//############################################################################
+// parse_pcrs_string()
+//############################################################################
+static int parse_pcrs_string(char *pcrs_string, int **pcrs, int *pcrs_len)
+{
+  *pcrs_len = 0;
+
+  if (pcrs_string == NULL)
+  {
+    return 0;
+  }
+
+  size_t pcrs_array_size = 24;
+
+  *pcrs = malloc(pcrs_array_size * sizeof(int));
+  if (*pcrs == NULL)
+  {
+    kmyth_log(LOG_ERR,
+              "failed to allocate memory to parse PCR string ... exiting");
+    return 1;
+  }
+
+  char *pcrs_string_cur = pcrs_string;
+  char *pcrs_string_next = NULL;
+
+  while (*pcrs_string_cur != '\0')
+  {
+    long pcrIndex = strtol(pcrs_string_cur, &pcrs_string_next, 10);
+
+    if (pcrIndex == LONG_MIN || pcrIndex == LONG_MAX
+        || pcrs_string_cur == pcrs_string_next
+        || (!isblank(*pcrs_string_next) && (*pcrs_string_next != ',')
+            && (*pcrs_string_next != '\0')))
+    {
+      kmyth_log(LOG_ERR, "error parsing PCR string ... exiting");
+      free(*pcrs);
+      *pcrs = NULL;
+      *pcrs_len = 0;
+      return 1;
+    }
+
+    while ((*pcrs_string_next != '\0')
+           && (isblank(*pcrs_string_next) || (*pcrs_string_next == ',')))
+    {
+      pcrs_string_next++;
+    }
+
+    if ((size_t) *pcrs_len == pcrs_array_size)
+    {
+      int *new_pcrs = realloc(*pcrs, pcrs_array_size * 2 * sizeof(int));
+
+      if (new_pcrs == NULL)
+      {
+        kmyth_log(LOG_ERR, "Ran out of memory ... exiting");
+        free(*pcrs);
+        *pcrs = NULL;
+        *pcrs_len = 0;
+        return 1;
+      }
+      *pcrs = new_pcrs;
+      pcrs_array_size *= 2;
+    }
+    (*pcrs)[*pcrs_len] = (int) pcrIndex;
+    (*pcrs_len)++;
+    pcrs_string_cur = pcrs_string_next;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// agent_on_pcr_change()
+//############################################################################
+static void agent_on_pcr_change(const kmyth_pcr_change_t * change, void *arg)
+{
+  agent_watch_state *state = (agent_watch_state *) arg;
+
+  (void) change;
+
+  // data unsealed under the old PCR values might no longer unseal, so
+  // none of it is served from the cache any more
+  agent_cache_clear(state->cache);
+  state->inflight->generation++;
+  kmyth_log(LOG_INFO, "PCRs changed - flushed cache");
+  state->reseal_pending = true;
+}
+
+//############################################################################
+// agent_reseal_file()
+//############################################################################
+static int agent_reseal_file(kmyth_ctx_t * ctx, char *path,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             int *pcrs, size_t pcrs_len,
+                             uint8_t bool_policy_or)
+{
+  uint8_t *input = NULL;
+  size_t input_len = 0;
+  bool input_mapped = false;
+
+  if (map_bytes_from_file(path, &input, &input_len, &input_mapped))
+  {
+    kmyth_log(LOG_ERR, "error reading .ski file (%s)", path);
+    return 1;
+  }
+
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+  int retval = tpm2_kmyth_rewrap(ctx, input, input_len, &output, &output_len,
+                                 auth_bytes, auth_bytes_len,
+                                 owner_auth_bytes, oa_bytes_len,
+                                 pcrs, pcrs_len, NULL, bool_policy_or);
+
+  unmap_bytes_from_file(input, input_len, input_mapped);
+  if (retval == 0)
+  {
+    retval = write_bytes_to_file_atomic(path, output, output_len, true);
+  }
+  free(output);
+
+  return retval;
+}
+
+//############################################################################
+// agent_reseal_all()
+//############################################################################
+static void agent_reseal_all(kmyth_ctx_t * ctx, agent_reseal_list * list,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             int *pcrs, size_t pcrs_len)
+{
+  for (size_t i = 0; i < list->len; i++)
+  {
+    if (agent_reseal_file(ctx, list->paths[i],
+                          auth_bytes, auth_bytes_len,
+                          owner_auth_bytes, oa_bytes_len,
+                          pcrs, pcrs_len, list->policy_or[i]))
+    {
+      kmyth_log(LOG_ERR, "unable to re-seal %s", list->paths[i]);
+      continue;
+    }
+    // it is now sealed to the current values alone
+    list->policy_or[i] = 0;
+    kmyth_log(LOG_INFO, "re-sealed %s", list->paths[i]);
+  }
+}
+
+//############################################################################
+// agent_peer_allowed()
+//############################################################################
+static bool agent_peer_allowed(int client_fd, uid_t * allowed_uids,
+                               size_t allowed_uids_len)
+{
+  struct ucred cred = { 0 };
+  socklen_t cred_len = sizeof(cred);
+
+  if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len))
+  {
+    kmyth_log(LOG_ERR, "unable to get client credentials");
+    return false;
+  }
+
+  if (cred.uid == 0 || cred.uid == geteuid())
+  {
+    return true;
+  }
+  for (size_t i = 0; i < allowed_uids_len; i++)
+  {
+    if (cred.uid == allowed_uids[i])
+    {
+      return true;
+    }
+  }
+
+  kmyth_log(LOG_WARNING, "rejected request from uid %u (pid %d)",
+            (unsigned int) cred.uid, (int) cred.pid);
+  return false;
+}
+
+//############################################################################
+// agent_read_ski()
+//############################################################################
+static int agent_read_ski(int ski_fd, const struct stat *st,
+                          uint8_t ** ski_bytes, size_t *ski_bytes_len)
+{
+  *ski_bytes = NULL;
+  *ski_bytes_len = 0;
+
+  if (!S_ISREG(st->st_mode) || st->st_size <= 0)
+  {
+    kmyth_log(LOG_ERR, "passed file is not a non-empty regular file");
+    return 1;
+  }
+
+  *ski_bytes = malloc((size_t) st->st_size);
+  if (*ski_bytes == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate %lld bytes for .ski file",
+              (long long) st->st_size);
+    return 1;
+  }
+  if (read_from_fd(ski_fd, *ski_bytes, (size_t) st->st_size, ski_bytes_len) ||
+      *ski_bytes_len != (size_t) st->st_size)
+  {
+    kmyth_log(LOG_ERR, "unable to read passed .ski file");
+    free(*ski_bytes);
+    *ski_bytes = NULL;
+    *ski_bytes_len = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// agent_flight_run()
+//############################################################################
+static void *agent_flight_run(void *arg)
+{
+  agent_flight *flight = (agent_flight *) arg;
+
+  flight->result = tpm2_kmyth_unseal_pool(flight->pool,
+                                          flight->ski_bytes,
+                                          flight->ski_bytes_len,
+                                          &flight->data, &flight->data_len,
+                                          flight->auth_bytes,
+                                          flight->auth_bytes_len,
+                                          flight->owner_auth_bytes,
+                                          flight->oa_bytes_len,
+                                          flight->policy_or);
+  free(flight->ski_bytes);
+  flight->ski_bytes = NULL;
+
+  // what is kept (and cached) is moved to the secure heap straight away
+  uint8_t *data = NULL;
+
+  if (flight->result == 0)
+  {
+    data = kmyth_secure_alloc(flight->data_len);
+    if (data == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate unsealed data");
+      flight->result = 1;
+    }
+    else
+    {
+      memcpy(data, flight->data, flight->data_len);
+    }
+  }
+  kmyth_clear_and_free(flight->data, flight->data_len);
+  flight->data = data;
+  if (flight->data == NULL)
+  {
+    flight->data_len = 0;
+  }
+
+  // (a pipe write this small is atomic, and the pipe has room for every
+  // flight's index)
+  if (write(flight->done_fd, &flight->index, sizeof(flight->index)) !=
+      sizeof(flight->index))
+  {
+    kmyth_log(LOG_ERR, "unable to report finished unseal");
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// agent_flight_start()
+//############################################################################
+static agent_flight *agent_flight_start(agent_inflight * inflight,
+                                        kmyth_pool_t * pool,
+                                        const agent_file_id * id,
+                                        uint8_t policy_or,
+                                        uint8_t * ski_bytes,
+                                        size_t ski_bytes_len,
+                                        uint8_t * auth_bytes,
+                                        size_t auth_bytes_len,
+                                        uint8_t * owner_auth_bytes,
+                                        size_t oa_bytes_len)
+{
+  agent_flight *flight = NULL;
+
+  for (size_t i = 0; i < KMYTH_AGENT_MAX_FLIGHTS; i++)
+  {
+    if (!inflight->flights[i].active)
+    {
+      flight = &inflight->flights[i];
+      flight->index = (uint32_t) i;
+      break;
+    }
+  }
+  if (flight == NULL)
+  {
+    return NULL;
+  }
+
+  flight->id = *id;
+  flight->policy_or = policy_or;
+  flight->generation = inflight->generation;
+  flight->ttl = 0;
+  flight->waiters = 0;
+  flight->pool = pool;
+  flight->ski_bytes = ski_bytes;
+  flight->ski_bytes_len = ski_bytes_len;
+  flight->auth_bytes = auth_bytes;
+  flight->auth_bytes_len = auth_bytes_len;
+  flight->owner_auth_bytes = owner_auth_bytes;
+  flight->oa_bytes_len = oa_bytes_len;
+  flight->result = 1;
+  flight->data = NULL;
+  flight->data_len = 0;
+  flight->done_fd = inflight->done_pipe[1];
+
+  if (pthread_create(&flight->thread, NULL, agent_flight_run, flight))
+  {
+    kmyth_log(LOG_ERR, "unable to start unseal thread");
+    flight->ski_bytes = NULL;
+    return NULL;
+  }
+  flight->active = true;
+  inflight->flights_len++;
+
+  return flight;
+}
+
+//############################################################################
+// agent_flight_finish()
+//############################################################################
+static void agent_flight_finish(agent_inflight * inflight, size_t index,
+                                agent_cache * cache)
+{
+  agent_flight *flight = &inflight->flights[index];
+
+  pthread_join(flight->thread, NULL);
+
+  // every client waiting on the flight gets its result (or error)
+  size_t kept = 0;
+
+  for (size_t i = 0; i < inflight->waiters_len; i++)
+  {
+    agent_waiter *waiter = &inflight->waiters[i];
+
+    if (waiter->flight != index)
+    {
+      inflight->waiters[kept++] = *waiter;
+      continue;
+    }
+    if (flight->result)
+    {
+      agent_send_error(waiter->fd, "unseal failed");
+    }
+    else
+    {
+      agent_send_ok(waiter->fd, flight->data, flight->data_len);
+    }
+    close(waiter->fd);
+  }
+  inflight->waiters_len = kept;
+
+  if (flight->result == 0)
+  {
+    kmyth_log(LOG_DEBUG, "unsealed %zu bytes for %zu client(s)",
+              flight->data_len, flight->waiters);
+
+    // nothing unsealed before the cache was last flushed is cached
+    if (flight->generation != inflight->generation)
+    {
+      kmyth_secure_free(flight->data);
+    }
+    else if (agent_cache_insert(cache, &flight->id, flight->data,
+                                flight->data_len,
+                                agent_now() + flight->ttl) == 0)
+    {
+      kmyth_log(LOG_DEBUG, "cached %zu bytes for %u seconds",
+                flight->data_len, flight->ttl);
+    }
+  }
+  flight->data = NULL;
+  flight->data_len = 0;
+  flight->active = false;
+  inflight->flights_len--;
+}
+
+//############################################################################
+// agent_flights_finish_all()
+//############################################################################
+static void agent_flights_finish_all(agent_inflight * inflight,
+                                     agent_cache * cache)
+{
+  while (inflight->flights_len > 0)
+  {
+    uint32_t index = 0;
+    ssize_t got = read(inflight->done_pipe[0], &index, sizeof(index));
+
+    if (got < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (got != sizeof(index) || index >= KMYTH_AGENT_MAX_FLIGHTS ||
+        !inflight->flights[index].active)
+    {
+      kmyth_log(LOG_ERR, "bad unseal completion report");
+      return;
+    }
+    agent_flight_finish(inflight, index, cache);
+  }
+}
+
+//############################################################################
+// agent_handle_request()
+//############################################################################
+static bool agent_handle_request(int client_fd, kmyth_pool_t * pool,
+                                 agent_cache * cache,
+                                 agent_inflight * inflight,
+                                 unsigned int max_ttl,
+                                 uint8_t * auth_bytes, size_t auth_bytes_len,
+                                 uint8_t * owner_auth_bytes,
+                                 size_t oa_bytes_len)
+{
+  char line[KMYTH_AGENT_MAX_LINE_LEN] = { 0 };
+  int ski_fd = -1;
+  kmyth_agent_request request = { 0 };
+
+  if (agent_recv_request(client_fd, line, &ski_fd)
+      || agent_parse_request(line, &request))
+  {
+    agent_send_error(client_fd, "invalid request");
+    if (ski_fd != -1)
+    {
+      close(ski_fd);
+    }
+    return false;
+  }
+
+  if (request.cmd == KMYTH_AGENT_FLUSH)
+  {
+    if (ski_fd != -1)
+    {
+      close(ski_fd);
+    }
+    agent_cache_clear(cache);
+    inflight->generation++;
+    kmyth_log(LOG_INFO, "flushed cache");
+    agent_send_ok(client_fd, NULL, 0);
+    return false;
+  }
+
+  struct stat st = { 0 };
+
+  if (ski_fd == -1 || fstat(ski_fd, &st))
+  {
+    agent_send_error(client_fd, "no .ski file passed");
+    if (ski_fd != -1)
+    {
+      close(ski_fd);
+    }
+    return false;
+  }
+
+  agent_file_id id;
+
+  agent_file_id_from_stat(&st, &id);
+
+  if (request.cmd == KMYTH_AGENT_INVALIDATE)
+  {
+    close(ski_fd);
+    inflight->generation++;
+    if (agent_cache_invalidate(cache, &id))
+    {
+      kmyth_log(LOG_DEBUG, "invalidated cache entry");
+    }
+    agent_send_ok(client_fd, NULL, 0);
+    return false;
+  }
+
+  time_t now = agent_now();
+  agent_cache_entry *entry = agent_cache_lookup(cache, &id, now);
+
+  if (entry != NULL)
+  {
+    close(ski_fd);
+    kmyth_log(LOG_DEBUG, "serving cached entry");
+    agent_send_ok(client_fd, entry->data, entry->data_len);
+    return false;
+  }
+
+  // A ttl of 0 selects the default, which is also the maximum.
+  unsigned int ttl = request.ttl;
+
+  if (ttl == 0 || ttl > max_ttl)
+  {
+    ttl = max_ttl;
+  }
+
+  // Wait for an unseal of the same file that is already running, if any,
+  // else start one.
+  agent_flight *flight = NULL;
+
+  for (size_t i = 0; i < KMYTH_AGENT_MAX_FLIGHTS; i++)
+  {
+    if (inflight->flights[i].active &&
+        inflight->flights[i].policy_or == request.policy_or &&
+        agent_file_id_equal(&inflight->flights[i].id, &id))
+    {
+      flight = &inflight->flights[i];
+      break;
+    }
+  }
+
+  if (flight != NULL)
+  {
+    close(ski_fd);
+    kmyth_log(LOG_DEBUG, "waiting for unseal already in progress");
+  }
+  else
+  {
+    uint8_t *ski_bytes = NULL;
+    size_t ski_bytes_len = 0;
+    int retval = agent_read_ski(ski_fd, &st, &ski_bytes, &ski_bytes_len);
+
+    close(ski_fd);
+    if (retval)
+    {
+      agent_send_error(client_fd, "unable to read .ski file");
+      return false;
+    }
+
+    flight = agent_flight_start(inflight, pool, &id, request.policy_or,
+                                ski_bytes, ski_bytes_len,
+                                auth_bytes, auth_bytes_len,
+                                owner_auth_bytes, oa_bytes_len);
+    if (flight == NULL)
+    {
+      free(ski_bytes);
+      agent_send_error(client_fd, "agent busy");
+      return false;
+    }
+  }
+
+  // (the main loop does not accept clients it has no room for)
+  agent_waiter *waiter = &inflight->waiters[inflight->waiters_len++];
+
+  waiter->fd = client_fd;
+  waiter->flight = flight->index;
+  flight->waiters++;
+  if (ttl > flight->ttl)
+  {
+    flight->ttl = ttl;
+  }
+
+  return true;
+}
+
+//############################################################################
+// agent_boot_deliver()
+//############################################################################
+static int agent_boot_deliver(const kmyth_boot_entry * entry, uint8_t * key,
+                              size_t key_len, void *arg)
+{
+  agent_boot_state *state = (agent_boot_state *) arg;
+  struct stat st = { 0 };
+
+  // (keyed as a client passing the file would find it)
+  if (stat(entry->ski_path, &st) || !S_ISREG(st.st_mode))
+  {
+    return 1;
+  }
+
+  agent_file_id id;
+
+  agent_file_id_from_stat(&st, &id);
+
+  uint8_t *data = kmyth_secure_alloc(key_len);
+
+  if (data == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate unsealed data");
+    return 1;
+  }
+  memcpy(data, key, key_len);
+
+  return agent_cache_insert(state->cache, &id, data, key_len,
+                            agent_now() + state->ttl);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "options are: \n\n"
+          " -s or --socket        Path of the UNIX domain socket to listen on. Defaults to "
+          KMYTH_AGENT_DEFAULT_SOCKET_PATH ".\n"
+          " -t or --ttl           Default (and maximum) time, in seconds, that unsealed data is cached.\n"
+          "                       Defaults to %d.\n"
+          " -u or --uid           Additional user ID allowed to make requests (may be repeated, up to %d times).\n"
+          "                       By default, only root and the user running the agent may make requests.\n"
+          " -a or --auth_string   String used to create 'authVal' digest. Defaults to empty string (all-zero digest).\n"
+          " -w or --owner_auth    TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n"
+          " -C or --precheck      Check the current PCR values against each .ski file's policy before loading\n"
+          "                       anything into the TPM, so that data whose PCRs have changed fails quickly.\n"
+          " -D or --device        TCTI configuration of a TPM to unseal with (may be repeated, up to %d times).\n"
+          "                       Each request is sent to the TPM holding the SRK its .ski file records, if any.\n"
+          "                       Defaults to the configured (or default) TCTI.\n"
+          " -W or --watch         Check the TPM's PCR update counter every given number of milliseconds, flushing\n"
+          "                       the cache (and re-sealing any -R files) when any PCR has been extended.\n"
+          " -E or --event_count   With --watch, read this measurement count file (e.g. IMA's\n"
+          "                       runtime_measurements_count) at each check instead, and only ask the TPM when\n"
+          "                       the count grew (or every %d checks).\n"
+          " -R or --reseal        .ski file to re-seal, with the first device, to the current values of the -p\n"
+          "                       PCRs after each PCR change (may be repeated, up to %d times). Requires --watch.\n"
+          " -p or --pcrs_list     PCRs the -R files are re-sealed to. Defaults to none.\n"
+          " -P or --policy_or     The -R files were sealed with a compound \"policy or\" (e.g., with an expected\n"
+          "                       policy for the values after a planned update), which their first re-seal drops.\n"
+          " -B or --boot          Before serving requests, unseal (and cache) the 'agent' entries of this boot\n"
+          "                       manifest, lowest priority first (see kmyth-unseal --boot), reporting the\n"
+          "                       time to the first key and in total.\n"
+          " -J or --json_log      Write the log file as JSON lines (one object per message), tagging the\n"
+          "                       messages logged while handling a request with its operation_id.\n"
+          " -v or --verbose       Enable detailed logging.\n"
+          " -h or --help          Help (displays this usage).\n", prog,
+          KMYTH_AGENT_DEFAULT_TTL, KMYTH_AGENT_MAX_UIDS, KMYTH_POOL_MAX,
+          KMYTH_AGENT_WATCH_TPM_EVERY, KMYTH_AGENT_MAX_RESEAL);
+}
+
+const struct option longopts[] = {
+  {"socket", required_argument, 0, 's'},
+  {"ttl", required_argument, 0, 't'},
+  {"uid", required_argument, 0, 'u'},
+  {"auth_string", required_argument, 0, 'a'},
+  {"owner_auth", required_argument, 0, 'w'},
+  {"precheck", no_argument, 0, 'C'},
+  {"device", required_argument, 0, 'D'},
+  {"watch", required_argument, 0, 'W'},
+  {"event_count", required_argument, 0, 'E'},
+  {"reseal", required_argument, 0, 'R'},
+  {"pcrs_list", required_argument, 0, 'p'},
+  {"policy_or", no_argument, 0, 'P'},
+  {"boot", required_argument, 0, 'B'},
+  {"json_log", no_argument, 0, 'J'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+int main(int argc, char **argv)
+{
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+
+  // Initialize parameters that might be modified by command line options
+  char *socketPath = KMYTH_AGENT_DEFAULT_SOCKET_PATH;
+  unsigned long maxTtl = KMYTH_AGENT_DEFAULT_TTL;
+  uid_t allowed_uids[KMYTH_AGENT_MAX_UIDS];
+  size_t allowed_uids_len = 0;
+  char *authString = NULL;
+  char *ownerAuthPasswd = "";
+  const char *devices[KMYTH_POOL_MAX];
+  size_t devices_len = 0;
+  bool precheck = false;
+  unsigned long watchInterval = 0;
+  char *eventCountPath = NULL;
+  agent_reseal_list reseal = { 0 };
+  uint8_t bool_policy_or = 0;
+  char *pcrsString = NULL;
+  char *bootPath = NULL;
+  char *end = NULL;
+  int options;
+  int option_index;
+
+  // Parse and apply command line options
+  while ((options = getopt_long(argc, argv, "a:s:t:u:w:p:B:D:E:R:W:hvCJP", longopts,
+                                &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 'a':
+      authString = optarg;
+      break;
+    case 's':
+      socketPath = optarg;
+      break;
+    case 't':
+      errno = 0;
+      maxTtl = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || maxTtl == 0 || maxTtl > UINT32_MAX)
+      {
+        kmyth_log(LOG_ERR, "invalid ttl (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'u':
+      {
+        errno = 0;
+        unsigned long uid = strtoul(optarg, &end, 10);
+
+        if (errno || *end != '\0' || uid >= UINT32_MAX
+            || allowed_uids_len == KMYTH_AGENT_MAX_UIDS)
+        {
+          kmyth_log(LOG_ERR, "invalid (or too many) uid (%s) ... exiting",
+                    optarg);
+          return 1;
+        }
+        allowed_uids[allowed_uids_len++] = (uid_t) uid;
+      }
+      break;
+    case 'w':
+      ownerAuthPasswd = optarg;
+      break;
+    case 'C':
+      precheck = true;
+      break;
+    case 'D':
+      if (devices_len == KMYTH_POOL_MAX)
+      {
+        kmyth_log(LOG_ERR, "too many devices (at most %d) ... exiting",
+                  KMYTH_POOL_MAX);
+        return 1;
+      }
+      devices[devices_len++] = optarg;
+      break;
+    case 'W':
+      errno = 0;
+      watchInterval = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || watchInterval == 0
+          || watchInterval > INT_MAX)
+      {
+        kmyth_log(LOG_ERR, "invalid watch interval (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'E':
+      eventCountPath = optarg;
+      break;
+    case 'R':
+      if (reseal.len == KMYTH_AGENT_MAX_RESEAL)
+      {
+        kmyth_log(LOG_ERR, "too many files to re-seal (at most %d) ... "
+                  "exiting", KMYTH_AGENT_MAX_RESEAL);
+        return 1;
+      }
+      reseal.paths[reseal.len++] = optarg;
+      break;
+    case 'p':
+      pcrsString = optarg;
+      break;
+    case 'P':
+      bool_policy_or = 1;
+      break;
+    case 'B':
+      bootPath = optarg;
+      break;
+    case 'J':
+      set_applog_format(KMYTH_APPLOG_FORMAT_JSON);
+      break;
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  if (watchInterval == 0 && (reseal.len > 0 || eventCountPath != NULL))
+  {
+    kmyth_log(LOG_ERR, "--reseal and --event_count require --watch ... "
+              "exiting");
+    return 1;
+  }
+  for (size_t i = 0; i < reseal.len; i++)
+  {
+    reseal.policy_or[i] = bool_policy_or;
+  }
+
+  int *pcrs = NULL;
+  int pcrs_len = 0;
+
+  if (parse_pcrs_string(pcrsString, &pcrs, &pcrs_len) != 0 || pcrs_len < 0)
+  {
+    kmyth_log(LOG_ERR, "failed to parse PCR string %s ... exiting",
+              pcrsString);
+    return 1;
+  }
+
+  // (once the log format is known, as it is fixed when this starts)
+  start_async_logging(0);
+
+  //Since these originate in main() we know they are null terminated
+  size_t auth_string_len = (authString == NULL) ? 0 : strlen(authString);
+  size_t oa_passwd_len =
+    (ownerAuthPasswd == NULL) ? 0 : strlen(ownerAuthPasswd);
+
+  // The socket is only made accessible to other users when some are allowed
+  // to make requests - their credentials are still checked per connection.
+  int server_fd = -1;
+  mode_t mode = (allowed_uids_len > 0) ? 0666 : 0600;
+
+  if (setup_unix_server_socket(socketPath, mode, &server_fd)
+      || listen(server_fd, SOMAXCONN))
+  {
+    kmyth_log(LOG_ERR, "unable to listen on socket: %s ... exiting",
+              socketPath);
+    if (server_fd != -1)
+    {
+      close(server_fd);
+      unlink(socketPath);
+    }
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(pcrs);
+    return 1;
+  }
+
+  // One context (TPM connection and storage key) per device serves every
+  // request routed to it.
+  kmyth_pool_t *pool = NULL;
+  int pool_failed = kmyth_pool_create(&pool, devices, devices_len);
+
+  for (size_t i = 0; !pool_failed && i < kmyth_pool_size(pool); i++)
+  {
+    kmyth_ctx_t *ctx = kmyth_pool_get_ctx(pool, i);
+
+    pool_failed = (kmyth_ctx_set_object_cache(ctx, 1) ||
+                   kmyth_ctx_set_policy_precheck(ctx, precheck));
+  }
+  if (pool_failed)
+  {
+    kmyth_log(LOG_ERR, "unable to create Kmyth context ... exiting");
+    kmyth_pool_destroy(&pool);
+    close(server_fd);
+    unlink(socketPath);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(pcrs);
+    return 1;
+  }
+
+  struct sigaction sa = { 0 };
+
+  sa.sa_handler = handle_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  agent_cache cache;
+
+  agent_cache_init(&cache, KMYTH_AGENT_MAX_ENTRIES);
+
+  // The boot keys are cached (over the same contexts that then serve
+  // requests) before the first request is accepted, so their consumers
+  // never wait on the TPM.
+  if (bootPath != NULL)
+  {
+    kmyth_boot_manifest manifest;
+    kmyth_boot_report report;
+    agent_boot_state boot_state = {.cache = &cache,
+      .ttl = (unsigned int) maxTtl
+    };
+
+    if (boot_manifest_read(bootPath, KMYTH_BOOT_TARGET_AGENT, &manifest) == 0)
+    {
+      boot_unseal(pool, &manifest, agent_boot_deliver, &boot_state,
+                  (uint8_t *) authString, auth_string_len,
+                  (uint8_t *) ownerAuthPasswd, oa_passwd_len, 0, &report);
+      kmyth_log(LOG_INFO, "boot keys: %zu cached, %zu failed (%zu "
+                "priorities), first after %lld us, all after %lld us",
+                report.delivered, report.failed, report.tiers,
+                (long long) report.first_key_us,
+                (long long) report.total_us);
+      boot_manifest_free(&manifest);
+    }
+  }
+
+  // Unseals run on worker threads (see agent_flight_start()), so that
+  // concurrent requests for the same file share a single unseal.
+  static agent_inflight inflight;
+
+  if (pipe2(inflight.done_pipe, O_CLOEXEC))
+  {
+    kmyth_log(LOG_ERR, "unable to create unseal completion pipe ... exiting");
+    agent_running = 0;
+  }
+
+  // Each device gets a watcher (with its own connection), checked from the
+  // main loop. The first check only records the device's counts.
+  kmyth_pcr_watcher_t *watchers[KMYTH_POOL_MAX] = { 0 };
+  size_t watchers_len = 0;
+  agent_watch_state watch_state = {.cache = &cache,.inflight = &inflight,
+    .reseal_pending = false
+  };
+  int watch_failed = 0;
+
+  if (watchInterval > 0)
+  {
+    watchers_len = (devices_len == 0) ? 1 : devices_len;
+  }
+  for (size_t i = 0; !watch_failed && i < watchers_len; i++)
+  {
+    watch_failed =
+      (kmyth_pcr_watcher_create(&watchers[i],
+                                (devices_len == 0) ? NULL : devices[i],
+                                (unsigned int) watchInterval) ||
+       kmyth_pcr_watcher_set_count_file(watchers[i], eventCountPath,
+                                        KMYTH_AGENT_WATCH_TPM_EVERY) ||
+       kmyth_pcr_watcher_add_callback(watchers[i], agent_on_pcr_change,
+                                      &watch_state) ||
+       kmyth_pcr_watcher_check(watchers[i], NULL));
+  }
+  if (watch_failed)
+  {
+    kmyth_log(LOG_ERR, "unable to watch the TPM's PCRs ... exiting");
+    agent_running = 0;
+  }
+
+  int64_t next_watch = agent_now_ms() + (int64_t) watchInterval;
+
+  kmyth_log(LOG_INFO, "listening on %s", socketPath);
+
+  struct timeval io_timeout = {.tv_sec = KMYTH_AGENT_IO_TIMEOUT,.tv_usec = 0 };
+  unsigned long request_count = 0;
+
+  while (agent_running)
+  {
+    // Check for PCR changes once per watch interval, re-sealing any files
+    // listed once a change has been seen.
+    if (watchers_len > 0 && agent_now_ms() >= next_watch)
+    {
+      for (size_t i = 0; i < watchers_len; i++)
+      {
+        kmyth_pcr_watcher_check(watchers[i], NULL);
+      }
+      if (watch_state.reseal_pending && reseal.len > 0)
+      {
+        // (the re-seals use the first device's context directly, so no
+        // unseal may be using it meanwhile)
+        agent_flights_finish_all(&inflight, &cache);
+        agent_reseal_all(kmyth_pool_get_ctx(pool, 0), &reseal,
+                         (uint8_t *) authString, auth_string_len,
+                         (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                         pcrs, (size_t) pcrs_len);
+      }
+      watch_state.reseal_pending = false;
+      next_watch = agent_now_ms() + (int64_t) watchInterval;
+    }
+
+    // Sleep until the next request, until the next entry expires, or until
+    // the next PCR check.
+    time_t now = agent_now();
+    time_t next_expiry = agent_cache_evict_expired(&cache, now);
+    int timeout = -1;
+
+    if (next_expiry != 0)
+    {
+      timeout = (int) ((next_expiry - now) * 1000);
+    }
+    if (watchers_len > 0)
+    {
+      int64_t until_watch = next_watch - agent_now_ms();
+
+      if (until_watch < 0)
+      {
+        until_watch = 0;
+      }
+      if (timeout < 0 || until_watch < timeout)
+      {
+        timeout = (int) until_watch;
+      }
+    }
+
+    // New clients are left queued on the socket while there is no room for
+    // another unseal or waiting client.
+    bool accepting = (inflight.flights_len < KMYTH_AGENT_MAX_FLIGHTS &&
+                      inflight.waiters_len < KMYTH_AGENT_MAX_WAITING);
+    struct pollfd pfds[2] = {
+      {.fd = inflight.done_pipe[0],.events = POLLIN},
+      {.fd = accepting ? server_fd : -1,.events = POLLIN},
+    };
+    int ready = poll(pfds, 2, timeout);
+
+    if (ready <= 0)
+    {
+      if (ready < 0 && errno != EINTR)
+      {
+        kmyth_log(LOG_ERR, "poll failed ... exiting");
+        break;
+      }
+      continue;
+    }
+
+    if (pfds[0].revents & POLLIN)
+    {
+      uint32_t index = 0;
+
+      if (read(inflight.done_pipe[0], &index, sizeof(index)) ==
+          sizeof(index) && index < KMYTH_AGENT_MAX_FLIGHTS &&
+          inflight.flights[index].active)
+      {
+        agent_flight_finish(&inflight, index, &cache);
+      }
+      continue;
+    }
+    if (!(pfds[1].revents & POLLIN))
+    {
+      continue;
+    }
+
+    int client_fd = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (client_fd < 0)
+    {
+      continue;
+    }
+    bool waiting = false;
+
+    if (agent_peer_allowed(client_fd, allowed_uids, allowed_uids_len))
+    {
+      char operation_id[32];
+      struct timespec start;
+      struct timespec end;
+
+      snprintf(operation_id, sizeof(operation_id), "request-%lu",
+               ++request_count);
+      set_log_operation_id(operation_id);
+      clock_gettime(CLOCK_MONOTONIC, &start);
+
+      // A client must not be able to stall the agent indefinitely.
+      setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &io_timeout,
+                 sizeof(io_timeout));
+      setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &io_timeout,
+                 sizeof(io_timeout));
+      waiting = agent_handle_request(client_fd, pool, &cache, &inflight,
+                                     (unsigned int) maxTtl,
+                                     (uint8_t *) authString, auth_string_len,
+                                     (uint8_t *) ownerAuthPasswd,
+                                     oa_passwd_len);
+
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      kmyth_log_duration(LOG_DEBUG,
+                         (int64_t) (end.tv_sec - start.tv_sec) * 1000000000 +
+                         (end.tv_nsec - start.tv_nsec), "request handled");
+      set_log_operation_id(NULL);
+    }
+    // (a client waiting on an unseal is answered, and closed, once it ends)
+    if (!waiting)
+    {
+      close(client_fd);
+    }
+  }
+
+  kmyth_log(LOG_INFO, "shutting down");
+  agent_flights_finish_all(&inflight, &cache);
+  if (inflight.done_pipe[0] > 0)
+  {
+    close(inflight.done_pipe[0]);
+    close(inflight.done_pipe[1]);
+  }
+  agent_cache_clear(&cache);
+  for (size_t i = 0; i < watchers_len; i++)
+  {
+    kmyth_pcr_watcher_destroy(&watchers[i]);
+  }
+  kmyth_pool_destroy(&pool);
+  close(server_fd);
+  unlink(socketPath);
+  kmyth_clear(authString, auth_string_len);
+  kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+  free(pcrs);
+
+  return watch_failed;
+}
@@ -5,57 +5,1046 @@
  * The code makes use of the utility function create_kmyth_tls_connection
  * to unseal the client's private authentication key and use it, in
  * memory, to establish a connection to a key server.
+ *
+ * Run with --daemon, it unseals the key only once and stays resident,
+ * getting keys on behalf of local clients (kmyth-getkey --agent) that ask
+ * for them over a UNIX domain socket.
  */
 
-#include <getopt.h>
-#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <openssl/bio.h>
+#include <openssl/ssl.h>
+
+#include "agent_util.h"
+#include "defines.h"
+#include "endpoint_util.h"
+#include "file_io.h"
+#include "handoff_util.h"
+#include "kmyth.h"
+#include "kmyth_log.h"
+#include "memory_util.h"
+#include "socket_util.h"
+#include "tls_util.h"
+#include "trace.h"
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n"
+          "       %s --daemon <socket> [options]\n"
+          "       %s --agent <socket> [-m <message>] [output options]\n\n"
+          "options are:\n\n"
+          "Client Information --\n"
+          "  -i or --input         Path to file containing the kmyth-sealed client's certificate private key.\n"
+          "  -l or --client        Path to file containing the client's certificate.\n\n"
+          "Server Information --\n"
+          "  -t or --type          The type of the key server. Valid values include 'kmip' and 'simple'.\n"
+          "                        Defaults to 'simple'.\n"
+          "  -s or --server        Path to file containing the certificate\n"
+          "                        for the CA that issued the server cert.\n"
+          "  -c or --conn_addr     The ip_address:port for the TLS connection. May be a comma separated list\n"
+          "                        (or repeated) to name several replicated servers: the one answering fastest\n"
+          "                        so far is tried first, and a server that fails is passed over for the next.\n"
+          "  -H or --hedge         With several servers, also send the request to a second server when the\n"
+          "                        first has not answered within this many milliseconds (0 for the first\n"
+          "                        server's observed 95th percentile latency), and use whichever answers first.\n"
+          "  -E or --endpoint_stats  File the servers' observed latencies are kept in between runs.\n"
+          "  -m or --message       An optional message to send the key server. For a 'kmip' server, this is\n"
+          "                        the ID of the key to get, and may be repeated to get several keys.\n"
+          "  -k or --key_list      Path to a file listing (one per line) the IDs of keys to get from a 'kmip'\n"
+          "                        server, as for -m. Blank lines and lines starting with '#' are skipped.\n"
+          "  -R or --resume        Save the TLS session next to the sealed key (as <input>"
+          KMYTH_GETKEY_SESSION_EXT ")\n"
+          "                        and resume it on later runs, skipping the full TLS handshake. The session is\n"
+          "                        sealed to this host's TPM (with the -a authorization and the PCRs the -i key is\n"
+          "                        sealed to, which it must be); a daemon keeps it in memory.\n"
+          "  -z or --early_data    With -R and a 'kmip' server, send the KMIP Get request as TLS 1.3 early data\n"
+          "                        when resuming a session that allows it, so the key arrives a round trip\n"
+          "                        sooner. The server must guard against replayed early data.\n"
+          "  -O or --sockopt       Tune the connection to the key server (repeatable): nodelay,\n"
+          "                        keepalive=<idle>[,<interval>[,<count>]], fastopen,\n"
+          "                        connect-timeout=<ms>, connect-stagger=<ms> (between attempts on each of\n"
+          "                        the server's addresses) or io-timeout=<ms>.\n"
+          "  -D or --deadline      Give up on getting the keys after this many milliseconds, however far\n"
+          "                        unsealing the client's private key, connecting or the requests have got\n"
+          "                        (in daemon mode, for each request).\n\n"
+          "Key Cache --\n"
+          "  -C or --cache         Directory to keep the keys got in, each sealed to this host's TPM (with the -a\n"
+          "                        authorization and the PCRs the -i key is sealed to, which it must be) as\n"
+          "                        <key ID>.ski (or " KMYTH_GETKEY_CACHE_DEFAULT_NAME ".ski, without -m). When every key\n"
+          "                        requested is cached, the cached keys are used, and refreshed from the key\n"
+          "                        server by a background process.\n"
+          "  -M or --cache_max_age Oldest (in seconds) a cached key may be to be used. Defaults to %d.\n"
+          "  -U or --unseal_agent  Unseal the cached keys with the kmyth-agent listening on this socket.\n\n"
+          "Output Parameters --\n"
+          "  -o or --output        Output file path to write the key. If none is selected, key will be sent to stdout.\n"
+          "                        When getting several keys, -o names the directory each key is written to\n"
+          "                        (in a file named by its ID).\n"
+          "  -e or --exec          Instead of writing the key, hand it to this command (run by /bin/sh) in a sealed\n"
+          "                        memory file it inherits: the file descriptor number is in $"
+          KMYTH_HANDOFF_FD_ENV " and the\n"
+          "                        size in $" KMYTH_HANDOFF_SIZE_ENV ". kmyth-getkey exits once the command has.\n"
+          "  -F or --send_fd       Instead of writing the key, pass it, in a sealed memory file, to the process\n"
+          "                        listening on this UNIX domain socket (the file descriptor is sent as SCM_RIGHTS\n"
+          "                        data with the line \"KEY <size>\\n\").\n\n"
+          "Daemon Mode --\n"
+          "  -d or --daemon        Unseal the client's private key once, then stay resident, answering requests\n"
+          "                        for keys made (by root or the same user) on this UNIX domain socket. A 'kmip'\n"
+          "                        server connection is kept open between requests. -m, -k and the output\n"
+          "                        parameters are instead given with each request.\n"
+          "  -A or --agent         Get the key (for the -m message, if any) from the kmyth-getkey --daemon\n"
+          "                        listening on this socket. Only -m (at most once) and the output parameters\n"
+          "                        then apply.\n\n"
+          "Sealed Key Parameters --\n"
+          "  -a or --auth_string   String used to create 'authVal' digest. Defaults to empty string (all-zero digest)\n"
+          "  -w or --owner_auth    TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n\n"
+          "Misc --\n"
+          "  -T or --timings       Report the time spent unsealing, in each phase and TPM command (to stderr).\n"
+          "  -v or --verbose       Detailed logging mode to help with debugging.\n"
+          "  -h or --help          Help (displays this usage).\n\n", prog, prog,
+          prog, KMYTH_GETKEY_CACHE_MAX_AGE);
+}
+
+int check_string_arg(const char *arg, size_t arg_len,
+                     const char *value, size_t value_len)
+{
+  if ((arg_len != value_len) || strncmp(arg, value, value_len))
+  {
+    return 0;
+  }
+  return 1;
+}
+
+static void free_key_list(char **messages, char **keyPaths,
+                          size_t keyPaths_count, char **listedMessages,
+                          size_t listedMessages_count, char *sessionPath,
+                          char **cachePaths, int *clientPcrs)
+{
+  // keyPaths is only allocated (one per message) for several keys
+  for (size_t i = 0; keyPaths != NULL && i < keyPaths_count; i++)
+  {
+    free(keyPaths[i]);
+  }
+  free(keyPaths);
+  free(messages);
+  free_path_list(listedMessages, listedMessages_count);
+  free(sessionPath);
+
+  // (the cache paths, one per request, end with a NULL)
+  for (size_t i = 0; cachePaths != NULL && cachePaths[i] != NULL; i++)
+  {
+    free(cachePaths[i]);
+  }
+  free(cachePaths);
+  free(clientPcrs);
+}
+
+static volatile sig_atomic_t daemon_running = 1;
+
+static void handle_signal(int signum)
+{
+  (void) signum;
+  daemon_running = 0;
+}
+
+// A request of one key server, made (by endpoint_fetch(), possibly on a
+// thread of its own) with a copy of everything it needs
+typedef struct
+{
+  uint8_t *client_key;
+  size_t client_key_len;
+  char *client_cert_path;
+  char *server_cert_path;
+  SSL_SESSION *session;
+  bool early_data;
+  socket_options sockopts;
+  bool has_sockopts;
+  char **messages;
+  size_t message_count;
+  bool kmip;
+  bool batched;
+  bool connect_only;
+} getkey_request_t;
+
+// A key server's response: the connection, and the keys got over it
+typedef struct
+{
+  BIO *bio;
+  SSL_CTX *ctx;
+  unsigned char **keys;
+  size_t *key_sizes;
+  size_t key_count;
+} getkey_response_t;
+
+// The state kmyth-getkey --daemon keeps between requests
+typedef struct
+{
+  endpoint_set *endpoints;
+  const endpoint_policy *policy;
+  char *stats_path;
+  uint8_t *client_key;
+  size_t client_key_len;
+  char *client_cert_path;
+  char *server_cert_path;
+  bool resume;
+  SSL_SESSION *session;
+  const socket_options *sockopts;
+  int deadline_ms;
+  bool kmip;
+  BIO *bio;
+  SSL_CTX *ctx;
+} getkey_daemon_t;
+
+//############################################################################
+// deadline_after()
+//############################################################################
+static uint64_t deadline_after(int timeout_ms)
+{
+  struct timespec now;
+
+  if (timeout_ms <= 0 || clock_gettime(CLOCK_MONOTONIC, &now))
+  {
+    return 0;
+  }
+
+  return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec +
+    (uint64_t) timeout_ms * 1000000;
+}
+
+//############################################################################
+// write_key()
+//############################################################################
+static int write_key(unsigned char *key, size_t key_size, char *outPath,
+                     char *execCommand, char *sendFdPath)
+{
+  if (execCommand == NULL && sendFdPath == NULL)
+  {
+    if (outPath == NULL)
+    {
+      return print_to_stdout(key, key_size);
+    }
+    return write_bytes_to_file(outPath, key, key_size);
+  }
+
+  int fd = -1;
+
+  if (handoff_create_memfd("kmyth-getkey", key, key_size, &fd))
+  {
+    return 1;
+  }
+
+  int retval = (execCommand != NULL) ? handoff_exec(fd, execCommand) :
+    handoff_send(fd, sendFdPath);
+
+  close(fd);
+  return retval;
+}
+
+//############################################################################
+// get_cache_paths()
+//############################################################################
+static int get_cache_paths(const char *cacheDir, char **messages,
+                           size_t count, char ***cachePaths)
+{
+  *cachePaths = calloc(count + 1, sizeof(char *));
+  if (*cachePaths == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate key cache paths ... exiting");
+    return 1;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    const char *name = (messages[i] == NULL) ?
+      KMYTH_GETKEY_CACHE_DEFAULT_NAME : messages[i];
+
+    if (strchr(name, '/') != NULL || strcmp(name, ".") == 0 ||
+        strcmp(name, "..") == 0 ||
+        asprintf(&(*cachePaths)[i], "%s/%s.ski", cacheDir, name) < 0)
+    {
+      (*cachePaths)[i] = NULL;
+      kmyth_log(LOG_ERR, "key ID (%s) is not usable as a cache file name "
+                "... exiting", name);
+      free_path_list(*cachePaths, i);
+      *cachePaths = NULL;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// read_cached_keys()
+//############################################################################
+static int read_cached_keys(char **cachePaths, size_t count,
+                            unsigned long maxAge, char *unsealAgentPath,
+                            uint8_t * authBytes, size_t authBytes_len,
+                            uint8_t * ownerAuthBytes, size_t oaBytes_len,
+                            unsigned char **keys, size_t *key_sizes)
+{
+  // Every key must be cached, and fresh enough, for the key server to be
+  // skipped, so that is checked before any of them is unsealed
+  time_t now = time(NULL);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    struct stat st;
+
+    if (stat(cachePaths[i], &st) != 0 || !S_ISREG(st.st_mode))
+    {
+      kmyth_log(LOG_DEBUG, "key not cached: %s", cachePaths[i]);
+      return 1;
+    }
+    if (now < st.st_mtime || (unsigned long) (now - st.st_mtime) > maxAge)
+    {
+      kmyth_log(LOG_DEBUG, "cached key too old: %s", cachePaths[i]);
+      return 1;
+    }
+  }
+
+  kmyth_ctx_t *ctx = NULL;
+  int retval = 0;
+
+  if (unsealAgentPath == NULL && kmyth_ctx_create(&ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to set up TPM context");
+    return 1;
+  }
+
+  for (size_t i = 0; retval == 0 && i < count; i++)
+  {
+    if (unsealAgentPath != NULL)
+    {
+      // The cached .ski file is opened here, and passed to kmyth-agent,
+      // so that the agent only serves files that the caller can read
+      int fd = open(cachePaths[i], O_RDONLY | O_CLOEXEC);
+
+      retval = (fd < 0) ||
+        agent_request(unsealAgentPath, "UNSEAL 0 0\n", fd, &keys[i],
+                      &key_sizes[i]);
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+    }
+    else
+    {
+      retval = tpm2_kmyth_unseal_file_ctx(ctx, cachePaths[i], &keys[i],
+                                          &key_sizes[i], authBytes,
+                                          authBytes_len, ownerAuthBytes,
+                                          oaBytes_len, 0);
+    }
+    if (retval)
+    {
+      kmyth_log(LOG_WARNING, "unable to unseal cached key: %s",
+                cachePaths[i]);
+    }
+  }
+  kmyth_ctx_destroy(&ctx);
+
+  for (size_t i = 0; retval && i < count; i++)
+  {
+    kmyth_clear_and_free(keys[i], key_sizes[i]);
+    keys[i] = NULL;
+    key_sizes[i] = 0;
+  }
+
+  return retval;
+}
+
+//############################################################################
+// get_client_pcrs()
+//############################################################################
+static int get_client_pcrs(char *capkPath, const char *option, int **pcrs,
+                           size_t *pcrs_len)
+{
+  uint8_t *ski = NULL;
+  size_t ski_len = 0;
+
+  if (read_bytes_from_file(capkPath, &ski, &ski_len))
+  {
+    kmyth_log(LOG_ERR, "unable to read %s ... exiting", capkPath);
+    return 1;
+  }
+
+  int retval = kmyth_get_ski_pcrs(ski, ski_len, pcrs, pcrs_len);
+
+  free(ski);
+  if (retval)
+  {
+    return 1;
+  }
+
+  // A cached key, or a saved TLS session, must be no easier to unseal than
+  // the client key needed to get (or resume a session for) it
+  if (*pcrs_len == 0)
+  {
+    kmyth_log(LOG_ERR, "%s requires the client's private key (-i) to be "
+              "sealed to PCRs ... exiting", option);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// write_cached_keys()
+//############################################################################
+static int write_cached_keys(char **cachePaths, size_t count,
+                             unsigned char **keys, size_t *key_sizes,
+                             int *pcrs, size_t pcrs_len,
+                             uint8_t * authBytes, size_t authBytes_len,
+                             uint8_t * ownerAuthBytes, size_t oaBytes_len)
+{
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to set up TPM context");
+    return 1;
+  }
+
+  int retval = 0;
+
+  // Each key is sealed to this host's TPM, with the client key's
+  // authorization and PCRs, so the cache is of no use off the host (or in
+  // a platform state the client key would not unseal in)
+  for (size_t i = 0; i < count; i++)
+  {
+    uint8_t *ski = NULL;
+    size_t ski_len = 0;
+
+    if (tpm2_kmyth_seal_ctx(ctx, keys[i], key_sizes[i], &ski, &ski_len,
+                            authBytes, authBytes_len, ownerAuthBytes,
+                            oaBytes_len, pcrs, pcrs_len, NULL, NULL, 0) ||
+        write_bytes_to_file_atomic(cachePaths[i], ski, ski_len, true))
+    {
+      kmyth_log(LOG_WARNING, "unable to cache key: %s", cachePaths[i]);
+      retval = 1;
+    }
+    free(ski);
+  }
+  kmyth_ctx_destroy(&ctx);
+
+  return retval;
+}
+
+//############################################################################
+// read_sealed_session()
+//############################################################################
+static int read_sealed_session(kmyth_ctx_t * ctx, char *sessionPath,
+                               uint8_t * authBytes, size_t authBytes_len,
+                               uint8_t * ownerAuthBytes, size_t oaBytes_len,
+                               SSL_SESSION ** session)
+{
+  // (there is none on the first run)
+  if (access(sessionPath, R_OK) != 0)
+  {
+    return 1;
+  }
+
+  uint8_t *bytes = NULL;
+  size_t bytes_len = 0;
+
+  // a file that does not unseal (e.g., a session saved unsealed by an
+  // earlier kmyth-getkey) is replaced once the new session is saved
+  if (tpm2_kmyth_unseal_file_ctx(ctx, sessionPath, &bytes, &bytes_len,
+                                 authBytes, authBytes_len, ownerAuthBytes,
+                                 oaBytes_len, 0))
+  {
+    kmyth_log(LOG_DEBUG, "unable to unseal TLS session: %s", sessionPath);
+    kmyth_clear_and_free(bytes, bytes_len);
+    return 1;
+  }
+
+  int retval = tls_session_from_bytes(bytes, bytes_len, session);
+
+  kmyth_clear_and_free(bytes, bytes_len);
+
+  return retval;
+}
+
+//############################################################################
+// write_sealed_session()
+//############################################################################
+static int write_sealed_session(char *sessionPath, BIO * bio,
+                                int *pcrs, size_t pcrs_len,
+                                uint8_t * authBytes, size_t authBytes_len,
+                                uint8_t * ownerAuthBytes, size_t oaBytes_len)
+{
+  SSL_SESSION *session = NULL;
+  unsigned char *bytes = NULL;
+  size_t bytes_len = 0;
+
+  if (tls_get_session(bio, &session))
+  {
+    return 1;
+  }
+
+  int retval = tls_session_to_bytes(session, &bytes, &bytes_len);
+
+  SSL_SESSION_free(session);
+  if (retval)
+  {
+    return 1;
+  }
+
+  // The session holds its resumption secret, which can resume it as the
+  // client, so is sealed to this host's TPM with the client key's
+  // authorization and PCRs (as the cached keys are)
+  kmyth_ctx_t *ctx = NULL;
+  uint8_t *ski = NULL;
+  size_t ski_len = 0;
+
+  if (kmyth_ctx_create(&ctx) ||
+      tpm2_kmyth_seal_ctx(ctx, bytes, bytes_len, &ski, &ski_len, authBytes,
+                          authBytes_len, ownerAuthBytes, oaBytes_len, pcrs,
+                          pcrs_len, NULL, NULL, 0) ||
+      write_bytes_to_file_atomic(sessionPath, ski, ski_len, true))
+  {
+    retval = 1;
+  }
+  kmyth_ctx_destroy(&ctx);
+  kmyth_clear_and_free(bytes, bytes_len);
+  free(ski);
+
+  return retval;
+}
+
+//############################################################################
+// getkey_request_free()
+//############################################################################
+static void getkey_request_free(void *ptr)
+{
+  getkey_request_t *request = ptr;
+
+  if (request == NULL)
+  {
+    return;
+  }
+  kmyth_secure_free(request->client_key);
+  free(request->client_cert_path);
+  free(request->server_cert_path);
+  SSL_SESSION_free(request->session);
+  for (size_t i = 0; request->messages != NULL &&
+       i < request->message_count; i++)
+  {
+    free(request->messages[i]);
+  }
+  free(request->messages);
+  free(request);
+}
+
+//############################################################################
+// getkey_request_copy()
+//############################################################################
+static getkey_request_t *getkey_request_copy(const getkey_request_t * request)
+{
+  getkey_request_t *copy = calloc(1, sizeof(getkey_request_t));
+
+  if (copy == NULL)
+  {
+    return NULL;
+  }
+  *copy = *request;
+  copy->client_key = NULL;
+  copy->client_cert_path = NULL;
+  copy->server_cert_path = NULL;
+  copy->session = NULL;
+  copy->messages = NULL;
+
+  // (the client key copy is kept in the secure heap, as the original is)
+  copy->client_key = kmyth_secure_alloc(request->client_key_len);
+  copy->client_cert_path = strdup(request->client_cert_path);
+  copy->server_cert_path = strdup(request->server_cert_path);
+  copy->messages = calloc(request->message_count + 1, sizeof(char *));
+  if (copy->client_key == NULL || copy->client_cert_path == NULL ||
+      copy->server_cert_path == NULL || copy->messages == NULL ||
+      (request->session != NULL && SSL_SESSION_up_ref(request->session) != 1))
+  {
+    getkey_request_free(copy);
+    return NULL;
+  }
+  copy->session = request->session;
+  memcpy(copy->client_key, request->client_key, request->client_key_len);
+
+  // (a single request may have no message)
+  for (size_t i = 0; i < request->message_count; i++)
+  {
+    if (request->messages[i] != NULL &&
+        (copy->messages[i] = strdup(request->messages[i])) == NULL)
+    {
+      getkey_request_free(copy);
+      return NULL;
+    }
+  }
+
+  return copy;
+}
+
+//############################################################################
+// getkey_response_free()
+//############################################################################
+static void getkey_response_free(void *ptr)
+{
+  getkey_response_t *response = ptr;
+
+  if (response == NULL)
+  {
+    return;
+  }
+  if (response->bio != NULL)
+  {
+    BIO_ssl_shutdown(response->bio);
+    BIO_free_all(response->bio);
+  }
+  SSL_CTX_free(response->ctx);
+  for (size_t i = 0; response->keys != NULL && i < response->key_count; i++)
+  {
+    kmyth_clear_and_free(response->keys[i], response->key_sizes[i]);
+  }
+  free(response->keys);
+  free(response->key_sizes);
+  free(response);
+}
+
+//############################################################################
+// getkey_fetch()
+//############################################################################
+static int getkey_fetch(char *address, void *arg, void **result)
+{
+  getkey_request_t *request = arg;
+  getkey_response_t *response = calloc(1, sizeof(getkey_response_t));
+
+  if (response == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate key server response");
+    return 1;
+  }
+
+  // Connect to the key server, using the CAPK (and resuming the saved TLS
+  // session, if any - with early data, the first request then goes with
+  // the handshake)
+  if (create_tls_connection_session(&address, request->client_key,
+                                    request->client_key_len,
+                                    request->client_cert_path,
+                                    request->server_cert_path,
+                                    request->session, request->early_data,
+                                    request->has_sockopts ?
+                                    &request->sockopts : NULL,
+                                    &response->bio, &response->ctx))
+  {
+    kmyth_log(LOG_ERR, "error creating TLS connection to %s", address);
+    getkey_response_free(response);
+    return 1;
+  }
+  if (request->connect_only)
+  {
+    *result = response;
+    return 0;
+  }
+
+  // Retrieve each key over the connection. A 'kmip' server is sent the
+  // requests for several keys batched together, saving a round trip per
+  // key.
+  response->keys = calloc(request->message_count, sizeof(unsigned char *));
+  response->key_sizes = calloc(request->message_count, sizeof(size_t));
+  if (response->keys == NULL || response->key_sizes == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating the key list");
+    getkey_response_free(response);
+    return 1;
+  }
+  response->key_count = request->message_count;
+
+  int retval = 0;
+
+  if (request->batched)
+  {
+    retval = get_keys_from_kmip_server(response->bio, request->messages,
+                                       request->message_count,
+                                       response->keys, response->key_sizes);
+  }
+  for (size_t i = 0; !request->batched && retval == 0 &&
+       i < request->message_count; i++)
+  {
+    size_t message_length = (request->messages[i] == NULL) ? 0 :
+      strlen(request->messages[i]);
+
+    // (the "simple" key server is the default)
+    retval = request->kmip ?
+      get_key_from_kmip_server(response->bio, request->messages[i],
+                               message_length, &response->keys[i],
+                               &response->key_sizes[i]) :
+      get_resp_from_tls_server(response->bio, request->messages[i],
+                               message_length, &response->keys[i],
+                               &response->key_sizes[i]);
+  }
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error obtaining key from server %s", address);
+    getkey_response_free(response);
+    return 1;
+  }
+
+  *result = response;
+  return 0;
+}
+
+//############################################################################
+// getkey_fetch_from_endpoints()
+//############################################################################
+static int getkey_fetch_from_endpoints(endpoint_set * endpoints,
+                                       const endpoint_policy * policy,
+                                       const char *statsPath,
+                                       const getkey_request_t * request,
+                                       getkey_response_t ** response,
+                                       size_t *index)
+{
+  // endpoint_fetch() frees its copy of the request, once no server is
+  // still working on it
+  getkey_request_t *copy = getkey_request_copy(request);
+
+  if (copy == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to copy key server request");
+    return 1;
+  }
+
+  int retval = endpoint_fetch(endpoints, policy, getkey_fetch,
+                              getkey_response_free, copy,
+                              getkey_request_free, (void **) response, index);
+
+  // what was learned of the servers steers the next run's choice of them
+  if (statsPath != NULL && endpoint_stats_save(endpoints, statsPath))
+  {
+    kmyth_log(LOG_WARNING, "endpoint statistics not saved");
+  }
+
+  return retval;
+}
+
+//############################################################################
+// get_key_from_daemon()
+//############################################################################
+static int get_key_from_daemon(char *agentPath, char *message, char *outPath,
+                               char *execCommand, char *sendFdPath)
+{
+  char request[KMYTH_AGENT_MAX_LINE_LEN];
+  int request_len = snprintf(request, sizeof(request), "GET%s%s\n",
+                             (message == NULL) ? "" : " ",
+                             (message == NULL) ? "" : message);
+
+  if (request_len < 0 || (size_t) request_len >= sizeof(request) ||
+      (message != NULL && strpbrk(message, " \n") != NULL))
+  {
+    kmyth_log(LOG_ERR, "key ID is too long (or has spaces) for a daemon "
+              "request ... exiting");
+    return 1;
+  }
+
+  unsigned char *key = NULL;
+  size_t key_size = 0;
+
+  if (agent_request(agentPath, request, -1, &key, &key_size) || key == NULL)
+  {
+    kmyth_log(LOG_ERR, "error obtaining key from daemon ... exiting");
+    kmyth_clear_and_free(key, key_size);
+    return 1;
+  }
+
+  int retval = write_key(key, key_size, outPath, execCommand, sendFdPath);
+
+  kmyth_clear_and_free(key, key_size);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error writing key ... exiting");
+  }
+  return retval;
+}
+
+//############################################################################
+// daemon_disconnect()
+//############################################################################
+static void daemon_disconnect(getkey_daemon_t * daemon)
+{
+  if (daemon->bio != NULL)
+  {
+    BIO_ssl_shutdown(daemon->bio);
+    BIO_free_all(daemon->bio);
+    daemon->bio = NULL;
+  }
+
+  // the context itself stays cached (by tls_util) for the next connection
+  SSL_CTX_free(daemon->ctx);
+  daemon->ctx = NULL;
+}
+
+//############################################################################
+// daemon_connection_idle()
+//############################################################################
+static bool daemon_connection_idle(getkey_daemon_t * daemon)
+{
+  int fd = -1;
+
+  if (daemon->bio == NULL || BIO_get_fd(daemon->bio, &fd) < 0 || fd < 0)
+  {
+    return false;
+  }
+
+  // Between requests, the server has nothing to send: a readable
+  // connection is one the server is closing.
+  struct pollfd pfd = {.fd = fd,.events = POLLIN };
+
+  return (poll(&pfd, 1, 0) == 0);
+}
+
+//############################################################################
+// daemon_connect()
+//############################################################################
+static int daemon_connect(getkey_daemon_t * daemon, uint64_t deadline_ns)
+{
+  daemon_disconnect(daemon);
+
+  getkey_request_t request = {
+    .client_key = daemon->client_key,
+    .client_key_len = daemon->client_key_len,
+    .client_cert_path = daemon->client_cert_path,
+    .server_cert_path = daemon->server_cert_path,
+    .session = daemon->session,
+    .has_sockopts = (daemon->sockopts != NULL),
+    .kmip = daemon->kmip,
+    .connect_only = true
+  };
+  getkey_response_t *response = NULL;
+
+  if (daemon->sockopts != NULL)
+  {
+    request.sockopts = *daemon->sockopts;
+  }
+  if (deadline_ns != 0)
+  {
+    if (!request.has_sockopts)
+    {
+      socket_options_init(&request.sockopts);
+      request.has_sockopts = true;
+    }
+    request.sockopts.deadline_ns = deadline_ns;
+  }
+  if (getkey_fetch_from_endpoints(daemon->endpoints, daemon->policy,
+                                  daemon->stats_path, &request, &response,
+                                  NULL))
+  {
+    return 1;
+  }
+
+  daemon->bio = response->bio;
+  daemon->ctx = response->ctx;
+  free(response);
+
+  return 0;
+}
+
+//############################################################################
+// daemon_get_key()
+//############################################################################
+static int daemon_get_key(getkey_daemon_t * daemon, char *message,
+                          unsigned char **key, size_t *key_size)
+{
+  size_t message_length = (message == NULL) ? 0 : strlen(message);
+  uint64_t deadline_ns = deadline_after(daemon->deadline_ms);
+
+  // A KMIP connection is kept open for the next request, and (should the
+  // server have closed it meanwhile) is only retried once over a new one.
+  // The "simple" server protocol has no framing, so each of its requests
+  // gets a connection of its own.
+  for (int attempt = 0; attempt < 2; attempt++)
+  {
+    bool reused = daemon->kmip && daemon_connection_idle(daemon);
+
+    // (a kept connection still has the last request's deadline)
+    if (reused && tls_set_deadline(daemon->bio, deadline_ns))
+    {
+      daemon_disconnect(daemon);
+      reused = false;
+    }
+    if (!reused && daemon_connect(daemon, deadline_ns))
+    {
+      return 1;
+    }
+
+    int retval = daemon->kmip ?
+      get_key_from_kmip_server(daemon->bio, message, message_length,
+                               key, key_size) :
+      get_resp_from_tls_server(daemon->bio, message, message_length,
+                               key, key_size);
+
+    if (retval == 0)
+    {
+      // the newest session is offered on reconnecting (it is only kept in
+      // memory - the sealed session file is left to one-shot runs)
+      SSL_SESSION *session = NULL;
+
+      if (daemon->resume && tls_get_session(daemon->bio, &session) == 0)
+      {
+        SSL_SESSION_free(daemon->session);
+        daemon->session = session;
+      }
+      if (!daemon->kmip)
+      {
+        daemon_disconnect(daemon);
+      }
+      return 0;
+    }
+
+    daemon_disconnect(daemon);
+    if (!reused)
+    {
+      break;
+    }
+    kmyth_log(LOG_DEBUG, "retrying request over a new connection");
+  }
+
+  return 1;
+}
+
+//############################################################################
+// daemon_handle_request()
+//############################################################################
+static void daemon_handle_request(int client_fd, getkey_daemon_t * daemon)
+{
+  char line[KMYTH_AGENT_MAX_LINE_LEN] = { 0 };
+  int passed_fd = -1;
+
+  if (agent_recv_request(client_fd, line, &passed_fd))
+  {
+    agent_send_error(client_fd, "invalid request");
+    return;
+  }
+  if (passed_fd != -1)
+  {
+    close(passed_fd);
+  }
+
+  // "GET" (no message) or "GET <key ID>"
+  char *message = NULL;
+
+  if (strncmp(line, "GET ", 4) == 0 && line[4] != '\0')
+  {
+    message = line + 4;
+  }
+  else if (strcmp(line, "GET") != 0)
+  {
+    agent_send_error(client_fd, "invalid request");
+    return;
+  }
+
+  unsigned char *key = NULL;
+  size_t key_size = 0;
+
+  if (daemon_get_key(daemon, message, &key, &key_size))
+  {
+    agent_send_error(client_fd, "key server request failed");
+    return;
+  }
+
+  agent_send_ok(client_fd, key, key_size);
+  kmyth_clear_and_free(key, key_size);
+}
+
+//############################################################################
+// run_daemon()
+//############################################################################
+static int run_daemon(char *daemonPath, getkey_daemon_t * daemon)
+{
+  int server_fd = -1;
+
+  if (setup_unix_server_socket(daemonPath, 0600, &server_fd)
+      || listen(server_fd, SOMAXCONN))
+  {
+    kmyth_log(LOG_ERR, "unable to listen on socket: %s ... exiting",
+              daemonPath);
+    if (server_fd != -1)
+    {
+      close(server_fd);
+      unlink(daemonPath);
+    }
+    return 1;
+  }
 
-#include <openssl/bio.h>
-#include <openssl/ssl.h>
+  struct sigaction sa = { 0 };
 
-#include "defines.h"
-#include "file_io.h"
-#include "kmyth.h"
-#include "kmyth_log.h"
-#include "memory_util.h"
-#include "tls_util.h"
+  sa.sa_handler = handle_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
 
-static void usage(const char *prog)
-{
-  fprintf(stdout,
-          "\nusage: %s [options]\n\n"
-          "options are:\n\n"
-          "Client Information --\n"
-          "  -i or --input         Path to file containing the kmyth-sealed client's certificate private key.\n"
-          "  -l or --client        Path to file containing the client's certificate.\n\n"
-          "Server Information --\n"
-          "  -t or --type          The type of the key server. Valid values include 'kmip' and 'simple'.\n"
-          "                        Defaults to 'simple'.\n"
-          "  -s or --server        Path to file containing the certificate\n"
-          "                        for the CA that issued the server cert.\n"
-          "  -c or --conn_addr     The ip_address:port for the TLS connection.\n"
-          "  -m or --message       An optional message to send the key server.\n\n"
-          "Output Parameters --\n"
-          "  -o or --output        Output file path to write the key. If none is selected, key will be sent to stdout.\n\n"
-          "Sealed Key Parameters --\n"
-          "  -a or --auth_string   String used to create 'authVal' digest. Defaults to empty string (all-zero digest)\n"
-          "  -w or --owner_auth    TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n\n"
-          "Misc --\n"
-          "  -v or --verbose       Detailed logging mode to help with debugging.\n"
-          "  -h or --help          Help (displays this usage).\n\n", prog);
-}
+  kmyth_log(LOG_INFO, "listening on %s", daemonPath);
 
-int check_string_arg(const char *arg, size_t arg_len,
-                     const char *value, size_t value_len)
-{
-  if ((arg_len != value_len) || strncmp(arg, value, value_len))
+  struct timeval io_timeout = {.tv_sec = KMYTH_AGENT_IO_TIMEOUT,.tv_usec = 0 };
+
+  while (daemon_running)
   {
-    return 0;
+    int client_fd = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (client_fd < 0)
+    {
+      if (errno != EINTR)
+      {
+        kmyth_log(LOG_ERR, "accept failed ... exiting");
+        break;
+      }
+      continue;
+    }
+
+    // only root and the user running the daemon may get keys from it
+    struct ucred cred = { 0 };
+    socklen_t cred_len = sizeof(cred);
+
+    if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == 0
+        && (cred.uid == 0 || cred.uid == geteuid()))
+    {
+      // A client must not be able to stall the daemon indefinitely.
+      setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &io_timeout,
+                 sizeof(io_timeout));
+      setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &io_timeout,
+                 sizeof(io_timeout));
+      daemon_handle_request(client_fd, daemon);
+    }
+    else
+    {
+      kmyth_log(LOG_WARNING, "rejected request from uid %u (pid %d)",
+                (unsigned int) cred.uid, (int) cred.pid);
+    }
+    close(client_fd);
   }
-  return 1;
+
+  kmyth_log(LOG_INFO, "shutting down");
+  daemon_disconnect(daemon);
+  close(server_fd);
+  unlink(daemonPath);
+
+  return 0;
 }
 
-const struct option longopts[] = {
+static const struct option longopts[] = {
   // Client info
   {"input", required_argument, 0, 'i'},
   {"client", required_argument, 0, 'l'},
@@ -63,19 +1052,39 @@ const struct option longopts[] = {
   {"type", no_argument, 0, 't'},
   {"server", required_argument, 0, 's'},
   {"conn_addr", required_argument, 0, 'c'},
+  {"hedge", required_argument, 0, 'H'},
+  {"endpoint_stats", required_argument, 0, 'E'},
   {"message", required_argument, 0, 'm'},
+  {"key_list", required_argument, 0, 'k'},
+  {"resume", no_argument, 0, 'R'},
+  {"early_data", no_argument, 0, 'z'},
+  {"sockopt", required_argument, 0, 'O'},
+  {"deadline", required_argument, 0, 'D'},
+  // Key cache
+  {"cache", required_argument, 0, 'C'},
+  {"cache_max_age", required_argument, 0, 'M'},
+  {"unseal_agent", required_argument, 0, 'U'},
   // Output info
   {"output", required_argument, 0, 'o'},
+  {"exec", required_argument, 0, 'e'},
+  {"send_fd", required_argument, 0, 'F'},
+  // Daemon mode
+  {"daemon", required_argument, 0, 'd'},
+  {"agent", required_argument, 0, 'A'},
   // Sealed Key info
   {"auth_string", required_argument, 0, 'a'},
   {"owner_auth", required_argument, 0, 'w'},
   // Misc
   {"verbose", no_argument, 0, 'v'},
   {"help", no_argument, 0, 'h'},
+  {"timings", no_argument, 0, 'T'},
   {0, 0, 0, 0}
 };
 
-int main(int argc, char **argv)
+//############################################################################
+// getkey_main()
+//############################################################################
+static int getkey_main(int argc, char **argv, endpoint_set * endpoints)
 {
   // Exit early if there are no arguments
   if (argc == 1)
@@ -84,27 +1093,40 @@ int main(int argc, char **argv)
     return 0;
   }
 
-  // Configure logging messages
-  set_app_name(KMYTH_APP_NAME);
-  set_app_version(KMYTH_VERSION);
-  set_applog_path(KMYTH_APPLOG_PATH);
-
   // Info passed through command line inputs
   char *inPath = NULL;
   char *outPath = NULL;
+  char *execCommand = NULL;
+  char *sendFdPath = NULL;
+  char *daemonPath = NULL;
+  char *agentPath = NULL;
   char *clientCertPath = NULL;
   char *serverType = "simple";
   char *serverCertPath = NULL;
-  char *address = NULL;
-  char *message = NULL;
+  endpoint_policy policy = {.hedge = false,.hedge_delay_ms = 0 };
+  char *statsPath = NULL;
+  char *messages[KMYTH_GETKEY_MAX_MESSAGES];
+  size_t messages_count = 0;
+  char *keyListPath = NULL;
+  bool resumeSession = false;
+  bool earlyData = false;
+  socket_options sockopts;
+  socket_options *sockoptsIn = NULL;
+  int deadlineMs = 0;
+  char *cacheDir = NULL;
+  unsigned long cacheMaxAge = KMYTH_GETKEY_CACHE_MAX_AGE;
+  char *unsealAgentPath = NULL;
   char *authString = NULL;
   char *ownerAuthPasswd = "";
+  kmyth_timings_t timings = { 0 };
+  kmyth_timings_t *timingsOut = NULL;
 
   int options;
   int option_index;
 
+  socket_options_init(&sockopts);
   while ((options =
-          getopt_long(argc, argv, "i:l:t:s:c:m:o:a:w:vh", longopts,
+          getopt_long(argc, argv, "i:l:t:s:c:H:E:m:k:C:M:U:o:e:F:d:A:a:w:vhRzO:D:T", longopts,
                       &option_index)) != -1)
     switch (options)
     {
@@ -124,16 +1146,114 @@ int main(int argc, char **argv)
       serverCertPath = optarg;
       break;
     case 'c':
-      address = optarg;
+      if (endpoint_set_add(endpoints, optarg))
+      {
+        return 1;
+      }
+      break;
+    case 'H':
+      {
+        char *end = NULL;
+
+        errno = 0;
+        long delay = strtol(optarg, &end, 10);
+
+        if (errno || end == optarg || *end != '\0' || delay < 0
+            || delay > INT_MAX)
+        {
+          kmyth_log(LOG_ERR, "invalid hedging delay (%s) ... exiting",
+                    optarg);
+          return 1;
+        }
+        policy.hedge = true;
+        policy.hedge_delay_ms = (int) delay;
+      }
+      break;
+    case 'E':
+      statsPath = optarg;
       break;
     case 'm':
-      message = optarg;
+      if (messages_count == KMYTH_GETKEY_MAX_MESSAGES)
+      {
+        kmyth_log(LOG_ERR, "too many messages (maximum %d) ... exiting",
+                  KMYTH_GETKEY_MAX_MESSAGES);
+        return 1;
+      }
+      messages[messages_count++] = optarg;
+      break;
+    case 'k':
+      keyListPath = optarg;
+      break;
+    case 'R':
+      resumeSession = true;
+      break;
+    case 'z':
+      earlyData = true;
+      break;
+    case 'O':
+      if (parse_socket_option(optarg, &sockopts))
+      {
+        return 1;
+      }
+      sockoptsIn = &sockopts;
+      break;
+    case 'D':
+      {
+        char *end = NULL;
+
+        errno = 0;
+        long deadline = strtol(optarg, &end, 10);
+
+        if (errno || end == optarg || *end != '\0' || deadline <= 0
+            || deadline > INT_MAX)
+        {
+          kmyth_log(LOG_ERR, "invalid deadline (%s) ... exiting", optarg);
+          return 1;
+        }
+        deadlineMs = (int) deadline;
+      }
+      break;
+
+      // Key cache
+    case 'C':
+      cacheDir = optarg;
+      break;
+    case 'M':
+      {
+        char *end = NULL;
+
+        errno = 0;
+        cacheMaxAge = strtoul(optarg, &end, 10);
+        if (errno || end == optarg || *end != '\0')
+        {
+          kmyth_log(LOG_ERR, "invalid cache max age (%s) ... exiting",
+                    optarg);
+          return 1;
+        }
+      }
+      break;
+    case 'U':
+      unsealAgentPath = optarg;
       break;
 
       // Output info
     case 'o':
       outPath = optarg;
       break;
+    case 'e':
+      execCommand = optarg;
+      break;
+    case 'F':
+      sendFdPath = optarg;
+      break;
+
+      // Daemon mode
+    case 'd':
+      daemonPath = optarg;
+      break;
+    case 'A':
+      agentPath = optarg;
+      break;
 
       // Sealed Key info
     case 'a':
@@ -150,6 +1270,9 @@ int main(int argc, char **argv)
       set_applog_severity_threshold(LOG_DEBUG);
       set_applog_output_mode(0);
       break;
+    case 'T':
+      timingsOut = &timings;
+      break;
     case 'h':
       usage(argv[0]);
       return 0;
@@ -162,6 +1285,40 @@ int main(int argc, char **argv)
   size_t oa_passwd_len =
     (ownerAuthPasswd == NULL) ? 0 : strlen(ownerAuthPasswd);
 
+  // A key is got from a running daemon without the TPM or the client's
+  // credentials, and is output as usual
+  if (agentPath != NULL)
+  {
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    if (daemonPath != NULL || keyListPath != NULL || messages_count > 1 ||
+        (execCommand != NULL && (sendFdPath != NULL || outPath != NULL)) ||
+        (sendFdPath != NULL && outPath != NULL))
+    {
+      kmyth_log(LOG_ERR, "-A gets a single key, and cannot be combined with "
+                "-d or -k (nor -e or -F with -o) ... exiting");
+      return 1;
+    }
+    if (outPath != NULL && verifyOutputFilePath(outPath))
+    {
+      kmyth_log(LOG_ERR, "error verifying output path ... exiting");
+      return 1;
+    }
+    return get_key_from_daemon(agentPath,
+                               (messages_count == 0) ? NULL : messages[0],
+                               outPath, execCommand, sendFdPath);
+  }
+  if (daemonPath != NULL && (messages_count > 0 || keyListPath != NULL ||
+                             outPath != NULL || execCommand != NULL ||
+                             sendFdPath != NULL || cacheDir != NULL))
+  {
+    kmyth_log(LOG_ERR, "-d cannot be combined with -m, -k, -o, -e, -F or -C "
+              "... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+
   // Validate presence of required command line input parameters
   if (inPath == NULL)
   {
@@ -184,7 +1341,7 @@ int main(int argc, char **argv)
     kmyth_clear(ownerAuthPasswd, oa_passwd_len);
     return 1;
   }
-  if (address == NULL)
+  if (endpoints->count == 0)
   {
     kmyth_log(LOG_ERR, "server address not specified ... exiting");
     kmyth_clear(authString, auth_string_len);
@@ -192,8 +1349,25 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  // If configured to write to an output file, verify that path
-  if (outPath != NULL)
+  // With -k, or more than one -m, several keys are requested
+  bool multiKey = (keyListPath != NULL || messages_count > 1);
+
+  // A (single) key can be handed off (-e or -F) in place of being written
+  bool handoff = (execCommand != NULL || sendFdPath != NULL);
+
+  if (handoff && (multiKey || outPath != NULL ||
+                  (execCommand != NULL && sendFdPath != NULL)))
+  {
+    kmyth_log(LOG_ERR, "-e or -F must be used alone, for a single key, and "
+              "not with -o ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+
+  // If configured to write to an output file, verify that path (the path
+  // of each of several keys is checked once they are known)
+  if (outPath != NULL && !multiKey)
   {
     if (verifyOutputFilePath(outPath))
     {
@@ -215,6 +1389,19 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  // Early data is sent over a resumed session, and only as a KMIP Get
+  // (which is safe to replay), by a one-shot run
+  if (earlyData && (!resumeSession || daemonPath != NULL ||
+                    !check_string_arg(serverType, serverTypeLen, "kmip",
+                                      strlen("kmip"))))
+  {
+    kmyth_log(LOG_ERR, "-z requires -R and a 'kmip' server, and cannot be "
+              "combined with -d ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+
   // Validate user-specified input paths
   if (verifyInputFilePath(inPath))
   {
@@ -238,12 +1425,206 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  // Compute size of user-specified optional message parameter
-  size_t message_length = 0;
+  // The messages (key IDs) are those given with -m, then those listed in
+  // the -k file. Several keys are only supported for a KMIP server, which
+  // answers any number of requests over the one connection, and are each
+  // written to a file (named by the key ID) in the -o directory.
+  char **listedMessages = NULL;
+  size_t listedMessages_count = 0;
+
+  if (multiKey &&
+      read_path_list(keyListPath, &listedMessages, &listedMessages_count))
+  {
+    kmyth_log(LOG_ERR, "unable to read key list: %s ... exiting",
+              keyListPath);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+
+  size_t allMessages_count = messages_count + listedMessages_count;
+  char **allMessages = calloc(allMessages_count + 1, sizeof(char *));
+  char **keyPaths = calloc(allMessages_count + 1, sizeof(char *));
+  int retval = 0;
+
+  if (allMessages == NULL || keyPaths == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate key list ... exiting");
+    retval = 1;
+  }
+  else
+  {
+    memcpy(allMessages, messages, messages_count * sizeof(char *));
+    memcpy(allMessages + messages_count, listedMessages,
+           listedMessages_count * sizeof(char *));
+  }
+  if (retval == 0 && multiKey && (allMessages_count == 0 ||
+                                  !check_string_arg(serverType, serverTypeLen,
+                                                    "kmip", strlen("kmip"))
+                                  || outPath == NULL))
+  {
+    kmyth_log(LOG_ERR, "getting several keys requires a 'kmip' server and "
+              "an output directory ... exiting");
+    retval = 1;
+  }
+  for (size_t i = 0; retval == 0 && multiKey && i < allMessages_count; i++)
+  {
+    if (strchr(allMessages[i], '/') != NULL ||
+        strcmp(allMessages[i], ".") == 0 || strcmp(allMessages[i], "..") == 0
+        || asprintf(&keyPaths[i], "%s/%s", outPath, allMessages[i]) < 0)
+    {
+      keyPaths[i] = NULL;
+      kmyth_log(LOG_ERR, "key ID (%s) is not usable as a file name ... "
+                "exiting", allMessages[i]);
+      retval = 1;
+    }
+    else if (verifyOutputFilePath(keyPaths[i]))
+    {
+      retval = 1;
+    }
+  }
+  if (retval == 0 && !multiKey)
+  {
+    keyPaths[0] = outPath;
+  }
+
+  // The saved TLS session (if any) is kept next to the sealed client key
+  char *sessionPath = NULL;
+
+  if (retval == 0 && resumeSession &&
+      asprintf(&sessionPath, "%s" KMYTH_GETKEY_SESSION_EXT, inPath) < 0)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate TLS session path ... exiting");
+    sessionPath = NULL;
+    retval = 1;
+  }
+
+  // The cached keys are kept one per file, named by the key ID, as with
+  // several keys written to the -o directory
+  char **cachePaths = NULL;
+
+  if (retval == 0 && cacheDir != NULL &&
+      get_cache_paths(cacheDir, allMessages,
+                      multiKey ? allMessages_count : 1, &cachePaths))
+  {
+    retval = 1;
+  }
+
+  // The cached keys and the saved TLS session are sealed to the PCRs the
+  // client key is sealed to
+  int *clientPcrs = NULL;
+  size_t clientPcrs_len = 0;
+
+  if (retval == 0 && (cacheDir != NULL || resumeSession) &&
+      get_client_pcrs(inPath, (cacheDir != NULL) ? "-C" : "-R", &clientPcrs,
+                      &clientPcrs_len))
+  {
+    retval = 1;
+  }
+
+  if (retval)
+  {
+    free_key_list(allMessages, keyPaths, multiKey ? allMessages_count : 0,
+                  listedMessages, listedMessages_count, sessionPath,
+                  cachePaths, clientPcrs);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+
+  // (a missing statistics file is only a first run)
+  if (statsPath != NULL)
+  {
+    endpoint_stats_load(endpoints, statsPath);
+  }
+
+  // With every key cached (and fresh enough), the keys are output without
+  // waiting on the key server, or even unsealing the CAPK. A background
+  // process (which carries on below) then refreshes the cache.
+  bool refreshOnly = false;
+  bool cacheUsed = false;
 
-  if (message != NULL)
+  if (cachePaths != NULL)
   {
-    message_length = strlen(message);
+    size_t cached_count = multiKey ? allMessages_count : 1;
+    unsigned char **cachedKeys = calloc(cached_count, sizeof(unsigned char *));
+    size_t *cachedKey_sizes = calloc(cached_count, sizeof(size_t));
+
+    if (cachedKeys != NULL && cachedKey_sizes != NULL &&
+        read_cached_keys(cachePaths, cached_count, cacheMaxAge,
+                         unsealAgentPath, (uint8_t *) authString,
+                         auth_string_len, (uint8_t *) ownerAuthPasswd,
+                         oa_passwd_len, cachedKeys, cachedKey_sizes) == 0)
+    {
+      kmyth_log(LOG_INFO, "using %zu cached key(s)", cached_count);
+
+      // (nothing buffered is to be written twice, and the child has no
+      // logging thread)
+      stop_async_logging();
+      fflush(NULL);
+
+      pid_t pid = fork();
+
+      if (pid == 0)
+      {
+        refreshOnly = true;
+        setsid();
+        kmyth_trace_shutdown();
+
+        // the child must not hold the caller's output (e.g., a pipe) open
+        int null_fd = open("/dev/null", O_RDWR);
+
+        if (null_fd >= 0)
+        {
+          dup2(null_fd, STDIN_FILENO);
+          dup2(null_fd, STDOUT_FILENO);
+          dup2(null_fd, STDERR_FILENO);
+          if (null_fd > STDERR_FILENO)
+          {
+            close(null_fd);
+          }
+        }
+      }
+      else
+      {
+        if (pid < 0)
+        {
+          kmyth_log(LOG_WARNING, "unable to refresh the key cache");
+        }
+        cacheUsed = true;
+        kmyth_clear(authString, auth_string_len);
+        kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+
+        // (several keys are each written to their own file)
+        for (size_t i = 0; retval == 0 && i < cached_count; i++)
+        {
+          retval = handoff ?
+            write_key(cachedKeys[i], cachedKey_sizes[i], NULL, execCommand,
+                      sendFdPath) :
+            write_key(cachedKeys[i], cachedKey_sizes[i], keyPaths[i], NULL,
+                      NULL);
+        }
+        if (retval)
+        {
+          kmyth_log(LOG_ERR, "error writing key ... exiting");
+        }
+      }
+
+      for (size_t i = 0; i < cached_count; i++)
+      {
+        kmyth_clear_and_free(cachedKeys[i], cachedKey_sizes[i]);
+      }
+    }
+    free(cachedKeys);
+    free(cachedKey_sizes);
+
+    if (cacheUsed)
+    {
+      free_key_list(allMessages, keyPaths, multiKey ? allMessages_count : 0,
+                    listedMessages, listedMessages_count, sessionPath,
+                    cachePaths, clientPcrs);
+      return retval;
+    }
   }
 
   // Use kmyth-unseal to recover the Client Authentication Private Key (CAPK)
@@ -253,16 +1634,52 @@ int main(int argc, char **argv)
 
   // use bool_policy_or = 1 to unseal objects that are sealed with a compound "policy or" policy
   uint8_t bool_policy_or = 0;
+  kmyth_ctx_t *unseal_ctx = NULL;
+  int unseal_retval = 1;
+  SSL_SESSION *session = NULL;
+
+  // The deadline (of a daemon, only its requests) runs from here, and
+  // covers getting the keys from the server too
+  uint64_t deadline_ns = (daemonPath == NULL) ? deadline_after(deadlineMs) : 0;
+
+  if (kmyth_ctx_create(&unseal_ctx) == 0 &&
+      (timingsOut == NULL ||
+       kmyth_ctx_set_timings(unseal_ctx, timingsOut) == 0) &&
+      kmyth_ctx_set_deadline(unseal_ctx, deadline_ns) == 0)
+  {
+    unseal_retval = tpm2_kmyth_unseal_file_ctx(unseal_ctx, inPath,
+                                               &clientPrivateKey_data,
+                                               &clientPrivateKey_size,
+                                               (uint8_t *) authString,
+                                               auth_string_len,
+                                               (uint8_t *) ownerAuthPasswd,
+                                               oa_passwd_len, bool_policy_or);
+
+    // (the saved TLS session is sealed with the same authorization)
+    if (unseal_retval == 0 && sessionPath != NULL &&
+        read_sealed_session(unseal_ctx, sessionPath, (uint8_t *) authString,
+                            auth_string_len, (uint8_t *) ownerAuthPasswd,
+                            oa_passwd_len, &session))
+    {
+      kmyth_log(LOG_DEBUG, "no previous TLS session to resume");
+    }
+  }
+  kmyth_ctx_destroy(&unseal_ctx);
+  if (timingsOut != NULL)
+  {
+    kmyth_timings_print(stderr, timingsOut);
+  }
 
-  if (tpm2_kmyth_unseal_file(inPath,
-                             &clientPrivateKey_data, &clientPrivateKey_size,
-                             (uint8_t *) authString, auth_string_len,
-                             (uint8_t *) ownerAuthPasswd, oa_passwd_len,
-                             bool_policy_or))
+  if (unseal_retval)
   {
-    kmyth_log(LOG_ERR, "Unable to unseal the certificate's private key.");
+    kmyth_log(LOG_ERR, "Unable to unseal the certificate's private key%s.",
+              (unseal_retval == KMYTH_ERR_TIMEOUT) ? " (deadline passed)" :
+              "");
     kmyth_clear_and_free(clientPrivateKey_data, clientPrivateKey_size);
     free(sdo_orig_fn);
+    free_key_list(allMessages, keyPaths, multiKey ? allMessages_count : 0,
+                  listedMessages, listedMessages_count, sessionPath,
+                  cachePaths, clientPcrs);
     kmyth_clear(authString, auth_string_len);
     kmyth_clear(ownerAuthPasswd, oa_passwd_len);
     return 1;
@@ -270,94 +1687,234 @@ int main(int argc, char **argv)
 
   free(sdo_orig_fn);
 
-  // We no longer need authString and ownerAuthPasswd, so clear them
-  kmyth_clear(authString, auth_string_len);
-  kmyth_clear(ownerAuthPasswd, oa_passwd_len);
-
-  // Create TLS connection to the key server, using the CAPK
-  BIO *bio = NULL;
-  SSL_CTX *ctx = NULL;
-
-  if (create_tls_connection(&address,
-                            clientPrivateKey_data,
-                            clientPrivateKey_size,
-                            clientCertPath, serverCertPath, &bio, &ctx) == 1)
+  // We no longer need authString and ownerAuthPasswd (unless the keys, or
+  // the TLS session of a one-shot run, are to be sealed), so clear them
+  if (cachePaths == NULL && (sessionPath == NULL || daemonPath != NULL))
   {
-    kmyth_log(LOG_ERR, "error creating TLS connection ... exiting");
-    BIO_ssl_shutdown(bio);
-    tls_cleanup();
-    BIO_free_all(bio);
-    SSL_CTX_free(ctx);
-    kmyth_clear_and_free(clientPrivateKey_data, clientPrivateKey_size);
-    return 1;
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
   }
 
-  // Done with unsealed key buffer, so clear and free this memory
-  kmyth_clear_and_free(clientPrivateKey_data, clientPrivateKey_size);
+  // The daemon keeps the CAPK, for the connections it makes, in the
+  // secure heap (locked, so never written to swap) for as long as it runs
+  if (daemonPath != NULL)
+  {
+    getkey_daemon_t daemon = {
+      .endpoints = endpoints,
+      .policy = &policy,
+      .stats_path = statsPath,
+      .client_key_len = clientPrivateKey_size,
+      .client_cert_path = clientCertPath,
+      .server_cert_path = serverCertPath,
+      .resume = resumeSession,
+      .session = session,
+      .sockopts = sockoptsIn,
+      .deadline_ms = deadlineMs,
+      .kmip = check_string_arg(serverType, serverTypeLen, "kmip",
+                               strlen("kmip"))
+    };
 
-  // Now that we have a secure connection to the key server, retrieve the key
-  size_t key_size = 0;
-  unsigned char *key = NULL;
+    daemon.client_key = kmyth_secure_alloc(clientPrivateKey_size);
+    if (daemon.client_key == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate client key memory ... exiting");
+      retval = 1;
+    }
+    else
+    {
+      memcpy(daemon.client_key, clientPrivateKey_data,
+             clientPrivateKey_size);
+    }
+    kmyth_clear_and_free(clientPrivateKey_data, clientPrivateKey_size);
+
+    if (retval == 0)
+    {
+      retval = run_daemon(daemonPath, &daemon);
+    }
+    kmyth_secure_free(daemon.client_key);
+    SSL_SESSION_free(daemon.session);
+    tls_cleanup();
+    free_key_list(allMessages, keyPaths, 0, listedMessages,
+                  listedMessages_count, sessionPath, cachePaths, clientPcrs);
+    return retval;
+  }
 
-  int server_result = 1;
+  // Get the keys from one of the key servers (a single request has no
+  // message unless -m was given)
+  bool kmipServer = check_string_arg(serverType, serverTypeLen,
+                                     "kmip", strlen("kmip"));
+  getkey_request_t request = {
+    .client_key = clientPrivateKey_data,
+    .client_key_len = clientPrivateKey_size,
+    .client_cert_path = clientCertPath,
+    .server_cert_path = serverCertPath,
+    .session = session,
+    .early_data = earlyData,
+    .has_sockopts = (sockoptsIn != NULL),
+    .messages = allMessages,
+    .message_count = multiKey ? allMessages_count : 1,
+    .kmip = kmipServer,
+    .batched = kmipServer && (multiKey ||
+                              (earlyData && allMessages[0] != NULL)),
+    .connect_only = false
+  };
+  getkey_response_t *response = NULL;
+  size_t endpoint_index = 0;
 
-  if (check_string_arg(serverType, serverTypeLen, "kmip", strlen("kmip")))
+  if (sockoptsIn != NULL)
   {
-    server_result = get_key_from_kmip_server(bio,
-                                             message, message_length,
-                                             &key, &key_size);
+    request.sockopts = *sockoptsIn;
   }
-  else
+  if (deadline_ns != 0)
   {
-    // The "simple" key server is the default.
-    server_result = get_resp_from_tls_server(bio,
-                                             message, message_length,
-                                             &key, &key_size);
+    request.has_sockopts = true;
+    request.sockopts.deadline_ns = deadline_ns;
   }
 
+  int server_result = getkey_fetch_from_endpoints(endpoints, &policy,
+                                                  statsPath, &request,
+                                                  &response, &endpoint_index);
+
+  // Done with unsealed key buffer, so clear and free this memory
+  kmyth_clear_and_free(clientPrivateKey_data, clientPrivateKey_size);
+  SSL_SESSION_free(session);
+
   if (server_result)
   {
     kmyth_log(LOG_ERR, "error obtaining key from server ... exiting");
-    BIO_ssl_shutdown(bio);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
     tls_cleanup();
-    if (BIO_reset(bio) != 0)
-    {
-      kmyth_log(LOG_ERR, "error resetting TLS BIO");
-    }
-    BIO_free_all(bio);
-    SSL_CTX_free(ctx);
-    kmyth_clear_and_free(key, key_size);
+    free_key_list(allMessages, keyPaths, multiKey ? allMessages_count : 0,
+                  listedMessages, listedMessages_count, sessionPath,
+                  cachePaths, clientPcrs);
     return 1;
   }
 
-  if (outPath == NULL)
+  int handoffFd = -1;
+
+  // (a background refresh of the cache only updates the cache)
+  for (size_t i = 0; !refreshOnly && retval == 0 && i < response->key_count;
+       i++)
   {
-    if (print_to_stdout(key, key_size) != 0)
+    if (handoff)
+    {
+      // the key is only kept (in a sealed memory file) for the handoff
+      retval = handoff_create_memfd("kmyth-getkey", response->keys[i],
+                                    response->key_sizes[i], &handoffFd);
+    }
+    else if (keyPaths[i] == NULL)
+    {
+      if (print_to_stdout(response->keys[i], response->key_sizes[i]) != 0)
+      {
+        kmyth_log(LOG_ERR, "error printing to stdout ... exiting");
+      }
+    }
+    else
     {
-      kmyth_log(LOG_ERR, "error printing to stdout ... exiting");
+      if (write_bytes_to_file(keyPaths[i], response->keys[i],
+                              response->key_sizes[i]))
+      {
+        kmyth_log(LOG_ERR, "Error writing file: %s", keyPaths[i]);
+      }
     }
   }
-  else
+
+  kmyth_log(LOG_INFO, "retrieved %zu key(s) from %s", response->key_count,
+            endpoints->addresses[endpoint_index]);
+
+  // The keys just got replace those cached (once output, so as not to
+  // hold up whatever is waiting on them)
+  if (cachePaths != NULL &&
+      write_cached_keys(cachePaths, response->key_count, response->keys,
+                        response->key_sizes, clientPcrs, clientPcrs_len,
+                        (uint8_t *) authString,
+                        auth_string_len, (uint8_t *) ownerAuthPasswd,
+                        oa_passwd_len) == 0)
+  {
+    kmyth_log(LOG_DEBUG, "cached %zu key(s) in %s", response->key_count,
+              cacheDir);
+  }
+
+  // Save the session (now that any TLS 1.3 ticket has arrived) for the
+  // next run to resume
+  if (sessionPath != NULL &&
+      write_sealed_session(sessionPath, response->bio, clientPcrs,
+                           clientPcrs_len, (uint8_t *) authString, auth_string_len,
+                           (uint8_t *) ownerAuthPasswd, oa_passwd_len) != 0)
+  {
+    kmyth_log(LOG_DEBUG, "TLS session not saved");
+  }
+  kmyth_clear(authString, auth_string_len);
+  kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+
+  // Close the TLS connection, and clear and free the memory holding the keys
+  getkey_response_free(response);
+  free_key_list(allMessages, keyPaths, multiKey ? allMessages_count : 0,
+                listedMessages, listedMessages_count, sessionPath,
+                cachePaths, clientPcrs);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error handing off key ... exiting");
+    return 1;
+  }
+
+  // The key is handed off once the connection is closed, so that a command
+  // run with it does not also inherit the connection
+  if (handoffFd != -1)
   {
-    if (write_bytes_to_file(outPath, key, key_size))
+    int handoff_result = (execCommand != NULL) ?
+      handoff_exec(handoffFd, execCommand) :
+      handoff_send(handoffFd, sendFdPath);
+
+    close(handoffFd);
+    if (handoff_result)
     {
-      kmyth_log(LOG_ERR, "Error writing file: %s", outPath);
+      kmyth_log(LOG_ERR, "error handing off key ... exiting");
+      return 1;
     }
   }
 
-  // Done with memory holding key, clear and free it
-  kmyth_clear_and_free(key, key_size);
+  return 0;
+}
 
-  kmyth_log(LOG_INFO, "retrieved key from %s", address);
+int main(int argc, char **argv)
+{
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+  start_async_logging(0);
 
-  // Cleanup TLS connection
-  BIO_ssl_shutdown(bio);
-  if (BIO_reset(bio) != 0)
+  // With KMYTH_TRACE_FILE set, the run is traced under one root span
+  if (kmyth_trace_init("kmyth-getkey"))
   {
-    kmyth_log(LOG_ERR, "error resetting TLS BIO");
+    kmyth_log(LOG_WARNING, "unable to open trace file, tracing is off");
   }
-  BIO_free_all(bio);
-  SSL_CTX_free(ctx);
 
-  return 0;
+  kmyth_span_t span;
+  char traceparent[KMYTH_TRACEPARENT_LEN];
+
+  kmyth_span_start(&span, "kmyth-getkey");
+
+  // a command the key is handed off to (-e) continues the same trace
+  if (kmyth_span_traceparent(&span, traceparent, sizeof(traceparent)) == 0)
+  {
+    setenv(KMYTH_TRACEPARENT_ENV, traceparent, 1);
+  }
+
+  // (the key servers, given with -c, are kept here so that every way out
+  // of getkey_main() frees them)
+  endpoint_set endpoints;
+
+  endpoint_set_init(&endpoints);
+
+  int retval = getkey_main(argc, argv, &endpoints);
+
+  endpoint_set_free(&endpoints);
+
+  kmyth_span_end(&span, retval);
+  kmyth_trace_shutdown();
+  return retval;
 }
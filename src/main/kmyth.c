@@ -0,0 +1,127 @@
+/**
+ * Kmyth Multi-Call Interface - TPM 2.0 version
+ *
+ * A single executable providing the kmyth-seal, kmyth-unseal, kmyth-reseal
+ * and kmyth-getkey applications, selected either by the name it is run as
+ * (e.g., through a kmyth-seal -> kmyth symbolic link) or by its first
+ * argument (e.g., 'kmyth seal -i file'). The kmyth libraries are linked
+ * into it statically, so that starting it only loads (and relocates) the
+ * TSS2 and OpenSSL shared libraries.
+ */
+
+#include <libgen.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "defines.h"
+
+/*
+ * The main() of each application, compiled (by the Makefile) a second time
+ * with main renamed
+ */
+int kmyth_seal_main(int argc, char **argv);
+int kmyth_unseal_main(int argc, char **argv);
+int kmyth_reseal_main(int argc, char **argv);
+int kmyth_getkey_main(int argc, char **argv);
+
+typedef struct kmyth_applet_s
+{
+  // the name the application is installed as
+  const char *name;
+
+  // the subcommand selecting it (its name without the "kmyth-" prefix)
+  const char *command;
+
+  int (*main) (int argc, char **argv);
+} kmyth_applet;
+
+static const kmyth_applet applets[] = {
+  {"kmyth-seal", "seal", kmyth_seal_main},
+  {"kmyth-unseal", "unseal", kmyth_unseal_main},
+  {"kmyth-reseal", "reseal", kmyth_reseal_main},
+  {"kmyth-getkey", "getkey", kmyth_getkey_main},
+};
+
+#define KMYTH_APPLET_COUNT (sizeof(applets) / sizeof(applets[0]))
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s <command> [options]\n"
+          "       <application> [options]   (run through a link named as the application)\n\n"
+          "commands are: \n\n", prog);
+  for (size_t i = 0; i < KMYTH_APPLET_COUNT; i++)
+  {
+    fprintf(stdout, " %-8s Runs %s (see '%s %s -h').\n", applets[i].command,
+            applets[i].name, prog, applets[i].command);
+  }
+  fprintf(stdout,
+          "\noptions are: \n\n"
+          " -l or --list     Lists the application names (e.g., for creating the links) and exits.\n"
+          " -V or --version  Displays the kmyth version and exits.\n"
+          " -h or --help     Help (displays this usage).\n");
+}
+
+//############################################################################
+// find_applet()
+//############################################################################
+static const kmyth_applet *find_applet(const char *name)
+{
+  for (size_t i = 0; i < KMYTH_APPLET_COUNT; i++)
+  {
+    if (strcmp(name, applets[i].name) == 0 ||
+        strcmp(name, applets[i].command) == 0)
+    {
+      return &applets[i];
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  // Nothing (in particular, no OpenSSL or TPM setup) is done before the
+  // application is selected, leaving all initialization to it
+  char *prog = basename(argv[0]);
+  const kmyth_applet *applet = find_applet(prog);
+
+  if (applet != NULL)
+  {
+    return applet->main(argc, argv);
+  }
+
+  if (argc == 1 || strcmp(argv[1], "-h") == 0 ||
+      strcmp(argv[1], "--help") == 0)
+  {
+    usage(prog);
+    return 0;
+  }
+
+  if (strcmp(argv[1], "-l") == 0 || strcmp(argv[1], "--list") == 0)
+  {
+    for (size_t i = 0; i < KMYTH_APPLET_COUNT; i++)
+    {
+      fprintf(stdout, "%s\n", applets[i].name);
+    }
+    return 0;
+  }
+
+  if (strcmp(argv[1], "-V") == 0 || strcmp(argv[1], "--version") == 0)
+  {
+    fprintf(stdout, "%s %s\n", KMYTH_APP_NAME, KMYTH_VERSION);
+    return 0;
+  }
+
+  applet = find_applet(argv[1]);
+  if (applet == NULL)
+  {
+    fprintf(stderr, "%s: unknown command '%s' (see '%s -h')\n", prog,
+            argv[1], prog);
+    return 1;
+  }
+
+  // the application sees the command as its own name (argv[0]), so that
+  // its usage and option errors read as they do when it is run directly
+  argv[1] = (char *) applet->name;
+  return applet->main(argc - 1, argv + 1);
+}
@@ -3,8 +3,13 @@
  * @brief A client app for testing the Needham-Schroeder-Lowe protocol
  */
 
+#include <errno.h>
 #include <getopt.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <kmip/kmip.h>
@@ -12,6 +17,7 @@
 #include "defines.h"
 #include "memory_util.h"
 #include "nsl_util.h"
+#include "parallel_util.h"
 #include "socket_util.h"
 #include "aes_gcm.h"
 #include "kmip_util.h"
@@ -22,12 +28,22 @@ static void usage(const char *prog)
           "\nusage: %s [options]\n\n"
           "options are:\n\n"
           "Client Information --\n"
-          "  -r or --priv   Path to the file containing the client's private key.\n"
+          "  -r or --priv   Path to the file containing the client's private key\n"
+          "                 (RSA, or EC - P-256 or X25519 - for ECIES).\n"
           "Server Information --\n"
           "  -i or --ip    The IP address or hostname of the server.\n"
           "  -p or --port  The port number to connect to.\n"
           "  -u or --pub  Path to the file containing the server's public key.\n"
-          "Misc --\n" "  -h or --help  Help (displays this usage).\n\n", prog);
+          "Load Generation --\n"
+          "  -n or --count  Number of sessions (handshake and key retrieval) to\n"
+          "                 run, reporting the rate achieved. Defaults to 1.\n"
+          "  -j or --jobs   Number of sessions run concurrently (1 to %d).\n"
+          "                 Defaults to 1.\n"
+          "  -R or --resume Have each worker obtain a session ticket with its first\n"
+          "                 session, and resume its later sessions with it (a single\n"
+          "                 round trip, with no public key operations).\n"
+          "Misc --\n" "  -h or --help  Help (displays this usage).\n\n", prog,
+          KMYTH_MAX_JOBS);
 }
 
 int check_string_arg(const char *arg, size_t arg_len,
@@ -47,6 +63,10 @@ const struct option longopts[] = {
   {"ip", required_argument, 0, 'i'},
   {"port", required_argument, 0, 'p'},
   {"pub", required_argument, 0, 'u'},
+  // Load generation
+  {"count", required_argument, 0, 'n'},
+  {"jobs", required_argument, 0, 'j'},
+  {"resume", no_argument, 0, 'R'},
   // Misc
   {"help", no_argument, 0, 'h'},
   {0, 0, 0, 0}
@@ -172,6 +192,171 @@ int retrieve_key_with_session_key(int socket_fd,
   return 0;
 }
 
+//
+// run_session()
+//
+static int run_session(char *ip, char *port, EVP_PKEY_CTX * public_key_ctx,
+                       EVP_PKEY_CTX * private_key_ctx,
+                       nsl_session_ticket * ticket, int key_severity)
+{
+  // Create socket to B
+  int socket_fd = -1;
+  int result = setup_client_socket(ip, port, &socket_fd);
+
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to setup socket.");
+    return 1;
+  }
+
+  // Conduct NSL to obtain a shared session key
+  unsigned char *session_key = NULL;
+  size_t session_key_len = 0;
+
+  unsigned char *id = (unsigned char *) "A\0";
+  size_t id_len = 2;
+
+  unsigned char *remote_id = (unsigned char *) "B\0";
+  size_t remote_id_len = 2;
+
+  if (NULL == ticket)
+  {
+    result = negotiate_client_session_key(socket_fd,
+                                          public_key_ctx,
+                                          private_key_ctx,
+                                          id, id_len,
+                                          remote_id, remote_id_len,
+                                          &session_key, &session_key_len);
+  }
+  else if (NULL != ticket->ticket && time(NULL) < ticket->expiry)
+  {
+    // a ticket that fails is dropped, so the next session gets a new one
+    result = resume_client_session_key(socket_fd, ticket,
+                                       &session_key, &session_key_len);
+    if (result)
+    {
+      free_session_ticket(ticket);
+    }
+  }
+  else
+  {
+    free_session_ticket(ticket);
+    result = negotiate_client_session_ticket(socket_fd,
+                                             public_key_ctx,
+                                             private_key_ctx,
+                                             id, id_len,
+                                             remote_id, remote_id_len,
+                                             &session_key, &session_key_len,
+                                             ticket);
+  }
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to negotiate the client session key.");
+    close(socket_fd);
+    return 1;
+  }
+
+  // Request key K from B; encrypt message with S
+  unsigned char *key_id = (unsigned char *) "1\0";
+  size_t key_id_len = 2;
+
+  unsigned char *retrieved_key = NULL;
+  size_t retrieved_key_len = 0;
+
+  result = retrieve_key_with_session_key(socket_fd,
+                                         session_key, session_key_len,
+                                         key_id, key_id_len,
+                                         &retrieved_key, &retrieved_key_len);
+  kmyth_clear_and_free(session_key, session_key_len);
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to retrieve key: %.*s", key_id_len, key_id);
+    close(socket_fd);
+    return 1;
+  }
+  kmyth_log(key_severity, "Received symmetric key: 0x%02X..%02X",
+            retrieved_key[0], retrieved_key[retrieved_key_len - 1]);
+
+  kmyth_clear_and_free(retrieved_key, retrieved_key_len);
+  close(socket_fd);
+
+  return 0;
+}
+
+// Shared state for the worker threads generating load
+typedef struct
+{
+  char *ip;
+  char *port;
+  EVP_PKEY_CTX *public_key_ctx;
+  EVP_PKEY_CTX *private_key_ctx;
+  size_t count;
+  size_t jobs;
+  bool resume;
+  atomic_size_t completed;
+} nsl_load_t;
+
+//
+// run_sessions()
+//
+static int run_sessions(size_t index, void *arg)
+{
+  nsl_load_t *load = (nsl_load_t *) arg;
+
+  // An EVP_PKEY_CTX must not be used by two threads at once, so each worker
+  // encrypts and decrypts with its own copies of the key contexts.
+  EVP_PKEY_CTX *public_key_ctx = EVP_PKEY_CTX_dup(load->public_key_ctx);
+  EVP_PKEY_CTX *private_key_ctx = EVP_PKEY_CTX_dup(load->private_key_ctx);
+
+  if (NULL == public_key_ctx || NULL == private_key_ctx)
+  {
+    kmyth_log(LOG_ERR, "Failed to copy the EVP contexts for worker %zu.",
+              index);
+    EVP_PKEY_CTX_free(public_key_ctx);
+    EVP_PKEY_CTX_free(private_key_ctx);
+    return 1;
+  }
+
+  // the sessions are shared out evenly between the workers
+  nsl_session_ticket ticket = { 0 };
+  int retval = 0;
+
+  for (size_t i = index; i < load->count; i += load->jobs)
+  {
+    if (run_session(load->ip, load->port, public_key_ctx, private_key_ctx,
+                    load->resume ? &ticket : NULL, LOG_DEBUG))
+    {
+      retval = 1;
+      continue;
+    }
+    atomic_fetch_add(&load->completed, 1);
+  }
+
+  free_session_ticket(&ticket);
+  EVP_PKEY_CTX_free(public_key_ctx);
+  EVP_PKEY_CTX_free(private_key_ctx);
+
+  return retval;
+}
+
+//
+// parse_count()
+//
+static int parse_count(const char *arg, unsigned long max,
+                       unsigned long *count)
+{
+  char *end = NULL;
+
+  errno = 0;
+  *count = strtoul(arg, &end, 10);
+  if (errno || *end != '\0' || *count == 0 || *count > max)
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
 int main(int argc, char **argv)
 {
   // Exit early if there are no arguments
@@ -185,12 +370,16 @@ int main(int argc, char **argv)
   char *ip = NULL;
   char *port = NULL;
   char *cert = NULL;
+  unsigned long count = 1;
+  unsigned long jobs = 1;
+  bool resume = false;
 
   int options;
   int option_index;
 
   while ((options =
-          getopt_long(argc, argv, "r:i:p:u:h", longopts, &option_index)) != -1)
+          getopt_long(argc, argv, "r:i:p:u:n:j:Rh", longopts,
+                      &option_index)) != -1)
   {
     switch (options)
     {
@@ -208,6 +397,25 @@ int main(int argc, char **argv)
     case 'u':
       cert = optarg;
       break;
+      // Load generation
+    case 'n':
+      if (parse_count(optarg, SIZE_MAX, &count))
+      {
+        kmyth_log(LOG_ERR, "Invalid number of sessions (%s).", optarg);
+        return 1;
+      }
+      break;
+    case 'j':
+      if (parse_count(optarg, KMYTH_MAX_JOBS, &jobs))
+      {
+        kmyth_log(LOG_ERR, "Invalid number of jobs (%s), must be 1 to %d.",
+                  optarg, KMYTH_MAX_JOBS);
+        return 1;
+      }
+      break;
+    case 'R':
+      resume = true;
+      break;
       // Misc
     case 'h':
       usage(argv[0]);
@@ -219,23 +427,12 @@ int main(int argc, char **argv)
 
   set_applog_severity_threshold(LOG_INFO);
 
-  // Create socket to B
-  int socket_fd = -1;
-  int result = setup_client_socket(ip, port, &socket_fd);
-
-  if (result)
-  {
-    kmyth_log(LOG_ERR, "Failed to setup socket.");
-    return 1;
-  }
-
   // Load public/private keys; create EVP contexts
   EVP_PKEY_CTX *public_key_ctx = setup_public_evp_context(cert);
 
   if (NULL == public_key_ctx)
   {
     kmyth_log(LOG_ERR, "Failed to setup public EVP context.");
-    close(socket_fd);
     return 1;
   }
   EVP_PKEY_CTX *private_key_ctx = setup_private_evp_context(key);
@@ -244,58 +441,47 @@ int main(int argc, char **argv)
   {
     kmyth_log(LOG_ERR, "Failed to setup the private EVP context.");
     EVP_PKEY_CTX_free(public_key_ctx);
-    close(socket_fd);
     return 1;
   }
 
-  // Conduct NSL to obtain a shared session key
-  unsigned char *session_key = NULL;
-  size_t session_key_len = 0;
+  int result = 0;
 
-  unsigned char *id = (unsigned char *) "A\0";
-  size_t id_len = 2;
-
-  unsigned char *remote_id = (unsigned char *) "B\0";
-  size_t remote_id_len = 2;
-
-  result = negotiate_client_session_key(socket_fd,
-                                        public_key_ctx,
-                                        private_key_ctx,
-                                        id, id_len,
-                                        remote_id, remote_id_len,
-                                        &session_key, &session_key_len);
-  if (result)
+  if (count == 1)
   {
-    kmyth_log(LOG_ERR, "Failed to negotiate the client session key.");
-    close(socket_fd);
-    return 1;
+    result = run_session(ip, port, public_key_ctx, private_key_ctx, NULL,
+                         LOG_INFO);
   }
-
-  EVP_PKEY_CTX_free(public_key_ctx);
-  EVP_PKEY_CTX_free(private_key_ctx);
-
-  // Request key K from B; encrypt message with S
-  unsigned char *key_id = (unsigned char *) "1\0";
-  size_t key_id_len = 2;
-
-  unsigned char *retrieved_key = NULL;
-  size_t retrieved_key_len = 0;
-
-  result = retrieve_key_with_session_key(socket_fd,
-                                         session_key, session_key_len,
-                                         key_id, key_id_len,
-                                         &retrieved_key, &retrieved_key_len);
-  if (result)
+  else
   {
-    kmyth_log(LOG_ERR, "Failed to retrieve key: %.*s", key_id_len, key_id);
-    close(socket_fd);
-    return 1;
+    // Generate load: run the sessions, jobs at a time, and report the rate
+    // at which they completed
+    nsl_load_t load = {
+      .ip = ip,
+      .port = port,
+      .public_key_ctx = public_key_ctx,
+      .private_key_ctx = private_key_ctx,
+      .count = (size_t) count,
+      .jobs = (jobs > count) ? (size_t) count : (size_t) jobs,
+      .resume = resume,
+    };
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    result = kmyth_parallel_for(load.jobs, load.jobs, run_sessions, &load);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (double) (end.tv_sec - start.tv_sec) +
+      (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+    size_t completed = atomic_load(&load.completed);
+
+    fprintf(stdout, "%zu of %zu sessions completed in %.3f s "
+            "(%.1f handshakes per second, %zu concurrent)\n",
+            completed, load.count, elapsed,
+            (elapsed > 0) ? (double) completed / elapsed : 0.0, load.jobs);
   }
-  kmyth_log(LOG_INFO, "Received symmetric key: 0x%02X..%02X",
-            retrieved_key[0], retrieved_key[retrieved_key_len - 1]);
 
-  kmyth_clear_and_free(retrieved_key, retrieved_key_len);
-  close(socket_fd);
+  EVP_PKEY_CTX_free(public_key_ctx);
+  EVP_PKEY_CTX_free(private_key_ctx);
 
-  return 0;
+  return result;
 }
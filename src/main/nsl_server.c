@@ -1,4 +1,8 @@
+#include <errno.h>
 #include <getopt.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -9,6 +13,7 @@
 #include "defines.h"
 #include "memory_util.h"
 #include "nsl_util.h"
+#include "parallel_util.h"
 #include "socket_util.h"
 #include "aes_gcm.h"
 #include "kmip_util.h"
@@ -19,11 +24,25 @@ static void usage(const char *prog)
           "\nusage: %s [options]\n\n"
           "options are :\n\n"
           "Server Information --\n"
-          "  -r or --priv  Path to the file containing the server's private key.\n"
+          "  -r or --priv  Path to the file containing the server's private key\n"
+          "                (RSA, or EC - P-256 or X25519 - for ECIES).\n"
           "  -p or --port  The port number to connect to.\n"
+          "  -w or --workers  Serve clients concurrently, with this many worker\n"
+          "                   threads (1 to %d), until stopped. By default, a\n"
+          "                   single client is served.\n"
+          "  -P or --prefork  Serve clients concurrently, with this many worker\n"
+          "                   processes (1 to %d) - each with -w threads, or\n"
+          "                   one - until stopped.\n"
+          "  -O or --sockopt  Tune the server socket (repeatable): nodelay,\n"
+          "                   keepalive=<idle>[,<interval>[,<count>]], reuseport,\n"
+          "                   fastopen[=<queue length>] or io-timeout=<ms>.\n"
+          "                   With reuseport (implied by -P), each worker listens\n"
+          "                   on a socket of its own, and the kernel spreads the\n"
+          "                   clients among them.\n"
           "Client Information --\n"
           "  -u or --pub  Path to the file containing the client's public key.\n"
-          "Misc --\n" "  -h or --help  Help (displays this usage).\n\n", prog);
+          "Misc --\n" "  -h or --help  Help (displays this usage).\n\n", prog,
+          KMYTH_MAX_JOBS, KMYTH_MAX_JOBS);
 }
 
 int check_string_arg(const char *arg, size_t arg_len,
@@ -40,6 +59,9 @@ const struct option longopts[] = {
   // Server info
   {"priv", required_argument, 0, 'r'},
   {"port", required_argument, 0, 'p'},
+  {"workers", required_argument, 0, 'w'},
+  {"prefork", required_argument, 0, 'P'},
+  {"sockopt", required_argument, 0, 'O'},
   // Client info
   {"pub", required_argument, 0, 'u'},
   // Misc
@@ -160,6 +182,181 @@ int send_key_with_session_key(int socket_fd,
   return 0;
 }
 
+//
+// serve_client()
+//
+static int serve_client(int socket_fd, EVP_PKEY_CTX * public_key_ctx,
+                        EVP_PKEY_CTX * private_key_ctx,
+                        unsigned char *ticket_key, size_t ticket_key_len)
+{
+  // Conduct NSL (or resume a session with a ticket) to obtain a shared
+  // session key
+  unsigned char *id = (unsigned char *) "B\0";
+  size_t id_len = 2;
+
+  unsigned char *session_key = NULL;
+  size_t session_key_len = 0;
+  bool resumed = false;
+
+  int result = accept_server_session_key(socket_fd,
+                                         public_key_ctx,
+                                         private_key_ctx,
+                                         id, id_len,
+                                         ticket_key, ticket_key_len,
+                                         NSL_TICKET_LIFETIME_DEFAULT,
+                                         &session_key, &session_key_len,
+                                         &resumed);
+
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to negotiate the server session key.");
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "Session %s.", resumed ? "resumed" : "negotiated");
+
+  // Send key K to A; encrypt message with S
+  uint8 static_key[16] = {
+    0xD3, 0x51, 0x91, 0x0F, 0x1D, 0x79, 0x34, 0xD6,
+    0xE2, 0xAE, 0x17, 0x57, 0x65, 0x64, 0xE2, 0xBC
+  };
+  kmyth_log(LOG_INFO, "Loaded symmetric key: 0x%02X..%02X", static_key[0],
+            static_key[15]);
+
+  result = send_key_with_session_key(socket_fd,
+                                     session_key, session_key_len,
+                                     static_key, 16);
+  kmyth_clear_and_free(session_key, session_key_len);
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to send the static key.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// open_listener()
+//
+static int open_listener(const char *port, const socket_options * sockopts,
+                         int backlog, int *listen_fd)
+{
+  if (setup_server_socket_opts(port, sockopts, listen_fd))
+  {
+    kmyth_log(LOG_ERR, "Failed to setup server socket.");
+    return 1;
+  }
+
+  if (listen(*listen_fd, backlog))
+  {
+    kmyth_log(LOG_ERR, "Socket listen failed.");
+    close(*listen_fd);
+    *listen_fd = -1;
+    return 1;
+  }
+
+  return 0;
+}
+
+// Shared state for the workers of the concurrent server (a listen_fd of -1
+// has each worker open a listening socket of its own, with SO_REUSEPORT)
+typedef struct
+{
+  int listen_fd;
+  const char *port;
+  const socket_options *sockopts;
+  size_t threads;
+  EVP_PKEY_CTX *public_key_ctx;
+  EVP_PKEY_CTX *private_key_ctx;
+  unsigned char *ticket_key;
+  size_t ticket_key_len;
+  atomic_ulong served;
+} nsl_server_t;
+
+//
+// serve_clients()
+//
+static int serve_clients(size_t index, void *arg)
+{
+  nsl_server_t *server = (nsl_server_t *) arg;
+
+  // An EVP_PKEY_CTX must not be used by two threads at once, so each worker
+  // encrypts and decrypts with its own copies of the key contexts.
+  EVP_PKEY_CTX *public_key_ctx = EVP_PKEY_CTX_dup(server->public_key_ctx);
+  EVP_PKEY_CTX *private_key_ctx = EVP_PKEY_CTX_dup(server->private_key_ctx);
+
+  if (NULL == public_key_ctx || NULL == private_key_ctx)
+  {
+    kmyth_log(LOG_ERR, "Failed to copy the EVP contexts for worker %zu.",
+              index);
+    EVP_PKEY_CTX_free(public_key_ctx);
+    EVP_PKEY_CTX_free(private_key_ctx);
+    return 1;
+  }
+
+  int listen_fd = server->listen_fd;
+
+  if (listen_fd == -1 &&
+      open_listener(server->port, server->sockopts, SOMAXCONN, &listen_fd))
+  {
+    EVP_PKEY_CTX_free(public_key_ctx);
+    EVP_PKEY_CTX_free(private_key_ctx);
+    return 1;
+  }
+
+  // Each client is served by whichever worker is free to accept it (on a
+  // shared listening socket), or the kernel handed it to (with one each)
+  // - a failed session only ends that client's connection.
+  for (;;)
+  {
+    int socket_fd = accept(listen_fd, NULL, NULL);
+
+    if (socket_fd == -1)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+      {
+        continue;
+      }
+      kmyth_log(LOG_ERR, "Socket accept failed.");
+      break;
+    }
+
+    if (serve_client(socket_fd, public_key_ctx, private_key_ctx,
+                     server->ticket_key, server->ticket_key_len))
+    {
+      kmyth_log(LOG_WARNING, "Worker %zu failed to serve a client.", index);
+    }
+    else
+    {
+      kmyth_log(LOG_DEBUG, "Served client %lu (worker %zu).",
+                atomic_fetch_add(&server->served, 1) + 1, index);
+    }
+    close(socket_fd);
+  }
+
+  if (listen_fd != server->listen_fd)
+  {
+    close(listen_fd);
+  }
+  EVP_PKEY_CTX_free(public_key_ctx);
+  EVP_PKEY_CTX_free(private_key_ctx);
+
+  return 1;
+}
+
+//
+// serve_process()
+//
+static int serve_process(size_t index, void *arg)
+{
+  nsl_server_t *server = (nsl_server_t *) arg;
+
+  kmyth_log(LOG_DEBUG, "Worker process %zu serving clients.", index);
+
+  return kmyth_parallel_for(server->threads, server->threads, serve_clients,
+                            server);
+}
+
 int main(int argc, char **argv)
 {
   // Exit early if there are no arguments.
@@ -172,12 +369,19 @@ int main(int argc, char **argv)
   char *key = NULL;
   char *port = NULL;
   char *cert = NULL;
+  unsigned long workers = 0;
+  unsigned long processes = 0;
+  char *end = NULL;
+  socket_options sockopts;
+
+  socket_options_init(&sockopts);
 
   int options;
   int option_index;
 
   while ((options =
-          getopt_long(argc, argv, "r:p:u:h", longopts, &option_index)) != -1)
+          getopt_long(argc, argv, "r:p:w:P:O:u:h", longopts,
+                      &option_index)) != -1)
   {
     switch (options)
     {
@@ -188,6 +392,33 @@ int main(int argc, char **argv)
     case 'p':
       port = optarg;
       break;
+    case 'w':
+      errno = 0;
+      workers = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || workers == 0 || workers > KMYTH_MAX_JOBS)
+      {
+        kmyth_log(LOG_ERR, "Invalid number of workers (%s), must be 1 to %d.",
+                  optarg, KMYTH_MAX_JOBS);
+        return 1;
+      }
+      break;
+    case 'P':
+      errno = 0;
+      processes = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || processes == 0 ||
+          processes > KMYTH_MAX_JOBS)
+      {
+        kmyth_log(LOG_ERR, "Invalid number of worker processes (%s), must be "
+                  "1 to %d.", optarg, KMYTH_MAX_JOBS);
+        return 1;
+      }
+      break;
+    case 'O':
+      if (parse_socket_option(optarg, &sockopts))
+      {
+        return 1;
+      }
+      break;
       // Client info
     case 'u':
       cert = optarg;
@@ -203,42 +434,12 @@ int main(int argc, char **argv)
 
   set_applog_severity_threshold(LOG_INFO);
 
-  // Create server socket
-  kmyth_log(LOG_INFO, "Setting up server socket");
-
-  int listen_fd = -1, socket_fd = -1;
-  int result = setup_server_socket(port, &listen_fd);
-
-  if (result)
-  {
-    kmyth_log(LOG_ERR, "Failed to setup server socket.");
-    return 1;
-  }
-
-  if (listen(listen_fd, 1))
-  {
-    kmyth_log(LOG_ERR, "Socket listen failed.");
-    close(listen_fd);
-    return 1;
-  }
-
-  socket_fd = accept(listen_fd, NULL, NULL);
-  if (socket_fd == -1)
-  {
-    kmyth_log(LOG_ERR, "Socket accept failed.");
-    close(listen_fd);
-    return 1;
-  }
-
-  close(listen_fd);
-
   // Load public/private keys; create EVP contexts
   EVP_PKEY_CTX *public_key_ctx = setup_public_evp_context(cert);
 
   if (NULL == public_key_ctx)
   {
     kmyth_log(LOG_ERR, "Failed to setup public EVP context.");
-    close(socket_fd);
     return 1;
   }
   EVP_PKEY_CTX *private_key_ctx = setup_private_evp_context(key);
@@ -247,52 +448,106 @@ int main(int argc, char **argv)
   {
     kmyth_log(LOG_ERR, "Failed to setup the private EVP context.");
     EVP_PKEY_CTX_free(public_key_ctx);
-    close(socket_fd);
     return 1;
   }
 
-  // Conduct NSL to obtain a shared session key
-  unsigned char *id = (unsigned char *) "B\0";
-  size_t id_len = 2;
+  // Clients may resume sessions with the tickets issued under this key
+  // (for as long as the server runs)
+  unsigned char *ticket_key = NULL;
+  size_t ticket_key_len = 0;
 
-  unsigned char *session_key = NULL;
-  size_t session_key_len = 0;
+  if (create_ticket_key(&ticket_key, &ticket_key_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to create the session ticket key.");
+    EVP_PKEY_CTX_free(public_key_ctx);
+    EVP_PKEY_CTX_free(private_key_ctx);
+    return 1;
+  }
 
-  result = negotiate_server_session_key(socket_fd,
-                                        public_key_ctx,
-                                        private_key_ctx,
-                                        id, id_len,
-                                        &session_key, &session_key_len);
+  int listen_fd = -1, socket_fd = -1;
+  int result = 0;
 
-  if (result)
+  // Worker processes each listen on a socket of their own - keeping the
+  // keys, and the ticket key (so a session resumes with any worker), they
+  // were forked with
+  if (processes > 0)
   {
-    kmyth_log(LOG_ERR, "Failed to negotiate the server session key.");
-    close(socket_fd);
-    return 1;
+    sockopts.reuseport = true;
   }
 
-  EVP_PKEY_CTX_free(public_key_ctx);
-  EVP_PKEY_CTX_free(private_key_ctx);
+  if (processes > 0 || workers > 0)
+  {
+    nsl_server_t server = {
+      .listen_fd = -1,
+      .port = port,
+      .sockopts = &sockopts,
+      .threads = (workers == 0) ? 1 : (size_t) workers,
+      .public_key_ctx = public_key_ctx,
+      .private_key_ctx = private_key_ctx,
+      .ticket_key = ticket_key,
+      .ticket_key_len = ticket_key_len,
+    };
+
+    // Threads share one listening socket (the connections accepted on it
+    // inherit its options), unless asked to bind one each
+    if (!sockopts.reuseport)
+    {
+      kmyth_log(LOG_INFO, "Setting up server socket");
+      result = open_listener(port, &sockopts, SOMAXCONN, &server.listen_fd);
+    }
 
-  // Send key K to A; encrypt message with S
-  uint8 static_key[16] = {
-    0xD3, 0x51, 0x91, 0x0F, 0x1D, 0x79, 0x34, 0xD6,
-    0xE2, 0xAE, 0x17, 0x57, 0x65, 0x64, 0xE2, 0xBC
-  };
-  kmyth_log(LOG_INFO, "Loaded symmetric key: 0x%02X..%02X", static_key[0],
-            static_key[15]);
+    if (result == 0 && processes > 0)
+    {
+      kmyth_log(LOG_INFO, "Serving clients with %lu worker processes of "
+                "%zu threads", processes, server.threads);
+      result = kmyth_prefork((size_t) processes, serve_process, &server);
+    }
+    else if (result == 0)
+    {
+      kmyth_log(LOG_INFO, "Serving clients with %lu workers", workers);
+      result = kmyth_parallel_for(server.threads, server.threads,
+                                  serve_clients, &server);
+    }
 
-  result = send_key_with_session_key(socket_fd,
-                                     session_key, session_key_len,
-                                     static_key, 16);
-  if (result)
+    if (server.listen_fd != -1)
+    {
+      close(server.listen_fd);
+    }
+    EVP_PKEY_CTX_free(public_key_ctx);
+    EVP_PKEY_CTX_free(private_key_ctx);
+    kmyth_clear_and_free(ticket_key, ticket_key_len);
+    return result;
+  }
+
+  // Create server socket (the connection accepted on it inherits its
+  // options)
+  kmyth_log(LOG_INFO, "Setting up server socket");
+  if (open_listener(port, &sockopts, 1, &listen_fd))
   {
-    kmyth_log(LOG_ERR, "Failed to send the static key.");
-    close(socket_fd);
+    EVP_PKEY_CTX_free(public_key_ctx);
+    EVP_PKEY_CTX_free(private_key_ctx);
+    kmyth_clear_and_free(ticket_key, ticket_key_len);
+    return 1;
+  }
+
+  socket_fd = accept(listen_fd, NULL, NULL);
+  close(listen_fd);
+  if (socket_fd == -1)
+  {
+    kmyth_log(LOG_ERR, "Socket accept failed.");
+    EVP_PKEY_CTX_free(public_key_ctx);
+    EVP_PKEY_CTX_free(private_key_ctx);
+    kmyth_clear_and_free(ticket_key, ticket_key_len);
     return 1;
   }
 
+  result = serve_client(socket_fd, public_key_ctx, private_key_ctx,
+                        ticket_key, ticket_key_len);
+
+  EVP_PKEY_CTX_free(public_key_ctx);
+  EVP_PKEY_CTX_free(private_key_ctx);
+  kmyth_clear_and_free(ticket_key, ticket_key_len);
   close(socket_fd);
 
-  return 0;
+  return result;
 }
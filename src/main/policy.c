@@ -0,0 +1,254 @@
+/**
+ * Kmyth Offline Policy Digest Interface - TPM 2.0 version
+ *
+ * Computes, without a TPM, the authorization policy digests that
+ * kmyth-seal would use for a list of (expected) PCR value sets.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "formatting_tools.h"
+#include "kmyth_log.h"
+#include "parallel_util.h"
+#include "pcrs.h"
+#include "tpm2_interface.h"
+
+/**
+ * @brief Default count of PCRs implemented by the TPM (the PC Client
+ *        platform requirement), which determines the size of the PCR
+ *        selection mask hashed into the policy
+ */
+#define KMYTH_POLICY_DEFAULT_PCR_COUNT 24
+
+/**
+ * @brief Length of a policy digest hex string, without NULL terminator
+ */
+#define KMYTH_POLICY_HEX_LEN (2 * KMYTH_DIGEST_SIZE)
+
+// Shared state for the parallel policy digest computation
+typedef struct
+{
+  char **lines;
+  size_t pcr_count;
+  char (*digests)[KMYTH_POLICY_HEX_LEN + 1];
+} policy_batch_t;
+
+//############################################################################
+// compute_batch_item()
+//############################################################################
+static int compute_batch_item(size_t index, void *arg)
+{
+  policy_batch_t *batch = (policy_batch_t *) arg;
+  TPML_PCR_SELECTION pcrList;
+  TPM2B_DIGEST pcrValues[TPM2_MAX_PCRS];
+  size_t pcrValues_len = 0;
+  TPM2B_DIGEST policyDigest;
+
+  if (parse_pcr_value_set(batch->lines[index], batch->pcr_count, &pcrList,
+                          pcrValues, &pcrValues_len))
+  {
+    kmyth_log(LOG_ERR, "invalid PCR value set (entry %zu)", index + 1);
+    return 1;
+  }
+
+  if (compute_policy_digest(pcrList, pcrValues, pcrValues_len, &policyDigest))
+  {
+    kmyth_log(LOG_ERR, "error computing policy digest (entry %zu)", index + 1);
+    return 1;
+  }
+
+  return convert_digest_to_string(&policyDigest, batch->digests[index]);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s -i <file> [options]\n\n"
+          "Computes the authorization policy digest kmyth-seal would use for each set of\n"
+          "PCR values in the input file, without a TPM. Each digest is written on its own\n"
+          "line, in input order, in the hex format accepted by kmyth-seal -e.\n\n"
+          "Each non-blank input line not starting with '#' is one PCR value set, written\n"
+          "as <PCR index>=<hex PCR value> fields separated by blanks or commas, e.g.:\n\n"
+          "    0=<64 hex digits>, 7=<64 hex digits>\n\n"
+          "options are: \n\n"
+          " -i or --input           Path to file containing the PCR value sets.\n"
+          " -o or --output          Destination path for the policy digests. Defaults to stdout.\n"
+          " -n or --pcr_count       Number of PCRs implemented by the target TPMs. Defaults to %d.\n"
+          " -j or --jobs            Number of workers computing digests. Defaults to the number of\n"
+          "                         online CPUs (at most %d).\n"
+          " -v or --verbose         Enable detailed logging.\n"
+          " -h or --help            Help (displays this usage).\n", prog,
+          KMYTH_POLICY_DEFAULT_PCR_COUNT, KMYTH_MAX_JOBS);
+}
+
+const struct option longopts[] = {
+  {"input", required_argument, 0, 'i'},
+  {"output", required_argument, 0, 'o'},
+  {"pcr_count", required_argument, 0, 'n'},
+  {"jobs", required_argument, 0, 'j'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+int main(int argc, char **argv)
+{
+  // If no command line arguments provided, provide usage help and exit early
+  if (argc == 1)
+  {
+    usage(argv[0]);
+    return 0;
+  }
+
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+  start_async_logging(0);
+
+  // Initialize parameters that might be modified by command line options
+  char *inPath = NULL;
+  char *outPath = NULL;
+  unsigned long pcrCount = KMYTH_POLICY_DEFAULT_PCR_COUNT;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned long jobs = (cpus < 1) ? 1 : (unsigned long) cpus;
+  char *end = NULL;
+
+  if (jobs > KMYTH_MAX_JOBS)
+  {
+    jobs = KMYTH_MAX_JOBS;
+  }
+
+  // Parse and apply command line options
+  int options;
+  int option_index;
+
+  while ((options =
+          getopt_long(argc, argv, "i:o:n:j:hv", longopts,
+                      &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 'i':
+      inPath = optarg;
+      break;
+    case 'o':
+      outPath = optarg;
+      break;
+    case 'n':
+      errno = 0;
+      pcrCount = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || pcrCount == 0 || pcrCount % 8 != 0 ||
+          pcrCount > TPM2_MAX_PCRS)
+      {
+        kmyth_log(LOG_ERR, "invalid PCR count (%s), must be a multiple of 8 "
+                  "up to %d ... exiting", optarg, TPM2_MAX_PCRS);
+        return 1;
+      }
+      break;
+    case 'j':
+      errno = 0;
+      jobs = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || jobs == 0 || jobs > KMYTH_MAX_JOBS)
+      {
+        kmyth_log(LOG_ERR, "invalid number of jobs (%s), must be 1 to %d "
+                  "... exiting", optarg, KMYTH_MAX_JOBS);
+        return 1;
+      }
+      break;
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  if (inPath == NULL)
+  {
+    kmyth_log(LOG_ERR, "no input (PCR value sets) specified ... exiting");
+    return 1;
+  }
+
+  policy_batch_t batch = {.pcr_count = (size_t) pcrCount, };
+  size_t count = 0;
+
+  if (read_path_list(inPath, &batch.lines, &count))
+  {
+    kmyth_log(LOG_ERR, "unable to read PCR value sets ... exiting");
+    return 1;
+  }
+  if (count == 0)
+  {
+    kmyth_log(LOG_ERR, "no PCR value sets in %s ... exiting", inPath);
+    return 1;
+  }
+
+  batch.digests = calloc(count, sizeof(*batch.digests));
+  if (batch.digests == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate policy digests ... exiting");
+    free_path_list(batch.lines, count);
+    return 1;
+  }
+
+  int retval = 1;
+
+  if (kmyth_parallel_for(count, (size_t) jobs, compute_batch_item, &batch))
+  {
+    kmyth_log(LOG_ERR, "error computing policy digests ... exiting");
+  }
+  else
+  {
+    FILE *out = (outPath == NULL) ? stdout : fopen(outPath, "w");
+
+    if (out == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to open output file %s ... exiting",
+                outPath);
+    }
+    else
+    {
+      retval = 0;
+      for (size_t i = 0; i < count && retval == 0; i++)
+      {
+        if (fprintf(out, "%s\n", batch.digests[i]) < 0)
+        {
+          retval = 1;
+        }
+      }
+      if ((out == stdout) ? fflush(out) : fclose(out))
+      {
+        retval = 1;
+      }
+      if (retval)
+      {
+        kmyth_log(LOG_ERR, "error writing policy digests ... exiting");
+      }
+      else
+      {
+        kmyth_log(LOG_DEBUG, "computed %zu policy digests", count);
+      }
+    }
+  }
+
+  free(batch.digests);
+  free_path_list(batch.lines, count);
+
+  return retval;
+}
@@ -5,17 +5,27 @@
 #include <getopt.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <malloc.h>
 
 #include "defines.h"
 #include "file_io.h"
+#include "file_loader.h"
+#include "formatting_tools.h"
 #include "kmyth.h"
 #include "kmyth_log.h"
 #include "memory_util.h"
+#include "parallel_util.h"
+#include "pcrs.h"
+#include "tpm2_interface.h"
 
 #include "cipher/cipher.h"
 
@@ -25,6 +35,16 @@
  */
 extern const cipher_t cipher_list[];
 
+/**
+ * @brief Default name of the --recursive journal (in the directory)
+ */
+#define RESEAL_JOURNAL_NAME ".kmyth-reseal.journal"
+
+/**
+ * @brief Default number of files re-sealed per --recursive batch
+ */
+#define RESEAL_BATCH_SIZE 256
+
 //############################################################################
 // parse_pcrs_string()
 //############################################################################
@@ -124,10 +144,458 @@ static int parse_pcrs_string(char *pcrs_string, int **pcrs, int *pcrs_len)
   return 0;
 }
 
+//############################################################################
+// predict_policy()
+//############################################################################
+static int predict_policy(char *predictPath, char *pcrsString,
+                          char *policy_string)
+{
+  char **lines = NULL;
+  size_t count = 0;
+
+  if (read_path_list(predictPath, &lines, &count))
+  {
+    kmyth_log(LOG_ERR, "unable to read expected PCR values ... exiting");
+    return 1;
+  }
+  if (count != 1)
+  {
+    kmyth_log(LOG_ERR, "%s must hold one set of expected PCR values (has "
+              "%zu) ... exiting", predictPath, count);
+    free_path_list(lines, count);
+    return 1;
+  }
+
+  int *pcrs = NULL;
+  int pcrs_len = 0;
+
+  if (parse_pcrs_string(pcrsString, &pcrs, &pcrs_len) != 0 || pcrs_len <= 0)
+  {
+    kmyth_log(LOG_ERR, "--predict needs the PCR selection (-p) the expected "
+              "values are for ... exiting");
+    free_path_list(lines, count);
+    free(pcrs);
+    return 1;
+  }
+
+  // The selection mask covers all of the TPM's PCRs, so its size is needed
+  // to compute the digest the TPM will reach after the update
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  TPML_PCR_SELECTION selection;
+  int pcrCount = 0;
+
+  if (init_tpm2_connection(&sapi_ctx) ||
+      init_pcr_selection(sapi_ctx, pcrs, (size_t) pcrs_len, &selection) ||
+      get_pcr_count(sapi_ctx, &pcrCount))
+  {
+    kmyth_log(LOG_ERR, "unable to set up the PCR selection ... exiting");
+    free_tpm2_resources(&sapi_ctx);
+    free_path_list(lines, count);
+    free(pcrs);
+    return 1;
+  }
+  free_tpm2_resources(&sapi_ctx);
+  free(pcrs);
+
+  TPML_PCR_SELECTION predicted;
+  TPM2B_DIGEST pcrValues[TPM2_MAX_PCRS];
+  size_t pcrValues_len = 0;
+  TPM2B_DIGEST policyDigest;
+  int retval = 1;
+
+  if (parse_pcr_value_set(lines[0], (size_t) pcrCount, &predicted,
+                          pcrValues, &pcrValues_len))
+  {
+    kmyth_log(LOG_ERR, "invalid expected PCR values ... exiting");
+  }
+  else if (memcmp(predicted.pcrSelections[0].pcrSelect,
+                  selection.pcrSelections[0].pcrSelect,
+                  selection.pcrSelections[0].sizeofSelect) != 0)
+  {
+    kmyth_log(LOG_ERR, "expected PCR values must be given for exactly the "
+              "-p PCRs ... exiting");
+  }
+  else if (compute_policy_digest(predicted, pcrValues, pcrValues_len,
+                                 &policyDigest) ||
+           convert_digest_to_string(&policyDigest, policy_string))
+  {
+    kmyth_log(LOG_ERR, "error computing expected policy digest ... exiting");
+  }
+  else
+  {
+    kmyth_log(LOG_DEBUG, "expected policy digest: %s", policy_string);
+    retval = 0;
+  }
+
+  free_path_list(lines, count);
+  return retval;
+}
+
+//############################################################################
+// rewrap_file()
+//############################################################################
+static int rewrap_file(char *inPath, uint8_t ** output, size_t *output_len,
+                       char *authString, size_t auth_string_len,
+                       char *ownerAuthPasswd, size_t oa_passwd_len,
+                       int *pcrs, size_t pcrs_len, char *expected_policy,
+                       uint8_t bool_policy_or)
+{
+  uint8_t *input = NULL;
+  size_t input_len = 0;
+  bool input_mapped = false;
+
+  if (map_bytes_from_file(inPath, &input, &input_len, &input_mapped))
+  {
+    kmyth_log(LOG_ERR, "error reading .ski file (%s) ... exiting", inPath);
+    return 1;
+  }
+
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx))
+  {
+    unmap_bytes_from_file(input, input_len, input_mapped);
+    return 1;
+  }
+
+  int retval = tpm2_kmyth_rewrap(ctx, input, input_len, output, output_len,
+                                 (uint8_t *) authString, auth_string_len,
+                                 (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                                 pcrs, pcrs_len, expected_policy,
+                                 bool_policy_or);
+
+  kmyth_ctx_destroy(&ctx);
+  unmap_bytes_from_file(input, input_len, input_mapped);
+
+  return retval;
+}
+
+// The .ski files found under a --recursive directory - nftw() passes its
+// callback no argument, so the list is built up here
+static char **tree_paths = NULL;
+static size_t tree_count = 0;
+static size_t tree_capacity = 0;
+
+//############################################################################
+// collect_ski_file()
+//############################################################################
+static int collect_ski_file(const char *path, const struct stat *st,
+                            int type, struct FTW *ftw)
+{
+  (void) ftw;
+
+  size_t path_len = strlen(path);
+  size_t ext_len = KMYTH_DEFAULT_SEAL_OUT_EXT_LEN + 1;
+
+  if (type != FTW_F || !S_ISREG(st->st_mode) || path_len <= ext_len ||
+      path[path_len - ext_len] != '.' ||
+      strcmp(path + path_len - KMYTH_DEFAULT_SEAL_OUT_EXT_LEN,
+             KMYTH_DEFAULT_SEAL_OUT_EXT) != 0)
+  {
+    return 0;
+  }
+
+  if (tree_count == tree_capacity)
+  {
+    size_t new_capacity = (tree_capacity == 0) ? 256 : 2 * tree_capacity;
+    char **new_paths = realloc(tree_paths, new_capacity * sizeof(char *));
+
+    if (new_paths == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate path list ... exiting");
+      return 1;
+    }
+    tree_paths = new_paths;
+    tree_capacity = new_capacity;
+  }
+
+  tree_paths[tree_count] = strdup(path);
+  if (tree_paths[tree_count] == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate path ... exiting");
+    return 1;
+  }
+  tree_count++;
+
+  return 0;
+}
+
+//############################################################################
+// compare_paths()
+//############################################################################
+static int compare_paths(const void *a, const void *b)
+{
+  return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+// The files of one batch of a tree reseal, shared with the workers writing
+// them (each of which only touches the files it is handed)
+typedef struct
+{
+  char **paths;
+  uint8_t **inputs;
+  size_t *input_lens;
+  uint8_t **outputs;
+  size_t *output_lens;
+  int *results;
+  kmyth_output_writer_t writer;
+} reseal_batch_files;
+
+//############################################################################
+// reseal_batch_write()
+//############################################################################
+static int reseal_batch_write(size_t i, void *arg)
+{
+  reseal_batch_files *files = (reseal_batch_files *) arg;
+
+  if (files->results[i] != 0)
+  {
+    kmyth_log(LOG_ERR, "kmyth-reseal error (%s)", files->paths[i]);
+    return 0;
+  }
+  if (kmyth_output_writer_stage(&files->writer, i, files->paths[i],
+                                files->outputs[i], files->output_lens[i]))
+  {
+    kmyth_log(LOG_ERR, "error writing data to .ski file (%s)",
+              files->paths[i]);
+    files->results[i] = 1;
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// reseal_batch()
+//############################################################################
+static int reseal_batch(kmyth_ctx_t * ctx, char **paths, size_t count,
+                        size_t jobs, bool syncOutput, int journal_fd,
+                        char *authString, size_t auth_string_len,
+                        char *ownerAuthPasswd, size_t oa_passwd_len,
+                        int *pcrs, size_t pcrs_len, char *expected_policy,
+                        uint8_t bool_policy_or, size_t *resealed)
+{
+  reseal_batch_files files = {
+    .paths = paths,
+    .inputs = calloc(count, sizeof(uint8_t *)),
+    .input_lens = calloc(count, sizeof(size_t)),
+    .outputs = calloc(count, sizeof(uint8_t *)),
+    .output_lens = calloc(count, sizeof(size_t)),
+    .results = calloc(count, sizeof(int))
+  };
+
+  *resealed = 0;
+  if (files.inputs == NULL || files.input_lens == NULL ||
+      files.outputs == NULL || files.output_lens == NULL ||
+      files.results == NULL ||
+      kmyth_output_writer_init(&files.writer, count, syncOutput))
+  {
+    kmyth_log(LOG_ERR, "unable to allocate memory for batch ... exiting");
+    free(files.inputs);
+    free(files.input_lens);
+    free(files.outputs);
+    free(files.output_lens);
+    free(files.results);
+    return 1;
+  }
+
+  // a file that can not be read fails (in tpm2_kmyth_rewrap_batch()) on
+  // its own, without holding up the rest of the batch
+  int retval = kmyth_load_files(paths, count, 0, files.inputs,
+                                files.input_lens, files.results);
+
+  if (tpm2_kmyth_rewrap_batch(ctx, count, files.inputs, files.input_lens,
+                              files.outputs, files.output_lens,
+                              files.results,
+                              (uint8_t *) authString, auth_string_len,
+                              (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                              pcrs, pcrs_len, expected_policy,
+                              bool_policy_or))
+  {
+    retval = 1;
+  }
+
+  // replace the re-sealed files together, and only then record them as
+  // done, so that an interrupted run never skips a file it did not write
+  if (kmyth_parallel_for(count, jobs, reseal_batch_write, &files))
+  {
+    retval = 1;
+  }
+  if (kmyth_output_writer_commit(&files.writer))
+  {
+    kmyth_log(LOG_ERR, "error replacing re-sealed .ski files ... exiting");
+    retval = 1;
+  }
+  else
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      if (files.results[i] != 0)
+      {
+        continue;
+      }
+      if (dprintf(journal_fd, "%s\n", paths[i]) < 0)
+      {
+        kmyth_log(LOG_ERR, "error writing reseal journal ... exiting");
+        retval = 1;
+        break;
+      }
+      (*resealed)++;
+    }
+    if (syncOutput && fdatasync(journal_fd))
+    {
+      kmyth_log(LOG_ERR, "error syncing reseal journal ... exiting");
+      retval = 1;
+    }
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    free(files.inputs[i]);
+    free(files.outputs[i]);
+  }
+  free(files.inputs);
+  free(files.input_lens);
+  free(files.outputs);
+  free(files.output_lens);
+  free(files.results);
+  kmyth_output_writer_free(&files.writer);
+
+  return retval;
+}
+
+//############################################################################
+// reseal_tree()
+//############################################################################
+static int reseal_tree(char *dir, char *journalPath, size_t batchSize,
+                       size_t jobs, bool syncOutput,
+                       char *authString, size_t auth_string_len,
+                       char *ownerAuthPasswd, size_t oa_passwd_len,
+                       int *pcrs, size_t pcrs_len, char *expected_policy,
+                       uint8_t bool_policy_or)
+{
+  // find every .ski file under dir (without following symbolic links), in
+  // path order, so that files of the same directory are batched together
+  if (nftw(dir, collect_ski_file, 32, FTW_PHYS) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to search directory (%s) ... exiting", dir);
+    free_path_list(tree_paths, tree_count);
+    return 1;
+  }
+  if (tree_count > 0)
+  {
+    qsort(tree_paths, tree_count, sizeof(char *), compare_paths);
+  }
+
+  // skip the files already re-sealed by an earlier, interrupted, run
+  char **done = NULL;
+  size_t done_count = 0;
+  struct stat st = { 0 };
+
+  if (stat(journalPath, &st) == 0 && st.st_size > 0)
+  {
+    if (read_path_list(journalPath, &done, &done_count))
+    {
+      kmyth_log(LOG_ERR, "unable to read reseal journal (%s) ... exiting",
+                journalPath);
+      free_path_list(tree_paths, tree_count);
+      return 1;
+    }
+    if (done_count > 0)
+    {
+      qsort(done, done_count, sizeof(char *), compare_paths);
+    }
+  }
+
+  size_t todo_count = 0;
+
+  for (size_t i = 0; i < tree_count; i++)
+  {
+    if (done_count > 0 &&
+        bsearch(&tree_paths[i], done, done_count, sizeof(char *),
+                compare_paths) != NULL)
+    {
+      free(tree_paths[i]);
+      continue;
+    }
+    tree_paths[todo_count++] = tree_paths[i];
+  }
+  free_path_list(done, done_count);
+
+  size_t total = tree_count;
+
+  fprintf(stderr, "kmyth-reseal: %zu .ski files found, %zu already "
+          "re-sealed\n", total, total - todo_count);
+
+  int journal_fd = open(journalPath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                        0600);
+
+  if (journal_fd < 0)
+  {
+    kmyth_log(LOG_ERR, "unable to open reseal journal (%s) ... exiting",
+              journalPath);
+    free_path_list(tree_paths, todo_count);
+    return 1;
+  }
+
+  kmyth_ctx_t *ctx = NULL;
+  int retval = 0;
+
+  if (kmyth_ctx_create(&ctx) || kmyth_ctx_set_jobs(ctx, jobs))
+  {
+    kmyth_log(LOG_ERR, "unable to create kmyth context ... exiting");
+    retval = 1;
+  }
+
+  size_t resealed = total - todo_count;
+  size_t failed = 0;
+
+  for (size_t start = 0; retval == 0 && start < todo_count;
+       start += batchSize)
+  {
+    size_t count = todo_count - start;
+    size_t batch_resealed = 0;
+
+    if (count > batchSize)
+    {
+      count = batchSize;
+    }
+
+    // a failed file is left for a later run, so carry on with the rest
+    reseal_batch(ctx, tree_paths + start, count, jobs, syncOutput, journal_fd,
+                 authString, auth_string_len, ownerAuthPasswd, oa_passwd_len,
+                 pcrs, pcrs_len, expected_policy, bool_policy_or,
+                 &batch_resealed);
+    resealed += batch_resealed;
+    failed += count - batch_resealed;
+    fprintf(stderr, "kmyth-reseal: %zu/%zu re-sealed, %zu failed\n",
+            resealed, total, failed);
+  }
+
+  kmyth_ctx_destroy(&ctx);
+  close(journal_fd);
+  free_path_list(tree_paths, todo_count);
+
+  if (retval == 0 && failed > 0)
+  {
+    kmyth_log(LOG_ERR, "%zu .ski files not re-sealed - run again to retry "
+              "them (journal: %s)", failed, journalPath);
+    retval = 1;
+  }
+  else if (retval == 0)
+  {
+    // the tree is done, so a later reseal starts afresh
+    unlink(journalPath);
+  }
+
+  return retval;
+}
+
 static void usage(const char *prog)
 {
   fprintf(stdout,
-          "\nusage: %s [options] \n\n"
+          "\nusage: %s [options] \n"
+          "       %s --recursive <dir> [options]\n\n"
           "options are: \n\n"
           " -a or --auth_string     String used to create 'authVal' digest. Defaults to empty string (all-zero digest).\n"
           " -i or --input           Path to file containing the data to be sealed.\n"
@@ -139,9 +607,26 @@ static void usage(const char *prog)
           " -e or --expected_policy Specifies an alternative digest value that can satisfy the authorization policy. \n"
           " -l or --list_ciphers    Lists all valid ciphers and exits.\n"
           " -w or --owner_auth      TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n"
+          " -r or --rewrap          Re-seal the .ski file given by -i under the -p PCR selection (and -e policy), only\n"
+          "                         unsealing and re-sealing its wrapping key. The encrypted data is copied as it is,\n"
+          "                         so the cipher (-c) can not be changed.\n"
+          " -P or --policy_or       With --rewrap, the input .ski was sealed using a compound \"policy or\".\n"
+          " -x or --predict         With --rewrap or --recursive, re-seal under a \"policy or\" of the current -p PCR\n"
+          "                         values and the expected ones in this file (e.g., after a planned kernel or\n"
+          "                         firmware update), as one <PCR index>=<hex PCR value> set (see kmyth-policy), in\n"
+          "                         place of -e. The data then unseals both before and after the update.\n"
+          " -R or --recursive       Re-seal (as for --rewrap) every .ski file under this directory, in place. The\n"
+          "                         policy and storage key are set up once per batch of files, and the files\n"
+          "                         are read, parsed and written by -j workers. Files re-sealed are recorded in\n"
+          "                         a journal, so that an interrupted run can be resumed by running it again.\n"
+          " -J or --journal         With --recursive, the journal file. Defaults to <dir>/%s.\n"
+          " -j or --jobs            With --recursive, number of workers (1 to %d). Defaults to 1.\n"
+          " -n or --batch_size      With --recursive, number of files re-sealed per batch. Defaults to %d.\n"
+          " -Y or --sync            Make the .ski output durable (fsync) before exiting.\n"
           " -v or --verbose         Enable detailed logging.\n"
           " -h or --help            Help (displays this usage).\n", prog,
-          cipher_list[0].cipher_name);
+          prog, cipher_list[0].cipher_name, RESEAL_JOURNAL_NAME,
+          KMYTH_MAX_JOBS, RESEAL_BATCH_SIZE);
 }
 
 static void list_ciphers(void)
@@ -162,7 +647,7 @@ static void list_ciphers(void)
           "using a 256-bit key.\n");
 }
 
-const struct option longopts[] = {
+static const struct option longopts[] = {
   {"auth_string", required_argument, 0, 'a'},
   {"input", required_argument, 0, 'i'},
   {"output", required_argument, 0, 'o'},
@@ -174,6 +659,14 @@ const struct option longopts[] = {
   {"verbose", no_argument, 0, 'v'},
   {"help", no_argument, 0, 'h'},
   {"list_ciphers", no_argument, 0, 'l'},
+  {"rewrap", no_argument, 0, 'r'},
+  {"policy_or", no_argument, 0, 'P'},
+  {"predict", required_argument, 0, 'x'},
+  {"sync", no_argument, 0, 'Y'},
+  {"recursive", required_argument, 0, 'R'},
+  {"journal", required_argument, 0, 'J'},
+  {"jobs", required_argument, 0, 'j'},
+  {"batch_size", required_argument, 0, 'n'},
   {0, 0, 0, 0}
 };
 
@@ -190,6 +683,10 @@ int main(int argc, char **argv)
   set_app_name(KMYTH_APP_NAME);
   set_app_version(KMYTH_VERSION);
   set_applog_path(KMYTH_APPLOG_PATH);
+  start_async_logging(0);
+
+  // add this run's metrics to the KMYTH_METRICS_FILE textfile (if set)
+  kmyth_metrics_export_at_exit();
 
   // Initialize parameters that might be modified by command line options
   char *inPath = NULL;
@@ -201,14 +698,24 @@ int main(int argc, char **argv)
   char *cipherString = NULL;
   bool forceOverwrite = false;
   char *expected_policy = NULL;
+  char *predictPath = NULL;
+  char predicted_policy[2 * sizeof(TPM2B_DIGEST) + 1];
   uint8_t bool_trial_only = 1; // reseal forces this
+  bool rewrap = false;
+  uint8_t bool_policy_or = 0;
+  bool syncOutput = false;
+  char *treeDir = NULL;
+  char *journalPath = NULL;
+  unsigned long jobs = 1;
+  unsigned long batchSize = RESEAL_BATCH_SIZE;
+  char *end = NULL;
 
   // Parse and apply command line options
   int options;
   int option_index;
 
   while ((options =
-          getopt_long(argc, argv, "a:e:i:o:c:p:w:fhlv", longopts,
+          getopt_long(argc, argv, "a:e:i:o:c:p:w:x:J:R:j:n:fhlrvPY", longopts,
                       &option_index)) != -1)
   {
     switch (options)
@@ -248,6 +755,45 @@ int main(int argc, char **argv)
     case 'w':
       ownerAuthPasswd = optarg;
       break;
+    case 'r':
+      rewrap = true;
+      break;
+    case 'P':
+      bool_policy_or = 1;
+      break;
+    case 'x':
+      predictPath = optarg;
+      break;
+    case 'Y':
+      syncOutput = true;
+      break;
+    case 'R':
+      treeDir = optarg;
+      break;
+    case 'J':
+      journalPath = optarg;
+      break;
+    case 'j':
+      errno = 0;
+      jobs = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || jobs == 0 || jobs > KMYTH_MAX_JOBS)
+      {
+        kmyth_log(LOG_ERR, "invalid number of jobs (%s), must be 1 to %d "
+                  "... exiting", optarg, KMYTH_MAX_JOBS);
+        free(outPath);
+        return 1;
+      }
+      break;
+    case 'n':
+      errno = 0;
+      batchSize = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || batchSize == 0)
+      {
+        kmyth_log(LOG_ERR, "invalid batch size (%s) ... exiting", optarg);
+        free(outPath);
+        return 1;
+      }
+      break;
     case 'v':
       // always display all log messages (severity threshold = LOG_DEBUG)
       // to stdout or stderr (output mode = 0)
@@ -270,6 +816,82 @@ int main(int argc, char **argv)
   size_t oa_passwd_len =
     (ownerAuthPasswd == NULL) ? 0 : strlen(ownerAuthPasswd);
 
+  // The expected policy can be computed from the PCR values expected after
+  // an update, so that the re-sealed data unseals on either side of it
+  if (predictPath != NULL)
+  {
+    int predicted = 1;
+
+    if (expected_policy != NULL || (!rewrap && treeDir == NULL))
+    {
+      kmyth_log(LOG_ERR, "--predict re-seals (with --rewrap or --recursive), "
+                "in place of -e ... exiting");
+    }
+    else
+    {
+      predicted = predict_policy(predictPath, pcrsString, predicted_policy);
+    }
+    if (predicted)
+    {
+      kmyth_clear(authString, auth_string_len);
+      kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+      free(outPath);
+      return 1;
+    }
+    expected_policy = predicted_policy;
+  }
+
+  // A tree reseal rewraps each .ski file found in place
+  if (treeDir != NULL)
+  {
+    int *pcrs = NULL;
+    int pcrs_len = 0;
+    char *defaultJournal = NULL;
+    int retval = 1;
+
+    if (inPath != NULL || outPath != NULL)
+    {
+      kmyth_log(LOG_ERR, "--recursive re-seals files in place, without -i "
+                "or -o ... exiting");
+    }
+    else if (parse_pcrs_string(pcrsString, &pcrs, &pcrs_len) != 0 ||
+             pcrs_len < 0)
+    {
+      kmyth_log(LOG_ERR, "failed to parse PCR string %s ... exiting",
+                pcrsString);
+    }
+    else if (journalPath == NULL &&
+             asprintf(&defaultJournal, "%s/%s", treeDir,
+                      RESEAL_JOURNAL_NAME) < 0)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate journal path ... exiting");
+      defaultJournal = NULL;
+    }
+    else
+    {
+      if (cipherString != NULL)
+      {
+        kmyth_log(LOG_WARNING, "cipher (%s) ignored - rewrap keeps the "
+                  "original", cipherString);
+      }
+      retval = reseal_tree(treeDir,
+                           (journalPath != NULL) ? journalPath :
+                           defaultJournal, (size_t) batchSize,
+                           (size_t) jobs, syncOutput,
+                           authString, auth_string_len,
+                           ownerAuthPasswd, oa_passwd_len,
+                           pcrs, (size_t) pcrs_len, expected_policy,
+                           bool_policy_or);
+    }
+
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(defaultJournal);
+    free(pcrs);
+    free(outPath);
+    return retval;
+  }
+
   // Check that input path (file to be sealed) was specified
   if (inPath == NULL)
   {
@@ -369,12 +991,33 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  // Call top-level "kmyth-reseal" function
-  if (tpm2_kmyth_seal_file(inPath, &output, &output_length,
-                           (uint8_t *) authString, auth_string_len,
-                           (uint8_t *) ownerAuthPasswd, oa_passwd_len,
-                           pcrs, (size_t)pcrs_len, cipherString, expected_policy,
-                           bool_trial_only))
+  if (rewrap && cipherString != NULL)
+  {
+    kmyth_log(LOG_WARNING, "cipher (%s) ignored - rewrap keeps the original",
+              cipherString);
+  }
+
+  // Call top-level "kmyth-reseal" function - a rewrap re-seals an
+  // existing .ski, otherwise only the policy digest is computed
+  int retval = 0;
+
+  if (rewrap)
+  {
+    retval = rewrap_file(inPath, &output, &output_length,
+                         authString, auth_string_len,
+                         ownerAuthPasswd, oa_passwd_len,
+                         pcrs, (size_t) pcrs_len, expected_policy,
+                         bool_policy_or);
+  }
+  else
+  {
+    retval = tpm2_kmyth_seal_file(inPath, &output, &output_length,
+                                  (uint8_t *) authString, auth_string_len,
+                                  (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                                  pcrs, (size_t)pcrs_len, cipherString,
+                                  expected_policy, bool_trial_only);
+  }
+  if (retval)
   {
     kmyth_log(LOG_ERR, "kmyth-reseal error ... exiting");
     kmyth_clear(authString, auth_string_len);
@@ -388,7 +1031,7 @@ int main(int argc, char **argv)
   kmyth_clear(authString, auth_string_len);
   kmyth_clear(ownerAuthPasswd, oa_passwd_len);
 
-  if (write_bytes_to_file(outPath, output, output_length))
+  if (write_bytes_to_file_atomic(outPath, output, output_length, syncOutput))
   {
     kmyth_log(LOG_ERR, "error writing data to .ski file ... exiting");
     free(outPath);
@@ -8,15 +8,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
 #include "defines.h"
 #include "file_io.h"
+#include "file_loader.h"
 #include "kmyth.h"
 #include "kmyth_log.h"
 #include "memory_util.h"
+#include "parallel_util.h"
 
 #include "cipher/cipher.h"
+#include "cipher/compression.h"
 
 /**
  * @brief The external list of valid (implemented and configured) symmetric
@@ -123,25 +129,395 @@ static int parse_pcrs_string(char *pcrs_string, int **pcrs, int *pcrs_len)
   return 0;
 }
 
+//############################################################################
+// get_default_output_path()
+//############################################################################
+static int get_default_output_path(char *inPath, char *outDir,
+                                   bool forceOverwrite, char **outPath)
+{
+  // create buffer to hold default filename derived from input filename
+  char default_fn[KMYTH_MAX_DEFAULT_FILENAME_LEN + 1];
+  memset(default_fn, '\0', sizeof(default_fn));
+
+  // Initialize default filename to basename() of input path, truncating if
+  // necessary. The maximum size of this "root" value is the must allow space
+  // to add a '.' delimiter (1 byte) and the default extension
+  // (KMYTH_DEFAULT_SEAL_OUT_EXT_LEN bytes).
+  size_t max_root_len = KMYTH_MAX_DEFAULT_FILENAME_LEN;
+  max_root_len -= KMYTH_DEFAULT_SEAL_OUT_EXT_LEN + 1;
+  strncpy(default_fn, basename(inPath), max_root_len);
+
+  // remove any leading '.'s
+  while (*default_fn == '.')
+  {
+    memmove(default_fn, default_fn + 1, sizeof(default_fn) - 1);
+  }
+
+  // ensure that this intermediate result is not an empty string
+  if (strlen(default_fn) == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid/empty default filename root ... exiting");
+    return 1;
+  }
+
+  // everything beyond first non-leading '.' is treated as extension
+  char *ext_ptr = strstr(default_fn, ".");
+  if (ext_ptr == NULL)
+  {
+    // no filename extension found - just add trailing '.'
+    strncat(default_fn, ".", 1);
+  }
+  else
+  {
+    // input fileame extension delimiter found, null everything after it
+    // The type conversion here is safe assuming inPath is not too pathological,
+    // so that's something we should think about.
+    ptrdiff_t filename_portion = ext_ptr - default_fn;
+    size_t tail_length = sizeof(default_fn) - (size_t)filename_portion;
+    memset(ext_ptr + 1, '\0', tail_length - 1);
+  }
+
+  // concatenate default filename root and extension
+  strncat(default_fn, KMYTH_DEFAULT_SEAL_OUT_EXT,
+                      KMYTH_DEFAULT_SEAL_OUT_EXT_LEN);
+
+  // The default filename goes in outDir, if specified, otherwise in
+  // the directory that the application is being run from
+  size_t outPath_size = strlen(default_fn) + 1;
+  if (outDir != NULL)
+  {
+    outPath_size += strlen(outDir) + 1;
+  }
+  *outPath = malloc(outPath_size * sizeof(char));
+  if (*outPath == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate output path ... exiting");
+    return 1;
+  }
+  if (outDir != NULL)
+  {
+    snprintf(*outPath, outPath_size, "%s/%s", outDir, default_fn);
+  }
+  else
+  {
+    snprintf(*outPath, outPath_size, "%s", default_fn);
+  }
+
+  // Make sure default filename we constructed doesn't already exist
+  struct stat st = { 0 };
+  if (!stat(*outPath, &st) && !forceOverwrite)
+  {
+    kmyth_log(LOG_ERR,
+              "default output filename (%s) already exists ... exiting",
+              *outPath);
+    free(*outPath);
+    *outPath = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+// The files of a batch, shared with the workers reading and writing them
+// (each of which only touches the files it is handed)
+typedef struct
+{
+  char **inPaths;
+  char *outDir;
+  bool forceOverwrite;
+  uint8_t **inputs;
+  size_t *input_lens;
+  char **outPaths;
+  uint8_t **outputs;
+  size_t *output_lens;
+  int *results;
+  kmyth_output_writer_t writer;
+} seal_batch_files;
+
+//############################################################################
+// seal_batch_paths()
+//############################################################################
+static int seal_batch_paths(size_t i, void *arg)
+{
+  seal_batch_files *files = (seal_batch_files *) arg;
+
+  if (verifyInputFilePath(files->inPaths[i]) ||
+      get_default_output_path(files->inPaths[i], files->outDir,
+                              files->forceOverwrite, &files->outPaths[i]))
+  {
+    kmyth_log(LOG_ERR, "invalid batch input (%s) ... exiting",
+              files->inPaths[i]);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// seal_batch_write()
+//############################################################################
+static int seal_batch_write(size_t i, void *arg)
+{
+  seal_batch_files *files = (seal_batch_files *) arg;
+
+  if (files->results[i] != 0)
+  {
+    kmyth_log(LOG_ERR, "kmyth-seal error (%s)", files->inPaths[i]);
+    return 0;
+  }
+  if (kmyth_output_writer_stage(&files->writer, i, files->outPaths[i],
+                                files->outputs[i], files->output_lens[i]))
+  {
+    kmyth_log(LOG_ERR, "error writing data to .ski file (%s)",
+              files->outPaths[i]);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "sealed %s to %s", files->inPaths[i],
+            files->outPaths[i]);
+
+  return 0;
+}
+
+//############################################################################
+// seal_batch()
+//############################################################################
+static int seal_batch(char **inPaths, size_t count, char *outDir,
+                      bool forceOverwrite, int skiFormat, int skAlg,
+                      uint32_t skHandle, bool recordSrk, size_t jobs,
+                      char *compression, bool syncOutput,
+                      uint8_t * auth_bytes, size_t auth_bytes_len,
+                      uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                      int *pcrs, size_t pcrs_len, char *cipherString,
+                      char *expected_policy, kmyth_timings_t * timings)
+{
+  seal_batch_files files = {
+    .inPaths = inPaths,
+    .outDir = outDir,
+    .forceOverwrite = forceOverwrite,
+    .inputs = calloc(count, sizeof(uint8_t *)),
+    .input_lens = calloc(count, sizeof(size_t)),
+    .outPaths = calloc(count, sizeof(char *)),
+    .outputs = calloc(count, sizeof(uint8_t *)),
+    .output_lens = calloc(count, sizeof(size_t)),
+    .results = calloc(count, sizeof(int))
+  };
+
+  if (files.inputs == NULL || files.input_lens == NULL ||
+      files.outputs == NULL || files.output_lens == NULL ||
+      files.results == NULL || files.outPaths == NULL ||
+      kmyth_output_writer_init(&files.writer, count, syncOutput))
+  {
+    kmyth_log(LOG_ERR, "unable to allocate memory for batch ... exiting");
+    free(files.inputs);
+    free(files.input_lens);
+    free(files.outputs);
+    free(files.output_lens);
+    free(files.results);
+    free(files.outPaths);
+    kmyth_output_writer_free(&files.writer);
+    return 1;
+  }
+
+  int retval = 0;
+
+  // Work out all of the output paths (using all of the workers), and then
+  // read all of the inputs together, before doing any TPM work, so that a
+  // bad path is caught up front - the batch shares one storage key, so the
+  // reads cannot overlap with the sealing
+  if (kmyth_parallel_for(count, jobs, seal_batch_paths, &files) ||
+      kmyth_load_files(inPaths, count, 0, files.inputs, files.input_lens,
+                       files.results))
+  {
+    retval = 1;
+  }
+
+  kmyth_ctx_t *ctx = NULL;
+
+  if (retval == 0 && (kmyth_ctx_create(&ctx) ||
+                      kmyth_ctx_set_ski_format(ctx, skiFormat) ||
+                      kmyth_ctx_set_sk_alg(ctx, skAlg) ||
+                      kmyth_ctx_set_persistent_sk(ctx, skHandle) ||
+                      kmyth_ctx_set_record_srk(ctx, recordSrk) ||
+                      kmyth_ctx_set_jobs(ctx, jobs) ||
+                      kmyth_ctx_set_compression(ctx, compression) ||
+                      (timings != NULL &&
+                       kmyth_ctx_set_timings(ctx, timings))))
+  {
+    kmyth_log(LOG_ERR, "unable to create kmyth context ... exiting");
+    retval = 1;
+  }
+
+  if (retval == 0)
+  {
+    if (tpm2_kmyth_seal_batch(ctx, count, files.inputs, files.input_lens,
+                              files.outputs, files.output_lens, files.results,
+                              auth_bytes, auth_bytes_len,
+                              owner_auth_bytes, oa_bytes_len,
+                              pcrs, pcrs_len, cipherString, expected_policy))
+    {
+      retval = 1;
+    }
+
+    // write out whatever was sealed, reporting each failure - the .ski
+    // files all appear (and, with syncOutput, are made durable) together
+    if (kmyth_parallel_for(count, jobs, seal_batch_write, &files))
+    {
+      retval = 1;
+    }
+    if (kmyth_output_writer_commit(&files.writer))
+    {
+      retval = 1;
+    }
+  }
+
+  kmyth_ctx_destroy(&ctx);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (files.inputs[i] != NULL)
+    {
+      kmyth_clear_and_free(files.inputs[i], files.input_lens[i]);
+    }
+    free(files.outputs[i]);
+    free(files.outPaths[i]);
+  }
+  free(files.inputs);
+  free(files.input_lens);
+  free(files.outputs);
+  free(files.output_lens);
+  free(files.results);
+  free(files.outPaths);
+  kmyth_output_writer_free(&files.writer);
+
+  return retval;
+}
+
+//############################################################################
+// seal_stream()
+//############################################################################
+static int seal_stream(char *inPath, char *outPath, int skAlg,
+                       uint32_t skHandle, bool recordSrk, char *compression,
+                       bool syncOutput,
+                       uint8_t * auth_bytes, size_t auth_bytes_len,
+                       uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                       int *pcrs, size_t pcrs_len, char *cipherString,
+                       char *expected_policy, kmyth_timings_t * timings)
+{
+  if (verifyInputFilePath(inPath))
+  {
+    kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting", inPath);
+    return 1;
+  }
+
+  int in_fd = open(inPath, O_RDONLY);
+
+  if (in_fd < 0)
+  {
+    kmyth_log(LOG_ERR, "unable to open file: %s ... exiting", inPath);
+    return 1;
+  }
+
+  int out_fd = open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+  if (out_fd < 0)
+  {
+    kmyth_log(LOG_ERR, "unable to open file: %s ... exiting", outPath);
+    close(in_fd);
+    return 1;
+  }
+
+  int retval = 1;
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx) == 0 &&
+      kmyth_ctx_set_sk_alg(ctx, skAlg) == 0 &&
+      kmyth_ctx_set_persistent_sk(ctx, skHandle) == 0 &&
+      kmyth_ctx_set_record_srk(ctx, recordSrk) == 0 &&
+      kmyth_ctx_set_compression(ctx, compression) == 0 &&
+      (timings == NULL || kmyth_ctx_set_timings(ctx, timings) == 0))
+  {
+    retval = tpm2_kmyth_seal_stream(ctx, in_fd, out_fd,
+                                    auth_bytes, auth_bytes_len,
+                                    owner_auth_bytes, oa_bytes_len,
+                                    pcrs, pcrs_len, cipherString,
+                                    expected_policy);
+  }
+  kmyth_ctx_destroy(&ctx);
+
+  close(in_fd);
+  if (retval == 0 && syncOutput && fsync(out_fd))
+  {
+    kmyth_log(LOG_ERR, "unable to sync %s ... exiting", outPath);
+    retval = 1;
+  }
+  if (close(out_fd))
+  {
+    retval = 1;
+  }
+
+  // don't leave an incomplete .ski file behind
+  if (retval)
+  {
+    unlink(outPath);
+  }
+
+  return retval;
+}
+
 static void usage(const char *prog)
 {
   fprintf(stdout,
-          "\nusage: %s [options] \n\n"
+          "\nusage: %s [options] \n"
+          "       %s --batch [options] <file> [<file> ...]\n"
+          "       %s --manifest <list> [options] [<file> ...]\n\n"
           "options are: \n\n"
           " -a or --auth_string     String used to create 'authVal' digest. Defaults to empty string (all-zero digest).\n"
           " -i or --input           Path to file containing the data to be sealed.\n"
           " -o or --output          Destination path for the sealed file. Defaults to <filename>.ski in the CWD.\n"
           " -f or --force           Force the overwrite of an existing .ski file when using default output.\n"
+          " -b or --batch           Seal each file listed after the options (and any -i file) under a single,\n"
+          "                         shared storage key, writing <filename>.ski for each. With --batch, -o\n"
+          "                         specifies the output directory (defaults to the CWD).\n"
+          " -M or --manifest        Seal (as for --batch) each file listed, one per line, in this file. Blank\n"
+          "                         lines and lines starting with '#' are skipped.\n"
+          " -j or --jobs            Number of workers for the reading, encryption, formatting and writing of\n"
+          "                         --batch files (the TPM work is done one file at a time), or for encrypting\n"
+          "                         the chunks of a --chunk_size seal. Defaults to 1.\n"
+          " -C or --chunk_size      Encrypt the input in separately authenticated chunks of this many bytes\n"
+          "                         (e.g., 1048576), which -j workers encrypt, and later decrypt, in parallel.\n"
+          "                         Only supported by the AES/GCM ciphers, and not with --batch or --stream.\n"
+          " -S or --stream          Seal the input in blocks, rather than reading all of it into memory first\n"
+          "                         (only supported by the AES/GCM ciphers).\n"
+          " -z or --compress        Compress the input before encrypting it: 'zstd' or 'none' (the default).\n"
+          "                         Inputs under %d bytes are not compressed. Unsealing detects compression.\n"
+          "                         Not supported with --chunk_size.\n"
+          " -F or --format          Format of the .ski output: 'text' (PEM-style, the default) or 'binary'\n"
+          "                         (compact). Unsealing detects the format. Not supported with --stream.\n"
+          " -k or --sk_alg          Storage key algorithm: 'rsa' (RSA-2048, the default) or 'ecc' (NIST P-256,\n"
+          "                         much faster for the TPM to generate). Unsealing detects the algorithm.\n"
+          " -P or --persist_sk      Also make the storage key persistent at this TPM handle (0x%08X to\n"
+          "                         0x%08X), so unsealing doesn't have to load it. A different key already\n"
+          "                         at the handle is replaced. Use kmyth-sk to list and evict these keys.\n"
+          " -N or --nv_index        Also store the (binary format) .ski output in this TPM NV index (0x%08X\n"
+          "                         to 0x%08X), sized to fit it, for kmyth-unseal -N. No .ski file is\n"
+          "                         written unless -o is given. Not supported with --batch or --stream.\n"
+          " -R or --record_srk      Record the name of the TPM's storage root key (SRK) in the .ski output, so\n"
+          "                         that kmyth-agent and kmyth-unseal -D can send it to the TPM that sealed it.\n"
           " -p or --pcrs_list       List of TPM platform configuration registers (PCRs) to apply to authorization policy.\n"
           "                         Defaults to no PCRs specified. Encapsulate in quotes (e.g. \"0, 1, 2\").\n"
           " -c or --cipher          Specifies the cipher type to use. Defaults to \'%s\'\n"
+          "                         'auto' picks the fastest cipher for this host's CPU.\n"
           " -g or --get_exp_policy  Retrieves the PolicyPCR digest associated with the current value of pcr registers \n"
           " -e or --expected_policy Specifies an alternative digest value that can satisfy the authorization policy. \n"
           " -l or --list_ciphers    Lists all valid ciphers and exits.\n"
           " -w or --owner_auth      TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n"
+          " -Y or --sync            Make the .ski output durable (fsync) before exiting. With --batch, the\n"
+          "                         outputs are synced together, once per file system, rather than one by one.\n"
+          " -T or --timings         Report the time spent in each phase and TPM command (to stderr).\n"
           " -v or --verbose         Enable detailed logging.\n"
-          " -h or --help            Help (displays this usage).\n", prog,
-          cipher_list[0].cipher_name);
+          " -h or --help            Help (displays this usage).\n", prog, prog, prog,
+          KMYTH_COMPRESSION_MIN_SIZE, KMYTH_PERSISTENT_SK_FIRST, KMYTH_PERSISTENT_SK_LAST,
+          KMYTH_NV_SKI_FIRST, KMYTH_NV_SKI_LAST, cipher_list[0].cipher_name);
 }
 
 static void list_ciphers(void)
@@ -155,6 +531,8 @@ static void list_ciphers(void)
             (i == 0) ? " (default)" : "");
     i++;
   }
+  fprintf(stdout, "  %s (the fastest of the above for this host: %s)\n",
+          KMYTH_AUTO_CIPHER, kmyth_get_auto_cipher(false).cipher_name);
   fprintf(stdout,
           "To select a cipher use the '-c' option with the full cipher name.\n"
           "For example, the option '-c AES/KeyWrap/RFC5649Padding/256'\n"
@@ -162,11 +540,22 @@ static void list_ciphers(void)
           "using a 256-bit key.\n");
 }
 
-const struct option longopts[] = {
+static const struct option longopts[] = {
   {"auth_string", required_argument, 0, 'a'},
   {"input", required_argument, 0, 'i'},
   {"output", required_argument, 0, 'o'},
   {"force", no_argument, 0, 'f'},
+  {"batch", no_argument, 0, 'b'},
+  {"manifest", required_argument, 0, 'M'},
+  {"jobs", required_argument, 0, 'j'},
+  {"chunk_size", required_argument, 0, 'C'},
+  {"stream", no_argument, 0, 'S'},
+  {"compress", required_argument, 0, 'z'},
+  {"format", required_argument, 0, 'F'},
+  {"sk_alg", required_argument, 0, 'k'},
+  {"persist_sk", required_argument, 0, 'P'},
+  {"nv_index", required_argument, 0, 'N'},
+  {"record_srk", no_argument, 0, 'R'},
   {"pcrs_list", required_argument, 0, 'p'},
   {"owner_auth", required_argument, 0, 'w'},
   {"cipher", required_argument, 0, 'c'},
@@ -175,6 +564,8 @@ const struct option longopts[] = {
   {"verbose", no_argument, 0, 'v'},
   {"help", no_argument, 0, 'h'},
   {"list_ciphers", no_argument, 0, 'l'},
+  {"timings", no_argument, 0, 'T'},
+  {"sync", no_argument, 0, 'Y'},
   {0, 0, 0, 0}
 };
 
@@ -191,6 +582,10 @@ int main(int argc, char **argv)
   set_app_name(KMYTH_APP_NAME);
   set_app_version(KMYTH_VERSION);
   set_applog_path(KMYTH_APPLOG_PATH);
+  start_async_logging(0);
+
+  // add this run's metrics to the KMYTH_METRICS_FILE textfile (if set)
+  kmyth_metrics_export_at_exit();
 
   // Initialize parameters that might be modified by command line options
   char *inPath = NULL;
@@ -203,13 +598,28 @@ int main(int argc, char **argv)
   bool forceOverwrite = false;
   char *expected_policy = NULL;
   uint8_t bool_trial_only = 0;
+  bool batchMode = false;
+  char *manifestPath = NULL;
+  unsigned long jobs = 1;
+  unsigned long chunkSize = 0;
+  char *end = NULL;
+  bool streamMode = false;
+  char *compression = NULL;
+  int skiFormat = KMYTH_SKI_FORMAT_TEXT;
+  int skAlg = KMYTH_SK_ALG_RSA;
+  uint32_t skHandle = 0;
+  uint32_t nvIndex = 0;
+  bool recordSrk = false;
+  kmyth_timings_t timings = { 0 };
+  kmyth_timings_t *timingsOut = NULL;
+  bool syncOutput = false;
 
   // Parse and apply command line options
   int options;
   int option_index;
 
   while ((options =
-          getopt_long(argc, argv, "a:e:i:o:c:p:w:fghlv", longopts,
+          getopt_long(argc, argv, "a:e:i:j:k:o:c:p:w:z:C:F:M:N:P:bfghlvRSTY", longopts,
                       &option_index)) != -1)
   {
     switch (options)
@@ -237,6 +647,106 @@ int main(int argc, char **argv)
     case 'f':
       forceOverwrite = true;
       break;
+    case 'b':
+      batchMode = true;
+      break;
+    case 'M':
+      manifestPath = optarg;
+      batchMode = true;
+      break;
+    case 'j':
+      errno = 0;
+      jobs = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || jobs == 0 || jobs > KMYTH_MAX_JOBS)
+      {
+        kmyth_log(LOG_ERR, "invalid number of jobs (%s), must be 1 to %d "
+                  "... exiting", optarg, KMYTH_MAX_JOBS);
+        free(outPath);
+        return 1;
+      }
+      break;
+    case 'C':
+      errno = 0;
+      chunkSize = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || chunkSize == 0)
+      {
+        kmyth_log(LOG_ERR, "invalid chunk size (%s) ... exiting", optarg);
+        free(outPath);
+        return 1;
+      }
+      break;
+    case 'S':
+      streamMode = true;
+      break;
+    case 'Y':
+      syncOutput = true;
+      break;
+    case 'z':
+      compression = optarg;
+      break;
+    case 'F':
+      if (strcmp(optarg, "text") == 0)
+      {
+        skiFormat = KMYTH_SKI_FORMAT_TEXT;
+      }
+      else if (strcmp(optarg, "binary") == 0)
+      {
+        skiFormat = KMYTH_SKI_FORMAT_BINARY;
+      }
+      else
+      {
+        kmyth_log(LOG_ERR, "invalid .ski format (%s) ... exiting", optarg);
+        free(outPath);
+        return 1;
+      }
+      break;
+    case 'k':
+      if (strcmp(optarg, "rsa") == 0)
+      {
+        skAlg = KMYTH_SK_ALG_RSA;
+      }
+      else if (strcmp(optarg, "ecc") == 0)
+      {
+        skAlg = KMYTH_SK_ALG_ECC;
+      }
+      else
+      {
+        kmyth_log(LOG_ERR, "invalid storage key algorithm (%s) ... exiting",
+                  optarg);
+        free(outPath);
+        return 1;
+      }
+      break;
+    case 'P':
+      errno = 0;
+      unsigned long handle = strtoul(optarg, &end, 0);
+
+      if (errno || *end != '\0' || handle < KMYTH_PERSISTENT_SK_FIRST ||
+          handle > KMYTH_PERSISTENT_SK_LAST)
+      {
+        kmyth_log(LOG_ERR, "invalid persistent SK handle (%s), must be "
+                  "0x%08X to 0x%08X ... exiting", optarg,
+                  KMYTH_PERSISTENT_SK_FIRST, KMYTH_PERSISTENT_SK_LAST);
+        free(outPath);
+        return 1;
+      }
+      skHandle = (uint32_t) handle;
+      break;
+    case 'N':
+      errno = 0;
+      unsigned long nv = strtoul(optarg, &end, 0);
+
+      if (errno || *end != '\0' || nv < KMYTH_NV_SKI_FIRST ||
+          nv > KMYTH_NV_SKI_LAST)
+      {
+        kmyth_log(LOG_ERR, "invalid NV index (%s), must be 0x%08X to "
+                  "0x%08X ... exiting", optarg, KMYTH_NV_SKI_FIRST,
+                  KMYTH_NV_SKI_LAST);
+        free(outPath);
+        return 1;
+      }
+      nvIndex = (uint32_t) nv;
+      break;
     case 'g':
       bool_trial_only = 1;
       break;
@@ -261,97 +771,164 @@ int main(int argc, char **argv)
     case 'l':
       list_ciphers();
       return 0;
+    case 'R':
+      recordSrk = true;
+      break;
+    case 'T':
+      timingsOut = &timings;
+      break;
     default:
       return 1;
     }
   }
 
-  //Since these originate in main() we know they are null terminated
-  size_t auth_string_len = (authString == NULL) ? 0 : strlen(authString);
-  size_t oa_passwd_len =
-    (ownerAuthPasswd == NULL) ? 0 : strlen(ownerAuthPasswd);
+  // resolve '-c auto' here, so the chosen cipher is recorded in the .ski
+  // like an explicitly named one
+  if (cipherString != NULL && strcmp(cipherString, KMYTH_AUTO_CIPHER) == 0)
+  {
+    cipherString =
+      kmyth_get_auto_cipher(streamMode || chunkSize != 0).cipher_name;
+    kmyth_log(LOG_INFO, "cipher '%s' selected %s", KMYTH_AUTO_CIPHER,
+              cipherString);
+  }
 
-  // Check that input path (file to be sealed) was specified
-  if (inPath == NULL)
+  // NV space is small, so an index holds just the one (compact) .ski
+  if (nvIndex != 0)
   {
-    kmyth_log(LOG_ERR, "no input (file to be sealed) specified ... exiting");
-    if (authString != NULL)
+    if (batchMode || streamMode || bool_trial_only)
     {
-      kmyth_clear(authString, auth_string_len);
+      kmyth_log(LOG_ERR, "--nv_index cannot be combined with --batch, "
+                "--stream or -g ... exiting");
+      free(outPath);
+      return 1;
     }
-    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    skiFormat = KMYTH_SKI_FORMAT_BINARY;
+  }
+
+  if (chunkSize != 0 && (batchMode || streamMode))
+  {
+    kmyth_log(LOG_ERR, "--chunk_size cannot be combined with --batch or "
+              "--stream ... exiting");
+    free(outPath);
+    return 1;
+  }
+  if (chunkSize != 0 && compression != NULL &&
+      strcmp(compression, KMYTH_COMPRESSION_NONE_NAME) != 0)
+  {
+    kmyth_log(LOG_ERR, "--chunk_size cannot be combined with --compress "
+              "... exiting");
     free(outPath);
     return 1;
   }
 
-  // If output file not specified, set output path to basename(inPath) with
-  // a .ski extension in the directory that the application is being run from.
-  if (outPath == NULL)
-  {
-    // create buffer to hold default filename derived from input filename
-    char default_fn[KMYTH_MAX_DEFAULT_FILENAME_LEN + 1];
-    memset(default_fn, '\0', sizeof(default_fn));
-
-    // Initialize default filename to basename() of input path, truncating if
-    // necessary. The maximum size of this "root" value is the must allow space
-    // to add a '.' delimiter (1 byte) and the default extension
-    // (KMYTH_DEFAULT_SEAL_OUT_EXT_LEN bytes).
-    size_t max_root_len = KMYTH_MAX_DEFAULT_FILENAME_LEN;
-    max_root_len -= KMYTH_DEFAULT_SEAL_OUT_EXT_LEN + 1;
-    strncpy(default_fn, basename(inPath), max_root_len);
-
-    // remove any leading '.'s
-    while (*default_fn == '.')
+  //Since these originate in main() we know they are null terminated
+  size_t auth_string_len = (authString == NULL) ? 0 : strlen(authString);
+  size_t oa_passwd_len =
+    (ownerAuthPasswd == NULL) ? 0 : strlen(ownerAuthPasswd);
+
+  // In batch mode, the files to be sealed are the -i file (if any), those
+  // listed in the manifest (if any) and all remaining (non-option)
+  // arguments, and -o names the output directory
+  if (batchMode)
+  {
+    int retval = 1;
+    char **manifestPaths = NULL;
+    size_t manifestPaths_count = 0;
+    size_t inPaths_count = 0;
+    char **inPaths = NULL;
+    int *pcrs = NULL;
+    int pcrs_len = 0;
+
+    if (manifestPath == NULL ||
+        read_path_list(manifestPath, &manifestPaths, &manifestPaths_count) == 0)
     {
-      memmove(default_fn, default_fn + 1, sizeof(default_fn) - 1);
+      inPaths = calloc((size_t) (argc - optind + 1) + manifestPaths_count,
+                       sizeof(char *));
     }
 
-    // ensure that this intermediate result is not an empty string
-    if (strlen(default_fn) == 0)
+    if (inPaths == NULL)
     {
-      kmyth_log(LOG_ERR, "invalid/empty default filename root ... exiting");
-      kmyth_clear(authString, auth_string_len);
-      kmyth_clear(ownerAuthPasswd, oa_passwd_len);
-      return 1;
+      kmyth_log(LOG_ERR, "unable to read batch input list ... exiting");
     }
-
-    // everything beyond first non-leading '.' is treated as extension
-    char *ext_ptr = strstr(default_fn, ".");
-    if (ext_ptr == NULL)
+    else if (bool_trial_only)
     {
-      // no filename extension found - just add trailing '.'
-      strncat(default_fn, ".", 1);
+      kmyth_log(LOG_ERR, "-g cannot be combined with --batch ... exiting");
+    }
+    else if (parse_pcrs_string(pcrsString, &pcrs, &pcrs_len) != 0
+             || pcrs_len < 0)
+    {
+      kmyth_log(LOG_ERR, "failed to parse PCR string %s ... exiting",
+                pcrsString);
     }
     else
     {
-      // input fileame extension delimiter found, null everything after it
-      // The type conversion here is safe assuming inPath is not too pathological,
-      // so that's something we should think about.
-      ptrdiff_t filename_portion = ext_ptr - default_fn;
-      size_t tail_length = sizeof(default_fn) - (size_t)filename_portion;
-      memset(ext_ptr + 1, '\0', tail_length);
+      if (inPath != NULL)
+      {
+        inPaths[inPaths_count++] = inPath;
+      }
+      for (size_t i = 0; i < manifestPaths_count; i++)
+      {
+        inPaths[inPaths_count++] = manifestPaths[i];
+      }
+      for (int i = optind; i < argc; i++)
+      {
+        inPaths[inPaths_count++] = argv[i];
+      }
+
+      if (inPaths_count == 0)
+      {
+        kmyth_log(LOG_ERR, "no input (files to be sealed) specified ... "
+                  "exiting");
+      }
+      else
+      {
+        retval = seal_batch(inPaths, inPaths_count, outPath, forceOverwrite,
+                            skiFormat, skAlg, skHandle, recordSrk,
+                            (size_t) jobs, compression, syncOutput,
+                            (uint8_t *) authString, auth_string_len,
+                            (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                            pcrs, (size_t) pcrs_len, cipherString,
+                            expected_policy, timingsOut);
+        if (timingsOut != NULL)
+        {
+          kmyth_timings_print(stderr, timingsOut);
+        }
+      }
     }
 
-    // concatenate default filename root and extension
-    strncat(default_fn, KMYTH_DEFAULT_SEAL_OUT_EXT,
-                        KMYTH_DEFAULT_SEAL_OUT_EXT_LEN);
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(inPaths);
+    free_path_list(manifestPaths, manifestPaths_count);
+    free(pcrs);
+    free(outPath);
+    return retval;
+  }
+
+  // Check that input path (file to be sealed) was specified
+  if (inPath == NULL)
+  {
+    kmyth_log(LOG_ERR, "no input (file to be sealed) specified ... exiting");
+    if (authString != NULL)
+    {
+      kmyth_clear(authString, auth_string_len);
+    }
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(outPath);
+    return 1;
+  }
 
-    // Make sure default filename we constructed doesn't already exist
-    struct stat st = { 0 };
-    if (!stat(default_fn, &st) && !forceOverwrite)
+  // If output file not specified, set output path to basename(inPath) with
+  // a .ski extension in the directory that the application is being run from
+  // (unless the .ski is going to an NV index instead).
+  if (outPath == NULL && nvIndex == 0)
+  {
+    if (get_default_output_path(inPath, NULL, forceOverwrite, &outPath))
     {
-      kmyth_log(LOG_ERR,
-                "default output filename (%s) already exists ... exiting",
-                default_fn);
       kmyth_clear(authString, auth_string_len);
       kmyth_clear(ownerAuthPasswd, oa_passwd_len);
       return 1;
     }
-
-    // Go ahead and make the default value the output path
-    outPath_size = strlen(default_fn);
-    outPath = malloc(outPath_size * sizeof(char));
-    memcpy(outPath, default_fn, outPath_size);
     kmyth_log(LOG_WARNING, "output file not specified, default = %s", outPath);
   }
 
@@ -369,12 +946,73 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  // Call top-level "kmyth-seal" function
-  if (tpm2_kmyth_seal_file(inPath, &output, &output_length,
+  // Stream the input straight through to the output file
+  if (streamMode)
+  {
+    int retval = 1;
+
+    if (bool_trial_only)
+    {
+      kmyth_log(LOG_ERR, "-g cannot be combined with --stream ... exiting");
+    }
+    else if (skiFormat != KMYTH_SKI_FORMAT_TEXT)
+    {
+      kmyth_log(LOG_ERR, "binary format cannot be combined with --stream "
+                "... exiting");
+    }
+    else
+    {
+      retval = seal_stream(inPath, outPath, skAlg, skHandle, recordSrk,
+                           compression, syncOutput,
                            (uint8_t *) authString, auth_string_len,
                            (uint8_t *) ownerAuthPasswd, oa_passwd_len,
-                           pcrs, (size_t)pcrs_len, cipherString, expected_policy,
-                           bool_trial_only))
+                           pcrs, (size_t) pcrs_len, cipherString,
+                           expected_policy, timingsOut);
+      if (timingsOut != NULL)
+      {
+        kmyth_timings_print(stderr, timingsOut);
+      }
+    }
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(pcrs);
+    free(outPath);
+    return retval;
+  }
+
+  // Call top-level "kmyth-seal" function
+  kmyth_ctx_t *ctx = NULL;
+  int retval = 1;
+
+  if (kmyth_ctx_create(&ctx) == 0 &&
+      kmyth_ctx_set_ski_format(ctx, skiFormat) == 0 &&
+      kmyth_ctx_set_sk_alg(ctx, skAlg) == 0 &&
+      kmyth_ctx_set_persistent_sk(ctx, skHandle) == 0 &&
+      kmyth_ctx_set_record_srk(ctx, recordSrk) == 0 &&
+      kmyth_ctx_set_jobs(ctx, (size_t) jobs) == 0 &&
+      kmyth_ctx_set_chunk_size(ctx, (size_t) chunkSize) == 0 &&
+      kmyth_ctx_set_compression(ctx, compression) == 0 &&
+      (timingsOut == NULL || kmyth_ctx_set_timings(ctx, timingsOut) == 0))
+  {
+    retval = tpm2_kmyth_seal_file_ctx(ctx, inPath, &output, &output_length,
+                                      (uint8_t *) authString, auth_string_len,
+                                      (uint8_t *) ownerAuthPasswd,
+                                      oa_passwd_len, pcrs, (size_t) pcrs_len,
+                                      cipherString, expected_policy,
+                                      bool_trial_only);
+    if (retval == 0 && nvIndex != 0)
+    {
+      retval = kmyth_ctx_store_nv(ctx, nvIndex, output, output_length,
+                                  (uint8_t *) ownerAuthPasswd, oa_passwd_len);
+    }
+  }
+  kmyth_ctx_destroy(&ctx);
+  if (timingsOut != NULL)
+  {
+    kmyth_timings_print(stderr, timingsOut);
+  }
+
+  if (retval)
   {
     kmyth_log(LOG_ERR, "kmyth-seal error ... exiting");
     kmyth_clear(authString, auth_string_len);
@@ -389,9 +1027,10 @@ int main(int argc, char **argv)
   kmyth_clear(ownerAuthPasswd, oa_passwd_len);
 
   // only create output file if -g option is NOT passed
-  if (bool_trial_only == 0)
+  if (bool_trial_only == 0 && outPath != NULL)
   {
-    if (write_bytes_to_file(outPath, output, output_length))
+    if (write_bytes_to_file_atomic(outPath, output, output_length,
+                                   syncOutput))
     {
       kmyth_log(LOG_ERR, "error writing data to .ski file ... exiting");
       free(outPath);
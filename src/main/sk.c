@@ -0,0 +1,168 @@
+/**
+ * Kmyth Persistent Storage Key Interface - TPM 2.0 version
+ *
+ * Lists and evicts the storage keys made persistent by kmyth-seal
+ * (--persist_sk), so that the TPM's limited persistent (NV) slots are
+ * managed explicitly.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "defines.h"
+#include "kmyth.h"
+#include "kmyth_log.h"
+
+/**
+ * @brief Number of handles in the Kmyth persistent storage key range
+ */
+#define KMYTH_SK_MAX_HANDLES \
+  (KMYTH_PERSISTENT_SK_LAST - KMYTH_PERSISTENT_SK_FIRST + 1)
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options]\n\n"
+          "Lists or evicts the storage keys made persistent by kmyth-seal --persist_sk\n"
+          "(TPM handles 0x%08X to 0x%08X). Data sealed under an evicted key can still\n"
+          "be unsealed - its storage key is then loaded from the .ski file.\n\n"
+          "options are: \n\n"
+          " -l or --list            List the persistent storage key handles in use (the default).\n"
+          " -e or --evict           Evict the persistent storage key at this handle.\n"
+          " -A or --evict_all       Evict all persistent storage keys.\n"
+          " -w or --owner_auth      TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n"
+          " -v or --verbose         Enable detailed logging.\n"
+          " -h or --help            Help (displays this usage).\n", prog,
+          KMYTH_PERSISTENT_SK_FIRST, KMYTH_PERSISTENT_SK_LAST);
+}
+
+const struct option longopts[] = {
+  {"list", no_argument, 0, 'l'},
+  {"evict", required_argument, 0, 'e'},
+  {"evict_all", no_argument, 0, 'A'},
+  {"owner_auth", required_argument, 0, 'w'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+int main(int argc, char **argv)
+{
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+  start_async_logging(0);
+
+  // Initialize parameters that might be modified by command line options
+  char *ownerAuthPasswd = "";
+  uint32_t evictHandle = 0;
+  bool evictAll = false;
+  char *end = NULL;
+
+  // Parse and apply command line options
+  int options;
+  int option_index;
+
+  while ((options =
+          getopt_long(argc, argv, "e:w:Ahlv", longopts,
+                      &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 'l':
+      break;
+    case 'e':
+      errno = 0;
+      unsigned long handle = strtoul(optarg, &end, 0);
+
+      if (errno || *end != '\0' || handle < KMYTH_PERSISTENT_SK_FIRST ||
+          handle > KMYTH_PERSISTENT_SK_LAST)
+      {
+        kmyth_log(LOG_ERR, "invalid persistent SK handle (%s), must be "
+                  "0x%08X to 0x%08X ... exiting", optarg,
+                  KMYTH_PERSISTENT_SK_FIRST, KMYTH_PERSISTENT_SK_LAST);
+        return 1;
+      }
+      evictHandle = (uint32_t) handle;
+      break;
+    case 'A':
+      evictAll = true;
+      break;
+    case 'w':
+      ownerAuthPasswd = optarg;
+      break;
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to create kmyth context ... exiting");
+    return 1;
+  }
+
+  uint32_t handles[KMYTH_SK_MAX_HANDLES];
+  size_t count = 0;
+  int retval = 0;
+
+  if (evictHandle != 0)
+  {
+    handles[0] = evictHandle;
+    count = 1;
+  }
+  else if (kmyth_ctx_list_persistent_sks(ctx, handles, KMYTH_SK_MAX_HANDLES,
+                                         &count))
+  {
+    kmyth_log(LOG_ERR, "unable to list persistent storage keys ... exiting");
+    kmyth_ctx_destroy(&ctx);
+    return 1;
+  }
+
+  if (evictHandle == 0 && !evictAll)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      fprintf(stdout, "0x%08X\n", handles[i]);
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      if (kmyth_ctx_evict_persistent_sk(ctx, handles[i],
+                                        (uint8_t *) ownerAuthPasswd,
+                                        strlen(ownerAuthPasswd)))
+      {
+        kmyth_log(LOG_ERR, "unable to evict persistent storage key "
+                  "(handle = 0x%08X)", handles[i]);
+        retval = 1;
+      }
+      else
+      {
+        fprintf(stdout, "evicted 0x%08X\n", handles[i]);
+      }
+    }
+  }
+
+  kmyth_ctx_destroy(&ctx);
+
+  return retval;
+}
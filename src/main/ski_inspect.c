@@ -0,0 +1,378 @@
+/**
+ * Kmyth .ski Metadata Inspection Interface - TPM 2.0 version
+ *
+ * Reports, without a TPM, the PCR selection, cipher and policy digests of
+ * a list of .ski files. Only the header of each file is read - never the
+ * encrypted data - so that large numbers of .ski files can be audited
+ * cheaply.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "formatting_tools.h"
+#include "kmyth_log.h"
+#include "marshalling_tools.h"
+#include "parallel_util.h"
+#include "tpm2_interface.h"
+
+// Shared state for the parallel inspection of a list of .ski files
+typedef struct
+{
+  char **paths;
+  char **reports;
+} inspect_batch_t;
+
+//############################################################################
+// get_hash_alg_name()
+//############################################################################
+static const char *get_hash_alg_name(TPMI_ALG_HASH hash)
+{
+  switch (hash)
+  {
+  case TPM2_ALG_SHA1:
+    return "sha1";
+  case TPM2_ALG_SHA256:
+    return "sha256";
+  case TPM2_ALG_SHA384:
+    return "sha384";
+  case TPM2_ALG_SHA512:
+    return "sha512";
+  case TPM2_ALG_SM3_256:
+    return "sm3_256";
+  default:
+    return NULL;
+  }
+}
+
+//############################################################################
+// print_hex()
+//############################################################################
+static void print_hex(FILE * out, const char *label, uint8_t * bytes,
+                      size_t bytes_len)
+{
+  fprintf(out, "  %s: ", label);
+  for (size_t i = 0; i < bytes_len; i++)
+  {
+    fprintf(out, "%02x", bytes[i]);
+  }
+  fprintf(out, "\n");
+}
+
+//############################################################################
+// print_ski_metadata()
+//############################################################################
+static void print_ski_metadata(FILE * out, char *path, bool binary, Ski * ski,
+                               size_t header_len)
+{
+  fprintf(out, "%s:\n", path);
+  fprintf(out, "  format: %s\n", binary ? "binary" : "text");
+  fprintf(out, "  header size: %zu\n", header_len);
+  fprintf(out, "  cipher: %s\n", ski->cipher.cipher_name);
+  if (ski->compression != KMYTH_COMPRESSION_NONE)
+  {
+    fprintf(out, "  compression: %s\n",
+            kmyth_get_compression_name(ski->compression));
+  }
+  if (ski->chunk_size != 0)
+  {
+    fprintf(out, "  chunks: %zu bytes each, %zu bytes in all\n",
+            ski->chunk_size, ski->chunked_data_len);
+  }
+
+  // the PCR selection, one line per bank
+  for (size_t i = 0; i < ski->pcr_list.count; i++)
+  {
+    TPMS_PCR_SELECTION *selection = &ski->pcr_list.pcrSelections[i];
+    const char *bank = get_hash_alg_name(selection->hash);
+    bool first = true;
+
+    if (bank == NULL)
+    {
+      fprintf(out, "  pcrs (0x%04x):", selection->hash);
+    }
+    else
+    {
+      fprintf(out, "  pcrs (%s):", bank);
+    }
+    for (size_t pcr = 0; pcr < 8 * (size_t) selection->sizeofSelect; pcr++)
+    {
+      if (selection->pcrSelect[pcr / 8] & (1 << (pcr % 8)))
+      {
+        fprintf(out, "%s %zu", first ? "" : ",", pcr);
+        first = false;
+      }
+    }
+    fprintf(out, "%s\n", first ? " none" : "");
+  }
+
+  // the policy the sealed wrapping key (and the storage key) is bound to,
+  // and, for a compound "policy or", its branches
+  print_hex(out, "policy digest",
+            ski->wk_pub.publicArea.authPolicy.buffer,
+            ski->wk_pub.publicArea.authPolicy.size);
+  if (ski->policyBranch1.size != 0)
+  {
+    print_hex(out, "policy branch 1", ski->policyBranch1.buffer,
+              ski->policyBranch1.size);
+    print_hex(out, "policy branch 2", ski->policyBranch2.buffer,
+              ski->policyBranch2.size);
+  }
+  if (ski->srk_name.size != 0)
+  {
+    print_hex(out, "srk name", ski->srk_name.name, ski->srk_name.size);
+  }
+}
+
+//############################################################################
+// inspect_batch_item()
+//############################################################################
+static int inspect_batch_item(size_t index, void *arg)
+{
+  inspect_batch_t *batch = (inspect_batch_t *) arg;
+  char *path = batch->paths[index];
+
+  // only the leading part of the file, which holds the header, is read
+  uint8_t *prefix = malloc(KMYTH_SKI_METADATA_MAX_SIZE);
+  size_t prefix_len = 0;
+  int fd = open(path, O_RDONLY);
+
+  if (prefix == NULL || fd < 0 ||
+      read_from_fd(fd, prefix, KMYTH_SKI_METADATA_MAX_SIZE, &prefix_len))
+  {
+    kmyth_log(LOG_ERR, "unable to read %s", path);
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    free(prefix);
+    return 1;
+  }
+  close(fd);
+
+  Ski ski = get_default_ski();
+  size_t header_len = 0;
+
+  if (parse_ski_metadata(prefix, prefix_len, &ski, &header_len))
+  {
+    kmyth_log(LOG_ERR, "unable to parse .ski header of %s", path);
+    free(prefix);
+    return 1;
+  }
+
+  size_t report_len = 0;
+  FILE *report = open_memstream(&batch->reports[index], &report_len);
+  int retval = 0;
+
+  if (report == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to create report for %s", path);
+    retval = 1;
+  }
+  else
+  {
+    print_ski_metadata(report, path, is_binary_ski_bytes(prefix, prefix_len),
+                       &ski, header_len);
+    if (fclose(report))
+    {
+      kmyth_log(LOG_ERR, "unable to create report for %s", path);
+      retval = 1;
+    }
+  }
+
+  free_ski(&ski);
+  free(prefix);
+
+  return retval;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stdout,
+          "\nusage: %s [options] <file> [<file> ...]\n"
+          "       %s --manifest <list> [options] [<file> ...]\n\n"
+          "Reports the metadata of each .ski file listed, without a TPM: the PCR selection,\n"
+          "the cipher and the policy digest(s) the data is sealed to. Only the header of each\n"
+          "file is read - not the encrypted data - however large the file.\n\n"
+          "options are: \n\n"
+          " -M or --manifest        Also inspect each file listed, one per line, in this file.\n"
+          "                         Blank lines and lines starting with '#' are ignored.\n"
+          " -o or --output          Destination path for the report. Defaults to stdout.\n"
+          " -j or --jobs            Number of workers reading files. Defaults to the number of\n"
+          "                         online CPUs (at most %d).\n"
+          " -v or --verbose         Enable detailed logging.\n"
+          " -h or --help            Help (displays this usage).\n", prog, prog,
+          KMYTH_MAX_JOBS);
+}
+
+const struct option longopts[] = {
+  {"manifest", required_argument, 0, 'M'},
+  {"output", required_argument, 0, 'o'},
+  {"jobs", required_argument, 0, 'j'},
+  {"verbose", no_argument, 0, 'v'},
+  {"help", no_argument, 0, 'h'},
+  {0, 0, 0, 0}
+};
+
+int main(int argc, char **argv)
+{
+  // If no command line arguments provided, provide usage help and exit early
+  if (argc == 1)
+  {
+    usage(argv[0]);
+    return 0;
+  }
+
+  // Configure logging messages
+  set_app_name(KMYTH_APP_NAME);
+  set_app_version(KMYTH_VERSION);
+  set_applog_path(KMYTH_APPLOG_PATH);
+  start_async_logging(0);
+
+  // Initialize parameters that might be modified by command line options
+  char *manifestPath = NULL;
+  char *outPath = NULL;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned long jobs = (cpus < 1) ? 1 : (unsigned long) cpus;
+  char *end = NULL;
+
+  if (jobs > KMYTH_MAX_JOBS)
+  {
+    jobs = KMYTH_MAX_JOBS;
+  }
+
+  // Parse and apply command line options
+  int options;
+  int option_index;
+
+  while ((options =
+          getopt_long(argc, argv, "M:o:j:hv", longopts,
+                      &option_index)) != -1)
+  {
+    switch (options)
+    {
+    case 'M':
+      manifestPath = optarg;
+      break;
+    case 'o':
+      outPath = optarg;
+      break;
+    case 'j':
+      errno = 0;
+      jobs = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || jobs == 0 || jobs > KMYTH_MAX_JOBS)
+      {
+        kmyth_log(LOG_ERR, "invalid number of jobs (%s), must be 1 to %d "
+                  "... exiting", optarg, KMYTH_MAX_JOBS);
+        return 1;
+      }
+      break;
+    case 'v':
+      // always display all log messages (severity threshold = LOG_DEBUG)
+      // to stdout or stderr (output mode = 0)
+      set_applog_severity_threshold(LOG_DEBUG);
+      set_applog_output_mode(0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  // The files inspected are those listed in the manifest (if any) and all
+  // remaining (non-option) arguments
+  char **manifestPaths = NULL;
+  size_t manifestPaths_count = 0;
+
+  if (manifestPath != NULL &&
+      read_path_list(manifestPath, &manifestPaths, &manifestPaths_count))
+  {
+    kmyth_log(LOG_ERR, "unable to read manifest ... exiting");
+    return 1;
+  }
+
+  size_t count = manifestPaths_count + (size_t) (argc - optind);
+
+  if (count == 0)
+  {
+    kmyth_log(LOG_ERR, "no .ski files specified ... exiting");
+    free_path_list(manifestPaths, manifestPaths_count);
+    return 1;
+  }
+
+  inspect_batch_t batch = {
+    .paths = calloc(count, sizeof(char *)),
+    .reports = calloc(count, sizeof(char *))
+  };
+
+  if (batch.paths == NULL || batch.reports == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate memory ... exiting");
+    free(batch.paths);
+    free(batch.reports);
+    free_path_list(manifestPaths, manifestPaths_count);
+    return 1;
+  }
+  for (size_t i = 0; i < manifestPaths_count; i++)
+  {
+    batch.paths[i] = manifestPaths[i];
+  }
+  for (int i = optind; i < argc; i++)
+  {
+    batch.paths[manifestPaths_count + (size_t) (i - optind)] = argv[i];
+  }
+
+  // a file that cannot be inspected is reported, but the others still are
+  int retval = 0;
+
+  if (kmyth_parallel_for(count, (size_t) jobs, inspect_batch_item, &batch))
+  {
+    retval = 1;
+  }
+
+  FILE *out = (outPath == NULL) ? stdout : fopen(outPath, "w");
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open output file %s ... exiting", outPath);
+    retval = 1;
+  }
+  else
+  {
+    bool write_error = false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+      if (batch.reports[i] != NULL && fputs(batch.reports[i], out) < 0)
+      {
+        write_error = true;
+      }
+    }
+    if (((out == stdout) ? fflush(out) : fclose(out)) || write_error)
+    {
+      kmyth_log(LOG_ERR, "error writing report ... exiting");
+      retval = 1;
+    }
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    free(batch.reports[i]);
+  }
+  free(batch.reports);
+  free(batch.paths);
+  free_path_list(manifestPaths, manifestPaths_count);
+
+  return retval;
+}
@@ -2,46 +2,673 @@
  * Kmyth Unsealing Interface - TPM 2.0
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <sys/stat.h>
 
+#include "agent_util.h"
+#include "boot_util.h"
 #include "defines.h"
 #include "file_io.h"
+#include "file_loader.h"
+#include "handoff_util.h"
 #include "kmyth.h"
 #include "kmyth_log.h"
 #include "memory_util.h"
+#include "parallel_util.h"
+
+//############################################################################
+// unseal_stream()
+//############################################################################
+static int unseal_stream(char *inPath, char *outPath, bool precheck,
+                         uint8_t * auth_bytes, size_t auth_bytes_len,
+                         uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                         uint8_t bool_policy_or, kmyth_timings_t * timings)
+{
+  int in_fd = open(inPath, O_RDONLY);
+
+  if (in_fd < 0)
+  {
+    kmyth_log(LOG_ERR, "unable to open file: %s ... exiting", inPath);
+    return 1;
+  }
+
+  // a NULL outPath selects stdout
+  int out_fd = STDOUT_FILENO;
+
+  if (outPath != NULL)
+  {
+    out_fd = open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out_fd < 0)
+    {
+      kmyth_log(LOG_ERR, "unable to open file: %s ... exiting", outPath);
+      close(in_fd);
+      return 1;
+    }
+  }
+
+  int retval = 1;
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx) == 0 &&
+      kmyth_ctx_set_policy_precheck(ctx, precheck) == 0 &&
+      (timings == NULL || kmyth_ctx_set_timings(ctx, timings) == 0))
+  {
+    retval = tpm2_kmyth_unseal_stream(ctx, in_fd, out_fd,
+                                      auth_bytes, auth_bytes_len,
+                                      owner_auth_bytes, oa_bytes_len,
+                                      bool_policy_or);
+  }
+  kmyth_ctx_destroy(&ctx);
+
+  close(in_fd);
+  if (outPath != NULL && close(out_fd))
+  {
+    retval = 1;
+  }
+
+  // unverified output must not be left behind
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "kmyth-unseal failed ... exiting");
+    if (outPath != NULL)
+    {
+      unlink(outPath);
+    }
+  }
+  else if (outPath != NULL)
+  {
+    kmyth_log(LOG_DEBUG, "unsealed contents of %s to %s", inPath, outPath);
+  }
+
+  return retval;
+}
+
+//############################################################################
+// get_unsealed_output_path()
+//############################################################################
+static int get_unsealed_output_path(char *inPath, char *outDir,
+                                    bool forceOverwrite, char **outPath)
+{
+  // The output filename is the basename() of the input path, without its
+  // .ski extension
+  char *fn = basename(inPath);
+  size_t fn_len = strlen(fn);
+  size_t ext_len = KMYTH_DEFAULT_SEAL_OUT_EXT_LEN + 1;
+
+  if (fn_len <= ext_len || fn[fn_len - ext_len] != '.' ||
+      strcmp(fn + fn_len - KMYTH_DEFAULT_SEAL_OUT_EXT_LEN,
+             KMYTH_DEFAULT_SEAL_OUT_EXT) != 0)
+  {
+    kmyth_log(LOG_ERR, "input filename (%s) must have a .%s extension "
+              "... exiting", inPath, KMYTH_DEFAULT_SEAL_OUT_EXT);
+    return 1;
+  }
+  fn_len -= ext_len;
+
+  // The output goes in outDir, if specified, otherwise in the directory
+  // that the application is being run from
+  size_t outPath_size = fn_len + 1;
+
+  if (outDir != NULL)
+  {
+    outPath_size += strlen(outDir) + 1;
+  }
+  *outPath = malloc(outPath_size);
+  if (*outPath == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate output path ... exiting");
+    return 1;
+  }
+  if (outDir != NULL)
+  {
+    snprintf(*outPath, outPath_size, "%s/%.*s", outDir, (int) fn_len, fn);
+  }
+  else
+  {
+    snprintf(*outPath, outPath_size, "%.*s", (int) fn_len, fn);
+  }
+
+  struct stat st = { 0 };
+
+  if (verifyOutputFilePath(*outPath) ||
+      (!forceOverwrite && !stat(*outPath, &st)))
+  {
+    kmyth_log(LOG_ERR, "invalid (or existing) output path (%s) ... exiting",
+              *outPath);
+    free(*outPath);
+    *outPath = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+// Batch items are unsealed a window at a time, so that the next window's
+// .ski files are read (and the previous window's outputs written) while the
+// TPM works on this one
+#define UNSEAL_BATCH_WINDOW 128
+
+// The files of a batch, shared with the workers reading and writing them
+// (each of which only touches the files it is handed)
+typedef struct
+{
+  char **inPaths;
+  char *outDir;
+  bool forceOverwrite;
+  uint8_t **inputs;
+  size_t *input_lens;
+  int *read_results;
+  char **outPaths;
+  uint8_t **outputs;
+  size_t *output_lens;
+  int *results;
+  kmyth_output_writer_t writer;
+  size_t first;
+} unseal_batch_files;
+
+// The windows of a batch, and what is needed to unseal them
+typedef struct
+{
+  unseal_batch_files *files;
+  size_t count;
+  size_t jobs;
+  size_t window;
+  kmyth_pool_t *pool;
+  uint8_t *auth_bytes;
+  size_t auth_bytes_len;
+  uint8_t *owner_auth_bytes;
+  size_t oa_bytes_len;
+  uint8_t bool_policy_or;
+} unseal_batch_pipeline;
+
+//############################################################################
+// unseal_batch_paths()
+//############################################################################
+static int unseal_batch_paths(size_t i, void *arg)
+{
+  unseal_batch_files *files = (unseal_batch_files *) arg;
+
+  if (verifyInputFilePath(files->inPaths[i]) ||
+      get_unsealed_output_path(files->inPaths[i], files->outDir,
+                               files->forceOverwrite, &files->outPaths[i]))
+  {
+    kmyth_log(LOG_ERR, "invalid batch input (%s) ... exiting",
+              files->inPaths[i]);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// unseal_batch_write()
+//############################################################################
+static int unseal_batch_write(size_t k, void *arg)
+{
+  unseal_batch_files *files = (unseal_batch_files *) arg;
+  size_t i = files->first + k;
+  int retval = 0;
+
+  if (files->results[i] != 0)
+  {
+    kmyth_log(LOG_ERR, "kmyth-unseal error (%s)", files->inPaths[i]);
+  }
+  else if (kmyth_output_writer_stage(&files->writer, i, files->outPaths[i],
+                                     files->outputs[i],
+                                     files->output_lens[i]))
+  {
+    kmyth_log(LOG_ERR, "Error writing file: %s", files->outPaths[i]);
+    retval = 1;
+  }
+  else
+  {
+    kmyth_log(LOG_DEBUG, "unsealed contents of %s to %s", files->inPaths[i],
+              files->outPaths[i]);
+  }
+
+  // done with the item's data
+  free(files->inputs[i]);
+  files->inputs[i] = NULL;
+  kmyth_clear_and_free(files->outputs[i], files->output_lens[i]);
+  files->outputs[i] = NULL;
+
+  return retval;
+}
+
+//############################################################################
+// unseal_batch_window_io()
+//############################################################################
+static int unseal_batch_window_io(unseal_batch_pipeline * pipeline,
+                                  size_t window, bool read)
+{
+  unseal_batch_files *files = pipeline->files;
+  size_t first = window * UNSEAL_BATCH_WINDOW;
+  size_t n = pipeline->count - first;
+
+  if (n > UNSEAL_BATCH_WINDOW)
+  {
+    n = UNSEAL_BATCH_WINDOW;
+  }
+
+  // an input that cannot be read fails its item (its empty input is not a
+  // .ski), but the rest of the batch goes on
+  if (read)
+  {
+    return kmyth_load_files(files->inPaths + first, n, 0,
+                            files->inputs + first, files->input_lens + first,
+                            files->read_results + first);
+  }
+
+  files->first = first;
+  return kmyth_parallel_for(n, pipeline->jobs, unseal_batch_write, files);
+}
+
+//############################################################################
+// unseal_batch_stage()
+//############################################################################
+static int unseal_batch_stage(size_t stage, void *arg)
+{
+  unseal_batch_pipeline *pipeline = (unseal_batch_pipeline *) arg;
+  unseal_batch_files *files = pipeline->files;
+  size_t windows = (pipeline->count + UNSEAL_BATCH_WINDOW - 1) /
+    UNSEAL_BATCH_WINDOW;
+  size_t window = pipeline->window;
+
+  // stage 1: the file I/O - reading the next window, and writing the
+  // previous one
+  if (stage == 1)
+  {
+    int retval = 0;
+
+    if (window + 1 < windows &&
+        unseal_batch_window_io(pipeline, window + 1, true))
+    {
+      retval = 1;
+    }
+    if (window > 0 && unseal_batch_window_io(pipeline, window - 1, false))
+    {
+      retval = 1;
+    }
+    return retval;
+  }
+
+  // stage 0: the TPM work, for this window
+  if (window == windows)
+  {
+    return 0;
+  }
+
+  size_t first = window * UNSEAL_BATCH_WINDOW;
+  size_t n = pipeline->count - first;
+
+  if (n > UNSEAL_BATCH_WINDOW)
+  {
+    n = UNSEAL_BATCH_WINDOW;
+  }
+
+  return tpm2_kmyth_unseal_batch_pool(pipeline->pool, n,
+                                      files->inputs + first,
+                                      files->input_lens + first,
+                                      files->outputs + first,
+                                      files->output_lens + first,
+                                      files->results + first,
+                                      pipeline->auth_bytes,
+                                      pipeline->auth_bytes_len,
+                                      pipeline->owner_auth_bytes,
+                                      pipeline->oa_bytes_len,
+                                      pipeline->bool_policy_or);
+}
+
+//############################################################################
+// unseal_batch()
+//############################################################################
+static int unseal_batch(char **inPaths, size_t count, char *outDir,
+                        bool forceOverwrite, size_t jobs, bool precheck,
+                        bool syncOutput,
+                        const char **devices, size_t devices_len,
+                        uint8_t * auth_bytes, size_t auth_bytes_len,
+                        uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                        uint8_t bool_policy_or, kmyth_timings_t * timings)
+{
+  unseal_batch_files files = {
+    .inPaths = inPaths,
+    .outDir = outDir,
+    .forceOverwrite = forceOverwrite,
+    .inputs = calloc(count, sizeof(uint8_t *)),
+    .input_lens = calloc(count, sizeof(size_t)),
+    .read_results = calloc(count, sizeof(int)),
+    .outPaths = calloc(count, sizeof(char *)),
+    .outputs = calloc(count, sizeof(uint8_t *)),
+    .output_lens = calloc(count, sizeof(size_t)),
+    .results = calloc(count, sizeof(int))
+  };
+
+  if (files.inputs == NULL || files.input_lens == NULL ||
+      files.read_results == NULL ||
+      files.outputs == NULL || files.output_lens == NULL ||
+      files.results == NULL || files.outPaths == NULL ||
+      kmyth_output_writer_init(&files.writer, count, syncOutput))
+  {
+    kmyth_log(LOG_ERR, "unable to allocate memory for batch ... exiting");
+    free(files.inputs);
+    free(files.input_lens);
+    free(files.read_results);
+    free(files.outputs);
+    free(files.output_lens);
+    free(files.results);
+    free(files.outPaths);
+    kmyth_output_writer_free(&files.writer);
+    return 1;
+  }
+
+  int retval = 0;
+
+  // Work out all of the output paths (using all of the workers) before
+  // doing any TPM work, so that a bad path is caught up front
+  if (kmyth_parallel_for(count, jobs, unseal_batch_paths, &files))
+  {
+    retval = 1;
+  }
+
+  // (timings are only collected for a single device - see main())
+  kmyth_pool_t *pool = NULL;
+
+  if (retval == 0 && kmyth_pool_create(&pool, devices, devices_len))
+  {
+    retval = 1;
+  }
+  for (size_t d = 0; retval == 0 && d < kmyth_pool_size(pool); d++)
+  {
+    kmyth_ctx_t *ctx = kmyth_pool_get_ctx(pool, d);
+
+    if (kmyth_ctx_set_jobs(ctx, jobs) ||
+        kmyth_ctx_set_policy_precheck(ctx, precheck) ||
+        (timings != NULL && kmyth_ctx_set_timings(ctx, timings)))
+    {
+      retval = 1;
+    }
+  }
+  if (pool == NULL || retval)
+  {
+    kmyth_log(LOG_ERR, "unable to create kmyth context ... exiting");
+    retval = 1;
+  }
+
+  if (retval == 0)
+  {
+    unseal_batch_pipeline pipeline = {
+      .files = &files,
+      .count = count,
+      .jobs = jobs,
+      .window = 0,
+      .pool = pool,
+      .auth_bytes = auth_bytes,
+      .auth_bytes_len = auth_bytes_len,
+      .owner_auth_bytes = owner_auth_bytes,
+      .oa_bytes_len = oa_bytes_len,
+      .bool_policy_or = bool_policy_or
+    };
+    size_t windows = (count + UNSEAL_BATCH_WINDOW - 1) / UNSEAL_BATCH_WINDOW;
+
+    // read the first window, then, for each window, unseal it while the
+    // next is read and the previous one written (the last pass only writes
+    // the last window), reporting each failure
+    if (unseal_batch_window_io(&pipeline, 0, true))
+    {
+      retval = 1;
+    }
+    for (size_t w = 0; w <= windows; w++)
+    {
+      pipeline.window = w;
+      if (kmyth_parallel_for(2, 2, unseal_batch_stage, &pipeline))
+      {
+        retval = 1;
+      }
+    }
+
+    // the files all appear (and, with syncOutput, are made durable)
+    // together
+    if (kmyth_output_writer_commit(&files.writer))
+    {
+      retval = 1;
+    }
+  }
+
+  kmyth_pool_destroy(&pool);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    free(files.inputs[i]);
+    kmyth_clear_and_free(files.outputs[i], files.output_lens[i]);
+    free(files.outPaths[i]);
+  }
+  free(files.inputs);
+  free(files.input_lens);
+  free(files.read_results);
+  free(files.outputs);
+  free(files.output_lens);
+  free(files.results);
+  free(files.outPaths);
+  kmyth_output_writer_free(&files.writer);
+
+  return retval;
+}
+
+//############################################################################
+// unseal_agent()
+//############################################################################
+static int unseal_agent(char *agentPath, char *inPath, const char *request,
+                        uint8_t ** output, size_t *output_length)
+{
+  // The .ski file is opened here, and passed to the agent, so that the
+  // agent only serves files that the caller is able to read.
+  int in_fd = open(inPath, O_RDONLY);
+
+  if (in_fd < 0)
+  {
+    kmyth_log(LOG_ERR, "unable to open file: %s ... exiting", inPath);
+    return 1;
+  }
+
+  int retval = agent_request(agentPath, request, in_fd, output,
+                             output_length);
+
+  close(in_fd);
+  return retval;
+}
+
+//############################################################################
+// unseal_boot_deliver()
+//############################################################################
+static int unseal_boot_deliver(const kmyth_boot_entry * entry, uint8_t * key,
+                               size_t key_len, void *arg)
+{
+  bool syncOutput = *(bool *) arg;
+
+  if (entry->target == KMYTH_BOOT_TARGET_FILE)
+  {
+    return write_bytes_to_file_atomic(entry->target_arg, key, key_len,
+                                      syncOutput);
+  }
+
+  int key_fd = -1;
+
+  if (handoff_create_memfd("kmyth-boot", key, key_len, &key_fd))
+  {
+    return 1;
+  }
+
+  int retval = (entry->target == KMYTH_BOOT_TARGET_EXEC) ?
+    handoff_exec(key_fd, entry->target_arg) :
+    handoff_send(key_fd, entry->target_arg);
+
+  close(key_fd);
+  return retval;
+}
+
+//############################################################################
+// unseal_boot()
+//############################################################################
+static int unseal_boot(char *bootPath, size_t jobs, bool precheck,
+                       bool syncOutput,
+                       const char **devices, size_t devices_len,
+                       uint8_t * auth_bytes, size_t auth_bytes_len,
+                       uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                       uint8_t bool_policy_or, kmyth_timings_t * timings)
+{
+  // the "agent" entries are kmyth-agent's to unseal (with its --boot)
+  kmyth_boot_manifest manifest;
+
+  if (boot_manifest_read(bootPath, KMYTH_BOOT_TARGET_FILE |
+                         KMYTH_BOOT_TARGET_EXEC | KMYTH_BOOT_TARGET_SEND,
+                         &manifest))
+  {
+    return 1;
+  }
+  if (manifest.count == 0)
+  {
+    kmyth_log(LOG_ERR, "no boot keys listed in %s ... exiting", bootPath);
+    boot_manifest_free(&manifest);
+    return 1;
+  }
+
+  kmyth_pool_t *pool = NULL;
+  int retval = kmyth_pool_create(&pool, devices, devices_len);
+
+  for (size_t d = 0; retval == 0 && d < kmyth_pool_size(pool); d++)
+  {
+    kmyth_ctx_t *ctx = kmyth_pool_get_ctx(pool, d);
+
+    if (kmyth_ctx_set_jobs(ctx, jobs) ||
+        kmyth_ctx_set_policy_precheck(ctx, precheck) ||
+        (timings != NULL && kmyth_ctx_set_timings(ctx, timings)))
+    {
+      retval = 1;
+    }
+  }
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to create kmyth context ... exiting");
+    kmyth_pool_destroy(&pool);
+    boot_manifest_free(&manifest);
+    return 1;
+  }
+
+  kmyth_boot_report report;
+
+  retval = boot_unseal(pool, &manifest, unseal_boot_deliver, &syncOutput,
+                       auth_bytes, auth_bytes_len,
+                       owner_auth_bytes, oa_bytes_len, bool_policy_or,
+                       &report);
+  kmyth_pool_destroy(&pool);
+
+  fprintf(stdout, "boot keys: %zu delivered, %zu failed (%zu priorities)\n",
+          report.delivered, report.failed, report.tiers);
+  if (report.first_key_us >= 0)
+  {
+    fprintf(stdout, "time to first key: %.3f ms\n",
+            (double) report.first_key_us / 1000.0);
+  }
+  fprintf(stdout, "total time: %.3f ms\n", (double) report.total_us / 1000.0);
+
+  boot_manifest_free(&manifest);
+  return retval;
+}
 
 static void usage(const char *prog)
 {
   fprintf(stdout,
-          "\nusage: %s [options]\n\n"
+          "\nusage: %s [options]\n"
+          "       %s --batch [options] <file> [<file> ...]\n"
+          "       %s --manifest <list> [options] [<file> ...]\n"
+          "       %s --boot <manifest> [options]\n\n"
           "options are: \n\n"
           " -a or --auth_string   String used to create 'authVal' digest. Defaults to empty string (all-zero digest).\n"
           " -i or --input         Path to file containing data the to be unsealed\n"
+          " -N or --nv_index      Instead of -i, unseal the .ski stored in this TPM NV index by kmyth-seal -N\n"
+          "                       (0x%08X to 0x%08X), without any file I/O.\n"
           " -o or --output        Destination path for unsealed file. This or -s must be specified. Will not overwrite any\n"
           "                       existing files unless the 'force' option is selected.\n"
           " -f or --force         Force the overwrite of an existing output file\n"
+          " -b or --batch         Unseal each .ski file listed after the options (and any -i file), writing\n"
+          "                       each to a file named without the .ski extension. With --batch, -o specifies\n"
+          "                       the output directory (defaults to the CWD).\n"
+          " -M or --manifest      Unseal (as for --batch) each file listed, one per line, in this file. Blank\n"
+          "                       lines and lines starting with '#' are skipped.\n"
+          " -B or --boot          Unseal the keys listed in this boot manifest, one per line as\n"
+          "                       '<priority> <.ski file> <target>', lowest priority first, handing each one to\n"
+          "                       its target ('file:<path>', 'exec:<command>' or 'send:<socket>', as for -o, -e\n"
+          "                       and -F) as soon as the keys of its priority are unsealed, then report the time\n"
+          "                       to the first key and in total. 'agent' entries are left to kmyth-agent --boot.\n"
+          " -j or --jobs          Number of workers for the reading, parsing, decryption and writing of --batch\n"
+          "                       files (the TPM work is done one file at a time), or for decrypting the\n"
+          "                       chunks of a chunked .ski file. Defaults to 1.\n"
+          " -D or --device        With --batch, TCTI configuration of a TPM to unseal with (may be repeated,\n"
+          "                       up to %d times). The files are shared between the TPMs, each going to the\n"
+          "                       one holding the SRK it records. Defaults to the configured (or default) TCTI.\n"
           " -s or --stdout        Output unencrypted result to stdout instead of file.\n"
+          " -S or --stream        Unseal the input in blocks, rather than reading all of it into memory first\n"
+          "                       (only supported by the AES/GCM ciphers). The output is only verified once\n"
+          "                       all of it has been written, so if kmyth-unseal fails it must be discarded.\n"
           " -p or --policy_or     Unseals a file sealed using a compound \"policy or\".\n"
+          " -C or --precheck      Check the current PCR values against the sealed data's policy before loading\n"
+          "                       anything into the TPM, so that data whose PCRs have changed fails quickly.\n"
+          " -A or --agent         Obtain the unsealed data from the kmyth-agent listening on this socket, which\n"
+          "                       caches it (-a and -w are then those the agent was started with).\n"
+          " -t or --ttl           With -A, how long (in seconds) the agent caches the unsealed data. Defaults to,\n"
+          "                       and is limited by, the agent's own ttl.\n"
+          " -x or --invalidate    With -A, drop the agent's cached data for the input file (no output is written).\n"
           " -w or --owner_auth    TPM 2.0 storage (owner) hierarchy authorization. Defaults to emptyAuth to match TPM default.\n"
+          " -e or --exec          Instead of writing the output, hand it to this command (run by /bin/sh) in a\n"
+          "                       sealed memory file it inherits: the file descriptor number is in $"
+          KMYTH_HANDOFF_FD_ENV " and\n"
+          "                       the size in $" KMYTH_HANDOFF_SIZE_ENV ". kmyth-unseal exits once the command has.\n"
+          " -F or --send_fd       Instead of writing the output, pass it, in a sealed memory file, to the process\n"
+          "                       listening on this UNIX domain socket (the file descriptor is sent as SCM_RIGHTS\n"
+          "                       data with the line \"KEY <size>\\n\").\n"
+          " -Y or --sync          Make the output durable (fsync) before exiting. With --batch, the outputs\n"
+          "                       are synced together, once per file system, rather than one by one.\n"
+          " -T or --timings       Report the time spent in each phase and TPM command (to stderr). Not\n"
+          "                       supported with -A, as the agent does the TPM work.\n"
           " -v or --verbose       Enable detailed logging.\n"
-          " -h or --help          Help (displays this usage).\n", prog);
+          " -h or --help          Help (displays this usage).\n", prog, prog, prog, prog,
+          KMYTH_NV_SKI_FIRST, KMYTH_NV_SKI_LAST, KMYTH_POOL_MAX);
 }
 
-const struct option longopts[] = {
+static const struct option longopts[] = {
   {"auth_string", required_argument, 0, 'a'},
   {"input", required_argument, 0, 'i'},
+  {"nv_index", required_argument, 0, 'N'},
   {"output", required_argument, 0, 'o'},
   {"force", no_argument, 0, 'f'},
+  {"batch", no_argument, 0, 'b'},
+  {"manifest", required_argument, 0, 'M'},
+  {"boot", required_argument, 0, 'B'},
+  {"jobs", required_argument, 0, 'j'},
+  {"device", required_argument, 0, 'D'},
   {"policy_or", no_argument, 0, 'p'},
+  {"precheck", no_argument, 0, 'C'},
+  {"agent", required_argument, 0, 'A'},
+  {"ttl", required_argument, 0, 't'},
+  {"invalidate", no_argument, 0, 'x'},
   {"owner_auth", required_argument, 0, 'w'},
   {"standard", no_argument, 0, 's'},
+  {"stream", no_argument, 0, 'S'},
   {"verbose", no_argument, 0, 'v'},
   {"help", no_argument, 0, 'h'},
+  {"timings", no_argument, 0, 'T'},
+  {"sync", no_argument, 0, 'Y'},
+  {"exec", required_argument, 0, 'e'},
+  {"send_fd", required_argument, 0, 'F'},
   {0, 0, 0, 0}
 };
 
@@ -58,20 +685,42 @@ int main(int argc, char **argv)
   set_app_name(KMYTH_APP_NAME);
   set_app_version(KMYTH_VERSION);
   set_applog_path(KMYTH_APPLOG_PATH);
+  start_async_logging(0);
+
+  // add this run's metrics to the KMYTH_METRICS_FILE textfile (if set)
+  kmyth_metrics_export_at_exit();
 
   // Initialize parameters that might be modified by command line options
   char *inPath = NULL;
+  uint32_t nvIndex = 0;
   char *outPath = NULL;
   bool stdout_flag = false;
   char *authString = NULL;
   char *ownerAuthPasswd = "";
   bool forceOverwrite = false;
   uint8_t bool_policy_or = 0;
+  bool precheck = false;
+  bool streamMode = false;
+  char *agentPath = NULL;
+  unsigned long agentTtl = 0;
+  bool invalidate = false;
+  bool batchMode = false;
+  char *manifestPath = NULL;
+  char *bootPath = NULL;
+  unsigned long jobs = 1;
+  const char *devices[KMYTH_POOL_MAX];
+  size_t devices_len = 0;
+  kmyth_timings_t timings = { 0 };
+  kmyth_timings_t *timingsOut = NULL;
+  bool syncOutput = false;
+  char *execCommand = NULL;
+  char *sendFdPath = NULL;
+  char *end = NULL;
   int options;
   int option_index;
 
   // Parse and apply command line options
-  while ((options = getopt_long(argc, argv, "a:i:o:w:fhpsv", longopts,
+  while ((options = getopt_long(argc, argv, "a:e:i:j:o:t:w:A:B:D:F:M:N:bfhpsvxCSTY", longopts,
                                 &option_index)) != -1)
   {
     switch (options)
@@ -88,6 +737,20 @@ int main(int argc, char **argv)
     case 'i':
       inPath = optarg;
       break;
+    case 'N':
+      errno = 0;
+      unsigned long nv = strtoul(optarg, &end, 0);
+
+      if (errno || *end != '\0' || nv < KMYTH_NV_SKI_FIRST ||
+          nv > KMYTH_NV_SKI_LAST)
+      {
+        kmyth_log(LOG_ERR, "invalid NV index (%s), must be 0x%08X to "
+                  "0x%08X ... exiting", optarg, KMYTH_NV_SKI_FIRST,
+                  KMYTH_NV_SKI_LAST);
+        return 1;
+      }
+      nvIndex = (uint32_t) nv;
+      break;
     case 'o':
       outPath = optarg;
       break;
@@ -103,6 +766,68 @@ int main(int argc, char **argv)
     case 's':
       stdout_flag = true;
       break;
+    case 'S':
+      streamMode = true;
+      break;
+    case 'A':
+      agentPath = optarg;
+      break;
+    case 't':
+      errno = 0;
+      agentTtl = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || agentTtl > UINT32_MAX)
+      {
+        kmyth_log(LOG_ERR, "invalid ttl (%s) ... exiting", optarg);
+        return 1;
+      }
+      break;
+    case 'x':
+      invalidate = true;
+      break;
+    case 'b':
+      batchMode = true;
+      break;
+    case 'M':
+      manifestPath = optarg;
+      batchMode = true;
+      break;
+    case 'B':
+      bootPath = optarg;
+      break;
+    case 'j':
+      errno = 0;
+      jobs = strtoul(optarg, &end, 10);
+      if (errno || *end != '\0' || jobs == 0 || jobs > KMYTH_MAX_JOBS)
+      {
+        kmyth_log(LOG_ERR, "invalid number of jobs (%s), must be 1 to %d "
+                  "... exiting", optarg, KMYTH_MAX_JOBS);
+        return 1;
+      }
+      break;
+    case 'C':
+      precheck = true;
+      break;
+    case 'D':
+      if (devices_len == KMYTH_POOL_MAX)
+      {
+        kmyth_log(LOG_ERR, "too many devices (at most %d) ... exiting",
+                  KMYTH_POOL_MAX);
+        return 1;
+      }
+      devices[devices_len++] = optarg;
+      break;
+    case 'T':
+      timingsOut = &timings;
+      break;
+    case 'Y':
+      syncOutput = true;
+      break;
+    case 'e':
+      execCommand = optarg;
+      break;
+    case 'F':
+      sendFdPath = optarg;
+      break;
     case 'h':
       usage(argv[0]);
       return 0;
@@ -116,8 +841,179 @@ int main(int argc, char **argv)
   size_t oa_passwd_len =
     (ownerAuthPasswd == NULL) ? 0 : strlen(ownerAuthPasswd);
 
+  if ((invalidate || agentTtl != 0) && agentPath == NULL)
+  {
+    kmyth_log(LOG_ERR, "-t and -x require -A ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+  if (nvIndex != 0 && (inPath != NULL || batchMode || bootPath != NULL ||
+                       streamMode || agentPath != NULL || optind < argc))
+  {
+    kmyth_log(LOG_ERR, "-N cannot be combined with -i, --batch, --boot, -S "
+              "or -A ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+  if (timingsOut != NULL && agentPath != NULL)
+  {
+    kmyth_log(LOG_ERR, "-T and -A cannot be combined ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+
+  // The output is handed off (-e or -F) in place of being written (-o or
+  // -s), and only a single, whole, output can be
+  bool handoff = (execCommand != NULL || sendFdPath != NULL);
+
+  if (execCommand != NULL && sendFdPath != NULL)
+  {
+    kmyth_log(LOG_ERR, "-e and -F cannot be combined ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+  if (handoff && (outPath != NULL || stdout_flag || batchMode || streamMode ||
+                  invalidate))
+  {
+    kmyth_log(LOG_ERR, "-e and -F cannot be combined with -o, -s, --batch, "
+              "-S or -x ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+  if ((devices_len > 0 && !batchMode && bootPath == NULL) ||
+      (devices_len > 1 && timingsOut != NULL))
+  {
+    kmyth_log(LOG_ERR, "-D requires --batch or --boot, and -T a single -D "
+              "... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+
+  // At boot, each key goes to the target its manifest entry names
+  if (bootPath != NULL)
+  {
+    int retval = 1;
+
+    if (batchMode || inPath != NULL || outPath != NULL || stdout_flag ||
+        streamMode || agentPath != NULL || handoff || optind < argc)
+    {
+      kmyth_log(LOG_ERR, "--boot cannot be combined with --batch, input "
+                "files, -o, -s, -S, -A, -e or -F ... exiting");
+    }
+    else
+    {
+      retval = unseal_boot(bootPath, (size_t) jobs, precheck, syncOutput,
+                           devices, devices_len,
+                           (uint8_t *) authString, auth_string_len,
+                           (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                           bool_policy_or, timingsOut);
+      if (timingsOut != NULL)
+      {
+        kmyth_timings_print(stderr, timingsOut);
+      }
+    }
+
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return retval;
+  }
+
+  // In batch mode, the files to be unsealed are the -i file (if any), those
+  // listed in the manifest (if any) and all remaining (non-option)
+  // arguments, and -o names the output directory
+  if (batchMode)
+  {
+    int retval = 1;
+    char **manifestPaths = NULL;
+    size_t manifestPaths_count = 0;
+    size_t inPaths_count = 0;
+    char **inPaths = NULL;
+
+    if (stdout_flag || streamMode || agentPath != NULL)
+    {
+      kmyth_log(LOG_ERR, "-s, -S and -A cannot be combined with --batch "
+                "... exiting");
+    }
+    else if (manifestPath == NULL ||
+             read_path_list(manifestPath, &manifestPaths,
+                            &manifestPaths_count) == 0)
+    {
+      inPaths = calloc((size_t) (argc - optind + 1) + manifestPaths_count,
+                       sizeof(char *));
+      if (inPaths == NULL)
+      {
+        kmyth_log(LOG_ERR, "unable to allocate batch input list ... exiting");
+      }
+    }
+
+    if (inPaths != NULL)
+    {
+      if (inPath != NULL)
+      {
+        inPaths[inPaths_count++] = inPath;
+      }
+      for (size_t i = 0; i < manifestPaths_count; i++)
+      {
+        inPaths[inPaths_count++] = manifestPaths[i];
+      }
+      for (int i = optind; i < argc; i++)
+      {
+        inPaths[inPaths_count++] = argv[i];
+      }
+
+      if (inPaths_count == 0)
+      {
+        kmyth_log(LOG_ERR, "no input (files to be unsealed) specified ... "
+                  "exiting");
+      }
+      else
+      {
+        retval = unseal_batch(inPaths, inPaths_count, outPath, forceOverwrite,
+                              (size_t) jobs, precheck, syncOutput,
+                              devices, devices_len,
+                              (uint8_t *) authString, auth_string_len,
+                              (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                              bool_policy_or, timingsOut);
+        if (timingsOut != NULL)
+        {
+          kmyth_timings_print(stderr, timingsOut);
+        }
+      }
+    }
+
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    free(inPaths);
+    free_path_list(manifestPaths, manifestPaths_count);
+    return retval;
+  }
+
+  // Invalidating the agent's cached copy of a file writes no output
+  if (invalidate)
+  {
+    uint8_t *unused = NULL;
+    size_t unused_length = 0;
+
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    if (inPath == NULL || unseal_agent(agentPath, inPath, "INVALIDATE\n",
+                                       &unused, &unused_length))
+    {
+      kmyth_log(LOG_ERR, "kmyth-unseal failed to invalidate ... exiting");
+      return 1;
+    }
+    return 0;
+  }
+
   // Check that input path (file to be sealed) was specified
-  if (inPath == NULL || (outPath == NULL && stdout_flag == false))
+  if ((inPath == NULL && nvIndex == 0) ||
+      (outPath == NULL && stdout_flag == false && !handoff))
   {
     kmyth_log(LOG_ERR,
               "Input file and output file (or stdout) must both be specified ... exiting");
@@ -125,7 +1021,7 @@ int main(int argc, char **argv)
     kmyth_clear(ownerAuthPasswd, oa_passwd_len);
     return 1;
   }
-  else
+  else if (inPath != NULL)
   {
     if (verifyInputFilePath(inPath))
     {
@@ -136,7 +1032,7 @@ int main(int argc, char **argv)
     }
   }
   // If output to be written to file - validate that path
-  if (stdout_flag == false)
+  if (stdout_flag == false && !handoff)
   {
     // Verify output path
     if (verifyOutputFilePath(outPath))
@@ -162,14 +1058,89 @@ int main(int argc, char **argv)
     }
   }
 
+  // Stream the unsealed data straight through to the output
+  if (streamMode && agentPath != NULL)
+  {
+    kmyth_log(LOG_ERR, "-S and -A cannot be combined ... exiting");
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return 1;
+  }
+  if (streamMode)
+  {
+    int retval = unseal_stream(inPath, stdout_flag ? NULL : outPath, precheck,
+                               (uint8_t *) authString, auth_string_len,
+                               (uint8_t *) ownerAuthPasswd, oa_passwd_len,
+                               bool_policy_or, timingsOut);
+
+    if (timingsOut != NULL)
+    {
+      kmyth_timings_print(stderr, timingsOut);
+    }
+    kmyth_clear(authString, auth_string_len);
+    kmyth_clear(ownerAuthPasswd, oa_passwd_len);
+    return retval;
+  }
+
   // Call top-level "kmyth-unseal" function
   uint8_t *output = NULL;
   size_t output_length = 0;
 
-  if (tpm2_kmyth_unseal_file(inPath, &output, &output_length,
-                             (uint8_t *) authString, auth_string_len,
-                             (uint8_t *) ownerAuthPasswd, oa_passwd_len,
-                             bool_policy_or))
+  // (an NV index is named, in the messages below, in place of a file)
+  char nvName[sizeof("NV index 0x00000000")];
+
+  if (nvIndex != 0)
+  {
+    snprintf(nvName, sizeof(nvName), "NV index 0x%08X", nvIndex);
+    inPath = nvName;
+  }
+
+  int retval = 0;
+
+  if (agentPath != NULL)
+  {
+    char request[KMYTH_AGENT_MAX_LINE_LEN];
+
+    snprintf(request, sizeof(request), "UNSEAL %lu %u\n", agentTtl,
+             (unsigned int) bool_policy_or);
+    retval = unseal_agent(agentPath, inPath, request, &output,
+                          &output_length);
+  }
+  else
+  {
+    kmyth_ctx_t *ctx = NULL;
+
+    retval = 1;
+    if (kmyth_ctx_create(&ctx) == 0 &&
+        kmyth_ctx_set_jobs(ctx, (size_t) jobs) == 0 &&
+        kmyth_ctx_set_policy_precheck(ctx, precheck) == 0 &&
+        (timingsOut == NULL || kmyth_ctx_set_timings(ctx, timingsOut) == 0))
+    {
+      if (nvIndex != 0)
+      {
+        retval = tpm2_kmyth_unseal_nv(ctx, nvIndex, &output, &output_length,
+                                      (uint8_t *) authString,
+                                      auth_string_len,
+                                      (uint8_t *) ownerAuthPasswd,
+                                      oa_passwd_len, bool_policy_or);
+      }
+      else
+      {
+        retval = tpm2_kmyth_unseal_file_ctx(ctx, inPath,
+                                            &output, &output_length,
+                                            (uint8_t *) authString,
+                                            auth_string_len,
+                                            (uint8_t *) ownerAuthPasswd,
+                                            oa_passwd_len, bool_policy_or);
+      }
+    }
+    kmyth_ctx_destroy(&ctx);
+    if (timingsOut != NULL)
+    {
+      kmyth_timings_print(stderr, timingsOut);
+    }
+  }
+  if (retval)
   {
     kmyth_clear_and_free(output, output_length);
     kmyth_log(LOG_ERR, "kmyth-unseal failed ... exiting");
@@ -181,6 +1152,30 @@ int main(int argc, char **argv)
   kmyth_clear(authString, auth_string_len);
   kmyth_clear(ownerAuthPasswd, oa_passwd_len);
 
+  if (handoff)
+  {
+    // the only copy of the output left is in the sealed memory file
+    int key_fd = -1;
+
+    retval = handoff_create_memfd("kmyth-unseal", output, output_length,
+                                  &key_fd);
+    kmyth_clear_and_free(output, output_length);
+    if (retval == 0)
+    {
+      retval = (execCommand != NULL) ? handoff_exec(key_fd, execCommand) :
+        handoff_send(key_fd, sendFdPath);
+      close(key_fd);
+    }
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "kmyth-unseal failed to hand off %s ... exiting",
+                inPath);
+      return 1;
+    }
+    kmyth_log(LOG_DEBUG, "handed off unsealed contents of %s", inPath);
+    return 0;
+  }
+
   if (stdout_flag == true)
   {
     if (print_to_stdout(output, output_length))
@@ -190,7 +1185,8 @@ int main(int argc, char **argv)
   }
   else
   {
-    if (write_bytes_to_file(outPath, output, output_length))
+    if (write_bytes_to_file_atomic(outPath, output, output_length,
+                                   syncOutput))
     {
       kmyth_log(LOG_ERR, "Error writing file: %s", outPath);
     }
@@ -0,0 +1,678 @@
+/**
+ * endpoint_util.c:
+ *
+ * C library for getting a response from any one of several replicated
+ * servers, with failover, hedging and latency based ordering
+ */
+
+#include "endpoint_util.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "defines.h"
+
+#include "alloc_stats.h"
+
+// The states of one request made by endpoint_fetch()
+typedef enum endpoint_attempt_state
+{
+  ENDPOINT_ATTEMPT_UNUSED = 0,
+  ENDPOINT_ATTEMPT_RUNNING,
+  ENDPOINT_ATTEMPT_FAILED,
+  ENDPOINT_ATTEMPT_DONE
+} endpoint_attempt_state;
+
+struct endpoint_run;
+
+// One request made by endpoint_fetch(), to the endpoint at index
+typedef struct endpoint_attempt
+{
+  struct endpoint_run *run;
+  size_t index;
+  char *address;
+  endpoint_attempt_state state;
+  struct timespec start;
+  uint64_t latency_us;
+  void *result;
+} endpoint_attempt;
+
+// The requests of one endpoint_fetch() call. It is shared with the threads
+// running them, and freed by whichever (of them or the caller) is last.
+typedef struct endpoint_run
+{
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  endpoint_fetch_fn fetch;
+  endpoint_free_fn result_free;
+  void *arg;
+  endpoint_free_fn arg_free;
+  endpoint_attempt attempts[ENDPOINT_MAX_COUNT];
+  bool finished;
+  size_t refs;
+} endpoint_run;
+
+//############################################################################
+// elapsed_us()
+//############################################################################
+static uint64_t elapsed_us(const struct timespec *since)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  int64_t us = (int64_t) (now.tv_sec - since->tv_sec) * 1000000 +
+    (now.tv_nsec - since->tv_nsec) / 1000;
+
+  return (us < 0) ? 0 : (uint64_t) us;
+}
+
+//############################################################################
+// endpoint_set_init()
+//############################################################################
+void endpoint_set_init(endpoint_set * set)
+{
+  memset(set, 0, sizeof(endpoint_set));
+}
+
+//############################################################################
+// endpoint_set_free()
+//############################################################################
+void endpoint_set_free(endpoint_set * set)
+{
+  for (size_t i = 0; i < set->count; i++)
+  {
+    free(set->addresses[i]);
+  }
+  endpoint_set_init(set);
+}
+
+//############################################################################
+// endpoint_set_add()
+//############################################################################
+int endpoint_set_add(endpoint_set * set, const char *list)
+{
+  char *copy = (list == NULL) ? NULL : strdup(list);
+
+  if (copy == NULL)
+  {
+    kmyth_log(LOG_ERR, "no endpoint addresses ... exiting");
+    return 1;
+  }
+
+  // (strsep(), unlike strtok(), keeps the empty addresses of ",," so that
+  // they can be rejected)
+  char *rest = copy;
+  char *address = NULL;
+  int retval = 0;
+
+  while (retval == 0 && (address = strsep(&rest, ",")) != NULL)
+  {
+    bool duplicate = false;
+
+    for (size_t i = 0; i < set->count; i++)
+    {
+      duplicate = duplicate || (strcmp(set->addresses[i], address) == 0);
+    }
+    if (address[0] == '\0')
+    {
+      kmyth_log(LOG_ERR, "empty endpoint address in: %s ... exiting", list);
+      retval = 1;
+    }
+    else if (duplicate)
+    {
+      kmyth_log(LOG_DEBUG, "endpoint %s already listed", address);
+    }
+    else if (set->count == ENDPOINT_MAX_COUNT)
+    {
+      kmyth_log(LOG_ERR, "too many endpoints (maximum %d) ... exiting",
+                ENDPOINT_MAX_COUNT);
+      retval = 1;
+    }
+    else if ((set->addresses[set->count] = strdup(address)) == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate endpoint address ... exiting");
+      retval = 1;
+    }
+    else
+    {
+      memset(&set->stats[set->count], 0, sizeof(endpoint_stats));
+      set->count++;
+    }
+  }
+
+  free(copy);
+  return retval;
+}
+
+//############################################################################
+// endpoint_record()
+//############################################################################
+void endpoint_record(endpoint_set * set, size_t index, bool success,
+                     uint64_t latency_us)
+{
+  endpoint_stats *stats = &set->stats[index];
+
+  if (!success)
+  {
+    if (stats->failures < UINT_MAX)
+    {
+      stats->failures++;
+    }
+    return;
+  }
+
+  stats->samples[stats->sample_count % ENDPOINT_LATENCY_SAMPLES] =
+    (latency_us > UINT32_MAX) ? UINT32_MAX : (uint32_t) latency_us;
+  stats->sample_count++;
+  stats->failures = 0;
+}
+
+//############################################################################
+// compare_samples()
+//############################################################################
+static int compare_samples(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a;
+  uint32_t y = *(const uint32_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+//############################################################################
+// endpoint_latency()
+//############################################################################
+uint64_t endpoint_latency(const endpoint_stats * stats,
+                          unsigned int percentile)
+{
+  size_t count = (stats->sample_count < ENDPOINT_LATENCY_SAMPLES) ?
+    stats->sample_count : ENDPOINT_LATENCY_SAMPLES;
+
+  if (count == 0)
+  {
+    return 0;
+  }
+  if (percentile > 100)
+  {
+    percentile = 100;
+  }
+
+  uint32_t sorted[ENDPOINT_LATENCY_SAMPLES];
+
+  memcpy(sorted, stats->samples, count * sizeof(uint32_t));
+  qsort(sorted, count, sizeof(uint32_t), compare_samples);
+
+  // (the nearest-rank percentile)
+  size_t rank = (percentile * count + 99) / 100;
+
+  return sorted[(rank == 0) ? 0 : rank - 1];
+}
+
+//############################################################################
+// endpoint_order()
+//############################################################################
+void endpoint_order(const endpoint_set * set, size_t *order)
+{
+  uint64_t p95[ENDPOINT_MAX_COUNT];
+
+  for (size_t i = 0; i < set->count; i++)
+  {
+    p95[i] = endpoint_latency(&set->stats[i], 95);
+    order[i] = i;
+  }
+
+  // (an insertion sort - stable, and the sets are small)
+  for (size_t i = 1; i < set->count; i++)
+  {
+    size_t index = order[i];
+    size_t j = i;
+
+    while (j > 0)
+    {
+      size_t prev = order[j - 1];
+
+      if (set->stats[prev].failures < set->stats[index].failures ||
+          (set->stats[prev].failures == set->stats[index].failures &&
+           p95[prev] <= p95[index]))
+      {
+        break;
+      }
+      order[j] = prev;
+      j--;
+    }
+    order[j] = index;
+  }
+}
+
+//############################################################################
+// endpoint_stats_load()
+//############################################################################
+int endpoint_stats_load(endpoint_set * set, const char *path)
+{
+  FILE *file = fopen(path, "r");
+
+  if (file == NULL)
+  {
+    kmyth_log(LOG_DEBUG, "no endpoint statistics in %s", path);
+    return 1;
+  }
+
+  // each line is an address, its consecutive failures and its number of
+  // samples, then the samples (oldest first)
+  char *line = NULL;
+  size_t line_size = 0;
+
+  while (getline(&line, &line_size, file) != -1)
+  {
+    char *rest = line;
+    char *address = strsep(&rest, " ");
+    char *end = NULL;
+
+    if (line[0] == '#' || rest == NULL)
+    {
+      continue;
+    }
+
+    size_t index = 0;
+
+    while (index < set->count && strcmp(set->addresses[index], address) != 0)
+    {
+      index++;
+    }
+    if (index == set->count)
+    {
+      continue;
+    }
+
+    endpoint_stats *stats = &set->stats[index];
+    unsigned long failures = strtoul(rest, &end, 10);
+    unsigned long count = strtoul(end, &end, 10);
+
+    memset(stats, 0, sizeof(endpoint_stats));
+    for (unsigned long i = 0; i < count && i < ENDPOINT_LATENCY_SAMPLES; i++)
+    {
+      endpoint_record(set, index, true, strtoul(end, &end, 10));
+    }
+    stats->failures = (failures > UINT_MAX) ?
+      UINT_MAX : (unsigned int) failures;
+  }
+
+  // (getline() allocates the line with the C library's allocator)
+  (free) (line);
+  fclose(file);
+  return 0;
+}
+
+//############################################################################
+// endpoint_stats_save()
+//############################################################################
+int endpoint_stats_save(const endpoint_set * set, const char *path)
+{
+  char *temp_path = NULL;
+
+  if (asprintf(&temp_path, "%s.XXXXXX", path) < 0)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate statistics file path ... exiting");
+    return 1;
+  }
+
+  int fd = mkstemp(temp_path);
+  FILE *file = (fd < 0) ? NULL : fdopen(fd, "w");
+
+  if (file == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to create %s: %s ... exiting", temp_path,
+              strerror(errno));
+    if (fd >= 0)
+    {
+      close(fd);
+      unlink(temp_path);
+    }
+    free(temp_path);
+    return 1;
+  }
+
+  int written = fprintf(file, "# address failures samples "
+                        "latency_us...\n");
+
+  for (size_t i = 0; written >= 0 && i < set->count; i++)
+  {
+    const endpoint_stats *stats = &set->stats[i];
+    size_t count = (stats->sample_count < ENDPOINT_LATENCY_SAMPLES) ?
+      stats->sample_count : ENDPOINT_LATENCY_SAMPLES;
+    size_t oldest = stats->sample_count - count;
+
+    written = fprintf(file, "%s %u %zu", set->addresses[i], stats->failures,
+                      count);
+    for (size_t j = 0; written >= 0 && j < count; j++)
+    {
+      written = fprintf(file, " %u", stats->samples[(oldest + j) %
+                                                    ENDPOINT_LATENCY_SAMPLES]);
+    }
+    if (written >= 0)
+    {
+      written = fprintf(file, "\n");
+    }
+  }
+
+  int retval = (written < 0 || fflush(file) != 0 || fsync(fd) != 0);
+
+  if (fclose(file) != 0 || retval || rename(temp_path, path) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to save endpoint statistics to %s ... "
+              "exiting", path);
+    unlink(temp_path);
+    retval = 1;
+  }
+
+  free(temp_path);
+  return retval;
+}
+
+//############################################################################
+// endpoint_run_release()
+//############################################################################
+static void endpoint_run_release(endpoint_run * run)
+{
+  // (called with the run locked)
+  bool last = (--run->refs == 0);
+
+  pthread_mutex_unlock(&run->lock);
+  if (!last)
+  {
+    return;
+  }
+
+  for (size_t i = 0; i < ENDPOINT_MAX_COUNT; i++)
+  {
+    free(run->attempts[i].address);
+  }
+  if (run->arg_free != NULL)
+  {
+    run->arg_free(run->arg);
+  }
+  pthread_cond_destroy(&run->changed);
+  pthread_mutex_destroy(&run->lock);
+  free(run);
+}
+
+//############################################################################
+// endpoint_attempt_run()
+//############################################################################
+static void *endpoint_attempt_run(void *attempt_arg)
+{
+  endpoint_attempt *attempt = (endpoint_attempt *) attempt_arg;
+  endpoint_run *run = attempt->run;
+  void *result = NULL;
+  int retval = run->fetch(attempt->address, run->arg, &result);
+
+  pthread_mutex_lock(&run->lock);
+  attempt->latency_us = elapsed_us(&attempt->start);
+  attempt->state = retval ? ENDPOINT_ATTEMPT_FAILED : ENDPOINT_ATTEMPT_DONE;
+  if (retval == 0 && run->finished)
+  {
+    // another endpoint has already answered
+    run->result_free(result);
+  }
+  else if (retval == 0)
+  {
+    attempt->result = result;
+  }
+  pthread_cond_signal(&run->changed);
+  endpoint_run_release(run);
+
+  return NULL;
+}
+
+//############################################################################
+// endpoint_attempt_start()
+//############################################################################
+static int endpoint_attempt_start(endpoint_run * run,
+                                  const endpoint_set * set, size_t index)
+{
+  // (called with the run locked)
+  endpoint_attempt *attempt = &run->attempts[index];
+  pthread_t thread;
+
+  attempt->run = run;
+  attempt->index = index;
+  attempt->address = strdup(set->addresses[index]);
+  attempt->state = ENDPOINT_ATTEMPT_FAILED;
+  clock_gettime(CLOCK_MONOTONIC, &attempt->start);
+  if (attempt->address == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate endpoint address");
+    return 1;
+  }
+
+  attempt->state = ENDPOINT_ATTEMPT_RUNNING;
+  run->refs++;
+  if (pthread_create(&thread, NULL, endpoint_attempt_run, attempt) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to start request to %s", attempt->address);
+    attempt->state = ENDPOINT_ATTEMPT_FAILED;
+    run->refs--;
+    return 1;
+  }
+  pthread_detach(thread);
+
+  return 0;
+}
+
+//############################################################################
+// hedge_deadline()
+//############################################################################
+static void hedge_deadline(const endpoint_set * set,
+                           const endpoint_policy * policy, size_t index,
+                           struct timespec *deadline)
+{
+  uint64_t delay_us = (uint64_t) ENDPOINT_HEDGE_DEFAULT_MS * 1000;
+
+  if (policy->hedge_delay_ms > 0)
+  {
+    delay_us = (uint64_t) policy->hedge_delay_ms * 1000;
+  }
+  else if (set->stats[index].sample_count >= ENDPOINT_HEDGE_MIN_SAMPLES)
+  {
+    delay_us = endpoint_latency(&set->stats[index], 95);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+  deadline->tv_sec += (time_t) (delay_us / 1000000);
+  deadline->tv_nsec += (long) (delay_us % 1000000) * 1000;
+  if (deadline->tv_nsec >= 1000000000)
+  {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000;
+  }
+}
+
+//############################################################################
+// endpoint_fetch()
+//############################################################################
+int endpoint_fetch(endpoint_set * set, const endpoint_policy * policy,
+                   endpoint_fetch_fn fetch, endpoint_free_fn result_free,
+                   void *arg, endpoint_free_fn arg_free, void **result,
+                   size_t *index)
+{
+  // A single endpoint is simply asked, on this thread.
+  if (set != NULL && set->count == 1 && fetch != NULL && result != NULL)
+  {
+    char *address = strdup(set->addresses[0]);
+    struct timespec start;
+    int retval = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *result = NULL;
+    if (address != NULL)
+    {
+      retval = fetch(address, arg, result);
+    }
+    endpoint_record(set, 0, (retval == 0), elapsed_us(&start));
+    if (retval == 0 && index != NULL)
+    {
+      *index = 0;
+    }
+    free(address);
+    if (arg_free != NULL)
+    {
+      arg_free(arg);
+    }
+    return retval;
+  }
+
+  endpoint_run *run = (set == NULL || set->count == 0 || fetch == NULL ||
+                       result_free == NULL || result == NULL) ? NULL :
+    calloc(1, sizeof(endpoint_run));
+
+  if (run == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid endpoint request ... exiting");
+    if (arg_free != NULL)
+    {
+      arg_free(arg);
+    }
+    return 1;
+  }
+  *result = NULL;
+
+  pthread_condattr_t cond_attr;
+
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&run->changed, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+  pthread_mutex_init(&run->lock, NULL);
+  run->fetch = fetch;
+  run->result_free = result_free;
+  run->arg = arg;
+  run->arg_free = arg_free;
+  run->refs = 1;
+
+  size_t order[ENDPOINT_MAX_COUNT];
+  size_t next = 0;
+  bool can_hedge = (policy != NULL && policy->hedge);
+  struct timespec hedge_at = { 0 };
+  endpoint_attempt *winner = NULL;
+
+  endpoint_order(set, order);
+  pthread_mutex_lock(&run->lock);
+  while (winner == NULL)
+  {
+    size_t running = 0;
+
+    for (size_t i = 0; i < set->count; i++)
+    {
+      endpoint_attempt *attempt = &run->attempts[i];
+
+      if (attempt->state == ENDPOINT_ATTEMPT_DONE && winner == NULL)
+      {
+        winner = attempt;
+      }
+      running += (attempt->state == ENDPOINT_ATTEMPT_RUNNING);
+    }
+    if (winner != NULL)
+    {
+      break;
+    }
+
+    if (running == 0)
+    {
+      // fail over to the next endpoint (the hedging delay restarting with
+      // it)
+      if (next == set->count)
+      {
+        break;
+      }
+      if (next > 0)
+      {
+        kmyth_log(LOG_DEBUG, "failing over to %s",
+                  set->addresses[order[next]]);
+      }
+      if (endpoint_attempt_start(run, set, order[next]) == 0 && can_hedge)
+      {
+        hedge_deadline(set, policy, order[next], &hedge_at);
+      }
+      next++;
+      continue;
+    }
+
+    if (can_hedge && next < set->count)
+    {
+      if (pthread_cond_timedwait(&run->changed, &run->lock, &hedge_at) ==
+          ETIMEDOUT)
+      {
+        // a single hedging request, so that a slow period does not
+        // multiply the load on every endpoint
+        kmyth_log(LOG_DEBUG, "hedging request with %s",
+                  set->addresses[order[next]]);
+        endpoint_attempt_start(run, set, order[next]);
+        next++;
+        can_hedge = false;
+      }
+    }
+    else
+    {
+      pthread_cond_wait(&run->changed, &run->lock);
+    }
+  }
+  run->finished = true;
+
+  // A request still running when another was answered is recorded as
+  // taking (at least) as long as it has so far, so that a stalled
+  // endpoint falls behind.
+  for (size_t i = 0; i < set->count; i++)
+  {
+    endpoint_attempt *attempt = &run->attempts[i];
+
+    switch (attempt->state)
+    {
+    case ENDPOINT_ATTEMPT_RUNNING:
+      endpoint_record(set, i, true, elapsed_us(&attempt->start));
+      break;
+    case ENDPOINT_ATTEMPT_DONE:
+      endpoint_record(set, i, true, attempt->latency_us);
+      if (attempt != winner)
+      {
+        run->result_free(attempt->result);
+        attempt->result = NULL;
+      }
+      break;
+    case ENDPOINT_ATTEMPT_FAILED:
+      endpoint_record(set, i, false, 0);
+      break;
+    default:
+      break;
+    }
+  }
+
+  int retval = 1;
+
+  if (winner != NULL)
+  {
+    kmyth_log(LOG_DEBUG, "response from %s in %lu us",
+              set->addresses[winner->index],
+              (unsigned long) winner->latency_us);
+    *result = winner->result;
+    winner->result = NULL;
+    if (index != NULL)
+    {
+      *index = winner->index;
+    }
+    retval = 0;
+  }
+  else
+  {
+    kmyth_log(LOG_ERR, "no endpoint answered (of %zu) ... exiting",
+              set->count);
+  }
+  endpoint_run_release(run);
+
+  return retval;
+}
@@ -1,21 +1,471 @@
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "defines.h"
+#include "socket_util.h"
+
+//
+// socket_options_init()
+//
+void socket_options_init(socket_options * opts)
+{
+  memset(opts, 0, sizeof(socket_options));
+}
+
+//
+// parse_option_int()
+//
+static int parse_option_int(const char *value, char **end, int *result)
+{
+  errno = 0;
+
+  long parsed = strtol(value, end, 10);
+
+  if (errno || *end == value || parsed < 0 || parsed > INT_MAX)
+  {
+    return 1;
+  }
+  *result = (int) parsed;
+
+  return 0;
+}
+
+//
+// parse_socket_option()
+//
+int parse_socket_option(const char *spec, socket_options * opts)
+{
+  const char *value = strchr(spec, '=');
+  size_t name_len = (value == NULL) ? strlen(spec) : (size_t) (value - spec);
+  char *end = NULL;
+  int result = 0;
+
+  // opts is only updated if the whole option is valid
+  socket_options parsed = *opts;
+
+  if (value != NULL)
+  {
+    value++;
+  }
+
+  if (name_len == strlen("nodelay") && !strncmp(spec, "nodelay", name_len) &&
+      value == NULL)
+  {
+    parsed.nodelay = true;
+  }
+  else if (name_len == strlen("reuseport") &&
+           !strncmp(spec, "reuseport", name_len) && value == NULL)
+  {
+    parsed.reuseport = true;
+  }
+  else if (name_len == strlen("fastopen") &&
+           !strncmp(spec, "fastopen", name_len))
+  {
+    // the queue length only matters to a server
+    parsed.fastopen = 16;
+    if (value != NULL)
+    {
+      result = parse_option_int(value, &end, &parsed.fastopen) || *end != '\0'
+        || parsed.fastopen == 0;
+    }
+  }
+  else if (name_len == strlen("keepalive") &&
+           !strncmp(spec, "keepalive", name_len) && value != NULL)
+  {
+    parsed.keepalive_interval = 0;
+    parsed.keepalive_count = 0;
+    result = parse_option_int(value, &end, &parsed.keepalive_idle) ||
+      parsed.keepalive_idle == 0;
+    if (!result && *end == ',')
+    {
+      result = parse_option_int(end + 1, &end, &parsed.keepalive_interval);
+      if (!result && *end == ',')
+      {
+        result = parse_option_int(end + 1, &end, &parsed.keepalive_count);
+      }
+    }
+    result = result || *end != '\0';
+  }
+  else if (name_len == strlen("connect-timeout") &&
+           !strncmp(spec, "connect-timeout", name_len) && value != NULL)
+  {
+    result = parse_option_int(value, &end, &parsed.connect_timeout_ms) ||
+      *end != '\0';
+  }
+  else if (name_len == strlen("connect-stagger") &&
+           !strncmp(spec, "connect-stagger", name_len) && value != NULL)
+  {
+    result = parse_option_int(value, &end, &parsed.connect_stagger_ms) ||
+      *end != '\0';
+  }
+  else if (name_len == strlen("io-timeout") &&
+           !strncmp(spec, "io-timeout", name_len) && value != NULL)
+  {
+    result = parse_option_int(value, &end, &parsed.io_timeout_ms) ||
+      *end != '\0';
+  }
+  else
+  {
+    result = 1;
+  }
+
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Invalid socket option: %s", spec);
+    return 1;
+  }
+  *opts = parsed;
+
+  return 0;
+}
+
+//
+// apply_socket_options()
+//
+int apply_socket_options(int socket_fd, const socket_options * opts)
+{
+  int optval = 1;
+
+  if (opts == NULL)
+  {
+    return 0;
+  }
+
+  if (opts->nodelay &&
+      setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &optval,
+                 sizeof(optval)))
+  {
+    kmyth_log(LOG_ERR, "Failed to set TCP_NODELAY: %s", strerror(errno));
+    return 1;
+  }
+
+  if (opts->keepalive_idle > 0)
+  {
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_KEEPALIVE, &optval,
+                   sizeof(optval)) ||
+        setsockopt(socket_fd, IPPROTO_TCP, TCP_KEEPIDLE,
+                   &opts->keepalive_idle, sizeof(int)) ||
+        (opts->keepalive_interval > 0 &&
+         setsockopt(socket_fd, IPPROTO_TCP, TCP_KEEPINTVL,
+                    &opts->keepalive_interval, sizeof(int))) ||
+        (opts->keepalive_count > 0 &&
+         setsockopt(socket_fd, IPPROTO_TCP, TCP_KEEPCNT,
+                    &opts->keepalive_count, sizeof(int))))
+    {
+      kmyth_log(LOG_ERR, "Failed to set up keepalive: %s", strerror(errno));
+      return 1;
+    }
+  }
+
+  if ((opts->io_timeout_ms > 0 || opts->deadline_ns != 0) &&
+      socket_arm_deadline(socket_fd, opts))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// time_left_us()
+//
+static uint64_t time_left_us(uint64_t deadline_ns)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  uint64_t now_ns = (uint64_t) now.tv_sec * 1000000000ULL +
+    (uint64_t) now.tv_nsec;
+
+  return (now_ns >= deadline_ns) ? 0 : (deadline_ns - now_ns + 999) / 1000;
+}
+
+//
+// socket_arm_deadline()
+//
+int socket_arm_deadline(int socket_fd, const socket_options * opts)
+{
+  uint64_t timeout_us = (opts->io_timeout_ms > 0) ?
+    (uint64_t) opts->io_timeout_ms * 1000 : 0;
+
+  if (opts->deadline_ns != 0)
+  {
+    uint64_t left_us = time_left_us(opts->deadline_ns);
+
+    if (left_us == 0)
+    {
+      kmyth_log(LOG_ERR, "Deadline passed");
+      errno = ETIMEDOUT;
+      return 1;
+    }
+    if (timeout_us == 0 || left_us < timeout_us)
+    {
+      timeout_us = left_us;
+    }
+  }
+
+  // (a zero timeout is none at all)
+  struct timeval timeout = {
+    .tv_sec = (time_t) (timeout_us / 1000000),
+    .tv_usec = (suseconds_t) (timeout_us % 1000000)
+  };
+
+  if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                 sizeof(timeout)) ||
+      setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                 sizeof(timeout)))
+  {
+    kmyth_log(LOG_ERR, "Failed to set the I/O timeout: %s", strerror(errno));
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// elapsed_ms()
+//
+static long elapsed_ms(const struct timespec *since)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (long) (now.tv_sec - since->tv_sec) * 1000 +
+    (long) (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+//
+// start_connect()
+//
+static int start_connect(const struct addrinfo *addr,
+                         const socket_options * opts, int *socket_fd,
+                         bool *connected)
+{
+  *connected = false;
+  *socket_fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK,
+                      addr->ai_protocol);
+  if (*socket_fd == -1)
+  {
+    return 1;
+  }
+#ifdef TCP_FASTOPEN_CONNECT
+  if (opts != NULL && opts->fastopen > 0)
+  {
+    // The first data sent (e.g., the first handshake message) goes with
+    // the connection request, where the server allows it.
+    int optval = 1;
+
+    if (setsockopt(*socket_fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+                   &optval, sizeof(optval)))
+    {
+      kmyth_log(LOG_WARNING, "TCP Fast Open is unavailable: %s",
+                strerror(errno));
+    }
+  }
+#endif
+  if (apply_socket_options(*socket_fd, opts) == 0)
+  {
+    if (connect(*socket_fd, addr->ai_addr, addr->ai_addrlen) == 0)
+    {
+      *connected = true;
+      return 0;
+    }
+    if (errno == EINPROGRESS)
+    {
+      return 0;
+    }
+  }
+  close(*socket_fd);
+  *socket_fd = -1;
+
+  return 1;
+}
+
+//
+// connect_first()
+//
+static int connect_first(const struct addrinfo *addrs,
+                         const socket_options * opts, int *socket_fd)
+{
+  int stagger_ms = (opts != NULL && opts->connect_stagger_ms > 0) ?
+    opts->connect_stagger_ms : SOCKET_CONNECT_STAGGER_DEFAULT_MS;
+  int deadline_ms = (opts != NULL) ? opts->connect_timeout_ms : 0;
+
+  // the connect timeout is cut short by the deadline, if that is sooner
+  if (opts != NULL && opts->deadline_ns != 0)
+  {
+    uint64_t left_ms = (time_left_us(opts->deadline_ns) + 999) / 1000;
+
+    if (left_ms == 0)
+    {
+      *socket_fd = -1;
+      errno = ETIMEDOUT;
+      return 1;
+    }
+    if (left_ms < INT_MAX &&
+        (deadline_ms == 0 || left_ms < (uint64_t) deadline_ms))
+    {
+      deadline_ms = (int) left_ms;
+    }
+  }
+
+  struct pollfd pending[SOCKET_CONNECT_MAX_ATTEMPTS];
+  nfds_t pending_count = 0;
+  const struct addrinfo *next = addrs;
+  struct timespec started;
+  long last_start_ms = 0;
+
+  *socket_fd = -1;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+
+  // Connections to the addresses are started in turn, each a stagger after
+  // the last (or as soon as all earlier ones have failed), and the first
+  // to be established is used - so an unreachable address only costs the
+  // stagger, not the system's whole connect timeout.
+  while (*socket_fd == -1)
+  {
+    long now_ms = elapsed_ms(&started);
+
+    if (deadline_ms > 0 && now_ms >= deadline_ms)
+    {
+      errno = ETIMEDOUT;
+      break;
+    }
+
+    if (next != NULL && pending_count < SOCKET_CONNECT_MAX_ATTEMPTS &&
+        (pending_count == 0 || now_ms - last_start_ms >= stagger_ms))
+    {
+      int fd = -1;
+      bool connected = false;
+
+      last_start_ms = now_ms;
+      if (start_connect(next, opts, &fd, &connected))
+      {
+        // a failure to start lets the next attempt start straight away
+        last_start_ms = now_ms - stagger_ms;
+      }
+      else
+      {
+        if (connected)
+        {
+          *socket_fd = fd;
+          break;
+        }
+        pending[pending_count].fd = fd;
+        pending[pending_count].events = POLLOUT;
+        pending[pending_count].revents = 0;
+        pending_count++;
+      }
+      next = next->ai_next;
+      continue;
+    }
+    if (pending_count == 0)
+    {
+      // every address has been tried, and has failed
+      break;
+    }
+
+    // Wait for a pending connection, but no later than the next attempt is
+    // due to start (or the deadline passes).
+    int timeout_ms = -1;
+
+    if (next != NULL && pending_count < SOCKET_CONNECT_MAX_ATTEMPTS)
+    {
+      timeout_ms = (int) (last_start_ms + stagger_ms - now_ms);
+    }
+    if (deadline_ms > 0 &&
+        (timeout_ms < 0 || deadline_ms - now_ms < timeout_ms))
+    {
+      timeout_ms = (int) (deadline_ms - now_ms);
+    }
+    if (poll(pending, pending_count, (timeout_ms < 0) ? -1 : timeout_ms) ==
+        -1 && errno != EINTR)
+    {
+      break;
+    }
+
+    for (nfds_t i = 0; i < pending_count && *socket_fd == -1;)
+    {
+      if (pending[i].revents == 0)
+      {
+        i++;
+        continue;
+      }
+
+      int error = 0;
+      socklen_t error_len = sizeof(error);
+
+      if (getsockopt(pending[i].fd, SOL_SOCKET, SO_ERROR, &error,
+                     &error_len) == 0 && error == 0)
+      {
+        *socket_fd = pending[i].fd;
+      }
+      else
+      {
+        close(pending[i].fd);
+        last_start_ms = elapsed_ms(&started) - stagger_ms;
+      }
+      pending[i] = pending[--pending_count];
+    }
+  }
+
+  for (nfds_t i = 0; i < pending_count; i++)
+  {
+    close(pending[i].fd);
+  }
+  if (*socket_fd == -1)
+  {
+    return 1;
+  }
+
+  // The connection is used with blocking I/O.
+  int flags = fcntl(*socket_fd, F_GETFL, 0);
+
+  if (flags == -1 || fcntl(*socket_fd, F_SETFL, flags & ~O_NONBLOCK) == -1)
+  {
+    close(*socket_fd);
+    *socket_fd = -1;
+    return 1;
+  }
+
+  return 0;
+}
 
 //
 // setup_client_socket()
 //
 int setup_client_socket(const char *node, const char *service, int *socket_fd)
+{
+  return setup_client_socket_opts(node, service, NULL, socket_fd);
+}
+
+//
+// setup_client_socket_opts()
+//
+int setup_client_socket_opts(const char *node, const char *service,
+                             const socket_options * opts, int *socket_fd)
 {
   // Setup socket settings and lookup the target Internet address.
   *socket_fd = -1;
 
   struct addrinfo hints = { 0 };
   struct addrinfo *result = NULL;
-  struct addrinfo *rp = NULL;
 
   hints.ai_family = AF_INET;
   hints.ai_socktype = SOCK_STREAM;
@@ -31,27 +481,12 @@ int setup_client_socket(const char *node, const char *service, int *socket_fd)
     return 1;
   }
 
-  // Scan through the set of possible Internet addresses until we find the
-  // right one.
-  for (rp = result; rp != NULL; rp = rp->ai_next)
-  {
-    *socket_fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-    if (*socket_fd == -1)
-    {
-      // Socket creation failed, try the next address.
-      continue;
-    }
-    if (connect(*socket_fd, rp->ai_addr, rp->ai_addrlen) != -1)
-    {
-      // Socket connection succeeded, use this socket.
-      break;
-    }
-    close(*socket_fd);
-  }
+  // Connect to whichever of the possible Internet addresses answers first.
+  int connect_result = connect_first(result, opts, socket_fd);
 
   // Cleanup address information and handle errors.
   freeaddrinfo(result);
-  if (rp == NULL)
+  if (connect_result)
   {
     kmyth_log(LOG_ERR, "Failed to establish socket connection.");
     return 1;
@@ -64,6 +499,15 @@ int setup_client_socket(const char *node, const char *service, int *socket_fd)
 // setup_server_socket()
 //
 int setup_server_socket(const char *service, int *socket_fd)
+{
+  return setup_server_socket_opts(service, NULL, socket_fd);
+}
+
+//
+// setup_server_socket_opts()
+//
+int setup_server_socket_opts(const char *service, const socket_options * opts,
+                             int *socket_fd)
 {
   struct addrinfo hints = { 0 };
   struct addrinfo *result = NULL;
@@ -103,12 +547,29 @@ int setup_server_socket(const char *service, int *socket_fd)
 
     // Avoid bind errors when reusing a port soon after closing it.
     if (setsockopt(*socket_fd, SOL_SOCKET, SO_REUSEADDR,
-                   &optval, sizeof(optval)))
+                   &optval, sizeof(optval)) ||
+        (opts != NULL && opts->reuseport &&
+         setsockopt(*socket_fd, SOL_SOCKET, SO_REUSEPORT,
+                    &optval, sizeof(optval))) ||
+        apply_socket_options(*socket_fd, opts))
     {
       kmyth_log(LOG_ERR, "setsockopt error");
+      close(*socket_fd);
+      *socket_fd = -1;
+      freeaddrinfo(result);
       return 1;
     }
 
+    // A Fast Open queue lets clients send their first message with the
+    // connection request.
+    if (opts != NULL && opts->fastopen > 0 &&
+        setsockopt(*socket_fd, IPPROTO_TCP, TCP_FASTOPEN,
+                   &opts->fastopen, sizeof(int)))
+    {
+      kmyth_log(LOG_WARNING, "TCP Fast Open is unavailable: %s",
+                strerror(errno));
+    }
+
     if (bind(*socket_fd, rp->ai_addr, rp->ai_addrlen) == 0)
     {
       // Socket successfully bound, use this socket.
@@ -122,6 +583,110 @@ int setup_server_socket(const char *service, int *socket_fd)
   if (rp == NULL)
   {
     kmyth_log(LOG_ERR, "Failed to establish bind socket.");
+    *socket_fd = -1;
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// setup_unix_address()
+//
+static int setup_unix_address(const char *path, struct sockaddr_un *addr)
+{
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+
+  if (path == NULL || strlen(path) == 0 ||
+      strlen(path) >= sizeof(addr->sun_path))
+  {
+    kmyth_log(LOG_ERR, "Invalid UNIX domain socket path.");
+    return 1;
+  }
+  memcpy(addr->sun_path, path, strlen(path));
+
+  return 0;
+}
+
+//
+// setup_unix_server_socket()
+//
+int setup_unix_server_socket(const char *path, mode_t mode, int *socket_fd)
+{
+  struct sockaddr_un addr;
+  struct stat st = { 0 };
+
+  *socket_fd = -1;
+
+  if (setup_unix_address(path, &addr))
+  {
+    return 1;
+  }
+
+  // Replace a socket left behind by an earlier server, but nothing else.
+  if (lstat(path, &st) == 0)
+  {
+    if (!S_ISSOCK(st.st_mode) || unlink(path))
+    {
+      kmyth_log(LOG_ERR, "Socket path (%s) is in use.", path);
+      return 1;
+    }
+  }
+
+  *socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (*socket_fd == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to create UNIX domain socket: %s",
+              strerror(errno));
+    return 1;
+  }
+
+  // Restrict the socket file permissions from the moment it is created.
+  mode_t old_umask = umask((mode_t) (~mode & 0777));
+  int bound = bind(*socket_fd, (struct sockaddr *) &addr, sizeof(addr));
+
+  umask(old_umask);
+  if (bound == -1 || chmod(path, mode) == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to bind UNIX domain socket (%s): %s", path,
+              strerror(errno));
+    close(*socket_fd);
+    *socket_fd = -1;
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// setup_unix_client_socket()
+//
+int setup_unix_client_socket(const char *path, int *socket_fd)
+{
+  struct sockaddr_un addr;
+
+  *socket_fd = -1;
+
+  if (setup_unix_address(path, &addr))
+  {
+    return 1;
+  }
+
+  *socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (*socket_fd == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to create UNIX domain socket: %s",
+              strerror(errno));
+    return 1;
+  }
+
+  if (connect(*socket_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to connect to UNIX domain socket (%s): %s",
+              path, strerror(errno));
+    close(*socket_fd);
+    *socket_fd = -1;
     return 1;
   }
 
@@ -6,17 +6,28 @@
 
 #include "tls_util.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <kmip/kmip.h>
 #include <kmip/kmip_bio.h>
 #include <openssl/bio.h>
 #include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/sha.h>
 #include <openssl/ssl.h>
 #include <openssl/x509v3.h>
 
 #include "defines.h"
+#include "kmip_util.h"
 #include "memory_util.h"
+#include "trace.h"
+
+#include "alloc_stats.h"
 
 // Check for supported OpenSSL version
 //   - OpenSSL v1.1.1 is a LTS version supported until 2023-09-11
@@ -26,10 +37,104 @@
 #error OpenSSL version 1.1.1 or newer is required
 #endif
 
+// A cached TLS context, and the (key, certificate, CA) triple it was built
+// from - the key is only kept as its digest
+typedef struct tls_context_entry
+{
+  unsigned char key_digest[SHA256_DIGEST_LENGTH];
+  char *client_cert_path;
+  char *ca_cert_path;
+  SSL_CTX *ctx;
+  unsigned long last_used;
+} tls_context_entry;
+
+static pthread_mutex_t tls_context_lock = PTHREAD_MUTEX_INITIALIZER;
+static tls_context_entry tls_contexts[TLS_CONTEXT_CACHE_SIZE];
+static unsigned long tls_context_uses = 0;
+
+// ex_data index of the socket options a connection's SSL keeps, for its
+// I/O timeout and deadline to be re-armed before each exchange
+static int tls_sockopts_index = -1;
+static pthread_once_t tls_sockopts_once = PTHREAD_ONCE_INIT;
+
 const char *PREFERRED_CIPHERS = "ECDHE-ECDSA-AES256-GCM-SHA384:"
   "ECDHE-RSA-AES256-GCM-SHA384:" "ECDHE-ECDSA-AES256-SHA384:"
   "ECDHE-RSA-AES256-SHA384";
 
+//############################################################################
+// tls_sockopts_free()
+//############################################################################
+static void tls_sockopts_free(void *parent, void *ptr, CRYPTO_EX_DATA * ad,
+                              int idx, long argl, void *argp)
+{
+  (void) parent;
+  (void) ad;
+  (void) idx;
+  (void) argl;
+  (void) argp;
+
+  free(ptr);
+}
+
+//############################################################################
+// tls_sockopts_index_init()
+//############################################################################
+static void tls_sockopts_index_init(void)
+{
+  tls_sockopts_index = SSL_get_ex_new_index(0, NULL, NULL, NULL,
+                                            tls_sockopts_free);
+}
+
+//############################################################################
+// tls_get_sockopts()
+//############################################################################
+static socket_options *tls_get_sockopts(BIO * bio, bool create)
+{
+  SSL *ssl = NULL;
+
+  pthread_once(&tls_sockopts_once, tls_sockopts_index_init);
+  if (tls_sockopts_index < 0 || BIO_get_ssl(bio, &ssl) <= 0 || ssl == NULL)
+  {
+    return NULL;
+  }
+
+  socket_options *opts = SSL_get_ex_data(ssl, tls_sockopts_index);
+
+  if (opts == NULL && create)
+  {
+    opts = malloc(sizeof(socket_options));
+    if (opts == NULL)
+    {
+      return NULL;
+    }
+    socket_options_init(opts);
+    if (SSL_set_ex_data(ssl, tls_sockopts_index, opts) != 1)
+    {
+      free(opts);
+      return NULL;
+    }
+  }
+
+  return opts;
+}
+
+//############################################################################
+// tls_arm_deadline()
+//############################################################################
+static int tls_arm_deadline(BIO * bio)
+{
+  socket_options *opts = tls_get_sockopts(bio, false);
+  int fd = -1;
+
+  // a connection set up without options keeps the system's timeouts
+  if (opts == NULL || BIO_get_fd(bio, &fd) < 0 || fd < 0)
+  {
+    return 0;
+  }
+
+  return socket_arm_deadline(fd, opts);
+}
+
 //############################################################################
 // tls_ctx_connect()
 //############################################################################
@@ -44,15 +149,25 @@ const char *PREFERRED_CIPHERS = "ECDHE-ECDSA-AES256-GCM-SHA384:"
  *
  * @param[in]  ctx         the context to use
  *
+ * @param[in]  session     a previous session to try to resume (NULL to
+ *                         always do a full handshake)
+ *
+ * @param[in]  early_data  if true, and the session allows early data,
+ *                         the handshake is left for the first request to
+ *                         be sent as early data with
+ *
+ * @param[in]  sockopts    options for the connection's socket (NULL to
+ *                         leave OpenSSL to connect it)
+ *
  * @param[out] ssl_bio     the BIO structure used to interface with the
  *                         connection
  *
- * @param[in]  verbose     if true, print extra debugging messages
- *
  * @return 0 on success, 1 on error
  */
 static int tls_ctx_connect(char *server_ip, char *server_port,
-                           SSL_CTX * ctx, BIO ** ssl_bio)
+                           SSL_CTX * ctx, SSL_SESSION * session,
+                           bool early_data, const socket_options * sockopts,
+                           BIO ** ssl_bio)
 {
   if (server_ip == NULL)
   {
@@ -75,7 +190,43 @@ static int tls_ctx_connect(char *server_ip, char *server_port,
     return 1;
   }
 
-  *ssl_bio = BIO_new_ssl_connect(ctx);
+  // With socket options, the socket is connected here (and the TLS BIO
+  // layered over it), rather than by a connect BIO.
+  int socket_fd = -1;
+
+  if (sockopts != NULL)
+  {
+    if (setup_client_socket_opts(server_ip, server_port, sockopts,
+                                 &socket_fd))
+    {
+      kmyth_log(LOG_ERR, "TCP/IP socket connection error ... exiting");
+      return 1;
+    }
+    *ssl_bio = BIO_new_ssl(ctx, 1);
+    if (*ssl_bio != NULL)
+    {
+      BIO *socket_bio = BIO_new_socket(socket_fd, BIO_CLOSE);
+
+      if (socket_bio == NULL)
+      {
+        BIO_free_all(*ssl_bio);
+        *ssl_bio = NULL;
+      }
+      else
+      {
+        BIO_push(*ssl_bio, socket_bio);
+        socket_fd = -1;
+      }
+    }
+    if (socket_fd != -1)
+    {
+      close(socket_fd);
+    }
+  }
+  else
+  {
+    *ssl_bio = BIO_new_ssl_connect(ctx);
+  }
   if (*ssl_bio == NULL)
   {
     kmyth_log(LOG_ERR, "error getting new BIO chain: %s ... exiting",
@@ -91,13 +242,13 @@ static int tls_ctx_connect(char *server_ip, char *server_port,
               ERR_error_string(ERR_get_error(), NULL));
     return 1;
   }
-  if (BIO_set_conn_address(*ssl_bio, server_ip) != 1)
+  if (sockopts == NULL && BIO_set_conn_address(*ssl_bio, server_ip) != 1)
   {
     kmyth_log(LOG_ERR, "error setting connection address: %s ... exiting",
               ERR_error_string(ERR_get_error(), NULL));
     return 1;
   }
-  if (BIO_set_conn_port(*ssl_bio, server_port) != 1)
+  if (sockopts == NULL && BIO_set_conn_port(*ssl_bio, server_port) != 1)
   {
     kmyth_log(LOG_ERR, "error setting connection port: %s ... exiting",
               ERR_error_string(ERR_get_error(), NULL));
@@ -112,6 +263,14 @@ static int tls_ctx_connect(char *server_ip, char *server_port,
     return 1;
   }
 
+  // offer the previous session - if the server no longer accepts it, the
+  // handshake is simply a full one
+  if (session != NULL && SSL_set_session(ssl, session) != 1)
+  {
+    kmyth_log(LOG_WARNING, "unable to offer previous TLS session: %s",
+              ERR_error_string(ERR_get_error(), NULL));
+  }
+
   // verify server's X509 certificate
   X509 *cert = SSL_get_peer_certificate(ssl);
 
@@ -126,19 +285,48 @@ static int tls_ctx_connect(char *server_ip, char *server_port,
     X509_free(cert);
   }
 
-  // initiate IP socket connection with the server
-  if (BIO_do_connect(*ssl_bio) <= 0)
+  // initiate IP socket connection with the server (unless already
+  // connected)
+  if (sockopts == NULL && BIO_do_connect(*ssl_bio) <= 0)
   {
     kmyth_log(LOG_ERR, "TCP/IP socket connection error ... exiting");
     return 1;
   }
 
+  // the connection keeps its socket options, so that its deadline (if it
+  // has, or is later given, one) is held to from the handshake on
+  if (sockopts != NULL)
+  {
+    socket_options *opts = tls_get_sockopts(*ssl_bio, true);
+
+    if (opts == NULL)
+    {
+      kmyth_log(LOG_ERR, "error keeping the socket options ... exiting");
+      return 1;
+    }
+    *opts = *sockopts;
+  }
+
+  // A session the server will take early data on lets the first request go
+  // out with the ClientHello (see tls_write_request()), so the handshake is
+  // done then. Whether it is offered is only known once the session is set.
+  SSL_SESSION *offered = SSL_get_session(ssl);
+
+  if (early_data && offered != NULL &&
+      SSL_SESSION_get_max_early_data(offered) > 0)
+  {
+    kmyth_log(LOG_DEBUG, "TLS handshake deferred to send early data");
+    return 0;
+  }
+
   // initiate SSL/TLS handshake with the server
-  if (BIO_do_handshake(*ssl_bio) <= 0)
+  if (tls_arm_deadline(*ssl_bio) || BIO_do_handshake(*ssl_bio) <= 0)
   {
     kmyth_log(LOG_ERR, "TLS connection error ... exiting");
     return 1;
   }
+  kmyth_log(LOG_DEBUG, "TLS session %s", (SSL_session_reused(ssl) == 1) ?
+            "resumed" : "established with a full handshake");
 
   return 0;
 }
@@ -151,6 +339,53 @@ int create_tls_connection(char **server_ip,
                           size_t client_private_key_len,
                           char *client_cert_path, char *ca_cert_path,
                           BIO ** tls_bio, SSL_CTX ** tls_ctx)
+{
+  return create_tls_connection_session(server_ip, client_private_key,
+                                       client_private_key_len,
+                                       client_cert_path, ca_cert_path, NULL,
+                                       false, NULL, tls_bio, tls_ctx);
+}
+
+//############################################################################
+// create_tls_connection_resume()
+//############################################################################
+int create_tls_connection_resume(char **server_ip,
+                                 unsigned char *client_private_key,
+                                 size_t client_private_key_len,
+                                 char *client_cert_path, char *ca_cert_path,
+                                 char *session_path,
+                                 const socket_options * sockopts,
+                                 BIO ** tls_bio, SSL_CTX ** tls_ctx)
+{
+  // a missing (or unreadable) session file just means a full handshake
+  SSL_SESSION *session = NULL;
+
+  if (session_path != NULL && tls_load_session(session_path, &session) != 0)
+  {
+    kmyth_log(LOG_DEBUG, "no previous TLS session to resume");
+  }
+
+  int retval = create_tls_connection_session(server_ip, client_private_key,
+                                             client_private_key_len,
+                                             client_cert_path, ca_cert_path,
+                                             session, false, sockopts,
+                                             tls_bio, tls_ctx);
+
+  SSL_SESSION_free(session);
+
+  return retval;
+}
+
+//############################################################################
+// create_tls_connection_session()
+//############################################################################
+int create_tls_connection_session(char **server_ip,
+                                  unsigned char *client_private_key,
+                                  size_t client_private_key_len,
+                                  char *client_cert_path, char *ca_cert_path,
+                                  SSL_SESSION * session, bool early_data,
+                                  const socket_options * sockopts,
+                                  BIO ** tls_bio, SSL_CTX ** tls_ctx)
 {
   if (server_ip == NULL)
   {
@@ -185,11 +420,16 @@ int create_tls_connection(char **server_ip,
     return 1;
   }
 
-  if (tls_set_context
+  kmyth_span_t span;
+
+  kmyth_span_start(&span, "create_tls_connection");
+
+  if (tls_context_acquire
       (client_private_key, client_private_key_len, client_cert_path,
        ca_cert_path, tls_ctx) != 0)
   {
     kmyth_log(LOG_ERR, "error setting up TLS context ... exiting");
+    kmyth_span_end(&span, 1);
     return 1;
   }
 
@@ -200,6 +440,7 @@ int create_tls_connection(char **server_ip,
   if (server_port == NULL)
   {
     kmyth_log(LOG_ERR, "null port (%s) ... exiting", *server_ip);
+    kmyth_span_end(&span, 1);
     return 1;
   }
   *server_port = '\0';
@@ -209,22 +450,373 @@ int create_tls_connection(char **server_ip,
   if ((strncmp(server_port, "0\0", 2) != 0) && (atoi(server_port) == 0))
   {
     kmyth_log(LOG_ERR, "malformed IP string, invalid port ... exiting");
+    kmyth_span_end(&span, 1);
     return 1;
   }
+  kmyth_span_set_str(&span, "server.address", *server_ip,
+                     strlen(*server_ip));
+  kmyth_span_set_int(&span, "server.port", atoi(server_port));
 
-  if (tls_ctx_connect(*server_ip, server_port, *tls_ctx, tls_bio) != 0)
+  if (tls_ctx_connect(*server_ip, server_port, *tls_ctx, session,
+                      early_data, sockopts, tls_bio) != 0)
   {
     kmyth_log(LOG_ERR, "error connecting to server ... exiting");
+    kmyth_span_end(&span, 1);
+    return 1;
+  }
+
+  SSL *ssl = NULL;
+
+  // (with the handshake deferred for early data, whether the session is
+  // resumed is not yet known)
+  if (BIO_get_ssl(*tls_bio, &ssl) > 0 && ssl != NULL)
+  {
+    bool deferred = SSL_is_init_finished(ssl) != 1;
+
+    kmyth_span_set_int(&span, "tls.early_data", deferred);
+    if (!deferred)
+    {
+      kmyth_span_set_int(&span, "tls.resumed", SSL_session_reused(ssl));
+    }
+  }
+  kmyth_span_end(&span, 0);
+  return 0;
+}
+
+//############################################################################
+// tls_load_session()
+//############################################################################
+int tls_load_session(char *session_path, SSL_SESSION ** session)
+{
+  if (session_path == NULL || session == NULL)
+  {
+    kmyth_log(LOG_ERR, "no TLS session path or variable ... exiting");
+    return 1;
+  }
+  *session = NULL;
+
+  BIO *session_bio = BIO_new_file(session_path, "r");
+
+  if (session_bio == NULL)
+  {
+    ERR_clear_error();
     return 1;
   }
+  *session = PEM_read_bio_SSL_SESSION(session_bio, NULL, NULL, NULL);
+  BIO_free(session_bio);
+
+  // a session that can no longer be resumed (e.g., an expired ticket) is
+  // no use
+  if (*session != NULL && SSL_SESSION_is_resumable(*session) != 1)
+  {
+    SSL_SESSION_free(*session);
+    *session = NULL;
+  }
+  if (*session == NULL)
+  {
+    ERR_clear_error();
+    return 1;
+  }
+
   return 0;
 }
 
+//############################################################################
+// tls_save_session()
+//############################################################################
+int tls_save_session(char *session_path, BIO * tls_bio)
+{
+  if (session_path == NULL || tls_bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "no TLS session path or BIO ... exiting");
+    return 1;
+  }
+
+  SSL_SESSION *session = NULL;
+
+  if (tls_get_session(tls_bio, &session) != 0)
+  {
+    return 1;
+  }
+
+  // the session holds the resumption secret, so only the owner may read it
+  int fd = open(session_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  FILE *session_file = (fd < 0) ? NULL : fdopen(fd, "w");
+
+  if (session_file == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open TLS session file: %s ... exiting",
+              session_path);
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    SSL_SESSION_free(session);
+    return 1;
+  }
+
+  int retval = (PEM_write_SSL_SESSION(session_file, session) == 1) ? 0 : 1;
+
+  if (fclose(session_file) != 0)
+  {
+    retval = 1;
+  }
+  SSL_SESSION_free(session);
+  if (retval != 0)
+  {
+    kmyth_log(LOG_ERR, "error writing TLS session file: %s ... exiting",
+              session_path);
+    unlink(session_path);
+  }
+
+  return retval;
+}
+
+//############################################################################
+// tls_get_session()
+//############################################################################
+int tls_get_session(BIO * tls_bio, SSL_SESSION ** session)
+{
+  if (tls_bio == NULL || session == NULL)
+  {
+    kmyth_log(LOG_ERR, "no BIO or TLS session variable ... exiting");
+    return 1;
+  }
+  *session = NULL;
+
+  SSL *ssl = NULL;
+
+  if (BIO_get_ssl(tls_bio, &ssl) <= 0 || ssl == NULL)
+  {
+    kmyth_log(LOG_ERR, "error retrieving the BIO SSL pointer ... exiting");
+    return 1;
+  }
+
+  // with TLS 1.3 any ticket arrives after the handshake, so this is only
+  // worth getting once some data has been exchanged
+  *session = SSL_get1_session(ssl);
+  if (*session == NULL || SSL_SESSION_is_resumable(*session) != 1)
+  {
+    kmyth_log(LOG_DEBUG, "no resumable TLS session to save");
+    SSL_SESSION_free(*session);
+    *session = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// tls_session_to_bytes()
+//############################################################################
+int tls_session_to_bytes(SSL_SESSION * session, unsigned char **bytes,
+                         size_t *bytes_len)
+{
+  if (session == NULL || bytes == NULL || bytes_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "no TLS session or output variables ... exiting");
+    return 1;
+  }
+  *bytes = NULL;
+  *bytes_len = 0;
+
+  int len = i2d_SSL_SESSION(session, NULL);
+
+  if (len <= 0)
+  {
+    kmyth_log(LOG_ERR, "error encoding TLS session: %s ... exiting",
+              ERR_error_string(ERR_get_error(), NULL));
+    return 1;
+  }
+
+  *bytes = malloc((size_t) len);
+  if (*bytes == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating TLS session buffer ... exiting");
+    return 1;
+  }
+
+  // (i2d advances the pointer it is given past what it writes)
+  unsigned char *next = *bytes;
+
+  if (i2d_SSL_SESSION(session, &next) != len)
+  {
+    kmyth_log(LOG_ERR, "error encoding TLS session ... exiting");
+    kmyth_clear_and_free(*bytes, (size_t) len);
+    *bytes = NULL;
+    return 1;
+  }
+  *bytes_len = (size_t) len;
+
+  return 0;
+}
+
+//############################################################################
+// tls_session_from_bytes()
+//############################################################################
+int tls_session_from_bytes(const unsigned char *bytes, size_t bytes_len,
+                           SSL_SESSION ** session)
+{
+  if (bytes == NULL || bytes_len == 0 || bytes_len > LONG_MAX ||
+      session == NULL)
+  {
+    kmyth_log(LOG_ERR, "no TLS session bytes or variable ... exiting");
+    return 1;
+  }
+
+  const unsigned char *next = bytes;
+
+  *session = d2i_SSL_SESSION(NULL, &next, (long) bytes_len);
+
+  // as with tls_load_session(), a session past resuming is no use
+  if (*session != NULL && SSL_SESSION_is_resumable(*session) != 1)
+  {
+    SSL_SESSION_free(*session);
+    *session = NULL;
+  }
+  if (*session == NULL)
+  {
+    ERR_clear_error();
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// tls_context_entry_clear()
+//############################################################################
+static void tls_context_entry_clear(tls_context_entry * entry)
+{
+  SSL_CTX_free(entry->ctx);
+  free(entry->client_cert_path);
+  free(entry->ca_cert_path);
+  memset(entry, 0, sizeof(tls_context_entry));
+}
+
+//############################################################################
+// tls_context_acquire()
+//############################################################################
+int tls_context_acquire(unsigned char *client_private_key,
+                        size_t client_private_key_len,
+                        char *client_cert_path, char *ca_cert_path,
+                        SSL_CTX ** ctx)
+{
+  unsigned char key_digest[SHA256_DIGEST_LENGTH];
+
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "no SSL context variable ... exiting");
+    return 1;
+  }
+  if (client_private_key == NULL || client_private_key_len == 0 ||
+      client_cert_path == NULL || ca_cert_path == NULL)
+  {
+    // tls_set_context() reports which input is missing
+    return tls_set_context(client_private_key, client_private_key_len,
+                           client_cert_path, ca_cert_path, ctx);
+  }
+  if (SHA256(client_private_key, client_private_key_len, key_digest) == NULL)
+  {
+    kmyth_log(LOG_ERR, "error hashing client private key ... exiting");
+    return 1;
+  }
+
+  pthread_mutex_lock(&tls_context_lock);
+
+  tls_context_entry *slot = &tls_contexts[0];
+
+  for (size_t i = 0; i < TLS_CONTEXT_CACHE_SIZE; i++)
+  {
+    tls_context_entry *entry = &tls_contexts[i];
+
+    if (entry->ctx != NULL &&
+        CRYPTO_memcmp(entry->key_digest, key_digest,
+                      SHA256_DIGEST_LENGTH) == 0 &&
+        strcmp(entry->client_cert_path, client_cert_path) == 0 &&
+        strcmp(entry->ca_cert_path, ca_cert_path) == 0)
+    {
+      // the caller shares the cached context, with its own reference
+      SSL_CTX_up_ref(entry->ctx);
+      entry->last_used = ++tls_context_uses;
+      *ctx = entry->ctx;
+      pthread_mutex_unlock(&tls_context_lock);
+      OPENSSL_cleanse(key_digest, sizeof(key_digest));
+      return 0;
+    }
+
+    // otherwise, a new context replaces an empty, or the least recently
+    // used, entry
+    if (slot->ctx != NULL &&
+        (entry->ctx == NULL || entry->last_used < slot->last_used))
+    {
+      slot = entry;
+    }
+  }
+
+  // The context is built with the lock held, so that concurrent callers
+  // with the same triple wait for (and share) the one context.
+  if (tls_set_context(client_private_key, client_private_key_len,
+                      client_cert_path, ca_cert_path, ctx) != 0)
+  {
+    pthread_mutex_unlock(&tls_context_lock);
+    OPENSSL_cleanse(key_digest, sizeof(key_digest));
+    return 1;
+  }
+
+  char *cert_path_copy = strdup(client_cert_path);
+  char *ca_path_copy = strdup(ca_cert_path);
+
+  if (cert_path_copy == NULL || ca_path_copy == NULL)
+  {
+    // the context is still usable, just not cached
+    free(cert_path_copy);
+    free(ca_path_copy);
+  }
+  else
+  {
+    tls_context_entry_clear(slot);
+    memcpy(slot->key_digest, key_digest, SHA256_DIGEST_LENGTH);
+    slot->client_cert_path = cert_path_copy;
+    slot->ca_cert_path = ca_path_copy;
+    slot->ctx = *ctx;
+    slot->last_used = ++tls_context_uses;
+    SSL_CTX_up_ref(*ctx);
+  }
+
+  pthread_mutex_unlock(&tls_context_lock);
+  OPENSSL_cleanse(key_digest, sizeof(key_digest));
+
+  return 0;
+}
+
+//############################################################################
+// tls_context_release()
+//############################################################################
+void tls_context_release(SSL_CTX * ctx)
+{
+  SSL_CTX_free(ctx);
+}
+
+//############################################################################
+// tls_context_cache_clear()
+//############################################################################
+void tls_context_cache_clear(void)
+{
+  pthread_mutex_lock(&tls_context_lock);
+  for (size_t i = 0; i < TLS_CONTEXT_CACHE_SIZE; i++)
+  {
+    tls_context_entry_clear(&tls_contexts[i]);
+  }
+  pthread_mutex_unlock(&tls_context_lock);
+}
+
 //############################################################################
 // tls_cleanup()
 //############################################################################
 int tls_cleanup(void)
 {
+  tls_context_cache_clear();
   CONF_modules_unload(1);
   ERR_free_strings();
   EVP_cleanup();
@@ -385,6 +977,33 @@ int tls_set_context(unsigned char *client_private_key,
   return 0;
 }
 
+//############################################################################
+// tls_set_deadline()
+//############################################################################
+int tls_set_deadline(BIO * bio, uint64_t deadline_ns)
+{
+  if (bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "no valid BIO object ... exiting");
+    return 1;
+  }
+
+  socket_options *opts = tls_get_sockopts(bio, deadline_ns != 0);
+
+  if (opts == NULL)
+  {
+    if (deadline_ns == 0)
+    {
+      return 0;
+    }
+    kmyth_log(LOG_ERR, "error setting the connection's deadline ... exiting");
+    return 1;
+  }
+  opts->deadline_ns = deadline_ns;
+
+  return 0;
+}
+
 //############################################################################
 // get_key_from_tls_server()
 //############################################################################
@@ -406,7 +1025,7 @@ int get_resp_from_tls_server(BIO * bio,
   // write message to server
   if (req_size > 0)
   {
-    if (BIO_write(bio, req, (int)req_size) <= 0)
+    if (tls_arm_deadline(bio) || BIO_write(bio, req, (int)req_size) <= 0)
     {
       kmyth_log(LOG_ERR, "error writing message to server ... exiting");
       return 1;
@@ -414,9 +1033,13 @@ int get_resp_from_tls_server(BIO * bio,
     if (BIO_flush(bio) != 1)
       kmyth_log(LOG_ERR, "error flushing server message BIO");
   }
-  // This size is known not to exceed INT_MAX.
+
+  // The response is not framed, so it is read, straight into a buffer that
+  // grows as needed, until the buffer is not filled and no more received
+  // data is pending. These sizes are known not to exceed INT_MAX.
   size_t buf_size = KMYTH_GETKEY_RX_BUFFER_SIZE;
-  char *buf = calloc(buf_size, sizeof(char));
+  size_t recv_size = 0;
+  unsigned char *buf = malloc(buf_size);
 
   if (buf == NULL)
   {
@@ -425,9 +1048,49 @@ int get_resp_from_tls_server(BIO * bio,
     return 1;
   }
 
-  int recv = BIO_read(bio, buf, (int)buf_size);
+  do
+  {
+    if (recv_size == buf_size)
+    {
+      if (buf_size >= KMYTH_GETKEY_MAX_RESPONSE_SIZE)
+      {
+        kmyth_log(LOG_ERR, "response exceeds maximum size (%d bytes) "
+                  "... exiting", KMYTH_GETKEY_MAX_RESPONSE_SIZE);
+        kmyth_clear_and_free(buf, buf_size);
+        return 1;
+      }
+
+      // grow by hand (rather than realloc) so no uncleared copy is left
+      unsigned char *new_buf = malloc(2 * buf_size);
+
+      if (new_buf == NULL)
+      {
+        kmyth_log(LOG_ERR, "error growing server response buffer ... exiting");
+        kmyth_clear_and_free(buf, buf_size);
+        return 1;
+      }
+      memcpy(new_buf, buf, recv_size);
+      kmyth_clear_and_free(buf, buf_size);
+      buf = new_buf;
+      buf_size *= 2;
+    }
+
+    if (tls_arm_deadline(bio))
+    {
+      break;
+    }
+
+    int recv = BIO_read(bio, buf + recv_size, (int) (buf_size - recv_size));
+
+    if (0 >= recv)
+    {
+      break;
+    }
+    recv_size += (size_t) recv;
+  }
+  while (recv_size == buf_size || BIO_pending(bio) > 0);
 
-  if (0 >= recv)
+  if (recv_size == 0)
   {
     kmyth_log(LOG_ERR, "no data received: %s ... exiting",
               ERR_error_string(ERR_get_error(), NULL));
@@ -435,31 +1098,135 @@ int get_resp_from_tls_server(BIO * bio,
     return 1;
   }
 
-  if (recv >= buf_size)
+  *resp = buf;
+  *resp_size = recv_size;
+
+  return 0;
+}
+
+//############################################################################
+// tls_read_all()
+//############################################################################
+static int tls_read_all(BIO * bio, unsigned char *buf, size_t len)
+{
+  size_t received = 0;
+
+  while (received < len)
+  {
+    if (tls_arm_deadline(bio))
+    {
+      return 1;
+    }
+
+    int recv = BIO_read(bio, buf + received, (int) (len - received));
+
+    if (recv <= 0)
+    {
+      kmyth_log(LOG_ERR, "no data received: %s ... exiting",
+                ERR_error_string(ERR_get_error(), NULL));
+      return 1;
+    }
+    received += (size_t) recv;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// tls_read_kmip_message()
+//############################################################################
+int tls_read_kmip_message(BIO * bio, size_t max_len,
+                          unsigned char **msg, size_t * msg_len)
+{
+  if (bio == NULL || msg == NULL || msg_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "no valid BIO object or message variable ... exiting");
+    return 1;
+  }
+
+  // the header is read into the start of the message buffer, which then
+  // grows to the declared length for the value to be read in after it
+  unsigned char *buf = malloc(KMYTH_KMIP_TTLV_HEADER_SIZE);
+
+  if (buf == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating KMIP message buffer ... exiting");
+    return 1;
+  }
+  if (tls_read_all(bio, buf, KMYTH_KMIP_TTLV_HEADER_SIZE) != 0)
   {
-    kmyth_log(LOG_ERR, "receive buffer full (%d bytes) ... exiting", recv);
+    kmyth_log(LOG_ERR, "error reading KMIP message header ... exiting");
     free(buf);
     return 1;
   }
 
-  // recv must be non-negative, as we've already errored out if it's negative.
-  *resp_size = (size_t)recv;
-  (*resp) = malloc(*resp_size);
-  if (*resp == NULL)
+  size_t value_len = ((size_t) buf[4] << 24) | ((size_t) buf[5] << 16) |
+    ((size_t) buf[6] << 8) | (size_t) buf[7];
+  size_t len = KMYTH_KMIP_TTLV_HEADER_SIZE + value_len;
+
+  if (len > max_len || len > INT_MAX)
   {
-    kmyth_log(LOG_ERR, "error allocating correctly sized buffer ... exiting");
-    buf = secure_memset(buf, 0, buf_size);
+    kmyth_log(LOG_ERR, "KMIP message (%zu bytes) exceeds maximum size "
+              "(%zu bytes) ... exiting", len, max_len);
     free(buf);
     return 1;
   }
-  memcpy((*resp), buf, *resp_size);
 
-  buf = secure_memset(buf, 0, buf_size);
-  free(buf);
+  unsigned char *new_buf = realloc(buf, len);
+
+  if (new_buf == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating KMIP message buffer ... exiting");
+    free(buf);
+    return 1;
+  }
+  buf = new_buf;
+
+  if (tls_read_all(bio, buf + KMYTH_KMIP_TTLV_HEADER_SIZE, value_len) != 0)
+  {
+    kmyth_log(LOG_ERR, "error reading KMIP message value ... exiting");
+    kmyth_clear_and_free(buf, len);
+    return 1;
+  }
+
+  *msg = buf;
+  *msg_len = len;
 
   return 0;
 }
 
+//############################################################################
+// get_kmip_resp_from_tls_server()
+//############################################################################
+int get_kmip_resp_from_tls_server(BIO * bio,
+                                  unsigned char *req, size_t req_size,
+                                  unsigned char **resp, size_t * resp_size)
+{
+  // validate input
+  if (bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "no valid BIO object ... exiting");
+    return 1;
+  }
+  if (req == NULL || req_size == 0 || req_size > INT_MAX)
+  {
+    kmyth_log(LOG_ERR, "invalid KMIP request ... exiting");
+    return 1;
+  }
+
+  if (tls_arm_deadline(bio) ||
+      BIO_write(bio, req, (int) req_size) != (int) req_size)
+  {
+    kmyth_log(LOG_ERR, "error writing KMIP request to server ... exiting");
+    return 1;
+  }
+  if (BIO_flush(bio) != 1)
+    kmyth_log(LOG_ERR, "error flushing server message BIO");
+
+  return tls_read_kmip_message(bio, KMYTH_GETKEY_MAX_RESPONSE_SIZE,
+                               resp, resp_size);
+}
+
 //############################################################################
 // get_key_from_kmip_server()
 //############################################################################
@@ -485,13 +1252,26 @@ int get_key_from_kmip_server(BIO * bio,
     return 1;
   }
 
+  kmyth_span_t span;
+
+  kmyth_span_start(&span, "get_key_from_kmip_server");
+  kmyth_span_set_str(&span, "kmip.key_id", message, message_length);
+  kmyth_span_set_int(&span, "kmip.key_id_bytes", (int64_t) message_length);
+
   KMIP kmip_context = { 0 };
   kmip_init(&kmip_context, NULL, 0, KMIP_1_0);
 
   int result = -1;
   int key_len = 0;
 
-  // write message to server
+  // write message to server (the exchange's reads and writes are each
+  // given no longer than the time left beforehand)
+  if (message_length > 0 && tls_arm_deadline(bio))
+  {
+    kmip_destroy(&kmip_context);
+    kmyth_span_end(&span, 1);
+    return 1;
+  }
   if (message_length > 0)
   {
     result = kmip_bio_get_symmetric_key_with_context(&kmip_context,
@@ -506,12 +1286,245 @@ int get_key_from_kmip_server(BIO * bio,
       kmyth_log(LOG_ERR, "error retrieving key from KMIP server");
       kmyth_log(LOG_ERR, kmip_context.error_message);
       kmip_destroy(&kmip_context);
+      kmyth_span_end(&span, result);
       return result;
     }
   }
 
   *key_size = (size_t) key_len;
+  kmyth_span_set_int(&span, "kmip.key_bytes", key_len);
+
+  kmip_destroy(&kmip_context);
+  kmyth_span_end(&span, 0);
+  return 0;
+}
+
+//############################################################################
+// tls_write_request()
+//############################################################################
+/**
+ * <pre>
+ * This static helper function writes a request. On a connection whose
+ * handshake was deferred (see tls_ctx_connect()), a request that fits in
+ * the session's early data allowance is sent as early data, and the
+ * handshake completed. If the server turns the early data down, the
+ * request is sent again once the handshake is done.
+ * </pre>
+ *
+ * @param[in]  bio          the connection
+ *
+ * @param[in]  request      the request
+ *
+ * @param[in]  request_len  length (in bytes) of the request
+ *
+ * @return 0 on success, 1 on error
+ */
+static int tls_write_request(BIO * bio, unsigned char *request,
+                             size_t request_len)
+{
+  SSL *ssl = NULL;
+
+  if (request_len > INT_MAX || tls_arm_deadline(bio))
+  {
+    return 1;
+  }
+
+  if (BIO_get_ssl(bio, &ssl) > 0 && ssl != NULL &&
+      SSL_is_init_finished(ssl) != 1 && SSL_get_session(ssl) != NULL &&
+      SSL_SESSION_get_max_early_data(SSL_get_session(ssl)) >= request_len)
+  {
+    size_t written = 0;
+
+    if (SSL_write_early_data(ssl, request, request_len, &written) != 1 ||
+        written != request_len || SSL_do_handshake(ssl) != 1)
+    {
+      kmyth_log(LOG_ERR, "error sending TLS early data: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+      return 1;
+    }
+    if (SSL_get_early_data_status(ssl) == SSL_EARLY_DATA_ACCEPTED)
+    {
+      return 0;
+    }
+    kmyth_log(LOG_DEBUG, "TLS early data rejected, resending request");
+  }
+
+  return (BIO_write(bio, request, (int) request_len) == (int) request_len) ?
+    0 : 1;
+}
+
+//############################################################################
+// get_key_batch_from_kmip_server()
+//############################################################################
+static int get_key_batch_from_kmip_server(BIO * bio, KMIP * kmip_context,
+                                          char **ids, size_t count,
+                                          unsigned char **keys,
+                                          size_t * key_sizes)
+{
+  unsigned char **id_bytes = calloc(count, sizeof(unsigned char *));
+  size_t *id_lens = calloc(count, sizeof(size_t));
+
+  if (id_bytes == NULL || id_lens == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating KMIP key ID list ... exiting");
+    free(id_bytes);
+    free(id_lens);
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    id_bytes[i] = (unsigned char *) ids[i];
+    id_lens[i] = strlen(ids[i]);
+  }
+
+  unsigned char *request = NULL;
+  size_t request_len = 0;
+  int result = build_kmip_get_batch_request(kmip_context, id_bytes, id_lens,
+                                            count, &request, &request_len);
+
+  free(id_bytes);
+  free(id_lens);
+  if (result != 0 || request_len > INT_MAX)
+  {
+    kmyth_log(LOG_ERR, "error building KMIP Get request ... exiting");
+    free(request);
+    return 1;
+  }
+
+  result = tls_write_request(bio, request, request_len);
+  free(request);
+  if (result != 0)
+  {
+    kmyth_log(LOG_ERR, "error writing KMIP Get request ... exiting");
+    return 1;
+  }
+
+  unsigned char *response = NULL;
+  size_t response_len = 0;
+
+  if (tls_read_kmip_message(bio, (size_t) kmip_context->max_message_size,
+                            &response, &response_len) != 0)
+  {
+    kmyth_log(LOG_ERR, "error reading KMIP Get response ... exiting");
+    return 1;
+  }
+
+  unsigned char **resp_ids = NULL;
+  size_t *resp_id_lens = NULL;
+  unsigned char **resp_keys = NULL;
+  size_t *resp_key_lens = NULL;
+  size_t resp_count = 0;
+
+  result = parse_kmip_get_batch_response(kmip_context, response, response_len,
+                                         &resp_ids, &resp_id_lens,
+                                         &resp_keys, &resp_key_lens,
+                                         &resp_count);
+  kmyth_clear_and_free(response, response_len);
+  if (result != 0 || resp_count != count)
+  {
+    kmyth_log(LOG_ERR, "invalid KMIP Get response ... exiting");
+    free_kmip_get_batch(resp_ids, resp_id_lens, resp_keys, resp_key_lens,
+                        resp_count);
+    return 1;
+  }
+
+  // The batch items are matched to the requested keys by ID, as the server
+  // need not answer them in order
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t id_len = strlen(ids[i]);
+
+    for (size_t j = 0; j < resp_count && keys[i] == NULL; j++)
+    {
+      if (resp_keys[j] != NULL && resp_id_lens[j] == id_len &&
+          memcmp(resp_ids[j], ids[i], id_len) == 0)
+      {
+        keys[i] = resp_keys[j];
+        key_sizes[i] = resp_key_lens[j];
+        resp_keys[j] = NULL;
+      }
+    }
+    if (keys[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "KMIP Get response has no key %s ... exiting",
+                ids[i]);
+      free_kmip_get_batch(resp_ids, resp_id_lens, resp_keys, resp_key_lens,
+                          resp_count);
+      return 1;
+    }
+  }
+
+  free_kmip_get_batch(resp_ids, resp_id_lens, resp_keys, resp_key_lens,
+                      resp_count);
+  return 0;
+}
+
+//############################################################################
+// get_keys_from_kmip_server()
+//############################################################################
+int get_keys_from_kmip_server(BIO * bio, char **ids, size_t count,
+                              unsigned char **keys, size_t * key_sizes)
+{
+  // validate input
+  if (bio == NULL)
+  {
+    kmyth_log(LOG_ERR, "no valid BIO object ... exiting");
+    return 1;
+  }
+  if (ids == NULL || count == 0 || keys == NULL || key_sizes == NULL)
+  {
+    kmyth_log(LOG_ERR, "no key IDs or key list ... exiting");
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    if (ids[i] == NULL || ids[i][0] == '\0')
+    {
+      kmyth_log(LOG_ERR, "empty key ID ... exiting");
+      return 1;
+    }
+    keys[i] = NULL;
+    key_sizes[i] = 0;
+  }
+
+  // The batches are all built and parsed in the one (reused) workspace
+  KMIP kmip_context = { 0 };
+  kmip_workspace kmip_ws = { 0 };
+
+  kmip_init(&kmip_context, NULL, 0, KMIP_1_0);
+  if (kmip_workspace_init(&kmip_ws, &kmip_context) != 0)
+  {
+    kmyth_log(LOG_ERR, "error setting up KMIP workspace ... exiting");
+    kmip_destroy(&kmip_context);
+    return 1;
+  }
+
+  for (size_t i = 0; i < count; i += KMYTH_KMIP_MAX_BATCH_COUNT)
+  {
+    size_t batch_count = count - i;
+
+    if (batch_count > KMYTH_KMIP_MAX_BATCH_COUNT)
+    {
+      batch_count = KMYTH_KMIP_MAX_BATCH_COUNT;
+    }
+    if (get_key_batch_from_kmip_server(bio, &kmip_context, ids + i,
+                                       batch_count, keys + i,
+                                       key_sizes + i) != 0)
+    {
+      kmyth_log(LOG_ERR, "error retrieving keys from KMIP server");
+      for (size_t j = 0; j < count; j++)
+      {
+        kmyth_clear_and_free(keys[j], key_sizes[j]);
+        keys[j] = NULL;
+        key_sizes[j] = 0;
+      }
+      kmip_workspace_free(&kmip_ws);
+      kmip_destroy(&kmip_context);
+      return 1;
+    }
+  }
 
+  kmip_workspace_free(&kmip_ws);
   kmip_destroy(&kmip_context);
   return 0;
 }
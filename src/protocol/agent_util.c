@@ -0,0 +1,479 @@
+//
+// Utilities supporting kmyth-agent (the unsealed data cache daemon) and its
+// clients - the cache itself and the UNIX domain socket request protocol.
+//
+
+#include "agent_util.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "memory_util.h"
+#include "socket_util.h"
+
+#include "alloc_stats.h"
+
+//
+// agent_cache_init()
+//
+void agent_cache_init(agent_cache * cache, size_t max_count)
+{
+  cache->head = NULL;
+  cache->count = 0;
+  cache->max_count = max_count;
+}
+
+//
+// agent_file_id_from_stat()
+//
+void agent_file_id_from_stat(const struct stat *st, agent_file_id * id)
+{
+  memset(id, 0, sizeof(agent_file_id));
+  id->dev = st->st_dev;
+  id->ino = st->st_ino;
+  id->size = st->st_size;
+  id->mtime = st->st_mtim;
+}
+
+//
+// agent_file_id_equal()
+//
+int agent_file_id_equal(const agent_file_id * a, const agent_file_id * b)
+{
+  return (a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+          a->mtime.tv_sec == b->mtime.tv_sec &&
+          a->mtime.tv_nsec == b->mtime.tv_nsec);
+}
+
+//
+// agent_cache_unlink()
+//
+static void agent_cache_unlink(agent_cache * cache, agent_cache_entry ** link)
+{
+  // Remove the entry from the list, wiping the unsealed data it holds.
+  agent_cache_entry *entry = *link;
+
+  *link = entry->next;
+  kmyth_secure_free(entry->data);
+  free(entry);
+  cache->count--;
+}
+
+//
+// agent_cache_lookup()
+//
+agent_cache_entry *agent_cache_lookup(agent_cache * cache,
+                                      const agent_file_id * id, time_t now)
+{
+  for (agent_cache_entry ** link = &cache->head; *link != NULL;
+       link = &(*link)->next)
+  {
+    if (agent_file_id_equal(&(*link)->id, id))
+    {
+      if ((*link)->expiry <= now)
+      {
+        agent_cache_unlink(cache, link);
+        return NULL;
+      }
+      return *link;
+    }
+  }
+
+  return NULL;
+}
+
+//
+// agent_cache_insert()
+//
+int agent_cache_insert(agent_cache * cache, const agent_file_id * id,
+                       uint8_t * data, size_t data_len, time_t expiry)
+{
+  agent_cache_invalidate(cache, id);
+
+  // When full, make room by evicting the entry closest to expiry.
+  if (cache->count > 0 && cache->count >= cache->max_count)
+  {
+    agent_cache_entry **oldest = &cache->head;
+
+    for (agent_cache_entry ** link = &cache->head; *link != NULL;
+         link = &(*link)->next)
+    {
+      if ((*link)->expiry < (*oldest)->expiry)
+      {
+        oldest = link;
+      }
+    }
+    agent_cache_unlink(cache, oldest);
+  }
+
+  agent_cache_entry *entry = calloc(1, sizeof(agent_cache_entry));
+
+  if (entry == NULL || cache->max_count == 0)
+  {
+    kmyth_log(LOG_ERR, "Failed to add cache entry.");
+    free(entry);
+    kmyth_secure_free(data);
+    return 1;
+  }
+  entry->id = *id;
+  entry->data = data;
+  entry->data_len = data_len;
+  entry->expiry = expiry;
+  entry->next = cache->head;
+  cache->head = entry;
+  cache->count++;
+
+  return 0;
+}
+
+//
+// agent_cache_invalidate()
+//
+int agent_cache_invalidate(agent_cache * cache, const agent_file_id * id)
+{
+  for (agent_cache_entry ** link = &cache->head; *link != NULL;
+       link = &(*link)->next)
+  {
+    if (agent_file_id_equal(&(*link)->id, id))
+    {
+      agent_cache_unlink(cache, link);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+//
+// agent_cache_evict_expired()
+//
+time_t agent_cache_evict_expired(agent_cache * cache, time_t now)
+{
+  time_t next_expiry = 0;
+  agent_cache_entry **link = &cache->head;
+
+  while (*link != NULL)
+  {
+    if ((*link)->expiry <= now)
+    {
+      agent_cache_unlink(cache, link);
+      continue;
+    }
+    if (next_expiry == 0 || (*link)->expiry < next_expiry)
+    {
+      next_expiry = (*link)->expiry;
+    }
+    link = &(*link)->next;
+  }
+
+  return next_expiry;
+}
+
+//
+// agent_cache_clear()
+//
+void agent_cache_clear(agent_cache * cache)
+{
+  while (cache->head != NULL)
+  {
+    agent_cache_unlink(cache, &cache->head);
+  }
+}
+
+//
+// agent_parse_request()
+//
+int agent_parse_request(const char *line, kmyth_agent_request * request)
+{
+  memset(request, 0, sizeof(kmyth_agent_request));
+
+  if (strcmp(line, "FLUSH") == 0)
+  {
+    request->cmd = KMYTH_AGENT_FLUSH;
+    return 0;
+  }
+  if (strcmp(line, "INVALIDATE") == 0)
+  {
+    request->cmd = KMYTH_AGENT_INVALIDATE;
+    return 0;
+  }
+
+  unsigned int ttl = 0;
+  unsigned int policy_or = 0;
+  int consumed = 0;
+
+  if (sscanf(line, "UNSEAL %u %u%n", &ttl, &policy_or, &consumed) == 2 &&
+      line[consumed] == '\0' && policy_or <= 1)
+  {
+    request->cmd = KMYTH_AGENT_UNSEAL;
+    request->ttl = ttl;
+    request->policy_or = (uint8_t) policy_or;
+    return 0;
+  }
+
+  kmyth_log(LOG_ERR, "Invalid agent request.");
+  return 1;
+}
+
+//
+// agent_recv_request()
+//
+int agent_recv_request(int socket_fd, char *line, int *passed_fd)
+{
+  *passed_fd = -1;
+
+  size_t line_len = 0;
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+
+  // Read until the end of the request line - any file descriptor is passed
+  // along with its first byte(s).
+  while (line_len < KMYTH_AGENT_MAX_LINE_LEN)
+  {
+    struct iovec iov = {
+      .iov_base = line + line_len,
+      .iov_len = KMYTH_AGENT_MAX_LINE_LEN - line_len
+    };
+    struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control.buf,
+      .msg_controllen = sizeof(control.buf)
+    };
+    ssize_t len = recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC);
+
+    if (len < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (len <= 0)
+    {
+      kmyth_log(LOG_ERR, "Failed to receive agent request.");
+      break;
+    }
+
+    for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+          cmsg->cmsg_len == CMSG_LEN(sizeof(int)) && *passed_fd == -1)
+      {
+        memcpy(passed_fd, CMSG_DATA(cmsg), sizeof(int));
+      }
+    }
+
+    char *newline = memchr(line + line_len, '\n', (size_t) len);
+
+    line_len += (size_t) len;
+    if (newline != NULL)
+    {
+      if (newline != line + line_len - 1)
+      {
+        kmyth_log(LOG_ERR, "Unexpected data after agent request.");
+        break;
+      }
+      *newline = '\0';
+      return 0;
+    }
+  }
+
+  if (*passed_fd != -1)
+  {
+    close(*passed_fd);
+    *passed_fd = -1;
+  }
+  return 1;
+}
+
+//
+// agent_send_ok()
+//
+int agent_send_ok(int socket_fd, uint8_t * data, size_t data_len)
+{
+  char header[KMYTH_AGENT_MAX_LINE_LEN];
+  int header_len = snprintf(header, sizeof(header), "OK %zu\n", data_len);
+
+  if (write_to_fd(socket_fd, (uint8_t *) header, (size_t) header_len) ||
+      (data_len > 0 && write_to_fd(socket_fd, data, data_len)))
+  {
+    kmyth_log(LOG_ERR, "Failed to send agent response.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// agent_send_error()
+//
+int agent_send_error(int socket_fd, const char *reason)
+{
+  char header[KMYTH_AGENT_MAX_LINE_LEN];
+  int header_len = snprintf(header, sizeof(header), "ERR %s\n", reason);
+
+  if (header_len < 0 || (size_t) header_len >= sizeof(header))
+  {
+    header_len = snprintf(header, sizeof(header), "ERR\n");
+  }
+  if (write_to_fd(socket_fd, (uint8_t *) header, (size_t) header_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to send agent response.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// agent_send_request()
+//
+static int agent_send_request(int socket_fd, const char *request, int ski_fd)
+{
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {
+    .iov_base = (void *) request,
+    .iov_len = strlen(request)
+  };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1
+  };
+
+  if (ski_fd >= 0)
+  {
+    memset(control.buf, 0, sizeof(control.buf));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &ski_fd, sizeof(int));
+  }
+
+  // The request line is short, so a single message carries all of it.
+  ssize_t len = 0;
+
+  do
+  {
+    len = sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+  }
+  while (len < 0 && errno == EINTR);
+
+  if (len != (ssize_t) iov.iov_len)
+  {
+    kmyth_log(LOG_ERR, "Failed to send agent request.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// agent_request()
+//
+int agent_request(const char *socket_path, const char *request, int ski_fd,
+                  uint8_t ** data, size_t *data_len)
+{
+  *data = NULL;
+  *data_len = 0;
+
+  if (strlen(request) >= KMYTH_AGENT_MAX_LINE_LEN)
+  {
+    kmyth_log(LOG_ERR, "Agent request too long.");
+    return 1;
+  }
+
+  int socket_fd = -1;
+
+  if (setup_unix_client_socket(socket_path, &socket_fd))
+  {
+    return 1;
+  }
+
+  struct timeval timeout = {.tv_sec = KMYTH_AGENT_IO_TIMEOUT,.tv_usec = 0 };
+
+  if (agent_send_request(socket_fd, request, ski_fd))
+  {
+    close(socket_fd);
+    return 1;
+  }
+
+  // The agent may have to unseal the file (wait for the TPM) before it can
+  // respond, so only the rest of the response is subject to the timeout.
+  char header[KMYTH_AGENT_MAX_LINE_LEN];
+  size_t header_len = 0;
+
+  while (header_len < sizeof(header) - 1)
+  {
+    ssize_t len = read(socket_fd, header + header_len, 1);
+
+    if (len < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (len <= 0 || header[header_len] == '\n')
+    {
+      break;
+    }
+    if (header_len++ == 0)
+    {
+      setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                 sizeof(timeout));
+    }
+  }
+  header[header_len] = '\0';
+
+  unsigned long long length = 0;
+  int consumed = 0;
+
+  if (sscanf(header, "OK %llu%n", &length, &consumed) != 1 ||
+      header[consumed] != '\0' || length > SIZE_MAX)
+  {
+    kmyth_log(LOG_ERR, "Agent request failed: %s",
+              (strncmp(header, "ERR", 3) == 0 && header_len > 4) ?
+              header + 4 : "invalid response");
+    close(socket_fd);
+    return 1;
+  }
+
+  if (length > 0)
+  {
+    size_t length_read = 0;
+
+    *data = malloc((size_t) length);
+    if (*data == NULL ||
+        read_from_fd(socket_fd, *data, (size_t) length, &length_read) ||
+        length_read != length)
+    {
+      kmyth_log(LOG_ERR, "Failed to receive agent response.");
+      if (*data != NULL)
+      {
+        kmyth_clear_and_free(*data, (size_t) length);
+      }
+      *data = NULL;
+      close(socket_fd);
+      return 1;
+    }
+    *data_len = (size_t) length;
+  }
+
+  close(socket_fd);
+  return 0;
+}
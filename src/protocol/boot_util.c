@@ -0,0 +1,451 @@
+//
+// Utilities unsealing the keys needed at boot from a boot manifest, the
+// most urgent first, and delivering each as soon as its tier is unsealed.
+//
+
+#include "boot_util.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "file_loader.h"
+#include "memory_util.h"
+#include "parallel_util.h"
+
+#include "alloc_stats.h"
+
+// A boot unseal in progress. Tier t is entries tier_starts[t] up to (but
+// not including) tier_starts[t + 1]. Only the delivering stage touches the
+// report.
+typedef struct
+{
+  kmyth_boot_manifest *manifest;
+  kmyth_pool_t *pool;
+  size_t *tier_starts;
+  size_t tiers;
+  size_t tier;
+  char **paths;
+  uint8_t **inputs;
+  size_t *input_lens;
+  int *read_results;
+  uint8_t **outputs;
+  size_t *output_lens;
+  int *results;
+  kmyth_boot_deliver_fn deliver;
+  void *deliver_arg;
+  uint8_t *auth_bytes;
+  size_t auth_bytes_len;
+  uint8_t *owner_auth_bytes;
+  size_t oa_bytes_len;
+  uint8_t bool_policy_or;
+  struct timespec start;
+  kmyth_boot_report *report;
+} boot_schedule;
+
+//
+// boot_elapsed_us()
+//
+static int64_t boot_elapsed_us(const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t) (now.tv_sec - start->tv_sec) * 1000000 +
+    (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+//
+// boot_parse_entry()
+//
+static int boot_parse_entry(char *line, unsigned int targets,
+                            kmyth_boot_entry * entry, bool *selected)
+{
+  char *end = NULL;
+
+  errno = 0;
+  unsigned long priority = strtoul(line, &end, 10);
+
+  if (errno || end == line || !isspace((unsigned char) *end) ||
+      priority > KMYTH_BOOT_MAX_PRIORITY)
+  {
+    return 1;
+  }
+
+  char *path = end;
+
+  while (isspace((unsigned char) *path))
+  {
+    path++;
+  }
+
+  char *target = path;
+
+  while (*target != '\0' && !isspace((unsigned char) *target))
+  {
+    target++;
+  }
+
+  size_t path_len = (size_t) (target - path);
+
+  while (isspace((unsigned char) *target))
+  {
+    target++;
+  }
+  if (path_len == 0 || *target == '\0')
+  {
+    return 1;
+  }
+
+  // (the line has already been trimmed, so the argument runs to its end)
+  const char *arg = NULL;
+
+  if (strcmp(target, "agent") == 0)
+  {
+    entry->target = KMYTH_BOOT_TARGET_AGENT;
+  }
+  else if (strncmp(target, "file:", 5) == 0)
+  {
+    entry->target = KMYTH_BOOT_TARGET_FILE;
+    arg = target + 5;
+  }
+  else if (strncmp(target, "exec:", 5) == 0)
+  {
+    entry->target = KMYTH_BOOT_TARGET_EXEC;
+    arg = target + 5;
+  }
+  else if (strncmp(target, "send:", 5) == 0)
+  {
+    entry->target = KMYTH_BOOT_TARGET_SEND;
+    arg = target + 5;
+  }
+  else
+  {
+    return 1;
+  }
+  if (arg != NULL && *arg == '\0')
+  {
+    return 1;
+  }
+
+  *selected = ((entry->target & targets) != 0);
+  if (!*selected)
+  {
+    return 0;
+  }
+
+  entry->priority = (unsigned int) priority;
+  entry->ski_path = strndup(path, path_len);
+  entry->target_arg = (arg == NULL) ? NULL : strdup(arg);
+  if (entry->ski_path == NULL || (arg != NULL && entry->target_arg == NULL))
+  {
+    kmyth_log(LOG_ERR, "unable to allocate boot manifest entry");
+    free(entry->ski_path);
+    free(entry->target_arg);
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// boot_entry_compare()
+//
+static int boot_entry_compare(const void *a, const void *b)
+{
+  const kmyth_boot_entry *ea = (const kmyth_boot_entry *) a;
+  const kmyth_boot_entry *eb = (const kmyth_boot_entry *) b;
+
+  if (ea->priority != eb->priority)
+  {
+    return (ea->priority < eb->priority) ? -1 : 1;
+  }
+  return (ea->order < eb->order) ? -1 : (ea->order > eb->order);
+}
+
+//
+// boot_manifest_read()
+//
+int boot_manifest_read(const char *path, unsigned int targets,
+                       kmyth_boot_manifest * manifest)
+{
+  manifest->entries = NULL;
+  manifest->count = 0;
+
+  char **lines = NULL;
+  size_t lines_count = 0;
+
+  if (read_path_list((char *) path, &lines, &lines_count))
+  {
+    kmyth_log(LOG_ERR, "unable to read boot manifest (%s)", path);
+    return 1;
+  }
+  if (lines_count > 0)
+  {
+    manifest->entries = calloc(lines_count, sizeof(kmyth_boot_entry));
+    if (manifest->entries == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate boot manifest");
+      free_path_list(lines, lines_count);
+      return 1;
+    }
+  }
+
+  int retval = 0;
+
+  for (size_t i = 0; i < lines_count; i++)
+  {
+    kmyth_boot_entry *entry = &manifest->entries[manifest->count];
+    bool selected = false;
+
+    if (boot_parse_entry(lines[i], targets, entry, &selected))
+    {
+      kmyth_log(LOG_ERR, "invalid boot manifest entry (%s)", lines[i]);
+      retval = 1;
+      break;
+    }
+    if (selected)
+    {
+      entry->order = manifest->count++;
+    }
+  }
+  free_path_list(lines, lines_count);
+
+  if (retval)
+  {
+    boot_manifest_free(manifest);
+    return 1;
+  }
+
+  qsort(manifest->entries, manifest->count, sizeof(kmyth_boot_entry),
+        boot_entry_compare);
+
+  return 0;
+}
+
+//
+// boot_manifest_free()
+//
+void boot_manifest_free(kmyth_boot_manifest * manifest)
+{
+  for (size_t i = 0; i < manifest->count; i++)
+  {
+    free(manifest->entries[i].ski_path);
+    free(manifest->entries[i].target_arg);
+  }
+  free(manifest->entries);
+  manifest->entries = NULL;
+  manifest->count = 0;
+}
+
+//
+// boot_tier_read()
+//
+static void boot_tier_read(boot_schedule * schedule, size_t tier)
+{
+  size_t first = schedule->tier_starts[tier];
+  size_t n = schedule->tier_starts[tier + 1] - first;
+
+  // a .ski file that cannot be read fails its key (its empty input is not
+  // a .ski), which is reported when the tier is delivered
+  kmyth_load_files(schedule->paths + first, n, 0, schedule->inputs + first,
+                   schedule->input_lens + first,
+                   schedule->read_results + first);
+}
+
+//
+// boot_tier_deliver()
+//
+static int boot_tier_deliver(boot_schedule * schedule, size_t tier)
+{
+  kmyth_boot_report *report = schedule->report;
+  int retval = 0;
+
+  for (size_t i = schedule->tier_starts[tier];
+       i < schedule->tier_starts[tier + 1]; i++)
+  {
+    const kmyth_boot_entry *entry = &schedule->manifest->entries[i];
+
+    if (schedule->results[i] != 0)
+    {
+      kmyth_log(LOG_ERR, "unable to unseal boot key (%s)", entry->ski_path);
+      retval = 1;
+    }
+    else if (schedule->deliver(entry, schedule->outputs[i],
+                               schedule->output_lens[i],
+                               schedule->deliver_arg))
+    {
+      kmyth_log(LOG_ERR, "unable to deliver boot key (%s)", entry->ski_path);
+      retval = 1;
+    }
+    else
+    {
+      if (report->delivered++ == 0)
+      {
+        report->first_key_us = boot_elapsed_us(&schedule->start);
+      }
+      kmyth_log(LOG_DEBUG, "delivered boot key (%s, priority %u)",
+                entry->ski_path, entry->priority);
+    }
+
+    free(schedule->inputs[i]);
+    schedule->inputs[i] = NULL;
+    kmyth_clear_and_free(schedule->outputs[i], schedule->output_lens[i]);
+    schedule->outputs[i] = NULL;
+  }
+
+  return retval;
+}
+
+//
+// boot_stage()
+//
+static int boot_stage(size_t stage, void *arg)
+{
+  boot_schedule *schedule = (boot_schedule *) arg;
+  size_t tier = schedule->tier;
+
+  // stage 1: delivering the previous tier's keys, then reading the next
+  // tier's .ski files
+  if (stage == 1)
+  {
+    int retval = 0;
+
+    if (tier > 0)
+    {
+      retval = boot_tier_deliver(schedule, tier - 1);
+    }
+    if (tier + 1 < schedule->tiers)
+    {
+      boot_tier_read(schedule, tier + 1);
+    }
+    return retval;
+  }
+
+  // stage 0: the TPM work, for this tier
+  if (tier == schedule->tiers)
+  {
+    return 0;
+  }
+
+  size_t first = schedule->tier_starts[tier];
+  size_t n = schedule->tier_starts[tier + 1] - first;
+
+  // (a failed item is reported when it is delivered, and an item counts as
+  // failed unless the batch says otherwise, even if it could not start)
+  for (size_t i = first; i < first + n; i++)
+  {
+    schedule->results[i] = 1;
+  }
+  tpm2_kmyth_unseal_batch_pool(schedule->pool, n,
+                               schedule->inputs + first,
+                               schedule->input_lens + first,
+                               schedule->outputs + first,
+                               schedule->output_lens + first,
+                               schedule->results + first,
+                               schedule->auth_bytes,
+                               schedule->auth_bytes_len,
+                               schedule->owner_auth_bytes,
+                               schedule->oa_bytes_len,
+                               schedule->bool_policy_or);
+  return 0;
+}
+
+//
+// boot_unseal()
+//
+int boot_unseal(kmyth_pool_t * pool, kmyth_boot_manifest * manifest,
+                kmyth_boot_deliver_fn deliver, void *deliver_arg,
+                uint8_t * auth_bytes, size_t auth_bytes_len,
+                uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                uint8_t bool_policy_or, kmyth_boot_report * report)
+{
+  size_t count = manifest->count;
+
+  report->delivered = 0;
+  report->failed = 0;
+  report->tiers = 0;
+  report->first_key_us = -1;
+  report->total_us = 0;
+
+  boot_schedule schedule = {
+    .manifest = manifest,
+    .pool = pool,
+    .tier_starts = calloc(count + 1, sizeof(size_t)),
+    .paths = calloc(count + 1, sizeof(char *)),
+    .inputs = calloc(count + 1, sizeof(uint8_t *)),
+    .input_lens = calloc(count + 1, sizeof(size_t)),
+    .read_results = calloc(count + 1, sizeof(int)),
+    .outputs = calloc(count + 1, sizeof(uint8_t *)),
+    .output_lens = calloc(count + 1, sizeof(size_t)),
+    .results = calloc(count + 1, sizeof(int)),
+    .deliver = deliver,
+    .deliver_arg = deliver_arg,
+    .auth_bytes = auth_bytes,
+    .auth_bytes_len = auth_bytes_len,
+    .owner_auth_bytes = owner_auth_bytes,
+    .oa_bytes_len = oa_bytes_len,
+    .bool_policy_or = bool_policy_or,
+    .report = report
+  };
+
+  clock_gettime(CLOCK_MONOTONIC, &schedule.start);
+
+  if (schedule.tier_starts == NULL || schedule.paths == NULL ||
+      schedule.inputs == NULL || schedule.input_lens == NULL ||
+      schedule.read_results == NULL || schedule.outputs == NULL ||
+      schedule.output_lens == NULL || schedule.results == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate memory for boot unseal");
+    count = 0;
+  }
+
+  // the (sorted) entries split into a tier per priority
+  for (size_t i = 0; i < count; i++)
+  {
+    schedule.paths[i] = manifest->entries[i].ski_path;
+    if (i == 0 ||
+        manifest->entries[i].priority != manifest->entries[i - 1].priority)
+    {
+      schedule.tier_starts[schedule.tiers++] = i;
+    }
+  }
+  report->tiers = schedule.tiers;
+
+  // read the first tier, then, for each tier, unseal it while the previous
+  // one is delivered and the next one read (the last pass only delivers)
+  if (schedule.tiers > 0)
+  {
+    schedule.tier_starts[schedule.tiers] = count;
+    boot_tier_read(&schedule, 0);
+    for (size_t t = 0; t <= schedule.tiers; t++)
+    {
+      schedule.tier = t;
+      kmyth_parallel_for(2, 2, boot_stage, &schedule);
+    }
+  }
+
+  report->failed = manifest->count - report->delivered;
+  report->total_us = boot_elapsed_us(&schedule.start);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    free(schedule.inputs[i]);
+    kmyth_clear_and_free(schedule.outputs[i], schedule.output_lens[i]);
+  }
+  free(schedule.tier_starts);
+  free(schedule.paths);
+  free(schedule.inputs);
+  free(schedule.input_lens);
+  free(schedule.read_results);
+  free(schedule.outputs);
+  free(schedule.output_lens);
+  free(schedule.results);
+
+  return (report->failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+//
+// Utilities handing a key to its consumer through a sealed memory file,
+// rather than a file on disk - either inherited by a command kmyth runs or
+// passed over a UNIX domain socket.
+//
+
+#include "handoff_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "defines.h"
+#include "file_io.h"
+#include "socket_util.h"
+
+#include "alloc_stats.h"
+
+extern char **environ;
+
+//
+// handoff_get_size()
+//
+static int handoff_get_size(int fd, size_t *size)
+{
+  struct stat st;
+
+  if (fstat(fd, &st) == -1 || st.st_size < 0)
+  {
+    kmyth_log(LOG_ERR, "Failed to get key memory file size: %s",
+              strerror(errno));
+    return 1;
+  }
+  *size = (size_t) st.st_size;
+
+  return 0;
+}
+
+//
+// handoff_create_memfd()
+//
+int handoff_create_memfd(const char *name, uint8_t * data, size_t data_len,
+                         int *fd)
+{
+  *fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (*fd == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to create key memory file: %s",
+              strerror(errno));
+    return 1;
+  }
+
+  // the size is set up front, so the pages are allocated once, and then
+  // everything about the file is sealed (the offset is rewound for a
+  // consumer that reads, rather than maps, the file)
+  if (ftruncate(*fd, (off_t) data_len) == -1 ||
+      write_to_fd(*fd, data, data_len) ||
+      lseek(*fd, 0, SEEK_SET) == -1 ||
+      fcntl(*fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to fill and seal key memory file: %s",
+              strerror(errno));
+    close(*fd);
+    *fd = -1;
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// handoff_exec()
+//
+int handoff_exec(int fd, const char *command)
+{
+  size_t size = 0;
+
+  if (handoff_get_size(fd, &size))
+  {
+    return 1;
+  }
+
+  // The command's environment is built before forking, as the child (of a
+  // possibly multi-threaded process) may only make async-signal-safe calls
+  // before it execs.
+  char fd_env[64];
+  char size_env[64];
+  size_t env_count = 0;
+
+  snprintf(fd_env, sizeof(fd_env), "%s=%d", KMYTH_HANDOFF_FD_ENV, fd);
+  snprintf(size_env, sizeof(size_env), "%s=%zu", KMYTH_HANDOFF_SIZE_ENV,
+           size);
+  while (environ != NULL && environ[env_count] != NULL)
+  {
+    env_count++;
+  }
+
+  char **envp = calloc(env_count + 3, sizeof(char *));
+
+  if (envp == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate handoff command environment.");
+    return 1;
+  }
+
+  size_t envp_count = 0;
+
+  for (size_t i = 0; i < env_count; i++)
+  {
+    if (strncmp(environ[i], KMYTH_HANDOFF_FD_ENV "=",
+                strlen(KMYTH_HANDOFF_FD_ENV "=")) &&
+        strncmp(environ[i], KMYTH_HANDOFF_SIZE_ENV "=",
+                strlen(KMYTH_HANDOFF_SIZE_ENV "=")))
+    {
+      envp[envp_count++] = environ[i];
+    }
+  }
+  envp[envp_count++] = fd_env;
+  envp[envp_count++] = size_env;
+
+  char *const argv[] = { "sh", "-c", (char *) command, NULL };
+  pid_t pid = fork();
+
+  if (pid == 0)
+  {
+    // only the command inherits the key memory file
+    if (fcntl(fd, F_SETFD, 0) == 0)
+    {
+      execve("/bin/sh", argv, envp);
+    }
+    _exit(127);
+  }
+  free(envp);
+  if (pid == -1)
+  {
+    kmyth_log(LOG_ERR, "Failed to start handoff command: %s",
+              strerror(errno));
+    return 1;
+  }
+
+  int status = 0;
+
+  while (waitpid(pid, &status, 0) == -1)
+  {
+    if (errno != EINTR)
+    {
+      kmyth_log(LOG_ERR, "Failed to wait for handoff command: %s",
+                strerror(errno));
+      return 1;
+    }
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+  {
+    kmyth_log(LOG_ERR, "Handoff command failed (status %d).",
+              WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// handoff_send()
+//
+int handoff_send(int fd, const char *socket_path)
+{
+  size_t size = 0;
+
+  if (handoff_get_size(fd, &size))
+  {
+    return 1;
+  }
+
+  int socket_fd = -1;
+
+  if (setup_unix_client_socket(socket_path, &socket_fd))
+  {
+    return 1;
+  }
+
+  char line[64];
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {
+    .iov_base = line,
+    .iov_len = (size_t) snprintf(line, sizeof(line), "KEY %zu\n", size)
+  };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf)
+  };
+
+  memset(control.buf, 0, sizeof(control.buf));
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  // The line is short, so a single message carries all of it.
+  ssize_t len = 0;
+
+  do
+  {
+    len = sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+  }
+  while (len < 0 && errno == EINTR);
+
+  close(socket_fd);
+  if (len != (ssize_t) iov.iov_len)
+  {
+    kmyth_log(LOG_ERR, "Failed to pass key memory file to %s.", socket_path);
+    return 1;
+  }
+
+  return 0;
+}
@@ -1,3 +1,6 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
@@ -5,8 +8,12 @@
 #include <kmip/kmip.h>
 
 #include "defines.h"
+#include "kmip_util.h"
 #include "memory_util.h"
 #include "aes_gcm.h"
+#include "trace.h"
+
+#include "alloc_stats.h"
 
 #ifdef KMYTH_SGX
   #define time(ret_ptr) time_sgx((ret_ptr))
@@ -24,6 +31,478 @@
   }
 #endif
 
+// size of each block of the (growable) buffer KMIP messages are encoded in
+#define KMIP_ENCODING_BLOCK_SIZE 1024
+
+// length (in bytes) of the unique batch item ID given each item of a batch
+#define KMIP_BATCH_ITEM_ID_LEN 4
+
+// The structures one Get request batch item points into
+typedef struct
+{
+  TextString key_id;
+  GetRequestPayload payload;
+  uint8 batch_item_id_bytes[KMIP_BATCH_ITEM_ID_LEN];
+  ByteString batch_item_id;
+} kmip_get_request_item;
+
+// The structures one Get response batch item points into
+typedef struct
+{
+  ByteString key_material;
+  KeyValue key_value;
+  KeyBlock key_block;
+  SymmetricKey symmetric_key;
+  TextString key_id;
+  GetResponsePayload payload;
+  uint8 batch_item_id_bytes[KMIP_BATCH_ITEM_ID_LEN];
+  ByteString batch_item_id;
+} kmip_get_response_item;
+
+// Header in front of each allocation from a workspace's slab, so that a
+// reallocation knows how much to copy (its size also keeps the
+// allocations aligned)
+typedef union
+{
+  size_t size;
+  max_align_t align;
+} kmip_slab_header;
+
+//
+// get_kmip_workspace()
+//
+static kmip_workspace *get_kmip_workspace(KMIP * ctx)
+{
+  kmip_workspace *ws = (kmip_workspace *) ctx->state;
+
+  return (ws != NULL && ws->ctx == ctx) ? ws : NULL;
+}
+
+//
+// kmip_slab_owns()
+//
+static int kmip_slab_owns(kmip_workspace * ws, void *ptr)
+{
+  uint8_t *p = (uint8_t *) ptr;
+
+  return (ws->slab != NULL && p >= ws->slab && p < ws->slab + ws->slab_size);
+}
+
+//
+// kmip_slab_calloc()
+//
+// libkmip allocator taking (zeroed) memory from the workspace's slab, or,
+// once the slab is full, from the heap.
+//
+static void *kmip_slab_calloc(void *state, size_t num, size_t size)
+{
+  kmip_workspace *ws = (kmip_workspace *) state;
+  size_t header_len = sizeof(kmip_slab_header);
+
+  if (size != 0 && num > (SIZE_MAX - 2 * header_len) / size)
+  {
+    return NULL;
+  }
+
+  size_t len = num * size;
+  size_t total = header_len + (len + header_len - 1) / header_len * header_len;
+
+  ws->slab_wanted += total;
+  if (total > ws->slab_size - ws->slab_used)
+  {
+    return calloc(num, size);
+  }
+
+  kmip_slab_header *header = (kmip_slab_header *) (ws->slab + ws->slab_used);
+
+  ws->slab_used += total;
+  header->size = len;
+
+  return header + 1;
+}
+
+//
+// kmip_slab_realloc()
+//
+static void *kmip_slab_realloc(void *state, void *ptr, size_t size)
+{
+  kmip_workspace *ws = (kmip_workspace *) state;
+
+  if (ptr == NULL)
+  {
+    return kmip_slab_calloc(state, 1, size);
+  }
+  if (!kmip_slab_owns(ws, ptr))
+  {
+    return realloc(ptr, size);
+  }
+
+  kmip_slab_header *header = (kmip_slab_header *) ptr - 1;
+
+  if (size <= header->size)
+  {
+    return ptr;
+  }
+
+  void *moved = kmip_slab_calloc(state, 1, size);
+
+  if (moved != NULL)
+  {
+    memcpy(moved, ptr, header->size);
+  }
+  return moved;
+}
+
+//
+// kmip_slab_free()
+//
+static void kmip_slab_free(void *state, void *ptr)
+{
+  // slab memory is only released, all together, once the message is parsed
+  if (!kmip_slab_owns((kmip_workspace *) state, ptr))
+  {
+    free(ptr);
+  }
+}
+
+//
+// reset_kmip_slab()
+//
+// Wipes the slab for the next message, first growing it if the last
+// message did not fit.
+//
+static void reset_kmip_slab(kmip_workspace * ws)
+{
+  kmyth_clear(ws->slab, ws->slab_used);
+  ws->slab_used = 0;
+
+  if (ws->slab_wanted > ws->slab_size)
+  {
+    size_t slab_size = 2 * ws->slab_size;
+
+    if (slab_size < ws->slab_wanted)
+    {
+      slab_size = ws->slab_wanted;
+    }
+
+    uint8_t *slab = calloc(slab_size, 1);
+
+    // (without a larger slab, the overflow is just allocated from the heap)
+    if (slab != NULL)
+    {
+      kmyth_clear_and_free(ws->slab, ws->slab_size);
+      ws->slab = slab;
+      ws->slab_size = slab_size;
+    }
+  }
+  ws->slab_wanted = 0;
+}
+
+//
+// begin_kmip_decode()
+//
+// Sets the context up to decode a message, allocating the decoded
+// structures from the slab of the context's workspace (if any).
+//
+static void begin_kmip_decode(KMIP * ctx, unsigned char *message,
+                              size_t message_len)
+{
+  kmip_workspace *ws = get_kmip_workspace(ctx);
+
+  kmip_reset(ctx);
+  if (ws != NULL)
+  {
+    ws->calloc_func = ctx->calloc_func;
+    ws->realloc_func = ctx->realloc_func;
+    ws->free_func = ctx->free_func;
+    ctx->calloc_func = kmip_slab_calloc;
+    ctx->realloc_func = kmip_slab_realloc;
+    ctx->free_func = kmip_slab_free;
+  }
+  kmip_set_buffer(ctx, message, message_len);
+}
+
+//
+// end_kmip_decode()
+//
+// Detaches the decoded message from the context (once its structures have
+// been freed), wiping the workspace slab they were allocated from.
+//
+static void end_kmip_decode(KMIP * ctx)
+{
+  kmip_workspace *ws = get_kmip_workspace(ctx);
+
+  kmip_set_buffer(ctx, NULL, 0);
+  if (ws != NULL && ctx->calloc_func == kmip_slab_calloc)
+  {
+    // any error message was allocated from the slab too
+    kmip_clear_errors(ctx);
+    ctx->calloc_func = ws->calloc_func;
+    ctx->realloc_func = ws->realloc_func;
+    ctx->free_func = ws->free_func;
+    reset_kmip_slab(ws);
+  }
+}
+
+//
+// grow_kmip_buffer()
+//
+static int grow_kmip_buffer(void **buffer, size_t *buffer_size, size_t size)
+{
+  if (size <= *buffer_size)
+  {
+    return 0;
+  }
+
+  void *grown = malloc(size);
+
+  if (grown == NULL)
+  {
+    return 1;
+  }
+  free(*buffer);
+  *buffer = grown;
+  *buffer_size = size;
+
+  return 0;
+}
+
+//
+// get_batch_item_slabs()
+//
+// Provides zeroed lists of count items (holding the structures a batch item
+// points into) and batch items - the workspace's, if the context has one.
+//
+static int get_batch_item_slabs(KMIP * ctx, size_t count, size_t item_size,
+                                size_t batch_item_size, void **items,
+                                void **batch_items)
+{
+  kmip_workspace *ws = get_kmip_workspace(ctx);
+
+  *items = NULL;
+  *batch_items = NULL;
+  if (count > SIZE_MAX / item_size || count > SIZE_MAX / batch_item_size)
+  {
+    kmyth_log(LOG_ERR, "Too many KMIP batch items.");
+    return 1;
+  }
+
+  if (ws == NULL)
+  {
+    *items = calloc(count, item_size);
+    *batch_items = calloc(count, batch_item_size);
+  }
+  else if (grow_kmip_buffer(&ws->items, &ws->items_size, count * item_size)
+           == 0 &&
+           grow_kmip_buffer(&ws->batch_items, &ws->batch_items_size,
+                            count * batch_item_size) == 0)
+  {
+    *items = memset(ws->items, 0, count * item_size);
+    *batch_items = memset(ws->batch_items, 0, count * batch_item_size);
+  }
+
+  if (*items == NULL || *batch_items == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the KMIP batch items.");
+    if (ws == NULL)
+    {
+      free(*items);
+      free(*batch_items);
+    }
+    *items = NULL;
+    *batch_items = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// put_batch_item_slabs()
+//
+static void put_batch_item_slabs(KMIP * ctx, void *items, void *batch_items)
+{
+  if (get_kmip_workspace(ctx) == NULL)
+  {
+    free(items);
+    free(batch_items);
+  }
+}
+
+//
+// encode_kmip_message()
+//
+// Encodes either a request or a response message (whichever is not NULL)
+// into a newly allocated buffer, growing the encoding buffer from its
+// initial size until the message fits. The encoding buffer of the
+// context's workspace (if any) is used, and kept, instead of a temporary
+// one.
+//
+static int encode_kmip_message(KMIP * ctx,
+                               const RequestMessage * request_message,
+                               const ResponseMessage * response_message,
+                               size_t buffer_blocks,
+                               unsigned char **message, size_t *message_len)
+{
+  kmip_workspace *ws = get_kmip_workspace(ctx);
+  int result = KMIP_ERROR_BUFFER_FULL;
+  size_t buffer_total_size = buffer_blocks * KMIP_ENCODING_BLOCK_SIZE;
+  uint8 *encoding = NULL;
+
+  if (ws != NULL && ws->encoding_size >= buffer_total_size)
+  {
+    encoding = ws->encoding;
+    buffer_total_size = ws->encoding_size;
+  }
+
+  while (result == KMIP_ERROR_BUFFER_FULL)
+  {
+    if (encoding == NULL)
+    {
+      encoding = calloc(buffer_total_size, 1);
+      if (encoding == NULL)
+      {
+        kmyth_log(LOG_ERR, "Failed to allocate the KMIP encoding buffer.");
+        return 1;
+      }
+      if (ws != NULL)
+      {
+        kmyth_clear_and_free(ws->encoding, ws->encoding_size);
+        ws->encoding = encoding;
+        ws->encoding_size = buffer_total_size;
+      }
+    }
+    kmip_reset(ctx);
+    kmip_set_buffer(ctx, encoding, buffer_total_size);
+
+    if (request_message != NULL)
+    {
+      result = kmip_encode_request_message(ctx, request_message);
+    }
+    else
+    {
+      result = kmip_encode_response_message(ctx, response_message);
+    }
+
+    if (result == KMIP_ERROR_BUFFER_FULL)
+    {
+      kmip_set_buffer(ctx, NULL, 0);
+      if (ws == NULL)
+      {
+        kmyth_clear_and_free(encoding, buffer_total_size);
+      }
+      encoding = NULL;
+      buffer_total_size *= 2;
+    }
+  }
+
+  // Set up the official message buffer and clean up.
+  // This type conversion should be safe assuming libkmip hasn't done
+  // something odd.
+  *message_len = (size_t)(ctx->index - ctx->buffer);
+  *message = NULL;
+  if (result != KMIP_OK)
+  {
+    kmyth_log(LOG_ERR, "Failed to encode the KMIP message.");
+  }
+  else
+  {
+    *message = calloc(*message_len, sizeof(unsigned char));
+    if (*message == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the KMIP message buffer.");
+    }
+    else
+    {
+      memcpy(*message, encoding, *message_len);
+    }
+  }
+
+  kmip_set_buffer(ctx, NULL, 0);
+  if (ws == NULL)
+  {
+    kmyth_clear_and_free(encoding, buffer_total_size);
+  }
+  else
+  {
+    kmyth_clear(encoding, buffer_total_size);
+  }
+
+  return (*message == NULL) ? 1 : 0;
+}
+
+//
+// set_batch_item_id()
+//
+// Numbers the items of a multi-item batch (KMIP requires a unique batch
+// item ID on each item when there is more than one).
+//
+static void set_batch_item_id(uint8 *id_bytes, ByteString * id, size_t index)
+{
+  for (size_t i = 0; i < KMIP_BATCH_ITEM_ID_LEN; i++)
+  {
+    id_bytes[i] = (uint8) (index >> (8 * (KMIP_BATCH_ITEM_ID_LEN - 1 - i)));
+  }
+  id->value = id_bytes;
+  id->size = KMIP_BATCH_ITEM_ID_LEN;
+}
+
+//
+// kmip_workspace_init()
+//
+int kmip_workspace_init(kmip_workspace * ws, KMIP * ctx)
+{
+  if (ws == NULL || ctx == NULL || ctx->state != NULL)
+  {
+    kmyth_log(LOG_ERR, "Invalid KMIP context for a workspace.");
+    return 1;
+  }
+
+  memset(ws, 0, sizeof(kmip_workspace));
+  ws->slab = calloc(KMIP_WORKSPACE_SLAB_SIZE, 1);
+  if (ws->slab == NULL)
+  {
+    kmyth_log(LOG_ERR, "Failed to allocate the KMIP workspace.");
+    return 1;
+  }
+  ws->slab_size = KMIP_WORKSPACE_SLAB_SIZE;
+  ws->ctx = ctx;
+  ctx->state = ws;
+
+  return 0;
+}
+
+//
+// kmip_workspace_reset()
+//
+void kmip_workspace_reset(kmip_workspace * ws)
+{
+  kmip_reset(ws->ctx);
+  kmip_set_buffer(ws->ctx, NULL, 0);
+  kmyth_clear(ws->encoding, ws->encoding_size);
+  reset_kmip_slab(ws);
+}
+
+//
+// kmip_workspace_free()
+//
+void kmip_workspace_free(kmip_workspace * ws)
+{
+  if (ws == NULL)
+  {
+    return;
+  }
+  if (ws->ctx != NULL && ws->ctx->state == ws)
+  {
+    ws->ctx->state = NULL;
+  }
+  kmyth_clear_and_free(ws->encoding, ws->encoding_size);
+  free(ws->items);
+  free(ws->batch_items);
+  kmyth_clear_and_free(ws->slab, ws->slab_size);
+  memset(ws, 0, sizeof(kmip_workspace));
+}
+
 //
 // build_kmip_get_request()
 //
@@ -31,22 +510,35 @@ int build_kmip_get_request(KMIP * ctx,
                            unsigned char *id, size_t id_len,
                            unsigned char **request, size_t *request_len)
 {
-  // Set up the encoding buffer.
-  size_t buffer_blocks = 1;
-  size_t buffer_block_size = 1024;
-  size_t buffer_total_size = buffer_blocks * buffer_block_size;
+  return build_kmip_get_batch_request(ctx, &id, &id_len, 1,
+                                      request, request_len);
+}
 
-  uint8 *encoding = calloc(buffer_blocks, buffer_block_size);
+//
+// build_kmip_get_batch_request()
+//
+int build_kmip_get_batch_request(KMIP * ctx,
+                                 unsigned char **ids, size_t *id_lens,
+                                 size_t count,
+                                 unsigned char **request, size_t *request_len)
+{
+  if (ids == NULL || id_lens == NULL || count == 0 || count > INT32_MAX)
+  {
+    kmyth_log(LOG_ERR, "Invalid list of KMIP object IDs to retrieve.");
+    return 1;
+  }
+
+  kmip_get_request_item *items = NULL;
+  RequestBatchItem *batch_items = NULL;
 
-  if (encoding == NULL)
+  if (get_batch_item_slabs(ctx, count, sizeof(kmip_get_request_item),
+                           sizeof(RequestBatchItem), (void **) &items,
+                           (void **) &batch_items))
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the KMIP encoding buffer.");
     return 1;
   }
-  kmip_reset(ctx);
-  kmip_set_buffer(ctx, encoding, buffer_total_size);
 
-  // Build the KMIP Get request.
+  // Build the KMIP Get request, one batch item per ID.
   ProtocolVersion protocol_version = { 0 };
   kmip_init_protocol_version(&protocol_version, ctx->version);
 
@@ -56,65 +548,87 @@ int build_kmip_get_request(KMIP * ctx,
   header.protocol_version = &protocol_version;
   header.maximum_response_size = ctx->max_message_size;
   header.time_stamp = time(NULL);
-  header.batch_count = 1;
+  header.batch_count = (int32) count;
 
-  TextString key_id = { 0 };
-  key_id.value = (char *) id;
-  key_id.size = id_len;
+  for (size_t i = 0; i < count; i++)
+  {
+    items[i].key_id.value = (char *) ids[i];
+    items[i].key_id.size = id_lens[i];
 
-  GetRequestPayload payload = { 0 };
-  payload.unique_identifier = &key_id;
+    items[i].payload.unique_identifier = &items[i].key_id;
 
-  RequestBatchItem batch_item = { 0 };
-  kmip_init_request_batch_item(&batch_item);
-  batch_item.operation = KMIP_OP_GET;
-  batch_item.request_payload = &payload;
+    kmip_init_request_batch_item(&batch_items[i]);
+    batch_items[i].operation = KMIP_OP_GET;
+    batch_items[i].request_payload = &items[i].payload;
+    if (count > 1)
+    {
+      set_batch_item_id(items[i].batch_item_id_bytes,
+                        &items[i].batch_item_id, i);
+      batch_items[i].unique_batch_item_id = &items[i].batch_item_id;
+    }
+  }
 
   RequestMessage message = { 0 };
   message.request_header = &header;
-  message.batch_items = &batch_item;
-  message.batch_count = 1;
+  message.batch_items = batch_items;
+  message.batch_count = count;
 
-  int result = kmip_encode_request_message(ctx, &message);
+  int result = encode_kmip_message(ctx, &message, NULL, count,
+                                   request, request_len);
 
-  if (result != KMIP_OK)
+  put_batch_item_slabs(ctx, items, batch_items);
+
+  if (result != 0)
   {
     kmyth_log(LOG_ERR, "Failed to encode the KMIP key request.");
-    kmyth_clear_and_free(encoding, buffer_total_size);
-    kmip_set_buffer(ctx, NULL, 0);
     return 1;
   }
 
-  // Set up the official request buffer and clean up.
-  // This type conversion should be safe assuming libkmip hasn't done
-  // something odd.
-  *request_len = (size_t)(ctx->index - ctx->buffer);
-  *request = calloc(*request_len, sizeof(unsigned char));
-  if (request == NULL)
+  return 0;
+}
+
+//
+// parse_kmip_get_request()
+//
+int parse_kmip_get_request(KMIP * ctx,
+                           unsigned char *request, size_t request_len,
+                           unsigned char **id, size_t *id_len)
+{
+  unsigned char **ids = NULL;
+  size_t *id_lens = NULL;
+  size_t count = 0;
+
+  if (parse_kmip_get_batch_request(ctx, request, request_len,
+                                   &ids, &id_lens, &count))
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the KMIP request buffer.");
-    kmyth_clear_and_free(encoding, buffer_total_size);
-    kmip_set_buffer(ctx, NULL, 0);
     return 1;
   }
-  memcpy(*request, encoding, *request_len);
 
-  kmyth_clear_and_free(encoding, buffer_total_size);
-  kmip_set_buffer(ctx, NULL, 0);
+  if (count != 1)
+  {
+    kmyth_log(LOG_ERR, "Received incorrect number of requests (expected 1).");
+    free_kmip_get_batch(ids, id_lens, NULL, NULL, count);
+    return 1;
+  }
+
+  *id = ids[0];
+  *id_len = id_lens[0];
+  free(ids);
+  free(id_lens);
 
   return 0;
 }
 
 //
-// parse_kmip_get_request()
+// parse_kmip_get_batch_request()
 //
-int parse_kmip_get_request(KMIP * ctx,
-                           unsigned char *request, size_t request_len,
-                           unsigned char **id, size_t *id_len)
+int parse_kmip_get_batch_request(KMIP * ctx,
+                                 unsigned char *request, size_t request_len,
+                                 unsigned char ***ids, size_t **id_lens,
+                                 size_t *count)
 {
   // Set up the decoding buffer and data structures.
-  kmip_reset(ctx);
-  kmip_set_buffer(ctx, request, request_len);
+  begin_kmip_decode(ctx, request, request_len);
   RequestMessage message = { 0 };
 
   // Parse the request message and handle errors.
@@ -124,44 +638,74 @@ int parse_kmip_get_request(KMIP * ctx,
   {
     kmyth_log(LOG_ERR, "Failed to decode the KMIP request message.");
     kmip_free_request_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
+    end_kmip_decode(ctx);
     return 1;
   }
 
-  if (message.request_header->batch_count != 1)
+  if (message.request_header->batch_count < 1 ||
+      (size_t) message.request_header->batch_count != message.batch_count)
   {
-    kmyth_log(LOG_ERR, "Received incorrect number of requests (expected 1).");
+    kmyth_log(LOG_ERR, "Received incorrect number of requests.");
     kmip_free_request_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
+    end_kmip_decode(ctx);
     return 1;
   }
 
-  RequestBatchItem batch_item = message.batch_items[0];
+  for (size_t i = 0; i < message.batch_count; i++)
+  {
+    GetRequestPayload *payload =
+      (GetRequestPayload *) message.batch_items[i].request_payload;
 
-  if (batch_item.operation != KMIP_OP_GET)
+    if (message.batch_items[i].operation != KMIP_OP_GET ||
+        payload == NULL || payload->unique_identifier == NULL)
+    {
+      kmyth_log(LOG_ERR, "Did not receive a KMIP Get request.");
+      kmip_free_request_message(ctx, &message);
+      end_kmip_decode(ctx);
+      return 1;
+    }
+  }
+
+  // Set up the official ID buffers and clean up.
+  *count = message.batch_count;
+  *ids = calloc(*count, sizeof(unsigned char *));
+  *id_lens = calloc(*count, sizeof(size_t));
+  if (*ids == NULL || *id_lens == NULL)
   {
-    kmyth_log(LOG_ERR, "Did not receive a KMIP Get request.");
+    kmyth_log(LOG_ERR, "Failed to allocate the ID list.");
+    free_kmip_get_batch(*ids, *id_lens, NULL, NULL, 0);
+    *ids = NULL;
+    *id_lens = NULL;
+    *count = 0;
     kmip_free_request_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
+    end_kmip_decode(ctx);
     return 1;
   }
 
-  GetRequestPayload *payload = (GetRequestPayload *) batch_item.request_payload;
-
-  // Set up the official ID buffer and clean up.
-  *id = calloc(payload->unique_identifier->size, sizeof(unsigned char));
-  if (*id == NULL)
+  for (size_t i = 0; i < *count; i++)
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
-    kmip_free_request_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
-    return 1;
+    GetRequestPayload *payload =
+      (GetRequestPayload *) message.batch_items[i].request_payload;
+
+    (*ids)[i] = calloc(payload->unique_identifier->size,
+                       sizeof(unsigned char));
+    if ((*ids)[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
+      free_kmip_get_batch(*ids, *id_lens, NULL, NULL, *count);
+      *ids = NULL;
+      *id_lens = NULL;
+      *count = 0;
+      kmip_free_request_message(ctx, &message);
+      end_kmip_decode(ctx);
+      return 1;
+    }
+    (*id_lens)[i] = payload->unique_identifier->size;
+    memcpy((*ids)[i], payload->unique_identifier->value, (*id_lens)[i]);
   }
-  *id_len = payload->unique_identifier->size;
-  memcpy(*id, payload->unique_identifier->value, *id_len);
 
   kmip_free_request_message(ctx, &message);
-  kmip_set_buffer(ctx, NULL, 0);
+  end_kmip_decode(ctx);
 
   return 0;
 }
@@ -174,22 +718,47 @@ int build_kmip_get_response(KMIP * ctx,
                             unsigned char *key, size_t key_len,
                             unsigned char **response, size_t *response_len)
 {
-  // Set up the encoding buffer
-  size_t buffer_blocks = 1;
-  size_t buffer_block_size = 1024;
-  size_t buffer_total_size = buffer_blocks * buffer_block_size;
+  return build_kmip_get_batch_response(ctx, &id, &id_len, &key, &key_len, 1,
+                                       response, response_len);
+}
 
-  uint8 *encoding = calloc(buffer_blocks, buffer_block_size);
+//
+// build_kmip_get_batch_response()
+//
+int build_kmip_get_batch_response(KMIP * ctx,
+                                  unsigned char **ids, size_t *id_lens,
+                                  unsigned char **keys, size_t *key_lens,
+                                  size_t count,
+                                  unsigned char **response,
+                                  size_t *response_len)
+{
+  if (ids == NULL || id_lens == NULL || keys == NULL || key_lens == NULL ||
+      count == 0 || count > INT32_MAX)
+  {
+    kmyth_log(LOG_ERR, "Invalid list of KMIP keys to return.");
+    return 1;
+  }
 
-  if (encoding == NULL)
+  for (size_t i = 0; i < count; i++)
+  {
+    if (key_lens[i] > UINT32_MAX)
+    {
+      kmyth_log(LOG_ERR, "KMIP key too long.");
+      return 1;
+    }
+  }
+
+  kmip_get_response_item *items = NULL;
+  ResponseBatchItem *batch_items = NULL;
+
+  if (get_batch_item_slabs(ctx, count, sizeof(kmip_get_response_item),
+                           sizeof(ResponseBatchItem), (void **) &items,
+                           (void **) &batch_items))
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the KMIP encoding buffer.");
     return 1;
   }
-  kmip_reset(ctx);
-  kmip_set_buffer(ctx, encoding, buffer_total_size);
 
-  // Build the KMIP Get response
+  // Build the KMIP Get response, one batch item per key
   ProtocolVersion protocol_version = { 0 };
   kmip_init_protocol_version(&protocol_version, ctx->version);
 
@@ -198,67 +767,53 @@ int build_kmip_get_response(KMIP * ctx,
 
   header.protocol_version = &protocol_version;
   header.time_stamp = time(NULL);
-  header.batch_count = 1;
+  header.batch_count = (int32) count;
 
-  ByteString byte_string = { 0 };
-  byte_string.size = key_len;
-  byte_string.value = key;
+  for (size_t i = 0; i < count; i++)
+  {
+    items[i].key_material.size = (uint32) key_lens[i];
+    items[i].key_material.value = keys[i];
 
-  KeyValue key_value = { 0 };
-  key_value.key_material = &byte_string;
+    items[i].key_value.key_material = &items[i].key_material;
 
-  KeyBlock key_block = { 0 };
-  key_block.key_format_type = KMIP_KEYFORMAT_RAW;
-  key_block.key_value = &key_value;
+    items[i].key_block.key_format_type = KMIP_KEYFORMAT_RAW;
+    items[i].key_block.key_value = &items[i].key_value;
 
-  SymmetricKey symmetric_key = { 0 };
-  symmetric_key.key_block = &key_block;
+    items[i].symmetric_key.key_block = &items[i].key_block;
 
-  TextString key_id = { 0 };
-  key_id.value = (char *) id;
-  key_id.size = id_len;
+    items[i].key_id.value = (char *) ids[i];
+    items[i].key_id.size = id_lens[i];
 
-  GetResponsePayload payload = { 0 };
-  payload.object_type = KMIP_OBJTYPE_SYMMETRIC_KEY;
-  payload.unique_identifier = &key_id;
-  payload.object = &symmetric_key;
+    items[i].payload.object_type = KMIP_OBJTYPE_SYMMETRIC_KEY;
+    items[i].payload.unique_identifier = &items[i].key_id;
+    items[i].payload.object = &items[i].symmetric_key;
 
-  ResponseBatchItem batch_item = { 0 };
-  batch_item.operation = KMIP_OP_GET;
-  batch_item.result_status = KMIP_STATUS_SUCCESS;
-  batch_item.response_payload = &payload;
+    batch_items[i].operation = KMIP_OP_GET;
+    batch_items[i].result_status = KMIP_STATUS_SUCCESS;
+    batch_items[i].response_payload = &items[i].payload;
+    if (count > 1)
+    {
+      set_batch_item_id(items[i].batch_item_id_bytes,
+                        &items[i].batch_item_id, i);
+      batch_items[i].unique_batch_item_id = &items[i].batch_item_id;
+    }
+  }
 
   ResponseMessage message = { 0 };
   message.response_header = &header;
-  message.batch_items = &batch_item;
-  message.batch_count = 1;
+  message.batch_items = batch_items;
+  message.batch_count = count;
 
-  int result = kmip_encode_response_message(ctx, &message);
+  int result = encode_kmip_message(ctx, NULL, &message, count,
+                                   response, response_len);
 
-  if (result != KMIP_OK)
-  {
-    kmyth_log(LOG_ERR, "Failed to encode the KMIP Get response.");
-    kmyth_clear_and_free(encoding, buffer_total_size);
-    kmip_set_buffer(ctx, NULL, 0);
-    return 1;
-  }
+  put_batch_item_slabs(ctx, items, batch_items);
 
-  // Set up the official response buffer and clean up.
-  // This type conversion should be safe unless libkmip has done
-  // something odd.
-  *response_len = (size_t)(ctx->index - ctx->buffer);
-  *response = calloc(*response_len, sizeof(unsigned char));
-  if (response == NULL)
+  if (result != 0)
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the KMIP response buffer.");
-    kmyth_clear_and_free(encoding, buffer_total_size);
-    kmip_set_buffer(ctx, NULL, 0);
+    kmyth_log(LOG_ERR, "Failed to encode the KMIP Get response.");
     return 1;
   }
-  memcpy(*response, encoding, *response_len);
-
-  kmyth_clear_and_free(encoding, buffer_total_size);
-  kmip_set_buffer(ctx, NULL, 0);
 
   return 0;
 }
@@ -271,91 +826,198 @@ int parse_kmip_get_response(KMIP * ctx,
                             unsigned char **id, size_t *id_len,
                             unsigned char **key, size_t *key_len)
 {
-  // Set up the decoding buffer and data structures.
-  kmip_reset(ctx);
-  kmip_set_buffer(ctx, response, response_len);
-  ResponseMessage message = { 0 };
-
-  // Parse the response message and handle errors.
-  int result = kmip_decode_response_message(ctx, &message);
-
-  if (result != KMIP_OK)
+  unsigned char **ids = NULL;
+  size_t *id_lens = NULL;
+  unsigned char **keys = NULL;
+  size_t *key_lens = NULL;
+  size_t count = 0;
+  kmyth_span_t span;
+
+  kmyth_span_start(&span, "parse_kmip_get_response");
+  kmyth_span_set_int(&span, "kmip.response_bytes", (int64_t) response_len);
+
+  if (parse_kmip_get_batch_response(ctx, response, response_len,
+                                    &ids, &id_lens, &keys, &key_lens, &count))
   {
-    kmyth_log(LOG_ERR, "Failed to decode the KMIP response message.");
-    kmip_free_response_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
+    kmyth_span_end(&span, 1);
     return 1;
   }
 
-  if (message.response_header->batch_count != 1)
+  if (count != 1)
   {
     kmyth_log(LOG_ERR, "Received incorrect number of responses (expected 1).");
-    kmip_free_response_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
+    free_kmip_get_batch(ids, id_lens, keys, key_lens, count);
+    kmyth_span_end(&span, 1);
     return 1;
   }
 
-  ResponseBatchItem batch_item = message.batch_items[0];
+  *id = ids[0];
+  *id_len = id_lens[0];
+  *key = keys[0];
+  *key_len = key_lens[0];
+  free(ids);
+  free(id_lens);
+  free(keys);
+  free(key_lens);
+
+  kmyth_span_set_str(&span, "kmip.key_id", (const char *) *id, *id_len);
+  kmyth_span_set_int(&span, "kmip.key_bytes", (int64_t) *key_len);
+  kmyth_span_end(&span, 0);
+  return 0;
+}
 
-  if (batch_item.operation != KMIP_OP_GET)
+//
+// parse_kmip_get_batch_response()
+//
+int parse_kmip_get_batch_response(KMIP * ctx,
+                                  unsigned char *response,
+                                  size_t response_len,
+                                  unsigned char ***ids, size_t **id_lens,
+                                  unsigned char ***keys, size_t **key_lens,
+                                  size_t *count)
+{
+  // Set up the decoding buffer and data structures.
+  begin_kmip_decode(ctx, response, response_len);
+  ResponseMessage message = { 0 };
+
+  // Parse the response message and handle errors.
+  int result = kmip_decode_response_message(ctx, &message);
+
+  if (result != KMIP_OK)
   {
-    kmyth_log(LOG_ERR, "Did not receive a KMIP Get response.");
+    kmyth_log(LOG_ERR, "Failed to decode the KMIP response message.");
     kmip_free_response_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
+    end_kmip_decode(ctx);
     return 1;
   }
-  if (batch_item.result_status != KMIP_STATUS_SUCCESS)
+
+  if (message.response_header->batch_count < 1 ||
+      (size_t) message.response_header->batch_count != message.batch_count)
   {
-    kmyth_log(LOG_ERR, "The KMIP Get request failed.");
+    kmyth_log(LOG_ERR, "Received incorrect number of responses.");
     kmip_free_response_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
+    end_kmip_decode(ctx);
     return 1;
   }
 
-  GetResponsePayload *payload =
-    (GetResponsePayload *) batch_item.response_payload;
-  if (payload->object_type != KMIP_OBJTYPE_SYMMETRIC_KEY)
+  // Every item of the batch has to be a successful Get of a symmetric key
+  for (size_t i = 0; i < message.batch_count; i++)
   {
-    kmyth_log(LOG_ERR, "The received KMIP object is not a symmetric key.");
-    kmip_free_response_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
-    return 1;
-  }
+    ResponseBatchItem *batch_item = &message.batch_items[i];
+
+    if (batch_item->operation != KMIP_OP_GET)
+    {
+      kmyth_log(LOG_ERR, "Did not receive a KMIP Get response.");
+      kmip_free_response_message(ctx, &message);
+      end_kmip_decode(ctx);
+      return 1;
+    }
+    if (batch_item->result_status != KMIP_STATUS_SUCCESS)
+    {
+      kmyth_log(LOG_ERR, "The KMIP Get request failed.");
+      kmip_free_response_message(ctx, &message);
+      end_kmip_decode(ctx);
+      return 1;
+    }
+
+    GetResponsePayload *payload =
+      (GetResponsePayload *) batch_item->response_payload;
+    if (payload == NULL || payload->unique_identifier == NULL ||
+        payload->object_type != KMIP_OBJTYPE_SYMMETRIC_KEY ||
+        payload->object == NULL)
+    {
+      kmyth_log(LOG_ERR, "The received KMIP object is not a symmetric key.");
+      kmip_free_response_message(ctx, &message);
+      end_kmip_decode(ctx);
+      return 1;
+    }
 
-  SymmetricKey *symmetric_key = (SymmetricKey *) payload->object;
-  KeyBlock *key_block = symmetric_key->key_block;
-  KeyValue *key_value = key_block->key_value;
-  ByteString *key_material = key_value->key_material;
+    SymmetricKey *symmetric_key = (SymmetricKey *) payload->object;
+    if (symmetric_key->key_block == NULL ||
+        symmetric_key->key_block->key_value == NULL ||
+        symmetric_key->key_block->key_value->key_material == NULL)
+    {
+      kmyth_log(LOG_ERR, "The received KMIP symmetric key has no value.");
+      kmip_free_response_message(ctx, &message);
+      end_kmip_decode(ctx);
+      return 1;
+    }
+  }
 
   // Set up the official ID and key buffers and clean up.
-  *id = calloc(payload->unique_identifier->size, sizeof(unsigned char));
-  if (*id == NULL)
+  *count = message.batch_count;
+  *ids = calloc(*count, sizeof(unsigned char *));
+  *id_lens = calloc(*count, sizeof(size_t));
+  *keys = calloc(*count, sizeof(unsigned char *));
+  *key_lens = calloc(*count, sizeof(size_t));
+  if (*ids == NULL || *id_lens == NULL || *keys == NULL || *key_lens == NULL)
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
+    kmyth_log(LOG_ERR, "Failed to allocate the ID and key lists.");
+    free_kmip_get_batch(*ids, *id_lens, *keys, *key_lens, 0);
+    *ids = NULL;
+    *id_lens = NULL;
+    *keys = NULL;
+    *key_lens = NULL;
+    *count = 0;
     kmip_free_response_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
+    end_kmip_decode(ctx);
     return 1;
   }
-  *id_len = payload->unique_identifier->size;
-
-  memcpy(*id, payload->unique_identifier->value, *id_len);
 
-  *key = calloc(key_material->size, sizeof(unsigned char));
-  if (*key == NULL)
+  for (size_t i = 0; i < *count; i++)
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the key buffer.");
-    kmyth_clear_and_free(*id, *id_len);
-    *id = NULL;
-    *id_len = 0;
-    kmip_free_response_message(ctx, &message);
-    kmip_set_buffer(ctx, NULL, 0);
-    return 1;
+    GetResponsePayload *payload =
+      (GetResponsePayload *) message.batch_items[i].response_payload;
+    SymmetricKey *symmetric_key = (SymmetricKey *) payload->object;
+    ByteString *key_material = symmetric_key->key_block->key_value->key_material;
+
+    (*ids)[i] = calloc(payload->unique_identifier->size,
+                       sizeof(unsigned char));
+    (*keys)[i] = calloc(key_material->size, sizeof(unsigned char));
+    if ((*ids)[i] == NULL || (*keys)[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the ID or key buffer.");
+      free_kmip_get_batch(*ids, *id_lens, *keys, *key_lens, *count);
+      *ids = NULL;
+      *id_lens = NULL;
+      *keys = NULL;
+      *key_lens = NULL;
+      *count = 0;
+      kmip_free_response_message(ctx, &message);
+      end_kmip_decode(ctx);
+      return 1;
+    }
+    (*id_lens)[i] = payload->unique_identifier->size;
+    memcpy((*ids)[i], payload->unique_identifier->value, (*id_lens)[i]);
+    (*key_lens)[i] = key_material->size;
+    memcpy((*keys)[i], key_material->value, (*key_lens)[i]);
   }
-  *key_len = key_material->size;
-  memcpy(*key, key_material->value, *key_len);
 
   kmip_free_response_message(ctx, &message);
-  kmip_set_buffer(ctx, NULL, 0);
+  end_kmip_decode(ctx);
 
   return 0;
 }
+
+//
+// free_kmip_get_batch()
+//
+void free_kmip_get_batch(unsigned char **ids, size_t *id_lens,
+                         unsigned char **keys, size_t *key_lens, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    if (ids != NULL)
+    {
+      free(ids[i]);
+    }
+    if (keys != NULL && keys[i] != NULL)
+    {
+      kmyth_clear_and_free(keys[i], (key_lens != NULL) ? key_lens[i] : 0);
+    }
+  }
+  free(ids);
+  free(id_lens);
+  free(keys);
+  free(key_lens);
+}
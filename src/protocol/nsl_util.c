@@ -1,15 +1,22 @@
 //
-// An implementation of the Needham-Schroeder-Lowe protocol using OpenSSL RSA.
-// 
+// An implementation of the Needham-Schroeder-Lowe protocol using OpenSSL RSA
+// or (for EC key pairs) ECIES.
+//
 
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 #include <netdb.h>
 
 #include <openssl/ec.h>
 #include <openssl/evp.h>
 #include <openssl/aes.h>
+#include <openssl/kdf.h>
+#include <openssl/x509.h>
 
 #include <openssl/rand.h>
 #include <openssl/rsa.h>
@@ -17,11 +24,252 @@
 #include <openssl/engine.h>
 
 #include "defines.h"
+#include "file_io.h"
 #include "memory_util.h"
+#include "aes_gcm.h"
+#include "nonce_drbg.h"
+#include "nsl_util.h"
+
+#include "alloc_stats.h"
 
 #define NSL_NONCE_LEN 32
 #define NSL_SESSION_KEY_LEN 32
 
+// The longest ID that fits in a (stack built) nonce request or response -
+// RSA-OAEP limits the plaintext to well under this anyway (ECIES does not)
+#define NSL_MAX_ID_LEN 1024
+
+// Smallest allocation made for a connection's message buffer
+#define NSL_BUFFER_MIN_SIZE 256
+
+// Markers sent (in the clear) ahead of a client's first message, asking for
+// a session ticket along with the full negotiation, or resuming a session
+// with one. The first message of a full negotiation is RSA ciphertext (or,
+// for an EC key, begins with the length of a DER public key - under 256
+// bytes - so a zero byte), so is not (but for a 2^-120 chance) mistaken for
+// either.
+#define NSL_TICKET_MARKER "KMYTH-NSL-TICKET"
+#define NSL_RESUME_MARKER "KMYTH-NSL-RESUME"
+#define NSL_MARKER_LEN 16
+
+// The resumption secret for a session is derived from its session key and
+// this label (zero padded to the nonce length)
+static unsigned char nsl_resumption_label[NSL_NONCE_LEN] =
+  "kmyth nsl resumption secret";
+
+// ECIES (used in place of RSA encryption when the key pair is an EC P-256 or
+// X25519 one) encrypts each message under an AES-256-GCM key derived, with
+// HKDF-SHA256, from an ephemeral-static ECDH shared secret. The message is
+// the ephemeral public key (DER, after its 16-bit big-endian length), then
+// the AES-GCM IV, ciphertext and tag.
+#define NSL_ECIES_KEY_LEN 32
+#define NSL_ECIES_SECRET_MAX_LEN 66
+#define NSL_ECIES_LEN_BYTES 2
+
+// The HKDF info for ECIES keys (the salt is the ephemeral public key)
+static const unsigned char nsl_ecies_label[] = "kmyth nsl ecies key";
+
+//
+// key_is_ec()
+//
+static bool key_is_ec(EVP_PKEY_CTX * ctx)
+{
+  EVP_PKEY *pkey = EVP_PKEY_CTX_get0_pkey(ctx);
+
+  if (NULL == pkey)
+  {
+    return false;
+  }
+
+  int type = EVP_PKEY_base_id(pkey);
+
+  return (type == EVP_PKEY_EC || type == EVP_PKEY_X25519);
+}
+
+//
+// derive_ecies_key()
+//
+static int derive_ecies_key(EVP_PKEY_CTX * own, EVP_PKEY * peer,
+                            const unsigned char *ephemeral,
+                            size_t ephemeral_len, unsigned char *key)
+{
+  unsigned char secret[NSL_ECIES_SECRET_MAX_LEN];
+  size_t secret_len = sizeof(secret);
+
+  if (EVP_PKEY_derive_init(own) <= 0 ||
+      EVP_PKEY_derive_set_peer(own, peer) <= 0 ||
+      EVP_PKEY_derive(own, secret, &secret_len) <= 0)
+  {
+    kmyth_log(LOG_ERR, "Failed to derive the ECDH shared secret.");
+    return 1;
+  }
+
+  EVP_PKEY_CTX *kdf = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+  size_t key_len = NSL_ECIES_KEY_LEN;
+  int result = 1;
+
+  if (NULL != kdf &&
+      EVP_PKEY_derive_init(kdf) > 0 &&
+      EVP_PKEY_CTX_set_hkdf_md(kdf, EVP_sha256()) > 0 &&
+      EVP_PKEY_CTX_set1_hkdf_salt(kdf, ephemeral, (int) ephemeral_len) > 0 &&
+      EVP_PKEY_CTX_set1_hkdf_key(kdf, secret, (int) secret_len) > 0 &&
+      EVP_PKEY_CTX_add1_hkdf_info(kdf, nsl_ecies_label,
+                                  (int) (sizeof(nsl_ecies_label) - 1)) > 0 &&
+      EVP_PKEY_derive(kdf, key, &key_len) > 0 &&
+      key_len == NSL_ECIES_KEY_LEN)
+  {
+    result = 0;
+  }
+  else
+  {
+    kmyth_log(LOG_ERR, "Failed to derive the ECIES key.");
+  }
+
+  EVP_PKEY_CTX_free(kdf);
+  kmyth_clear(secret, sizeof(secret));
+
+  return result;
+}
+
+//
+// ecies_encrypt_into_buffer()
+//
+static int ecies_encrypt_into_buffer(EVP_PKEY_CTX * ctx,
+                                     const unsigned char *p, size_t p_len,
+                                     nsl_buffer * c)
+{
+  // Generate an ephemeral key pair on the recipient key's curve.
+  EVP_PKEY *peer = EVP_PKEY_CTX_get0_pkey(ctx);
+  EVP_PKEY_CTX *gen_ctx = EVP_PKEY_CTX_new(peer, NULL);
+  EVP_PKEY *ephemeral = NULL;
+
+  if (NULL == gen_ctx ||
+      EVP_PKEY_keygen_init(gen_ctx) <= 0 ||
+      EVP_PKEY_keygen(gen_ctx, &ephemeral) <= 0)
+  {
+    kmyth_log(LOG_ERR, "Failed to generate the ephemeral ECIES key.");
+    EVP_PKEY_CTX_free(gen_ctx);
+    return 1;
+  }
+  EVP_PKEY_CTX_free(gen_ctx);
+
+  unsigned char *ephemeral_der = NULL;
+  int ephemeral_len = i2d_PUBKEY(ephemeral, &ephemeral_der);
+  EVP_PKEY_CTX *derive_ctx = EVP_PKEY_CTX_new(ephemeral, NULL);
+  unsigned char key[NSL_ECIES_KEY_LEN];
+  int result = 1;
+
+  if (ephemeral_len <= 0 || ephemeral_len > UINT16_MAX || NULL == derive_ctx)
+  {
+    kmyth_log(LOG_ERR, "Failed to encode the ephemeral ECIES key.");
+  }
+  else if (derive_ecies_key(derive_ctx, peer, ephemeral_der,
+                            (size_t) ephemeral_len, key) == 0)
+  {
+    // Append the ephemeral public key and then the AES-GCM ciphertext.
+    size_t start = c->len;
+    size_t gcm_len = GCM_IV_LEN + p_len + GCM_TAG_LEN;
+    size_t out_len = 0;
+    unsigned char *out = nsl_buffer_append(c, NSL_ECIES_LEN_BYTES +
+                                           (size_t) ephemeral_len + gcm_len);
+
+    if (NULL != out)
+    {
+      out[0] = (unsigned char) (ephemeral_len >> 8);
+      out[1] = (unsigned char) ephemeral_len;
+      memcpy(out + NSL_ECIES_LEN_BYTES, ephemeral_der, (size_t) ephemeral_len);
+      out += NSL_ECIES_LEN_BYTES + (size_t) ephemeral_len;
+      result = aes_gcm_encrypt_buf(key, NSL_ECIES_KEY_LEN,
+                                   (unsigned char *) p, p_len,
+                                   out, gcm_len, &out_len);
+    }
+    if (result)
+    {
+      kmyth_log(LOG_ERR, "Failed to encrypt the plaintext.");
+      c->len = start;
+    }
+    else
+    {
+      c->len = start + NSL_ECIES_LEN_BYTES + (size_t) ephemeral_len + out_len;
+    }
+    kmyth_clear(key, sizeof(key));
+  }
+
+  EVP_PKEY_CTX_free(derive_ctx);
+  OPENSSL_free(ephemeral_der);
+  EVP_PKEY_free(ephemeral);
+
+  return result;
+}
+
+//
+// ecies_decrypt_into_buffer()
+//
+static int ecies_decrypt_into_buffer(EVP_PKEY_CTX * ctx,
+                                     const unsigned char *c, size_t c_len,
+                                     nsl_buffer * p)
+{
+  // Split off the ephemeral public key.
+  size_t ephemeral_len = 0;
+
+  if (c_len >= NSL_ECIES_LEN_BYTES)
+  {
+    ephemeral_len = ((size_t) c[0] << 8) | c[1];
+  }
+  if (c_len < NSL_ECIES_LEN_BYTES + ephemeral_len + GCM_IV_LEN + GCM_TAG_LEN)
+  {
+    kmyth_log(LOG_ERR, "The ECIES ciphertext is malformed.");
+    return 1;
+  }
+
+  const unsigned char *ephemeral_der = c + NSL_ECIES_LEN_BYTES;
+  const unsigned char *der = ephemeral_der;
+  EVP_PKEY *ephemeral = d2i_PUBKEY(NULL, &der, (long) ephemeral_len);
+
+  if (NULL == ephemeral ||
+      EVP_PKEY_base_id(ephemeral) !=
+      EVP_PKEY_base_id(EVP_PKEY_CTX_get0_pkey(ctx)))
+  {
+    kmyth_log(LOG_ERR, "The ephemeral ECIES key is invalid.");
+    EVP_PKEY_free(ephemeral);
+    return 1;
+  }
+
+  unsigned char key[NSL_ECIES_KEY_LEN];
+  int result = derive_ecies_key(ctx, ephemeral, ephemeral_der,
+                                ephemeral_len, key);
+
+  EVP_PKEY_free(ephemeral);
+  if (result)
+  {
+    return 1;
+  }
+
+  // Decrypt the ciphertext into the (emptied) buffer.
+  const unsigned char *gcm = ephemeral_der + ephemeral_len;
+  size_t gcm_len = c_len - NSL_ECIES_LEN_BYTES - ephemeral_len;
+  size_t p_size = gcm_len - GCM_IV_LEN - GCM_TAG_LEN;
+  size_t p_len = 0;
+
+  p->len = 0;
+
+  unsigned char *out = nsl_buffer_append(p, p_size);
+
+  result = (NULL == out) ? 1 :
+    aes_gcm_decrypt_buf(key, NSL_ECIES_KEY_LEN, (unsigned char *) gcm,
+                        gcm_len, out, p_size, &p_len);
+  kmyth_clear(key, sizeof(key));
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to decrypt the ciphertext.");
+    p->len = 0;
+    return 1;
+  }
+  p->len = p_len;
+
+  return 0;
+}
+
 //
 // encrypt_with_key_pair()
 //
@@ -29,6 +277,20 @@ int encrypt_with_key_pair(EVP_PKEY_CTX * ctx,
                           const unsigned char *p, size_t p_len,
                           unsigned char **c, size_t *c_len)
 {
+  if (key_is_ec(ctx))
+  {
+    nsl_buffer out = { 0 };
+
+    if (ecies_encrypt_into_buffer(ctx, p, p_len, &out))
+    {
+      nsl_buffer_free(&out);
+      return 1;
+    }
+    *c = out.data;
+    *c_len = out.len;
+    return 0;
+  }
+
   // Initialize the context for encryption.
   int result = EVP_PKEY_encrypt_init(ctx);
 
@@ -73,6 +335,20 @@ int decrypt_with_key_pair(EVP_PKEY_CTX * ctx,
                           const unsigned char *c, size_t c_len,
                           unsigned char **p, size_t *p_len)
 {
+  if (key_is_ec(ctx))
+  {
+    nsl_buffer out = { 0 };
+
+    if (ecies_decrypt_into_buffer(ctx, c, c_len, &out))
+    {
+      nsl_buffer_free(&out);
+      return 1;
+    }
+    *p = out.data;
+    *p_len = out.len;
+    return 0;
+  }
+
   // Initialize the context for decryption.
   int result = EVP_PKEY_decrypt_init(ctx);
 
@@ -111,55 +387,89 @@ int decrypt_with_key_pair(EVP_PKEY_CTX * ctx,
 }
 
 //
-// build_nonce_request()
-// 
-int build_nonce_request(EVP_PKEY_CTX * ctx,
-                        unsigned char *nonce, size_t nonce_len,
-                        unsigned char *id, size_t id_len,
-                        unsigned char **request, size_t *request_len)
+// nsl_buffer_append()
+//
+unsigned char *nsl_buffer_append(nsl_buffer * buf, size_t len)
 {
-  if (NSL_NONCE_LEN != nonce_len)
+  if (len > SIZE_MAX - buf->len)
   {
-    kmyth_log(LOG_ERR,
-              "Invalid nonce length provided; received: %zd, expected: %zd",
-              nonce_len, NSL_NONCE_LEN);
-    return 1;
+    kmyth_log(LOG_ERR, "Message buffer length overflow.");
+    return NULL;
   }
+  if (buf->len + len > buf->size)
+  {
+    // grow (at least doubling), clearing the old allocation as it may hold
+    // keys or nonces
+    size_t size = (buf->size < NSL_BUFFER_MIN_SIZE) ?
+      NSL_BUFFER_MIN_SIZE : buf->size;
 
-  // TODO Add a length check for the ID as well.
+    while (size < buf->len + len)
+    {
+      size = (size > SIZE_MAX / 2) ? buf->len + len : 2 * size;
+    }
 
-  // Allocate the unencrypted request buffer.
-  unsigned char *message = NULL;
-  size_t message_len = id_len + nonce_len + (2 * sizeof(size_t));
+    unsigned char *data = calloc(size, sizeof(unsigned char));
 
-  message = calloc(message_len, sizeof(unsigned char));
-  if (message == NULL)
-  {
-    kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
-    return 1;
+    if (NULL == data)
+    {
+      kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
+      return NULL;
+    }
+    if (buf->len > 0)
+    {
+      memcpy(data, buf->data, buf->len);
+    }
+    kmyth_clear_and_free(buf->data, buf->size);
+    buf->data = data;
+    buf->size = size;
   }
 
-  // Build the nonce request message.
-  unsigned char *index = message;
+  unsigned char *appended = buf->data + buf->len;
 
-  memcpy(index, &nonce_len, sizeof(size_t));
-  index += sizeof(size_t);
-  memcpy(index, nonce, nonce_len);
-  index += nonce_len;
-  memcpy(index, &id_len, sizeof(size_t));
-  index += sizeof(size_t);
-  memcpy(index, id, id_len);
+  buf->len += len;
+
+  return appended;
+}
+
+//
+// nsl_buffer_free()
+//
+void nsl_buffer_free(nsl_buffer * buf)
+{
+  kmyth_clear_and_free(buf->data, buf->size);
+  buf->data = NULL;
+  buf->size = 0;
+  buf->len = 0;
+}
 
-  // Encrypt the nonce request and then clean up the unencrypted request.
-  int result =
-    encrypt_with_key_pair(ctx, message, message_len, request, request_len);
+//
+// nsl_connection_init()
+//
+void nsl_connection_init(nsl_connection * conn, int socket_fd)
+{
+  memset(conn, 0, sizeof(nsl_connection));
+  conn->socket_fd = socket_fd;
+}
 
-  kmyth_clear_and_free(message, message_len);
+//
+// nsl_connection_free()
+//
+void nsl_connection_free(nsl_connection * conn)
+{
+  nsl_buffer_free(&conn->send);
+  nsl_buffer_free(&conn->recv);
+  nsl_buffer_free(&conn->scratch);
+}
 
-  // Handle encryption errors if any occurred.
-  if (result)
+//
+// nsl_frame_begin()
+//
+int nsl_frame_begin(nsl_connection * conn)
+{
+  // room for the header, which is filled in once the length is known
+  conn->send.len = 0;
+  if (NULL == nsl_buffer_append(&conn->send, NSL_FRAME_HEADER_LEN))
   {
-    kmyth_log(LOG_ERR, "Failed to encrypt the nonce request.");
     return 1;
   }
 
@@ -167,242 +477,191 @@ int build_nonce_request(EVP_PKEY_CTX * ctx,
 }
 
 //
-// parse_nonce_request()
+// nsl_send_frame()
 //
-int parse_nonce_request(EVP_PKEY_CTX * ctx,
-                        unsigned char *request, size_t request_len,
-                        unsigned char **nonce, size_t *nonce_len,
-                        unsigned char **id, size_t *id_len)
+int nsl_send_frame(nsl_connection * conn)
 {
-  // Decrypt the nonce request.
-  unsigned char *message = NULL;
-  size_t message_len = 0;
-  int result =
-    decrypt_with_key_pair(ctx, request, request_len, &message, &message_len);
+  size_t payload_len = conn->send.len - NSL_FRAME_HEADER_LEN;
 
-  if (result)
+  if (payload_len > NSL_FRAME_MAX_LEN)
   {
-    kmyth_log(LOG_ERR, "Failed to decrypt the nonce request.");
+    kmyth_log(LOG_ERR, "Message length (%zu bytes) exceeds the maximum.",
+              payload_len);
     return 1;
   }
-  unsigned char *index = message;
 
-  // Parse out the nonce.
-  memcpy(nonce_len, index, sizeof(size_t));
-  index += sizeof(size_t);
-  *nonce = calloc(*nonce_len, sizeof(unsigned char));
-  if (*nonce == NULL)
+  // the header is the payload length, in network byte order
+  uint32_t header = htonl((uint32_t) payload_len);
+
+  memcpy(conn->send.data, &header, NSL_FRAME_HEADER_LEN);
+  if (write_to_fd(conn->socket_fd, conn->send.data, conn->send.len))
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the nonce buffer.");
+    kmyth_log(LOG_ERR, "Failed to fully send the message.");
+    return 1;
+  }
 
-    *nonce_len = 0;
+  return 0;
+}
 
-    kmyth_clear_and_free(message, message_len);
+//
+// nsl_recv_frame()
+//
+int nsl_recv_frame(nsl_connection * conn, unsigned char **payload,
+                   size_t *payload_len)
+{
+  uint32_t header = 0;
+  size_t bytes_read = 0;
 
+  if (read_from_fd(conn->socket_fd, (uint8_t *) & header,
+                   NSL_FRAME_HEADER_LEN, &bytes_read) ||
+      bytes_read != NSL_FRAME_HEADER_LEN)
+  {
+    kmyth_log(LOG_ERR, "Failed to receive the message header.");
     return 1;
   }
-  memcpy(*nonce, index, *nonce_len);
-  index += *nonce_len;
-
-  // Parse out the ID.
-  memcpy(id_len, index, sizeof(size_t));
-  index += sizeof(size_t);
-  *id = calloc(*id_len, sizeof(unsigned char));
-  if (*id == NULL)
-  {
-    kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
 
-    kmyth_clear_and_free(*nonce, *nonce_len);
-    *nonce = NULL;
-    *nonce_len = 0;
+  size_t len = (size_t) ntohl(header);
 
-    *id_len = 0;
-
-    kmyth_clear_and_free(message, message_len);
+  if (len > NSL_FRAME_MAX_LEN)
+  {
+    kmyth_log(LOG_ERR, "Message length (%zu bytes) exceeds the maximum.",
+              len);
+    return 1;
+  }
 
+  conn->recv.len = 0;
+  if (NULL == nsl_buffer_append(&conn->recv, len) ||
+      read_from_fd(conn->socket_fd, conn->recv.data, len, &bytes_read) ||
+      bytes_read != len)
+  {
+    kmyth_log(LOG_ERR, "Failed to receive the message.");
     return 1;
   }
-  memcpy(*id, index, *id_len);
 
-  kmyth_clear_and_free(message, message_len);
+  *payload = conn->recv.data;
+  *payload_len = len;
 
   return 0;
 }
 
 //
-// build_nonce_response()
+// encrypt_into_buffer()
 //
-int build_nonce_response(EVP_PKEY_CTX * ctx,
-                         unsigned char *nonce_a, size_t nonce_a_len,
-                         unsigned char *nonce_b, size_t nonce_b_len,
-                         unsigned char *id, size_t id_len,
-                         unsigned char **response, size_t *response_len)
+static int encrypt_into_buffer(EVP_PKEY_CTX * ctx,
+                               const unsigned char *p, size_t p_len,
+                               nsl_buffer * c)
 {
-  // Allocate the unencrypted response buffer.
-  unsigned char *message = NULL;
-  size_t message_len =
-    id_len + nonce_a_len + nonce_b_len + (3 * sizeof(size_t));
-  message = calloc(message_len, sizeof(unsigned char));
-  if (message == NULL)
+  if (key_is_ec(ctx))
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
-    return 1;
+    return ecies_encrypt_into_buffer(ctx, p, p_len, c);
   }
 
-  // Build the nonce response message.
-  unsigned char *index = message;
-
-  memcpy(index, &nonce_a_len, sizeof(size_t));
-  index += sizeof(size_t);
-  memcpy(index, nonce_a, nonce_a_len);
-  index += nonce_a_len;
-  memcpy(index, &nonce_b_len, sizeof(size_t));
-  index += sizeof(size_t);
-  memcpy(index, nonce_b, nonce_b_len);
-  index += nonce_b_len;
-  memcpy(index, &id_len, sizeof(size_t));
-  index += sizeof(size_t);
-  memcpy(index, id, id_len);
+  size_t c_len = 0;
 
-  // Encrypt the nonce response and then clean up the unencrypted response.
-  int result =
-    encrypt_with_key_pair(ctx, message, message_len, response, response_len);
+  // Initialize the context, and determine the length of the ciphertext.
+  if (EVP_PKEY_encrypt_init(ctx) <= 0 ||
+      EVP_PKEY_encrypt(ctx, NULL, &c_len, p, p_len) <= 0)
+  {
+    kmyth_log(LOG_ERR, "Failed to initialize the EVP context for encryption.");
+    return 1;
+  }
 
-  kmyth_clear_and_free(message, message_len);
+  // Encrypt the plaintext onto the end of the buffer.
+  size_t start = c->len;
+  unsigned char *out = nsl_buffer_append(c, c_len);
 
-  // Handle encryption errors if any occurred.
-  if (result)
+  if (NULL == out || EVP_PKEY_encrypt(ctx, out, &c_len, p, p_len) <= 0)
   {
-    kmyth_log(LOG_ERR, "Failed to encrypt the nonce response.");
+    kmyth_log(LOG_ERR, "Failed to encrypt the plaintext.");
+    c->len = start;
     return 1;
   }
+  c->len = start + c_len;
 
   return 0;
 }
 
 //
-// parse_nonce_response()
+// decrypt_into_buffer()
 //
-int parse_nonce_response(EVP_PKEY_CTX * ctx,
-                         unsigned char *response, size_t response_len,
-                         unsigned char **nonce_a, size_t *nonce_a_len,
-                         unsigned char **nonce_b, size_t *nonce_b_len,
-                         unsigned char **id, size_t *id_len)
+static int decrypt_into_buffer(EVP_PKEY_CTX * ctx,
+                               const unsigned char *c, size_t c_len,
+                               nsl_buffer * p)
 {
-  // Decrypt the nonce response.
-  unsigned char *message = NULL;
-  size_t message_len = 0;
-  int result =
-    decrypt_with_key_pair(ctx, response, response_len, &message, &message_len);
-
-  if (result)
+  if (key_is_ec(ctx))
   {
-    kmyth_log(LOG_ERR, "Failed to decrypt the nonce response.");
-    return 1;
+    return ecies_decrypt_into_buffer(ctx, c, c_len, p);
   }
 
-  // TODO Check and validate the length of the decrypted response message
-  // before proceeding with the parse.
-
-  unsigned char *index = message;
+  size_t p_len = 0;
 
-  // Parse out the first nonce.
-  memcpy(nonce_a_len, index, sizeof(size_t));
-  index += sizeof(size_t);
-  if (NSL_NONCE_LEN != *nonce_a_len)
+  // Initialize the context, and determine the length of the plaintext.
+  if (EVP_PKEY_decrypt_init(ctx) <= 0 ||
+      EVP_PKEY_decrypt(ctx, NULL, &p_len, c, c_len) <= 0)
   {
-    kmyth_log(LOG_ERR,
-              "Unexpected length for nonce A; received: %zd bytes, expected: %zd bytes",
-              *nonce_a_len, NSL_NONCE_LEN);
-    *nonce_a_len = 0;
-    kmyth_clear_and_free(message, message_len);
+    kmyth_log(LOG_ERR, "Failed to initialize the EVP context for decryption.");
     return 1;
   }
-  *nonce_a = calloc(*nonce_a_len, sizeof(unsigned char));
-  if (*nonce_a == NULL)
-  {
-    kmyth_log(LOG_ERR, "Failed to allocate the first nonce buffer.");
-
-    *nonce_a_len = 0;
 
-    kmyth_clear_and_free(message, message_len);
+  // Decrypt the ciphertext into the (emptied) buffer.
+  p->len = 0;
 
-    return 1;
-  }
-  memcpy(*nonce_a, index, *nonce_a_len);
-  index += *nonce_a_len;
+  unsigned char *out = nsl_buffer_append(p, p_len);
 
-  // Parse out the second nonce.
-  memcpy(nonce_b_len, index, sizeof(size_t));
-  index += sizeof(size_t);
-  if (NSL_NONCE_LEN != *nonce_b_len)
+  if (NULL == out || EVP_PKEY_decrypt(ctx, out, &p_len, c, c_len) <= 0)
   {
-    kmyth_log(LOG_ERR,
-              "Unexpected length for nonce B; received: %zd bytes, expected: %zd bytes",
-              *nonce_b_len, NSL_NONCE_LEN);
-
-    *nonce_a_len = 0;
-    *nonce_b_len = 0;
-
-    kmyth_clear_and_free(nonce_a, *nonce_a_len);
-    kmyth_clear_and_free(message, message_len);
-
+    kmyth_log(LOG_ERR, "Failed to decrypt the ciphertext.");
+    p->len = 0;
     return 1;
   }
-  *nonce_b = calloc(*nonce_b_len, sizeof(unsigned char));
-  if (*nonce_b == NULL)
-  {
-    kmyth_log(LOG_ERR, "Failed to allocate the second nonce buffer.");
-
-    *nonce_b_len = 0;
+  p->len = p_len;
 
-    kmyth_clear_and_free(*nonce_a, *nonce_a_len);
-    *nonce_a = NULL;
-    *nonce_a_len = 0;
+  return 0;
+}
 
-    kmyth_clear_and_free(message, message_len);
+//
+// put_field()
+//
+static void put_field(unsigned char **index, const unsigned char *field,
+                      size_t field_len)
+{
+  memcpy(*index, &field_len, sizeof(size_t));
+  *index += sizeof(size_t);
+  memcpy(*index, field, field_len);
+  *index += field_len;
+}
 
+//
+// take_field()
+//
+static int take_field(unsigned char **index, size_t *remaining,
+                      unsigned char **field, size_t *field_len)
+{
+  if (*remaining < sizeof(size_t))
+  {
     return 1;
   }
-  memcpy(*nonce_b, index, *nonce_b_len);
-  index += *nonce_b_len;
-
-  // Parse out the ID.
-  memcpy(id_len, index, sizeof(size_t));
-  index += sizeof(size_t);
-  *id = calloc(*id_len, sizeof(unsigned char));
-  if (*id == NULL)
+  memcpy(field_len, *index, sizeof(size_t));
+  *index += sizeof(size_t);
+  *remaining -= sizeof(size_t);
+  if (*field_len > *remaining)
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the ID buffer.");
-
-    kmyth_clear_and_free(*nonce_a, *nonce_a_len);
-    *nonce_a = NULL;
-    *nonce_a_len = 0;
-
-    kmyth_clear_and_free(*nonce_b, *nonce_b_len);
-    *nonce_b = NULL;
-    *nonce_b_len = 0;
-
-    *id_len = 0;
-
-    kmyth_clear_and_free(message, message_len);
-
     return 1;
   }
-  memcpy(*id, index, *id_len);
-
-  kmyth_clear_and_free(message, message_len);
+  *field = *index;
+  *index += *field_len;
+  *remaining -= *field_len;
 
   return 0;
 }
 
 //
-// build_nonce_confirmation()
-//
-int build_nonce_confirmation(EVP_PKEY_CTX * ctx,
-                             unsigned char *nonce, size_t nonce_len,
-                             unsigned char **confirmation,
-                             size_t *confirmation_len)
+// build_nonce_request()
+// 
+int build_nonce_request(EVP_PKEY_CTX * ctx,
+                        unsigned char *nonce, size_t nonce_len,
+                        unsigned char *id, size_t id_len,
+                        nsl_buffer * request)
 {
   if (NSL_NONCE_LEN != nonce_len)
   {
@@ -411,31 +670,189 @@ int build_nonce_confirmation(EVP_PKEY_CTX * ctx,
               nonce_len, NSL_NONCE_LEN);
     return 1;
   }
+  if (id_len > NSL_MAX_ID_LEN)
+  {
+    kmyth_log(LOG_ERR, "Invalid ID length provided; received: %zd, "
+              "maximum: %d", id_len, NSL_MAX_ID_LEN);
+    return 1;
+  }
+
+  // Build the nonce request message (small enough, as it must be to be
+  // RSA encrypted, to be built on the stack).
+  unsigned char message[NSL_NONCE_LEN + NSL_MAX_ID_LEN + 2 * sizeof(size_t)];
+  unsigned char *index = message;
+
+  put_field(&index, nonce, nonce_len);
+  put_field(&index, id, id_len);
+
+  // Encrypt the nonce request into the request buffer and then clean up
+  // the unencrypted request.
+  int result = encrypt_into_buffer(ctx, message, (size_t) (index - message),
+                                   request);
+
+  kmyth_clear(message, sizeof(message));
+
+  // Handle encryption errors if any occurred.
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to encrypt the nonce request.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// parse_nonce_request()
+//
+int parse_nonce_request(EVP_PKEY_CTX * ctx,
+                        unsigned char *request, size_t request_len,
+                        nsl_buffer * message,
+                        unsigned char **nonce, size_t *nonce_len,
+                        unsigned char **id, size_t *id_len)
+{
+  // Decrypt the nonce request.
+  if (decrypt_into_buffer(ctx, request, request_len, message))
+  {
+    kmyth_log(LOG_ERR, "Failed to decrypt the nonce request.");
+    return 1;
+  }
+
+  // Parse out the nonce and the ID.
+  unsigned char *index = message->data;
+  size_t remaining = message->len;
+
+  if (take_field(&index, &remaining, nonce, nonce_len) ||
+      take_field(&index, &remaining, id, id_len))
+  {
+    kmyth_log(LOG_ERR, "The nonce request is malformed.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// build_nonce_response()
+//
+int build_nonce_response(EVP_PKEY_CTX * ctx,
+                         unsigned char *nonce_a, size_t nonce_a_len,
+                         unsigned char *nonce_b, size_t nonce_b_len,
+                         unsigned char *id, size_t id_len,
+                         nsl_buffer * response)
+{
+  if (NSL_NONCE_LEN != nonce_a_len || NSL_NONCE_LEN != nonce_b_len)
+  {
+    kmyth_log(LOG_ERR, "Invalid nonce length provided; expected: %zd",
+              NSL_NONCE_LEN);
+    return 1;
+  }
+  if (id_len > NSL_MAX_ID_LEN)
+  {
+    kmyth_log(LOG_ERR, "Invalid ID length provided; received: %zd, "
+              "maximum: %d", id_len, NSL_MAX_ID_LEN);
+    return 1;
+  }
+
+  // Build the nonce response message.
+  unsigned char message[2 * NSL_NONCE_LEN + NSL_MAX_ID_LEN +
+                        3 * sizeof(size_t)];
+  unsigned char *index = message;
+
+  put_field(&index, nonce_a, nonce_a_len);
+  put_field(&index, nonce_b, nonce_b_len);
+  put_field(&index, id, id_len);
+
+  // Encrypt the nonce response into the response buffer and then clean up
+  // the unencrypted response.
+  int result = encrypt_into_buffer(ctx, message, (size_t) (index - message),
+                                   response);
+
+  kmyth_clear(message, sizeof(message));
+
+  // Handle encryption errors if any occurred.
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to encrypt the nonce response.");
+    return 1;
+  }
+
+  return 0;
+}
 
-  // Allocate the unencrypted confirmation buffer.
-  unsigned char *message = NULL;
-  size_t message_len = nonce_len + sizeof(size_t);
-
-  message = calloc(message_len, sizeof(unsigned char));
-  if (message == NULL)
+//
+// parse_nonce_response()
+//
+int parse_nonce_response(EVP_PKEY_CTX * ctx,
+                         unsigned char *response, size_t response_len,
+                         nsl_buffer * message,
+                         unsigned char **nonce_a, size_t *nonce_a_len,
+                         unsigned char **nonce_b, size_t *nonce_b_len,
+                         unsigned char **id, size_t *id_len)
+{
+  // Decrypt the nonce response.
+  if (decrypt_into_buffer(ctx, response, response_len, message))
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the message buffer.");
+    kmyth_log(LOG_ERR, "Failed to decrypt the nonce response.");
+    return 1;
+  }
+
+  // Parse out the nonces and the ID.
+  unsigned char *index = message->data;
+  size_t remaining = message->len;
+
+  if (take_field(&index, &remaining, nonce_a, nonce_a_len) ||
+      take_field(&index, &remaining, nonce_b, nonce_b_len) ||
+      take_field(&index, &remaining, id, id_len))
+  {
+    kmyth_log(LOG_ERR, "The nonce response is malformed.");
+    return 1;
+  }
+  if (NSL_NONCE_LEN != *nonce_a_len)
+  {
+    kmyth_log(LOG_ERR,
+              "Unexpected length for nonce A; received: %zd bytes, expected: %zd bytes",
+              *nonce_a_len, NSL_NONCE_LEN);
+    return 1;
+  }
+  if (NSL_NONCE_LEN != *nonce_b_len)
+  {
+    kmyth_log(LOG_ERR,
+              "Unexpected length for nonce B; received: %zd bytes, expected: %zd bytes",
+              *nonce_b_len, NSL_NONCE_LEN);
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// build_nonce_confirmation()
+//
+int build_nonce_confirmation(EVP_PKEY_CTX * ctx,
+                             unsigned char *nonce, size_t nonce_len,
+                             nsl_buffer * confirmation)
+{
+  if (NSL_NONCE_LEN != nonce_len)
+  {
+    kmyth_log(LOG_ERR,
+              "Invalid nonce length provided; received: %zd, expected: %zd",
+              nonce_len, NSL_NONCE_LEN);
     return 1;
   }
 
   // Build the nonce confirmation message.
+  unsigned char message[NSL_NONCE_LEN + sizeof(size_t)];
   unsigned char *index = message;
 
-  memcpy(index, &nonce_len, sizeof(size_t));
-  index += sizeof(size_t);
-  memcpy(index, nonce, nonce_len);
+  put_field(&index, nonce, nonce_len);
 
-  // Encrypt the nonce confirmation and then clean up the unencrypted
-  // confirmation.
-  int result = encrypt_with_key_pair(ctx, message, message_len, confirmation,
-                                     confirmation_len);
+  // Encrypt the nonce confirmation into the confirmation buffer and then
+  // clean up the unencrypted confirmation.
+  int result = encrypt_into_buffer(ctx, message, sizeof(message),
+                                   confirmation);
 
-  kmyth_clear_and_free(message, message_len);
+  kmyth_clear(message, sizeof(message));
 
   // Handle encryption errors if any occurred.
   if (result)
@@ -452,40 +869,25 @@ int build_nonce_confirmation(EVP_PKEY_CTX * ctx,
 //
 int parse_nonce_confirmation(EVP_PKEY_CTX * ctx,
                              unsigned char *confirmation,
-                             size_t confirmation_len, unsigned char **nonce,
-                             size_t *nonce_len)
+                             size_t confirmation_len, nsl_buffer * message,
+                             unsigned char **nonce, size_t *nonce_len)
 {
   // Decrypt the nonce confirmation.
-  unsigned char *message = NULL;
-  size_t message_len = 0;
-  int result =
-    decrypt_with_key_pair(ctx, confirmation, confirmation_len, &message,
-                          &message_len);
-
-  if (result)
+  if (decrypt_into_buffer(ctx, confirmation, confirmation_len, message))
   {
     kmyth_log(LOG_ERR, "Failed to decrypt the nonce confirmation.");
     return 1;
   }
-  unsigned char *index = message;
 
   // Parse out the nonce.
-  memcpy(nonce_len, index, sizeof(size_t));
-  index += sizeof(size_t);
-  *nonce = calloc(*nonce_len, sizeof(unsigned char));
-  if (*nonce == NULL)
-  {
-    kmyth_log(LOG_ERR, "Failed to allocate the nonce buffer.");
-
-    *nonce_len = 0;
-
-    kmyth_clear_and_free(message, message_len);
+  unsigned char *index = message->data;
+  size_t remaining = message->len;
 
+  if (take_field(&index, &remaining, nonce, nonce_len))
+  {
+    kmyth_log(LOG_ERR, "The nonce confirmation is malformed.");
     return 1;
   }
-  memcpy(*nonce, index, *nonce_len);
-
-  kmyth_clear_and_free(message, message_len);
 
   return 0;
 }
@@ -709,36 +1111,38 @@ int generate_nonce(size_t desired_min_nonce_len, unsigned char **nonce,
   }
 
   *nonce_len = size * sizeof(int);
-  unsigned int *buffer = calloc(size, sizeof(int));
+  unsigned char *buffer = calloc(size, sizeof(int));
 
   if (NULL == buffer)
   {
     kmyth_log(LOG_ERR, "Failed to allocated the nonce buffer.");
     return 1;
   }
-  unsigned int *index = buffer;
 
-  for (size_t i = 0; i < size; i++)
+  // the nonces are combined into the session key, so they must come from a
+  // cryptographic generator (the calling thread's DRBG)
+  if (kmyth_nonce_bytes(buffer, *nonce_len))
   {
-    *index = (unsigned int)rand();
-    index += 1;
+    kmyth_log(LOG_ERR, "Failed to generate the nonce.");
+    free(buffer);
+    return 1;
   }
 
-  *nonce = (unsigned char *) buffer;
+  *nonce = buffer;
   return 0;
 }
 
 //
-// negotiate_client_session_key()
+// run_client_negotiation()
 //
-int negotiate_client_session_key(int socket_fd,
-                                 EVP_PKEY_CTX * public_key_ctx,
-                                 EVP_PKEY_CTX * private_key_ctx,
-                                 unsigned char *id, size_t id_len,
-                                 unsigned char *expected_id,
-                                 size_t expected_id_len,
-                                 unsigned char **session_key,
-                                 size_t *session_key_len)
+static int run_client_negotiation(nsl_connection * conn, const char *marker,
+                                  EVP_PKEY_CTX * public_key_ctx,
+                                  EVP_PKEY_CTX * private_key_ctx,
+                                  unsigned char *id, size_t id_len,
+                                  unsigned char *expected_id,
+                                  size_t expected_id_len,
+                                  unsigned char **session_key,
+                                  size_t *session_key_len)
 {
   // Generate nonce A
   unsigned char *nonce_a = NULL;
@@ -752,76 +1156,75 @@ int negotiate_client_session_key(int socket_fd,
     return 1;
   }
 
-  // Conduct NSL to obtain nonce B
-  unsigned char *nonce_b = NULL;
-  size_t nonce_b_len = 0;
-
-  unsigned char *request = NULL;
-  size_t request_len = 0;
+  kmyth_log(LOG_DEBUG, "Sending nonce A: %zd bytes", nonce_a_len);
 
-  unsigned char *response = calloc(8192, sizeof(unsigned char));
+  // A marker (if any) is sent ahead of the request, in the same message.
+  unsigned char *marker_out = NULL;
 
-  if (NULL == response)
+  result = nsl_frame_begin(conn);
+  if (result == 0 && marker != NULL)
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the response buffer.");
-    kmyth_clear_and_free(nonce_a, nonce_a_len);
-    return 1;
+    marker_out = nsl_buffer_append(&conn->send, NSL_MARKER_LEN);
+    if (NULL == marker_out)
+    {
+      result = 1;
+    }
+    else
+    {
+      memcpy(marker_out, marker, NSL_MARKER_LEN);
+    }
+  }
+  if (result == 0)
+  {
+    result = build_nonce_request(public_key_ctx,
+                                 nonce_a, nonce_a_len,
+                                 id, id_len, &conn->send);
   }
-  size_t response_len = 8192 * sizeof(unsigned char);
-
-  kmyth_log(LOG_DEBUG, "Sending nonce A: %zd bytes", nonce_a_len);
-
-  result = build_nonce_request(public_key_ctx,
-                               nonce_a, nonce_a_len,
-                               id, id_len, &request, &request_len);
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to build the nonce request.");
     kmyth_clear_and_free(nonce_a, nonce_a_len);
-    kmyth_clear_and_free(response, response_len);
     return 1;
   }
 
-  if (write(socket_fd, request, request_len) != request_len)
+  if (nsl_send_frame(conn))
   {
     kmyth_log(LOG_ERR, "Failed to fully send nonce request message.");
     kmyth_clear_and_free(nonce_a, nonce_a_len);
-    kmyth_clear_and_free(response, response_len);
     return 1;
   }
 
   kmyth_log(LOG_DEBUG, "Successfully sent nonce A.");
 
-  ssize_t read_result = read(socket_fd, response, response_len);
+  // Conduct NSL to obtain nonce B
+  unsigned char *response = NULL;
+  size_t response_len = 0;
 
-  if (read_result <= 0)
+  if (nsl_recv_frame(conn, &response, &response_len))
   {
     kmyth_log(LOG_ERR, "Failed to read the nonce response message.");
     kmyth_clear_and_free(nonce_a, nonce_a_len);
-    kmyth_clear_and_free(response, response_len);
     return 1;
   }
 
-  kmyth_log(LOG_DEBUG, "Received %zd bytes", read_result);
-
-  kmyth_clear_and_free(request, request_len);
-  request = NULL;
-  request_len = 0;
+  kmyth_log(LOG_DEBUG, "Received %zd bytes", response_len);
 
+  // The received nonces and ID are views into the connection's scratch
+  // buffer, valid until it is next used.
   unsigned char *received_nonce_a = NULL;
   size_t received_nonce_a_len = 0;
 
+  unsigned char *nonce_b = NULL;
+  size_t nonce_b_len = 0;
+
   unsigned char *received_id = NULL;
   size_t received_id_len = 0;
 
-  // read_result can safely be cast to a size_t since we've already
-  // dealt with the possibility it's negative
   result = parse_nonce_response(private_key_ctx,
-                                response, (size_t)read_result,
+                                response, response_len, &conn->scratch,
                                 &received_nonce_a, &received_nonce_a_len,
                                 &nonce_b, &nonce_b_len,
                                 &received_id, &received_id_len);
-  kmyth_clear_and_free(response, response_len);
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to parse the nonce response.");
@@ -833,82 +1236,206 @@ int negotiate_client_session_key(int socket_fd,
   kmyth_log(LOG_DEBUG, "Received nonce B: %zd bytes", nonce_b_len);
   kmyth_log(LOG_DEBUG, "Received ID: %.*s", received_id_len, received_id);
 
-  if (nonce_a_len != received_nonce_a_len)
+  if (nonce_a_len != received_nonce_a_len ||
+      memcmp(nonce_a, received_nonce_a, nonce_a_len) != 0)
   {
-    kmyth_log(LOG_ERR, "The received nonce A length is invalid.");
+    kmyth_log(LOG_ERR, "The received nonce A is invalid.");
+    kmyth_log(LOG_ERR, "Expected nonce A: %zd bytes", nonce_a_len);
     kmyth_clear_and_free(nonce_a, nonce_a_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_id, received_id_len);
     return 1;
   }
-  if (nonce_b_len != nonce_a_len)
+  if (received_id_len != expected_id_len ||
+      memcmp(received_id, expected_id, expected_id_len) != 0)
   {
-    kmyth_log(LOG_ERR, "The received nonce B length is invalid.");
+    kmyth_log(LOG_ERR, "The received ID is invalid.");
     kmyth_clear_and_free(nonce_a, nonce_a_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_id, received_id_len);
     return 1;
   }
-  if (strncmp
-      ((const char *) nonce_a, (const char *) received_nonce_a,
-       nonce_a_len) != 0)
+
+  result = nsl_frame_begin(conn);
+  if (result == 0)
   {
-    kmyth_log(LOG_ERR, "The received nonce A is invalid.");
-    kmyth_log(LOG_ERR, "Expected nonce A: %zd bytes", nonce_a_len);
+    result = build_nonce_confirmation(public_key_ctx,
+                                      nonce_b, nonce_b_len, &conn->send);
+  }
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to build the nonce confirmation.");
+    kmyth_clear_and_free(nonce_a, nonce_a_len);
+    return 1;
+  }
+
+  if (nsl_send_frame(conn))
+  {
+    kmyth_log(LOG_ERR, "Failed to fully send the nonce confirmation.");
     kmyth_clear_and_free(nonce_a, nonce_a_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
+    return 1;
+  }
+
+  // Use nonces to generate shared session key S
+  result = generate_session_key(nonce_a, nonce_a_len,
+                                nonce_b, nonce_b_len,
+                                session_key, session_key_len);
+  kmyth_clear_and_free(nonce_a, nonce_a_len);
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to generate the session key.");
+    return 1;
+  }
+
+  return 0;
+}
+
+//
+// negotiate_client_session_key()
+//
+int negotiate_client_session_key(int socket_fd,
+                                 EVP_PKEY_CTX * public_key_ctx,
+                                 EVP_PKEY_CTX * private_key_ctx,
+                                 unsigned char *id, size_t id_len,
+                                 unsigned char *expected_id,
+                                 size_t expected_id_len,
+                                 unsigned char **session_key,
+                                 size_t *session_key_len)
+{
+  nsl_connection conn;
+
+  nsl_connection_init(&conn, socket_fd);
+
+  int result = run_client_negotiation(&conn, NULL,
+                                      public_key_ctx, private_key_ctx,
+                                      id, id_len,
+                                      expected_id, expected_id_len,
+                                      session_key, session_key_len);
+
+  nsl_connection_free(&conn);
+
+  return result;
+}
+
+//
+// complete_server_negotiation()
+//
+static int complete_server_negotiation(nsl_connection * conn,
+                                       EVP_PKEY_CTX * public_key_ctx,
+                                       EVP_PKEY_CTX * private_key_ctx,
+                                       unsigned char *id, size_t id_len,
+                                       unsigned char *request,
+                                       size_t request_len,
+                                       unsigned char **session_key,
+                                       size_t *session_key_len)
+{
+  unsigned char *received_nonce_a = NULL;
+  size_t received_nonce_a_len = 0;
+
+  unsigned char *received_id = NULL;
+  size_t received_id_len = 0;
+
+  int result = parse_nonce_request(private_key_ctx,
+                                   request, request_len, &conn->scratch,
+                                   &received_nonce_a, &received_nonce_a_len,
+                                   &received_id, &received_id_len);
+
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to parse the nonce request.");
+    return 1;
+  }
+  if (NSL_NONCE_LEN != received_nonce_a_len)
+  {
+    kmyth_log(LOG_ERR, "The received nonce A length is invalid.");
+    return 1;
+  }
+
+  kmyth_log(LOG_DEBUG, "Received nonce A: %zd bytes", received_nonce_a_len);
+  kmyth_log(LOG_DEBUG, "Received ID: %.*s", received_id_len, received_id);
+
+  // Nonce A is kept, as the scratch buffer it was parsed into is reused
+  // for the nonce confirmation.
+  unsigned char nonce_a[NSL_NONCE_LEN];
+
+  memcpy(nonce_a, received_nonce_a, NSL_NONCE_LEN);
+
+  // Generate nonce B
+  unsigned char *nonce_b = NULL;
+  size_t nonce_b_len = 0;
+
+  result = generate_nonce(NSL_NONCE_LEN, &nonce_b, &nonce_b_len);
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to generate a nonce.");
+    kmyth_clear(nonce_a, sizeof(nonce_a));
+    return 1;
+  }
+
+  kmyth_log(LOG_DEBUG, "Sending nonce B: %zd", nonce_b_len);
+
+  result = nsl_frame_begin(conn);
+  if (result == 0)
+  {
+    result = build_nonce_response(public_key_ctx,
+                                  nonce_a, sizeof(nonce_a),
+                                  nonce_b, nonce_b_len,
+                                  id, id_len, &conn->send);
+  }
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to build the nonce response.");
     kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_id, received_id_len);
+    kmyth_clear(nonce_a, sizeof(nonce_a));
     return 1;
   }
 
-  kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
+  if (nsl_send_frame(conn))
+  {
+    kmyth_log(LOG_ERR, "Failed to fully send the nonce response.");
+    kmyth_clear_and_free(nonce_b, nonce_b_len);
+    kmyth_clear(nonce_a, sizeof(nonce_a));
+    return 1;
+  }
+
+  unsigned char *confirmation = NULL;
+  size_t confirmation_len = 0;
 
-  if (strncmp
-      ((const char *) received_id, (const char *) expected_id,
-       expected_id_len) != 0)
+  if (nsl_recv_frame(conn, &confirmation, &confirmation_len))
   {
-    kmyth_log(LOG_ERR, "The received ID is invalid.");
-    kmyth_clear_and_free(nonce_a, nonce_a_len);
+    kmyth_log(LOG_ERR, "Failed to receive the nonce confirmation.");
     kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_id, received_id_len);
+    kmyth_clear(nonce_a, sizeof(nonce_a));
     return 1;
   }
 
-  kmyth_clear_and_free(received_id, received_id_len);
+  unsigned char *received_nonce_b = NULL;
+  size_t received_nonce_b_len = 0;
 
-  result = build_nonce_confirmation(public_key_ctx,
-                                    nonce_b, nonce_b_len,
-                                    &request, &request_len);
+  result = parse_nonce_confirmation(private_key_ctx,
+                                    confirmation, confirmation_len,
+                                    &conn->scratch,
+                                    &received_nonce_b, &received_nonce_b_len);
   if (result)
   {
-    kmyth_log(LOG_ERR, "Failed to build the nonce confirmation.");
-    kmyth_clear_and_free(nonce_a, nonce_a_len);
+    kmyth_log(LOG_ERR, "Failed to parse the nonce confirmation.");
     kmyth_clear_and_free(nonce_b, nonce_b_len);
+    kmyth_clear(nonce_a, sizeof(nonce_a));
     return 1;
   }
-
-  if (write(socket_fd, request, request_len) != request_len)
+  if (nonce_b_len != received_nonce_b_len ||
+      memcmp(nonce_b, received_nonce_b, nonce_b_len) != 0)
   {
-    kmyth_log(LOG_ERR, "Failed to fully send the nonce confirmation.");
-    kmyth_clear_and_free(nonce_a, nonce_a_len);
+    kmyth_log(LOG_ERR, "The received nonce B is invalid.");
     kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(request, request_len);
+    kmyth_clear(nonce_a, sizeof(nonce_a));
     return 1;
   }
 
-  kmyth_clear_and_free(request, request_len);
-  request = NULL;
-  request_len = 0;
+  kmyth_log(LOG_DEBUG, "Received nonce B: %zd bytes", nonce_b_len);
 
   // Use nonces to generate shared session key S
-  result = generate_session_key(nonce_a, nonce_a_len,
+  result = generate_session_key(nonce_a, sizeof(nonce_a),
                                 nonce_b, nonce_b_len,
                                 session_key, session_key_len);
-  kmyth_clear_and_free(nonce_a, nonce_a_len);
   kmyth_clear_and_free(nonce_b, nonce_b_len);
+  kmyth_clear(nonce_a, sizeof(nonce_a));
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to generate the session key.");
@@ -928,150 +1455,522 @@ int negotiate_server_session_key(int socket_fd,
                                  unsigned char **session_key,
                                  size_t *session_key_len)
 {
-  // Generate nonce B
-  unsigned char *nonce_b = NULL;
-  size_t nonce_b_len = 0;
+  nsl_connection conn;
 
-  int result = generate_nonce(NSL_NONCE_LEN, &nonce_b, &nonce_b_len);
+  nsl_connection_init(&conn, socket_fd);
+
+  // Conduct NSL to obtain nonce A
+  unsigned char *request = NULL;
+  size_t request_len = 0;
+  int result = nsl_recv_frame(&conn, &request, &request_len);
 
   if (result)
   {
-    kmyth_log(LOG_ERR, "Failed to generate a nonce.");
+    kmyth_log(LOG_ERR, "Failed to receive the nonce request.");
+  }
+  else
+  {
+    result = complete_server_negotiation(&conn,
+                                         public_key_ctx, private_key_ctx,
+                                         id, id_len,
+                                         request, request_len,
+                                         session_key, session_key_len);
+  }
+
+  nsl_connection_free(&conn);
+
+  return result;
+}
+
+//
+// derive_resumption_secret()
+//
+static int derive_resumption_secret(unsigned char *session_key,
+                                    size_t session_key_len,
+                                    unsigned char **secret,
+                                    size_t *secret_len)
+{
+  return generate_session_key(session_key, session_key_len,
+                              nsl_resumption_label, NSL_NONCE_LEN,
+                              secret, secret_len);
+}
+
+//
+// derive_resumed_session_key()
+//
+static int derive_resumed_session_key(unsigned char *secret,
+                                      size_t secret_len,
+                                      unsigned char *nonce_a,
+                                      size_t nonce_a_len,
+                                      unsigned char *nonce_b,
+                                      size_t nonce_b_len,
+                                      unsigned char **session_key,
+                                      size_t *session_key_len)
+{
+  // The resumed session key depends on the resumption secret as well as
+  // both (fresh) nonces, so it differs from the ticket's original session.
+  unsigned char *bound = NULL;
+  size_t bound_len = 0;
+
+  if (generate_session_key(secret, secret_len, nonce_a, nonce_a_len,
+                           &bound, &bound_len))
+  {
     return 1;
   }
 
-  // Conduct NSL to obtain nonce A
-  unsigned char *response = calloc(8192, sizeof(unsigned char));
+  int result = generate_session_key(bound, bound_len, nonce_b, nonce_b_len,
+                                    session_key, session_key_len);
 
-  if (NULL == response)
+  kmyth_clear_and_free(bound, bound_len);
+
+  return result;
+}
+
+//
+// create_ticket_key()
+//
+int create_ticket_key(unsigned char **ticket_key, size_t *ticket_key_len)
+{
+  *ticket_key = calloc(NSL_TICKET_KEY_LEN, sizeof(unsigned char));
+  if (NULL == *ticket_key)
   {
-    kmyth_log(LOG_ERR, "Failed to allocate the response buffer.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
+    kmyth_log(LOG_ERR, "Failed to allocate the ticket key.");
+    return 1;
+  }
+  *ticket_key_len = NSL_TICKET_KEY_LEN;
+
+  if (RAND_bytes(*ticket_key, NSL_TICKET_KEY_LEN) != 1)
+  {
+    kmyth_log(LOG_ERR, "Failed to generate the ticket key.");
+    kmyth_clear_and_free(*ticket_key, *ticket_key_len);
+    *ticket_key = NULL;
     return 1;
   }
-  size_t response_len = 8192;
 
-  ssize_t read_result = read(socket_fd, response, response_len);
+  return 0;
+}
+
+//
+// send_session_ticket()
+//
+static int send_session_ticket(nsl_connection * conn,
+                               unsigned char *ticket_key,
+                               size_t ticket_key_len, time_t ticket_lifetime,
+                               unsigned char *session_key,
+                               size_t session_key_len)
+{
+  unsigned char *secret = NULL;
+  size_t secret_len = 0;
 
-  if (read_result <= 0)
+  if (derive_resumption_secret(session_key, session_key_len,
+                               &secret, &secret_len))
   {
-    kmyth_log(LOG_ERR, "Failed to receive the nonce request.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(response, response_len);
+    kmyth_log(LOG_ERR, "Failed to derive the resumption secret.");
     return 1;
   }
 
-  unsigned char *received_nonce_a = NULL;
-  size_t received_nonce_a_len = 0;
+  // The ticket holds the expiry time and the resumption secret, encrypted
+  // under the ticket key, so that the server need not keep any session
+  // state.
+  uint64_t expiry = (uint64_t) (time(NULL) + ticket_lifetime);
+  unsigned char contents[sizeof(uint64_t) + NSL_SESSION_KEY_LEN];
 
-  unsigned char *received_id = NULL;
-  size_t received_id_len = 0;
+  memcpy(contents, &expiry, sizeof(uint64_t));
+  memcpy(contents + sizeof(uint64_t), secret, NSL_SESSION_KEY_LEN);
+  kmyth_clear_and_free(secret, secret_len);
 
-  // read_result can safely be cast to size_t because we've already
-  // dealt with the case that it's negative.
-  result = parse_nonce_request(private_key_ctx,
-                               response, (size_t)read_result,
-                               &received_nonce_a, &received_nonce_a_len,
-                               &received_id, &received_id_len);
+  // The client is sent the expiry time and the ticket, encrypted under the
+  // session key - the ticket is encrypted straight into place after the
+  // expiry time.
+  unsigned char message[sizeof(uint64_t) + GCM_IV_LEN + sizeof(contents) +
+                        GCM_TAG_LEN];
+  size_t ticket_len = 0;
 
-  kmyth_log(LOG_DEBUG, "Received nonce A: %zd bytes", received_nonce_a_len);
-  kmyth_log(LOG_DEBUG, "Received ID: %.*s", received_id_len, received_id);
+  memcpy(message, &expiry, sizeof(uint64_t));
 
-  kmyth_clear_and_free(received_id, received_id_len);
-  kmyth_clear_and_free(response, response_len);
-  response = NULL;
-  response_len = 0;
+  int result = aes_gcm_encrypt_buf(ticket_key, ticket_key_len,
+                                   contents, sizeof(contents),
+                                   message + sizeof(uint64_t),
+                                   sizeof(message) - sizeof(uint64_t),
+                                   &ticket_len);
 
-  kmyth_log(LOG_DEBUG, "Sending nonce B: %zd", nonce_b_len);
+  kmyth_clear(contents, sizeof(contents));
+  if (result)
+  {
+    kmyth_log(LOG_ERR, "Failed to encrypt the session ticket.");
+    return 1;
+  }
 
-  result = build_nonce_response(public_key_ctx,
-                                received_nonce_a, received_nonce_a_len,
-                                nonce_b, nonce_b_len,
-                                id, id_len, &response, &response_len);
+  size_t encrypted_len = GCM_IV_LEN + sizeof(message) + GCM_TAG_LEN;
+  unsigned char *encrypted = NULL;
+
+  result = nsl_frame_begin(conn);
+  if (result == 0)
+  {
+    encrypted = nsl_buffer_append(&conn->send, encrypted_len);
+    result = (NULL == encrypted) ||
+      aes_gcm_encrypt_buf(session_key, session_key_len,
+                          message, sizeof(message),
+                          encrypted, encrypted_len, &encrypted_len);
+  }
+  kmyth_clear(message, sizeof(message));
   if (result)
   {
-    kmyth_log(LOG_ERR, "Failed to build the nonce response.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
+    kmyth_log(LOG_ERR, "Failed to encrypt the ticket message.");
+    return 1;
+  }
+
+  if (nsl_send_frame(conn))
+  {
+    kmyth_log(LOG_ERR, "Failed to fully send the session ticket.");
     return 1;
   }
 
-  ssize_t send_result = write(socket_fd, response, response_len);
+  return 0;
+}
+
+//
+// resume_server_session()
+//
+static int resume_server_session(nsl_connection * conn,
+                                 unsigned char *ticket_key,
+                                 size_t ticket_key_len,
+                                 unsigned char *request, size_t request_len,
+                                 unsigned char **session_key,
+                                 size_t *session_key_len)
+{
+  // The resumption request is the ticket's length, the ticket and nonce A.
+  size_t ticket_len = 0;
 
-  if (response_len != send_result)
+  if (request_len < sizeof(size_t) + NSL_NONCE_LEN)
   {
-    kmyth_log(LOG_ERR, "Failed to fully send the nonce response.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
-    kmyth_clear_and_free(response, response_len);
+    kmyth_log(LOG_ERR, "The resumption request is too short.");
+    return 1;
+  }
+  memcpy(&ticket_len, request, sizeof(size_t));
+  if (ticket_len != request_len - sizeof(size_t) - NSL_NONCE_LEN)
+  {
+    kmyth_log(LOG_ERR, "The resumption request ticket length is invalid.");
     return 1;
   }
 
-  kmyth_clear_and_free(response, response_len);
+  unsigned char *ticket = request + sizeof(size_t);
+  unsigned char *nonce_a = ticket + ticket_len;
+  unsigned char contents[sizeof(uint64_t) + NSL_SESSION_KEY_LEN];
+  size_t contents_len = 0;
 
-  response = calloc(8192, sizeof(unsigned char));
-  if (NULL == response)
+  if (aes_gcm_decrypt_buf(ticket_key, ticket_key_len, ticket, ticket_len,
+                          contents, sizeof(contents), &contents_len) ||
+      contents_len != sizeof(contents))
   {
-    kmyth_log(LOG_ERR, "Failed to re-allocate the response buffer.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
+    kmyth_log(LOG_ERR, "Failed to decrypt the session ticket.");
+    kmyth_clear(contents, sizeof(contents));
     return 1;
   }
-  response_len = 8192 * sizeof(unsigned char);
 
-  read_result = read(socket_fd, response, response_len);
-  if (read_result <= 0)
+  uint64_t expiry = 0;
+
+  memcpy(&expiry, contents, sizeof(uint64_t));
+  if ((uint64_t) time(NULL) >= expiry)
   {
-    kmyth_log(LOG_ERR, "Failed to receive the nonce confirmation.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
-    kmyth_clear_and_free(response, response_len);
+    kmyth_log(LOG_ERR, "The session ticket has expired.");
+    kmyth_clear(contents, sizeof(contents));
     return 1;
   }
 
-  unsigned char *received_nonce_b = NULL;
-  size_t received_nonce_b_len = 0;
+  unsigned char *secret = contents + sizeof(uint64_t);
+  size_t secret_len = NSL_SESSION_KEY_LEN;
 
-  // read_result can safely be cast to a size_t because we've already
-  // dealt with the case it's negative.
-  result = parse_nonce_confirmation(private_key_ctx,
-                                    response, (size_t)read_result,
-                                    &received_nonce_b, &received_nonce_b_len);
-  kmyth_clear_and_free(response, response_len);
+  // Generate nonce B, and return it (with nonce A, proving the server holds
+  // the ticket key) encrypted under the resumption secret.
+  unsigned char *nonce_b = NULL;
+  size_t nonce_b_len = 0;
+
+  if (generate_nonce(NSL_NONCE_LEN, &nonce_b, &nonce_b_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to generate a nonce.");
+    kmyth_clear(contents, sizeof(contents));
+    return 1;
+  }
+
+  unsigned char nonces[2 * NSL_NONCE_LEN];
+  size_t response_len = GCM_IV_LEN + sizeof(nonces) + GCM_TAG_LEN;
+  unsigned char *response = NULL;
+
+  memcpy(nonces, nonce_a, NSL_NONCE_LEN);
+  memcpy(nonces + NSL_NONCE_LEN, nonce_b, NSL_NONCE_LEN);
+
+  int result = nsl_frame_begin(conn);
+
+  if (result == 0)
+  {
+    response = nsl_buffer_append(&conn->send, response_len);
+    result = (NULL == response) ||
+      aes_gcm_encrypt_buf(secret, secret_len, nonces, sizeof(nonces),
+                          response, response_len, &response_len);
+  }
+  kmyth_clear(nonces, sizeof(nonces));
   if (result)
   {
-    kmyth_log(LOG_ERR, "Failed to parse the nonce confirmation.");
+    kmyth_log(LOG_ERR, "Failed to encrypt the resumption response.");
     kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
+    kmyth_clear(contents, sizeof(contents));
     return 1;
   }
-  if (nonce_b_len != received_nonce_b_len)
+
+  if (nsl_send_frame(conn))
   {
-    kmyth_log(LOG_ERR, "The received nonce B length is invalid.");
+    kmyth_log(LOG_ERR, "Failed to fully send the resumption response.");
     kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
-    kmyth_clear_and_free(received_nonce_b, received_nonce_b_len);
+    kmyth_clear(contents, sizeof(contents));
     return 1;
   }
-  if (strncmp
-      ((const char *) nonce_b, (const char *) received_nonce_b,
-       nonce_b_len) != 0)
+
+  result = derive_resumed_session_key(secret, secret_len,
+                                      nonce_a, NSL_NONCE_LEN,
+                                      nonce_b, nonce_b_len,
+                                      session_key, session_key_len);
+  kmyth_clear_and_free(nonce_b, nonce_b_len);
+  kmyth_clear(contents, sizeof(contents));
+  if (result)
   {
-    kmyth_log(LOG_ERR, "The received nonce B is invalid.");
-    kmyth_clear_and_free(nonce_b, nonce_b_len);
-    kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
-    kmyth_clear_and_free(received_nonce_b, received_nonce_b_len);
+    kmyth_log(LOG_ERR, "Failed to generate the session key.");
     return 1;
   }
 
-  kmyth_clear_and_free(received_nonce_b, received_nonce_b_len);
-  kmyth_log(LOG_DEBUG, "Received nonce B: %zd bytes", nonce_b_len);
+  return 0;
+}
 
-  // Use nonces to generate shared session key S
-  result = generate_session_key(received_nonce_a, received_nonce_a_len,
-                                nonce_b, nonce_b_len,
-                                session_key, session_key_len);
-  kmyth_clear_and_free(nonce_b, nonce_b_len);
-  kmyth_clear_and_free(received_nonce_a, received_nonce_a_len);
+//
+// accept_server_session_key()
+//
+int accept_server_session_key(int socket_fd,
+                              EVP_PKEY_CTX * public_key_ctx,
+                              EVP_PKEY_CTX * private_key_ctx,
+                              unsigned char *id, size_t id_len,
+                              unsigned char *ticket_key,
+                              size_t ticket_key_len, time_t ticket_lifetime,
+                              unsigned char **session_key,
+                              size_t *session_key_len, bool *resumed)
+{
+  nsl_connection conn;
+  unsigned char *request = NULL;
+  size_t request_len = 0;
+  int result = 0;
+
+  *resumed = false;
+  nsl_connection_init(&conn, socket_fd);
+  if (nsl_recv_frame(&conn, &request, &request_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to receive the nonce request.");
+    nsl_connection_free(&conn);
+    return 1;
+  }
+
+  if (request_len >= NSL_MARKER_LEN &&
+      memcmp(request, NSL_RESUME_MARKER, NSL_MARKER_LEN) == 0)
+  {
+    result = resume_server_session(&conn, ticket_key, ticket_key_len,
+                                   request + NSL_MARKER_LEN,
+                                   request_len - NSL_MARKER_LEN,
+                                   session_key, session_key_len);
+    *resumed = (result == 0);
+  }
+  else if (request_len >= NSL_MARKER_LEN &&
+           memcmp(request, NSL_TICKET_MARKER, NSL_MARKER_LEN) == 0)
+  {
+    result = complete_server_negotiation(&conn,
+                                         public_key_ctx, private_key_ctx,
+                                         id, id_len,
+                                         request + NSL_MARKER_LEN,
+                                         request_len - NSL_MARKER_LEN,
+                                         session_key, session_key_len);
+    if (result == 0 &&
+        send_session_ticket(&conn, ticket_key, ticket_key_len,
+                            ticket_lifetime, *session_key, *session_key_len))
+    {
+      kmyth_clear_and_free(*session_key, *session_key_len);
+      *session_key = NULL;
+      result = 1;
+    }
+  }
+  else
+  {
+    result = complete_server_negotiation(&conn,
+                                         public_key_ctx, private_key_ctx,
+                                         id, id_len,
+                                         request, request_len,
+                                         session_key, session_key_len);
+  }
+
+  nsl_connection_free(&conn);
+
+  return result;
+}
+
+//
+// receive_session_ticket()
+//
+static int receive_session_ticket(nsl_connection * conn,
+                                  unsigned char *session_key,
+                                  size_t session_key_len,
+                                  nsl_session_ticket * ticket)
+{
+  unsigned char *message = NULL;
+  size_t message_len = 0;
+
+  if (nsl_recv_frame(conn, &message, &message_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to receive the session ticket.");
+    return 1;
+  }
+
+  // The ticket message is decrypted where it was received.
+  if (aes_gcm_decrypt_in_place(session_key, session_key_len,
+                               message, message_len, &message_len) ||
+      message_len <= sizeof(uint64_t))
+  {
+    kmyth_log(LOG_ERR, "Failed to decrypt the session ticket.");
+    return 1;
+  }
+
+  uint64_t expiry = 0;
+
+  memcpy(&expiry, message, sizeof(uint64_t));
+  ticket->expiry = (time_t) expiry;
+  ticket->ticket_len = message_len - sizeof(uint64_t);
+  ticket->ticket = calloc(ticket->ticket_len, sizeof(unsigned char));
+  if (NULL == ticket->ticket ||
+      derive_resumption_secret(session_key, session_key_len,
+                               &ticket->secret, &ticket->secret_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to keep the session ticket.");
+    free(ticket->ticket);
+    ticket->ticket = NULL;
+    return 1;
+  }
+  memcpy(ticket->ticket, message + sizeof(uint64_t), ticket->ticket_len);
+
+  return 0;
+}
+
+//
+// negotiate_client_session_ticket()
+//
+int negotiate_client_session_ticket(int socket_fd,
+                                    EVP_PKEY_CTX * public_key_ctx,
+                                    EVP_PKEY_CTX * private_key_ctx,
+                                    unsigned char *id, size_t id_len,
+                                    unsigned char *expected_id,
+                                    size_t expected_id_len,
+                                    unsigned char **session_key,
+                                    size_t *session_key_len,
+                                    nsl_session_ticket * ticket)
+{
+  nsl_connection conn;
+
+  nsl_connection_init(&conn, socket_fd);
+
+  int result = run_client_negotiation(&conn, NSL_TICKET_MARKER,
+                                      public_key_ctx, private_key_ctx,
+                                      id, id_len,
+                                      expected_id, expected_id_len,
+                                      session_key, session_key_len);
+
+  if (result == 0 &&
+      receive_session_ticket(&conn, *session_key, *session_key_len, ticket))
+  {
+    kmyth_clear_and_free(*session_key, *session_key_len);
+    *session_key = NULL;
+    result = 1;
+  }
+  nsl_connection_free(&conn);
+
+  return result;
+}
+
+//
+// resume_client_session_key()
+//
+int resume_client_session_key(int socket_fd, nsl_session_ticket * ticket,
+                              unsigned char **session_key,
+                              size_t *session_key_len)
+{
+  if (NULL == ticket->ticket || time(NULL) >= ticket->expiry)
+  {
+    kmyth_log(LOG_ERR, "No unexpired session ticket to resume with.");
+    return 1;
+  }
+
+  // Generate nonce A
+  unsigned char *nonce_a = NULL;
+  size_t nonce_a_len = 0;
+
+  if (generate_nonce(NSL_NONCE_LEN, &nonce_a, &nonce_a_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to generate a nonce.");
+    return 1;
+  }
+
+  // The resumption request is the marker, the ticket's length, the ticket
+  // and nonce A, written straight into the send buffer.
+  nsl_connection conn;
+  unsigned char *index = NULL;
+
+  nsl_connection_init(&conn, socket_fd);
+  if (nsl_frame_begin(&conn) ||
+      NULL == (index = nsl_buffer_append(&conn.send,
+                                         NSL_MARKER_LEN + sizeof(size_t) +
+                                         ticket->ticket_len + nonce_a_len)))
+  {
+    kmyth_log(LOG_ERR, "Failed to build the resumption request.");
+    kmyth_clear_and_free(nonce_a, nonce_a_len);
+    nsl_connection_free(&conn);
+    return 1;
+  }
+  memcpy(index, NSL_RESUME_MARKER, NSL_MARKER_LEN);
+  index += NSL_MARKER_LEN;
+  put_field(&index, ticket->ticket, ticket->ticket_len);
+  memcpy(index, nonce_a, nonce_a_len);
+
+  unsigned char *nonces = NULL;
+  size_t nonces_len = 0;
+
+  if (nsl_send_frame(&conn))
+  {
+    kmyth_log(LOG_ERR, "Failed to fully send the resumption request.");
+    kmyth_clear_and_free(nonce_a, nonce_a_len);
+    nsl_connection_free(&conn);
+    return 1;
+  }
+  if (nsl_recv_frame(&conn, &nonces, &nonces_len))
+  {
+    kmyth_log(LOG_ERR, "Failed to receive the resumption response.");
+    kmyth_clear_and_free(nonce_a, nonce_a_len);
+    nsl_connection_free(&conn);
+    return 1;
+  }
+
+  // The response is nonce A and nonce B, encrypted under the resumption
+  // secret (and decrypted where it was received).
+  int result = aes_gcm_decrypt_in_place(ticket->secret, ticket->secret_len,
+                                        nonces, nonces_len, &nonces_len);
+
+  if (result || nonces_len != 2 * NSL_NONCE_LEN ||
+      memcmp(nonces, nonce_a, nonce_a_len) != 0)
+  {
+    kmyth_log(LOG_ERR, "The resumption response is invalid.");
+    kmyth_clear_and_free(nonce_a, nonce_a_len);
+    nsl_connection_free(&conn);
+    return 1;
+  }
+
+  result = derive_resumed_session_key(ticket->secret, ticket->secret_len,
+                                      nonce_a, nonce_a_len,
+                                      nonces + NSL_NONCE_LEN, NSL_NONCE_LEN,
+                                      session_key, session_key_len);
+  kmyth_clear_and_free(nonce_a, nonce_a_len);
+  nsl_connection_free(&conn);
   if (result)
   {
     kmyth_log(LOG_ERR, "Failed to generate the session key.");
@@ -1080,3 +1979,17 @@ int negotiate_server_session_key(int socket_fd,
 
   return 0;
 }
+
+//
+// free_session_ticket()
+//
+void free_session_ticket(nsl_session_ticket * ticket)
+{
+  free(ticket->ticket);
+  ticket->ticket = NULL;
+  ticket->ticket_len = 0;
+  kmyth_clear_and_free(ticket->secret, ticket->secret_len);
+  ticket->secret = NULL;
+  ticket->secret_len = 0;
+  ticket->expiry = 0;
+}
@@ -0,0 +1,373 @@
+/**
+ * @file  kmyth_async.c
+ * @brief Implements the engine for asynchronous seal/unseal requests (see
+ *        kmyth_async_t in kmyth.h)
+ */
+
+#include "kmyth_async.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+#include "defines.h"
+
+#include "alloc_stats.h"
+
+//############################################################################
+// async_signal()
+//############################################################################
+static void async_signal(kmyth_async_t * async)
+{
+  uint64_t one = 1;
+
+  // (the eventfd only fails to count up if its counter would overflow,
+  // and is readable then anyway)
+  while (write(async->event_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+  {
+  }
+}
+
+//############################################################################
+// async_run()
+//############################################################################
+static void async_run(kmyth_ctx_pool_t * pool, kmyth_async_req_t * req)
+{
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_pool_acquire(pool, &ctx))
+  {
+    req->result = 1;
+    return;
+  }
+  kmyth_ctx_set_deadline(ctx, req->deadline_ns);
+
+  if (req->op == KMYTH_ASYNC_SEAL)
+  {
+    req->result = tpm2_kmyth_seal_ctx(ctx, req->input, req->input_len,
+                                      &req->output, &req->output_len,
+                                      req->auth_bytes, req->auth_bytes_len,
+                                      req->owner_auth_bytes,
+                                      req->oa_bytes_len, req->pcrs,
+                                      req->pcrs_len, req->cipher_string,
+                                      req->expected_policy, 0);
+  }
+  else
+  {
+    req->result = tpm2_kmyth_unseal_ctx(ctx, req->input, req->input_len,
+                                        &req->output, &req->output_len,
+                                        req->auth_bytes, req->auth_bytes_len,
+                                        req->owner_auth_bytes,
+                                        req->oa_bytes_len,
+                                        req->bool_policy_or);
+  }
+
+  // a timed out request may have left the connection mid-command
+  kmyth_ctx_pool_release(pool, ctx, req->result == KMYTH_ERR_TIMEOUT);
+}
+
+//############################################################################
+// async_worker()
+//############################################################################
+static void *async_worker(void *arg)
+{
+  kmyth_async_t *async = (kmyth_async_t *) arg;
+
+  pthread_mutex_lock(&async->lock);
+  while (true)
+  {
+    while (async->queue_head == NULL && !async->stopping)
+    {
+      pthread_cond_wait(&async->queued, &async->lock);
+    }
+
+    // the requests queued before the engine was stopped are still run
+    kmyth_async_req_t *req = async->queue_head;
+
+    if (req == NULL)
+    {
+      break;
+    }
+    async->queue_head = req->next;
+    if (async->queue_head == NULL)
+    {
+      async->queue_tail = NULL;
+    }
+    pthread_mutex_unlock(&async->lock);
+
+    async_run(async->pool, req);
+
+    pthread_mutex_lock(&async->lock);
+    req->next = NULL;
+    if (async->done_tail == NULL)
+    {
+      async->done_head = req;
+    }
+    else
+    {
+      async->done_tail->next = req;
+    }
+    async->done_tail = req;
+    async_signal(async);
+  }
+  pthread_mutex_unlock(&async->lock);
+
+  return NULL;
+}
+
+//############################################################################
+// async_submit()
+//############################################################################
+static int async_submit(kmyth_async_t * async, kmyth_async_req_t * req,
+                        kmyth_async_callback_t callback, kmyth_async_op_t op)
+{
+  if (async == NULL || req == NULL || callback == NULL || req->input == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid asynchronous request ... exiting");
+    return 1;
+  }
+
+  req->callback = callback;
+  req->op = (int) op;
+  req->next = NULL;
+  req->result = 1;
+  req->output = NULL;
+  req->output_len = 0;
+
+  pthread_mutex_lock(&async->lock);
+  if (async->stopping)
+  {
+    pthread_mutex_unlock(&async->lock);
+    kmyth_log(LOG_ERR, "asynchronous engine is stopping ... exiting");
+    return 1;
+  }
+  if (async->queue_tail == NULL)
+  {
+    async->queue_head = req;
+  }
+  else
+  {
+    async->queue_tail->next = req;
+  }
+  async->queue_tail = req;
+  async->in_flight++;
+  pthread_cond_signal(&async->queued);
+  pthread_mutex_unlock(&async->lock);
+
+  return 0;
+}
+
+//############################################################################
+// async_stop()
+//############################################################################
+static void async_stop(kmyth_async_t * async)
+{
+  pthread_mutex_lock(&async->lock);
+  async->stopping = true;
+  pthread_cond_broadcast(&async->queued);
+  pthread_mutex_unlock(&async->lock);
+
+  for (size_t i = 0; i < async->worker_count; i++)
+  {
+    pthread_join(async->workers[i], NULL);
+  }
+  async->worker_count = 0;
+}
+
+//############################################################################
+// kmyth_async_create()
+//############################################################################
+int kmyth_async_create(kmyth_async_t ** async, kmyth_ctx_pool_t * pool,
+                       size_t workers)
+{
+  if (async == NULL || *async != NULL || pool == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid asynchronous engine parameters ... exiting");
+    return 1;
+  }
+  if (workers == 0 || workers > KMYTH_ASYNC_MAX_WORKERS)
+  {
+    kmyth_log(LOG_ERR, "invalid number of workers (%zu), must be 1 to %d "
+              "... exiting", workers, KMYTH_ASYNC_MAX_WORKERS);
+    return 1;
+  }
+
+  kmyth_async_t *new_async = calloc(1, sizeof(kmyth_async_t));
+
+  if (new_async == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate asynchronous engine ... exiting");
+    return 1;
+  }
+  new_async->pool = pool;
+  new_async->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (new_async->event_fd < 0)
+  {
+    kmyth_log(LOG_ERR, "unable to create eventfd ... exiting");
+    free(new_async);
+    return 1;
+  }
+  pthread_mutex_init(&new_async->lock, NULL);
+  pthread_cond_init(&new_async->queued, NULL);
+
+  for (size_t i = 0; i < workers; i++)
+  {
+    if (pthread_create(&new_async->workers[i], NULL, async_worker,
+                       new_async) != 0)
+    {
+      kmyth_log(LOG_ERR, "unable to start asynchronous worker ... exiting");
+      async_stop(new_async);
+      pthread_cond_destroy(&new_async->queued);
+      pthread_mutex_destroy(&new_async->lock);
+      close(new_async->event_fd);
+      free(new_async);
+      return 1;
+    }
+    new_async->worker_count++;
+  }
+
+  *async = new_async;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_async_destroy()
+//############################################################################
+int kmyth_async_destroy(kmyth_async_t ** async)
+{
+  if (async == NULL || *async == NULL)
+  {
+    return 0;
+  }
+
+  // the workers finish every request queued, then the callbacks are run
+  // (new requests submitted by them are refused)
+  async_stop(*async);
+  while (kmyth_async_complete(*async, 0) > 0)
+  {
+  }
+
+  pthread_cond_destroy(&(*async)->queued);
+  pthread_mutex_destroy(&(*async)->lock);
+  close((*async)->event_fd);
+
+  free(*async);
+  *async = NULL;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_async_fd()
+//############################################################################
+int kmyth_async_fd(kmyth_async_t * async)
+{
+  return (async == NULL) ? -1 : async->event_fd;
+}
+
+//############################################################################
+// kmyth_seal_async()
+//############################################################################
+int kmyth_seal_async(kmyth_async_t * async, kmyth_async_req_t * req,
+                     kmyth_async_callback_t callback)
+{
+  return async_submit(async, req, callback, KMYTH_ASYNC_SEAL);
+}
+
+//############################################################################
+// kmyth_unseal_async()
+//############################################################################
+int kmyth_unseal_async(kmyth_async_t * async, kmyth_async_req_t * req,
+                       kmyth_async_callback_t callback)
+{
+  return async_submit(async, req, callback, KMYTH_ASYNC_UNSEAL);
+}
+
+//############################################################################
+// kmyth_async_complete()
+//############################################################################
+size_t kmyth_async_complete(kmyth_async_t * async, size_t max)
+{
+  if (async == NULL)
+  {
+    return 0;
+  }
+
+  // Reset the eventfd before taking the completed requests: one completed
+  // after this is either taken too, or signals the eventfd again.
+  uint64_t count = 0;
+
+  while (read(async->event_fd, &count, sizeof(count)) < 0 && errno == EINTR)
+  {
+  }
+
+  pthread_mutex_lock(&async->lock);
+
+  kmyth_async_req_t *head = async->done_head;
+  kmyth_async_req_t *last = NULL;
+  size_t taken = 0;
+
+  for (kmyth_async_req_t * req = head;
+       req != NULL && (max == 0 || taken < max); req = req->next)
+  {
+    last = req;
+    taken++;
+  }
+  if (last != NULL)
+  {
+    async->done_head = last->next;
+    if (async->done_head == NULL)
+    {
+      async->done_tail = NULL;
+    }
+    last->next = NULL;
+  }
+  async->in_flight -= taken;
+
+  // (those left over keep the eventfd readable)
+  if (async->done_head != NULL)
+  {
+    async_signal(async);
+  }
+  pthread_mutex_unlock(&async->lock);
+
+  // the callbacks are run without the lock, so that they can submit
+  // requests
+  if (last == NULL)
+  {
+    head = NULL;
+  }
+  while (head != NULL)
+  {
+    kmyth_async_req_t *req = head;
+
+    head = req->next;
+    req->next = NULL;
+    req->callback(req);
+  }
+
+  return taken;
+}
+
+//############################################################################
+// kmyth_async_in_flight()
+//############################################################################
+size_t kmyth_async_in_flight(kmyth_async_t * async)
+{
+  if (async == NULL)
+  {
+    return 0;
+  }
+
+  pthread_mutex_lock(&async->lock);
+
+  size_t in_flight = async->in_flight;
+
+  pthread_mutex_unlock(&async->lock);
+
+  return in_flight;
+}
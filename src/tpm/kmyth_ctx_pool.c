@@ -0,0 +1,182 @@
+/**
+ * @file  kmyth_ctx_pool.c
+ * @brief Implements the checkout pool of Kmyth contexts (see
+ *        kmyth_ctx_pool_t in kmyth.h)
+ */
+
+#include "kmyth_ctx_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+
+#include "alloc_stats.h"
+
+//############################################################################
+// kmyth_ctx_pool_create()
+//############################################################################
+int kmyth_ctx_pool_create(kmyth_ctx_pool_t ** pool, const char *tcti_conf,
+                          size_t max_ctxs, kmyth_ctx_pool_init_fn init,
+                          void *init_arg)
+{
+  if (pool == NULL || *pool != NULL)
+  {
+    kmyth_log(LOG_ERR, "context pool passed in must be NULL ... exiting");
+    return 1;
+  }
+  if (max_ctxs == 0 || max_ctxs > KMYTH_CTX_POOL_MAX)
+  {
+    kmyth_log(LOG_ERR, "invalid number of contexts (%zu), must be 1 to %d "
+              "... exiting", max_ctxs, KMYTH_CTX_POOL_MAX);
+    return 1;
+  }
+
+  kmyth_ctx_pool_t *new_pool = calloc(1, sizeof(kmyth_ctx_pool_t));
+
+  if (new_pool == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate context pool ... exiting");
+    return 1;
+  }
+  if (tcti_conf != NULL)
+  {
+    new_pool->tcti_conf = strdup(tcti_conf);
+    if (new_pool->tcti_conf == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate TCTI configuration ... exiting");
+      free(new_pool);
+      return 1;
+    }
+  }
+  new_pool->init = init;
+  new_pool->init_arg = init_arg;
+  new_pool->max_ctxs = max_ctxs;
+  pthread_mutex_init(&new_pool->lock, NULL);
+  pthread_cond_init(&new_pool->available, NULL);
+
+  *pool = new_pool;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_pool_destroy()
+//############################################################################
+int kmyth_ctx_pool_destroy(kmyth_ctx_pool_t ** pool)
+{
+  if (pool == NULL || *pool == NULL)
+  {
+    return 0;
+  }
+
+  int retval = 0;
+
+  if ((*pool)->created != (*pool)->idle_len)
+  {
+    kmyth_log(LOG_ERR, "%zu context(s) still checked out of the pool",
+              (*pool)->created - (*pool)->idle_len);
+    retval = 1;
+  }
+  for (size_t i = 0; i < (*pool)->idle_len; i++)
+  {
+    if (kmyth_ctx_destroy(&(*pool)->idle[i]))
+    {
+      retval = 1;
+    }
+  }
+  pthread_cond_destroy(&(*pool)->available);
+  pthread_mutex_destroy(&(*pool)->lock);
+  free((*pool)->tcti_conf);
+
+  free(*pool);
+  *pool = NULL;
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_ctx_pool_acquire()
+//############################################################################
+int kmyth_ctx_pool_acquire(kmyth_ctx_pool_t * pool, kmyth_ctx_t ** ctx)
+{
+  if (pool == NULL || ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid context pool parameters ... exiting");
+    return 1;
+  }
+  *ctx = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->idle_len == 0 && pool->created == pool->max_ctxs)
+  {
+    pthread_cond_wait(&pool->available, &pool->lock);
+  }
+
+  // the most recently returned context is the one most likely to have
+  // its SRK handle (and objects) still cached
+  if (pool->idle_len > 0)
+  {
+    *ctx = pool->idle[--pool->idle_len];
+    pool->idle[pool->idle_len] = NULL;
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+  }
+
+  // otherwise, create another context - counted as created while it is
+  // connecting (outside the lock), so the limit holds
+  pool->created++;
+  pthread_mutex_unlock(&pool->lock);
+
+  kmyth_ctx_t *new_ctx = NULL;
+
+  if (kmyth_ctx_create_tcti(&new_ctx, pool->tcti_conf) ||
+      (pool->init != NULL && pool->init(new_ctx, pool->init_arg)))
+  {
+    kmyth_log(LOG_ERR, "unable to create pooled context ... exiting");
+    kmyth_ctx_destroy(&new_ctx);
+    pthread_mutex_lock(&pool->lock);
+    pool->created--;
+    pthread_cond_signal(&pool->available);
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+  }
+  *ctx = new_ctx;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_pool_release()
+//############################################################################
+int kmyth_ctx_pool_release(kmyth_ctx_pool_t * pool, kmyth_ctx_t * ctx,
+                           int discard)
+{
+  if (pool == NULL || ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid context pool parameters ... exiting");
+    return 1;
+  }
+
+  int retval = 0;
+
+  // a discarded context (e.g., one whose TPM connection failed) is
+  // replaced by a new one on a later checkout
+  if (discard)
+  {
+    retval = kmyth_ctx_destroy(&ctx);
+    pthread_mutex_lock(&pool->lock);
+    pool->created--;
+  }
+  else
+  {
+    // the next user starts without this one's deadline (or cancellation)
+    kmyth_ctx_set_deadline(ctx, 0);
+    pthread_mutex_lock(&pool->lock);
+    pool->idle[pool->idle_len++] = ctx;
+  }
+  pthread_cond_signal(&pool->available);
+  pthread_mutex_unlock(&pool->lock);
+
+  return retval;
+}
@@ -0,0 +1,648 @@
+/**
+ * @file  kmyth_keyring.c
+ * @brief Implements the sealed keyring container (see kmyth_keyring.h) and
+ *        the keyring lookup functions declared in kmyth.h
+ */
+
+#include "kmyth_keyring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+#include "memory_util.h"
+
+#include "cipher/aes_gcm.h"
+
+#include "alloc_stats.h"
+
+// size of the packed index record of an entry, excluding its name
+#define KMYTH_KEYRING_RECORD_SIZE (2 + 8 + 4)
+
+// size added by AES/GCM encryption (the IV and the tag)
+#define KMYTH_KEYRING_GCM_OVERHEAD (GCM_IV_LEN + GCM_TAG_LEN)
+
+// an entry to be written to a keyring container: either a value to be
+// encrypted, or (when enc_value is set) an already encrypted value to be
+// copied as it is
+typedef struct
+{
+  const char *name;
+  uint8_t *value;
+  size_t value_len;
+  uint8_t *enc_value;
+} kmyth_keyring_entry;
+
+//############################################################################
+// keyring_put_be()
+//############################################################################
+static void keyring_put_be(uint8_t * output, uint64_t value, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    output[i] = (uint8_t) (value >> (8 * (len - 1 - i)));
+  }
+}
+
+//############################################################################
+// keyring_get_be()
+//############################################################################
+static uint64_t keyring_get_be(uint8_t * input, size_t len)
+{
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    value = (value << 8) | input[i];
+  }
+
+  return value;
+}
+
+//############################################################################
+// keyring_compare_names()
+//############################################################################
+static int keyring_compare_names(const void *a, const void *b)
+{
+  return strcmp(((const kmyth_keyring_entry *) a)->name,
+                ((const kmyth_keyring_entry *) b)->name);
+}
+
+//############################################################################
+// kmyth_keyring_sort_entries()
+//############################################################################
+static int kmyth_keyring_sort_entries(size_t count,
+                                      const char **names, uint8_t ** values,
+                                      size_t *value_lens,
+                                      kmyth_keyring_entry ** entries)
+{
+  if (names == NULL || values == NULL || value_lens == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid keyring parameters ... exiting");
+    return 1;
+  }
+  if (count == 0 || count > UINT32_MAX)
+  {
+    kmyth_log(LOG_ERR, "invalid keyring entry count (%zu) ... exiting",
+              count);
+    return 1;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t name_len = (names[i] == NULL) ? 0 : strlen(names[i]);
+
+    if (name_len == 0 || name_len > KMYTH_KEYRING_MAX_NAME_LEN)
+    {
+      kmyth_log(LOG_ERR, "invalid keyring entry name (entry %zu) "
+                "... exiting", i);
+      return 1;
+    }
+    if (values[i] == NULL || value_lens[i] == 0 ||
+        value_lens[i] > UINT32_MAX - KMYTH_KEYRING_GCM_OVERHEAD)
+    {
+      kmyth_log(LOG_ERR, "invalid keyring entry value (%s) ... exiting",
+                names[i]);
+      return 1;
+    }
+  }
+
+  kmyth_keyring_entry *sorted = calloc(count, sizeof(kmyth_keyring_entry));
+
+  if (sorted == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error (keyring index) ... exiting");
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    sorted[i].name = names[i];
+    sorted[i].value = values[i];
+    sorted[i].value_len = value_lens[i];
+  }
+  qsort(sorted, count, sizeof(kmyth_keyring_entry), keyring_compare_names);
+  for (size_t i = 1; i < count; i++)
+  {
+    if (strcmp(sorted[i - 1].name, sorted[i].name) == 0)
+    {
+      kmyth_log(LOG_ERR, "duplicate keyring entry name (%s) ... exiting",
+                sorted[i].name);
+      free(sorted);
+      return 1;
+    }
+  }
+
+  *entries = sorted;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_keyring_write()
+//############################################################################
+static int kmyth_keyring_write(uint8_t * key, size_t key_len, size_t count,
+                               kmyth_keyring_entry * entries,
+                               uint8_t ** data, size_t *data_size)
+{
+  // size the index and the values
+  size_t index_len = 0;
+  size_t values_size = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    index_len += KMYTH_KEYRING_RECORD_SIZE + strlen(entries[i].name);
+    if (values_size >
+        SIZE_MAX - entries[i].value_len - KMYTH_KEYRING_GCM_OVERHEAD)
+    {
+      kmyth_log(LOG_ERR, "keyring too large ... exiting");
+      return 1;
+    }
+    values_size += entries[i].value_len + KMYTH_KEYRING_GCM_OVERHEAD;
+  }
+
+  size_t index_size = index_len + KMYTH_KEYRING_GCM_OVERHEAD;
+
+  if (index_size > UINT32_MAX ||
+      values_size > SIZE_MAX - KMYTH_KEYRING_HEADER_SIZE - index_size)
+  {
+    kmyth_log(LOG_ERR, "keyring too large ... exiting");
+    return 1;
+  }
+
+  size_t out_size = KMYTH_KEYRING_HEADER_SIZE + index_size + values_size;
+  uint8_t *out = malloc(out_size);
+  uint8_t *index = malloc(index_len);
+
+  if (out == NULL || index == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error (%zu byte keyring) ... exiting",
+              out_size);
+    free(out);
+    free(index);
+    return 1;
+  }
+
+  // header
+  memcpy(out, KMYTH_KEYRING_MAGIC, KMYTH_KEYRING_MAGIC_LEN);
+  keyring_put_be(out + KMYTH_KEYRING_MAGIC_LEN, KMYTH_KEYRING_VERSION, 4);
+  keyring_put_be(out + KMYTH_KEYRING_MAGIC_LEN + 4, (uint64_t) count, 4);
+  keyring_put_be(out + KMYTH_KEYRING_MAGIC_LEN + 8, (uint64_t) index_size,
+                 4);
+
+  // values, recording each one in the index as it is written - a value is
+  // authenticated together with its name, so values cannot be swapped
+  // between entries
+  uint8_t *values_out = out + KMYTH_KEYRING_HEADER_SIZE + index_size;
+  uint8_t *record = index;
+  size_t offset = 0;
+  int retval = 0;
+
+  for (size_t i = 0; i < count && retval == 0; i++)
+  {
+    const char *name = entries[i].name;
+    size_t name_len = strlen(name);
+    size_t value_len = entries[i].value_len;
+
+    keyring_put_be(record, (uint64_t) name_len, 2);
+    memcpy(record + 2, name, name_len);
+    keyring_put_be(record + 2 + name_len, (uint64_t) offset, 8);
+    keyring_put_be(record + 10 + name_len, (uint64_t) value_len, 4);
+    record += KMYTH_KEYRING_RECORD_SIZE + name_len;
+
+    if (entries[i].enc_value != NULL)
+    {
+      memcpy(values_out + offset, entries[i].enc_value,
+             value_len + KMYTH_KEYRING_GCM_OVERHEAD);
+    }
+    else
+    {
+      retval = aes_gcm_encrypt_chunk(key, key_len,
+                                     (uint8_t *) name, name_len,
+                                     entries[i].value, value_len,
+                                     values_out + offset);
+    }
+    offset += value_len + KMYTH_KEYRING_GCM_OVERHEAD;
+  }
+
+  // the index is authenticated together with the header
+  if (retval == 0)
+  {
+    retval = aes_gcm_encrypt_chunk(key, key_len,
+                                   out, KMYTH_KEYRING_HEADER_SIZE,
+                                   index, index_len,
+                                   out + KMYTH_KEYRING_HEADER_SIZE);
+  }
+  kmyth_clear_and_free(index, index_len);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to encrypt keyring ... exiting");
+    free(out);
+    return 1;
+  }
+
+  *data = out;
+  *data_size = out_size;
+
+  return 0;
+}
+
+//############################################################################
+// is_keyring_data()
+//############################################################################
+bool is_keyring_data(uint8_t * data, size_t data_size)
+{
+  return (data != NULL && data_size >= KMYTH_KEYRING_MAGIC_LEN &&
+          memcmp(data, KMYTH_KEYRING_MAGIC, KMYTH_KEYRING_MAGIC_LEN) == 0);
+}
+
+//############################################################################
+// kmyth_keyring_pack()
+//############################################################################
+int kmyth_keyring_pack(uint8_t * key, size_t key_len, size_t count,
+                       const char **names, uint8_t ** values,
+                       size_t *value_lens,
+                       uint8_t ** data, size_t *data_size)
+{
+  if (key == NULL || data == NULL || data_size == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid keyring parameters ... exiting");
+    return 1;
+  }
+
+  // entries are stored in name order, so that they can be looked up by a
+  // binary search
+  kmyth_keyring_entry *entries = NULL;
+
+  if (kmyth_keyring_sort_entries(count, names, values, value_lens, &entries))
+  {
+    return 1;
+  }
+
+  int retval = kmyth_keyring_write(key, key_len, count, entries,
+                                   data, data_size);
+
+  free(entries);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_keyring_update()
+//############################################################################
+int kmyth_keyring_update(kmyth_keyring_t * keyring, size_t count,
+                         const char **names, uint8_t ** values,
+                         size_t *value_lens,
+                         uint8_t ** data, size_t *data_size)
+{
+  if (keyring == NULL || data == NULL || data_size == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid keyring parameters ... exiting");
+    return 1;
+  }
+
+  kmyth_keyring_entry *updates = NULL;
+
+  if (kmyth_keyring_sort_entries(count, names, values, value_lens, &updates))
+  {
+    return 1;
+  }
+  if (keyring->count > UINT32_MAX - count)
+  {
+    kmyth_log(LOG_ERR, "too many keyring entries ... exiting");
+    free(updates);
+    return 1;
+  }
+
+  kmyth_keyring_entry *entries =
+    calloc(keyring->count + count, sizeof(kmyth_keyring_entry));
+
+  if (entries == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error (keyring index) ... exiting");
+    free(updates);
+    return 1;
+  }
+
+  // merge the (sorted) existing entries and updates - an update replaces
+  // the existing entry of the same name, and the other existing entries
+  // are kept as they are (still encrypted)
+  size_t total = 0;
+  size_t i = 0;
+  size_t j = 0;
+
+  while (i < keyring->count || j < count)
+  {
+    int cmp = (i == keyring->count) ? 1 :
+      (j == count) ? -1 : strcmp(keyring->names[i], updates[j].name);
+
+    if (cmp < 0)
+    {
+      entries[total].name = keyring->names[i];
+      entries[total].value_len = keyring->value_lens[i];
+      entries[total].enc_value = keyring->values + keyring->offsets[i];
+      i++;
+    }
+    else
+    {
+      entries[total] = updates[j];
+      j++;
+      if (cmp == 0)
+      {
+        i++;
+      }
+    }
+    total++;
+  }
+
+  int retval = kmyth_keyring_write(keyring->key, keyring->key_len, total,
+                                   entries, data, data_size);
+
+  free(entries);
+  free(updates);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_keyring_parse_index()
+//############################################################################
+static int kmyth_keyring_parse_index(kmyth_keyring_t * keyring,
+                                     uint8_t * index, size_t index_len)
+{
+  size_t pos = 0;
+
+  for (size_t i = 0; i < keyring->count; i++)
+  {
+    if (index_len - pos < KMYTH_KEYRING_RECORD_SIZE)
+    {
+      return 1;
+    }
+
+    size_t name_len = (size_t) keyring_get_be(index + pos, 2);
+
+    if (name_len == 0 || name_len > KMYTH_KEYRING_MAX_NAME_LEN ||
+        index_len - pos - KMYTH_KEYRING_RECORD_SIZE < name_len ||
+        memchr(index + pos + 2, '\0', name_len) != NULL)
+    {
+      return 1;
+    }
+
+    uint64_t offset = keyring_get_be(index + pos + 2 + name_len, 8);
+    uint64_t value_len = keyring_get_be(index + pos + 10 + name_len, 4);
+
+    // each value must lie within the values
+    if (value_len == 0 || offset > keyring->values_size ||
+        keyring->values_size - offset <
+        value_len + KMYTH_KEYRING_GCM_OVERHEAD)
+    {
+      return 1;
+    }
+
+    keyring->names[i] = calloc(name_len + 1, 1);
+    if (keyring->names[i] == NULL)
+    {
+      return 1;
+    }
+    memcpy(keyring->names[i], index + pos + 2, name_len);
+    keyring->offsets[i] = (size_t) offset;
+    keyring->value_lens[i] = (size_t) value_len;
+
+    // names must be in (strictly increasing) order
+    if (i > 0 && strcmp(keyring->names[i - 1], keyring->names[i]) >= 0)
+    {
+      return 1;
+    }
+
+    pos += KMYTH_KEYRING_RECORD_SIZE + name_len;
+  }
+
+  return (pos != index_len);
+}
+
+//############################################################################
+// kmyth_keyring_load()
+//############################################################################
+int kmyth_keyring_load(uint8_t * key, size_t key_len,
+                       uint8_t * data, size_t data_size,
+                       kmyth_keyring_t ** keyring)
+{
+  if (key == NULL || key_len == 0 || keyring == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid keyring parameters ... exiting");
+    return 1;
+  }
+  if (!is_keyring_data(data, data_size) ||
+      data_size < KMYTH_KEYRING_HEADER_SIZE)
+  {
+    kmyth_log(LOG_ERR, "sealed data is not a keyring ... exiting");
+    return 1;
+  }
+
+  uint64_t version = keyring_get_be(data + KMYTH_KEYRING_MAGIC_LEN, 4);
+  uint64_t count = keyring_get_be(data + KMYTH_KEYRING_MAGIC_LEN + 4, 4);
+  uint64_t index_size = keyring_get_be(data + KMYTH_KEYRING_MAGIC_LEN + 8,
+                                       4);
+
+  if (version != KMYTH_KEYRING_VERSION)
+  {
+    kmyth_log(LOG_ERR, "unsupported keyring version (%u) ... exiting",
+              (unsigned int) version);
+    return 1;
+  }
+  if (count == 0 || index_size <= KMYTH_KEYRING_GCM_OVERHEAD ||
+      index_size > data_size - KMYTH_KEYRING_HEADER_SIZE)
+  {
+    kmyth_log(LOG_ERR, "invalid keyring header ... exiting");
+    return 1;
+  }
+
+  kmyth_keyring_t *out = calloc(1, sizeof(kmyth_keyring_t));
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error (keyring) ... exiting");
+    return 1;
+  }
+  out->count = (size_t) count;
+  out->values = data + KMYTH_KEYRING_HEADER_SIZE + index_size;
+  out->values_size = data_size - KMYTH_KEYRING_HEADER_SIZE -
+    (size_t) index_size;
+  out->names = calloc(out->count, sizeof(char *));
+  out->offsets = calloc(out->count, sizeof(size_t));
+  out->value_lens = calloc(out->count, sizeof(size_t));
+  out->key = malloc(key_len);
+
+  size_t index_len = (size_t) index_size - KMYTH_KEYRING_GCM_OVERHEAD;
+  uint8_t *index = malloc(index_len);
+
+  if (out->names == NULL || out->offsets == NULL ||
+      out->value_lens == NULL || out->key == NULL || index == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error (keyring) ... exiting");
+    free(index);
+    kmyth_keyring_close(&out);
+    return 1;
+  }
+  memcpy(out->key, key, key_len);
+  out->key_len = key_len;
+
+  // decrypting the index checks the header, the index, and the key
+  if (aes_gcm_decrypt_chunk(key, key_len, data, KMYTH_KEYRING_HEADER_SIZE,
+                            data + KMYTH_KEYRING_HEADER_SIZE,
+                            (size_t) index_size, index))
+  {
+    kmyth_log(LOG_ERR, "unable to decrypt keyring index ... exiting");
+    free(index);
+    kmyth_keyring_close(&out);
+    return 1;
+  }
+
+  int retval = kmyth_keyring_parse_index(out, index, index_len);
+
+  kmyth_clear_and_free(index, index_len);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "invalid keyring index ... exiting");
+    kmyth_keyring_close(&out);
+    return 1;
+  }
+
+  // only now does the keyring take ownership of the data
+  out->data = data;
+  out->data_size = data_size;
+  *keyring = out;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_keyring_count()
+//############################################################################
+size_t kmyth_keyring_count(kmyth_keyring_t * keyring)
+{
+  return (keyring == NULL) ? 0 : keyring->count;
+}
+
+//############################################################################
+// kmyth_keyring_name()
+//############################################################################
+const char *kmyth_keyring_name(kmyth_keyring_t * keyring, size_t index)
+{
+  if (keyring == NULL || index >= keyring->count)
+  {
+    return NULL;
+  }
+
+  return keyring->names[index];
+}
+
+//############################################################################
+// kmyth_keyring_get_index()
+//############################################################################
+int kmyth_keyring_get_index(kmyth_keyring_t * keyring, size_t index,
+                            uint8_t ** value, size_t *value_len)
+{
+  if (keyring == NULL || index >= keyring->count ||
+      value == NULL || value_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid keyring lookup ... exiting");
+    return 1;
+  }
+
+  const char *name = keyring->names[index];
+  size_t len = keyring->value_lens[index];
+  uint8_t *out = malloc(len);
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error (%zu bytes) ... exiting", len);
+    return 1;
+  }
+
+  // only this entry's value is decrypted
+  if (aes_gcm_decrypt_chunk(keyring->key, keyring->key_len,
+                            (uint8_t *) name, strlen(name),
+                            keyring->values + keyring->offsets[index],
+                            len + KMYTH_KEYRING_GCM_OVERHEAD, out))
+  {
+    kmyth_log(LOG_ERR, "unable to decrypt keyring entry (%s) ... exiting",
+              name);
+    free(out);
+    return 1;
+  }
+
+  *value = out;
+  *value_len = len;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_keyring_get()
+//############################################################################
+int kmyth_keyring_get(kmyth_keyring_t * keyring, const char *name,
+                      uint8_t ** value, size_t *value_len)
+{
+  if (keyring == NULL || name == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid keyring lookup ... exiting");
+    return 1;
+  }
+
+  // binary search of the (sorted) names
+  size_t low = 0;
+  size_t high = keyring->count;
+
+  while (low < high)
+  {
+    size_t mid = low + (high - low) / 2;
+    int cmp = strcmp(name, keyring->names[mid]);
+
+    if (cmp == 0)
+    {
+      return kmyth_keyring_get_index(keyring, mid, value, value_len);
+    }
+    if (cmp < 0)
+    {
+      high = mid;
+    }
+    else
+    {
+      low = mid + 1;
+    }
+  }
+
+  kmyth_log(LOG_ERR, "keyring entry (%s) not found ... exiting", name);
+  return 1;
+}
+
+//############################################################################
+// kmyth_keyring_close()
+//############################################################################
+int kmyth_keyring_close(kmyth_keyring_t ** keyring)
+{
+  if (keyring == NULL || *keyring == NULL)
+  {
+    return 1;
+  }
+
+  kmyth_keyring_t *kr = *keyring;
+
+  if (kr->names != NULL)
+  {
+    for (size_t i = 0; i < kr->count; i++)
+    {
+      free(kr->names[i]);
+    }
+  }
+  free(kr->names);
+  free(kr->offsets);
+  free(kr->value_lens);
+  kmyth_clear_and_free(kr->key, kr->key_len);
+  free(kr->data);
+  free(kr);
+  *keyring = NULL;
+
+  return 0;
+}
@@ -0,0 +1,649 @@
+/**
+ * @file  kmyth_metrics.c
+ * @brief Implements the library-wide metrics (see kmyth_metrics.h) and
+ *        their snapshot and Prometheus export, declared in kmyth.h
+ */
+
+#include "kmyth_metrics.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+
+#include "defines.h"
+#include "tpm2_interface.h"
+
+#include "cipher/cipher.h"
+
+#include "alloc_stats.h"
+
+extern const cipher_t cipher_list[];
+
+// Upper bounds of the operation latency buckets (the last is unbounded)
+static const uint64_t kmyth_metrics_bounds_ns[KMYTH_METRICS_BUCKETS] = {
+  1000000ULL, 2500000ULL, 5000000ULL, 10000000ULL, 25000000ULL,
+  50000000ULL, 100000000ULL, 250000000ULL, 500000000ULL, 1000000000ULL,
+  2500000000ULL, UINT64_MAX
+};
+
+// The counts, each updated with relaxed atomics. The per cipher counts are
+// indexed as cipher_list[].
+static uint64_t metrics_calls[KMYTH_OP_COUNT];
+static uint64_t metrics_failures[KMYTH_OP_COUNT][KMYTH_FAILURE_COUNT];
+static uint64_t metrics_buckets[KMYTH_OP_COUNT][KMYTH_METRICS_BUCKETS];
+static uint64_t metrics_latency_ns[KMYTH_OP_COUNT];
+static uint64_t metrics_tpm_commands;
+static uint64_t metrics_tpm_errors;
+static uint64_t metrics_tpm_retries;
+static uint64_t metrics_cache_hits[KMYTH_CACHE_COUNT];
+static uint64_t metrics_cache_misses[KMYTH_CACHE_COUNT];
+static uint64_t metrics_encrypted[KMYTH_METRICS_MAX_CIPHERS];
+static uint64_t metrics_decrypted[KMYTH_METRICS_MAX_CIPHERS];
+
+// The calling thread's operation nesting depth, and the last reason noted
+// for the failure of its current operation (-1 for none)
+static __thread unsigned int metrics_depth = 0;
+static __thread int metrics_failure = -1;
+
+// Path of the textfile written at exit (see kmyth_metrics_export_at_exit())
+static char *metrics_exit_path = NULL;
+
+static const char *const kmyth_op_names[KMYTH_OP_COUNT] = {
+  "seal", "unseal", "reseal"
+};
+
+static const char *const kmyth_failure_names[KMYTH_FAILURE_COUNT] = {
+  "input", "auth", "tpm", "cipher", "timeout", "other"
+};
+
+static const char *const kmyth_cache_names[KMYTH_CACHE_COUNT] = {
+  "unseal", "object_context", "policy_session"
+};
+
+//############################################################################
+// metrics_add()
+//############################################################################
+static void metrics_add(uint64_t * counter, uint64_t value)
+{
+  __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// metrics_get()
+//############################################################################
+static uint64_t metrics_get(uint64_t * counter)
+{
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// kmyth_metrics_op_begin()
+//############################################################################
+uint64_t kmyth_metrics_op_begin(void)
+{
+  if (metrics_depth++ == 0)
+  {
+    metrics_failure = -1;
+  }
+
+  return get_timing_ns();
+}
+
+//############################################################################
+// kmyth_metrics_op_end()
+//############################################################################
+void kmyth_metrics_op_end(kmyth_op_t op, uint64_t start_ns, int retval)
+{
+  if (metrics_depth > 0 && --metrics_depth > 0)
+  {
+    return;
+  }
+  if ((size_t) op >= KMYTH_OP_COUNT)
+  {
+    return;
+  }
+
+  uint64_t elapsed_ns = get_timing_ns() - start_ns;
+  size_t bucket = 0;
+
+  while (elapsed_ns > kmyth_metrics_bounds_ns[bucket])
+  {
+    bucket++;
+  }
+
+  metrics_add(&metrics_calls[op], 1);
+  metrics_add(&metrics_buckets[op][bucket], 1);
+  metrics_add(&metrics_latency_ns[op], elapsed_ns);
+  if (retval != 0)
+  {
+    int reason = (metrics_failure < 0) ? KMYTH_FAILURE_OTHER :
+      metrics_failure;
+
+    metrics_add(&metrics_failures[op][reason], 1);
+  }
+  metrics_failure = -1;
+}
+
+//############################################################################
+// kmyth_metrics_note_failure()
+//############################################################################
+void kmyth_metrics_note_failure(kmyth_failure_t reason)
+{
+  if ((size_t) reason < KMYTH_FAILURE_COUNT)
+  {
+    metrics_failure = (int) reason;
+  }
+}
+
+//############################################################################
+// kmyth_metrics_count_tpm_response()
+//############################################################################
+void kmyth_metrics_count_tpm_response(uint32_t tpm_rc)
+{
+  metrics_add(&metrics_tpm_commands, 1);
+  if (tpm_rc == TPM2_RC_SUCCESS)
+  {
+    return;
+  }
+  metrics_add(&metrics_tpm_errors, 1);
+
+  // format-one codes also carry the number of the handle, session or
+  // parameter they refer to, which is masked off here
+  uint32_t base = (tpm_rc & TPM2_RC_FMT1) ? (tpm_rc & (TPM2_RC_FMT1 | 0x3F)) :
+    (tpm_rc & 0xFFF);
+
+  switch (base)
+  {
+  case TPM2_RC_AUTH_FAIL:
+  case TPM2_RC_BAD_AUTH:
+  case TPM2_RC_POLICY_FAIL:
+  case TPM2_RC_PCR_CHANGED:
+  case TPM2_RC_LOCKOUT:
+    kmyth_metrics_note_failure(KMYTH_FAILURE_AUTH);
+    break;
+  default:
+    kmyth_metrics_note_failure(KMYTH_FAILURE_TPM);
+    break;
+  }
+}
+
+//############################################################################
+// kmyth_metrics_count_tpm_retry()
+//############################################################################
+void kmyth_metrics_count_tpm_retry(void)
+{
+  metrics_add(&metrics_tpm_retries, 1);
+}
+
+//############################################################################
+// kmyth_metrics_count_cache()
+//############################################################################
+void kmyth_metrics_count_cache(kmyth_cache_t cache, bool hit)
+{
+  if ((size_t) cache >= KMYTH_CACHE_COUNT)
+  {
+    return;
+  }
+
+  metrics_add(hit ? &metrics_cache_hits[cache] : &metrics_cache_misses[cache],
+              1);
+}
+
+//############################################################################
+// kmyth_metrics_count_cipher_bytes()
+//############################################################################
+void kmyth_metrics_count_cipher_bytes(const char *cipher_name, bool encrypt,
+                                      size_t bytes)
+{
+  if (cipher_name == NULL)
+  {
+    return;
+  }
+
+  for (size_t i = 0; i < KMYTH_METRICS_MAX_CIPHERS &&
+       cipher_list[i].cipher_name != NULL; i++)
+  {
+    if (cipher_list[i].cipher_name == cipher_name ||
+        strcmp(cipher_list[i].cipher_name, cipher_name) == 0)
+    {
+      metrics_add(encrypt ? &metrics_encrypted[i] : &metrics_decrypted[i],
+                  (uint64_t) bytes);
+      return;
+    }
+  }
+}
+
+//############################################################################
+// kmyth_metrics_bucket_bound_ns()
+//############################################################################
+uint64_t kmyth_metrics_bucket_bound_ns(size_t bucket)
+{
+  if (bucket >= KMYTH_METRICS_BUCKETS)
+  {
+    return UINT64_MAX;
+  }
+
+  return kmyth_metrics_bounds_ns[bucket];
+}
+
+//############################################################################
+// kmyth_metrics_snapshot()
+//############################################################################
+int kmyth_metrics_snapshot(kmyth_metrics_t * metrics)
+{
+  if (metrics == NULL)
+  {
+    kmyth_log(LOG_ERR, "no metrics snapshot ... exiting");
+    return 1;
+  }
+  memset(metrics, 0, sizeof(kmyth_metrics_t));
+
+  for (size_t op = 0; op < KMYTH_OP_COUNT; op++)
+  {
+    metrics->calls[op] = metrics_get(&metrics_calls[op]);
+    metrics->latency_ns[op] = metrics_get(&metrics_latency_ns[op]);
+    for (size_t i = 0; i < KMYTH_FAILURE_COUNT; i++)
+    {
+      metrics->failures[op][i] = metrics_get(&metrics_failures[op][i]);
+    }
+    for (size_t i = 0; i < KMYTH_METRICS_BUCKETS; i++)
+    {
+      metrics->latency_buckets[op][i] = metrics_get(&metrics_buckets[op][i]);
+    }
+  }
+  metrics->tpm_commands = metrics_get(&metrics_tpm_commands);
+  metrics->tpm_errors = metrics_get(&metrics_tpm_errors);
+  metrics->tpm_retries = metrics_get(&metrics_tpm_retries);
+  for (size_t i = 0; i < KMYTH_CACHE_COUNT; i++)
+  {
+    metrics->cache_hits[i] = metrics_get(&metrics_cache_hits[i]);
+    metrics->cache_misses[i] = metrics_get(&metrics_cache_misses[i]);
+  }
+  while (metrics->cipher_count < KMYTH_METRICS_MAX_CIPHERS &&
+         cipher_list[metrics->cipher_count].cipher_name != NULL)
+  {
+    size_t i = metrics->cipher_count++;
+
+    metrics->ciphers[i].name = cipher_list[i].cipher_name;
+    metrics->ciphers[i].encrypted_bytes = metrics_get(&metrics_encrypted[i]);
+    metrics->ciphers[i].decrypted_bytes = metrics_get(&metrics_decrypted[i]);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_metrics_reset()
+//############################################################################
+void kmyth_metrics_reset(void)
+{
+  uint64_t *groups[] = {
+    metrics_calls, &metrics_failures[0][0], &metrics_buckets[0][0],
+    metrics_latency_ns, &metrics_tpm_commands, &metrics_tpm_errors,
+    &metrics_tpm_retries, metrics_cache_hits, metrics_cache_misses,
+    metrics_encrypted, metrics_decrypted
+  };
+  size_t sizes[] = {
+    KMYTH_OP_COUNT, KMYTH_OP_COUNT * KMYTH_FAILURE_COUNT,
+    KMYTH_OP_COUNT * KMYTH_METRICS_BUCKETS, KMYTH_OP_COUNT, 1, 1, 1,
+    KMYTH_CACHE_COUNT, KMYTH_CACHE_COUNT, KMYTH_METRICS_MAX_CIPHERS,
+    KMYTH_METRICS_MAX_CIPHERS
+  };
+
+  for (size_t g = 0; g < sizeof(sizes) / sizeof(sizes[0]); g++)
+  {
+    for (size_t i = 0; i < sizes[g]; i++)
+    {
+      __atomic_store_n(&groups[g][i], 0, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+// The Prometheus metric families written, in order
+typedef enum
+{
+  FAMILY_OPERATIONS,
+  FAMILY_FAILURES,
+  FAMILY_DURATION,
+  FAMILY_TPM_COMMANDS,
+  FAMILY_TPM_ERRORS,
+  FAMILY_TPM_RETRIES,
+  FAMILY_CACHE,
+  FAMILY_CIPHER_BYTES,
+  FAMILY_COUNT
+} metrics_family;
+
+static const struct
+{
+  const char *name;
+  const char *type;
+  const char *help;
+} metrics_families[FAMILY_COUNT] = {
+  {"kmyth_operations_total", "counter",
+   "Seal, unseal and reseal operations made"},
+  {"kmyth_operation_failures_total", "counter",
+   "Seal, unseal and reseal operations failed, by reason"},
+  {"kmyth_operation_duration_seconds", "histogram",
+   "Time taken by seal, unseal and reseal operations"},
+  {"kmyth_tpm_commands_total", "counter", "TPM commands completed"},
+  {"kmyth_tpm_command_errors_total", "counter",
+   "TPM commands completed with an error response"},
+  {"kmyth_tpm_retries_total", "counter",
+   "TPM commands retried because the TPM was busy"},
+  {"kmyth_cache_lookups_total", "counter", "Cache lookups, by result"},
+  {"kmyth_cipher_bytes_total", "counter",
+   "Bytes of data encrypted and decrypted, by cipher"},
+};
+
+// Maximum number of samples written (the histogram, with its sum and
+// count, has KMYTH_METRICS_BUCKETS + 2 per operation)
+#define KMYTH_METRICS_MAX_SAMPLES \
+  (KMYTH_OP_COUNT * (KMYTH_FAILURE_COUNT + KMYTH_METRICS_BUCKETS + 3) + 3 + \
+   2 * KMYTH_CACHE_COUNT + 2 * KMYTH_METRICS_MAX_CIPHERS)
+
+// A sample: its family, name (with labels) and value
+typedef struct
+{
+  metrics_family family;
+  char key[192];
+  double value;
+} metrics_sample;
+
+//############################################################################
+// add_sample()
+//############################################################################
+static void add_sample(metrics_sample * samples, size_t *count,
+                       metrics_family family, const char *suffix,
+                       const char *labels, double value)
+{
+  metrics_sample *sample = &samples[(*count)++];
+
+  sample->family = family;
+  sample->value = value;
+  if (labels == NULL || labels[0] == '\0')
+  {
+    snprintf(sample->key, sizeof(sample->key), "%s%s",
+             metrics_families[family].name, suffix);
+  }
+  else
+  {
+    snprintf(sample->key, sizeof(sample->key), "%s%s{%s}",
+             metrics_families[family].name, suffix, labels);
+  }
+}
+
+//############################################################################
+// collect_samples()
+//############################################################################
+static size_t collect_samples(const kmyth_metrics_t * metrics,
+                              metrics_sample * samples)
+{
+  size_t count = 0;
+  char labels[160];
+
+  for (size_t op = 0; op < KMYTH_OP_COUNT; op++)
+  {
+    snprintf(labels, sizeof(labels), "op=\"%s\"", kmyth_op_names[op]);
+    add_sample(samples, &count, FAMILY_OPERATIONS, "", labels,
+               (double) metrics->calls[op]);
+  }
+  for (size_t op = 0; op < KMYTH_OP_COUNT; op++)
+  {
+    for (size_t i = 0; i < KMYTH_FAILURE_COUNT; i++)
+    {
+      snprintf(labels, sizeof(labels), "op=\"%s\",reason=\"%s\"",
+               kmyth_op_names[op], kmyth_failure_names[i]);
+      add_sample(samples, &count, FAMILY_FAILURES, "", labels,
+                 (double) metrics->failures[op][i]);
+    }
+  }
+  for (size_t op = 0; op < KMYTH_OP_COUNT; op++)
+  {
+    uint64_t cumulative = 0;
+
+    for (size_t i = 0; i < KMYTH_METRICS_BUCKETS; i++)
+    {
+      cumulative += metrics->latency_buckets[op][i];
+      if (i == KMYTH_METRICS_BUCKETS - 1)
+      {
+        snprintf(labels, sizeof(labels), "op=\"%s\",le=\"+Inf\"",
+                 kmyth_op_names[op]);
+      }
+      else
+      {
+        snprintf(labels, sizeof(labels), "op=\"%s\",le=\"%g\"",
+                 kmyth_op_names[op],
+                 (double) kmyth_metrics_bounds_ns[i] / 1e9);
+      }
+      add_sample(samples, &count, FAMILY_DURATION, "_bucket", labels,
+                 (double) cumulative);
+    }
+    snprintf(labels, sizeof(labels), "op=\"%s\"", kmyth_op_names[op]);
+    add_sample(samples, &count, FAMILY_DURATION, "_sum", labels,
+               (double) metrics->latency_ns[op] / 1e9);
+    add_sample(samples, &count, FAMILY_DURATION, "_count", labels,
+               (double) cumulative);
+  }
+  add_sample(samples, &count, FAMILY_TPM_COMMANDS, "", NULL,
+             (double) metrics->tpm_commands);
+  add_sample(samples, &count, FAMILY_TPM_ERRORS, "", NULL,
+             (double) metrics->tpm_errors);
+  add_sample(samples, &count, FAMILY_TPM_RETRIES, "", NULL,
+             (double) metrics->tpm_retries);
+  for (size_t i = 0; i < KMYTH_CACHE_COUNT; i++)
+  {
+    snprintf(labels, sizeof(labels), "cache=\"%s\",result=\"hit\"",
+             kmyth_cache_names[i]);
+    add_sample(samples, &count, FAMILY_CACHE, "", labels,
+               (double) metrics->cache_hits[i]);
+    snprintf(labels, sizeof(labels), "cache=\"%s\",result=\"miss\"",
+             kmyth_cache_names[i]);
+    add_sample(samples, &count, FAMILY_CACHE, "", labels,
+               (double) metrics->cache_misses[i]);
+  }
+  for (size_t i = 0; i < metrics->cipher_count &&
+       i < KMYTH_METRICS_MAX_CIPHERS; i++)
+  {
+    snprintf(labels, sizeof(labels), "cipher=\"%s\",direction=\"encrypt\"",
+             metrics->ciphers[i].name);
+    add_sample(samples, &count, FAMILY_CIPHER_BYTES, "", labels,
+               (double) metrics->ciphers[i].encrypted_bytes);
+    snprintf(labels, sizeof(labels), "cipher=\"%s\",direction=\"decrypt\"",
+             metrics->ciphers[i].name);
+    add_sample(samples, &count, FAMILY_CIPHER_BYTES, "", labels,
+               (double) metrics->ciphers[i].decrypted_bytes);
+  }
+
+  return count;
+}
+
+//############################################################################
+// write_samples()
+//############################################################################
+static int write_samples(FILE * out, const metrics_sample * samples,
+                         size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    if (i == 0 || samples[i].family != samples[i - 1].family)
+    {
+      fprintf(out, "# HELP %s %s\n# TYPE %s %s\n",
+              metrics_families[samples[i].family].name,
+              metrics_families[samples[i].family].help,
+              metrics_families[samples[i].family].name,
+              metrics_families[samples[i].family].type);
+    }
+    fprintf(out, "%s %.17g\n", samples[i].key, samples[i].value);
+  }
+
+  return ferror(out) ? 1 : 0;
+}
+
+//############################################################################
+// kmyth_metrics_write_prometheus()
+//############################################################################
+int kmyth_metrics_write_prometheus(FILE * out,
+                                   const kmyth_metrics_t * metrics)
+{
+  if (out == NULL || metrics == NULL)
+  {
+    kmyth_log(LOG_ERR, "no metrics or output stream ... exiting");
+    return 1;
+  }
+
+  metrics_sample *samples = calloc(KMYTH_METRICS_MAX_SAMPLES,
+                                   sizeof(metrics_sample));
+
+  if (samples == NULL)
+  {
+    kmyth_log(LOG_ERR, "error allocating metrics samples ... exiting");
+    return 1;
+  }
+
+  int retval = write_samples(out, samples, collect_samples(metrics, samples));
+
+  free(samples);
+
+  return retval;
+}
+
+//############################################################################
+// add_previous_samples()
+//############################################################################
+static void add_previous_samples(const char *path, metrics_sample * samples,
+                                 size_t count)
+{
+  FILE *in = fopen(path, "re");
+  char line[256];
+
+  while (in != NULL && fgets(line, sizeof(line), in) != NULL)
+  {
+    char *space = strrchr(line, ' ');
+
+    if (line[0] == '#' || space == NULL)
+    {
+      continue;
+    }
+    *space = '\0';
+
+    // lines written by another version of the library that do not match
+    // one of this version's samples are dropped
+    for (size_t i = 0; i < count; i++)
+    {
+      if (strcmp(samples[i].key, line) == 0)
+      {
+        samples[i].value += strtod(space + 1, NULL);
+        break;
+      }
+    }
+  }
+  if (in != NULL)
+  {
+    fclose(in);
+  }
+}
+
+//############################################################################
+// kmyth_metrics_write_textfile()
+//############################################################################
+int kmyth_metrics_write_textfile(const char *path, int accumulate)
+{
+  if (path == NULL || path[0] == '\0')
+  {
+    kmyth_log(LOG_ERR, "no metrics textfile path ... exiting");
+    return 1;
+  }
+
+  kmyth_metrics_t metrics;
+  metrics_sample *samples = calloc(KMYTH_METRICS_MAX_SAMPLES,
+                                   sizeof(metrics_sample));
+  char *lock_path = NULL;
+  char *tmp_path = NULL;
+
+  if (samples == NULL ||
+      asprintf(&lock_path, "%s.lock", path) < 0 ||
+      asprintf(&tmp_path, "%s.%d.tmp", path, (int) getpid()) < 0)
+  {
+    kmyth_log(LOG_ERR, "error allocating metrics textfile ... exiting");
+    free(samples);
+    free(lock_path);
+    return 1;
+  }
+
+  kmyth_metrics_snapshot(&metrics);
+
+  size_t count = collect_samples(&metrics, samples);
+
+  // the read (when accumulating), write and rename are made under the
+  // lock, so that concurrent writers do not lose each other's counts
+  int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  int retval = 1;
+
+  if (lock_fd >= 0 && flock(lock_fd, LOCK_EX) == 0)
+  {
+    if (accumulate)
+    {
+      add_previous_samples(path, samples, count);
+    }
+
+    FILE *out = fopen(tmp_path, "we");
+
+    if (out != NULL)
+    {
+      retval = write_samples(out, samples, count);
+      if (fclose(out) != 0 || retval != 0 || rename(tmp_path, path) != 0)
+      {
+        unlink(tmp_path);
+        retval = 1;
+      }
+    }
+  }
+  if (retval != 0)
+  {
+    kmyth_log(LOG_ERR, "error writing metrics textfile: %s", path);
+  }
+  if (lock_fd >= 0)
+  {
+    close(lock_fd);
+  }
+  free(samples);
+  free(lock_path);
+  free(tmp_path);
+
+  return retval;
+}
+
+//############################################################################
+// metrics_write_at_exit()
+//############################################################################
+static void metrics_write_at_exit(void)
+{
+  kmyth_metrics_write_textfile(metrics_exit_path, 1);
+}
+
+//############################################################################
+// kmyth_metrics_export_at_exit()
+//############################################################################
+int kmyth_metrics_export_at_exit(void)
+{
+  const char *path = getenv(KMYTH_METRICS_FILE_ENV);
+
+  if (path == NULL || path[0] == '\0' || metrics_exit_path != NULL)
+  {
+    return 0;
+  }
+
+  metrics_exit_path = strdup(path);
+  if (metrics_exit_path == NULL || atexit(metrics_write_at_exit) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to export metrics at exit ... exiting");
+    free(metrics_exit_path);
+    metrics_exit_path = NULL;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,388 @@
+/**
+ * @file  kmyth_pcr_watcher.c
+ * @brief Implements the PCR change watcher (see kmyth_pcr_watcher_t in
+ *        kmyth.h)
+ */
+
+#include "kmyth_pcr_watcher.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "defines.h"
+#include "tpm2_interface.h"
+
+#include "alloc_stats.h"
+
+//############################################################################
+// read_measurement_count()
+//############################################################################
+int read_measurement_count(const char *path, uint64_t * count)
+{
+  FILE *fp = fopen(path, "r");
+
+  if (fp == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to open measurement count file: %s", path);
+    return 1;
+  }
+
+  int matched = fscanf(fp, "%" SCNu64, count);
+
+  fclose(fp);
+  if (matched != 1)
+  {
+    kmyth_log(LOG_ERR, "no count in measurement count file: %s", path);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// watcher_check()
+//############################################################################
+static int watcher_check(kmyth_pcr_watcher_t * watcher, int *changed)
+{
+  *changed = 0;
+
+  pthread_mutex_lock(&watcher->lock);
+
+  // an unchanged measurement count saves asking the TPM, except every
+  // tpm_every checks (a count that can not be read falls back to the TPM)
+  uint64_t count = 0;
+
+  if (watcher->count_path != NULL &&
+      read_measurement_count(watcher->count_path, &count) == 0)
+  {
+    if (watcher->have_epoch && count == watcher->last_count &&
+        (watcher->tpm_every == 0 || ++watcher->skipped < watcher->tpm_every))
+    {
+      pthread_mutex_unlock(&watcher->lock);
+      return 0;
+    }
+    watcher->last_count = count;
+  }
+  watcher->skipped = 0;
+
+  kmyth_unseal_cache_epoch epoch;
+
+  if (get_unseal_cache_epoch(watcher->sapi_ctx, &epoch))
+  {
+    pthread_mutex_unlock(&watcher->lock);
+    kmyth_log(LOG_ERR, "unable to read the TPM's PCR update counter");
+    return 1;
+  }
+
+  if (!watcher->have_epoch)
+  {
+    watcher->last_epoch = epoch;
+    watcher->have_epoch = true;
+    pthread_mutex_unlock(&watcher->lock);
+    return 0;
+  }
+  if (epoch.pcr_update_counter == watcher->last_epoch.pcr_update_counter &&
+      epoch.reset_count == watcher->last_epoch.reset_count &&
+      epoch.restart_count == watcher->last_epoch.restart_count)
+  {
+    pthread_mutex_unlock(&watcher->lock);
+    return 0;
+  }
+
+  kmyth_pcr_change_t change = {
+    .old_pcr_update_counter = watcher->last_epoch.pcr_update_counter,
+    .new_pcr_update_counter = epoch.pcr_update_counter,
+    .old_reset_count = watcher->last_epoch.reset_count,
+    .new_reset_count = epoch.reset_count,
+    .old_restart_count = watcher->last_epoch.restart_count,
+    .new_restart_count = epoch.restart_count,
+  };
+
+  watcher->last_epoch = epoch;
+
+  // the callbacks run unlocked (on a copy), so that they may register more
+  kmyth_pcr_watcher_callback callbacks[KMYTH_PCR_WATCHER_MAX_CALLBACKS];
+  size_t callbacks_len = watcher->callbacks_len;
+
+  memcpy(callbacks, watcher->callbacks,
+         callbacks_len * sizeof(kmyth_pcr_watcher_callback));
+  pthread_mutex_unlock(&watcher->lock);
+
+  kmyth_log(LOG_INFO, "PCR update counter changed (%" PRIu32 " -> %" PRIu32
+            ", resets %" PRIu32 " -> %" PRIu32 ", restarts %" PRIu32
+            " -> %" PRIu32 ")", change.old_pcr_update_counter,
+            change.new_pcr_update_counter, change.old_reset_count,
+            change.new_reset_count, change.old_restart_count,
+            change.new_restart_count);
+
+  kmyth_unseal_cache_flush();
+  for (size_t i = 0; i < callbacks_len; i++)
+  {
+    callbacks[i].callback(&change, callbacks[i].arg);
+  }
+  *changed = 1;
+
+  return 0;
+}
+
+//############################################################################
+// watcher_thread()
+//############################################################################
+static void *watcher_thread(void *arg)
+{
+  kmyth_pcr_watcher_t *watcher = (kmyth_pcr_watcher_t *) arg;
+  int changed = 0;
+
+  pthread_mutex_lock(&watcher->lock);
+  while (!watcher->stopping)
+  {
+    // the next check is an interval after the last one finished
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += watcher->interval_ms / 1000;
+    deadline.tv_nsec += (long) (watcher->interval_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+
+    int rc = 0;
+
+    while (!watcher->stopping && rc != ETIMEDOUT)
+    {
+      rc = pthread_cond_timedwait(&watcher->wake, &watcher->lock, &deadline);
+    }
+    if (watcher->stopping)
+    {
+      break;
+    }
+
+    // (a failed check is logged, and the next one tried as usual)
+    pthread_mutex_unlock(&watcher->lock);
+    watcher_check(watcher, &changed);
+    pthread_mutex_lock(&watcher->lock);
+  }
+  pthread_mutex_unlock(&watcher->lock);
+
+  return NULL;
+}
+
+//############################################################################
+// kmyth_pcr_watcher_create()
+//############################################################################
+int kmyth_pcr_watcher_create(kmyth_pcr_watcher_t ** watcher,
+                             const char *tcti_conf, unsigned int interval_ms)
+{
+  if (watcher == NULL || *watcher != NULL || interval_ms == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid PCR watcher parameters ... exiting");
+    return 1;
+  }
+
+  kmyth_pcr_watcher_t *new_watcher = calloc(1, sizeof(kmyth_pcr_watcher_t));
+
+  if (new_watcher == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate PCR watcher ... exiting");
+    return 1;
+  }
+
+  pthread_condattr_t attr;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&new_watcher->wake, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_mutex_init(&new_watcher->lock, NULL);
+  new_watcher->interval_ms = interval_ms;
+
+  if (init_tpm2_connection_tcti(&new_watcher->sapi_ctx, tcti_conf))
+  {
+    kmyth_log(LOG_ERR, "unable to connect to the TPM to watch ... exiting");
+    kmyth_pcr_watcher_destroy(&new_watcher);
+    return 1;
+  }
+
+  *watcher = new_watcher;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_pcr_watcher_add_callback()
+//############################################################################
+int kmyth_pcr_watcher_add_callback(kmyth_pcr_watcher_t * watcher,
+                                   kmyth_pcr_change_callback_t callback,
+                                   void *arg)
+{
+  if (watcher == NULL || callback == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid PCR watcher callback ... exiting");
+    return 1;
+  }
+
+  pthread_mutex_lock(&watcher->lock);
+  if (watcher->callbacks_len == KMYTH_PCR_WATCHER_MAX_CALLBACKS)
+  {
+    pthread_mutex_unlock(&watcher->lock);
+    kmyth_log(LOG_ERR, "too many PCR watcher callbacks (at most %d) ... "
+              "exiting", KMYTH_PCR_WATCHER_MAX_CALLBACKS);
+    return 1;
+  }
+  watcher->callbacks[watcher->callbacks_len].callback = callback;
+  watcher->callbacks[watcher->callbacks_len].arg = arg;
+  watcher->callbacks_len++;
+  pthread_mutex_unlock(&watcher->lock);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_pcr_watcher_set_count_file()
+//############################################################################
+int kmyth_pcr_watcher_set_count_file(kmyth_pcr_watcher_t * watcher,
+                                     const char *path, unsigned int tpm_every)
+{
+  if (watcher == NULL)
+  {
+    return 1;
+  }
+
+  char *new_path = NULL;
+
+  if (path != NULL)
+  {
+    new_path = strdup(path);
+    if (new_path == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate count file path ... exiting");
+      return 1;
+    }
+  }
+
+  pthread_mutex_lock(&watcher->lock);
+  free(watcher->count_path);
+  watcher->count_path = new_path;
+  watcher->tpm_every = tpm_every;
+  watcher->skipped = 0;
+  // the next check asks the TPM, and starts counting from there
+  watcher->last_count = UINT64_MAX;
+  pthread_mutex_unlock(&watcher->lock);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_pcr_watcher_check()
+//############################################################################
+int kmyth_pcr_watcher_check(kmyth_pcr_watcher_t * watcher, int *changed)
+{
+  int seen = 0;
+
+  if (changed != NULL)
+  {
+    *changed = 0;
+  }
+  if (watcher == NULL || watcher->running)
+  {
+    kmyth_log(LOG_ERR, "invalid (or running) PCR watcher ... exiting");
+    return 1;
+  }
+
+  int retval = watcher_check(watcher, &seen);
+
+  if (changed != NULL)
+  {
+    *changed = seen;
+  }
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_pcr_watcher_start()
+//############################################################################
+int kmyth_pcr_watcher_start(kmyth_pcr_watcher_t * watcher)
+{
+  if (watcher == NULL || watcher->running)
+  {
+    kmyth_log(LOG_ERR, "invalid (or running) PCR watcher ... exiting");
+    return 1;
+  }
+
+  // changes are counted from the start, not from the first interval
+  int changed = 0;
+
+  if (!watcher->have_epoch && watcher_check(watcher, &changed))
+  {
+    return 1;
+  }
+
+  watcher->stopping = false;
+  if (pthread_create(&watcher->thread, NULL, watcher_thread, watcher))
+  {
+    kmyth_log(LOG_ERR, "unable to start PCR watcher thread ... exiting");
+    return 1;
+  }
+  watcher->running = true;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_pcr_watcher_stop()
+//############################################################################
+int kmyth_pcr_watcher_stop(kmyth_pcr_watcher_t * watcher)
+{
+  if (watcher == NULL)
+  {
+    return 1;
+  }
+  if (!watcher->running)
+  {
+    return 0;
+  }
+
+  pthread_mutex_lock(&watcher->lock);
+  watcher->stopping = true;
+  pthread_cond_signal(&watcher->wake);
+  pthread_mutex_unlock(&watcher->lock);
+
+  pthread_join(watcher->thread, NULL);
+  watcher->running = false;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_pcr_watcher_destroy()
+//############################################################################
+int kmyth_pcr_watcher_destroy(kmyth_pcr_watcher_t ** watcher)
+{
+  if (watcher == NULL || *watcher == NULL)
+  {
+    return 0;
+  }
+
+  int retval = kmyth_pcr_watcher_stop(*watcher);
+
+  if ((*watcher)->sapi_ctx != NULL &&
+      free_tpm2_resources(&(*watcher)->sapi_ctx))
+  {
+    retval = 1;
+  }
+  free((*watcher)->count_path);
+  pthread_cond_destroy(&(*watcher)->wake);
+  pthread_mutex_destroy(&(*watcher)->lock);
+
+  free(*watcher);
+  *watcher = NULL;
+
+  return retval;
+}
@@ -0,0 +1,692 @@
+/**
+ * @file  kmyth_pool.c
+ * @brief Implements the Kmyth context pool (see kmyth_pool_t in kmyth.h),
+ *        which spreads seal/unseal requests over several TPM connections
+ */
+
+#include "kmyth_pool.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+#include "marshalling_tools.h"
+#include "parallel_util.h"
+#include "kmyth_seal_unseal_impl.h"
+
+#include "alloc_stats.h"
+
+//############################################################################
+// pool_reserve_device()
+//############################################################################
+static void pool_reserve_device(kmyth_pool_t * pool, size_t d, size_t items)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->load[d] += items;
+  pthread_mutex_unlock(&pool->lock);
+
+  // requests on the same device queue up here, and count towards its load
+  // while they wait
+  pthread_mutex_lock(&pool->ctx_locks[d]);
+}
+
+//############################################################################
+// pool_reserve()
+//############################################################################
+static size_t pool_reserve(kmyth_pool_t * pool, const bool *exclude,
+                           size_t items)
+{
+  size_t best = pool->count;
+
+  // the least loaded device wins, ties going to the one that has served
+  // the fewest requests so far
+  pthread_mutex_lock(&pool->lock);
+  for (size_t d = 0; d < pool->count; d++)
+  {
+    if (exclude != NULL && exclude[d])
+    {
+      continue;
+    }
+    if (best == pool->count || pool->load[d] < pool->load[best] ||
+        (pool->load[d] == pool->load[best] &&
+         pool->served[d] < pool->served[best]))
+    {
+      best = d;
+    }
+  }
+  if (best < pool->count)
+  {
+    pool->load[best] += items;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if (best < pool->count)
+  {
+    pthread_mutex_lock(&pool->ctx_locks[best]);
+  }
+
+  return best;
+}
+
+//############################################################################
+// pool_release()
+//############################################################################
+static void pool_release(kmyth_pool_t * pool, size_t d, size_t items)
+{
+  pthread_mutex_lock(&pool->lock);
+  // remember the device's SRK name once a request has looked it up
+  if (pool->srk_names[d].size == 0)
+  {
+    pool->srk_names[d] = pool->ctxs[d]->srk_name;
+  }
+  pool->load[d] -= items;
+  pool->served[d] += items;
+  pthread_mutex_unlock(&pool->lock);
+
+  pthread_mutex_unlock(&pool->ctx_locks[d]);
+}
+
+//############################################################################
+// pool_match_srk()
+//############################################################################
+static bool pool_match_srk(kmyth_pool_t * pool, TPM2B_NAME * srk_name,
+                           size_t *d)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&pool->lock);
+  for (size_t i = 0; i < pool->count && !found; i++)
+  {
+    if (pool->srk_names[i].size == srk_name->size &&
+        memcmp(pool->srk_names[i].name, srk_name->name, srk_name->size) == 0)
+    {
+      *d = i;
+      found = true;
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return found;
+}
+
+//############################################################################
+// pool_find_srk()
+//############################################################################
+static int pool_find_srk(kmyth_pool_t * pool, TPM2B_NAME * srk_name,
+                         uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                         size_t *d)
+{
+  if (pool_match_srk(pool, srk_name, d))
+  {
+    return 0;
+  }
+
+  // look up the SRK names not yet known, until the one needed turns up
+  for (size_t i = 0; i < pool->count; i++)
+  {
+    pthread_mutex_lock(&pool->lock);
+    bool known = (pool->srk_names[i].size != 0);
+
+    pthread_mutex_unlock(&pool->lock);
+    if (known)
+    {
+      continue;
+    }
+
+    TPM2B_NAME name = {.size = 0, };
+
+    pool_reserve_device(pool, i, 0);
+    if (kmyth_ctx_get_srk_name(pool->ctxs[i], owner_auth_bytes, oa_bytes_len,
+                               &name))
+    {
+      kmyth_log(LOG_WARNING, "unable to get SRK name of device %zu", i);
+    }
+    pool_release(pool, i, 0);
+
+    if (pool_match_srk(pool, srk_name, d))
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+//############################################################################
+// kmyth_pool_create()
+//############################################################################
+int kmyth_pool_create(kmyth_pool_t ** pool, const char **tcti_confs,
+                      size_t count)
+{
+  if (pool == NULL || *pool != NULL)
+  {
+    kmyth_log(LOG_ERR, "pool passed in must be NULL ... exiting");
+    return 1;
+  }
+  if (count > KMYTH_POOL_MAX || (count > 0 && tcti_confs == NULL))
+  {
+    kmyth_log(LOG_ERR, "invalid number of devices (%zu), must be 0 to %d "
+              "... exiting", count, KMYTH_POOL_MAX);
+    return 1;
+  }
+
+  kmyth_pool_t *new_pool = calloc(1, sizeof(kmyth_pool_t));
+
+  if (new_pool == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate kmyth pool ... exiting");
+    return 1;
+  }
+
+  pthread_mutex_init(&new_pool->lock, NULL);
+  for (size_t d = 0; d < KMYTH_POOL_MAX; d++)
+  {
+    pthread_mutex_init(&new_pool->ctx_locks[d], NULL);
+  }
+
+  new_pool->count = (count == 0) ? 1 : count;
+  for (size_t d = 0; d < new_pool->count; d++)
+  {
+    const char *conf = (count == 0) ? NULL : tcti_confs[d];
+
+    // record the SRK name in every .ski sealed through the pool, so that
+    // it can be unsealed on the right device
+    if (kmyth_ctx_create_tcti(&new_pool->ctxs[d], conf) ||
+        kmyth_ctx_set_record_srk(new_pool->ctxs[d], 1))
+    {
+      kmyth_log(LOG_ERR, "unable to connect to device %zu (%s) ... exiting",
+                d, (conf == NULL) ? "default TCTI" : conf);
+      kmyth_pool_destroy(&new_pool);
+      return 1;
+    }
+  }
+  kmyth_log(LOG_DEBUG, "created kmyth pool of %zu device(s)",
+            new_pool->count);
+
+  *pool = new_pool;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_pool_destroy()
+//############################################################################
+int kmyth_pool_destroy(kmyth_pool_t ** pool)
+{
+  if (pool == NULL || *pool == NULL)
+  {
+    return 0;
+  }
+
+  int retval = 0;
+
+  for (size_t d = 0; d < KMYTH_POOL_MAX; d++)
+  {
+    if ((*pool)->ctxs[d] != NULL && kmyth_ctx_destroy(&(*pool)->ctxs[d]))
+    {
+      retval = 1;
+    }
+    pthread_mutex_destroy(&(*pool)->ctx_locks[d]);
+  }
+  pthread_mutex_destroy(&(*pool)->lock);
+
+  free(*pool);
+  *pool = NULL;
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_pool_size()
+//############################################################################
+size_t kmyth_pool_size(kmyth_pool_t * pool)
+{
+  return (pool == NULL) ? 0 : pool->count;
+}
+
+//############################################################################
+// kmyth_pool_get_ctx()
+//############################################################################
+kmyth_ctx_t *kmyth_pool_get_ctx(kmyth_pool_t * pool, size_t index)
+{
+  if (pool == NULL || index >= pool->count)
+  {
+    return NULL;
+  }
+
+  return pool->ctxs[index];
+}
+
+//############################################################################
+// tpm2_kmyth_seal_pool()
+//############################################################################
+int tpm2_kmyth_seal_pool(kmyth_pool_t * pool,
+                         uint8_t * input, size_t input_len,
+                         uint8_t ** output, size_t *output_len,
+                         uint8_t * auth_bytes, size_t auth_bytes_len,
+                         uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                         int *pcrs, size_t pcrs_len, char *cipher_string,
+                         char *expected_policy)
+{
+  if (pool == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth pool ... exiting");
+    return 1;
+  }
+
+  size_t d = pool_reserve(pool, NULL, 1);
+  int retval = tpm2_kmyth_seal_ctx(pool->ctxs[d], input, input_len,
+                                   output, output_len,
+                                   auth_bytes, auth_bytes_len,
+                                   owner_auth_bytes, oa_bytes_len,
+                                   pcrs, pcrs_len, cipher_string,
+                                   expected_policy, 0);
+
+  pool_release(pool, d, 1);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_pool()
+//############################################################################
+int tpm2_kmyth_unseal_pool(kmyth_pool_t * pool,
+                           uint8_t * input, size_t input_len,
+                           uint8_t ** output, size_t *output_len,
+                           uint8_t * auth_bytes, size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                           uint8_t bool_policy_or)
+{
+  if (pool == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth pool ... exiting");
+    return 1;
+  }
+
+  TPM2B_NAME srk_name = {.size = 0, };
+
+  if (get_ski_srk_name(input, input_len, &srk_name))
+  {
+    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
+    return 1;
+  }
+
+  size_t d = 0;
+  int retval = 1;
+
+  // sealed with a recorded SRK: only the device holding it can unseal
+  if (srk_name.size != 0)
+  {
+    if (pool_find_srk(pool, &srk_name, owner_auth_bytes, oa_bytes_len, &d))
+    {
+      kmyth_log(LOG_ERR, "no device in the pool holds the SRK the data "
+                "was sealed under ... exiting");
+      return 1;
+    }
+    pool_reserve_device(pool, d, 1);
+    retval = tpm2_kmyth_unseal_ctx(pool->ctxs[d], input, input_len,
+                                   output, output_len,
+                                   auth_bytes, auth_bytes_len,
+                                   owner_auth_bytes, oa_bytes_len,
+                                   bool_policy_or);
+    pool_release(pool, d, 1);
+    return retval;
+  }
+
+  // otherwise, try each device in turn (least loaded first)
+  bool tried[KMYTH_POOL_MAX] = { false };
+
+  for (size_t i = 0; i < pool->count && retval != 0; i++)
+  {
+    d = pool_reserve(pool, tried, 1);
+    tried[d] = true;
+    retval = tpm2_kmyth_unseal_ctx(pool->ctxs[d], input, input_len,
+                                   output, output_len,
+                                   auth_bytes, auth_bytes_len,
+                                   owner_auth_bytes, oa_bytes_len,
+                                   bool_policy_or);
+    pool_release(pool, d, 1);
+  }
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to unseal on any of the %zu device(s) "
+              "... exiting", pool->count);
+  }
+
+  return retval;
+}
+
+// State of a pooled batch seal or unseal, shared by the per-device shares
+typedef struct
+{
+  kmyth_pool_t *pool;
+  size_t count;
+  uint8_t **inputs;
+  size_t *input_lens;
+  uint8_t **outputs;
+  size_t *output_lens;
+  int *results;
+  uint8_t *auth_bytes;
+  size_t auth_bytes_len;
+  uint8_t *owner_auth_bytes;
+  size_t oa_bytes_len;
+  int *pcrs;
+  size_t pcrs_len;
+  char *cipher_string;
+  char *expected_policy;
+  uint8_t bool_policy_or;
+  size_t shares;
+  size_t *device;
+} kmyth_pool_batch;
+
+//############################################################################
+// kmyth_pool_seal_share()
+//############################################################################
+static int kmyth_pool_seal_share(size_t share, void *arg)
+{
+  kmyth_pool_batch *batch = (kmyth_pool_batch *) arg;
+  size_t start = share * batch->count / batch->shares;
+  size_t len = (share + 1) * batch->count / batch->shares - start;
+
+  size_t d = pool_reserve(batch->pool, NULL, len);
+  int retval = tpm2_kmyth_seal_batch(batch->pool->ctxs[d], len,
+                                     batch->inputs + start,
+                                     batch->input_lens + start,
+                                     batch->outputs + start,
+                                     batch->output_lens + start,
+                                     batch->results + start,
+                                     batch->auth_bytes,
+                                     batch->auth_bytes_len,
+                                     batch->owner_auth_bytes,
+                                     batch->oa_bytes_len,
+                                     batch->pcrs, batch->pcrs_len,
+                                     batch->cipher_string,
+                                     batch->expected_policy);
+
+  pool_release(batch->pool, d, len);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_batch_pool()
+//############################################################################
+int tpm2_kmyth_seal_batch_pool(kmyth_pool_t * pool, size_t count,
+                               uint8_t ** inputs, size_t *input_lens,
+                               uint8_t ** outputs, size_t *output_lens,
+                               int *results,
+                               uint8_t * auth_bytes, size_t auth_bytes_len,
+                               uint8_t * owner_auth_bytes,
+                               size_t oa_bytes_len,
+                               int *pcrs, size_t pcrs_len,
+                               char *cipher_string, char *expected_policy)
+{
+  if (pool == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth pool ... exiting");
+    return 1;
+  }
+  if (count == 0 || inputs == NULL || input_lens == NULL ||
+      outputs == NULL || output_lens == NULL || results == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid batch parameters ... exiting");
+    return 1;
+  }
+
+  // items in a share that never gets started stay failed
+  for (size_t i = 0; i < count; i++)
+  {
+    outputs[i] = NULL;
+    output_lens[i] = 0;
+    results[i] = 1;
+  }
+
+  kmyth_pool_batch batch = {
+    .pool = pool,
+    .count = count,
+    .inputs = inputs,
+    .input_lens = input_lens,
+    .outputs = outputs,
+    .output_lens = output_lens,
+    .results = results,
+    .auth_bytes = auth_bytes,
+    .auth_bytes_len = auth_bytes_len,
+    .owner_auth_bytes = owner_auth_bytes,
+    .oa_bytes_len = oa_bytes_len,
+    .pcrs = pcrs,
+    .pcrs_len = pcrs_len,
+    .cipher_string = cipher_string,
+    .expected_policy = expected_policy,
+    .shares = (count < pool->count) ? count : pool->count,
+  };
+
+  return kmyth_parallel_for(batch.shares, batch.shares,
+                            kmyth_pool_seal_share, &batch);
+}
+
+//############################################################################
+// kmyth_pool_unseal_share()
+//############################################################################
+static int kmyth_pool_unseal_share(size_t d, void *arg)
+{
+  kmyth_pool_batch *batch = (kmyth_pool_batch *) arg;
+  size_t len = 0;
+
+  for (size_t i = 0; i < batch->count; i++)
+  {
+    if (batch->device[i] == d)
+    {
+      len++;
+    }
+  }
+  if (len == 0)
+  {
+    return 0;
+  }
+
+  // gather this device's items, unseal them as one batch, then scatter
+  // the results back
+  size_t *index = calloc(len, sizeof(size_t));
+  uint8_t **inputs = calloc(len, sizeof(uint8_t *));
+  size_t *input_lens = calloc(len, sizeof(size_t));
+  uint8_t **outputs = calloc(len, sizeof(uint8_t *));
+  size_t *output_lens = calloc(len, sizeof(size_t));
+  int *results = calloc(len, sizeof(int));
+  int retval = 1;
+
+  if (index != NULL && inputs != NULL && input_lens != NULL &&
+      outputs != NULL && output_lens != NULL && results != NULL)
+  {
+    size_t n = 0;
+
+    for (size_t i = 0; i < batch->count; i++)
+    {
+      if (batch->device[i] == d)
+      {
+        index[n] = i;
+        inputs[n] = batch->inputs[i];
+        input_lens[n] = batch->input_lens[i];
+        n++;
+      }
+    }
+
+    pool_reserve_device(batch->pool, d, len);
+    retval = tpm2_kmyth_unseal_batch(batch->pool->ctxs[d], len,
+                                     inputs, input_lens,
+                                     outputs, output_lens, results,
+                                     batch->auth_bytes,
+                                     batch->auth_bytes_len,
+                                     batch->owner_auth_bytes,
+                                     batch->oa_bytes_len,
+                                     batch->bool_policy_or);
+    pool_release(batch->pool, d, len);
+
+    for (size_t j = 0; j < len; j++)
+    {
+      batch->outputs[index[j]] = outputs[j];
+      batch->output_lens[index[j]] = output_lens[j];
+      batch->results[index[j]] = results[j];
+    }
+  }
+  else
+  {
+    kmyth_log(LOG_ERR, "unable to allocate batch share for device %zu", d);
+  }
+
+  free(index);
+  free(inputs);
+  free(input_lens);
+  free(outputs);
+  free(output_lens);
+  free(results);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_batch_pool()
+//############################################################################
+int tpm2_kmyth_unseal_batch_pool(kmyth_pool_t * pool, size_t count,
+                                 uint8_t ** inputs, size_t *input_lens,
+                                 uint8_t ** outputs, size_t *output_lens,
+                                 int *results,
+                                 uint8_t * auth_bytes, size_t auth_bytes_len,
+                                 uint8_t * owner_auth_bytes,
+                                 size_t oa_bytes_len, uint8_t bool_policy_or)
+{
+  if (pool == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth pool ... exiting");
+    return 1;
+  }
+  if (count == 0 || inputs == NULL || input_lens == NULL ||
+      outputs == NULL || output_lens == NULL || results == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid batch parameters ... exiting");
+    return 1;
+  }
+
+  size_t *device = calloc(count, sizeof(size_t));
+  bool *recorded = calloc(count, sizeof(bool));
+  bool *pending = calloc(count, sizeof(bool));
+
+  if (device == NULL || recorded == NULL || pending == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate batch routing ... exiting");
+    free(device);
+    free(recorded);
+    free(pending);
+    return 1;
+  }
+
+  // route each item to the device holding its SRK, spreading those that
+  // do not record one evenly over the pool (device == pool->count marks an
+  // item that cannot be unsealed by any device)
+  size_t assigned[KMYTH_POOL_MAX] = { 0 };
+
+  for (size_t i = 0; i < count; i++)
+  {
+    TPM2B_NAME srk_name = {.size = 0, };
+
+    outputs[i] = NULL;
+    output_lens[i] = 0;
+    results[i] = 1;
+    device[i] = pool->count;
+
+    if (get_ski_srk_name(inputs[i], input_lens[i], &srk_name))
+    {
+      kmyth_log(LOG_ERR, "error parsing ski string (batch item %zu)", i);
+    }
+    else if (srk_name.size != 0)
+    {
+      recorded[i] = true;
+      if (pool_find_srk(pool, &srk_name, owner_auth_bytes, oa_bytes_len,
+                        &device[i]))
+      {
+        kmyth_log(LOG_ERR, "no device in the pool holds the SRK for "
+                  "batch item %zu", i);
+        device[i] = pool->count;
+      }
+      else
+      {
+        assigned[device[i]]++;
+      }
+    }
+    else
+    {
+      pending[i] = true;
+    }
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    if (pending[i])
+    {
+      size_t best = 0;
+
+      for (size_t d = 1; d < pool->count; d++)
+      {
+        if (assigned[d] < assigned[best])
+        {
+          best = d;
+        }
+      }
+      device[i] = best;
+      assigned[best]++;
+    }
+  }
+
+  kmyth_pool_batch batch = {
+    .pool = pool,
+    .count = count,
+    .inputs = inputs,
+    .input_lens = input_lens,
+    .outputs = outputs,
+    .output_lens = output_lens,
+    .results = results,
+    .auth_bytes = auth_bytes,
+    .auth_bytes_len = auth_bytes_len,
+    .owner_auth_bytes = owner_auth_bytes,
+    .oa_bytes_len = oa_bytes_len,
+    .bool_policy_or = bool_policy_or,
+    .device = device,
+  };
+
+  kmyth_parallel_for(pool->count, pool->count, kmyth_pool_unseal_share,
+                     &batch);
+
+  // an item that does not record its SRK may have been sealed on any
+  // device, so any that failed are tried on the others
+  int retval = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (results[i] != 0 && !recorded[i] && device[i] < pool->count)
+    {
+      for (size_t d = 0; d < pool->count && results[i] != 0; d++)
+      {
+        if (d == device[i])
+        {
+          continue;
+        }
+        pool_reserve_device(pool, d, 1);
+        results[i] = tpm2_kmyth_unseal_ctx(pool->ctxs[d], inputs[i],
+                                           input_lens[i], &outputs[i],
+                                           &output_lens[i], auth_bytes,
+                                           auth_bytes_len, owner_auth_bytes,
+                                           oa_bytes_len, bool_policy_or);
+        pool_release(pool, d, 1);
+      }
+    }
+    if (results[i] != 0)
+    {
+      retval = 1;
+    }
+  }
+
+  free(device);
+  free(recorded);
+  free(pending);
+
+  return retval;
+}
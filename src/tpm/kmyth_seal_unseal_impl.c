@@ -10,19 +10,30 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <openssl/rand.h>
+
 #include "defines.h"
 #include "file_io.h"
 #include "formatting_tools.h"
+#include "kmyth_keyring.h"
+#include "kmyth_metrics.h"
+#include "kmyth_unseal_cache.h"
 #include "marshalling_tools.h"
 #include "memory_util.h"
+#include "nv_tools.h"
 #include "object_tools.h"
+#include "parallel_util.h"
 #include "pcrs.h"
 #include "storage_key_tools.h"
 #include "tpm2_interface.h"
+#include "trace.h"
 
 
+#include "cipher/aes_gcm.h"
 #include "cipher/cipher.h"
 
+#include "alloc_stats.h"
+
 /**
  * @brief The external list of valid (implemented and configured) symmetric
  *        cipher options (see src/util/kmyth_cipher.c)
@@ -30,586 +41,5393 @@
 extern const cipher_t cipher_list[];
 
 //############################################################################
-// tpm2_kmyth_seal()
+// flush_kmyth_transient()
 //############################################################################
-int tpm2_kmyth_seal(uint8_t * input,
-                    size_t input_len,
-                    uint8_t ** output,
-                    size_t *output_len,
-                    uint8_t * auth_bytes,
-                    size_t auth_bytes_len,
-                    uint8_t * owner_auth_bytes,
-                    size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
-                    char *cipher_string, char *expected_policy,
-                    uint8_t bool_trial_only)
+static void flush_kmyth_transient(TSS2_SYS_CONTEXT * sapi_ctx,
+                                  TPM2_HANDLE handle)
 {
-  if(oa_bytes_len > UINT16_MAX)
+  // nothing to do if the object was never loaded
+  if (handle == 0)
   {
-    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
-    return 1;
+    return;
   }
-  
-  //init connection to the resource manager
-  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
 
-  if (init_tpm2_connection(&sapi_ctx))
+  // When the TPM connection is reused across operations, transient objects
+  // (e.g., the storage key) must be explicitly flushed from the TPM. They
+  // would otherwise accumulate until the connection is closed.
+  TSS2_RC rc = Tss2_Sys_FlushContext(sapi_ctx, handle);
+
+  if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "unable to init connection to TPM2 resource manager");
-    free_tpm2_resources(&sapi_ctx);
-    return 1;
+    kmyth_log(LOG_WARNING, "Tss2_Sys_FlushContext(): rc = 0x%08X, %s",
+              rc, getErrorString(rc));
+    kmyth_log(LOG_WARNING, "unable to flush object (handle = 0x%08X)", handle);
+    return;
   }
-  kmyth_log(LOG_DEBUG, "initialized connection to TPM 2.0 resource manager");
+  kmyth_log(LOG_DEBUG, "flushed object (handle = 0x%08X)", handle);
+}
 
-  Ski ski = get_default_ski();
+//############################################################################
+// kmyth_ctx_create()
+//############################################################################
+int kmyth_ctx_create(kmyth_ctx_t ** ctx)
+{
+  return kmyth_ctx_create_tcti(ctx, NULL);
+}
 
-  //obtain cipher function
-  if (cipher_string == NULL)
+//############################################################################
+// kmyth_ctx_create_tcti()
+//############################################################################
+int kmyth_ctx_create_tcti(kmyth_ctx_t ** ctx, const char *tcti_conf)
+{
+  if (ctx == NULL || *ctx != NULL)
   {
-    cipher_string = KMYTH_DEFAULT_CIPHER;
+    kmyth_log(LOG_ERR, "context passed in must be NULL ... exiting");
+    return 1;
   }
-  ski.cipher = kmyth_get_cipher_t_from_string(cipher_string);
 
-  if (ski.cipher.cipher_name == NULL)
+  *ctx = calloc(1, sizeof(kmyth_ctx_t));
+  if (*ctx == NULL)
   {
-    kmyth_log(LOG_ERR, "invalid cipher: %s ... exiting", cipher_string);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "memory allocation for context failed ... exiting");
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "cipher: %s", ski.cipher.cipher_name);
 
-  // Create owner (storage) hierarchy authorization structure
-  TPM2B_AUTH ownerAuth;
+  uint64_t phase_start = get_timing_ns();
 
-  ownerAuth.size = (uint16_t)oa_bytes_len;
-  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
-  {
-    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
-  }
-  if (ownerAuth.size > 0)
+  if (init_tpm2_connection_tcti(&((*ctx)->sapi_ctx), tcti_conf))
   {
-    kmyth_log(LOG_DEBUG, "TPM storage hierarchy auth string provided");
+    kmyth_log(LOG_ERR, "unable to init connection to TPM2 resource manager");
+    free_tpm2_resources(&((*ctx)->sapi_ctx));
+    free(*ctx);
+    *ctx = NULL;
+    return 1;
   }
-  else if (ownerAuth.size == 0)
+  kmyth_log(LOG_DEBUG, "initialized connection to TPM 2.0 resource manager");
+
+  // the SRK handle (and name) is resolved on first use
+  (*ctx)->srk_handle = 0;
+  (*ctx)->srk_name.size = 0;
+  (*ctx)->record_srk_name = false;
+  (*ctx)->policy_precheck = false;
+  (*ctx)->ski_format = KMYTH_SKI_FORMAT_TEXT;
+  (*ctx)->sk_alg = KMYTH_KEY_PUBKEY_ALG;
+  (*ctx)->jobs = 1;
+  (*ctx)->chunk_size = 0;
+  (*ctx)->compression = KMYTH_COMPRESSION_NONE;
+  (*ctx)->sk_pool_size = 0;
+  (*ctx)->sk_pool_count = 0;
+  (*ctx)->persistent_sk_handle = 0;
+  (*ctx)->persistent_sk_hint = 0;
+  (*ctx)->nv_index_max = 0;
+  (*ctx)->nv_buffer_max = 0;
+
+  // the connection is set up before any timings can be attached, so its
+  // duration is held until they are (see kmyth_ctx_set_timings())
+  (*ctx)->timings = NULL;
+  (*ctx)->connect_ns = get_timing_ns() - phase_start;
+
+  (*ctx)->deadline.deadline_ns = 0;
+  (*ctx)->deadline.cancelled = 0;
+  if (set_tpm2_deadline((*ctx)->sapi_ctx, &(*ctx)->deadline))
   {
-    kmyth_log(LOG_DEBUG,
-              "using default (empty) auth string for TPM storage hierarchy");
+    kmyth_ctx_destroy(ctx);
+    return 1;
   }
-  else
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_destroy()
+//############################################################################
+int kmyth_ctx_destroy(kmyth_ctx_t ** ctx)
+{
+  // If the input context is null there's nothing to do.
+  if (ctx == NULL || *ctx == NULL)
   {
-    // should never reach this code - ownerAuth.size should be:
-    //   - zero that it was initialized to
-    //   - strlen(owner_auth_password) value that is greater than zero
-    // included this case for completenes
-    kmyth_log(LOG_DEBUG,
-              "bad size: auth string for TPM storage hierarchy ... exiting");
-    free_tpm2_resources(&sapi_ctx);
-    return 1;
+    return 0;
   }
 
-  // Create authorization value for new, non-primary Kmyth objects (objectAuth)
-  //   - all-zero digest (like TPM 1.2 well-known secret) by default
-  //   - hash of input authorization string if one is specified
-  TPM2B_AUTH objAuthVal = {.size = 0, };
-  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthVal))
+  int retval = free_tpm2_resources(&((*ctx)->sapi_ctx));
+
+  // pooled storage keys hold their authorization values
+  kmyth_clear((*ctx)->sk_pool, sizeof((*ctx)->sk_pool));
+  free(*ctx);
+  *ctx = NULL;
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_ctx_set_ski_format()
+//############################################################################
+int kmyth_ctx_set_ski_format(kmyth_ctx_t * ctx, int ski_format)
+{
+  if (ctx == NULL)
   {
-    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "NULL context ... exiting");
     return 1;
   }
-
-  // Create a "PCR Selection" struct and populate it in accordance with
-  // the PCR values specified in user input "PCR Selection" string, if any
-  // (if the "PCR Selection" string is NULL, the "PCR Selection" struct created
-  // will specify that no PCRs were selected by the user - all-zero mask)
-  // This PCR Selection struct will be used in the authorization policy for
-  // new, non-primary Kmyth objects.
-  if (init_pcr_selection(sapi_ctx, pcrs, pcrs_len, &ski.pcr_list))
+  if (ski_format != KMYTH_SKI_FORMAT_TEXT &&
+      ski_format != KMYTH_SKI_FORMAT_BINARY)
   {
-    kmyth_log(LOG_ERR, "error initializing PCRs ... exiting");
-
-    // clear potential 'auth' data, free TPM resources before exiting early
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "invalid .ski format (%d) ... exiting", ski_format);
     return 1;
   }
 
-  // For all non-primary (other than SRK), Kmyth TPM 2.0 objects that we will
-  // create, we will assign TPM 2.0 policy-based enhanced authorization
-  // critera. Therefore, we will calculate the authorization policy digest that
-  // results from applying the steps of our selected authorization policy. We
-  // can then incorporate this result into the objects we create as the
-  // authorization policy digest value that must be regenerated to authorize
-  // use of these objects.
-  TPM2B_DIGEST objAuthPolicy;
+  ctx->ski_format = ski_format;
 
-  objAuthPolicy.size = 0;
-  if (create_policy_digest(sapi_ctx, ski.pcr_list, &objAuthPolicy))
-  {
-    kmyth_log(LOG_ERR,
-              "error creating policy digest for new Kmyth object ... exiting");
+  return 0;
+}
 
-    // clear potential 'auth' data, free TPM resources before exiting early
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
+//############################################################################
+// kmyth_ctx_set_record_srk()
+//############################################################################
+int kmyth_ctx_set_record_srk(kmyth_ctx_t * ctx, int enabled)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL context ... exiting");
     return 1;
   }
 
-  // optional argument allowing user to receive a hex dump of the policy digest,
-  // to be used to calculate a second policy for policyOR authorization
-  if (bool_trial_only == 1)
-  {
-    // size of string is 2x chars for the size of the TPM2B_DIGEST buffer + 4
-    // for TPM2B struct which encodes size in memory + 1 byte for null termination.
-    // prints to the console and finishes the program without sealing
-    // By using TPM2B_DIGEST size we're reserving a little bit more than needed but
-    // then the output_string can be reserved based on compile-time values.
-    size_t string_size = (2 * sizeof(TPM2B_DIGEST)) + 1;
-    char output_string[string_size];
+  ctx->record_srk_name = (enabled != 0);
 
-    convert_digest_to_string(&objAuthPolicy, output_string);
-    printf("%s", output_string);
-    return 0;
-  }
+  return 0;
+}
 
-  // if the user has passed in secondary policy, this indicates that they wish to use
-  // the compound policy, PolicyOR and the argument they've passed in as an alternative
-  // policy digest that can be used to satisfy the policy of the sealed data object
-  if (expected_policy != NULL)
+//############################################################################
+// kmyth_ctx_set_policy_precheck()
+//############################################################################
+int kmyth_ctx_set_policy_precheck(kmyth_ctx_t * ctx, int enabled)
+{
+  if (ctx == NULL)
   {
-    // digest that will hold the second auth policy branch
-    TPM2B_DIGEST policy_branch_1;
-    TPM2B_DIGEST policy_branch_2;
+    kmyth_log(LOG_ERR, "NULL context ... exiting");
+    return 1;
+  }
 
-    // assigns the previously calculated objAuthPolicy to policy branch 1
-    policy_branch_1 = objAuthPolicy;
+  ctx->policy_precheck = (enabled != 0);
 
-    // fills the second policy branch with a policy specified by the user
-    if (convert_string_to_digest(expected_policy, &policy_branch_2))
-    {
-      kmyth_log(LOG_ERR,
-                "failed to convert secondary policy %s to digest ... exiting",
-                expected_policy);
-      return 1;
-    }
-    TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
-    TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+  return 0;
+}
 
-    // Digest to hold the policy that results from compounding objAuthPolicy and secondObjAuthPolicy
-    TPM2B_DIGEST policyOR;
+//############################################################################
+// kmyth_ctx_set_chunk_size()
+//############################################################################
+int kmyth_ctx_set_chunk_size(kmyth_ctx_t * ctx, size_t chunk_size)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL context ... exiting");
+    return 1;
+  }
 
-    policyOR.size = 0;
+  ctx->chunk_size = chunk_size;
 
-    // TPML_DIGEST struct to hold the 2 policy branches per TPM specifications
-    TPML_DIGEST pHashList;
+  return 0;
+}
 
-    // initializing a new session for the policyOR
-    SESSION policySessionOR;
+//############################################################################
+// kmyth_ctx_set_compression()
+//############################################################################
+int kmyth_ctx_set_compression(kmyth_ctx_t * ctx, const char *compression)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL context ... exiting");
+    return 1;
+  }
 
-    // creates a trial session for calculating the policyOR digest
-    create_auth_session(sapi_ctx, &policySessionOR, TPM2_SE_TRIAL);
+  kmyth_compression_t alg = KMYTH_COMPRESSION_NONE;
 
-    // applies policy_or to the session 2 policy branches:
-    // objAuthPolicy = results from current pcr readings
-    // objAuthPolicy2 = a user-supplied policy for a known future state of pcrs
-    apply_policy_or(sapi_ctx, policySessionOR.sessionHandle, &policy_branch_1,
-                    &policy_branch_2, &pHashList);
+  if (compression != NULL &&
+      kmyth_get_compression_from_string(compression, &alg))
+  {
+    kmyth_log(LOG_ERR, "invalid compression (%s) ... exiting", compression);
+    return 1;
+  }
 
-    // obtains the policy digest from the policyOR calculation
-    Tss2_Sys_PolicyGetDigest(sapi_ctx, policySessionOR.sessionHandle,
-                             nullCmdAuths, &policyOR, nullRspAuths);
+  ctx->compression = alg;
 
-    // flushes the session from the TPM
-    Tss2_Sys_FlushContext(sapi_ctx, policySessionOR.sessionHandle);
+  return 0;
+}
 
-    // stores the 2 policy branches in the ski file, they will be needed for future calculations
-    // specifies the policyOR digest as the primary policy used for authorizing actions
-    ski.policyBranch1 = policy_branch_1;
-    ski.policyBranch2 = policy_branch_2;
-    objAuthPolicy = policyOR;
+//############################################################################
+// kmyth_ctx_set_sk_alg()
+//############################################################################
+int kmyth_ctx_set_sk_alg(kmyth_ctx_t * ctx, int sk_alg)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL context ... exiting");
+    return 1;
   }
 
-  // The storage root key (SRK) is the primary key for the storage hierarchy
-  // in the TPM.  We will first check to see if it is already loaded in
-  // persistent storage. We do this by getting the loaded persistent handle
-  // values, inspecting each of their public structures, and comparing
-  // these public area parameters against those for the SRK. None of these
-  // activities require authorization. If the key is not already loaded,
-  // though, it must be re-derived using the storage hierarchy's primary
-  // seed (SPS). Use of the SPS requires owner hierarchy authorization.
-  TPM2_HANDLE storageRootKey_handle = 0;
-
-  if (get_srk_handle(sapi_ctx, &storageRootKey_handle, &ownerAuth))
+  switch (sk_alg)
   {
-    kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
-
-    // clear potential 'auth' data, free TPM resources before exiting early
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
+  case KMYTH_SK_ALG_RSA:
+    ctx->sk_alg = TPM2_ALG_RSA;
+    break;
+  case KMYTH_SK_ALG_ECC:
+    ctx->sk_alg = TPM2_ALG_ECC;
+    break;
+  default:
+    kmyth_log(LOG_ERR, "invalid storage key algorithm (%d) ... exiting",
+              sk_alg);
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "retrieved SRK handle (0x%08X)", storageRootKey_handle);
 
-  // We create a storage key (SK) that we will use to seal a symmetric
-  // wrapping key that we will create and use to encrypt the user input data.
-  // This storage key will be sealed to the SRK (its parent is the SRK).
-  TPM2_HANDLE storageKey_handle = 0;
+  return 0;
+}
 
-  if (create_and_load_sk(sapi_ctx,
-                         storageRootKey_handle,
-                         ownerAuth,
-                         objAuthVal,
-                         ski.pcr_list,
-                         objAuthPolicy,
-                         &storageKey_handle, &ski.sk_priv, &ski.sk_pub))
+//############################################################################
+// kmyth_ctx_set_jobs()
+//############################################################################
+int kmyth_ctx_set_jobs(kmyth_ctx_t * ctx, size_t jobs)
+{
+  if (ctx == NULL)
   {
-    kmyth_log(LOG_ERR, "failed to create and load a storage key ... exiting");
-
-    // clear potential 'auth' data, free TPM resources before exiting early
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "NULL context ... exiting");
+    return 1;
+  }
+  if (jobs == 0 || jobs > KMYTH_MAX_JOBS)
+  {
+    kmyth_log(LOG_ERR, "invalid number of jobs (%zu) ... exiting", jobs);
     return 1;
   }
 
-  // Done with owner hierarchy authorization - SRK and SK available in TPM
-  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+  ctx->jobs = jobs;
 
-  // Wrap input data -
-  //   - The data to be encrypted is contained in a file and the path to that
-  //     file is specified by the user.
-  //   - The encryption uses the symmetric 'cipher' specified by the user.
-  //   - The symmetric wrapping key used for encryption
-  kmyth_log(LOG_DEBUG, "wrapping input data");
-  size_t wrapKey_size = get_key_len_from_cipher(ski.cipher) / 8;
-  unsigned char *wrapKey = calloc(wrapKey_size, sizeof(unsigned char));
+  return 0;
+}
 
-  if (wrapKey == NULL)
+//############################################################################
+// kmyth_ctx_set_sk_pool()
+//############################################################################
+int kmyth_ctx_set_sk_pool(kmyth_ctx_t * ctx, size_t max_sks)
+{
+  if (ctx == NULL)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for the wrapping key ... exiting");
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "NULL context ... exiting");
     return 1;
   }
-
-  // validate non-empty plaintext buffer specified
-  if (input_len == 0 || input == NULL)
+  if (max_sks > KMYTH_SK_POOL_MAX)
   {
-    kmyth_log(LOG_ERR, "no input data ... exiting");
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "invalid storage key pool size (%zu) ... exiting",
+              max_sks);
     return 1;
   }
 
-  // encrypt (wrap) input data read in (e.g., client certificate private .pem)
-  if (kmyth_encrypt_data(input, input_len,
-                         ski.cipher, &ski.enc_data, &ski.enc_data_size,
-                         &wrapKey, &wrapKey_size))
+  // drop the least recently used storage keys that no longer fit
+  if (ctx->sk_pool_count > max_sks)
   {
-    kmyth_log(LOG_ERR, "unable to encrypt (wrap) data ... exiting");
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    free_tpm2_resources(&sapi_ctx);
-    return 1;
+    size_t drop = ctx->sk_pool_count - max_sks;
+
+    memmove(&ctx->sk_pool[0], &ctx->sk_pool[drop],
+            max_sks * sizeof(kmyth_pooled_sk_t));
+    kmyth_clear(&ctx->sk_pool[max_sks], drop * sizeof(kmyth_pooled_sk_t));
+    ctx->sk_pool_count = max_sks;
   }
+  ctx->sk_pool_size = max_sks;
 
-  kmyth_log(LOG_DEBUG, "input data wrapped");
+  return 0;
+}
 
-  // Seal the wrapping key to the TPM using the Storage Key (SK)
-  if (tpm2_kmyth_seal_data(sapi_ctx,
-                           wrapKey,
-                           wrapKey_size,
-                           storageKey_handle,
-                           objAuthVal,
-                           ski.pcr_list,
-                           objAuthVal,
-                           ski.pcr_list,
-                           objAuthPolicy,
-                           ski.policyBranch1,
-                           ski.policyBranch2, &ski.wk_pub, &ski.wk_priv))
+//############################################################################
+// kmyth_ctx_set_persistent_sk()
+//############################################################################
+int kmyth_ctx_set_persistent_sk(kmyth_ctx_t * ctx, uint32_t handle)
+{
+  if (ctx == NULL)
   {
-    kmyth_log(LOG_ERR, "unable to seal data ... exiting");
-    kmyth_clear_and_free(wrapKey, wrapKey_size);
-    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "NULL context ... exiting");
+    return 1;
+  }
+  if (handle != 0 && (handle < KMYTH_PERSISTENT_SK_FIRST ||
+                      handle > KMYTH_PERSISTENT_SK_LAST))
+  {
+    kmyth_log(LOG_ERR, "invalid persistent SK handle (0x%08X) ... exiting",
+              handle);
     return 1;
   }
 
-  // Clean-up:
-  //   - done with unencrypted wrapping key (now have sealed version)
-  //   - done with authVal
-  kmyth_clear_and_free(wrapKey, wrapKey_size);
-  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+  ctx->persistent_sk_handle = handle;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_list_persistent_sks()
+//############################################################################
+int kmyth_ctx_list_persistent_sks(kmyth_ctx_t * ctx, uint32_t * handles,
+                                  size_t max_handles, size_t *count)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL || count == NULL ||
+      (handles == NULL && max_handles > 0))
+  {
+    kmyth_log(LOG_ERR, "invalid arguments ... exiting");
+    return 1;
+  }
+
+  TPML_HANDLE sk_handles;
+
+  if (list_persistent_sks(ctx->sapi_ctx, &sk_handles))
+  {
+    kmyth_log(LOG_ERR, "unable to list persistent SKs ... exiting");
+    return 1;
+  }
+
+  for (size_t i = 0; i < sk_handles.count && i < max_handles; i++)
+  {
+    handles[i] = sk_handles.handle[i];
+  }
+  *count = sk_handles.count;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_evict_persistent_sk()
+//############################################################################
+int kmyth_ctx_evict_persistent_sk(kmyth_ctx_t * ctx, uint32_t handle,
+                                  uint8_t * owner_auth_bytes,
+                                  size_t oa_bytes_len)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+  if (oa_bytes_len > sizeof(((TPM2B_AUTH *) NULL)->buffer))
+  {
+    kmyth_log(LOG_ERR, "owner auth too large ... exiting");
+    return 1;
+  }
+
+  TPM2B_AUTH ownerAuth = {.size = (uint16_t) oa_bytes_len, };
+
+  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+  {
+    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+  }
+
+  int retval = evict_persistent_sk(ctx->sapi_ctx, ownerAuth, handle);
+
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+  if (ctx->persistent_sk_hint == handle)
+  {
+    ctx->persistent_sk_hint = 0;
+  }
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_ctx_get_nv_limits()
+//############################################################################
+static int kmyth_ctx_get_nv_limits(kmyth_ctx_t * ctx)
+{
+  if (ctx->nv_index_max != 0 && ctx->nv_buffer_max != 0)
+  {
+    return 0;
+  }
+
+  return get_nv_limits(ctx->sapi_ctx, &ctx->nv_index_max,
+                       &ctx->nv_buffer_max);
+}
+
+//############################################################################
+// kmyth_ctx_store_nv()
+//############################################################################
+int kmyth_ctx_store_nv(kmyth_ctx_t * ctx, uint32_t nv_index,
+                       uint8_t * ski_bytes, size_t ski_bytes_len,
+                       uint8_t * owner_auth_bytes, size_t oa_bytes_len)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+  if (ski_bytes == NULL || ski_bytes_len == 0)
+  {
+    kmyth_log(LOG_ERR, "no .ski data to store ... exiting");
+    return 1;
+  }
+
+  // the text format is several times the size, so only the binary one is
+  // worth the (scarce) NV space
+  if (!is_binary_ski_bytes(ski_bytes, ski_bytes_len))
+  {
+    kmyth_log(LOG_ERR, "only a binary format .ski can be stored in NV ... "
+              "exiting");
+    return 1;
+  }
+  if (oa_bytes_len > sizeof(((TPM2B_AUTH *) NULL)->buffer))
+  {
+    kmyth_log(LOG_ERR, "owner auth too large ... exiting");
+    return 1;
+  }
+  if (kmyth_ctx_get_nv_limits(ctx))
+  {
+    return 1;
+  }
+  if (ski_bytes_len > ctx->nv_index_max || ski_bytes_len > UINT16_MAX)
+  {
+    kmyth_log(LOG_ERR, ".ski of %zu bytes too large for a TPM NV index "
+              "(max %u bytes) ... exiting", ski_bytes_len, ctx->nv_index_max);
+    return 1;
+  }
+
+  TPM2B_AUTH ownerAuth = {.size = (uint16_t) oa_bytes_len, };
+
+  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+  {
+    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+  }
+
+  int retval = 0;
+
+  if (define_nv_index(ctx->sapi_ctx, ownerAuth, nv_index,
+                      (uint16_t) ski_bytes_len)
+      || write_nv_index(ctx->sapi_ctx, ownerAuth, nv_index, ski_bytes,
+                        ski_bytes_len, ctx->nv_buffer_max))
+  {
+    kmyth_log(LOG_ERR, "unable to store .ski in NV index (0x%08X) ... "
+              "exiting", nv_index);
+    retval = 1;
+  }
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_ctx_remove_nv()
+//############################################################################
+int kmyth_ctx_remove_nv(kmyth_ctx_t * ctx, uint32_t nv_index,
+                        uint8_t * owner_auth_bytes, size_t oa_bytes_len)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+  if (oa_bytes_len > sizeof(((TPM2B_AUTH *) NULL)->buffer))
+  {
+    kmyth_log(LOG_ERR, "owner auth too large ... exiting");
+    return 1;
+  }
+
+  TPM2B_AUTH ownerAuth = {.size = (uint16_t) oa_bytes_len, };
+
+  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+  {
+    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+  }
+
+  int retval = undefine_nv_index(ctx->sapi_ctx, ownerAuth, nv_index);
+
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_ctx_find_persistent_sk()
+//############################################################################
+static TPM2_HANDLE kmyth_ctx_find_persistent_sk(kmyth_ctx_t * ctx,
+                                                TPM2B_PUBLIC * sk_pub)
+{
+  // the handle found last time is checked first, as a service typically
+  // unseals many .ski files sealed under the same storage key
+  TPM2_HANDLE handle = ctx->persistent_sk_hint;
+
+  if (find_persistent_sk(ctx->sapi_ctx, *sk_pub, &handle))
+  {
+    // not fatal - the storage key is loaded from the .ski instead
+    kmyth_log(LOG_WARNING, "error looking for persistent SK");
+    handle = 0;
+  }
+  if (handle != 0)
+  {
+    ctx->persistent_sk_hint = handle;
+  }
+
+  return handle;
+}
+
+//############################################################################
+// kmyth_ctx_set_object_cache()
+//############################################################################
+int kmyth_ctx_set_object_cache(kmyth_ctx_t * ctx, int enabled)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+
+  return set_object_context_cache(ctx->sapi_ctx, enabled != 0);
+}
+
+//############################################################################
+// kmyth_ctx_set_timings()
+//############################################################################
+int kmyth_ctx_set_timings(kmyth_ctx_t * ctx, kmyth_timings_t * timings)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+
+  if (set_tpm2_timings(ctx->sapi_ctx, timings))
+  {
+    return 1;
+  }
+  ctx->timings = timings;
+
+  // account for the connection made by kmyth_ctx_create() (once)
+  if (timings != NULL && ctx->connect_ns != 0)
+  {
+    timings->phase_ns[KMYTH_PHASE_CONNECT] += ctx->connect_ns;
+    timings->phase_calls[KMYTH_PHASE_CONNECT]++;
+    ctx->connect_ns = 0;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_set_deadline()
+//############################################################################
+int kmyth_ctx_set_deadline(kmyth_ctx_t * ctx, uint64_t deadline_ns)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+
+  ctx->deadline.deadline_ns = deadline_ns;
+  __atomic_store_n(&ctx->deadline.cancelled, 0, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_cancel()
+//############################################################################
+int kmyth_ctx_cancel(kmyth_ctx_t * ctx)
+{
+  if (ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+
+  __atomic_store_n(&ctx->deadline.cancelled, 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+//############################################################################
+// ctx_call_result()
+//############################################################################
+static int ctx_call_result(kmyth_ctx_t * ctx, int retval)
+{
+  // a command abandoned at the deadline leaves the connection mid-command,
+  // so it is reset for the context's next call
+  if (retval != 0 && ctx != NULL && reset_tpm2_connection(ctx->sapi_ctx))
+  {
+    kmyth_log(LOG_ERR, "unable to reset the context's TPM connection");
+  }
+
+  // whichever step it failed at, a call that failed once its deadline had
+  // passed (or it was cancelled) is reported as timed out
+  if (retval != 0 && ctx != NULL && tpm2_deadline_expired(&ctx->deadline))
+  {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_TIMEOUT);
+    return KMYTH_ERR_TIMEOUT;
+  }
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_phase_name()
+//############################################################################
+const char *kmyth_phase_name(kmyth_phase_t phase)
+{
+  switch (phase)
+  {
+  case KMYTH_PHASE_CONNECT:
+    return "connect";
+  case KMYTH_PHASE_SRK:
+    return "srk";
+  case KMYTH_PHASE_POLICY:
+    return "policy";
+  case KMYTH_PHASE_CREATE:
+    return "create";
+  case KMYTH_PHASE_LOAD:
+    return "load";
+  case KMYTH_PHASE_UNSEAL:
+    return "unseal";
+  case KMYTH_PHASE_ENCRYPT:
+    return "encrypt";
+  case KMYTH_PHASE_DECRYPT:
+    return "decrypt";
+  default:
+    return NULL;
+  }
+}
+
+//############################################################################
+// kmyth_timings_print()
+//############################################################################
+int kmyth_timings_print(FILE * out, const kmyth_timings_t * timings)
+{
+  if (out == NULL || timings == NULL)
+  {
+    return 1;
+  }
+
+  fprintf(out, "%-24s %8s %12s %12s\n", "phase", "calls", "total ms",
+          "mean ms");
+  for (int i = 0; i < KMYTH_PHASE_COUNT; i++)
+  {
+    if (timings->phase_calls[i] == 0)
+    {
+      continue;
+    }
+    fprintf(out, "%-24s %8lu %12.3f %12.3f\n",
+            kmyth_phase_name((kmyth_phase_t) i),
+            (unsigned long) timings->phase_calls[i],
+            (double) timings->phase_ns[i] / 1e6,
+            (double) timings->phase_ns[i] / 1e6 /
+            (double) timings->phase_calls[i]);
+  }
+
+  fprintf(out, "\n%-24s %8s %12s %12s %12s\n", "TPM command", "calls",
+          "total ms", "mean ms", "max ms");
+  for (size_t i = 0; i < timings->command_count; i++)
+  {
+    char name[32];
+
+    snprintf(name, sizeof(name), "%s (0x%03X)",
+             get_tpm2_command_name(timings->commands[i].command_code),
+             timings->commands[i].command_code);
+    fprintf(out, "%-24s %8lu %12.3f %12.3f %12.3f\n", name,
+            (unsigned long) timings->commands[i].calls,
+            (double) timings->commands[i].total_ns / 1e6,
+            (double) timings->commands[i].total_ns / 1e6 /
+            (double) timings->commands[i].calls,
+            (double) timings->commands[i].max_ns / 1e6);
+  }
+  if (timings->dropped_commands > 0)
+  {
+    fprintf(out, "(%lu further commands not recorded)\n",
+            (unsigned long) timings->dropped_commands);
+  }
+  if (timings->retries > 0)
+  {
+    fprintf(out, "(%lu commands retried, %.3f ms waiting to retry)\n",
+            (unsigned long) timings->retries,
+            (double) timings->retry_wait_ns / 1e6);
+  }
+  if (timings->alloc_calls > 0)
+  {
+    fprintf(out, "(%lu allocations, %lu frees, %lu bytes allocated in %lu "
+            "calls, peak %lu bytes)\n", (unsigned long) timings->allocs,
+            (unsigned long) timings->frees,
+            (unsigned long) timings->alloc_bytes,
+            (unsigned long) timings->alloc_calls,
+            (unsigned long) timings->peak_alloc_bytes);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// start_alloc_timing()
+//############################################################################
+static void start_alloc_timing(kmyth_timings_t * timings,
+                               kmyth_alloc_stats * start)
+{
+  // only a timed call restarts the peak, so that an untimed call made
+  // while something else is being measured does not disturb it
+  if (timings != NULL && kmyth_alloc_stats_enabled())
+  {
+    kmyth_alloc_stats_reset_peak();
+  }
+  kmyth_alloc_stats_get(start);
+}
+
+//############################################################################
+// add_alloc_timing()
+//############################################################################
+static void add_alloc_timing(kmyth_timings_t * timings,
+                             const kmyth_alloc_stats * start)
+{
+  if (timings == NULL || !kmyth_alloc_stats_enabled())
+  {
+    return;
+  }
+
+  kmyth_alloc_stats end;
+
+  kmyth_alloc_stats_get(&end);
+  timings->alloc_calls++;
+  timings->allocs += end.allocs - start->allocs;
+  timings->frees += end.frees - start->frees;
+  timings->alloc_bytes += end.bytes - start->bytes;
+  if (end.peak > start->current &&
+      (uint64_t) (end.peak - start->current) > timings->peak_alloc_bytes)
+  {
+    timings->peak_alloc_bytes = (uint64_t) (end.peak - start->current);
+  }
+}
+
+//############################################################################
+// kmyth_ctx_get_srk_handle()
+//############################################################################
+static int kmyth_ctx_get_srk_handle(kmyth_ctx_t * ctx, TPM2B_AUTH * ownerAuth)
+{
+  // The storage root key (SRK) is the primary key for the storage hierarchy
+  // in the TPM. If the context already holds an SRK handle from an earlier
+  // operation, it is verified with a single ReadPublic. Otherwise (or if
+  // that check fails) we check to see if it is already loaded in
+  // persistent storage. We do this by getting the loaded persistent handle
+  // values, inspecting each of their public structures, and comparing
+  // these public area parameters against those for the SRK. None of these
+  // activities require authorization. If the key is not already loaded,
+  // though, it must be re-derived using the storage hierarchy's primary
+  // seed (SPS). Use of the SPS requires owner hierarchy authorization.
+  //
+  // The SRK name, which identifies the TPM, is read once the handle is
+  // known (and again if the handle changes).
+  uint64_t phase_start = get_timing_ns();
+  TPM2_HANDLE prev_handle = ctx->srk_handle;
+  int retval = get_cached_srk_handle(ctx->sapi_ctx, &(ctx->srk_handle),
+                                     ownerAuth);
+
+  if (retval == 0 && (ctx->srk_name.size == 0 ||
+                      ctx->srk_handle != prev_handle))
+  {
+    retval = get_srk_name(ctx->sapi_ctx, ctx->srk_handle, &(ctx->srk_name));
+  }
+  add_phase_timing(ctx->timings, KMYTH_PHASE_SRK, phase_start);
+  if (retval)
+  {
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "retrieved SRK handle (0x%08X)", ctx->srk_handle);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_get_srk_name()
+//############################################################################
+int kmyth_ctx_get_srk_name(kmyth_ctx_t * ctx,
+                           uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                           TPM2B_NAME * srk_name)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL || srk_name == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+  if (oa_bytes_len > UINT16_MAX)
+  {
+    kmyth_log(LOG_ERR, "oa_bytes_len too large ... exiting");
+    return 1;
+  }
+
+  if (ctx->srk_name.size == 0)
+  {
+    TPM2B_AUTH ownerAuth = {.size = (uint16_t) oa_bytes_len, };
+
+    if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+    {
+      memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+    }
+
+    int retval = kmyth_ctx_get_srk_handle(ctx, &ownerAuth);
+
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
+      return 1;
+    }
+  }
+
+  *srk_name = ctx->srk_name;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_srk_matches()
+//############################################################################
+static bool kmyth_ctx_srk_matches(kmyth_ctx_t * ctx, Ski * ski)
+{
+  // a .ski that does not record its SRK may have been sealed under any
+  // TPM, so only a load can tell
+  if (ski->srk_name.size == 0 || ctx->srk_name.size == 0)
+  {
+    return true;
+  }
+
+  if (ski->srk_name.size != ctx->srk_name.size ||
+      memcmp(ski->srk_name.name, ctx->srk_name.name, ski->srk_name.size))
+  {
+    kmyth_log(LOG_ERR, "sealed under the SRK of a different TPM");
+    return false;
+  }
+
+  return true;
+}
+
+// Policy digest for the current values of a PCR selection, kept so that
+// the PCRs are only read once for items sharing a selection
+typedef struct
+{
+  bool valid;
+  TPML_PCR_SELECTION pcr_list;
+  TPM2B_DIGEST pcr_policy;
+} kmyth_pcr_policy_cache;
+
+//############################################################################
+// kmyth_same_pcr_selection()
+//############################################################################
+static bool kmyth_same_pcr_selection(TPML_PCR_SELECTION * a,
+                                     TPML_PCR_SELECTION * b)
+{
+  // compared field by field, as the structs may contain padding
+  if (a->count != b->count)
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < a->count; i++)
+  {
+    if (a->pcrSelections[i].hash != b->pcrSelections[i].hash ||
+        a->pcrSelections[i].sizeofSelect != b->pcrSelections[i].sizeofSelect ||
+        memcmp(a->pcrSelections[i].pcrSelect, b->pcrSelections[i].pcrSelect,
+               a->pcrSelections[i].sizeofSelect) != 0)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+//############################################################################
+// kmyth_ctx_precheck_policy()
+//############################################################################
+static int kmyth_ctx_precheck_policy(kmyth_ctx_t * ctx, Ski * ski,
+                                     kmyth_pcr_policy_cache * cache)
+{
+  if (!ctx->policy_precheck)
+  {
+    return 0;
+  }
+
+  if (!cache->valid || !kmyth_same_pcr_selection(&cache->pcr_list,
+                                                 &ski->pcr_list))
+  {
+    uint64_t phase_start = get_timing_ns();
+    int retval = create_policy_digest(ctx->sapi_ctx, ski->pcr_list,
+                                      &cache->pcr_policy);
+
+    add_phase_timing(ctx->timings, KMYTH_PHASE_POLICY, phase_start);
+    cache->valid = (retval == 0);
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "error computing policy digest for the current "
+                "PCR values ... exiting");
+      return 1;
+    }
+    cache->pcr_list = ski->pcr_list;
+  }
+
+  if (check_policy_digest(cache->pcr_policy,
+                          ski->wk_pub.publicArea.authPolicy,
+                          ski->policyBranch1, ski->policyBranch2))
+  {
+    kmyth_log(LOG_ERR, "current PCR values do not satisfy the policy the "
+              "data was sealed under ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_seal()
+//############################################################################
+int tpm2_kmyth_seal(uint8_t * input,
+                    size_t input_len,
+                    uint8_t ** output,
+                    size_t *output_len,
+                    uint8_t * auth_bytes,
+                    size_t auth_bytes_len,
+                    uint8_t * owner_auth_bytes,
+                    size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                    char *cipher_string, char *expected_policy,
+                    uint8_t bool_trial_only)
+{
+  if(oa_bytes_len > UINT16_MAX)
+  {
+    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
+    return 1;
+  }
+
+  //init connection to the resource manager
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx))
+  {
+    return 1;
+  }
+
+  int retval = tpm2_kmyth_seal_ctx(ctx,
+                                   input, input_len,
+                                   output, output_len,
+                                   auth_bytes, auth_bytes_len,
+                                   owner_auth_bytes, oa_bytes_len,
+                                   pcrs, pcrs_len, cipher_string,
+                                   expected_policy, bool_trial_only);
+
+  // done, so free any allocated resources that remain
+  kmyth_ctx_destroy(&ctx);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_ctx_get_sk()
+//############################################################################
+static int kmyth_ctx_get_sk(kmyth_ctx_t * ctx,
+                            TPM2_HANDLE srk_handle,
+                            TPM2B_AUTH srk_authVal,
+                            TPM2B_AUTH sk_authVal,
+                            TPML_PCR_SELECTION sk_pcrList,
+                            TPM2B_DIGEST sk_authPolicy,
+                            TPM2_HANDLE * sk_handle,
+                            TPM2B_PRIVATE * sk_private,
+                            TPM2B_PUBLIC * sk_public)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = ctx->sapi_ctx;
+
+  // Look for a pooled storage key created for the same parameters. A
+  // match is moved to the end of the pool (most recently used).
+  for (size_t i = 0; i < ctx->sk_pool_count; i++)
+  {
+    kmyth_pooled_sk_t *entry = &ctx->sk_pool[i];
+
+    if (entry->srk_handle != srk_handle || entry->sk_alg != ctx->sk_alg ||
+        entry->authVal.size != sk_authVal.size ||
+        memcmp(entry->authVal.buffer, sk_authVal.buffer, sk_authVal.size) ||
+        entry->authPolicy.size != sk_authPolicy.size ||
+        memcmp(entry->authPolicy.buffer, sk_authPolicy.buffer,
+               sk_authPolicy.size))
+    {
+      continue;
+    }
+
+    kmyth_pooled_sk_t found = *entry;
+
+    memmove(&ctx->sk_pool[i], &ctx->sk_pool[i + 1],
+            (ctx->sk_pool_count - i - 1) * sizeof(kmyth_pooled_sk_t));
+    ctx->sk_pool_count--;
+
+    // loading the storage key needs no authorization beyond the SRK's
+    TPML_PCR_SELECTION emptyPcrList = {.count = 0, };
+
+    if (load_kmyth_object(sapi_ctx,
+                          (SESSION *) NULL,
+                          srk_handle,
+                          srk_authVal,
+                          emptyPcrList,
+                          &found.sk_priv, &found.sk_pub, sk_handle, NULL))
+    {
+      // e.g., the SRK was re-derived since, so drop the key and create
+      // a new one instead
+      kmyth_log(LOG_WARNING, "unable to load pooled storage key, "
+                "creating a new one");
+      kmyth_clear(&found, sizeof(found));
+      *sk_handle = 0;
+      break;
+    }
+
+    *sk_private = found.sk_priv;
+    *sk_public = found.sk_pub;
+    ctx->sk_pool[ctx->sk_pool_count++] = found;
+    kmyth_clear(&found, sizeof(found));
+    kmyth_log(LOG_DEBUG, "loaded pooled storage key (handle = 0x%08X)",
+              *sk_handle);
+    return 0;
+  }
+
+  if (create_and_load_sk(sapi_ctx,
+                         srk_handle,
+                         srk_authVal,
+                         sk_authVal,
+                         sk_pcrList,
+                         sk_authPolicy,
+                         ctx->sk_alg, sk_handle, sk_private, sk_public))
+  {
+    return 1;
+  }
+
+  if (ctx->sk_pool_size == 0)
+  {
+    return 0;
+  }
+
+  // keep the new storage key, dropping the least recently used one if
+  // the pool is full
+  if (ctx->sk_pool_count == ctx->sk_pool_size)
+  {
+    memmove(&ctx->sk_pool[0], &ctx->sk_pool[1],
+            (ctx->sk_pool_count - 1) * sizeof(kmyth_pooled_sk_t));
+    ctx->sk_pool_count--;
+  }
+
+  kmyth_pooled_sk_t *entry = &ctx->sk_pool[ctx->sk_pool_count++];
+
+  entry->srk_handle = srk_handle;
+  entry->sk_alg = ctx->sk_alg;
+  entry->authVal = sk_authVal;
+  entry->authPolicy = sk_authPolicy;
+  entry->sk_priv = *sk_private;
+  entry->sk_pub = *sk_public;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_seal_setup()
+//############################################################################
+static int kmyth_seal_setup(kmyth_ctx_t * ctx,
+                            uint8_t * auth_bytes,
+                            size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes,
+                            size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                            char *cipher_string, char *expected_policy,
+                            uint8_t bool_trial_only,
+                            Ski * ski,
+                            TPM2B_AUTH * objAuthVal,
+                            TPM2B_DIGEST * objAuthPolicy,
+                            TPM2_HANDLE * storageKey_handle)
+{
+  // Everything done here depends only on the sealing parameters, not the
+  // data being sealed, so that it can be done once and shared by any
+  // number of inputs. On success (other than for a trial run), this
+  // leaves a storage key loaded at *storageKey_handle that the caller must
+  // flush when done.
+  *storageKey_handle = 0;
+
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+
+  if(oa_bytes_len > UINT16_MAX)
+  {
+    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
+    return 1;
+  }
+
+  TSS2_SYS_CONTEXT *sapi_ctx = ctx->sapi_ctx;
+
+  //obtain cipher function
+  if (cipher_string == NULL)
+  {
+    cipher_string = KMYTH_DEFAULT_CIPHER;
+  }
+  ski->cipher = kmyth_get_cipher_t_from_string(cipher_string);
+
+  if (ski->cipher.cipher_name == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid cipher: %s ... exiting", cipher_string);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "cipher: %s", ski->cipher.cipher_name);
+
+  // Create owner (storage) hierarchy authorization structure
+  TPM2B_AUTH ownerAuth;
+
+  ownerAuth.size = (uint16_t)oa_bytes_len;
+  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+  {
+    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+  }
+  if (ownerAuth.size > 0)
+  {
+    kmyth_log(LOG_DEBUG, "TPM storage hierarchy auth string provided");
+  }
+  else if (ownerAuth.size == 0)
+  {
+    kmyth_log(LOG_DEBUG,
+              "using default (empty) auth string for TPM storage hierarchy");
+  }
+  else
+  {
+    // should never reach this code - ownerAuth.size should be:
+    //   - zero that it was initialized to
+    //   - strlen(owner_auth_password) value that is greater than zero
+    // included this case for completenes
+    kmyth_log(LOG_DEBUG,
+              "bad size: auth string for TPM storage hierarchy ... exiting");
+    return 1;
+  }
+
+  // Create authorization value for new, non-primary Kmyth objects (objectAuth)
+  //   - all-zero digest (like TPM 1.2 well-known secret) by default
+  //   - hash of input authorization string if one is specified
+  objAuthVal->size = 0;
+  if (create_authVal(auth_bytes, auth_bytes_len, objAuthVal))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    kmyth_clear(objAuthVal->buffer, objAuthVal->size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  // Create a "PCR Selection" struct and populate it in accordance with
+  // the PCR values specified in user input "PCR Selection" string, if any
+  // (if the "PCR Selection" string is NULL, the "PCR Selection" struct created
+  // will specify that no PCRs were selected by the user - all-zero mask)
+  // This PCR Selection struct will be used in the authorization policy for
+  // new, non-primary Kmyth objects.
+  if (init_pcr_selection(sapi_ctx, pcrs, pcrs_len, &ski->pcr_list))
+  {
+    kmyth_log(LOG_ERR, "error initializing PCRs ... exiting");
+
+    // clear potential 'auth' data before exiting early
+    kmyth_clear(objAuthVal->buffer, objAuthVal->size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  // For all non-primary (other than SRK), Kmyth TPM 2.0 objects that we will
+  // create, we will assign TPM 2.0 policy-based enhanced authorization
+  // critera. Therefore, we will calculate the authorization policy digest that
+  // results from applying the steps of our selected authorization policy. We
+  // can then incorporate this result into the objects we create as the
+  // authorization policy digest value that must be regenerated to authorize
+  // use of these objects.
+  objAuthPolicy->size = 0;
+  if (create_policy_digest(sapi_ctx, ski->pcr_list, objAuthPolicy))
+  {
+    kmyth_log(LOG_ERR,
+              "error creating policy digest for new Kmyth object ... exiting");
+
+    // clear potential 'auth' data before exiting early
+    kmyth_clear(objAuthVal->buffer, objAuthVal->size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  // optional argument allowing user to receive a hex dump of the policy digest,
+  // to be used to calculate a second policy for policyOR authorization
+  if (bool_trial_only == 1)
+  {
+    // size of string is 2x chars for the size of the TPM2B_DIGEST buffer + 4
+    // for TPM2B struct which encodes size in memory + 1 byte for null termination.
+    // prints to the console and finishes the program without sealing
+    // By using TPM2B_DIGEST size we're reserving a little bit more than needed but
+    // then the output_string can be reserved based on compile-time values.
+    size_t string_size = (2 * sizeof(TPM2B_DIGEST)) + 1;
+    char output_string[string_size];
+
+    convert_digest_to_string(objAuthPolicy, output_string);
+    printf("%s", output_string);
+    kmyth_clear(objAuthVal->buffer, objAuthVal->size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 0;
+  }
+
+  // if the user has passed in secondary policy, this indicates that they wish to use
+  // the compound policy, PolicyOR and the argument they've passed in as an alternative
+  // policy digest that can be used to satisfy the policy of the sealed data object
+  if (expected_policy != NULL)
+  {
+    // digest that will hold the second auth policy branch
+    TPM2B_DIGEST policy_branch_1;
+    TPM2B_DIGEST policy_branch_2;
+
+    // assigns the previously calculated objAuthPolicy to policy branch 1
+    policy_branch_1 = *objAuthPolicy;
+
+    // fills the second policy branch with a policy specified by the user
+    if (convert_string_to_digest(expected_policy, &policy_branch_2))
+    {
+      kmyth_log(LOG_ERR,
+                "failed to convert secondary policy %s to digest ... exiting",
+                expected_policy);
+      kmyth_clear(objAuthVal->buffer, objAuthVal->size);
+      kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+      return 1;
+    }
+    // Digest to hold the policy that results from compounding objAuthPolicy and secondObjAuthPolicy
+    TPM2B_DIGEST policyOR;
+
+    policyOR.size = 0;
+
+    // computes the policyOR digest over the 2 policy branches:
+    // objAuthPolicy = results from current pcr readings
+    // objAuthPolicy2 = a user-supplied policy for a known future state of pcrs
+    if (create_policy_or_digest(sapi_ctx, policy_branch_1, policy_branch_2,
+                                &policyOR))
+    {
+      kmyth_log(LOG_ERR, "error creating policyOR digest ... exiting");
+      kmyth_clear(objAuthVal->buffer, objAuthVal->size);
+      kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+      return 1;
+    }
+
+    // stores the 2 policy branches in the ski file, they will be needed for future calculations
+    // specifies the policyOR digest as the primary policy used for authorizing actions
+    ski->policyBranch1 = policy_branch_1;
+    ski->policyBranch2 = policy_branch_2;
+    *objAuthPolicy = policyOR;
+  }
+
+  // Get the storage root key (SRK) handle, re-using the one cached in the
+  // context if it has already been looked up
+  if (kmyth_ctx_get_srk_handle(ctx, &ownerAuth))
+  {
+    kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
+
+    // clear potential 'auth' data before exiting early
+    kmyth_clear(objAuthVal->buffer, objAuthVal->size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+  TPM2_HANDLE storageRootKey_handle = ctx->srk_handle;
+
+  // Optionally, record which TPM (SRK) the data is sealed under
+  if (ctx->record_srk_name)
+  {
+    ski->srk_name = ctx->srk_name;
+  }
+
+  // We create (or load a pooled) storage key (SK) that we will use to seal
+  // a symmetric wrapping key that we will create and use to encrypt the
+  // user input data. This storage key is sealed to the SRK (its parent is
+  // the SRK).
+  if (kmyth_ctx_get_sk(ctx,
+                       storageRootKey_handle,
+                       ownerAuth,
+                       *objAuthVal,
+                       ski->pcr_list,
+                       *objAuthPolicy,
+                       storageKey_handle, &ski->sk_priv, &ski->sk_pub))
+  {
+    kmyth_log(LOG_ERR, "failed to create and load a storage key ... exiting");
+
+    // clear potential 'auth' data before exiting early
+    kmyth_clear(objAuthVal->buffer, objAuthVal->size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    *storageKey_handle = 0;
+    return 1;
+  }
+
+  // Optionally, keep a persistent copy of the storage key so that unseal
+  // can skip loading it (the transient copy is flushed by the caller)
+  if (ctx->persistent_sk_handle != 0 &&
+      make_sk_persistent(sapi_ctx, ownerAuth, *storageKey_handle,
+                         ctx->persistent_sk_handle))
+  {
+    kmyth_log(LOG_ERR, "failed to make storage key persistent ... exiting");
+    flush_kmyth_transient(sapi_ctx, *storageKey_handle);
+    kmyth_clear(objAuthVal->buffer, objAuthVal->size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    *storageKey_handle = 0;
+    return 1;
+  }
+
+  // Done with owner hierarchy authorization - SRK and SK available in TPM
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_ctx_precreate_sk()
+//############################################################################
+int kmyth_ctx_precreate_sk(kmyth_ctx_t * ctx,
+                           uint8_t * auth_bytes,
+                           size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes,
+                           size_t oa_bytes_len,
+                           int *pcrs, size_t pcrs_len, char *expected_policy)
+{
+  if (ctx == NULL || ctx->sk_pool_size == 0)
+  {
+    kmyth_log(LOG_ERR, "storage key pool not enabled ... exiting");
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+  TPM2B_AUTH objAuthVal;
+  TPM2B_DIGEST objAuthPolicy;
+  TPM2_HANDLE storageKey_handle = 0;
+
+  // the seal setup creates (and pools) a storage key for these parameters,
+  // which is then flushed, as only its blobs are needed for later seals
+  if (kmyth_seal_setup(ctx, auth_bytes, auth_bytes_len,
+                       owner_auth_bytes, oa_bytes_len, pcrs, pcrs_len,
+                       NULL, expected_policy, 0,
+                       &ski, &objAuthVal, &objAuthPolicy, &storageKey_handle))
+  {
+    free_ski(&ski);
+    return 1;
+  }
+
+  flush_kmyth_transient(ctx->sapi_ctx, storageKey_handle);
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+  free_ski(&ski);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_create_ski_output()
+//############################################################################
+static int kmyth_create_ski_output(int ski_format, Ski ski,
+                                   uint8_t ** output, size_t *output_len)
+{
+  if (ski_format == KMYTH_SKI_FORMAT_BINARY)
+  {
+    return create_ski_binary_bytes(ski, output, output_len);
+  }
+  return create_ski_bytes(ski, output, output_len);
+}
+
+//############################################################################
+// kmyth_encrypt_ski_data()
+//############################################################################
+static int kmyth_encrypt_ski_data(Ski * ski, kmyth_compression_t compression,
+                                  uint8_t * input, size_t input_len,
+                                  unsigned char **wrapKey,
+                                  size_t *wrapKey_size)
+{
+  // Inputs below the compression threshold, or that do not get any smaller,
+  // are encrypted as they are (and the .ski records no compression)
+  uint8_t *data = input;
+  size_t data_len = input_len;
+  uint8_t *compressed = NULL;
+  size_t compressed_len = 0;
+
+  ski->compression = KMYTH_COMPRESSION_NONE;
+  if (compression != KMYTH_COMPRESSION_NONE &&
+      input_len >= KMYTH_COMPRESSION_MIN_SIZE)
+  {
+    if (kmyth_compress_data(compression, input, input_len,
+                            &compressed, &compressed_len))
+    {
+      kmyth_log(LOG_ERR, "unable to compress data ... exiting");
+      return 1;
+    }
+    if (compressed_len < input_len)
+    {
+      kmyth_log(LOG_DEBUG, "compressed %zu bytes of input data to %zu",
+                input_len, compressed_len);
+      data = compressed;
+      data_len = compressed_len;
+      ski->compression = compression;
+    }
+  }
+
+  int retval = kmyth_encrypt_data(data, data_len, ski->cipher,
+                                  &ski->enc_data, &ski->enc_data_size,
+                                  wrapKey, wrapKey_size);
+
+  kmyth_clear_and_free(compressed, compressed_len);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_seal_input()
+//############################################################################
+static int kmyth_seal_input(TSS2_SYS_CONTEXT * sapi_ctx,
+                            SESSION * sealData_session,
+                            TPM2_HANDLE storageKey_handle,
+                            Ski * ski,
+                            TPM2B_AUTH objAuthVal,
+                            TPM2B_DIGEST objAuthPolicy,
+                            uint8_t * input, size_t input_len,
+                            kmyth_compression_t compression,
+                            int ski_format,
+                            uint8_t ** output, size_t *output_len)
+{
+  // Wrap input data -
+  //   - The data to be encrypted is contained in a file and the path to that
+  //     file is specified by the user.
+  //   - The encryption uses the symmetric 'cipher' specified by the user.
+  //   - The symmetric wrapping key used for encryption
+  kmyth_log(LOG_DEBUG, "wrapping input data");
+  size_t wrapKey_size = get_key_len_from_cipher(ski->cipher) / 8;
+  unsigned char *wrapKey = calloc(wrapKey_size, sizeof(unsigned char));
+
+  if (wrapKey == NULL)
+  {
+    kmyth_log(LOG_ERR,
+              "unable to allocate memory for the wrapping key ... exiting");
+    return 1;
+  }
+
+  // validate non-empty plaintext buffer specified
+  if (input_len == 0 || input == NULL)
+  {
+    kmyth_log(LOG_ERR, "no input data ... exiting");
+    kmyth_clear_and_free(wrapKey, wrapKey_size);
+    return 1;
+  }
+
+  // encrypt (wrap) input data read in (e.g., client certificate private .pem)
+  uint64_t phase_start = get_timing_ns();
+  int encrypt_failed = kmyth_encrypt_ski_data(ski, compression,
+                                              input, input_len,
+                                              &wrapKey, &wrapKey_size);
+
+  add_phase_timing(get_tpm2_timings(sapi_ctx), KMYTH_PHASE_ENCRYPT,
+                   phase_start);
+  if (encrypt_failed)
+  {
+    kmyth_log(LOG_ERR, "unable to encrypt (wrap) data ... exiting");
+    kmyth_clear_and_free(wrapKey, wrapKey_size);
+    return 1;
+  }
+
+  kmyth_log(LOG_DEBUG, "input data wrapped");
+
+  // Seal the wrapping key to the TPM using the Storage Key (SK)
+  if (tpm2_kmyth_seal_data_ref(sapi_ctx,
+                               sealData_session,
+                               wrapKey,
+                               wrapKey_size,
+                               storageKey_handle,
+                               &objAuthVal,
+                               &ski->pcr_list,
+                               &objAuthVal,
+                               &ski->pcr_list,
+                               &objAuthPolicy,
+                               &ski->policyBranch1,
+                               &ski->policyBranch2,
+                               &ski->wk_pub,
+                               &ski->wk_priv,
+                               NULL))
+  {
+    kmyth_log(LOG_ERR, "unable to seal data ... exiting");
+    kmyth_clear_and_free(wrapKey, wrapKey_size);
+    free_ski(ski);
+    return 1;
+  }
+
+  // Clean-up: done with unencrypted wrapping key (now have sealed version)
+  kmyth_clear_and_free(wrapKey, wrapKey_size);
+
+  if (kmyth_create_ski_output(ski_format, *ski, output, output_len))
+  {
+    kmyth_log(LOG_ERR, "error writing data to .ski format ... exiting");
+    free_ski(ski);
+    return 1;
+  }
+
+  // done with this input's encrypted data (the rest of the ski is shared)
+  free_ski(ski);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_seal_ctx()
+//############################################################################
+static int kmyth_seal_ctx(kmyth_ctx_t * ctx,
+                          uint8_t * input,
+                          size_t input_len,
+                          uint8_t ** output,
+                          size_t *output_len,
+                          uint8_t * auth_bytes,
+                          size_t auth_bytes_len,
+                          uint8_t * owner_auth_bytes,
+                          size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                          char *cipher_string, char *expected_policy,
+                          uint8_t bool_trial_only)
+{
+  Ski ski = get_default_ski();
+  TPM2B_AUTH objAuthVal = {.size = 0, };
+  TPM2B_DIGEST objAuthPolicy = {.size = 0, };
+  TPM2_HANDLE storageKey_handle = 0;
+
+  if (kmyth_seal_setup(ctx, auth_bytes, auth_bytes_len,
+                       owner_auth_bytes, oa_bytes_len, pcrs, pcrs_len,
+                       cipher_string, expected_policy, bool_trial_only,
+                       &ski, &objAuthVal, &objAuthPolicy, &storageKey_handle))
+  {
+    return 1;
+  }
+
+  // trial run only computes (and prints) the policy digest
+  if (bool_trial_only == 1)
+  {
+    return 0;
+  }
+
+  int retval = kmyth_seal_input(ctx->sapi_ctx, NULL, storageKey_handle, &ski,
+                                objAuthVal, objAuthPolicy,
+                                input, input_len, ctx->compression,
+                                ctx->ski_format, output, output_len);
+
+  // Clean-up:
+  //   - done with authVal
+  //   - done with the storage key, so flush it from the TPM
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+  flush_kmyth_transient(ctx->sapi_ctx, storageKey_handle);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_ctx()
+//############################################################################
+int tpm2_kmyth_seal_ctx(kmyth_ctx_t * ctx,
+                        uint8_t * input,
+                        size_t input_len,
+                        uint8_t ** output,
+                        size_t *output_len,
+                        uint8_t * auth_bytes,
+                        size_t auth_bytes_len,
+                        uint8_t * owner_auth_bytes,
+                        size_t oa_bytes_len, int *pcrs, size_t pcrs_len,
+                        char *cipher_string, char *expected_policy,
+                        uint8_t bool_trial_only)
+{
+  kmyth_timings_t *timings = (ctx != NULL) ? ctx->timings : NULL;
+  kmyth_alloc_stats start;
+
+  start_alloc_timing(timings, &start);
+
+  uint64_t metrics_start = kmyth_metrics_op_begin();
+  int retval = kmyth_seal_ctx(ctx, input, input_len, output, output_len,
+                              auth_bytes, auth_bytes_len, owner_auth_bytes,
+                              oa_bytes_len, pcrs, pcrs_len, cipher_string,
+                              expected_policy, bool_trial_only);
+
+  retval = ctx_call_result(ctx, retval);
+  kmyth_metrics_op_end(KMYTH_OP_SEAL, metrics_start, retval);
+  add_alloc_timing(timings, &start);
+
+  return retval;
+}
+
+// Per-item state of a batch seal, shared with the workers (each of which
+// only touches the items it is handed)
+typedef struct
+{
+  Ski *skis;
+  uint8_t **inputs;
+  size_t *input_lens;
+  uint8_t **wrapKeys;
+  size_t *wrapKey_lens;
+  bool *sealed;
+  uint8_t **outputs;
+  size_t *output_lens;
+  int *results;
+  kmyth_compression_t compression;
+  int ski_format;
+} kmyth_seal_batch_work;
+
+// A single batch seal item, handed to host work run while the TPM is busy
+typedef struct
+{
+  kmyth_seal_batch_work *work;
+  size_t index;
+} kmyth_seal_batch_item;
+
+//############################################################################
+// kmyth_seal_batch_encrypt()
+//############################################################################
+static int kmyth_seal_batch_encrypt(size_t i, void *arg)
+{
+  kmyth_seal_batch_work *work = (kmyth_seal_batch_work *) arg;
+  Ski *ski = &work->skis[i];
+  size_t wrapKey_size = get_key_len_from_cipher(ski->cipher) / 8;
+  unsigned char *wrapKey = NULL;
+
+  if (work->inputs[i] == NULL || work->input_lens[i] == 0)
+  {
+    kmyth_log(LOG_ERR, "no input data (batch item %zu)", i);
+    return 1;
+  }
+
+  wrapKey = calloc(wrapKey_size, sizeof(unsigned char));
+  if (wrapKey == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate wrapping key (batch item %zu)", i);
+    return 1;
+  }
+
+  if (kmyth_encrypt_ski_data(ski, work->compression,
+                             work->inputs[i], work->input_lens[i],
+                             &wrapKey, &wrapKey_size))
+  {
+    kmyth_log(LOG_ERR, "unable to encrypt (wrap) data (batch item %zu)", i);
+    kmyth_clear_and_free(wrapKey, wrapKey_size);
+    free_ski(ski);
+    return 1;
+  }
+
+  work->wrapKeys[i] = wrapKey;
+  work->wrapKey_lens[i] = wrapKey_size;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_seal_batch_format()
+//############################################################################
+static int kmyth_seal_batch_format(size_t i, void *arg)
+{
+  kmyth_seal_batch_work *work = (kmyth_seal_batch_work *) arg;
+  int retval = 0;
+
+  // items that were never sealed, or that have already been formatted
+  // while the TPM was sealing a later item, have nothing (more) to do
+  if (!work->sealed[i])
+  {
+    free_ski(&work->skis[i]);
+    return work->results[i];
+  }
+
+  if (kmyth_create_ski_output(work->ski_format, work->skis[i],
+                              &work->outputs[i], &work->output_lens[i]))
+  {
+    kmyth_log(LOG_ERR, "error writing data to .ski format (batch item %zu)",
+              i);
+    work->outputs[i] = NULL;
+    work->output_lens[i] = 0;
+    retval = 1;
+  }
+  else
+  {
+    work->results[i] = 0;
+  }
+
+  // done with this input's encrypted data
+  free_ski(&work->skis[i]);
+  work->sealed[i] = false;
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_seal_batch_format_item()
+//############################################################################
+static void kmyth_seal_batch_format_item(void *arg)
+{
+  kmyth_seal_batch_item *item = (kmyth_seal_batch_item *) arg;
+
+  kmyth_seal_batch_format(item->index, item->work);
+}
+
+//############################################################################
+// kmyth_seal_batch()
+//############################################################################
+static int kmyth_seal_batch(kmyth_ctx_t * ctx, size_t count,
+                            uint8_t ** inputs, size_t *input_lens,
+                            uint8_t ** outputs, size_t *output_lens,
+                            int *results,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            int *pcrs, size_t pcrs_len,
+                            char *cipher_string, char *expected_policy)
+{
+  if (count == 0 || inputs == NULL || input_lens == NULL ||
+      outputs == NULL || output_lens == NULL || results == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid batch parameters ... exiting");
+    return 1;
+  }
+
+  // every item starts out failed, and is only marked successful once its
+  // .ski output has actually been produced
+  for (size_t i = 0; i < count; i++)
+  {
+    outputs[i] = NULL;
+    output_lens[i] = 0;
+    results[i] = 1;
+  }
+
+  // The storage key, authVal and policy digest are computed once and
+  // shared by every input in the batch
+  Ski ski;
+  TPM2B_AUTH objAuthVal = {.size = 0, };
+  TPM2B_DIGEST objAuthPolicy = {.size = 0, };
+  TPM2_HANDLE storageKey_handle = 0;
+
+  init_default_ski(&ski);
+  if (kmyth_seal_setup(ctx, auth_bytes, auth_bytes_len,
+                       owner_auth_bytes, oa_bytes_len, pcrs, pcrs_len,
+                       cipher_string, expected_policy, 0,
+                       &ski, &objAuthVal, &objAuthPolicy, &storageKey_handle))
+  {
+    return 1;
+  }
+
+  TSS2_SYS_CONTEXT *sapi_ctx = ctx->sapi_ctx;
+
+  kmyth_seal_batch_work work = {
+    .skis = calloc(count, sizeof(Ski)),
+    .inputs = inputs,
+    .input_lens = input_lens,
+    .wrapKeys = calloc(count, sizeof(uint8_t *)),
+    .wrapKey_lens = calloc(count, sizeof(size_t)),
+    .sealed = calloc(count, sizeof(bool)),
+    .outputs = outputs,
+    .output_lens = output_lens,
+    .results = results,
+    .compression = ctx->compression,
+    .ski_format = ctx->ski_format
+  };
+
+  if (work.skis == NULL || work.wrapKeys == NULL ||
+      work.wrapKey_lens == NULL || work.sealed == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate memory for batch ... exiting");
+    free(work.skis);
+    free(work.wrapKeys);
+    free(work.wrapKey_lens);
+    free(work.sealed);
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    flush_kmyth_transient(sapi_ctx, storageKey_handle);
+    return 1;
+  }
+
+  // each item gets its own copy of the shared parts of the ski
+  for (size_t i = 0; i < count; i++)
+  {
+    work.skis[i] = ski;
+  }
+
+  // Encrypt every input (each under its own wrapping key) - this needs no
+  // TPM, so it is spread over the context's workers
+  kmyth_log(LOG_DEBUG, "wrapping batch input data");
+  uint64_t phase_start = get_timing_ns();
+
+  kmyth_parallel_for(count, ctx->jobs, kmyth_seal_batch_encrypt, &work);
+  add_phase_timing(ctx->timings, KMYTH_PHASE_ENCRYPT, phase_start);
+
+  // The same policy session is used to authorize the creation of every
+  // sealed wrapping key. The TPM resets its policy digest after each use,
+  // so the policy is re-applied per input, but the session itself only
+  // needs to be obtained (and released) once. The TPM commands are issued
+  // one at a time, in order, over the context's connection. While the TPM
+  // creates each sealed wrapping key, the .ski output of the previously
+  // sealed item is produced.
+  SESSION sealData_session;
+  kmyth_seal_batch_item prev = {.work = &work, .index = count };
+  int retval = 0;
+
+  phase_start = get_timing_ns();
+  if (acquire_policy_session(sapi_ctx, &sealData_session))
+  {
+    kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
+    retval = 1;
+  }
+  add_phase_timing(ctx->timings, KMYTH_PHASE_POLICY, phase_start);
+
+  for (size_t i = 0; i < count && retval == 0; i++)
+  {
+    if (work.wrapKeys[i] == NULL)
+    {
+      continue;
+    }
+
+    HOST_WORK host_work = {
+      .fn = (prev.index < count) ? kmyth_seal_batch_format_item : NULL,
+      .arg = &prev
+    };
+
+    // Seal the wrapping key to the TPM using the Storage Key (SK)
+    int seal_failed = tpm2_kmyth_seal_data_ref(sapi_ctx,
+                                               &sealData_session,
+                                               work.wrapKeys[i],
+                                               work.wrapKey_lens[i],
+                                               storageKey_handle,
+                                               &objAuthVal,
+                                               &work.skis[i].pcr_list,
+                                               &objAuthVal,
+                                               &work.skis[i].pcr_list,
+                                               &objAuthPolicy,
+                                               &work.skis[i].policyBranch1,
+                                               &work.skis[i].policyBranch2,
+                                               &work.skis[i].wk_pub,
+                                               &work.skis[i].wk_priv,
+                                               &host_work);
+
+    // the previous item is formatted even if the TPM command never ran
+    finish_host_work(&host_work);
+    prev.index = count;
+
+    if (seal_failed)
+    {
+      kmyth_log(LOG_ERR, "error sealing batch item %zu", i);
+
+      // a failure part way through may leave the session's policy digest
+      // in an unknown state, so start over with another session
+      release_policy_session(sapi_ctx, &sealData_session, true);
+      if (acquire_policy_session(sapi_ctx, &sealData_session))
+      {
+        kmyth_log(LOG_ERR, "error restarting auth policy session ... exiting");
+        retval = 1;
+      }
+      continue;
+    }
+    work.sealed[i] = true;
+    prev.index = i;
+  }
+
+  // Clean-up: done with the policy session, authVal, storage key, and the
+  // unencrypted wrapping keys (now have sealed versions)
+  if (retval == 0)
+  {
+    release_policy_session(sapi_ctx, &sealData_session, false);
+  }
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+  flush_kmyth_transient(sapi_ctx, storageKey_handle);
+  for (size_t i = 0; i < count; i++)
+  {
+    kmyth_clear_and_free(work.wrapKeys[i], work.wrapKey_lens[i]);
+  }
+
+  // Produce the .ski output for every sealed item not already formatted
+  // (and release the encrypted data of the rest) - again spread over the
+  // workers
+  if (kmyth_parallel_for(count, ctx->jobs, kmyth_seal_batch_format, &work))
+  {
+    retval = 1;
+  }
+
+  free(work.skis);
+  free(work.wrapKeys);
+  free(work.wrapKey_lens);
+  free(work.sealed);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_batch()
+//############################################################################
+int tpm2_kmyth_seal_batch(kmyth_ctx_t * ctx, size_t count,
+                          uint8_t ** inputs, size_t *input_lens,
+                          uint8_t ** outputs, size_t *output_lens,
+                          int *results,
+                          uint8_t * auth_bytes, size_t auth_bytes_len,
+                          uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                          int *pcrs, size_t pcrs_len,
+                          char *cipher_string, char *expected_policy)
+{
+  uint64_t metrics_start = kmyth_metrics_op_begin();
+  int retval = kmyth_seal_batch(ctx, count, inputs, input_lens, outputs,
+                                output_lens, results, auth_bytes,
+                                auth_bytes_len, owner_auth_bytes,
+                                oa_bytes_len, pcrs, pcrs_len, cipher_string,
+                                expected_policy);
+
+  retval = ctx_call_result(ctx, retval);
+  kmyth_metrics_op_end(KMYTH_OP_SEAL, metrics_start, retval);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal()
+//############################################################################
+int tpm2_kmyth_unseal(uint8_t * input,
+                      size_t input_len,
+                      uint8_t ** output,
+                      size_t *output_len,
+                      uint8_t * auth_bytes,
+                      size_t auth_bytes_len,
+                      uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                      uint8_t bool_policy_or)
+{
+  if(oa_bytes_len > UINT16_MAX)
+  {
+    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
+    return 1;
+  }
+
+  // Initialize connection to TPM 2.0 resource manager
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx))
+  {
+    return 1;
+  }
+
+  // with the unseal cache enabled, a repeated request is answered from the
+  // cache unless the TPM's PCR (or reset) counts have changed since - the
+  // counts are read before unsealing, so a result is never cached under
+  // counts newer than the PCR state it was unsealed in
+  uint8_t cache_key[KMYTH_UNSEAL_CACHE_KEY_LEN];
+  kmyth_unseal_cache_epoch epoch;
+  bool cacheable = kmyth_unseal_cache_enabled() &&
+    get_unseal_cache_key(input, input_len, auth_bytes, auth_bytes_len,
+                         owner_auth_bytes, oa_bytes_len, bool_policy_or,
+                         cache_key) == 0 &&
+    get_unseal_cache_epoch(ctx->sapi_ctx, &epoch) == 0;
+
+  if (cacheable &&
+      kmyth_unseal_cache_lookup(cache_key, &epoch, output, output_len) == 0)
+  {
+    kmyth_log(LOG_DEBUG, "unsealed data found in unseal cache");
+    kmyth_clear(cache_key, sizeof(cache_key));
+    kmyth_ctx_destroy(&ctx);
+    return 0;
+  }
+
+  int retval = tpm2_kmyth_unseal_ctx(ctx,
+                                     input, input_len,
+                                     output, output_len,
+                                     auth_bytes, auth_bytes_len,
+                                     owner_auth_bytes, oa_bytes_len,
+                                     bool_policy_or);
+
+  if (retval == 0 && cacheable)
+  {
+    kmyth_unseal_cache_insert(cache_key, &epoch, *output, *output_len);
+  }
+  kmyth_clear(cache_key, sizeof(cache_key));
+
+  // done, so free any allocated resources that remain
+  kmyth_ctx_destroy(&ctx);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_chunk_layout()
+//############################################################################
+static int kmyth_chunk_layout(Ski * ski, size_t *chunk_count,
+                              size_t *enc_data_size)
+{
+  // chunked data is only ever encrypted with AES/GCM, which authenticates
+  // each chunk along with its position (see kmyth_set_chunk_aad())
+  if (ski->cipher.encrypt_fn != aes_gcm_encrypt)
+  {
+    kmyth_log(LOG_ERR, "chunked data requires an AES/GCM cipher ... exiting");
+    return 1;
+  }
+  if (ski->chunk_size == 0 || ski->chunked_data_len == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid chunk index ... exiting");
+    return 1;
+  }
+
+  // every chunk is stored as IV||ciphertext||tag
+  size_t count = ski->chunked_data_len / ski->chunk_size +
+    ((ski->chunked_data_len % ski->chunk_size) ? 1 : 0);
+  size_t overhead = GCM_IV_LEN + GCM_TAG_LEN;
+
+  if (count > (SIZE_MAX - ski->chunked_data_len) / overhead)
+  {
+    kmyth_log(LOG_ERR, "chunked data too large ... exiting");
+    return 1;
+  }
+
+  *chunk_count = count;
+  *enc_data_size = ski->chunked_data_len + count * overhead;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_set_chunk_aad()
+//############################################################################
+static int kmyth_set_chunk_aad(Ski * ski, size_t chunk, uint8_t * aad)
+{
+  // the additional authenticated data for each chunk is the packed chunk
+  // index followed by the (big-endian, 64-bit) chunk number
+  if (pack_ski_chunk_index(ski->chunk_size, ski->chunked_data_len, aad))
+  {
+    return 1;
+  }
+  for (size_t i = 0; i < 8; i++)
+  {
+    aad[KMYTH_CHUNK_INDEX_SIZE + i] =
+      (uint8_t) ((uint64_t) chunk >> (56 - 8 * i));
+  }
+
+  return 0;
+}
+
+// State of a chunked encryption or decryption, shared with the workers
+// (each of which only touches the chunks, and the parts of the input and
+// output, it is handed)
+typedef struct
+{
+  Ski *ski;
+  uint8_t *key;
+  size_t key_len;
+
+  // encryption: the plaintext - decryption: the base64 encoded encrypted
+  // data, if only the chunks needed are to be decoded from it (else NULL)
+  uint8_t *input;
+  size_t input_size;
+
+  // size of the whole (decoded) encrypted data, and of a full chunk record
+  size_t enc_data_size;
+  size_t record_size;
+
+  // decryption only: the range unsealed, and the first chunk it covers
+  size_t offset;
+  size_t length;
+  size_t first_chunk;
+  uint8_t *output;
+} kmyth_chunk_work;
+
+//############################################################################
+// kmyth_chunk_len()
+//############################################################################
+static size_t kmyth_chunk_len(Ski * ski, size_t chunk)
+{
+  size_t chunk_len = ski->chunked_data_len - chunk * ski->chunk_size;
+
+  return (chunk_len > ski->chunk_size) ? ski->chunk_size : chunk_len;
+}
+
+//############################################################################
+// kmyth_encrypt_chunk()
+//############################################################################
+static int kmyth_encrypt_chunk(size_t i, void *arg)
+{
+  kmyth_chunk_work *work = (kmyth_chunk_work *) arg;
+  Ski *ski = work->ski;
+  uint8_t aad[KMYTH_CHUNK_INDEX_SIZE + 8];
+
+  // every chunk but the last is full sized, so each record's position is
+  // known up front, and the chunks can be encrypted in any order
+  if (kmyth_set_chunk_aad(ski, i, aad) ||
+      aes_gcm_encrypt_chunk(work->key, work->key_len, aad, sizeof(aad),
+                            work->input + i * ski->chunk_size,
+                            kmyth_chunk_len(ski, i),
+                            ski->enc_data + i * work->record_size))
+  {
+    kmyth_log(LOG_ERR, "unable to encrypt chunk %zu ... exiting", i);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_encrypt_chunks()
+//############################################################################
+static int kmyth_encrypt_chunks(Ski * ski, uint8_t * key, size_t key_len,
+                                uint8_t * input, size_t jobs)
+{
+  size_t chunk_count = 0;
+  size_t enc_data_size = 0;
+
+  if (kmyth_chunk_layout(ski, &chunk_count, &enc_data_size))
+  {
+    return 1;
+  }
+
+  uint8_t *enc_data = malloc(enc_data_size);
+
+  if (enc_data == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error (%zu bytes) ... exiting", enc_data_size);
+    return 1;
+  }
+  ski->enc_data = enc_data;
+  ski->enc_data_size = enc_data_size;
+
+  kmyth_chunk_work work = {
+    .ski = ski,
+    .key = key,
+    .key_len = key_len,
+    .input = input,
+    .record_size = GCM_IV_LEN + ski->chunk_size + GCM_TAG_LEN,
+  };
+
+  if (kmyth_parallel_for(chunk_count, jobs, kmyth_encrypt_chunk, &work))
+  {
+    free(enc_data);
+    ski->enc_data = NULL;
+    ski->enc_data_size = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_decrypt_chunk()
+//############################################################################
+static int kmyth_decrypt_chunk(size_t j, void *arg)
+{
+  kmyth_chunk_work *work = (kmyth_chunk_work *) arg;
+  Ski *ski = work->ski;
+  size_t i = work->first_chunk + j;
+  size_t chunk_start = i * ski->chunk_size;
+  size_t chunk_len = kmyth_chunk_len(ski, i);
+  size_t record_len = GCM_IV_LEN + chunk_len + GCM_TAG_LEN;
+
+  // the part of this chunk that falls within the range
+  size_t skip = (chunk_start < work->offset) ? work->offset - chunk_start : 0;
+  size_t count = chunk_len - skip;
+
+  if (count > work->offset + work->length - (chunk_start + skip))
+  {
+    count = work->offset + work->length - (chunk_start + skip);
+  }
+  uint8_t *out = work->output + (chunk_start + skip - work->offset);
+
+  // a chunk wholly within the range is decrypted in place, the (at most
+  // two) partly covered ones into a buffer of their own
+  uint8_t *record = NULL;
+  uint8_t *plaintext = out;
+
+  if (work->input != NULL)
+  {
+    record = malloc(record_len);
+  }
+  if (count != chunk_len)
+  {
+    plaintext = malloc(chunk_len);
+  }
+  if ((work->input != NULL && record == NULL) || plaintext == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate chunk buffers ... exiting");
+    free(record);
+    if (plaintext != out)
+    {
+      free(plaintext);
+    }
+    return 1;
+  }
+
+  uint8_t *chunk_record = NULL;
+
+  if (work->input == NULL)
+  {
+    chunk_record = ski->enc_data + i * work->record_size;
+  }
+  else if (decodeBase64Range(work->input, work->input_size,
+                             work->enc_data_size, i * work->record_size,
+                             record_len, record) == 0)
+  {
+    chunk_record = record;
+  }
+
+  uint8_t aad[KMYTH_CHUNK_INDEX_SIZE + 8];
+  int retval = 0;
+
+  if (chunk_record == NULL ||
+      kmyth_set_chunk_aad(ski, i, aad) ||
+      aes_gcm_decrypt_chunk(work->key, work->key_len, aad, sizeof(aad),
+                            chunk_record, record_len, plaintext))
+  {
+    kmyth_log(LOG_ERR, "unable to decrypt chunk %zu ... exiting", i);
+    retval = 1;
+  }
+  else if (plaintext != out)
+  {
+    memcpy(out, plaintext + skip, count);
+  }
+
+  free(record);
+  if (plaintext != out)
+  {
+    kmyth_clear_and_free(plaintext, chunk_len);
+  }
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_decrypt_chunks()
+//############################################################################
+static int kmyth_decrypt_chunks(Ski * ski, uint8_t * key, size_t key_len,
+                                uint8_t * enc_data64, size_t enc_data64_size,
+                                size_t offset, size_t length,
+                                uint8_t * output, size_t jobs)
+{
+  // The encrypted chunks are taken from the (already decoded) ski enc_data
+  // or, if enc_data64 is passed in, only the chunks needed are decoded
+  // from the base64 encoded encrypted data block.
+  size_t chunk_count = 0;
+  size_t enc_data_size = 0;
+
+  if (kmyth_chunk_layout(ski, &chunk_count, &enc_data_size))
+  {
+    return 1;
+  }
+  if (enc_data64 == NULL &&
+      (ski->enc_data == NULL || ski->enc_data_size != enc_data_size))
+  {
+    kmyth_log(LOG_ERR, "encrypted data does not match its chunk index "
+              "... exiting");
+    return 1;
+  }
+  if (length == 0 || offset > ski->chunked_data_len ||
+      length > ski->chunked_data_len - offset)
+  {
+    kmyth_log(LOG_ERR, "range (%zu bytes at offset %zu) not within sealed "
+              "data (%zu bytes) ... exiting", length, offset,
+              ski->chunked_data_len);
+    return 1;
+  }
+
+  kmyth_chunk_work work = {
+    .ski = ski,
+    .key = key,
+    .key_len = key_len,
+    .input = enc_data64,
+    .input_size = enc_data64_size,
+    .enc_data_size = enc_data_size,
+    .record_size = GCM_IV_LEN + ski->chunk_size + GCM_TAG_LEN,
+    .offset = offset,
+    .length = length,
+    .first_chunk = offset / ski->chunk_size,
+    .output = output,
+  };
+
+  // each chunk's plaintext has a fixed place in the output, so the chunks
+  // can be decrypted in any order
+  size_t last_chunk = (offset + length - 1) / ski->chunk_size;
+
+  return kmyth_parallel_for(last_chunk - work.first_chunk + 1, jobs,
+                            kmyth_decrypt_chunk, &work);
+}
+
+//############################################################################
+// kmyth_decrypt_ski_enc_data()
+//############################################################################
+static int kmyth_decrypt_ski_enc_data(Ski * ski, uint8_t * key,
+                                      size_t key_len,
+                                      uint8_t ** output, size_t *output_len)
+{
+  if (ski->cipher.decrypt_in_place_fn == NULL)
+  {
+    return kmyth_decrypt_data((unsigned char *) ski->enc_data,
+                              ski->enc_data_size, ski->cipher,
+                              (unsigned char *) key, key_len,
+                              output, output_len);
+  }
+
+  // decrypt the (decoded) data in the Ski itself, rather than into a
+  // second buffer of the same size, and hand that buffer to the caller
+  if (kmyth_decrypt_data_in_place((unsigned char *) ski->enc_data,
+                                  ski->enc_data_size, ski->cipher,
+                                  (unsigned char *) key, key_len,
+                                  output_len))
+  {
+    return 1;
+  }
+
+  *output = ski->enc_data;
+  ski->enc_data = NULL;
+  ski->enc_data_size = 0;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_decrypt_ski_data()
+//############################################################################
+static int kmyth_decrypt_ski_data(Ski * ski, uint8_t * key, size_t key_len,
+                                  size_t jobs,
+                                  uint8_t ** output, size_t *output_len)
+{
+  if (ski->chunk_size == 0 && ski->compression == KMYTH_COMPRESSION_NONE)
+  {
+    return kmyth_decrypt_ski_enc_data(ski, key, key_len, output, output_len);
+  }
+
+  // compressed data (never chunked) - decrypt, then decompress it
+  if (ski->chunk_size == 0)
+  {
+    uint8_t *compressed = NULL;
+    size_t compressed_len = 0;
+
+    if (kmyth_decrypt_ski_enc_data(ski, key, key_len,
+                                   &compressed, &compressed_len))
+    {
+      return 1;
+    }
+
+    int retval = kmyth_decompress_data(ski->compression,
+                                       compressed, compressed_len,
+                                       output, output_len);
+
+    if (retval)
+    {
+      kmyth_log(LOG_ERR, "unable to decompress data ... exiting");
+    }
+    kmyth_clear_and_free(compressed, compressed_len);
+
+    return retval;
+  }
+
+  // chunked data - decrypt every chunk
+  uint8_t *out = malloc(ski->chunked_data_len);
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error (%zu bytes) ... exiting",
+              ski->chunked_data_len);
+    return 1;
+  }
+  if (kmyth_decrypt_chunks(ski, key, key_len, NULL, 0,
+                           0, ski->chunked_data_len, out, jobs))
+  {
+    kmyth_clear_and_free(out, ski->chunked_data_len);
+    return 1;
+  }
+
+  *output = out;
+  *output_len = ski->chunked_data_len;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_unseal_wrapping_key()
+//############################################################################
+static int kmyth_unseal_wrapping_key(kmyth_ctx_t * ctx,
+                                     Ski * ski,
+                                     uint8_t * auth_bytes,
+                                     size_t auth_bytes_len,
+                                     uint8_t * owner_auth_bytes,
+                                     size_t oa_bytes_len,
+                                     uint8_t ** key, size_t *key_len)
+{
+  if(oa_bytes_len > UINT16_MAX)
+  {
+    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
+    return 1;
+  }
+
+  // fail fast (before loading anything) if the PCRs have changed
+  kmyth_pcr_policy_cache pcr_policy = {.valid = false, };
+
+  if (kmyth_ctx_precheck_policy(ctx, ski, &pcr_policy))
+  {
+    return 1;
+  }
+
+  TSS2_SYS_CONTEXT *sapi_ctx = ctx->sapi_ctx;
+
+  // Create owner (storage) hierarchy authorization structure
+  // to provide password session authorization criteria for use of:
+  //   - Storage Root Key (SRK)
+  //   - Storage Primary Seed (SPS), if necessary to re-derive SRK
+  TPM2B_AUTH ownerAuth;
+
+  ownerAuth.size = (uint16_t)oa_bytes_len;
+  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+  {
+    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+  }
+
+  if (ownerAuth.size > 0)
+  {
+    kmyth_log(LOG_DEBUG, "auth string for TPM storage hierarchy specified");
+  }
+  // Create authorization value (authVal) to provide policy session
+  // authorization criteria for use of:
+  //   - Storage Key (SK) TPM object
+  //   - Sealed Data (wrapping key) TPM object
+  // The authVal is set to:
+  //   - all-zero digest (like TPM 1.2 well-known secret) by default
+  //   - hash of input authorization string if one is specified
+  TPM2B_AUTH objAuthValue;
+
+  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthValue))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  // The Storage Key (SK) will be used by the TPM to unseal the wrapping key.
+  // If a persistent copy of it exists, that is used as-is. Otherwise, we
+  // have obtained its public and encrypted private blobs from the input
+  // .ski file and will now load the SK into the TPM (under the SRK).
+  TPM2_HANDLE storageKey_handle = kmyth_ctx_find_persistent_sk(ctx,
+                                                               &ski->sk_pub);
+  bool sk_persistent = (storageKey_handle != 0);
+
+  if (!sk_persistent)
+  {
+    // Get the storage root key (SRK) handle, re-using the one cached in
+    // the context if it has already been looked up
+    if (kmyth_ctx_get_srk_handle(ctx, &ownerAuth))
+    {
+      kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
+      kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+      kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+      return 1;
+    }
+    TPM2_HANDLE storageRootKey_handle = ctx->srk_handle;
+    TPML_PCR_SELECTION emptyPcrList = {.count = 0, };
+
+    if (!kmyth_ctx_srk_matches(ctx, ski))
+    {
+      kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+      kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+      return 1;
+    }
+
+    if (load_kmyth_object(sapi_ctx,
+                          (SESSION *) NULL,
+                          storageRootKey_handle,
+                          ownerAuth,
+                          emptyPcrList,
+                          &ski->sk_priv, &ski->sk_pub, &storageKey_handle,
+                          NULL))
+    {
+      kmyth_log(LOG_ERR, "error loading storage key ... exiting");
+      kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+      kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+      return 1;
+    }
+  }
+  kmyth_log(LOG_DEBUG, "%s SK at handle = 0x%08X",
+            sk_persistent ? "using persistent" : "loaded", storageKey_handle);
+
+  // Done with owner hierarchy authorization - SK loaded under the SRK
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+
+  // Authorization for the use of all non-primary (other than SRK), Kmyth
+  // TPM 2.0 objects utilizes policy-based enhanced authorization critera.
+  // Therefore, we will calculate the authorization policy digest that
+  // results from applying the steps of our selected authorization policy.
+  // We pass this result to the kmyth_unseal_data() function where it is
+  // used in theinto the objects we create as the
+  // authorization policy digest value that must be regenerated to authorize
+  // use of these objects.
+  TPM2B_DIGEST objAuthPolicy;
+
+  objAuthPolicy.size = 0;
+
+  // Perform "unseal" to recover data
+  if (tpm2_kmyth_unseal_data_ref(sapi_ctx,
+                                 storageKey_handle,
+                                 &ski->wk_pub,
+                                 &ski->wk_priv,
+                                 &objAuthValue,
+                                 &ski->pcr_list,
+                                 &objAuthPolicy,
+                                 &ski->policyBranch1,
+                                 &ski->policyBranch2,
+                                 key,
+                                 key_len,
+                                 NULL))
+  {
+    kmyth_log(LOG_ERR, "error unsealing data ... exiting");
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    if (!sk_persistent)
+    {
+      flush_kmyth_transient(sapi_ctx, storageKey_handle);
+    }
+    return 1;
+  }
+
+  // done with the authVal and the storage key
+  kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+  if (!sk_persistent)
+  {
+    flush_kmyth_transient(sapi_ctx, storageKey_handle);
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_unseal_ctx()
+//############################################################################
+static int kmyth_unseal_ctx(kmyth_ctx_t * ctx,
+                            uint8_t * input,
+                            size_t input_len,
+                            uint8_t ** output,
+                            size_t *output_len,
+                            uint8_t * auth_bytes,
+                            size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            uint8_t bool_policy_or)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+
+  if (parse_ski_bytes(input, input_len, &ski, bool_policy_or))
+  {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_INPUT);
+    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+  if (is_keyring_data(ski.enc_data, ski.enc_data_size))
+  {
+    kmyth_log(LOG_ERR, "keyring .ski must be opened as a keyring "
+              "(tpm2_kmyth_keyring_open()) ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  uint8_t *key = NULL;
+  size_t key_len = 0;
+
+  if (kmyth_unseal_wrapping_key(ctx, &ski,
+                                auth_bytes, auth_bytes_len,
+                                owner_auth_bytes, oa_bytes_len,
+                                &key, &key_len))
+  {
+    free_ski(&ski);
+    return 1;
+  }
+
+  uint64_t phase_start = get_timing_ns();
+  int decrypt_failed = kmyth_decrypt_ski_data(&ski, key, key_len,
+                                              ctx->jobs, output, output_len);
+
+  add_phase_timing(ctx->timings, KMYTH_PHASE_DECRYPT, phase_start);
+  if (decrypt_failed)
+  {
+    kmyth_log(LOG_ERR, "error decrypting data ... exiting");
+    free_ski(&ski);
+    kmyth_secure_free(key);
+    return 1;
+  }
+
+  // done, so free any allocated resources that remain
+  free_ski(&ski);
+  kmyth_secure_free(key);
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_ctx()
+//############################################################################
+int tpm2_kmyth_unseal_ctx(kmyth_ctx_t * ctx,
+                          uint8_t * input,
+                          size_t input_len,
+                          uint8_t ** output,
+                          size_t *output_len,
+                          uint8_t * auth_bytes,
+                          size_t auth_bytes_len,
+                          uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                          uint8_t bool_policy_or)
+{
+  kmyth_timings_t *timings = (ctx != NULL) ? ctx->timings : NULL;
+  kmyth_alloc_stats start;
+
+  start_alloc_timing(timings, &start);
+
+  uint64_t metrics_start = kmyth_metrics_op_begin();
+  int retval = kmyth_unseal_ctx(ctx, input, input_len, output, output_len,
+                                auth_bytes, auth_bytes_len, owner_auth_bytes,
+                                oa_bytes_len, bool_policy_or);
+
+  retval = ctx_call_result(ctx, retval);
+  kmyth_metrics_op_end(KMYTH_OP_UNSEAL, metrics_start, retval);
+  add_alloc_timing(timings, &start);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_ski_plaintext_size()
+//############################################################################
+static int kmyth_ski_plaintext_size(Ski * ski, size_t *size)
+{
+  if (ski->chunk_size != 0)
+  {
+    size_t chunk_count = 0;
+    size_t enc_data_size = 0;
+
+    if (kmyth_chunk_layout(ski, &chunk_count, &enc_data_size))
+    {
+      return 1;
+    }
+    *size = ski->chunked_data_len;
+    return 0;
+  }
+
+  // the decompressed size is only recorded within the encrypted data
+  if (ski->compression != KMYTH_COMPRESSION_NONE)
+  {
+    kmyth_log(LOG_ERR, "size of compressed data is not known until it is "
+              "unsealed ... exiting");
+    return 1;
+  }
+
+  // the cipher works this out from the encrypted data size alone (for a
+  // padded cipher, it is an upper bound on the plaintext size)
+  if (kmyth_decrypt_data_buf((unsigned char *) ski->enc_data,
+                             ski->enc_data_size, ski->cipher, NULL, 0,
+                             NULL, 0, size))
+  {
+    kmyth_log(LOG_ERR, "cipher (%s) cannot decrypt into a caller supplied "
+              "buffer ... exiting", ski->cipher.cipher_name);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_decompress_ski_data_into()
+//############################################################################
+static int kmyth_decompress_ski_data_into(Ski * ski, uint8_t * key,
+                                          size_t key_len, uint8_t * buf,
+                                          size_t cap, size_t *len)
+{
+  uint8_t *compressed = NULL;
+  size_t compressed_len = 0;
+  void *dstate = NULL;
+
+  *len = 0;
+  if (kmyth_decrypt_ski_enc_data(ski, key, key_len,
+                                 &compressed, &compressed_len))
+  {
+    return 1;
+  }
+  if (kmyth_decompress_stream_init(ski->compression, &dstate))
+  {
+    kmyth_log(LOG_ERR, "unable to set up decompression ... exiting");
+    kmyth_clear_and_free(compressed, compressed_len);
+    return 1;
+  }
+
+  // decompress straight into buf - once it is full, the rest is only
+  // counted (in scratch), so that a too small buffer reports the size
+  // it needed
+  uint8_t scratch[KMYTH_COMPRESSION_MIN_SIZE];
+  size_t used_len = 0;
+  size_t total = 0;
+  size_t out_len = 0;
+  size_t out_size = 0;
+  bool done = false;
+  int retval = 0;
+
+  do
+  {
+    uint8_t *out = (total < cap) ? buf + total : scratch;
+    size_t used = 0;
+
+    out_size = (total < cap) ? cap - total : sizeof(scratch);
+    if (kmyth_decompress_stream_update(dstate, compressed + used_len,
+                                       compressed_len - used_len, &used,
+                                       out, out_size, &out_len, &done))
+    {
+      kmyth_log(LOG_ERR, "error decompressing data ... exiting");
+      retval = 1;
+      break;
+    }
+    used_len += used;
+    total += out_len;
+  }
+  while (used_len < compressed_len || out_len == out_size);
+
+  kmyth_clear(scratch, sizeof(scratch));
+  kmyth_decompress_stream_free(dstate);
+  kmyth_clear_and_free(compressed, compressed_len);
+
+  if (retval == 0 && !done)
+  {
+    kmyth_log(LOG_ERR, "compressed data truncated ... exiting");
+    retval = 1;
+  }
+  if (retval == 0 && total > cap)
+  {
+    kmyth_log(LOG_ERR, "buffer too small for unsealed data (%zu bytes, "
+              "%zu needed) ... exiting", cap, total);
+    *len = total;
+    return 1;
+  }
+  if (retval == 0)
+  {
+    *len = total;
+  }
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_unseal_into_ctx()
+//############################################################################
+static int kmyth_unseal_into_ctx(kmyth_ctx_t * ctx,
+                                 uint8_t * input, size_t input_len,
+                                 uint8_t * buf, size_t cap, size_t *len,
+                                 uint8_t * auth_bytes, size_t auth_bytes_len,
+                                 uint8_t * owner_auth_bytes,
+                                 size_t oa_bytes_len, uint8_t bool_policy_or)
+{
+  if (len == NULL)
+  {
+    kmyth_log(LOG_ERR, "no unsealed data length output ... exiting");
+    return 1;
+  }
+  *len = 0;
+
+  // a size query does not need the TPM (or a context)
+  if (buf != NULL && (ctx == NULL || ctx->sapi_ctx == NULL))
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+
+  if (parse_ski_bytes(input, input_len, &ski, bool_policy_or))
+  {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_INPUT);
+    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+  if (is_keyring_data(ski.enc_data, ski.enc_data_size))
+  {
+    kmyth_log(LOG_ERR, "keyring .ski must be opened as a keyring "
+              "(tpm2_kmyth_keyring_open()) ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  // the size needed is known from the .ski alone (other than for
+  // compressed data), so a too small buffer is turned away before the
+  // wrapping key is unsealed
+  size_t needed = 0;
+
+  if (buf == NULL || ski.compression == KMYTH_COMPRESSION_NONE)
+  {
+    if (kmyth_ski_plaintext_size(&ski, &needed))
+    {
+      free_ski(&ski);
+      return 1;
+    }
+    if (buf == NULL || cap < needed)
+    {
+      if (buf != NULL)
+      {
+        kmyth_log(LOG_ERR, "buffer too small for unsealed data (%zu bytes, "
+                  "%zu needed) ... exiting", cap, needed);
+      }
+      *len = needed;
+      free_ski(&ski);
+      return (buf == NULL) ? 0 : 1;
+    }
+  }
+
+  uint8_t *key = NULL;
+  size_t key_len = 0;
+
+  if (kmyth_unseal_wrapping_key(ctx, &ski,
+                                auth_bytes, auth_bytes_len,
+                                owner_auth_bytes, oa_bytes_len,
+                                &key, &key_len))
+  {
+    free_ski(&ski);
+    return 1;
+  }
+
+  // the final decrypt (or decompression) writes into buf itself
+  uint64_t phase_start = get_timing_ns();
+  int decrypt_failed = 0;
+
+  if (ski.chunk_size != 0)
+  {
+    decrypt_failed = kmyth_decrypt_chunks(&ski, key, key_len, NULL, 0, 0,
+                                          ski.chunked_data_len, buf,
+                                          ctx->jobs);
+    *len = decrypt_failed ? 0 : ski.chunked_data_len;
+  }
+  else if (ski.compression == KMYTH_COMPRESSION_NONE)
+  {
+    decrypt_failed = kmyth_decrypt_data_buf((unsigned char *) ski.enc_data,
+                                            ski.enc_data_size, ski.cipher,
+                                            (unsigned char *) key, key_len,
+                                            buf, cap, len);
+    if (decrypt_failed)
+    {
+      *len = 0;
+    }
+  }
+  else
+  {
+    decrypt_failed = kmyth_decompress_ski_data_into(&ski, key, key_len,
+                                                    buf, cap, len);
+  }
+
+  add_phase_timing(ctx->timings, KMYTH_PHASE_DECRYPT, phase_start);
+  free_ski(&ski);
+  kmyth_secure_free(key);
+  if (decrypt_failed)
+  {
+    // leave nothing of a partial result behind
+    kmyth_clear(buf, cap);
+    kmyth_log(LOG_ERR, "error decrypting data ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_into_ctx()
+//############################################################################
+int tpm2_kmyth_unseal_into_ctx(kmyth_ctx_t * ctx,
+                               uint8_t * input, size_t input_len,
+                               uint8_t * buf, size_t cap, size_t *len,
+                               uint8_t * auth_bytes, size_t auth_bytes_len,
+                               uint8_t * owner_auth_bytes,
+                               size_t oa_bytes_len, uint8_t bool_policy_or)
+{
+  kmyth_timings_t *timings = (ctx != NULL) ? ctx->timings : NULL;
+  kmyth_alloc_stats start;
+
+  start_alloc_timing(timings, &start);
+
+  // a size query (buf == NULL) is not an unseal
+  uint64_t metrics_start = (buf != NULL) ? kmyth_metrics_op_begin() : 0;
+  int retval = kmyth_unseal_into_ctx(ctx, input, input_len, buf, cap, len,
+                                     auth_bytes, auth_bytes_len,
+                                     owner_auth_bytes, oa_bytes_len,
+                                     bool_policy_or);
+
+  retval = ctx_call_result(ctx, retval);
+  if (buf != NULL)
+  {
+    kmyth_metrics_op_end(KMYTH_OP_UNSEAL, metrics_start, retval);
+  }
+  add_alloc_timing(timings, &start);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_into()
+//############################################################################
+int tpm2_kmyth_unseal_into(uint8_t * input, size_t input_len,
+                           uint8_t * buf, size_t cap, size_t *len,
+                           uint8_t * auth_bytes, size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                           uint8_t bool_policy_or)
+{
+  if (oa_bytes_len > UINT16_MAX)
+  {
+    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
+    return 1;
+  }
+
+  // a size query is answered from the .ski alone
+  if (buf == NULL)
+  {
+    return tpm2_kmyth_unseal_into_ctx(NULL, input, input_len, NULL, 0, len,
+                                      auth_bytes, auth_bytes_len,
+                                      owner_auth_bytes, oa_bytes_len,
+                                      bool_policy_or);
+  }
+
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx))
+  {
+    return 1;
+  }
+
+  // (the unseal cache is not used - its copies would be exactly the extra
+  // plaintext buffers this function exists to avoid)
+  int retval = tpm2_kmyth_unseal_into_ctx(ctx, input, input_len,
+                                          buf, cap, len,
+                                          auth_bytes, auth_bytes_len,
+                                          owner_auth_bytes, oa_bytes_len,
+                                          bool_policy_or);
+
+  kmyth_ctx_destroy(&ctx);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_same_storage_key()
+//############################################################################
+static bool kmyth_same_storage_key(Ski * a, Ski * b)
+{
+  // the encrypted private blob differs for every storage key created,
+  // so it is the cheaper (and usually decisive) comparison
+  if (a->sk_priv.size != b->sk_priv.size ||
+      memcmp(a->sk_priv.buffer, b->sk_priv.buffer, a->sk_priv.size) != 0)
+  {
+    return false;
+  }
+
+  // compare the public areas in their packed (platform independent) form,
+  // as the unpacked structs may contain padding
+  uint8_t pub_a[sizeof(TPM2B_PUBLIC)] = { 0 };
+  uint8_t pub_b[sizeof(TPM2B_PUBLIC)] = { 0 };
+
+  if (pack_public(&(a->sk_pub), pub_a, sizeof(pub_a), 0) ||
+      pack_public(&(b->sk_pub), pub_b, sizeof(pub_b), 0))
+  {
+    return false;
+  }
+
+  return (memcmp(pub_a, pub_b, sizeof(pub_a)) == 0);
+}
+
+// Per-item state of a batch unseal, shared with the workers (each of which
+// only touches the items it is handed)
+typedef struct
+{
+  Ski *skis;
+  bool *pending;
+  uint8_t **inputs;
+  size_t *input_lens;
+  uint8_t **keys;
+  size_t *key_lens;
+  uint8_t **outputs;
+  size_t *output_lens;
+  int *results;
+  uint8_t bool_policy_or;
+} kmyth_unseal_batch_work;
+
+// A single batch unseal item, handed to host work run while the TPM is busy
+typedef struct
+{
+  kmyth_unseal_batch_work *work;
+  size_t index;
+} kmyth_unseal_batch_item;
+
+//############################################################################
+// kmyth_unseal_batch_parse()
+//############################################################################
+static int kmyth_unseal_batch_parse(size_t i, void *arg)
+{
+  kmyth_unseal_batch_work *work = (kmyth_unseal_batch_work *) arg;
+
+  init_default_ski(&work->skis[i]);
+  if (work->inputs[i] == NULL || work->input_lens[i] == 0 ||
+      parse_ski_bytes(work->inputs[i], work->input_lens[i], &work->skis[i],
+                      work->bool_policy_or))
+  {
+    kmyth_log(LOG_ERR, "error parsing ski string (batch item %zu)", i);
+    return 1;
+  }
+  work->pending[i] = true;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_unseal_batch_decrypt()
+//############################################################################
+static int kmyth_unseal_batch_decrypt(size_t i, void *arg)
+{
+  kmyth_unseal_batch_work *work = (kmyth_unseal_batch_work *) arg;
+
+  // an item already decrypted while the TPM was unsealing a later item
+  // has its result recorded, and its wrapping key cleared
+  if (work->keys[i] != NULL)
+  {
+    // the batch workers already run in parallel, so each item's chunks
+    // (if any) are decrypted by the worker handling the item
+    if (kmyth_decrypt_ski_data(&work->skis[i],
+                               work->keys[i], work->key_lens[i], 1,
+                               &work->outputs[i], &work->output_lens[i]))
+    {
+      kmyth_log(LOG_ERR, "error decrypting data (batch item %zu)", i);
+      work->outputs[i] = NULL;
+      work->output_lens[i] = 0;
+    }
+    else
+    {
+      work->results[i] = 0;
+    }
+    kmyth_secure_free(work->keys[i]);
+    work->keys[i] = NULL;
+  }
+
+  free_ski(&work->skis[i]);
+
+  return work->results[i];
+}
+
+//############################################################################
+// kmyth_unseal_batch_decrypt_item()
+//############################################################################
+static void kmyth_unseal_batch_decrypt_item(void *arg)
+{
+  kmyth_unseal_batch_item *item = (kmyth_unseal_batch_item *) arg;
+
+  kmyth_unseal_batch_decrypt(item->index, item->work);
+}
+
+//############################################################################
+// kmyth_unseal_batch_keys()
+//############################################################################
+static void kmyth_unseal_batch_keys(kmyth_ctx_t * ctx, size_t count,
+                                    kmyth_unseal_batch_work * work,
+                                    TPM2B_AUTH ownerAuth,
+                                    TPM2B_AUTH objAuthValue, bool decrypt)
+{
+  // Recovers the wrapping key of every parsed (pending) item, loading each
+  // distinct storage key once. With decrypt set, each item's data is also
+  // decrypted, overlapped with the TPM unsealing the next item.
+  TSS2_SYS_CONTEXT *sapi_ctx = ctx->sapi_ctx;
+  TPM2_HANDLE storageRootKey_handle = ctx->srk_handle;
+  Ski *skis = work->skis;
+  bool *pending = work->pending;
+  TPML_PCR_SELECTION emptyPcrList = {.count = 0, };
+  TPM2B_DIGEST objAuthPolicy = {.size = 0, };
+
+  // fail fast on the items whose PCRs have changed, so that no storage key
+  // is loaded for them (items usually share a PCR selection, so the PCRs
+  // are read just once)
+  kmyth_pcr_policy_cache pcr_policy = {.valid = false, };
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (pending[i] && kmyth_ctx_precheck_policy(ctx, &skis[i], &pcr_policy))
+    {
+      kmyth_log(LOG_ERR, "policy precheck failed (batch item %zu)", i);
+      pending[i] = false;
+    }
+  }
+
+  // Unseal the wrapping keys - the TPM commands are issued one at a time,
+  // in order, over the context's connection. While the TPM works on them,
+  // the data of the previously unsealed item can be decrypted.
+  kmyth_unseal_batch_item prev = {.work = work, .index = count };
+  HOST_WORK host_work = {.fn = NULL, .arg = &prev };
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (!pending[i])
+    {
+      continue;
+    }
+
+    // load the storage key for this group once (unless it is persistent)
+    TPM2_HANDLE storageKey_handle =
+      kmyth_ctx_find_persistent_sk(ctx, &skis[i].sk_pub);
+    bool sk_persistent = (storageKey_handle != 0);
+
+    if (sk_persistent)
+    {
+      kmyth_log(LOG_DEBUG, "using persistent SK at handle = 0x%08X",
+                storageKey_handle);
+    }
+    else if (!kmyth_ctx_srk_matches(ctx, &skis[i]))
+    {
+      kmyth_log(LOG_ERR, "wrong TPM for storage key (batch item %zu)", i);
+      storageKey_handle = 0;
+    }
+    else if (load_kmyth_object(sapi_ctx,
+                          (SESSION *) NULL,
+                          storageRootKey_handle,
+                          ownerAuth,
+                          emptyPcrList,
+                          &skis[i].sk_priv, &skis[i].sk_pub,
+                          &storageKey_handle, &host_work))
+    {
+      kmyth_log(LOG_ERR, "error loading storage key (batch item %zu)", i);
+      storageKey_handle = 0;
+    }
+    else
+    {
+      kmyth_log(LOG_DEBUG, "loaded SK at handle = 0x%08X", storageKey_handle);
+    }
+
+    // unseal every remaining item sealed under the same storage key
+    for (size_t j = i; j < count; j++)
+    {
+      if (!pending[j] || (j != i && !kmyth_same_storage_key(&skis[i],
+                                                            &skis[j])))
+      {
+        continue;
+      }
+      pending[j] = false;
+
+      if (storageKey_handle == 0)
+      {
+        continue;
+      }
+
+      if (tpm2_kmyth_unseal_data_ref(sapi_ctx,
+                                     storageKey_handle,
+                                     &skis[j].wk_pub,
+                                     &skis[j].wk_priv,
+                                     &objAuthValue,
+                                     &skis[j].pcr_list,
+                                     &objAuthPolicy,
+                                     &skis[j].policyBranch1,
+                                     &skis[j].policyBranch2,
+                                     &work->keys[j],
+                                     &work->key_lens[j],
+                                     &host_work))
+      {
+        kmyth_log(LOG_ERR, "error unsealing data (batch item %zu)", j);
+        kmyth_secure_free(work->keys[j]);
+        work->keys[j] = NULL;
+        work->key_lens[j] = 0;
+      }
+
+      // the previous item is decrypted even if no TPM command ran
+      finish_host_work(&host_work);
+      if (decrypt && work->keys[j] != NULL)
+      {
+        prev.index = j;
+        host_work.fn = kmyth_unseal_batch_decrypt_item;
+      }
+    }
+
+    if (!sk_persistent)
+    {
+      flush_kmyth_transient(sapi_ctx, storageKey_handle);
+    }
+  }
+  finish_host_work(&host_work);
+}
+
+//############################################################################
+// kmyth_unseal_batch()
+//############################################################################
+static int kmyth_unseal_batch(kmyth_ctx_t * ctx, size_t count,
+                              uint8_t ** inputs, size_t *input_lens,
+                              uint8_t ** outputs, size_t *output_lens,
+                              int *results,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                              uint8_t bool_policy_or)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+
+  if (count == 0 || inputs == NULL || input_lens == NULL ||
+      outputs == NULL || output_lens == NULL || results == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid batch parameters ... exiting");
+    return 1;
+  }
+
+  if (oa_bytes_len > UINT16_MAX)
+  {
+    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
+    return 1;
+  }
+
+  // every item starts out failed, and is only marked successful once its
+  // data has actually been recovered
+  for (size_t i = 0; i < count; i++)
+  {
+    outputs[i] = NULL;
+    output_lens[i] = 0;
+    results[i] = 1;
+  }
+
+  // Create owner (storage) hierarchy authorization structure
+  TPM2B_AUTH ownerAuth;
+
+  ownerAuth.size = (uint16_t) oa_bytes_len;
+  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+  {
+    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+  }
+
+  // Create authorization value (authVal), shared by all items in the batch
+  TPM2B_AUTH objAuthValue;
+
+  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthValue))
+  {
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  if (kmyth_ctx_get_srk_handle(ctx, &ownerAuth))
+  {
+    kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  // Parse all of the inputs up front (spread over the context's workers),
+  // so that they can be grouped by the storage key they were sealed under
+  kmyth_unseal_batch_work work = {
+    .skis = calloc(count, sizeof(Ski)),
+    .pending = calloc(count, sizeof(bool)),
+    .inputs = inputs,
+    .input_lens = input_lens,
+    .keys = calloc(count, sizeof(uint8_t *)),
+    .key_lens = calloc(count, sizeof(size_t)),
+    .outputs = outputs,
+    .output_lens = output_lens,
+    .results = results,
+    .bool_policy_or = bool_policy_or
+  };
+
+  if (work.skis == NULL || work.pending == NULL ||
+      work.keys == NULL || work.key_lens == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate memory for batch ... exiting");
+    free(work.skis);
+    free(work.pending);
+    free(work.keys);
+    free(work.key_lens);
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+    return 1;
+  }
+
+  kmyth_parallel_for(count, ctx->jobs, kmyth_unseal_batch_parse, &work);
+
+  kmyth_unseal_batch_keys(ctx, count, &work, ownerAuth, objAuthValue, true);
+
+  // done with the TPM authorizations
+  kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+
+  // Decrypt the data of every item whose wrapping key was recovered, and
+  // that has not already been decrypted (and free all of the parsed
+  // inputs) - again spread over the workers
+  uint64_t phase_start = get_timing_ns();
+  int retval = kmyth_parallel_for(count, ctx->jobs,
+                                  kmyth_unseal_batch_decrypt, &work);
+
+  add_phase_timing(ctx->timings, KMYTH_PHASE_DECRYPT, phase_start);
+
+  free(work.skis);
+  free(work.pending);
+  free(work.keys);
+  free(work.key_lens);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_batch()
+//############################################################################
+int tpm2_kmyth_unseal_batch(kmyth_ctx_t * ctx, size_t count,
+                            uint8_t ** inputs, size_t *input_lens,
+                            uint8_t ** outputs, size_t *output_lens,
+                            int *results,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            uint8_t bool_policy_or)
+{
+  uint64_t metrics_start = kmyth_metrics_op_begin();
+  int retval = kmyth_unseal_batch(ctx, count, inputs, input_lens, outputs,
+                                  output_lens, results, auth_bytes,
+                                  auth_bytes_len, owner_auth_bytes,
+                                  oa_bytes_len, bool_policy_or);
+
+  retval = ctx_call_result(ctx, retval);
+  kmyth_metrics_op_end(KMYTH_OP_UNSEAL, metrics_start, retval);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_file()
+//############################################################################
+int tpm2_kmyth_seal_file(char *input_path,
+                         uint8_t ** output,
+                         size_t *output_len,
+                         uint8_t * auth_bytes,
+                         size_t auth_bytes_len,
+                         uint8_t * owner_auth_bytes,
+                         size_t oa_bytes_len,
+                         int *pcrs, size_t pcrs_len, char *cipher_string,
+                         char *expected_policy, uint8_t bool_trial_only)
+{
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx))
+  {
+    return 1;
+  }
+
+  int retval = tpm2_kmyth_seal_file_ctx(ctx, input_path,
+                                        output, output_len,
+                                        auth_bytes, auth_bytes_len,
+                                        owner_auth_bytes, oa_bytes_len,
+                                        pcrs, pcrs_len, cipher_string,
+                                        expected_policy, bool_trial_only);
+
+  kmyth_ctx_destroy(&ctx);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_file_ctx()
+//############################################################################
+int tpm2_kmyth_seal_file_ctx(kmyth_ctx_t * ctx,
+                             char *input_path,
+                             uint8_t ** output,
+                             size_t *output_len,
+                             uint8_t * auth_bytes,
+                             size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes,
+                             size_t oa_bytes_len,
+                             int *pcrs, size_t pcrs_len, char *cipher_string,
+                             char *expected_policy, uint8_t bool_trial_only)
+{
+
+  // Verify input path exists with read permissions
+  if (verifyInputFilePath(input_path))
+  {
+    kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting", input_path);
+    return 1;
+  }
+
+  // the (read-only) file contents are encrypted straight from the mapping
+  uint8_t *data = NULL;
+  size_t data_len = 0;
+  bool data_mapped = false;
+
+  if (map_bytes_from_file(input_path, &data, &data_len, &data_mapped))
+  {
+    kmyth_log(LOG_ERR, "seal input data file read error ... exiting");
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "read in %zu bytes of data to be wrapped", data_len);
+
+  // validate non-empty plaintext buffer specified
+  if (data_len == 0 || data == NULL)
+  {
+    kmyth_log(LOG_ERR, "no input data ... exiting");
+    unmap_bytes_from_file(data, data_len, data_mapped);
+    return 1;
+  }
+
+  // a trial (policy only) seal has no data to chunk
+  int retval = (ctx != NULL && ctx->chunk_size != 0 && !bool_trial_only) ?
+    tpm2_kmyth_seal_chunked(ctx, data, data_len, ctx->chunk_size,
+                            output, output_len,
+                            auth_bytes, auth_bytes_len,
+                            owner_auth_bytes, oa_bytes_len,
+                            pcrs, pcrs_len, cipher_string, expected_policy) :
+    tpm2_kmyth_seal_ctx(ctx, data, data_len,
+                        output, output_len,
+                        auth_bytes, auth_bytes_len,
+                        owner_auth_bytes, oa_bytes_len,
+                        pcrs, pcrs_len, cipher_string, expected_policy,
+                        bool_trial_only);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "Failed to kmyth-seal data ... exiting");
+    unmap_bytes_from_file(data, data_len, data_mapped);
+    return ctx_call_result(ctx, retval);
+  }
+  unmap_bytes_from_file(data, data_len, data_mapped);
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_file()
+//############################################################################
+int tpm2_kmyth_unseal_file(char *input_path,
+                           uint8_t ** output,
+                           size_t *output_length,
+                           uint8_t * auth_bytes,
+                           size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                           uint8_t bool_policy_or)
+{
+  kmyth_ctx_t *ctx = NULL;
+
+  if (kmyth_ctx_create(&ctx))
+  {
+    return 1;
+  }
+
+  int retval = tpm2_kmyth_unseal_file_ctx(ctx, input_path,
+                                          output, output_length,
+                                          auth_bytes, auth_bytes_len,
+                                          owner_auth_bytes, oa_bytes_len,
+                                          bool_policy_or);
+
+  kmyth_ctx_destroy(&ctx);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_get_ski_pcrs()
+//############################################################################
+int kmyth_get_ski_pcrs(uint8_t * ski_bytes, size_t ski_bytes_len,
+                       int **pcrs, size_t *pcrs_len)
+{
+  if (ski_bytes == NULL || pcrs == NULL || pcrs_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid .ski PCR query ... exiting");
+    return 1;
+  }
+  *pcrs = NULL;
+  *pcrs_len = 0;
+
+  Ski ski = get_default_ski();
+
+  if (parse_ski_metadata(ski_bytes, ski_bytes_len, &ski, NULL))
+  {
+    kmyth_log(LOG_ERR, "unable to parse .ski header ... exiting");
+    return 1;
+  }
+
+  // (data is only ever sealed to PCRs of one bank - see
+  // init_pcr_selection())
+  TPMS_PCR_SELECTION *selection = &ski.pcr_list.pcrSelections[0];
+  size_t max_pcrs = (ski.pcr_list.count == 0) ? 0 :
+    8 * (size_t) selection->sizeofSelect;
+  int *list = (max_pcrs == 0) ? NULL : malloc(max_pcrs * sizeof(int));
+  size_t count = 0;
+
+  if (max_pcrs > 0 && list == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate PCR list ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+  for (size_t pcr = 0; pcr < max_pcrs; pcr++)
+  {
+    if (selection->pcrSelect[pcr / 8] & (1 << (pcr % 8)))
+    {
+      list[count++] = (int) pcr;
+    }
+  }
+  free_ski(&ski);
+
+  if (count == 0)
+  {
+    free(list);
+    list = NULL;
+  }
+  *pcrs = list;
+  *pcrs_len = count;
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_file_ctx()
+//############################################################################
+int tpm2_kmyth_unseal_file_ctx(kmyth_ctx_t * ctx,
+                               char *input_path,
+                               uint8_t ** output,
+                               size_t *output_length,
+                               uint8_t * auth_bytes,
+                               size_t auth_bytes_len,
+                               uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                               uint8_t bool_policy_or)
+{
+  kmyth_span_t span;
+
+  kmyth_span_start(&span, "tpm2_kmyth_unseal_file");
+  if (input_path != NULL)
+  {
+    kmyth_span_set_str(&span, "kmyth.input_path", input_path,
+                       strlen(input_path));
+  }
+
+  // the .ski is parsed straight from the (read-only) file mapping
+  uint8_t *data = NULL;
+  size_t data_length = 0;
+  bool data_mapped = false;
+
+  if (map_bytes_from_file(input_path, &data, &data_length, &data_mapped))
+  {
+    kmyth_log(LOG_ERR, "Unable to read file %s ... exiting", input_path);
+    kmyth_span_end(&span, 1);
+    return (1);
+  }
+  kmyth_span_set_int(&span, "kmyth.ski_bytes", (int64_t) data_length);
+  int retval = tpm2_kmyth_unseal_ctx(ctx, data, data_length,
+                                     output, output_length,
+                                     auth_bytes, auth_bytes_len,
+                                     owner_auth_bytes, oa_bytes_len,
+                                     bool_policy_or);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "Unable to unseal contents ... exiting");
+    unmap_bytes_from_file(data, data_length, data_mapped);
+    kmyth_span_end(&span, 1);
+    return retval;
+  }
+
+  unmap_bytes_from_file(data, data_length, data_mapped);
+  kmyth_span_set_int(&span, "kmyth.output_bytes", (int64_t) *output_length);
+  kmyth_span_end(&span, 0);
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_nv()
+//############################################################################
+int tpm2_kmyth_unseal_nv(kmyth_ctx_t * ctx,
+                         uint32_t nv_index,
+                         uint8_t ** output,
+                         size_t *output_length,
+                         uint8_t * auth_bytes,
+                         size_t auth_bytes_len,
+                         uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                         uint8_t bool_policy_or)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+
+  kmyth_span_t span;
+
+  kmyth_span_start(&span, "tpm2_kmyth_unseal_nv");
+  kmyth_span_set_int(&span, "kmyth.nv_index", (int64_t) nv_index);
+
+  uint8_t *data = NULL;
+  size_t data_length = 0;
+
+  if (kmyth_ctx_get_nv_limits(ctx)
+      || read_nv_index(ctx->sapi_ctx, nv_index, ctx->nv_buffer_max,
+                       &data, &data_length))
+  {
+    kmyth_log(LOG_ERR, "Unable to read NV index (0x%08X) ... exiting",
+              nv_index);
+    kmyth_span_end(&span, 1);
+    return (1);
+  }
+  kmyth_span_set_int(&span, "kmyth.ski_bytes", (int64_t) data_length);
+  if (tpm2_kmyth_unseal_ctx(ctx, data, data_length,
+                            output, output_length, auth_bytes, auth_bytes_len,
+                            owner_auth_bytes, oa_bytes_len, bool_policy_or))
+  {
+    kmyth_log(LOG_ERR, "Unable to unseal contents ... exiting");
+    free(data);
+    kmyth_span_end(&span, 1);
+    return (1);
+  }
+
+  free(data);
+  kmyth_span_set_int(&span, "kmyth.output_bytes", (int64_t) *output_length);
+  kmyth_span_end(&span, 0);
+  return 0;
+}
+
+//############################################################################
+// kmyth_abandon_stream()
+//############################################################################
+static void kmyth_abandon_stream(cipher_t cipher, void *state)
+{
+  // the cipher's final call must always be made, as it releases the state
+  unsigned char discard[KMYTH_CIPHER_STREAM_MAX_OVERHEAD];
+  size_t discard_len = 0;
+
+  cipher.stream_final_fn(state, discard, &discard_len);
+  kmyth_clear(discard, sizeof(discard));
+}
+
+//############################################################################
+// kmyth_encrypt_stream_piece()
+//############################################################################
+static int kmyth_encrypt_stream_piece(cipher_t cipher, void *state,
+                                      uint8_t * piece, size_t piece_len,
+                                      uint8_t * enc, uint8_t * b64,
+                                      EVP_ENCODE_CTX * b64_ctx, int out_fd)
+{
+  // enc and b64 are sized for a piece of up to KMYTH_STREAM_BLOCK_SIZE
+  // bytes (see kmyth_encrypt_stream_to_fd())
+  size_t enc_len = 0;
+  int b64_len = 0;
+
+  if (cipher.stream_update_fn(state, piece, piece_len, enc, &enc_len))
+  {
+    kmyth_log(LOG_ERR, "unable to encrypt (wrap) data ... exiting");
+    return 1;
+  }
+  kmyth_metrics_count_cipher_bytes(cipher.cipher_name, true, piece_len);
+
+  if (enc_len > 0
+      && (!EVP_EncodeUpdate(b64_ctx, b64, &b64_len, enc, (int) enc_len)
+          || write_to_fd(out_fd, b64, (size_t) b64_len)))
+  {
+    kmyth_log(LOG_ERR, "error writing encrypted data ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_compress_stream_piece()
+//############################################################################
+static int kmyth_compress_stream_piece(cipher_t cipher, void *state,
+                                       void *cstate,
+                                       uint8_t * piece, size_t piece_len,
+                                       bool end, uint8_t * comp,
+                                       uint8_t * enc, uint8_t * b64,
+                                       EVP_ENCODE_CTX * b64_ctx, int out_fd)
+{
+  // the piece is compressed into comp (KMYTH_STREAM_BLOCK_SIZE bytes), and
+  // each comp-full is encrypted and written out - at the end of the stream,
+  // until the compressor has nothing more to flush
+  size_t used_len = 0;
+  bool done = false;
+
+  do
+  {
+    size_t used = 0;
+    size_t comp_len = 0;
+
+    if (kmyth_compress_stream_update(cstate, piece + used_len,
+                                     piece_len - used_len, &used, end,
+                                     comp, KMYTH_STREAM_BLOCK_SIZE,
+                                     &comp_len, &done))
+    {
+      kmyth_log(LOG_ERR, "unable to compress data ... exiting");
+      return 1;
+    }
+    used_len += used;
+
+    if (comp_len > 0 &&
+        kmyth_encrypt_stream_piece(cipher, state, comp, comp_len,
+                                   enc, b64, b64_ctx, out_fd))
+    {
+      return 1;
+    }
+  }
+  while (used_len < piece_len || (end && !done));
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_encrypt_stream_to_fd()
+//############################################################################
+static int kmyth_encrypt_stream_to_fd(cipher_t cipher, void *state,
+                                      void *cstate,
+                                      uint8_t * block, size_t block_len,
+                                      int in_fd, int out_fd)
+{
+  // The block buffer (KMYTH_STREAM_BLOCK_SIZE bytes) holds the first block
+  // of input on entry, and is re-filled from in_fd until end-of-file. Each
+  // block is (if cstate is set) compressed, encrypted, then base64 encoded
+  // (as 64 character lines, just as by encodeBase64Data()) and written out:
+  //   - compressed data is encrypted in pieces of at most a block
+  //   - a cipher update call adds at most KMYTH_CIPHER_STREAM_MAX_OVERHEAD
+  //     bytes to its input
+  //   - each 48 bytes (plus any left pending from the last call) produce
+  //     a 64 character line and its newline, then a string terminator
+  size_t enc_size = KMYTH_STREAM_BLOCK_SIZE + KMYTH_CIPHER_STREAM_MAX_OVERHEAD;
+  size_t b64_size = ((enc_size / 48) + 2) * 65 + 1;
+  size_t comp_size = (cstate != NULL) ? KMYTH_STREAM_BLOCK_SIZE : 0;
+  uint8_t *enc = malloc(enc_size);
+  uint8_t *b64 = malloc(b64_size);
+  uint8_t *comp = (cstate != NULL) ? malloc(comp_size) : NULL;
+  EVP_ENCODE_CTX *b64_ctx = EVP_ENCODE_CTX_new();
+
+  if (enc == NULL || b64 == NULL || b64_ctx == NULL ||
+      (cstate != NULL && comp == NULL))
+  {
+    kmyth_log(LOG_ERR, "unable to allocate stream buffers ... exiting");
+    kmyth_abandon_stream(cipher, state);
+    free(enc);
+    free(b64);
+    free(comp);
+    EVP_ENCODE_CTX_free(b64_ctx);
+    return 1;
+  }
+  EVP_EncodeInit(b64_ctx);
+
+  size_t enc_len = 0;
+  int b64_len = 0;
+  size_t total_len = 0;
+  int retval = 0;
+
+  while (retval == 0 && block_len > 0)
+  {
+    if (cstate != NULL)
+    {
+      retval = kmyth_compress_stream_piece(cipher, state, cstate,
+                                           block, block_len, false, comp,
+                                           enc, b64, b64_ctx, out_fd);
+    }
+    else
+    {
+      retval = kmyth_encrypt_stream_piece(cipher, state, block, block_len,
+                                          enc, b64, b64_ctx, out_fd);
+    }
+    total_len += block_len;
+
+    if (retval == 0 &&
+        read_from_fd(in_fd, block, KMYTH_STREAM_BLOCK_SIZE, &block_len))
+    {
+      kmyth_log(LOG_ERR, "seal input data read error ... exiting");
+      retval = 1;
+    }
+  }
+
+  // whatever the compressor still holds completes the (compressed) data
+  if (retval == 0 && cstate != NULL)
+  {
+    retval = kmyth_compress_stream_piece(cipher, state, cstate,
+                                         block, 0, true, comp,
+                                         enc, b64, b64_ctx, out_fd);
+  }
+  kmyth_clear_and_free(comp, comp_size);
+
+  if (retval)
+  {
+    kmyth_abandon_stream(cipher, state);
+    kmyth_clear_and_free(enc, enc_size);
+    free(b64);
+    EVP_ENCODE_CTX_free(b64_ctx);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "wrapped %lu bytes of input data", total_len);
+
+  // the final cipher output (e.g., the AES/GCM tag) completes the data,
+  // which is then terminated by the end of file delimiter
+  if (cipher.stream_final_fn(state, enc, &enc_len))
+  {
+    kmyth_log(LOG_ERR, "unable to encrypt (wrap) data ... exiting");
+    kmyth_clear_and_free(enc, enc_size);
+    free(b64);
+    EVP_ENCODE_CTX_free(b64_ctx);
+    return 1;
+  }
+
+  if (enc_len > 0
+      && (!EVP_EncodeUpdate(b64_ctx, b64, &b64_len, enc, (int) enc_len)
+          || write_to_fd(out_fd, b64, (size_t) b64_len)))
+  {
+    retval = 1;
+  }
+  if (retval == 0)
+  {
+    EVP_EncodeFinal(b64_ctx, b64, &b64_len);
+    if (write_to_fd(out_fd, b64, (size_t) b64_len)
+        || write_to_fd(out_fd, (uint8_t *) KMYTH_DELIM_END_FILE,
+                       strlen(KMYTH_DELIM_END_FILE)))
+    {
+      retval = 1;
+    }
+  }
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "error writing encrypted data ... exiting");
+  }
+
+  kmyth_clear_and_free(enc, enc_size);
+  free(b64);
+  EVP_ENCODE_CTX_free(b64_ctx);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_write_stream_output()
+//############################################################################
+static int kmyth_write_stream_output(void *dstate,
+                                     uint8_t * data, size_t data_len,
+                                     uint8_t * dbuf, int out_fd, bool *done)
+{
+  // decrypted data is written out as it is, or (if dstate is set)
+  // decompressed into dbuf (KMYTH_STREAM_BLOCK_SIZE bytes) and written out
+  // a dbuf-full at a time, until the decompressor has nothing more to give
+  if (dstate == NULL)
+  {
+    if (write_to_fd(out_fd, data, data_len))
+    {
+      kmyth_log(LOG_ERR, "error writing unsealed data ... exiting");
+      return 1;
+    }
+    return 0;
+  }
+
+  size_t used_len = 0;
+  size_t dbuf_len = 0;
+
+  do
+  {
+    size_t used = 0;
+
+    if (kmyth_decompress_stream_update(dstate, data + used_len,
+                                       data_len - used_len, &used,
+                                       dbuf, KMYTH_STREAM_BLOCK_SIZE,
+                                       &dbuf_len, done))
+    {
+      kmyth_log(LOG_ERR, "error decompressing data ... exiting");
+      return 1;
+    }
+    used_len += used;
+
+    if (write_to_fd(out_fd, dbuf, dbuf_len))
+    {
+      kmyth_log(LOG_ERR, "error writing unsealed data ... exiting");
+      return 1;
+    }
+  }
+  while (used_len < data_len || dbuf_len == KMYTH_STREAM_BLOCK_SIZE);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_decrypt_stream_from_fd()
+//############################################################################
+static int kmyth_decrypt_stream_from_fd(cipher_t cipher, void *state,
+                                        void *dstate,
+                                        uint8_t * block, size_t block_len,
+                                        int in_fd, int out_fd)
+{
+  // The block buffer (KMYTH_STREAM_BLOCK_SIZE bytes) holds whatever follows
+  // the encrypted data delimiter in the first block of input on entry, and
+  // is re-filled from in_fd until end-of-file. The base64 encoded data is
+  // decoded, decrypted, (if dstate is set) decompressed, and written out
+  // one block at a time:
+  //   - base64 decoding may also release up to 64 characters held over
+  //     from the previous block
+  //   - a cipher update call adds at most KMYTH_CIPHER_STREAM_MAX_OVERHEAD
+  //     bytes to its input
+  //
+  // '-' is not a base64 character, so the first one found marks the start
+  // of the end of file delimiter, which must be all that remains.
+  size_t dec_size = KMYTH_BASE64_DECODED_MAX(KMYTH_STREAM_BLOCK_SIZE + 64);
+  size_t out_size = dec_size + KMYTH_CIPHER_STREAM_MAX_OVERHEAD;
+  size_t dbuf_size = (dstate != NULL) ? KMYTH_STREAM_BLOCK_SIZE : 0;
+  uint8_t *dec = malloc(dec_size);
+  uint8_t *out = malloc(out_size);
+  uint8_t *dbuf = (dstate != NULL) ? malloc(dbuf_size) : NULL;
+  EVP_ENCODE_CTX *b64_ctx = EVP_ENCODE_CTX_new();
+  uint8_t trailer[sizeof(KMYTH_DELIM_END_FILE)];
+  size_t trailer_len = 0;
+  bool in_trailer = false;
+  bool done = (dstate == NULL);
+
+  if (dec == NULL || out == NULL || b64_ctx == NULL ||
+      (dstate != NULL && dbuf == NULL))
+  {
+    kmyth_log(LOG_ERR, "unable to allocate stream buffers ... exiting");
+    kmyth_abandon_stream(cipher, state);
+    free(dec);
+    free(out);
+    free(dbuf);
+    EVP_ENCODE_CTX_free(b64_ctx);
+    return 1;
+  }
+  EVP_DecodeInit(b64_ctx);
+
+  int dec_len = 0;
+  size_t out_len = 0;
+  size_t total_len = 0;
+  size_t plain_len = 0;
+  int retval = 0;
+
+  while (retval == 0)
+  {
+    size_t data_len = block_len;
+
+    if (in_trailer)
+    {
+      data_len = 0;
+    }
+    else
+    {
+      uint8_t *dash = memchr(block, '-', block_len);
+
+      if (dash != NULL)
+      {
+        data_len = (size_t) (dash - block);
+        in_trailer = true;
+      }
+    }
+
+    size_t tail_len = block_len - data_len;
+
+    if (trailer_len + tail_len > strlen(KMYTH_DELIM_END_FILE))
+    {
+      kmyth_log(LOG_ERR, "unexpected data after encrypted data ... exiting");
+      retval = 1;
+      break;
+    }
+    memcpy(trailer + trailer_len, block + data_len, tail_len);
+    trailer_len += tail_len;
+
+    if (data_len > 0)
+    {
+      if (EVP_DecodeUpdate(b64_ctx, dec, &dec_len, block, (int) data_len) < 0)
+      {
+        kmyth_log(LOG_ERR, "base64 decode error ... exiting");
+        retval = 1;
+        break;
+      }
+    }
+    else if (block_len == 0)
+    {
+      // end-of-file: release anything still held by the decoder
+      if (EVP_DecodeFinal(b64_ctx, dec, &dec_len) != 1)
+      {
+        kmyth_log(LOG_ERR, "base64 decode error ... exiting");
+        retval = 1;
+        break;
+      }
+    }
+    else
+    {
+      dec_len = 0;
+    }
+
+    if (dec_len > 0)
+    {
+      total_len += (size_t) dec_len;
+      if (cipher.stream_update_fn(state, dec, (size_t) dec_len,
+                                  out, &out_len))
+      {
+        kmyth_log(LOG_ERR, "error decrypting data ... exiting");
+        retval = 1;
+        break;
+      }
+      plain_len += out_len;
+      if (kmyth_write_stream_output(dstate, out, out_len, dbuf, out_fd,
+                                    &done))
+      {
+        retval = 1;
+        break;
+      }
+    }
+
+    if (block_len == 0)
+    {
+      break;
+    }
+    if (read_from_fd(in_fd, block, KMYTH_STREAM_BLOCK_SIZE, &block_len))
+    {
+      kmyth_log(LOG_ERR, "unseal input data read error ... exiting");
+      retval = 1;
+    }
+  }
+
+  if (retval == 0 &&
+      (trailer_len != strlen(KMYTH_DELIM_END_FILE) ||
+       memcmp(trailer, KMYTH_DELIM_END_FILE, trailer_len)))
+  {
+    kmyth_log(LOG_ERR, "unable to find the end delimiter ... exiting");
+    retval = 1;
+  }
+  if (retval == 0 && total_len == 0)
+  {
+    kmyth_log(LOG_ERR, "no encrypted data ... exiting");
+    retval = 1;
+  }
+
+  if (retval)
+  {
+    kmyth_abandon_stream(cipher, state);
+  }
+  else if (cipher.stream_final_fn(state, out, &out_len))
+  {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_CIPHER);
+    kmyth_log(LOG_ERR, "error decrypting data (integrity check failed, "
+              "discard output) ... exiting");
+    retval = 1;
+  }
+  else if (kmyth_write_stream_output(dstate, out, out_len, dbuf, out_fd,
+                                     &done))
+  {
+    retval = 1;
+  }
+  else if (!done)
+  {
+    kmyth_log(LOG_ERR, "truncated compressed data ... exiting");
+    retval = 1;
+  }
+  if (retval == 0)
+  {
+    kmyth_metrics_count_cipher_bytes(cipher.cipher_name, false,
+                                     plain_len + out_len);
+  }
+
+  kmyth_clear_and_free(dec, dec_size);
+  kmyth_clear_and_free(out, out_size);
+  kmyth_clear_and_free(dbuf, dbuf_size);
+  EVP_ENCODE_CTX_free(b64_ctx);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_seal_stream()
+//############################################################################
+static int kmyth_seal_stream(kmyth_ctx_t * ctx, int in_fd, int out_fd,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             int *pcrs, size_t pcrs_len,
+                             char *cipher_string, char *expected_policy)
+{
+  // only ciphers with an incremental (init/update/final) interface can be
+  // used (an invalid cipher string is reported by kmyth_seal_setup())
+  cipher_t cipher = kmyth_get_cipher_t_from_string((cipher_string == NULL) ?
+                                                   KMYTH_DEFAULT_CIPHER :
+                                                   cipher_string);
+
+  if (cipher.cipher_name != NULL && cipher.stream_init_fn == NULL)
+  {
+    kmyth_log(LOG_ERR, "cipher (%s) does not support streaming ... exiting",
+              cipher.cipher_name);
+    return 1;
+  }
+
+  // the binary .ski format is written in one piece (its record lengths
+  // precede the data), so it cannot be streamed
+  if (ctx != NULL && ctx->ski_format != KMYTH_SKI_FORMAT_TEXT)
+  {
+    kmyth_log(LOG_ERR, "only text format .ski output can be streamed "
+              "... exiting");
+    return 1;
+  }
+
+  // read the first block of input before doing any TPM work, so that empty
+  // input is rejected up front
+  uint8_t *block = malloc(KMYTH_STREAM_BLOCK_SIZE);
+  size_t block_len = 0;
+
+  if (block == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate stream buffer ... exiting");
+    return 1;
+  }
+  if (read_from_fd(in_fd, block, KMYTH_STREAM_BLOCK_SIZE, &block_len))
+  {
+    kmyth_log(LOG_ERR, "seal input data read error ... exiting");
+    free(block);
+    return 1;
+  }
+  if (block_len == 0)
+  {
+    kmyth_log(LOG_ERR, "no input data ... exiting");
+    free(block);
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+  TPM2B_AUTH objAuthVal = {.size = 0, };
+  TPM2B_DIGEST objAuthPolicy = {.size = 0, };
+  TPM2_HANDLE storageKey_handle = 0;
+
+  if (kmyth_seal_setup(ctx, auth_bytes, auth_bytes_len,
+                       owner_auth_bytes, oa_bytes_len, pcrs, pcrs_len,
+                       cipher_string, expected_policy, 0,
+                       &ski, &objAuthVal, &objAuthPolicy, &storageKey_handle))
+  {
+    kmyth_clear_and_free(block, KMYTH_STREAM_BLOCK_SIZE);
+    return 1;
+  }
+
+  // Create the symmetric wrapping key and set up the streaming encryption
+  size_t wrapKey_size = get_key_len_from_cipher(ski.cipher) / 8;
+  unsigned char *wrapKey = calloc(wrapKey_size, sizeof(unsigned char));
+  void *state = NULL;
+
+  if (wrapKey == NULL ||
+      kmyth_encrypt_stream_init(ski.cipher, &wrapKey, &wrapKey_size, &state))
+  {
+    kmyth_log(LOG_ERR, "unable to set up data encryption ... exiting");
+    kmyth_clear_and_free(wrapKey, wrapKey_size);
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    flush_kmyth_transient(ctx->sapi_ctx, storageKey_handle);
+    kmyth_clear_and_free(block, KMYTH_STREAM_BLOCK_SIZE);
+    return 1;
+  }
+
+  // Seal the wrapping key to the TPM using the Storage Key (SK)
+  int retval = tpm2_kmyth_seal_data_ref(ctx->sapi_ctx,
+                                        NULL,
+                                        wrapKey,
+                                        wrapKey_size,
+                                        storageKey_handle,
+                                        &objAuthVal,
+                                        &ski.pcr_list,
+                                        &objAuthVal,
+                                        &ski.pcr_list,
+                                        &objAuthPolicy,
+                                        &ski.policyBranch1,
+                                        &ski.policyBranch2,
+                                        &ski.wk_pub,
+                                        &ski.wk_priv,
+                                        NULL);
+
+  // Clean-up: done with the unencrypted wrapping key (the streaming state
+  // holds what it needs), the authVal, and the storage key
+  kmyth_clear_and_free(wrapKey, wrapKey_size);
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+  flush_kmyth_transient(ctx->sapi_ctx, storageKey_handle);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to seal data ... exiting");
+    kmyth_abandon_stream(ski.cipher, state);
+    kmyth_clear_and_free(block, KMYTH_STREAM_BLOCK_SIZE);
+    return 1;
+  }
+
+  // The data is compressed if the context asks for it and the input is not
+  // small (a first block that is not full holds all of the input). Whether
+  // it actually compresses is not known until it has all been written out.
+  void *cstate = NULL;
+
+  if (ctx->compression != KMYTH_COMPRESSION_NONE &&
+      block_len >= KMYTH_COMPRESSION_MIN_SIZE)
+  {
+    if (kmyth_compress_stream_init(ctx->compression, &cstate))
+    {
+      kmyth_log(LOG_ERR, "unable to set up data compression ... exiting");
+      kmyth_abandon_stream(ski.cipher, state);
+      kmyth_clear_and_free(block, KMYTH_STREAM_BLOCK_SIZE);
+      return 1;
+    }
+    ski.compression = ctx->compression;
+  }
+
+  // everything but the encrypted data can now be written out
+  uint8_t *header = NULL;
+  size_t header_len = 0;
+
+  if (create_ski_header_bytes(ski, &header, &header_len)
+      || write_to_fd(out_fd, header, header_len))
+  {
+    kmyth_log(LOG_ERR, "error writing data to .ski format ... exiting");
+    free(header);
+    kmyth_compress_stream_free(cstate);
+    kmyth_abandon_stream(ski.cipher, state);
+    kmyth_clear_and_free(block, KMYTH_STREAM_BLOCK_SIZE);
+    return 1;
+  }
+  free(header);
+
+  // (for a stream, the encryption phase includes reading and writing it)
+  uint64_t phase_start = get_timing_ns();
+
+  retval = kmyth_encrypt_stream_to_fd(ski.cipher, state, cstate,
+                                      block, block_len, in_fd, out_fd);
+  add_phase_timing(ctx->timings, KMYTH_PHASE_ENCRYPT, phase_start);
+
+  kmyth_compress_stream_free(cstate);
+  kmyth_clear_and_free(block, KMYTH_STREAM_BLOCK_SIZE);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_stream()
+//############################################################################
+int tpm2_kmyth_seal_stream(kmyth_ctx_t * ctx, int in_fd, int out_fd,
+                           uint8_t * auth_bytes, size_t auth_bytes_len,
+                           uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                           int *pcrs, size_t pcrs_len,
+                           char *cipher_string, char *expected_policy)
+{
+  uint64_t metrics_start = kmyth_metrics_op_begin();
+  int retval = kmyth_seal_stream(ctx, in_fd, out_fd, auth_bytes,
+                                 auth_bytes_len, owner_auth_bytes,
+                                 oa_bytes_len, pcrs, pcrs_len, cipher_string,
+                                 expected_policy);
+
+  retval = ctx_call_result(ctx, retval);
+  kmyth_metrics_op_end(KMYTH_OP_SEAL, metrics_start, retval);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_unseal_stream()
+//############################################################################
+static int kmyth_unseal_stream(kmyth_ctx_t * ctx, int in_fd, int out_fd,
+                               uint8_t * auth_bytes, size_t auth_bytes_len,
+                               uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                               uint8_t bool_policy_or)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+
+  uint8_t *block = malloc(KMYTH_STREAM_BLOCK_SIZE);
+  size_t block_len = 0;
+
+  if (block == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate stream buffer ... exiting");
+    return 1;
+  }
+  if (read_from_fd(in_fd, block, KMYTH_STREAM_BLOCK_SIZE, &block_len))
+  {
+    kmyth_log(LOG_ERR, "unseal input data read error ... exiting");
+    free(block);
+    return 1;
+  }
+  if (is_binary_ski_bytes(block, block_len))
+  {
+    kmyth_log(LOG_ERR, "binary .ski input cannot be streamed ... exiting");
+    free(block);
+    return 1;
+  }
+
+  // everything preceding the encrypted data is small, and must be
+  // contained in the first block of input
+  uint8_t *enc_delim = memmem(block, block_len, KMYTH_DELIM_ENC_DATA,
+                              strlen(KMYTH_DELIM_ENC_DATA));
+
+  if (enc_delim == NULL)
+  {
+    kmyth_log(LOG_ERR, "encrypted data not found in the first %d bytes of "
+              "input ... exiting", KMYTH_STREAM_BLOCK_SIZE);
+    free(block);
+    return 1;
+  }
+  size_t header_len = (size_t) (enc_delim - block) +
+    strlen(KMYTH_DELIM_ENC_DATA);
+
+  Ski ski = get_default_ski();
+
+  if (parse_ski_header_bytes(block, header_len, &ski, bool_policy_or))
+  {
+    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
+    free(block);
+    return 1;
+  }
+
+  if (ski.cipher.stream_init_fn == NULL)
+  {
+    kmyth_log(LOG_ERR, "cipher (%s) does not support streaming ... exiting",
+              ski.cipher.cipher_name);
+    free(block);
+    return 1;
+  }
+  if (ski.chunk_size != 0)
+  {
+    kmyth_log(LOG_ERR, "chunked .ski input cannot be streamed ... exiting");
+    free(block);
+    return 1;
+  }
+
+  uint8_t *key = NULL;
+  size_t key_len = 0;
+
+  if (kmyth_unseal_wrapping_key(ctx, &ski,
+                                auth_bytes, auth_bytes_len,
+                                owner_auth_bytes, oa_bytes_len,
+                                &key, &key_len))
+  {
+    free(block);
+    return 1;
+  }
+
+  void *state = NULL;
+  void *dstate = NULL;
+
+  if (ski.compression != KMYTH_COMPRESSION_NONE &&
+      kmyth_decompress_stream_init(ski.compression, &dstate))
+  {
+    kmyth_log(LOG_ERR, "unable to set up data decompression ... exiting");
+    kmyth_secure_free(key);
+    free(block);
+    return 1;
+  }
+  if (kmyth_decrypt_stream_init(ski.cipher, key, key_len, &state))
+  {
+    kmyth_log(LOG_ERR, "unable to set up data decryption ... exiting");
+    kmyth_decompress_stream_free(dstate);
+    kmyth_secure_free(key);
+    free(block);
+    return 1;
+  }
+  kmyth_secure_free(key);
+
+  // what follows the header in the first block starts the encrypted data
+  block_len -= header_len;
+  memmove(block, block + header_len, block_len);
+
+  // (for a stream, the decryption phase includes reading and writing it)
+  uint64_t phase_start = get_timing_ns();
+  int retval = kmyth_decrypt_stream_from_fd(ski.cipher, state, dstate,
+                                            block, block_len,
+                                            in_fd, out_fd);
+
+  add_phase_timing(ctx->timings, KMYTH_PHASE_DECRYPT, phase_start);
+
+  kmyth_decompress_stream_free(dstate);
+  free(block);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_stream()
+//############################################################################
+int tpm2_kmyth_unseal_stream(kmyth_ctx_t * ctx, int in_fd, int out_fd,
+                             uint8_t * auth_bytes, size_t auth_bytes_len,
+                             uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                             uint8_t bool_policy_or)
+{
+  uint64_t metrics_start = kmyth_metrics_op_begin();
+  int retval = kmyth_unseal_stream(ctx, in_fd, out_fd, auth_bytes,
+                                   auth_bytes_len, owner_auth_bytes,
+                                   oa_bytes_len, bool_policy_or);
+
+  retval = ctx_call_result(ctx, retval);
+  kmyth_metrics_op_end(KMYTH_OP_UNSEAL, metrics_start, retval);
+
+  return retval;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_chunked()
+//############################################################################
+int tpm2_kmyth_seal_chunked(kmyth_ctx_t * ctx,
+                            uint8_t * input, size_t input_len,
+                            size_t chunk_size,
+                            uint8_t ** output, size_t *output_len,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            int *pcrs, size_t pcrs_len,
+                            char *cipher_string, char *expected_policy)
+{
+  if (input == NULL || input_len == 0)
+  {
+    kmyth_log(LOG_ERR, "no input data ... exiting");
+    return 1;
+  }
+
+  // only AES/GCM ciphers can be used (an invalid cipher string is reported
+  // by kmyth_seal_setup())
+  cipher_t cipher = kmyth_get_cipher_t_from_string((cipher_string == NULL) ?
+                                                   KMYTH_DEFAULT_CIPHER :
+                                                   cipher_string);
+
+  if (cipher.cipher_name != NULL && cipher.encrypt_fn != aes_gcm_encrypt)
+  {
+    kmyth_log(LOG_ERR, "chunked data requires an AES/GCM cipher (not %s) "
+              "... exiting", cipher.cipher_name);
+    return 1;
+  }
+
+  // chunks are located by their offset in the encrypted data, so they
+  // cannot be compressed
+  if (ctx != NULL && ctx->compression != KMYTH_COMPRESSION_NONE)
+  {
+    kmyth_log(LOG_ERR, "chunked data cannot be compressed ... exiting");
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+  TPM2B_AUTH objAuthVal = {.size = 0, };
+  TPM2B_DIGEST objAuthPolicy = {.size = 0, };
+  TPM2_HANDLE storageKey_handle = 0;
+
+  if (kmyth_seal_setup(ctx, auth_bytes, auth_bytes_len,
+                       owner_auth_bytes, oa_bytes_len, pcrs, pcrs_len,
+                       cipher_string, expected_policy, 0,
+                       &ski, &objAuthVal, &objAuthPolicy, &storageKey_handle))
+  {
+    return 1;
+  }
+
+  ski.chunk_size = (chunk_size == 0) ? KMYTH_DEFAULT_CHUNK_SIZE : chunk_size;
+  ski.chunked_data_len = input_len;
+
+  // Create the symmetric wrapping key and encrypt the input with it, one
+  // chunk at a time
+  size_t wrapKey_size = get_key_len_from_cipher(ski.cipher) / 8;
+  unsigned char *wrapKey = calloc(wrapKey_size, sizeof(unsigned char));
+  uint64_t phase_start = get_timing_ns();
+  int encrypt_failed = (wrapKey == NULL ||
+                        RAND_bytes(wrapKey, (int) wrapKey_size) != 1 ||
+                        kmyth_encrypt_chunks(&ski, wrapKey, wrapKey_size,
+                                             input, ctx->jobs));
+
+  add_phase_timing(ctx->timings, KMYTH_PHASE_ENCRYPT, phase_start);
+  if (encrypt_failed)
+  {
+    kmyth_log(LOG_ERR, "unable to encrypt (wrap) data ... exiting");
+    kmyth_clear_and_free(wrapKey, wrapKey_size);
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    flush_kmyth_transient(ctx->sapi_ctx, storageKey_handle);
+    return 1;
+  }
+
+  // Seal the wrapping key to the TPM using the Storage Key (SK)
+  int retval = tpm2_kmyth_seal_data_ref(ctx->sapi_ctx,
+                                        NULL,
+                                        wrapKey,
+                                        wrapKey_size,
+                                        storageKey_handle,
+                                        &objAuthVal,
+                                        &ski.pcr_list,
+                                        &objAuthVal,
+                                        &ski.pcr_list,
+                                        &objAuthPolicy,
+                                        &ski.policyBranch1,
+                                        &ski.policyBranch2,
+                                        &ski.wk_pub,
+                                        &ski.wk_priv,
+                                        NULL);
+
+  // Clean-up: done with the unencrypted wrapping key, the authVal, and the
+  // storage key
+  kmyth_clear_and_free(wrapKey, wrapKey_size);
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+  flush_kmyth_transient(ctx->sapi_ctx, storageKey_handle);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to seal data ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  if (kmyth_create_ski_output(ctx->ski_format, ski, output, output_len))
+  {
+    kmyth_log(LOG_ERR, "error writing data to .ski format ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+  free_ski(&ski);
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_range()
+//############################################################################
+int tpm2_kmyth_unseal_range(kmyth_ctx_t * ctx,
+                            uint8_t * input, size_t input_len,
+                            size_t offset, size_t length,
+                            uint8_t ** output, size_t *output_len,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            uint8_t bool_policy_or)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+
+  // text input: the encrypted data is left base64 encoded, so that only
+  // the chunks covering the requested range need to be decoded (binary
+  // input holds the raw encrypted data, which is used as it is)
+  Ski ski = get_default_ski();
+  uint8_t *enc_data64 = NULL;
+  size_t enc_data64_size = 0;
+
+  if (is_binary_ski_bytes(input, input_len) ?
+      parse_ski_binary_bytes(input, input_len, &ski) :
+      parse_chunked_ski_bytes(input, input_len, &ski, bool_policy_or,
+                              &enc_data64, &enc_data64_size))
+  {
+    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
+    return 1;
+  }
+
+  // check the range before doing any TPM work
+  if (ski.chunk_size == 0)
+  {
+    kmyth_log(LOG_ERR, "no chunk index (encrypted data not chunked) "
+              "... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+  if (length == 0 || offset > ski.chunked_data_len ||
+      length > ski.chunked_data_len - offset)
+  {
+    kmyth_log(LOG_ERR, "range (%zu bytes at offset %zu) not within sealed "
+              "data (%zu bytes) ... exiting", length, offset,
+              ski.chunked_data_len);
+    free_ski(&ski);
+    return 1;
+  }
+
+  uint8_t *out = malloc(length);
+
+  if (out == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error (%zu bytes) ... exiting", length);
+    free_ski(&ski);
+    return 1;
+  }
+
+  uint8_t *key = NULL;
+  size_t key_len = 0;
+
+  if (kmyth_unseal_wrapping_key(ctx, &ski,
+                                auth_bytes, auth_bytes_len,
+                                owner_auth_bytes, oa_bytes_len,
+                                &key, &key_len))
+  {
+    free(out);
+    free_ski(&ski);
+    return 1;
+  }
+
+  uint64_t phase_start = get_timing_ns();
+  int decrypt_failed = kmyth_decrypt_chunks(&ski, key, key_len,
+                                            enc_data64, enc_data64_size,
+                                            offset, length, out, ctx->jobs);
+
+  add_phase_timing(ctx->timings, KMYTH_PHASE_DECRYPT, phase_start);
+  if (decrypt_failed)
+  {
+    kmyth_log(LOG_ERR, "error decrypting data ... exiting");
+    kmyth_clear_and_free(out, length);
+    kmyth_secure_free(key);
+    free_ski(&ski);
+    return 1;
+  }
+  kmyth_secure_free(key);
+  free_ski(&ski);
+
+  *output = out;
+  *output_len = length;
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_seal_keyring()
+//############################################################################
+int tpm2_kmyth_seal_keyring(kmyth_ctx_t * ctx, size_t count,
+                            const char **names, uint8_t ** values,
+                            size_t *value_lens,
+                            uint8_t ** output, size_t *output_len,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            int *pcrs, size_t pcrs_len,
+                            char *cipher_string, char *expected_policy)
+{
+  if (count == 0 || names == NULL || values == NULL || value_lens == NULL)
+  {
+    kmyth_log(LOG_ERR, "no keyring entries ... exiting");
+    return 1;
+  }
+
+  // only AES/GCM ciphers can be used (an invalid cipher string is reported
+  // by kmyth_seal_setup())
+  cipher_t cipher = kmyth_get_cipher_t_from_string((cipher_string == NULL) ?
+                                                   KMYTH_DEFAULT_CIPHER :
+                                                   cipher_string);
+
+  if (cipher.cipher_name != NULL && cipher.encrypt_fn != aes_gcm_encrypt)
+  {
+    kmyth_log(LOG_ERR, "keyring requires an AES/GCM cipher (not %s) "
+              "... exiting", cipher.cipher_name);
+    return 1;
+  }
+  if (ctx != NULL && ctx->compression != KMYTH_COMPRESSION_NONE)
+  {
+    kmyth_log(LOG_ERR, "keyring cannot be compressed ... exiting");
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+  TPM2B_AUTH objAuthVal = {.size = 0, };
+  TPM2B_DIGEST objAuthPolicy = {.size = 0, };
+  TPM2_HANDLE storageKey_handle = 0;
+
+  if (kmyth_seal_setup(ctx, auth_bytes, auth_bytes_len,
+                       owner_auth_bytes, oa_bytes_len, pcrs, pcrs_len,
+                       cipher_string, expected_policy, 0,
+                       &ski, &objAuthVal, &objAuthPolicy, &storageKey_handle))
+  {
+    return 1;
+  }
+
+  // Create the symmetric wrapping key and pack (encrypt) the keyring
+  // entries with it
+  size_t wrapKey_size = get_key_len_from_cipher(ski.cipher) / 8;
+  unsigned char *wrapKey = calloc(wrapKey_size, sizeof(unsigned char));
+  uint64_t phase_start = get_timing_ns();
+  int encrypt_failed = (wrapKey == NULL ||
+                        RAND_bytes(wrapKey, (int) wrapKey_size) != 1 ||
+                        kmyth_keyring_pack(wrapKey, wrapKey_size, count,
+                                           names, values, value_lens,
+                                           &ski.enc_data,
+                                           &ski.enc_data_size));
+
+  add_phase_timing(ctx->timings, KMYTH_PHASE_ENCRYPT, phase_start);
+  if (encrypt_failed)
+  {
+    kmyth_log(LOG_ERR, "unable to encrypt (wrap) keyring ... exiting");
+    kmyth_clear_and_free(wrapKey, wrapKey_size);
+    kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+    flush_kmyth_transient(ctx->sapi_ctx, storageKey_handle);
+    return 1;
+  }
+
+  // Seal the wrapping key to the TPM using the Storage Key (SK)
+  int retval = tpm2_kmyth_seal_data_ref(ctx->sapi_ctx,
+                                        NULL,
+                                        wrapKey,
+                                        wrapKey_size,
+                                        storageKey_handle,
+                                        &objAuthVal,
+                                        &ski.pcr_list,
+                                        &objAuthVal,
+                                        &ski.pcr_list,
+                                        &objAuthPolicy,
+                                        &ski.policyBranch1,
+                                        &ski.policyBranch2,
+                                        &ski.wk_pub,
+                                        &ski.wk_priv,
+                                        NULL);
+
+  // Clean-up: done with the unencrypted wrapping key, the authVal, and the
+  // storage key
+  kmyth_clear_and_free(wrapKey, wrapKey_size);
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+  flush_kmyth_transient(ctx->sapi_ctx, storageKey_handle);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to seal data ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  if (kmyth_create_ski_output(ctx->ski_format, ski, output, output_len))
+  {
+    kmyth_log(LOG_ERR, "error writing data to .ski format ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+  free_ski(&ski);
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_keyring_open()
+//############################################################################
+int tpm2_kmyth_keyring_open(kmyth_ctx_t * ctx,
+                            uint8_t * input, size_t input_len,
+                            kmyth_keyring_t ** keyring,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            uint8_t bool_policy_or)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+  if (keyring == NULL)
+  {
+    kmyth_log(LOG_ERR, "no keyring output ... exiting");
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+
+  if (parse_ski_bytes(input, input_len, &ski, bool_policy_or))
+  {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_INPUT);
+    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  // check the input is a keyring before doing any TPM work
+  if (ski.chunk_size != 0 || ski.compression != KMYTH_COMPRESSION_NONE ||
+      !is_keyring_data(ski.enc_data, ski.enc_data_size))
+  {
+    kmyth_log(LOG_ERR, "sealed data is not a keyring ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  uint8_t *key = NULL;
+  size_t key_len = 0;
+
+  if (kmyth_unseal_wrapping_key(ctx, &ski,
+                                auth_bytes, auth_bytes_len,
+                                owner_auth_bytes, oa_bytes_len,
+                                &key, &key_len))
+  {
+    free_ski(&ski);
+    return 1;
+  }
+
+  uint64_t phase_start = get_timing_ns();
+  int load_failed = kmyth_keyring_load(key, key_len,
+                                       ski.enc_data, ski.enc_data_size,
+                                       keyring);
+
+  add_phase_timing(ctx->timings, KMYTH_PHASE_DECRYPT, phase_start);
+  kmyth_secure_free(key);
+  if (load_failed)
+  {
+    free_ski(&ski);
+    return 1;
+  }
+
+  // the keyring now owns the (encrypted) keyring data
+  ski.enc_data = NULL;
+  ski.enc_data_size = 0;
+  free_ski(&ski);
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_keyring_update()
+//############################################################################
+int tpm2_kmyth_keyring_update(kmyth_ctx_t * ctx,
+                              uint8_t * input, size_t input_len,
+                              size_t count, const char **names,
+                              uint8_t ** values, size_t *value_lens,
+                              uint8_t ** output, size_t *output_len,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes,
+                              size_t oa_bytes_len, uint8_t bool_policy_or)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+
+  if (parse_ski_bytes(input, input_len, &ski, bool_policy_or))
+  {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_INPUT);
+    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  // the keyring is opened from the parsed .ski's encrypted data, which it
+  // then owns - the rest of the .ski (the storage key and sealed wrapping
+  // key) is written back unchanged
+  uint8_t *enc_data = ski.enc_data;
+  size_t enc_data_size = ski.enc_data_size;
+  kmyth_keyring_t *keyring = NULL;
+
+  ski.enc_data = NULL;
+  ski.enc_data_size = 0;
+  if (ski.chunk_size != 0 || ski.compression != KMYTH_COMPRESSION_NONE ||
+      !is_keyring_data(enc_data, enc_data_size))
+  {
+    kmyth_log(LOG_ERR, "sealed data is not a keyring ... exiting");
+    free(enc_data);
+    free_ski(&ski);
+    return 1;
+  }
+
+  uint8_t *key = NULL;
+  size_t key_len = 0;
+
+  if (kmyth_unseal_wrapping_key(ctx, &ski,
+                                auth_bytes, auth_bytes_len,
+                                owner_auth_bytes, oa_bytes_len,
+                                &key, &key_len))
+  {
+    free(enc_data);
+    free_ski(&ski);
+    return 1;
+  }
+
+  uint64_t phase_start = get_timing_ns();
+  int load_failed = kmyth_keyring_load(key, key_len,
+                                       enc_data, enc_data_size, &keyring);
+
+  kmyth_secure_free(key);
+  if (load_failed)
+  {
+    free(enc_data);
+    free_ski(&ski);
+    return 1;
+  }
+
+  int update_failed = kmyth_keyring_update(keyring, count, names, values,
+                                           value_lens, &ski.enc_data,
+                                           &ski.enc_data_size);
+
+  add_phase_timing(ctx->timings, KMYTH_PHASE_ENCRYPT, phase_start);
+  kmyth_keyring_close(&keyring);
+  if (update_failed)
+  {
+    kmyth_log(LOG_ERR, "unable to update keyring ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  if (kmyth_create_ski_output(ctx->ski_format, ski, output, output_len))
+  {
+    kmyth_log(LOG_ERR, "error writing data to .ski format ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+  free_ski(&ski);
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_kmyth_keyring_update_file()
+//############################################################################
+int tpm2_kmyth_keyring_update_file(kmyth_ctx_t * ctx, char *path,
+                                   size_t count, const char **names,
+                                   uint8_t ** values, size_t *value_lens,
+                                   uint8_t * auth_bytes,
+                                   size_t auth_bytes_len,
+                                   uint8_t * owner_auth_bytes,
+                                   size_t oa_bytes_len,
+                                   uint8_t bool_policy_or)
+{
+  uint8_t *input = NULL;
+  size_t input_len = 0;
+
+  if (read_bytes_from_file(path, &input, &input_len))
+  {
+    kmyth_log(LOG_ERR, "unable to read keyring file (%s) ... exiting", path);
+    return 1;
+  }
+
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+  int retval = tpm2_kmyth_keyring_update(ctx, input, input_len,
+                                         count, names, values, value_lens,
+                                         &output, &output_len,
+                                         auth_bytes, auth_bytes_len,
+                                         owner_auth_bytes, oa_bytes_len,
+                                         bool_policy_or);
+
+  free(input);
+  if (retval == 0)
+  {
+    retval = replace_file_atomically(path, output, output_len);
+  }
+  free(output);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_rewrap()
+//############################################################################
+static int kmyth_rewrap(kmyth_ctx_t * ctx,
+                        uint8_t * input, size_t input_len,
+                        uint8_t ** output, size_t *output_len,
+                        uint8_t * auth_bytes, size_t auth_bytes_len,
+                        uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                        int *pcrs, size_t pcrs_len, char *expected_policy,
+                        uint8_t bool_policy_or)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
+    return 1;
+  }
+
+  Ski ski = get_default_ski();
+
+  if (parse_ski_bytes(input, input_len, &ski, bool_policy_or))
+  {
+    kmyth_metrics_note_failure(KMYTH_FAILURE_INPUT);
+    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  // only the wrapping key is recovered - the encrypted data is never
+  // decrypted, and is carried over to the new .ski as it is
+  uint8_t *key = NULL;
+  size_t key_len = 0;
+
+  if (kmyth_unseal_wrapping_key(ctx, &ski,
+                                auth_bytes, auth_bytes_len,
+                                owner_auth_bytes, oa_bytes_len,
+                                &key, &key_len))
+  {
+    free_ski(&ski);
+    return 1;
+  }
+
+  // set up a new storage key and policy, keeping the original cipher (the
+  // wrapping key is only meaningful for that cipher) and storage key
+  // algorithm
+  Ski new_ski = get_default_ski();
+  TPM2B_AUTH objAuthVal = {.size = 0, };
+  TPM2B_DIGEST objAuthPolicy = {.size = 0, };
+  TPM2_HANDLE storageKey_handle = 0;
+  TPMI_ALG_PUBLIC ctx_sk_alg = ctx->sk_alg;
+
+  ctx->sk_alg = ski.sk_pub.publicArea.type;
+  int setup_failed = kmyth_seal_setup(ctx, auth_bytes, auth_bytes_len,
+                                      owner_auth_bytes, oa_bytes_len,
+                                      pcrs, pcrs_len,
+                                      ski.cipher.cipher_name,
+                                      expected_policy, 0,
+                                      &new_ski, &objAuthVal, &objAuthPolicy,
+                                      &storageKey_handle);
+
+  ctx->sk_alg = ctx_sk_alg;
+  if (setup_failed)
+  {
+    kmyth_secure_free(key);
+    free_ski(&ski);
+    return 1;
+  }
+
+  // Re-seal the wrapping key to the TPM using the new Storage Key (SK)
+  int retval = tpm2_kmyth_seal_data_ref(ctx->sapi_ctx,
+                                        NULL,
+                                        key,
+                                        key_len,
+                                        storageKey_handle,
+                                        &objAuthVal,
+                                        &new_ski.pcr_list,
+                                        &objAuthVal,
+                                        &new_ski.pcr_list,
+                                        &objAuthPolicy,
+                                        &new_ski.policyBranch1,
+                                        &new_ski.policyBranch2,
+                                        &new_ski.wk_pub,
+                                        &new_ski.wk_priv,
+                                        NULL);
+
+  // Clean-up: done with the unencrypted wrapping key, authVal and the
+  // storage key
+  kmyth_secure_free(key);
+  kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+  flush_kmyth_transient(ctx->sapi_ctx, storageKey_handle);
+
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to re-seal wrapping key ... exiting");
+    free_ski(&ski);
+    return 1;
+  }
+
+  // hand the encrypted data (and any chunk index or compression) over to
+  // the new ski, which is written out in the same format as the input
+  new_ski.enc_data = ski.enc_data;
+  new_ski.enc_data_size = ski.enc_data_size;
+  new_ski.chunk_size = ski.chunk_size;
+  new_ski.chunked_data_len = ski.chunked_data_len;
+  new_ski.compression = ski.compression;
+  ski.enc_data = NULL;
+  ski.enc_data_size = 0;
+
+  int ski_format = is_binary_ski_bytes(input, input_len) ?
+    KMYTH_SKI_FORMAT_BINARY : KMYTH_SKI_FORMAT_TEXT;
 
-  if (create_ski_bytes(ski, output, output_len))
+  if (kmyth_create_ski_output(ski_format, new_ski, output, output_len))
   {
     kmyth_log(LOG_ERR, "error writing data to .ski format ... exiting");
-    free_tpm2_resources(&sapi_ctx);
-    return 1;
+    retval = 1;
   }
 
-  free_ski(&ski);
-  // done, so free any allocated resources that remain
-  free_tpm2_resources(&sapi_ctx);
+  free_ski(&new_ski);
 
-  return 0;
+  return retval;
 }
 
 //############################################################################
-// tpm2_kmyth_unseal()
+// tpm2_kmyth_rewrap()
 //############################################################################
-int tpm2_kmyth_unseal(uint8_t * input,
-                      size_t input_len,
-                      uint8_t ** output,
-                      size_t *output_len,
-                      uint8_t * auth_bytes,
-                      size_t auth_bytes_len,
+int tpm2_kmyth_rewrap(kmyth_ctx_t * ctx,
+                      uint8_t * input, size_t input_len,
+                      uint8_t ** output, size_t *output_len,
+                      uint8_t * auth_bytes, size_t auth_bytes_len,
                       uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                      int *pcrs, size_t pcrs_len, char *expected_policy,
                       uint8_t bool_policy_or)
 {
-  if(oa_bytes_len > UINT16_MAX)
-  {
-    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
-    return 1;
-  }
-  
-  // Initialize connection to TPM 2.0 resource manager
-  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  uint64_t metrics_start = kmyth_metrics_op_begin();
+  int retval = kmyth_rewrap(ctx, input, input_len, output, output_len,
+                            auth_bytes, auth_bytes_len, owner_auth_bytes,
+                            oa_bytes_len, pcrs, pcrs_len, expected_policy,
+                            bool_policy_or);
 
-  if (init_tpm2_connection(&sapi_ctx))
-  {
-    kmyth_log(LOG_ERR, "unable to init connection to TPM2 resource manager");
-    free_tpm2_resources(&sapi_ctx);
-    return 1;
-  }
-  kmyth_log(LOG_DEBUG, "initialized connection to TPM 2.0 resource manager");
+  retval = ctx_call_result(ctx, retval);
+  kmyth_metrics_op_end(KMYTH_OP_RESEAL, metrics_start, retval);
 
-  // Create owner (storage) hierarchy authorization structure
-  // to provide password session authorization criteria for use of:
-  //   - Storage Root Key (SRK)
-  //   - Storage Primary Seed (SPS), if necessary to re-derive SRK
-  TPM2B_AUTH ownerAuth;
+  return retval;
+}
 
-  ownerAuth.size = (uint16_t)oa_bytes_len;
-  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+// Per-item state of a batch rewrap: the parsed inputs and their recovered
+// wrapping keys, and the new .ski (sealed under the new policy) of each
+typedef struct
+{
+  kmyth_unseal_batch_work *unseal;
+  Ski *new_skis;
+  bool *sealed;
+} kmyth_rewrap_batch_work;
+
+//############################################################################
+// kmyth_rewrap_batch_format()
+//############################################################################
+static int kmyth_rewrap_batch_format(size_t i, void *arg)
+{
+  kmyth_rewrap_batch_work *work = (kmyth_rewrap_batch_work *) arg;
+  kmyth_unseal_batch_work *unseal = work->unseal;
+  Ski *ski = &unseal->skis[i];
+  Ski *new_ski = &work->new_skis[i];
+
+  if (work->sealed[i])
   {
-    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+    // as for a single rewrap, the encrypted data is carried over as it is
+    new_ski->enc_data = ski->enc_data;
+    new_ski->enc_data_size = ski->enc_data_size;
+    new_ski->chunk_size = ski->chunk_size;
+    new_ski->chunked_data_len = ski->chunked_data_len;
+    new_ski->compression = ski->compression;
+    ski->enc_data = NULL;
+    ski->enc_data_size = 0;
+
+    int ski_format = is_binary_ski_bytes(unseal->inputs[i],
+                                         unseal->input_lens[i]) ?
+      KMYTH_SKI_FORMAT_BINARY : KMYTH_SKI_FORMAT_TEXT;
+
+    if (kmyth_create_ski_output(ski_format, *new_ski,
+                                &unseal->outputs[i], &unseal->output_lens[i]))
+    {
+      kmyth_log(LOG_ERR, "error writing data to .ski format (batch item %zu)",
+                i);
+      unseal->outputs[i] = NULL;
+      unseal->output_lens[i] = 0;
+    }
+    else
+    {
+      unseal->results[i] = 0;
+    }
+    free_ski(new_ski);
   }
 
-  if (ownerAuth.size > 0)
+  free_ski(ski);
+
+  return unseal->results[i];
+}
+
+//############################################################################
+// kmyth_rewrap_batch_seal()
+//############################################################################
+static void kmyth_rewrap_batch_seal(kmyth_ctx_t * ctx, size_t count,
+                                    kmyth_rewrap_batch_work * work,
+                                    uint8_t * auth_bytes,
+                                    size_t auth_bytes_len,
+                                    uint8_t * owner_auth_bytes,
+                                    size_t oa_bytes_len,
+                                    int *pcrs, size_t pcrs_len,
+                                    char *expected_policy)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = ctx->sapi_ctx;
+  Ski *skis = work->unseal->skis;
+  uint8_t **keys = work->unseal->keys;
+  size_t *key_lens = work->unseal->key_lens;
+  bool *pending = work->unseal->pending;
+  TPMI_ALG_PUBLIC ctx_sk_alg = ctx->sk_alg;
+
+  // every item whose wrapping key was recovered is waiting to be sealed
+  for (size_t i = 0; i < count; i++)
   {
-    kmyth_log(LOG_DEBUG, "auth string for TPM storage hierarchy specified");
+    pending[i] = (keys[i] != NULL);
   }
-  // Create authorization value (authVal) to provide policy session
-  // authorization criteria for use of:
-  //   - Storage Key (SK) TPM object
-  //   - Sealed Data (wrapping key) TPM object
-  // The authVal is set to:
-  //   - all-zero digest (like TPM 1.2 well-known secret) by default
-  //   - hash of input authorization string if one is specified
-  TPM2B_AUTH objAuthValue;
 
-  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthValue))
+  // The new policy and storage key are set up once for each storage key
+  // algorithm in the batch (normally just one), and shared by every item
+  // sealed with that algorithm - each item keeps its own cipher, as its
+  // wrapping key is only meaningful for that cipher
+  for (size_t i = 0; i < count; i++)
   {
-    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
-    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
-    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
-    free_tpm2_resources(&sapi_ctx);
-    return 1;
-  }
+    if (!pending[i])
+    {
+      continue;
+    }
 
-  // The storage root key (SRK) is the primary key for the storage hierarchy
-  // in the TPM.  We will first check to see if it is already loaded in
-  // persistent storage. We do this by getting the loaded persistent handle
-  // values, inspecting each of their their public structures, and comparing
-  // these public area parameters against those for the SRK. None of these
-  // activities require authorization. If the key is not already loaded,
-  // though, it must be re-derived using the storage hierarchy's primary
-  // seed (SPS). Use of the SPS requires owner hierarchy authorization.
-  TPM2_HANDLE storageRootKey_handle = 0;
+    TPMI_ALG_PUBLIC sk_alg = skis[i].sk_pub.publicArea.type;
+    Ski base_ski;
+    TPM2B_AUTH objAuthVal = {.size = 0, };
+    TPM2B_DIGEST objAuthPolicy = {.size = 0, };
+    TPM2_HANDLE storageKey_handle = 0;
+    SESSION sealData_session;
 
-  if (get_srk_handle(sapi_ctx, &storageRootKey_handle, &ownerAuth))
-  {
-    kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
-    free_tpm2_resources(&sapi_ctx);
-    return 1;
+    init_default_ski(&base_ski);
+
+    ctx->sk_alg = sk_alg;
+    int setup_failed = kmyth_seal_setup(ctx, auth_bytes, auth_bytes_len,
+                                        owner_auth_bytes, oa_bytes_len,
+                                        pcrs, pcrs_len,
+                                        skis[i].cipher.cipher_name,
+                                        expected_policy, 0,
+                                        &base_ski, &objAuthVal,
+                                        &objAuthPolicy, &storageKey_handle);
+
+    if (!setup_failed &&
+        acquire_policy_session(sapi_ctx, &sealData_session))
+    {
+      kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
+      kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+      flush_kmyth_transient(sapi_ctx, storageKey_handle);
+      setup_failed = 1;
+    }
+
+    for (size_t j = i; j < count; j++)
+    {
+      if (!pending[j] || skis[j].sk_pub.publicArea.type != sk_alg)
+      {
+        continue;
+      }
+      pending[j] = false;
+
+      if (setup_failed)
+      {
+        kmyth_log(LOG_ERR, "unable to set up re-seal (batch item %zu)", j);
+        continue;
+      }
+
+      work->new_skis[j] = base_ski;
+      work->new_skis[j].cipher = skis[j].cipher;
+      if (tpm2_kmyth_seal_data_ref(sapi_ctx,
+                                   &sealData_session,
+                                   keys[j],
+                                   key_lens[j],
+                                   storageKey_handle,
+                                   &objAuthVal,
+                                   &base_ski.pcr_list,
+                                   &objAuthVal,
+                                   &base_ski.pcr_list,
+                                   &objAuthPolicy,
+                                   &base_ski.policyBranch1,
+                                   &base_ski.policyBranch2,
+                                   &work->new_skis[j].wk_pub,
+                                   &work->new_skis[j].wk_priv,
+                                   NULL))
+      {
+        kmyth_log(LOG_ERR, "unable to re-seal wrapping key (batch item %zu)",
+                  j);
+
+        // as for a batch seal, carry on with a fresh session
+        release_policy_session(sapi_ctx, &sealData_session, true);
+        if (acquire_policy_session(sapi_ctx, &sealData_session))
+        {
+          kmyth_log(LOG_ERR, "error restarting auth policy session ... "
+                    "exiting");
+          kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+          flush_kmyth_transient(sapi_ctx, storageKey_handle);
+          setup_failed = 1;
+        }
+        continue;
+      }
+      work->sealed[j] = true;
+    }
+
+    if (!setup_failed)
+    {
+      release_policy_session(sapi_ctx, &sealData_session, false);
+      kmyth_clear(objAuthVal.buffer, objAuthVal.size);
+      flush_kmyth_transient(sapi_ctx, storageKey_handle);
+    }
   }
-  kmyth_log(LOG_DEBUG, "retrieved SRK handle (0x%08X)", storageRootKey_handle);
 
-  Ski ski = get_default_ski();
+  ctx->sk_alg = ctx_sk_alg;
+}
 
-  if (parse_ski_bytes(input, input_len, &ski, bool_policy_or))
+//############################################################################
+// kmyth_rewrap_batch()
+//############################################################################
+static int kmyth_rewrap_batch(kmyth_ctx_t * ctx, size_t count,
+                              uint8_t ** inputs, size_t *input_lens,
+                              uint8_t ** outputs, size_t *output_lens,
+                              int *results,
+                              uint8_t * auth_bytes, size_t auth_bytes_len,
+                              uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                              int *pcrs, size_t pcrs_len,
+                              char *expected_policy, uint8_t bool_policy_or)
+{
+  if (ctx == NULL || ctx->sapi_ctx == NULL)
   {
-    kmyth_log(LOG_ERR, "error parsing ski string ... exiting");
-    free_ski(&ski);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "uninitialized kmyth context ... exiting");
     return 1;
   }
 
-  // The Storage Key (SK) will be used by the TPM to unseal the wrapping key.
-  // We have obtained its public and encrypted private blobs from
-  // the input .ski file and will now load the SK into the TPM.
-  TPM2_HANDLE storageKey_handle = 0;
-  TPML_PCR_SELECTION emptyPcrList = {.count = 0, };
-  if (load_kmyth_object(sapi_ctx,
-                        (SESSION *) NULL,
-                        storageRootKey_handle,
-                        ownerAuth,
-                        emptyPcrList,
-                        &ski.sk_priv, &ski.sk_pub, &storageKey_handle))
+  if (count == 0 || inputs == NULL || input_lens == NULL ||
+      outputs == NULL || output_lens == NULL || results == NULL)
   {
-    kmyth_log(LOG_ERR, "error loading storage key ... exiting");
-    free_ski(&ski);
-    free_tpm2_resources(&sapi_ctx);
+    kmyth_log(LOG_ERR, "invalid batch parameters ... exiting");
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "loaded SK at handle = 0x%08X", storageKey_handle);
-
-  // Authorization for the use of all non-primary (other than SRK), Kmyth
-  // TPM 2.0 objects utilizes policy-based enhanced authorization critera.
-  // Therefore, we will calculate the authorization policy digest that
-  // results from applying the steps of our selected authorization policy.
-  // We pass this result to the kmyth_unseal_data() function where it is
-  // used in theinto the objects we create as the
-  // authorization policy digest value that must be regenerated to authorize
-  // use of these objects.
-  TPM2B_DIGEST objAuthPolicy;
-
-  objAuthPolicy.size = 0;
-
-  uint8_t *key = NULL;
-  size_t key_len;
 
-  // Perform "unseal" to recover data
-  if (tpm2_kmyth_unseal_data(sapi_ctx,
-                             storageKey_handle,
-                             ski.wk_pub,
-                             ski.wk_priv,
-                             objAuthValue,
-                             ski.pcr_list, objAuthPolicy, ski.policyBranch1,
-                             ski.policyBranch2, &key, &key_len))
+  if (oa_bytes_len > UINT16_MAX)
   {
-    kmyth_log(LOG_ERR, "error unsealing data ... exiting");
-    free_ski(&ski);
-    free_tpm2_resources(&sapi_ctx);
-    kmyth_clear(key, key_len);
+    kmyth_log(LOG_ERR, "unable to start TPM2 session, oa_bytes_len too large");
     return 1;
   }
 
-  if (kmyth_decrypt_data((unsigned char *) ski.enc_data,
-                         ski.enc_data_size,
-                         ski.cipher,
-                         (unsigned char *) key, key_len, output, output_len))
+  // every item starts out failed, and is only marked successful once its
+  // re-sealed .ski output has actually been produced
+  for (size_t i = 0; i < count; i++)
   {
-    kmyth_log(LOG_ERR, "error decrypting data ... exiting");
-    free_ski(&ski);
-    free_tpm2_resources(&sapi_ctx);
-    kmyth_clear(key, key_len);
-    return 1;
+    outputs[i] = NULL;
+    output_lens[i] = 0;
+    results[i] = 1;
   }
 
-  // done, so free any allocated resources that remain
-  free_ski(&ski);
-  free_tpm2_resources(&sapi_ctx);
-  kmyth_clear(key, key_len);
+  TPM2B_AUTH ownerAuth;
 
-  return 0;
-}
+  ownerAuth.size = (uint16_t) oa_bytes_len;
+  if (owner_auth_bytes != NULL && oa_bytes_len > 0)
+  {
+    memcpy(ownerAuth.buffer, owner_auth_bytes, ownerAuth.size);
+  }
 
-//############################################################################
-// tpm2_kmyth_seal_file()
-//############################################################################
-int tpm2_kmyth_seal_file(char *input_path,
-                         uint8_t ** output,
-                         size_t *output_len,
-                         uint8_t * auth_bytes,
-                         size_t auth_bytes_len,
-                         uint8_t * owner_auth_bytes,
-                         size_t oa_bytes_len,
-                         int *pcrs, size_t pcrs_len, char *cipher_string,
-                         char *expected_policy, uint8_t bool_trial_only)
-{
+  TPM2B_AUTH objAuthValue;
 
-  // Verify input path exists with read permissions
-  if (verifyInputFilePath(input_path))
+  if (create_authVal(auth_bytes, auth_bytes_len, &objAuthValue))
   {
-    kmyth_log(LOG_ERR, "input path (%s) is not valid ... exiting", input_path);
+    kmyth_log(LOG_ERR, "error creating authorization value ... exiting");
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
     return 1;
   }
 
-  uint8_t *data = NULL;
-  size_t data_len = 0;
-
-  if (read_bytes_from_file(input_path, &data, &data_len))
+  if (kmyth_ctx_get_srk_handle(ctx, &ownerAuth))
   {
-    kmyth_log(LOG_ERR, "seal input data file read error ... exiting");
-    if (data != NULL) free(data);
+    kmyth_log(LOG_ERR, "error obtaining handle for SRK ... exiting");
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "read in %d bytes of data to be wrapped", data_len);
 
-  // validate non-empty plaintext buffer specified
-  if (data_len == 0 || data == NULL)
+  kmyth_unseal_batch_work unseal = {
+    .skis = calloc(count, sizeof(Ski)),
+    .pending = calloc(count, sizeof(bool)),
+    .inputs = inputs,
+    .input_lens = input_lens,
+    .keys = calloc(count, sizeof(uint8_t *)),
+    .key_lens = calloc(count, sizeof(size_t)),
+    .outputs = outputs,
+    .output_lens = output_lens,
+    .results = results,
+    .bool_policy_or = bool_policy_or
+  };
+  kmyth_rewrap_batch_work work = {
+    .unseal = &unseal,
+    .new_skis = calloc(count, sizeof(Ski)),
+    .sealed = calloc(count, sizeof(bool))
+  };
+
+  if (unseal.skis == NULL || unseal.pending == NULL ||
+      unseal.keys == NULL || unseal.key_lens == NULL ||
+      work.new_skis == NULL || work.sealed == NULL)
   {
-    kmyth_log(LOG_ERR, "no input data ... exiting");
-    if (data != NULL) free(data);
+    kmyth_log(LOG_ERR, "unable to allocate memory for batch ... exiting");
+    free(unseal.skis);
+    free(unseal.pending);
+    free(unseal.keys);
+    free(unseal.key_lens);
+    free(work.new_skis);
+    free(work.sealed);
+    kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+    kmyth_clear(ownerAuth.buffer, ownerAuth.size);
     return 1;
   }
 
-  if (tpm2_kmyth_seal(data, data_len,
-                      output, output_len,
-                      auth_bytes, auth_bytes_len,
-                      owner_auth_bytes, oa_bytes_len,
-                      pcrs, pcrs_len, cipher_string, expected_policy,
-                      bool_trial_only))
+  // Parse every input (spread over the context's workers), and recover
+  // the wrapping keys, loading each distinct (old) storage key once - as
+  // for a single rewrap, no data is decrypted
+  kmyth_parallel_for(count, ctx->jobs, kmyth_unseal_batch_parse, &unseal);
+  kmyth_unseal_batch_keys(ctx, count, &unseal, ownerAuth, objAuthValue,
+                          false);
+  kmyth_clear(objAuthValue.buffer, objAuthValue.size);
+  kmyth_clear(ownerAuth.buffer, ownerAuth.size);
+
+  // Re-seal the wrapping keys under the new policy, and then drop them
+  kmyth_rewrap_batch_seal(ctx, count, &work, auth_bytes, auth_bytes_len,
+                          owner_auth_bytes, oa_bytes_len, pcrs, pcrs_len,
+                          expected_policy);
+  for (size_t i = 0; i < count; i++)
   {
-    kmyth_log(LOG_ERR, "Failed to kmyth-seal data ... exiting");
-    if (data != NULL) free(data);
-    return (1);
+    kmyth_secure_free(unseal.keys[i]);
   }
-  if (data != NULL) free(data);
-  return 0;
+
+  // Produce the .ski output of every re-sealed item (and free all of the
+  // parsed inputs) - again spread over the workers
+  int retval = kmyth_parallel_for(count, ctx->jobs,
+                                  kmyth_rewrap_batch_format, &work);
+
+  free(unseal.skis);
+  free(unseal.pending);
+  free(unseal.keys);
+  free(unseal.key_lens);
+  free(work.new_skis);
+  free(work.sealed);
+
+  return retval;
 }
 
 //############################################################################
-// tpm2_kmyth_unseal_file()
+// tpm2_kmyth_rewrap_batch()
 //############################################################################
-int tpm2_kmyth_unseal_file(char *input_path,
-                           uint8_t ** output,
-                           size_t *output_length,
-                           uint8_t * auth_bytes,
-                           size_t auth_bytes_len,
-                           uint8_t * owner_auth_bytes, size_t oa_bytes_len,
-                           uint8_t bool_policy_or)
+int tpm2_kmyth_rewrap_batch(kmyth_ctx_t * ctx, size_t count,
+                            uint8_t ** inputs, size_t *input_lens,
+                            uint8_t ** outputs, size_t *output_lens,
+                            int *results,
+                            uint8_t * auth_bytes, size_t auth_bytes_len,
+                            uint8_t * owner_auth_bytes, size_t oa_bytes_len,
+                            int *pcrs, size_t pcrs_len,
+                            char *expected_policy, uint8_t bool_policy_or)
 {
+  uint64_t metrics_start = kmyth_metrics_op_begin();
+  int retval = kmyth_rewrap_batch(ctx, count, inputs, input_lens, outputs,
+                                  output_lens, results, auth_bytes,
+                                  auth_bytes_len, owner_auth_bytes,
+                                  oa_bytes_len, pcrs, pcrs_len,
+                                  expected_policy, bool_policy_or);
 
-  uint8_t *data = NULL;
-  size_t data_length = 0;
-
-  if (read_bytes_from_file(input_path, &data, &data_length))
-  {
-    kmyth_log(LOG_ERR, "Unable to read file %s ... exiting", input_path);
-    return (1);
-  }
-  if (tpm2_kmyth_unseal(data, data_length,
-                        output, output_length, auth_bytes, auth_bytes_len,
-                        owner_auth_bytes, oa_bytes_len, bool_policy_or))
-  {
-    kmyth_log(LOG_ERR, "Unable to unseal contents ... exiting");
-    if (data != NULL) free(data);
-    return (1);
-  }
+  retval = ctx_call_result(ctx, retval);
+  kmyth_metrics_op_end(KMYTH_OP_RESEAL, metrics_start, retval);
 
-  if (data != NULL) free(data);
-  return 0;
+  return retval;
 }
 
 //############################################################################
-// tpm2_kmyth_seal_data
+// tpm2_kmyth_seal_data()
 //############################################################################
 int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
                          uint8_t * sdo_data,
@@ -623,6 +5441,62 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
                          TPM2B_DIGEST sdo_policyBranch1,
                          TPM2B_DIGEST sdo_policyBranch2,
                          TPM2B_PUBLIC * sdo_public, TPM2B_PRIVATE * sdo_private)
+{
+  return tpm2_kmyth_seal_data_session(sapi_ctx, NULL,
+                                      sdo_data, sdo_dataSize,
+                                      sk_handle, sk_authVal, sk_pcrList,
+                                      sdo_authVal, sdo_pcrList,
+                                      sdo_authPolicy,
+                                      sdo_policyBranch1, sdo_policyBranch2,
+                                      sdo_public, sdo_private, NULL);
+}
+
+//############################################################################
+// tpm2_kmyth_seal_data_session()
+//############################################################################
+int tpm2_kmyth_seal_data_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                                 SESSION * sealData_session,
+                                 uint8_t * sdo_data,
+                                 size_t sdo_dataSize,
+                                 TPM2_HANDLE sk_handle,
+                                 TPM2B_AUTH sk_authVal,
+                                 TPML_PCR_SELECTION sk_pcrList,
+                                 TPM2B_AUTH sdo_authVal,
+                                 TPML_PCR_SELECTION sdo_pcrList,
+                                 TPM2B_DIGEST sdo_authPolicy,
+                                 TPM2B_DIGEST sdo_policyBranch1,
+                                 TPM2B_DIGEST sdo_policyBranch2,
+                                 TPM2B_PUBLIC * sdo_public,
+                                 TPM2B_PRIVATE * sdo_private,
+                                 HOST_WORK * host_work)
+{
+  return tpm2_kmyth_seal_data_ref(sapi_ctx, sealData_session,
+                                  sdo_data, sdo_dataSize,
+                                  sk_handle, &sk_authVal, &sk_pcrList,
+                                  &sdo_authVal, &sdo_pcrList,
+                                  &sdo_authPolicy,
+                                  &sdo_policyBranch1, &sdo_policyBranch2,
+                                  sdo_public, sdo_private, host_work);
+}
+
+//############################################################################
+// tpm2_kmyth_seal_data_ref()
+//############################################################################
+int tpm2_kmyth_seal_data_ref(TSS2_SYS_CONTEXT * sapi_ctx,
+                             SESSION * sealData_session,
+                             uint8_t * sdo_data,
+                             size_t sdo_dataSize,
+                             TPM2_HANDLE sk_handle,
+                             const TPM2B_AUTH * sk_authVal,
+                             const TPML_PCR_SELECTION * sk_pcrList,
+                             const TPM2B_AUTH * sdo_authVal,
+                             const TPML_PCR_SELECTION * sdo_pcrList,
+                             const TPM2B_DIGEST * sdo_authPolicy,
+                             const TPM2B_DIGEST * sdo_policyBranch1,
+                             const TPM2B_DIGEST * sdo_policyBranch2,
+                             TPM2B_PUBLIC * sdo_public,
+                             TPM2B_PRIVATE * sdo_private,
+                             HOST_WORK * host_work)
 {
   // Create and set up sensitive data input for new sealed data object:
   //   - The authVal (hash of user specifed authorization string or default
@@ -635,7 +5509,7 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
   sdo_sensitive.sensitive.userAuth.size = 0;  // and empty userAuth buffers
 
   // Populate buffer with data to be sealed and set size to its length in bytes
-  if (init_kmyth_object_sensitive(sdo_authVal,
+  if (init_kmyth_object_sensitive(*sdo_authVal,
                                   sdo_data, sdo_dataSize, &sdo_sensitive))
   {
     kmyth_log(LOG_ERR, "error populating data to be sealed ... exiting");
@@ -646,33 +5520,41 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
   TPM2B_PUBLIC sdo_template;
 
   sdo_template.size = 0;
-  if (init_kmyth_object_template(false,
-                                 sdo_authPolicy, &(sdo_template.publicArea)))
+  if (init_kmyth_object_template(false, TPM2_ALG_NULL,
+                                 *sdo_authPolicy, &(sdo_template.publicArea)))
   {
     kmyth_log(LOG_ERR,
               "error populating public template for data object ... exiting");
     return 1;
   }
 
-  // Start a TPM 2.0 policy session that we will use to authorize the use of
-  // storage key (SK) to create the sealed wrapping key object
-  SESSION sealData_session;
+  // Obtain a TPM 2.0 policy session (from the connection's pool, if one is
+  // idle) that we will use to authorize the use of storage key (SK) to
+  // create the sealed wrapping key object, unless the caller has supplied
+  // one to be reused
+  SESSION local_session;
+  bool own_session = (sealData_session == NULL);
+  kmyth_timings_t *timings = get_tpm2_timings(sapi_ctx);
+  uint64_t phase_start = get_timing_ns();
 
-  if (create_auth_session(sapi_ctx, &sealData_session, TPM2_SE_POLICY))
+  if (own_session)
   {
-    kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
-    return 1;
+    sealData_session = &local_session;
+    if (acquire_policy_session(sapi_ctx, sealData_session))
+    {
+      kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
+      add_phase_timing(timings, KMYTH_PHASE_POLICY, phase_start);
+      return 1;
+    }
   }
 
   // Apply policy to session context, in preparation for the "create" command
-  if (apply_policy(sapi_ctx, sealData_session.sessionHandle, sk_pcrList))
-  {
-    kmyth_log(LOG_ERR, "error applying policy to session context ... exiting");
-    return 1;
-  }
+  int policy_failed = apply_policy(sapi_ctx, sealData_session->sessionHandle,
+                                   *sk_pcrList);
 
   // if both policy branches have a size, policyor digest should be calculated
-  if (sdo_policyBranch1.size != 0 && sdo_policyBranch2.size != 0)
+  if (!policy_failed && sdo_policyBranch1->size != 0 &&
+      sdo_policyBranch2->size != 0)
   {
     TPML_DIGEST pHashList;
 
@@ -681,42 +5563,58 @@ int tpm2_kmyth_seal_data(TSS2_SYS_CONTEXT * sapi_ctx,
       pHashList.digests[i].size = 0;
     }
 
-    apply_policy_or(sapi_ctx, sealData_session.sessionHandle,
-                    &sdo_policyBranch1, &sdo_policyBranch2, &pHashList);
+    apply_policy_or(sapi_ctx, sealData_session->sessionHandle,
+                    sdo_policyBranch1, sdo_policyBranch2, &pHashList);
+  }
+  add_phase_timing(timings, KMYTH_PHASE_POLICY, phase_start);
+
+  if (policy_failed)
+  {
+    kmyth_log(LOG_ERR, "error applying policy to session context ... exiting");
+    if (own_session)
+    {
+      release_policy_session(sapi_ctx, sealData_session, true);
+    }
+    return 1;
   }
 
   // create sealed data object
-  if (create_kmyth_object(sapi_ctx,
-                          &sealData_session,
-                          sk_handle,
-                          sk_authVal,
-                          sk_pcrList,
-                          sdo_sensitive,
-                          sdo_template,
-                          sdo_pcrList,
-                          (TPM2_HANDLE) 0, sdo_private, sdo_public))
+  if (create_kmyth_object_ref(sapi_ctx,
+                              sealData_session,
+                              sk_handle,
+                              sk_authVal,
+                              sk_pcrList,
+                              &sdo_sensitive,
+                              &sdo_template,
+                              sdo_pcrList,
+                              (TPM2_HANDLE) 0, sdo_private, sdo_public,
+                              host_work))
   {
     kmyth_log(LOG_ERR, "could not seal data ... exiting");
+    if (own_session)
+    {
+      release_policy_session(sapi_ctx, sealData_session, true);
+    }
     return 1;
   }
   kmyth_log(LOG_DEBUG, "created sealed data (wrapping key) object");
 
-  // Clean-up: done with the policy authorization session setup to enable
-  //           creation of the sealed data object, so flush it from the TPM
-  TSS2_RC rc = Tss2_Sys_FlushContext(sapi_ctx, sealData_session.sessionHandle);
+  // a session supplied by the caller is left open for reuse
+  if (!own_session)
+  {
+    return 0;
+  }
 
-  if (rc != TSS2_RC_SUCCESS)
+  // Clean-up: done with the policy authorization session setup to enable
+  //           creation of the sealed data object, so return it to the pool
+  //           (or flush it from the TPM)
+  if (release_policy_session(sapi_ctx, sealData_session, false))
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_FlushContext(): rc = 0x%08X, %s",
-              rc, getErrorString(rc));
     kmyth_log(LOG_ERR,
-              "error flushing policy session (handle = 0x%08X) ... exiting",
-              sealData_session.sessionHandle);
+              "error releasing policy session (handle = 0x%08X) ... exiting",
+              sealData_session->sessionHandle);
     return 1;
   }
-  kmyth_log(LOG_DEBUG,
-            "flushed policy authorization session (handle = 0x%08X)",
-            sealData_session.sessionHandle);
 
   return 0;
 }
@@ -735,24 +5633,76 @@ int tpm2_kmyth_unseal_data(TSS2_SYS_CONTEXT * sapi_ctx,
                            TPM2B_DIGEST policyBranch2,
                            uint8_t ** result, size_t *result_size)
 {
-  // Start a TPM 2.0 policy session that we will use to authorize the use of
-  // storage key (SK) to:
+  return tpm2_kmyth_unseal_data_overlap(sapi_ctx, sk_handle,
+                                        sdo_public, sdo_private,
+                                        authVal, pcrList, authPolicy,
+                                        policyBranch1, policyBranch2,
+                                        result, result_size, NULL);
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_data_overlap()
+//############################################################################
+int tpm2_kmyth_unseal_data_overlap(TSS2_SYS_CONTEXT * sapi_ctx,
+                                   TPM2_HANDLE sk_handle,
+                                   TPM2B_PUBLIC sdo_public,
+                                   TPM2B_PRIVATE sdo_private,
+                                   TPM2B_AUTH authVal,
+                                   TPML_PCR_SELECTION pcrList,
+                                   TPM2B_DIGEST authPolicy,
+                                   TPM2B_DIGEST policyBranch1,
+                                   TPM2B_DIGEST policyBranch2,
+                                   uint8_t ** result, size_t *result_size,
+                                   HOST_WORK * host_work)
+{
+  return tpm2_kmyth_unseal_data_ref(sapi_ctx, sk_handle,
+                                    &sdo_public, &sdo_private,
+                                    &authVal, &pcrList, &authPolicy,
+                                    &policyBranch1, &policyBranch2,
+                                    result, result_size, host_work);
+}
+
+//############################################################################
+// tpm2_kmyth_unseal_data_ref()
+//############################################################################
+int tpm2_kmyth_unseal_data_ref(TSS2_SYS_CONTEXT * sapi_ctx,
+                               TPM2_HANDLE sk_handle,
+                               TPM2B_PUBLIC * sdo_public,
+                               TPM2B_PRIVATE * sdo_private,
+                               const TPM2B_AUTH * authVal,
+                               const TPML_PCR_SELECTION * pcrList,
+                               const TPM2B_DIGEST * authPolicy,
+                               const TPM2B_DIGEST * policyBranch1,
+                               const TPM2B_DIGEST * policyBranch2,
+                               uint8_t ** result, size_t *result_size,
+                               HOST_WORK * host_work)
+{
+  // Obtain a TPM 2.0 policy session (from the connection's pool, if one is
+  // idle) that we will use to authorize the use of storage key (SK) to:
   //   1. load the sealed data object into the TPM as a child of the SK
   //   2. unseal it in order to retrieve the wrapping key
   SESSION unsealData_session;
+  kmyth_timings_t *timings = get_tpm2_timings(sapi_ctx);
+  uint64_t phase_start = get_timing_ns();
 
-  if (create_auth_session(sapi_ctx, &unsealData_session, TPM2_SE_POLICY))
+  if (acquire_policy_session(sapi_ctx, &unsealData_session))
   {
     kmyth_log(LOG_ERR, "error starting auth policy session ... exiting");
+    add_phase_timing(timings, KMYTH_PHASE_POLICY, phase_start);
     return 1;
   }
 
   // Apply policy to session context, in preparation for the "load" command
-  if (unseal_apply_policy
-      (sapi_ctx, unsealData_session.sessionHandle, pcrList,
-       policyBranch1, policyBranch2))
+  int policy_failed = unseal_apply_policy(sapi_ctx,
+                                          unsealData_session.sessionHandle,
+                                          *pcrList, *policyBranch1,
+                                          *policyBranch2);
+
+  add_phase_timing(timings, KMYTH_PHASE_POLICY, phase_start);
+  if (policy_failed)
   {
     kmyth_log(LOG_ERR, "apply policy to session context error ... exiting");
+    release_policy_session(sapi_ctx, &unsealData_session, true);
     return 1;
   }
 
@@ -763,11 +5713,12 @@ int tpm2_kmyth_unseal_data(TSS2_SYS_CONTEXT * sapi_ctx,
   if (load_kmyth_object(sapi_ctx,
                         &unsealData_session,
                         sk_handle,
-                        authVal,
-                        pcrList, &sdo_private, &sdo_public, &sdo_handle))
+                        *authVal,
+                        *pcrList, sdo_private, sdo_public, &sdo_handle,
+                        host_work))
   {
     kmyth_log(LOG_ERR, "load error: sealed data object ... exiting");
-    Tss2_Sys_FlushContext(sapi_ctx, unsealData_session.sessionHandle);
+    release_policy_session(sapi_ctx, &unsealData_session, true);
     return 1;
   }
   kmyth_log(LOG_DEBUG, "loaded sealed data object at handle = 0x%08X",
@@ -777,40 +5728,45 @@ int tpm2_kmyth_unseal_data(TSS2_SYS_CONTEXT * sapi_ctx,
   TPM2B_SENSITIVE_DATA unseal_sensitive = {.size = 0, };
   if (unseal_kmyth_object(sapi_ctx,
                           &unsealData_session,
-                          sdo_handle, authVal, policyBranch1, policyBranch2,
-                          pcrList, &unseal_sensitive))
+                          sdo_handle, *authVal, *policyBranch1,
+                          *policyBranch2, *pcrList, &unseal_sensitive,
+                          host_work))
   {
     kmyth_log(LOG_ERR, "error unsealing ... exiting");
 
     // overwrite any potentially unsealed data before exiting early due
     // to failed unseal
     kmyth_clear(unseal_sensitive.buffer, unseal_sensitive.size);
+    release_policy_session(sapi_ctx, &unsealData_session, true);
+    flush_kmyth_transient(sapi_ctx, sdo_handle);
     return 1;
   }
   kmyth_log(LOG_DEBUG, "unsealed data object (handle = 0x%08X)", sdo_handle);
 
-  // Clean-up: done with the policy authorization session setup to enable
-  //           loading and unsealing of the sealed data object, so
-  //           flush it from the TPM
-  TSS2_RC rc = Tss2_Sys_FlushContext(sapi_ctx,
-                                     unsealData_session.sessionHandle);
+  // done with the sealed data object, so flush it from the TPM
+  flush_kmyth_transient(sapi_ctx, sdo_handle);
 
-  if (rc != TSS2_RC_SUCCESS)
+  // Clean-up: done with the policy authorization session setup to enable
+  //           loading and unsealing of the sealed data object, so return
+  //           it to the pool (or flush it from the TPM)
+  if (release_policy_session(sapi_ctx, &unsealData_session, false))
   {
     kmyth_log(LOG_ERR,
-              "Tss2_Sys_FlushContext(): rc = 0x%08X, %s",
-              rc, getErrorString(rc));
-    kmyth_log(LOG_ERR,
-              "error flushing policy session (handle = 0x%08X) ... exiting",
+              "error releasing policy session (handle = 0x%08X) ... exiting",
               unsealData_session.sessionHandle);
     kmyth_clear(unseal_sensitive.buffer, unseal_sensitive.size);
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "flushed policy auth session (handle = 0x%08X)",
-            unsealData_session.sessionHandle);
 
+  // the unsealed data (e.g., a wrapping key) is kept in the secure heap
+  *result = (uint8_t *) kmyth_secure_alloc(unseal_sensitive.size);
+  if (*result == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate unsealed data ... exiting");
+    kmyth_clear(unseal_sensitive.buffer, unseal_sensitive.size);
+    return 1;
+  }
   *result_size = unseal_sensitive.size;
-  *result = (uint8_t *) malloc(*result_size);
 
   memcpy(*result, unseal_sensitive.buffer, *result_size);
   kmyth_clear(unseal_sensitive.buffer, unseal_sensitive.size);
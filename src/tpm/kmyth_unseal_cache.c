@@ -0,0 +1,342 @@
+/**
+ * @file  kmyth_unseal_cache.c
+ * @brief Implements the process-wide unseal cache (see kmyth_unseal_cache.h)
+ *        and kmyth_set_unseal_cache(), declared in kmyth.h
+ */
+
+#include "kmyth_unseal_cache.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+
+#include "defines.h"
+#include "kmyth.h"
+#include "kmyth_metrics.h"
+#include "memory_util.h"
+#include "tpm2_interface.h"
+
+#include "alloc_stats.h"
+
+// A cached unsealed result (an empty entry has no data). The plaintext is
+// kept in the secure heap, and is wiped when the entry is dropped.
+typedef struct
+{
+  uint8_t key[KMYTH_UNSEAL_CACHE_KEY_LEN];
+  uint8_t *data;
+  size_t data_len;
+  uint64_t last_used;
+} kmyth_unseal_cache_entry;
+
+// The cache, shared by the process's threads. It is disabled while
+// kmyth_unseal_cache_max is 0. Every entry was unsealed under the TPM
+// counts in kmyth_unseal_cache_current.
+static kmyth_unseal_cache_entry kmyth_unseal_cache[KMYTH_UNSEAL_CACHE_MAX];
+static size_t kmyth_unseal_cache_max = 0;
+static kmyth_unseal_cache_epoch kmyth_unseal_cache_current;
+static uint64_t kmyth_unseal_cache_clock = 0;
+static uint64_t kmyth_unseal_cache_hits = 0;
+static uint64_t kmyth_unseal_cache_misses = 0;
+static pthread_mutex_t kmyth_unseal_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//############################################################################
+// unseal_cache_drop()
+//############################################################################
+static void unseal_cache_drop(kmyth_unseal_cache_entry * entry)
+{
+  kmyth_secure_free(entry->data);
+  kmyth_clear(entry, sizeof(kmyth_unseal_cache_entry));
+}
+
+//############################################################################
+// unseal_cache_drop_all()
+//############################################################################
+static void unseal_cache_drop_all(void)
+{
+  for (size_t i = 0; i < KMYTH_UNSEAL_CACHE_MAX; i++)
+  {
+    if (kmyth_unseal_cache[i].data != NULL)
+    {
+      unseal_cache_drop(&kmyth_unseal_cache[i]);
+    }
+  }
+}
+
+//############################################################################
+// unseal_cache_check_epoch()
+//############################################################################
+static void unseal_cache_check_epoch(const kmyth_unseal_cache_epoch * epoch)
+{
+  // a PCR extend (or reset) changes the update counter, and the counter
+  // itself restarts when the TPM does, so any change drops every entry
+  if (epoch->pcr_update_counter !=
+      kmyth_unseal_cache_current.pcr_update_counter ||
+      epoch->reset_count != kmyth_unseal_cache_current.reset_count ||
+      epoch->restart_count != kmyth_unseal_cache_current.restart_count)
+  {
+    unseal_cache_drop_all();
+    kmyth_unseal_cache_current = *epoch;
+  }
+}
+
+//############################################################################
+// kmyth_set_unseal_cache()
+//############################################################################
+int kmyth_set_unseal_cache(size_t max_entries)
+{
+  if (max_entries > KMYTH_UNSEAL_CACHE_MAX)
+  {
+    kmyth_log(LOG_ERR, "unseal cache size must not exceed %d ... exiting",
+              KMYTH_UNSEAL_CACHE_MAX);
+    return 1;
+  }
+
+  pthread_mutex_lock(&kmyth_unseal_cache_lock);
+  unseal_cache_drop_all();
+  kmyth_unseal_cache_max = max_entries;
+  kmyth_unseal_cache_hits = 0;
+  kmyth_unseal_cache_misses = 0;
+  pthread_mutex_unlock(&kmyth_unseal_cache_lock);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_unseal_cache_enabled()
+//############################################################################
+bool kmyth_unseal_cache_enabled(void)
+{
+  return __atomic_load_n(&kmyth_unseal_cache_max, __ATOMIC_RELAXED) > 0;
+}
+
+//############################################################################
+// get_unseal_cache_epoch()
+//############################################################################
+int get_unseal_cache_epoch(TSS2_SYS_CONTEXT * sapi_ctx,
+                           kmyth_unseal_cache_epoch * epoch)
+{
+  // an empty selection reads no PCR values, just the update counter
+  TPML_PCR_SELECTION pcrSelectionIn = {.count = 0, };
+  TPML_PCR_SELECTION pcrSelectionOut;
+  TPML_DIGEST pcrValues;
+  uint32_t pcrUpdateCounter = 0;
+  TSS2L_SYS_AUTH_COMMAND *nullCmdAuths = NULL;
+  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+
+  TSS2_RC rc = Tss2_Sys_PCR_Read(sapi_ctx,
+                                 nullCmdAuths,
+                                 &pcrSelectionIn,
+                                 &pcrUpdateCounter,
+                                 &pcrSelectionOut,
+                                 &pcrValues,
+                                 nullRspAuths);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_PCR_Read(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return 1;
+  }
+
+  TPMS_TIME_INFO currentTime;
+
+  rc = Tss2_Sys_ReadClock(sapi_ctx, nullCmdAuths, &currentTime, nullRspAuths);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_ReadClock(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return 1;
+  }
+
+  epoch->pcr_update_counter = pcrUpdateCounter;
+  epoch->reset_count = currentTime.clockInfo.resetCount;
+  epoch->restart_count = currentTime.clockInfo.restartCount;
+
+  return 0;
+}
+
+//############################################################################
+// get_unseal_cache_key()
+//############################################################################
+int get_unseal_cache_key(const uint8_t * input, size_t input_len,
+                         const uint8_t * auth_bytes, size_t auth_bytes_len,
+                         const uint8_t * owner_auth_bytes,
+                         size_t oa_bytes_len, uint8_t bool_policy_or,
+                         uint8_t * key)
+{
+  if (input == NULL || input_len == 0)
+  {
+    return 1;
+  }
+
+  // the lengths are hashed ahead of the (variable length) values, so that
+  // no two different requests hash the same bytes
+  uint64_t lens[3] = { input_len,
+    (auth_bytes == NULL) ? 0 : auth_bytes_len,
+    (owner_auth_bytes == NULL) ? 0 : oa_bytes_len
+  };
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_create();
+  int retval = 1;
+
+  if (md_ctx != NULL &&
+      EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL) &&
+      EVP_DigestUpdate(md_ctx, lens, sizeof(lens)) &&
+      EVP_DigestUpdate(md_ctx, &bool_policy_or, 1) &&
+      EVP_DigestUpdate(md_ctx, input, input_len) &&
+      (lens[1] == 0 || EVP_DigestUpdate(md_ctx, auth_bytes, lens[1])) &&
+      (lens[2] == 0 || EVP_DigestUpdate(md_ctx, owner_auth_bytes, lens[2]))
+      && EVP_DigestFinal_ex(md_ctx, key, NULL))
+  {
+    retval = 0;
+  }
+  EVP_MD_CTX_destroy(md_ctx);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_unseal_cache_lookup()
+//############################################################################
+int kmyth_unseal_cache_lookup(const uint8_t * key,
+                              const kmyth_unseal_cache_epoch * epoch,
+                              uint8_t ** output, size_t *output_len)
+{
+  int retval = 1;
+
+  pthread_mutex_lock(&kmyth_unseal_cache_lock);
+  unseal_cache_check_epoch(epoch);
+  for (size_t i = 0; i < KMYTH_UNSEAL_CACHE_MAX; i++)
+  {
+    kmyth_unseal_cache_entry *entry = &kmyth_unseal_cache[i];
+
+    if (entry->data == NULL ||
+        memcmp(entry->key, key, KMYTH_UNSEAL_CACHE_KEY_LEN) != 0)
+    {
+      continue;
+    }
+
+    *output = malloc(entry->data_len);
+    if (*output != NULL)
+    {
+      memcpy(*output, entry->data, entry->data_len);
+      *output_len = entry->data_len;
+      entry->last_used = ++kmyth_unseal_cache_clock;
+      retval = 0;
+    }
+    break;
+  }
+  kmyth_metrics_count_cache(KMYTH_CACHE_UNSEAL, retval == 0);
+  if (retval == 0)
+  {
+    kmyth_unseal_cache_hits++;
+  }
+  else
+  {
+    kmyth_unseal_cache_misses++;
+  }
+  pthread_mutex_unlock(&kmyth_unseal_cache_lock);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_unseal_cache_insert()
+//############################################################################
+void kmyth_unseal_cache_insert(const uint8_t * key,
+                               const kmyth_unseal_cache_epoch * epoch,
+                               const uint8_t * data, size_t data_len)
+{
+  if (data == NULL || data_len == 0)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&kmyth_unseal_cache_lock);
+
+  // a result unsealed under older counts than the cache's (a PCR changed
+  // meanwhile, and another lookup saw it) is not cached
+  if (kmyth_unseal_cache_max == 0 ||
+      epoch->pcr_update_counter !=
+      kmyth_unseal_cache_current.pcr_update_counter ||
+      epoch->reset_count != kmyth_unseal_cache_current.reset_count ||
+      epoch->restart_count != kmyth_unseal_cache_current.restart_count)
+  {
+    pthread_mutex_unlock(&kmyth_unseal_cache_lock);
+    return;
+  }
+
+  // replace any entry for the same key, else use a free entry, else evict
+  // the least recently used
+  size_t used = 0;
+  size_t slot = KMYTH_UNSEAL_CACHE_MAX;
+  size_t lru = KMYTH_UNSEAL_CACHE_MAX;
+
+  for (size_t i = 0; i < KMYTH_UNSEAL_CACHE_MAX; i++)
+  {
+    kmyth_unseal_cache_entry *entry = &kmyth_unseal_cache[i];
+
+    if (entry->data == NULL)
+    {
+      if (slot == KMYTH_UNSEAL_CACHE_MAX)
+      {
+        slot = i;
+      }
+      continue;
+    }
+    if (memcmp(entry->key, key, KMYTH_UNSEAL_CACHE_KEY_LEN) == 0)
+    {
+      unseal_cache_drop(entry);
+      slot = i;
+      continue;
+    }
+    used++;
+    if (lru == KMYTH_UNSEAL_CACHE_MAX ||
+        entry->last_used < kmyth_unseal_cache[lru].last_used)
+    {
+      lru = i;
+    }
+  }
+  if (used >= kmyth_unseal_cache_max)
+  {
+    unseal_cache_drop(&kmyth_unseal_cache[lru]);
+    slot = lru;
+  }
+
+  kmyth_unseal_cache_entry *entry = &kmyth_unseal_cache[slot];
+
+  entry->data = kmyth_secure_alloc(data_len);
+  if (entry->data == NULL)
+  {
+    pthread_mutex_unlock(&kmyth_unseal_cache_lock);
+    return;
+  }
+  memcpy(entry->data, data, data_len);
+  memcpy(entry->key, key, KMYTH_UNSEAL_CACHE_KEY_LEN);
+  entry->data_len = data_len;
+  entry->last_used = ++kmyth_unseal_cache_clock;
+
+  pthread_mutex_unlock(&kmyth_unseal_cache_lock);
+}
+
+//############################################################################
+// kmyth_unseal_cache_flush()
+//############################################################################
+void kmyth_unseal_cache_flush(void)
+{
+  pthread_mutex_lock(&kmyth_unseal_cache_lock);
+  unseal_cache_drop_all();
+  pthread_mutex_unlock(&kmyth_unseal_cache_lock);
+}
+
+//############################################################################
+// kmyth_unseal_cache_counts()
+//############################################################################
+void kmyth_unseal_cache_counts(uint64_t * hits, uint64_t * misses)
+{
+  pthread_mutex_lock(&kmyth_unseal_cache_lock);
+  *hits = kmyth_unseal_cache_hits;
+  *misses = kmyth_unseal_cache_misses;
+  pthread_mutex_unlock(&kmyth_unseal_cache_lock);
+}
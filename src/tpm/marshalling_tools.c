@@ -7,6 +7,7 @@
 
 #include "tpm/marshalling_tools.h"
 
+#include <pthread.h>
 #include <string.h>
 
 #include <openssl/bio.h>
@@ -15,6 +16,449 @@
 #include <tss2/tss2_mu.h>
 
 #include "defines.h"
+#include "memory_util.h"
+
+#include "alloc_stats.h"
+
+// The .ski blocks, in the order they appear in the file
+//
+// Note: the policy branch blocks are present only when policyOR is used,
+//       the chunk index block only when the encrypted data is chunked, and
+//       the SRK name block only when the sealing TPM is recorded
+enum
+{
+  SKI_SRK_NAME = 0, SKI_PCR_SELECTION_LIST, SKI_POLICY_BRANCH_1,
+  SKI_POLICY_BRANCH_2,
+  SKI_STORAGE_KEY_PUBLIC, SKI_STORAGE_KEY_PRIVATE, SKI_CIPHER_SUITE,
+  SKI_SYM_KEY_PUBLIC, SKI_SYM_KEY_PRIVATE, SKI_CHUNK_INDEX, SKI_ENC_DATA,
+  SKI_END_FILE, SKI_BLOCK_COUNT
+};
+
+static char *const ski_block_delims[SKI_BLOCK_COUNT] = {
+  KMYTH_DELIM_SRK_NAME,
+  KMYTH_DELIM_PCR_SELECTION_LIST,
+  KMYTH_DELIM_POLICY_BRANCH_1,
+  KMYTH_DELIM_POLICY_BRANCH_2,
+  KMYTH_DELIM_STORAGE_KEY_PUBLIC,
+  KMYTH_DELIM_STORAGE_KEY_PRIVATE,
+  KMYTH_DELIM_CIPHER_SUITE,
+  KMYTH_DELIM_SYM_KEY_PUBLIC,
+  KMYTH_DELIM_SYM_KEY_PRIVATE,
+  KMYTH_DELIM_CHUNK_INDEX,
+  KMYTH_DELIM_ENC_DATA,
+  KMYTH_DELIM_END_FILE
+};
+
+typedef struct
+{
+  uint8_t *data;
+  size_t size;
+} ski_block_view;
+
+// The record tag identifying each block in a binary .ski file (the end of
+// file delimiter has no binary equivalent). Records appear in block order,
+// and tags are never reused (the later-added SRK name record is first).
+static const uint8_t ski_block_tags[SKI_BLOCK_COUNT] = {
+  0x0B, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x00
+};
+
+// The temporary (marshalled or decoded) .ski blocks are allocated from a
+// per-thread arena, which is wiped once each .ski has been created or
+// parsed. It has room for every block preceding the encrypted data at
+// twice its raw size (the size of the base-64 decode buffers), twice over
+// to allow for alignment.
+#define SKI_ARENA_SIZE (4 * (sizeof(TPML_PCR_SELECTION) + \
+                             2 * sizeof(TPM2B_DIGEST) + \
+                             2 * sizeof(TPM2B_PUBLIC) + \
+                             2 * sizeof(TPM2B_PRIVATE) + \
+                             KMYTH_MAX_CIPHER_STR_LEN + \
+                             KMYTH_CHUNK_INDEX_SIZE + \
+                             sizeof(TPMU_NAME)))
+
+// An owned marshal cursor's buffer starts at this size, and then doubles
+#define MARSHAL_CURSOR_MIN_SIZE 1024
+
+static pthread_key_t ski_arena_key;
+static bool ski_arena_key_created = false;
+static pthread_once_t ski_arena_key_once = PTHREAD_ONCE_INIT;
+
+//############################################################################
+// free_ski_arena
+//############################################################################
+static void free_ski_arena(void *arg)
+{
+  kmyth_arena_free((kmyth_arena *) arg);
+  free(arg);
+}
+
+//############################################################################
+// create_ski_arena_key
+//############################################################################
+static void create_ski_arena_key(void)
+{
+  ski_arena_key_created =
+    (pthread_key_create(&ski_arena_key, free_ski_arena) == 0);
+}
+
+//############################################################################
+// get_ski_arena
+//############################################################################
+static kmyth_arena *get_ski_arena(void)
+{
+  pthread_once(&ski_arena_key_once, create_ski_arena_key);
+  if (!ski_arena_key_created)
+  {
+    kmyth_log(LOG_ERR, "unable to create .ski arena key ... exiting");
+    return NULL;
+  }
+
+  kmyth_arena *arena = pthread_getspecific(ski_arena_key);
+
+  if (arena != NULL)
+  {
+    return arena;
+  }
+
+  arena = calloc(1, sizeof(kmyth_arena));
+  if (arena == NULL || kmyth_arena_init(arena, SKI_ARENA_SIZE))
+  {
+    kmyth_log(LOG_ERR, "unable to create .ski arena ... exiting");
+    free(arena);
+    return NULL;
+  }
+  if (pthread_setspecific(ski_arena_key, arena) != 0)
+  {
+    kmyth_log(LOG_ERR, "unable to set .ski arena ... exiting");
+    free_ski_arena(arena);
+    return NULL;
+  }
+
+  return arena;
+}
+
+//############################################################################
+// find_ski_blocks
+//############################################################################
+static int find_ski_blocks(uint8_t * input, size_t input_length,
+                           size_t last_block, uint8_t bool_policy_or,
+                           ski_block_view * blocks)
+{
+  // The blocks are located in a single forward pass over the input, and
+  // each is kept as a view into the input buffer (no copies are made). The
+  // input must end with the (otherwise empty) last_block delimiter.
+  uint8_t *position = input;
+  size_t remaining = input_length;
+  bool chunked = false;
+  size_t srk_delim_len = strlen(KMYTH_DELIM_SRK_NAME);
+  size_t first = SKI_PCR_SELECTION_LIST;
+
+  // the SRK name block, if present, precedes the PCR selection list
+  if (remaining >= srk_delim_len &&
+      !memcmp(position, KMYTH_DELIM_SRK_NAME, srk_delim_len))
+  {
+    first = SKI_SRK_NAME;
+  }
+
+  for (size_t i = first; i < last_block; i++)
+  {
+    if (bool_policy_or != 1 &&
+        (i == SKI_POLICY_BRANCH_1 || i == SKI_POLICY_BRANCH_2))
+    {
+      continue;
+    }
+    if (i == SKI_CHUNK_INDEX && !chunked)
+    {
+      continue;
+    }
+
+    size_t next = i + 1;
+
+    if (bool_policy_or != 1 && next == SKI_POLICY_BRANCH_1)
+    {
+      next = SKI_STORAGE_KEY_PUBLIC;
+    }
+
+    // the (base64 encoded) wrapping key private block is followed by the
+    // chunk index block only if the encrypted data is chunked - as the
+    // block contains no '-', the first one found starts the next delimiter
+    if (i == SKI_SYM_KEY_PRIVATE)
+    {
+      size_t delim_len = strlen(ski_block_delims[i]);
+      size_t chunk_delim_len = strlen(KMYTH_DELIM_CHUNK_INDEX);
+      uint8_t *next_delim = NULL;
+
+      if (remaining > delim_len)
+      {
+        next_delim = memchr(position + delim_len, '-', remaining - delim_len);
+      }
+      chunked = (next_delim != NULL &&
+                 (size_t) (input + input_length - next_delim) >=
+                 chunk_delim_len &&
+                 !memcmp(next_delim, KMYTH_DELIM_CHUNK_INDEX,
+                         chunk_delim_len));
+      if (!chunked)
+      {
+        next = SKI_ENC_DATA;
+      }
+    }
+
+    if (get_block_view(&position, &remaining,
+                       &blocks[i].data, &blocks[i].size,
+                       ski_block_delims[i], strlen(ski_block_delims[i]),
+                       ski_block_delims[next],
+                       strlen(ski_block_delims[next])))
+    {
+      kmyth_log(LOG_ERR, "get .ski block (%.*s) error ... exiting",
+                (int) (strlen(ski_block_delims[i]) - 1), ski_block_delims[i]);
+      return 1;
+    }
+  }
+
+  if (remaining != strlen(ski_block_delims[last_block]) ||
+      memcmp(position, ski_block_delims[last_block], remaining))
+  {
+    kmyth_log(LOG_ERR, "unable to find the end delimiter ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// unpack_ski_chunk_index
+//############################################################################
+static int unpack_ski_chunk_index(uint8_t * input, size_t input_length,
+                                  size_t *chunk_size,
+                                  size_t *chunked_data_len)
+{
+  if (input_length != KMYTH_CHUNK_INDEX_SIZE)
+  {
+    kmyth_log(LOG_ERR, "invalid chunk index size ... exiting");
+    return 1;
+  }
+
+  uint32_t version = 0;
+  uint32_t size = 0;
+  uint64_t data_len = 0;
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    version = (version << 8) | input[i];
+    size = (size << 8) | input[4 + i];
+  }
+  for (size_t i = 8; i < KMYTH_CHUNK_INDEX_SIZE; i++)
+  {
+    data_len = (data_len << 8) | input[i];
+  }
+
+  if (version != KMYTH_CHUNK_INDEX_VERSION)
+  {
+    kmyth_log(LOG_ERR, "unsupported chunk index version (%u) ... exiting",
+              version);
+    return 1;
+  }
+  if (size == 0 || data_len == 0 || data_len > SIZE_MAX)
+  {
+    kmyth_log(LOG_ERR, "invalid chunk index ... exiting");
+    return 1;
+  }
+
+  *chunk_size = size;
+  *chunked_data_len = (size_t) data_len;
+
+  return 0;
+}
+
+//############################################################################
+// unmarshal_ski_raw_blocks
+//############################################################################
+static int unmarshal_ski_raw_blocks(ski_block_view * raw, Ski * output)
+{
+  // create cipher suite struct (the raw cipher suite block is the cipher
+  // name without a string terminator, which is added in a local copy)
+  char cipher_str[KMYTH_MAX_CIPHER_STR_LEN + 1];
+
+  if (raw[SKI_CIPHER_SUITE].size == 0 ||
+      raw[SKI_CIPHER_SUITE].size >= sizeof(cipher_str))
+  {
+    kmyth_log(LOG_ERR, "invalid cipher string length ... exiting");
+    return 1;
+  }
+  memcpy(cipher_str, raw[SKI_CIPHER_SUITE].data, raw[SKI_CIPHER_SUITE].size);
+  cipher_str[raw[SKI_CIPHER_SUITE].size] = '\0';
+
+  // a compression tag, if any, follows the cipher name
+  char *compression_tag = strchr(cipher_str, KMYTH_COMPRESSION_TAG_SEPARATOR);
+
+  if (compression_tag != NULL)
+  {
+    *compression_tag++ = '\0';
+    if (kmyth_get_compression_from_string(compression_tag,
+                                          &output->compression) ||
+        output->compression == KMYTH_COMPRESSION_NONE)
+    {
+      kmyth_log(LOG_ERR, "unsupported compression (%s) ... exiting",
+                compression_tag);
+      return 1;
+    }
+  }
+  output->cipher = kmyth_get_cipher_t_from_string(cipher_str);
+  if (output->cipher.cipher_name == NULL)
+  {
+    kmyth_log(LOG_ERR, "cipher_t init error ... exiting");
+    return 1;
+  }
+
+  if (raw[SKI_SRK_NAME].data != NULL)
+  {
+    if (raw[SKI_SRK_NAME].size > sizeof(output->srk_name.name))
+    {
+      kmyth_log(LOG_ERR, "invalid SRK name size ... exiting");
+      return 1;
+    }
+    memcpy(output->srk_name.name, raw[SKI_SRK_NAME].data,
+           raw[SKI_SRK_NAME].size);
+    output->srk_name.size = (UINT16) raw[SKI_SRK_NAME].size;
+  }
+
+  // chunked data is never compressed
+  if (raw[SKI_CHUNK_INDEX].data != NULL &&
+      output->compression != KMYTH_COMPRESSION_NONE)
+  {
+    kmyth_log(LOG_ERR, "compressed chunked data ... exiting");
+    return 1;
+  }
+
+  if (raw[SKI_CHUNK_INDEX].data != NULL &&
+      unpack_ski_chunk_index(raw[SKI_CHUNK_INDEX].data,
+                             raw[SKI_CHUNK_INDEX].size,
+                             &output->chunk_size, &output->chunked_data_len))
+  {
+    kmyth_log(LOG_ERR, "invalid chunk index ... exiting");
+    return 1;
+  }
+
+  // each TPM object is unmarshalled from a view of its own block
+  unmarshal_view views[SKI_BLOCK_COUNT];
+
+  for (size_t i = SKI_SRK_NAME; i < SKI_ENC_DATA; i++)
+  {
+    unmarshal_view_init(&views[i], raw[i].data, raw[i].size);
+  }
+
+  int retval = 0;
+
+  retval |= view_unpack_pcr(&views[SKI_PCR_SELECTION_LIST], &output->pcr_list);
+
+  // policy branches are present only if policyOR was used
+  if (raw[SKI_POLICY_BRANCH_1].data != NULL &&
+      raw[SKI_POLICY_BRANCH_2].data != NULL)
+  {
+    retval |= view_unpack_digest(&views[SKI_POLICY_BRANCH_1],
+                                 &output->policyBranch1);
+    retval |= view_unpack_digest(&views[SKI_POLICY_BRANCH_2],
+                                 &output->policyBranch2);
+  }
+  retval |= view_unpack_public(&views[SKI_STORAGE_KEY_PUBLIC],
+                               &output->sk_pub);
+  retval |= view_unpack_private(&views[SKI_STORAGE_KEY_PRIVATE],
+                                &output->sk_priv);
+  retval |= view_unpack_public(&views[SKI_SYM_KEY_PUBLIC], &output->wk_pub);
+  retval |= view_unpack_private(&views[SKI_SYM_KEY_PRIVATE],
+                                &output->wk_priv);
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unmarshal .ski object error ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// unmarshal_ski_blocks
+//############################################################################
+static int unmarshal_ski_blocks(ski_block_view * blocks,
+                                uint8_t bool_policy_or, Ski * output)
+{
+  ski_block_view raw[SKI_BLOCK_COUNT] = { {NULL, 0} };
+
+  // the cipher suite block is terminated by a newline, which is not part
+  // of the cipher name
+  if (blocks[SKI_CIPHER_SUITE].size == 0)
+  {
+    kmyth_log(LOG_ERR, "empty cipher string ... exiting");
+    return 1;
+  }
+  raw[SKI_CIPHER_SUITE].data = blocks[SKI_CIPHER_SUITE].data;
+  raw[SKI_CIPHER_SUITE].size = blocks[SKI_CIPHER_SUITE].size - 1;
+
+  // Decode the marshalled TPM structures straight into fixed size buffers
+  // (from the arena). The buffers are sized so that a well-formed .ski
+  // block always fits - anything larger is rejected as malformed by the
+  // decoder.
+  size_t buffer_sizes[SKI_BLOCK_COUNT] = { 0 };
+
+  buffer_sizes[SKI_PCR_SELECTION_LIST] = 2 * sizeof(TPML_PCR_SELECTION);
+  buffer_sizes[SKI_STORAGE_KEY_PUBLIC] = 2 * sizeof(TPM2B_PUBLIC);
+  buffer_sizes[SKI_STORAGE_KEY_PRIVATE] = 2 * sizeof(TPM2B_PRIVATE);
+  buffer_sizes[SKI_SYM_KEY_PUBLIC] = 2 * sizeof(TPM2B_PUBLIC);
+  buffer_sizes[SKI_SYM_KEY_PRIVATE] = 2 * sizeof(TPM2B_PRIVATE);
+  if (bool_policy_or == 1)
+  {
+    buffer_sizes[SKI_POLICY_BRANCH_1] = 2 * sizeof(TPM2B_DIGEST);
+    buffer_sizes[SKI_POLICY_BRANCH_2] = 2 * sizeof(TPM2B_DIGEST);
+  }
+  if (blocks[SKI_CHUNK_INDEX].data != NULL)
+  {
+    if (blocks[SKI_CHUNK_INDEX].size >
+        KMYTH_BASE64_ENCODED_SIZE(KMYTH_CHUNK_INDEX_SIZE))
+    {
+      kmyth_log(LOG_ERR, "invalid chunk index ... exiting");
+      return 1;
+    }
+    buffer_sizes[SKI_CHUNK_INDEX] = 2 * KMYTH_CHUNK_INDEX_SIZE;
+  }
+  if (blocks[SKI_SRK_NAME].data != NULL)
+  {
+    buffer_sizes[SKI_SRK_NAME] = 2 * sizeof(TPMU_NAME);
+  }
+
+  kmyth_arena *arena = get_ski_arena();
+
+  if (arena == NULL)
+  {
+    return 1;
+  }
+
+  for (size_t i = SKI_SRK_NAME; i < SKI_ENC_DATA; i++)
+  {
+    if (buffer_sizes[i] == 0)
+    {
+      continue;
+    }
+    raw[i].data = kmyth_arena_alloc(arena, buffer_sizes[i]);
+    if (raw[i].data == NULL)
+    {
+      kmyth_log(LOG_ERR, ".ski arena exhausted ... exiting");
+      kmyth_arena_reset(arena);
+      return 1;
+    }
+    if (decodeBase64DataInto(blocks[i].data, blocks[i].size,
+                             raw[i].data, buffer_sizes[i], &raw[i].size))
+    {
+      kmyth_log(LOG_ERR, "base64 decode error ... exiting");
+      kmyth_arena_reset(arena);
+      return 1;
+    }
+  }
+
+  int retval = unmarshal_ski_raw_blocks(raw, output);
+
+  kmyth_arena_reset(arena);
+
+  return retval;
+}
 
 //############################################################################
 // parse_ski_bytes
@@ -29,428 +473,795 @@ int parse_ski_bytes(uint8_t * input, size_t input_length, Ski * output,
     return 1;
   }
 
-  uint8_t *position = input;
-  size_t remaining = input_length;
-  Ski temp_ski = get_default_ski();
+  // binary .ski files are self-describing (bool_policy_or is not needed)
+  if (is_binary_ski_bytes(input, input_length))
+  {
+    return parse_ski_binary_bytes(input, input_length, output);
+  }
+
+  ski_block_view blocks[SKI_BLOCK_COUNT] = { {NULL, 0} };
+
+  if (find_ski_blocks(input, input_length, SKI_END_FILE, bool_policy_or,
+                      blocks))
+  {
+    return 1;
+  }
 
-  // read in (parse out) 'raw' (encoded) PCR selection list block
-  uint8_t *raw_pcr_select_list_data = NULL;
-  size_t raw_pcr_select_list_size = 0;
+  Ski temp_ski;
 
-  uint8_t *raw_pb_1_data = NULL;
-  size_t raw_pb_1_size = 0;
-  uint8_t *raw_pb_2_data = NULL;
-  size_t raw_pb_2_size = 0;
+  init_default_ski(&temp_ski);
 
-  if (bool_policy_or == 1)
+  if (unmarshal_ski_blocks(blocks, bool_policy_or, &temp_ski))
+  {
+    return 1;
+  }
+
+  // decode the encrypted data block directly into its final (ski) buffer
+  size_t enc_data_max = KMYTH_BASE64_DECODED_MAX(blocks[SKI_ENC_DATA].size);
+
+  temp_ski.enc_data = malloc(enc_data_max);
+  if (temp_ski.enc_data == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error (%lu bytes) ... exiting", enc_data_max);
+    return 1;
+  }
+  if (decodeBase64DataInto(blocks[SKI_ENC_DATA].data,
+                           blocks[SKI_ENC_DATA].size,
+                           temp_ski.enc_data, enc_data_max,
+                           &temp_ski.enc_data_size))
+  {
+    kmyth_log(LOG_ERR, "base64 decode error ... exiting");
+    free_ski(&temp_ski);
+    return 1;
+  }
+
+  *output = temp_ski;
+  return 0;
+}
+
+//############################################################################
+// parse_ski_header_bytes
+//############################################################################
+int parse_ski_header_bytes(uint8_t * input, size_t input_length,
+                           Ski * output, uint8_t bool_policy_or)
+{
+  if (input == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input cannot be parsed ... exiting");
+    return 1;
+  }
+
+  ski_block_view blocks[SKI_BLOCK_COUNT] = { {NULL, 0} };
+
+  if (find_ski_blocks(input, input_length, SKI_ENC_DATA, bool_policy_or,
+                      blocks))
   {
-    if (get_block_bytes((char **) &position,
-                        &remaining,
-                        &raw_pcr_select_list_data,
-                        &raw_pcr_select_list_size,
-                        KMYTH_DELIM_PCR_SELECTION_LIST,
-                        strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
-                        KMYTH_DELIM_POLICY_BRANCH_1,
-                        strlen(KMYTH_DELIM_POLICY_BRANCH_1)))
+    return 1;
+  }
+
+  Ski temp_ski;
+
+  init_default_ski(&temp_ski);
+
+  if (unmarshal_ski_blocks(blocks, bool_policy_or, &temp_ski))
+  {
+    return 1;
+  }
+
+  *output = temp_ski;
+  return 0;
+}
+
+//############################################################################
+// parse_ski_metadata
+//############################################################################
+int parse_ski_metadata(uint8_t * input, size_t input_length, Ski * output,
+                       size_t *header_length)
+{
+  if (input == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input cannot be parsed ... exiting");
+    return 1;
+  }
+
+  Ski temp_ski;
+
+  init_default_ski(&temp_ski);
+
+  if (is_binary_ski_bytes(input, input_length))
+  {
+    ski_block_view raw[SKI_BLOCK_COUNT] = { {NULL, 0} };
+
+    if (find_ski_binary_records(input, input_length, true, raw) ||
+        unmarshal_ski_raw_blocks(raw, &temp_ski))
     {
-      kmyth_log(LOG_ERR, "get PCR selection list error ... exiting");
-      free(raw_pcr_select_list_data);
       return 1;
     }
+    *output = temp_ski;
+    if (header_length != NULL)
+    {
+      *header_length = (size_t) (raw[SKI_ENC_DATA].data - input);
+    }
+    return 0;
+  }
+
+  // The header ends at the (first) encrypted data delimiter, and has the
+  // policy branch blocks only if a delimiter for them comes before it -
+  // neither can appear inside a (base64 encoded) block
+  size_t delim_len = strlen(KMYTH_DELIM_ENC_DATA);
+  uint8_t *enc_delim = memmem(input, input_length, KMYTH_DELIM_ENC_DATA,
+                              delim_len);
 
-    if (get_block_bytes((char **) &position,
-                        &remaining,
-                        &raw_pb_1_data,
-                        &raw_pb_1_size,
-                        KMYTH_DELIM_POLICY_BRANCH_1,
-                        strlen(KMYTH_DELIM_POLICY_BRANCH_1),
-                        KMYTH_DELIM_POLICY_BRANCH_2,
-                        strlen(KMYTH_DELIM_POLICY_BRANCH_2)))
+  if (enc_delim == NULL)
+  {
+    kmyth_log(LOG_ERR, "no encrypted data delimiter in .ski header "
+              "... exiting");
+    return 1;
+  }
+
+  size_t header_len = (size_t) (enc_delim - input) + delim_len;
+  uint8_t bool_policy_or =
+    (memmem(input, header_len, KMYTH_DELIM_POLICY_BRANCH_1,
+            strlen(KMYTH_DELIM_POLICY_BRANCH_1)) != NULL);
+
+  if (parse_ski_header_bytes(input, header_len, &temp_ski, bool_policy_or))
+  {
+    return 1;
+  }
+
+  *output = temp_ski;
+  if (header_length != NULL)
+  {
+    *header_length = header_len;
+  }
+  return 0;
+}
+
+//############################################################################
+// parse_chunked_ski_bytes
+//############################################################################
+int parse_chunked_ski_bytes(uint8_t * input, size_t input_length,
+                            Ski * output, uint8_t bool_policy_or,
+                            uint8_t ** enc_data64, size_t *enc_data64_size)
+{
+  if (input == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input cannot be parsed ... exiting");
+    return 1;
+  }
+
+  ski_block_view blocks[SKI_BLOCK_COUNT] = { {NULL, 0} };
+
+  if (find_ski_blocks(input, input_length, SKI_END_FILE, bool_policy_or,
+                      blocks))
+  {
+    return 1;
+  }
+
+  if (blocks[SKI_CHUNK_INDEX].data == NULL)
+  {
+    kmyth_log(LOG_ERR, "no chunk index (encrypted data not chunked) "
+              "... exiting");
+    return 1;
+  }
+
+  Ski temp_ski;
+
+  init_default_ski(&temp_ski);
+
+  if (unmarshal_ski_blocks(blocks, bool_policy_or, &temp_ski))
+  {
+    return 1;
+  }
+
+  *output = temp_ski;
+  *enc_data64 = blocks[SKI_ENC_DATA].data;
+  *enc_data64_size = blocks[SKI_ENC_DATA].size;
+  return 0;
+}
+
+//############################################################################
+// get_ski_srk_name
+//############################################################################
+int get_ski_srk_name(uint8_t * input, size_t input_length,
+                     TPM2B_NAME * srk_name)
+{
+  // Only the start of the input is examined, as the SRK name (if recorded)
+  // is the first block - the rest of the .ski is left to the full parse.
+  srk_name->size = 0;
+
+  if (input == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input cannot be parsed ... exiting");
+    return 1;
+  }
+
+  uint8_t *data = NULL;
+  size_t size = 0;
+  uint8_t decoded[2 * sizeof(TPMU_NAME)];
+
+  if (is_binary_ski_bytes(input, input_length))
+  {
+    size_t position = KMYTH_SKI_BINARY_MAGIC_SIZE + 1;
+
+    if (input_length < position + KMYTH_SKI_BINARY_RECORD_HEADER_SIZE ||
+        input[position] != ski_block_tags[SKI_SRK_NAME])
     {
-      kmyth_log(LOG_ERR, "get policy branch 1 error ... exiting");
-      free(raw_pcr_select_list_data);
-      free(raw_pb_1_data);
+      return 0;
+    }
+    for (size_t i = 1; i < KMYTH_SKI_BINARY_RECORD_HEADER_SIZE; i++)
+    {
+      size = (size << 8) | input[position + i];
+    }
+    position += KMYTH_SKI_BINARY_RECORD_HEADER_SIZE;
+    if (size > input_length - position)
+    {
+      kmyth_log(LOG_ERR, "invalid binary .ski record (0x%02X) length "
+                "... exiting", ski_block_tags[SKI_SRK_NAME]);
       return 1;
     }
+    data = input + position;
+  }
+  else
+  {
+    size_t delim_len = strlen(KMYTH_DELIM_SRK_NAME);
+
+    if (input_length < delim_len ||
+        memcmp(input, KMYTH_DELIM_SRK_NAME, delim_len))
+    {
+      return 0;
+    }
 
-    if (get_block_bytes((char **) &position,
-                        &remaining,
-                        &raw_pb_2_data,
-                        &raw_pb_2_size,
-                        KMYTH_DELIM_POLICY_BRANCH_2,
-                        strlen(KMYTH_DELIM_POLICY_BRANCH_2),
-                        KMYTH_DELIM_STORAGE_KEY_PUBLIC,
-                        strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC)))
+    uint8_t *position = input;
+    size_t remaining = input_length;
+    uint8_t *block = NULL;
+    size_t block_size = 0;
+
+    if (get_block_view(&position, &remaining, &block, &block_size,
+                       KMYTH_DELIM_SRK_NAME, delim_len,
+                       KMYTH_DELIM_PCR_SELECTION_LIST,
+                       strlen(KMYTH_DELIM_PCR_SELECTION_LIST)) ||
+        block_size > KMYTH_BASE64_ENCODED_SIZE(sizeof(TPMU_NAME)) ||
+        decodeBase64DataInto(block, block_size, decoded, sizeof(decoded),
+                             &size))
     {
-      kmyth_log(LOG_ERR, "get policy branch 2 error ... exiting");
-      free(raw_pcr_select_list_data);
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
+      kmyth_log(LOG_ERR, "invalid SRK name block ... exiting");
       return 1;
     }
+    data = decoded;
+  }
 
+  if (size == 0 || size > sizeof(srk_name->name))
+  {
+    kmyth_log(LOG_ERR, "invalid SRK name size ... exiting");
+    return 1;
   }
-  else
+  memcpy(srk_name->name, data, size);
+  srk_name->size = (UINT16) size;
+
+  return 0;
+}
+
+//############################################################################
+// is_binary_ski_bytes
+//############################################################################
+bool is_binary_ski_bytes(uint8_t * input, size_t input_length)
+{
+  return (input != NULL && input_length >= KMYTH_SKI_BINARY_MAGIC_SIZE &&
+          !memcmp(input, KMYTH_SKI_BINARY_MAGIC, KMYTH_SKI_BINARY_MAGIC_SIZE));
+}
+
+//############################################################################
+// find_ski_binary_records
+//############################################################################
+static int find_ski_binary_records(uint8_t * input, size_t input_length,
+                                   bool header_only, ski_block_view * raw)
+{
+  if (!is_binary_ski_bytes(input, input_length))
+  {
+    kmyth_log(LOG_ERR, "input is not a binary .ski ... exiting");
+    return 1;
+  }
+  if (input_length < KMYTH_SKI_BINARY_MAGIC_SIZE + 1 ||
+      input[KMYTH_SKI_BINARY_MAGIC_SIZE] != KMYTH_SKI_BINARY_VERSION)
   {
-    if (get_block_bytes((char **) &position,
-                        &remaining,
-                        &raw_pcr_select_list_data,
-                        &raw_pcr_select_list_size,
-                        KMYTH_DELIM_PCR_SELECTION_LIST,
-                        strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
-                        KMYTH_DELIM_STORAGE_KEY_PUBLIC,
-                        strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC)))
+    kmyth_log(LOG_ERR, "unsupported binary .ski version ... exiting");
+    return 1;
+  }
+
+  // walk the (tag, length, value) records - each is kept as a view into
+  // the input buffer and the raw block contents are used as they are
+  size_t position = KMYTH_SKI_BINARY_MAGIC_SIZE + 1;
+  size_t block = 0;
+
+  while (position < input_length)
+  {
+    if (input_length - position < KMYTH_SKI_BINARY_RECORD_HEADER_SIZE)
+    {
+      kmyth_log(LOG_ERR, "truncated binary .ski record ... exiting");
+      return 1;
+    }
+
+    uint8_t tag = input[position];
+    size_t length = 0;
+
+    for (size_t i = 1; i < KMYTH_SKI_BINARY_RECORD_HEADER_SIZE; i++)
+    {
+      length = (length << 8) | input[position + i];
+    }
+    position += KMYTH_SKI_BINARY_RECORD_HEADER_SIZE;
+
+    // records must appear (at most once each) in file order
+    while (block < SKI_ENC_DATA && ski_block_tags[block] != tag)
+    {
+      block++;
+    }
+    if (ski_block_tags[block] != tag || raw[block].data != NULL)
+    {
+      kmyth_log(LOG_ERR, "unexpected binary .ski record (0x%02X) "
+                "... exiting", tag);
+      return 1;
+    }
+
+    // for just the header, the encrypted data record's header is enough
+    // (its size is kept, but the data need not be in the input)
+    if (block == SKI_ENC_DATA && header_only)
+    {
+      raw[block].data = input + position;
+      raw[block].size = length;
+      break;
+    }
+
+    if (block == SKI_ENC_DATA && position + length != input_length)
+    {
+      kmyth_log(LOG_ERR, "unexpected binary .ski record (0x%02X) "
+                "... exiting", tag);
+      return 1;
+    }
+    if (length == 0 || length > input_length - position)
     {
-      kmyth_log(LOG_ERR, "get PCR selection list error ... exiting");
-      free(raw_pcr_select_list_data);
+      kmyth_log(LOG_ERR, "invalid binary .ski record (0x%02X) length "
+                "... exiting", tag);
       return 1;
     }
+
+    raw[block].data = input + position;
+    raw[block].size = length;
+    position += length;
+  }
+
+  if (raw[SKI_PCR_SELECTION_LIST].data == NULL ||
+      raw[SKI_STORAGE_KEY_PUBLIC].data == NULL ||
+      raw[SKI_STORAGE_KEY_PRIVATE].data == NULL ||
+      raw[SKI_CIPHER_SUITE].data == NULL ||
+      raw[SKI_SYM_KEY_PUBLIC].data == NULL ||
+      raw[SKI_SYM_KEY_PRIVATE].data == NULL ||
+      raw[SKI_ENC_DATA].data == NULL ||
+      (raw[SKI_POLICY_BRANCH_1].data == NULL) !=
+      (raw[SKI_POLICY_BRANCH_2].data == NULL))
+  {
+    kmyth_log(LOG_ERR, "missing binary .ski record ... exiting");
+    return 1;
   }
 
-  // read in (parse out) 'raw' (encoded) public data block for the storage key
-  uint8_t *raw_sk_pub_data = NULL;
-  size_t raw_sk_pub_size = 0;
+  return 0;
+}
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_sk_pub_data,
-                      &raw_sk_pub_size,
-                      KMYTH_DELIM_STORAGE_KEY_PUBLIC,
-                      strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC),
-                      KMYTH_DELIM_STORAGE_KEY_PRIVATE,
-                      strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE)))
+//############################################################################
+// parse_ski_binary_bytes
+//############################################################################
+int parse_ski_binary_bytes(uint8_t * input, size_t input_length, Ski * output)
+{
+  ski_block_view raw[SKI_BLOCK_COUNT] = { {NULL, 0} };
+
+  if (find_ski_binary_records(input, input_length, false, raw))
   {
-    kmyth_log(LOG_ERR, "get storage key public error ... exiting");
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    if (bool_policy_or == 1)
+    return 1;
+  }
+
+  Ski temp_ski;
+
+  init_default_ski(&temp_ski);
+
+  if (unmarshal_ski_raw_blocks(raw, &temp_ski))
+  {
+    return 1;
+  }
+
+  temp_ski.enc_data = malloc(raw[SKI_ENC_DATA].size);
+  if (temp_ski.enc_data == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error (%lu bytes) ... exiting",
+              raw[SKI_ENC_DATA].size);
+    return 1;
+  }
+  memcpy(temp_ski.enc_data, raw[SKI_ENC_DATA].data, raw[SKI_ENC_DATA].size);
+  temp_ski.enc_data_size = raw[SKI_ENC_DATA].size;
+
+  *output = temp_ski;
+  return 0;
+}
+
+//############################################################################
+// pack_ski_chunk_index
+//############################################################################
+int pack_ski_chunk_index(size_t chunk_size, size_t chunked_data_len,
+                         uint8_t * output)
+{
+  if (chunk_size == 0 || chunk_size > UINT32_MAX || chunked_data_len == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid chunk size/data length ... exiting");
+    return 1;
+  }
+
+  uint32_t version = KMYTH_CHUNK_INDEX_VERSION;
+  uint32_t size = (uint32_t) chunk_size;
+  uint64_t data_len = (uint64_t) chunked_data_len;
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    output[i] = (uint8_t) (version >> (24 - 8 * i));
+    output[4 + i] = (uint8_t) (size >> (24 - 8 * i));
+  }
+  for (size_t i = 0; i < 8; i++)
+  {
+    output[8 + i] = (uint8_t) (data_len >> (56 - 8 * i));
+  }
+
+  return 0;
+}
+
+//############################################################################
+// marshal_ski_blocks
+//############################################################################
+static int marshal_ski_blocks(Ski * input, kmyth_arena * arena,
+                              uint8_t ** data, size_t *size)
+{
+  // The (raw) contents of each .ski block preceding the encrypted data are
+  // returned in the block indexed data/size arrays - absent blocks (policy
+  // branches without policyOR, chunk index if not chunked, SRK name if not
+  // recorded) are left NULL.
+  // The cipher suite block holds the cipher name, and any compression tag
+  // (without a terminator).
+  // The blocks are allocated from the arena, which the caller must reset
+  // once it is done with them (or if this fails).
+  for (size_t i = 0; i < SKI_BLOCK_COUNT; i++)
+  {
+    data[i] = NULL;
+    size[i] = 0;
+  }
+
+  if (input->cipher.cipher_name == NULL ||
+      strlen(input->cipher.cipher_name) == 0)
+  {
+    kmyth_log(LOG_ERR, "cannot write empty sections ... exiting");
+    return 1;
+  }
+
+  if (input->sk_pub.size == 0 || input->sk_priv.size == 0 ||
+      input->wk_pub.size == 0 || input->wk_priv.size == 0)
+  {
+    kmyth_log(LOG_ERR, "input structs to be packed NULL or empty ... exiting");
+    return 1;
+  }
+
+  // the cipher name is followed by the compression tag (if compressed)
+  const char *compression_tag = kmyth_get_compression_name(input->compression);
+
+  size[SKI_CIPHER_SUITE] = strlen(input->cipher.cipher_name);
+  if (compression_tag != NULL)
+  {
+    size[SKI_CIPHER_SUITE] += 1 + strlen(compression_tag);
+  }
+  if (size[SKI_CIPHER_SUITE] > KMYTH_MAX_CIPHER_STR_LEN)
+  {
+    kmyth_log(LOG_ERR, "cipher suite too long ... exiting");
+    return 1;
+  }
+
+  // chunked encrypted data is preceded by its chunk index
+  if (input->chunk_size != 0)
+  {
+    size[SKI_CHUNK_INDEX] = KMYTH_CHUNK_INDEX_SIZE;
+  }
+
+  // the SRK name (raw, without its size) is recorded only if known
+  if (input->srk_name.size != 0)
+  {
+    size[SKI_SRK_NAME] = input->srk_name.size;
+  }
+
+  for (size_t i = SKI_SRK_NAME; i < SKI_ENC_DATA; i++)
+  {
+    if (size[i] == 0)
     {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
+      continue;
+    }
+    data[i] = (uint8_t *) kmyth_arena_alloc(arena, size[i]);
+    if (data[i] == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate memory for .ski block (%.*s) "
+                "... exiting", (int) (strlen(ski_block_delims[i]) - 1),
+                ski_block_delims[i]);
+      return 1;
     }
+  }
+
+  // The TPM objects are marshalled one after another into a single arena
+  // block, with room for the largest object of each type, and each of
+  // their .ski blocks is the part of it that its object was marshalled to.
+  // Policy branches are included only if both are present (policyOR).
+  static const size_t tpm_blocks[] = {
+    SKI_PCR_SELECTION_LIST, SKI_POLICY_BRANCH_1, SKI_POLICY_BRANCH_2,
+    SKI_STORAGE_KEY_PUBLIC, SKI_STORAGE_KEY_PRIVATE, SKI_SYM_KEY_PUBLIC,
+    SKI_SYM_KEY_PRIVATE
+  };
+  bool policy_or = (input->policyBranch1.size > 0 &&
+                    input->policyBranch2.size > 0);
+  size_t objects_size = sizeof(input->pcr_list) + 2 * sizeof(TPM2B_DIGEST) +
+    2 * sizeof(TPM2B_PUBLIC) + 2 * sizeof(TPM2B_PRIVATE);
+  uint8_t *objects = (uint8_t *) kmyth_arena_alloc(arena, objects_size);
+
+  if (objects == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate memory for .ski objects "
+              "... exiting");
     return 1;
   }
 
-  // read in (parse out) 'raw' (encoded) private data block for the storage key
-  uint8_t *raw_sk_priv_data = NULL;
-  size_t raw_sk_priv_size = 0;
+  marshal_cursor cursor;
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_sk_priv_data,
-                      &raw_sk_priv_size,
-                      KMYTH_DELIM_STORAGE_KEY_PRIVATE,
-                      strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE),
-                      KMYTH_DELIM_CIPHER_SUITE,
-                      strlen(KMYTH_DELIM_CIPHER_SUITE)))
+  marshal_cursor_init(&cursor, objects, objects_size);
+  for (size_t j = 0; j < sizeof(tpm_blocks) / sizeof(tpm_blocks[0]); j++)
   {
-    kmyth_log(LOG_ERR, "get storage key private error ... exiting");
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    if (bool_policy_or == 1)
+    size_t i = tpm_blocks[j];
+    size_t start = cursor.offset;
+    int retval = 0;
+
+    switch (i)
+    {
+    case SKI_PCR_SELECTION_LIST:
+      retval = cursor_pack_pcr(&cursor, &input->pcr_list);
+      // the block keeps the size of the (unmarshalled) list, so the zero
+      // fill following the marshalled list is part of it
+      if (retval == 0 && cursor.offset < start + sizeof(input->pcr_list))
+      {
+        cursor.offset = start + sizeof(input->pcr_list);
+      }
+      break;
+    case SKI_POLICY_BRANCH_1:
+    case SKI_POLICY_BRANCH_2:
+      if (!policy_or)
+      {
+        continue;
+      }
+      retval = cursor_pack_digest(&cursor, (i == SKI_POLICY_BRANCH_1) ?
+                                  &input->policyBranch1 :
+                                  &input->policyBranch2);
+      break;
+    case SKI_STORAGE_KEY_PUBLIC:
+      retval = cursor_pack_public(&cursor, &input->sk_pub);
+      break;
+    case SKI_STORAGE_KEY_PRIVATE:
+      retval = cursor_pack_private(&cursor, &input->sk_priv);
+      break;
+    case SKI_SYM_KEY_PUBLIC:
+      retval = cursor_pack_public(&cursor, &input->wk_pub);
+      break;
+    default:
+      retval = cursor_pack_private(&cursor, &input->wk_priv);
+      break;
+    }
+    if (retval)
     {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
+      kmyth_log(LOG_ERR, "unable to marshal .ski block (%.*s) ... exiting",
+                (int) (strlen(ski_block_delims[i]) - 1), ski_block_delims[i]);
+      return 1;
     }
+    data[i] = objects + start;
+    size[i] = cursor.offset - start;
+  }
+
+  size_t cipher_name_len = strlen(input->cipher.cipher_name);
+
+  memcpy(data[SKI_CIPHER_SUITE], input->cipher.cipher_name, cipher_name_len);
+  if (compression_tag != NULL)
+  {
+    data[SKI_CIPHER_SUITE][cipher_name_len] = KMYTH_COMPRESSION_TAG_SEPARATOR;
+    memcpy(data[SKI_CIPHER_SUITE] + cipher_name_len + 1, compression_tag,
+           strlen(compression_tag));
+  }
+
+  if (data[SKI_SRK_NAME] != NULL)
+  {
+    memcpy(data[SKI_SRK_NAME], input->srk_name.name, size[SKI_SRK_NAME]);
+  }
+
+  if (data[SKI_CHUNK_INDEX] != NULL &&
+      pack_ski_chunk_index(input->chunk_size, input->chunked_data_len,
+                           data[SKI_CHUNK_INDEX]))
+  {
+    kmyth_log(LOG_ERR, "error encoding chunk index ... exiting");
     return 1;
   }
 
-  // read in (parse out) cipher suite string data block for the storage key
-  uint8_t *raw_cipher_str_data = NULL;
-  size_t raw_cipher_str_size = 0;
+  return 0;
+}
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_cipher_str_data,
-                      &raw_cipher_str_size,
-                      KMYTH_DELIM_CIPHER_SUITE,
-                      strlen(KMYTH_DELIM_CIPHER_SUITE),
-                      KMYTH_DELIM_SYM_KEY_PUBLIC,
-                      strlen(KMYTH_DELIM_SYM_KEY_PUBLIC)))
+//############################################################################
+// ski_text_length
+//############################################################################
+static size_t ski_text_length(Ski * input, bool with_enc_data,
+                              uint8_t ** data, size_t *size)
+{
+  // Each block is written in file order, base64 encoded - except for the
+  // cipher suite which is written as a (newline terminated) string - so
+  // the exact output size follows from the marshalled block sizes.
+  size_t length = strlen(KMYTH_DELIM_ENC_DATA);
+
+  for (size_t i = SKI_SRK_NAME; i < SKI_ENC_DATA; i++)
   {
-    kmyth_log(LOG_ERR, "get cipher string error ... exiting");
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_cipher_str_data);
-    if (bool_policy_or == 1)
+    if (data[i] != NULL)
     {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
+      length += strlen(ski_block_delims[i]) +
+        ((i == SKI_CIPHER_SUITE) ? size[i] + 1 :
+         KMYTH_BASE64_ENCODED_SIZE(size[i]));
     }
-    return 1;
   }
+  if (with_enc_data)
+  {
+    length += KMYTH_BASE64_ENCODED_SIZE(input->enc_data_size) +
+      strlen(KMYTH_DELIM_END_FILE);
+  }
+
+  return length;
+}
 
-  // create cipher suite struct
-  raw_cipher_str_data[raw_cipher_str_size - 1] = '\0';
-  temp_ski.cipher =
-    kmyth_get_cipher_t_from_string((char *) raw_cipher_str_data);
-  if (temp_ski.cipher.cipher_name == NULL)
+//############################################################################
+// write_ski_text
+//############################################################################
+static int write_ski_text(Ski * input, bool with_enc_data,
+                          uint8_t ** data, size_t *size,
+                          uint8_t * out, size_t out_length)
+{
+  // out must hold (exactly) ski_text_length() bytes
+  size_t position = 0;
+  size_t block64_size = 0;
+
+  for (size_t i = SKI_SRK_NAME; i < SKI_ENC_DATA; i++)
   {
-    kmyth_log(LOG_ERR, "cipher_t init error ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_cipher_str_data);
-    if (bool_policy_or == 1)
+    if (data[i] == NULL)
     {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
+      continue;
     }
 
-    return 1;
+    memcpy(out + position, ski_block_delims[i], strlen(ski_block_delims[i]));
+    position += strlen(ski_block_delims[i]);
+
+    if (i == SKI_CIPHER_SUITE)
+    {
+      memcpy(out + position, data[i], size[i]);
+      position += size[i];
+      out[position++] = '\n';
+      continue;
+    }
+
+    if (encodeBase64DataInto(data[i], size[i], out + position,
+                             out_length - position, &block64_size))
+    {
+      kmyth_log(LOG_ERR, "error base64 encoding ski string ... exiting");
+      return 1;
+    }
+    position += block64_size;
   }
-  free(raw_cipher_str_data);
-  raw_cipher_str_data = NULL;
-  // read in (parse out) 'raw' (encoded) public data block for the wrapping key
-  uint8_t *raw_sym_pub_data = NULL;
-  size_t raw_sym_pub_size = 0;
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_sym_pub_data,
-                      &raw_sym_pub_size,
-                      KMYTH_DELIM_SYM_KEY_PUBLIC,
-                      strlen(KMYTH_DELIM_SYM_KEY_PUBLIC),
-                      KMYTH_DELIM_SYM_KEY_PRIVATE,
-                      strlen(KMYTH_DELIM_SYM_KEY_PRIVATE)))
+  memcpy(out + position, KMYTH_DELIM_ENC_DATA, strlen(KMYTH_DELIM_ENC_DATA));
+  position += strlen(KMYTH_DELIM_ENC_DATA);
+
+  if (with_enc_data)
+  {
+    if (encodeBase64DataInto(input->enc_data, input->enc_data_size,
+                             out + position, out_length - position,
+                             &block64_size))
+    {
+      kmyth_log(LOG_ERR, "error base64 encoding ski string ... exiting");
+      return 1;
+    }
+    position += block64_size;
+
+    memcpy(out + position, KMYTH_DELIM_END_FILE,
+           strlen(KMYTH_DELIM_END_FILE));
+  }
+
+  return 0;
+}
+
+//############################################################################
+// create_ski_text_bytes
+//############################################################################
+static int create_ski_text_bytes(Ski * input, bool with_enc_data,
+                                 uint8_t ** alloc_output,
+                                 uint8_t * output, size_t output_size,
+                                 size_t *output_length)
+{
+  // The output is either allocated (if alloc_output is non-NULL) or
+  // written to the caller's buffer (output, which if NULL is a size query).
+  // Either way, the blocks are marshalled once, sized, and then written in
+  // a single pass.
+  kmyth_arena *arena = get_ski_arena();
+
+  if (arena == NULL)
   {
-    kmyth_log(LOG_ERR, "get symmetric key public error ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_sym_pub_data);
-    if (bool_policy_or == 1)
-    {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
-    }
     return 1;
   }
 
-  // read in (parse out) raw (encoded) private data block for the wrapping key
-  unsigned char *raw_sym_priv_data = NULL;
-  size_t raw_sym_priv_size = 0;
+  uint8_t *data[SKI_BLOCK_COUNT];
+  size_t size[SKI_BLOCK_COUNT];
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_sym_priv_data,
-                      &raw_sym_priv_size,
-                      KMYTH_DELIM_SYM_KEY_PRIVATE,
-                      strlen(KMYTH_DELIM_SYM_KEY_PRIVATE),
-                      KMYTH_DELIM_ENC_DATA, strlen(KMYTH_DELIM_ENC_DATA)))
+  if (marshal_ski_blocks(input, arena, data, size))
   {
-    kmyth_log(LOG_ERR, "get symmetric key private error ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_sym_pub_data);
-    free(raw_sym_priv_data);
-    if (bool_policy_or == 1)
-    {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
-    }
+    kmyth_arena_reset(arena);
     return 1;
   }
 
-  // read in (parse out) raw (encoded) encrypted data block
-  unsigned char *raw_enc_data = NULL;
-  size_t raw_enc_size = 0;
+  size_t out_length = ski_text_length(input, with_enc_data, data, size);
+  uint8_t *out = output;
 
-  if (get_block_bytes((char **) &position,
-                      &remaining,
-                      &raw_enc_data, &raw_enc_size,
-                      KMYTH_DELIM_ENC_DATA,
-                      strlen(KMYTH_DELIM_ENC_DATA),
-                      KMYTH_DELIM_END_FILE, strlen(KMYTH_DELIM_END_FILE)))
+  if (alloc_output != NULL)
   {
-    kmyth_log(LOG_ERR, "getting encrypted data error ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_sym_pub_data);
-    free(raw_sym_priv_data);
-    free(raw_enc_data);
-    if (bool_policy_or == 1)
+    out = (uint8_t *) malloc(out_length);
+    if (out == NULL)
     {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
+      kmyth_log(LOG_ERR, "malloc error (%lu bytes) ... exiting", out_length);
+      kmyth_arena_reset(arena);
+      return 1;
     }
-    return 1;
   }
-
-  if (strncmp
-      ((char *) position, KMYTH_DELIM_END_FILE, strlen(KMYTH_DELIM_END_FILE))
-      || remaining != strlen(KMYTH_DELIM_END_FILE))
+  else
   {
-    kmyth_log(LOG_ERR, "unable to find the end delimiter ... exiting");
-    free_ski(&temp_ski);
-    free(raw_pcr_select_list_data);
-    free(raw_sk_pub_data);
-    free(raw_sk_priv_data);
-    free(raw_sym_pub_data);
-    free(raw_sym_priv_data);
-    free(raw_enc_data);
-    if (bool_policy_or == 1)
+    *output_length = out_length;
+    if (output == NULL)
     {
-      free(raw_pb_1_data);
-      free(raw_pb_2_data);
+      kmyth_arena_reset(arena);
+      return 0;
+    }
+    if (output_size < out_length)
+    {
+      kmyth_log(LOG_ERR, "output buffer too small (%lu bytes, %lu needed) "
+                "... exiting", output_size, out_length);
+      kmyth_arena_reset(arena);
+      return 1;
     }
-    return 1;
   }
 
-  //We are done with position. It was marking our place in input, which is freed by the caller
-  position = NULL;
-
-  int retval = 0;
-
-  // decode PCR selection list struct
-  uint8_t *decoded_pcr_select_list_data = NULL;
-  size_t decoded_pcr_select_list_size = 0;
-  size_t decoded_pcr_select_list_offset = 0;
-
-  retval |= decodeBase64Data(raw_pcr_select_list_data,
-                             raw_pcr_select_list_size,
-                             &decoded_pcr_select_list_data,
-                             &decoded_pcr_select_list_size);
-  free(raw_pcr_select_list_data);
-  raw_pcr_select_list_data = NULL;
-
-  uint8_t *decoded_policy_branch_1_data = NULL;
-  size_t decoded_policy_branch_1_size = 0;
-  size_t decoded_policy_branch_1_offset = 0;
-  uint8_t *decoded_policy_branch_2_data = NULL;
-  size_t decoded_policy_branch_2_size = 0;
-  size_t decoded_policy_branch_2_offset = 0;
+  int retval = write_ski_text(input, with_enc_data, data, size, out,
+                              out_length);
 
-  if (bool_policy_or == 1)
-  {
-    // decode policy 1 branch struct
-    retval |= decodeBase64Data(raw_pb_1_data,
-                               raw_pb_1_size,
-                               &decoded_policy_branch_1_data,
-                               &decoded_policy_branch_1_size);
-
-    // decode policy 2 branch struct
-    retval |= decodeBase64Data(raw_pb_2_data,
-                               raw_pb_2_size,
-                               &decoded_policy_branch_2_data,
-                               &decoded_policy_branch_2_size);
-  }
-  free(raw_pb_1_data);
-  raw_pb_1_data = NULL;
-  free(raw_pb_2_data);
-  raw_pb_2_data = NULL;
-
-  // decode public data block for storage key
-  uint8_t *decoded_sk_pub_data = NULL;
-  size_t decoded_sk_pub_size = 0;
-  size_t decoded_sk_pub_offset = 0;
-
-  retval |= decodeBase64Data(raw_sk_pub_data,
-                             raw_sk_pub_size,
-                             &decoded_sk_pub_data, &decoded_sk_pub_size);
-  free(raw_sk_pub_data);
-  raw_sk_pub_data = NULL;
-
-  // decode encrypted private data block for storage key
-  uint8_t *decoded_sk_priv_data = NULL;
-  size_t decoded_sk_priv_size = 0;
-  size_t decoded_sk_priv_offset = 0;
-
-  retval |= decodeBase64Data(raw_sk_priv_data,
-                             raw_sk_priv_size,
-                             &decoded_sk_priv_data, &decoded_sk_priv_size);
-  free(raw_sk_priv_data);
-  raw_sk_priv_data = NULL;
-
-  // decode public data block for symmetric wrapping key
-  uint8_t *decoded_sym_pub_data = NULL;
-  size_t decoded_sym_pub_size = 0;
-  size_t decoded_sym_pub_offset = 0;
-
-  retval |= decodeBase64Data(raw_sym_pub_data,
-                             raw_sym_pub_size,
-                             &decoded_sym_pub_data, &decoded_sym_pub_size);
-  free(raw_sym_pub_data);
-  raw_sym_pub_data = NULL;
-
-  // decode encrypted private data block for symmetric wrapping key
-  uint8_t *decoded_sym_priv_data = NULL;
-  size_t decoded_sym_priv_size = 0;
-  size_t decoded_sym_priv_offset = 0;
-
-  retval |= decodeBase64Data(raw_sym_priv_data,
-                             raw_sym_priv_size,
-                             &decoded_sym_priv_data, &decoded_sym_priv_size);
-  free(raw_sym_priv_data);
-  raw_sym_priv_data = NULL;
-
-  // decode the encrypted data block
-  retval |= decodeBase64Data(raw_enc_data,
-                             raw_enc_size, &temp_ski.enc_data,
-                             &temp_ski.enc_data_size);
-  free(raw_enc_data);
-  raw_enc_data = NULL;
+  kmyth_arena_reset(arena);
 
-  if (retval)
+  if (alloc_output == NULL)
   {
-    kmyth_log(LOG_ERR, "base64 decode error ... exiting");
+    return retval;
   }
-  else
+  if (retval)
   {
-    retval = unmarshal_skiObjects(&temp_ski.pcr_list,
-                                  decoded_pcr_select_list_data,
-                                  decoded_pcr_select_list_size,
-                                  decoded_pcr_select_list_offset,
-                                  &temp_ski.sk_pub,
-                                  decoded_sk_pub_data,
-                                  decoded_sk_pub_size,
-                                  decoded_sk_pub_offset,
-                                  &temp_ski.sk_priv,
-                                  decoded_sk_priv_data,
-                                  decoded_sk_priv_size,
-                                  decoded_sk_priv_offset,
-                                  &temp_ski.wk_pub,
-                                  decoded_sym_pub_data,
-                                  decoded_sym_pub_size,
-                                  decoded_sym_pub_offset,
-                                  &temp_ski.wk_priv,
-                                  decoded_sym_priv_data,
-                                  decoded_sym_priv_size,
-                                  decoded_sym_priv_offset,
-                                  &temp_ski.policyBranch1,
-                                  decoded_policy_branch_1_data,
-                                  decoded_policy_branch_1_size,
-                                  decoded_policy_branch_1_offset,
-                                  &temp_ski.policyBranch2,
-                                  decoded_policy_branch_2_data,
-                                  decoded_policy_branch_2_size,
-                                  decoded_policy_branch_2_offset);
-    if (retval)
-    {
-      kmyth_log(LOG_ERR, "unmarshal .ski object error ... exiting");
-    }
+    free(out);
+    return 1;
   }
 
-  free(decoded_pcr_select_list_data);
-  free(decoded_sk_pub_data);
-  free(decoded_sk_priv_data);
-  free(decoded_sym_pub_data);
-  free(decoded_sym_priv_data);
-  if (bool_policy_or == 1)
-  {
-    free(decoded_policy_branch_1_data);
-    free(decoded_policy_branch_2_data);
-  }
-  *output = temp_ski;
-  return retval;
+  *alloc_output = out;
+  *output_length = out_length;
+
+  return 0;
+}
+
+//############################################################################
+// create_ski_header_bytes
+//############################################################################
+int create_ski_header_bytes(Ski input, uint8_t ** output,
+                            size_t *output_length)
+{
+  return create_ski_text_bytes(&input, false, output, NULL, 0, output_length);
 }
 
 //############################################################################
@@ -458,368 +1269,130 @@ int parse_ski_bytes(uint8_t * input, size_t input_length, Ski * output,
 //############################################################################
 int create_ski_bytes(Ski input, uint8_t ** output, size_t *output_length)
 {
-  if(input.sk_pub.size < 0 || input.sk_priv.size < 0 || input.wk_pub.size < 0 || input.wk_priv.size < 0 || input.policyBranch1.size < 0 || input.policyBranch2.size < 0)
+  if (input.enc_data == NULL || input.enc_data_size == 0)
   {
-    kmyth_log(LOG_ERR, "ski file should not have negative field sizes.");
+    kmyth_log(LOG_ERR, "cannot write empty sections ... exiting");
     return 1;
   }
-  // marshal data contained in TPM sized buffers (TPM2B_PUBLIC / TPM2B_PRIVATE)
-  // and structs (TPML_PCR_SELECTION)
-  // Note: must account for two extra bytes to include the buffer's size value
-  //       in the TPM2B_* sized buffer cases
-  size_t pcr_select_size = sizeof(input.pcr_list);
-  size_t pcr_select_offset = 0;
-  uint8_t *pcr_select_data =
-    (uint8_t *) calloc(pcr_select_size, sizeof(uint8_t));
 
-  // boolean to indicate whether the user has elected to use policyOR which
-  // requires writing both policy digests to the ski file for future calculations
-  uint8_t bool_policy_or = 0;
+  return create_ski_text_bytes(&input, true, output, NULL, 0, output_length);
+}
 
-  if (pcr_select_data == NULL)
+//############################################################################
+// create_ski_bytes_buf
+//############################################################################
+int create_ski_bytes_buf(Ski input, uint8_t * output, size_t output_size,
+                         size_t *output_length)
+{
+  if (output_length == NULL)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for PCR select data ... exiting");
+    kmyth_log(LOG_ERR, "no output length pointer provided ... exiting");
     return 1;
   }
 
-  size_t sk_pub_size = (size_t)input.sk_pub.size + 2;
-  size_t sk_pub_offset = 0;
-  uint8_t *sk_pub_data = (uint8_t *) malloc(sk_pub_size);
-
-  if (sk_pub_data == NULL)
+  if (input.enc_data == NULL || input.enc_data_size == 0)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for storage key public data ... exiting");
-    free(pcr_select_data);
+    kmyth_log(LOG_ERR, "cannot write empty sections ... exiting");
     return 1;
   }
 
-  size_t sk_priv_size = (size_t)input.sk_priv.size + 2;
-  size_t sk_priv_offset = 0;
-  uint8_t *sk_priv_data = (uint8_t *) malloc(sk_priv_size);
+  return create_ski_text_bytes(&input, true, NULL, output, output_size,
+                               output_length);
+}
 
-  if (sk_priv_data == NULL)
+//############################################################################
+// create_ski_binary_bytes
+//############################################################################
+int create_ski_binary_bytes(Ski input, uint8_t ** output,
+                            size_t *output_length)
+{
+  if (input.enc_data == NULL || input.enc_data_size == 0)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for storage key private data ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
+    kmyth_log(LOG_ERR, "cannot write empty sections ... exiting");
     return 1;
   }
 
-  size_t wk_pub_size = (size_t)input.wk_pub.size + 2;
-  size_t wk_pub_offset = 0;
-  uint8_t *wk_pub_data = (uint8_t *) malloc(wk_pub_size);
+  kmyth_arena *arena = get_ski_arena();
 
-  if (wk_pub_data == NULL)
+  if (arena == NULL)
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for wrapping key public data ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
-    free(sk_priv_data);
     return 1;
   }
 
-  size_t wk_priv_size = (size_t)input.wk_priv.size + 2;
-  size_t wk_priv_offset = 0;
-  uint8_t *wk_priv_data = (uint8_t *) malloc(wk_priv_size);
+  uint8_t *data[SKI_BLOCK_COUNT];
+  size_t size[SKI_BLOCK_COUNT];
 
-  if (wk_priv_data == NULL)
+  if (marshal_ski_blocks(&input, arena, data, size))
   {
-    kmyth_log(LOG_ERR,
-              "unable to allocate memory for wrapping key private data ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
-    free(sk_priv_data);
-    free(wk_pub_data);
+    kmyth_arena_reset(arena);
     return 1;
   }
+  data[SKI_ENC_DATA] = input.enc_data;
+  size[SKI_ENC_DATA] = input.enc_data_size;
 
-  size_t p_branch_1_size = 0;
-  size_t p_branch_1_offset = 0;
-  uint8_t *p_branch_1_data = NULL;
-
-  size_t p_branch_2_size = 0;
-  size_t p_branch_2_offset = 0;
-  uint8_t *p_branch_2_data = NULL;
+  // the PCR selection list block is sized for the largest possible list,
+  // but only its marshalled part needs to be stored
+  size_t pcr_list_size = 0;
 
-  // if both policy branches are present, includes
-  // policy branch info to be marshalled to ski file
-  if (input.policyBranch1.size > 0 && input.policyBranch2.size > 0)
+  if (Tss2_MU_TPML_PCR_SELECTION_Marshal(&input.pcr_list, NULL,
+                                         size[SKI_PCR_SELECTION_LIST],
+                                         &pcr_list_size) == TSS2_RC_SUCCESS &&
+      pcr_list_size > 0)
   {
-    bool_policy_or = 1;
+    size[SKI_PCR_SELECTION_LIST] = pcr_list_size;
+  }
 
-    p_branch_1_size = (size_t)input.policyBranch1.size + 2;
-    p_branch_1_data = (uint8_t *) malloc(p_branch_1_size);
+  // the output size is known up front, so it is written in one pass
+  size_t out_length = KMYTH_SKI_BINARY_MAGIC_SIZE + 1;
 
-    if (p_branch_1_data == NULL)
+  for (size_t i = SKI_SRK_NAME; i <= SKI_ENC_DATA; i++)
+  {
+    if (data[i] == NULL)
     {
-      kmyth_log(LOG_ERR,
-                "unable to allocate memory for policy data ... exiting");
-      free(pcr_select_data);
-      free(sk_pub_data);
-      free(sk_priv_data);
-      free(wk_pub_data);
-      free(wk_priv_data);
-      return 1;
+      continue;
     }
-
-    p_branch_2_size = (size_t)input.policyBranch2.size + 2;
-    p_branch_2_data = (uint8_t *) malloc(p_branch_2_size);
-
-    if (p_branch_2_data == NULL)
+    if (size[i] > UINT32_MAX)
     {
-      kmyth_log(LOG_ERR,
-                "unable to allocate memory for policy data ... exiting");
-      free(pcr_select_data);
-      free(sk_pub_data);
-      free(sk_priv_data);
-      free(wk_pub_data);
-      free(wk_priv_data);
-      free(p_branch_1_data);
+      kmyth_log(LOG_ERR, ".ski block (%.*s) too large for binary format "
+                "... exiting", (int) (strlen(ski_block_delims[i]) - 1),
+                ski_block_delims[i]);
+      kmyth_arena_reset(arena);
       return 1;
     }
-
+    out_length += KMYTH_SKI_BINARY_RECORD_HEADER_SIZE + size[i];
   }
 
-  if (marshal_skiObjects(&input.pcr_list,
-                         &pcr_select_data,
-                         &pcr_select_size,
-                         pcr_select_offset,
-                         &input.sk_pub,
-                         &sk_pub_data,
-                         &sk_pub_size,
-                         sk_pub_offset,
-                         &input.sk_priv,
-                         &sk_priv_data,
-                         &sk_priv_size,
-                         sk_priv_offset,
-                         &input.wk_pub,
-                         &wk_pub_data,
-                         &wk_pub_size,
-                         wk_pub_offset,
-                         &input.wk_priv,
-                         &wk_priv_data,
-                         &wk_priv_size,
-                         wk_priv_offset,
-                         &input.policyBranch1,
-                         &p_branch_1_data,
-                         &p_branch_1_size,
-                         p_branch_1_offset,
-                         &input.policyBranch2,
-                         &p_branch_2_data, &p_branch_2_size, p_branch_2_offset))
-  {
-    kmyth_log(LOG_ERR, "unable to marshal data for ski file ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
-    free(sk_priv_data);
-    free(wk_pub_data);
-    free(wk_priv_data);
-    free(p_branch_1_data);
-    free(p_branch_2_data);
-    return 1;
-  }
-
-  // validate that all data to be written is non-NULL and non-empty
-  if (pcr_select_data == NULL ||
-      pcr_select_size == 0 ||
-      sk_pub_data == NULL ||
-      sk_pub_size == 0 ||
-      sk_priv_data == NULL ||
-      sk_priv_size == 0 ||
-      wk_pub_data == NULL ||
-      wk_pub_size == 0 ||
-      wk_priv_data == NULL ||
-      wk_priv_size == 0 ||
-      input.cipher.cipher_name == NULL ||
-      strlen(input.cipher.cipher_name) == 0 ||
-      input.enc_data == NULL || input.enc_data_size == 0)
+  uint8_t *out = (uint8_t *) malloc(out_length);
+
+  if (out == NULL)
   {
-    kmyth_log(LOG_ERR, "cannot write empty sections ... exiting");
-    free(pcr_select_data);
-    free(sk_pub_data);
-    free(sk_priv_data);
-    free(wk_pub_data);
-    free(wk_priv_data);
-    free(p_branch_1_data);
-    free(p_branch_2_data);
-    return 1;
-  }
-
-  //Encode each portion of the file in base64
-  uint8_t *pcr64_select_data = NULL;
-  size_t pcr64_select_size = 0;
-  uint8_t *sk64_pub_data = NULL;
-  size_t sk64_pub_size = 0;
-  uint8_t *sk64_priv_data = NULL;
-  size_t sk64_priv_size = 0;
-  uint8_t *wk64_pub_data = NULL;
-  size_t wk64_pub_size = 0;
-  uint8_t *wk64_priv_data = NULL;
-  size_t wk64_priv_size = 0;
-  uint8_t *enc64_data = NULL;
-  size_t enc64_data_size = 0;
-  //uint8_t *policy64_data = NULL;
-  //size_t policy64_data_size = 0;
-  uint8_t *p_branch_1_64_data = NULL;
-  size_t p_branch_1_64_data_size = 0;
-  uint8_t *p_branch_2_64_data = NULL;
-  size_t p_branch_2_64_data_size = 0;
-
-  // only used if policy branches are present for compound policyOR
-  if (p_branch_1_data != NULL && p_branch_2_data != NULL)
+    kmyth_log(LOG_ERR, "malloc error (%lu bytes) ... exiting", out_length);
+    kmyth_arena_reset(arena);
+    return 1;
+  }
+
+  memcpy(out, KMYTH_SKI_BINARY_MAGIC, KMYTH_SKI_BINARY_MAGIC_SIZE);
+  out[KMYTH_SKI_BINARY_MAGIC_SIZE] = KMYTH_SKI_BINARY_VERSION;
+
+  size_t position = KMYTH_SKI_BINARY_MAGIC_SIZE + 1;
+
+  for (size_t i = SKI_SRK_NAME; i <= SKI_ENC_DATA; i++)
   {
-    if (encodeBase64Data
-        (pcr_select_data, pcr_select_size, &pcr64_select_data,
-         &pcr64_select_size)
-        || encodeBase64Data(sk_pub_data, sk_pub_size, &sk64_pub_data,
-                            &sk64_pub_size)
-        || encodeBase64Data(sk_priv_data, sk_priv_size, &sk64_priv_data,
-                            &sk64_priv_size)
-        || encodeBase64Data(wk_pub_data, wk_pub_size, &wk64_pub_data,
-                            &wk64_pub_size)
-        || encodeBase64Data(wk_priv_data, wk_priv_size, &wk64_priv_data,
-                            &wk64_priv_size)
-        || encodeBase64Data(input.enc_data, input.enc_data_size, &enc64_data,
-                            &enc64_data_size)
-        || encodeBase64Data(p_branch_1_data, p_branch_1_size,
-                            &p_branch_1_64_data, &p_branch_1_64_data_size)
-        || encodeBase64Data(p_branch_2_data, p_branch_2_size,
-                            &p_branch_2_64_data, &p_branch_2_64_data_size))
+    if (data[i] == NULL)
     {
-      kmyth_log(LOG_ERR, "error base64 encoding ski string ... exiting");
-      free(pcr_select_data);
-      free(sk_pub_data);
-      free(sk_priv_data);
-      free(wk_pub_data);
-      free(wk_priv_data);
-      free(pcr64_select_data);
-      free(sk64_pub_data);
-      free(sk64_priv_data);
-      free(wk64_pub_data);
-      free(wk64_priv_data);
-      free(enc64_data);
-      free(p_branch_1_data);
-      free(p_branch_2_data);
-      return 1;
+      continue;
     }
-  }
-  // else condition: policy branches are not written to ski file
-  else
-  {
-    if (encodeBase64Data
-        (pcr_select_data, pcr_select_size, &pcr64_select_data,
-         &pcr64_select_size)
-        || encodeBase64Data(sk_pub_data, sk_pub_size, &sk64_pub_data,
-                            &sk64_pub_size)
-        || encodeBase64Data(sk_priv_data, sk_priv_size, &sk64_priv_data,
-                            &sk64_priv_size)
-        || encodeBase64Data(wk_pub_data, wk_pub_size, &wk64_pub_data,
-                            &wk64_pub_size)
-        || encodeBase64Data(wk_priv_data, wk_priv_size, &wk64_priv_data,
-                            &wk64_priv_size)
-        || encodeBase64Data(input.enc_data, input.enc_data_size, &enc64_data,
-                            &enc64_data_size))
+    out[position] = ski_block_tags[i];
+    for (size_t j = 1; j < KMYTH_SKI_BINARY_RECORD_HEADER_SIZE; j++)
     {
-      kmyth_log(LOG_ERR, "error base64 encoding ski string ... exiting");
-      free(pcr_select_data);
-      free(sk_pub_data);
-      free(sk_priv_data);
-      free(wk_pub_data);
-      free(wk_priv_data);
-      free(pcr64_select_data);
-      free(sk64_pub_data);
-      free(sk64_priv_data);
-      free(wk64_pub_data);
-      free(wk64_priv_data);
-      free(enc64_data);
-      free(p_branch_1_data);
-      free(p_branch_2_data);
-      return 1;
+      out[position + j] = (uint8_t) (size[i] >> (8 * (4 - j)));
     }
+    position += KMYTH_SKI_BINARY_RECORD_HEADER_SIZE;
+    memcpy(out + position, data[i], size[i]);
+    position += size[i];
   }
 
-  free(pcr_select_data);
-  pcr_select_data = NULL;
-  free(sk_pub_data);
-  sk_pub_data = NULL;
-  free(sk_priv_data);
-  sk_priv_data = NULL;
-  free(wk_pub_data);
-  wk_pub_data = NULL;
-  free(wk_priv_data);
-  wk_priv_data = NULL;
-  free(p_branch_1_data);
-  p_branch_1_data = NULL;
-  free(p_branch_2_data);
-  p_branch_2_data = NULL;
-
-  //At this point the data is all formatted, it's time to create the string
-  uint8_t *out = NULL;
-  size_t out_length = 0;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_PCR_SELECTION_LIST,
-         strlen(KMYTH_DELIM_PCR_SELECTION_LIST));
-  concat(&out, &out_length, pcr64_select_data, pcr64_select_size);
-  free(pcr64_select_data);
-  pcr64_select_data = NULL;
-
-  // if policyOR is used, includes policy branch information in ski file
-  if (bool_policy_or == 1)
-  {
-    concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_POLICY_BRANCH_1,
-           strlen(KMYTH_DELIM_POLICY_BRANCH_1));
-    concat(&out, &out_length, p_branch_1_64_data, p_branch_1_64_data_size);
-    free(p_branch_1_64_data);
-    p_branch_1_64_data = NULL;
-
-    concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_POLICY_BRANCH_2,
-           strlen(KMYTH_DELIM_POLICY_BRANCH_2));
-    concat(&out, &out_length, p_branch_2_64_data, p_branch_2_64_data_size);
-    free(p_branch_2_64_data);
-    p_branch_2_64_data = NULL;
-  }
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_STORAGE_KEY_PUBLIC,
-         strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC));
-  concat(&out, &out_length, sk64_pub_data, sk64_pub_size);
-  free(sk64_pub_data);
-  sk64_pub_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_STORAGE_KEY_PRIVATE,
-         strlen(KMYTH_DELIM_STORAGE_KEY_PRIVATE));
-  concat(&out, &out_length, sk64_priv_data, sk64_priv_size);
-  free(sk64_priv_data);
-  sk64_priv_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_CIPHER_SUITE,
-         strlen(KMYTH_DELIM_CIPHER_SUITE));
-  concat(&out, &out_length, (uint8_t *) input.cipher.cipher_name,
-         strlen(input.cipher.cipher_name));
-  concat(&out, &out_length, (uint8_t *) "\n", 1);
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_SYM_KEY_PUBLIC,
-         strlen(KMYTH_DELIM_SYM_KEY_PUBLIC));
-  concat(&out, &out_length, wk64_pub_data, wk64_pub_size);
-  free(wk64_pub_data);
-  wk64_pub_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_SYM_KEY_PRIVATE,
-         strlen(KMYTH_DELIM_SYM_KEY_PRIVATE));
-  concat(&out, &out_length, wk64_priv_data, wk64_priv_size);
-  free(wk64_priv_data);
-  wk64_priv_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_ENC_DATA,
-         strlen(KMYTH_DELIM_ENC_DATA));
-  concat(&out, &out_length, enc64_data, enc64_data_size);
-  free(enc64_data);
-  enc64_data = NULL;
-
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_END_FILE,
-         strlen(KMYTH_DELIM_END_FILE));
+  kmyth_arena_reset(arena);
 
   *output = out;
   *output_length = out_length;
@@ -834,21 +1407,21 @@ void free_ski(Ski * ski)
   ski->enc_data_size = 0;
 }
 
+void init_default_ski(Ski * ski)
+{
+  // every TPM2B/TPML size and count, pointer and length starts out zero
+  memset(ski, 0, sizeof(Ski));
+  ski->cipher.cipher_name = NULL;
+  ski->compression = KMYTH_COMPRESSION_NONE;
+  ski->enc_data = NULL;
+}
+
 Ski get_default_ski(void)
 {
-  Ski ret = {
-    .pcr_list = {.count = 0,},
-    .policyBranch1 = {.size = 0,},
-    .policyBranch2 = {.size = 0,},
-    .sk_priv = {.size = 0,},
-    .cipher = {.cipher_name = NULL,},
-    .wk_pub = {.size = 0},
-    .wk_priv = {.size = 0},
-    .enc_data = NULL,
-    .enc_data_size = 0
-  };
-  return (ret);
+  Ski ret;
 
+  init_default_ski(&ret);
+  return (ret);
 }
 
 //############################################################################
@@ -1262,6 +1835,285 @@ int unpack_digest(TPM2B_DIGEST * digest_out,
   return 0;
 }
 
+//############################################################################
+// marshal_cursor_init()
+//############################################################################
+void marshal_cursor_init(marshal_cursor * cursor, uint8_t * buf, size_t size)
+{
+  cursor->buf = buf;
+  cursor->size = (buf == NULL) ? 0 : size;
+  cursor->offset = 0;
+  cursor->owned = (buf == NULL);
+}
+
+//############################################################################
+// marshal_cursor_free()
+//############################################################################
+void marshal_cursor_free(marshal_cursor * cursor)
+{
+  if (cursor->owned && cursor->buf != NULL)
+  {
+    kmyth_clear_and_free(cursor->buf, cursor->size);
+  }
+  marshal_cursor_init(cursor, NULL, 0);
+}
+
+//############################################################################
+// marshal_cursor_reserve()
+//############################################################################
+static int marshal_cursor_reserve(marshal_cursor * cursor, size_t needed)
+{
+  if (needed <= cursor->size - cursor->offset)
+  {
+    return 0;
+  }
+  if (!cursor->owned)
+  {
+    kmyth_log(LOG_ERR, "marshal buffer too small (%lu bytes free, %lu "
+              "needed) ... exiting", cursor->size - cursor->offset, needed);
+    return 1;
+  }
+
+  // an owned buffer at least doubles, so a sequence of structures is
+  // marshalled with few reallocations
+  size_t new_size = (cursor->size == 0) ? MARSHAL_CURSOR_MIN_SIZE :
+    cursor->size;
+
+  while (new_size - cursor->offset < needed)
+  {
+    if (new_size > SIZE_MAX / 2)
+    {
+      kmyth_log(LOG_ERR, "marshal buffer size overflow ... exiting");
+      return 1;
+    }
+    new_size *= 2;
+  }
+
+  uint8_t *new_buf = (uint8_t *) realloc(cursor->buf, new_size);
+
+  if (new_buf == NULL)
+  {
+    kmyth_log(LOG_ERR, "realloc error (%lu bytes) ... exiting", new_size);
+    return 1;
+  }
+  cursor->buf = new_buf;
+  cursor->size = new_size;
+
+  return 0;
+}
+
+//############################################################################
+// cursor_pack_pcr()
+//############################################################################
+int cursor_pack_pcr(marshal_cursor * cursor, TPML_PCR_SELECTION * pcr_select_in)
+{
+  // size the marshalled result (a NULL buffer only advances the offset)
+  // so that the cursor can make room for it
+  size_t needed = 0;
+  size_t offset = cursor->offset;
+  TSS2_RC rc = Tss2_MU_TPML_PCR_SELECTION_Marshal(pcr_select_in, NULL, SIZE_MAX,
+                                                  &needed);
+
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    if (marshal_cursor_reserve(cursor, needed))
+    {
+      return 1;
+    }
+    rc = Tss2_MU_TPML_PCR_SELECTION_Marshal(pcr_select_in, cursor->buf,
+                                            cursor->size, &offset);
+  }
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR,
+              "Tss2_MU_TPML_PCR_SELECTION_Marshal(): 0x%08X ... exiting", rc);
+    return 1;
+  }
+  cursor->offset = offset;
+
+  return 0;
+}
+
+//############################################################################
+// cursor_pack_public()
+//############################################################################
+int cursor_pack_public(marshal_cursor * cursor, TPM2B_PUBLIC * public_blob_in)
+{
+  size_t needed = 0;
+  size_t offset = cursor->offset;
+  TSS2_RC rc = Tss2_MU_TPM2B_PUBLIC_Marshal(public_blob_in, NULL, SIZE_MAX,
+                                            &needed);
+
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    if (marshal_cursor_reserve(cursor, needed))
+    {
+      return 1;
+    }
+    rc = Tss2_MU_TPM2B_PUBLIC_Marshal(public_blob_in, cursor->buf, cursor->size,
+                                      &offset);
+  }
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR,
+              "Tss2_MU_TPM2B_PUBLIC_Marshal(): 0x%08X ... exiting", rc);
+    return 1;
+  }
+  cursor->offset = offset;
+
+  return 0;
+}
+
+//############################################################################
+// cursor_pack_private()
+//############################################################################
+int cursor_pack_private(marshal_cursor * cursor,
+                        TPM2B_PRIVATE * private_blob_in)
+{
+  size_t needed = 0;
+  size_t offset = cursor->offset;
+  TSS2_RC rc = Tss2_MU_TPM2B_PRIVATE_Marshal(private_blob_in, NULL, SIZE_MAX,
+                                             &needed);
+
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    if (marshal_cursor_reserve(cursor, needed))
+    {
+      return 1;
+    }
+    rc = Tss2_MU_TPM2B_PRIVATE_Marshal(private_blob_in, cursor->buf,
+                                       cursor->size, &offset);
+  }
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR,
+              "Tss2_MU_TPM2B_PRIVATE_Marshal(): 0x%08X ... exiting", rc);
+    return 1;
+  }
+  cursor->offset = offset;
+
+  return 0;
+}
+
+//############################################################################
+// cursor_pack_digest()
+//############################################################################
+int cursor_pack_digest(marshal_cursor * cursor, TPM2B_DIGEST * digest_in)
+{
+  size_t needed = 0;
+  size_t offset = cursor->offset;
+  TSS2_RC rc = Tss2_MU_TPM2B_DIGEST_Marshal(digest_in, NULL, SIZE_MAX, &needed);
+
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    if (marshal_cursor_reserve(cursor, needed))
+    {
+      return 1;
+    }
+    rc = Tss2_MU_TPM2B_DIGEST_Marshal(digest_in, cursor->buf, cursor->size,
+                                      &offset);
+  }
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR,
+              "Tss2_MU_TPM2B_DIGEST_Marshal(): 0x%08X ... exiting", rc);
+    return 1;
+  }
+  cursor->offset = offset;
+
+  return 0;
+}
+
+//############################################################################
+// unmarshal_view_init()
+//############################################################################
+void unmarshal_view_init(unmarshal_view * view, uint8_t * data, size_t size)
+{
+  view->data = data;
+  view->size = (data == NULL) ? 0 : size;
+  view->offset = 0;
+}
+
+//############################################################################
+// view_unpack_pcr()
+//############################################################################
+int view_unpack_pcr(unmarshal_view * view, TPML_PCR_SELECTION * pcr_select_out)
+{
+  size_t offset = view->offset;
+  TSS2_RC rc = Tss2_MU_TPML_PCR_SELECTION_Unmarshal(view->data, view->size,
+                                                    &offset, pcr_select_out);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR,
+              "Tss2_MU_TPML_PCR_SELECTION_Unmarshal(): 0x%08x ... exiting", rc);
+    return 1;
+  }
+  view->offset = offset;
+
+  return 0;
+}
+
+//############################################################################
+// view_unpack_public()
+//############################################################################
+int view_unpack_public(unmarshal_view * view, TPM2B_PUBLIC * public_blob_out)
+{
+  size_t offset = view->offset;
+  TSS2_RC rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(view->data, view->size, &offset,
+                                     public_blob_out);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR,
+              "Tss2_MU_TPM2B_PUBLIC_Unmarshal(): 0x%08x ... exiting", rc);
+    return 1;
+  }
+  view->offset = offset;
+
+  return 0;
+}
+
+//############################################################################
+// view_unpack_private()
+//############################################################################
+int view_unpack_private(unmarshal_view * view, TPM2B_PRIVATE * private_blob_out)
+{
+  size_t offset = view->offset;
+  TSS2_RC rc = Tss2_MU_TPM2B_PRIVATE_Unmarshal(view->data, view->size, &offset,
+                                     private_blob_out);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR,
+              "Tss2_MU_TPM2B_PRIVATE_Unmarshal(): 0x%08x ... exiting", rc);
+    return 1;
+  }
+  view->offset = offset;
+
+  return 0;
+}
+
+//############################################################################
+// view_unpack_digest()
+//############################################################################
+int view_unpack_digest(unmarshal_view * view, TPM2B_DIGEST * digest_out)
+{
+  size_t offset = view->offset;
+  TSS2_RC rc = Tss2_MU_TPM2B_DIGEST_Unmarshal(view->data, view->size, &offset,
+                                     digest_out);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR,
+              "Tss2_MU_TPM2B_DIGEST_Unmarshal(): 0x%08x ... exiting", rc);
+    return 1;
+  }
+  view->offset = offset;
+
+  return 0;
+}
+
 //############################################################################
 // unpack_uint32_to_str()
 //############################################################################
@@ -0,0 +1,346 @@
+/**
+ * @file  nv_tools.c
+ *
+ * @brief Implements library of TPM 2.0 utility functions for keeping Kmyth
+ *        .ski data in TPM non-volatile (NV) indices.
+ */
+
+#include "nv_tools.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+#include "kmyth.h"
+#include "memory_util.h"
+#include "tpm2_interface.h"
+
+#include "alloc_stats.h"
+
+//############################################################################
+// check_nv_handle()
+//############################################################################
+static int check_nv_handle(TPM2_HANDLE nv_index)
+{
+  if (nv_index < KMYTH_NV_SKI_FIRST || nv_index > KMYTH_NV_SKI_LAST)
+  {
+    kmyth_log(LOG_ERR, "NV index (0x%08X) out of Kmyth NV range ... exiting",
+              nv_index);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// get_nv_limits()
+//############################################################################
+int get_nv_limits(TSS2_SYS_CONTEXT * sapi_ctx, uint32_t * index_max,
+                  uint32_t * buffer_max)
+{
+  // both are fixed properties, so a single query (of the properties from
+  // one to the other) returns them
+  TPMS_CAPABILITY_DATA capData;
+
+  if (get_tpm2_properties(sapi_ctx, TPM2_CAP_TPM_PROPERTIES,
+                          TPM2_PT_NV_INDEX_MAX,
+                          TPM2_PT_NV_BUFFER_MAX - TPM2_PT_NV_INDEX_MAX + 1,
+                          &capData))
+  {
+    kmyth_log(LOG_ERR, "unable to get TPM NV limits ... exiting");
+    return 1;
+  }
+
+  TPML_TAGGED_TPM_PROPERTY *props = &capData.data.tpmProperties;
+
+  *index_max = 0;
+  *buffer_max = 0;
+  for (uint32_t i = 0; i < props->count; i++)
+  {
+    if (props->tpmProperty[i].property == TPM2_PT_NV_INDEX_MAX)
+    {
+      *index_max = props->tpmProperty[i].value;
+    }
+    else if (props->tpmProperty[i].property == TPM2_PT_NV_BUFFER_MAX)
+    {
+      *buffer_max = props->tpmProperty[i].value;
+    }
+  }
+  if (*index_max == 0 || *buffer_max == 0)
+  {
+    kmyth_log(LOG_ERR, "TPM did not report its NV limits ... exiting");
+    return 1;
+  }
+
+  // (a single transfer is also limited by the TSS's buffer)
+  if (*buffer_max > TPM2_MAX_NV_BUFFER_SIZE)
+  {
+    *buffer_max = TPM2_MAX_NV_BUFFER_SIZE;
+  }
+  kmyth_log(LOG_DEBUG, "TPM NV limits: index %u bytes, transfer %u bytes",
+            *index_max, *buffer_max);
+
+  return 0;
+}
+
+//############################################################################
+// get_nv_index_size()
+//############################################################################
+int get_nv_index_size(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE nv_index,
+                      uint16_t * data_size)
+{
+  TPM2B_NV_PUBLIC nvPublic = {.size = 0, };
+  TPM2B_NAME nvName = {.size = 0, };
+
+  // no authorization is needed to read an index's public area
+  TSS2_RC rc = Tss2_Sys_NV_ReadPublic(sapi_ctx, nv_index, NULL, &nvPublic,
+                                      &nvName, NULL);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_DEBUG, "Tss2_Sys_NV_ReadPublic(0x%08X): rc = 0x%08X, %s",
+              nv_index, rc, getErrorString(rc));
+    return 1;
+  }
+  *data_size = nvPublic.nvPublic.dataSize;
+
+  return 0;
+}
+
+//############################################################################
+// define_nv_index()
+//############################################################################
+int define_nv_index(TSS2_SYS_CONTEXT * sapi_ctx, TPM2B_AUTH owner_auth,
+                    TPM2_HANDLE nv_index, uint16_t data_size)
+{
+  if (check_nv_handle(nv_index))
+  {
+    return 1;
+  }
+
+  // an index cannot be resized, so one of another size is replaced
+  uint16_t existing_size = 0;
+
+  if (get_nv_index_size(sapi_ctx, nv_index, &existing_size) == 0)
+  {
+    if (existing_size == data_size)
+    {
+      kmyth_log(LOG_DEBUG, "NV index (0x%08X) already defined", nv_index);
+      return 0;
+    }
+    kmyth_log(LOG_WARNING, "replacing NV index (0x%08X) of %u bytes",
+              nv_index, existing_size);
+    if (undefine_nv_index(sapi_ctx, owner_auth, nv_index))
+    {
+      return 1;
+    }
+  }
+
+  TPM2B_AUTH indexAuth = {.size = 0, };
+  TPM2B_NV_PUBLIC publicInfo = {.size = 0, };
+
+  publicInfo.nvPublic.nvIndex = nv_index;
+  publicInfo.nvPublic.nameAlg = KMYTH_HASH_ALG;
+  publicInfo.nvPublic.authPolicy.size = 0;
+  publicInfo.nvPublic.dataSize = data_size;
+
+  // (an ordinary index, exempt from dictionary attack lockout as its
+  // authorization value is empty)
+  publicInfo.nvPublic.attributes = TPMA_NV_OWNERWRITE | TPMA_NV_OWNERREAD |
+    TPMA_NV_AUTHREAD | TPMA_NV_NO_DA;
+
+  TSS2L_SYS_AUTH_COMMAND cmdAuths;
+  TSS2L_SYS_AUTH_RESPONSE rspAuths;
+
+  if (init_password_cmd_auth(owner_auth, &cmdAuths, &rspAuths))
+  {
+    kmyth_log(LOG_ERR, "error setting up auth session ... exiting");
+    return 1;
+  }
+
+  TSS2_RC rc = Tss2_Sys_NV_DefineSpace(sapi_ctx, TPM2_RH_OWNER, &cmdAuths,
+                                       &indexAuth, &publicInfo, &rspAuths);
+
+  kmyth_clear(&cmdAuths, sizeof(cmdAuths));
+  if (rc == TPM2_RC_NV_SPACE)
+  {
+    kmyth_log(LOG_ERR, "not enough TPM NV space left for %u bytes ... "
+              "exiting", data_size);
+    return 1;
+  }
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_NV_DefineSpace(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "defined NV index (0x%08X) of %u bytes", nv_index,
+            data_size);
+
+  return 0;
+}
+
+//############################################################################
+// undefine_nv_index()
+//############################################################################
+int undefine_nv_index(TSS2_SYS_CONTEXT * sapi_ctx, TPM2B_AUTH owner_auth,
+                      TPM2_HANDLE nv_index)
+{
+  if (check_nv_handle(nv_index))
+  {
+    return 1;
+  }
+
+  TSS2L_SYS_AUTH_COMMAND cmdAuths;
+  TSS2L_SYS_AUTH_RESPONSE rspAuths;
+
+  if (init_password_cmd_auth(owner_auth, &cmdAuths, &rspAuths))
+  {
+    kmyth_log(LOG_ERR, "error setting up auth session ... exiting");
+    return 1;
+  }
+
+  TSS2_RC rc = Tss2_Sys_NV_UndefineSpace(sapi_ctx, TPM2_RH_OWNER, nv_index,
+                                         &cmdAuths, &rspAuths);
+
+  kmyth_clear(&cmdAuths, sizeof(cmdAuths));
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_NV_UndefineSpace(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// write_nv_index()
+//############################################################################
+int write_nv_index(TSS2_SYS_CONTEXT * sapi_ctx, TPM2B_AUTH owner_auth,
+                   TPM2_HANDLE nv_index, const uint8_t * data,
+                   size_t data_len, uint32_t buffer_max)
+{
+  if (check_nv_handle(nv_index))
+  {
+    return 1;
+  }
+  if (data_len > UINT16_MAX || buffer_max == 0)
+  {
+    kmyth_log(LOG_ERR, "invalid NV write ... exiting");
+    return 1;
+  }
+
+  TSS2L_SYS_AUTH_COMMAND cmdAuths;
+  TSS2L_SYS_AUTH_RESPONSE rspAuths;
+
+  if (init_password_cmd_auth(owner_auth, &cmdAuths, &rspAuths))
+  {
+    kmyth_log(LOG_ERR, "error setting up auth session ... exiting");
+    return 1;
+  }
+
+  TPM2B_MAX_NV_BUFFER chunk = {.size = 0, };
+  int retval = 0;
+
+  for (size_t offset = 0; offset < data_len; offset += chunk.size)
+  {
+    chunk.size = (uint16_t) ((data_len - offset < buffer_max) ?
+                             data_len - offset : buffer_max);
+    memcpy(chunk.buffer, data + offset, chunk.size);
+
+    TSS2_RC rc = Tss2_Sys_NV_Write(sapi_ctx, TPM2_RH_OWNER, nv_index,
+                                   &cmdAuths, &chunk, (uint16_t) offset,
+                                   &rspAuths);
+
+    if (rc != TSS2_RC_SUCCESS)
+    {
+      kmyth_log(LOG_ERR, "Tss2_Sys_NV_Write(): rc = 0x%08X, %s", rc,
+                getErrorString(rc));
+      retval = 1;
+      break;
+    }
+  }
+
+  kmyth_clear(&cmdAuths, sizeof(cmdAuths));
+  kmyth_clear(&chunk, sizeof(chunk));
+
+  return retval;
+}
+
+//############################################################################
+// read_nv_index()
+//############################################################################
+int read_nv_index(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE nv_index,
+                  uint32_t buffer_max, uint8_t ** data, size_t *data_len)
+{
+  *data = NULL;
+  *data_len = 0;
+
+  if (check_nv_handle(nv_index))
+  {
+    return 1;
+  }
+
+  uint16_t data_size = 0;
+
+  if (buffer_max == 0 || get_nv_index_size(sapi_ctx, nv_index, &data_size))
+  {
+    kmyth_log(LOG_ERR, "unable to read NV index (0x%08X) ... exiting",
+              nv_index);
+    return 1;
+  }
+  if (data_size == 0)
+  {
+    kmyth_log(LOG_ERR, "NV index (0x%08X) is empty ... exiting", nv_index);
+    return 1;
+  }
+
+  *data = malloc(data_size);
+  if (*data == NULL)
+  {
+    kmyth_log(LOG_ERR, "unable to allocate %u bytes ... exiting", data_size);
+    return 1;
+  }
+
+  // the index is read with its own (empty) authorization value
+  TPM2B_AUTH indexAuth = {.size = 0, };
+  TSS2L_SYS_AUTH_COMMAND cmdAuths;
+  TSS2L_SYS_AUTH_RESPONSE rspAuths;
+
+  if (init_password_cmd_auth(indexAuth, &cmdAuths, &rspAuths))
+  {
+    kmyth_log(LOG_ERR, "error setting up auth session ... exiting");
+    free(*data);
+    *data = NULL;
+    return 1;
+  }
+
+  // each read transfers as much as the TPM allows, so a typical small .ski
+  // takes one or two
+  TPM2B_MAX_NV_BUFFER chunk = {.size = 0, };
+
+  for (uint32_t offset = 0; offset < data_size; offset += chunk.size)
+  {
+    uint16_t size = (uint16_t) ((data_size - offset < buffer_max) ?
+                                data_size - offset : buffer_max);
+
+    chunk.size = 0;
+
+    TSS2_RC rc = Tss2_Sys_NV_Read(sapi_ctx, nv_index, nv_index, &cmdAuths,
+                                  size, (uint16_t) offset, &chunk, &rspAuths);
+
+    if (rc != TSS2_RC_SUCCESS || chunk.size == 0 || chunk.size > size)
+    {
+      kmyth_log(LOG_ERR, "Tss2_Sys_NV_Read(): rc = 0x%08X, %s", rc,
+                getErrorString(rc));
+      free(*data);
+      *data = NULL;
+      return 1;
+    }
+    memcpy(*data + offset, chunk.buffer, chunk.size);
+  }
+  *data_len = data_size;
+
+  return 0;
+}
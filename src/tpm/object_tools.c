@@ -74,7 +74,7 @@ int init_kmyth_object_sensitive(TPM2B_AUTH object_auth,
 //############################################################################
 // init_kmyth_object_template
 //############################################################################
-int init_kmyth_object_template(bool isKey,
+int init_kmyth_object_template(bool isKey, TPMI_ALG_PUBLIC keyAlg,
                                TPM2B_DIGEST auth_policy, TPMT_PUBLIC * pubArea)
 {
   if (pubArea == NULL)
@@ -84,11 +84,18 @@ int init_kmyth_object_template(bool isKey,
   }
 
   // Initialize public key algorithm (object type) for object to be created
-  //   - for SRK or SK, use Kmyth configured default for keys
+  //   - for SRK or SK, use the requested key algorithm (restricted
+  //     decryption keys can only be RSA or ECC)
   //   - for sealed data, use Kmyth configured default for data
   if (isKey == true)
   {
-    pubArea->type = KMYTH_KEY_PUBKEY_ALG;
+    if (keyAlg != TPM2_ALG_RSA && keyAlg != TPM2_ALG_ECC)
+    {
+      kmyth_log(LOG_ERR, "key algorithm (0x%04X) not supported ... exiting",
+                keyAlg);
+      return 1;
+    }
+    pubArea->type = keyAlg;
   }
   else
   {
@@ -239,7 +246,7 @@ int init_kmyth_object_parameters(TPMI_ALG_PUBLIC objectType,
     objectParams->eccDetail.scheme.scheme = TPM2_ALG_NULL;
 
     // 'curveID' options: P192, P224, P256 (TCG Standard), P384, P521
-    objectParams->eccDetail.curveID = TPM2_ECC_NIST_P256;
+    objectParams->eccDetail.curveID = KMYTH_ECC_CURVE;
     // Spec indicates "no commands where this (kdf.scheme) parameter has effect
     // and, in the reference code, this field needs to be set to TPM_ALG_NULL."
     objectParams->eccDetail.kdf.scheme = TPM2_ALG_NULL;
@@ -326,6 +333,88 @@ int init_kmyth_object_unique(TPMI_ALG_PUBLIC objectType,
   return 0;
 }
 
+//############################################################################
+// create_object_async()
+//############################################################################
+static TSS2_RC create_object_async(TSS2_SYS_CONTEXT * sapi_ctx,
+                                   TPM2_HANDLE parent_handle,
+                                   TSS2L_SYS_AUTH_COMMAND * cmdAuths,
+                                   const TPM2B_SENSITIVE_CREATE *
+                                   in_sensitive,
+                                   const TPM2B_PUBLIC * in_public,
+                                   const TPM2B_DATA * outside_info,
+                                   const TPML_PCR_SELECTION * creation_pcr,
+                                   TPM2B_PRIVATE * out_private,
+                                   TPM2B_PUBLIC * out_public,
+                                   TPM2B_CREATION_DATA * creation_data,
+                                   TPM2B_DIGEST * creation_hash,
+                                   TPMT_TK_CREATION * creation_ticket,
+                                   TSS2L_SYS_AUTH_RESPONSE * rspAuths,
+                                   HOST_WORK * host_work)
+{
+  // equivalent to Tss2_Sys_Create(), but lets host work overlap the command
+  TSS2_RC rc = Tss2_Sys_Create_Prepare(sapi_ctx, parent_handle, in_sensitive,
+                                       in_public, outside_info, creation_pcr);
+
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_Sys_SetCmdAuths(sapi_ctx, cmdAuths);
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = execute_tpm2_async(sapi_ctx, host_work);
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_Sys_Create_Complete(sapi_ctx, out_private, out_public,
+                                  creation_data, creation_hash,
+                                  creation_ticket);
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_Sys_GetRspAuths(sapi_ctx, rspAuths);
+  }
+
+  return rc;
+}
+
+//############################################################################
+// load_object_async()
+//############################################################################
+static TSS2_RC load_object_async(TSS2_SYS_CONTEXT * sapi_ctx,
+                                 TPM2_HANDLE parent_handle,
+                                 TSS2L_SYS_AUTH_COMMAND * cmdAuths,
+                                 TPM2B_PRIVATE * in_private,
+                                 TPM2B_PUBLIC * in_public,
+                                 TPM2_HANDLE * object_handle,
+                                 TPM2B_NAME * name,
+                                 TSS2L_SYS_AUTH_RESPONSE * rspAuths,
+                                 HOST_WORK * host_work)
+{
+  // equivalent to Tss2_Sys_Load(), but lets host work overlap the command
+  TSS2_RC rc = Tss2_Sys_Load_Prepare(sapi_ctx, parent_handle, in_private,
+                                     in_public);
+
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_Sys_SetCmdAuths(sapi_ctx, cmdAuths);
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = execute_tpm2_async(sapi_ctx, host_work);
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_Sys_Load_Complete(sapi_ctx, object_handle, name);
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_Sys_GetRspAuths(sapi_ctx, rspAuths);
+  }
+
+  return rc;
+}
+
 //############################################################################
 // create_kmyth_object()
 //############################################################################
@@ -339,7 +428,31 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                         TPML_PCR_SELECTION object_pcrSelect,
                         TPM2_HANDLE object_dest_handle,
                         TPM2B_PRIVATE * object_private,
-                        TPM2B_PUBLIC * object_public)
+                        TPM2B_PUBLIC * object_public, HOST_WORK * host_work)
+{
+  return create_kmyth_object_ref(sapi_ctx, createObjectAuthSession,
+                                 parent_handle, &parent_auth,
+                                 &parent_pcrList, &object_sensitive,
+                                 &object_template, &object_pcrSelect,
+                                 object_dest_handle, object_private,
+                                 object_public, host_work);
+}
+
+//############################################################################
+// create_kmyth_object_ref()
+//############################################################################
+int create_kmyth_object_ref(TSS2_SYS_CONTEXT * sapi_ctx,
+                            SESSION * createObjectAuthSession,
+                            TPM2_HANDLE parent_handle,
+                            const TPM2B_AUTH * parent_auth,
+                            const TPML_PCR_SELECTION * parent_pcrList,
+                            const TPM2B_SENSITIVE_CREATE * object_sensitive,
+                            const TPM2B_PUBLIC * object_template,
+                            const TPML_PCR_SELECTION * object_pcrSelect,
+                            TPM2_HANDLE object_dest_handle,
+                            TPM2B_PRIVATE * object_private,
+                            TPM2B_PUBLIC * object_public,
+                            HOST_WORK * host_work)
 {
   // Initialize TSS2 response code to failure, initially
   TSS2_RC rc = TPM2_RC_FAILURE;
@@ -377,7 +490,7 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
     // Set up NULL password authorization session for TPM commands used to
     // create the primary object (Tss2_Sys_CreatePrimary()) and load it at
     // a persistent handle (Tss2_Sys_EvictControl())
-    if (init_password_cmd_auth(parent_auth,
+    if (init_password_cmd_auth(*parent_auth,
                                &createObjectCmdAuths, &createObjectRspAuths))
     {
       kmyth_log(LOG_ERR, "error setting up auth session ... exiting");
@@ -391,12 +504,19 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
     // SRK will be created with a transient handle (returned in temp_handle).
     TPM2_HANDLE temp_handle = 0;
 
-    rc = Tss2_Sys_CreatePrimary(sapi_ctx, parent_handle, &createObjectCmdAuths,
-                                &object_sensitive, &object_template,
-                                &outside_info, &object_pcrSelect, &temp_handle,
-                                object_public, &creation_data, &creation_hash,
-                                &creation_ticket, &object_name,
-                                &createObjectRspAuths);
+    unsigned int retry_count = 0;
+
+    do
+    {
+      rc = Tss2_Sys_CreatePrimary(sapi_ctx, parent_handle,
+                                  &createObjectCmdAuths, object_sensitive,
+                                  object_template, &outside_info,
+                                  object_pcrSelect, &temp_handle,
+                                  object_public, &creation_data,
+                                  &creation_hash, &creation_ticket,
+                                  &object_name, &createObjectRspAuths);
+    }
+    while (retry_tpm2_command(sapi_ctx, rc, &retry_count));
     if (rc != TSS2_RC_SUCCESS)
     {
       kmyth_log(LOG_ERR,
@@ -433,7 +553,7 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
       // If a NULL authorization session (indicating password authorization)
       // was passed in, the object being created is a storage key (SK)
       //   - TPM owner (storage) auth is required for use of the SRK to seal
-      if (init_password_cmd_auth(parent_auth,
+      if (init_password_cmd_auth(*parent_auth,
                                  &createObjectCmdAuths, &createObjectRspAuths))
       {
         kmyth_log(LOG_ERR, "error setting up auth session ... exiting");
@@ -489,9 +609,9 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
       // create 'command parameter buffer' in SAPI context
       rc = Tss2_Sys_Create_Prepare(sapi_ctx,
                                    parent_handle,
-                                   &object_sensitive,
-                                   &object_template,
-                                   &outside_info, &object_pcrSelect);
+                                   object_sensitive,
+                                   object_template,
+                                   &outside_info, object_pcrSelect);
       if (rc != TSS2_RC_SUCCESS)
       {
         kmyth_log(LOG_ERR,
@@ -533,10 +653,10 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
       if (init_policy_cmd_auth(createObjectAuthSession,
                                create_object_command_code,
                                parent_name,
-                               parent_auth,
+                               *parent_auth,
                                cmdParams,
                                cmdParams_size,
-                               object_pcrSelect,
+                               *object_pcrSelect,
                                &createObjectCmdAuths, &createObjectRspAuths))
       {
         kmyth_log(LOG_ERR,
@@ -556,34 +676,23 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
       }
     }
 
-    // create the ordinary object
-    int retry_count = 0;
+    // create the ordinary object (any host work overlaps the first attempt)
+    unsigned int retry_count = 0;
+    uint64_t phase_start = get_timing_ns();
 
     kmyth_log(LOG_DEBUG, "creating object");
-    rc = Tss2_Sys_Create(sapi_ctx, parent_handle, &createObjectCmdAuths,
-                         &object_sensitive, &object_template, &outside_info,
-                         &object_pcrSelect, object_private, object_public,
-                         &creation_data, &creation_hash, &creation_ticket,
-                         &createObjectRspAuths);
-    while (rc == TPM2_RC_RETRY)
+    do
     {
-      if (retry_count < MAX_RETRIES)
-      {
-        rc = Tss2_Sys_Create(sapi_ctx, parent_handle, &createObjectCmdAuths,
-                             &object_sensitive, &object_template, &outside_info,
-                             &object_pcrSelect, object_private, object_public,
-                             &creation_data, &creation_hash, &creation_ticket,
-                             &createObjectRspAuths);
-        retry_count++;
-      }
-      else
-      {
-        kmyth_log(LOG_ERR,
-                  "Tss2_Sys_Create(): retry limit (%d) reached ... exiting",
-                  MAX_RETRIES);
-        return 1;
-      }
+      rc = create_object_async(sapi_ctx, parent_handle, &createObjectCmdAuths,
+                               object_sensitive, object_template,
+                               &outside_info, object_pcrSelect,
+                               object_private, object_public, &creation_data,
+                               &creation_hash, &creation_ticket,
+                               &createObjectRspAuths, host_work);
     }
+    while (retry_tpm2_command(sapi_ctx, rc, &retry_count));
+    add_phase_timing(get_tpm2_timings(sapi_ctx), KMYTH_PHASE_CREATE,
+                     phase_start);
     if (rc != TSS2_RC_SUCCESS)
     {
       kmyth_log(LOG_ERR, "Tss2_Sys_Create(): rc = 0x%08X, %s ... exiting", rc,
@@ -592,7 +701,7 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
     }
     if (retry_count > 0)
     {
-      kmyth_log(LOG_DEBUG, "Tss2_Sys_Create(): %d retries", retry_count);
+      kmyth_log(LOG_DEBUG, "Tss2_Sys_Create(): %u retries", retry_count);
     }
 
     // Only validate the TPM authorization response if a policy session used
@@ -621,7 +730,7 @@ int create_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                               create_object_command_code,
                               rspParams,
                               rspParams_size,
-                              parent_auth, &createObjectRspAuths))
+                              *parent_auth, &createObjectRspAuths))
       {
         kmyth_log(LOG_ERR, "response authorization check failed ... exiting");
         return 1;
@@ -642,7 +751,8 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                       TPM2B_AUTH parent_auth,
                       TPML_PCR_SELECTION parent_pcrList,
                       TPM2B_PRIVATE * in_private,
-                      TPM2B_PUBLIC * in_public, TPM2_HANDLE * object_handle)
+                      TPM2B_PUBLIC * in_public, TPM2_HANDLE * object_handle,
+                      HOST_WORK * host_work)
 {
   // Initialize TSS2 response code to failure, initially
   TSS2_RC rc = TPM2_RC_FAILURE;
@@ -656,6 +766,37 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
   TSS2L_SYS_AUTH_COMMAND loadObjectCmdAuths;
   TSS2L_SYS_AUTH_RESPONSE loadObjectRspAuths;
 
+  // If this object was loaded before over this connection, its saved
+  // context is loaded instead (Tss2_Sys_ContextLoad() needs no
+  // authorization - use of the object is still authorized as usual)
+  uint64_t phase_start = get_timing_ns();
+
+  if (load_cached_object_context(sapi_ctx, in_private, in_public,
+                                 object_handle) == 0)
+  {
+    add_phase_timing(get_tpm2_timings(sapi_ctx), KMYTH_PHASE_LOAD,
+                     phase_start);
+
+    // the policy applied for the skipped Tss2_Sys_Load() would otherwise
+    // still be in the session when the caller applies it again
+    if (loadObjectAuthSession != NULL)
+    {
+      rc = Tss2_Sys_PolicyRestart(sapi_ctx,
+                                  loadObjectAuthSession->sessionHandle,
+                                  nullCmdAuths, nullRspAuths);
+      if (rc != TSS2_RC_SUCCESS)
+      {
+        kmyth_log(LOG_ERR,
+                  "Tss2_Sys_PolicyRestart(): rc = 0x%08X, %s ... exiting", rc,
+                  getErrorString(rc));
+        Tss2_Sys_FlushContext(sapi_ctx, *object_handle);
+        *object_handle = 0;
+        return 1;
+      }
+    }
+    return 0;
+  }
+
   // The name of the parent object is needed to specify where in the TPM
   // hierarchy the object should be loaded. We get the parent name from
   // the object loaded at parent handle.
@@ -779,23 +920,25 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
       return 1;
     }
     kmyth_log(LOG_DEBUG, "policy auth structs prepared for Tss2_Sys_Load()");
-
-    rc = Tss2_Sys_SetCmdAuths(sapi_ctx, &loadObjectCmdAuths);
-    if (rc != TSS2_RC_SUCCESS)
-    {
-      kmyth_log(LOG_ERR, "Tss2_Sys_SetCmdAuths(): rc = 0x%08X, %s ... exiting",
-                rc, getErrorString(rc));
-      return 1;
-    }
   }
 
-  // Load the object
-  rc = Tss2_Sys_Load(sapi_ctx,
-                     parent_handle,
-                     &loadObjectCmdAuths,
-                     in_private,
-                     in_public,
-                     object_handle, &parent_name, &loadObjectRspAuths);
+  // Load the object (the command parameters are prepared again, along with
+  // the command authorizations computed from them, before execution)
+  unsigned int retry_count = 0;
+
+  phase_start = get_timing_ns();
+  do
+  {
+    rc = load_object_async(sapi_ctx,
+                           parent_handle,
+                           &loadObjectCmdAuths,
+                           in_private,
+                           in_public,
+                           object_handle, &parent_name, &loadObjectRspAuths,
+                           host_work);
+  }
+  while (retry_tpm2_command(sapi_ctx, rc, &retry_count));
+  add_phase_timing(get_tpm2_timings(sapi_ctx), KMYTH_PHASE_LOAD, phase_start);
   if (rc != TSS2_RC_SUCCESS)
   {
     kmyth_log(LOG_ERR, "Tss2_Sys_Load(): rc = 0x%08X, %s ... exiting", rc,
@@ -835,6 +978,8 @@ int load_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
     kmyth_log(LOG_DEBUG, "validated HMAC in response for TPM object load");
   }
 
+  save_object_context(sapi_ctx, in_private, in_public, *object_handle);
+
   return 0;
 }
 
@@ -848,7 +993,8 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
                         TPM2B_DIGEST policyBranch1,
                         TPM2B_DIGEST policyBranch2,
                         TPML_PCR_SELECTION object_pcrList,
-                        TPM2B_SENSITIVE_DATA * object_sensitive)
+                        TPM2B_SENSITIVE_DATA * object_sensitive,
+                        HOST_WORK * host_work)
 {
   kmyth_log(LOG_DEBUG, "unsealing TPM object (handle = 0x%08X)", object_handle);
 
@@ -982,10 +1128,36 @@ int unseal_kmyth_object(TSS2_SYS_CONTEXT * sapi_ctx,
     return 1;
   }
 
-  // Unseal the object
+  // Unseal the object - the command is already prepared in the SAPI
+  // context, so it is issued asynchronously to overlap any host work
   kmyth_log(LOG_DEBUG, "unsealing TPM object ...");
-  rc = Tss2_Sys_Unseal(sapi_ctx, object_handle, &unsealObjectCmdAuths,
-                       object_sensitive, &unsealObjectRspAuths);
+  uint64_t phase_start = get_timing_ns();
+  unsigned int retry_count = 0;
+
+  rc = execute_tpm2_async(sapi_ctx, host_work);
+  while (retry_tpm2_command(sapi_ctx, rc, &retry_count))
+  {
+    // the response overwrote the prepared command, so prepare it again
+    rc = Tss2_Sys_Unseal_Prepare(sapi_ctx, object_handle);
+    if (rc == TSS2_RC_SUCCESS)
+    {
+      rc = Tss2_Sys_SetCmdAuths(sapi_ctx, &unsealObjectCmdAuths);
+    }
+    if (rc == TSS2_RC_SUCCESS)
+    {
+      rc = execute_tpm2_async(sapi_ctx, NULL);
+    }
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_Sys_Unseal_Complete(sapi_ctx, object_sensitive);
+  }
+  if (rc == TSS2_RC_SUCCESS)
+  {
+    rc = Tss2_Sys_GetRspAuths(sapi_ctx, &unsealObjectRspAuths);
+  }
+  add_phase_timing(get_tpm2_timings(sapi_ctx), KMYTH_PHASE_UNSEAL,
+                   phase_start);
   if (rc != TSS2_RC_SUCCESS)
   {
     kmyth_log(LOG_ERR, "Tss2_Sys_Unseal(): rc = 0x%08X, %s ... exiting",
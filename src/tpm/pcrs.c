@@ -7,11 +7,13 @@
 #include "pcrs.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <string.h>
 
 #include <openssl/evp.h>
 
 #include "defines.h"
+#include "formatting_tools.h"
 #include "tpm2_interface.h"
 
 //############################################################################
@@ -87,18 +89,211 @@ int init_pcr_selection(TSS2_SYS_CONTEXT * sapi_ctx,
 //############################################################################
 int get_pcr_count(TSS2_SYS_CONTEXT * sapi_ctx, int *pcrCount)
 {
-  // query TPM 2.0 to obtain the count of available PCRs
-  TPMS_CAPABILITY_DATA capData;
+  // obtain the count of available PCRs from the TPM 2.0 capability
+  // snapshot (only queried once per connection)
+  CAP_SNAPSHOT snapshot;
 
-  if (get_tpm2_properties
-      (sapi_ctx, TPM2_CAP_TPM_PROPERTIES, TPM2_PT_PCR_COUNT, TPM2_PT_GROUP,
-       &capData))
+  if (get_tpm2_snapshot(sapi_ctx, KMYTH_SNAPSHOT_PROPERTIES, &snapshot))
   {
     kmyth_log(LOG_ERR, "error obtaining PCR count from TPM ... exiting");
     return 1;
   }
-  *pcrCount = (int) capData.data.tpmProperties.tpmProperty[0].value;
+  *pcrCount = (int) snapshot.pcr_count;
   kmyth_log(LOG_DEBUG, "count of available PCRs (TPM2_PT_PCR_COUNT) = %d",
             *pcrCount);
   return 0;
 }
+
+//############################################################################
+// read_pcr_values()
+//############################################################################
+int read_pcr_values(TSS2_SYS_CONTEXT * sapi_ctx,
+                    TPML_PCR_SELECTION pcrs_struct,
+                    TPM2B_DIGEST * pcrValues,
+                    size_t pcrValues_size, size_t *pcrValues_len)
+{
+  if (sapi_ctx == NULL || pcrValues == NULL || pcrValues_len == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid input ... exiting");
+    return 1;
+  }
+
+  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
+  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+
+  // PCR_Read returns the values for (a prefix of) the PCRs still to be
+  // read, so keep reading until the remaining selection is empty
+  TPML_PCR_SELECTION remaining = pcrs_struct;
+  uint32_t firstUpdateCounter = 0;
+  size_t count = 0;
+
+  while (true)
+  {
+    bool done = true;
+
+    for (uint32_t i = 0; i < remaining.count && done; i++)
+    {
+      for (uint8_t j = 0; j < remaining.pcrSelections[i].sizeofSelect; j++)
+      {
+        if (remaining.pcrSelections[i].pcrSelect[j] != 0)
+        {
+          done = false;
+          break;
+        }
+      }
+    }
+    if (done)
+    {
+      break;
+    }
+
+    uint32_t pcrUpdateCounter = 0;
+    TPML_PCR_SELECTION pcrSelectionOut;
+    TPML_DIGEST pcrDigests;
+
+    TSS2_RC rc = Tss2_Sys_PCR_Read(sapi_ctx,
+                                   nullCmdAuths,
+                                   &remaining,
+                                   &pcrUpdateCounter,
+                                   &pcrSelectionOut,
+                                   &pcrDigests,
+                                   nullRspAuths);
+
+    if (rc != TSS2_RC_SUCCESS)
+    {
+      kmyth_log(LOG_ERR, "Tss2_Sys_PCR_Read(): rc = 0x%08X, %s", rc,
+                getErrorString(rc));
+      return 1;
+    }
+    if (pcrDigests.count == 0)
+    {
+      kmyth_log(LOG_ERR, "selected PCRs not available in TPM ... exiting");
+      return 1;
+    }
+
+    // a PCR changed since the first read - start over so that the values
+    // returned all come from the same PCR state
+    if (count > 0 && pcrUpdateCounter != firstUpdateCounter)
+    {
+      kmyth_log(LOG_DEBUG, "PCRs changed during read ... restarting");
+      remaining = pcrs_struct;
+      count = 0;
+      continue;
+    }
+    firstUpdateCounter = pcrUpdateCounter;
+
+    if (count + pcrDigests.count > pcrValues_size)
+    {
+      kmyth_log(LOG_ERR, "too many PCRs selected (max %zu) ... exiting",
+                pcrValues_size);
+      return 1;
+    }
+    for (uint32_t i = 0; i < pcrDigests.count; i++)
+    {
+      pcrValues[count++] = pcrDigests.digests[i];
+    }
+
+    // remove the PCRs just read from the remaining selection
+    for (uint32_t i = 0; i < pcrSelectionOut.count; i++)
+    {
+      for (uint32_t k = 0; k < remaining.count; k++)
+      {
+        if (remaining.pcrSelections[k].hash !=
+            pcrSelectionOut.pcrSelections[i].hash)
+        {
+          continue;
+        }
+        for (uint8_t j = 0;
+             j < pcrSelectionOut.pcrSelections[i].sizeofSelect &&
+             j < remaining.pcrSelections[k].sizeofSelect; j++)
+        {
+          remaining.pcrSelections[k].pcrSelect[j] &=
+            (uint8_t) ~pcrSelectionOut.pcrSelections[i].pcrSelect[j];
+        }
+      }
+    }
+  }
+
+  *pcrValues_len = count;
+  kmyth_log(LOG_DEBUG, "read %zu PCR values", count);
+
+  return 0;
+}
+
+//############################################################################
+// parse_pcr_value_set()
+//############################################################################
+int parse_pcr_value_set(char *line, size_t pcr_count,
+                        TPML_PCR_SELECTION * pcrList,
+                        TPM2B_DIGEST * pcrValues, size_t *pcrValues_len)
+{
+  // the selection uses the Kmyth PCR bank, as set up by init_pcr_selection()
+  TPM2B_DIGEST values[TPM2_MAX_PCRS];
+
+  pcrList->count = 1;
+  pcrList->pcrSelections[0].hash = KMYTH_HASH_ALG;
+  pcrList->pcrSelections[0].sizeofSelect = (uint8_t) (pcr_count / 8);
+  memset(pcrList->pcrSelections[0].pcrSelect, 0,
+         sizeof(pcrList->pcrSelections[0].pcrSelect));
+
+  char *save_ptr = NULL;
+  char *field = strtok_r(line, " \t,", &save_ptr);
+
+  while (field != NULL)
+  {
+    // each field is <PCR index>=<hex PCR value>
+    char *end = NULL;
+
+    errno = 0;
+    unsigned long pcr = strtoul(field, &end, 10);
+
+    if (errno || end == field || *end != '=' || pcr >= pcr_count)
+    {
+      kmyth_log(LOG_ERR, "invalid PCR index (%s)", field);
+      return 1;
+    }
+
+    uint8_t mask = (uint8_t) (1 << (pcr % 8));
+
+    if (pcrList->pcrSelections[0].pcrSelect[pcr / 8] & mask)
+    {
+      kmyth_log(LOG_ERR, "PCR %lu specified more than once", pcr);
+      return 1;
+    }
+
+    char *hex = end + 1;
+
+    if (strlen(hex) != 2 * KMYTH_DIGEST_SIZE)
+    {
+      kmyth_log(LOG_ERR, "invalid length for PCR %lu value", pcr);
+      return 1;
+    }
+    for (size_t i = 0; i < 2 * KMYTH_DIGEST_SIZE; i++)
+    {
+      if (!isxdigit((unsigned char) hex[i]))
+      {
+        kmyth_log(LOG_ERR, "invalid hex character in PCR %lu value", pcr);
+        return 1;
+      }
+    }
+    if (convert_string_to_digest(hex, &values[pcr]))
+    {
+      return 1;
+    }
+    pcrList->pcrSelections[0].pcrSelect[pcr / 8] |= mask;
+
+    field = strtok_r(NULL, " \t,", &save_ptr);
+  }
+
+  // the PCR digest covers the selected PCRs in increasing index order
+  *pcrValues_len = 0;
+  for (size_t pcr = 0; pcr < pcr_count; pcr++)
+  {
+    if (pcrList->pcrSelections[0].pcrSelect[pcr / 8] & (1 << (pcr % 8)))
+    {
+      pcrValues[(*pcrValues_len)++] = values[pcr];
+    }
+  }
+
+  return 0;
+}
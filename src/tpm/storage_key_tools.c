@@ -14,6 +14,8 @@
 #include <openssl/evp.h>
 
 #include "defines.h"
+#include "kmyth.h"
+#include "memory_util.h"
 #include "object_tools.h"
 #include "tpm2_interface.h"
 
@@ -57,6 +59,71 @@ int get_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
   return 0;
 }
 
+//############################################################################
+// get_cached_srk_handle()
+//############################################################################
+int get_cached_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
+                          TPM2_HANDLE * srk_handle,
+                          TPM2B_AUTH * storage_hierarchy_auth)
+{
+  if (sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "SAPI context not initialized ... exiting");
+    return 1;
+  }
+
+  // If we have a hint, a single ReadPublic on that handle tells us whether
+  // it still references the SRK. A failed check (including an error reading
+  // the handle, as happens if the object was evicted) is not fatal - it
+  // just means the hint is stale and we must do the full lookup.
+  if (*srk_handle != 0)
+  {
+    bool isSRK = false;
+
+    if (!check_if_srk(sapi_ctx, *srk_handle, &isSRK) && isSRK)
+    {
+      kmyth_log(LOG_DEBUG, "cached SRK handle (0x%08X) verified",
+                *srk_handle);
+      return 0;
+    }
+    kmyth_log(LOG_DEBUG, "cached SRK handle (0x%08X) is stale", *srk_handle);
+    *srk_handle = 0;
+  }
+
+  if (get_srk_handle(sapi_ctx, srk_handle, storage_hierarchy_auth))
+  {
+    *srk_handle = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// get_srk_name()
+//############################################################################
+int get_srk_name(TSS2_SYS_CONTEXT * sapi_ctx, TPM2_HANDLE srk_handle,
+                 TPM2B_NAME * srk_name)
+{
+  TPM2B_PUBLIC publicOut = {.size = 0, };
+  TPM2B_NAME qualNameOut = {.size = 0, };
+
+  srk_name->size = 0;
+
+  // no authorization is needed to read an object's public area (and name)
+  TPM2_RC rc = Tss2_Sys_ReadPublic(sapi_ctx, srk_handle, NULL, &publicOut,
+                                   srk_name, &qualNameOut, NULL);
+
+  if (rc != TPM2_RC_SUCCESS || srk_name->size == 0)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_ReadPublic(): TPM rc = 0x%08X", rc);
+    srk_name->size = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
 //############################################################################
 // get_existing_srk_handle()
 //############################################################################
@@ -99,45 +166,48 @@ int get_existing_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
   //                As this limit seems to be much more than the TPM
   //                hardware is expected to support, for now, this seems
   //                an acceptable assumption.
+  //
+  //          The list comes from the connection's TPM capability snapshot,
+  //          so it is only queried again after a persistent object has
+  //          been added or removed (EvictControl).
 
-  TPMS_CAPABILITY_DATA persistent_handle_list;
+  CAP_SNAPSHOT snapshot;
 
-  if (get_tpm2_properties(sapi_ctx,
-                          TPM2_CAP_HANDLES,
-                          TPM2_HR_PERSISTENT,
-                          TPM2_MAX_CAP_HANDLES, &persistent_handle_list))
+  if (get_tpm2_snapshot(sapi_ctx, KMYTH_SNAPSHOT_PERSISTENT, &snapshot))
   {
     kmyth_log(LOG_ERR, "error getting list of persistent handles ... exiting");
     return 1;
   }
 
+  TPML_HANDLE *persistent_handles = &(snapshot.persistent_handles);
+
   // Step 2:  Search the list for the SRK
 
-  if (persistent_handle_list.data.handles.count == 0)
+  if (persistent_handles->count == 0)
   {
     kmyth_log(LOG_DEBUG, "no handles for existing persistent objects found");
   }
   else
   {
     kmyth_log(LOG_DEBUG, "checking %d persistent data handle(s) for SRK",
-              persistent_handle_list.data.handles.count);
+              persistent_handles->count);
   }
 
-  for (int i = 0; i < persistent_handle_list.data.handles.count; i++)
+  for (int i = 0; i < persistent_handles->count; i++)
   {
     bool SRK_flag = false;
 
     if (check_if_srk(sapi_ctx,
-                     persistent_handle_list.data.handles.handle[i], &SRK_flag))
+                     persistent_handles->handle[i], &SRK_flag))
     {
       kmyth_log(LOG_ERR,
                 "error checking if handle = 0x%08X references SRK ... exiting",
-                persistent_handle_list.data.handles.handle[i]);
+                persistent_handles->handle[i]);
       return 1;
     }
     if (SRK_flag)
     {
-      *srkHandle = persistent_handle_list.data.handles.handle[i];
+      *srkHandle = persistent_handles->handle[i];
       kmyth_log(LOG_DEBUG, "SRK found ... done searching");
       break;
     }
@@ -185,9 +255,9 @@ int get_existing_srk_handle(TSS2_SYS_CONTEXT * sapi_ctx,
     {
       bool handleInUse = false;
 
-      for (int i = 0; i < persistent_handle_list.data.handles.count; i++)
+      for (int i = 0; i < persistent_handles->count; i++)
       {
-        if (*nextSrkHandle == persistent_handle_list.data.handles.handle[i])
+        if (*nextSrkHandle == persistent_handles->handle[i])
         {
           handleInUse = true;   // handle being checked is "in use" (on list)
           break;                // no need to compare with other handles in list
@@ -450,7 +520,7 @@ int put_srk_into_persistent_storage(TSS2_SYS_CONTEXT * sapi_ctx,
 
   srk_template.size = 0;
   empty_policy_digest.size = 0;
-  if (init_kmyth_object_template(true,
+  if (init_kmyth_object_template(true, KMYTH_KEY_PUBKEY_ALG,
                                  empty_policy_digest,
                                  &(srk_template.publicArea)))
   {
@@ -474,7 +544,8 @@ int put_srk_into_persistent_storage(TSS2_SYS_CONTEXT * sapi_ctx,
                           srk_sensitive,
                           srk_template,
                           emptyPCRList,
-                          srkHandle, nullPrivateBlob, nullPublicBlob))
+                          srkHandle, nullPrivateBlob, nullPublicBlob,
+                          NULL))
   {
     kmyth_log(LOG_ERR, "error deriving SRK ... exiting");
     return 1;
@@ -492,6 +563,7 @@ int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
                        TPM2B_AUTH sk_authVal,
                        TPML_PCR_SELECTION sk_pcrList,
                        TPM2B_DIGEST sk_authPolicy,
+                       TPMI_ALG_PUBLIC sk_alg,
                        TPM2_HANDLE * sk_handle,
                        TPM2B_PRIVATE * sk_private, TPM2B_PUBLIC * sk_public)
 {
@@ -517,7 +589,7 @@ int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
   TPM2B_PUBLIC sk_template;
 
   sk_template.size = 0;
-  if (init_kmyth_object_template(true,
+  if (init_kmyth_object_template(true, sk_alg,
                                  sk_authPolicy, &(sk_template.publicArea)))
   {
     kmyth_log(LOG_ERR, "SK create template error ... exiting");
@@ -538,7 +610,8 @@ int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
                           emptyPCRList,
                           sk_sensitive,
                           sk_template,
-                          sk_pcrList, unusedHandle, sk_private, sk_public))
+                          sk_pcrList, unusedHandle, sk_private, sk_public,
+                          NULL))
   {
     kmyth_log(LOG_ERR, "error creating storage key ... exiting");
     return 1;
@@ -549,7 +622,8 @@ int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
                         nullSession,
                         srk_handle,
                         srk_authVal,
-                        emptyPCRList, sk_private, sk_public, sk_handle))
+                        emptyPCRList, sk_private, sk_public, sk_handle,
+                        NULL))
   {
     kmyth_log(LOG_ERR, "failed to load storage key ... exiting");
     return 1;
@@ -558,3 +632,278 @@ int create_and_load_sk(TSS2_SYS_CONTEXT * sapi_ctx,
   kmyth_log(LOG_DEBUG, "storage key object created and loaded");
   return 0;
 }
+
+//############################################################################
+// same_sk_public()
+//############################################################################
+static bool same_sk_public(TPMT_PUBLIC * a, TPMT_PUBLIC * b)
+{
+  // The public key (unique) identifies the storage key, the rest guards
+  // against a key with the same public key but other usage restrictions
+  if (a->type != b->type || a->nameAlg != b->nameAlg ||
+      a->objectAttributes != b->objectAttributes ||
+      a->authPolicy.size != b->authPolicy.size ||
+      memcmp(a->authPolicy.buffer, b->authPolicy.buffer, a->authPolicy.size))
+  {
+    return false;
+  }
+
+  switch (a->type)
+  {
+  case TPM2_ALG_RSA:
+    return (a->unique.rsa.size == b->unique.rsa.size &&
+            memcmp(a->unique.rsa.buffer, b->unique.rsa.buffer,
+                   a->unique.rsa.size) == 0);
+  case TPM2_ALG_ECC:
+    return (a->unique.ecc.x.size == b->unique.ecc.x.size &&
+            a->unique.ecc.y.size == b->unique.ecc.y.size &&
+            memcmp(a->unique.ecc.x.buffer, b->unique.ecc.x.buffer,
+                   a->unique.ecc.x.size) == 0 &&
+            memcmp(a->unique.ecc.y.buffer, b->unique.ecc.y.buffer,
+                   a->unique.ecc.y.size) == 0);
+  default:
+    return false;
+  }
+}
+
+//############################################################################
+// check_persistent_sk()
+//############################################################################
+static int check_persistent_sk(TSS2_SYS_CONTEXT * sapi_ctx,
+                               TPM2_HANDLE handle,
+                               TPM2B_PUBLIC * sk_public, bool *isSK)
+{
+  *isSK = false;
+
+  TPM2B_PUBLIC publicOut = {.size = 0, };
+  TPM2B_NAME nameOut = {.size = 0, };
+  TPM2B_NAME qualNameOut = {.size = 0, };
+
+  // no authorization is needed to read an object's public area
+  TPM2_RC rc = Tss2_Sys_ReadPublic(sapi_ctx, handle, NULL, &publicOut,
+                                   &nameOut, &qualNameOut, NULL);
+
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_ReadPublic(): TPM rc = 0x%08X", rc);
+    return 1;
+  }
+
+  *isSK = same_sk_public(&publicOut.publicArea, &sk_public->publicArea);
+
+  return 0;
+}
+
+//############################################################################
+// list_persistent_sks()
+//############################################################################
+int list_persistent_sks(TSS2_SYS_CONTEXT * sapi_ctx, TPML_HANDLE * sk_handles)
+{
+  sk_handles->count = 0;
+
+  if (sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "SAPI context not initialized ... exiting");
+    return 1;
+  }
+
+  // the list comes from the connection's TPM capability snapshot, which is
+  // refreshed after every EvictControl
+  CAP_SNAPSHOT snapshot;
+
+  if (get_tpm2_snapshot(sapi_ctx, KMYTH_SNAPSHOT_PERSISTENT, &snapshot))
+  {
+    kmyth_log(LOG_ERR, "error getting list of persistent handles ... exiting");
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < snapshot.persistent_handles.count; i++)
+  {
+    TPM2_HANDLE handle = snapshot.persistent_handles.handle[i];
+
+    if (handle >= KMYTH_PERSISTENT_SK_FIRST &&
+        handle <= KMYTH_PERSISTENT_SK_LAST)
+    {
+      sk_handles->handle[sk_handles->count++] = handle;
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// find_persistent_sk()
+//############################################################################
+int find_persistent_sk(TSS2_SYS_CONTEXT * sapi_ctx,
+                       TPM2B_PUBLIC sk_public, TPM2_HANDLE * sk_handle)
+{
+  bool isSK = false;
+
+  // A hint that no longer holds the key (including one that was evicted,
+  // so cannot be read) just means the full lookup is needed
+  if (*sk_handle != 0)
+  {
+    if (!check_persistent_sk(sapi_ctx, *sk_handle, &sk_public, &isSK) && isSK)
+    {
+      return 0;
+    }
+    *sk_handle = 0;
+  }
+
+  TPML_HANDLE sk_handles;
+
+  if (list_persistent_sks(sapi_ctx, &sk_handles))
+  {
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < sk_handles.count; i++)
+  {
+    if (check_persistent_sk(sapi_ctx, sk_handles.handle[i], &sk_public, &isSK))
+    {
+      return 1;
+    }
+    if (isSK)
+    {
+      *sk_handle = sk_handles.handle[i];
+      kmyth_log(LOG_DEBUG, "found persistent SK (handle = 0x%08X)",
+                *sk_handle);
+      break;
+    }
+  }
+
+  return 0;
+}
+
+//############################################################################
+// evict_control_sk()
+//############################################################################
+static int evict_control_sk(TSS2_SYS_CONTEXT * sapi_ctx,
+                            TPM2B_AUTH owner_auth,
+                            TPM2_HANDLE object_handle,
+                            TPM2_HANDLE persistent_handle)
+{
+  TSS2L_SYS_AUTH_COMMAND cmdAuths;
+  TSS2L_SYS_AUTH_RESPONSE rspAuths;
+
+  if (init_password_cmd_auth(owner_auth, &cmdAuths, &rspAuths))
+  {
+    kmyth_log(LOG_ERR, "error setting up auth session ... exiting");
+    return 1;
+  }
+
+  // EvictControl on a transient object makes a persistent copy of it, and
+  // on a persistent object evicts it
+  TSS2_RC rc = Tss2_Sys_EvictControl(sapi_ctx, TPM2_RH_OWNER, object_handle,
+                                     &cmdAuths, persistent_handle,
+                                     &rspAuths);
+
+  kmyth_clear(&cmdAuths, sizeof(cmdAuths));
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_EvictControl(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// evict_persistent_sk()
+//############################################################################
+int evict_persistent_sk(TSS2_SYS_CONTEXT * sapi_ctx,
+                        TPM2B_AUTH owner_auth, TPM2_HANDLE persistent_handle)
+{
+  if (persistent_handle < KMYTH_PERSISTENT_SK_FIRST ||
+      persistent_handle > KMYTH_PERSISTENT_SK_LAST)
+  {
+    kmyth_log(LOG_ERR, "handle (0x%08X) out of persistent SK range ... exiting",
+              persistent_handle);
+    return 1;
+  }
+
+  if (evict_control_sk(sapi_ctx, owner_auth, persistent_handle,
+                       persistent_handle))
+  {
+    kmyth_log(LOG_ERR, "unable to evict persistent SK (handle = 0x%08X)",
+              persistent_handle);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "evicted persistent SK (handle = 0x%08X)",
+            persistent_handle);
+
+  return 0;
+}
+
+//############################################################################
+// make_sk_persistent()
+//############################################################################
+int make_sk_persistent(TSS2_SYS_CONTEXT * sapi_ctx,
+                       TPM2B_AUTH owner_auth,
+                       TPM2_HANDLE sk_handle, TPM2_HANDLE persistent_handle)
+{
+  if (persistent_handle < KMYTH_PERSISTENT_SK_FIRST ||
+      persistent_handle > KMYTH_PERSISTENT_SK_LAST)
+  {
+    kmyth_log(LOG_ERR, "handle (0x%08X) out of persistent SK range ... exiting",
+              persistent_handle);
+    return 1;
+  }
+
+  TPML_HANDLE sk_handles;
+
+  if (list_persistent_sks(sapi_ctx, &sk_handles))
+  {
+    return 1;
+  }
+
+  // a persistent handle cannot be overwritten, so whatever is there must
+  // be evicted first (unless it is the same key)
+  for (uint32_t i = 0; i < sk_handles.count; i++)
+  {
+    if (sk_handles.handle[i] != persistent_handle)
+    {
+      continue;
+    }
+
+    TPM2B_PUBLIC publicOut = {.size = 0, };
+    TPM2B_NAME nameOut = {.size = 0, };
+    TPM2B_NAME qualNameOut = {.size = 0, };
+    TPM2_RC rc = Tss2_Sys_ReadPublic(sapi_ctx, sk_handle, NULL, &publicOut,
+                                     &nameOut, &qualNameOut, NULL);
+    bool isSK = false;
+
+    if (rc != TPM2_RC_SUCCESS ||
+        check_persistent_sk(sapi_ctx, persistent_handle, &publicOut, &isSK))
+    {
+      kmyth_log(LOG_ERR, "unable to read storage key public area ... exiting");
+      return 1;
+    }
+    if (isSK)
+    {
+      kmyth_log(LOG_DEBUG, "SK already persistent (handle = 0x%08X)",
+                persistent_handle);
+      return 0;
+    }
+
+    kmyth_log(LOG_WARNING, "replacing persistent SK (handle = 0x%08X)",
+              persistent_handle);
+    if (evict_persistent_sk(sapi_ctx, owner_auth, persistent_handle))
+    {
+      return 1;
+    }
+    break;
+  }
+
+  if (evict_control_sk(sapi_ctx, owner_auth, sk_handle, persistent_handle))
+  {
+    kmyth_log(LOG_ERR, "unable to make SK persistent (handle = 0x%08X)",
+              persistent_handle);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "made SK persistent (handle = 0x%08X)",
+            persistent_handle);
+
+  return 0;
+}
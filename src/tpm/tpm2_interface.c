@@ -7,18 +7,30 @@
 
 #include "tpm2_interface.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
-#include <openssl/rand.h>
 
+#include <tss2/tss2_mu.h>
 #include <tss2/tss2_rc.h>
 #include <tss2/tss2-tcti-tabrmd.h>
+#include <tss2/tss2_tcti_device.h>
+#include <tss2/tss2_tcti_mssim.h>
+#include <tss2/tss2_tcti_swtpm.h>
 
 #include "defines.h"
+#include "cipher/nonce_drbg.h"
+#include "tpm/kmyth_metrics.h"
 #include "tpm/marshalling_tools.h"
+#include "tpm/pcrs.h"
+
+#include "alloc_stats.h"
 
 /*
  * These are known to be manufacturer strings for software TPM simulators.
@@ -30,10 +42,409 @@ const char *simulator_manufacturers[] = { "IBM",  // https://sourceforge.net/pro
   NULL
 };
 
+// Magic value identifying a TCTI context set up by init_tcti_timing()
+#define KMYTH_TIMING_TCTI_MAGIC 0x6b6d797468544d47ULL
+
+// Magic value identifying a delay TCTI context (see delay_tcti_init())
+#define KMYTH_DELAY_TCTI_MAGIC 0x6b6d797468444c59ULL
+
+// Maximum number of per-command times configured for a delay TCTI
+#define KMYTH_DELAY_TCTI_MAX_DELAYS 32
+
+// Maximum number of idle policy sessions kept open per connection
+#define KMYTH_POLICY_SESSION_POOL_SIZE 2
+
+// Maximum number of saved object contexts cached per connection
+#define KMYTH_OBJECT_CONTEXT_CACHE_SIZE 8
+
+// Saved context of a loaded object, keyed by the hash of its blobs
+typedef struct
+{
+  uint8_t key[KMYTH_DIGEST_SIZE];
+  TPMS_CONTEXT context;
+} OBJECT_CONTEXT_ENTRY;
+
+// TCTI wrapping the resource manager TCTI, that times every command sent
+// over it into the timings attached with set_tpm2_timings(), and holds
+// them to the deadline attached with set_tpm2_deadline(). It also holds
+// the connection's pool of idle policy sessions (see
+// acquire_policy_session()) and its TPM capability snapshot (see
+// get_tpm2_snapshot()) and object context cache (see
+// load_cached_object_context()).
+typedef struct
+{
+  TSS2_TCTI_CONTEXT_COMMON_V2 common;
+  TSS2_TCTI_CONTEXT *inner;
+  kmyth_timings_t *timings;
+  CALL_DEADLINE *deadline;
+  bool in_flight;
+  bool abandoned;
+  uint32_t command_code;
+  uint64_t start_ns;
+  SESSION session_pool[KMYTH_POLICY_SESSION_POOL_SIZE];
+  size_t session_pool_count;
+  CAP_SNAPSHOT snapshot;
+  uint32_t snapshot_valid;
+  bool context_cache_enabled;
+  OBJECT_CONTEXT_ENTRY context_cache[KMYTH_OBJECT_CONTEXT_CACHE_SIZE];
+  size_t context_cache_count;
+  uint32_t context_cache_reset_count;
+  uint32_t context_cache_restart_count;
+} TIMING_TCTI;
+
+//############################################################################
+// record_command_timing()
+//############################################################################
+static void record_command_timing(kmyth_timings_t * timings,
+                                  uint32_t command_code, uint64_t elapsed_ns)
+{
+  size_t i = 0;
+
+  while (i < timings->command_count &&
+         timings->commands[i].command_code != command_code)
+  {
+    i++;
+  }
+  if (i == timings->command_count)
+  {
+    if (i == KMYTH_TIMINGS_MAX_COMMANDS)
+    {
+      timings->dropped_commands++;
+      return;
+    }
+    timings->commands[i].command_code = command_code;
+    timings->commands[i].calls = 0;
+    timings->commands[i].total_ns = 0;
+    timings->commands[i].max_ns = 0;
+    timings->command_count++;
+  }
+
+  timings->commands[i].calls++;
+  timings->commands[i].total_ns += elapsed_ns;
+  if (elapsed_ns > timings->commands[i].max_ns)
+  {
+    timings->commands[i].max_ns = elapsed_ns;
+  }
+}
+
+//############################################################################
+// invalidate_snapshot_for_command()
+//############################################################################
+static void invalidate_snapshot_for_command(TIMING_TCTI * tcti,
+                                            uint32_t command_code,
+                                            size_t size,
+                                            const uint8_t * command)
+{
+  switch (command_code)
+  {
+  case TPM2_CC_StartAuthSession:
+  case TPM2_CC_ContextLoad:
+    tcti->snapshot_valid &= ~KMYTH_SNAPSHOT_SESSIONS;
+    break;
+  case TPM2_CC_FlushContext:
+    // only flushing a session (not a transient object) changes the
+    // session lists - the handle to flush follows the command header
+    if (size < 14 || command[10] == TPM2_HT_HMAC_SESSION ||
+        command[10] == TPM2_HT_POLICY_SESSION)
+    {
+      tcti->snapshot_valid &= ~KMYTH_SNAPSHOT_SESSIONS;
+    }
+    break;
+  case TPM2_CC_EvictControl:
+    tcti->snapshot_valid &= ~KMYTH_SNAPSHOT_PERSISTENT;
+    break;
+  case TPM2_CC_Startup:
+  case TPM2_CC_Clear:
+    tcti->snapshot_valid &=
+      ~(KMYTH_SNAPSHOT_PERSISTENT | KMYTH_SNAPSHOT_SESSIONS);
+    tcti->context_cache_count = 0;
+    break;
+  default:
+    break;
+  }
+}
+
+//############################################################################
+// drain_abandoned_response()
+//############################################################################
+static TSS2_RC drain_abandoned_response(TIMING_TCTI * tcti)
+{
+  // the response may hold secrets (e.g., unsealed data), so is wiped
+  uint8_t response[TPM2_MAX_COMMAND_SIZE];
+  size_t size = sizeof(response);
+  TSS2_RC rc = TSS2_TCTI_RC_TRY_AGAIN;
+
+  while (rc == TSS2_TCTI_RC_TRY_AGAIN)
+  {
+    if (tpm2_deadline_expired(tcti->deadline))
+    {
+      kmyth_log(LOG_ERR, "TPM command not sent, deadline passed or "
+                "cancelled while waiting out an abandoned command");
+      return TSS2_TCTI_RC_NOT_PERMITTED;
+    }
+
+    int32_t slice = TSS2_TCTI_TIMEOUT_BLOCK;
+
+    if (tcti->deadline != NULL && tcti->deadline->deadline_ns != 0)
+    {
+      slice = KMYTH_DEADLINE_POLL_MS;
+    }
+    size = sizeof(response);
+    rc = Tss2_Tcti_Receive(tcti->inner, &size, response, slice);
+  }
+  OPENSSL_cleanse(response, sizeof(response));
+
+  // (a TCTI that did cancel the command has no response left to read)
+  if (rc != TSS2_RC_SUCCESS && rc != TSS2_TCTI_RC_BAD_SEQUENCE)
+  {
+    kmyth_log(LOG_ERR, "unable to read abandoned TPM command 0x%08X's "
+              "response: rc = 0x%08X, %s", tcti->command_code, rc,
+              getErrorString(rc));
+    return rc;
+  }
+  kmyth_log(LOG_DEBUG, "dropped abandoned TPM command 0x%08X's response",
+            tcti->command_code);
+  tcti->abandoned = false;
+
+  return TSS2_RC_SUCCESS;
+}
+
+//############################################################################
+// timing_tcti_transmit()
+//############################################################################
+static TSS2_RC timing_tcti_transmit(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                    size_t size, const uint8_t * command)
+{
+  TIMING_TCTI *tcti = (TIMING_TCTI *) tcti_ctx;
+  uint32_t command_code = 0;
+
+  // nothing more is sent once the deadline has passed
+  if (tpm2_deadline_expired(tcti->deadline))
+  {
+    kmyth_log(LOG_ERR, "TPM command not sent, deadline passed or cancelled");
+    return TSS2_TCTI_RC_NOT_PERMITTED;
+  }
+
+  // the response to a command abandoned at an earlier deadline is still
+  // to come, and must be read (and dropped) first, or it would be taken
+  // for this command's
+  if (tcti->abandoned)
+  {
+    TSS2_RC rc = drain_abandoned_response(tcti);
+
+    if (rc != TSS2_RC_SUCCESS)
+    {
+      return rc;
+    }
+  }
+
+  // the command code follows the tag (2 bytes) and size (4 bytes) of the
+  // (big-endian) command header
+  if (command != NULL && size >= 10)
+  {
+    command_code = ((uint32_t) command[6] << 24) |
+      ((uint32_t) command[7] << 16) |
+      ((uint32_t) command[8] << 8) | (uint32_t) command[9];
+
+    // the command may change the state cached in the snapshot whether or
+    // not it succeeds, so invalidate as it is sent
+    invalidate_snapshot_for_command(tcti, command_code, size, command);
+  }
+
+  tcti->in_flight = (command != NULL && size >= 10);
+  tcti->command_code = command_code;
+  if (tcti->in_flight && tcti->timings != NULL)
+  {
+    tcti->start_ns = get_timing_ns();
+  }
+
+  TSS2_RC rc = Tss2_Tcti_Transmit(tcti->inner, size, command);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    tcti->in_flight = false;
+  }
+
+  return rc;
+}
+
+//############################################################################
+// timing_tcti_receive()
+//############################################################################
+static TSS2_RC timing_tcti_receive(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                   size_t *size, uint8_t * response,
+                                   int32_t timeout)
+{
+  TIMING_TCTI *tcti = (TIMING_TCTI *) tcti_ctx;
+  TSS2_RC rc = TSS2_TCTI_RC_TRY_AGAIN;
+
+  if (tcti->in_flight && tcti->deadline != NULL &&
+      tcti->deadline->deadline_ns != 0)
+  {
+    // Wait for the response in slices, each no longer than the time left
+    // (or the caller's own timeout), checking for cancellation between
+    // them. A command abandoned at the deadline is cancelled, if the TCTI
+    // can, and any response it still gets is dropped before the next
+    // command is sent (see reset_tpm2_connection()).
+    do
+    {
+      uint64_t now_ns = get_timing_ns();
+
+      if (tpm2_deadline_expired(tcti->deadline))
+      {
+        kmyth_log(LOG_ERR, "TPM command 0x%08X abandoned, deadline passed "
+                  "or cancelled", tcti->command_code);
+        Tss2_Tcti_Cancel(tcti->inner);
+        tcti->in_flight = false;
+        tcti->abandoned = true;
+        return TSS2_TCTI_RC_TRY_AGAIN;
+      }
+
+      uint64_t left_ms = (tcti->deadline->deadline_ns - now_ns + 999999) /
+        1000000;
+      int32_t slice = KMYTH_DEADLINE_POLL_MS;
+
+      if (left_ms < (uint64_t) slice)
+      {
+        slice = (int32_t) left_ms;
+      }
+      if (timeout != TSS2_TCTI_TIMEOUT_BLOCK && timeout < slice)
+      {
+        slice = timeout;
+      }
+      rc = Tss2_Tcti_Receive(tcti->inner, size, response, slice);
+    }
+    while (rc == TSS2_TCTI_RC_TRY_AGAIN && timeout == TSS2_TCTI_TIMEOUT_BLOCK);
+  }
+  else
+  {
+    rc = Tss2_Tcti_Receive(tcti->inner, size, response, timeout);
+  }
+
+  // a NULL response only queries the response size, and a timed out
+  // receive will be retried - neither completes the command
+  if (tcti->in_flight && response != NULL && rc != TSS2_TCTI_RC_TRY_AGAIN)
+  {
+    tcti->in_flight = false;
+    if (tcti->timings != NULL)
+    {
+      record_command_timing(tcti->timings, tcti->command_code,
+                            get_timing_ns() - tcti->start_ns);
+    }
+
+    // the response code follows the tag and size of the response header
+    if (rc == TSS2_RC_SUCCESS && size != NULL && *size >= 10)
+    {
+      kmyth_metrics_count_tpm_response(((uint32_t) response[6] << 24) |
+                                       ((uint32_t) response[7] << 16) |
+                                       ((uint32_t) response[8] << 8) |
+                                       (uint32_t) response[9]);
+    }
+  }
+
+  return rc;
+}
+
+//############################################################################
+// timing_tcti_finalize()
+//############################################################################
+static void timing_tcti_finalize(TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  TIMING_TCTI *tcti = (TIMING_TCTI *) tcti_ctx;
+
+  // the wrapping context itself is freed by the caller, as for any TCTI
+  Tss2_Tcti_Finalize(tcti->inner);
+  free(tcti->inner);
+  tcti->inner = NULL;
+}
+
+//############################################################################
+// timing_tcti_cancel()
+//############################################################################
+static TSS2_RC timing_tcti_cancel(TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  TIMING_TCTI *tcti = (TIMING_TCTI *) tcti_ctx;
+
+  tcti->in_flight = false;
+
+  return Tss2_Tcti_Cancel(tcti->inner);
+}
+
+//############################################################################
+// timing_tcti_get_poll_handles()
+//############################################################################
+static TSS2_RC timing_tcti_get_poll_handles(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                            TSS2_TCTI_POLL_HANDLE * handles,
+                                            size_t *num_handles)
+{
+  return Tss2_Tcti_GetPollHandles(((TIMING_TCTI *) tcti_ctx)->inner,
+                                  handles, num_handles);
+}
+
+//############################################################################
+// timing_tcti_set_locality()
+//############################################################################
+static TSS2_RC timing_tcti_set_locality(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                        uint8_t locality)
+{
+  return Tss2_Tcti_SetLocality(((TIMING_TCTI *) tcti_ctx)->inner, locality);
+}
+
+//############################################################################
+// timing_tcti_make_sticky()
+//############################################################################
+static TSS2_RC timing_tcti_make_sticky(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                       TPM2_HANDLE * handle, uint8_t sticky)
+{
+  return Tss2_Tcti_MakeSticky(((TIMING_TCTI *) tcti_ctx)->inner, handle,
+                              sticky);
+}
+
+//############################################################################
+// init_tcti_timing()
+//############################################################################
+static int init_tcti_timing(TSS2_TCTI_CONTEXT ** tcti_ctx)
+{
+  TIMING_TCTI *tcti = calloc(1, sizeof(TIMING_TCTI));
+
+  if (tcti == NULL)
+  {
+    kmyth_log(LOG_ERR, "calloc for timing TCTI context failed ... exiting");
+    return 1;
+  }
+
+  tcti->common.v1.magic = KMYTH_TIMING_TCTI_MAGIC;
+  tcti->common.v1.version = 2;
+  tcti->common.v1.transmit = timing_tcti_transmit;
+  tcti->common.v1.receive = timing_tcti_receive;
+  tcti->common.v1.finalize = timing_tcti_finalize;
+  tcti->common.v1.cancel = timing_tcti_cancel;
+  tcti->common.v1.getPollHandles = timing_tcti_get_poll_handles;
+  tcti->common.v1.setLocality = timing_tcti_set_locality;
+  tcti->common.makeSticky = timing_tcti_make_sticky;
+  tcti->inner = *tcti_ctx;
+  tcti->timings = NULL;
+  tcti->deadline = NULL;
+  tcti->abandoned = false;
+
+  *tcti_ctx = (TSS2_TCTI_CONTEXT *) tcti;
+
+  return 0;
+}
+
 //############################################################################
 // init_tpm2_connection()
 //############################################################################
 int init_tpm2_connection(TSS2_SYS_CONTEXT ** sapi_ctx)
+{
+  return init_tpm2_connection_tcti(sapi_ctx, NULL);
+}
+
+//############################################################################
+// init_tpm2_connection_tcti()
+//############################################################################
+int init_tpm2_connection_tcti(TSS2_SYS_CONTEXT ** sapi_ctx,
+                              const char *tcti_conf)
 {
   // Verify that SAPI context is uninitialized (NULL) -
   // TCTI context must be initialized first 
@@ -43,15 +454,25 @@ int init_tpm2_connection(TSS2_SYS_CONTEXT ** sapi_ctx)
     return 1;
   }
 
-  // Step 1: Initialize TCTI context for connection to resource manager
+  // Step 1: Initialize TCTI context for connection to the configured
+  //         backend (by default, the resource manager)
   TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
 
-  if (init_tcti_abrmd(&tcti_ctx))
+  if (init_tcti(&tcti_ctx, tcti_conf))
   {
     kmyth_log(LOG_ERR, "unable to initialize TCTI context ... exiting");
     return 1;
   }
 
+  // The backend TCTI is wrapped so that the commands sent over
+  // the connection can be timed (see set_tpm2_timings())
+  if (init_tcti_timing(&tcti_ctx))
+  {
+    Tss2_Tcti_Finalize(tcti_ctx);
+    free(tcti_ctx);
+    return 1;
+  }
+
   // Step 2: Initialize SAPI context with TCTI context
   if (init_sapi(sapi_ctx, tcti_ctx))
   {
@@ -106,166 +527,562 @@ int init_tpm2_connection(TSS2_SYS_CONTEXT ** sapi_ctx)
   return 0;
 }
 
+// Names of the commands kmyth issues, as used in the timings report and in
+// the delay TCTI's configuration
+static const struct
+{
+  uint32_t command_code;
+  const char *name;
+} tpm2_command_names[] = {
+  {TPM2_CC_ContextLoad, "ContextLoad"},
+  {TPM2_CC_ContextSave, "ContextSave"},
+  {TPM2_CC_Create, "Create"},
+  {TPM2_CC_CreatePrimary, "CreatePrimary"},
+  {TPM2_CC_EvictControl, "EvictControl"},
+  {TPM2_CC_FlushContext, "FlushContext"},
+  {TPM2_CC_GetCapability, "GetCapability"},
+  {TPM2_CC_Load, "Load"},
+  {TPM2_CC_PCR_Read, "PCR_Read"},
+  {TPM2_CC_PolicyAuthValue, "PolicyAuthValue"},
+  {TPM2_CC_PolicyGetDigest, "PolicyGetDigest"},
+  {TPM2_CC_PolicyOR, "PolicyOR"},
+  {TPM2_CC_PolicyPCR, "PolicyPCR"},
+  {TPM2_CC_PolicyRestart, "PolicyRestart"},
+  {TPM2_CC_ReadClock, "ReadClock"},
+  {TPM2_CC_ReadPublic, "ReadPublic"},
+  {TPM2_CC_StartAuthSession, "StartAuthSession"},
+  {TPM2_CC_Startup, "Startup"},
+  {TPM2_CC_Unseal, "Unseal"},
+};
+
 //############################################################################
-// init_tcti_abrmd()
+// get_tpm2_command_name()
 //############################################################################
-int init_tcti_abrmd(TSS2_TCTI_CONTEXT ** tcti_ctx)
+const char *get_tpm2_command_name(uint32_t command_code)
 {
-  // TCTI context must be passed in uninitialized (NULL)
-  if (*tcti_ctx != NULL)
-  {
-    kmyth_log(LOG_ERR, "TCTI context passed in not NULL ... exiting");
-    return 1;
-  }
-
-  // We are using the default TCTI bus. Initial Tss2_Tcti_Tabrmd_Init() call
-  // returns memory space needed for TCTI context.
-  size_t size;
-  TSS2_RC rc;
-
-  rc = Tss2_Tcti_Tabrmd_Init(NULL, &size, NULL);
-  if (rc != TSS2_RC_SUCCESS)
-  {
-    kmyth_log(LOG_ERR, "Tss2_Tcti_Tabrmd_Init(): rc = 0x%08X, %s", rc,
-              getErrorString(rc));
-    return 1;
-  }
-
-  // Now that we know how much space we need, allocate memory for TCTI context
-  *tcti_ctx = (TSS2_TCTI_CONTEXT *) calloc(1, size);
-  if (*tcti_ctx == NULL)
-  {
-    kmyth_log(LOG_ERR, "calloc for res mgr TCTI context failed ... exiting");
-    return 1;
-  }
-
-  // Second Tss2_Tcti_Tabrmd_Init() call actually initializes the TCTI context
-  rc = Tss2_Tcti_Tabrmd_Init(*tcti_ctx, &size, NULL);
-  if (rc != TSS2_RC_SUCCESS)
+  for (size_t i = 0;
+       i < sizeof(tpm2_command_names) / sizeof(tpm2_command_names[0]); i++)
   {
-    kmyth_log(LOG_ERR, "Tss2_Tcti_Tabrmd_Init(): rc = 0x%08X, %s", rc,
-              getErrorString(rc));
-    free(*tcti_ctx);
-    return 1;
+    if (tpm2_command_names[i].command_code == command_code)
+    {
+      return tpm2_command_names[i].name;
+    }
   }
 
-  return 0;
+  return "unknown";
 }
 
 //############################################################################
-// init_sapi()
+// get_tpm2_command_code()
 //############################################################################
-int init_sapi(TSS2_SYS_CONTEXT ** sapi_ctx, TSS2_TCTI_CONTEXT * tcti_ctx)
+int get_tpm2_command_code(const char *name, size_t name_len,
+                          uint32_t * command_code)
 {
-  // SAPI context passed in to be initialized must be empty (NULL)
-  if (*sapi_ctx != NULL)
+  for (size_t i = 0;
+       i < sizeof(tpm2_command_names) / sizeof(tpm2_command_names[0]); i++)
   {
-    kmyth_log(LOG_ERR, "pointer to input SAPI context not NULL ... exiting");
-    return 1;
-  }
-
-  // TCTI context should have already been initialized - must not be NULL
-  if (tcti_ctx == NULL)
-  {
-    kmyth_log(LOG_ERR, "TCTI context is a NULL pointer ... exiting");
-    return 1;
+    if (strlen(tpm2_command_names[i].name) == name_len &&
+        strncmp(tpm2_command_names[i].name, name, name_len) == 0)
+    {
+      *command_code = tpm2_command_names[i].command_code;
+      return 0;
+    }
   }
 
-  // Specify current Application Binary Interface (ABI) version
-  TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
-
-  kmyth_log(LOG_DEBUG, "ABI version is %d.%d.%d.%d",
-            abi_version.tssCreator, abi_version.tssFamily, abi_version.tssLevel,
-            abi_version.tssVersion);
-
-  // Get the maximum size needed for SAPI context and then allocate space for
-  // it using the returned value. Passing in zero to Tss2_Sys_GetContextSize()
-  // returns a size guaranteed to handle any TPM command and response.
-  // (recommended to avoid TSS2_SYS_RC_INSUFFICIENT_CONTEXT errors)
-  size_t size = Tss2_Sys_GetContextSize(0);
+  // otherwise, a numeric command code (e.g., 0x157)
+  char code[16];
+  char *end = NULL;
 
-  if (size == 0)
+  if (name_len == 0 || name_len >= sizeof(code))
   {
-    kmyth_log(LOG_ERR, "maximum size for SAPI context is zero ... exiting");
-    return 1;
-  }
-  *sapi_ctx = (TSS2_SYS_CONTEXT *) calloc(1, size);
-  if (*sapi_ctx == NULL)
-  {
-    kmyth_log(LOG_ERR, "memory allocation for SAPI context failed ... exiting");
     return 1;
   }
+  memcpy(code, name, name_len);
+  code[name_len] = '\0';
 
-  // Now that space is allocated for the SAPI context,
-  // use Tss2_Sys_Initialize() to initialize it.
-  TSS2_RC rc = Tss2_Sys_Initialize(*sapi_ctx, size, tcti_ctx, &abi_version);
+  unsigned long value = strtoul(code, &end, 0);
 
-  if (rc != TSS2_RC_SUCCESS)
+  if (*end != '\0' || value > UINT32_MAX)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_Initialize(): rc = 0x%08X, %s", rc,
-              getErrorString(rc));
-    free(sapi_ctx);
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "initialized SAPI context");
+  *command_code = (uint32_t) value;
 
   return 0;
 }
 
+// TCTI wrapping another TCTI (normally the simulator's), that makes each
+// command take (at least) a configured time, to model a faster or slower
+// TPM (see init_tcti() for its configuration)
+typedef struct
+{
+  TSS2_TCTI_CONTEXT_COMMON_V2 common;
+  TSS2_TCTI_CONTEXT *inner;
+  uint64_t default_ns;
+  size_t delay_count;
+  struct
+  {
+    uint32_t command_code;
+    uint64_t ns;
+  } delays[KMYTH_DELAY_TCTI_MAX_DELAYS];
+  bool in_flight;
+  uint64_t command_ns;
+  uint64_t start_ns;
+} DELAY_TCTI;
+
 //############################################################################
-// free_tpm2_resources()
+// parse_delay_conf()
 //############################################################################
-int free_tpm2_resources(TSS2_SYS_CONTEXT ** sapi_ctx)
+static int parse_delay_conf(const char *conf, DELAY_TCTI * tcti,
+                            const char **inner_conf)
 {
-  // If the input context is null there's nothing to do.
-  if ((sapi_ctx == NULL) || (*sapi_ctx == NULL))
+  // <command>=<ms>[,<command>=<ms>...][@<inner TCTI configuration>], where
+  // the command '*' sets the time of every command not listed
+  const char *at = (conf == NULL) ? NULL : strchr(conf, '@');
+  const char *p = conf;
+  const char *spec_end = (at != NULL) ? at : (conf == NULL) ? NULL :
+    conf + strlen(conf);
+
+  *inner_conf = (at != NULL && at[1] != '\0') ? at + 1 : KMYTH_TCTI_DEFAULT;
+  while (p != NULL && p < spec_end)
   {
-    return 0;
-  }
+    const char *eq = memchr(p, '=', (size_t) (spec_end - p));
+    const char *next = memchr(p, ',', (size_t) (spec_end - p));
 
-  int retval = 0;
+    if (next == NULL)
+    {
+      next = spec_end;
+    }
+    if (eq == NULL || eq > next)
+    {
+      return 1;
+    }
 
-  // flush any remaining loaded or active session handle values
-  TPMS_CAPABILITY_DATA hSession;
+    char value[32];
+    char *end = NULL;
+    size_t value_len = (size_t) (next - eq - 1);
 
-  if (get_tpm2_properties(*sapi_ctx,
-                          TPM2_CAP_HANDLES,
-                          TPM2_HR_HMAC_SESSION,
-                          TPM2_PT_ACTIVE_SESSIONS_MAX, &hSession))
-  {
-    kmyth_log(LOG_ERR, "unable to get TPM2_HR_HMAC_SESSION property from TPM");
-    kmyth_log(LOG_ERR, "unable to flush active HMAC sessions");
-    retval = 1;
+    if (value_len == 0 || value_len >= sizeof(value))
+    {
+      return 1;
+    }
+    memcpy(value, eq + 1, value_len);
+    value[value_len] = '\0';
+
+    double ms = strtod(value, &end);
+
+    if (*end != '\0' || !(ms >= 0) || ms > 1e6)
+    {
+      return 1;
+    }
+
+    uint64_t ns = (uint64_t) (ms * 1e6);
+    uint32_t command_code = 0;
+
+    if (eq - p == 1 && *p == '*')
+    {
+      if (tcti != NULL)
+      {
+        tcti->default_ns = ns;
+      }
+    }
+    else if (get_tpm2_command_code(p, (size_t) (eq - p), &command_code))
+    {
+      return 1;
+    }
+    else if (tcti != NULL)
+    {
+      if (tcti->delay_count == KMYTH_DELAY_TCTI_MAX_DELAYS)
+      {
+        return 1;
+      }
+      tcti->delays[tcti->delay_count].command_code = command_code;
+      tcti->delays[tcti->delay_count].ns = ns;
+      tcti->delay_count++;
+    }
+    p = next + 1;
   }
-  else
+
+  return 0;
+}
+
+//############################################################################
+// delay_tcti_transmit()
+//############################################################################
+static TSS2_RC delay_tcti_transmit(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                   size_t size, const uint8_t * command)
+{
+  DELAY_TCTI *tcti = (DELAY_TCTI *) tcti_ctx;
+
+  tcti->in_flight = (command != NULL && size >= 10);
+  if (tcti->in_flight)
   {
-    for (int i = 0; i < hSession.data.handles.count; i++)
+    uint32_t command_code = ((uint32_t) command[6] << 24) |
+      ((uint32_t) command[7] << 16) |
+      ((uint32_t) command[8] << 8) | (uint32_t) command[9];
+
+    tcti->command_ns = tcti->default_ns;
+    for (size_t i = 0; i < tcti->delay_count; i++)
     {
-      Tss2_Sys_FlushContext(*sapi_ctx, hSession.data.handles.handle[i]);
-      kmyth_log(LOG_DEBUG, "flushed HMAC handle 0x%08X",
-                hSession.data.handles.handle[i]);
+      if (tcti->delays[i].command_code == command_code)
+      {
+        tcti->command_ns = tcti->delays[i].ns;
+        break;
+      }
     }
+    tcti->start_ns = get_timing_ns();
   }
 
-  TPMS_CAPABILITY_DATA pSession;
+  TSS2_RC rc = Tss2_Tcti_Transmit(tcti->inner, size, command);
 
-  if (get_tpm2_properties(*sapi_ctx,
-                          TPM2_CAP_HANDLES,
-                          TPM2_HR_POLICY_SESSION,
-                          TPM2_PT_ACTIVE_SESSIONS_MAX, &pSession))
+  if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR,
-              "unable to get TPM2_HR_POLICY_SESSION property from TPM");
-    kmyth_log(LOG_ERR, "unable to flush active policy sessions");
+    tcti->in_flight = false;
+  }
+
+  return rc;
+}
+
+//############################################################################
+// delay_tcti_receive()
+//############################################################################
+static TSS2_RC delay_tcti_receive(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                  size_t *size, uint8_t * response,
+                                  int32_t timeout)
+{
+  DELAY_TCTI *tcti = (DELAY_TCTI *) tcti_ctx;
+  TSS2_RC rc = Tss2_Tcti_Receive(tcti->inner, size, response, timeout);
+
+  // the response is held back until the command has taken its configured
+  // time (a command that took longer is not delayed further)
+  if (tcti->in_flight && response != NULL && rc != TSS2_TCTI_RC_TRY_AGAIN)
+  {
+    tcti->in_flight = false;
+
+    uint64_t elapsed_ns = get_timing_ns() - tcti->start_ns;
+
+    if (elapsed_ns < tcti->command_ns)
+    {
+      uint64_t wait_ns = tcti->command_ns - elapsed_ns;
+      struct timespec ts = {
+        .tv_sec = (time_t) (wait_ns / 1000000000ULL),
+        .tv_nsec = (long) (wait_ns % 1000000000ULL),
+      };
+
+      while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+      {
+      }
+    }
+  }
+
+  return rc;
+}
+
+//############################################################################
+// delay_tcti_finalize()
+//############################################################################
+static void delay_tcti_finalize(TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  DELAY_TCTI *tcti = (DELAY_TCTI *) tcti_ctx;
+
+  Tss2_Tcti_Finalize(tcti->inner);
+  free(tcti->inner);
+  tcti->inner = NULL;
+}
+
+//############################################################################
+// delay_tcti_cancel()
+//############################################################################
+static TSS2_RC delay_tcti_cancel(TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  DELAY_TCTI *tcti = (DELAY_TCTI *) tcti_ctx;
+
+  tcti->in_flight = false;
+
+  return Tss2_Tcti_Cancel(tcti->inner);
+}
+
+//############################################################################
+// delay_tcti_get_poll_handles()
+//############################################################################
+static TSS2_RC delay_tcti_get_poll_handles(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                           TSS2_TCTI_POLL_HANDLE * handles,
+                                           size_t *num_handles)
+{
+  return Tss2_Tcti_GetPollHandles(((DELAY_TCTI *) tcti_ctx)->inner,
+                                  handles, num_handles);
+}
+
+//############################################################################
+// delay_tcti_set_locality()
+//############################################################################
+static TSS2_RC delay_tcti_set_locality(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                       uint8_t locality)
+{
+  return Tss2_Tcti_SetLocality(((DELAY_TCTI *) tcti_ctx)->inner, locality);
+}
+
+//############################################################################
+// delay_tcti_make_sticky()
+//############################################################################
+static TSS2_RC delay_tcti_make_sticky(TSS2_TCTI_CONTEXT * tcti_ctx,
+                                      TPM2_HANDLE * handle, uint8_t sticky)
+{
+  return Tss2_Tcti_MakeSticky(((DELAY_TCTI *) tcti_ctx)->inner, handle,
+                              sticky);
+}
+
+//############################################################################
+// delay_tcti_init()
+//############################################################################
+static TSS2_RC delay_tcti_init(TSS2_TCTI_CONTEXT * tcti_ctx, size_t *size,
+                               const char *conf)
+{
+  const char *inner_conf = NULL;
+
+  // (called first for the context size, then to initialize the context,
+  // as for the TSS's own TCTIs)
+  if (tcti_ctx == NULL)
+  {
+    if (size == NULL || parse_delay_conf(conf, NULL, &inner_conf))
+    {
+      return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    *size = sizeof(DELAY_TCTI);
+    return TSS2_RC_SUCCESS;
+  }
+
+  DELAY_TCTI *tcti = (DELAY_TCTI *) tcti_ctx;
+
+  memset(tcti, 0, sizeof(DELAY_TCTI));
+  if (parse_delay_conf(conf, tcti, &inner_conf))
+  {
+    return TSS2_TCTI_RC_BAD_VALUE;
+  }
+  if (init_tcti(&tcti->inner, inner_conf))
+  {
+    return TSS2_TCTI_RC_IO_ERROR;
+  }
+
+  tcti->common.v1.magic = KMYTH_DELAY_TCTI_MAGIC;
+  tcti->common.v1.version = 2;
+  tcti->common.v1.transmit = delay_tcti_transmit;
+  tcti->common.v1.receive = delay_tcti_receive;
+  tcti->common.v1.finalize = delay_tcti_finalize;
+  tcti->common.v1.cancel = delay_tcti_cancel;
+  tcti->common.v1.getPollHandles = delay_tcti_get_poll_handles;
+  tcti->common.v1.setLocality = delay_tcti_set_locality;
+  tcti->common.makeSticky = delay_tcti_make_sticky;
+
+  return TSS2_RC_SUCCESS;
+}
+
+// TCTI backends selectable with init_tcti(), with the backend configuration
+// used if none is given (NULL leaves the choice to the backend)
+static const struct
+{
+  const char *name;
+  TSS2_TCTI_INIT_FUNC init;
+  const char *default_conf;
+} tcti_backends[] = {
+  {"tabrmd", Tss2_Tcti_Tabrmd_Init, NULL},
+  {"device", Tss2_Tcti_Device_Init, "/dev/tpmrm0"},
+  {"mssim", Tss2_Tcti_Mssim_Init, NULL},
+  {"swtpm", Tss2_Tcti_Swtpm_Init, NULL},
+  {"delay", delay_tcti_init, NULL},
+};
+
+//############################################################################
+// init_tcti_backend()
+//############################################################################
+static int init_tcti_backend(TSS2_TCTI_CONTEXT ** tcti_ctx,
+                             const char *name, TSS2_TCTI_INIT_FUNC init,
+                             const char *conf)
+{
+  // TCTI context must be passed in uninitialized (NULL)
+  if (*tcti_ctx != NULL)
+  {
+    kmyth_log(LOG_ERR, "TCTI context passed in not NULL ... exiting");
+    return 1;
+  }
+
+  // Initial init call returns memory space needed for TCTI context.
+  size_t size;
+  TSS2_RC rc;
+
+  rc = init(NULL, &size, conf);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "%s TCTI init: rc = 0x%08X, %s", name, rc,
+              getErrorString(rc));
+    return 1;
+  }
+
+  // Now that we know how much space we need, allocate memory for TCTI context
+  *tcti_ctx = (TSS2_TCTI_CONTEXT *) calloc(1, size);
+  if (*tcti_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "calloc for %s TCTI context failed ... exiting", name);
+    return 1;
+  }
+
+  // Second init call actually initializes the TCTI context
+  rc = init(*tcti_ctx, &size, conf);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "%s TCTI init (conf = %s): rc = 0x%08X, %s", name,
+              (conf == NULL) ? "default" : conf, rc, getErrorString(rc));
+    free(*tcti_ctx);
+    *tcti_ctx = NULL;
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "initialized %s TCTI (conf = %s)", name,
+            (conf == NULL) ? "default" : conf);
+
+  return 0;
+}
+
+//############################################################################
+// init_tcti()
+//############################################################################
+int init_tcti(TSS2_TCTI_CONTEXT ** tcti_ctx, const char *tcti_conf)
+{
+  if (tcti_conf == NULL)
+  {
+    tcti_conf = getenv(KMYTH_TCTI_ENV);
+  }
+  if (tcti_conf == NULL || tcti_conf[0] == '\0')
+  {
+    tcti_conf = KMYTH_TCTI_DEFAULT;
+  }
+
+  // split the configuration string into <backend>[:<backend config>]
+  const char *sep = strchr(tcti_conf, ':');
+  size_t name_len = (sep == NULL) ? strlen(tcti_conf) :
+    (size_t) (sep - tcti_conf);
+
+  for (size_t i = 0; i < sizeof(tcti_backends) / sizeof(tcti_backends[0]);
+       i++)
+  {
+    if (strlen(tcti_backends[i].name) == name_len &&
+        strncmp(tcti_backends[i].name, tcti_conf, name_len) == 0)
+    {
+      const char *conf = (sep == NULL || sep[1] == '\0') ?
+        tcti_backends[i].default_conf : sep + 1;
+
+      return init_tcti_backend(tcti_ctx, tcti_backends[i].name,
+                               tcti_backends[i].init, conf);
+    }
+  }
+
+  kmyth_log(LOG_ERR, "unsupported TCTI (%s) ... exiting", tcti_conf);
+  return 1;
+}
+
+//############################################################################
+// init_tcti_abrmd()
+//############################################################################
+int init_tcti_abrmd(TSS2_TCTI_CONTEXT ** tcti_ctx)
+{
+  // We are using the default TCTI bus.
+  return init_tcti_backend(tcti_ctx, "tabrmd", Tss2_Tcti_Tabrmd_Init, NULL);
+}
+
+//############################################################################
+// init_sapi()
+//############################################################################
+int init_sapi(TSS2_SYS_CONTEXT ** sapi_ctx, TSS2_TCTI_CONTEXT * tcti_ctx)
+{
+  // SAPI context passed in to be initialized must be empty (NULL)
+  if (*sapi_ctx != NULL)
+  {
+    kmyth_log(LOG_ERR, "pointer to input SAPI context not NULL ... exiting");
+    return 1;
+  }
+
+  // TCTI context should have already been initialized - must not be NULL
+  if (tcti_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "TCTI context is a NULL pointer ... exiting");
+    return 1;
+  }
+
+  // Specify current Application Binary Interface (ABI) version
+  TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+
+  kmyth_log(LOG_DEBUG, "ABI version is %d.%d.%d.%d",
+            abi_version.tssCreator, abi_version.tssFamily, abi_version.tssLevel,
+            abi_version.tssVersion);
+
+  // Get the maximum size needed for SAPI context and then allocate space for
+  // it using the returned value. Passing in zero to Tss2_Sys_GetContextSize()
+  // returns a size guaranteed to handle any TPM command and response.
+  // (recommended to avoid TSS2_SYS_RC_INSUFFICIENT_CONTEXT errors)
+  size_t size = Tss2_Sys_GetContextSize(0);
+
+  if (size == 0)
+  {
+    kmyth_log(LOG_ERR, "maximum size for SAPI context is zero ... exiting");
+    return 1;
+  }
+  *sapi_ctx = (TSS2_SYS_CONTEXT *) calloc(1, size);
+  if (*sapi_ctx == NULL)
+  {
+    kmyth_log(LOG_ERR, "memory allocation for SAPI context failed ... exiting");
+    return 1;
+  }
+
+  // Now that space is allocated for the SAPI context,
+  // use Tss2_Sys_Initialize() to initialize it.
+  TSS2_RC rc = Tss2_Sys_Initialize(*sapi_ctx, size, tcti_ctx, &abi_version);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_Initialize(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    free(sapi_ctx);
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "initialized SAPI context");
+
+  return 0;
+}
+
+//############################################################################
+// free_tpm2_resources()
+//############################################################################
+int free_tpm2_resources(TSS2_SYS_CONTEXT ** sapi_ctx)
+{
+  // If the input context is null there's nothing to do.
+  if ((sapi_ctx == NULL) || (*sapi_ctx == NULL))
+  {
+    return 0;
+  }
+
+  int retval = 0;
+
+  // flush any remaining loaded or active session handle values
+  CAP_SNAPSHOT snapshot;
+
+  if (get_tpm2_snapshot(*sapi_ctx, KMYTH_SNAPSHOT_SESSIONS, &snapshot))
+  {
+    kmyth_log(LOG_ERR, "unable to get loaded sessions from TPM");
+    kmyth_log(LOG_ERR, "unable to flush active HMAC and policy sessions");
     retval = 1;
   }
   else
   {
-    for (int i = 0; i < pSession.data.handles.count; i++)
+    for (int i = 0; i < snapshot.hmac_sessions.count; i++)
+    {
+      Tss2_Sys_FlushContext(*sapi_ctx, snapshot.hmac_sessions.handle[i]);
+      kmyth_log(LOG_DEBUG, "flushed HMAC handle 0x%08X",
+                snapshot.hmac_sessions.handle[i]);
+    }
+    for (int i = 0; i < snapshot.policy_sessions.count; i++)
     {
-      Tss2_Sys_FlushContext(*sapi_ctx, pSession.data.handles.handle[i]);
+      Tss2_Sys_FlushContext(*sapi_ctx, snapshot.policy_sessions.handle[i]);
       kmyth_log(LOG_DEBUG, "flushed policy handle 0x%08X",
-                pSession.data.handles.handle[i]);
+                snapshot.policy_sessions.handle[i]);
     }
   }
 
@@ -362,10 +1179,15 @@ int get_tpm2_properties(TSS2_SYS_CONTEXT * sapi_ctx,
    *   - rspAuthsArray - default is NULL byte
    */
   TPMI_YES_NO moreDataAvailable = 1;
+  unsigned int attempt = 0;
 
-  rc =
-    Tss2_Sys_GetCapability(sapi_ctx, 0, capability, property, propertyCount,
-                           &moreDataAvailable, capabilityData, 0);
+  do
+  {
+    rc = Tss2_Sys_GetCapability(sapi_ctx, 0, capability, property,
+                                propertyCount, &moreDataAvailable,
+                                capabilityData, 0);
+  }
+  while (retry_tpm2_command(sapi_ctx, rc, &attempt));
   if (rc != TSS2_RC_SUCCESS)
   {
     kmyth_log(LOG_ERR, "Tss2_Get_Capability(): rc = 0x%08X, %s",
@@ -388,11 +1210,9 @@ int get_tpm2_properties(TSS2_SYS_CONTEXT * sapi_ctx,
 //############################################################################
 int get_tpm2_impl_type(TSS2_SYS_CONTEXT * sapi_ctx, bool *isEmulator)
 {
-  TPMS_CAPABILITY_DATA capData;
+  CAP_SNAPSHOT snapshot;
 
-  if (get_tpm2_properties(sapi_ctx,
-                          TPM2_CAP_TPM_PROPERTIES,
-                          TPM2_PT_MANUFACTURER, TPM2_PT_GROUP, &capData))
+  if (get_tpm2_snapshot(sapi_ctx, KMYTH_SNAPSHOT_PROPERTIES, &snapshot))
   {
     kmyth_log(LOG_ERR, "unable to get TPM2_PT_MANUFACTURER "
               "property from TPM ... exiting");
@@ -402,8 +1222,7 @@ int get_tpm2_impl_type(TSS2_SYS_CONTEXT * sapi_ctx, bool *isEmulator)
   // obtain string representation of TPM2_PT_MANUFACTURER property
   char *manufacturer_str;
 
-  if (unpack_uint32_to_str(capData.data.tpmProperties.tpmProperty[0].value,
-                           &manufacturer_str))
+  if (unpack_uint32_to_str(snapshot.manufacturer, &manufacturer_str))
   {
     kmyth_log(LOG_ERR, "unable to get vendor string ... exiting");
     return 1;
@@ -685,13 +1504,212 @@ int create_authVal(uint8_t * auth_bytes,
   return 0;
 }
 
+// The digest and HMAC contexts a thread reuses to authorize TPM commands,
+// freed when the thread exits. md_init is initialized for
+// KMYTH_OPENSSL_HASH once and then only cloned (into md), and hmac stays
+// keyed with hmac_key until a command is authorized with a different key.
+typedef struct
+{
+  EVP_MD_CTX *md_init;
+  EVP_MD_CTX *md;
+  HMAC_CTX *hmac;
+  uint8_t hmac_key[2 * sizeof(TPMU_HA)];
+  size_t hmac_key_len;
+  bool hmac_keyed;
+} AUTH_CTX_CACHE;
+
+static pthread_key_t auth_cache_key;
+static bool auth_cache_key_created = false;
+static pthread_once_t auth_cache_key_once = PTHREAD_ONCE_INIT;
+
 //############################################################################
-// compute_cpHash
+// free_auth_ctx_cache()
 //############################################################################
-int compute_cpHash(TPM2_CC cmdCode,
-                   TPM2B_NAME authEntityName,
-                   uint8_t * cmdParams,
-                   size_t cmdParams_size, TPM2B_DIGEST * cpHash_out)
+static void free_auth_ctx_cache(void *arg)
+{
+  AUTH_CTX_CACHE *cache = (AUTH_CTX_CACHE *) arg;
+
+  EVP_MD_CTX_free(cache->md_init);
+  EVP_MD_CTX_free(cache->md);
+  HMAC_CTX_free(cache->hmac);
+  OPENSSL_cleanse(cache->hmac_key, sizeof(cache->hmac_key));
+  free(cache);
+}
+
+//############################################################################
+// create_auth_cache_key()
+//############################################################################
+static void create_auth_cache_key(void)
+{
+  auth_cache_key_created =
+    (pthread_key_create(&auth_cache_key, free_auth_ctx_cache) == 0);
+}
+
+//############################################################################
+// get_auth_ctx_cache()
+//############################################################################
+static AUTH_CTX_CACHE *get_auth_ctx_cache(void)
+{
+  pthread_once(&auth_cache_key_once, create_auth_cache_key);
+  if (!auth_cache_key_created)
+  {
+    return NULL;
+  }
+
+  AUTH_CTX_CACHE *cache = pthread_getspecific(auth_cache_key);
+
+  if (cache == NULL)
+  {
+    cache = calloc(1, sizeof(AUTH_CTX_CACHE));
+    if (cache != NULL && pthread_setspecific(auth_cache_key, cache) != 0)
+    {
+      free(cache);
+      cache = NULL;
+    }
+  }
+
+  return cache;
+}
+
+//############################################################################
+// acquire_auth_digest()
+//############################################################################
+static EVP_MD_CTX *acquire_auth_digest(void)
+{
+  AUTH_CTX_CACHE *cache = get_auth_ctx_cache();
+
+  if (cache != NULL && cache->md_init == NULL)
+  {
+    cache->md_init = EVP_MD_CTX_new();
+    cache->md = EVP_MD_CTX_new();
+    if (cache->md_init == NULL || cache->md == NULL ||
+        !EVP_DigestInit_ex(cache->md_init, KMYTH_OPENSSL_HASH, NULL))
+    {
+      EVP_MD_CTX_free(cache->md_init);
+      EVP_MD_CTX_free(cache->md);
+      cache->md_init = NULL;
+      cache->md = NULL;
+    }
+  }
+
+  // cloning the initialized context skips looking up the digest again
+  if (cache != NULL && cache->md_init != NULL &&
+      EVP_MD_CTX_copy_ex(cache->md, cache->md_init))
+  {
+    return cache->md;
+  }
+
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+
+  if (md_ctx != NULL && !EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL))
+  {
+    EVP_MD_CTX_free(md_ctx);
+    md_ctx = NULL;
+  }
+
+  return md_ctx;
+}
+
+//############################################################################
+// release_auth_digest()
+//############################################################################
+static void release_auth_digest(EVP_MD_CTX * md_ctx)
+{
+  AUTH_CTX_CACHE *cache = get_auth_ctx_cache();
+
+  if (cache == NULL || md_ctx != cache->md)
+  {
+    EVP_MD_CTX_free(md_ctx);
+  }
+}
+
+//############################################################################
+// acquire_auth_hmac()
+//############################################################################
+static HMAC_CTX *acquire_auth_hmac(SESSION * auth_session,
+                                   TPM2B_AUTH * auth_authValue)
+{
+  // the HMAC key is sessionKey || authValue (sessionKey is empty for the
+  // unbound, unsalted sessions kmyth starts)
+  uint8_t key[2 * sizeof(TPMU_HA)];
+  size_t key_len = 0;
+
+  if (auth_session->sessionKey.size > sizeof(TPMU_HA)
+      || auth_authValue->size > sizeof(TPMU_HA))
+  {
+    return NULL;
+  }
+  memcpy(key, auth_session->sessionKey.buffer, auth_session->sessionKey.size);
+  key_len += auth_session->sessionKey.size;
+  memcpy(key + key_len, auth_authValue->buffer, auth_authValue->size);
+  key_len += auth_authValue->size;
+
+  AUTH_CTX_CACHE *cache = get_auth_ctx_cache();
+  HMAC_CTX *hmac_ctx = NULL;
+
+  if (cache != NULL)
+  {
+    if (cache->hmac == NULL)
+    {
+      cache->hmac = HMAC_CTX_new();
+    }
+    hmac_ctx = cache->hmac;
+
+    // a context still keyed with this key only needs resetting
+    if (hmac_ctx != NULL && cache->hmac_keyed && cache->hmac_key_len == key_len
+        && memcmp(cache->hmac_key, key, key_len) == 0
+        && HMAC_Init_ex(hmac_ctx, NULL, 0, NULL, NULL))
+    {
+      OPENSSL_cleanse(key, sizeof(key));
+      return hmac_ctx;
+    }
+    cache->hmac_keyed = false;
+  }
+
+  if (hmac_ctx == NULL)
+  {
+    hmac_ctx = HMAC_CTX_new();
+  }
+  if (hmac_ctx != NULL
+      && !HMAC_Init_ex(hmac_ctx, key, (int) key_len, KMYTH_OPENSSL_HASH, NULL))
+  {
+    if (cache == NULL || hmac_ctx != cache->hmac)
+    {
+      HMAC_CTX_free(hmac_ctx);
+    }
+    hmac_ctx = NULL;
+  }
+  if (hmac_ctx != NULL && cache != NULL && hmac_ctx == cache->hmac)
+  {
+    memcpy(cache->hmac_key, key, key_len);
+    cache->hmac_key_len = key_len;
+    cache->hmac_keyed = true;
+  }
+  OPENSSL_cleanse(key, sizeof(key));
+
+  return hmac_ctx;
+}
+
+//############################################################################
+// release_auth_hmac()
+//############################################################################
+static void release_auth_hmac(HMAC_CTX * hmac_ctx)
+{
+  AUTH_CTX_CACHE *cache = get_auth_ctx_cache();
+
+  if (cache == NULL || hmac_ctx != cache->hmac)
+  {
+    HMAC_CTX_free(hmac_ctx);
+  }
+}
+
+//############################################################################
+// compute_cpHash
+//############################################################################
+int compute_cpHash(TPM2_CC cmdCode,
+                   TPM2B_NAME authEntityName,
+                   uint8_t * cmdParams,
+                   size_t cmdParams_size, TPM2B_DIGEST * cpHash_out)
 {
   if (cpHash_out == NULL)
   {
@@ -700,12 +1718,11 @@ int compute_cpHash(TPM2_CC cmdCode,
   }
 
   // initialize hash
-  EVP_MD_CTX *md_ctx = EVP_MD_CTX_create();
+  EVP_MD_CTX *md_ctx = acquire_auth_digest();
 
-  if (!EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL))
+  if (md_ctx == NULL)
   {
     kmyth_log(LOG_ERR, "error setting up digest context ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
     return 1;
   }
 
@@ -713,7 +1730,7 @@ int compute_cpHash(TPM2_CC cmdCode,
   if (!EVP_DigestUpdate(md_ctx, (uint8_t *) & cmdCode, sizeof(TPM2_CC)))
   {
     kmyth_log(LOG_ERR, "error hashing command code ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
+    release_auth_digest(md_ctx);
     return 1;
   }
 
@@ -721,7 +1738,7 @@ int compute_cpHash(TPM2_CC cmdCode,
   if (!EVP_DigestUpdate(md_ctx, authEntityName.name, authEntityName.size))
   {
     kmyth_log(LOG_ERR, "error hashing entity name ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
+    release_auth_digest(md_ctx);
     return 1;
   }
 
@@ -729,7 +1746,7 @@ int compute_cpHash(TPM2_CC cmdCode,
   if (!EVP_DigestUpdate(md_ctx, cmdParams, cmdParams_size))
   {
     kmyth_log(LOG_ERR, "error hashing command parameters ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
+    release_auth_digest(md_ctx);
     return 1;
   }
 
@@ -740,11 +1757,11 @@ int compute_cpHash(TPM2_CC cmdCode,
   if (!EVP_DigestFinal_ex(md_ctx, cpHash_result, &cpHash_result_size))
   {
     kmyth_log(LOG_ERR, "error finalizing digest ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
+    release_auth_digest(md_ctx);
     return 1;
   }
 
-  EVP_MD_CTX_destroy(md_ctx);
+  release_auth_digest(md_ctx);
   md_ctx = NULL;
   kmyth_log(LOG_DEBUG, "cpHash: 0x%02X..%02X", cpHash_result[0],
             cpHash_result[cpHash_result_size - 1]);
@@ -771,12 +1788,11 @@ int compute_rpHash(TPM2_RC rspCode,
   }
 
   // initialize hash
-  EVP_MD_CTX *md_ctx = EVP_MD_CTX_create();
+  EVP_MD_CTX *md_ctx = acquire_auth_digest();
 
-  if (!EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL))
+  if (md_ctx == NULL)
   {
     kmyth_log(LOG_ERR, "error setting up digest context ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
     return 1;
   }
 
@@ -784,7 +1800,7 @@ int compute_rpHash(TPM2_RC rspCode,
   if (!EVP_DigestUpdate(md_ctx, (uint8_t *) & rspCode, sizeof(TPM2_RC)))
   {
     kmyth_log(LOG_ERR, "error hashing response code ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
+    release_auth_digest(md_ctx);
     return 1;
   }
 
@@ -792,7 +1808,7 @@ int compute_rpHash(TPM2_RC rspCode,
   if (!EVP_DigestUpdate(md_ctx, (uint8_t *) & cmdCode, sizeof(TPM2_CC)))
   {
     kmyth_log(LOG_ERR, "error hashing command code ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
+    release_auth_digest(md_ctx);
     return 1;
   }
 
@@ -800,7 +1816,7 @@ int compute_rpHash(TPM2_RC rspCode,
   if (!EVP_DigestUpdate(md_ctx, cmdParams, cmdParams_size))
   {
     kmyth_log(LOG_ERR, "error hashing command parameters ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
+    release_auth_digest(md_ctx);
     return 1;
   }
 
@@ -811,11 +1827,11 @@ int compute_rpHash(TPM2_RC rspCode,
   if (!EVP_DigestFinal_ex(md_ctx, rpHash_result, &rpHash_result_size))
   {
     kmyth_log(LOG_ERR, "error finalizing digest ... exiting");
-    EVP_MD_CTX_destroy(md_ctx);
+    release_auth_digest(md_ctx);
     return 1;
   }
 
-  EVP_MD_CTX_destroy(md_ctx);
+  release_auth_digest(md_ctx);
   md_ctx = NULL;
 
   kmyth_log(LOG_DEBUG, "rpHash: 0x%02X..%02X", rpHash_result[0],
@@ -843,14 +1859,12 @@ int compute_authHMAC(SESSION auth_session,
     return 1;
   }
 
-  // initialize authHMAC (authValue is key for computing the keyed hash)
-  HMAC_CTX *hmac_ctx = HMAC_CTX_new();
+  // initialize authHMAC (keyed with sessionKey || authValue)
+  HMAC_CTX *hmac_ctx = acquire_auth_hmac(&auth_session, &auth_authValue);
 
-  if (!HMAC_Init_ex(hmac_ctx, auth_authValue.buffer, auth_authValue.size,
-                    KMYTH_OPENSSL_HASH, NULL))
+  if (hmac_ctx == NULL)
   {
     kmyth_log(LOG_ERR, "error initializing HMAC ... exiting");
-    HMAC_CTX_free(hmac_ctx);
     return 1;
   }
 
@@ -859,7 +1873,7 @@ int compute_authHMAC(SESSION auth_session,
   {
     kmyth_log(LOG_ERR,
               "error updating HMAC with authorized command hash ... exiting");
-    HMAC_CTX_free(hmac_ctx);
+    release_auth_hmac(hmac_ctx);
     return 1;
   }
 
@@ -868,7 +1882,7 @@ int compute_authHMAC(SESSION auth_session,
                    auth_session.nonceNewer.size))
   {
     kmyth_log(LOG_ERR, "error updating HMAC with new nonce ... exiting");
-    HMAC_CTX_free(hmac_ctx);
+    release_auth_hmac(hmac_ctx);
     return 1;
   }
 
@@ -877,7 +1891,7 @@ int compute_authHMAC(SESSION auth_session,
                    auth_session.nonceOlder.size))
   {
     kmyth_log(LOG_ERR, "error updating HMAC with old nonce ... exiting");
-    HMAC_CTX_free(hmac_ctx);
+    release_auth_hmac(hmac_ctx);
     return 1;
   }
 
@@ -886,7 +1900,7 @@ int compute_authHMAC(SESSION auth_session,
   {
     kmyth_log(LOG_ERR,
               "error updating HMAC with session attributes ... exiting");
-    HMAC_CTX_free(hmac_ctx);
+    release_auth_hmac(hmac_ctx);
     return 1;
   }
 
@@ -897,10 +1911,10 @@ int compute_authHMAC(SESSION auth_session,
   if (!HMAC_Final(hmac_ctx, authHMAC_result, &authHMAC_result_size))
   {
     kmyth_log(LOG_ERR, "error finalizing HMAC ... exiting");
-    HMAC_CTX_free(hmac_ctx);
+    release_auth_hmac(hmac_ctx);
     return 1;
   }
-  HMAC_CTX_free(hmac_ctx);
+  release_auth_hmac(hmac_ctx);
   hmac_ctx = NULL;
   kmyth_log(LOG_DEBUG, "authHMAC: 0x%02X..%02X", authHMAC_result[0],
             authHMAC_result[authHMAC_result_size - 1]);
@@ -913,342 +1927,1358 @@ int compute_authHMAC(SESSION auth_session,
 }
 
 //############################################################################
-// create_policy_digest
+// extend_policy_digest()
 //############################################################################
-int create_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
-                         TPML_PCR_SELECTION tp_pcrList,
-                         TPM2B_DIGEST * policyDigest_out)
+static int extend_policy_digest(TPM2B_DIGEST * policyDigest,
+                                TPM2_CC cmdCode,
+                                const uint8_t * cmdParams,
+                                size_t cmdParams_size)
 {
-  // declare a session structure variable for the trial policy session
-  SESSION trialPolicySession;
+  // policyDigest_new = H(policyDigest_old || commandCode || parameters),
+  // with the command code marshalled (big-endian) as on the TPM
+  uint8_t cmdCode_bytes[sizeof(TPM2_CC)];
+  size_t offset = 0;
 
-  if (create_auth_session(sapi_ctx, &trialPolicySession, TPM2_SE_TRIAL))
+  if (Tss2_MU_TPM2_CC_Marshal(cmdCode, cmdCode_bytes, sizeof(cmdCode_bytes),
+                              &offset) != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "error creating auth session ... exiting");
+    kmyth_log(LOG_ERR, "error marshalling command code ... exiting");
     return 1;
   }
 
-  // Apply policy to trial session context
-  if (apply_policy(sapi_ctx, trialPolicySession.sessionHandle, tp_pcrList))
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_create();
+
+  if (md_ctx == NULL ||
+      !EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL) ||
+      !EVP_DigestUpdate(md_ctx, policyDigest->buffer, policyDigest->size) ||
+      !EVP_DigestUpdate(md_ctx, cmdCode_bytes, offset) ||
+      !EVP_DigestUpdate(md_ctx, cmdParams, cmdParams_size))
   {
-    kmyth_log(LOG_ERR, "error applying policy to session context ... exiting");
+    kmyth_log(LOG_ERR, "error hashing policy digest ... exiting");
+    EVP_MD_CTX_destroy(md_ctx);
+    return 1;
+  }
+
+  unsigned int policyDigest_size = KMYTH_DIGEST_SIZE;
+
+  if (!EVP_DigestFinal_ex(md_ctx, policyDigest->buffer, &policyDigest_size))
+  {
+    kmyth_log(LOG_ERR, "error finalizing policy digest ... exiting");
+    EVP_MD_CTX_destroy(md_ctx);
+    return 1;
+  }
+  EVP_MD_CTX_destroy(md_ctx);
+  policyDigest->size = (uint16_t) policyDigest_size;
+
+  return 0;
+}
+
+//############################################################################
+// compute_pcr_digest()
+//############################################################################
+int compute_pcr_digest(const TPM2B_DIGEST * pcrValues,
+                       size_t pcrValues_len, TPM2B_DIGEST * pcrDigest_out)
+{
+  if (pcrDigest_out == NULL || (pcrValues == NULL && pcrValues_len > 0))
+  {
+    kmyth_log(LOG_ERR, "invalid input ... exiting");
+    return 1;
+  }
+
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_create();
+
+  if (md_ctx == NULL || !EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL))
+  {
+    kmyth_log(LOG_ERR, "error setting up digest context ... exiting");
+    EVP_MD_CTX_destroy(md_ctx);
+    return 1;
+  }
+  for (size_t i = 0; i < pcrValues_len; i++)
+  {
+    if (!EVP_DigestUpdate(md_ctx, pcrValues[i].buffer, pcrValues[i].size))
+    {
+      kmyth_log(LOG_ERR, "error hashing PCR value ... exiting");
+      EVP_MD_CTX_destroy(md_ctx);
+      return 1;
+    }
+  }
+
+  unsigned int pcrDigest_size = KMYTH_DIGEST_SIZE;
+
+  if (!EVP_DigestFinal_ex(md_ctx, pcrDigest_out->buffer, &pcrDigest_size))
+  {
+    kmyth_log(LOG_ERR, "error finalizing digest ... exiting");
+    EVP_MD_CTX_destroy(md_ctx);
+    return 1;
+  }
+  EVP_MD_CTX_destroy(md_ctx);
+  pcrDigest_out->size = (uint16_t) pcrDigest_size;
+
+  return 0;
+}
+
+//############################################################################
+// compute_policy_digest()
+//############################################################################
+int compute_policy_digest(TPML_PCR_SELECTION tp_pcrList,
+                          const TPM2B_DIGEST * pcrValues,
+                          size_t pcrValues_len,
+                          TPM2B_DIGEST * policyDigest_out)
+{
+  if (policyDigest_out == NULL)
+  {
+    kmyth_log(LOG_ERR, "no buffer available to store digest ... exiting");
+    return 1;
+  }
+
+  // a new policy session starts with an all-zero policy digest
+  policyDigest_out->size = KMYTH_DIGEST_SIZE;
+  memset(policyDigest_out->buffer, 0, KMYTH_DIGEST_SIZE);
+
+  // PolicyAuthValue has no parameters
+  if (extend_policy_digest(policyDigest_out, TPM2_CC_PolicyAuthValue,
+                           NULL, 0))
+  {
+    return 1;
+  }
+
+  // PolicyPCR (applied only for a non-empty PCR Selection List, as in
+  // apply_policy()) extends the policy digest with the marshalled PCR
+  // selection and the digest of the selected PCR values
+  if (tp_pcrList.count > 0)
+  {
+    TPM2B_DIGEST pcrDigest;
+
+    if (compute_pcr_digest(pcrValues, pcrValues_len, &pcrDigest))
+    {
+      return 1;
+    }
+
+    uint8_t params[sizeof(TPML_PCR_SELECTION) + sizeof(pcrDigest.buffer)];
+    size_t params_size = 0;
+
+    if (Tss2_MU_TPML_PCR_SELECTION_Marshal(&tp_pcrList, params,
+                                           sizeof(params), &params_size)
+        != TSS2_RC_SUCCESS)
+    {
+      kmyth_log(LOG_ERR, "error marshalling PCR selection ... exiting");
+      return 1;
+    }
+    memcpy(params + params_size, pcrDigest.buffer, pcrDigest.size);
+    params_size += pcrDigest.size;
+
+    if (extend_policy_digest(policyDigest_out, TPM2_CC_PolicyPCR,
+                             params, params_size))
+    {
+      return 1;
+    }
+  }
+
+  kmyth_log(LOG_DEBUG, "authPolicy: 0x%02X..%02X",
+            policyDigest_out->buffer[0],
+            policyDigest_out->buffer[policyDigest_out->size - 1]);
+
+  return 0;
+}
+
+//############################################################################
+// compute_policy_or_digest()
+//############################################################################
+int compute_policy_or_digest(TPML_DIGEST pHashList,
+                             TPM2B_DIGEST * policyDigest_out)
+{
+  if (policyDigest_out == NULL)
+  {
+    kmyth_log(LOG_ERR, "no buffer available to store digest ... exiting");
+    return 1;
+  }
+  if (pHashList.count < 2 || pHashList.count > 8)
+  {
+    kmyth_log(LOG_ERR, "invalid number of policy branches (%u) ... exiting",
+              pHashList.count);
+    return 1;
+  }
+
+  // PolicyOR resets the policy digest to all-zero, then extends it with
+  // the concatenation of the branch digests
+  uint8_t params[8 * sizeof(pHashList.digests[0].buffer)];
+  size_t params_size = 0;
+
+  for (uint32_t i = 0; i < pHashList.count; i++)
+  {
+    memcpy(params + params_size, pHashList.digests[i].buffer,
+           pHashList.digests[i].size);
+    params_size += pHashList.digests[i].size;
+  }
+
+  policyDigest_out->size = KMYTH_DIGEST_SIZE;
+  memset(policyDigest_out->buffer, 0, KMYTH_DIGEST_SIZE);
+  if (extend_policy_digest(policyDigest_out, TPM2_CC_PolicyOR,
+                           params, params_size))
+  {
+    return 1;
+  }
+
+  kmyth_log(LOG_DEBUG, "policyOR: 0x%02X..%02X",
+            policyDigest_out->buffer[0],
+            policyDigest_out->buffer[policyDigest_out->size - 1]);
+
+  return 0;
+}
+
+//############################################################################
+// check_policy_digest()
+//############################################################################
+int check_policy_digest(TPM2B_DIGEST pcrPolicy, TPM2B_DIGEST authPolicy,
+                        TPM2B_DIGEST policyBranch1,
+                        TPM2B_DIGEST policyBranch2)
+{
+  TPM2B_DIGEST expected = pcrPolicy;
+
+  // with a policy-OR, the PCR policy must be one of the branches, and the
+  // branches must combine into the object's authPolicy
+  if (policyBranch1.size != 0 || policyBranch2.size != 0)
+  {
+    bool is_branch1 = (pcrPolicy.size == policyBranch1.size &&
+                       memcmp(pcrPolicy.buffer, policyBranch1.buffer,
+                              pcrPolicy.size) == 0);
+    bool is_branch2 = (pcrPolicy.size == policyBranch2.size &&
+                       memcmp(pcrPolicy.buffer, policyBranch2.buffer,
+                              pcrPolicy.size) == 0);
+
+    if (!is_branch1 && !is_branch2)
+    {
+      kmyth_log(LOG_DEBUG, "PCR policy matches neither policy-OR branch");
+      return 1;
+    }
+
+    TPML_DIGEST pHashList = {.count = 2, };
+
+    pHashList.digests[0] = policyBranch1;
+    pHashList.digests[1] = policyBranch2;
+    if (compute_policy_or_digest(pHashList, &expected))
+    {
+      return 1;
+    }
+  }
+
+  if (expected.size != authPolicy.size ||
+      memcmp(expected.buffer, authPolicy.buffer, expected.size) != 0)
+  {
+    kmyth_log(LOG_DEBUG, "policy digest does not match authPolicy");
     return 1;
   }
 
-  // get the policy digest - no authorization is needed for this call
-  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
-  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
-  TPM2_RC rc = Tss2_Sys_PolicyGetDigest(sapi_ctx,
-                                        trialPolicySession.sessionHandle,
-                                        nullCmdAuths,
-                                        policyDigest_out,
-                                        nullRspAuths);
+  return 0;
+}
+
+//############################################################################
+// create_policy_digest
+//############################################################################
+int create_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
+                         TPML_PCR_SELECTION tp_pcrList,
+                         TPM2B_DIGEST * policyDigest_out)
+{
+  // Kmyth PCR selections use a single PCR bank
+  TPM2B_DIGEST pcrValues[TPM2_MAX_PCRS];
+  size_t pcrValues_len = 0;
+
+  if (tp_pcrList.count > 0)
+  {
+    if (read_pcr_values(sapi_ctx, tp_pcrList, pcrValues, TPM2_MAX_PCRS,
+                        &pcrValues_len))
+    {
+      kmyth_log(LOG_ERR, "error reading PCR values ... exiting");
+      return 1;
+    }
+  }
+
+  if (compute_policy_digest(tp_pcrList, pcrValues, pcrValues_len,
+                            policyDigest_out))
+  {
+    kmyth_log(LOG_ERR, "error computing policy digest ... exiting");
+    return 1;
+  }
+
+#ifdef KMYTH_POLICY_TRIAL_CHECK
+  TPM2B_DIGEST trialDigest = {.size = 0, };
+
+  if (create_trial_policy_digest(sapi_ctx, tp_pcrList, &trialDigest))
+  {
+    return 1;
+  }
+  if (trialDigest.size != policyDigest_out->size ||
+      memcmp(trialDigest.buffer, policyDigest_out->buffer,
+             trialDigest.size) != 0)
+  {
+    kmyth_log(LOG_ERR, "policy digest does not match trial session ... "
+              "exiting");
+    return 1;
+  }
+#endif
+
+  return 0;
+}
+
+//############################################################################
+// create_policy_or_digest
+//############################################################################
+int create_policy_or_digest(TSS2_SYS_CONTEXT * sapi_ctx,
+                            TPM2B_DIGEST policy1, TPM2B_DIGEST policy2,
+                            TPM2B_DIGEST * policyDigest_out)
+{
+  TPML_DIGEST pHashList = {.count = 2, };
+
+  pHashList.digests[0] = policy1;
+  pHashList.digests[1] = policy2;
+
+  if (compute_policy_or_digest(pHashList, policyDigest_out))
+  {
+    kmyth_log(LOG_ERR, "error computing policyOR digest ... exiting");
+    return 1;
+  }
+
+#ifdef KMYTH_POLICY_TRIAL_CHECK
+  SESSION trialPolicySession;
+  TPM2B_DIGEST trialDigest = {.size = 0, };
+  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
+  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+
+  if (create_auth_session(sapi_ctx, &trialPolicySession, TPM2_SE_TRIAL))
+  {
+    kmyth_log(LOG_ERR, "error creating auth session ... exiting");
+    return 1;
+  }
+
+  int ret = apply_policy_or(sapi_ctx, trialPolicySession.sessionHandle,
+                            &policy1, &policy2, &pHashList);
+
+  if (ret == 0 &&
+      Tss2_Sys_PolicyGetDigest(sapi_ctx, trialPolicySession.sessionHandle,
+                               nullCmdAuths, &trialDigest,
+                               nullRspAuths) != TSS2_RC_SUCCESS)
+  {
+    ret = 1;
+  }
+  Tss2_Sys_FlushContext(sapi_ctx, trialPolicySession.sessionHandle);
+
+  if (ret != 0 ||
+      trialDigest.size != policyDigest_out->size ||
+      memcmp(trialDigest.buffer, policyDigest_out->buffer,
+             trialDigest.size) != 0)
+  {
+    kmyth_log(LOG_ERR, "policyOR digest does not match trial session ... "
+              "exiting");
+    return 1;
+  }
+#else
+  (void) sapi_ctx;
+#endif
+
+  return 0;
+}
+
+//############################################################################
+// create_trial_policy_digest
+//############################################################################
+int create_trial_policy_digest(TSS2_SYS_CONTEXT * sapi_ctx,
+                               TPML_PCR_SELECTION tp_pcrList,
+                               TPM2B_DIGEST * policyDigest_out)
+{
+  // declare a session structure variable for the trial policy session
+  SESSION trialPolicySession;
+
+  if (create_auth_session(sapi_ctx, &trialPolicySession, TPM2_SE_TRIAL))
+  {
+    kmyth_log(LOG_ERR, "error creating auth session ... exiting");
+    return 1;
+  }
+
+  // Apply policy to trial session context
+  if (apply_policy(sapi_ctx, trialPolicySession.sessionHandle, tp_pcrList))
+  {
+    kmyth_log(LOG_ERR, "error applying policy to session context ... exiting");
+    return 1;
+  }
+
+  // get the policy digest - no authorization is needed for this call
+  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
+  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+  TPM2_RC rc = Tss2_Sys_PolicyGetDigest(sapi_ctx,
+                                        trialPolicySession.sessionHandle,
+                                        nullCmdAuths,
+                                        policyDigest_out,
+                                        nullRspAuths);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR,
+              "Tss2_Sys_PolicyGetDigest(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "authPolicy: 0x%02X..%02X",
+            policyDigest_out->buffer[0],
+            policyDigest_out->buffer[policyDigest_out->size - 1]);
+
+  // done with trial session, so flush it from the TPM
+  rc = Tss2_Sys_FlushContext(sapi_ctx, trialPolicySession.sessionHandle);
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_FlushContext(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "flushed trial policy session "
+            "(handle = 0x%08X)", trialPolicySession.sessionHandle);
+
+  return 0;
+}
+
+//############################################################################
+// create_auth_session
+//############################################################################
+int create_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                        SESSION * policySession, TPM2_SE session_type)
+{
+  // create initial callerNonce
+  TPM2B_NONCE initialNonce;
+
+  if (session_type != TPM2_SE_POLICY)
+  {
+    initialNonce.size = KMYTH_DIGEST_SIZE;
+  }
+  else
+  {
+    initialNonce.size = 0;      // start with empty nonce
+  }
+  if (create_caller_nonce(&initialNonce))
+  {
+    return 1;
+  }
+
+  // initialize session state with "start-up" nonce values
+  //   - nonceNewer initialized to nonceCaller value just generated
+  //   - nonceOlder initialized to all-zero value of KMYTH_DIGEST_SIZE length
+  //   - nonceTPM initialized to empty nonce
+  policySession->nonceNewer.size = KMYTH_DIGEST_SIZE;
+  memset(policySession->nonceNewer.buffer, 0, KMYTH_DIGEST_SIZE);
+
+  if (session_type != TPM2_SE_POLICY)
+  {
+    policySession->nonceOlder.size = KMYTH_DIGEST_SIZE;
+  }
+
+  if (rollNonces(policySession, initialNonce))
+  {
+    kmyth_log(LOG_ERR, "error rolling session nonces ... exiting");
+    return 1;
+  }
+  policySession->nonceTPM.size = 0;
+
+  // initiate an unbound, unsalted policy session
+  if (start_policy_auth_session(sapi_ctx, policySession, session_type))
+  {
+    kmyth_log(LOG_ERR, "error starting policy session ... exiting");
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// start_policy_auth_session()
+//############################################################################
+int start_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                              SESSION * session, TPM2_SE session_type)
+{
+  // assign session "type" passed in - Kmyth sessions are either:
+  //   - trial (used to compute policy digest value) - TPM2_SE_TRIAL
+  //   - policy (used for actual policy authorization) - TPM2_SE_POLICY
+  if ((session_type != TPM2_SE_TRIAL) && (session_type != TPM2_SE_POLICY))
+  {
+    kmyth_log(LOG_ERR, "invalid session type ... exiting");
+    return 1;
+  }
+  if (session->nonceNewer.size != KMYTH_DIGEST_SIZE
+      || session->nonceOlder.size != KMYTH_DIGEST_SIZE)
+  {
+    kmyth_log(LOG_ERR, "Session nonce uninitialized ... exiting");
+    return 1;
+  }
+  session->sessionType = session_type;
+
+  // For Kmyth, the current implementation uses unbound and unsalted sessions.
+  // This results in a NULL sessionKey meaning that the HMAC key is simply the
+  // authVal for the entity being authorized.
+
+  // configure algorithm parameters for session according to Kmyth defaults
+  session->symmetric.algorithm = KMYTH_SYM_PARAM_ENC_ALG;
+  if (session->symmetric.algorithm == TPM2_ALG_AES)
+  {
+    session->symmetric.keyBits.aes = KMYTH_SYM_PARAM_ENC_KEY_LEN;
+    session->symmetric.mode.aes = KMYTH_SYM_PARAM_ENC_MODE;
+  }
+  session->authHash = KMYTH_HASH_ALG;
+  session->bind = TPM2_RH_NULL; // unbound
+  session->tpmKey = TPM2_RH_NULL; // unsalted
+  session->encryptedSalt.size = 0;  // empty encrypted salt value
+  session->sessionKey.size = 0; // empty session key
+
+  // use API call to start session - command requires no authorization
+  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
+  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+  TPM2_RC rc;
+  unsigned int attempt = 0;
+
+  do
+  {
+    rc = Tss2_Sys_StartAuthSession(sapi_ctx,
+                                   session->tpmKey,
+                                   session->bind,
+                                   nullCmdAuths,
+                                   &session->nonceNewer,
+                                   &session->encryptedSalt,
+                                   session->sessionType,
+                                   &session->symmetric,
+                                   session->authHash,
+                                   &session->sessionHandle,
+                                   &session->nonceTPM, nullRspAuths);
+  }
+  while (retry_tpm2_command(sapi_ctx, rc, &attempt));
+
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_StartAuthSession(): rc = 0x%08X, %s",
+              rc, getErrorString(rc));
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "started %s session (0x%08X)",
+            session->sessionType == TPM2_SE_TRIAL ? "trial" : "policy",
+            session->sessionHandle);
+
+  // Roll nonces to add the nonce just returned from the TPM to the session
+  // state (i.e., nonceTPM -> nonceNewer and  nonceCaller -> nonceOlder)
+  if (rollNonces(session, session->nonceTPM))
+  {
+    kmyth_log(LOG_ERR, "error rolling session nonces ... exiting");
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG,
+            "rolled nonces - nonceTPM = 0x%02X..%02X is now nonceNewer",
+            session->nonceTPM.buffer[0],
+            session->nonceTPM.buffer[session->nonceTPM.size - 1]);
+
+  return 0;
+}
+
+//############################################################################
+// apply_policy()
+//############################################################################
+int apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
+                 TPM2_HANDLE policySessionHandle,
+                 TPML_PCR_SELECTION policySession_pcrList)
+{
+  // Apply authorization value (AuthValue) policy command
+  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
+  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+  TPM2_RC rc = Tss2_Sys_PolicyAuthValue(sapi_ctx,
+                                        policySessionHandle,
+                                        nullCmdAuths, nullRspAuths);
+
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR,
+              "Tss2_Sys_PolicyAuthValue(): rc = 0x%08X, %s ... exiting", rc,
+              getErrorString(rc));
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "applied AuthVal policy to session context");
+  // If the supplied PCR Selection List is not empty, supply PCR policy command
+  // (if empty, PCR criteria will not be included in the authorization policy)
+  if (policySession_pcrList.count > 0)
+  {
+    // policySession→policyDigest is extended by a call to Tss2_Sys_PolicyPCR()
+    //   - an empty (zero length) PCR digest must be passed in
+    TPM2B_DIGEST pcrEmptyDigest;
+
+    pcrEmptyDigest.size = 0;
+
+    rc = Tss2_Sys_PolicyPCR(sapi_ctx,
+                            policySessionHandle,
+                            nullCmdAuths,
+                            &pcrEmptyDigest,
+                            &policySession_pcrList, nullRspAuths);
+    if (rc != TPM2_RC_SUCCESS)
+    {
+      kmyth_log(LOG_ERR, "Tss2_Sys_PolicyPCR(): rc = 0x%08X, %s", rc,
+                getErrorString(rc));
+      return 1;
+    }
+    kmyth_log(LOG_DEBUG, "applied PCR policy to session context");
+  }
+  return 0;
+}
+
+//############################################################################
+// unseal_apply_policy()
+//############################################################################
+int unseal_apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
+                        TPM2_HANDLE policySessionHandle,
+                        TPML_PCR_SELECTION policySession_pcrList,
+                        TPM2B_DIGEST policy1, TPM2B_DIGEST policy2)
+{
+
+  if (apply_policy(sapi_ctx, policySessionHandle, policySession_pcrList))
+  {
+    return 1;
+  }
+
+  TPML_DIGEST pHashList = {.count = 0 };
+  for (size_t i = 0; i < 8; i++)
+  {
+    pHashList.digests[i].size = 0;
+  }
+
+  if (policy1.size != 0 && policy2.size != 0)
+  {
+    apply_policy_or(sapi_ctx, policySessionHandle, &policy1, &policy2,
+                    &pHashList);
+  }
+  return 0;
+}
+
+//############################################################################
+// apply_policy_or()
+//############################################################################
+int apply_policy_or(TSS2_SYS_CONTEXT * sapi_ctx,
+                    TPM2_HANDLE policySessionHandle,
+                    const TPM2B_DIGEST * policy1,
+                    const TPM2B_DIGEST * policy2, TPML_DIGEST * pHashList)
+{
+  // Apply authorization value (AuthValue) policy command
+  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
+  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+
+  // initializing all digests to empty buffers
+  for (size_t i; i < 8; i++)
+  {
+    pHashList->digests[0].size = 0;
+  }
+
+  pHashList->count = 2;
+  pHashList->digests[0] = *policy1;
+  pHashList->digests[1] = *policy2;
+
+  TPM2_RC rc =
+    Tss2_Sys_PolicyOR(sapi_ctx, policySessionHandle, nullCmdAuths, pHashList,
+                      nullRspAuths);
+
+  if (rc != TPM2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_PolicyOR(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return 1;
+  }
+  kmyth_log(LOG_DEBUG, "applied PCR policyOR to session context");
+  return 0;
+}
+
+//############################################################################
+// create_caller_nonce()
+//############################################################################
+int create_caller_nonce(TPM2B_NONCE * nonceOut)
+{
+  // the nonce need only be unique, so it comes from the calling thread's
+  // DRBG (written straight into the TPM2B_NONCE struct passed in)
+  if (kmyth_nonce_bytes(nonceOut->buffer, KMYTH_DIGEST_SIZE))
+  {
+    kmyth_log(LOG_ERR, "error generating random bytes ... exiting");
+    return 1;
+  }
+  nonceOut->size = KMYTH_DIGEST_SIZE;
+
+  kmyth_log(LOG_DEBUG, "nonceCaller: 0x%02X..%02X",
+            nonceOut->buffer[0], nonceOut->buffer[nonceOut->size - 1]);
+  return 0;
+}
+
+//############################################################################
+// rollNonces()
+//############################################################################
+int rollNonces(SESSION * session, TPM2B_NONCE newNonce)
+{
+  if (session == NULL)
+  {
+    kmyth_log(LOG_ERR, "no session ... exiting");
+    return 1;
+  }
+
+  if (newNonce.size != KMYTH_DIGEST_SIZE)
+  {
+    kmyth_log(LOG_ERR, "Invalid newNonce size ... exiting");
+    return 1;
+  }
+
+  session->nonceOlder = session->nonceNewer;
+  session->nonceNewer = newNonce;
+
+  return 0;
+}
+
+//############################################################################
+// execute_tpm2_async()
+//############################################################################
+TSS2_RC execute_tpm2_async(TSS2_SYS_CONTEXT * sapi_ctx, HOST_WORK * host_work)
+{
+  TSS2_RC rc = Tss2_Sys_ExecuteAsync(sapi_ctx);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_ExecuteAsync(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return rc;
+  }
+
+  // the TPM is now working on the command, so do the host-side work
+  finish_host_work(host_work);
+
+  return Tss2_Sys_ExecuteFinish(sapi_ctx, TSS2_TCTI_TIMEOUT_BLOCK);
+}
+
+//############################################################################
+// finish_host_work()
+//############################################################################
+void finish_host_work(HOST_WORK * host_work)
+{
+  if (host_work == NULL || host_work->fn == NULL)
+  {
+    return;
+  }
+
+  void (*fn) (void *arg) = host_work->fn;
+
+  host_work->fn = NULL;
+  fn(host_work->arg);
+}
+
+//############################################################################
+// get_timing_tcti()
+//############################################################################
+static TIMING_TCTI *get_timing_tcti(TSS2_SYS_CONTEXT * sapi_ctx)
+{
+  TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+
+  if (sapi_ctx == NULL ||
+      Tss2_Sys_GetTctiContext(sapi_ctx, &tcti_ctx) != TSS2_RC_SUCCESS ||
+      tcti_ctx == NULL || TSS2_TCTI_MAGIC(tcti_ctx) != KMYTH_TIMING_TCTI_MAGIC)
+  {
+    return NULL;
+  }
+
+  return (TIMING_TCTI *) tcti_ctx;
+}
+
+//############################################################################
+// retry_tpm2_command()
+//############################################################################
+bool retry_tpm2_command(TSS2_SYS_CONTEXT * sapi_ctx, TSS2_RC rc,
+                        unsigned int *attempt)
+{
+  // only the TPM's own "busy" warnings mean the command was not executed
+  // and can simply be sent again
+  if ((rc & TSS2_RC_LAYER_MASK) != TSS2_TPM_RC_LAYER)
+  {
+    return false;
+  }
+  TSS2_RC tpm_rc = rc & ~TSS2_RC_LAYER_MASK;
+
+  if (tpm_rc != TPM2_RC_RETRY && tpm_rc != TPM2_RC_YIELDED &&
+      tpm_rc != TPM2_RC_TESTING)
+  {
+    return false;
+  }
+  if (*attempt >= MAX_RETRIES)
+  {
+    kmyth_log(LOG_ERR, "TPM busy (rc = 0x%08X), retry limit (%d) reached",
+              rc, MAX_RETRIES);
+    return false;
+  }
+
+  // exponential backoff, capped, with the actual delay drawn from the upper
+  // half of the window (the clock's low bits are ample jitter for this)
+  uint64_t window_us = KMYTH_RETRY_MAX_US;
+
+  if (*attempt < 16 && ((uint64_t) KMYTH_RETRY_BASE_US << *attempt) <
+      KMYTH_RETRY_MAX_US)
+  {
+    window_us = (uint64_t) KMYTH_RETRY_BASE_US << *attempt;
+  }
+  uint64_t jitter = (get_timing_ns() * 2654435761ULL) >> 16;
+  uint64_t delay_us = window_us / 2 + jitter % (window_us / 2 + 1);
+
+  // a retry that could not be sent before the deadline is not waited for
+  TIMING_TCTI *tcti = get_timing_tcti(sapi_ctx);
+
+  if (tcti != NULL && tcti->deadline != NULL &&
+      (tpm2_deadline_expired(tcti->deadline) ||
+       (tcti->deadline->deadline_ns != 0 &&
+        get_timing_ns() + delay_us * 1000 >= tcti->deadline->deadline_ns)))
+  {
+    kmyth_log(LOG_ERR, "TPM busy (rc = 0x%08X), no time left to retry", rc);
+    return false;
+  }
+
+  (*attempt)++;
+  kmyth_log(LOG_DEBUG, "TPM busy (rc = 0x%08X), retry %u in %lu us", rc,
+            *attempt, (unsigned long) delay_us);
+
+  uint64_t start_ns = get_timing_ns();
+  struct timespec delay = {
+    .tv_sec = (time_t) (delay_us / 1000000),
+    .tv_nsec = (long) (delay_us % 1000000) * 1000,
+  };
+
+  while (nanosleep(&delay, &delay) != 0 && errno == EINTR)
+  {
+    // resume after a signal with the remaining time
+  }
+
+  kmyth_timings_t *timings = get_tpm2_timings(sapi_ctx);
+
+  if (timings != NULL)
+  {
+    timings->retries++;
+    timings->retry_wait_ns += get_timing_ns() - start_ns;
+  }
+  kmyth_metrics_count_tpm_retry();
+
+  return true;
+}
+
+//############################################################################
+// get_timing_ns()
+//############################################################################
+uint64_t get_timing_ns(void)
+{
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts))
+  {
+    return 0;
+  }
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+//############################################################################
+// set_tpm2_timings()
+//############################################################################
+int set_tpm2_timings(TSS2_SYS_CONTEXT * sapi_ctx, kmyth_timings_t * timings)
+{
+  TIMING_TCTI *tcti = get_timing_tcti(sapi_ctx);
+
+  if (tcti == NULL)
+  {
+    kmyth_log(LOG_ERR, "connection does not support timings ... exiting");
+    return 1;
+  }
+
+  tcti->timings = timings;
+  tcti->in_flight = false;
+
+  return 0;
+}
+
+//############################################################################
+// get_tpm2_timings()
+//############################################################################
+kmyth_timings_t *get_tpm2_timings(TSS2_SYS_CONTEXT * sapi_ctx)
+{
+  TIMING_TCTI *tcti = get_timing_tcti(sapi_ctx);
+
+  return (tcti == NULL) ? NULL : tcti->timings;
+}
+
+//############################################################################
+// set_tpm2_deadline()
+//############################################################################
+int set_tpm2_deadline(TSS2_SYS_CONTEXT * sapi_ctx, CALL_DEADLINE * deadline)
+{
+  TIMING_TCTI *tcti = get_timing_tcti(sapi_ctx);
+
+  if (tcti == NULL)
+  {
+    kmyth_log(LOG_ERR, "connection does not support deadlines ... exiting");
+    return 1;
+  }
+
+  tcti->deadline = deadline;
+
+  return 0;
+}
+
+//############################################################################
+// reset_tpm2_connection()
+//############################################################################
+int reset_tpm2_connection(TSS2_SYS_CONTEXT * sapi_ctx)
+{
+  TIMING_TCTI *tcti = get_timing_tcti(sapi_ctx);
+
+  if (tcti == NULL || !tcti->abandoned)
+  {
+    return 0;
+  }
+
+  // The SAPI context is left waiting for the abandoned command's response
+  // (which the TCTI drops before sending the next command), so is set up
+  // afresh over the same TCTI
+  TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+  TSS2_RC rc = Tss2_Sys_Initialize(sapi_ctx, Tss2_Sys_GetContextSize(0),
+                                   (TSS2_TCTI_CONTEXT *) tcti, &abi_version);
+
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_ERR, "Tss2_Sys_Initialize(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// tpm2_deadline_expired()
+//############################################################################
+bool tpm2_deadline_expired(const CALL_DEADLINE * deadline)
+{
+  if (deadline == NULL)
+  {
+    return false;
+  }
+
+  return __atomic_load_n(&deadline->cancelled, __ATOMIC_ACQUIRE) != 0 ||
+    (deadline->deadline_ns != 0 && get_timing_ns() >= deadline->deadline_ns);
+}
+
+//############################################################################
+// add_phase_timing()
+//############################################################################
+void add_phase_timing(kmyth_timings_t * timings, kmyth_phase_t phase,
+                      uint64_t start_ns)
+{
+  if (timings == NULL || phase < 0 || phase >= KMYTH_PHASE_COUNT)
+  {
+    return;
+  }
+
+  timings->phase_ns[phase] += get_timing_ns() - start_ns;
+  timings->phase_calls[phase]++;
+}
+
+//############################################################################
+// acquire_policy_session()
+//############################################################################
+int acquire_policy_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                           SESSION * policySession)
+{
+  TIMING_TCTI *tcti = get_timing_tcti(sapi_ctx);
+
+  while (tcti != NULL && tcti->session_pool_count > 0)
+  {
+    *policySession = tcti->session_pool[--tcti->session_pool_count];
+    memset(&(tcti->session_pool[tcti->session_pool_count]), 0,
+           sizeof(SESSION));
+
+    // PolicyRestart resets the policy digest but leaves the session's
+    // nonces as last rolled, so the pooled SESSION stays in sync
+    TSS2_RC rc = Tss2_Sys_PolicyRestart(sapi_ctx,
+                                        policySession->sessionHandle,
+                                        NULL, NULL);
+
+    if (rc == TSS2_RC_SUCCESS)
+    {
+      kmyth_log(LOG_DEBUG, "reusing policy session 0x%08X",
+                policySession->sessionHandle);
+      kmyth_metrics_count_cache(KMYTH_CACHE_POLICY_SESSION, true);
+      return 0;
+    }
+
+    kmyth_log(LOG_WARNING, "Tss2_Sys_PolicyRestart(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    Tss2_Sys_FlushContext(sapi_ctx, policySession->sessionHandle);
+  }
+  if (tcti != NULL)
+  {
+    kmyth_metrics_count_cache(KMYTH_CACHE_POLICY_SESSION, false);
+  }
+
+  return create_auth_session(sapi_ctx, policySession, TPM2_SE_POLICY);
+}
+
+//############################################################################
+// release_policy_session()
+//############################################################################
+int release_policy_session(TSS2_SYS_CONTEXT * sapi_ctx,
+                           SESSION * policySession, bool failed)
+{
+  TIMING_TCTI *tcti = get_timing_tcti(sapi_ctx);
 
-  if (rc != TSS2_RC_SUCCESS)
+  if (!failed && tcti != NULL &&
+      tcti->session_pool_count < KMYTH_POLICY_SESSION_POOL_SIZE)
   {
-    kmyth_log(LOG_ERR,
-              "Tss2_Sys_PolicyGetDigest(): rc = 0x%08X, %s", rc,
-              getErrorString(rc));
-    return 1;
+    tcti->session_pool[tcti->session_pool_count++] = *policySession;
+    return 0;
   }
-  kmyth_log(LOG_DEBUG, "authPolicy: 0x%02X..%02X",
-            policyDigest_out->buffer[0],
-            policyDigest_out->buffer[policyDigest_out->size - 1]);
 
-  // done with trial session, so flush it from the TPM
-  rc = Tss2_Sys_FlushContext(sapi_ctx, trialPolicySession.sessionHandle);
+  TSS2_RC rc = Tss2_Sys_FlushContext(sapi_ctx, policySession->sessionHandle);
+
   if (rc != TSS2_RC_SUCCESS)
   {
     kmyth_log(LOG_ERR, "Tss2_Sys_FlushContext(): rc = 0x%08X, %s", rc,
               getErrorString(rc));
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "flushed trial policy session "
-            "(handle = 0x%08X)", trialPolicySession.sessionHandle);
+  kmyth_log(LOG_DEBUG, "flushed policy session 0x%08X",
+            policySession->sessionHandle);
 
   return 0;
 }
 
 //############################################################################
-// create_auth_session
+// gather_tpm2_snapshot()
 //############################################################################
-int create_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
-                        SESSION * policySession, TPM2_SE session_type)
+static int gather_tpm2_snapshot(TSS2_SYS_CONTEXT * sapi_ctx, uint32_t parts,
+                                CAP_SNAPSHOT * snapshot)
 {
-  // create initial callerNonce
-  TPM2B_NONCE initialNonce;
+  TPMS_CAPABILITY_DATA capData;
 
-  if (session_type != TPM2_SE_POLICY)
+  if (parts & KMYTH_SNAPSHOT_PROPERTIES)
   {
-    initialNonce.size = KMYTH_DIGEST_SIZE;
-  }
-  else
-  {
-    initialNonce.size = 0;      // start with empty nonce
-  }
-  create_caller_nonce(&initialNonce);
+    // both properties are in the fixed group, so one query returns both
+    if (get_tpm2_properties(sapi_ctx,
+                            TPM2_CAP_TPM_PROPERTIES,
+                            TPM2_PT_MANUFACTURER,
+                            TPM2_PT_PCR_COUNT - TPM2_PT_MANUFACTURER + 1,
+                            &capData))
+    {
+      kmyth_log(LOG_ERR, "unable to get fixed TPM properties ... exiting");
+      return 1;
+    }
 
-  // initialize session state with "start-up" nonce values
-  //   - nonceNewer initialized to nonceCaller value just generated
-  //   - nonceOlder initialized to all-zero value of KMYTH_DIGEST_SIZE length
-  //   - nonceTPM initialized to empty nonce
-  policySession->nonceNewer.size = KMYTH_DIGEST_SIZE;
-  memset(policySession->nonceNewer.buffer, 0, KMYTH_DIGEST_SIZE);
+    bool have_manufacturer = false;
+    bool have_pcr_count = false;
+    TPML_TAGGED_TPM_PROPERTY *props = &(capData.data.tpmProperties);
 
-  if (session_type != TPM2_SE_POLICY)
-  {
-    policySession->nonceOlder.size = KMYTH_DIGEST_SIZE;
+    for (uint32_t i = 0; i < props->count; i++)
+    {
+      if (props->tpmProperty[i].property == TPM2_PT_MANUFACTURER)
+      {
+        snapshot->manufacturer = props->tpmProperty[i].value;
+        have_manufacturer = true;
+      }
+      else if (props->tpmProperty[i].property == TPM2_PT_PCR_COUNT)
+      {
+        snapshot->pcr_count = props->tpmProperty[i].value;
+        have_pcr_count = true;
+      }
+    }
+    if (!have_manufacturer || !have_pcr_count)
+    {
+      kmyth_log(LOG_ERR, "fixed TPM properties incomplete ... exiting");
+      return 1;
+    }
   }
 
-  if (rollNonces(policySession, initialNonce))
+  if (parts & KMYTH_SNAPSHOT_PERSISTENT)
   {
-    kmyth_log(LOG_ERR, "error rolling session nonces ... exiting");
-    return 1;
+    if (get_tpm2_properties(sapi_ctx,
+                            TPM2_CAP_HANDLES,
+                            TPM2_HR_PERSISTENT,
+                            TPM2_MAX_CAP_HANDLES, &capData))
+    {
+      kmyth_log(LOG_ERR, "unable to get persistent handles ... exiting");
+      return 1;
+    }
+    snapshot->persistent_handles = capData.data.handles;
   }
-  policySession->nonceTPM.size = 0;
 
-  // initiate an unbound, unsalted policy session
-  if (start_policy_auth_session(sapi_ctx, policySession, session_type))
+  if (parts & KMYTH_SNAPSHOT_SESSIONS)
   {
-    kmyth_log(LOG_ERR, "error starting policy session ... exiting");
-    return 1;
+    if (get_tpm2_properties(sapi_ctx,
+                            TPM2_CAP_HANDLES,
+                            TPM2_HR_HMAC_SESSION,
+                            TPM2_PT_ACTIVE_SESSIONS_MAX, &capData))
+    {
+      kmyth_log(LOG_ERR, "unable to get HMAC session handles ... exiting");
+      return 1;
+    }
+    snapshot->hmac_sessions = capData.data.handles;
+
+    if (get_tpm2_properties(sapi_ctx,
+                            TPM2_CAP_HANDLES,
+                            TPM2_HR_POLICY_SESSION,
+                            TPM2_PT_ACTIVE_SESSIONS_MAX, &capData))
+    {
+      kmyth_log(LOG_ERR, "unable to get policy session handles ... exiting");
+      return 1;
+    }
+    snapshot->policy_sessions = capData.data.handles;
   }
 
   return 0;
 }
 
 //############################################################################
-// start_policy_auth_session()
+// get_tpm2_snapshot()
 //############################################################################
-int start_policy_auth_session(TSS2_SYS_CONTEXT * sapi_ctx,
-                              SESSION * session, TPM2_SE session_type)
+int get_tpm2_snapshot(TSS2_SYS_CONTEXT * sapi_ctx, uint32_t parts,
+                      CAP_SNAPSHOT * snapshot)
 {
-  // assign session "type" passed in - Kmyth sessions are either:
-  //   - trial (used to compute policy digest value) - TPM2_SE_TRIAL
-  //   - policy (used for actual policy authorization) - TPM2_SE_POLICY
-  if ((session_type != TPM2_SE_TRIAL) && (session_type != TPM2_SE_POLICY))
+  if (snapshot == NULL)
   {
-    kmyth_log(LOG_ERR, "invalid session type ... exiting");
+    kmyth_log(LOG_ERR, "NULL snapshot ... exiting");
     return 1;
   }
-  if (session->nonceNewer.size != KMYTH_DIGEST_SIZE
-      || session->nonceOlder.size != KMYTH_DIGEST_SIZE)
+
+  TIMING_TCTI *tcti = get_timing_tcti(sapi_ctx);
+
+  if (tcti == NULL)
   {
-    kmyth_log(LOG_ERR, "Session nonce uninitialized ... exiting");
-    return 1;
+    return gather_tpm2_snapshot(sapi_ctx, parts, snapshot);
   }
-  session->sessionType = session_type;
 
-  // For Kmyth, the current implementation uses unbound and unsalted sessions.
-  // This results in a NULL sessionKey meaning that the HMAC key is simply the
-  // authVal for the entity being authorized.
+  uint32_t missing = parts & KMYTH_SNAPSHOT_ALL & ~tcti->snapshot_valid;
 
-  // configure algorithm parameters for session according to Kmyth defaults
-  session->symmetric.algorithm = KMYTH_SYM_PARAM_ENC_ALG;
-  if (session->symmetric.algorithm == TPM2_ALG_AES)
+  if (missing)
   {
-    session->symmetric.keyBits.aes = KMYTH_SYM_PARAM_ENC_KEY_LEN;
-    session->symmetric.mode.aes = KMYTH_SYM_PARAM_ENC_MODE;
+    if (gather_tpm2_snapshot(sapi_ctx, missing, &(tcti->snapshot)))
+    {
+      return 1;
+    }
+    tcti->snapshot_valid |= missing;
   }
-  session->authHash = KMYTH_HASH_ALG;
-  session->bind = TPM2_RH_NULL; // unbound
-  session->tpmKey = TPM2_RH_NULL; // unsalted
-  session->encryptedSalt.size = 0;  // empty encrypted salt value
-  session->sessionKey.size = 0; // empty session key
 
-  // use API call to start session - command requires no authorization
-  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
-  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
-  TPM2_RC rc = Tss2_Sys_StartAuthSession(sapi_ctx,
-                                         session->tpmKey,
-                                         session->bind,
-                                         nullCmdAuths,
-                                         &session->nonceNewer,
-                                         &session->encryptedSalt,
-                                         session->sessionType,
-                                         &session->symmetric,
-                                         session->authHash,
-                                         &session->sessionHandle,
-                                         &session->nonceTPM,
-                                         nullRspAuths);
+  *snapshot = tcti->snapshot;
 
-  if (rc != TPM2_RC_SUCCESS)
+  return 0;
+}
+
+//############################################################################
+// refresh_tpm2_snapshot()
+//############################################################################
+void refresh_tpm2_snapshot(TSS2_SYS_CONTEXT * sapi_ctx, uint32_t parts)
+{
+  TIMING_TCTI *tcti = get_timing_tcti(sapi_ctx);
+
+  if (tcti != NULL)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_StartAuthSession(): rc = 0x%08X, %s",
-              rc, getErrorString(rc));
-    return 1;
+    tcti->snapshot_valid &= ~parts;
   }
-  kmyth_log(LOG_DEBUG, "started %s session (0x%08X)",
-            session->sessionType == TPM2_SE_TRIAL ? "trial" : "policy",
-            session->sessionHandle);
+}
 
-  // Roll nonces to add the nonce just returned from the TPM to the session
-  // state (i.e., nonceTPM -> nonceNewer and  nonceCaller -> nonceOlder)
-  if (rollNonces(session, session->nonceTPM))
+//############################################################################
+// hash_object_blobs()
+//############################################################################
+static int hash_object_blobs(TPM2B_PRIVATE * in_private,
+                             TPM2B_PUBLIC * in_public, uint8_t * key)
+{
+  // the public area is hashed in its marshalled (canonical) form
+  uint8_t public_buf[sizeof(TPM2B_PUBLIC)];
+  size_t public_len = 0;
+
+  if (Tss2_MU_TPM2B_PUBLIC_Marshal(in_public, public_buf, sizeof(public_buf),
+                                   &public_len) != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "error rolling session nonces ... exiting");
     return 1;
   }
-  kmyth_log(LOG_DEBUG,
-            "rolled nonces - nonceTPM = 0x%02X..%02X is now nonceNewer",
-            session->nonceTPM.buffer[0],
-            session->nonceTPM.buffer[session->nonceTPM.size - 1]);
 
-  return 0;
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_create();
+  int retval = 1;
+
+  if (md_ctx != NULL &&
+      EVP_DigestInit_ex(md_ctx, KMYTH_OPENSSL_HASH, NULL) &&
+      EVP_DigestUpdate(md_ctx, public_buf, public_len) &&
+      EVP_DigestUpdate(md_ctx, in_private->buffer, in_private->size) &&
+      EVP_DigestFinal_ex(md_ctx, key, NULL))
+  {
+    retval = 0;
+  }
+  EVP_MD_CTX_destroy(md_ctx);
+
+  return retval;
 }
 
 //############################################################################
-// apply_policy()
+// check_context_cache_epoch()
 //############################################################################
-int apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
-                 TPM2_HANDLE policySessionHandle,
-                 TPML_PCR_SELECTION policySession_pcrList)
+static int check_context_cache_epoch(TSS2_SYS_CONTEXT * sapi_ctx,
+                                     TIMING_TCTI * tcti, bool reset)
 {
-  // Apply authorization value (AuthValue) policy command
-  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
-  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
-  TPM2_RC rc = Tss2_Sys_PolicyAuthValue(sapi_ctx,
-                                        policySessionHandle,
-                                        nullCmdAuths, nullRspAuths);
+  TPMS_TIME_INFO currentTime;
+  TSS2_RC rc = Tss2_Sys_ReadClock(sapi_ctx, NULL, &currentTime, NULL);
 
-  if (rc != TPM2_RC_SUCCESS)
+  if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR,
-              "Tss2_Sys_PolicyAuthValue(): rc = 0x%08X, %s ... exiting", rc,
+    kmyth_log(LOG_WARNING, "Tss2_Sys_ReadClock(): rc = 0x%08X, %s", rc,
               getErrorString(rc));
+    tcti->context_cache_count = 0;
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "applied AuthVal policy to session context");
-  // If the supplied PCR Selection List is not empty, supply PCR policy command
-  // (if empty, PCR criteria will not be included in the authorization policy)
-  if (policySession_pcrList.count > 0)
-  {
-    // policySession→policyDigest is extended by a call to Tss2_Sys_PolicyPCR()
-    //   - an empty (zero length) PCR digest must be passed in
-    TPM2B_DIGEST pcrEmptyDigest;
 
-    pcrEmptyDigest.size = 0;
+  uint32_t reset_count = currentTime.clockInfo.resetCount;
+  uint32_t restart_count = currentTime.clockInfo.restartCount;
 
-    rc = Tss2_Sys_PolicyPCR(sapi_ctx,
-                            policySessionHandle,
-                            nullCmdAuths,
-                            &pcrEmptyDigest,
-                            &policySession_pcrList, nullRspAuths);
-    if (rc != TPM2_RC_SUCCESS)
-    {
-      kmyth_log(LOG_ERR, "Tss2_Sys_PolicyPCR(): rc = 0x%08X, %s", rc,
-                getErrorString(rc));
-      return 1;
-    }
-    kmyth_log(LOG_DEBUG, "applied PCR policy to session context");
+  // saved contexts are lost on TPM Reset and TPM Restart, so the cache is
+  // only good for the counts it was filled under
+  if (!reset && (reset_count != tcti->context_cache_reset_count ||
+                 restart_count != tcti->context_cache_restart_count))
+  {
+    kmyth_log(LOG_DEBUG, "TPM reset/restart count changed, "
+              "dropping %zu cached object contexts",
+              tcti->context_cache_count);
+    tcti->context_cache_count = 0;
+    return 1;
   }
+  tcti->context_cache_reset_count = reset_count;
+  tcti->context_cache_restart_count = restart_count;
+
   return 0;
 }
 
 //############################################################################
-// unseal_apply_policy()
+// set_object_context_cache()
 //############################################################################
-int unseal_apply_policy(TSS2_SYS_CONTEXT * sapi_ctx,
-                        TPM2_HANDLE policySessionHandle,
-                        TPML_PCR_SELECTION policySession_pcrList,
-                        TPM2B_DIGEST policy1, TPM2B_DIGEST policy2)
+int set_object_context_cache(TSS2_SYS_CONTEXT * sapi_ctx, bool enabled)
 {
+  TIMING_TCTI *tcti = get_timing_tcti(sapi_ctx);
 
-  if (apply_policy(sapi_ctx, policySessionHandle, policySession_pcrList))
+  if (tcti == NULL)
   {
+    kmyth_log(LOG_ERR, "connection has no object context cache ... exiting");
     return 1;
   }
 
-  TPML_DIGEST pHashList = {.count = 0 };
-  for (size_t i = 0; i < 8; i++)
+  tcti->context_cache_enabled = enabled;
+  if (!enabled)
   {
-    pHashList.digests[i].size = 0;
+    tcti->context_cache_count = 0;
   }
 
-  if (policy1.size != 0 && policy2.size != 0)
-  {
-    apply_policy_or(sapi_ctx, policySessionHandle, &policy1, &policy2,
-                    &pHashList);
-  }
   return 0;
 }
 
 //############################################################################
-// apply_policy_or()
+// load_object_context_entry()
 //############################################################################
-int apply_policy_or(TSS2_SYS_CONTEXT * sapi_ctx,
-                    TPM2_HANDLE policySessionHandle, TPM2B_DIGEST * policy1,
-                    TPM2B_DIGEST * policy2, TPML_DIGEST * pHashList)
+static int load_object_context_entry(TSS2_SYS_CONTEXT * sapi_ctx,
+                                     TIMING_TCTI * tcti,
+                                     TPM2B_PRIVATE * in_private,
+                                     TPM2B_PUBLIC * in_public,
+                                     TPM2_HANDLE * object_handle)
 {
-  // Apply authorization value (AuthValue) policy command
-  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
-  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+  uint8_t key[KMYTH_DIGEST_SIZE];
 
-  // initializing all digests to empty buffers
-  for (size_t i; i < 8; i++)
+  if (tcti == NULL || tcti->context_cache_count == 0 ||
+      hash_object_blobs(in_private, in_public, key))
   {
-    pHashList->digests[0].size = 0;
+    return 1;
   }
 
-  pHashList->count = 2;
-  pHashList->digests[0] = *policy1;
-  pHashList->digests[1] = *policy2;
+  size_t i = 0;
 
-  TPM2_RC rc =
-    Tss2_Sys_PolicyOR(sapi_ctx, policySessionHandle, nullCmdAuths, pHashList,
-                      nullRspAuths);
+  while (i < tcti->context_cache_count &&
+         memcmp(tcti->context_cache[i].key, key, sizeof(key)) != 0)
+  {
+    i++;
+  }
+  if (i == tcti->context_cache_count ||
+      check_context_cache_epoch(sapi_ctx, tcti, false))
+  {
+    return 1;
+  }
 
-  if (rc != TPM2_RC_SUCCESS)
+  // take the entry out, putting it back as the most recently used if it
+  // still loads
+  OBJECT_CONTEXT_ENTRY entry = tcti->context_cache[i];
+
+  memmove(&(tcti->context_cache[i]), &(tcti->context_cache[i + 1]),
+          (tcti->context_cache_count - i - 1) * sizeof(OBJECT_CONTEXT_ENTRY));
+  tcti->context_cache_count--;
+
+  TSS2_RC rc = Tss2_Sys_ContextLoad(sapi_ctx, &(entry.context),
+                                    object_handle);
+
+  if (rc != TSS2_RC_SUCCESS)
   {
-    kmyth_log(LOG_ERR, "Tss2_Sys_PolicyOR(): rc = 0x%08X, %s", rc,
+    kmyth_log(LOG_DEBUG, "Tss2_Sys_ContextLoad(): rc = 0x%08X, %s", rc,
               getErrorString(rc));
     return 1;
   }
-  kmyth_log(LOG_DEBUG, "applied PCR policyOR to session context");
+  tcti->context_cache[tcti->context_cache_count++] = entry;
+  kmyth_log(LOG_DEBUG, "loaded cached object context (handle = 0x%08X)",
+            *object_handle);
+
   return 0;
 }
 
 //############################################################################
-// create_caller_nonce()
+// load_cached_object_context()
 //############################################################################
-int create_caller_nonce(TPM2B_NONCE * nonceOut)
+int load_cached_object_context(TSS2_SYS_CONTEXT * sapi_ctx,
+                               TPM2B_PRIVATE * in_private,
+                               TPM2B_PUBLIC * in_public,
+                               TPM2_HANDLE * object_handle)
 {
-  // use OpenSSL RAND_bytes() to generate a "unique" nonce
-  unsigned char rand_bytes[KMYTH_DIGEST_SIZE];
+  TIMING_TCTI *tcti = get_timing_tcti(sapi_ctx);
+  int retval = load_object_context_entry(sapi_ctx, tcti, in_private,
+                                         in_public, object_handle);
 
-  if (!RAND_bytes(rand_bytes, KMYTH_DIGEST_SIZE))
+  if (tcti != NULL && tcti->context_cache_enabled)
   {
-    kmyth_log(LOG_ERR, "error generating random bytes ... exiting");
+    kmyth_metrics_count_cache(KMYTH_CACHE_OBJECT_CONTEXT, retval == 0);
   }
 
-  // Put random bytes result in the TPM2B_NONCE struct passed in
-  nonceOut->size = KMYTH_DIGEST_SIZE;
-  memcpy(nonceOut->buffer, rand_bytes, KMYTH_DIGEST_SIZE);
-
-  kmyth_log(LOG_DEBUG, "nonceCaller: 0x%02X..%02X",
-            nonceOut->buffer[0], nonceOut->buffer[nonceOut->size - 1]);
-  return 0;
+  return retval;
 }
 
 //############################################################################
-// rollNonces()
+// save_object_context()
 //############################################################################
-int rollNonces(SESSION * session, TPM2B_NONCE newNonce)
+void save_object_context(TSS2_SYS_CONTEXT * sapi_ctx,
+                         TPM2B_PRIVATE * in_private,
+                         TPM2B_PUBLIC * in_public, TPM2_HANDLE object_handle)
 {
-  if (session == NULL)
+  TIMING_TCTI *tcti = get_timing_tcti(sapi_ctx);
+  OBJECT_CONTEXT_ENTRY entry;
+
+  if (tcti == NULL || !tcti->context_cache_enabled ||
+      hash_object_blobs(in_private, in_public, entry.key))
   {
-    kmyth_log(LOG_ERR, "no session ... exiting");
-    return 1;
+    return;
   }
 
-  if (newNonce.size != KMYTH_DIGEST_SIZE)
+  // an empty cache starts a new epoch (see check_context_cache_epoch())
+  if (tcti->context_cache_count == 0 &&
+      check_context_cache_epoch(sapi_ctx, tcti, true))
   {
-    kmyth_log(LOG_ERR, "Invalid newNonce size ... exiting");
-    return 1;
+    return;
   }
 
-  session->nonceOlder = session->nonceNewer;
-  session->nonceNewer = newNonce;
+  TSS2_RC rc = Tss2_Sys_ContextSave(sapi_ctx, object_handle, &(entry.context));
 
-  return 0;
+  if (rc != TSS2_RC_SUCCESS)
+  {
+    kmyth_log(LOG_DEBUG, "Tss2_Sys_ContextSave(): rc = 0x%08X, %s", rc,
+              getErrorString(rc));
+    return;
+  }
+
+  if (tcti->context_cache_count == KMYTH_OBJECT_CONTEXT_CACHE_SIZE)
+  {
+    memmove(&(tcti->context_cache[0]), &(tcti->context_cache[1]),
+            (tcti->context_cache_count - 1) * sizeof(OBJECT_CONTEXT_ENTRY));
+    tcti->context_cache_count--;
+  }
+  tcti->context_cache[tcti->context_cache_count++] = entry;
 }
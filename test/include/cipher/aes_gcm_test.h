@@ -149,4 +149,17 @@ void test_gcm_cipher_modification(void);
  */
 void test_gcm_parameter_limits(void);
 
+/**
+ * Test to verify that the AES/GCM streaming functions (aes_gcm_stream_init(),
+ * aes_gcm_stream_update(), and aes_gcm_stream_final()) interoperate with
+ * aes_gcm_encrypt() and aes_gcm_decrypt(), and detect modified data.
+ */
+void test_gcm_stream_encrypt_decrypt(void);
+
+/**
+ * Test to verify that aes_gcm_encrypt_chunk() and aes_gcm_decrypt_chunk()
+ * round trip, authenticate the additional data, and detect modified data.
+ */
+void test_gcm_chunk_encrypt_decrypt(void);
+
 #endif
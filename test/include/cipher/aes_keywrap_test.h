@@ -121,4 +121,11 @@ void test_aes_keywrap_parameters(void);
  */
 void test_aes_keywrap_vectors(void);
 
+/**
+ * Tests wrapping and unwrapping batches of keys under one key, checking
+ * the results against wrapping each key on its own, and that a single
+ * invalid input fails the whole batch.
+ */
+void test_aes_keywrap_batch(void);
+
 #endif
@@ -0,0 +1,51 @@
+/**
+ * @file  chacha20_poly1305_test.h
+ *
+ * Provides unit tests for the kmyth ChaCha20-Poly1305 cipher functionality
+ * implemented in src/cipher/chacha20_poly1305.c
+ */
+
+#ifndef CHACHA20_POLY1305_TEST_H
+#define CHACHA20_POLY1305_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/cipher/chacha20_poly1305_test.c to a test suite parameter passed
+ * in by the caller. This allows a top-level 'test-runner' application to
+ * include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the ChaCha20-Poly1305 cipher tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int chacha20_poly1305_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests decryption of a known answer vector (the RFC 8439, section 2.8.2
+ * key, nonce and plaintext, without the additional authenticated data)
+ */
+void test_chacha20_poly1305_vector(void);
+
+/**
+ * Tests that encrypted data decrypts back to the original plaintext, with
+ * both the allocating and the caller supplied buffer interfaces
+ */
+void test_chacha20_poly1305_encrypt_decrypt(void);
+
+/**
+ * Tests that modifying the key, IV, ciphertext or tag breaks decryption
+ */
+void test_chacha20_poly1305_modification(void);
+
+/**
+ * Tests the parameter checks (NULL and empty inputs, key lengths, and
+ * output buffer sizes)
+ */
+void test_chacha20_poly1305_parameter_limits(void);
+
+#endif
@@ -0,0 +1,45 @@
+/**
+ * @file  cipher_ctx_test.h
+ *
+ * Provides unit tests for the kmyth cipher context cache implemented in
+ * src/cipher/cipher_ctx.c
+ */
+
+#ifndef CIPHER_CTX_TEST_H
+#define CIPHER_CTX_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/cipher/cipher_ctx_test.c to a test suite parameter passed in by
+ * the caller. This allows a top-level 'test-runner' application to include
+ * them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the cipher context cache tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int cipher_ctx_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests for the cipher lookup in kmyth_get_evp_cipher()
+ */
+void test_kmyth_get_evp_cipher(void);
+
+/**
+ * Tests for the per-thread context caching implemented by
+ * kmyth_cipher_ctx_acquire() and kmyth_cipher_ctx_release()
+ */
+void test_kmyth_cipher_ctx_cache(void);
+
+/**
+ * Tests that cached contexts are reset properly between uses by the
+ * cipher implementations (including after a failed operation)
+ */
+void test_kmyth_cipher_ctx_reuse(void);
+
+#endif
@@ -84,6 +84,11 @@ int cipher_add_tests(CU_pSuite suite);
  */
 void test_kmyth_get_cipher_t_from_string(void);
 
+/**
+ * Tests for the host dependent cipher choice in kmyth_get_auto_cipher()
+ */
+void test_kmyth_get_auto_cipher(void);
+
 /**
  * Tests for key length parsing in get_key_len_from_cipher()
  */
@@ -99,4 +104,21 @@ void test_kmyth_encrypt_data(void);
  */
 void test_kmyth_decrypt_data(void);
 
+/**
+ * Tests for encrypting and decrypting data into caller supplied buffers in
+ * kmyth_encrypt_data_buf() and kmyth_decrypt_data_buf()
+ */
+void test_kmyth_crypt_data_buf(void);
+
+/**
+ * Tests for decrypting data in place in kmyth_decrypt_data_in_place()
+ */
+void test_kmyth_decrypt_data_in_place(void);
+
+/**
+ * Tests for encrypting and decrypting batches of data under one key in
+ * kmyth_encrypt_data_batch() and kmyth_decrypt_data_batch()
+ */
+void test_kmyth_crypt_data_batch(void);
+
 #endif
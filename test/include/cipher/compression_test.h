@@ -0,0 +1,46 @@
+/**
+ * @file  compression_test.h
+ *
+ * Provides unit tests for the kmyth compression functionality implemented
+ * in src/cipher/compression.c
+ */
+
+#ifndef COMPRESSION_TEST_H
+#define COMPRESSION_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/cipher/compression_test.c to a test suite parameter passed in by
+ * the caller. This allows a top-level 'test-runner' application to include
+ * them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the compression tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int compression_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests the compression algorithm name lookups
+ */
+void test_kmyth_compression_names(void);
+
+/**
+ * Tests that compressible data gets smaller and decompresses back to the
+ * original, and that bad compressed data is rejected
+ */
+void test_kmyth_compress_decompress(void);
+
+/**
+ * Tests that data compressed incrementally (in small pieces, into a small
+ * output buffer) decompresses back to the original, both in one piece and
+ * incrementally, and that a truncated stream is detected
+ */
+void test_kmyth_compress_stream(void);
+
+#endif
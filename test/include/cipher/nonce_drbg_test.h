@@ -0,0 +1,39 @@
+/**
+ * @file  nonce_drbg_test.h
+ *
+ * Provides unit tests for the kmyth per-thread nonce DRBGs implemented in
+ * src/cipher/nonce_drbg.c
+ */
+
+#ifndef NONCE_DRBG_TEST_H
+#define NONCE_DRBG_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/cipher/nonce_drbg_test.c to a test suite parameter passed in by
+ * the caller. This allows a top-level 'test-runner' application to include
+ * them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the nonce DRBG tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int nonce_drbg_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests for the random bytes produced by kmyth_nonce_bytes()
+ */
+void test_kmyth_nonce_bytes(void);
+
+/**
+ * Tests that different threads, and a forked child process, produce
+ * different output
+ */
+void test_kmyth_nonce_bytes_threads_fork(void);
+
+#endif
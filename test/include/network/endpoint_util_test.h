@@ -0,0 +1,54 @@
+/**
+ * @file  endpoint_util_test.h
+ *
+ * Provides unit tests for the endpoint (replicated server) utility
+ * functions implemented in src/network/endpoint_util.c
+ */
+
+#ifndef ENDPOINT_UTIL_TEST__H
+#define ENDPOINT_UTIL_TEST__H
+
+/**
+ * This function adds all of the tests contained in endpoint_util_test.c to
+ * a test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it runs
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of the
+ *                    endpoint utility tests to
+ *
+ * @return     0 on success, 1 on failure
+ */
+int endpoint_util_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests for adding endpoint addresses in endpoint_set_add()
+ */
+void test_endpoint_set_add(void);
+
+/**
+ * Tests for recording latencies in endpoint_record() and reading their
+ * percentiles in endpoint_latency()
+ */
+void test_endpoint_latency(void);
+
+/**
+ * Tests for ordering endpoints in endpoint_order()
+ */
+void test_endpoint_order(void);
+
+/**
+ * Tests for saving and loading statistics in endpoint_stats_save() and
+ * endpoint_stats_load()
+ */
+void test_endpoint_stats_file(void);
+
+/**
+ * Tests for failing over and hedging requests in endpoint_fetch()
+ */
+void test_endpoint_fetch(void);
+
+#endif
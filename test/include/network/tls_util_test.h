@@ -39,9 +39,38 @@ void test_tls_set_context(void);
  */
 void test_get_resp_from_tls_server(void);
 
+/**
+ * Tests for reading a complete KMIP message in tls_read_kmip_message()
+ */
+void test_tls_read_kmip_message(void);
+
 /**
  * Tests for getting a key from a KMIP server in get_key_from_kmip_server()
  */
 void test_get_key_from_kmip_server(void);
 
+/**
+ * Tests for saving and loading a TLS session in tls_save_session() and
+ * tls_load_session()
+ */
+void test_tls_session_file(void);
+
+/**
+ * Tests for getting, encoding and decoding a TLS session in
+ * tls_get_session(), tls_session_to_bytes() and tls_session_from_bytes()
+ */
+void test_tls_session_bytes(void);
+
+/**
+ * Tests for sharing TLS contexts in tls_context_acquire() and
+ * tls_context_cache_clear()
+ */
+void test_tls_context_cache(void);
+
+/**
+ * Tests for bounding a connection's I/O by a deadline in
+ * socket_arm_deadline() and tls_set_deadline()
+ */
+void test_socket_arm_deadline(void);
+
 #endif
@@ -0,0 +1,44 @@
+/**
+ * @file  kmyth_keyring_test.h
+ *
+ * Provides unit tests for the sealed keyring container and lookup functions
+ * implemented in src/tpm/kmyth_keyring.c
+ */
+
+#ifndef KMYTH_KEYRING_TEST_H
+#define KMYTH_KEYRING_TEST_H
+
+/**
+ * This function adds all of the tests contained in kmyth_keyring_test.c to
+ * a test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it
+ * runs.
+ *
+ * @param[out] suite  CUnit test suite function that will add all the tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+int kmyth_keyring_add_tests(CU_pSuite suite);
+
+/**
+ * Tests packing a keyring and looking its entries up, by name and by index
+ */
+void test_kmyth_keyring_pack_load(void);
+
+/**
+ * Tests that invalid entries (names and values) are rejected when packing
+ */
+void test_kmyth_keyring_pack_invalid(void);
+
+/**
+ * Tests adding entries to, and replacing entries of, a keyring
+ */
+void test_kmyth_keyring_update(void);
+
+/**
+ * Tests that a modified keyring (header, index, or value), or the wrong
+ * key, is detected
+ */
+void test_kmyth_keyring_modification(void);
+
+#endif
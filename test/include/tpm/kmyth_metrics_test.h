@@ -0,0 +1,43 @@
+/**
+ * @file  kmyth_metrics_test.h
+ *
+ * Provides unit tests for the library-wide metrics registry implemented in
+ * src/tpm/kmyth_metrics.c
+ */
+
+#ifndef KMYTH_METRICS_TEST_H
+#define KMYTH_METRICS_TEST_H
+
+/**
+ * This function adds all of the tests contained in kmyth_metrics_test.c to
+ * a test suite parameter passed in by the caller. This allows a top-level
+ * 'test-runner' application to include them in the set of tests that it
+ * runs.
+ *
+ * @param[out] suite  CUnit test suite function that will add all the tests
+ *
+ * @return     0 on success, 1 on failure
+ */
+int kmyth_metrics_add_tests(CU_pSuite suite);
+
+/**
+ * Tests counting operations, including nested ones, and their latencies
+ */
+void test_kmyth_metrics_ops(void);
+
+/**
+ * Tests the reasons failed operations are counted under
+ */
+void test_kmyth_metrics_failures(void);
+
+/**
+ * Tests the TPM command, cache lookup and cipher byte counts
+ */
+void test_kmyth_metrics_counts(void);
+
+/**
+ * Tests the Prometheus output, and accumulating it in a textfile
+ */
+void test_kmyth_metrics_export(void);
+
+#endif
@@ -26,6 +26,23 @@ int kmyth_seal_unseal_impl_add_tests(CU_pSuite suite);
 //********************************************************************************
 void test_tpm2_kmyth_seal(void);
 void test_tpm2_kmyth_unseal(void);
+void test_kmyth_ctx_seal_unseal(void);
+void test_kmyth_ctx_sk_pool(void);
+void test_kmyth_ctx_persistent_sk(void);
+void test_kmyth_ctx_object_cache(void);
+void test_kmyth_ctx_deadline(void);
+void test_kmyth_ctx_pool(void);
+void test_kmyth_async(void);
+void test_tpm2_kmyth_unseal_cache(void);
+void test_kmyth_get_ski_pcrs(void);
+void test_tpm2_kmyth_unseal_into(void);
+void test_tpm2_kmyth_seal_batch(void);
+void test_tpm2_kmyth_unseal_batch(void);
+void test_tpm2_kmyth_rewrap_batch(void);
+void test_tpm2_kmyth_seal_unseal_stream(void);
+void test_tpm2_kmyth_seal_chunked_unseal_range(void);
+void test_tpm2_kmyth_seal_chunked_parallel(void);
+void test_kmyth_ctx_seal_compressed(void);
 void test_tpm2_kmyth_seal_file(void);
 void test_tpm2_kmyth_unseal_file(void);
 void test_tpm2_kmyth_seal_data(void);
@@ -102,9 +102,16 @@ void test_marshal_unmarshal_skiObjects(void);
 void test_pack_unpack_pcr(void);
 void test_pack_unpack_public(void);
 void test_pack_unpack_private(void);
+void test_cursor_pack_view_unpack(void);
 void test_unpack_uint32_to_str(void);
 void test_parse_ski_bytes(void);
 void test_create_ski_bytes(void);
+void test_create_ski_bytes_buf(void);
+void test_create_parse_ski_header_bytes(void);
+void test_create_parse_ski_binary_bytes(void);
+void test_parse_ski_metadata(void);
+void test_get_ski_srk_name(void);
+void test_ski_compression_tag(void);
 void test_free_ski(void);
 void test_get_default_ski(void);
 void test_verifyPackUnpackDigest(void);
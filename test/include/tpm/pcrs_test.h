@@ -25,5 +25,8 @@ int pcrs_add_tests(CU_pSuite suite);
 //****************************************************************************
 void test_init_pcr_selection(void);
 void test_get_pcr_count(void);
+void test_read_pcr_values(void);
+void test_kmyth_pcr_watcher(void);
+void test_parse_pcr_value_set(void);
 
 #endif
@@ -25,11 +25,14 @@ int tpm2_interface_add_tests(CU_pSuite suite);
 //****************************************************************************
 void test_init_tpm2_connection(void);
 void test_init_tcti_abrmd(void);
+void test_init_tcti(void);
+void test_get_tpm2_command_code(void);
 void test_init_sapi(void);
 void test_free_tpm2_resources(void);
 void test_startup_tpm2(void);
 void test_get_tpm2_properties(void);
 void test_get_tpm2_impl_type(void);
+void test_get_tpm2_snapshot(void);
 void test_getErrorString(void);
 void test_init_password_cmd_auth(void);
 void test_init_policy_cmd_auth(void);
@@ -39,11 +42,17 @@ void test_compute_cpHash(void);
 void test_compute_rpHash(void);
 void test_compute_authHMAC(void);
 void test_create_policy_digest(void);
+void test_compute_policy_digest(void);
+void test_compute_policy_or_digest(void);
+void test_check_policy_digest(void);
 void test_create_policy_auth_session(void);
 void test_start_policy_auth_session(void);
+void test_acquire_policy_session(void);
 void test_apply_policy(void);
 void test_create_caller_nonce(void);
 void test_rollNonces(void);
+void test_retry_tpm2_command(void);
+void test_tpm2_deadline(void);
 void test_unseal_apply_policy(void);
 void test_apply_policy_or(void);
 
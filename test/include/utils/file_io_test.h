@@ -43,12 +43,36 @@ void test_verifyOutputFilePath(void);
  */
 void test_read_bytes_from_file(void);
 
+/**
+ * Tests for the functionality to map (or, failing that, read) the bytes of
+ * a generic file implemented in functions map_bytes_from_file() and
+ * unmap_bytes_from_file()
+ */
+void test_map_bytes_from_file(void);
+
+/**
+ * Tests for the functionality to read a list of file paths implemented in
+ * functions read_path_list() and free_path_list()
+ */
+void test_read_path_list(void);
+
 /**
  * Tests for the functionality to write bytes to a generic file implemented
  * in function write_bytes_to_file()
  */
 void test_write_bytes_to_file(void);
 
+/**
+ * Tests for replacing a file atomically in replace_file_atomically()
+ */
+void test_replace_file_atomically(void);
+
+/**
+ * Tests for writing batches of files atomically with kmyth_output_writer_t
+ * (and write_bytes_to_file_atomic())
+ */
+void test_kmyth_output_writer(void);
+
 /**
  * Tests for the functionality to print information to the STDOUT stream
  * implemented in function print_to_stdout()
@@ -0,0 +1,34 @@
+/**
+ * @file  file_loader_test.h
+ *
+ * Provides unit tests for the kmyth file loader utility function
+ * implemented in utils/src/file_loader.c
+ */
+
+#ifndef FILE_LOADER_TEST_H
+#define FILE_LOADER_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/file_loader_test.c to a test suite parameter passed
+ * in by the caller. This allows a top-level 'test-runner' application to
+ * include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the kmyth file loader utility function tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int file_loader_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests for reading many files at once, implemented in function
+ * kmyth_load_files()
+ */
+void test_kmyth_load_files(void);
+
+#endif
@@ -43,4 +43,32 @@ void test_kmyth_clear_and_free(void);
  */
 void test_secure_memset(void);
 
+/**
+ * Tests for the arena (zero filled, wiped on reset) allocation
+ * functionality implemented in functions kmyth_arena_init(),
+ * kmyth_arena_alloc(), kmyth_arena_reset(), and kmyth_arena_free()
+ */
+void test_kmyth_arena(void);
+
+/**
+ * Tests for the secure heap (zero filled, wiped on free) allocation
+ * functionality implemented in functions kmyth_secure_heap_init(),
+ * kmyth_secure_alloc() and kmyth_secure_free()
+ */
+void test_kmyth_secure_heap(void);
+
+/**
+ * Tests for the allocation counters (of an instrumented build) implemented
+ * in alloc_stats.c: the kmyth_counted_*() functions and
+ * kmyth_alloc_stats_get() / kmyth_alloc_stats_reset_peak()
+ */
+void test_kmyth_alloc_stats(void);
+
+/**
+ * Tests for the allocator hooks implemented in allocator.c: that
+ * kmyth_set_allocator() checks the hooks it is given, and that the
+ * allocation functions (and the secure heap, given secure hooks) call them
+ */
+void test_kmyth_allocator(void);
+
 #endif
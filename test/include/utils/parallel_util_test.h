@@ -0,0 +1,39 @@
+/**
+ * @file  parallel_util_test.h
+ *
+ * Provides unit tests for the kmyth worker pool utility function
+ * implemented in utils/src/parallel_util.c
+ */
+
+#ifndef PARALLEL_UTIL_TEST_H
+#define PARALLEL_UTIL_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/parallel_util_test.c to a test suite parameter passed
+ * in by the caller. This allows a top-level 'test-runner' application to
+ * include them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the kmyth worker pool utility function tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int parallel_util_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests for the worker pool functionality implemented in function
+ * kmyth_parallel_for()
+ */
+void test_kmyth_parallel_for(void);
+
+/**
+ * Tests for the pre-forked worker processes of function kmyth_prefork()
+ */
+void test_kmyth_prefork(void);
+
+#endif
@@ -0,0 +1,39 @@
+/**
+ * @file  trace_test.h
+ *
+ * Provides unit tests for the kmyth trace span utility functions
+ * implemented in utils/src/trace.c
+ */
+
+#ifndef TRACE_TEST_H
+#define TRACE_TEST_H
+
+/**
+ * This function adds all of the tests contained in
+ * test/src/utils/trace_test.c to a test suite parameter passed in by the
+ * caller. This allows a top-level 'test-runner' application to include
+ * them in the set of tests that it runs.
+ *
+ * @param[out] suite  CUnit test suite that this function will add all of
+ *                    the kmyth trace span utility function tests to.
+ *
+ * @return     0 on success, 1 on error
+ */
+int trace_add_tests(CU_pSuite suite);
+
+//****************************************************************************
+// Tests
+//****************************************************************************
+
+/**
+ * Tests that spans are only recorded with a trace file configured
+ */
+void test_kmyth_trace_disabled(void);
+
+/**
+ * Tests the OTLP/JSON written for nested spans, including the parent
+ * taken from a W3C traceparent
+ */
+void test_kmyth_span_nesting(void);
+
+#endif
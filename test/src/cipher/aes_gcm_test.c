@@ -61,6 +61,18 @@ int aes_gcm_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "Test AES/GCM streaming encryption/decryption",
+                          test_gcm_stream_encrypt_decrypt))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Test AES/GCM chunk encryption/decryption",
+                          test_gcm_chunk_encrypt_decrypt))
+  {
+    return 1;
+  }
+
   return 0;
 }
 
@@ -760,3 +772,201 @@ void test_gcm_parameter_limits(void)
   free(outData);
   free(key);
 }
+
+//----------------------------------------------------------------------------
+// test_gcm_stream_encrypt_decrypt()
+//----------------------------------------------------------------------------
+void test_gcm_stream_encrypt_decrypt(void)
+{
+  unsigned char key[32] = { 0 };
+  size_t key_len = 32;
+  size_t plaintext_len = 1000;
+  unsigned char *plaintext = calloc(plaintext_len, 1);
+  unsigned char *ciphertext = calloc(plaintext_len + GCM_IV_LEN +
+                                     GCM_TAG_LEN, 1);
+  unsigned char *oneshot = NULL;
+  unsigned char *decrypt = NULL;
+  size_t ciphertext_len = 0;
+  size_t oneshot_len = 0;
+  size_t decrypt_len = 0;
+
+  // output buffer for a single update (or final) call
+  unsigned char out[100 + GCM_IV_LEN + GCM_TAG_LEN];
+  size_t out_len = 0;
+  size_t chunk = 100;
+  void *state = NULL;
+
+  for (size_t i = 0; i < plaintext_len; i++)
+  {
+    plaintext[i] = (unsigned char) i;
+  }
+
+  // Stream encrypt in chunks, stream output must decrypt one-shot
+  CU_ASSERT(aes_gcm_stream_init(key, key_len, true, &state) == 0);
+  for (size_t i = 0; i < plaintext_len; i += chunk)
+  {
+    CU_ASSERT(aes_gcm_stream_update(state, plaintext + i, chunk, out,
+                                    &out_len) == 0);
+    memcpy(ciphertext + ciphertext_len, out, out_len);
+    ciphertext_len += out_len;
+  }
+  CU_ASSERT(aes_gcm_stream_final(state, out, &out_len) == 0);
+  memcpy(ciphertext + ciphertext_len, out, out_len);
+  ciphertext_len += out_len;
+  CU_ASSERT(ciphertext_len == plaintext_len + GCM_IV_LEN + GCM_TAG_LEN);
+  CU_ASSERT(aes_gcm_decrypt(key, key_len, ciphertext, ciphertext_len,
+                            &decrypt, &decrypt_len) == 0);
+  CU_ASSERT(decrypt_len == plaintext_len);
+  CU_ASSERT(memcmp(plaintext, decrypt, plaintext_len) == 0);
+  free(decrypt);
+  decrypt = NULL;
+
+  // One-shot encrypt, stream decrypt in chunks that split the IV and tag
+  CU_ASSERT(aes_gcm_encrypt(key, key_len, plaintext, plaintext_len,
+                            &oneshot, &oneshot_len) == 0);
+  decrypt = calloc(plaintext_len, 1);
+  decrypt_len = 0;
+  chunk = 7;
+  CU_ASSERT(aes_gcm_stream_init(key, key_len, false, &state) == 0);
+  for (size_t i = 0; i < oneshot_len; i += chunk)
+  {
+    size_t len = (oneshot_len - i < chunk) ? oneshot_len - i : chunk;
+
+    CU_ASSERT(aes_gcm_stream_update(state, oneshot + i, len, out,
+                                    &out_len) == 0);
+    CU_ASSERT(decrypt_len + out_len <= plaintext_len);
+    memcpy(decrypt + decrypt_len, out, out_len);
+    decrypt_len += out_len;
+  }
+  CU_ASSERT(aes_gcm_stream_final(state, out, &out_len) == 0);
+  CU_ASSERT(out_len == 0);
+  CU_ASSERT(decrypt_len == plaintext_len);
+  CU_ASSERT(memcmp(plaintext, decrypt, plaintext_len) == 0);
+
+  // Modified tag must fail in the final call
+  oneshot[oneshot_len - 1] ^= 0x01;
+  CU_ASSERT(aes_gcm_stream_init(key, key_len, false, &state) == 0);
+  CU_ASSERT(aes_gcm_stream_update(state, oneshot, 100, out, &out_len) == 0);
+  CU_ASSERT(aes_gcm_stream_update(state, oneshot + 100, oneshot_len - 100,
+                                  decrypt, &decrypt_len) == 0);
+  CU_ASSERT(aes_gcm_stream_final(state, out, &out_len) == 1);
+
+  // Truncated stream (too short for an IV and tag) must fail
+  CU_ASSERT(aes_gcm_stream_init(key, key_len, false, &state) == 0);
+  CU_ASSERT(aes_gcm_stream_update(state, oneshot,
+                                  GCM_IV_LEN + GCM_TAG_LEN - 1, out,
+                                  &out_len) == 0);
+  CU_ASSERT(out_len == 0);
+  CU_ASSERT(aes_gcm_stream_final(state, out, &out_len) == 1);
+
+  // Empty plaintext still produces an IV and tag
+  CU_ASSERT(aes_gcm_stream_init(key, key_len, true, &state) == 0);
+  CU_ASSERT(aes_gcm_stream_final(state, out, &out_len) == 0);
+  CU_ASSERT(out_len == GCM_IV_LEN + GCM_TAG_LEN);
+
+  // Invalid parameters
+  CU_ASSERT(aes_gcm_stream_init(NULL, key_len, true, &state) == 1);
+  CU_ASSERT(aes_gcm_stream_init(key, 0, true, &state) == 1);
+  CU_ASSERT(aes_gcm_stream_init(key, 15, true, &state) == 1);
+  CU_ASSERT(aes_gcm_stream_init(key, key_len, true, &state) == 0);
+  CU_ASSERT(aes_gcm_stream_update(state, NULL, 1, out, &out_len) == 1);
+  CU_ASSERT(aes_gcm_stream_update(state, plaintext, (size_t) INT_MAX + 1,
+                                  out, &out_len) == 1);
+  CU_ASSERT(aes_gcm_stream_final(state, out, &out_len) == 0);
+  CU_ASSERT(aes_gcm_stream_update(NULL, plaintext, 1, out, &out_len) == 1);
+  CU_ASSERT(aes_gcm_stream_final(NULL, out, &out_len) == 1);
+
+  free(plaintext);
+  free(ciphertext);
+  free(oneshot);
+  free(decrypt);
+}
+
+//----------------------------------------------------------------------------
+// test_gcm_chunk_encrypt_decrypt()
+//----------------------------------------------------------------------------
+void test_gcm_chunk_encrypt_decrypt(void)
+{
+  unsigned char key[32] = { 0 };
+  size_t key_len = 32;
+  unsigned char aad[24] = { 0 };
+  unsigned char plaintext[100];
+  unsigned char ciphertext[sizeof(plaintext) + GCM_IV_LEN + GCM_TAG_LEN];
+  unsigned char decrypt[sizeof(plaintext)];
+  unsigned char *oneshot = NULL;
+  size_t oneshot_len = 0;
+
+  for (size_t i = 0; i < sizeof(plaintext); i++)
+  {
+    plaintext[i] = (unsigned char) i;
+  }
+  aad[23] = 7;
+
+  // Round trip, with and without additional authenticated data
+  CU_ASSERT(aes_gcm_encrypt_chunk(key, key_len, aad, sizeof(aad),
+                                  plaintext, sizeof(plaintext),
+                                  ciphertext) == 0);
+  CU_ASSERT(aes_gcm_decrypt_chunk(key, key_len, aad, sizeof(aad),
+                                  ciphertext, sizeof(ciphertext),
+                                  decrypt) == 0);
+  CU_ASSERT(memcmp(decrypt, plaintext, sizeof(plaintext)) == 0);
+
+  CU_ASSERT(aes_gcm_encrypt_chunk(key, key_len, NULL, 0,
+                                  plaintext, sizeof(plaintext),
+                                  ciphertext) == 0);
+  CU_ASSERT(aes_gcm_decrypt_chunk(key, key_len, NULL, 0,
+                                  ciphertext, sizeof(ciphertext),
+                                  decrypt) == 0);
+  CU_ASSERT(memcmp(decrypt, plaintext, sizeof(plaintext)) == 0);
+
+  // Without additional authenticated data, the output is the same as that
+  // of aes_gcm_encrypt()
+  CU_ASSERT(aes_gcm_decrypt(key, key_len, ciphertext, sizeof(ciphertext),
+                            &oneshot, &oneshot_len) == 0);
+  CU_ASSERT(oneshot_len == sizeof(plaintext));
+  CU_ASSERT(memcmp(oneshot, plaintext, sizeof(plaintext)) == 0);
+  free(oneshot);
+
+  // Different additional authenticated data must not verify
+  CU_ASSERT(aes_gcm_encrypt_chunk(key, key_len, aad, sizeof(aad),
+                                  plaintext, sizeof(plaintext),
+                                  ciphertext) == 0);
+  aad[23] = 8;
+  CU_ASSERT(aes_gcm_decrypt_chunk(key, key_len, aad, sizeof(aad),
+                                  ciphertext, sizeof(ciphertext),
+                                  decrypt) == 1);
+  aad[23] = 7;
+  CU_ASSERT(aes_gcm_decrypt_chunk(key, key_len, aad, sizeof(aad) - 1,
+                                  ciphertext, sizeof(ciphertext),
+                                  decrypt) == 1);
+
+  // Modified ciphertext must not verify
+  ciphertext[GCM_IV_LEN] ^= 1;
+  CU_ASSERT(aes_gcm_decrypt_chunk(key, key_len, aad, sizeof(aad),
+                                  ciphertext, sizeof(ciphertext),
+                                  decrypt) == 1);
+  ciphertext[GCM_IV_LEN] ^= 1;
+  CU_ASSERT(aes_gcm_decrypt_chunk(key, key_len, aad, sizeof(aad),
+                                  ciphertext, sizeof(ciphertext),
+                                  decrypt) == 0);
+
+  // Invalid parameters
+  CU_ASSERT(aes_gcm_encrypt_chunk(NULL, key_len, aad, sizeof(aad),
+                                  plaintext, sizeof(plaintext),
+                                  ciphertext) == 1);
+  CU_ASSERT(aes_gcm_encrypt_chunk(key, 31, aad, sizeof(aad),
+                                  plaintext, sizeof(plaintext),
+                                  ciphertext) == 1);
+  CU_ASSERT(aes_gcm_encrypt_chunk(key, key_len, NULL, sizeof(aad),
+                                  plaintext, sizeof(plaintext),
+                                  ciphertext) == 1);
+  CU_ASSERT(aes_gcm_encrypt_chunk(key, key_len, aad, sizeof(aad),
+                                  plaintext, 0, ciphertext) == 1);
+  CU_ASSERT(aes_gcm_encrypt_chunk(key, key_len, aad, sizeof(aad),
+                                  plaintext, sizeof(plaintext), NULL) == 1);
+  CU_ASSERT(aes_gcm_decrypt_chunk(key, key_len, aad, sizeof(aad),
+                                  ciphertext, GCM_IV_LEN + GCM_TAG_LEN,
+                                  decrypt) == 1);
+  CU_ASSERT(aes_gcm_decrypt_chunk(key, key_len, aad, sizeof(aad),
+                                  NULL, sizeof(ciphertext), decrypt) == 1);
+}
@@ -40,6 +40,13 @@ int aes_keywrap_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite,
+                          "Test Kmyth AES key wrap/unwrap batches",
+                          test_aes_keywrap_batch))
+  {
+    return 1;
+  }
+
   return 0;
 }
 
@@ -562,3 +569,121 @@ void test_aes_keywrap_vectors(void)
 
   if (out != NULL) free(out);
 }
+
+//----------------------------------------------------------------------------
+// test_aes_keywrap_batch()
+//----------------------------------------------------------------------------
+void test_aes_keywrap_batch(void)
+{
+  typedef int (*single_fn) (unsigned char *, size_t, unsigned char *, size_t,
+                            unsigned char **, size_t *);
+  typedef int (*batch_fn) (unsigned char *, size_t, size_t,
+                           unsigned char **, size_t *,
+                           unsigned char **, size_t *);
+
+  single_fn wrap[] = { aes_keywrap_3394nopad_encrypt,
+    aes_keywrap_5649pad_encrypt
+  };
+  batch_fn wrap_batch[] = { aes_keywrap_3394nopad_encrypt_batch,
+    aes_keywrap_5649pad_encrypt_batch
+  };
+  batch_fn unwrap_batch[] = { aes_keywrap_3394nopad_decrypt_batch,
+    aes_keywrap_5649pad_decrypt_batch
+  };
+  size_t key_lens[] = { 16, 24, 32 };
+
+  // a keyring's worth of 32 byte data keys
+  const size_t count = 100;
+  unsigned char key[32];
+  unsigned char data[100][32];
+  unsigned char *in[100];
+  size_t in_len[100];
+  unsigned char *wrapped[100];
+  size_t wrapped_len[100];
+  unsigned char *unwrapped[100];
+  size_t unwrapped_len[100];
+
+  for (size_t i = 0; i < sizeof(key); i++)
+  {
+    key[i] = (unsigned char) (0xA5 ^ i);
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    for (size_t j = 0; j < sizeof(data[i]); j++)
+    {
+      data[i][j] = (unsigned char) (i * 31 + j);
+    }
+    in[i] = data[i];
+    in_len[i] = sizeof(data[i]);
+  }
+
+  for (size_t f = 0; f < 2; f++)
+  {
+    for (size_t k = 0; k < sizeof(key_lens) / sizeof(key_lens[0]); k++)
+    {
+      CU_ASSERT(wrap_batch[f](key, key_lens[k], count, in, in_len,
+                              wrapped, wrapped_len) == 0);
+
+      // key wrap is deterministic, so each output must match the output
+      // of wrapping that input on its own
+      for (size_t i = 0; i < count; i++)
+      {
+        unsigned char *single = NULL;
+        size_t single_len = 0;
+
+        CU_ASSERT(wrap[f](key, key_lens[k], in[i], in_len[i],
+                          &single, &single_len) == 0);
+        CU_ASSERT(wrapped_len[i] == single_len);
+        CU_ASSERT(wrapped[i] != NULL && single != NULL &&
+                  memcmp(wrapped[i], single, single_len) == 0);
+        free(single);
+      }
+
+      CU_ASSERT(unwrap_batch[f](key, key_lens[k], count,
+                                wrapped, wrapped_len,
+                                unwrapped, unwrapped_len) == 0);
+      for (size_t i = 0; i < count; i++)
+      {
+        CU_ASSERT(unwrapped_len[i] == in_len[i]);
+        CU_ASSERT(unwrapped[i] != NULL &&
+                  memcmp(unwrapped[i], in[i], in_len[i]) == 0);
+        free(unwrapped[i]);
+      }
+
+      // one input failing its integrity check fails the whole batch
+      wrapped[count / 2][3] ^= 1;
+      CU_ASSERT(unwrap_batch[f](key, key_lens[k], count,
+                                wrapped, wrapped_len,
+                                unwrapped, unwrapped_len) == 1);
+      for (size_t i = 0; i < count; i++)
+      {
+        CU_ASSERT(unwrapped[i] == NULL && unwrapped_len[i] == 0);
+        free(wrapped[i]);
+      }
+    }
+
+    // invalid parameters
+    CU_ASSERT(wrap_batch[f](NULL, 16, count, in, in_len,
+                            wrapped, wrapped_len) == 1);
+    CU_ASSERT(wrap_batch[f](key, 0, count, in, in_len,
+                            wrapped, wrapped_len) == 1);
+    CU_ASSERT(wrap_batch[f](key, 16, 0, in, in_len,
+                            wrapped, wrapped_len) == 1);
+    CU_ASSERT(wrap_batch[f](key, 16, count, NULL, in_len,
+                            wrapped, wrapped_len) == 1);
+    CU_ASSERT(wrap_batch[f](key, 16, count, in, in_len,
+                            NULL, wrapped_len) == 1);
+    CU_ASSERT(unwrap_batch[f](key, 16, count, in, in_len,
+                              unwrapped, NULL) == 1);
+
+    // an invalid input (empty) fails the whole batch
+    in_len[count - 1] = 0;
+    CU_ASSERT(wrap_batch[f](key, 16, count, in, in_len,
+                            wrapped, wrapped_len) == 1);
+    for (size_t i = 0; i < count; i++)
+    {
+      CU_ASSERT(wrapped[i] == NULL && wrapped_len[i] == 0);
+    }
+    in_len[count - 1] = sizeof(data[count - 1]);
+  }
+}
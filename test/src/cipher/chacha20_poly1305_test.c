@@ -0,0 +1,280 @@
+//############################################################################
+// chacha20_poly1305_test.c
+//
+// Tests for kmyth ChaCha20-Poly1305 functionality in
+// src/cipher/chacha20_poly1305.c
+//############################################################################
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "chacha20_poly1305_test.h"
+#include "cipher/chacha20_poly1305.h"
+
+//----------------------------------------------------------------------------
+// chacha20_poly1305_add_tests()
+//----------------------------------------------------------------------------
+int chacha20_poly1305_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "ChaCha20-Poly1305 known answer Tests",
+                          test_chacha20_poly1305_vector))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "ChaCha20-Poly1305 encrypt/decrypt Tests",
+                          test_chacha20_poly1305_encrypt_decrypt))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "ChaCha20-Poly1305 modification Tests",
+                          test_chacha20_poly1305_modification))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "ChaCha20-Poly1305 parameter limit Tests",
+                          test_chacha20_poly1305_parameter_limits))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_chacha20_poly1305_vector()
+//----------------------------------------------------------------------------
+void test_chacha20_poly1305_vector(void)
+{
+  // RFC 8439, section 2.8.2 key, nonce and plaintext - kmyth uses no AAD,
+  // so the tag differs from the one in the RFC (the ciphertext does not)
+  unsigned char key[CHACHA20_POLY1305_KEY_LEN];
+
+  for (size_t i = 0; i < sizeof(key); i++)
+  {
+    key[i] = (unsigned char) (0x80 + i);
+  }
+
+  char *plaintext = "Ladies and Gentlemen of the class of '99: If I could "
+    "offer you only one tip for the future, sunscreen would be it.";
+  size_t plaintext_len = strlen(plaintext);
+
+  // IV||ciphertext||tag
+  unsigned char input[] = {
+    0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43,
+    0x44, 0x45, 0x46, 0x47, 0xd3, 0x1a, 0x8d, 0x34,
+    0x64, 0x8e, 0x60, 0xdb, 0x7b, 0x86, 0xaf, 0xbc,
+    0x53, 0xef, 0x7e, 0xc2, 0xa4, 0xad, 0xed, 0x51,
+    0x29, 0x6e, 0x08, 0xfe, 0xa9, 0xe2, 0xb5, 0xa7,
+    0x36, 0xee, 0x62, 0xd6, 0x3d, 0xbe, 0xa4, 0x5e,
+    0x8c, 0xa9, 0x67, 0x12, 0x82, 0xfa, 0xfb, 0x69,
+    0xda, 0x92, 0x72, 0x8b, 0x1a, 0x71, 0xde, 0x0a,
+    0x9e, 0x06, 0x0b, 0x29, 0x05, 0xd6, 0xa5, 0xb6,
+    0x7e, 0xcd, 0x3b, 0x36, 0x92, 0xdd, 0xbd, 0x7f,
+    0x2d, 0x77, 0x8b, 0x8c, 0x98, 0x03, 0xae, 0xe3,
+    0x28, 0x09, 0x1b, 0x58, 0xfa, 0xb3, 0x24, 0xe4,
+    0xfa, 0xd6, 0x75, 0x94, 0x55, 0x85, 0x80, 0x8b,
+    0x48, 0x31, 0xd7, 0xbc, 0x3f, 0xf4, 0xde, 0xf0,
+    0x8e, 0x4b, 0x7a, 0x9d, 0xe5, 0x76, 0xd2, 0x65,
+    0x86, 0xce, 0xc6, 0x4b, 0x61, 0x16, 0x6a, 0x23,
+    0xa4, 0x68, 0x1f, 0xd5, 0x94, 0x56, 0xae, 0xa1,
+    0xd2, 0x9f, 0x82, 0x47, 0x72, 0x16
+  };
+
+  unsigned char *output = NULL;
+  size_t output_len = 0;
+
+  CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), input, sizeof(input),
+                                      &output, &output_len) == 0);
+  CU_ASSERT(output_len == plaintext_len);
+  CU_ASSERT(output != NULL &&
+            memcmp(output, plaintext, plaintext_len) == 0);
+  free(output);
+  output = NULL;
+
+  // the same vector, with the last tag byte altered, must fail
+  input[sizeof(input) - 1] ^= 0x1;
+  CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), input, sizeof(input),
+                                      &output, &output_len) == 1);
+  CU_ASSERT(output == NULL);
+}
+
+//----------------------------------------------------------------------------
+// test_chacha20_poly1305_encrypt_decrypt()
+//----------------------------------------------------------------------------
+void test_chacha20_poly1305_encrypt_decrypt(void)
+{
+  unsigned char key[CHACHA20_POLY1305_KEY_LEN] = { 0 };
+  unsigned char plaintext[100];
+
+  for (size_t i = 0; i < sizeof(plaintext); i++)
+  {
+    plaintext[i] = (unsigned char) i;
+  }
+
+  unsigned char *ciphertext = NULL;
+  size_t ciphertext_len = 0;
+  unsigned char *decrypt = NULL;
+  size_t decrypt_len = 0;
+
+  CU_ASSERT(chacha20_poly1305_encrypt(key, sizeof(key), plaintext,
+                                      sizeof(plaintext), &ciphertext,
+                                      &ciphertext_len) == 0);
+  CU_ASSERT(ciphertext_len == sizeof(plaintext) + CHACHA20_POLY1305_IV_LEN +
+            CHACHA20_POLY1305_TAG_LEN);
+  CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), ciphertext,
+                                      ciphertext_len, &decrypt,
+                                      &decrypt_len) == 0);
+  CU_ASSERT(decrypt_len == sizeof(plaintext));
+  CU_ASSERT(memcmp(decrypt, plaintext, sizeof(plaintext)) == 0);
+  free(decrypt);
+
+  // a second encryption uses a new IV
+  unsigned char *ciphertext2 = NULL;
+  size_t ciphertext2_len = 0;
+
+  CU_ASSERT(chacha20_poly1305_encrypt(key, sizeof(key), plaintext,
+                                      sizeof(plaintext), &ciphertext2,
+                                      &ciphertext2_len) == 0);
+  CU_ASSERT(memcmp(ciphertext, ciphertext2, CHACHA20_POLY1305_IV_LEN) != 0);
+  free(ciphertext2);
+
+  // the caller supplied buffer interface, including the size queries
+  size_t out_len = 0;
+
+  CU_ASSERT(chacha20_poly1305_encrypt_buf(key, sizeof(key), plaintext,
+                                          sizeof(plaintext), NULL, 0,
+                                          &out_len) == 0);
+  CU_ASSERT(out_len == ciphertext_len);
+  CU_ASSERT(chacha20_poly1305_decrypt_buf(key, sizeof(key), ciphertext,
+                                          ciphertext_len, NULL, 0,
+                                          &out_len) == 0);
+  CU_ASSERT(out_len == sizeof(plaintext));
+
+  unsigned char buf[sizeof(plaintext)];
+
+  CU_ASSERT(chacha20_poly1305_decrypt_buf(key, sizeof(key), ciphertext,
+                                          ciphertext_len, buf, sizeof(buf),
+                                          &out_len) == 0);
+  CU_ASSERT(out_len == sizeof(plaintext));
+  CU_ASSERT(memcmp(buf, plaintext, sizeof(plaintext)) == 0);
+
+  free(ciphertext);
+}
+
+//----------------------------------------------------------------------------
+// test_chacha20_poly1305_modification()
+//----------------------------------------------------------------------------
+void test_chacha20_poly1305_modification(void)
+{
+  unsigned char key[CHACHA20_POLY1305_KEY_LEN] = { 0 };
+  unsigned char plaintext[16] = { 0 };
+  unsigned char *ciphertext = NULL;
+  size_t ciphertext_len = 0;
+  unsigned char *decrypt = NULL;
+  size_t decrypt_len = 0;
+
+  CU_ASSERT(chacha20_poly1305_encrypt(key, sizeof(key), plaintext,
+                                      sizeof(plaintext), &ciphertext,
+                                      &ciphertext_len) == 0);
+
+  // modify a single key bit
+  key[0] ^= 0x1;
+  CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), ciphertext,
+                                      ciphertext_len, &decrypt,
+                                      &decrypt_len) == 1);
+  key[0] ^= 0x1;
+
+  // modify the first byte of the IV, ciphertext, and tag in turn
+  size_t offsets[] = { 0, CHACHA20_POLY1305_IV_LEN, ciphertext_len - 1 };
+
+  for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++)
+  {
+    ciphertext[offsets[i]] ^= 0x1;
+    CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), ciphertext,
+                                        ciphertext_len, &decrypt,
+                                        &decrypt_len) == 1);
+    CU_ASSERT(decrypt == NULL);
+    ciphertext[offsets[i]] ^= 0x1;
+  }
+
+  // truncating the input (passing the wrong length) breaks decryption
+  CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), ciphertext,
+                                      ciphertext_len - 2, &decrypt,
+                                      &decrypt_len) == 1);
+
+  // with everything restored, decryption succeeds
+  CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), ciphertext,
+                                      ciphertext_len, &decrypt,
+                                      &decrypt_len) == 0);
+  CU_ASSERT(decrypt_len == sizeof(plaintext));
+
+  free(decrypt);
+  free(ciphertext);
+}
+
+//----------------------------------------------------------------------------
+// test_chacha20_poly1305_parameter_limits()
+//----------------------------------------------------------------------------
+void test_chacha20_poly1305_parameter_limits(void)
+{
+  unsigned char key[CHACHA20_POLY1305_KEY_LEN] = { 0 };
+  unsigned char inData[CHACHA20_POLY1305_IV_LEN +
+                       CHACHA20_POLY1305_TAG_LEN] = { 0 };
+  unsigned char *outData = NULL;
+  size_t outData_len = 0;
+
+  // NULL and empty keys produce an error
+  CU_ASSERT(chacha20_poly1305_encrypt(NULL, sizeof(key), inData,
+                                      sizeof(inData), &outData,
+                                      &outData_len) == 1);
+  CU_ASSERT(chacha20_poly1305_decrypt(NULL, sizeof(key), inData,
+                                      sizeof(inData), &outData,
+                                      &outData_len) == 1);
+  CU_ASSERT(chacha20_poly1305_encrypt(key, 0, inData, sizeof(inData),
+                                      &outData, &outData_len) == 1);
+
+  // ChaCha20-Poly1305 only supports 32 byte keys
+  CU_ASSERT(chacha20_poly1305_encrypt(key, 16, inData, sizeof(inData),
+                                      &outData, &outData_len) == 1);
+  CU_ASSERT(chacha20_poly1305_encrypt(key, 24, inData, sizeof(inData),
+                                      &outData, &outData_len) == 1);
+  CU_ASSERT(outData == NULL);
+
+  // NULL input data produces an error
+  CU_ASSERT(chacha20_poly1305_encrypt(key, sizeof(key), NULL, 16,
+                                      &outData, &outData_len) == 1);
+  CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), NULL, 16,
+                                      &outData, &outData_len) == 1);
+
+  // empty plaintext encrypts to just the IV and tag, and back again
+  CU_ASSERT(chacha20_poly1305_encrypt(key, sizeof(key), inData, 0,
+                                      &outData, &outData_len) == 0);
+  CU_ASSERT(outData_len == sizeof(inData));
+  memcpy(inData, outData, sizeof(inData));
+  free(outData);
+  outData = NULL;
+  CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), inData,
+                                      sizeof(inData), &outData,
+                                      &outData_len) == 0);
+  CU_ASSERT(outData_len == 0);
+  free(outData);
+  outData = NULL;
+
+  // input too short to hold the IV and tag produces an error
+  CU_ASSERT(chacha20_poly1305_decrypt(key, sizeof(key), inData,
+                                      sizeof(inData) - 1, &outData,
+                                      &outData_len) == 1);
+
+  // a caller supplied buffer that is too small produces an error
+  unsigned char small[sizeof(inData) - 1];
+  size_t out_len = 0;
+
+  CU_ASSERT(chacha20_poly1305_encrypt_buf(key, sizeof(key), inData, 0,
+                                          small, sizeof(small),
+                                          &out_len) == 1);
+}
@@ -0,0 +1,230 @@
+//############################################################################
+// cipher_ctx_test.c
+//
+// Tests for kmyth cipher context cache functionality in
+// src/cipher/cipher_ctx.c
+//############################################################################
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "cipher_ctx_test.h"
+#include "cipher/cipher_ctx.h"
+#include "cipher/aes_gcm.h"
+#include "cipher/aes_keywrap_3394nopad.h"
+#include "cipher/aes_keywrap_5649pad.h"
+
+//----------------------------------------------------------------------------
+// cipher_ctx_add_tests()
+//----------------------------------------------------------------------------
+int cipher_ctx_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kmyth_get_evp_cipher() Tests",
+                          test_kmyth_get_evp_cipher))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Cipher context cache Tests",
+                          test_kmyth_cipher_ctx_cache))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Cipher context reuse Tests",
+                          test_kmyth_cipher_ctx_reuse))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_get_evp_cipher()
+//----------------------------------------------------------------------------
+void test_kmyth_get_evp_cipher(void)
+{
+  size_t key_lens[] = { 16, 24, 32 };
+
+  for (size_t f = 0; f < KMYTH_CIPHER_FAMILY_COUNT; f++)
+  {
+    for (size_t k = 0; k < sizeof(key_lens) / sizeof(key_lens[0]); k++)
+    {
+      const EVP_CIPHER *cipher = kmyth_get_evp_cipher(f, key_lens[k]);
+
+      // ChaCha20-Poly1305 only has a 32 byte key variant
+      if (f == KMYTH_CIPHER_CHACHA20_POLY1305 && key_lens[k] != 32)
+      {
+        CU_ASSERT(cipher == NULL);
+        continue;
+      }
+      CU_ASSERT(cipher != NULL);
+      CU_ASSERT(EVP_CIPHER_key_length(cipher) == (int) key_lens[k]);
+
+      // the same cipher is returned every time
+      CU_ASSERT(kmyth_get_evp_cipher(f, key_lens[k]) == cipher);
+    }
+  }
+
+  // invalid key lengths and cipher families
+  CU_ASSERT(kmyth_get_evp_cipher(KMYTH_CIPHER_AES_GCM, 0) == NULL);
+  CU_ASSERT(kmyth_get_evp_cipher(KMYTH_CIPHER_AES_GCM, 20) == NULL);
+  CU_ASSERT(kmyth_get_evp_cipher(KMYTH_CIPHER_FAMILY_COUNT, 32) == NULL);
+}
+
+//----------------------------------------------------------------------------
+// get the calling thread's cached context for a cipher
+//----------------------------------------------------------------------------
+static void *get_thread_ctx(void *arg)
+{
+  (void) arg;
+  EVP_CIPHER_CTX *ctx = kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_GCM, 32, 1);
+
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_GCM, 32, ctx);
+
+  return ctx;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_cipher_ctx_cache()
+//----------------------------------------------------------------------------
+void test_kmyth_cipher_ctx_cache(void)
+{
+  // invalid key lengths and cipher families
+  CU_ASSERT(kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_GCM, 0, 1) == NULL);
+  CU_ASSERT(kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_WRAP, 20, 1) == NULL);
+  CU_ASSERT(kmyth_cipher_ctx_acquire(KMYTH_CIPHER_FAMILY_COUNT, 32,
+                                     1) == NULL);
+
+  // releasing NULL is harmless
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_GCM, 32, NULL);
+
+  // a released context is handed out again, for either direction
+  EVP_CIPHER_CTX *ctx1 = kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_GCM, 32, 1);
+
+  CU_ASSERT(ctx1 != NULL);
+  CU_ASSERT(EVP_CIPHER_CTX_encrypting(ctx1) == 1);
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_GCM, 32, ctx1);
+
+  EVP_CIPHER_CTX *ctx2 = kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_GCM, 32, 0);
+
+  CU_ASSERT(ctx2 == ctx1);
+  CU_ASSERT(EVP_CIPHER_CTX_encrypting(ctx2) == 0);
+
+  // while it is in use, a different context is handed out
+  EVP_CIPHER_CTX *ctx3 = kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_GCM, 32, 1);
+
+  CU_ASSERT(ctx3 != NULL);
+  CU_ASSERT(ctx3 != ctx2);
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_GCM, 32, ctx3);
+
+  // each cipher has its own context
+  EVP_CIPHER_CTX *ctx4 = kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_GCM, 16, 1);
+
+  CU_ASSERT(ctx4 != NULL);
+  CU_ASSERT(ctx4 != ctx2);
+  CU_ASSERT(EVP_CIPHER_CTX_key_length(ctx4) == 16);
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_GCM, 16, ctx4);
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_GCM, 32, ctx2);
+
+  CU_ASSERT(kmyth_cipher_ctx_acquire(KMYTH_CIPHER_AES_GCM, 32, 1) == ctx1);
+  kmyth_cipher_ctx_release(KMYTH_CIPHER_AES_GCM, 32, ctx1);
+
+  // each thread has its own contexts
+  pthread_t thread;
+  void *thread_ctx = NULL;
+
+  CU_ASSERT(pthread_create(&thread, NULL, get_thread_ctx, NULL) == 0);
+  CU_ASSERT(pthread_join(thread, &thread_ctx) == 0);
+  CU_ASSERT(thread_ctx != NULL);
+  CU_ASSERT(thread_ctx != (void *) ctx1);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_cipher_ctx_reuse()
+//----------------------------------------------------------------------------
+void test_kmyth_cipher_ctx_reuse(void)
+{
+  unsigned char key1[32];
+  unsigned char key2[32];
+  unsigned char plaintext[64];
+
+  memset(key1, 0x11, sizeof(key1));
+  memset(key2, 0x22, sizeof(key2));
+  for (size_t i = 0; i < sizeof(plaintext); i++)
+  {
+    plaintext[i] = (unsigned char) i;
+  }
+
+  // repeated AES/GCM operations (sharing the cached contexts), with
+  // different keys, and with a failed decryption part way through
+  for (int round = 0; round < 3; round++)
+  {
+    unsigned char *ct1 = NULL;
+    unsigned char *ct2 = NULL;
+    unsigned char *pt = NULL;
+    size_t ct1_len = 0;
+    size_t ct2_len = 0;
+    size_t pt_len = 0;
+
+    CU_ASSERT(aes_gcm_encrypt(key1, 32, plaintext, sizeof(plaintext),
+                              &ct1, &ct1_len) == 0);
+    CU_ASSERT(aes_gcm_encrypt(key2, 32, plaintext, sizeof(plaintext),
+                              &ct2, &ct2_len) == 0);
+
+    // decrypting with the wrong key fails
+    CU_ASSERT(aes_gcm_decrypt(key2, 32, ct1, ct1_len, &pt, &pt_len) == 1);
+    pt = NULL;
+
+    CU_ASSERT(aes_gcm_decrypt(key1, 32, ct1, ct1_len, &pt, &pt_len) == 0);
+    CU_ASSERT(pt_len == sizeof(plaintext));
+    CU_ASSERT(pt != NULL && memcmp(pt, plaintext, sizeof(plaintext)) == 0);
+    free(pt);
+    pt = NULL;
+
+    CU_ASSERT(aes_gcm_decrypt(key2, 32, ct2, ct2_len, &pt, &pt_len) == 0);
+    CU_ASSERT(pt != NULL && memcmp(pt, plaintext, sizeof(plaintext)) == 0);
+    free(pt);
+    free(ct1);
+    free(ct2);
+  }
+
+  // the same for the key wrap ciphers
+  for (int round = 0; round < 3; round++)
+  {
+    unsigned char *ct = NULL;
+    unsigned char *pt = NULL;
+    size_t ct_len = 0;
+    size_t pt_len = 0;
+
+    CU_ASSERT(aes_keywrap_3394nopad_encrypt(key1, 32, plaintext, 32,
+                                            &ct, &ct_len) == 0);
+    CU_ASSERT(aes_keywrap_3394nopad_decrypt(key2, 32, ct, ct_len,
+                                            &pt, &pt_len) == 1);
+    pt = NULL;
+    CU_ASSERT(aes_keywrap_3394nopad_decrypt(key1, 32, ct, ct_len,
+                                            &pt, &pt_len) == 0);
+    CU_ASSERT(pt_len == 32);
+    CU_ASSERT(pt != NULL && memcmp(pt, plaintext, 32) == 0);
+    free(pt);
+    free(ct);
+
+    ct = NULL;
+    pt = NULL;
+    CU_ASSERT(aes_keywrap_5649pad_encrypt(key2, 32, plaintext, 21,
+                                          &ct, &ct_len) == 0);
+    CU_ASSERT(aes_keywrap_5649pad_decrypt(key1, 32, ct, ct_len,
+                                          &pt, &pt_len) == 1);
+    pt = NULL;
+    CU_ASSERT(aes_keywrap_5649pad_decrypt(key2, 32, ct, ct_len,
+                                          &pt, &pt_len) == 0);
+    CU_ASSERT(pt_len == 21);
+    CU_ASSERT(pt != NULL && memcmp(pt, plaintext, 21) == 0);
+    free(pt);
+    free(ct);
+  }
+}
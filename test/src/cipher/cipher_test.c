@@ -6,6 +6,7 @@
 // Tests for cipher utility functions in tpm2/src/cipher/cipher.c
 //############################################################################
 
+#include <string.h>
 #include <CUnit/CUnit.h>
 
 #include "cipher/aes_gcm.h"
@@ -52,6 +53,12 @@ int cipher_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "kmyth_get_auto_cipher() Tests",
+                          test_kmyth_get_auto_cipher))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "get_key_len_from_cipher() Tests",
                           test_get_key_len_from_cipher))
   {
@@ -70,6 +77,24 @@ int cipher_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "Caller supplied buffer cipher Tests",
+                          test_kmyth_crypt_data_buf))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_decrypt_data_in_place() Tests",
+                          test_kmyth_decrypt_data_in_place))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Batch cipher Tests",
+                          test_kmyth_crypt_data_batch))
+  {
+    return 1;
+  }
+
   return 0;
 }
 
@@ -103,6 +128,30 @@ void test_kmyth_get_cipher_t_from_string(void)
   CU_ASSERT(aes_gcm_decrypt == result.decrypt_fn);
 }
 
+//----------------------------------------------------------------------------
+// test_kmyth_get_auto_cipher()
+//----------------------------------------------------------------------------
+void test_kmyth_get_auto_cipher(void)
+{
+  // the choice is one of the two candidates, and is the same every time
+  cipher_t result = kmyth_get_auto_cipher(false);
+
+  CU_ASSERT(result.cipher_name != NULL);
+  CU_ASSERT(strcmp(result.cipher_name, KMYTH_AUTO_CIPHER_AES) == 0 ||
+            strcmp(result.cipher_name, KMYTH_AUTO_CIPHER_NO_AES) == 0);
+  CU_ASSERT(result.encrypt_fn != NULL);
+  CU_ASSERT(kmyth_get_auto_cipher(false).encrypt_fn == result.encrypt_fn);
+
+  // a streaming capable cipher is chosen when one is needed
+  result = kmyth_get_auto_cipher(true);
+  CU_ASSERT(result.cipher_name != NULL);
+  CU_ASSERT(result.stream_init_fn != NULL);
+
+  // "auto" is not itself a cipher name
+  result = kmyth_get_cipher_t_from_string(KMYTH_AUTO_CIPHER);
+  CU_ASSERT(result.cipher_name == NULL);
+}
+
 //----------------------------------------------------------------------------
 // test_get_key_len_from_cipher
 //----------------------------------------------------------------------------
@@ -427,3 +476,289 @@ void test_kmyth_decrypt_data(void)
   free(key_g);
   free(results_g);
 }
+
+//----------------------------------------------------------------------------
+// test_kmyth_crypt_data_buf()
+//----------------------------------------------------------------------------
+void test_kmyth_crypt_data_buf(void)
+{
+  char *names[] = { "AES/GCM/NoPadding/256", "AES/GCM/NoPadding/128",
+    "AES/KeyWrap/RFC3394NoPadding/256", "AES/KeyWrap/RFC5649Padding/192"
+  };
+  unsigned char data[40];
+  unsigned char enc_data[128];
+  unsigned char result[128];
+  unsigned char key[32];
+
+  for (size_t i = 0; i < sizeof(data); i++)
+  {
+    data[i] = (unsigned char) i;
+  }
+
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+  {
+    cipher_t cipher_spec = kmyth_get_cipher_t_from_string(names[i]);
+    size_t key_size = get_key_len_from_cipher(cipher_spec) / 8;
+    size_t enc_data_size = 0;
+    size_t result_size = 0;
+
+    CU_ASSERT(cipher_spec.encrypt_buf_fn != NULL);
+    CU_ASSERT(cipher_spec.decrypt_buf_fn != NULL);
+
+    // size query, then an exactly sized (stack) output buffer
+    CU_ASSERT(kmyth_encrypt_data_buf(data, sizeof(data), cipher_spec,
+                                     NULL, 0, &enc_data_size,
+                                     key, key_size) == 0);
+    CU_ASSERT(enc_data_size > sizeof(data));
+    CU_ASSERT(enc_data_size <= sizeof(enc_data));
+
+    size_t needed = enc_data_size;
+
+    CU_ASSERT(kmyth_encrypt_data_buf(data, sizeof(data), cipher_spec,
+                                     enc_data, needed - 1, &enc_data_size,
+                                     key, key_size) == 1);
+    CU_ASSERT(kmyth_encrypt_data_buf(data, sizeof(data), cipher_spec,
+                                     enc_data, needed, &enc_data_size,
+                                     key, key_size) == 0);
+    CU_ASSERT(enc_data_size == needed);
+
+    CU_ASSERT(kmyth_decrypt_data_buf(enc_data, enc_data_size, cipher_spec,
+                                     key, key_size, NULL, 0,
+                                     &result_size) == 0);
+    CU_ASSERT(result_size >= sizeof(data));
+    needed = result_size;
+
+    // the size query does not need the key
+    CU_ASSERT(kmyth_decrypt_data_buf(enc_data, enc_data_size, cipher_spec,
+                                     NULL, 0, NULL, 0, &result_size) == 0);
+    CU_ASSERT(result_size == needed);
+    CU_ASSERT(kmyth_decrypt_data_buf(enc_data, enc_data_size, cipher_spec,
+                                     key, key_size, result, needed - 1,
+                                     &result_size) == 1);
+    CU_ASSERT(kmyth_decrypt_data_buf(enc_data, enc_data_size, cipher_spec,
+                                     key, key_size, result, needed,
+                                     &result_size) == 0);
+    CU_ASSERT(result_size == sizeof(data));
+    CU_ASSERT(memcmp(result, data, sizeof(data)) == 0);
+
+    // the output is the same as that of the allocating functions
+    unsigned char *alloc_result = NULL;
+    size_t alloc_result_size = 0;
+
+    CU_ASSERT(kmyth_decrypt_data(enc_data, enc_data_size, cipher_spec,
+                                 key, key_size, &alloc_result,
+                                 &alloc_result_size) == 0);
+    CU_ASSERT(alloc_result_size == sizeof(data));
+    CU_ASSERT(alloc_result != NULL &&
+              memcmp(alloc_result, data, sizeof(data)) == 0);
+    free(alloc_result);
+
+    // a modified ciphertext must not decrypt
+    enc_data[enc_data_size - 1] ^= 1;
+    CU_ASSERT(kmyth_decrypt_data_buf(enc_data, enc_data_size, cipher_spec,
+                                     key, key_size, result, sizeof(result),
+                                     &result_size) == 1);
+
+    // invalid parameters
+    CU_ASSERT(kmyth_encrypt_data_buf(NULL, sizeof(data), cipher_spec,
+                                     enc_data, sizeof(enc_data),
+                                     &enc_data_size, key, key_size) == 1);
+    CU_ASSERT(kmyth_encrypt_data_buf(data, sizeof(data), cipher_spec,
+                                     enc_data, sizeof(enc_data),
+                                     &enc_data_size, NULL, key_size) == 1);
+    CU_ASSERT(kmyth_decrypt_data_buf(enc_data, enc_data_size, cipher_spec,
+                                     NULL, key_size, result, sizeof(result),
+                                     &result_size) == 1);
+  }
+
+  // a cipher_t without the caller supplied buffer functions
+  cipher_t cipher_spec = {.cipher_name = "AES/GCM/NoPadding/256",
+    .encrypt_fn = aes_gcm_encrypt,
+    .decrypt_fn = aes_gcm_decrypt
+  };
+  size_t size = 0;
+
+  CU_ASSERT(kmyth_encrypt_data_buf(data, sizeof(data), cipher_spec,
+                                   enc_data, sizeof(enc_data), &size,
+                                   key, 32) == 1);
+  CU_ASSERT(kmyth_decrypt_data_buf(enc_data, sizeof(enc_data), cipher_spec,
+                                   key, 32, result, sizeof(result),
+                                   &size) == 1);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_decrypt_data_in_place()
+//----------------------------------------------------------------------------
+void test_kmyth_decrypt_data_in_place(void)
+{
+  char *names[] = { "AES/GCM/NoPadding/256", "AES/GCM/NoPadding/192",
+    "AES/GCM/NoPadding/128", "ChaCha20/Poly1305/NoPadding/256"
+  };
+  unsigned char data[1000];
+
+  for (size_t i = 0; i < sizeof(data); i++)
+  {
+    data[i] = (unsigned char) (i * 7);
+  }
+
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+  {
+    cipher_t cipher_spec = kmyth_get_cipher_t_from_string(names[i]);
+    unsigned char *enc_data = NULL;
+    size_t enc_data_size = 0;
+    unsigned char key_buf[32];
+    unsigned char *key = key_buf;
+    size_t key_size = get_key_len_from_cipher(cipher_spec) / 8;
+    size_t result_size = 0;
+
+    CU_ASSERT(cipher_spec.decrypt_in_place_fn != NULL);
+    CU_ASSERT(kmyth_encrypt_data(data, sizeof(data), cipher_spec,
+                                 &enc_data, &enc_data_size,
+                                 &key, &key_size) == 0);
+
+    // a modified ciphertext must not decrypt, and leaves no plaintext
+    unsigned char *bad_data = malloc(enc_data_size);
+
+    CU_ASSERT_FATAL(bad_data != NULL);
+    memcpy(bad_data, enc_data, enc_data_size);
+    bad_data[enc_data_size / 2] ^= 1;
+    CU_ASSERT(kmyth_decrypt_data_in_place(bad_data, enc_data_size,
+                                          cipher_spec, key, key_size,
+                                          &result_size) == 1);
+    CU_ASSERT(result_size == 0);
+    CU_ASSERT(memmem(bad_data, enc_data_size, data + 100, 32) == NULL);
+    free(bad_data);
+
+    // the plaintext overwrites the start of the input buffer
+    CU_ASSERT(kmyth_decrypt_data_in_place(enc_data, enc_data_size,
+                                          cipher_spec, key, key_size,
+                                          &result_size) == 0);
+    CU_ASSERT(result_size == sizeof(data));
+    CU_ASSERT(memcmp(enc_data, data, sizeof(data)) == 0);
+
+    // invalid parameters
+    CU_ASSERT(kmyth_decrypt_data_in_place(NULL, enc_data_size, cipher_spec,
+                                          key, key_size,
+                                          &result_size) == 1);
+    CU_ASSERT(kmyth_decrypt_data_in_place(enc_data, 27, cipher_spec,
+                                          key, key_size,
+                                          &result_size) == 1);
+    CU_ASSERT(kmyth_decrypt_data_in_place(enc_data, enc_data_size,
+                                          cipher_spec, NULL, key_size,
+                                          &result_size) == 1);
+    CU_ASSERT(kmyth_decrypt_data_in_place(enc_data, enc_data_size,
+                                          cipher_spec, key, key_size,
+                                          NULL) == 1);
+
+    free(enc_data);
+  }
+
+  // ciphers that cannot decrypt in place
+  cipher_t cipher_spec =
+    kmyth_get_cipher_t_from_string("AES/KeyWrap/RFC3394NoPadding/256");
+  unsigned char buf[48] = { 0 };
+  unsigned char key[32] = { 0 };
+  size_t size = 0;
+
+  CU_ASSERT(cipher_spec.decrypt_in_place_fn == NULL);
+  CU_ASSERT(kmyth_decrypt_data_in_place(buf, sizeof(buf), cipher_spec,
+                                        key, sizeof(key), &size) == 1);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_crypt_data_batch()
+//----------------------------------------------------------------------------
+void test_kmyth_crypt_data_batch(void)
+{
+  char *names[] = { "AES/KeyWrap/RFC3394NoPadding/256",
+    "AES/KeyWrap/RFC5649Padding/128"
+  };
+  unsigned char data[10][32];
+  unsigned char *in[10];
+  size_t in_sizes[10];
+  unsigned char *enc_data[10];
+  size_t enc_data_sizes[10];
+  unsigned char *result[10];
+  size_t result_sizes[10];
+  unsigned char key_buf[32];
+
+  for (size_t i = 0; i < 10; i++)
+  {
+    memset(data[i], (int) i, sizeof(data[i]));
+    in[i] = data[i];
+    in_sizes[i] = sizeof(data[i]);
+  }
+
+  for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++)
+  {
+    cipher_t cipher_spec = kmyth_get_cipher_t_from_string(names[n]);
+    unsigned char *key = key_buf;
+    size_t key_size = get_key_len_from_cipher(cipher_spec) / 8;
+
+    CU_ASSERT(cipher_spec.encrypt_batch_fn != NULL);
+    CU_ASSERT(cipher_spec.decrypt_batch_fn != NULL);
+
+    // the batch is encrypted under one new key, and each output decrypts
+    // on its own with that key
+    CU_ASSERT(kmyth_encrypt_data_batch(10, in, in_sizes, cipher_spec,
+                                       enc_data, enc_data_sizes,
+                                       &key, &key_size) == 0);
+    for (size_t i = 0; i < 10; i++)
+    {
+      unsigned char *single = NULL;
+      size_t single_size = 0;
+
+      CU_ASSERT(kmyth_decrypt_data(enc_data[i], enc_data_sizes[i],
+                                   cipher_spec, key, key_size,
+                                   &single, &single_size) == 0);
+      CU_ASSERT(single_size == sizeof(data[i]));
+      CU_ASSERT(single != NULL &&
+                memcmp(single, data[i], sizeof(data[i])) == 0);
+      free(single);
+    }
+
+    CU_ASSERT(kmyth_decrypt_data_batch(10, enc_data, enc_data_sizes,
+                                       cipher_spec, key, key_size,
+                                       result, result_sizes) == 0);
+    for (size_t i = 0; i < 10; i++)
+    {
+      CU_ASSERT(result_sizes[i] == sizeof(data[i]));
+      CU_ASSERT(result[i] != NULL &&
+                memcmp(result[i], data[i], sizeof(data[i])) == 0);
+      free(result[i]);
+    }
+
+    // invalid parameters
+    CU_ASSERT(kmyth_encrypt_data_batch(0, in, in_sizes, cipher_spec,
+                                       enc_data, enc_data_sizes,
+                                       &key, &key_size) == 1);
+    CU_ASSERT(kmyth_encrypt_data_batch(10, in, in_sizes, cipher_spec,
+                                       enc_data, enc_data_sizes,
+                                       NULL, &key_size) == 1);
+    CU_ASSERT(kmyth_decrypt_data_batch(10, enc_data, enc_data_sizes,
+                                       cipher_spec, NULL, key_size,
+                                       result, result_sizes) == 1);
+    CU_ASSERT(kmyth_decrypt_data_batch(10, enc_data, enc_data_sizes,
+                                       cipher_spec, key, key_size,
+                                       NULL, result_sizes) == 1);
+
+    for (size_t i = 0; i < 10; i++)
+    {
+      free(enc_data[i]);
+    }
+  }
+
+  // a cipher without batch functions
+  cipher_t cipher_spec =
+    kmyth_get_cipher_t_from_string("AES/GCM/NoPadding/256");
+  unsigned char *key = key_buf;
+  size_t key_size = 32;
+
+  CU_ASSERT(cipher_spec.encrypt_batch_fn == NULL);
+  CU_ASSERT(kmyth_encrypt_data_batch(10, in, in_sizes, cipher_spec,
+                                     enc_data, enc_data_sizes,
+                                     &key, &key_size) == 1);
+  CU_ASSERT(kmyth_decrypt_data_batch(10, in, in_sizes, cipher_spec,
+                                     key, key_size,
+                                     result, result_sizes) == 1);
+}
@@ -0,0 +1,257 @@
+//############################################################################
+// compression_test.c
+//
+// Tests for kmyth compression functionality in src/cipher/compression.c
+//############################################################################
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "compression_test.h"
+#include "cipher/compression.h"
+
+//----------------------------------------------------------------------------
+// compression_add_tests()
+//----------------------------------------------------------------------------
+int compression_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Compression name Tests",
+                          test_kmyth_compression_names))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Compress/decompress Tests",
+                          test_kmyth_compress_decompress))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Compression stream Tests",
+                          test_kmyth_compress_stream))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// fill_compressible()
+//----------------------------------------------------------------------------
+static void fill_compressible(uint8_t * data, size_t data_len)
+{
+  // repetitive text, much like a configuration file
+  const char *line = "option.name = some configuration value\n";
+  size_t line_len = strlen(line);
+
+  for (size_t i = 0; i < data_len; i++)
+  {
+    data[i] = (uint8_t) line[i % line_len];
+  }
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_compression_names()
+//----------------------------------------------------------------------------
+void test_kmyth_compression_names(void)
+{
+  kmyth_compression_t compression = KMYTH_COMPRESSION_NONE;
+
+  CU_ASSERT(kmyth_get_compression_from_string(KMYTH_COMPRESSION_ZSTD_NAME,
+                                              &compression) == 0);
+  CU_ASSERT(compression == KMYTH_COMPRESSION_ZSTD);
+  CU_ASSERT(strcmp(kmyth_get_compression_name(compression),
+                   KMYTH_COMPRESSION_ZSTD_NAME) == 0);
+
+  CU_ASSERT(kmyth_get_compression_from_string(KMYTH_COMPRESSION_NONE_NAME,
+                                              &compression) == 0);
+  CU_ASSERT(compression == KMYTH_COMPRESSION_NONE);
+  CU_ASSERT(kmyth_get_compression_name(compression) == NULL);
+
+  CU_ASSERT(kmyth_get_compression_from_string("lz77", &compression) != 0);
+  CU_ASSERT(kmyth_get_compression_from_string(NULL, &compression) != 0);
+  CU_ASSERT(kmyth_get_compression_from_string("zstd", NULL) != 0);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_compress_decompress()
+//----------------------------------------------------------------------------
+void test_kmyth_compress_decompress(void)
+{
+  size_t data_len = 65536;
+  uint8_t *data = malloc(data_len);
+
+  CU_ASSERT_FATAL(data != NULL);
+  fill_compressible(data, data_len);
+
+  uint8_t *comp = NULL;
+  size_t comp_len = 0;
+  uint8_t *out = NULL;
+  size_t out_len = 0;
+
+  CU_ASSERT(kmyth_compress_data(KMYTH_COMPRESSION_ZSTD, data, data_len,
+                                &comp, &comp_len) == 0);
+  CU_ASSERT(comp != NULL && comp_len > 0 && comp_len < data_len / 10);
+
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_ZSTD, comp, comp_len,
+                                  &out, &out_len) == 0);
+  CU_ASSERT(out_len == data_len);
+  CU_ASSERT(out != NULL && memcmp(out, data, data_len) == 0);
+  free(out);
+  out = NULL;
+
+  // truncated, or trailing, data is rejected
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_ZSTD, comp, comp_len - 1,
+                                  &out, &out_len) != 0);
+  CU_ASSERT(out == NULL);
+
+  uint8_t *extended = malloc(comp_len + 1);
+
+  CU_ASSERT_FATAL(extended != NULL);
+  memcpy(extended, comp, comp_len);
+  extended[comp_len] = 0;
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_ZSTD, extended,
+                                  comp_len + 1, &out, &out_len) != 0);
+  CU_ASSERT(out == NULL);
+  free(extended);
+
+  // data that is not compressed is rejected
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_ZSTD, data, data_len,
+                                  &out, &out_len) != 0);
+  CU_ASSERT(out == NULL);
+
+  // no compression is not an algorithm, and empty inputs are rejected
+  CU_ASSERT(kmyth_compress_data(KMYTH_COMPRESSION_NONE, data, data_len,
+                                &out, &out_len) != 0);
+  CU_ASSERT(kmyth_decompress_data(KMYTH_COMPRESSION_NONE, comp, comp_len,
+                                  &out, &out_len) != 0);
+  CU_ASSERT(kmyth_compress_data(KMYTH_COMPRESSION_ZSTD, data, 0,
+                                &out, &out_len) != 0);
+  CU_ASSERT(kmyth_compress_data(KMYTH_COMPRESSION_ZSTD, NULL, data_len,
+                                &out, &out_len) != 0);
+  CU_ASSERT(out == NULL);
+
+  free(comp);
+  free(data);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_compress_stream()
+//----------------------------------------------------------------------------
+void test_kmyth_compress_stream(void)
+{
+  size_t data_len = 100000;
+  uint8_t *data = malloc(data_len);
+  size_t comp_size = data_len + 1024;
+  uint8_t *comp = malloc(comp_size);
+  uint8_t *out = malloc(data_len);
+
+  CU_ASSERT_FATAL(data != NULL && comp != NULL && out != NULL);
+  fill_compressible(data, data_len);
+
+  // compress in 1000 byte pieces, into a 64 byte output buffer
+  void *state = NULL;
+  size_t comp_len = 0;
+  size_t piece_size = 1000;
+  uint8_t buf[64];
+  bool done = false;
+
+  CU_ASSERT_FATAL(kmyth_compress_stream_init(KMYTH_COMPRESSION_ZSTD,
+                                             &state) == 0);
+  for (size_t pos = 0; pos < data_len && !done; pos += piece_size)
+  {
+    size_t piece_len = (data_len - pos < piece_size) ?
+      data_len - pos : piece_size;
+    bool end = (pos + piece_len == data_len);
+    size_t used_len = 0;
+
+    do
+    {
+      size_t used = 0;
+      size_t buf_len = 0;
+
+      CU_ASSERT_FATAL(kmyth_compress_stream_update(state, data + pos +
+                                                   used_len,
+                                                   piece_len - used_len,
+                                                   &used, end, buf,
+                                                   sizeof(buf), &buf_len,
+                                                   &done) == 0);
+      CU_ASSERT_FATAL(comp_len + buf_len <= comp_size);
+      memcpy(comp + comp_len, buf, buf_len);
+      comp_len += buf_len;
+      used_len += used;
+    }
+    while (used_len < piece_len || (end && !done));
+  }
+  kmyth_compress_stream_free(state);
+  CU_ASSERT(done);
+  CU_ASSERT(comp_len > 0 && comp_len < data_len / 10);
+
+  // decompress incrementally, one compressed byte at a time
+  size_t out_len = 0;
+
+  state = NULL;
+  done = false;
+  CU_ASSERT_FATAL(kmyth_decompress_stream_init(KMYTH_COMPRESSION_ZSTD,
+                                               &state) == 0);
+  for (size_t pos = 0; pos < comp_len; pos++)
+  {
+    size_t used_len = 0;
+    size_t buf_len = 0;
+
+    do
+    {
+      size_t used = 0;
+
+      CU_ASSERT_FATAL(kmyth_decompress_stream_update(state,
+                                                     comp + pos + used_len,
+                                                     1 - used_len, &used,
+                                                     buf, sizeof(buf),
+                                                     &buf_len, &done) == 0);
+      CU_ASSERT_FATAL(out_len + buf_len <= data_len);
+      memcpy(out + out_len, buf, buf_len);
+      out_len += buf_len;
+      used_len += used;
+    }
+    while (used_len < 1 || buf_len == sizeof(buf));
+  }
+  CU_ASSERT(done);
+  CU_ASSERT(out_len == data_len);
+  CU_ASSERT(memcmp(out, data, data_len) == 0);
+
+  // nothing may follow the end of the compressed stream
+  size_t used = 0;
+  size_t buf_len = 0;
+
+  CU_ASSERT(kmyth_decompress_stream_update(state, comp, 1, &used, buf,
+                                           sizeof(buf), &buf_len,
+                                           &done) != 0);
+  kmyth_decompress_stream_free(state);
+
+  // a truncated stream never completes
+  state = NULL;
+  done = false;
+  CU_ASSERT_FATAL(kmyth_decompress_stream_init(KMYTH_COMPRESSION_ZSTD,
+                                               &state) == 0);
+  size_t used_len = 0;
+
+  do
+  {
+    CU_ASSERT_FATAL(kmyth_decompress_stream_update(state, comp + used_len,
+                                                   comp_len - 1 - used_len,
+                                                   &used, buf, sizeof(buf),
+                                                   &buf_len, &done) == 0);
+    used_len += used;
+  }
+  while (used_len < comp_len - 1 || buf_len == sizeof(buf));
+  CU_ASSERT(!done);
+  kmyth_decompress_stream_free(state);
+
+  free(out);
+  free(comp);
+  free(data);
+}
@@ -0,0 +1,137 @@
+//############################################################################
+// nonce_drbg_test.c
+//
+// Tests for kmyth per-thread nonce DRBG functionality in
+// src/cipher/nonce_drbg.c
+//############################################################################
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <CUnit/CUnit.h>
+
+#include "nonce_drbg_test.h"
+#include "cipher/nonce_drbg.h"
+
+#define NONCE_TEST_LEN 32
+
+//----------------------------------------------------------------------------
+// nonce_drbg_add_tests()
+//----------------------------------------------------------------------------
+int nonce_drbg_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kmyth_nonce_bytes() Tests",
+                          test_kmyth_nonce_bytes))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Nonce DRBG thread and fork Tests",
+                          test_kmyth_nonce_bytes_threads_fork))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_nonce_bytes()
+//----------------------------------------------------------------------------
+void test_kmyth_nonce_bytes(void)
+{
+  unsigned char zero[NONCE_TEST_LEN] = { 0 };
+  unsigned char nonce1[NONCE_TEST_LEN] = { 0 };
+  unsigned char nonce2[NONCE_TEST_LEN] = { 0 };
+
+  // consecutive nonces differ (and are not left unwritten)
+  CU_ASSERT(kmyth_nonce_bytes(nonce1, sizeof(nonce1)) == 0);
+  CU_ASSERT(kmyth_nonce_bytes(nonce2, sizeof(nonce2)) == 0);
+  CU_ASSERT(memcmp(nonce1, zero, sizeof(zero)) != 0);
+  CU_ASSERT(memcmp(nonce1, nonce2, sizeof(nonce1)) != 0);
+
+  // a request larger than the DRBG produces at once is filled completely
+  size_t big_len = 3 * 4096 + 5;
+  unsigned char *big = calloc(1, big_len);
+
+  CU_ASSERT(big != NULL);
+  if (big != NULL)
+  {
+    CU_ASSERT(kmyth_nonce_bytes(big, big_len) == 0);
+    CU_ASSERT(memcmp(big + big_len - sizeof(zero), zero, sizeof(zero)) != 0);
+    free(big);
+  }
+
+  // nothing to write
+  CU_ASSERT(kmyth_nonce_bytes(nonce1, 0) == 0);
+  CU_ASSERT(kmyth_nonce_bytes(NULL, 0) == 0);
+  CU_ASSERT(kmyth_nonce_bytes(NULL, sizeof(nonce1)) == 1);
+}
+
+//----------------------------------------------------------------------------
+// get a nonce from a new thread's DRBG
+//----------------------------------------------------------------------------
+static void *get_thread_nonce(void *arg)
+{
+  if (kmyth_nonce_bytes((unsigned char *) arg, NONCE_TEST_LEN))
+  {
+    return arg;
+  }
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_nonce_bytes_threads_fork()
+//----------------------------------------------------------------------------
+void test_kmyth_nonce_bytes_threads_fork(void)
+{
+  unsigned char nonce[NONCE_TEST_LEN];
+  unsigned char thread_nonce[NONCE_TEST_LEN];
+  unsigned char child_nonce[NONCE_TEST_LEN];
+  void *thread_result = NULL;
+  pthread_t thread;
+
+  CU_ASSERT(kmyth_nonce_bytes(nonce, sizeof(nonce)) == 0);
+
+  // each thread has its own DRBG
+  CU_ASSERT(pthread_create(&thread, NULL, get_thread_nonce,
+                           thread_nonce) == 0);
+  CU_ASSERT(pthread_join(thread, &thread_result) == 0);
+  CU_ASSERT(thread_result == NULL);
+  CU_ASSERT(memcmp(nonce, thread_nonce, sizeof(nonce)) != 0);
+
+  // the next nonces of a parent and its forked child (whose DRBG starts
+  // as a copy of the parent's) differ
+  int fds[2];
+
+  CU_ASSERT_FATAL(pipe(fds) == 0);
+
+  pid_t pid = fork();
+
+  CU_ASSERT_FATAL(pid >= 0);
+  if (pid == 0)
+  {
+    int status = kmyth_nonce_bytes(child_nonce, sizeof(child_nonce));
+
+    if (status == 0 &&
+        write(fds[1], child_nonce, sizeof(child_nonce)) !=
+        (ssize_t) sizeof(child_nonce))
+    {
+      status = 1;
+    }
+    _exit(status);
+  }
+  close(fds[1]);
+
+  int status = 0;
+
+  CU_ASSERT(kmyth_nonce_bytes(nonce, sizeof(nonce)) == 0);
+  CU_ASSERT(read(fds[0], child_nonce, sizeof(child_nonce)) ==
+            (ssize_t) sizeof(child_nonce));
+  close(fds[0]);
+  CU_ASSERT(waitpid(pid, &status, 0) == pid);
+  CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  CU_ASSERT(memcmp(nonce, child_nonce, sizeof(nonce)) != 0);
+}
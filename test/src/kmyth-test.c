@@ -5,6 +5,7 @@
  * Incorporates the following test suites:
  *   - File I/O Utility (tests in util/file_io_test.c)
  *   - TLS Utility (tests in util/tls_util_test.c)
+ *   - Endpoint Utility (tests in network/endpoint_util_test.c)
  */
 
 #include <stdio.h>
@@ -15,17 +16,27 @@
 
 #include "file_io_test.h"
 #include "memory_util_test.h"
+#include "parallel_util_test.h"
+#include "trace_test.h"
+#include "file_loader_test.h"
 #include "object_tools_test.h"
 #include "marshalling_tools_test.h"
 #include "formatting_tools_test.h"
 #include "tls_util_test.h"
+#include "endpoint_util_test.h"
 #include "aes_gcm_test.h"
 #include "aes_keywrap_test.h"
+#include "chacha20_poly1305_test.h"
+#include "compression_test.h"
 #include "tpm2_interface_test.h"
 #include "storage_key_tools_test.h"
 #include "pcrs_test.h"
 #include "kmyth_seal_unseal_impl_test.h"
+#include "kmyth_keyring_test.h"
+#include "kmyth_metrics_test.h"
 #include "cipher_test.h"
+#include "cipher_ctx_test.h"
+#include "nonce_drbg_test.h"
 
 /**
  * Use trivial (do nothing) init_suite and clean_suite functionality
@@ -83,6 +94,54 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  // Create and configure kmyth worker pool utility test suite
+  CU_pSuite parallel_utility_test_suite = NULL;
+
+  parallel_utility_test_suite = CU_add_suite("Worker Pool Utility Test Suite",
+                                             init_suite, clean_suite);
+  if (NULL == parallel_utility_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (parallel_util_add_tests(parallel_utility_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure kmyth trace span utility test suite
+  CU_pSuite trace_test_suite = NULL;
+
+  trace_test_suite = CU_add_suite("Trace Span Utility Test Suite",
+                                  init_suite, clean_suite);
+  if (NULL == trace_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (trace_add_tests(trace_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure kmyth file loader utility test suite
+  CU_pSuite file_loader_test_suite = NULL;
+
+  file_loader_test_suite = CU_add_suite("File Loader Utility Test Suite",
+                                        init_suite, clean_suite);
+  if (NULL == file_loader_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (file_loader_add_tests(file_loader_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Create and configure storage key tools test suite
   CU_pSuite storage_key_tools_test_suite = NULL;
 
@@ -132,6 +191,37 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  CU_pSuite kmyth_keyring_test_suite = NULL;
+
+  kmyth_keyring_test_suite = CU_add_suite("Sealed Keyring Test Suite",
+                                          init_suite, clean_suite);
+  if (NULL == kmyth_keyring_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_keyring_add_tests(kmyth_keyring_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure library-wide metrics test suite
+  CU_pSuite kmyth_metrics_test_suite = NULL;
+
+  kmyth_metrics_test_suite = CU_add_suite("Library Metrics Test Suite",
+                                          init_suite, clean_suite);
+  if (NULL == kmyth_metrics_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (kmyth_metrics_add_tests(kmyth_metrics_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Create and configure utility formatting tools test suite
   CU_pSuite formatting_tools_test_suite = NULL;
 
@@ -164,6 +254,22 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  // Create and configure the endpoint utility test suite
+  CU_pSuite endpoint_utility_test_suite = NULL;
+
+  endpoint_utility_test_suite = CU_add_suite("Endpoint Utility Test Suite",
+                                             init_suite, clean_suite);
+  if (NULL == endpoint_utility_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (endpoint_util_add_tests(endpoint_utility_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Create and configure the AES/GCM cipher test suite
   CU_pSuite aes_gcm_test_suite = NULL;
 
@@ -196,6 +302,39 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  // Create and configure the ChaCha20-Poly1305 cipher test suite
+  CU_pSuite chacha20_poly1305_test_suite = NULL;
+
+  chacha20_poly1305_test_suite =
+    CU_add_suite("ChaCha20-Poly1305 Cipher Test Suite", init_suite,
+                 clean_suite);
+  if (NULL == chacha20_poly1305_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (chacha20_poly1305_add_tests(chacha20_poly1305_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure the compression test suite
+  CU_pSuite compression_test_suite = NULL;
+
+  compression_test_suite = CU_add_suite("Compression Test Suite", init_suite,
+                                        clean_suite);
+  if (NULL == compression_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (compression_add_tests(compression_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Create and configure the tpm2 interface test suite
   CU_pSuite tpm2_interface_test_suite = NULL;
 
@@ -243,6 +382,38 @@ int main(int argc, char **argv)
     return CU_get_error();
   }
 
+  // Create and configure cipher context cache test suite
+  CU_pSuite cipher_ctx_test_suite = NULL;
+
+  cipher_ctx_test_suite = CU_add_suite("Cipher Context Cache Test Suite",
+                                       init_suite, clean_suite);
+  if (NULL == cipher_ctx_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (cipher_ctx_add_tests(cipher_ctx_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Create and configure nonce DRBG test suite
+  CU_pSuite nonce_drbg_test_suite = NULL;
+
+  nonce_drbg_test_suite = CU_add_suite("Nonce DRBG Test Suite",
+                                       init_suite, clean_suite);
+  if (NULL == nonce_drbg_test_suite)
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+  if (nonce_drbg_add_tests(nonce_drbg_test_suite))
+  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   // Run tests using basic interface
   CU_basic_run_tests();
 
@@ -0,0 +1,336 @@
+//############################################################################
+// endpoint_util_test.c
+//
+// Tests for endpoint utility functions in src/network/endpoint_util.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <CUnit/CUnit.h>
+
+#include "endpoint_util_test.h"
+#include "endpoint_util.h"
+
+//----------------------------------------------------------------------------
+// endpoint_util_add_tests()
+//----------------------------------------------------------------------------
+int endpoint_util_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "endpoint_set_add() Tests",
+                          test_endpoint_set_add))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "endpoint_record()/endpoint_latency() Tests",
+                          test_endpoint_latency))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "endpoint_order() Tests",
+                          test_endpoint_order))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "endpoint_stats_save()/"
+                          "endpoint_stats_load() Tests",
+                          test_endpoint_stats_file))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "endpoint_fetch() Tests",
+                          test_endpoint_fetch))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_endpoint_set_add()
+//----------------------------------------------------------------------------
+void test_endpoint_set_add(void)
+{
+  endpoint_set set;
+
+  endpoint_set_init(&set);
+
+  // A single address, then a list (repeating it) should add each once
+  CU_ASSERT(endpoint_set_add(&set, "kmip1:5696") == 0);
+  CU_ASSERT(endpoint_set_add(&set, "kmip2:5696,kmip1:5696,kmip3:5696") == 0);
+  CU_ASSERT_FATAL(set.count == 3);
+  CU_ASSERT(strcmp(set.addresses[0], "kmip1:5696") == 0);
+  CU_ASSERT(strcmp(set.addresses[1], "kmip2:5696") == 0);
+  CU_ASSERT(strcmp(set.addresses[2], "kmip3:5696") == 0);
+
+  // Empty addresses, and a missing list, should produce an error
+  CU_ASSERT(endpoint_set_add(&set, NULL) == 1);
+  CU_ASSERT(endpoint_set_add(&set, "") == 1);
+  CU_ASSERT(endpoint_set_add(&set, "kmip4:5696,,kmip5:5696") == 1);
+  endpoint_set_free(&set);
+  CU_ASSERT(set.count == 0);
+
+  // No more than the maximum number of endpoints should be added
+  char address[32];
+
+  for (int i = 0; i < ENDPOINT_MAX_COUNT; i++)
+  {
+    snprintf(address, sizeof(address), "kmip%d:5696", i);
+    CU_ASSERT(endpoint_set_add(&set, address) == 0);
+  }
+  CU_ASSERT(endpoint_set_add(&set, "kmip1:5696") == 0);
+  CU_ASSERT(endpoint_set_add(&set, "one-too-many:5696") == 1);
+  CU_ASSERT(set.count == ENDPOINT_MAX_COUNT);
+  endpoint_set_free(&set);
+}
+
+//----------------------------------------------------------------------------
+// test_endpoint_latency()
+//----------------------------------------------------------------------------
+void test_endpoint_latency(void)
+{
+  endpoint_set set;
+
+  endpoint_set_init(&set);
+  CU_ASSERT_FATAL(endpoint_set_add(&set, "kmip:5696") == 0);
+
+  // No samples, no latency
+  CU_ASSERT(endpoint_latency(&set.stats[0], 95) == 0);
+
+  // Latencies of 1 to 20 ms should have the nearest-rank percentiles
+  for (uint64_t i = 1; i <= 20; i++)
+  {
+    endpoint_record(&set, 0, true, i * 1000);
+  }
+  CU_ASSERT(endpoint_latency(&set.stats[0], 50) == 10000);
+  CU_ASSERT(endpoint_latency(&set.stats[0], 95) == 19000);
+  CU_ASSERT(endpoint_latency(&set.stats[0], 100) == 20000);
+  CU_ASSERT(endpoint_latency(&set.stats[0], 1) == 1000);
+
+  // Failures should be counted until the next success, which resets them
+  endpoint_record(&set, 0, false, 0);
+  endpoint_record(&set, 0, false, 0);
+  CU_ASSERT(set.stats[0].failures == 2);
+  CU_ASSERT(set.stats[0].sample_count == 20);
+  endpoint_record(&set, 0, true, 1000);
+  CU_ASSERT(set.stats[0].failures == 0);
+
+  // Only the most recent samples should be kept
+  for (int i = 0; i < ENDPOINT_LATENCY_SAMPLES; i++)
+  {
+    endpoint_record(&set, 0, true, 500000);
+  }
+  CU_ASSERT(endpoint_latency(&set.stats[0], 1) == 500000);
+
+  endpoint_set_free(&set);
+}
+
+//----------------------------------------------------------------------------
+// test_endpoint_order()
+//----------------------------------------------------------------------------
+void test_endpoint_order(void)
+{
+  endpoint_set set;
+  size_t order[ENDPOINT_MAX_COUNT];
+
+  endpoint_set_init(&set);
+  CU_ASSERT_FATAL(endpoint_set_add(&set, "a:1,b:1,c:1,d:1") == 0);
+
+  // With no statistics, endpoints should be tried as given
+  endpoint_order(&set, order);
+  for (size_t i = 0; i < set.count; i++)
+  {
+    CU_ASSERT(order[i] == i);
+  }
+
+  // Faster endpoints should come first, and failing ones last
+  endpoint_record(&set, 0, true, 90000);
+  endpoint_record(&set, 1, true, 2000);
+  endpoint_record(&set, 2, true, 1000);
+  endpoint_record(&set, 2, false, 0);
+  endpoint_record(&set, 3, true, 30000);
+  endpoint_order(&set, order);
+  CU_ASSERT(order[0] == 1);
+  CU_ASSERT(order[1] == 3);
+  CU_ASSERT(order[2] == 0);
+  CU_ASSERT(order[3] == 2);
+
+  endpoint_set_free(&set);
+}
+
+//----------------------------------------------------------------------------
+// test_endpoint_stats_file()
+//----------------------------------------------------------------------------
+void test_endpoint_stats_file(void)
+{
+  char dir[] = "/tmp/kmyth_endpoint_stats_XXXXXX";
+  char path[sizeof(dir) + 16];
+  endpoint_set saved;
+  endpoint_set loaded;
+
+  CU_ASSERT_FATAL(mkdtemp(dir) != NULL);
+  snprintf(path, sizeof(path), "%s/stats", dir);
+  endpoint_set_init(&saved);
+  endpoint_set_init(&loaded);
+  CU_ASSERT_FATAL(endpoint_set_add(&saved, "a:1,b:1") == 0);
+  CU_ASSERT_FATAL(endpoint_set_add(&loaded, "c:1,b:1") == 0);
+
+  // A missing file should produce an error
+  CU_ASSERT(endpoint_stats_load(&loaded, path) == 1);
+
+  // The statistics of the endpoints in both sets should be read back (the
+  // most recent samples, in order), and others ignored
+  for (uint64_t i = 0; i < ENDPOINT_LATENCY_SAMPLES + 5; i++)
+  {
+    endpoint_record(&saved, 1, true, i);
+  }
+  endpoint_record(&saved, 1, false, 0);
+  endpoint_record(&saved, 0, true, 42);
+  CU_ASSERT(endpoint_stats_save(&saved, path) == 0);
+  CU_ASSERT(endpoint_stats_load(&loaded, path) == 0);
+  CU_ASSERT(loaded.stats[0].sample_count == 0);
+  CU_ASSERT(loaded.stats[1].failures == 1);
+  CU_ASSERT(loaded.stats[1].sample_count == ENDPOINT_LATENCY_SAMPLES);
+  CU_ASSERT(loaded.stats[1].samples[0] == 5);
+  CU_ASSERT(loaded.stats[1].samples[ENDPOINT_LATENCY_SAMPLES - 1] ==
+            ENDPOINT_LATENCY_SAMPLES + 4);
+  CU_ASSERT(endpoint_latency(&loaded.stats[1], 95) ==
+            endpoint_latency(&saved.stats[1], 95));
+
+  // A file that cannot be written should produce an error
+  char bad_path[sizeof(dir) + 16];
+
+  snprintf(bad_path, sizeof(bad_path), "%s/missing/stats", dir);
+  CU_ASSERT(endpoint_stats_save(&saved, bad_path) == 1);
+
+  unlink(path);
+  rmdir(dir);
+  endpoint_set_free(&saved);
+  endpoint_set_free(&loaded);
+}
+
+//----------------------------------------------------------------------------
+// fetch_test_request()
+//----------------------------------------------------------------------------
+// A request to a test "endpoint" named for what it does: "ok:<ms>" answers
+// (with its own name) after ms milliseconds, and "fail:<ms>" fails after
+// them
+static int fetch_test_request(char *address, void *arg, void **result)
+{
+  (void) arg;
+  char *delay = strchr(address, ':');
+
+  usleep((useconds_t) atoi(delay + 1) * 1000);
+  if (strncmp(address, "ok:", 3) != 0)
+  {
+    return 1;
+  }
+  *result = strdup(address);
+  return (*result == NULL);
+}
+
+//----------------------------------------------------------------------------
+// fetch_test_elapsed_ms()
+//----------------------------------------------------------------------------
+static long fetch_test_elapsed_ms(const struct timespec *since)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000 +
+    (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+//----------------------------------------------------------------------------
+// test_endpoint_fetch()
+//----------------------------------------------------------------------------
+void test_endpoint_fetch(void)
+{
+  endpoint_set set;
+  endpoint_policy hedge = {.hedge = true,.hedge_delay_ms = 20 };
+  void *result = NULL;
+  size_t index = 0;
+  struct timespec start;
+
+  // Invalid inputs (an empty set) should produce an error
+  endpoint_set_init(&set);
+  CU_ASSERT(endpoint_fetch(&set, NULL, fetch_test_request, free, NULL, NULL,
+                           &result, &index) == 1);
+
+  // A single endpoint should be asked directly
+  CU_ASSERT_FATAL(endpoint_set_add(&set, "ok:0") == 0);
+  CU_ASSERT(endpoint_fetch(&set, &hedge, fetch_test_request, free, NULL,
+                           NULL, &result, &index) == 0);
+  CU_ASSERT(result != NULL && strcmp(result, "ok:0") == 0);
+  CU_ASSERT(index == 0);
+  CU_ASSERT(set.stats[0].sample_count == 1);
+  free(result);
+  endpoint_set_free(&set);
+
+  // A failed request should fail over to the next endpoint, and the
+  // failure be recorded (with the argument freed)
+  char *arg = strdup("argument");
+
+  CU_ASSERT_FATAL(endpoint_set_add(&set, "fail:0,ok:0") == 0);
+  CU_ASSERT(endpoint_fetch(&set, NULL, fetch_test_request, free, arg, free,
+                           &result, &index) == 0);
+  CU_ASSERT(result != NULL && strcmp(result, "ok:0") == 0);
+  CU_ASSERT(index == 1);
+  CU_ASSERT(set.stats[0].failures == 1);
+  CU_ASSERT(set.stats[1].sample_count == 1);
+  free(result);
+
+  // The endpoint that failed should now be tried last
+  CU_ASSERT(endpoint_fetch(&set, NULL, fetch_test_request, free, NULL,
+                           NULL, &result, &index) == 0);
+  CU_ASSERT(index == 1);
+  CU_ASSERT(set.stats[0].failures == 1);
+  free(result);
+  endpoint_set_free(&set);
+
+  // Without hedging, a slow endpoint should be waited for
+  CU_ASSERT_FATAL(endpoint_set_add(&set, "ok:200,ok:0") == 0);
+  CU_ASSERT(endpoint_fetch(&set, NULL, fetch_test_request, free, NULL,
+                           NULL, &result, &index) == 0);
+  CU_ASSERT(index == 0);
+  free(result);
+  endpoint_set_free(&set);
+
+  // With hedging, the next endpoint should also be asked, and answer first,
+  // with the slow request recorded as (at least) the hedging delay
+  CU_ASSERT_FATAL(endpoint_set_add(&set, "ok:400,ok:0") == 0);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  CU_ASSERT(endpoint_fetch(&set, &hedge, fetch_test_request, free, NULL,
+                           NULL, &result, &index) == 0);
+  CU_ASSERT(fetch_test_elapsed_ms(&start) < 300);
+  CU_ASSERT(index == 1);
+  CU_ASSERT(result != NULL && strcmp(result, "ok:0") == 0);
+  CU_ASSERT(set.stats[0].sample_count == 1);
+  CU_ASSERT(set.stats[0].samples[0] >= 20000);
+  free(result);
+
+  // (and the slow endpoint then ordered last)
+  size_t order[ENDPOINT_MAX_COUNT];
+
+  endpoint_order(&set, order);
+  CU_ASSERT(order[0] == 1);
+  endpoint_set_free(&set);
+
+  // Every endpoint failing should produce an error
+  CU_ASSERT_FATAL(endpoint_set_add(&set, "fail:0,fail:10,fail:0") == 0);
+  CU_ASSERT(endpoint_fetch(&set, &hedge, fetch_test_request, free, NULL,
+                           NULL, &result, &index) == 1);
+  CU_ASSERT(result == NULL);
+  for (size_t i = 0; i < set.count; i++)
+  {
+    CU_ASSERT(set.stats[i].failures == 1);
+  }
+  endpoint_set_free(&set);
+}
@@ -4,12 +4,23 @@
 // Tests for TLS utility functions in tpm2/src/util/tls_util.c
 //############################################################################
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <CUnit/CUnit.h>
+#include <openssl/pem.h>
 #include <openssl/ssl.h>
+#include <openssl/x509.h>
 
+#include "defines.h"
+#include "memory_util.h"
 #include "tls_util_test.h"
+#include "socket_util.h"
 #include "tls_util.h"
 
 //----------------------------------------------------------------------------
@@ -35,12 +46,43 @@ int tls_util_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "tls_read_kmip_message() Tests",
+                          test_tls_read_kmip_message))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "get_key_from_kmip_server() Tests",
                           test_get_key_from_kmip_server))
   {
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "tls_save_session()/tls_load_session() "
+                          "Tests", test_tls_session_file))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "tls_session_to_bytes()/"
+                          "tls_session_from_bytes() Tests",
+                          test_tls_session_bytes))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "tls_context_acquire() Tests",
+                          test_tls_context_cache))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "socket_arm_deadline() Tests",
+                          test_socket_arm_deadline))
+  {
+    return 1;
+  }
+
   return 0;
 }
 
@@ -146,6 +188,81 @@ void test_get_resp_from_tls_server(void)
   CU_ASSERT(get_resp_from_tls_server((BIO *) NULL,
                                      message, message_length, &key, &key_size));
 
+  // No response should produce an error
+  CU_ASSERT(get_resp_from_tls_server(bio, NULL, 0, &key, &key_size));
+
+  // A response bigger than the initial receive buffer should be read whole
+  size_t resp_len = 3 * KMYTH_GETKEY_RX_BUFFER_SIZE + 5;
+  unsigned char *resp = malloc(resp_len);
+
+  for (size_t i = 0; i < resp_len; i++)
+  {
+    resp[i] = (unsigned char) i;
+  }
+  CU_ASSERT(BIO_write(bio, resp, (int) resp_len) == (int) resp_len);
+  CU_ASSERT(get_resp_from_tls_server(bio, NULL, 0, &key, &key_size) == 0);
+  CU_ASSERT(key_size == resp_len);
+  CU_ASSERT(key != NULL && memcmp(key, resp, resp_len) == 0);
+  free(key);
+  free(resp);
+
+  // Cleanup
+  BIO_free_all(bio);
+}
+
+//----------------------------------------------------------------------------
+// test_tls_read_kmip_message()
+//----------------------------------------------------------------------------
+void test_tls_read_kmip_message(void)
+{
+  BIO *bio = BIO_new(BIO_s_mem());
+  unsigned char *msg = NULL;
+  size_t msg_len = 0;
+
+  // a KMIP (TTLV) message: tag, type, length (20 bytes) and value
+  unsigned char kmip_msg[28] = { 0x42, 0x00, 0x7B, 0x01, 0x00, 0x00, 0x00,
+    0x14
+  };
+
+  for (size_t i = 8; i < sizeof(kmip_msg); i++)
+  {
+    kmip_msg[i] = (unsigned char) i;
+  }
+
+  // A null BIO or output should produce an error
+  CU_ASSERT(tls_read_kmip_message(NULL, 1024, &msg, &msg_len));
+  CU_ASSERT(tls_read_kmip_message(bio, 1024, NULL, &msg_len));
+
+  // Exactly the message should be read, however it arrives, leaving any
+  // data that follows it
+  CU_ASSERT(BIO_write(bio, kmip_msg, 5) == 5);
+  CU_ASSERT(BIO_write(bio, kmip_msg + 5, 10) == 10);
+  CU_ASSERT(BIO_write(bio, kmip_msg + 15, 13) == 13);
+  CU_ASSERT(BIO_write(bio, "next", 4) == 4);
+  CU_ASSERT(tls_read_kmip_message(bio, 1024, &msg, &msg_len) == 0);
+  CU_ASSERT(msg_len == sizeof(kmip_msg));
+  CU_ASSERT(msg != NULL && memcmp(msg, kmip_msg, sizeof(kmip_msg)) == 0);
+  CU_ASSERT(BIO_pending(bio) == 4);
+  free(msg);
+  msg = NULL;
+  CU_ASSERT(BIO_reset(bio) == 1);
+
+  // A message bigger than the maximum should produce an error
+  CU_ASSERT(BIO_write(bio, kmip_msg, sizeof(kmip_msg)) ==
+            (int) sizeof(kmip_msg));
+  CU_ASSERT(tls_read_kmip_message(bio, sizeof(kmip_msg) - 1,
+                                  &msg, &msg_len));
+  CU_ASSERT(msg == NULL);
+  CU_ASSERT(BIO_reset(bio) == 1);
+
+  // A truncated header or value should produce an error
+  CU_ASSERT(BIO_write(bio, kmip_msg, 6) == 6);
+  CU_ASSERT(tls_read_kmip_message(bio, 1024, &msg, &msg_len));
+  CU_ASSERT(BIO_reset(bio) == 1);
+  CU_ASSERT(BIO_write(bio, kmip_msg, 20) == 20);
+  CU_ASSERT(tls_read_kmip_message(bio, 1024, &msg, &msg_len));
+  CU_ASSERT(msg == NULL);
+
   // Cleanup
   BIO_free_all(bio);
 }
@@ -179,3 +296,346 @@ void test_get_key_from_kmip_server(void)
   // Cleanup
   BIO_free_all(bio);
 }
+
+//----------------------------------------------------------------------------
+// test_tls_session_file()
+//----------------------------------------------------------------------------
+void test_tls_session_file(void)
+{
+  char session_path[] = "/tmp/kmyth_tls_session_XXXXXX";
+  int fd = mkstemp(session_path);
+  SSL_SESSION *session = NULL;
+
+  CU_ASSERT_FATAL(fd != -1);
+  close(fd);
+
+  BIO *mem_bio = BIO_new(BIO_s_mem());
+
+  // Null inputs should produce an error
+  CU_ASSERT(tls_load_session(NULL, &session) == 1);
+  CU_ASSERT(tls_load_session(session_path, NULL) == 1);
+  CU_ASSERT(tls_save_session(NULL, mem_bio) == 1);
+  CU_ASSERT(tls_save_session(session_path, (BIO *) NULL) == 1);
+
+  // An empty (or missing) session file should produce an error
+  CU_ASSERT(tls_load_session(session_path, &session) == 1);
+  CU_ASSERT(session == NULL);
+
+  // A BIO without a TLS connection has no session to save
+  CU_ASSERT(tls_save_session(session_path, mem_bio) == 1);
+  BIO_free_all(mem_bio);
+
+  // A connection without a resumable session has no session to save
+  SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+  BIO *ssl_bio = BIO_new_ssl(ctx, 1);
+  SSL *ssl = NULL;
+
+  CU_ASSERT_FATAL(ssl_bio != NULL);
+  CU_ASSERT(BIO_get_ssl(ssl_bio, &ssl) > 0);
+  CU_ASSERT(tls_save_session(session_path, ssl_bio) == 1);
+
+  // A resumable session should be saved (only readable by its owner) and
+  // read back
+  SSL_SESSION *resumable = SSL_SESSION_new();
+  unsigned char id[32] = { 1 };
+  unsigned char master_key[48] = { 2 };
+  struct stat st = { 0 };
+
+  CU_ASSERT(SSL_SESSION_set_protocol_version(resumable, TLS1_2_VERSION) == 1);
+  CU_ASSERT(SSL_SESSION_set1_id(resumable, id, sizeof(id)) == 1);
+  CU_ASSERT(SSL_SESSION_set1_master_key(resumable, master_key,
+                                        sizeof(master_key)) == 1);
+  CU_ASSERT(SSL_SESSION_set_cipher(resumable,
+                                   SSL_CIPHER_find(ssl, (unsigned char *)
+                                                   "\xc0\x30")) == 1);
+  CU_ASSERT(SSL_set_session(ssl, resumable) == 1);
+  CU_ASSERT(tls_save_session(session_path, ssl_bio) == 0);
+  CU_ASSERT(stat(session_path, &st) == 0);
+  CU_ASSERT((st.st_mode & 0077) == 0);
+  CU_ASSERT(tls_load_session(session_path, &session) == 0);
+  CU_ASSERT_FATAL(session != NULL);
+
+  unsigned int loaded_id_len = 0;
+  const unsigned char *loaded_id = SSL_SESSION_get_id(session, &loaded_id_len);
+
+  CU_ASSERT(loaded_id_len == sizeof(id));
+  CU_ASSERT(memcmp(loaded_id, id, sizeof(id)) == 0);
+
+  // Cleanup
+  SSL_SESSION_free(session);
+  SSL_SESSION_free(resumable);
+  BIO_free_all(ssl_bio);
+  SSL_CTX_free(ctx);
+  unlink(session_path);
+}
+
+//----------------------------------------------------------------------------
+// test_tls_session_bytes()
+//----------------------------------------------------------------------------
+void test_tls_session_bytes(void)
+{
+  SSL_SESSION *session = NULL;
+  unsigned char *bytes = NULL;
+  size_t bytes_len = 0;
+  unsigned char garbage[16] = { 0x30, 0x0e };
+
+  // Null inputs should produce an error
+  CU_ASSERT(tls_get_session(NULL, &session) == 1);
+  CU_ASSERT(tls_session_to_bytes(NULL, &bytes, &bytes_len) == 1);
+  CU_ASSERT(tls_session_from_bytes(NULL, sizeof(garbage), &session) == 1);
+  CU_ASSERT(tls_session_from_bytes(garbage, 0, &session) == 1);
+  CU_ASSERT(tls_session_from_bytes(garbage, sizeof(garbage), NULL) == 1);
+
+  // Bytes that are not an encoded session should produce an error
+  CU_ASSERT(tls_session_from_bytes(garbage, sizeof(garbage), &session) == 1);
+  CU_ASSERT(session == NULL);
+
+  // A connection without a resumable session has no session to get
+  SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+  BIO *ssl_bio = BIO_new_ssl(ctx, 1);
+  SSL *ssl = NULL;
+
+  CU_ASSERT_FATAL(ssl_bio != NULL);
+  CU_ASSERT(BIO_get_ssl(ssl_bio, &ssl) > 0);
+  CU_ASSERT(tls_get_session(ssl_bio, &session) == 1);
+  CU_ASSERT(session == NULL);
+
+  // A resumable session should be got, encoded and decoded again, keeping
+  // how much early data it allows
+  SSL_SESSION *resumable = SSL_SESSION_new();
+  unsigned char id[32] = { 3 };
+  unsigned char master_key[48] = { 4 };
+
+  CU_ASSERT(SSL_SESSION_set_protocol_version(resumable, TLS1_2_VERSION) == 1);
+  CU_ASSERT(SSL_SESSION_set1_id(resumable, id, sizeof(id)) == 1);
+  CU_ASSERT(SSL_SESSION_set1_master_key(resumable, master_key,
+                                        sizeof(master_key)) == 1);
+  CU_ASSERT(SSL_SESSION_set_cipher(resumable,
+                                   SSL_CIPHER_find(ssl, (unsigned char *)
+                                                   "\xc0\x30")) == 1);
+  CU_ASSERT(SSL_SESSION_set_max_early_data(resumable, 1024) == 1);
+  CU_ASSERT(SSL_set_session(ssl, resumable) == 1);
+  CU_ASSERT(tls_get_session(ssl_bio, &session) == 0);
+  CU_ASSERT_FATAL(session != NULL);
+  CU_ASSERT(tls_session_to_bytes(session, &bytes, &bytes_len) == 0);
+  CU_ASSERT_FATAL(bytes != NULL);
+  CU_ASSERT(bytes_len > 0);
+  SSL_SESSION_free(session);
+  session = NULL;
+
+  CU_ASSERT(tls_session_from_bytes(bytes, bytes_len, &session) == 0);
+  CU_ASSERT_FATAL(session != NULL);
+
+  unsigned int decoded_id_len = 0;
+  const unsigned char *decoded_id = SSL_SESSION_get_id(session,
+                                                       &decoded_id_len);
+
+  CU_ASSERT(decoded_id_len == sizeof(id));
+  CU_ASSERT(memcmp(decoded_id, id, sizeof(id)) == 0);
+  CU_ASSERT(SSL_SESSION_get_max_early_data(session) == 1024);
+
+  // Truncated bytes should produce an error
+  SSL_SESSION *truncated = NULL;
+
+  CU_ASSERT(tls_session_from_bytes(bytes, bytes_len / 2, &truncated) == 1);
+  CU_ASSERT(truncated == NULL);
+
+  // A connection needs everything create_tls_connection() does
+  char address_str[] = "127.0.0.1:1";
+  char *address = address_str;
+  BIO *conn_bio = NULL;
+  SSL_CTX *conn_ctx = NULL;
+
+  CU_ASSERT(create_tls_connection_session(NULL, master_key,
+                                          sizeof(master_key), "cert", "ca",
+                                          session, true, NULL, &conn_bio,
+                                          &conn_ctx) == 1);
+  CU_ASSERT(create_tls_connection_session(&address, NULL, 0,
+                                          "cert", "ca", session, true, NULL,
+                                          &conn_bio, &conn_ctx) == 1);
+  CU_ASSERT(conn_bio == NULL);
+  CU_ASSERT(conn_ctx == NULL);
+
+  // Cleanup
+  kmyth_clear_and_free(bytes, bytes_len);
+  SSL_SESSION_free(session);
+  SSL_SESSION_free(resumable);
+  BIO_free_all(ssl_bio);
+  SSL_CTX_free(ctx);
+}
+
+//----------------------------------------------------------------------------
+// create_test_credentials()
+//----------------------------------------------------------------------------
+static int create_test_credentials(unsigned char **key_pem,
+                                   size_t *key_pem_len, char *cert_path)
+{
+  // a throwaway (P-256) key, and a self-signed certificate for it, which
+  // also serves as the CA certificate
+  EVP_PKEY *key = EVP_PKEY_new();
+  EC_KEY *ec_key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+  X509 *cert = X509_new();
+  BIO *key_bio = BIO_new(BIO_s_mem());
+  int fd = mkstemp(cert_path);
+  FILE *cert_file = (fd == -1) ? NULL : fdopen(fd, "w");
+  int retval = 1;
+
+  if (key != NULL && ec_key != NULL && cert != NULL && key_bio != NULL &&
+      cert_file != NULL && EC_KEY_generate_key(ec_key) == 1 &&
+      EVP_PKEY_assign_EC_KEY(key, ec_key) == 1)
+  {
+    ec_key = NULL;              // now owned by key
+    X509_NAME *name = X509_get_subject_name(cert);
+
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               (unsigned char *) "kmyth test", -1, -1, 0);
+    if (X509_set_issuer_name(cert, name) == 1 &&
+        X509_set_pubkey(cert, key) == 1 &&
+        X509_sign(cert, key, EVP_sha256()) > 0 &&
+        PEM_write_X509(cert_file, cert) == 1 &&
+        PEM_write_bio_PrivateKey(key_bio, key, NULL, NULL, 0, NULL,
+                                 NULL) == 1)
+    {
+      char *data = NULL;
+      long data_len = BIO_get_mem_data(key_bio, &data);
+
+      *key_pem = malloc((size_t) data_len);
+      if (*key_pem != NULL)
+      {
+        memcpy(*key_pem, data, (size_t) data_len);
+        *key_pem_len = (size_t) data_len;
+        retval = 0;
+      }
+    }
+  }
+
+  if (cert_file != NULL)
+  {
+    fclose(cert_file);
+  }
+  else if (fd != -1)
+  {
+    close(fd);
+  }
+  BIO_free_all(key_bio);
+  X509_free(cert);
+  EC_KEY_free(ec_key);
+  EVP_PKEY_free(key);
+
+  return retval;
+}
+
+//----------------------------------------------------------------------------
+// test_tls_context_cache()
+//----------------------------------------------------------------------------
+void test_tls_context_cache(void)
+{
+  char cert_path[] = "/tmp/kmyth_tls_cert_XXXXXX";
+  char other_cert_path[] = "/tmp/kmyth_tls_cert_XXXXXX";
+  unsigned char *key = NULL;
+  size_t key_len = 0;
+  unsigned char *other_key = NULL;
+  size_t other_key_len = 0;
+  SSL_CTX *ctx = NULL;
+  SSL_CTX *shared_ctx = NULL;
+  SSL_CTX *other_ctx = NULL;
+
+  // Invalid inputs should produce an error
+  CU_ASSERT(tls_context_acquire(NULL, 1, cert_path, cert_path, &ctx) == 1);
+  CU_ASSERT(tls_context_acquire((unsigned char *) cert_path, 1, cert_path,
+                                cert_path, NULL) == 1);
+
+  CU_ASSERT_FATAL(create_test_credentials(&key, &key_len, cert_path) == 0);
+  CU_ASSERT_FATAL(create_test_credentials(&other_key, &other_key_len,
+                                          other_cert_path) == 0);
+
+  // The same key and certificates should share one context
+  CU_ASSERT(tls_context_acquire(key, key_len, cert_path, cert_path,
+                                &ctx) == 0);
+  CU_ASSERT(tls_context_acquire(key, key_len, cert_path, cert_path,
+                                &shared_ctx) == 0);
+  CU_ASSERT(ctx != NULL && ctx == shared_ctx);
+
+  // A different key (and certificates) should get its own context
+  CU_ASSERT(tls_context_acquire(other_key, other_key_len, other_cert_path,
+                                other_cert_path, &other_ctx) == 0);
+  CU_ASSERT(other_ctx != NULL && other_ctx != ctx);
+  tls_context_release(other_ctx);
+
+  // A released context stays usable by its other holders, and a cleared
+  // cache builds a new context
+  tls_context_release(shared_ctx);
+  tls_context_cache_clear();
+  CU_ASSERT(SSL_CTX_check_private_key(ctx) == 1);
+  CU_ASSERT(tls_context_acquire(key, key_len, cert_path, cert_path,
+                                &shared_ctx) == 0);
+  CU_ASSERT(shared_ctx != NULL);
+  tls_context_release(shared_ctx);
+  tls_context_release(ctx);
+
+  // A key that does not match the certificate should produce an error
+  CU_ASSERT(tls_context_acquire(other_key, other_key_len, cert_path,
+                                cert_path, &ctx) == 1);
+
+  tls_context_cache_clear();
+  unlink(cert_path);
+  unlink(other_cert_path);
+  free(key);
+  free(other_key);
+}
+
+//----------------------------------------------------------------------------
+// test_socket_arm_deadline()
+//----------------------------------------------------------------------------
+void test_socket_arm_deadline(void)
+{
+  int fds[2];
+  struct timespec now;
+  struct timeval timeout;
+  socklen_t timeout_len = sizeof(timeout);
+  socket_options opts = {.io_timeout_ms = 1000 };
+
+  CU_ASSERT_FATAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  uint64_t now_ns = (uint64_t) now.tv_sec * 1000000000ULL +
+    (uint64_t) now.tv_nsec;
+
+  // Without a deadline, the I/O timeout is used as is
+  CU_ASSERT(socket_arm_deadline(fds[0], &opts) == 0);
+  CU_ASSERT(getsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                       &timeout_len) == 0);
+  CU_ASSERT(timeout.tv_sec == 1 && timeout.tv_usec == 0);
+
+  // A nearer deadline cuts it short
+  opts.deadline_ns = now_ns + 100000000ULL;
+  CU_ASSERT(socket_arm_deadline(fds[0], &opts) == 0);
+  CU_ASSERT(getsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                       &timeout_len) == 0);
+  CU_ASSERT(timeout.tv_sec == 0 && timeout.tv_usec > 0 &&
+            timeout.tv_usec <= 100000);
+
+  // ... so a read with nothing to read gives up by the deadline
+  char buf[1];
+
+  CU_ASSERT(recv(fds[0], buf, sizeof(buf), 0) == -1);
+  CU_ASSERT(errno == EAGAIN || errno == EWOULDBLOCK);
+
+  // Once the deadline has passed, nothing is armed
+  CU_ASSERT(socket_arm_deadline(fds[0], &opts) == 1);
+  CU_ASSERT(errno == ETIMEDOUT);
+
+  close(fds[0]);
+  close(fds[1]);
+
+  // A deadline can be cleared on any BIO, but only set on a TLS connection
+  BIO *bio = BIO_new(BIO_s_mem());
+
+  CU_ASSERT(tls_set_deadline(NULL, 0) == 1);
+  CU_ASSERT(tls_set_deadline(bio, 0) == 0);
+  CU_ASSERT(tls_set_deadline(bio, now_ns) == 1);
+  BIO_free(bio);
+}
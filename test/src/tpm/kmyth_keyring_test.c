@@ -0,0 +1,345 @@
+//############################################################################
+// kmyth_keyring_test.c
+//
+// Tests for the sealed keyring functions in src/tpm/kmyth_keyring.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "kmyth_keyring.h"
+#include "kmyth_keyring_test.h"
+
+#include "cipher/aes_gcm.h"
+
+//----------------------------------------------------------------------------
+// kmyth_keyring_add_tests()
+//----------------------------------------------------------------------------
+int kmyth_keyring_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Keyring pack/lookup Tests",
+                          test_kmyth_keyring_pack_load))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Keyring invalid entry Tests",
+                          test_kmyth_keyring_pack_invalid))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Keyring update Tests",
+                          test_kmyth_keyring_update))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Keyring modification Tests",
+                          test_kmyth_keyring_modification))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_keyring_pack_load()
+//----------------------------------------------------------------------------
+void test_kmyth_keyring_pack_load(void)
+{
+  uint8_t key[32] = { 0 };
+  char name_buf[60][16];
+  const char *names[60];
+  uint8_t value_buf[60][32];
+  uint8_t *values[60];
+  size_t value_lens[60];
+
+  // 60 data keys, given out of name order
+  for (size_t i = 0; i < 60; i++)
+  {
+    snprintf(name_buf[i], sizeof(name_buf[i]), "key-%02zu", (i * 7) % 60);
+    names[i] = name_buf[i];
+    memset(value_buf[i], (int) ((i * 7) % 60), sizeof(value_buf[i]));
+    values[i] = value_buf[i];
+    value_lens[i] = (i == 0) ? 1 : sizeof(value_buf[i]);
+  }
+
+  uint8_t *data = NULL;
+  size_t data_size = 0;
+
+  CU_ASSERT_FATAL(kmyth_keyring_pack(key, sizeof(key), 60, names, values,
+                                     value_lens, &data, &data_size) == 0);
+  CU_ASSERT(is_keyring_data(data, data_size));
+
+  kmyth_keyring_t *keyring = NULL;
+
+  CU_ASSERT_FATAL(kmyth_keyring_load(key, sizeof(key), data, data_size,
+                                     &keyring) == 0);
+  CU_ASSERT(kmyth_keyring_count(keyring) == 60);
+  CU_ASSERT(kmyth_keyring_count(NULL) == 0);
+
+  // iteration is in name order
+  for (size_t i = 0; i < 60; i++)
+  {
+    char expected[16];
+
+    snprintf(expected, sizeof(expected), "key-%02zu", i);
+    CU_ASSERT(kmyth_keyring_name(keyring, i) != NULL &&
+              strcmp(kmyth_keyring_name(keyring, i), expected) == 0);
+
+    uint8_t *value = NULL;
+    size_t value_len = 0;
+
+    CU_ASSERT(kmyth_keyring_get_index(keyring, i, &value, &value_len) == 0);
+    CU_ASSERT(value_len == ((i == 0) ? 1 : 32));
+    CU_ASSERT(value != NULL && value[value_len - 1] == (uint8_t) i);
+    free(value);
+  }
+  CU_ASSERT(kmyth_keyring_name(keyring, 60) == NULL);
+
+  // lookups by name
+  uint8_t *value = NULL;
+  size_t value_len = 0;
+
+  CU_ASSERT(kmyth_keyring_get(keyring, "key-42", &value, &value_len) == 0);
+  CU_ASSERT(value_len == 32);
+  CU_ASSERT(value != NULL && memcmp(value, value_buf[6], 32) == 0);
+  free(value);
+  value = NULL;
+  CU_ASSERT(kmyth_keyring_get(keyring, "key-60", &value, &value_len) == 1);
+  CU_ASSERT(kmyth_keyring_get(keyring, "key-", &value, &value_len) == 1);
+  CU_ASSERT(kmyth_keyring_get(keyring, "", &value, &value_len) == 1);
+  CU_ASSERT(kmyth_keyring_get(keyring, NULL, &value, &value_len) == 1);
+  CU_ASSERT(kmyth_keyring_get_index(keyring, 60, &value, &value_len) == 1);
+  CU_ASSERT(value == NULL);
+
+  CU_ASSERT(kmyth_keyring_close(&keyring) == 0);
+  CU_ASSERT(keyring == NULL);
+  CU_ASSERT(kmyth_keyring_close(&keyring) == 1);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_keyring_pack_invalid()
+//----------------------------------------------------------------------------
+void test_kmyth_keyring_pack_invalid(void)
+{
+  uint8_t key[16] = { 0 };
+  char long_name[KMYTH_KEYRING_MAX_NAME_LEN + 2];
+  const char *names[2] = { "a", "b" };
+  uint8_t value[4] = { 1, 2, 3, 4 };
+  uint8_t *values[2] = { value, value };
+  size_t value_lens[2] = { sizeof(value), sizeof(value) };
+  uint8_t *data = NULL;
+  size_t data_size = 0;
+
+  memset(long_name, 'x', sizeof(long_name) - 1);
+  long_name[sizeof(long_name) - 1] = '\0';
+
+  CU_ASSERT(kmyth_keyring_pack(key, sizeof(key), 2, names, values,
+                               value_lens, &data, &data_size) == 0);
+  free(data);
+  data = NULL;
+
+  // no entries, or no key
+  CU_ASSERT(kmyth_keyring_pack(key, sizeof(key), 0, names, values,
+                               value_lens, &data, &data_size) == 1);
+  CU_ASSERT(kmyth_keyring_pack(NULL, sizeof(key), 2, names, values,
+                               value_lens, &data, &data_size) == 1);
+
+  // duplicate, empty, NULL, and too long names
+  names[1] = "a";
+  CU_ASSERT(kmyth_keyring_pack(key, sizeof(key), 2, names, values,
+                               value_lens, &data, &data_size) == 1);
+  names[1] = "";
+  CU_ASSERT(kmyth_keyring_pack(key, sizeof(key), 2, names, values,
+                               value_lens, &data, &data_size) == 1);
+  names[1] = NULL;
+  CU_ASSERT(kmyth_keyring_pack(key, sizeof(key), 2, names, values,
+                               value_lens, &data, &data_size) == 1);
+  names[1] = long_name;
+  CU_ASSERT(kmyth_keyring_pack(key, sizeof(key), 2, names, values,
+                               value_lens, &data, &data_size) == 1);
+  long_name[KMYTH_KEYRING_MAX_NAME_LEN] = '\0';
+  CU_ASSERT(kmyth_keyring_pack(key, sizeof(key), 2, names, values,
+                               value_lens, &data, &data_size) == 0);
+  free(data);
+  data = NULL;
+
+  // empty and NULL values
+  value_lens[0] = 0;
+  CU_ASSERT(kmyth_keyring_pack(key, sizeof(key), 2, names, values,
+                               value_lens, &data, &data_size) == 1);
+  value_lens[0] = sizeof(value);
+  values[0] = NULL;
+  CU_ASSERT(kmyth_keyring_pack(key, sizeof(key), 2, names, values,
+                               value_lens, &data, &data_size) == 1);
+  CU_ASSERT(data == NULL);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_keyring_update()
+//----------------------------------------------------------------------------
+void test_kmyth_keyring_update(void)
+{
+  uint8_t key[16] = { 0 };
+  const char *names[3] = { "bravo", "delta", "foxtrot" };
+  uint8_t value_b[8] = { 0xBB };
+  uint8_t value_d[8] = { 0xDD };
+  uint8_t value_f[8] = { 0xFF };
+  uint8_t *values[3] = { value_b, value_d, value_f };
+  size_t value_lens[3] = { 8, 8, 8 };
+  uint8_t *data = NULL;
+  size_t data_size = 0;
+  kmyth_keyring_t *keyring = NULL;
+
+  CU_ASSERT_FATAL(kmyth_keyring_pack(key, sizeof(key), 3, names, values,
+                                     value_lens, &data, &data_size) == 0);
+  CU_ASSERT_FATAL(kmyth_keyring_load(key, sizeof(key), data, data_size,
+                                     &keyring) == 0);
+
+  // add entries before, between, and after the existing ones, and replace
+  // one of them
+  const char *new_names[4] = { "delta", "alpha", "echo", "golf" };
+  uint8_t new_d[3] = { 0x0D, 0x0D, 0x0D };
+  uint8_t new_a[8] = { 0xAA };
+  uint8_t new_e[8] = { 0xEE };
+  uint8_t new_g[8] = { 0x66 };
+  uint8_t *new_values[4] = { new_d, new_a, new_e, new_g };
+  size_t new_value_lens[4] = { 3, 8, 8, 8 };
+  uint8_t *updated = NULL;
+  size_t updated_size = 0;
+
+  CU_ASSERT_FATAL(kmyth_keyring_update(keyring, 4, new_names, new_values,
+                                       new_value_lens, &updated,
+                                       &updated_size) == 0);
+
+  // the untouched entries are copied, not re-encrypted
+  size_t enc_len = 8 + GCM_IV_LEN + GCM_TAG_LEN;
+
+  CU_ASSERT(memmem(updated, updated_size, keyring->values +
+                   keyring->offsets[0], enc_len) != NULL);
+  CU_ASSERT(memmem(updated, updated_size, keyring->values +
+                   keyring->offsets[2], enc_len) != NULL);
+  CU_ASSERT(memmem(updated, updated_size, keyring->values +
+                   keyring->offsets[1], enc_len) == NULL);
+
+  // invalid updates (duplicate names, empty values) are rejected
+  uint8_t *bad = NULL;
+  size_t bad_size = 0;
+
+  new_names[2] = "alpha";
+  CU_ASSERT(kmyth_keyring_update(keyring, 4, new_names, new_values,
+                                 new_value_lens, &bad, &bad_size) == 1);
+  new_names[2] = "echo";
+  new_value_lens[0] = 0;
+  CU_ASSERT(kmyth_keyring_update(keyring, 4, new_names, new_values,
+                                 new_value_lens, &bad, &bad_size) == 1);
+  CU_ASSERT(bad == NULL);
+  CU_ASSERT(kmyth_keyring_close(&keyring) == 0);
+
+  // the updated keyring holds all of the entries, in name order
+  const char *expected_names[6] = { "alpha", "bravo", "delta", "echo",
+    "foxtrot", "golf"
+  };
+  uint8_t expected_first[6] = { 0xAA, 0xBB, 0x0D, 0xEE, 0xFF, 0x66 };
+
+  CU_ASSERT_FATAL(kmyth_keyring_load(key, sizeof(key), updated,
+                                     updated_size, &keyring) == 0);
+  CU_ASSERT(kmyth_keyring_count(keyring) == 6);
+  for (size_t i = 0; i < 6; i++)
+  {
+    uint8_t *value = NULL;
+    size_t value_len = 0;
+
+    CU_ASSERT(strcmp(kmyth_keyring_name(keyring, i), expected_names[i]) == 0);
+    CU_ASSERT(kmyth_keyring_get(keyring, expected_names[i], &value,
+                                &value_len) == 0);
+    CU_ASSERT(value_len == ((i == 2) ? 3 : 8));
+    CU_ASSERT(value != NULL && value[0] == expected_first[i]);
+    free(value);
+  }
+  CU_ASSERT(kmyth_keyring_close(&keyring) == 0);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_keyring_modification()
+//----------------------------------------------------------------------------
+void test_kmyth_keyring_modification(void)
+{
+  uint8_t key[24] = { 0 };
+  const char *names[3] = { "alpha", "beta", "gamma" };
+  uint8_t value_a[16] = { 0xAA };
+  uint8_t value_b[16] = { 0xBB };
+  uint8_t value_c[16] = { 0xCC };
+  uint8_t *values[3] = { value_a, value_b, value_c };
+  size_t value_lens[3] = { 16, 16, 16 };
+  uint8_t *data = NULL;
+  size_t data_size = 0;
+
+  CU_ASSERT_FATAL(kmyth_keyring_pack(key, sizeof(key), 3, names, values,
+                                     value_lens, &data, &data_size) == 0);
+
+  kmyth_keyring_t *keyring = NULL;
+  uint8_t *copy = malloc(data_size);
+
+  CU_ASSERT_FATAL(copy != NULL);
+
+  // wrong key
+  uint8_t wrong_key[24] = { 1 };
+
+  memcpy(copy, data, data_size);
+  CU_ASSERT(kmyth_keyring_load(wrong_key, sizeof(wrong_key), copy,
+                               data_size, &keyring) == 1);
+  CU_ASSERT(keyring == NULL);
+
+  // modified magic, count, and index
+  size_t positions[3] = { 0, KMYTH_KEYRING_MAGIC_LEN + 7,
+    KMYTH_KEYRING_HEADER_SIZE + GCM_IV_LEN + 1
+  };
+
+  for (size_t i = 0; i < 3; i++)
+  {
+    memcpy(copy, data, data_size);
+    copy[positions[i]] ^= 1;
+    CU_ASSERT(kmyth_keyring_load(key, sizeof(key), copy, data_size,
+                                 &keyring) == 1);
+    CU_ASSERT(keyring == NULL);
+  }
+
+  // truncated
+  memcpy(copy, data, data_size);
+  CU_ASSERT(kmyth_keyring_load(key, sizeof(key), copy,
+                               KMYTH_KEYRING_HEADER_SIZE + 10,
+                               &keyring) == 1);
+
+  // swapping two (equal length) values is detected on lookup, and the
+  // other entries are unaffected
+  size_t value_size = 16 + GCM_IV_LEN + GCM_TAG_LEN;
+  uint8_t *last = copy + data_size - value_size;
+  uint8_t *prev = last - value_size;
+  uint8_t tmp[16 + GCM_IV_LEN + GCM_TAG_LEN];
+
+  memcpy(copy, data, data_size);
+  memcpy(tmp, last, value_size);
+  memcpy(last, prev, value_size);
+  memcpy(prev, tmp, value_size);
+  CU_ASSERT_FATAL(kmyth_keyring_load(key, sizeof(key), copy, data_size,
+                                     &keyring) == 0);
+
+  uint8_t *value = NULL;
+  size_t value_len = 0;
+
+  CU_ASSERT(kmyth_keyring_get(keyring, "beta", &value, &value_len) == 1);
+  CU_ASSERT(kmyth_keyring_get(keyring, "gamma", &value, &value_len) == 1);
+  CU_ASSERT(kmyth_keyring_get(keyring, "alpha", &value, &value_len) == 0);
+  CU_ASSERT(value_len == 16 && value != NULL && value[0] == 0xAA);
+  free(value);
+
+  // the keyring owns (and frees) copy
+  CU_ASSERT(kmyth_keyring_close(&keyring) == 0);
+  free(data);
+}
@@ -0,0 +1,311 @@
+//############################################################################
+// kmyth_metrics_test.c
+//
+// Tests for the library-wide metrics registry in src/tpm/kmyth_metrics.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <CUnit/CUnit.h>
+
+#include "kmyth_metrics.h"
+#include "kmyth_metrics_test.h"
+
+//----------------------------------------------------------------------------
+// kmyth_metrics_add_tests()
+//----------------------------------------------------------------------------
+int kmyth_metrics_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "Metrics operation count Tests",
+                          test_kmyth_metrics_ops))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Metrics failure reason Tests",
+                          test_kmyth_metrics_failures))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Metrics TPM/cache/cipher count Tests",
+                          test_kmyth_metrics_counts))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Metrics export Tests",
+                          test_kmyth_metrics_export))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_metrics_ops()
+//----------------------------------------------------------------------------
+void test_kmyth_metrics_ops(void)
+{
+  kmyth_metrics_t metrics;
+
+  kmyth_metrics_reset();
+
+  // a reseal that unseals and seals is counted once, as a reseal
+  uint64_t outer = kmyth_metrics_op_begin();
+  uint64_t inner = kmyth_metrics_op_begin();
+
+  kmyth_metrics_op_end(KMYTH_OP_UNSEAL, inner, 0);
+  inner = kmyth_metrics_op_begin();
+  kmyth_metrics_op_end(KMYTH_OP_SEAL, inner, 0);
+  kmyth_metrics_op_end(KMYTH_OP_RESEAL, outer, 0);
+
+  for (size_t i = 0; i < 3; i++)
+  {
+    kmyth_metrics_op_end(KMYTH_OP_SEAL, kmyth_metrics_op_begin(), 0);
+  }
+
+  CU_ASSERT_FATAL(kmyth_metrics_snapshot(&metrics) == 0);
+  CU_ASSERT(metrics.calls[KMYTH_OP_SEAL] == 3);
+  CU_ASSERT(metrics.calls[KMYTH_OP_UNSEAL] == 0);
+  CU_ASSERT(metrics.calls[KMYTH_OP_RESEAL] == 1);
+
+  // every operation falls in exactly one latency bucket
+  for (size_t op = 0; op < KMYTH_OP_COUNT; op++)
+  {
+    uint64_t bucketed = 0;
+
+    for (size_t i = 0; i < KMYTH_METRICS_BUCKETS; i++)
+    {
+      bucketed += metrics.latency_buckets[op][i];
+    }
+    CU_ASSERT(bucketed == metrics.calls[op]);
+  }
+
+  // the bucket bounds increase, with the last one unbounded
+  for (size_t i = 1; i < KMYTH_METRICS_BUCKETS; i++)
+  {
+    CU_ASSERT(kmyth_metrics_bucket_bound_ns(i) >
+              kmyth_metrics_bucket_bound_ns(i - 1));
+  }
+  CU_ASSERT(kmyth_metrics_bucket_bound_ns(KMYTH_METRICS_BUCKETS - 1) ==
+            UINT64_MAX);
+
+  CU_ASSERT(kmyth_metrics_snapshot(NULL) == 1);
+
+  kmyth_metrics_reset();
+  CU_ASSERT_FATAL(kmyth_metrics_snapshot(&metrics) == 0);
+  CU_ASSERT(metrics.calls[KMYTH_OP_SEAL] == 0);
+  CU_ASSERT(metrics.calls[KMYTH_OP_RESEAL] == 0);
+  CU_ASSERT(metrics.latency_ns[KMYTH_OP_SEAL] == 0);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_metrics_failures()
+//----------------------------------------------------------------------------
+void test_kmyth_metrics_failures(void)
+{
+  kmyth_metrics_t metrics;
+
+  kmyth_metrics_reset();
+
+  // no reason noted
+  kmyth_metrics_op_end(KMYTH_OP_UNSEAL, kmyth_metrics_op_begin(), 1);
+
+  // malformed input
+  uint64_t start = kmyth_metrics_op_begin();
+
+  kmyth_metrics_note_failure(KMYTH_FAILURE_INPUT);
+  kmyth_metrics_op_end(KMYTH_OP_UNSEAL, start, 1);
+
+  // TPM_RC_POLICY_FAIL (format-one, for session 1) is an authorization
+  // failure
+  start = kmyth_metrics_op_begin();
+  kmyth_metrics_count_tpm_response(0x99D);
+  kmyth_metrics_op_end(KMYTH_OP_UNSEAL, start, 1);
+
+  // TPM_RC_AUTH_FAIL (format-one, for handle 1), after an earlier failure
+  start = kmyth_metrics_op_begin();
+  kmyth_metrics_note_failure(KMYTH_FAILURE_CIPHER);
+  kmyth_metrics_count_tpm_response(0x98E);
+  kmyth_metrics_op_end(KMYTH_OP_SEAL, start, 1);
+
+  // TPM_RC_HIERARCHY (format-one, for handle 1) is not
+  start = kmyth_metrics_op_begin();
+  kmyth_metrics_count_tpm_response(0x185);
+  kmyth_metrics_op_end(KMYTH_OP_SEAL, start, 1);
+
+  // a reason noted by a successful operation does not carry over
+  start = kmyth_metrics_op_begin();
+  kmyth_metrics_note_failure(KMYTH_FAILURE_CIPHER);
+  kmyth_metrics_op_end(KMYTH_OP_RESEAL, start, 0);
+  kmyth_metrics_op_end(KMYTH_OP_RESEAL, kmyth_metrics_op_begin(), 1);
+
+  CU_ASSERT_FATAL(kmyth_metrics_snapshot(&metrics) == 0);
+  CU_ASSERT(metrics.calls[KMYTH_OP_UNSEAL] == 3);
+  CU_ASSERT(metrics.failures[KMYTH_OP_UNSEAL][KMYTH_FAILURE_OTHER] == 1);
+  CU_ASSERT(metrics.failures[KMYTH_OP_UNSEAL][KMYTH_FAILURE_INPUT] == 1);
+  CU_ASSERT(metrics.failures[KMYTH_OP_UNSEAL][KMYTH_FAILURE_AUTH] == 1);
+  CU_ASSERT(metrics.failures[KMYTH_OP_SEAL][KMYTH_FAILURE_AUTH] == 1);
+  CU_ASSERT(metrics.failures[KMYTH_OP_SEAL][KMYTH_FAILURE_TPM] == 1);
+  CU_ASSERT(metrics.failures[KMYTH_OP_SEAL][KMYTH_FAILURE_CIPHER] == 0);
+  CU_ASSERT(metrics.calls[KMYTH_OP_RESEAL] == 2);
+  CU_ASSERT(metrics.failures[KMYTH_OP_RESEAL][KMYTH_FAILURE_CIPHER] == 0);
+  CU_ASSERT(metrics.failures[KMYTH_OP_RESEAL][KMYTH_FAILURE_OTHER] == 1);
+  CU_ASSERT(metrics.tpm_commands == 3);
+  CU_ASSERT(metrics.tpm_errors == 3);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_metrics_counts()
+//----------------------------------------------------------------------------
+void test_kmyth_metrics_counts(void)
+{
+  kmyth_metrics_t metrics;
+
+  kmyth_metrics_reset();
+
+  kmyth_metrics_count_tpm_response(0);
+  kmyth_metrics_count_tpm_response(0);
+  kmyth_metrics_count_tpm_retry();
+
+  kmyth_metrics_count_cache(KMYTH_CACHE_UNSEAL, true);
+  kmyth_metrics_count_cache(KMYTH_CACHE_UNSEAL, false);
+  kmyth_metrics_count_cache(KMYTH_CACHE_UNSEAL, true);
+  kmyth_metrics_count_cache(KMYTH_CACHE_POLICY_SESSION, false);
+  kmyth_metrics_count_cache(KMYTH_CACHE_COUNT, true);
+
+  kmyth_metrics_count_cipher_bytes("AES/GCM/NoPadding/256", true, 100);
+  kmyth_metrics_count_cipher_bytes("AES/GCM/NoPadding/256", true, 28);
+  kmyth_metrics_count_cipher_bytes("AES/GCM/NoPadding/256", false, 64);
+  kmyth_metrics_count_cipher_bytes("no such cipher", true, 1000);
+  kmyth_metrics_count_cipher_bytes(NULL, true, 1000);
+
+  CU_ASSERT_FATAL(kmyth_metrics_snapshot(&metrics) == 0);
+  CU_ASSERT(metrics.tpm_commands == 2);
+  CU_ASSERT(metrics.tpm_errors == 0);
+  CU_ASSERT(metrics.tpm_retries == 1);
+  CU_ASSERT(metrics.cache_hits[KMYTH_CACHE_UNSEAL] == 2);
+  CU_ASSERT(metrics.cache_misses[KMYTH_CACHE_UNSEAL] == 1);
+  CU_ASSERT(metrics.cache_hits[KMYTH_CACHE_POLICY_SESSION] == 0);
+  CU_ASSERT(metrics.cache_misses[KMYTH_CACHE_POLICY_SESSION] == 1);
+  CU_ASSERT(metrics.cache_hits[KMYTH_CACHE_OBJECT_CONTEXT] == 0);
+
+  bool found = false;
+
+  CU_ASSERT_FATAL(metrics.cipher_count <= KMYTH_METRICS_MAX_CIPHERS);
+  for (size_t i = 0; i < metrics.cipher_count; i++)
+  {
+    CU_ASSERT_FATAL(metrics.ciphers[i].name != NULL);
+    if (strcmp(metrics.ciphers[i].name, "AES/GCM/NoPadding/256") == 0)
+    {
+      found = true;
+      CU_ASSERT(metrics.ciphers[i].encrypted_bytes == 128);
+      CU_ASSERT(metrics.ciphers[i].decrypted_bytes == 64);
+    }
+    else
+    {
+      CU_ASSERT(metrics.ciphers[i].encrypted_bytes == 0);
+      CU_ASSERT(metrics.ciphers[i].decrypted_bytes == 0);
+    }
+  }
+  CU_ASSERT(found);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_metrics_export()
+//----------------------------------------------------------------------------
+void test_kmyth_metrics_export(void)
+{
+  kmyth_metrics_t metrics;
+
+  kmyth_metrics_reset();
+  kmyth_metrics_op_end(KMYTH_OP_SEAL, kmyth_metrics_op_begin(), 0);
+  kmyth_metrics_op_end(KMYTH_OP_SEAL, kmyth_metrics_op_begin(), 0);
+  kmyth_metrics_count_cache(KMYTH_CACHE_UNSEAL, true);
+  kmyth_metrics_count_cipher_bytes("AES/GCM/NoPadding/256", true, 100);
+  CU_ASSERT_FATAL(kmyth_metrics_snapshot(&metrics) == 0);
+
+  char *text = NULL;
+  size_t text_size = 0;
+  FILE *out = open_memstream(&text, &text_size);
+
+  CU_ASSERT_FATAL(out != NULL);
+  CU_ASSERT(kmyth_metrics_write_prometheus(out, &metrics) == 0);
+  fclose(out);
+
+  CU_ASSERT(strstr(text, "# TYPE kmyth_operations_total counter\n") != NULL);
+  CU_ASSERT(strstr(text, "\nkmyth_operations_total{op=\"seal\"} 2\n") !=
+            NULL);
+  CU_ASSERT(strstr(text, "# TYPE kmyth_operation_duration_seconds "
+                   "histogram\n") != NULL);
+  CU_ASSERT(strstr(text, "\nkmyth_operation_duration_seconds_bucket"
+                   "{op=\"seal\",le=\"+Inf\"} 2\n") != NULL);
+  CU_ASSERT(strstr(text, "\nkmyth_operation_duration_seconds_count"
+                   "{op=\"seal\"} 2\n") != NULL);
+  CU_ASSERT(strstr(text, "\nkmyth_cache_lookups_total"
+                   "{cache=\"unseal\",result=\"hit\"} 1\n") != NULL);
+  CU_ASSERT(strstr(text, "\nkmyth_cipher_bytes_total"
+                   "{cipher=\"AES/GCM/NoPadding/256\",direction=\"encrypt\"} "
+                   "100\n") != NULL);
+  free(text);
+
+  CU_ASSERT(kmyth_metrics_write_prometheus(NULL, &metrics) == 1);
+
+  // writing the textfile twice, accumulating, doubles its counts
+  char path[] = "/tmp/kmyth_metrics_test_XXXXXX";
+  int fd = mkstemp(path);
+
+  CU_ASSERT_FATAL(fd >= 0);
+  close(fd);
+  CU_ASSERT(kmyth_metrics_write_textfile(path, 0) == 0);
+  CU_ASSERT(kmyth_metrics_write_textfile(path, 1) == 0);
+
+  FILE *in = fopen(path, "r");
+  char line[256];
+  bool seal_found = false;
+  bool cipher_found = false;
+
+  CU_ASSERT_FATAL(in != NULL);
+  while (fgets(line, sizeof(line), in) != NULL)
+  {
+    if (strcmp(line, "kmyth_operations_total{op=\"seal\"} 4\n") == 0)
+    {
+      seal_found = true;
+    }
+    if (strcmp(line, "kmyth_cipher_bytes_total{cipher=\"AES/GCM/NoPadding/"
+               "256\",direction=\"encrypt\"} 200\n") == 0)
+    {
+      cipher_found = true;
+    }
+  }
+  fclose(in);
+  CU_ASSERT(seal_found);
+  CU_ASSERT(cipher_found);
+
+  // without accumulating, the file only has the process's counts
+  CU_ASSERT(kmyth_metrics_write_textfile(path, 0) == 0);
+  in = fopen(path, "r");
+  seal_found = false;
+  CU_ASSERT_FATAL(in != NULL);
+  while (fgets(line, sizeof(line), in) != NULL)
+  {
+    if (strcmp(line, "kmyth_operations_total{op=\"seal\"} 2\n") == 0)
+    {
+      seal_found = true;
+    }
+  }
+  fclose(in);
+  CU_ASSERT(seal_found);
+
+  char lock_path[sizeof(path) + 5];
+
+  snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+  unlink(path);
+  unlink(lock_path);
+
+  CU_ASSERT(kmyth_metrics_write_textfile(NULL, 0) == 1);
+}
@@ -4,11 +4,18 @@
 // Tests kmyth seal/unseal functions in tpm2/src/tpm/kmyth_seal_unseal_implc.
 //################################################################################
 
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 #include <CUnit/CUnit.h>
 
+#include "allocator.h"
+#include "defines.h"
+#include "file_io.h"
 #include "kmyth.h"
 #include "pcrs.h"
 #include "formatting_tools.h"
@@ -16,6 +23,8 @@
 #include "storage_key_tools.h"
 #include "tpm2_interface.h"
 #include "kmyth_seal_unseal_impl.h"
+#include "memory_util.h"
+#include "kmyth_unseal_cache.h"
 #include "kmyth_seal_unseal_impl_test.h"
 
 //--------------------------------------------------------------------------------
@@ -45,6 +54,110 @@ int kmyth_seal_unseal_impl_add_tests(CU_pSuite suite)
   {
     return 1;
   }
+  if (NULL ==
+      CU_add_test(suite, "kmyth_ctx Seal/Unseal Tests",
+                  test_kmyth_ctx_seal_unseal))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "kmyth_ctx Storage Key Pool Tests",
+                  test_kmyth_ctx_sk_pool))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "kmyth_ctx Persistent Storage Key Tests",
+                  test_kmyth_ctx_persistent_sk))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "kmyth_ctx Object Context Cache Tests",
+                  test_kmyth_ctx_object_cache))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "kmyth_ctx Deadline/Cancellation Tests",
+                  test_kmyth_ctx_deadline))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "kmyth_ctx_pool Checkout Tests",
+                  test_kmyth_ctx_pool))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "kmyth_async Seal/Unseal Tests", test_kmyth_async))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "tpm2_kmyth_unseal() Cache Tests",
+                  test_tpm2_kmyth_unseal_cache))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "kmyth_get_ski_pcrs() Tests",
+                  test_kmyth_get_ski_pcrs))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "tpm2_kmyth_unseal_into() Tests",
+                  test_tpm2_kmyth_unseal_into))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "tpm2_kmyth_seal_batch() Tests",
+                  test_tpm2_kmyth_seal_batch))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "tpm2_kmyth_unseal_batch() Tests",
+                  test_tpm2_kmyth_unseal_batch))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "tpm2_kmyth_rewrap_batch() Tests",
+                  test_tpm2_kmyth_rewrap_batch))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "tpm2_kmyth_seal_stream()/unseal_stream() Tests",
+                  test_tpm2_kmyth_seal_unseal_stream))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "tpm2_kmyth_seal_chunked()/unseal_range() Tests",
+                  test_tpm2_kmyth_seal_chunked_unseal_range))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "Parallel chunked seal/unseal Tests",
+                  test_tpm2_kmyth_seal_chunked_parallel))
+  {
+    return 1;
+  }
+  if (NULL ==
+      CU_add_test(suite, "Compressed seal/unseal Tests",
+                  test_kmyth_ctx_seal_compressed))
+  {
+    return 1;
+  }
+
   if (NULL ==
       CU_add_test(suite, "tpm2_kmyth_seal_file() Tests",
                   test_tpm2_kmyth_seal_file))
@@ -183,6 +296,1694 @@ void test_tpm2_kmyth_unseal(void)
   // tests for tpm2_kmyth_seal.
 }
 
+//--------------------------------------------------------------------------------
+// test_kmyth_ctx_seal_unseal
+//--------------------------------------------------------------------------------
+void test_kmyth_ctx_seal_unseal(void)
+{
+  uint8_t input[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+  size_t input_len = 8;
+
+  kmyth_ctx_t *ctx = NULL;
+
+  // Check that a context can be created, and that a non-NULL context pointer
+  // is rejected rather than overwritten
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+  CU_ASSERT(ctx != NULL);
+  kmyth_ctx_t *orig_ctx = ctx;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 1);
+  CU_ASSERT(ctx == orig_ctx);
+
+  // Check that repeated seal/unseal operations over the same context all
+  // succeed (the SRK lookup is cached and transient objects are flushed)
+  for (int i = 0; i < 4; i++)
+  {
+    uint8_t *sealed = NULL;
+    size_t sealed_len = 0;
+
+    CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, input_len, &sealed, &sealed_len,
+                                  NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                  0) == 0);
+
+    uint8_t *plaintext = NULL;
+    size_t plaintext_len = 0;
+
+    CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &plaintext,
+                                    &plaintext_len, NULL, 0, NULL, 0, 0) == 0);
+    CU_ASSERT(plaintext_len == input_len);
+    CU_ASSERT(plaintext != NULL && memcmp(plaintext, input, input_len) == 0);
+
+    free(sealed);
+    free(plaintext);
+  }
+
+  // Check that the context operations reject a NULL context
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_seal_ctx(NULL, input, input_len, &output, &output_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL, 0) == 1);
+  CU_ASSERT(output == NULL);
+  CU_ASSERT(output_len == 0);
+
+  // Check that destroy releases the context and is safe to repeat
+  CU_ASSERT(kmyth_ctx_destroy(&ctx) == 0);
+  CU_ASSERT(ctx == NULL);
+  CU_ASSERT(kmyth_ctx_destroy(&ctx) == 0);
+}
+
+//--------------------------------------------------------------------------------
+// test_kmyth_ctx_sk_pool
+//--------------------------------------------------------------------------------
+void test_kmyth_ctx_sk_pool(void)
+{
+  uint8_t input[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+  size_t input_len = 8;
+  uint8_t auth[4] = { 'a', 'u', 't', 'h' };
+
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+
+  // Check that the pool is disabled by default, and that invalid sizes and
+  // pre-creating a storage key without a pool are rejected
+  CU_ASSERT(ctx->sk_pool_size == 0);
+  CU_ASSERT(kmyth_ctx_precreate_sk(ctx, NULL, 0, NULL, 0, NULL, 0, NULL) == 1);
+  CU_ASSERT(kmyth_ctx_set_sk_pool(NULL, 1) == 1);
+  CU_ASSERT(kmyth_ctx_set_sk_pool(ctx, KMYTH_SK_POOL_MAX + 1) == 1);
+  CU_ASSERT(kmyth_ctx_set_sk_pool(ctx, 2) == 0);
+
+  // Check that a pre-created storage key is pooled, and that a seal with
+  // the same parameters reuses it rather than adding another
+  CU_ASSERT(kmyth_ctx_precreate_sk(ctx, NULL, 0, NULL, 0, NULL, 0, NULL) == 0);
+  CU_ASSERT(ctx->sk_pool_count == 1);
+  TPM2B_PUBLIC pooled_pub = ctx->sk_pool[0].sk_pub;
+
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, input_len, &sealed, &sealed_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                0) == 0);
+  CU_ASSERT(ctx->sk_pool_count == 1);
+  CU_ASSERT(memcmp(&ctx->sk_pool[0].sk_pub, &pooled_pub,
+                   sizeof(pooled_pub)) == 0);
+
+  // Check that data sealed under a pooled storage key unseals
+  uint8_t *plaintext = NULL;
+  size_t plaintext_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &plaintext,
+                                  &plaintext_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(plaintext_len == input_len);
+  CU_ASSERT(plaintext != NULL && memcmp(plaintext, input, input_len) == 0);
+  free(sealed);
+  free(plaintext);
+
+  // Check that a seal with a different authorization value gets a storage
+  // key of its own, and that shrinking the pool keeps the most recent one
+  sealed = NULL;
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, input_len, &sealed, &sealed_len,
+                                auth, sizeof(auth), NULL, 0, NULL, 0, NULL,
+                                NULL, 0) == 0);
+  free(sealed);
+  CU_ASSERT(ctx->sk_pool_count == 2);
+  CU_ASSERT(kmyth_ctx_set_sk_pool(ctx, 1) == 0);
+  CU_ASSERT(ctx->sk_pool_count == 1);
+  CU_ASSERT(memcmp(&ctx->sk_pool[0].sk_pub, &pooled_pub,
+                   sizeof(pooled_pub)) != 0);
+
+  // Check that disabling the pool empties it
+  CU_ASSERT(kmyth_ctx_set_sk_pool(ctx, 0) == 0);
+  CU_ASSERT(ctx->sk_pool_count == 0);
+
+  CU_ASSERT(kmyth_ctx_destroy(&ctx) == 0);
+}
+
+//--------------------------------------------------------------------------------
+// test_kmyth_ctx_persistent_sk
+//--------------------------------------------------------------------------------
+void test_kmyth_ctx_persistent_sk(void)
+{
+  uint8_t input[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+  size_t input_len = 8;
+  uint32_t handles[8];
+  size_t count = 0;
+  bool listed = false;
+
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+
+  // Check that handles outside of the persistent SK range are rejected
+  CU_ASSERT(kmyth_ctx_set_persistent_sk(NULL, KMYTH_PERSISTENT_SK_FIRST) == 1);
+  CU_ASSERT(kmyth_ctx_set_persistent_sk(ctx, TPM2_PERSISTENT_FIRST) == 1);
+  CU_ASSERT(kmyth_ctx_set_persistent_sk(ctx, KMYTH_PERSISTENT_SK_LAST + 1) ==
+            1);
+  CU_ASSERT(kmyth_ctx_set_persistent_sk(ctx, KMYTH_PERSISTENT_SK_FIRST) == 0);
+
+  // Check that sealing makes the storage key persistent
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, input_len, &sealed, &sealed_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                0) == 0);
+  CU_ASSERT(kmyth_ctx_list_persistent_sks(ctx, handles, 8, &count) == 0);
+  for (size_t i = 0; i < count && i < 8; i++)
+  {
+    listed |= (handles[i] == KMYTH_PERSISTENT_SK_FIRST);
+  }
+  CU_ASSERT(listed);
+
+  // Check that unsealing uses the persistent storage key
+  uint8_t *plaintext = NULL;
+  size_t plaintext_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &plaintext,
+                                  &plaintext_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(ctx->persistent_sk_hint == KMYTH_PERSISTENT_SK_FIRST);
+  CU_ASSERT(plaintext != NULL && memcmp(plaintext, input, input_len) == 0);
+  free(plaintext);
+
+  // Check that, once evicted, the storage key is loaded from the .ski again
+  CU_ASSERT(kmyth_ctx_evict_persistent_sk(ctx, KMYTH_PERSISTENT_SK_FIRST,
+                                          NULL, 0) == 0);
+  CU_ASSERT(kmyth_ctx_evict_persistent_sk(ctx, KMYTH_PERSISTENT_SK_FIRST,
+                                          NULL, 0) == 1);
+  CU_ASSERT(kmyth_ctx_list_persistent_sks(ctx, handles, 8, &count) == 0);
+  for (size_t i = 0; i < count && i < 8; i++)
+  {
+    CU_ASSERT(handles[i] != KMYTH_PERSISTENT_SK_FIRST);
+  }
+
+  plaintext = NULL;
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &plaintext,
+                                  &plaintext_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(ctx->persistent_sk_hint == 0);
+  CU_ASSERT(plaintext != NULL && memcmp(plaintext, input, input_len) == 0);
+  free(plaintext);
+  free(sealed);
+
+  CU_ASSERT(kmyth_ctx_destroy(&ctx) == 0);
+}
+
+//--------------------------------------------------------------------------------
+// test_kmyth_ctx_object_cache
+//--------------------------------------------------------------------------------
+void test_kmyth_ctx_object_cache(void)
+{
+  uint8_t input[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+  size_t input_len = 8;
+
+  kmyth_ctx_t *ctx = NULL;
+  kmyth_timings_t timings = { 0 };
+
+  CU_ASSERT(kmyth_ctx_set_object_cache(NULL, 1) == 1);
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, input_len, &sealed, &sealed_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                0) == 0);
+
+  // enabled after sealing, so that the storage key loaded by the seal is
+  // not already cached
+  CU_ASSERT(kmyth_ctx_set_object_cache(ctx, 1) == 0);
+  CU_ASSERT(kmyth_ctx_set_timings(ctx, &timings) == 0);
+
+  // Check that repeated unseals of the same .ski succeed, and that after the
+  // first, the storage key and wrapping key are loaded from their contexts
+  for (int i = 0; i < 3; i++)
+  {
+    uint8_t *plaintext = NULL;
+    size_t plaintext_len = 0;
+
+    CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &plaintext,
+                                    &plaintext_len, NULL, 0, NULL, 0, 0) == 0);
+    CU_ASSERT(plaintext != NULL && memcmp(plaintext, input, input_len) == 0);
+    free(plaintext);
+  }
+
+  uint64_t loads = 0;
+  uint64_t context_loads = 0;
+
+  for (size_t i = 0; i < timings.command_count; i++)
+  {
+    if (timings.commands[i].command_code == TPM2_CC_Load)
+    {
+      loads = timings.commands[i].calls;
+    }
+    else if (timings.commands[i].command_code == TPM2_CC_ContextLoad)
+    {
+      context_loads = timings.commands[i].calls;
+    }
+  }
+  CU_ASSERT(loads == 2);
+  CU_ASSERT(context_loads == 4);
+
+  // Check that disabling the cache goes back to loading from the blobs
+  CU_ASSERT(kmyth_ctx_set_object_cache(ctx, 0) == 0);
+  CU_ASSERT(kmyth_ctx_set_timings(ctx, NULL) == 0);
+  uint8_t *plaintext = NULL;
+  size_t plaintext_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &plaintext,
+                                  &plaintext_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(plaintext != NULL && memcmp(plaintext, input, input_len) == 0);
+  free(plaintext);
+  free(sealed);
+
+  CU_ASSERT(kmyth_ctx_destroy(&ctx) == 0);
+}
+
+//--------------------------------------------------------------------------------
+// test_kmyth_ctx_deadline
+//--------------------------------------------------------------------------------
+void test_kmyth_ctx_deadline(void)
+{
+  uint8_t input[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+  size_t input_len = 8;
+  kmyth_ctx_t *ctx = NULL;
+
+  // A NULL context is rejected
+  CU_ASSERT(kmyth_ctx_set_deadline(NULL, 0) == 1);
+  CU_ASSERT(kmyth_ctx_cancel(NULL) == 1);
+
+  CU_ASSERT_FATAL(kmyth_ctx_create(&ctx) == 0);
+
+  // A deadline still well ahead does not get in the way
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  CU_ASSERT(kmyth_ctx_set_deadline(ctx, get_timing_ns() +
+                                   60000000000ULL) == 0);
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, input_len, &sealed, &sealed_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                0) == 0);
+
+  // A cancelled context's calls fail as timed out, and are counted so
+  kmyth_metrics_t before;
+  kmyth_metrics_t after;
+  uint8_t *plaintext = NULL;
+  size_t plaintext_len = 0;
+
+  CU_ASSERT(kmyth_metrics_snapshot(&before) == 0);
+  CU_ASSERT(kmyth_ctx_cancel(ctx) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &plaintext,
+                                  &plaintext_len, NULL, 0, NULL, 0,
+                                  0) == KMYTH_ERR_TIMEOUT);
+  CU_ASSERT(plaintext == NULL);
+  CU_ASSERT(kmyth_metrics_snapshot(&after) == 0);
+  CU_ASSERT(after.failures[KMYTH_OP_UNSEAL][KMYTH_FAILURE_TIMEOUT] ==
+            before.failures[KMYTH_OP_UNSEAL][KMYTH_FAILURE_TIMEOUT] + 1);
+
+  // So do those made past the deadline (setting it clears the cancellation)
+  CU_ASSERT(kmyth_ctx_set_deadline(ctx, 1) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &plaintext,
+                                  &plaintext_len, NULL, 0, NULL, 0,
+                                  0) == KMYTH_ERR_TIMEOUT);
+
+  // No command was sent past the deadline, so the connection is still
+  // usable once the deadline is cleared
+  CU_ASSERT(kmyth_ctx_set_deadline(ctx, 0) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &plaintext,
+                                  &plaintext_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(plaintext_len == input_len);
+  CU_ASSERT(plaintext != NULL && memcmp(plaintext, input, input_len) == 0);
+
+  free(sealed);
+  sealed = NULL;
+  free(plaintext);
+  plaintext = NULL;
+  kmyth_ctx_destroy(&ctx);
+
+  // A command abandoned part way (here, a Create the delay TCTI makes take
+  // 500 ms, against a 100 ms deadline) times the call out ...
+  CU_ASSERT_FATAL(kmyth_ctx_create_tcti(&ctx, "delay:Create=500") == 0);
+  CU_ASSERT(kmyth_ctx_set_deadline(ctx, get_timing_ns() +
+                                   100000000ULL) == 0);
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, input_len, &sealed, &sealed_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                0) == KMYTH_ERR_TIMEOUT);
+  CU_ASSERT(sealed == NULL);
+
+  // ... but the context is still usable: its next calls wait out (and
+  // drop) the abandoned command's response, and then seal and unseal
+  CU_ASSERT(kmyth_ctx_set_deadline(ctx, 0) == 0);
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, input_len, &sealed, &sealed_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                0) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &plaintext,
+                                  &plaintext_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(plaintext_len == input_len);
+  CU_ASSERT(plaintext != NULL && memcmp(plaintext, input, input_len) == 0);
+
+  free(sealed);
+  free(plaintext);
+  kmyth_ctx_destroy(&ctx);
+}
+
+//--------------------------------------------------------------------------------
+// test_kmyth_ctx_pool
+//--------------------------------------------------------------------------------
+static int ctx_pool_test_init(kmyth_ctx_t * ctx, void *arg)
+{
+  __atomic_fetch_add((int *) arg, 1, __ATOMIC_RELAXED);
+  return kmyth_ctx_set_jobs(ctx, 1);
+}
+
+static void *ctx_pool_test_worker(void *arg)
+{
+  kmyth_ctx_pool_t *pool = (kmyth_ctx_pool_t *) arg;
+  uint8_t input[16];
+  intptr_t failed = 0;
+
+  memset(input, (int) (uintptr_t) pthread_self() & 0xFF, sizeof(input));
+  for (int i = 0; i < 4; i++)
+  {
+    kmyth_ctx_t *ctx = NULL;
+    uint8_t *sealed = NULL;
+    size_t sealed_len = 0;
+    uint8_t *output = NULL;
+    size_t output_len = 0;
+
+    if (kmyth_ctx_pool_acquire(pool, &ctx))
+    {
+      return (void *) 1;
+    }
+    if (tpm2_kmyth_seal_ctx(ctx, input, sizeof(input), &sealed, &sealed_len,
+                            NULL, 0, NULL, 0, NULL, 0, NULL, NULL, 0) ||
+        tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &output, &output_len,
+                              NULL, 0, NULL, 0, 0) ||
+        output_len != sizeof(input) ||
+        memcmp(output, input, sizeof(input)) != 0)
+    {
+      failed = 1;
+    }
+    kmyth_ctx_pool_release(pool, ctx, 0);
+    free(sealed);
+    free(output);
+  }
+
+  return (void *) failed;
+}
+
+void test_kmyth_ctx_pool(void)
+{
+  kmyth_ctx_pool_t *pool = NULL;
+  int created = 0;
+
+  // Check invalid parameters
+  CU_ASSERT(kmyth_ctx_pool_create(&pool, NULL, 0, NULL, NULL) == 1);
+  CU_ASSERT(kmyth_ctx_pool_create(&pool, NULL, KMYTH_CTX_POOL_MAX + 1,
+                                  NULL, NULL) == 1);
+  CU_ASSERT(kmyth_ctx_pool_create(NULL, NULL, 1, NULL, NULL) == 1);
+  CU_ASSERT(kmyth_ctx_pool_acquire(NULL, NULL) == 1);
+
+  // Check that contexts are created as needed, and reused once returned
+  CU_ASSERT_FATAL(kmyth_ctx_pool_create(&pool, NULL, 2, ctx_pool_test_init,
+                                        &created) == 0);
+  CU_ASSERT(created == 0);
+
+  kmyth_ctx_t *ctx1 = NULL;
+  kmyth_ctx_t *ctx2 = NULL;
+  kmyth_ctx_t *ctx3 = NULL;
+
+  CU_ASSERT(kmyth_ctx_pool_acquire(pool, &ctx1) == 0);
+  CU_ASSERT(kmyth_ctx_pool_acquire(pool, &ctx2) == 0);
+  CU_ASSERT(ctx1 != NULL && ctx2 != NULL && ctx1 != ctx2);
+  CU_ASSERT(created == 2);
+
+  // (a pool with contexts still checked out cannot be destroyed cleanly)
+  CU_ASSERT(kmyth_ctx_pool_release(pool, ctx2, 0) == 0);
+  CU_ASSERT(kmyth_ctx_pool_acquire(pool, &ctx3) == 0);
+  CU_ASSERT(ctx3 == ctx2);
+  CU_ASSERT(created == 2);
+
+  // Check that a discarded context is replaced
+  CU_ASSERT(kmyth_ctx_pool_release(pool, ctx3, 1) == 0);
+  CU_ASSERT(kmyth_ctx_pool_acquire(pool, &ctx3) == 0);
+  CU_ASSERT(created == 3);
+  CU_ASSERT(kmyth_ctx_pool_release(pool, ctx3, 0) == 0);
+  CU_ASSERT(kmyth_ctx_pool_release(pool, ctx1, 0) == 0);
+
+  // Check that more workers than contexts share them safely
+  pthread_t threads[6];
+
+  for (size_t i = 0; i < 6; i++)
+  {
+    CU_ASSERT_FATAL(pthread_create(&threads[i], NULL, ctx_pool_test_worker,
+                                   pool) == 0);
+  }
+  for (size_t i = 0; i < 6; i++)
+  {
+    void *failed = NULL;
+
+    pthread_join(threads[i], &failed);
+    CU_ASSERT(failed == NULL);
+  }
+  CU_ASSERT(created == 3);
+
+  CU_ASSERT(kmyth_ctx_pool_destroy(&pool) == 0);
+  CU_ASSERT(pool == NULL);
+}
+
+//--------------------------------------------------------------------------------
+// test_kmyth_async
+//--------------------------------------------------------------------------------
+typedef struct
+{
+  kmyth_async_req_t req;
+  kmyth_async_t *async;
+  uint8_t input[16];
+  int completed;
+  int failed;
+} async_test_item;
+
+static void async_test_unsealed(kmyth_async_req_t * req)
+{
+  async_test_item *item = (async_test_item *) req->user_data;
+
+  if (req->result || req->output_len != sizeof(item->input) ||
+      memcmp(req->output, item->input, sizeof(item->input)) != 0)
+  {
+    item->failed = 1;
+  }
+  free(req->output);
+  free(req->input);
+  item->completed = 1;
+}
+
+static void async_test_sealed(kmyth_async_req_t * req)
+{
+  async_test_item *item = (async_test_item *) req->user_data;
+  uint8_t *sealed = req->output;
+  size_t sealed_len = req->output_len;
+
+  // the sealed data is unsealed by a request submitted from the callback
+  if (req->result)
+  {
+    item->failed = 1;
+    item->completed = 1;
+    return;
+  }
+  memset(req, 0, sizeof(kmyth_async_req_t));
+  req->user_data = item;
+  req->input = sealed;
+  req->input_len = sealed_len;
+  if (kmyth_unseal_async(item->async, req, async_test_unsealed))
+  {
+    free(sealed);
+    item->failed = 1;
+    item->completed = 1;
+  }
+}
+
+static void async_test_junk_unsealed(kmyth_async_req_t * req)
+{
+  *(int *) req->user_data = (req->result == 1 && req->output == NULL) ? 1 :
+    2;
+}
+
+void test_kmyth_async(void)
+{
+  kmyth_ctx_pool_t *pool = NULL;
+  kmyth_async_t *async = NULL;
+  async_test_item items[12];
+
+  CU_ASSERT_FATAL(kmyth_ctx_pool_create(&pool, NULL, 2, NULL, NULL) == 0);
+
+  // Check invalid parameters
+  CU_ASSERT(kmyth_async_create(&async, NULL, 1) == 1);
+  CU_ASSERT(kmyth_async_create(&async, pool, 0) == 1);
+  CU_ASSERT(kmyth_async_create(&async, pool, KMYTH_ASYNC_MAX_WORKERS + 1)
+            == 1);
+  CU_ASSERT(kmyth_async_fd(NULL) == -1);
+  CU_ASSERT(kmyth_async_complete(NULL, 0) == 0);
+
+  CU_ASSERT_FATAL(kmyth_async_create(&async, pool, 2) == 0);
+  CU_ASSERT(kmyth_async_fd(async) >= 0);
+  CU_ASSERT(kmyth_unseal_async(async, NULL, async_test_unsealed) == 1);
+  CU_ASSERT(kmyth_unseal_async(async, &items[0].req, NULL) == 1);
+
+  // Check that more requests than workers, each sealed then unsealed, are
+  // all completed by a single thread polling the engine's fd
+  for (size_t i = 0; i < 12; i++)
+  {
+    memset(&items[i], 0, sizeof(async_test_item));
+    memset(items[i].input, (int) i, sizeof(items[i].input));
+    items[i].async = async;
+    items[i].req.user_data = &items[i];
+    items[i].req.input = items[i].input;
+    items[i].req.input_len = sizeof(items[i].input);
+    CU_ASSERT(kmyth_seal_async(async, &items[i].req, async_test_sealed) == 0);
+  }
+  CU_ASSERT(kmyth_async_in_flight(async) == 12);
+
+  size_t completed = 0;
+
+  while (completed < 12)
+  {
+    struct pollfd pfd = {.fd = kmyth_async_fd(async),.events = POLLIN };
+
+    CU_ASSERT_FATAL(poll(&pfd, 1, 30000) == 1);
+    kmyth_async_complete(async, 5);
+
+    completed = 0;
+    for (size_t i = 0; i < 12; i++)
+    {
+      completed += (size_t) items[i].completed;
+    }
+  }
+  for (size_t i = 0; i < 12; i++)
+  {
+    CU_ASSERT(items[i].failed == 0);
+  }
+  CU_ASSERT(kmyth_async_in_flight(async) == 0);
+
+  // Check that invalid .ski data fails, and that destroying the engine
+  // completes a request still in progress
+  uint8_t junk[8] = { 0 };
+  int junk_result = 0;
+
+  memset(&items[0].req, 0, sizeof(kmyth_async_req_t));
+  items[0].req.input = junk;
+  items[0].req.input_len = sizeof(junk);
+  items[0].req.user_data = &junk_result;
+  CU_ASSERT(kmyth_unseal_async(async, &items[0].req,
+                               async_test_junk_unsealed) == 0);
+  CU_ASSERT(kmyth_async_destroy(&async) == 0);
+  CU_ASSERT(async == NULL);
+  CU_ASSERT(junk_result == 1);
+
+  CU_ASSERT(kmyth_ctx_pool_destroy(&pool) == 0);
+}
+
+//--------------------------------------------------------------------------------
+// test_tpm2_kmyth_unseal_cache
+//--------------------------------------------------------------------------------
+void test_tpm2_kmyth_unseal_cache(void)
+{
+  uint8_t input[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+  size_t input_len = 8;
+  uint8_t auth[4] = { 'a', 'u', 't', 'h' };
+  uint8_t wrong_auth[4] = { 'w', 'r', 'o', 'n' };
+
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  uint8_t *plaintext = NULL;
+  size_t plaintext_len = 0;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+  CU_ASSERT(tpm2_kmyth_seal(input, input_len, &sealed, &sealed_len,
+                            auth, sizeof(auth), NULL, 0, NULL, 0, NULL, NULL,
+                            0) == 0);
+
+  // Check the cache size is limited
+  CU_ASSERT(kmyth_set_unseal_cache(KMYTH_UNSEAL_CACHE_MAX + 1) == 1);
+  CU_ASSERT(kmyth_set_unseal_cache(4) == 0);
+
+  // Check that the first unseal goes to the TPM, and a repeat hits the cache
+  for (int i = 0; i < 2; i++)
+  {
+    CU_ASSERT(tpm2_kmyth_unseal(sealed, sealed_len, &plaintext,
+                                &plaintext_len, auth, sizeof(auth), NULL, 0,
+                                0) == 0);
+    CU_ASSERT(plaintext_len == input_len &&
+              memcmp(plaintext, input, input_len) == 0);
+    free(plaintext);
+    plaintext = NULL;
+  }
+  kmyth_unseal_cache_counts(&hits, &misses);
+  CU_ASSERT(hits == 1);
+  CU_ASSERT(misses == 1);
+
+  // Check that a request with different authorization misses (and fails)
+  CU_ASSERT(tpm2_kmyth_unseal(sealed, sealed_len, &plaintext, &plaintext_len,
+                              wrong_auth, sizeof(wrong_auth), NULL, 0,
+                              0) == 1);
+  kmyth_unseal_cache_counts(&hits, &misses);
+  CU_ASSERT(hits == 1);
+  CU_ASSERT(misses == 2);
+
+  // Check that extending a PCR (23, the resettable debug PCR) drops the
+  // cached result, so that the next unseal goes back to the TPM
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  TPM2B_AUTH pcr_auth = {.size = 0, };
+  TSS2L_SYS_AUTH_COMMAND cmdAuths;
+  TSS2L_SYS_AUTH_RESPONSE rspAuths;
+  TPML_DIGEST_VALUES digests = {.count = 1, };
+
+  digests.digests[0].hashAlg = TPM2_ALG_SHA256;
+  memset(digests.digests[0].digest.sha256, 0x5A, TPM2_SHA256_DIGEST_SIZE);
+  CU_ASSERT(init_tpm2_connection(&sapi_ctx) == 0);
+  CU_ASSERT(init_password_cmd_auth(pcr_auth, &cmdAuths, &rspAuths) == 0);
+  CU_ASSERT(Tss2_Sys_PCR_Extend(sapi_ctx, 23, &cmdAuths, &digests,
+                                &rspAuths) == TSS2_RC_SUCCESS);
+  free_tpm2_resources(&sapi_ctx);
+
+  CU_ASSERT(tpm2_kmyth_unseal(sealed, sealed_len, &plaintext, &plaintext_len,
+                              auth, sizeof(auth), NULL, 0, 0) == 0);
+  CU_ASSERT(plaintext_len == input_len &&
+            memcmp(plaintext, input, input_len) == 0);
+  free(plaintext);
+  plaintext = NULL;
+  kmyth_unseal_cache_counts(&hits, &misses);
+  CU_ASSERT(hits == 1);
+  CU_ASSERT(misses == 3);
+
+  // Check that disabling the cache empties it
+  CU_ASSERT(kmyth_set_unseal_cache(0) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal(sealed, sealed_len, &plaintext, &plaintext_len,
+                              auth, sizeof(auth), NULL, 0, 0) == 0);
+  free(plaintext);
+  kmyth_unseal_cache_counts(&hits, &misses);
+  CU_ASSERT(hits == 0);
+  CU_ASSERT(misses == 0);
+
+  free(sealed);
+}
+
+//--------------------------------------------------------------------------------
+// test_kmyth_get_ski_pcrs
+//--------------------------------------------------------------------------------
+void test_kmyth_get_ski_pcrs(void)
+{
+  uint8_t input[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+  uint8_t auth[4] = { 'a', 'u', 't', 'h' };
+  int pcr23[1] = { 23 };
+
+  uint8_t *capk = NULL;
+  size_t capk_len = 0;
+  uint8_t *cached = NULL;
+  size_t cached_len = 0;
+  uint8_t *plaintext = NULL;
+  size_t plaintext_len = 0;
+  int *pcrs = NULL;
+  size_t pcrs_len = 0;
+
+  // Check that invalid arguments are rejected
+  CU_ASSERT(kmyth_get_ski_pcrs(NULL, 0, &pcrs, &pcrs_len) == 1);
+
+  // Check that data sealed without a PCR policy has no PCRs
+  CU_ASSERT(tpm2_kmyth_seal(input, sizeof(input), &capk, &capk_len, auth,
+                            sizeof(auth), NULL, 0, NULL, 0, NULL, NULL,
+                            0) == 0);
+  CU_ASSERT(kmyth_get_ski_pcrs(capk, capk_len, NULL, &pcrs_len) == 1);
+  CU_ASSERT(kmyth_get_ski_pcrs(capk, capk_len, &pcrs, &pcrs_len) == 0);
+  CU_ASSERT(pcrs == NULL);
+  CU_ASSERT(pcrs_len == 0);
+  free(capk);
+  capk = NULL;
+
+  // Check that the PCRs a (client key) .ski is sealed to are returned
+  CU_ASSERT(tpm2_kmyth_seal(input, sizeof(input), &capk, &capk_len, auth,
+                            sizeof(auth), NULL, 0, pcr23, 1, NULL, NULL,
+                            0) == 0);
+  CU_ASSERT(kmyth_get_ski_pcrs(capk, capk_len, &pcrs, &pcrs_len) == 0);
+  CU_ASSERT(pcrs_len == 1);
+  CU_ASSERT(pcrs != NULL && pcrs[0] == 23);
+
+  // Check that data (a kmyth-getkey cache entry) sealed to those PCRs
+  // unseals in the current PCR state ...
+  CU_ASSERT(tpm2_kmyth_seal(input, sizeof(input), &cached, &cached_len,
+                            auth, sizeof(auth), NULL, 0, pcrs, pcrs_len,
+                            NULL, NULL, 0) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal(cached, cached_len, &plaintext,
+                              &plaintext_len, auth, sizeof(auth), NULL, 0,
+                              0) == 0);
+  CU_ASSERT(plaintext_len == sizeof(input) &&
+            memcmp(plaintext, input, sizeof(input)) == 0);
+  free(plaintext);
+  plaintext = NULL;
+
+  // ... but not, with the right authorization, once a PCR has changed
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  TPM2B_AUTH pcr_auth = {.size = 0, };
+  TSS2L_SYS_AUTH_COMMAND cmdAuths;
+  TSS2L_SYS_AUTH_RESPONSE rspAuths;
+  TPML_DIGEST_VALUES digests = {.count = 1, };
+
+  digests.digests[0].hashAlg = TPM2_ALG_SHA256;
+  memset(digests.digests[0].digest.sha256, 0x5A, TPM2_SHA256_DIGEST_SIZE);
+  CU_ASSERT(init_tpm2_connection(&sapi_ctx) == 0);
+  CU_ASSERT(init_password_cmd_auth(pcr_auth, &cmdAuths, &rspAuths) == 0);
+  CU_ASSERT(Tss2_Sys_PCR_Extend(sapi_ctx, 23, &cmdAuths, &digests,
+                                &rspAuths) == TSS2_RC_SUCCESS);
+  free_tpm2_resources(&sapi_ctx);
+
+  CU_ASSERT(tpm2_kmyth_unseal(cached, cached_len, &plaintext,
+                              &plaintext_len, auth, sizeof(auth), NULL, 0,
+                              0) == 1);
+
+  free(pcrs);
+  free(cached);
+  free(capk);
+}
+
+//--------------------------------------------------------------------------------
+// test_tpm2_kmyth_unseal_into
+//--------------------------------------------------------------------------------
+void test_tpm2_kmyth_unseal_into(void)
+{
+  uint8_t input[40];
+  uint8_t auth[4] = { 'a', 'u', 't', 'h' };
+  uint8_t buf[64];
+  size_t len = 0;
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  for (size_t i = 0; i < sizeof(input); i++)
+  {
+    input[i] = (uint8_t) i;
+  }
+  CU_ASSERT(tpm2_kmyth_seal(input, sizeof(input), &sealed, &sealed_len,
+                            auth, sizeof(auth), NULL, 0, NULL, 0, NULL, NULL,
+                            0) == 0);
+
+  // Check that the size query needs no TPM (or authorization)
+  CU_ASSERT(tpm2_kmyth_unseal_into(sealed, sealed_len, NULL, 0, &len,
+                                   NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(len == sizeof(input));
+  CU_ASSERT(tpm2_kmyth_unseal_into_ctx(NULL, sealed, sealed_len, NULL, 0,
+                                       &len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(len == sizeof(input));
+
+  // Check that a too small buffer reports the size needed
+  CU_ASSERT(tpm2_kmyth_unseal_into(sealed, sealed_len, buf,
+                                   sizeof(input) - 1, &len, auth,
+                                   sizeof(auth), NULL, 0, 0) == 1);
+  CU_ASSERT(len == sizeof(input));
+
+  // Check that the data unseals into the buffer
+  memset(buf, 0xFF, sizeof(buf));
+  CU_ASSERT(tpm2_kmyth_unseal_into(sealed, sealed_len, buf, sizeof(buf),
+                                   &len, auth, sizeof(auth), NULL, 0,
+                                   0) == 0);
+  CU_ASSERT(len == sizeof(input));
+  CU_ASSERT(memcmp(buf, input, sizeof(input)) == 0);
+  CU_ASSERT(buf[sizeof(input)] == 0xFF);
+
+  // Check that a failed unseal leaves nothing in the buffer
+  uint8_t zeros[sizeof(buf)] = { 0 };
+  uint8_t wrong_auth[4] = { 'w', 'r', 'o', 'n' };
+
+  CU_ASSERT(tpm2_kmyth_unseal_into(sealed, sealed_len, buf, sizeof(buf),
+                                   &len, wrong_auth, sizeof(wrong_auth),
+                                   NULL, 0, 0) == 1);
+  CU_ASSERT(len == 0);
+  CU_ASSERT(memcmp(buf, zeros, sizeof(buf)) == 0);
+  free(sealed);
+  sealed = NULL;
+
+  // Check that chunked data unseals into the buffer
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT_FATAL(kmyth_ctx_create(&ctx) == 0);
+  CU_ASSERT(tpm2_kmyth_seal_chunked(ctx, input, sizeof(input), 16,
+                                    &sealed, &sealed_len, NULL, 0, NULL, 0,
+                                    NULL, 0, NULL, NULL) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal_into_ctx(ctx, sealed, sealed_len, NULL, 0,
+                                       &len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(len == sizeof(input));
+  memset(buf, 0, sizeof(buf));
+  CU_ASSERT(tpm2_kmyth_unseal_into_ctx(ctx, sealed, sealed_len, buf,
+                                       sizeof(input), &len, NULL, 0, NULL, 0,
+                                       0) == 0);
+  CU_ASSERT(len == sizeof(input));
+  CU_ASSERT(memcmp(buf, input, sizeof(input)) == 0);
+  free(sealed);
+  sealed = NULL;
+
+  // Check that compressed data unseals into the buffer, though its size
+  // cannot be queried
+  size_t big_len = 2 * KMYTH_COMPRESSION_MIN_SIZE;
+  uint8_t *big = calloc(1, big_len);
+  uint8_t *big_buf = malloc(big_len);
+
+  CU_ASSERT_FATAL(big != NULL && big_buf != NULL);
+  CU_ASSERT(kmyth_ctx_set_compression(ctx, "zstd") == 0);
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, big, big_len, &sealed, &sealed_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                0) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal_into_ctx(ctx, sealed, sealed_len, NULL, 0,
+                                       &len, NULL, 0, NULL, 0, 0) == 1);
+  CU_ASSERT(tpm2_kmyth_unseal_into_ctx(ctx, sealed, sealed_len, big_buf,
+                                       big_len - 1, &len, NULL, 0, NULL, 0,
+                                       0) == 1);
+  CU_ASSERT(len == big_len);
+  memset(big_buf, 0xFF, big_len);
+  CU_ASSERT(tpm2_kmyth_unseal_into_ctx(ctx, sealed, sealed_len, big_buf,
+                                       big_len, &len, NULL, 0, NULL, 0,
+                                       0) == 0);
+  CU_ASSERT(len == big_len);
+  CU_ASSERT(memcmp(big_buf, big, big_len) == 0);
+  free(sealed);
+  free(big_buf);
+  free(big);
+
+  // Check invalid parameters
+  CU_ASSERT(tpm2_kmyth_unseal_into(NULL, 0, NULL, 0, &len, NULL, 0, NULL, 0,
+                                   0) == 1);
+  CU_ASSERT(tpm2_kmyth_unseal_into_ctx(NULL, input, sizeof(input), buf,
+                                       sizeof(buf), NULL, NULL, 0, NULL, 0,
+                                       0) == 1);
+
+  kmyth_ctx_destroy(&ctx);
+}
+
+//--------------------------------------------------------------------------------
+// test_tpm2_kmyth_seal_batch
+//--------------------------------------------------------------------------------
+void test_tpm2_kmyth_seal_batch(void)
+{
+  uint8_t input_a[8] = { 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A };
+  uint8_t input_b[4] = { 0x0B, 0x0B, 0x0B, 0x0B };
+
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+
+  // Batch with an empty (invalid) item between two valid ones
+  uint8_t *inputs[3] = { input_a, NULL, input_b };
+  size_t input_lens[3] = { sizeof(input_a), 0, sizeof(input_b) };
+  uint8_t *outputs[3] = { NULL };
+  size_t output_lens[3] = { 0 };
+  int results[3] = { 0 };
+
+  // Check that a failed item is reported, but doesn't stop the others
+  CU_ASSERT(tpm2_kmyth_seal_batch(ctx, 3, inputs, input_lens, outputs,
+                                  output_lens, results, NULL, 0, NULL, 0,
+                                  NULL, 0, NULL, NULL) == 1);
+  CU_ASSERT(results[0] == 0);
+  CU_ASSERT(results[1] == 1);
+  CU_ASSERT(results[2] == 0);
+  CU_ASSERT(outputs[1] == NULL);
+  CU_ASSERT(output_lens[1] == 0);
+
+  // Check that each sealed output unseals to its own input
+  uint8_t *plaintext = NULL;
+  size_t plaintext_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, outputs[0], output_lens[0],
+                                  &plaintext, &plaintext_len, NULL, 0, NULL,
+                                  0, 0) == 0);
+  CU_ASSERT(plaintext_len == sizeof(input_a));
+  CU_ASSERT(plaintext != NULL
+            && memcmp(plaintext, input_a, sizeof(input_a)) == 0);
+  free(plaintext);
+  plaintext = NULL;
+  plaintext_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, outputs[2], output_lens[2],
+                                  &plaintext, &plaintext_len, NULL, 0, NULL,
+                                  0, 0) == 0);
+  CU_ASSERT(plaintext_len == sizeof(input_b));
+  CU_ASSERT(plaintext != NULL
+            && memcmp(plaintext, input_b, sizeof(input_b)) == 0);
+  free(plaintext);
+
+  // Check that the batch shares a single storage key, so the outputs can
+  // be unsealed as one group
+  uint8_t *sealed[2] = { outputs[0], outputs[2] };
+  size_t sealed_lens[2] = { output_lens[0], output_lens[2] };
+  uint8_t *unsealed[2] = { NULL };
+  size_t unsealed_lens[2] = { 0 };
+  int unseal_results[2] = { 0 };
+
+  CU_ASSERT(tpm2_kmyth_unseal_batch(ctx, 2, sealed, sealed_lens, unsealed,
+                                    unsealed_lens, unseal_results, NULL, 0,
+                                    NULL, 0, 0) == 0);
+  free(unsealed[0]);
+  free(unsealed[1]);
+
+  for (int i = 0; i < 3; i++)
+  {
+    free(outputs[i]);
+  }
+
+  // Check that invalid parameters are rejected
+  CU_ASSERT(tpm2_kmyth_seal_batch(NULL, 3, inputs, input_lens, outputs,
+                                  output_lens, results, NULL, 0, NULL, 0,
+                                  NULL, 0, NULL, NULL) == 1);
+  CU_ASSERT(tpm2_kmyth_seal_batch(ctx, 0, inputs, input_lens, outputs,
+                                  output_lens, results, NULL, 0, NULL, 0,
+                                  NULL, 0, NULL, NULL) == 1);
+
+  kmyth_ctx_destroy(&ctx);
+}
+
+//--------------------------------------------------------------------------------
+// secure buffer check: an allocator (using the C library's functions) that
+// tracks the live secure buffers, so that one released with the plain free
+// hook, rather than kmyth_secure_free(), is caught
+//--------------------------------------------------------------------------------
+#define SECURE_CHECK_MAX 64
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  void *live[SECURE_CHECK_MAX];
+  int secure_allocs;
+  int secure_frees;
+  int mismatched_frees;
+} secure_check_state;
+
+static secure_check_state secure_check = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static bool secure_check_untrack(void *ptr)
+{
+  for (size_t i = 0; i < SECURE_CHECK_MAX; i++)
+  {
+    if (secure_check.live[i] == ptr)
+    {
+      secure_check.live[i] = NULL;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *secure_check_alloc(size_t size, void *arg)
+{
+  (void) arg;
+  return malloc(size);
+}
+
+static void *secure_check_realloc(void *ptr, size_t size, void *arg)
+{
+  (void) arg;
+  return realloc(ptr, size);
+}
+
+static void secure_check_free(void *ptr, void *arg)
+{
+  (void) arg;
+  pthread_mutex_lock(&secure_check.lock);
+  if (secure_check_untrack(ptr))
+  {
+    secure_check.mismatched_frees++;
+  }
+  pthread_mutex_unlock(&secure_check.lock);
+  free(ptr);
+}
+
+static void *secure_check_secure_alloc(size_t size, void *arg)
+{
+  (void) arg;
+  void *ptr = calloc(1, size);
+
+  pthread_mutex_lock(&secure_check.lock);
+  secure_check.secure_allocs++;
+  for (size_t i = 0; ptr != NULL && i < SECURE_CHECK_MAX; i++)
+  {
+    if (secure_check.live[i] == NULL)
+    {
+      secure_check.live[i] = ptr;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&secure_check.lock);
+
+  return ptr;
+}
+
+static void secure_check_secure_free(void *ptr, void *arg)
+{
+  (void) arg;
+  pthread_mutex_lock(&secure_check.lock);
+  secure_check.secure_frees++;
+  secure_check_untrack(ptr);
+  pthread_mutex_unlock(&secure_check.lock);
+  free(ptr);
+}
+
+static void secure_check_start(void)
+{
+  kmyth_allocator allocator = {
+    .alloc = secure_check_alloc,
+    .realloc = secure_check_realloc,
+    .free = secure_check_free,
+    .secure_alloc = secure_check_secure_alloc,
+    .secure_free = secure_check_secure_free,
+  };
+
+  memset(secure_check.live, 0, sizeof(secure_check.live));
+  secure_check.secure_allocs = 0;
+  secure_check.secure_frees = 0;
+  secure_check.mismatched_frees = 0;
+  CU_ASSERT(kmyth_set_allocator(&allocator) == 0);
+}
+
+// returns the number of secure buffers allocated since secure_check_start()
+static int secure_check_stop(void)
+{
+  CU_ASSERT(kmyth_set_allocator(NULL) == 0);
+
+  // every secure buffer went back through kmyth_secure_free()
+  CU_ASSERT(secure_check.mismatched_frees == 0);
+  CU_ASSERT(secure_check.secure_frees == secure_check.secure_allocs);
+
+  return secure_check.secure_allocs;
+}
+
+//--------------------------------------------------------------------------------
+// test_tpm2_kmyth_unseal_batch
+//--------------------------------------------------------------------------------
+void test_tpm2_kmyth_unseal_batch(void)
+{
+  uint8_t input_a[8] = { 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A };
+  uint8_t input_b[4] = { 0x0B, 0x0B, 0x0B, 0x0B };
+  uint8_t bad_input[8] = { 0 };
+
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+
+  uint8_t *sealed_a = NULL;
+  size_t sealed_a_len = 0;
+  uint8_t *sealed_b = NULL;
+  size_t sealed_b_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input_a, sizeof(input_a), &sealed_a,
+                                &sealed_a_len, NULL, 0, NULL, 0, NULL, 0,
+                                NULL, NULL, 0) == 0);
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input_b, sizeof(input_b), &sealed_b,
+                                &sealed_b_len, NULL, 0, NULL, 0, NULL, 0,
+                                NULL, NULL, 0) == 0);
+
+  // Batch contains two items sharing a storage key, an item with its own
+  // storage key, and an unparseable item in the middle
+  uint8_t *inputs[4] = { sealed_a, bad_input, sealed_b, sealed_a };
+  size_t input_lens[4] = { sealed_a_len, sizeof(bad_input), sealed_b_len,
+    sealed_a_len
+  };
+  uint8_t *outputs[4] = { NULL };
+  size_t output_lens[4] = { 0 };
+  int results[4] = { 0 };
+
+  // Check that a failed item is reported, but doesn't stop the others
+  CU_ASSERT(tpm2_kmyth_unseal_batch(ctx, 4, inputs, input_lens, outputs,
+                                    output_lens, results, NULL, 0, NULL, 0,
+                                    0) == 1);
+  CU_ASSERT(results[0] == 0);
+  CU_ASSERT(results[1] == 1);
+  CU_ASSERT(results[2] == 0);
+  CU_ASSERT(results[3] == 0);
+  CU_ASSERT(outputs[1] == NULL);
+  CU_ASSERT(output_lens[1] == 0);
+  CU_ASSERT(output_lens[0] == sizeof(input_a));
+  CU_ASSERT(output_lens[2] == sizeof(input_b));
+  CU_ASSERT(output_lens[3] == sizeof(input_a));
+  CU_ASSERT(outputs[0] != NULL
+            && memcmp(outputs[0], input_a, sizeof(input_a)) == 0);
+  CU_ASSERT(outputs[2] != NULL
+            && memcmp(outputs[2], input_b, sizeof(input_b)) == 0);
+  CU_ASSERT(outputs[3] != NULL
+            && memcmp(outputs[3], input_a, sizeof(input_a)) == 0);
+
+  for (int i = 0; i < 4; i++)
+  {
+    free(outputs[i]);
+    outputs[i] = NULL;
+  }
+
+  // Check that an all-valid batch succeeds
+  inputs[1] = sealed_b;
+  input_lens[1] = sealed_b_len;
+  CU_ASSERT(tpm2_kmyth_unseal_batch(ctx, 4, inputs, input_lens, outputs,
+                                    output_lens, results, NULL, 0, NULL, 0,
+                                    0) == 0);
+  for (int i = 0; i < 4; i++)
+  {
+    CU_ASSERT(results[i] == 0);
+    free(outputs[i]);
+    outputs[i] = NULL;
+  }
+
+  // Check that each item's unsealed wrapping key (held in the secure heap)
+  // is released back to it, with a failed item in the batch
+  inputs[1] = bad_input;
+  input_lens[1] = sizeof(bad_input);
+  secure_check_start();
+  CU_ASSERT(tpm2_kmyth_unseal_batch(ctx, 4, inputs, input_lens, outputs,
+                                    output_lens, results, NULL, 0, NULL, 0,
+                                    0) == 1);
+  for (int i = 0; i < 4; i++)
+  {
+    free(outputs[i]);
+    outputs[i] = NULL;
+  }
+  CU_ASSERT(secure_check_stop() == 3);
+
+  // Check that invalid parameters are rejected
+  CU_ASSERT(tpm2_kmyth_unseal_batch(NULL, 4, inputs, input_lens, outputs,
+                                    output_lens, results, NULL, 0, NULL, 0,
+                                    0) == 1);
+  CU_ASSERT(tpm2_kmyth_unseal_batch(ctx, 0, inputs, input_lens, outputs,
+                                    output_lens, results, NULL, 0, NULL, 0,
+                                    0) == 1);
+
+  free(sealed_a);
+  free(sealed_b);
+  kmyth_ctx_destroy(&ctx);
+}
+
+//--------------------------------------------------------------------------------
+// test_tpm2_kmyth_rewrap_batch
+//--------------------------------------------------------------------------------
+void test_tpm2_kmyth_rewrap_batch(void)
+{
+  uint8_t input_a[8] = { 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A };
+  uint8_t input_b[4] = { 0x0B, 0x0B, 0x0B, 0x0B };
+  uint8_t bad_input[8] = { 0 };
+
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+
+  uint8_t *sealed_a = NULL;
+  size_t sealed_a_len = 0;
+  uint8_t *sealed_b = NULL;
+  size_t sealed_b_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input_a, sizeof(input_a), &sealed_a,
+                                &sealed_a_len, NULL, 0, NULL, 0, NULL, 0,
+                                NULL, NULL, 0) == 0);
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input_b, sizeof(input_b), &sealed_b,
+                                &sealed_b_len, NULL, 0, NULL, 0, NULL, 0,
+                                NULL, NULL, 0) == 0);
+
+  uint8_t *inputs[3] = { sealed_a, bad_input, sealed_b };
+  size_t input_lens[3] = { sealed_a_len, sizeof(bad_input), sealed_b_len };
+  uint8_t *outputs[3] = { NULL };
+  size_t output_lens[3] = { 0 };
+  int results[3] = { 0 };
+
+  // Check that a failed item is reported, but doesn't stop the others
+  CU_ASSERT(tpm2_kmyth_rewrap_batch(ctx, 3, inputs, input_lens, outputs,
+                                    output_lens, results, NULL, 0, NULL, 0,
+                                    NULL, 0, NULL, 0) == 1);
+  CU_ASSERT(results[0] == 0);
+  CU_ASSERT(results[1] == 1);
+  CU_ASSERT(results[2] == 0);
+  CU_ASSERT(outputs[1] == NULL);
+  CU_ASSERT(output_lens[1] == 0);
+
+  // Check that the re-sealed items unseal to the original data
+  uint8_t *plain = NULL;
+  size_t plain_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, outputs[0], output_lens[0], &plain,
+                                  &plain_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(plain_len == sizeof(input_a));
+  CU_ASSERT(plain != NULL && memcmp(plain, input_a, sizeof(input_a)) == 0);
+  free(plain);
+  plain = NULL;
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, outputs[2], output_lens[2], &plain,
+                                  &plain_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(plain_len == sizeof(input_b));
+  CU_ASSERT(plain != NULL && memcmp(plain, input_b, sizeof(input_b)) == 0);
+  free(plain);
+
+  for (int i = 0; i < 3; i++)
+  {
+    free(outputs[i]);
+    outputs[i] = NULL;
+  }
+
+  // Check that each item's recovered wrapping key (held in the secure heap)
+  // is released back to it once re-sealed
+  secure_check_start();
+  CU_ASSERT(tpm2_kmyth_rewrap_batch(ctx, 3, inputs, input_lens, outputs,
+                                    output_lens, results, NULL, 0, NULL, 0,
+                                    NULL, 0, NULL, 0) == 1);
+  for (int i = 0; i < 3; i++)
+  {
+    free(outputs[i]);
+    outputs[i] = NULL;
+  }
+  CU_ASSERT(secure_check_stop() == 2);
+
+  // Check that invalid parameters are rejected
+  CU_ASSERT(tpm2_kmyth_rewrap_batch(NULL, 3, inputs, input_lens, outputs,
+                                    output_lens, results, NULL, 0, NULL, 0,
+                                    NULL, 0, NULL, 0) == 1);
+  CU_ASSERT(tpm2_kmyth_rewrap_batch(ctx, 0, inputs, input_lens, outputs,
+                                    output_lens, results, NULL, 0, NULL, 0,
+                                    NULL, 0, NULL, 0) == 1);
+
+  free(sealed_a);
+  free(sealed_b);
+  kmyth_ctx_destroy(&ctx);
+}
+
+//--------------------------------------------------------------------------------
+// test_tpm2_kmyth_seal_unseal_stream
+//--------------------------------------------------------------------------------
+void test_tpm2_kmyth_seal_unseal_stream(void)
+{
+  // input spanning several stream blocks, not a multiple of the block size
+  size_t input_len = 2 * KMYTH_STREAM_BLOCK_SIZE + 17;
+  uint8_t *input = malloc(input_len);
+
+  for (size_t i = 0; i < input_len; i++)
+  {
+    input[i] = (uint8_t) (i * 7);
+  }
+
+  FILE *in_file = tmpfile();
+  FILE *sealed_file = tmpfile();
+  FILE *out_file = tmpfile();
+  FILE *empty_file = tmpfile();
+
+  CU_ASSERT_FATAL(in_file != NULL && sealed_file != NULL &&
+                  out_file != NULL && empty_file != NULL);
+  int in_fd = fileno(in_file);
+  int sealed_fd = fileno(sealed_file);
+  int out_fd = fileno(out_file);
+
+  CU_ASSERT(write_to_fd(in_fd, input, input_len) == 0);
+  lseek(in_fd, 0, SEEK_SET);
+
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+
+  // Check that the stream is sealed
+  CU_ASSERT(tpm2_kmyth_seal_stream(ctx, in_fd, sealed_fd, NULL, 0, NULL, 0,
+                                   NULL, 0, NULL, NULL) == 0);
+
+  // Check that the streamed output is a .ski the one-shot unseal accepts
+  off_t sealed_len = lseek(sealed_fd, 0, SEEK_END);
+
+  CU_ASSERT(sealed_len > 0);
+  uint8_t *sealed = malloc((size_t) sealed_len);
+  size_t sealed_read = 0;
+
+  lseek(sealed_fd, 0, SEEK_SET);
+  CU_ASSERT(read_from_fd(sealed_fd, sealed, (size_t) sealed_len,
+                         &sealed_read) == 0);
+  CU_ASSERT(sealed_read == (size_t) sealed_len);
+
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_read, &output,
+                                  &output_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(output_len == input_len);
+  CU_ASSERT(output != NULL && memcmp(output, input, input_len) == 0);
+  free(output);
+  output = NULL;
+
+  // Check that the stream unseal recovers the input
+  uint8_t *unsealed = malloc(input_len + 1);
+  size_t unsealed_len = 0;
+
+  lseek(sealed_fd, 0, SEEK_SET);
+  CU_ASSERT(tpm2_kmyth_unseal_stream(ctx, sealed_fd, out_fd, NULL, 0, NULL,
+                                     0, 0) == 0);
+  lseek(out_fd, 0, SEEK_SET);
+  CU_ASSERT(read_from_fd(out_fd, unsealed, input_len + 1,
+                         &unsealed_len) == 0);
+  CU_ASSERT(unsealed_len == input_len);
+  CU_ASSERT(memcmp(unsealed, input, input_len) == 0);
+
+  // Check that the stream unseal accepts one-shot sealed .ski input
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, 100, &output, &output_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                0) == 0);
+  CU_ASSERT(ftruncate(sealed_fd, 0) == 0);
+  CU_ASSERT(ftruncate(out_fd, 0) == 0);
+  lseek(sealed_fd, 0, SEEK_SET);
+  lseek(out_fd, 0, SEEK_SET);
+  CU_ASSERT(write_to_fd(sealed_fd, output, output_len) == 0);
+  lseek(sealed_fd, 0, SEEK_SET);
+  CU_ASSERT(tpm2_kmyth_unseal_stream(ctx, sealed_fd, out_fd, NULL, 0, NULL,
+                                     0, 0) == 0);
+  lseek(out_fd, 0, SEEK_SET);
+  CU_ASSERT(read_from_fd(out_fd, unsealed, input_len, &unsealed_len) == 0);
+  CU_ASSERT(unsealed_len == 100);
+  CU_ASSERT(memcmp(unsealed, input, 100) == 0);
+
+  // Check that a truncated .ski is rejected
+  CU_ASSERT(ftruncate(sealed_fd, (off_t) output_len - 1) == 0);
+  lseek(sealed_fd, 0, SEEK_SET);
+  CU_ASSERT(tpm2_kmyth_unseal_stream(ctx, sealed_fd, out_fd, NULL, 0, NULL,
+                                     0, 0) == 1);
+  free(output);
+
+  // Check that empty input and ciphers that can't be streamed are rejected
+  lseek(in_fd, 0, SEEK_SET);
+  CU_ASSERT(tpm2_kmyth_seal_stream(ctx, fileno(empty_file), sealed_fd,
+                                   NULL, 0, NULL, 0, NULL, 0, NULL,
+                                   NULL) == 1);
+  CU_ASSERT(tpm2_kmyth_seal_stream(ctx, in_fd, sealed_fd, NULL, 0, NULL, 0,
+                                   NULL, 0,
+                                   "AES/KeyWrap/RFC5649Padding/256",
+                                   NULL) == 1);
+  CU_ASSERT(tpm2_kmyth_unseal_stream(NULL, sealed_fd, out_fd, NULL, 0, NULL,
+                                     0, 0) == 1);
+
+  kmyth_ctx_destroy(&ctx);
+
+  fclose(in_file);
+  fclose(sealed_file);
+  fclose(out_file);
+  fclose(empty_file);
+  free(input);
+  free(sealed);
+  free(unsealed);
+}
+
+//--------------------------------------------------------------------------------
+// test_tpm2_kmyth_seal_chunked_unseal_range
+//--------------------------------------------------------------------------------
+void test_tpm2_kmyth_seal_chunked_unseal_range(void)
+{
+  size_t input_len = 10000;
+  size_t chunk_size = 1024;
+  uint8_t *input = malloc(input_len);
+
+  for (size_t i = 0; i < input_len; i++)
+  {
+    input[i] = (uint8_t) (i * 11);
+  }
+
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+
+  // Check that the input is sealed into a chunked .ski
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_seal_chunked(ctx, input, input_len, chunk_size,
+                                    &sealed, &sealed_len, NULL, 0, NULL, 0,
+                                    NULL, 0, NULL, NULL) == 0);
+  CU_ASSERT(memmem(sealed, sealed_len, KMYTH_DELIM_CHUNK_INDEX,
+                   strlen(KMYTH_DELIM_CHUNK_INDEX)) != NULL);
+
+  // Check that ranges within, across, and at the ends of chunks unseal
+  size_t ranges[][2] = { {0, 1}, {0, input_len}, {1023, 2}, {5000, 3000},
+  {input_len - 1, 1}, {2048, 1024}
+  };
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++)
+  {
+    CU_ASSERT(tpm2_kmyth_unseal_range(ctx, sealed, sealed_len,
+                                      ranges[i][0], ranges[i][1],
+                                      &output, &output_len, NULL, 0,
+                                      NULL, 0, 0) == 0);
+    CU_ASSERT(output_len == ranges[i][1]);
+    CU_ASSERT(output != NULL &&
+              memcmp(output, input + ranges[i][0], ranges[i][1]) == 0);
+    free(output);
+    output = NULL;
+    output_len = 0;
+  }
+
+  // Check that the whole chunked .ski also unseals with the one-shot unseal
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &output,
+                                  &output_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(output_len == input_len);
+  CU_ASSERT(output != NULL && memcmp(output, input, input_len) == 0);
+  free(output);
+  output = NULL;
+  output_len = 0;
+
+  // Check that ranges outside of the sealed data are rejected
+  CU_ASSERT(tpm2_kmyth_unseal_range(ctx, sealed, sealed_len, input_len, 1,
+                                    &output, &output_len, NULL, 0, NULL, 0,
+                                    0) == 1);
+  CU_ASSERT(tpm2_kmyth_unseal_range(ctx, sealed, sealed_len, 1, input_len,
+                                    &output, &output_len, NULL, 0, NULL, 0,
+                                    0) == 1);
+  CU_ASSERT(tpm2_kmyth_unseal_range(ctx, sealed, sealed_len, 0, 0,
+                                    &output, &output_len, NULL, 0, NULL, 0,
+                                    0) == 1);
+  CU_ASSERT(output == NULL);
+
+  // Check that a modified chunk is detected (only when it is unsealed)
+  uint8_t *enc_data = memmem(sealed, sealed_len, KMYTH_DELIM_ENC_DATA,
+                             strlen(KMYTH_DELIM_ENC_DATA));
+
+  CU_ASSERT_FATAL(enc_data != NULL);
+  enc_data += strlen(KMYTH_DELIM_ENC_DATA);
+  enc_data[0] = (enc_data[0] == 'A') ? 'B' : 'A';
+  CU_ASSERT(tpm2_kmyth_unseal_range(ctx, sealed, sealed_len, 0, 1,
+                                    &output, &output_len, NULL, 0, NULL, 0,
+                                    0) == 1);
+  CU_ASSERT(tpm2_kmyth_unseal_range(ctx, sealed, sealed_len, 5000, 1,
+                                    &output, &output_len, NULL, 0, NULL, 0,
+                                    0) == 0);
+  free(output);
+  output = NULL;
+  free(sealed);
+  sealed = NULL;
+
+  // Check that non-chunked .ski input and non-GCM ciphers are rejected
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, 100, &sealed, &sealed_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                0) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal_range(ctx, sealed, sealed_len, 0, 1,
+                                    &output, &output_len, NULL, 0, NULL, 0,
+                                    0) == 1);
+  free(sealed);
+  sealed = NULL;
+  CU_ASSERT(tpm2_kmyth_seal_chunked(ctx, input, input_len, chunk_size,
+                                    &sealed, &sealed_len, NULL, 0, NULL, 0,
+                                    NULL, 0,
+                                    "AES/KeyWrap/RFC5649Padding/256",
+                                    NULL) == 1);
+  CU_ASSERT(tpm2_kmyth_seal_chunked(ctx, NULL, input_len, chunk_size,
+                                    &sealed, &sealed_len, NULL, 0, NULL, 0,
+                                    NULL, 0, NULL, NULL) == 1);
+  CU_ASSERT(tpm2_kmyth_unseal_range(NULL, sealed, sealed_len, 0, 1,
+                                    &output, &output_len, NULL, 0, NULL, 0,
+                                    0) == 1);
+
+  kmyth_ctx_destroy(&ctx);
+  free(input);
+}
+
+//--------------------------------------------------------------------------------
+// test_tpm2_kmyth_seal_chunked_parallel
+//--------------------------------------------------------------------------------
+void test_tpm2_kmyth_seal_chunked_parallel(void)
+{
+  size_t input_len = 100000;
+  size_t chunk_size = 1000;
+  uint8_t *input = malloc(input_len);
+
+  for (size_t i = 0; i < input_len; i++)
+  {
+    input[i] = (uint8_t) (i * 7);
+  }
+
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+  CU_ASSERT(kmyth_ctx_set_chunk_size(NULL, chunk_size) == 1);
+  CU_ASSERT(kmyth_ctx_set_chunk_size(ctx, chunk_size) == 0);
+
+  // Check that chunks encrypted by several workers unseal with one, and
+  // the other way around
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  CU_ASSERT(kmyth_ctx_set_jobs(ctx, 4) == 0);
+  CU_ASSERT(tpm2_kmyth_seal_chunked(ctx, input, input_len, chunk_size,
+                                    &sealed, &sealed_len, NULL, 0, NULL, 0,
+                                    NULL, 0, NULL, NULL) == 0);
+  CU_ASSERT(kmyth_ctx_set_jobs(ctx, 1) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &output,
+                                  &output_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(output_len == input_len);
+  CU_ASSERT(output != NULL && memcmp(output, input, input_len) == 0);
+  free(output);
+  output = NULL;
+
+  CU_ASSERT(kmyth_ctx_set_jobs(ctx, 4) == 0);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &output,
+                                  &output_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(output_len == input_len);
+  CU_ASSERT(output != NULL && memcmp(output, input, input_len) == 0);
+  free(output);
+  output = NULL;
+
+  // Check that a range starting and ending part way through a chunk, and
+  // spanning many, unseals in parallel
+  CU_ASSERT(tpm2_kmyth_unseal_range(ctx, sealed, sealed_len, 1500, 50000,
+                                    &output, &output_len, NULL, 0, NULL, 0,
+                                    0) == 0);
+  CU_ASSERT(output_len == 50000);
+  CU_ASSERT(output != NULL && memcmp(output, input + 1500, 50000) == 0);
+  free(output);
+  output = NULL;
+
+  // Check that a modified chunk is still detected
+  uint8_t *enc_data = memmem(sealed, sealed_len, KMYTH_DELIM_ENC_DATA,
+                             strlen(KMYTH_DELIM_ENC_DATA));
+
+  CU_ASSERT_FATAL(enc_data != NULL);
+  enc_data += strlen(KMYTH_DELIM_ENC_DATA) + 100;
+  enc_data[0] = (enc_data[0] == 'A') ? 'B' : 'A';
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &output,
+                                  &output_len, NULL, 0, NULL, 0, 0) == 1);
+  CU_ASSERT(output == NULL);
+
+  free(sealed);
+  kmyth_ctx_destroy(&ctx);
+  free(input);
+}
+
+//--------------------------------------------------------------------------------
+// test_kmyth_ctx_seal_compressed
+//--------------------------------------------------------------------------------
+void test_kmyth_ctx_seal_compressed(void)
+{
+  // compressible input spanning several stream blocks
+  size_t input_len = 3 * KMYTH_STREAM_BLOCK_SIZE + 17;
+  uint8_t *input = malloc(input_len);
+  const char *line = "option.name = some configuration value\n";
+
+  CU_ASSERT_FATAL(input != NULL);
+  for (size_t i = 0; i < input_len; i++)
+  {
+    input[i] = (uint8_t) line[i % strlen(line)];
+  }
+
+  char tag[KMYTH_MAX_CIPHER_STR_LEN + 1];
+
+  snprintf(tag, sizeof(tag), "%s%c%s\n", KMYTH_DEFAULT_CIPHER,
+           KMYTH_COMPRESSION_TAG_SEPARATOR, KMYTH_COMPRESSION_ZSTD_NAME);
+
+  kmyth_ctx_t *ctx = NULL;
+
+  CU_ASSERT(kmyth_ctx_create(&ctx) == 0);
+  CU_ASSERT(kmyth_ctx_set_compression(NULL, "zstd") == 1);
+  CU_ASSERT(kmyth_ctx_set_compression(ctx, "lz77") == 1);
+  CU_ASSERT(kmyth_ctx_set_compression(ctx, "zstd") == 0);
+
+  // Check that compressed data is tagged, smaller, and unseals
+  uint8_t *sealed = NULL;
+  size_t sealed_len = 0;
+  uint8_t *output = NULL;
+  size_t output_len = 0;
+
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, input_len, &sealed, &sealed_len,
+                                NULL, 0, NULL, 0, NULL, 0, NULL, NULL,
+                                0) == 0);
+  CU_ASSERT(sealed_len < input_len / 10);
+  CU_ASSERT(memmem(sealed, sealed_len, tag, strlen(tag)) != NULL);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &output,
+                                  &output_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(output_len == input_len);
+  CU_ASSERT(output != NULL && memcmp(output, input, input_len) == 0);
+  free(output);
+  output = NULL;
+
+  // Check that the stream unseal decompresses it too
+  FILE *in_file = tmpfile();
+  FILE *sealed_file = tmpfile();
+  FILE *out_file = tmpfile();
+
+  CU_ASSERT_FATAL(in_file != NULL && sealed_file != NULL && out_file != NULL);
+  int in_fd = fileno(in_file);
+  int sealed_fd = fileno(sealed_file);
+  int out_fd = fileno(out_file);
+  uint8_t *unsealed = malloc(input_len + 1);
+  size_t unsealed_len = 0;
+
+  CU_ASSERT(write_to_fd(sealed_fd, sealed, sealed_len) == 0);
+  lseek(sealed_fd, 0, SEEK_SET);
+  CU_ASSERT(tpm2_kmyth_unseal_stream(ctx, sealed_fd, out_fd, NULL, 0, NULL,
+                                     0, 0) == 0);
+  lseek(out_fd, 0, SEEK_SET);
+  CU_ASSERT(read_from_fd(out_fd, unsealed, input_len + 1,
+                         &unsealed_len) == 0);
+  CU_ASSERT(unsealed_len == input_len);
+  CU_ASSERT(memcmp(unsealed, input, input_len) == 0);
+  free(sealed);
+  sealed = NULL;
+
+  // Check that a compressed stream seal unseals, streamed or not
+  CU_ASSERT(write_to_fd(in_fd, input, input_len) == 0);
+  lseek(in_fd, 0, SEEK_SET);
+  CU_ASSERT(ftruncate(sealed_fd, 0) == 0);
+  CU_ASSERT(ftruncate(out_fd, 0) == 0);
+  lseek(sealed_fd, 0, SEEK_SET);
+  lseek(out_fd, 0, SEEK_SET);
+  CU_ASSERT(tpm2_kmyth_seal_stream(ctx, in_fd, sealed_fd, NULL, 0, NULL, 0,
+                                   NULL, 0, NULL, NULL) == 0);
+
+  off_t stream_len = lseek(sealed_fd, 0, SEEK_END);
+
+  CU_ASSERT(stream_len > 0 && (size_t) stream_len < input_len / 10);
+  sealed = malloc((size_t) stream_len);
+  lseek(sealed_fd, 0, SEEK_SET);
+  CU_ASSERT(read_from_fd(sealed_fd, sealed, (size_t) stream_len,
+                         &sealed_len) == 0);
+  CU_ASSERT(memmem(sealed, sealed_len, tag, strlen(tag)) != NULL);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &output,
+                                  &output_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(output_len == input_len);
+  CU_ASSERT(output != NULL && memcmp(output, input, input_len) == 0);
+  free(output);
+  output = NULL;
+
+  lseek(sealed_fd, 0, SEEK_SET);
+  CU_ASSERT(tpm2_kmyth_unseal_stream(ctx, sealed_fd, out_fd, NULL, 0, NULL,
+                                     0, 0) == 0);
+  lseek(out_fd, 0, SEEK_SET);
+  CU_ASSERT(read_from_fd(out_fd, unsealed, input_len + 1,
+                         &unsealed_len) == 0);
+  CU_ASSERT(unsealed_len == input_len);
+  CU_ASSERT(memcmp(unsealed, input, input_len) == 0);
+  free(sealed);
+  sealed = NULL;
+
+  // Check that small input is not compressed
+  CU_ASSERT(tpm2_kmyth_seal_ctx(ctx, input, KMYTH_COMPRESSION_MIN_SIZE - 1,
+                                &sealed, &sealed_len, NULL, 0, NULL, 0,
+                                NULL, 0, NULL, NULL, 0) == 0);
+  CU_ASSERT(memmem(sealed, sealed_len, tag, strlen(tag)) == NULL);
+  CU_ASSERT(tpm2_kmyth_unseal_ctx(ctx, sealed, sealed_len, &output,
+                                  &output_len, NULL, 0, NULL, 0, 0) == 0);
+  CU_ASSERT(output_len == KMYTH_COMPRESSION_MIN_SIZE - 1);
+  CU_ASSERT(output != NULL && memcmp(output, input, output_len) == 0);
+  free(output);
+  output = NULL;
+  free(sealed);
+  sealed = NULL;
+
+  // Check that chunked data cannot be compressed
+  CU_ASSERT(tpm2_kmyth_seal_chunked(ctx, input, input_len, 1000,
+                                    &sealed, &sealed_len, NULL, 0, NULL, 0,
+                                    NULL, 0, NULL, NULL) == 1);
+  CU_ASSERT(sealed == NULL);
+
+  kmyth_ctx_destroy(&ctx);
+
+  fclose(in_file);
+  fclose(sealed_file);
+  fclose(out_file);
+  free(unsealed);
+  free(input);
+}
+
 //--------------------------------------------------------------------------------
 // test_tpm2_kmyth_seal_file
 //--------------------------------------------------------------------------------
@@ -271,7 +2072,8 @@ void test_tpm2_kmyth_seal_data(void)
   TPM2_HANDLE sk_handle = 0;
 
   create_and_load_sk(sapi_ctx, srk_handle, authVal, authVal, ski.pcr_list,
-                     authPolicy, &sk_handle, &ski.sk_priv, &ski.sk_pub);
+                     authPolicy, KMYTH_KEY_PUBKEY_ALG, &sk_handle,
+                     &ski.sk_priv, &ski.sk_pub);
 
   uint8_t data[8] = { 0 };
   size_t data_len = 8;
@@ -341,7 +2143,8 @@ void test_tpm2_kmyth_unseal_data(void)
   TPM2_HANDLE sk_handle = 0;
 
   create_and_load_sk(sapi_ctx, srk_handle, authVal, authVal, ski.pcr_list,
-                     authPolicy, &sk_handle, &ski.sk_priv, &ski.sk_pub);
+                     authPolicy, KMYTH_KEY_PUBKEY_ALG, &sk_handle,
+                     &ski.sk_priv, &ski.sk_pub);
 
   uint8_t input_data[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
   size_t input_data_len = 8;
@@ -363,7 +2166,7 @@ void test_tpm2_kmyth_unseal_data(void)
   CU_ASSERT(output_data_len == 8);
   CU_ASSERT(memcmp(output_data, input_data, 8) == 0);
 
-  free(output_data);
+  kmyth_secure_free(output_data);
   output_data = NULL;
   output_data_len = 0;
 
@@ -12,6 +12,7 @@
 
 #include "tpm2_interface.h"
 #include "marshalling_tools_test.h"
+#include "formatting_tools.h"
 #include "marshalling_tools.h"
 #include "object_tools.h"
 #include "defines.h"
@@ -98,6 +99,12 @@ int marshalling_tools_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "cursor_pack_*() / view_unpack_*() Tests",
+                          test_cursor_pack_view_unpack))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "unpack_uint32_to_str() Tests",
                           test_unpack_uint32_to_str))
   {
@@ -116,6 +123,42 @@ int marshalling_tools_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "create_ski_bytes_buf() Tests",
+                          test_create_ski_bytes_buf))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "create/parse_ski_header_bytes() Tests",
+                          test_create_parse_ski_header_bytes))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "create/parse_ski_binary_bytes() Tests",
+                          test_create_parse_ski_binary_bytes))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "parse_ski_metadata() Tests",
+                          test_parse_ski_metadata))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "get_ski_srk_name() Tests",
+                          test_get_ski_srk_name))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Cipher suite compression tag Tests",
+                          test_ski_compression_tag))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "free_ski() Tests", test_free_ski))
   {
     return 1;
@@ -286,7 +329,7 @@ size_t init_test_public(TPM2B_PUBLIC * test_public, size_t offset)
   //   - RSA key value is set to an incrementing byte pattern.
   //   - 'size' member of the struct is calculated by adding
   //     up the sizes for each field in the 'publicArea' member.
-  if (init_kmyth_object_template(true, empty_authPolicy,
+  if (init_kmyth_object_template(true, KMYTH_KEY_PUBKEY_ALG, empty_authPolicy,
                                  &test_public->publicArea))
   {
     CU_FAIL("test public object template struct initialization error");
@@ -1555,6 +1598,80 @@ void test_pack_unpack_private(void)
   free(test_packed_private_data);
 }
 
+//----------------------------------------------------------------------------
+// test_cursor_pack_view_unpack
+//----------------------------------------------------------------------------
+void test_cursor_pack_view_unpack(void)
+{
+  TPML_PCR_SELECTION pcr_in = { 0 };
+  TPML_PCR_SELECTION pcr_out = { 0 };
+  TPM2B_PUBLIC public_in = { 0 };
+  TPM2B_PUBLIC public_out = { 0 };
+  TPM2B_PRIVATE private_in = { 0 };
+  TPM2B_PRIVATE private_out = { 0 };
+  TPM2B_DIGEST digest_in = {.size = 32 };
+  TPM2B_DIGEST digest_out = { 0 };
+
+  init_test_pcrSelect(&pcr_in, 0);
+  init_test_public(&public_in, 0);
+  size_t private_size = init_test_private(&private_in, 64, 0);
+
+  memset(digest_in.buffer, 0x5A, digest_in.size);
+
+  // marshal every struct, a number of times, into one (growing) buffer
+  marshal_cursor cursor;
+
+  marshal_cursor_init(&cursor, NULL, 0);
+  for (int i = 0; i < 16; i++)
+  {
+    CU_ASSERT(cursor_pack_pcr(&cursor, &pcr_in) == 0);
+    CU_ASSERT(cursor_pack_public(&cursor, &public_in) == 0);
+    CU_ASSERT(cursor_pack_private(&cursor, &private_in) == 0);
+    CU_ASSERT(cursor_pack_digest(&cursor, &digest_in) == 0);
+  }
+  CU_ASSERT(cursor.owned);
+  CU_ASSERT(cursor.offset <= cursor.size);
+
+  // check that each struct unmarshals in sequence from a view
+  unmarshal_view view;
+
+  unmarshal_view_init(&view, cursor.buf, cursor.offset);
+  for (int i = 0; i < 16; i++)
+  {
+    CU_ASSERT(view_unpack_pcr(&view, &pcr_out) == 0);
+    CU_ASSERT(match_pcrSelect(pcr_in, pcr_out));
+    CU_ASSERT(view_unpack_public(&view, &public_out) == 0);
+    CU_ASSERT(match_public(public_in, public_out));
+    CU_ASSERT(view_unpack_private(&view, &private_out) == 0);
+    CU_ASSERT(match_private(private_in, private_out));
+    CU_ASSERT(view_unpack_digest(&view, &digest_out) == 0);
+    CU_ASSERT(digest_out.size == digest_in.size);
+    CU_ASSERT(memcmp(digest_out.buffer, digest_in.buffer,
+                     digest_in.size) == 0);
+  }
+  CU_ASSERT(view.offset == cursor.offset);
+
+  // check that unmarshalling past the end of the view errors, without
+  // moving the view
+  CU_ASSERT(view_unpack_digest(&view, &digest_out) != 0);
+  CU_ASSERT(view.offset == cursor.offset);
+
+  marshal_cursor_free(&cursor);
+  CU_ASSERT(cursor.buf == NULL);
+
+  // check that a caller's buffer is never grown - marshalling more than
+  // fits errors, without moving the cursor
+  uint8_t fixed[2 * sizeof(TPM2B_PRIVATE)];
+
+  marshal_cursor_init(&cursor, fixed, private_size + 1);
+  CU_ASSERT(cursor_pack_private(&cursor, &private_in) == 0);
+  CU_ASSERT(cursor.offset == private_size);
+  CU_ASSERT(cursor_pack_private(&cursor, &private_in) != 0);
+  CU_ASSERT(cursor.offset == private_size);
+  CU_ASSERT(cursor.buf == fixed);
+  marshal_cursor_free(&cursor);
+}
+
 //----------------------------------------------------------------------------
 // test_unpack_uint32_to_str
 //----------------------------------------------------------------------------
@@ -1771,6 +1888,478 @@ void test_create_ski_bytes(void)
   CU_ASSERT(sb_len == 0);
 }
 
+//----------------------------------------------------------------------------
+// test_create_ski_bytes_buf
+//----------------------------------------------------------------------------
+void test_create_ski_bytes_buf(void)
+{
+  uint8_t bool_policy_or = 0;
+  size_t ski_bytes_len = strlen(CONST_SKI_BYTES);
+
+  Ski ski = get_default_ski();
+
+  parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len, &ski, bool_policy_or);  //get valid ski struct
+
+  //A size query returns the exact .ski size
+  size_t sb_len = 0;
+
+  CU_ASSERT(create_ski_bytes_buf(ski, NULL, 0, &sb_len) == 0);
+  CU_ASSERT(sb_len == ski_bytes_len);
+
+  //The output written to a large enough buffer matches create_ski_bytes()
+  uint8_t *sb = malloc(ski_bytes_len + 1);
+
+  sb[ski_bytes_len] = 0xa5;
+  sb_len = 0;
+  CU_ASSERT(create_ski_bytes_buf(ski, sb, ski_bytes_len + 1, &sb_len) == 0);
+  CU_ASSERT(sb_len == ski_bytes_len);
+  CU_ASSERT(memcmp(sb, CONST_SKI_BYTES, sb_len) == 0);
+  CU_ASSERT(sb[ski_bytes_len] == 0xa5);
+
+  //A buffer too small fails, but still reports the size needed
+  sb_len = 0;
+  CU_ASSERT(create_ski_bytes_buf(ski, sb, ski_bytes_len - 1, &sb_len) == 1);
+  CU_ASSERT(sb_len == ski_bytes_len);
+
+  //Invalid parameters
+  CU_ASSERT(create_ski_bytes_buf(ski, sb, ski_bytes_len, NULL) == 1);
+  CU_ASSERT(create_ski_bytes_buf(get_default_ski(), sb, ski_bytes_len,
+                                 &sb_len) == 1);
+  free(sb);
+  free_ski(&ski);
+}
+
+//----------------------------------------------------------------------------
+// test_create_parse_ski_header_bytes
+//----------------------------------------------------------------------------
+void test_create_parse_ski_header_bytes(void)
+{
+  uint8_t bool_policy_or = 0;
+  size_t ski_bytes_len = strlen(CONST_SKI_BYTES);
+  size_t delim_len = strlen(KMYTH_DELIM_ENC_DATA);
+  uint8_t chunk_index[KMYTH_CHUNK_INDEX_SIZE];
+
+  Ski ski = get_default_ski();
+
+  parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len, &ski, bool_policy_or);  //get valid ski struct
+
+  //Header is the .ski contents up to and including the ENC_DATA delimiter
+  uint8_t *hb = NULL;
+  size_t hb_len = 0;
+
+  CU_ASSERT(create_ski_header_bytes(ski, &hb, &hb_len) == 0);
+  CU_ASSERT(hb_len > delim_len && hb_len < ski_bytes_len);
+  CU_ASSERT(memcmp(hb, CONST_SKI_BYTES, hb_len) == 0);
+  CU_ASSERT(memcmp(hb + hb_len - delim_len, KMYTH_DELIM_ENC_DATA,
+                   delim_len) == 0);
+
+  //Parsing the header recovers everything but the encrypted data
+  Ski hdr = get_default_ski();
+
+  CU_ASSERT(parse_ski_header_bytes(hb, hb_len, &hdr, bool_policy_or) == 0);
+  CU_ASSERT(hdr.pcr_list.count == ski.pcr_list.count);
+  CU_ASSERT(hdr.sk_pub.size == ski.sk_pub.size);
+  CU_ASSERT(hdr.sk_priv.size == ski.sk_priv.size);
+  CU_ASSERT(hdr.wk_pub.size == ski.wk_pub.size);
+  CU_ASSERT(hdr.wk_priv.size == ski.wk_priv.size);
+  CU_ASSERT(hdr.cipher.cipher_name != NULL);
+  CU_ASSERT(strcmp(hdr.cipher.cipher_name, ski.cipher.cipher_name) == 0);
+  CU_ASSERT(hdr.enc_data == NULL);
+  CU_ASSERT(hdr.enc_data_size == 0);
+  free_ski(&hdr);
+
+  //Input that does not end at the ENC_DATA delimiter is rejected
+  hdr = get_default_ski();
+  CU_ASSERT(parse_ski_header_bytes(hb, hb_len - 1, &hdr, bool_policy_or) == 1);
+  CU_ASSERT(parse_ski_header_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len,
+                                   &hdr, bool_policy_or) == 1);
+  CU_ASSERT(parse_ski_header_bytes(NULL, hb_len, &hdr, bool_policy_or) == 1);
+  free(hb);
+  hb = NULL;
+  hb_len = 0;
+
+  //Chunked header includes the chunk index, which is parsed back
+  ski.chunk_size = 4096;
+  ski.chunked_data_len = 10000;
+  CU_ASSERT(create_ski_header_bytes(ski, &hb, &hb_len) == 0);
+  CU_ASSERT(memmem(hb, hb_len, KMYTH_DELIM_CHUNK_INDEX,
+                   strlen(KMYTH_DELIM_CHUNK_INDEX)) != NULL);
+  CU_ASSERT(memcmp(hb + hb_len - delim_len, KMYTH_DELIM_ENC_DATA,
+                   delim_len) == 0);
+  hdr = get_default_ski();
+  CU_ASSERT(parse_ski_header_bytes(hb, hb_len, &hdr, bool_policy_or) == 0);
+  CU_ASSERT(hdr.chunk_size == 4096);
+  CU_ASSERT(hdr.chunked_data_len == 10000);
+  CU_ASSERT(hdr.wk_priv.size == ski.wk_priv.size);
+  free_ski(&hdr);
+  free(hb);
+  hb = NULL;
+  hb_len = 0;
+
+  //Chunked .ski leaves the encrypted data encoded for parse_chunked_ski_bytes()
+  uint8_t *sb = NULL;
+  size_t sb_len = 0;
+  uint8_t *enc64 = NULL;
+  size_t enc64_len = 0;
+
+  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 0);
+  hdr = get_default_ski();
+  CU_ASSERT(parse_chunked_ski_bytes(sb, sb_len, &hdr, bool_policy_or,
+                                    &enc64, &enc64_len) == 0);
+  CU_ASSERT(hdr.chunk_size == 4096);
+  CU_ASSERT(hdr.chunked_data_len == 10000);
+  CU_ASSERT(hdr.enc_data == NULL);
+  CU_ASSERT(enc64 > sb && enc64 + enc64_len < sb + sb_len);
+  CU_ASSERT(enc64_len == KMYTH_BASE64_ENCODED_SIZE(ski.enc_data_size));
+  free_ski(&hdr);
+
+  //... and the whole .ski still parses, with the encrypted data decoded
+  hdr = get_default_ski();
+  CU_ASSERT(parse_ski_bytes(sb, sb_len, &hdr, bool_policy_or) == 0);
+  CU_ASSERT(hdr.chunk_size == 4096);
+  CU_ASSERT(hdr.enc_data_size == ski.enc_data_size);
+  CU_ASSERT(memcmp(hdr.enc_data, ski.enc_data, ski.enc_data_size) == 0);
+  free_ski(&hdr);
+  free(sb);
+
+  //Non-chunked .ski cannot be parsed as chunked
+  hdr = get_default_ski();
+  CU_ASSERT(parse_chunked_ski_bytes((uint8_t *) CONST_SKI_BYTES,
+                                    ski_bytes_len, &hdr, bool_policy_or,
+                                    &enc64, &enc64_len) == 1);
+
+  //Invalid chunk index cannot be marshalled
+  ski.chunk_size = 0;
+  CU_ASSERT(pack_ski_chunk_index(ski.chunk_size, ski.chunked_data_len,
+                                 chunk_index) == 1);
+  ski.chunked_data_len = 0;
+
+  //Empty storage key public cannot be marshalled
+  ski.sk_pub.size = 0;
+  CU_ASSERT(create_ski_header_bytes(ski, &hb, &hb_len) == 1);
+  CU_ASSERT(hb == NULL);
+  CU_ASSERT(hb_len == 0);
+  free_ski(&ski);
+}
+
+//----------------------------------------------------------------------------
+// test_create_parse_ski_binary_bytes
+//----------------------------------------------------------------------------
+void test_create_parse_ski_binary_bytes(void)
+{
+  uint8_t bool_policy_or = 0;
+  size_t ski_bytes_len = strlen(CONST_SKI_BYTES);
+
+  Ski ski = get_default_ski();
+
+  parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len, &ski, bool_policy_or);  //get valid ski struct
+
+  //Binary .ski is smaller than the text format
+  uint8_t *bb = NULL;
+  size_t bb_len = 0;
+
+  CU_ASSERT(create_ski_binary_bytes(ski, &bb, &bb_len) == 0);
+  CU_ASSERT(bb_len < ski_bytes_len);
+  CU_ASSERT(is_binary_ski_bytes(bb, bb_len));
+  CU_ASSERT(!is_binary_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len));
+
+  //parse_ski_bytes() detects the binary format
+  Ski bin = get_default_ski();
+
+  CU_ASSERT(parse_ski_bytes(bb, bb_len, &bin, bool_policy_or) == 0);
+  CU_ASSERT(bin.pcr_list.count == ski.pcr_list.count);
+  CU_ASSERT(bin.sk_pub.size == ski.sk_pub.size);
+  CU_ASSERT(bin.sk_priv.size == ski.sk_priv.size);
+  CU_ASSERT(bin.wk_pub.size == ski.wk_pub.size);
+  CU_ASSERT(bin.wk_priv.size == ski.wk_priv.size);
+  CU_ASSERT(memcmp(bin.wk_priv.buffer, ski.wk_priv.buffer,
+                   ski.wk_priv.size) == 0);
+  CU_ASSERT(bin.policyBranch1.size == 0);
+  CU_ASSERT(bin.chunk_size == 0);
+  CU_ASSERT(strcmp(bin.cipher.cipher_name, ski.cipher.cipher_name) == 0);
+  CU_ASSERT(bin.enc_data_size == ski.enc_data_size);
+  CU_ASSERT(memcmp(bin.enc_data, ski.enc_data, ski.enc_data_size) == 0);
+
+  //... and the result converts back to the original text format
+  uint8_t *sb = NULL;
+  size_t sb_len = 0;
+
+  CU_ASSERT(create_ski_bytes(bin, &sb, &sb_len) == 0);
+  CU_ASSERT(sb_len == ski_bytes_len);
+  CU_ASSERT(memcmp(sb, CONST_SKI_BYTES, ski_bytes_len) == 0);
+  free(sb);
+  free_ski(&bin);
+
+  //Truncated binary input is rejected, as is input in the wrong format
+  for (size_t i = 0; i < bb_len; i++)
+  {
+    bin = get_default_ski();
+    CU_ASSERT(parse_ski_binary_bytes(bb, i, &bin) == 1);
+    CU_ASSERT(bin.enc_data == NULL);
+  }
+  CU_ASSERT(parse_ski_binary_bytes((uint8_t *) CONST_SKI_BYTES,
+                                   ski_bytes_len, &bin) == 1);
+  CU_ASSERT(parse_ski_header_bytes(bb, bb_len, &bin, bool_policy_or) == 1);
+
+  //Unsupported version, unknown or repeated records are rejected
+  uint8_t *bad = malloc(bb_len);
+
+  memcpy(bad, bb, bb_len);
+  bad[KMYTH_SKI_BINARY_MAGIC_SIZE] = KMYTH_SKI_BINARY_VERSION + 1;
+  CU_ASSERT(parse_ski_bytes(bad, bb_len, &bin, bool_policy_or) == 1);
+  memcpy(bad, bb, bb_len);
+  bad[KMYTH_SKI_BINARY_MAGIC_SIZE + 1] = 0x7F;
+  CU_ASSERT(parse_ski_bytes(bad, bb_len, &bin, bool_policy_or) == 1);
+  memcpy(bad, bb, bb_len);
+  bad[KMYTH_SKI_BINARY_MAGIC_SIZE + 1] = 0x04;
+  CU_ASSERT(parse_ski_bytes(bad, bb_len, &bin, bool_policy_or) == 1);
+  free(bad);
+  free(bb);
+  bb = NULL;
+  bb_len = 0;
+
+  //Chunk index and policy branches are carried in the binary format
+  ski.chunk_size = 4096;
+  ski.chunked_data_len = 10000;
+  ski.policyBranch1.size = 4;
+  memset(ski.policyBranch1.buffer, 0x11, 4);
+  ski.policyBranch2.size = 4;
+  memset(ski.policyBranch2.buffer, 0x22, 4);
+  CU_ASSERT(create_ski_binary_bytes(ski, &bb, &bb_len) == 0);
+  bin = get_default_ski();
+  CU_ASSERT(parse_ski_bytes(bb, bb_len, &bin, 0) == 0);
+  CU_ASSERT(bin.chunk_size == 4096);
+  CU_ASSERT(bin.chunked_data_len == 10000);
+  CU_ASSERT(bin.policyBranch1.size == 4);
+  CU_ASSERT(bin.policyBranch2.size == 4);
+  CU_ASSERT(memcmp(bin.policyBranch2.buffer, ski.policyBranch2.buffer,
+                   4) == 0);
+  free_ski(&bin);
+  free(bb);
+  bb = NULL;
+  bb_len = 0;
+
+  //Empty encrypted data cannot be marshalled
+  free_ski(&ski);
+  CU_ASSERT(create_ski_binary_bytes(ski, &bb, &bb_len) == 1);
+  CU_ASSERT(bb == NULL);
+  CU_ASSERT(bb_len == 0);
+}
+
+//----------------------------------------------------------------------------
+// test_parse_ski_metadata
+//----------------------------------------------------------------------------
+void test_parse_ski_metadata(void)
+{
+  uint8_t bool_policy_or = 0;
+  size_t ski_bytes_len = strlen(CONST_SKI_BYTES);
+  uint8_t *enc_delim = memmem(CONST_SKI_BYTES, ski_bytes_len,
+                              KMYTH_DELIM_ENC_DATA,
+                              strlen(KMYTH_DELIM_ENC_DATA));
+  size_t text_header_len = (size_t) (enc_delim - (uint8_t *) CONST_SKI_BYTES)
+    + strlen(KMYTH_DELIM_ENC_DATA);
+
+  Ski ski = get_default_ski();
+
+  parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len, &ski, bool_policy_or);  //get valid ski struct
+
+  //The whole .ski, or any prefix including the header, gives the metadata
+  //(without the encrypted data)
+  Ski meta = get_default_ski();
+  size_t header_len = 0;
+
+  CU_ASSERT(parse_ski_metadata((uint8_t *) CONST_SKI_BYTES, ski_bytes_len,
+                               &meta, &header_len) == 0);
+  CU_ASSERT(header_len == text_header_len);
+  CU_ASSERT(meta.enc_data == NULL);
+  CU_ASSERT(meta.enc_data_size == 0);
+  CU_ASSERT(meta.pcr_list.count == ski.pcr_list.count);
+  CU_ASSERT(memcmp(&meta.pcr_list, &ski.pcr_list, sizeof(ski.pcr_list)) == 0);
+  CU_ASSERT(strcmp(meta.cipher.cipher_name, ski.cipher.cipher_name) == 0);
+  CU_ASSERT(meta.wk_pub.publicArea.authPolicy.size ==
+            ski.wk_pub.publicArea.authPolicy.size);
+  CU_ASSERT(meta.policyBranch1.size == 0);
+  free_ski(&meta);
+
+  meta = get_default_ski();
+  CU_ASSERT(parse_ski_metadata((uint8_t *) CONST_SKI_BYTES, text_header_len,
+                               &meta, NULL) == 0);
+  CU_ASSERT(meta.wk_priv.size == ski.wk_priv.size);
+  free_ski(&meta);
+
+  //A prefix stopping short of the header is rejected
+  meta = get_default_ski();
+  CU_ASSERT(parse_ski_metadata((uint8_t *) CONST_SKI_BYTES,
+                               text_header_len - 1, &meta, NULL) == 1);
+  CU_ASSERT(parse_ski_metadata(NULL, ski_bytes_len, &meta, NULL) == 1);
+
+  //Binary .ski: the encrypted data record header ends the metadata
+  uint8_t *bb = NULL;
+  size_t bb_len = 0;
+
+  CU_ASSERT(create_ski_binary_bytes(ski, &bb, &bb_len) == 0);
+  header_len = 0;
+  CU_ASSERT(parse_ski_metadata(bb, bb_len, &meta, &header_len) == 0);
+  CU_ASSERT(header_len == bb_len - ski.enc_data_size);
+  CU_ASSERT(meta.enc_data == NULL);
+  CU_ASSERT(strcmp(meta.cipher.cipher_name, ski.cipher.cipher_name) == 0);
+  CU_ASSERT(meta.wk_priv.size == ski.wk_priv.size);
+  free_ski(&meta);
+
+  meta = get_default_ski();
+  CU_ASSERT(parse_ski_metadata(bb, header_len, &meta, NULL) == 0);
+  free_ski(&meta);
+  for (size_t i = 0; i < header_len; i++)
+  {
+    meta = get_default_ski();
+    CU_ASSERT(parse_ski_metadata(bb, i, &meta, NULL) == 1);
+  }
+  free(bb);
+  bb = NULL;
+  bb_len = 0;
+
+  //The policy branches are detected in (and read from) the text format
+  uint8_t *sb = NULL;
+  size_t sb_len = 0;
+
+  ski.policyBranch1.size = 4;
+  memset(ski.policyBranch1.buffer, 0x11, 4);
+  ski.policyBranch2.size = 4;
+  memset(ski.policyBranch2.buffer, 0x22, 4);
+  CU_ASSERT(create_ski_bytes(ski, &sb, &sb_len) == 0);
+  meta = get_default_ski();
+  CU_ASSERT(parse_ski_metadata(sb, sb_len, &meta, NULL) == 0);
+  CU_ASSERT(meta.policyBranch1.size == 4);
+  CU_ASSERT(meta.policyBranch2.size == 4);
+  CU_ASSERT(memcmp(meta.policyBranch2.buffer, ski.policyBranch2.buffer,
+                   4) == 0);
+  free_ski(&meta);
+  free(sb);
+  free_ski(&ski);
+}
+
+//----------------------------------------------------------------------------
+// test_get_ski_srk_name
+//----------------------------------------------------------------------------
+void test_get_ski_srk_name(void)
+{
+  size_t ski_bytes_len = strlen(CONST_SKI_BYTES);
+  TPM2B_NAME name = {.size = 0, };
+  Ski ski = get_default_ski();
+
+  parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len, &ski, 0);  //get valid ski struct
+
+  //No SRK name is recorded by default
+  CU_ASSERT(ski.srk_name.size == 0);
+  name.size = 1;
+  CU_ASSERT(get_ski_srk_name((uint8_t *) CONST_SKI_BYTES, ski_bytes_len,
+                             &name) == 0);
+  CU_ASSERT(name.size == 0);
+
+  //A recorded name is written first, and read back from both formats
+  ski.srk_name.size = 34;
+  ski.srk_name.name[0] = 0x00;
+  ski.srk_name.name[1] = 0x0B;
+  memset(ski.srk_name.name + 2, 0x5A, 32);
+
+  uint8_t *tb = NULL;
+  size_t tb_len = 0;
+  uint8_t *bb = NULL;
+  size_t bb_len = 0;
+
+  CU_ASSERT(create_ski_bytes(ski, &tb, &tb_len) == 0);
+  CU_ASSERT(tb_len > ski_bytes_len);
+  CU_ASSERT(memcmp(tb, KMYTH_DELIM_SRK_NAME,
+                   strlen(KMYTH_DELIM_SRK_NAME)) == 0);
+  CU_ASSERT(create_ski_binary_bytes(ski, &bb, &bb_len) == 0);
+
+  uint8_t *formats[] = { tb, bb };
+  size_t format_lens[] = { tb_len, bb_len };
+
+  for (size_t i = 0; i < 2; i++)
+  {
+    name.size = 0;
+    CU_ASSERT(get_ski_srk_name(formats[i], format_lens[i], &name) == 0);
+    CU_ASSERT(name.size == ski.srk_name.size);
+    CU_ASSERT(memcmp(name.name, ski.srk_name.name, name.size) == 0);
+
+    Ski parsed = get_default_ski();
+
+    CU_ASSERT(parse_ski_bytes(formats[i], format_lens[i], &parsed, 0) == 0);
+    CU_ASSERT(parsed.srk_name.size == ski.srk_name.size);
+    CU_ASSERT(memcmp(parsed.srk_name.name, ski.srk_name.name,
+                     ski.srk_name.size) == 0);
+    CU_ASSERT(parsed.enc_data_size == ski.enc_data_size);
+    free_ski(&parsed);
+  }
+
+  //A truncated name is rejected
+  CU_ASSERT(get_ski_srk_name(tb, strlen(KMYTH_DELIM_SRK_NAME) + 4,
+                             &name) == 1);
+
+  free(tb);
+  free(bb);
+  free_ski(&ski);
+}
+
+//----------------------------------------------------------------------------
+// test_ski_compression_tag
+//----------------------------------------------------------------------------
+void test_ski_compression_tag(void)
+{
+  size_t ski_bytes_len = strlen(CONST_SKI_BYTES);
+  Ski ski = get_default_ski();
+
+  parse_ski_bytes((uint8_t *) CONST_SKI_BYTES, ski_bytes_len, &ski, 0);  //get valid ski struct
+
+  //No compression is recorded by default
+  CU_ASSERT(ski.compression == KMYTH_COMPRESSION_NONE);
+
+  //Compression is tagged onto the cipher suite, and read back from both
+  //formats
+  ski.compression = KMYTH_COMPRESSION_ZSTD;
+
+  uint8_t *tb = NULL;
+  size_t tb_len = 0;
+  uint8_t *bb = NULL;
+  size_t bb_len = 0;
+  char suite[KMYTH_MAX_CIPHER_STR_LEN + 1];
+
+  snprintf(suite, sizeof(suite), "%s%c%s\n", ski.cipher.cipher_name,
+           KMYTH_COMPRESSION_TAG_SEPARATOR, KMYTH_COMPRESSION_ZSTD_NAME);
+  CU_ASSERT(create_ski_bytes(ski, &tb, &tb_len) == 0);
+  CU_ASSERT(tb_len == ski_bytes_len + 1 + strlen(KMYTH_COMPRESSION_ZSTD_NAME));
+  CU_ASSERT(memmem(tb, tb_len, suite, strlen(suite)) != NULL);
+  CU_ASSERT(create_ski_binary_bytes(ski, &bb, &bb_len) == 0);
+
+  uint8_t *formats[] = { tb, bb };
+  size_t format_lens[] = { tb_len, bb_len };
+
+  for (size_t i = 0; i < 2; i++)
+  {
+    Ski parsed = get_default_ski();
+
+    CU_ASSERT(parse_ski_bytes(formats[i], format_lens[i], &parsed, 0) == 0);
+    CU_ASSERT(parsed.compression == KMYTH_COMPRESSION_ZSTD);
+    CU_ASSERT(parsed.cipher.cipher_name != NULL &&
+              strcmp(parsed.cipher.cipher_name,
+                     ski.cipher.cipher_name) == 0);
+    free_ski(&parsed);
+  }
+
+  //An unknown tag is rejected
+  uint8_t *tag = memmem(tb, tb_len, suite, strlen(suite));
+  Ski parsed = get_default_ski();
+
+  CU_ASSERT_FATAL(tag != NULL);
+  tag[strlen(ski.cipher.cipher_name) + 1] = 'x';
+  CU_ASSERT(parse_ski_bytes(tb, tb_len, &parsed, 0) == 1);
+
+  free(tb);
+  free(bb);
+  free_ski(&ski);
+}
+
 //----------------------------------------------------------------------------
 // test_free_ski
 //----------------------------------------------------------------------------
@@ -1803,6 +2392,18 @@ void test_get_default_ski(void)
   CU_ASSERT(ski.wk_priv.size == 0);
   CU_ASSERT(ski.enc_data == NULL);
   CU_ASSERT(ski.enc_data_size == 0);
+  CU_ASSERT(ski.chunk_size == 0);
+  CU_ASSERT(ski.chunked_data_len == 0);
+
+  // initializing in place resets a struct that has already been used
+  Ski used;
+
+  memset(&used, 0xA5, sizeof(Ski));
+  init_default_ski(&used);
+  CU_ASSERT(memcmp(&used, &ski, sizeof(Ski)) == 0);
+  CU_ASSERT(used.cipher.cipher_name == NULL);
+  CU_ASSERT(used.compression == KMYTH_COMPRESSION_NONE);
+  CU_ASSERT(used.srk_name.size == 0);
 }
 
 //----------------------------------------------------------------------------
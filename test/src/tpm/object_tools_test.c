@@ -93,11 +93,12 @@ void test_init_kmyth_object_template(void)
   static const TPMT_PUBLIC emptyPubArea = { 0 };
 
   // A null public area should produce an error
-  CU_ASSERT(init_kmyth_object_template(false, emptyAuthPolicy,
+  CU_ASSERT(init_kmyth_object_template(false, TPM2_ALG_NULL, emptyAuthPolicy,
                                        (TPMT_PUBLIC *) NULL) == 1);
 
   // An object template for a non-key should be initialized in a certain way
-  CU_ASSERT(init_kmyth_object_template(false, emptyAuthPolicy, &pubArea) == 0);
+  CU_ASSERT(init_kmyth_object_template(false, TPM2_ALG_NULL, emptyAuthPolicy,
+                                       &pubArea) == 0);
   CU_ASSERT(pubArea.type == KMYTH_DATA_PUBKEY_ALG);
   CU_ASSERT(pubArea.nameAlg == KMYTH_HASH_ALG);
   CU_ASSERT(pubArea.authPolicy.size == 0);
@@ -106,12 +107,26 @@ void test_init_kmyth_object_template(void)
   // a non-empty auth policy
   pubArea = emptyPubArea;
   TPM2B_DIGEST authPolicy = {.size = 4,.buffer = {1, 2, 3, 4} };
-  CU_ASSERT(init_kmyth_object_template(true, authPolicy, &pubArea) == 0);
+  CU_ASSERT(init_kmyth_object_template(true, KMYTH_KEY_PUBKEY_ALG, authPolicy,
+                                       &pubArea) == 0);
   CU_ASSERT(pubArea.type == KMYTH_KEY_PUBKEY_ALG);
   CU_ASSERT(pubArea.nameAlg == KMYTH_HASH_ALG);
   CU_ASSERT(pubArea.authPolicy.size == authPolicy.size);
   CU_ASSERT(memcmp(authPolicy.buffer, pubArea.authPolicy.buffer,
                    authPolicy.size) == 0);
+
+  // An ECC key template should use the Kmyth curve
+  pubArea = emptyPubArea;
+  CU_ASSERT(init_kmyth_object_template(true, TPM2_ALG_ECC, authPolicy,
+                                       &pubArea) == 0);
+  CU_ASSERT(pubArea.type == TPM2_ALG_ECC);
+  CU_ASSERT(pubArea.parameters.eccDetail.curveID == KMYTH_ECC_CURVE);
+  CU_ASSERT(pubArea.unique.ecc.x.size == 0);
+
+  // Keys other than RSA or ECC are not supported
+  pubArea = emptyPubArea;
+  CU_ASSERT(init_kmyth_object_template(true, TPM2_ALG_KEYEDHASH, authPolicy,
+                                       &pubArea) == 1);
 }
 
 //----------------------------------------------------------------------------
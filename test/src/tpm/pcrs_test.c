@@ -6,9 +6,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <CUnit/CUnit.h>
 
 #include "tpm2_interface.h"
+#include "defines.h"
 
 #include "pcrs_test.h"
 #include "pcrs.h"
@@ -27,6 +30,21 @@ int pcrs_add_tests(CU_pSuite suite)
   {
     return 1;
   }
+  if (NULL == CU_add_test(suite, "read_pcr_values() Tests",
+                          test_read_pcr_values))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "kmyth_pcr_watcher Tests",
+                          test_kmyth_pcr_watcher))
+  {
+    return 1;
+  }
+  if (NULL == CU_add_test(suite, "parse_pcr_value_set() Tests",
+                          test_parse_pcr_value_set))
+  {
+    return 1;
+  }
 
   return 0;
 }
@@ -103,3 +121,204 @@ void test_get_pcr_count(void)
   //Test NULL context
   CU_ASSERT(get_pcr_count(NULL, &count) == 1);
 }
+
+//----------------------------------------------------------------------------
+// test_read_pcr_values
+//----------------------------------------------------------------------------
+void test_read_pcr_values(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+  bool emulator = true;
+
+  get_tpm2_impl_type(sapi_ctx, &emulator);
+  if (!emulator)
+  {
+    return;
+  }
+
+  int pcrs[12] = { };
+  TPML_PCR_SELECTION pcrs_struct = {.count = 0, };
+  TPM2B_DIGEST values[TPM2_MAX_PCRS];
+  size_t values_len = 1;
+
+  //No PCRs selected
+  init_pcr_selection(sapi_ctx, NULL, 0, &pcrs_struct);
+  CU_ASSERT(read_pcr_values(sapi_ctx, pcrs_struct, values, TPM2_MAX_PCRS,
+                            &values_len) == 0);
+  CU_ASSERT(values_len == 0);
+
+  //More PCRs selected than a single PCR_Read command returns
+  for (int i = 0; i < 12; i++)
+  {
+    pcrs[i] = i;
+  }
+  init_pcr_selection(sapi_ctx, pcrs, 12, &pcrs_struct);
+  CU_ASSERT(read_pcr_values(sapi_ctx, pcrs_struct, values, TPM2_MAX_PCRS,
+                            &values_len) == 0);
+  CU_ASSERT(values_len == 12);
+  for (size_t i = 0; i < values_len; i++)
+  {
+    CU_ASSERT(values[i].size == KMYTH_DIGEST_SIZE);
+  }
+
+  //Output array too small
+  CU_ASSERT(read_pcr_values(sapi_ctx, pcrs_struct, values, 4,
+                            &values_len) != 0);
+
+  //NULL TPM context
+  CU_ASSERT(read_pcr_values(NULL, pcrs_struct, values, TPM2_MAX_PCRS,
+                            &values_len) != 0);
+
+  free_tpm2_resources(&sapi_ctx);
+}
+
+//----------------------------------------------------------------------------
+// count_pcr_change (callback for test_kmyth_pcr_watcher)
+//----------------------------------------------------------------------------
+static void count_pcr_change(const kmyth_pcr_change_t * change, void *arg)
+{
+  CU_ASSERT(change->new_pcr_update_counter !=
+            change->old_pcr_update_counter);
+  (*(int *) arg)++;
+}
+
+//----------------------------------------------------------------------------
+// extend_pcr_23 (helper for test_kmyth_pcr_watcher)
+//----------------------------------------------------------------------------
+static void extend_pcr_23(void)
+{
+  // PCR 23 is the resettable debug PCR
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  TPM2B_AUTH pcr_auth = {.size = 0, };
+  TSS2L_SYS_AUTH_COMMAND cmdAuths;
+  TSS2L_SYS_AUTH_RESPONSE rspAuths;
+  TPML_DIGEST_VALUES digests = {.count = 1, };
+
+  digests.digests[0].hashAlg = TPM2_ALG_SHA256;
+  memset(digests.digests[0].digest.sha256, 0xA5, TPM2_SHA256_DIGEST_SIZE);
+  CU_ASSERT(init_tpm2_connection(&sapi_ctx) == 0);
+  CU_ASSERT(init_password_cmd_auth(pcr_auth, &cmdAuths, &rspAuths) == 0);
+  CU_ASSERT(Tss2_Sys_PCR_Extend(sapi_ctx, 23, &cmdAuths, &digests,
+                                &rspAuths) == TSS2_RC_SUCCESS);
+  free_tpm2_resources(&sapi_ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_pcr_watcher
+//----------------------------------------------------------------------------
+void test_kmyth_pcr_watcher(void)
+{
+  kmyth_pcr_watcher_t *watcher = NULL;
+  int calls = 0;
+  int changed = 0;
+
+  // Invalid interval
+  CU_ASSERT(kmyth_pcr_watcher_create(&watcher, NULL, 0) == 1);
+  CU_ASSERT(watcher == NULL);
+
+  CU_ASSERT(kmyth_pcr_watcher_create(&watcher, NULL, 20) == 0);
+  CU_ASSERT(kmyth_pcr_watcher_add_callback(watcher, count_pcr_change,
+                                           &calls) == 0);
+
+  // The first check only records the counts, and nothing has changed since
+  CU_ASSERT(kmyth_pcr_watcher_check(watcher, &changed) == 0);
+  CU_ASSERT(changed == 0);
+  CU_ASSERT(kmyth_pcr_watcher_check(watcher, &changed) == 0);
+  CU_ASSERT(changed == 0);
+  CU_ASSERT(calls == 0);
+
+  // An extend is seen (once)
+  extend_pcr_23();
+  CU_ASSERT(kmyth_pcr_watcher_check(watcher, &changed) == 0);
+  CU_ASSERT(changed == 1);
+  CU_ASSERT(calls == 1);
+  CU_ASSERT(kmyth_pcr_watcher_check(watcher, &changed) == 0);
+  CU_ASSERT(changed == 0);
+
+  // With a count file, the TPM is only asked once the count changes
+  char count_path[] = "/tmp/kmyth_count_XXXXXX";
+  int count_fd = mkstemp(count_path);
+
+  CU_ASSERT(count_fd >= 0);
+  CU_ASSERT(write(count_fd, "5\n", 2) == 2);
+  CU_ASSERT(kmyth_pcr_watcher_set_count_file(watcher, count_path, 0) == 0);
+  CU_ASSERT(kmyth_pcr_watcher_check(watcher, &changed) == 0);
+  CU_ASSERT(changed == 0);
+  extend_pcr_23();
+  CU_ASSERT(kmyth_pcr_watcher_check(watcher, &changed) == 0);
+  CU_ASSERT(changed == 0);
+  CU_ASSERT(pwrite(count_fd, "6\n", 2, 0) == 2);
+  CU_ASSERT(kmyth_pcr_watcher_check(watcher, &changed) == 0);
+  CU_ASSERT(changed == 1);
+  CU_ASSERT(calls == 2);
+  close(count_fd);
+  unlink(count_path);
+  CU_ASSERT(kmyth_pcr_watcher_set_count_file(watcher, NULL, 0) == 0);
+
+  // The watcher's thread sees an extend within a few intervals
+  CU_ASSERT(kmyth_pcr_watcher_start(watcher) == 0);
+  CU_ASSERT(kmyth_pcr_watcher_check(watcher, &changed) == 1);
+  extend_pcr_23();
+  for (int i = 0; i < 50 && __atomic_load_n(&calls, __ATOMIC_SEQ_CST) < 3;
+       i++)
+  {
+    usleep(20000);
+  }
+  CU_ASSERT(kmyth_pcr_watcher_stop(watcher) == 0);
+  CU_ASSERT(calls == 3);
+
+  CU_ASSERT(kmyth_pcr_watcher_destroy(&watcher) == 0);
+  CU_ASSERT(watcher == NULL);
+}
+
+//----------------------------------------------------------------------------
+// test_parse_pcr_value_set
+//----------------------------------------------------------------------------
+void test_parse_pcr_value_set(void)
+{
+  const char *zeros =
+    "0000000000000000000000000000000000000000000000000000000000000000";
+  const char *ones =
+    "1111111111111111111111111111111111111111111111111111111111111111";
+  char line[512];
+  TPML_PCR_SELECTION pcrList;
+  TPM2B_DIGEST pcrValues[TPM2_MAX_PCRS];
+  size_t pcrValues_len = 0;
+
+  // Values are returned in PCR index order, whatever order they are given in
+  snprintf(line, sizeof(line), "7=%s, 0=%s", ones, zeros);
+  CU_ASSERT(parse_pcr_value_set(line, 24, &pcrList, pcrValues,
+                                &pcrValues_len) == 0);
+  CU_ASSERT(pcrList.count == 1);
+  CU_ASSERT(pcrList.pcrSelections[0].hash == KMYTH_HASH_ALG);
+  CU_ASSERT(pcrList.pcrSelections[0].sizeofSelect == 3);
+  CU_ASSERT(pcrList.pcrSelections[0].pcrSelect[0] == 0x81);
+  CU_ASSERT(pcrList.pcrSelections[0].pcrSelect[1] == 0);
+  CU_ASSERT(pcrValues_len == 2);
+  CU_ASSERT(pcrValues[0].size == KMYTH_DIGEST_SIZE);
+  CU_ASSERT(pcrValues[0].buffer[0] == 0x00);
+  CU_ASSERT(pcrValues[1].buffer[0] == 0x11);
+
+  // The PCR index must be implemented by the TPM
+  snprintf(line, sizeof(line), "24=%s", ones);
+  CU_ASSERT(parse_pcr_value_set(line, 24, &pcrList, pcrValues,
+                                &pcrValues_len) == 1);
+
+  // A PCR must not be given twice
+  snprintf(line, sizeof(line), "3=%s 3=%s", ones, zeros);
+  CU_ASSERT(parse_pcr_value_set(line, 24, &pcrList, pcrValues,
+                                &pcrValues_len) == 1);
+
+  // A value must be a whole digest, in hex
+  snprintf(line, sizeof(line), "3=%.62s", ones);
+  CU_ASSERT(parse_pcr_value_set(line, 24, &pcrList, pcrValues,
+                                &pcrValues_len) == 1);
+  snprintf(line, sizeof(line), "3=%.63sg", ones);
+  CU_ASSERT(parse_pcr_value_set(line, 24, &pcrList, pcrValues,
+                                &pcrValues_len) == 1);
+  snprintf(line, sizeof(line), "3:%s", ones);
+  CU_ASSERT(parse_pcr_value_set(line, 24, &pcrList, pcrValues,
+                                &pcrValues_len) == 1);
+}
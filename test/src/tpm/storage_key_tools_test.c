@@ -34,6 +34,11 @@ int storage_key_tools_add_tests(CU_pSuite suite)
   {
     return 1;
   }
+  if (NULL == CU_add_test(suite, "get_cached_srk_handle() Tests",
+                          test_get_cached_srk_handle))
+  {
+    return 1;
+  }
   if (NULL == CU_add_test(suite, "get_existing_srk_handle() Tests",
                           test_get_existing_srk_handle))
   {
@@ -76,6 +81,46 @@ void test_get_srk_handle(void)
   free_tpm2_resources(&sapi_ctx);
 }
 
+//----------------------------------------------------------------------------
+// test_get_cached_srk_handle
+//----------------------------------------------------------------------------
+void test_get_cached_srk_handle(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+
+  TPM2_HANDLE srk_handle = 0;
+  TPM2B_AUTH owner_auth = {.size = 0, };
+
+  get_srk_handle(sapi_ctx, &srk_handle, &owner_auth);
+
+  //Valid test with no hint, should find the same SRK as get_srk_handle()
+  TPM2_HANDLE cached_handle = 0;
+
+  CU_ASSERT(get_cached_srk_handle(sapi_ctx, &cached_handle, &owner_auth) == 0);
+  CU_ASSERT(cached_handle == srk_handle);
+
+  //Valid test with a correct hint, hint should be returned unchanged
+  CU_ASSERT(get_cached_srk_handle(sapi_ctx, &cached_handle, &owner_auth) == 0);
+  CU_ASSERT(cached_handle == srk_handle);
+
+  //Stale hint (handle that does not reference the SRK), should fall back
+  //to the full lookup
+  cached_handle = TPM2_PLATFORM_PERSISTENT - 1;
+  if (cached_handle == srk_handle)
+  {
+    cached_handle--;
+  }
+  CU_ASSERT(get_cached_srk_handle(sapi_ctx, &cached_handle, &owner_auth) == 0);
+  CU_ASSERT(cached_handle == srk_handle);
+
+  //NULL context
+  CU_ASSERT(get_cached_srk_handle(NULL, &cached_handle, &owner_auth) != 0);
+
+  free_tpm2_resources(&sapi_ctx);
+}
+
 //----------------------------------------------------------------------------
 // test_get_existing_srk_handle
 //----------------------------------------------------------------------------
@@ -127,7 +172,8 @@ void test_check_if_srk(void)
   TPM2_HANDLE sk_handle = 0;
 
   create_and_load_sk(sapi_ctx, srk_handle, owner_auth, obj_auth, pcrs_struct,
-                     auth_policy, &sk_handle, &sk_priv, &sk_pub);
+                     auth_policy, KMYTH_KEY_PUBKEY_ALG, &sk_handle, &sk_priv,
+                     &sk_pub);
   CU_ASSERT(check_if_srk(sapi_ctx, sk_handle, &is_srk) == 0);
   CU_ASSERT(!is_srk);
 
@@ -220,18 +266,29 @@ void test_create_and_load_sk(void)
   TPM2_HANDLE sk_handle = 0;
 
   CU_ASSERT(create_and_load_sk(sapi_ctx, srk_handle, owner_auth, obj_auth,
-                               pcrs_struct, auth_policy, &sk_handle, &sk_priv,
-                               &sk_pub) == 0);
+                               pcrs_struct, auth_policy, KMYTH_KEY_PUBKEY_ALG,
+                               &sk_handle, &sk_priv, &sk_pub) == 0);
   CU_ASSERT(sk_handle != 0);
   CU_ASSERT(sk_handle != srk_handle);
+  Tss2_Sys_FlushContext(sapi_ctx, sk_handle);
+
+  //Valid test (ECC storage key)
+  sk_handle = 0;
+  sk_priv.size = 0;
+  sk_pub.size = 0;
+  CU_ASSERT(create_and_load_sk(sapi_ctx, srk_handle, owner_auth, obj_auth,
+                               pcrs_struct, auth_policy, TPM2_ALG_ECC,
+                               &sk_handle, &sk_priv, &sk_pub) == 0);
+  CU_ASSERT(sk_handle != 0);
+  CU_ASSERT(sk_pub.publicArea.type == TPM2_ALG_ECC);
 
   //Invalid context
   TPM2B_PRIVATE invalid_priv = {.size = 0, };
   TPM2B_PUBLIC invalid_pub = {.size = 0, };
   sk_handle = 0;
   CU_ASSERT(create_and_load_sk(NULL, srk_handle, owner_auth, obj_auth,
-                               pcrs_struct, auth_policy, &sk_handle,
-                               &invalid_priv, &invalid_pub) != 0);
+                               pcrs_struct, auth_policy, KMYTH_KEY_PUBKEY_ALG,
+                               &sk_handle, &invalid_priv, &invalid_pub) != 0);
   CU_ASSERT(sk_handle == 0 && invalid_priv.size == 0 && invalid_pub.size == 0);
 
   free_tpm2_resources(&sapi_ctx);
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <CUnit/CUnit.h>
+#include <openssl/hmac.h>
 
 #include "tpm2_interface.h"
 #include "tpm2_interface_test.h"
@@ -45,6 +46,18 @@ int tpm2_interface_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "init_tcti() Tests", test_init_tcti))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "get_tpm2_command_code() Tests",
+                  test_get_tpm2_command_code))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "init_sapi() Tests", test_init_sapi))
   {
     return 1;
@@ -75,6 +88,12 @@ int tpm2_interface_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "get_tpm2_snapshot() Tests", test_get_tpm2_snapshot))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "getErrorString() Tests", test_getErrorString))
   {
     return 1;
@@ -129,6 +148,27 @@ int tpm2_interface_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "compute_policy_digest() Tests",
+                  test_compute_policy_digest))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "compute_policy_or_digest() Tests",
+                  test_compute_policy_or_digest))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "check_policy_digest() Tests",
+                  test_check_policy_digest))
+  {
+    return 1;
+  }
+
   if (NULL ==
       CU_add_test(suite, "create_policy_auth_session() Tests",
                   test_create_policy_auth_session))
@@ -143,6 +183,13 @@ int tpm2_interface_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "acquire_policy_session() Tests",
+                  test_acquire_policy_session))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "apply_policy() Tests", test_apply_policy))
   {
     return 1;
@@ -160,6 +207,19 @@ int tpm2_interface_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "retry_tpm2_command() Tests",
+                  test_retry_tpm2_command))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "set_tpm2_deadline() Tests", test_tpm2_deadline))
+  {
+    return 1;
+  }
+
   //These tests requireTPM2_ALG_SHA256 so we don't want to run them if this changes
   if (KMYTH_HASH_ALG == TPM2_ALG_SHA256)
   {
@@ -213,6 +273,80 @@ void test_init_tcti_abrmd(void)
   free(tcti_ctx);
 }
 
+//----------------------------------------------------------------------------
+// test_init_tcti
+//----------------------------------------------------------------------------
+void test_init_tcti(void)
+{
+  TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+
+  //Valid test (resource manager, with and without backend configuration)
+  CU_ASSERT(init_tcti(&tcti_ctx, "tabrmd") == 0);
+  CU_ASSERT(tcti_ctx != NULL);
+
+  //Must have null tcti_ctx to init
+  CU_ASSERT(init_tcti(&tcti_ctx, "tabrmd") != 0);
+  Tss2_Tcti_Finalize(tcti_ctx);
+  free(tcti_ctx);
+  tcti_ctx = NULL;
+
+  CU_ASSERT(init_tcti(&tcti_ctx, "tabrmd:") == 0);
+  Tss2_Tcti_Finalize(tcti_ctx);
+  free(tcti_ctx);
+  tcti_ctx = NULL;
+
+  //Unsupported backends
+  CU_ASSERT(init_tcti(&tcti_ctx, "nosuchtcti") != 0);
+  CU_ASSERT(tcti_ctx == NULL);
+  CU_ASSERT(init_tcti(&tcti_ctx, "tab") != 0);
+  CU_ASSERT(init_tcti(&tcti_ctx, "tabrmdx:") != 0);
+  CU_ASSERT(tcti_ctx == NULL);
+
+  //Delay TCTI, wrapping the resource manager
+  CU_ASSERT(init_tcti(&tcti_ctx, "delay:*=1,Create=5,0x15E=2@tabrmd") == 0);
+  CU_ASSERT(tcti_ctx != NULL);
+  Tss2_Tcti_Finalize(tcti_ctx);
+  free(tcti_ctx);
+  tcti_ctx = NULL;
+
+  CU_ASSERT(init_tcti(&tcti_ctx, "delay") == 0);
+  Tss2_Tcti_Finalize(tcti_ctx);
+  free(tcti_ctx);
+  tcti_ctx = NULL;
+
+  //Invalid delays, and an unsupported wrapped TCTI
+  CU_ASSERT(init_tcti(&tcti_ctx, "delay:NoSuchCommand=1@tabrmd") != 0);
+  CU_ASSERT(init_tcti(&tcti_ctx, "delay:*=-1@tabrmd") != 0);
+  CU_ASSERT(init_tcti(&tcti_ctx, "delay:Create@tabrmd") != 0);
+  CU_ASSERT(init_tcti(&tcti_ctx, "delay:*=1@nosuchtcti") != 0);
+  CU_ASSERT(tcti_ctx == NULL);
+}
+
+//----------------------------------------------------------------------------
+// test_get_tpm2_command_code
+//----------------------------------------------------------------------------
+void test_get_tpm2_command_code(void)
+{
+  uint32_t command_code = 0;
+
+  //By name, matching get_tpm2_command_name()
+  CU_ASSERT(get_tpm2_command_code("Unseal", 6, &command_code) == 0);
+  CU_ASSERT(command_code == TPM2_CC_Unseal);
+  CU_ASSERT(strcmp(get_tpm2_command_name(TPM2_CC_Unseal), "Unseal") == 0);
+  CU_ASSERT(get_tpm2_command_code("Create=5", 6, &command_code) == 0);
+  CU_ASSERT(command_code == TPM2_CC_Create);
+
+  //By number
+  CU_ASSERT(get_tpm2_command_code("0x176", 5, &command_code) == 0);
+  CU_ASSERT(command_code == TPM2_CC_StartAuthSession);
+
+  //Unknown names, and names of unknown commands
+  CU_ASSERT(get_tpm2_command_code("Unsea", 5, &command_code) != 0);
+  CU_ASSERT(get_tpm2_command_code("", 0, &command_code) != 0);
+  CU_ASSERT(get_tpm2_command_code("0x1x", 4, &command_code) != 0);
+  CU_ASSERT(strcmp(get_tpm2_command_name(0xFFFF), "unknown") == 0);
+}
+
 //----------------------------------------------------------------------------
 // test_init_sapi
 //----------------------------------------------------------------------------
@@ -299,6 +433,51 @@ void test_get_tpm2_properties(void)
   free_tpm2_resources(&sapi_ctx);
 }
 
+//----------------------------------------------------------------------------
+// test_get_tpm2_snapshot
+//----------------------------------------------------------------------------
+void test_get_tpm2_snapshot(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  CAP_SNAPSHOT snapshot;
+  CAP_SNAPSHOT cached;
+  SESSION session;
+
+  init_tpm2_connection(&sapi_ctx);
+
+  //Valid test: fixed properties match a direct query
+  TPMS_CAPABILITY_DATA capData;
+
+  CU_ASSERT(get_tpm2_snapshot(sapi_ctx, KMYTH_SNAPSHOT_ALL, &snapshot) == 0);
+  CU_ASSERT(get_tpm2_properties(sapi_ctx, TPM2_CAP_TPM_PROPERTIES,
+                                TPM2_PT_PCR_COUNT, 1, &capData) == 0);
+  CU_ASSERT(snapshot.pcr_count ==
+            capData.data.tpmProperties.tpmProperty[0].value);
+
+  //Cached snapshot is unchanged by commands not affecting it
+  CU_ASSERT(get_tpm2_snapshot(sapi_ctx, KMYTH_SNAPSHOT_ALL, &cached) == 0);
+  CU_ASSERT(cached.pcr_count == snapshot.pcr_count);
+  CU_ASSERT(cached.manufacturer == snapshot.manufacturer);
+
+  //Starting a session is reflected in the session lists
+  CU_ASSERT(create_auth_session(sapi_ctx, &session, TPM2_SE_POLICY) == 0);
+  CU_ASSERT(get_tpm2_snapshot(sapi_ctx, KMYTH_SNAPSHOT_SESSIONS, &cached) ==
+            0);
+  CU_ASSERT(cached.policy_sessions.count ==
+            snapshot.policy_sessions.count + 1);
+
+  //Explicit refresh
+  refresh_tpm2_snapshot(sapi_ctx, KMYTH_SNAPSHOT_ALL);
+  CU_ASSERT(get_tpm2_snapshot(sapi_ctx, KMYTH_SNAPSHOT_ALL, &cached) == 0);
+  CU_ASSERT(cached.pcr_count == snapshot.pcr_count);
+
+  //NULL inputs
+  CU_ASSERT(get_tpm2_snapshot(NULL, KMYTH_SNAPSHOT_ALL, &snapshot) != 0);
+  CU_ASSERT(get_tpm2_snapshot(sapi_ctx, KMYTH_SNAPSHOT_ALL, NULL) != 0);
+
+  free_tpm2_resources(&sapi_ctx);
+}
+
 //----------------------------------------------------------------------------
 // test_get_tpm2_impl_type
 //----------------------------------------------------------------------------
@@ -572,6 +751,36 @@ void test_compute_authHMAC(void)
   CU_ASSERT(compute_authHMAC(session, hash, auth, session_attr, &hmac) == 0);
   CU_ASSERT(hmac.size != 0);
 
+  //Check that reusing the keyed HMAC, and re-keying it, match a direct HMAC
+  for (int i = 0; i < 4; i++)
+  {
+    auth.size = KMYTH_DIGEST_SIZE;
+    memset(auth.buffer, i % 2, auth.size);
+
+    uint8_t msg[sizeof(hash.buffer) + 2 * sizeof(TPMU_HA) +
+                sizeof(TPMA_SESSION)];
+    size_t msg_len = 0;
+
+    memcpy(msg, hash.buffer, hash.size);
+    msg_len += hash.size;
+    memcpy(msg + msg_len, session.nonceNewer.buffer, session.nonceNewer.size);
+    msg_len += session.nonceNewer.size;
+    memcpy(msg + msg_len, session.nonceOlder.buffer, session.nonceOlder.size);
+    msg_len += session.nonceOlder.size;
+    memcpy(msg + msg_len, &session_attr, sizeof(TPMA_SESSION));
+    msg_len += sizeof(TPMA_SESSION);
+
+    uint8_t expected[KMYTH_DIGEST_SIZE];
+    unsigned int expected_len = KMYTH_DIGEST_SIZE;
+
+    HMAC(KMYTH_OPENSSL_HASH, auth.buffer, auth.size, msg, msg_len, expected,
+         &expected_len);
+    CU_ASSERT(compute_authHMAC(session, hash, auth, session_attr, &hmac) ==
+              0);
+    CU_ASSERT(hmac.size == expected_len);
+    CU_ASSERT(memcmp(hmac.buffer, expected, expected_len) == 0);
+  }
+
   //NULL output
   CU_ASSERT(compute_authHMAC(session, hash, auth, session_attr, NULL) != 0);
   free_tpm2_resources(&sapi_ctx);
@@ -628,6 +837,143 @@ void test_create_policy_digest(void)
   free_tpm2_resources(&sapi_ctx);
 }
 
+//----------------------------------------------------------------------------
+// test_compute_policy_digest
+//----------------------------------------------------------------------------
+void test_compute_policy_digest(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+  TPML_PCR_SELECTION pcrs_struct = {.count = 0, };
+  TPM2B_DIGEST values[TPM2_MAX_PCRS];
+  size_t values_len = 0;
+  TPM2B_DIGEST out;
+  TPM2B_DIGEST trial;
+
+  //Host-computed digest matches trial session with no PCR selection list
+  CU_ASSERT(compute_policy_digest(pcrs_struct, NULL, 0, &out) == 0);
+  CU_ASSERT(create_trial_policy_digest(sapi_ctx, pcrs_struct, &trial) == 0);
+  CU_ASSERT(out.size == trial.size);
+  CU_ASSERT(memcmp(out.buffer, trial.buffer, out.size) == 0);
+
+  //Host-computed digest matches trial session with no PCRs selected
+  init_pcr_selection(sapi_ctx, NULL, 0, &pcrs_struct);
+  CU_ASSERT(compute_policy_digest(pcrs_struct, NULL, 0, &out) == 0);
+  CU_ASSERT(create_trial_policy_digest(sapi_ctx, pcrs_struct, &trial) == 0);
+  CU_ASSERT(out.size == trial.size);
+  CU_ASSERT(memcmp(out.buffer, trial.buffer, out.size) == 0);
+
+  //Host-computed digest matches trial session with multiple PCRs selected
+  int pcrs[3] = { 0, 5, 23 };
+  init_pcr_selection(sapi_ctx, pcrs, 3, &pcrs_struct);
+  CU_ASSERT(read_pcr_values(sapi_ctx, pcrs_struct, values, TPM2_MAX_PCRS,
+                            &values_len) == 0);
+  CU_ASSERT(compute_policy_digest(pcrs_struct, values, values_len, &out) == 0);
+  CU_ASSERT(create_trial_policy_digest(sapi_ctx, pcrs_struct, &trial) == 0);
+  CU_ASSERT(out.size == trial.size);
+  CU_ASSERT(memcmp(out.buffer, trial.buffer, out.size) == 0);
+
+  //create_policy_digest() returns the host-computed digest
+  CU_ASSERT(create_policy_digest(sapi_ctx, pcrs_struct, &trial) == 0);
+  CU_ASSERT(memcmp(out.buffer, trial.buffer, out.size) == 0);
+
+  //Different PCR values give a different digest
+  values[0].buffer[0] ^= 0x01;
+  CU_ASSERT(compute_policy_digest(pcrs_struct, values, values_len, &out) == 0);
+  CU_ASSERT(memcmp(out.buffer, trial.buffer, out.size) != 0);
+
+  //NULL output
+  CU_ASSERT(compute_policy_digest(pcrs_struct, values, values_len, NULL) != 0);
+
+  free_tpm2_resources(&sapi_ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_compute_policy_or_digest
+//----------------------------------------------------------------------------
+void test_compute_policy_or_digest(void)
+{
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+  TSS2L_SYS_AUTH_COMMAND const *nullCmdAuths = NULL;
+  TSS2L_SYS_AUTH_RESPONSE *nullRspAuths = NULL;
+
+  TPML_DIGEST pHashList = {.count = 2, };
+  TPM2B_DIGEST out;
+  TPM2B_DIGEST trial = {.size = 0, };
+
+  pHashList.digests[0].size = KMYTH_DIGEST_SIZE;
+  memset(pHashList.digests[0].buffer, 0x11, KMYTH_DIGEST_SIZE);
+  pHashList.digests[1].size = KMYTH_DIGEST_SIZE;
+  memset(pHashList.digests[1].buffer, 0x22, KMYTH_DIGEST_SIZE);
+
+  //Host-computed digest matches trial session
+  CU_ASSERT(compute_policy_or_digest(pHashList, &out) == 0);
+
+  SESSION policySessionOR;
+  TPML_DIGEST trialHashList;
+
+  create_auth_session(sapi_ctx, &policySessionOR, TPM2_SE_TRIAL);
+  CU_ASSERT(apply_policy_or(sapi_ctx, policySessionOR.sessionHandle,
+                            &pHashList.digests[0], &pHashList.digests[1],
+                            &trialHashList) == 0);
+  CU_ASSERT(Tss2_Sys_PolicyGetDigest(sapi_ctx, policySessionOR.sessionHandle,
+                                     nullCmdAuths, &trial, nullRspAuths) == 0);
+  Tss2_Sys_FlushContext(sapi_ctx, policySessionOR.sessionHandle);
+  CU_ASSERT(out.size == trial.size);
+  CU_ASSERT(memcmp(out.buffer, trial.buffer, out.size) == 0);
+
+  //create_policy_or_digest() returns the host-computed digest
+  CU_ASSERT(create_policy_or_digest(sapi_ctx, pHashList.digests[0],
+                                    pHashList.digests[1], &trial) == 0);
+  CU_ASSERT(memcmp(out.buffer, trial.buffer, out.size) == 0);
+
+  //Too few branches
+  pHashList.count = 1;
+  CU_ASSERT(compute_policy_or_digest(pHashList, &out) != 0);
+
+  free_tpm2_resources(&sapi_ctx);
+}
+
+//----------------------------------------------------------------------------
+// test_check_policy_digest
+//----------------------------------------------------------------------------
+void test_check_policy_digest(void)
+{
+  TPM2B_DIGEST pcrPolicy = {.size = KMYTH_DIGEST_SIZE, };
+  TPM2B_DIGEST otherPolicy = {.size = KMYTH_DIGEST_SIZE, };
+  TPM2B_DIGEST noBranch = {.size = 0, };
+  TPM2B_DIGEST orPolicy;
+  TPML_DIGEST pHashList = {.count = 2, };
+
+  memset(pcrPolicy.buffer, 0x11, KMYTH_DIGEST_SIZE);
+  memset(otherPolicy.buffer, 0x22, KMYTH_DIGEST_SIZE);
+
+  //Without branches, the PCR policy must be the authPolicy
+  CU_ASSERT(check_policy_digest(pcrPolicy, pcrPolicy, noBranch,
+                                noBranch) == 0);
+  CU_ASSERT(check_policy_digest(otherPolicy, pcrPolicy, noBranch,
+                                noBranch) == 1);
+
+  //With branches, the PCR policy must be one of them ...
+  pHashList.digests[0] = otherPolicy;
+  pHashList.digests[1] = pcrPolicy;
+  CU_ASSERT(compute_policy_or_digest(pHashList, &orPolicy) == 0);
+  CU_ASSERT(check_policy_digest(pcrPolicy, orPolicy, otherPolicy,
+                                pcrPolicy) == 0);
+  CU_ASSERT(check_policy_digest(otherPolicy, orPolicy, otherPolicy,
+                                pcrPolicy) == 0);
+  memset(otherPolicy.buffer, 0x33, KMYTH_DIGEST_SIZE);
+  CU_ASSERT(check_policy_digest(otherPolicy, orPolicy, pHashList.digests[0],
+                                pcrPolicy) == 1);
+
+  //... and the branches must combine into the authPolicy
+  CU_ASSERT(check_policy_digest(pcrPolicy, pcrPolicy, pHashList.digests[0],
+                                pcrPolicy) == 1);
+}
+
 //----------------------------------------------------------------------------
 // test_create_policy_auth_session
 //----------------------------------------------------------------------------
@@ -649,6 +995,38 @@ void test_create_policy_auth_session(void)
   free_tpm2_resources(&sapi_ctx);
 }
 
+//----------------------------------------------------------------------------
+// test_acquire_policy_session
+//----------------------------------------------------------------------------
+void test_acquire_policy_session(void)
+{
+  SESSION session;
+  SESSION reused;
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+  init_tpm2_connection(&sapi_ctx);
+
+  //Valid test: empty pool starts a new session
+  CU_ASSERT(acquire_policy_session(sapi_ctx, &session) == 0);
+  CU_ASSERT(session.nonceNewer.size == KMYTH_DIGEST_SIZE);
+
+  //Released session is restarted and reused, with its nonces
+  CU_ASSERT(release_policy_session(sapi_ctx, &session, false) == 0);
+  CU_ASSERT(acquire_policy_session(sapi_ctx, &reused) == 0);
+  CU_ASSERT(reused.sessionHandle == session.sessionHandle);
+  CU_ASSERT(memcmp(reused.nonceNewer.buffer, session.nonceNewer.buffer,
+                   session.nonceNewer.size) == 0);
+
+  //Failed session is flushed rather than reused
+  CU_ASSERT(release_policy_session(sapi_ctx, &reused, true) == 0);
+  CU_ASSERT(release_policy_session(sapi_ctx, &reused, true) != 0);
+
+  //NULL context
+  CU_ASSERT(acquire_policy_session(NULL, &session) != 0);
+
+  free_tpm2_resources(&sapi_ctx);
+}
+
 //----------------------------------------------------------------------------
 // test_start_policy_auth_session
 //----------------------------------------------------------------------------
@@ -771,6 +1149,81 @@ void test_rollNonces(void)
 
 }
 
+//----------------------------------------------------------------------------
+// test_retry_tpm2_command
+//----------------------------------------------------------------------------
+void test_retry_tpm2_command(void)
+{
+  unsigned int attempt = 0;
+
+  //Success and ordinary errors are not retried
+  CU_ASSERT(!retry_tpm2_command(NULL, TSS2_RC_SUCCESS, &attempt));
+  CU_ASSERT(!retry_tpm2_command(NULL, TPM2_RC_FAILURE, &attempt));
+  CU_ASSERT(!retry_tpm2_command(NULL, TPM2_RC_LOCKOUT, &attempt));
+  CU_ASSERT(attempt == 0);
+
+  //Busy codes from other layers are not TPM responses, so are not retried
+  CU_ASSERT(!retry_tpm2_command(NULL, TSS2_SYS_RC_LAYER | TPM2_RC_RETRY,
+                                &attempt));
+  CU_ASSERT(attempt == 0);
+
+  //Each busy TPM response code is retried, counting the attempts
+  CU_ASSERT(retry_tpm2_command(NULL, TPM2_RC_RETRY, &attempt));
+  CU_ASSERT(attempt == 1);
+  CU_ASSERT(retry_tpm2_command(NULL, TPM2_RC_YIELDED, &attempt));
+  CU_ASSERT(attempt == 2);
+  CU_ASSERT(retry_tpm2_command(NULL, TPM2_RC_TESTING, &attempt));
+  CU_ASSERT(attempt == 3);
+
+  //No retries once the limit is reached
+  attempt = MAX_RETRIES;
+  CU_ASSERT(!retry_tpm2_command(NULL, TPM2_RC_RETRY, &attempt));
+  CU_ASSERT(attempt == MAX_RETRIES);
+}
+
+//----------------------------------------------------------------------------
+// test_tpm2_deadline
+//----------------------------------------------------------------------------
+void test_tpm2_deadline(void)
+{
+  CALL_DEADLINE deadline = {.deadline_ns = 0,.cancelled = 0 };
+
+  //No deadline never expires
+  CU_ASSERT(!tpm2_deadline_expired(NULL));
+  CU_ASSERT(!tpm2_deadline_expired(&deadline));
+
+  //A deadline expires once it has passed, or been cancelled
+  deadline.deadline_ns = get_timing_ns() + 60000000000ULL;
+  CU_ASSERT(!tpm2_deadline_expired(&deadline));
+  deadline.cancelled = 1;
+  CU_ASSERT(tpm2_deadline_expired(&deadline));
+  deadline.cancelled = 0;
+  deadline.deadline_ns = 1;
+  CU_ASSERT(tpm2_deadline_expired(&deadline));
+
+  //Past its deadline, a connection sends no command, and retries none
+  TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+  TPM2B_DIGEST random = {.size = 0 };
+  unsigned int attempt = 0;
+
+  CU_ASSERT(set_tpm2_deadline(NULL, &deadline) == 1);
+  CU_ASSERT_FATAL(init_tpm2_connection(&sapi_ctx) == 0);
+  CU_ASSERT(set_tpm2_deadline(sapi_ctx, &deadline) == 0);
+  CU_ASSERT(Tss2_Sys_GetRandom(sapi_ctx, NULL, 8, &random, NULL) !=
+            TSS2_RC_SUCCESS);
+  CU_ASSERT(!retry_tpm2_command(sapi_ctx, TPM2_RC_RETRY, &attempt));
+  CU_ASSERT(attempt == 0);
+
+  //With the deadline cleared, the connection is used as before
+  deadline.deadline_ns = 0;
+  CU_ASSERT(Tss2_Sys_GetRandom(sapi_ctx, NULL, 8, &random, NULL) ==
+            TSS2_RC_SUCCESS);
+  CU_ASSERT(random.size == 8);
+
+  CU_ASSERT(set_tpm2_deadline(sapi_ctx, NULL) == 0);
+  free_tpm2_resources(&sapi_ctx);
+}
+
 //----------------------------------------------------------------------------
 // test_unseal_apply_policy
 //----------------------------------------------------------------------------
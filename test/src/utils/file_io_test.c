@@ -11,6 +11,7 @@
 #include <unistd.h>
 #include <CUnit/CUnit.h>
 
+#include "defines.h"
 #include "file_io_test.h"
 #include "file_io.h"
 
@@ -37,12 +38,36 @@ int file_io_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "map_bytes_from_file() Tests",
+                          test_map_bytes_from_file))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "read_path_list() Tests",
+                          test_read_path_list))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "write_bytes_to_file() Tests",
                           test_write_bytes_to_file))
   {
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "replace_file_atomically() Tests",
+                          test_replace_file_atomically))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_output_writer Tests",
+                          test_kmyth_output_writer))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "print_to_stdout() Tests",
                           test_print_to_stdout))
   {
@@ -156,6 +181,131 @@ void test_read_bytes_from_file(void)
   free(testdata);
 }
 
+//----------------------------------------------------------------------------
+// test_map_bytes_from_file()
+//----------------------------------------------------------------------------
+void test_map_bytes_from_file(void)
+{
+  uint8_t *testfile_data = (uint8_t *) "123 & ABC !!";
+  size_t testfile_size = strlen((char *) testfile_data);
+
+  uint8_t *testdata = NULL;
+  size_t testdata_len = 0;
+  bool mapped = false;
+
+  // Trying to map a NULL or non-existent input path should result in error
+  CU_ASSERT(map_bytes_from_file(NULL, &testdata, &testdata_len, &mapped) == 1);
+  remove("testfile");
+  CU_ASSERT(map_bytes_from_file("testfile", &testdata, &testdata_len,
+                                &mapped) == 1);
+
+  // An empty file produces no data
+  FILE *fp = fopen("testfile", "w");
+
+  fclose(fp);
+  CU_ASSERT(map_bytes_from_file("testfile", &testdata, &testdata_len,
+                                &mapped) == 0);
+  CU_ASSERT(testdata == NULL);
+  CU_ASSERT(testdata_len == 0);
+
+  // A regular file is mapped, with contents matching the test data
+  fp = fopen("testfile", "w");
+  fwrite(testfile_data, 1, testfile_size, fp);
+  fclose(fp);
+  CU_ASSERT(map_bytes_from_file("testfile", &testdata, &testdata_len,
+                                &mapped) == 0);
+  CU_ASSERT(mapped == true);
+  CU_ASSERT(testdata_len == testfile_size);
+  CU_ASSERT(memcmp(testdata, testfile_data, testfile_size) == 0);
+  unmap_bytes_from_file(testdata, testdata_len, mapped);
+
+  // Mapping an existing file without read permission should result in error
+  chmod("testfile", 0333);
+  CU_ASSERT(map_bytes_from_file("testfile", &testdata, &testdata_len,
+                                &mapped) == 1);
+  remove("testfile");
+
+  // A pipe cannot be mapped, so is read in (larger than one read block)
+  int pipe_fds[2];
+  size_t pipe_data_len = 3 * KMYTH_STREAM_BLOCK_SIZE / 2;
+  uint8_t *pipe_data = malloc(pipe_data_len);
+  char pipe_path[64];
+
+  CU_ASSERT(pipe(pipe_fds) == 0);
+  CU_ASSERT(fcntl(pipe_fds[1], F_SETPIPE_SZ, 2 * KMYTH_STREAM_BLOCK_SIZE) >=
+            (int) pipe_data_len);
+  for (size_t i = 0; i < pipe_data_len; i++)
+  {
+    pipe_data[i] = (uint8_t) i;
+  }
+  CU_ASSERT(write(pipe_fds[1], pipe_data, pipe_data_len) ==
+            (ssize_t) pipe_data_len);
+  close(pipe_fds[1]);
+  snprintf(pipe_path, sizeof(pipe_path), "/proc/self/fd/%d", pipe_fds[0]);
+  CU_ASSERT(map_bytes_from_file(pipe_path, &testdata, &testdata_len,
+                                &mapped) == 0);
+  CU_ASSERT(mapped == false);
+  CU_ASSERT(testdata_len == pipe_data_len);
+  CU_ASSERT(memcmp(testdata, pipe_data, pipe_data_len) == 0);
+  unmap_bytes_from_file(testdata, testdata_len, mapped);
+  close(pipe_fds[0]);
+  free(pipe_data);
+}
+
+//----------------------------------------------------------------------------
+// test_read_path_list()
+//----------------------------------------------------------------------------
+void test_read_path_list(void)
+{
+  char **paths = NULL;
+  size_t count = 0;
+
+  // A non-existent list should result in error
+  remove("testfile");
+  CU_ASSERT(read_path_list("testfile", &paths, &count) == 1);
+  CU_ASSERT(paths == NULL);
+  CU_ASSERT(count == 0);
+
+  // An empty list (or one holding only blank lines and comments) is valid
+  FILE *fp = fopen("testfile", "w");
+
+  fprintf(fp, "\n  \n# comment\n\t# indented comment\n");
+  fclose(fp);
+  CU_ASSERT(read_path_list("testfile", &paths, &count) == 0);
+  CU_ASSERT(paths == NULL);
+  CU_ASSERT(count == 0);
+
+  // Paths are trimmed, and the last line need not end in a newline
+  fp = fopen("testfile", "w");
+  fprintf(fp, "a.txt\n  dir/b c.txt \r\n\n# skipped\n/tmp/c");
+  fclose(fp);
+  CU_ASSERT(read_path_list("testfile", &paths, &count) == 0);
+  CU_ASSERT(count == 3);
+  if (count == 3)
+  {
+    CU_ASSERT(strcmp(paths[0], "a.txt") == 0);
+    CU_ASSERT(strcmp(paths[1], "dir/b c.txt") == 0);
+    CU_ASSERT(strcmp(paths[2], "/tmp/c") == 0);
+  }
+  free_path_list(paths, count);
+
+  // Lists longer than the initial allocation are grown
+  fp = fopen("testfile", "w");
+  for (int i = 0; i < 100; i++)
+  {
+    fprintf(fp, "file%d\n", i);
+  }
+  fclose(fp);
+  CU_ASSERT(read_path_list("testfile", &paths, &count) == 0);
+  CU_ASSERT(count == 100);
+  if (count == 100)
+  {
+    CU_ASSERT(strcmp(paths[99], "file99") == 0);
+  }
+  free_path_list(paths, count);
+  remove("testfile");
+}
+
 //----------------------------------------------------------------------------
 // test_write_bytes_to_file()
 //----------------------------------------------------------------------------
@@ -198,6 +348,115 @@ void test_write_bytes_to_file(void)
   remove("testfile");
 }
 
+//----------------------------------------------------------------------------
+// test_replace_file_atomically()
+//----------------------------------------------------------------------------
+void test_replace_file_atomically(void)
+{
+  uint8_t *testdata1 = (uint8_t *) "Testing 123 ...";
+  size_t testdata1_len = strlen((char *) testdata1);
+  uint8_t *testdata2 = (uint8_t *) "And now for something different!\n";
+  size_t testdata2_len = strlen((char *) testdata2);
+
+  // the file to be replaced must exist
+  remove("testfile");
+  CU_ASSERT(replace_file_atomically(NULL, testdata1, testdata1_len) == 1);
+  CU_ASSERT(replace_file_atomically("testfile", testdata1,
+                                    testdata1_len) == 1);
+
+  // replacing an existing file should keep its permissions
+  CU_ASSERT(write_bytes_to_file("testfile", testdata1, testdata1_len) == 0);
+  chmod("testfile", 0600);
+  CU_ASSERT(replace_file_atomically("testfile", testdata2,
+                                    testdata2_len) == 0);
+
+  uint8_t *filedata = NULL;
+  size_t filedata_len = 0;
+  struct stat st;
+
+  read_bytes_from_file("testfile", &filedata, &filedata_len);
+  CU_ASSERT(filedata_len == testdata2_len);
+  CU_ASSERT(strncmp((char *) testdata2, (char *) filedata, filedata_len) == 0);
+  CU_ASSERT(stat("testfile", &st) == 0 && (st.st_mode & 0777) == 0600);
+
+  // Test cleanup
+  free(filedata);
+  remove("testfile");
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_output_writer()
+//----------------------------------------------------------------------------
+void test_kmyth_output_writer(void)
+{
+  uint8_t *testdata1 = (uint8_t *) "Testing 123 ...";
+  size_t testdata1_len = strlen((char *) testdata1);
+  uint8_t *testdata2 = (uint8_t *) "And now for something different!\n";
+  size_t testdata2_len = strlen((char *) testdata2);
+  char *paths[3] = { "testfile1", "testfile2", "testfile3" };
+  uint8_t *filedata = NULL;
+  size_t filedata_len = 0;
+  kmyth_output_writer_t writer = { 0 };
+
+  remove(paths[0]);
+  remove(paths[1]);
+  remove(paths[2]);
+
+  // an empty batch, or an invalid slot, is an error
+  CU_ASSERT(kmyth_output_writer_init(&writer, 0, true) == 1);
+  CU_ASSERT(kmyth_output_writer_init(&writer, 3, true) == 0);
+  CU_ASSERT(kmyth_output_writer_stage(&writer, 3, paths[0], testdata1,
+                                      testdata1_len) == 1);
+
+  // nothing appears until the batch is committed (slot 2 is left empty)
+  CU_ASSERT(kmyth_output_writer_stage(&writer, 0, paths[0], testdata1,
+                                      testdata1_len) == 0);
+  CU_ASSERT(kmyth_output_writer_stage(&writer, 0, paths[0], testdata1,
+                                      testdata1_len) == 1);
+  CU_ASSERT(kmyth_output_writer_stage(&writer, 1, paths[1], testdata2,
+                                      testdata2_len) == 0);
+  CU_ASSERT(access(paths[0], F_OK) != 0);
+  CU_ASSERT(access(paths[1], F_OK) != 0);
+  CU_ASSERT(kmyth_output_writer_commit(&writer) == 0);
+  kmyth_output_writer_free(&writer);
+
+  read_bytes_from_file(paths[0], &filedata, &filedata_len);
+  CU_ASSERT(filedata_len == testdata1_len);
+  CU_ASSERT(strncmp((char *) testdata1, (char *) filedata, filedata_len) == 0);
+  free(filedata);
+  filedata = NULL;
+  read_bytes_from_file(paths[1], &filedata, &filedata_len);
+  CU_ASSERT(filedata_len == testdata2_len);
+  CU_ASSERT(strncmp((char *) testdata2, (char *) filedata, filedata_len) == 0);
+  free(filedata);
+  filedata = NULL;
+  CU_ASSERT(access(paths[2], F_OK) != 0);
+
+  // a batch released without being committed leaves the files unchanged
+  CU_ASSERT(kmyth_output_writer_init(&writer, 1, false) == 0);
+  CU_ASSERT(kmyth_output_writer_stage(&writer, 0, paths[0], testdata2,
+                                      testdata2_len) == 0);
+  kmyth_output_writer_free(&writer);
+  read_bytes_from_file(paths[0], &filedata, &filedata_len);
+  CU_ASSERT(filedata_len == testdata1_len);
+  free(filedata);
+  filedata = NULL;
+
+  // a single file, replaced atomically
+  CU_ASSERT(write_bytes_to_file_atomic(paths[0], testdata2, testdata2_len,
+                                       false) == 0);
+  read_bytes_from_file(paths[0], &filedata, &filedata_len);
+  CU_ASSERT(filedata_len == testdata2_len);
+  CU_ASSERT(strncmp((char *) testdata2, (char *) filedata, filedata_len) == 0);
+  CU_ASSERT(write_bytes_to_file_atomic(NULL, testdata2, testdata2_len,
+                                       false) == 1);
+
+  // Test cleanup
+  free(filedata);
+  remove(paths[0]);
+  remove(paths[1]);
+}
+
 //----------------------------------------------------------------------------
 // test_print_to_stdout()
 //----------------------------------------------------------------------------
@@ -0,0 +1,107 @@
+//############################################################################
+// file_loader_test.c
+//
+// Tests for kmyth file loader utility function in utils/src/file_loader.c
+//############################################################################
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/CUnit.h>
+
+#include "file_loader_test.h"
+#include "file_loader.h"
+#include "file_io.h"
+
+#define TEST_FILE_COUNT 100
+
+//----------------------------------------------------------------------------
+// file_loader_add_tests()
+//----------------------------------------------------------------------------
+int file_loader_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kmyth_load_files() Tests",
+                          test_kmyth_load_files))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_load_files()
+//----------------------------------------------------------------------------
+void test_kmyth_load_files(void)
+{
+  char name_buf[TEST_FILE_COUNT][32];
+  char *paths[TEST_FILE_COUNT];
+  uint8_t *datas[TEST_FILE_COUNT];
+  size_t data_lens[TEST_FILE_COUNT];
+  int results[TEST_FILE_COUNT];
+  uint8_t contents[4096];
+
+  for (size_t i = 0; i < sizeof(contents); i++)
+  {
+    contents[i] = (uint8_t) (i * 7);
+  }
+
+  // files of different sizes (the first one empty), one of which is missing
+  for (size_t i = 0; i < TEST_FILE_COUNT; i++)
+  {
+    snprintf(name_buf[i], sizeof(name_buf[i]), "loader_test_%zu", i);
+    paths[i] = name_buf[i];
+    remove(paths[i]);
+    if (i != 50)
+    {
+      FILE *fp = fopen(paths[i], "w");
+
+      CU_ASSERT_FATAL(fp != NULL);
+      CU_ASSERT(fwrite(contents, 1, i * 41, fp) == i * 41);
+      fclose(fp);
+    }
+  }
+
+  // invalid parameters
+  CU_ASSERT(kmyth_load_files(NULL, TEST_FILE_COUNT, 0, datas, data_lens,
+                             results) == 1);
+  CU_ASSERT(kmyth_load_files(paths, 0, 0, datas, data_lens, results) == 1);
+
+  // each depth (including one read at a time, and the default) reads the
+  // same contents, failing only the missing file
+  size_t depths[3] = { 1, 7, 0 };
+
+  for (size_t d = 0; d < 3; d++)
+  {
+    CU_ASSERT(kmyth_load_files(paths, TEST_FILE_COUNT, depths[d], datas,
+                               data_lens, results) == 1);
+    for (size_t i = 0; i < TEST_FILE_COUNT; i++)
+    {
+      if (i == 50)
+      {
+        CU_ASSERT(results[i] == 1);
+        CU_ASSERT(datas[i] == NULL && data_lens[i] == 0);
+        continue;
+      }
+      CU_ASSERT(results[i] == 0);
+      CU_ASSERT(data_lens[i] == i * 41);
+      CU_ASSERT(i == 0 || (datas[i] != NULL &&
+                           memcmp(datas[i], contents, data_lens[i]) == 0));
+      free(datas[i]);
+    }
+  }
+
+  // all present
+  CU_ASSERT(kmyth_load_files(paths, 50, 0, datas, data_lens, results) == 0);
+  for (size_t i = 0; i < 50; i++)
+  {
+    free(datas[i]);
+  }
+
+  // Test cleanup
+  for (size_t i = 0; i < TEST_FILE_COUNT; i++)
+  {
+    remove(paths[i]);
+  }
+}
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <CUnit/CUnit.h>
+#include <openssl/evp.h>
 #include <openssl/rand.h>
 
 #include "tpm2_interface.h"
@@ -27,12 +28,25 @@ int formatting_tools_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "get_block_view() Tests", test_get_block_view))
+  {
+    return 1;
+  }
+
   if (NULL ==
       CU_add_test(suite, "create_nkl_bytes() Tests", test_create_nkl_bytes))
   {
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "get_nkl_binary_view() Tests",
+                  test_get_nkl_binary_view))
+  {
+    return 1;
+  }
+
   if (NULL ==
       CU_add_test(suite, "encodeBase64Data() Tests", test_encodeBase64Data))
   {
@@ -45,6 +59,33 @@ int formatting_tools_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL ==
+      CU_add_test(suite, "encodeBase64DataInto() Tests",
+                  test_encodeBase64DataInto))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "decodeBase64DataInto() Tests",
+                  test_decodeBase64DataInto))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "Base64 Codec Reference Tests",
+                  test_base64_reference))
+  {
+    return 1;
+  }
+
+  if (NULL ==
+      CU_add_test(suite, "decodeBase64Range() Tests", test_decodeBase64Range))
+  {
+    return 1;
+  }
+
   if (NULL == CU_add_test(suite, "concat() Tests", test_concat))
   {
     return 1;
@@ -226,6 +267,93 @@ AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\n";
   free(sb);
 }
 
+//----------------------------------------------------------------------------
+// test_get_block_view
+//----------------------------------------------------------------------------
+void test_get_block_view(void)
+{
+const char *CONST_SKI_BYTES = "\
+-----PCR SELECTION LIST-----\n\
+AAAAAQALAwAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\n\
+-----CIPHER SUITE-----\n\
+AES/GCM/NoPadding/256\n\
+-----FILE END-----\n";
+
+const char *RAW_PCR64 =
+  "AAAAAQALAwAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\n";
+
+  size_t sb_len = strlen(CONST_SKI_BYTES);
+  uint8_t *sb = malloc(sb_len * sizeof(char));
+
+  memcpy(sb, CONST_SKI_BYTES, sb_len);
+
+  uint8_t *position = sb;
+  size_t remaining = sb_len;
+  uint8_t *block = NULL;
+  size_t block_size = 0;
+
+  //Valid parse test, block should point into the input buffer
+  CU_ASSERT(get_block_view(&position, &remaining, &block, &block_size,
+                           KMYTH_DELIM_PCR_SELECTION_LIST,
+                           strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
+                           KMYTH_DELIM_CIPHER_SUITE,
+                           strlen(KMYTH_DELIM_CIPHER_SUITE)) == 0);
+  CU_ASSERT(block == sb + strlen(KMYTH_DELIM_PCR_SELECTION_LIST));
+  CU_ASSERT(block_size == strlen(RAW_PCR64));
+  CU_ASSERT(memcmp(block, RAW_PCR64, block_size) == 0);
+  CU_ASSERT(position == block + block_size);
+
+  //Next block, containing '-' characters that are not a delimiter
+  CU_ASSERT(get_block_view(&position, &remaining, &block, &block_size,
+                           KMYTH_DELIM_CIPHER_SUITE,
+                           strlen(KMYTH_DELIM_CIPHER_SUITE),
+                           KMYTH_DELIM_END_FILE,
+                           strlen(KMYTH_DELIM_END_FILE)) == 0);
+  CU_ASSERT(block_size == strlen("AES/GCM/NoPadding/256\n"));
+  CU_ASSERT(remaining == strlen(KMYTH_DELIM_END_FILE));
+
+  //Invalid first delim
+  position = sb;
+  remaining = sb_len;
+  sb[0] = '!';
+  CU_ASSERT(get_block_view(&position, &remaining, &block, &block_size,
+                           KMYTH_DELIM_PCR_SELECTION_LIST,
+                           strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
+                           KMYTH_DELIM_CIPHER_SUITE,
+                           strlen(KMYTH_DELIM_CIPHER_SUITE)) == 1);
+  sb[0] = '-';
+
+  //Missing next delim
+  position = sb;
+  remaining = sb_len;
+  CU_ASSERT(get_block_view(&position, &remaining, &block, &block_size,
+                           KMYTH_DELIM_PCR_SELECTION_LIST,
+                           strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
+                           KMYTH_DELIM_STORAGE_KEY_PUBLIC,
+                           strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC)) == 1);
+
+  //Input shorter than the first delim
+  position = sb;
+  remaining = 4;
+  CU_ASSERT(get_block_view(&position, &remaining, &block, &block_size,
+                           KMYTH_DELIM_PCR_SELECTION_LIST,
+                           strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
+                           KMYTH_DELIM_CIPHER_SUITE,
+                           strlen(KMYTH_DELIM_CIPHER_SUITE)) == 1);
+
+  //Test empty block
+  const char *empty_block =
+    "-----PCR SELECTION LIST-----\n-----STORAGE KEY PUBLIC-----\n";
+  position = (uint8_t *) empty_block;
+  remaining = strlen(empty_block);
+  CU_ASSERT(get_block_view(&position, &remaining, &block, &block_size,
+                           KMYTH_DELIM_PCR_SELECTION_LIST,
+                           strlen(KMYTH_DELIM_PCR_SELECTION_LIST),
+                           KMYTH_DELIM_STORAGE_KEY_PUBLIC,
+                           strlen(KMYTH_DELIM_STORAGE_KEY_PUBLIC)) == 1);
+  free(sb);
+}
+
 //----------------------------------------------------------------------------
 // test_create_nkl_bytes
 //----------------------------------------------------------------------------
@@ -264,6 +392,86 @@ void test_create_nkl_bytes(void)
   free(nfb);
   free(raw_nkl_data);
   free(nkl64_data);
+
+  // chunked data is marked as such, so it is not read as a single blob
+  CU_ASSERT(create_nkl_chunked_bytes
+            ((uint8_t *) RAW_NKL, nkl_bytes_len, &nfb, &nfb_len) == 0);
+  position = nfb;
+  remaining = nfb_len;
+  CU_ASSERT(get_block_bytes((char **) &position,
+                            &remaining,
+                            &raw_nkl_data,
+                            &raw_nkl_size,
+                            KMYTH_DELIM_NKL_DATA,
+                            strlen(KMYTH_DELIM_NKL_DATA),
+                            KMYTH_DELIM_END_NKL,
+                            strlen(KMYTH_DELIM_END_NKL)) == 1);
+  position = nfb;
+  remaining = nfb_len;
+  CU_ASSERT(get_block_bytes((char **) &position,
+                            &remaining,
+                            &raw_nkl_data,
+                            &raw_nkl_size,
+                            KMYTH_DELIM_NKL_CHUNKED_DATA,
+                            strlen(KMYTH_DELIM_NKL_CHUNKED_DATA),
+                            KMYTH_DELIM_END_NKL,
+                            strlen(KMYTH_DELIM_END_NKL)) == 0);
+  CU_ASSERT(decodeBase64Data
+            (raw_nkl_data, raw_nkl_size, &nkl64_data, &nkl64_size) == 0);
+  CU_ASSERT(nkl_bytes_len == nkl64_size);
+  CU_ASSERT(memcmp(nkl64_data, (uint8_t *) RAW_NKL, nkl64_size) == 0);
+  free(nfb);
+  free(raw_nkl_data);
+  free(nkl64_data);
+}
+
+//----------------------------------------------------------------------------
+// test_get_nkl_binary_view
+//----------------------------------------------------------------------------
+void test_get_nkl_binary_view(void)
+{
+  uint8_t nkl[KMYTH_NKL_BINARY_HEADER_LEN + 300];
+  size_t nkl_len = sizeof(nkl);
+  uint8_t *data = NULL;
+  size_t data_len = 0;
+  uint8_t flags = 0;
+
+  for (size_t i = 0; i < 300; i++)
+  {
+    nkl[KMYTH_NKL_BINARY_HEADER_LEN + i] = (uint8_t) i;
+  }
+  create_nkl_binary_header(300, KMYTH_NKL_BINARY_CHUNKED, nkl);
+
+  // the header is followed by the data itself, in place
+  CU_ASSERT(is_nkl_binary(nkl, nkl_len));
+  CU_ASSERT(get_nkl_binary_view(nkl, nkl_len, &data, &data_len, &flags) == 0);
+  CU_ASSERT(data == nkl + KMYTH_NKL_BINARY_HEADER_LEN);
+  CU_ASSERT(data_len == 300);
+  CU_ASSERT(flags == KMYTH_NKL_BINARY_CHUNKED);
+  CU_ASSERT(nkl[8] == 0 && nkl[14] == 0x01 && nkl[15] == 0x2c);
+
+  // truncated (or extended) data is rejected
+  CU_ASSERT(get_nkl_binary_view(nkl, nkl_len - 1, &data, &data_len, &flags)
+            == 1);
+  CU_ASSERT(get_nkl_binary_view(nkl, KMYTH_NKL_BINARY_HEADER_LEN - 1, &data,
+                                &data_len, &flags) == 1);
+  create_nkl_binary_header(299, 0, nkl);
+  CU_ASSERT(get_nkl_binary_view(nkl, nkl_len, &data, &data_len, &flags) == 1);
+
+  // so is an unknown version
+  create_nkl_binary_header(300, 0, nkl);
+  nkl[4] = KMYTH_NKL_BINARY_VERSION + 1;
+  CU_ASSERT(get_nkl_binary_view(nkl, nkl_len, &data, &data_len, &flags) == 1);
+
+  // a text .nkl is not mistaken for a binary one
+  uint8_t *text = NULL;
+  size_t text_len = 0;
+
+  CU_ASSERT(create_nkl_bytes(nkl, nkl_len, &text, &text_len) == 0);
+  CU_ASSERT(!is_nkl_binary(text, text_len));
+  CU_ASSERT(get_nkl_binary_view(text, text_len, &data, &data_len, &flags)
+            == 1);
+  free(text);
 }
 
 //----------------------------------------------------------------------------
@@ -335,9 +543,11 @@ uint8_t RAW_PCR[] = { 0, 0, 0, 1, 0, 11, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0,
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
     0, 0, 0, 0
   };
-  CU_ASSERT(encodeBase64Data(short_pcr, RAW_PCR_LEN, &pcr64, &pcr64_len) == 0);
-  CU_ASSERT(pcr64_len == strlen(RAW_PCR64));
+  CU_ASSERT(encodeBase64Data(short_pcr, sizeof(short_pcr), &pcr64,
+                             &pcr64_len) == 0);
+  CU_ASSERT(pcr64_len != strlen(RAW_PCR64));
   CU_ASSERT(memcmp(pcr64, RAW_PCR64, pcr64_len) != 0);
+  free(pcr64);
 }
 
 //----------------------------------------------------------------------------
@@ -409,6 +619,265 @@ uint8_t RAW_PCR[] = { 0, 0, 0, 1, 0, 11, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0,
   free(pcr);
 }
 
+//----------------------------------------------------------------------------
+// test_encodeBase64DataInto
+//----------------------------------------------------------------------------
+void test_encodeBase64DataInto(void)
+{
+  uint8_t raw[150];
+
+  for (size_t i = 0; i < sizeof(raw); i++)
+  {
+    raw[i] = (uint8_t) (i * 13);
+  }
+
+  //Test output matches encodeBase64Data() (full lines, partial last line,
+  //and exactly one full line)
+  size_t sizes[] = { sizeof(raw), 2 * KMYTH_BASE64_LINE_RAW_SIZE,
+    KMYTH_BASE64_LINE_RAW_SIZE, 1
+  };
+  uint8_t encoded[KMYTH_BASE64_ENCODED_SIZE(sizeof(raw))];
+  size_t encoded_len = 0;
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    uint8_t *expected = NULL;
+    size_t expected_len = 0;
+
+    CU_ASSERT(encodeBase64Data(raw, sizes[i], &expected, &expected_len) == 0);
+    CU_ASSERT(encodeBase64DataInto(raw, sizes[i], encoded, sizeof(encoded),
+                                   &encoded_len) == 0);
+    CU_ASSERT(encoded_len == expected_len);
+    CU_ASSERT(encoded_len == KMYTH_BASE64_ENCODED_SIZE(sizes[i]));
+    CU_ASSERT(memcmp(encoded, expected, encoded_len) == 0);
+    free(expected);
+  }
+
+  //Test invalid input
+  CU_ASSERT(encodeBase64DataInto(NULL, sizeof(raw), encoded, sizeof(encoded),
+                                 &encoded_len) == 1);
+  CU_ASSERT(encodeBase64DataInto(raw, 0, encoded, sizeof(encoded),
+                                 &encoded_len) == 1);
+  CU_ASSERT(encodeBase64DataInto(raw, sizeof(raw), NULL, sizeof(encoded),
+                                 &encoded_len) == 1);
+
+  //Test output buffer too small
+  CU_ASSERT(encodeBase64DataInto(raw, sizeof(raw), encoded,
+                                 sizeof(encoded) - 1, &encoded_len) == 1);
+}
+
+//----------------------------------------------------------------------------
+// test_decodeBase64DataInto
+//----------------------------------------------------------------------------
+void test_decodeBase64DataInto(void)
+{
+const char *RAW_PCR64 =
+  "AAAAAQALAwAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\n\
+AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\n\
+AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\n";
+
+const size_t RAW_PCR_LEN = 132;
+
+  uint8_t pcr[KMYTH_BASE64_DECODED_MAX(strlen(RAW_PCR64))];
+  size_t pcr_len = 0;
+
+  //Test valid decode matches decodeBase64Data()
+  uint8_t *expected = NULL;
+  size_t expected_len = 0;
+
+  CU_ASSERT(decodeBase64Data((uint8_t *) RAW_PCR64,
+                             strlen(RAW_PCR64), &expected,
+                             &expected_len) == 0);
+  CU_ASSERT(decodeBase64DataInto((uint8_t *) RAW_PCR64, strlen(RAW_PCR64),
+                                 pcr, sizeof(pcr), &pcr_len) == 0);
+  CU_ASSERT(pcr_len == RAW_PCR_LEN);
+  CU_ASSERT(pcr_len == expected_len);
+  CU_ASSERT(memcmp(pcr, expected, pcr_len) == 0);
+  free(expected);
+
+  //Test round trip with encodeBase64Data()
+  uint8_t raw[100];
+
+  for (size_t i = 0; i < sizeof(raw); i++)
+  {
+    raw[i] = (uint8_t) (i * 7);
+  }
+  uint8_t *encoded = NULL;
+  size_t encoded_len = 0;
+
+  CU_ASSERT(encodeBase64Data(raw, sizeof(raw), &encoded, &encoded_len) == 0);
+  uint8_t decoded[KMYTH_BASE64_DECODED_MAX(2 * sizeof(raw))];
+  size_t decoded_len = 0;
+
+  CU_ASSERT(decodeBase64DataInto(encoded, encoded_len, decoded,
+                                 sizeof(decoded), &decoded_len) == 0);
+  CU_ASSERT(decoded_len == sizeof(raw));
+  CU_ASSERT(memcmp(decoded, raw, sizeof(raw)) == 0);
+  free(encoded);
+
+  //Test invalid input
+  CU_ASSERT(decodeBase64DataInto(NULL, strlen(RAW_PCR64), pcr, sizeof(pcr),
+                                 &pcr_len) == 1);
+  CU_ASSERT(decodeBase64DataInto((uint8_t *) RAW_PCR64, 0, pcr, sizeof(pcr),
+                                 &pcr_len) == 1);
+  CU_ASSERT(decodeBase64DataInto((uint8_t *) RAW_PCR64, strlen(RAW_PCR64),
+                                 NULL, sizeof(pcr), &pcr_len) == 1);
+
+  //Test output buffer too small
+  CU_ASSERT(decodeBase64DataInto((uint8_t *) RAW_PCR64, strlen(RAW_PCR64),
+                                 pcr, RAW_PCR_LEN - 1, &pcr_len) == 1);
+
+  //INT_MAX+1
+  CU_ASSERT(decodeBase64DataInto((uint8_t *) RAW_PCR64, INT_MAX + (size_t) 1,
+                                 pcr, sizeof(pcr), &pcr_len) == 1);
+
+  //Test invalid base64 symbols
+  CU_ASSERT(decodeBase64DataInto((uint8_t *) "AA*A\n", 5, pcr, sizeof(pcr),
+                                 &pcr_len) == 1);
+}
+
+//----------------------------------------------------------------------------
+// test_base64_reference
+//----------------------------------------------------------------------------
+void test_base64_reference(void)
+{
+  uint8_t raw[1000];
+  uint8_t expected[KMYTH_BASE64_ENCODED_SIZE(sizeof(raw))];
+
+  RAND_bytes(raw, sizeof(raw));
+
+  //Every size of the encoded output matches OpenSSL's encoding, one line
+  //at a time, and decodes back to the raw data
+  int all_match = 1;
+
+  for (size_t raw_len = 1; raw_len <= sizeof(raw); raw_len++)
+  {
+    size_t expected_len = 0;
+
+    for (size_t i = 0; i < raw_len; i += KMYTH_BASE64_LINE_RAW_SIZE)
+    {
+      size_t line_len = raw_len - i;
+
+      if (line_len > KMYTH_BASE64_LINE_RAW_SIZE)
+      {
+        line_len = KMYTH_BASE64_LINE_RAW_SIZE;
+      }
+      expected_len += (size_t) EVP_EncodeBlock(expected + expected_len,
+                                               raw + i, (int) line_len);
+      expected[expected_len++] = '\n';
+    }
+
+    uint8_t *encoded = NULL;
+    size_t encoded_len = 0;
+    uint8_t *decoded = NULL;
+    size_t decoded_len = 0;
+
+    if (encodeBase64Data(raw, raw_len, &encoded, &encoded_len) ||
+        encoded_len != expected_len ||
+        memcmp(encoded, expected, expected_len) ||
+        decodeBase64Data(encoded, encoded_len, &decoded, &decoded_len) ||
+        decoded_len != raw_len || memcmp(decoded, raw, raw_len))
+    {
+      all_match = 0;
+    }
+    free(encoded);
+    free(decoded);
+  }
+  CU_ASSERT(all_match);
+
+  //Test whitespace is skipped anywhere, but other symbols are rejected
+  uint8_t out[16];
+  size_t out_len = 0;
+
+  const char *spaced = " QU\r\nJD\tRA==\n ";
+
+  CU_ASSERT(decodeBase64DataInto((uint8_t *) spaced, strlen(spaced), out,
+                                 sizeof(out), &out_len) == 0);
+  CU_ASSERT(out_len == 4);
+  CU_ASSERT(memcmp(out, "ABCD", 4) == 0);
+  CU_ASSERT(decodeBase64DataInto((uint8_t *) "QUJD-A==\n", 9, out,
+                                 sizeof(out), &out_len) == 1);
+
+  //Test padding may only end the data
+  CU_ASSERT(decodeBase64DataInto((uint8_t *) "QQ==QUJD\n", 9, out,
+                                 sizeof(out), &out_len) == 1);
+  CU_ASSERT(decodeBase64DataInto((uint8_t *) "Q===\n", 5, out,
+                                 sizeof(out), &out_len) == 1);
+
+  //Test incomplete symbol groups are rejected
+  CU_ASSERT(decodeBase64DataInto((uint8_t *) "QUJDR\n", 6, out,
+                                 sizeof(out), &out_len) == 1);
+}
+
+//----------------------------------------------------------------------------
+// test_decodeBase64Range
+//----------------------------------------------------------------------------
+void test_decodeBase64Range(void)
+{
+  uint8_t raw[1000];
+
+  for (size_t i = 0; i < sizeof(raw); i++)
+  {
+    raw[i] = (uint8_t) (i * 13 + 5);
+  }
+
+  //Every range of a few data sizes matches the raw data
+  size_t sizes[] = { 1, 47, 48, 49, 97, sizeof(raw) };
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+  {
+    size_t raw_len = sizes[s];
+    uint8_t *encoded = NULL;
+    size_t encoded_len = 0;
+
+    CU_ASSERT(encodeBase64Data(raw, raw_len, &encoded, &encoded_len) == 0);
+    CU_ASSERT(encoded_len == KMYTH_BASE64_ENCODED_SIZE(raw_len));
+
+    uint8_t decoded[sizeof(raw)];
+    int all_match = 1;
+
+    for (size_t offset = 0; offset < raw_len; offset += 7)
+    {
+      for (size_t length = 1; length <= raw_len - offset; length += 11)
+      {
+        memset(decoded, 0, sizeof(decoded));
+        if (decodeBase64Range(encoded, encoded_len, raw_len, offset, length,
+                              decoded) ||
+            memcmp(decoded, raw + offset, length))
+        {
+          all_match = 0;
+        }
+      }
+    }
+    CU_ASSERT(all_match);
+
+    //Test range outside of the data
+    CU_ASSERT(decodeBase64Range(encoded, encoded_len, raw_len, raw_len, 1,
+                                decoded) == 1);
+    CU_ASSERT(decodeBase64Range(encoded, encoded_len, raw_len, 0,
+                                raw_len + 1, decoded) == 1);
+
+    //Test layout not matching the data size
+    CU_ASSERT(decodeBase64Range(encoded, encoded_len - 1, raw_len, 0, 1,
+                                decoded) == 1);
+    CU_ASSERT(decodeBase64Range(encoded, encoded_len, raw_len + 1, 0, 1,
+                                decoded) == 1);
+    free(encoded);
+  }
+
+  //Test invalid input
+  uint8_t out[4];
+
+  CU_ASSERT(decodeBase64Range(NULL, 5, 3, 0, 1, out) == 1);
+  CU_ASSERT(decodeBase64Range((uint8_t *) "AAAA\n", 5, 3, 0, 0, out) == 1);
+  CU_ASSERT(decodeBase64Range((uint8_t *) "AAAA\n", 5, 3, 0, 1, NULL) == 1);
+  CU_ASSERT(decodeBase64Range((uint8_t *) "AAAA\n", 5, 3, 0, 3, out) == 0);
+
+  //Test invalid base64 symbols and line layout
+  CU_ASSERT(decodeBase64Range((uint8_t *) "AA*A\n", 5, 3, 0, 1, out) == 1);
+  CU_ASSERT(decodeBase64Range((uint8_t *) "AAAAA", 5, 3, 0, 1, out) == 1);
+}
+
 //----------------------------------------------------------------------------
 // test_concat()
 //----------------------------------------------------------------------------
@@ -7,12 +7,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <limits.h>
 #include <CUnit/CUnit.h>
 
 #include "memory_util_test.h"
 #include "memory_util.h"
+#include "alloc_stats.h"
 
 //----------------------------------------------------------------------------
 // memory_util_add_tests()
@@ -30,6 +33,29 @@ int memory_util_add_tests(CU_pSuite suite)
     return 1;
   }
 
+  if (NULL == CU_add_test(suite, "Kmyth Memory Arena Tests", test_kmyth_arena))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Kmyth Secure Heap Tests",
+                          test_kmyth_secure_heap))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Kmyth Allocation Counter Tests",
+                          test_kmyth_alloc_stats))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "Kmyth Allocator Hook Tests",
+                          test_kmyth_allocator))
+  {
+    return 1;
+  }
+
 //  if (NULL == CU_add_test(suite, "Kmyth Secure Memory Set Tests",
 //                          test_secure_memset))
 //  {
@@ -146,3 +172,355 @@ void test_secure_memset(void)
   CU_ASSERT(result);
   free(tmp1);
 }
+
+//----------------------------------------------------------------------------
+// test_kmyth_arena()
+//----------------------------------------------------------------------------
+void test_kmyth_arena(void)
+{
+  kmyth_arena arena = { 0 };
+
+  // Invalid parameters
+  CU_ASSERT(kmyth_arena_init(NULL, 100) == 1);
+  CU_ASSERT(kmyth_arena_init(&arena, 0) == 1);
+  CU_ASSERT(kmyth_arena_alloc(&arena, 1) == NULL);
+
+  // The size is rounded up to whole pages
+  CU_ASSERT(kmyth_arena_init(&arena, 100) == 0);
+  CU_ASSERT(arena.base != NULL);
+  CU_ASSERT(arena.size >= 100);
+  CU_ASSERT(arena.used == 0);
+
+  // Allocations are zero filled, aligned, and don't overlap
+  unsigned char *a = kmyth_arena_alloc(&arena, 3);
+  unsigned char *b = kmyth_arena_alloc(&arena, 40);
+
+  CU_ASSERT(a != NULL && b != NULL);
+  CU_ASSERT((uintptr_t) b % 16 == 0);
+  CU_ASSERT(b >= a + 3);
+
+  bool result = true;
+
+  for (int i = 0; i < 40; i++)
+  {
+    if (b[i] != 0)
+    {
+      result = false;
+    }
+  }
+  CU_ASSERT(result);
+  memset(a, 0x55, 3);
+  memset(b, 0xaa, 40);
+
+  // Requests beyond the remaining space fail
+  CU_ASSERT(kmyth_arena_alloc(&arena, 0) == NULL);
+  CU_ASSERT(kmyth_arena_alloc(&arena, arena.size) == NULL);
+
+  // Reset wipes everything that was allocated, and the space is reused
+  kmyth_arena_reset(&arena);
+  CU_ASSERT(arena.used == 0);
+  result = true;
+  for (int i = 0; i < 43; i++)
+  {
+    if (arena.base[i] != 0)
+    {
+      result = false;
+    }
+  }
+  CU_ASSERT(result);
+  CU_ASSERT(kmyth_arena_alloc(&arena, 3) == a);
+  CU_ASSERT(kmyth_arena_alloc(&arena, arena.size - 16) == arena.base + 16);
+
+  kmyth_arena_free(&arena);
+  CU_ASSERT(arena.base == NULL);
+  CU_ASSERT(arena.size == 0);
+
+  // Freeing twice (or an unused arena) is harmless
+  kmyth_arena_free(&arena);
+  kmyth_arena_reset(&arena);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_secure_heap()
+//----------------------------------------------------------------------------
+void test_kmyth_secure_heap(void)
+{
+  // Invalid parameters
+  CU_ASSERT(kmyth_secure_alloc(0) == NULL);
+  kmyth_secure_free(NULL);
+
+  CU_ASSERT(kmyth_secure_heap_init(KMYTH_SECURE_HEAP_DEFAULT_SIZE) == 0);
+
+  // Allocations are zero filled, aligned, and don't overlap
+  unsigned char *a = kmyth_secure_alloc(3);
+  unsigned char *b = kmyth_secure_alloc(40);
+
+  CU_ASSERT(a != NULL && b != NULL);
+  CU_ASSERT((uintptr_t) a % 16 == 0);
+  CU_ASSERT((uintptr_t) b % 16 == 0);
+  CU_ASSERT(b >= a + 3 || a >= b + 40);
+
+  bool result = true;
+
+  for (int i = 0; i < 40; i++)
+  {
+    if (b[i] != 0)
+    {
+      result = false;
+    }
+  }
+  CU_ASSERT(result);
+  memset(a, 0x55, 3);
+  memset(b, 0xaa, 40);
+
+  // A freed slot is wiped, and handed out (zero filled) again
+  kmyth_secure_free(b);
+
+  unsigned char *c = kmyth_secure_alloc(33);
+
+  CU_ASSERT(c == b);
+  result = true;
+  for (int i = 0; i < 64; i++)
+  {
+    if (c[i] != 0)
+    {
+      result = false;
+    }
+  }
+  CU_ASSERT(result);
+
+  // Requests larger than any size class get a mapping of their own
+  size_t big_len = 3 * KMYTH_SECURE_HEAP_DEFAULT_SIZE;
+  unsigned char *big = kmyth_secure_alloc(big_len);
+
+  CU_ASSERT(big != NULL);
+  CU_ASSERT(big[0] == 0 && big[big_len - 1] == 0);
+  memset(big, 0x33, big_len);
+
+  // So do requests finding their size class full
+  unsigned char *slots[1024];
+
+  result = true;
+  for (int i = 0; i < 1024; i++)
+  {
+    slots[i] = kmyth_secure_alloc(4096);
+    if (slots[i] == NULL || slots[i][4095] != 0)
+    {
+      result = false;
+    }
+  }
+  CU_ASSERT(result);
+  for (int i = 0; i < 1024; i++)
+  {
+    kmyth_secure_free(slots[i]);
+  }
+
+  kmyth_secure_free(big);
+  kmyth_secure_free(c);
+  kmyth_secure_free(a);
+
+  // Freeing a slot again (here, once its whole slab is free), or a pointer
+  // part way into a slot, is refused, so the slot is not handed out twice
+  kmyth_secure_free(a);
+
+  unsigned char *d = kmyth_secure_alloc(16);
+  unsigned char *e = kmyth_secure_alloc(16);
+
+  CU_ASSERT(d != NULL && e != NULL && d != e);
+  kmyth_secure_free(d + 1);
+
+  unsigned char *f = kmyth_secure_alloc(16);
+
+  CU_ASSERT(f != NULL && f != d && f != e);
+
+  // Freeing a slot again while another slot of its slab is still
+  // allocated is refused too, so later allocations stay distinct
+  kmyth_secure_free(d);
+  kmyth_secure_free(d);
+
+  unsigned char *g = kmyth_secure_alloc(16);
+  unsigned char *h = kmyth_secure_alloc(16);
+
+  CU_ASSERT(g != NULL && h != NULL && g != h);
+  CU_ASSERT(g != e && g != f && h != e && h != f);
+
+  kmyth_secure_free(h);
+  kmyth_secure_free(g);
+  kmyth_secure_free(f);
+  kmyth_secure_free(e);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_alloc_stats()
+//----------------------------------------------------------------------------
+void test_kmyth_alloc_stats(void)
+{
+  kmyth_alloc_stats start;
+  kmyth_alloc_stats stats;
+
+  // The counting functions count whether or not the build redirects to them
+  kmyth_alloc_stats_reset_peak();
+  kmyth_alloc_stats_get(&start);
+  CU_ASSERT(start.peak == start.current);
+
+  unsigned char *a = kmyth_counted_malloc(100);
+  char *b = kmyth_counted_strdup("kmyth");
+  unsigned char *c = kmyth_counted_calloc(4, 25);
+
+  CU_ASSERT(a != NULL && b != NULL && c != NULL);
+  kmyth_alloc_stats_get(&stats);
+  CU_ASSERT(stats.allocs - start.allocs == 3);
+  CU_ASSERT(stats.frees == start.frees);
+  CU_ASSERT(stats.bytes - start.bytes == 206);
+  CU_ASSERT(stats.current - start.current >= 206);
+  CU_ASSERT(stats.peak == stats.current);
+
+  // A reallocation counts as an allocation, with the old block released
+  a = kmyth_counted_realloc(a, 1000);
+  CU_ASSERT(a != NULL);
+  kmyth_alloc_stats_get(&stats);
+  CU_ASSERT(stats.allocs - start.allocs == 4);
+  CU_ASSERT(stats.current - start.current >= 1106);
+
+  int64_t peak = stats.peak;
+
+  kmyth_counted_free(a);
+  kmyth_counted_free(b);
+  kmyth_counted_clear_and_free(c, 100);
+  kmyth_counted_free(NULL);
+  kmyth_alloc_stats_get(&stats);
+  CU_ASSERT(stats.frees - start.frees == 3);
+  CU_ASSERT(stats.current == start.current);
+  CU_ASSERT(stats.peak == peak);
+
+  // The peak restarts from the current level
+  kmyth_alloc_stats_reset_peak();
+  kmyth_alloc_stats_get(&stats);
+  CU_ASSERT(stats.peak == stats.current);
+}
+
+//----------------------------------------------------------------------------
+// test allocator hooks: count their calls, and use the C library's functions
+// (called as (malloc) etc., as this file's calls are redirected)
+//----------------------------------------------------------------------------
+typedef struct
+{
+  int allocs;
+  int reallocs;
+  int frees;
+  int secure_allocs;
+  int secure_frees;
+} test_allocator_counts;
+
+static void *test_alloc(size_t size, void *arg)
+{
+  ((test_allocator_counts *) arg)->allocs++;
+  return (malloc) (size);
+}
+
+static void *test_realloc(void *ptr, size_t size, void *arg)
+{
+  ((test_allocator_counts *) arg)->reallocs++;
+  return (realloc) (ptr, size);
+}
+
+static void test_free(void *ptr, void *arg)
+{
+  ((test_allocator_counts *) arg)->frees++;
+  (free) (ptr);
+}
+
+static void *test_secure_alloc(size_t size, void *arg)
+{
+  ((test_allocator_counts *) arg)->secure_allocs++;
+  return (calloc) (1, size);
+}
+
+static void test_secure_free(void *ptr, void *arg)
+{
+  ((test_allocator_counts *) arg)->secure_frees++;
+  (free) (ptr);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_allocator()
+//----------------------------------------------------------------------------
+void test_kmyth_allocator(void)
+{
+  test_allocator_counts counts = { 0 };
+  kmyth_allocator allocator = {
+    .alloc = test_alloc,
+    .realloc = test_realloc,
+    .free = test_free,
+    .arg = &counts
+  };
+
+  CU_ASSERT(kmyth_get_allocator() == NULL);
+
+  // The required hooks must be given, and the secure hooks together
+  allocator.free = NULL;
+  CU_ASSERT(kmyth_set_allocator(&allocator) == 1);
+  allocator.free = test_free;
+  allocator.secure_alloc = test_secure_alloc;
+  CU_ASSERT(kmyth_set_allocator(&allocator) == 1);
+  CU_ASSERT(kmyth_get_allocator() == NULL);
+
+  // Without secure hooks, the secure heap is still used
+  allocator.secure_alloc = NULL;
+  CU_ASSERT(kmyth_set_allocator(&allocator) == 0);
+  CU_ASSERT(kmyth_get_allocator() != NULL);
+
+  unsigned char *s = kmyth_secure_alloc(32);
+
+  CU_ASSERT(s != NULL);
+  kmyth_secure_free(s);
+  CU_ASSERT(counts.allocs == 0 && counts.frees == 0);
+
+  // Every allocation function goes through the hooks
+  unsigned char *a = kmyth_malloc(16);
+  unsigned char *b = kmyth_calloc(4, 8);
+  char *c = kmyth_strdup("kmyth");
+  char *d = kmyth_strndup("kmyth-seal", 5);
+  char *e = NULL;
+
+  CU_ASSERT(kmyth_asprintf(&e, "%s-%d", "kmyth", 2) == 7);
+  CU_ASSERT(counts.allocs == 5);
+  CU_ASSERT(a != NULL && b != NULL && c != NULL && d != NULL && e != NULL);
+  CU_ASSERT(b != NULL && b[0] == 0 && b[31] == 0);
+  CU_ASSERT(c != NULL && strcmp(c, "kmyth") == 0);
+  CU_ASSERT(d != NULL && strcmp(d, "kmyth") == 0);
+  CU_ASSERT(e != NULL && strcmp(e, "kmyth-2") == 0);
+  CU_ASSERT(kmyth_calloc(SIZE_MAX, 2) == NULL);
+
+  a = kmyth_realloc(a, 64);
+  CU_ASSERT(a != NULL);
+  CU_ASSERT(counts.reallocs == 1);
+
+  kmyth_free(a);
+  kmyth_clear_and_free(b, 32);
+  kmyth_free(c);
+  kmyth_free(d);
+  kmyth_free(e);
+  kmyth_free(NULL);
+  CU_ASSERT(counts.frees == 5);
+
+  // A library source's calls are redirected to the hooks too
+  char *f = strdup("kmyth");
+
+  CU_ASSERT(f != NULL);
+  free(f);
+  CU_ASSERT(counts.allocs == 6 && counts.frees == 6);
+
+  // With secure hooks, they take the place of the secure heap
+  allocator.secure_alloc = test_secure_alloc;
+  allocator.secure_free = test_secure_free;
+  CU_ASSERT(kmyth_set_allocator(&allocator) == 0);
+  s = kmyth_secure_alloc(32);
+  CU_ASSERT(s != NULL);
+  kmyth_secure_free(s);
+  kmyth_secure_free(NULL);
+  CU_ASSERT(counts.secure_allocs == 1 && counts.secure_frees == 1);
+
+  CU_ASSERT(kmyth_set_allocator(NULL) == 0);
+  CU_ASSERT(kmyth_get_allocator() == NULL);
+}
@@ -0,0 +1,148 @@
+//############################################################################
+// parallel_util_test.c
+//
+// Tests for kmyth worker pool utility function in utils/src/parallel_util.c
+//############################################################################
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <CUnit/CUnit.h>
+
+#include "parallel_util_test.h"
+#include "parallel_util.h"
+
+#define TEST_ITEM_COUNT 1000
+
+//----------------------------------------------------------------------------
+// parallel_util_add_tests()
+//----------------------------------------------------------------------------
+int parallel_util_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kmyth_parallel_for() Tests",
+                          test_kmyth_parallel_for))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth_prefork() Tests",
+                          test_kmyth_prefork))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// test items - each marks its own slot, and those with an index that is a
+// multiple of fail_every (if non-zero) fail
+//----------------------------------------------------------------------------
+typedef struct
+{
+  uint8_t runs[TEST_ITEM_COUNT];
+  size_t fail_every;
+} test_items;
+
+static int run_test_item(size_t index, void *arg)
+{
+  test_items *items = (test_items *) arg;
+
+  items->runs[index]++;
+  if (items->fail_every != 0 && index % items->fail_every == 0)
+  {
+    return 1;
+  }
+  return 0;
+}
+
+static int count_items_run_once(test_items * items, size_t count)
+{
+  int once = 1;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (items->runs[i] != 1)
+    {
+      once = 0;
+    }
+  }
+  return once;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_parallel_for()
+//----------------------------------------------------------------------------
+void test_kmyth_parallel_for(void)
+{
+  test_items items;
+
+  // A NULL function is an error
+  CU_ASSERT(kmyth_parallel_for(1, 1, NULL, &items) == 1);
+
+  // No items is trivially successful
+  CU_ASSERT(kmyth_parallel_for(0, 4, run_test_item, &items) == 0);
+
+  // Every item is run exactly once, whatever the number of workers
+  size_t jobs[] = { 0, 1, 2, 7, KMYTH_MAX_JOBS, KMYTH_MAX_JOBS + 10 };
+
+  for (size_t j = 0; j < sizeof(jobs) / sizeof(jobs[0]); j++)
+  {
+    memset(&items, 0, sizeof(items));
+    CU_ASSERT(kmyth_parallel_for(TEST_ITEM_COUNT, jobs[j], run_test_item,
+                                 &items) == 0);
+    CU_ASSERT(count_items_run_once(&items, TEST_ITEM_COUNT));
+  }
+
+  // More workers than items
+  memset(&items, 0, sizeof(items));
+  CU_ASSERT(kmyth_parallel_for(3, 8, run_test_item, &items) == 0);
+  CU_ASSERT(count_items_run_once(&items, 3));
+  CU_ASSERT(items.runs[3] == 0);
+
+  // A failing item is reported, but does not stop the others being run
+  memset(&items, 0, sizeof(items));
+  items.fail_every = 97;
+  CU_ASSERT(kmyth_parallel_for(TEST_ITEM_COUNT, 4, run_test_item,
+                               &items) == 1);
+  CU_ASSERT(count_items_run_once(&items, TEST_ITEM_COUNT));
+
+  memset(&items, 0, sizeof(items));
+  items.fail_every = 97;
+  CU_ASSERT(kmyth_parallel_for(TEST_ITEM_COUNT, 1, run_test_item,
+                               &items) == 1);
+  CU_ASSERT(count_items_run_once(&items, TEST_ITEM_COUNT));
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_prefork()
+//----------------------------------------------------------------------------
+void test_kmyth_prefork(void)
+{
+  // the workers are separate processes, so they mark their slots in shared
+  // memory
+  test_items *items = mmap(NULL, sizeof(test_items), PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  CU_ASSERT_FATAL(items != MAP_FAILED);
+
+  // A NULL function, or a number of workers out of range, is an error
+  CU_ASSERT(kmyth_prefork(1, NULL, items) == 1);
+  CU_ASSERT(kmyth_prefork(0, run_test_item, items) == 1);
+  CU_ASSERT(kmyth_prefork(KMYTH_MAX_JOBS + 1, run_test_item, items) == 1);
+
+  // Each worker is run exactly once
+  memset(items, 0, sizeof(test_items));
+  CU_ASSERT(kmyth_prefork(8, run_test_item, items) == 0);
+  CU_ASSERT(count_items_run_once(items, 8));
+  CU_ASSERT(items->runs[8] == 0);
+
+  // A failing worker is reported, but does not stop the others
+  memset(items, 0, sizeof(test_items));
+  items->fail_every = 3;
+  CU_ASSERT(kmyth_prefork(KMYTH_MAX_JOBS, run_test_item, items) == 1);
+  CU_ASSERT(count_items_run_once(items, KMYTH_MAX_JOBS));
+
+  munmap(items, sizeof(test_items));
+}
@@ -0,0 +1,146 @@
+//############################################################################
+// trace_test.c
+//
+// Tests for kmyth trace span utility functions in utils/src/trace.c
+//############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <CUnit/CUnit.h>
+
+#include "trace_test.h"
+#include "trace.h"
+
+#define TEST_TRACEPARENT \
+  "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01"
+
+//----------------------------------------------------------------------------
+// trace_add_tests()
+//----------------------------------------------------------------------------
+int trace_add_tests(CU_pSuite suite)
+{
+  if (NULL == CU_add_test(suite, "kmyth tracing disabled Tests",
+                          test_kmyth_trace_disabled))
+  {
+    return 1;
+  }
+
+  if (NULL == CU_add_test(suite, "kmyth span nesting Tests",
+                          test_kmyth_span_nesting))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// read_trace_lines() - reads up to max_lines lines of the trace file
+//----------------------------------------------------------------------------
+static size_t read_trace_lines(const char *path, char lines[][2048],
+                               size_t max_lines)
+{
+  FILE *file = fopen(path, "r");
+  size_t count = 0;
+
+  while (file != NULL && count < max_lines &&
+         fgets(lines[count], 2048, file) != NULL)
+  {
+    count++;
+  }
+  if (file != NULL)
+  {
+    fclose(file);
+  }
+  return count;
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_trace_disabled()
+//----------------------------------------------------------------------------
+void test_kmyth_trace_disabled(void)
+{
+  kmyth_span_t span;
+  char traceparent[KMYTH_TRACEPARENT_LEN];
+
+  // Without KMYTH_TRACE_FILE, tracing stays off
+  unsetenv(KMYTH_TRACE_FILE_ENV);
+  CU_ASSERT(kmyth_trace_init("kmyth-test") == 0);
+  CU_ASSERT(!kmyth_trace_enabled());
+
+  kmyth_span_start(&span, "untraced");
+  CU_ASSERT(!span.active);
+  kmyth_span_set_int(&span, "bytes", 1);
+  CU_ASSERT(span.attr_count == 0);
+  CU_ASSERT(kmyth_span_traceparent(&span, traceparent,
+                                   sizeof(traceparent)) == 1);
+  kmyth_span_end(&span, 0);
+
+  // An unopenable trace file is an error, leaving tracing off
+  setenv(KMYTH_TRACE_FILE_ENV, "/nonexistent/kmyth-trace.json", 1);
+  CU_ASSERT(kmyth_trace_init("kmyth-test") == 1);
+  CU_ASSERT(!kmyth_trace_enabled());
+  unsetenv(KMYTH_TRACE_FILE_ENV);
+}
+
+//----------------------------------------------------------------------------
+// test_kmyth_span_nesting()
+//----------------------------------------------------------------------------
+void test_kmyth_span_nesting(void)
+{
+  char path[] = "/tmp/kmyth-trace-test-XXXXXX";
+  int fd = mkstemp(path);
+
+  CU_ASSERT_FATAL(fd >= 0);
+  close(fd);
+
+  setenv(KMYTH_TRACE_FILE_ENV, path, 1);
+  setenv(KMYTH_TRACEPARENT_ENV, TEST_TRACEPARENT, 1);
+  CU_ASSERT(kmyth_trace_init("kmyth-test") == 0);
+  CU_ASSERT(kmyth_trace_enabled());
+
+  kmyth_span_t outer;
+  kmyth_span_t inner;
+  char traceparent[KMYTH_TRACEPARENT_LEN];
+
+  kmyth_span_start(&outer, "outer");
+  CU_ASSERT(outer.active);
+  CU_ASSERT(kmyth_span_traceparent(&outer, traceparent,
+                                   sizeof(traceparent)) == 0);
+  CU_ASSERT(strncmp(traceparent, TEST_TRACEPARENT, 36) == 0);
+  CU_ASSERT(strlen(traceparent) == KMYTH_TRACEPARENT_LEN - 1);
+  CU_ASSERT(kmyth_span_traceparent(&outer, traceparent, 8) == 1);
+
+  kmyth_span_start(&inner, "inner");
+  CU_ASSERT(memcmp(inner.trace_id, outer.trace_id, 16) == 0);
+  CU_ASSERT(memcmp(inner.parent_id, outer.span_id, 8) == 0);
+  kmyth_span_set_str(&inner, "kmip.key_id", "key\"1\n", 6);
+  kmyth_span_set_int(&inner, "kmip.key_bytes", 32);
+  kmyth_span_end(&inner, 1);
+  kmyth_span_end(&outer, 0);
+
+  kmyth_trace_shutdown();
+  CU_ASSERT(!kmyth_trace_enabled());
+  unsetenv(KMYTH_TRACE_FILE_ENV);
+  unsetenv(KMYTH_TRACEPARENT_ENV);
+
+  // Each span is a line, written as it ends (the inner span first)
+  char lines[3][2048];
+
+  CU_ASSERT_FATAL(read_trace_lines(path, lines, 3) == 2);
+  unlink(path);
+
+  CU_ASSERT(strstr(lines[0], "\"name\":\"inner\"") != NULL);
+  CU_ASSERT(strstr(lines[0], "\"traceId\":\"0af7651916cd43dd8448eb211c80319c\"")
+            != NULL);
+  CU_ASSERT(strstr(lines[0], "\"stringValue\":\"key\\\"1\\u000a\"") != NULL);
+  CU_ASSERT(strstr(lines[0], "\"intValue\":\"32\"") != NULL);
+  CU_ASSERT(strstr(lines[0], "\"status\":{\"code\":2}") != NULL);
+  CU_ASSERT(strstr(lines[0], "\"stringValue\":\"kmyth-test\"") != NULL);
+
+  CU_ASSERT(strstr(lines[1], "\"name\":\"outer\"") != NULL);
+  CU_ASSERT(strstr(lines[1], "\"parentSpanId\":\"b7ad6b7169203331\"") != NULL);
+  CU_ASSERT(strstr(lines[1], "\"status\":{\"code\":1}") != NULL);
+}
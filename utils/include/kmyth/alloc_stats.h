@@ -0,0 +1,124 @@
+/**
+ * @file  alloc_stats.h
+ *
+ * @brief Provides the heap allocation counters of an instrumented build
+ *        (make KMYTH_ALLOC_STATS=1), used to measure how many allocations,
+ *        and how much peak heap, the seal/unseal calls cost.
+ *
+ * A source file opts in by including this header after all of its other
+ * includes: its malloc(), calloc(), realloc(), strdup(), strndup(),
+ * asprintf() and free() calls are then redirected to the allocator hooks
+ * of allocator.h (kmyth_malloc() etc.), and in an instrumented build to the
+ * counting versions below, which count and then call those hooks (as does
+ * kmyth_clear_and_free()). In a normal build the counters stay at zero.
+ *
+ * The counters are process-wide, so allocations made by other threads
+ * (e.g., workers set up with kmyth_ctx_set_jobs()) are included. Sizes are
+ * counted as the allocator's usable size of each block, so a block can be
+ * freed by uninstrumented code (it then simply remains counted as live).
+ * That size is only known for the C library's allocator: with one set by
+ * kmyth_set_allocator(), blocks and bytes requested are still counted, but
+ * current and peak are not.
+ */
+
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A snapshot of the allocation counters
+ */
+typedef struct
+{
+  /** @brief number of blocks allocated (including reallocations) */
+  uint64_t allocs;
+
+  /** @brief number of blocks freed */
+  uint64_t frees;
+
+  /** @brief total bytes requested by those allocations */
+  uint64_t bytes;
+
+  /** @brief bytes currently allocated (by instrumented code) */
+  int64_t current;
+
+  /** @brief highest value of current since the peak was last reset */
+  int64_t peak;
+} kmyth_alloc_stats;
+
+/**
+ * @brief Reports whether this build counts allocations.
+ *
+ * @return true for an instrumented build, false otherwise
+ */
+bool kmyth_alloc_stats_enabled(void);
+
+/**
+ * @brief Reads the allocation counters.
+ *
+ * @param[out] stats    The current counts
+ *
+ * @return None
+ */
+void kmyth_alloc_stats_get(kmyth_alloc_stats * stats);
+
+/**
+ * @brief Restarts the peak from the current allocation level, so that the
+ *        peak of a single operation can be measured.
+ *
+ * @return None
+ */
+void kmyth_alloc_stats_reset_peak(void);
+
+/**
+ * @brief Counting versions of the allocation functions (see above).
+ */
+void *kmyth_counted_malloc(size_t size);
+void *kmyth_counted_calloc(size_t nmemb, size_t size);
+void *kmyth_counted_realloc(void *ptr, size_t size);
+char *kmyth_counted_strdup(const char *s);
+char *kmyth_counted_strndup(const char *s, size_t n);
+int kmyth_counted_asprintf(char **strp, const char *format, ...)
+  __attribute__((format(printf, 2, 3)));
+void kmyth_counted_free(void *ptr);
+void kmyth_counted_clear_and_free(void *ptr, size_t size);
+
+#ifndef KMYTH_SGX
+#undef strdup
+#undef strndup
+#ifdef KMYTH_ALLOC_STATS
+#define malloc(size) kmyth_counted_malloc(size)
+#define calloc(nmemb, size) kmyth_counted_calloc(nmemb, size)
+#define realloc(ptr, size) kmyth_counted_realloc(ptr, size)
+#define strdup(s) kmyth_counted_strdup(s)
+#define strndup(s, n) kmyth_counted_strndup(s, n)
+#define asprintf(...) kmyth_counted_asprintf(__VA_ARGS__)
+#define free(ptr) kmyth_counted_free(ptr)
+#define kmyth_clear_and_free(ptr, size) kmyth_counted_clear_and_free(ptr, size)
+#else
+#define malloc(size) kmyth_malloc(size)
+#define calloc(nmemb, size) kmyth_calloc(nmemb, size)
+#define realloc(ptr, size) kmyth_realloc(ptr, size)
+#define strdup(s) kmyth_strdup(s)
+#define strndup(s, n) kmyth_strndup(s, n)
+#define asprintf(...) kmyth_asprintf(__VA_ARGS__)
+#define free(ptr) kmyth_free(ptr)
+#endif
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLOC_STATS_H */
@@ -0,0 +1,100 @@
+/**
+ * @file  allocator.h
+ *
+ * @brief Provides the allocator hooks through which the kmyth libraries
+ *        (libkmyth-tpm and libkmyth-utils) make their heap allocations, so
+ *        that an embedding application can supply its own allocator (e.g.,
+ *        a pool, an arena, or a wrapper that tracks or limits usage).
+ *
+ * Library sources route their malloc(), calloc(), realloc(), strdup(),
+ * strndup(), asprintf() and free() calls here by including alloc_stats.h
+ * last. By default the hooks are the C library's own functions.
+ *
+ * With an allocator of its own set, an application must release buffers
+ * that kmyth returns to it (sealed or unsealed data, strings, ...) with
+ * kmyth_free() or kmyth_clear_and_free(), and must not hand kmyth buffers
+ * to release that it allocated some other way.
+ */
+
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stdarg.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief An application supplied allocator. The alloc, realloc and free
+ *        hooks are required; secure_alloc and secure_free are optional (but
+ *        must be given together) and take the place of the secure heap of
+ *        kmyth_secure_alloc(). Each hook is passed arg.
+ */
+typedef struct kmyth_allocator
+{
+  /** @brief allocates size bytes (NULL on error) */
+  void *(*alloc) (size_t size, void *arg);
+
+  /** @brief resizes a block from alloc (as realloc() does) */
+  void *(*realloc) (void *ptr, size_t size, void *arg);
+
+  /** @brief releases a block from alloc or realloc (never passed NULL) */
+  void (*free) (void *ptr, void *arg);
+
+  /** @brief allocates a zero filled block of memory kept from swap and core
+   *         dumps (NULL on error) */
+  void *(*secure_alloc) (size_t size, void *arg);
+
+  /** @brief wipes and releases a block from secure_alloc (never passed
+   *         NULL) */
+  void (*secure_free) (void *ptr, void *arg);
+
+  /** @brief passed to each hook */
+  void *arg;
+} kmyth_allocator;
+
+/**
+ * @brief Sets the allocator the kmyth libraries use. It must be set before
+ *        kmyth makes any allocation (i.e., before any other kmyth call,
+ *        while no other thread uses kmyth), and not changed while any
+ *        buffer allocated with it is still in use.
+ *
+ * @param[in]  allocator  The allocator (copied), or NULL to restore the C
+ *                        library's allocation functions
+ *
+ * @return 0 on success, 1 on error (a required hook missing, or only one
+ *         of the secure hooks given)
+ */
+int kmyth_set_allocator(const kmyth_allocator * allocator);
+
+/**
+ * @brief Gets the allocator set with kmyth_set_allocator().
+ *
+ * @return the allocator, or NULL if the C library's functions are used
+ */
+const kmyth_allocator *kmyth_get_allocator(void);
+
+/**
+ * @brief The allocation functions of the kmyth libraries, which call the
+ *        current allocator's hooks. Their behavior otherwise matches the C
+ *        library's functions of the same name (kmyth_calloc() zero fills,
+ *        and fails on overflow; kmyth_free() ignores NULL).
+ */
+void *kmyth_malloc(size_t size);
+void *kmyth_calloc(size_t nmemb, size_t size);
+void *kmyth_realloc(void *ptr, size_t size);
+char *kmyth_strdup(const char *s);
+char *kmyth_strndup(const char *s, size_t n);
+int kmyth_asprintf(char **strp, const char *format, ...)
+  __attribute__((format(printf, 2, 3)));
+int kmyth_vasprintf(char **strp, const char *format, va_list args)
+  __attribute__((format(printf, 2, 0)));
+void kmyth_free(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLOCATOR_H */
@@ -8,9 +8,12 @@
 #ifndef FILE_IO_H
 #define FILE_IO_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -59,6 +62,80 @@ int verifyOutputFilePath(char *path);
 int read_bytes_from_file(char *input_path, uint8_t ** data,
                          size_t * data_length);
 
+/**
+ * @brief Provides a read-only view of the bytes in a file, located at
+ *        input_path, without copying them where possible.
+ *
+ * A regular file is memory-mapped (with a sequential access hint), so its
+ * contents can be used directly without first being read into (and grown
+ * in) a heap buffer. Anything that cannot be mapped (e.g., a pipe, or
+ * /dev/stdin) is instead read, until end-of-file, into an allocated buffer.
+ * Either way, the view must be released with unmap_bytes_from_file(), and
+ * must not be written to. The file should not be truncated while it is
+ * mapped.
+ *
+ * @param[in]  input_path  String representing the path to the file being read
+ *
+ * @param[out] data        Read-only view of the file contents - passed as a
+ *                         pointer to the byte array pointer. NULL if
+ *                         input_path points to an empty file.
+ *
+ * @param[out] data_length The size, in bytes, of the file contents -
+ *                         passed as a pointer to the length value
+ *
+ * @param[out] mapped      Set to true if the view is a memory mapping,
+ *                         false if it is an allocated buffer - passed as a
+ *                         pointer to the flag
+ *
+ * @return 0 if success, 1 if error
+ */
+int map_bytes_from_file(char *input_path, uint8_t ** data,
+                        size_t * data_length, bool * mapped);
+
+/**
+ * @brief Releases a view of a file's contents obtained from
+ *        map_bytes_from_file().
+ *
+ * @param[in]  data        The file contents view (may be NULL)
+ *
+ * @param[in]  data_length The size, in bytes, of the view
+ *
+ * @param[in]  mapped      The mapped flag returned with the view
+ *
+ * @return None
+ */
+void unmap_bytes_from_file(uint8_t * data, size_t data_length, bool mapped);
+
+/**
+ * @brief Reads a list of file paths (a "manifest"), one per line, from the
+ *        file located at list_path. Leading and trailing whitespace is
+ *        removed from each line, and blank lines and lines starting with
+ *        '#' are skipped.
+ *
+ * @param[in]  list_path   String representing the path to the list file
+ *
+ * @param[out] paths       Array of count paths - passed as a pointer to
+ *                         the array, which must be released with
+ *                         free_path_list() (NULL if the list is empty)
+ *
+ * @param[out] count       The number of paths read - passed as a pointer
+ *                         to the count
+ *
+ * @return 0 if success, 1 if error
+ */
+int read_path_list(char *list_path, char ***paths, size_t * count);
+
+/**
+ * @brief Releases a list of file paths obtained from read_path_list().
+ *
+ * @param[in]  paths       The path list (may be NULL)
+ *
+ * @param[in]  count       The number of paths in the list
+ *
+ * @return None
+ */
+void free_path_list(char **paths, size_t count);
+
 /**
  * @brief Verifies output_path is valid, then writes bytes to file
  * 
@@ -74,6 +151,129 @@ int read_bytes_from_file(char *input_path, uint8_t ** data,
 int write_bytes_to_file(char *output_path,
                         uint8_t * bytes, size_t bytes_length);
 
+/**
+ * @brief Writes a set of output files atomically: each file is written to
+ *        a temporary file in its directory (an unnamed one, linked in once
+ *        complete, where the file system supports O_TMPFILE), and all of
+ *        them are renamed into place together by
+ *        kmyth_output_writer_commit(). Files that are replaced keep their
+ *        permissions.
+ *
+ *        With sync set, the files are made durable when committed - for a
+ *        batch of files, by syncing each file system written to once
+ *        (syncfs()), before and after the renames, rather than each file.
+ */
+typedef struct kmyth_output_writer_s
+{
+  /** @brief make the files durable when committed */
+  bool sync;
+
+  /** @brief number of files (slots) in the batch */
+  size_t count;
+
+  /** @brief path of each file */
+  char **out_paths;
+
+  /** @brief temporary file of each file, until it is committed */
+  char **tmp_paths;
+
+  /** @brief device (file system) of each temporary file */
+  dev_t *devs;
+} kmyth_output_writer_t;
+
+/**
+ * @brief Sets up an output writer for a batch of files.
+ *
+ * @param[out] writer              The output writer, to be released with
+ *                                 kmyth_output_writer_free()
+ *
+ * @param[in]  count               Number of files in the batch
+ *
+ * @param[in]  sync                true to make the files durable
+ *
+ * @return 0 if success, 1 if error
+ */
+int kmyth_output_writer_init(kmyth_output_writer_t * writer, size_t count,
+                             bool sync);
+
+/**
+ * @brief Writes one file of a batch to its temporary file. Different
+ *        files (indices) may be staged concurrently.
+ *
+ * @param[in]  writer              The output writer
+ *
+ * @param[in]  index               Index of the file in the batch (each
+ *                                 index may be staged once)
+ *
+ * @param[in]  output_path         String containing the path to the
+ *                                 output file
+ *
+ * @param[in]  bytes               Bytes to be written
+ *
+ * @param[in]  bytes_length        Number of bytes to be written
+ *
+ * @return 0 if success, 1 if error
+ */
+int kmyth_output_writer_stage(kmyth_output_writer_t * writer, size_t index,
+                              char *output_path, uint8_t * bytes,
+                              size_t bytes_length);
+
+/**
+ * @brief Renames all of the staged files of a batch into place (syncing
+ *        them first, if requested).
+ *
+ * @param[in]  writer              The output writer
+ *
+ * @return 0 if success, 1 if error
+ */
+int kmyth_output_writer_commit(kmyth_output_writer_t * writer);
+
+/**
+ * @brief Releases an output writer, removing the temporary files of any
+ *        files staged but not committed.
+ *
+ * @param[in]  writer              The output writer
+ *
+ * @return None
+ */
+void kmyth_output_writer_free(kmyth_output_writer_t * writer);
+
+/**
+ * @brief As write_bytes_to_file(), but replaces the file atomically (see
+ *        kmyth_output_writer_t) - a reader sees either the old or the new
+ *        contents, never a partly written file.
+ *
+ * @param[in]  output_path         String containing the path to the
+ *                                 output file
+ *
+ * @param[in]  bytes               Bytes to be written
+ *
+ * @param[in]  bytes_length        Number of bytes to be written
+ *
+ * @param[in]  sync                true to make the file durable (fsync()
+ *                                 of the file and its directory)
+ *
+ * @return 0 if success, 1 if error
+ */
+int write_bytes_to_file_atomic(char *output_path, uint8_t * bytes,
+                               size_t bytes_length, bool sync);
+
+/**
+ * @brief Replaces the contents of an existing file atomically and durably
+ *        (see write_bytes_to_file_atomic()), keeping its permissions.
+ *
+ * @param[in]  output_path         String containing the path to the
+ *                                 (existing) file to be replaced
+ *
+ * @param[in]  bytes               Bytes to be written
+ *
+ * @param[in]  bytes_length        Number of bytes to be written
+ *
+ * @return 0 if success, 1 if error (the original file is then unchanged)
+ */
+int replace_file_atomically(char *output_path, uint8_t * bytes,
+                            size_t bytes_length);
+
 /**
  * @brief Prints raw bytes to standard out.
  * 
@@ -86,6 +286,39 @@ int write_bytes_to_file(char *output_path,
 int print_to_stdout(unsigned char *plain_text_data,
                     size_t plain_text_data_size);
 
+/**
+ * @brief Reads from a file descriptor until the buffer passed in is full or
+ *        end-of-file is reached, retrying reads that are interrupted or
+ *        return only part of the requested data.
+ *
+ * @param[in]  fd          File descriptor to read from
+ *
+ * @param[out] buf         Buffer to hold the bytes read
+ *
+ * @param[in]  buf_size    Size, in bytes, of buf
+ *
+ * @param[out] bytes_read  Number of bytes read (less than buf_size only at
+ *                         end-of-file) - passed as pointer to the length
+ *                         value
+ *
+ * @return 0 if success, 1 if error
+ */
+int read_from_fd(int fd, uint8_t * buf, size_t buf_size, size_t * bytes_read);
+
+/**
+ * @brief Writes all of the bytes passed in to a file descriptor, retrying
+ *        writes that are interrupted or accept only part of the data.
+ *
+ * @param[in]  fd            File descriptor to write to
+ *
+ * @param[in]  bytes         Bytes to be written
+ *
+ * @param[in]  bytes_length  Number of bytes to be written
+ *
+ * @return 0 if success, 1 if error
+ */
+int write_to_fd(int fd, uint8_t * bytes, size_t bytes_length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,58 @@
+/**
+ * @file  file_loader.h
+ *
+ * @brief Provides a loader that reads many (input) files at once, for the
+ *        Kmyth batch operations.
+ *
+ * Where the kernel supports it, the reads are submitted together through
+ * io_uring (into registered buffers), so that the latency of each read -
+ * high on a network file system - overlaps with that of the others. The
+ * loader otherwise falls back to reading the files with a pool of worker
+ * threads.
+ */
+
+#ifndef FILE_LOADER_H
+#define FILE_LOADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Default (and maximum) number of reads kmyth_load_files() keeps
+ *        in flight
+ */
+#define KMYTH_LOADER_DEPTH 64
+
+/**
+ * @brief Reads the contents of each of a list of files into memory (as
+ *        read_bytes_from_file() does for one file).
+ *
+ * @param[in]  paths       The paths of the files to be read
+ *
+ * @param[in]  count       The number of files
+ *
+ * @param[in]  depth       The number of reads to keep in flight (0 for
+ *                         KMYTH_LOADER_DEPTH, and limited to it)
+ *
+ * @param[out] datas       The contents of each file (allocated here, to be
+ *                         freed by the caller - NULL for an empty file, or
+ *                         one that could not be read)
+ *
+ * @param[out] data_lens   The length, in bytes, of each file's contents
+ *
+ * @param[out] results     The result of each read: 0 on success, 1 on error
+ *
+ * @return 0 if every file was read, 1 otherwise
+ */
+int kmyth_load_files(char **paths, size_t count, size_t depth,
+                     uint8_t ** datas, size_t *data_lens, int *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FILE_LOADER_H */
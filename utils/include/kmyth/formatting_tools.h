@@ -23,6 +23,15 @@ extern "C" {
  *           each one is used for parsing a kmyth-seal'd file.
  */
 
+/** 
+ * @ingroup block_delim
+ *
+ * @brief   Indicates the start of an (optional) storage root key name
+ *          block, present only when the .ski records the TPM (SRK) it was
+ *          sealed under. When present, it is the first block.
+ */
+#define KMYTH_DELIM_SRK_NAME "-----STORAGE ROOT KEY NAME-----\n"
+
 /** 
  * @ingroup block_delim
  *
@@ -81,6 +90,15 @@ extern "C" {
  */
 #define KMYTH_DELIM_SYM_KEY_PRIVATE "-----SYM KEY ENC PRIVATE-----\n"
 
+/** 
+ * @ingroup block_delim
+ *
+ * @brief   Indicates the start of an (optional) chunk index block, present
+ *          only when the encrypted data is split into separately
+ *          authenticated chunks
+ */
+#define KMYTH_DELIM_CHUNK_INDEX "-----CHUNK INDEX-----\n"
+
 /** 
  * @ingroup block_delim
  *
@@ -102,6 +120,14 @@ extern "C" {
  */
 #define KMYTH_DELIM_NKL_DATA "-----NKL DATA-----\n"
 
+/**
+ * @ingroup block_delim
+ *
+ * @brief   Indicates the start of a nickel file whose data was sealed in
+ *          pieces (so it can be unsealed a piece at a time)
+ */
+#define KMYTH_DELIM_NKL_CHUNKED_DATA "-----NKL CHUNKED DATA-----\n"
+
 /**
  * @ingroup block_delim
  *
@@ -109,6 +135,54 @@ extern "C" {
  */
 #define KMYTH_DELIM_END_NKL "-----NKL END-----\n"
 
+/**
+ * @defgroup nkl_binary Binary NKL Format
+ *
+ * @brief    A binary .nkl holds its sealed data raw, after a fixed header,
+ *           so it can be passed to the enclave without being decoded:
+ *
+ *           <pre>
+ *           offset  size  field
+ *           0       4     magic, KMYTH_NKL_BINARY_MAGIC
+ *           4       1     version, KMYTH_NKL_BINARY_VERSION
+ *           5       1     flags (KMYTH_NKL_BINARY_CHUNKED)
+ *           6       2     reserved, zero
+ *           8       8     length of the sealed data (big-endian)
+ *           16            the sealed data
+ *           </pre>
+ *
+ *           The magic cannot begin a text .nkl, so the two are told apart by
+ *           their first bytes.
+ */
+
+/**
+ * @ingroup nkl_binary
+ *
+ * @brief   Identifies a binary .nkl
+ */
+#define KMYTH_NKL_BINARY_MAGIC "KNKL"
+
+/**
+ * @ingroup nkl_binary
+ *
+ * @brief   The binary .nkl format version written (and the only one read)
+ */
+#define KMYTH_NKL_BINARY_VERSION 1
+
+/**
+ * @ingroup nkl_binary
+ *
+ * @brief   Flag marking data that was sealed in pieces
+ */
+#define KMYTH_NKL_BINARY_CHUNKED 0x01
+
+/**
+ * @ingroup nkl_binary
+ *
+ * @brief   Size of the binary .nkl header, in bytes
+ */
+#define KMYTH_NKL_BINARY_HEADER_LEN 16
+
 /**
  * @brief Retrieves the contents of the next "block" in the data read from a 
  *         block file, if the delimiter for the current file block matches the
@@ -150,6 +224,45 @@ int get_block_bytes(char **contents,
                     char *delim, size_t delim_len,
                     char *next_delim, size_t next_delim_len);
 
+/**
+ * @brief Retrieves the contents of the next "block" in the data read in
+ *        from a .ski file, without copying it.
+ *
+ * Same as get_block_bytes(), except that the returned block points into
+ * the input buffer rather than to a newly allocated copy. The block is
+ * therefore only valid for as long as the input buffer is, and must not be
+ * freed by the caller.
+ *
+ * @param[in/out] contents   Data buffer containing the contents (or partial
+ *                           contents of a .ski file - passed as a pointer
+ *                           to the address of the data buffer (updated by
+ *                           this function)
+ *
+ * @param[in/out] remaining  Count of bytes remaining in data buffer -
+ *                           passed as a pointer to the count value (updated by
+ *                           this function)
+ *
+ * @param[out] block         Start of the .ski file "block" retrieved, within
+ *                           the contents buffer
+ *
+ * @param[out] blocksize     Size, in bytes, of the .ski file "block" retrieved -
+ *                           passed as a pointer to the length value
+ *
+ * @param[in]  delim         String value representing the expected delimiter (the
+ *                           delimiter value for the block type being retrieved)
+ *
+ * @param[in] delim_len      Length of the expected delimeter
+ * @param[in] next_delim     String value representing the next expected
+ *                           delimiter.
+ * @param[in] next_delim_len Length of the next expected delimeter
+ * @return 0 on success, 1 on failure
+ */
+int get_block_view(uint8_t ** contents,
+                   size_t * remaining, uint8_t ** block,
+                   size_t * blocksize,
+                   char *delim, size_t delim_len,
+                   char *next_delim, size_t next_delim_len);
+
 /**
  * @brief Creates a byte array in .nkl format from a input string
  *
@@ -166,6 +279,70 @@ int get_block_bytes(char **contents,
 int create_nkl_bytes(uint8_t * input, size_t input_length,
                      uint8_t ** output, size_t * output_length);
 
+/**
+ * @brief Creates a byte array in .nkl format from data sealed in pieces,
+ *        marking the data block with KMYTH_DELIM_NKL_CHUNKED_DATA rather
+ *        than KMYTH_DELIM_NKL_DATA
+ *
+ * @param[in]  input          The sealed pieces, concatenated
+ *
+ * @param[in]  input_length   The number of bytes in input
+ *
+ * @param[out] output         The bytes in .nkl format
+ *
+ * @param[out] output_length  The number of bytes in output
+ *
+ * @return 0 on success, 1 on error
+ */
+int create_nkl_chunked_bytes(uint8_t * input, size_t input_length,
+                             uint8_t ** output, size_t * output_length);
+
+/**
+ * @brief Writes the header of a binary .nkl, to be followed by the sealed
+ *        data itself
+ *
+ * @param[in]  data_length    The number of bytes of sealed data
+ *
+ * @param[in]  flags          The header flags (KMYTH_NKL_BINARY_CHUNKED
+ *                            or 0)
+ *
+ * @param[out] header         Space for the KMYTH_NKL_BINARY_HEADER_LEN
+ *                            header bytes
+ */
+void create_nkl_binary_header(size_t data_length, uint8_t flags,
+                              uint8_t * header);
+
+/**
+ * @brief Checks whether a .nkl is in the binary format (rather than the
+ *        base64 text format)
+ *
+ * @param[in]  input          The .nkl bytes
+ *
+ * @param[in]  input_length   The number of bytes in input
+ *
+ * @return 1 if input begins with KMYTH_NKL_BINARY_MAGIC, 0 otherwise
+ */
+int is_nkl_binary(const uint8_t * input, size_t input_length);
+
+/**
+ * @brief Finds the sealed data in a binary .nkl, without copying it
+ *
+ * @param[in]  input          The .nkl bytes
+ *
+ * @param[in]  input_length   The number of bytes in input
+ *
+ * @param[out] data           Points to the sealed data, within input
+ *
+ * @param[out] data_length    The number of bytes of sealed data
+ *
+ * @param[out] flags          The header flags
+ *
+ * @return 0 on success, 1 if input is not a well-formed binary .nkl
+ */
+int get_nkl_binary_view(uint8_t * input, size_t input_length,
+                        uint8_t ** data, size_t * data_length,
+                        uint8_t * flags);
+
 /**
  * @brief Encodes a base-64 encoded version of the "raw" hex bytes contained
  *        in an input data buffer.
@@ -213,6 +390,113 @@ int decodeBase64Data(unsigned char *base64_data,
                      size_t base64_data_size, unsigned char **raw_data,
                      size_t * raw_data_size);
 
+/**
+ * @brief Upper bound on the size, in bytes, of the result of decoding
+ *        base64_data_size bytes of base-64 encoded data
+ */
+#define KMYTH_BASE64_DECODED_MAX(base64_data_size) \
+  ((((base64_data_size) + 3) / 4) * 3)
+
+/**
+ * @brief Decodes a base-64 encoded data buffer into a caller-supplied
+ *        buffer, without any intermediate allocation.
+ *
+ * @param[in]  base64_data      The base-64 encoded input data -
+ *                              passed as a pointer to the byte
+ *                              array containing these bytes
+ *
+ * @param[in]  base64_data_size Size, in bytes, of the base-64 encoded
+ *                              input data
+ *
+ * @param[out] raw_data         Buffer to hold the base-64 decoded "raw"
+ *                              data bytes
+ *
+ * @param[in]  raw_data_max     Size, in bytes, of the raw_data buffer. Must
+ *                              be at least KMYTH_BASE64_DECODED_MAX(base64_data_size)
+ *
+ * @param[out] raw_data_size    Size, in bytes, of the base-64 decoded output
+ *                              data - passed as a pointer to the length value
+ *
+ * @return 0 if success, 1 if error
+ */
+int decodeBase64DataInto(uint8_t * base64_data,
+                         size_t base64_data_size,
+                         uint8_t * raw_data,
+                         size_t raw_data_max, size_t * raw_data_size);
+
+/**
+ * @brief Number of "raw" bytes encoded in each (full) line of base-64 data
+ *        produced by encodeBase64Data() - each such line holds 64 base-64
+ *        symbols followed by a newline
+ */
+#define KMYTH_BASE64_LINE_RAW_SIZE 48
+
+/**
+ * @brief Size, in bytes, of the base-64 encoded data (including newlines)
+ *        produced by encodeBase64Data() for raw_data_size bytes of input
+ */
+#define KMYTH_BASE64_ENCODED_SIZE(raw_data_size) \
+  (((raw_data_size) / KMYTH_BASE64_LINE_RAW_SIZE) * 65 + \
+   (((raw_data_size) % KMYTH_BASE64_LINE_RAW_SIZE) ? \
+    ((((raw_data_size) % KMYTH_BASE64_LINE_RAW_SIZE) + 2) / 3) * 4 + 1 : 0))
+
+/**
+ * @brief Base-64 encodes an input data buffer into a caller-supplied
+ *        buffer, without any intermediate allocation. The output is
+ *        identical to that of encodeBase64Data() (without its string
+ *        terminator).
+ *
+ * @param[in]  raw_data         The "raw" input data (hex bytes)
+ *
+ * @param[in]  raw_data_size    Size, in bytes, of the raw input data
+ *
+ * @param[out] base64_data      Buffer to hold the base-64 encoded data
+ *
+ * @param[in]  base64_data_max  Size, in bytes, of the base64_data buffer.
+ *                              Must be at least
+ *                              KMYTH_BASE64_ENCODED_SIZE(raw_data_size)
+ *
+ * @param[out] base64_data_size Size, in bytes, of the base-64 encoded output
+ *                              data - passed as a pointer to the length value
+ *
+ * @return 0 if success, 1 if error
+ */
+int encodeBase64DataInto(uint8_t * raw_data,
+                         size_t raw_data_size,
+                         uint8_t * base64_data,
+                         size_t base64_data_max, size_t * base64_data_size);
+
+/**
+ * @brief Decodes a range of the "raw" bytes contained in a base-64 encoded
+ *        data buffer, without decoding the rest of it.
+ *
+ * The fixed line layout of encodeBase64Data() output is used to locate
+ * the lines holding the requested range, so only those lines are decoded.
+ * Input that does not have that exact layout is rejected.
+ *
+ * @param[in]  base64_data      The base-64 encoded input data, as produced
+ *                              by encodeBase64Data()
+ *
+ * @param[in]  base64_data_size Size, in bytes, of the base-64 encoded
+ *                              input data
+ *
+ * @param[in]  raw_data_size    Size, in bytes, of the complete decoded data
+ *
+ * @param[in]  offset           Offset, within the decoded data, of the
+ *                              first byte to decode
+ *
+ * @param[in]  length           Number of decoded bytes to return (the range
+ *                              must lie within raw_data_size bytes)
+ *
+ * @param[out] raw_data         Buffer, of at least length bytes, to hold
+ *                              the decoded bytes
+ *
+ * @return 0 if success, 1 if error
+ */
+int decodeBase64Range(uint8_t * base64_data, size_t base64_data_size,
+                      size_t raw_data_size, size_t offset, size_t length,
+                      uint8_t * raw_data);
+
 /**
  * @brief Concatinates two arrays of type uint8_t
  *
@@ -8,6 +8,7 @@
 #ifndef MEMORY_UTIL_H
 #define MEMORY_UTIL_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -19,6 +20,7 @@ extern "C" {
 /**
  * @brief Wipes the memory in a designated pointer. If the size is incorrectly specified, behavior 
  *        can be unpredictable. If a NULL pointer is handled, the function simply returns.
+ *        The aligned part of the memory is cleared a word at a time.
  *
  *        Based on SEI Cert C Coding Standard miscellaneous recommendation MSC06-C
  *
@@ -31,7 +33,8 @@ extern "C" {
 void kmyth_clear(void *v, size_t size);
 
 /**
- * @brief Wipes the memory in a designated pointer, then frees the pointer. Utilizes kmyth_clear.
+ * @brief Wipes the memory in a designated pointer, then frees the pointer (with kmyth_free(),
+ *         see allocator.h). Utilizes kmyth_clear.
  *         If the size is incorrectly specified, behavior can be unpredictable. If a NULL pointer 
  *         is handled, the function simply returns.
  *
@@ -56,6 +59,115 @@ void kmyth_clear_and_free(void *v, size_t size);
  */
 void *secure_memset(void *v, int c, size_t n);
 
+/**
+ * @brief A fixed size region of memory that temporary buffers are
+ *        allocated from, and that is wiped and recycled as a whole.
+ *
+ * The region is locked into memory (when the process is allowed to lock
+ * it) so that the buffers are not written to swap. Allocations are zero
+ * filled and are only released, all together, by kmyth_arena_reset() or
+ * kmyth_arena_free(), which wipe everything allocated since the last reset.
+ */
+typedef struct
+{
+  uint8_t *base;
+  size_t size;
+  size_t used;
+  bool locked;
+} kmyth_arena;
+
+/**
+ * @brief Creates an (empty) arena.
+ *
+ * @param[out] arena    The arena to initialize
+ *
+ * @param[in]  size     The size, in bytes, of the arena (rounded up to a
+ *                      whole number of pages)
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_arena_init(kmyth_arena * arena, size_t size);
+
+/**
+ * @brief Allocates a zero filled buffer from an arena. The buffer is
+ *        aligned for any type, and must not be passed to free().
+ *
+ * @param[in]  arena    The arena to allocate from
+ *
+ * @param[in]  size     The size, in bytes, of the buffer
+ *
+ * @return the buffer, or NULL if the arena does not have enough space left
+ */
+void *kmyth_arena_alloc(kmyth_arena * arena, size_t size);
+
+/**
+ * @brief Wipes every buffer allocated from an arena, which releases them so
+ *        that the arena's space can be reused.
+ *
+ * @param[in]  arena    The arena to reset
+ *
+ * @return None
+ */
+void kmyth_arena_reset(kmyth_arena * arena);
+
+/**
+ * @brief Wipes, unlocks, and releases the memory of an arena.
+ *
+ * @param[in]  arena    The arena to free (may be uninitialized, if zeroed)
+ *
+ * @return None
+ */
+void kmyth_arena_free(kmyth_arena * arena);
+
+/**
+ * @brief Default size, in bytes, of the secure heap (see
+ *        kmyth_secure_alloc())
+ */
+#define KMYTH_SECURE_HEAP_DEFAULT_SIZE (256 * 1024)
+
+/**
+ * @brief Sets up the process-wide secure heap that kmyth_secure_alloc()
+ *        allocates from, if it is not set up already. Otherwise, it is set
+ *        up (with the default size) by the first kmyth_secure_alloc().
+ *
+ * The heap is a single mapping, excluded from core dumps and locked into
+ * memory (when the process is allowed to lock it), so that plaintext keys
+ * allocated from it are not written to swap. It is split into one slab
+ * per size class (16 to 4096 bytes), each followed by an inaccessible
+ * guard page, and there is a guard page before the first.
+ *
+ * @param[in]  size     The size, in bytes, of the heap (shared equally by
+ *                      the size classes, and rounded up to whole pages)
+ *
+ * @return 0 on success, 1 on error
+ */
+int kmyth_secure_heap_init(size_t size);
+
+/**
+ * @brief Allocates a zero filled buffer of secure memory. Requests larger
+ *        than the largest size class, or that find their class full, get a
+ *        mapping of their own (also locked, excluded from core dumps, and
+ *        between guard pages). The buffer is aligned for any type, and must
+ *        be released with kmyth_secure_free(), not free(). When the
+ *        allocator set by kmyth_set_allocator() has secure hooks, the
+ *        buffer comes from its secure_alloc hook instead.
+ *
+ * @param[in]  size     The size, in bytes, of the buffer
+ *
+ * @return the buffer, or NULL on error
+ */
+void *kmyth_secure_alloc(size_t size);
+
+/**
+ * @brief Wipes (the whole size class slot or mapping of) and releases a
+ *        buffer allocated by kmyth_secure_alloc().
+ *
+ * @param[in]  ptr      The buffer to release (may be NULL)
+ *
+ * @return None
+ */
+void kmyth_secure_free(void *ptr);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,89 @@
+/**
+ * @file  parallel_util.h
+ *
+ * @brief Provides a minimal worker pool for running the independent items
+ *        of a Kmyth batch operation in parallel, and a pool of pre-forked
+ *        worker processes for servers
+ */
+
+#ifndef PARALLEL_UTIL_H
+#define PARALLEL_UTIL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Maximum number of workers used by kmyth_parallel_for()
+ */
+#define KMYTH_MAX_JOBS 64
+
+/**
+ * @brief Function run by kmyth_parallel_for() for each item.
+ *
+ * @param[in]     index  Index of the item (0 to count - 1)
+ *
+ * @param[in,out] arg    Caller supplied argument, shared by all items
+ *
+ * @return 0 on success, non-zero on error
+ */
+typedef int (*kmyth_parallel_fn) (size_t index, void *arg);
+
+/**
+ * @brief Runs fn once for each of count items, using up to jobs workers
+ *        (the calling thread included). Items are handed out in order,
+ *        one at a time, so each one is run by exactly one worker, but
+ *        items may complete in any order.
+ *
+ *        With jobs <= 1 (or a single item) everything is run in the
+ *        calling thread. If fewer worker threads than requested can be
+ *        started, the items are shared between those that were.
+ *
+ * @param[in]     count  Number of items
+ *
+ * @param[in]     jobs   Maximum number of workers (limited to KMYTH_MAX_JOBS)
+ *
+ * @param[in]     fn     Function run for each item - it must be safe to
+ *                       run concurrently for different items
+ *
+ * @param[in,out] arg    Argument passed to every call of fn
+ *
+ * @return 0 if fn succeeded for every item, 1 otherwise
+ */
+int kmyth_parallel_for(size_t count, size_t jobs, kmyth_parallel_fn fn,
+                       void *arg);
+
+/**
+ * @brief Runs fn once in each of count forked worker processes (index 0 to
+ *        count - 1), and waits for all of them to exit. Each worker starts
+ *        with a copy of the caller's state - e.g., keys already loaded -
+ *        and exits (without running atexit() handlers) when fn returns.
+ *        The workers are sent SIGTERM if the calling process dies.
+ *
+ *        This suits servers whose workers each bind their own listening
+ *        socket to the same port (with SO_REUSEPORT), so that the kernel
+ *        spreads the incoming connections among them. Only the calling
+ *        thread is copied into the workers, so fn must not rely on the
+ *        caller's other threads (or on locks they may hold), and the
+ *        caller must not reap the workers itself.
+ *
+ * @param[in]     count  Number of worker processes (1 to KMYTH_MAX_JOBS)
+ *
+ * @param[in]     fn     Function run by each worker
+ *
+ * @param[in,out] arg    Argument passed to every call of fn (each worker
+ *                       has its own copy of anything it points to)
+ *
+ * @return 0 if every worker was started, and fn succeeded in each, 1
+ *         otherwise (if a worker cannot be started, those already running
+ *         are stopped)
+ */
+int kmyth_prefork(size_t count, kmyth_parallel_fn fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PARALLEL_UTIL_H */
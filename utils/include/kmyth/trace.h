@@ -0,0 +1,190 @@
+/**
+ * @file  trace.h
+ *
+ * @brief Provides optional trace spans, so that the time taken by the
+ *        stages of a request (e.g., unsealing, the TLS handshake, the KMIP
+ *        exchange) can be told apart and correlated with a key server's
+ *        own traces.
+ *
+ * Tracing is off unless the KMYTH_TRACE_FILE environment variable names a
+ * file when kmyth_trace_init() is called. Each ended span is then appended
+ * to that file as one line of OTLP/JSON (an ExportTraceServiceRequest), the
+ * format read by an OpenTelemetry collector's otlpjsonfile receiver. A W3C
+ * traceparent in the TRACEPARENT environment variable makes the process's
+ * top-level spans children of the caller's span.
+ *
+ * Spans started by a thread while another of its spans is open are
+ * children of that span. With tracing off, starting and ending a span
+ * only records that it is inactive.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Environment variable naming the file spans are written to
+ */
+#define KMYTH_TRACE_FILE_ENV "KMYTH_TRACE_FILE"
+
+/**
+ * @brief Environment variable holding a W3C traceparent to continue
+ */
+#define KMYTH_TRACEPARENT_ENV "TRACEPARENT"
+
+/**
+ * @brief Maximum number of attributes recorded on a span
+ */
+#define KMYTH_SPAN_MAX_ATTRS 8
+
+/**
+ * @brief Maximum length of a string attribute value (longer values are
+ *        truncated)
+ */
+#define KMYTH_SPAN_MAX_STR_LEN 128
+
+/**
+ * @brief Length of a W3C traceparent string, including its NUL terminator
+ */
+#define KMYTH_TRACEPARENT_LEN 56
+
+/**
+ * @brief A span, normally a local variable of the function it times
+ */
+typedef struct kmyth_span_s
+{
+  bool active;
+  const char *name;
+  uint8_t trace_id[16];
+  uint8_t span_id[8];
+  uint8_t parent_id[8];
+  bool has_parent;
+  uint64_t start_ns;
+  size_t attr_count;
+  struct
+  {
+    const char *key;
+    bool is_int;
+    int64_t int_value;
+    char str_value[KMYTH_SPAN_MAX_STR_LEN];
+  } attrs[KMYTH_SPAN_MAX_ATTRS];
+  struct kmyth_span_s *outer;
+} kmyth_span_t;
+
+#ifdef KMYTH_SGX
+
+// code shared with the enclaves (e.g., kmip_util.c) has no trace file there
+#define kmyth_span_start(span, name) ((span)->active = false)
+#define kmyth_span_set_str(span, key, value, len) ((void) 0)
+#define kmyth_span_set_int(span, key, value) ((void) 0)
+#define kmyth_span_end(span, result) ((void) 0)
+
+#else
+
+/**
+ * @brief Turns tracing on if KMYTH_TRACE_FILE is set (and reads any
+ *        TRACEPARENT). Tracing is left off otherwise.
+ *
+ * @param[in]  service_name  Name reported as the spans' service.name
+ *                           (e.g., "kmyth-getkey")
+ *
+ * @return 0 on success (tracing on or off), 1 if the trace file could not
+ *         be opened
+ */
+int kmyth_trace_init(const char *service_name);
+
+/**
+ * @brief Turns tracing off, closing the trace file.
+ *
+ * @return None
+ */
+void kmyth_trace_shutdown(void);
+
+/**
+ * @brief Reports whether tracing is on.
+ *
+ * @return true if spans are being written, false otherwise
+ */
+bool kmyth_trace_enabled(void);
+
+/**
+ * @brief Starts a span, as a child of the thread's open span (if any).
+ *
+ * @param[out] span     The span to start
+ *
+ * @param[in]  name     Name of the span (a string constant)
+ *
+ * @return None
+ */
+void kmyth_span_start(kmyth_span_t * span, const char *name);
+
+/**
+ * @brief Records a string attribute on a span.
+ *
+ * @param[in,out] span  An open span
+ *
+ * @param[in]  key      Attribute name (a string constant)
+ *
+ * @param[in]  value    Attribute value (need not be NUL terminated)
+ *
+ * @param[in]  len      Length, in bytes, of value
+ *
+ * @return None
+ */
+void kmyth_span_set_str(kmyth_span_t * span, const char *key,
+                        const char *value, size_t len);
+
+/**
+ * @brief Records an integer attribute (e.g., a byte count) on a span.
+ *
+ * @param[in,out] span  An open span
+ *
+ * @param[in]  key      Attribute name (a string constant)
+ *
+ * @param[in]  value    Attribute value
+ *
+ * @return None
+ */
+void kmyth_span_set_int(kmyth_span_t * span, const char *key, int64_t value);
+
+/**
+ * @brief Ends a span, writing it to the trace file.
+ *
+ * @param[in,out] span  The thread's innermost open span
+ *
+ * @param[in]  result   Result of the traced operation (non-zero marks the
+ *                      span as an error)
+ *
+ * @return None
+ */
+void kmyth_span_end(kmyth_span_t * span, int result);
+
+/**
+ * @brief Formats a span's W3C traceparent, for passing its context on to
+ *        another process.
+ *
+ * @param[in]  span     An open span
+ *
+ * @param[out] buf      The traceparent
+ *
+ * @param[in]  len      Size, in bytes, of buf (at least
+ *                      KMYTH_TRACEPARENT_LEN)
+ *
+ * @return 0 on success, 1 if the span is inactive (or buf too small)
+ */
+int kmyth_span_traceparent(const kmyth_span_t * span, char *buf, size_t len);
+
+#endif /* KMYTH_SGX */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H */
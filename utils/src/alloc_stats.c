@@ -0,0 +1,224 @@
+/**
+ * @file  alloc_stats.c
+ * @brief Implements the heap allocation counters of an instrumented build
+ *        (see alloc_stats.h)
+ */
+
+#include <malloc.h>
+#include <stdarg.h>
+
+#include "memory_util.h"
+
+// (this file calls the allocator hooks, and kmyth_clear_and_free(), itself)
+#include "alloc_stats.h"
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef strdup
+#undef strndup
+#undef asprintf
+#undef free
+#undef kmyth_clear_and_free
+
+static uint64_t alloc_count = 0;
+static uint64_t free_count = 0;
+static uint64_t alloc_bytes = 0;
+static int64_t alloc_current = 0;
+static int64_t alloc_peak = 0;
+
+//############################################################################
+// usable_size()
+//############################################################################
+static int64_t usable_size(void *ptr)
+{
+  // (the size of an application allocator's block is not known)
+  if (ptr == NULL || kmyth_get_allocator() != NULL)
+  {
+    return 0;
+  }
+
+  return (int64_t) malloc_usable_size(ptr);
+}
+
+//############################################################################
+// count_alloc()
+//############################################################################
+static void count_alloc(void *ptr, size_t requested, int64_t released)
+{
+  int64_t current = __atomic_add_fetch(&alloc_current,
+                                       usable_size(ptr) - released,
+                                       __ATOMIC_RELAXED);
+  int64_t peak = __atomic_load_n(&alloc_peak, __ATOMIC_RELAXED);
+
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&alloc_bytes, requested, __ATOMIC_RELAXED);
+  while (current > peak &&
+         !__atomic_compare_exchange_n(&alloc_peak, &peak, current, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+  }
+}
+
+//############################################################################
+// count_free()
+//############################################################################
+static void count_free(void *ptr)
+{
+  __atomic_fetch_add(&free_count, 1, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&alloc_current, usable_size(ptr), __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// kmyth_alloc_stats_enabled()
+//############################################################################
+bool kmyth_alloc_stats_enabled(void)
+{
+#ifdef KMYTH_ALLOC_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+//############################################################################
+// kmyth_alloc_stats_get()
+//############################################################################
+void kmyth_alloc_stats_get(kmyth_alloc_stats * stats)
+{
+  stats->allocs = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+  stats->frees = __atomic_load_n(&free_count, __ATOMIC_RELAXED);
+  stats->bytes = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED);
+  stats->current = __atomic_load_n(&alloc_current, __ATOMIC_RELAXED);
+  stats->peak = __atomic_load_n(&alloc_peak, __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// kmyth_alloc_stats_reset_peak()
+//############################################################################
+void kmyth_alloc_stats_reset_peak(void)
+{
+  __atomic_store_n(&alloc_peak,
+                   __atomic_load_n(&alloc_current, __ATOMIC_RELAXED),
+                   __ATOMIC_RELAXED);
+}
+
+//############################################################################
+// kmyth_counted_malloc()
+//############################################################################
+void *kmyth_counted_malloc(size_t size)
+{
+  void *ptr = kmyth_malloc(size);
+
+  if (ptr != NULL)
+  {
+    count_alloc(ptr, size, 0);
+  }
+
+  return ptr;
+}
+
+//############################################################################
+// kmyth_counted_calloc()
+//############################################################################
+void *kmyth_counted_calloc(size_t nmemb, size_t size)
+{
+  void *ptr = kmyth_calloc(nmemb, size);
+
+  if (ptr != NULL)
+  {
+    count_alloc(ptr, nmemb * size, 0);
+  }
+
+  return ptr;
+}
+
+//############################################################################
+// kmyth_counted_realloc()
+//############################################################################
+void *kmyth_counted_realloc(void *ptr, size_t size)
+{
+  int64_t old_size = usable_size(ptr);
+  void *new_ptr = kmyth_realloc(ptr, size);
+
+  if (new_ptr != NULL)
+  {
+    count_alloc(new_ptr, size, old_size);
+  }
+
+  return new_ptr;
+}
+
+//############################################################################
+// kmyth_counted_strdup()
+//############################################################################
+char *kmyth_counted_strdup(const char *s)
+{
+  char *ptr = kmyth_strdup(s);
+
+  if (ptr != NULL)
+  {
+    count_alloc(ptr, strlen(ptr) + 1, 0);
+  }
+
+  return ptr;
+}
+
+//############################################################################
+// kmyth_counted_strndup()
+//############################################################################
+char *kmyth_counted_strndup(const char *s, size_t n)
+{
+  char *ptr = kmyth_strndup(s, n);
+
+  if (ptr != NULL)
+  {
+    count_alloc(ptr, strlen(ptr) + 1, 0);
+  }
+
+  return ptr;
+}
+
+//############################################################################
+// kmyth_counted_asprintf()
+//############################################################################
+int kmyth_counted_asprintf(char **strp, const char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  int len = kmyth_vasprintf(strp, format, args);
+
+  va_end(args);
+
+  if (len >= 0)
+  {
+    count_alloc(*strp, (size_t) len + 1, 0);
+  }
+
+  return len;
+}
+
+//############################################################################
+// kmyth_counted_free()
+//############################################################################
+void kmyth_counted_free(void *ptr)
+{
+  if (ptr != NULL)
+  {
+    count_free(ptr);
+  }
+  kmyth_free(ptr);
+}
+
+//############################################################################
+// kmyth_counted_clear_and_free()
+//############################################################################
+void kmyth_counted_clear_and_free(void *ptr, size_t size)
+{
+  if (ptr != NULL)
+  {
+    count_free(ptr);
+  }
+  kmyth_clear_and_free(ptr, size);
+}
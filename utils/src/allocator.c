@@ -0,0 +1,180 @@
+/**
+ * @file  allocator.c
+ * @brief Implements the allocator hooks of the kmyth libraries (see
+ *        allocator.h)
+ */
+
+#include "allocator.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the application's allocator, if custom_allocator is set (otherwise the C
+// library's functions are called directly)
+static kmyth_allocator current_allocator;
+static bool custom_allocator = false;
+
+//############################################################################
+// kmyth_set_allocator()
+//############################################################################
+int kmyth_set_allocator(const kmyth_allocator * allocator)
+{
+  if (allocator == NULL)
+  {
+    custom_allocator = false;
+    memset(&current_allocator, 0, sizeof(kmyth_allocator));
+    return 0;
+  }
+
+  if (allocator->alloc == NULL || allocator->realloc == NULL ||
+      allocator->free == NULL ||
+      (allocator->secure_alloc == NULL) != (allocator->secure_free == NULL))
+  {
+    return 1;
+  }
+
+  current_allocator = *allocator;
+  custom_allocator = true;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_get_allocator()
+//############################################################################
+const kmyth_allocator *kmyth_get_allocator(void)
+{
+  return custom_allocator ? &current_allocator : NULL;
+}
+
+//############################################################################
+// kmyth_malloc()
+//############################################################################
+void *kmyth_malloc(size_t size)
+{
+  if (!custom_allocator)
+  {
+    return malloc(size);
+  }
+
+  return current_allocator.alloc(size, current_allocator.arg);
+}
+
+//############################################################################
+// kmyth_calloc()
+//############################################################################
+void *kmyth_calloc(size_t nmemb, size_t size)
+{
+  if (!custom_allocator)
+  {
+    return calloc(nmemb, size);
+  }
+
+  if (size != 0 && nmemb > SIZE_MAX / size)
+  {
+    return NULL;
+  }
+
+  void *ptr = current_allocator.alloc(nmemb * size, current_allocator.arg);
+
+  if (ptr != NULL)
+  {
+    memset(ptr, 0, nmemb * size);
+  }
+
+  return ptr;
+}
+
+//############################################################################
+// kmyth_realloc()
+//############################################################################
+void *kmyth_realloc(void *ptr, size_t size)
+{
+  if (!custom_allocator)
+  {
+    return realloc(ptr, size);
+  }
+
+  return current_allocator.realloc(ptr, size, current_allocator.arg);
+}
+
+//############################################################################
+// kmyth_strdup()
+//############################################################################
+char *kmyth_strdup(const char *s)
+{
+  return kmyth_strndup(s, SIZE_MAX);
+}
+
+//############################################################################
+// kmyth_strndup()
+//############################################################################
+char *kmyth_strndup(const char *s, size_t n)
+{
+  size_t len = strnlen(s, n);
+  char *copy = kmyth_malloc(len + 1);
+
+  if (copy != NULL)
+  {
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+  }
+
+  return copy;
+}
+
+//############################################################################
+// kmyth_asprintf()
+//############################################################################
+int kmyth_asprintf(char **strp, const char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  int len = kmyth_vasprintf(strp, format, args);
+
+  va_end(args);
+
+  return len;
+}
+
+//############################################################################
+// kmyth_vasprintf()
+//############################################################################
+int kmyth_vasprintf(char **strp, const char *format, va_list args)
+{
+  va_list copy;
+
+  va_copy(copy, args);
+  int len = vsnprintf(NULL, 0, format, copy);
+
+  va_end(copy);
+
+  if (len < 0 || (*strp = kmyth_malloc((size_t) len + 1)) == NULL)
+  {
+    return -1;
+  }
+  vsnprintf(*strp, (size_t) len + 1, format, args);
+
+  return len;
+}
+
+//############################################################################
+// kmyth_free()
+//############################################################################
+void kmyth_free(void *ptr)
+{
+  if (!custom_allocator)
+  {
+    free(ptr);
+    return;
+  }
+
+  if (ptr != NULL)
+  {
+    current_allocator.free(ptr, current_allocator.arg);
+  }
+}
@@ -7,11 +7,16 @@
 
 #include "file_io.h"
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <openssl/bio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include "defines.h"
@@ -21,6 +26,8 @@
 #include "formatting_tools.h"
 #include "memory_util.h"
 
+#include "alloc_stats.h"
+
 //############################################################################
 // verifyInputFilePath()
 //############################################################################
@@ -216,6 +223,249 @@ int read_bytes_from_file(char *input_path, uint8_t ** data,
   return 0;
 }
 
+//############################################################################
+// map_bytes_from_file()
+//############################################################################
+int map_bytes_from_file(char *input_path, uint8_t ** data,
+                        size_t * data_length, bool * mapped)
+{
+  *data = NULL;
+  *data_length = 0;
+  *mapped = false;
+
+  if (input_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "NULL input path ... exiting");
+    return 1;
+  }
+
+  int fd = open(input_path, O_RDONLY);
+
+  if (fd < 0)
+  {
+    kmyth_log(LOG_ERR, "error opening input file: %s ... exiting", input_path);
+    return 1;
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) == -1)
+  {
+    kmyth_log(LOG_ERR,
+              "input file (%s) stats could not be retrieved ... exiting",
+              input_path);
+    close(fd);
+    return 1;
+  }
+
+  // a (non-empty) regular file is mapped - the mapping remains valid after
+  // the file descriptor is closed
+  if (S_ISREG(st.st_mode) && st.st_size > 0)
+  {
+    void *view = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE,
+                      fd, 0);
+
+    if (view != MAP_FAILED)
+    {
+      close(fd);
+
+      // the contents are (at most) read through once, front to back
+      madvise(view, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+      *data = (uint8_t *) view;
+      *data_length = (size_t) st.st_size;
+      *mapped = true;
+      return 0;
+    }
+    kmyth_log(LOG_DEBUG, "unable to map input file (%s), reading instead",
+              input_path);
+  }
+  else if (S_ISREG(st.st_mode))
+  {
+    // empty file
+    close(fd);
+    return 0;
+  }
+
+  // Otherwise (e.g., a pipe) the size is not known up front, so the input
+  // is read into a buffer that grows as needed
+  size_t buf_size = KMYTH_STREAM_BLOCK_SIZE;
+  size_t buf_len = 0;
+  uint8_t *buf = malloc(buf_size);
+
+  while (buf != NULL)
+  {
+    size_t len = 0;
+
+    if (read_from_fd(fd, buf + buf_len, buf_size - buf_len, &len))
+    {
+      kmyth_log(LOG_ERR, "error reading input file: %s ... exiting",
+                input_path);
+      free(buf);
+      close(fd);
+      return 1;
+    }
+    buf_len += len;
+    if (buf_len < buf_size)
+    {
+      // end-of-file
+      break;
+    }
+
+    uint8_t *new_buf = NULL;
+
+    if (buf_size <= SIZE_MAX / 2)
+    {
+      new_buf = realloc(buf, 2 * buf_size);
+    }
+    if (new_buf == NULL)
+    {
+      free(buf);
+    }
+    buf = new_buf;
+    buf_size *= 2;
+  }
+  close(fd);
+
+  if (buf == NULL)
+  {
+    kmyth_log(LOG_ERR, "could not allocate memory to read file ... exiting");
+    return 1;
+  }
+  if (buf_len == 0)
+  {
+    free(buf);
+    return 0;
+  }
+
+  *data = buf;
+  *data_length = buf_len;
+  return 0;
+}
+
+//############################################################################
+// unmap_bytes_from_file()
+//############################################################################
+void unmap_bytes_from_file(uint8_t * data, size_t data_length, bool mapped)
+{
+  if (data == NULL)
+  {
+    return;
+  }
+  if (mapped)
+  {
+    munmap(data, data_length);
+  }
+  else
+  {
+    free(data);
+  }
+}
+
+//############################################################################
+// read_path_list()
+//############################################################################
+int read_path_list(char *list_path, char ***paths, size_t * count)
+{
+  *paths = NULL;
+  *count = 0;
+
+  uint8_t *data = NULL;
+  size_t data_length = 0;
+  bool mapped = false;
+
+  if (map_bytes_from_file(list_path, &data, &data_length, &mapped))
+  {
+    kmyth_log(LOG_ERR, "unable to read path list ... exiting");
+    return 1;
+  }
+
+  char *text = (char *) data;
+  int retval = 0;
+  size_t start = 0;
+  size_t capacity = 0;
+
+  while (start < data_length)
+  {
+    size_t end = start;
+
+    while (end < data_length && text[end] != '\n')
+    {
+      end++;
+    }
+
+    // trim the line, then skip it if it is blank or a comment
+    size_t first = start;
+    size_t last = end;
+
+    while (first < last && isspace((unsigned char) text[first]))
+    {
+      first++;
+    }
+    while (last > first && isspace((unsigned char) text[last - 1]))
+    {
+      last--;
+    }
+    start = end + 1;
+    if (first == last || text[first] == '#')
+    {
+      continue;
+    }
+
+    if (*count == capacity)
+    {
+      size_t new_capacity = (capacity == 0) ? 16 : 2 * capacity;
+      char **new_paths = realloc(*paths, new_capacity * sizeof(char *));
+
+      if (new_paths == NULL)
+      {
+        kmyth_log(LOG_ERR, "unable to allocate path list ... exiting");
+        retval = 1;
+        break;
+      }
+      *paths = new_paths;
+      capacity = new_capacity;
+    }
+
+    (*paths)[*count] = strndup(text + first, last - first);
+    if ((*paths)[*count] == NULL)
+    {
+      kmyth_log(LOG_ERR, "unable to allocate path ... exiting");
+      retval = 1;
+      break;
+    }
+    (*count)++;
+  }
+
+  unmap_bytes_from_file(data, data_length, mapped);
+
+  if (retval)
+  {
+    free_path_list(*paths, *count);
+    *paths = NULL;
+    *count = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// free_path_list()
+//############################################################################
+void free_path_list(char **paths, size_t count)
+{
+  if (paths == NULL)
+  {
+    return;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    free(paths[i]);
+  }
+  free(paths);
+}
+
 //############################################################################
 // write_bytes_to_file
 //############################################################################
@@ -248,6 +498,332 @@ int write_bytes_to_file(char *output_path, uint8_t * bytes, size_t bytes_length)
   return 0;
 }
 
+// sequence number making the temporary file names of a process unique
+static size_t output_tmp_seq = 0;
+
+//############################################################################
+// stage_output_file()
+//############################################################################
+static int stage_output_file(char *output_path, uint8_t * bytes,
+                             size_t bytes_length, char **tmp_path, dev_t * dev)
+{
+  if (verifyOutputFilePath(output_path))
+  {
+    kmyth_log(LOG_ERR, "invalid output path (%s) ... exiting", output_path);
+    return 1;
+  }
+
+  // a file being replaced keeps its permissions
+  struct stat st = { 0 };
+  bool replacing = (stat(output_path, &st) == 0);
+  mode_t mode = st.st_mode & 07777;
+
+  // the temporary file goes in the same directory (so on the same file
+  // system) as the output file - its name includes our (live) process ID,
+  // so any file already of that name was left behind by an earlier process
+  // and can be removed
+  size_t tmp_path_len = strlen(output_path) + 64;
+  char *tmp = malloc(tmp_path_len);
+  char *dir_path = strdup(output_path);
+
+  if (tmp == NULL || dir_path == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error ... exiting");
+    free(tmp);
+    free(dir_path);
+    return 1;
+  }
+  snprintf(tmp, tmp_path_len, "%s.kmyth-tmp.%ld.%zu", output_path,
+           (long) getpid(),
+           __atomic_fetch_add(&output_tmp_seq, 1, __ATOMIC_RELAXED));
+  unlink(tmp);
+
+  // where the file system supports it, the data is written to an unnamed
+  // file that is only linked into the directory once complete, so a crash
+  // part way through leaves nothing behind
+  int fd = -1;
+  bool unnamed = false;
+
+#ifdef O_TMPFILE
+  fd = open(dirname(dir_path), O_TMPFILE | O_WRONLY, 0666);
+  unnamed = (fd >= 0);
+#endif
+  free(dir_path);
+  if (fd < 0)
+  {
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+  }
+  if (fd < 0)
+  {
+    kmyth_log(LOG_ERR, "unable to create temporary file for %s (%s) "
+              "... exiting", output_path, strerror(errno));
+    free(tmp);
+    return 1;
+  }
+
+  int retval = ((replacing && fchmod(fd, mode) != 0) ||
+                write_to_fd(fd, bytes, bytes_length) ||
+                fstat(fd, &st) != 0);
+
+  if (retval == 0 && unnamed)
+  {
+    char fd_path[32];
+
+    snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fd);
+    retval = (linkat(AT_FDCWD, fd_path, AT_FDCWD, tmp,
+                     AT_SYMLINK_FOLLOW) != 0);
+  }
+  if (close(fd) != 0)
+  {
+    retval = 1;
+  }
+  if (retval)
+  {
+    kmyth_log(LOG_ERR, "unable to write temporary file for %s (%s) "
+              "... exiting", output_path, strerror(errno));
+    unlink(tmp);
+    free(tmp);
+    return 1;
+  }
+
+  *tmp_path = tmp;
+  *dev = st.st_dev;
+
+  return 0;
+}
+
+//############################################################################
+// sync_output_files()
+//############################################################################
+static int sync_output_files(kmyth_output_writer_t * writer, char **paths,
+                             bool dirs, bool batch)
+{
+  // for a batch, each file system written to is synced once (syncfs),
+  // rather than each file - the file systems written to are few, so they
+  // are simply kept in a list
+  dev_t *synced = calloc(writer->count, sizeof(dev_t));
+  size_t synced_count = 0;
+  int retval = (synced == NULL);
+
+  for (size_t i = 0; i < writer->count && retval == 0; i++)
+  {
+    if (paths[i] == NULL)
+    {
+      continue;
+    }
+
+    bool done = false;
+
+    for (size_t j = 0; batch && j < synced_count && !done; j++)
+    {
+      done = (synced[j] == writer->devs[i]);
+    }
+    if (done)
+    {
+      continue;
+    }
+
+    char *path = strdup(paths[i]);
+    int fd = (path == NULL) ? -1 :
+      open(dirs ? dirname(path) : path, O_RDONLY);
+
+    retval = (fd < 0 || (batch ? syncfs(fd) : fsync(fd)) != 0);
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    free(path);
+    synced[synced_count++] = writer->devs[i];
+  }
+  free(synced);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_output_writer_init()
+//############################################################################
+int kmyth_output_writer_init(kmyth_output_writer_t * writer, size_t count,
+                             bool sync)
+{
+  if (writer == NULL || count == 0)
+  {
+    return 1;
+  }
+
+  writer->sync = sync;
+  writer->count = count;
+  writer->out_paths = calloc(count, sizeof(char *));
+  writer->tmp_paths = calloc(count, sizeof(char *));
+  writer->devs = calloc(count, sizeof(dev_t));
+  if (writer->out_paths == NULL || writer->tmp_paths == NULL ||
+      writer->devs == NULL)
+  {
+    kmyth_log(LOG_ERR, "malloc error ... exiting");
+    kmyth_output_writer_free(writer);
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_output_writer_stage()
+//############################################################################
+int kmyth_output_writer_stage(kmyth_output_writer_t * writer, size_t index,
+                              char *output_path, uint8_t * bytes,
+                              size_t bytes_length)
+{
+  if (writer == NULL || index >= writer->count ||
+      writer->tmp_paths[index] != NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid output writer parameters ... exiting");
+    return 1;
+  }
+
+  char *out_path = strdup(output_path == NULL ? "" : output_path);
+
+  if (out_path == NULL ||
+      stage_output_file(output_path, bytes, bytes_length,
+                        &writer->tmp_paths[index], &writer->devs[index]))
+  {
+    free(out_path);
+    return 1;
+  }
+  writer->out_paths[index] = out_path;
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_output_writer_commit()
+//############################################################################
+int kmyth_output_writer_commit(kmyth_output_writer_t * writer)
+{
+  if (writer == NULL)
+  {
+    return 1;
+  }
+
+  size_t staged = 0;
+
+  for (size_t i = 0; i < writer->count; i++)
+  {
+    staged += (writer->tmp_paths[i] != NULL);
+  }
+
+  // a single file is synced on its own, a batch a file system at a time -
+  // either way, the contents must be durable before they are renamed into
+  // place, and the renames (the directories) after
+  bool batch = (staged > 1);
+
+  if (writer->sync &&
+      sync_output_files(writer, writer->tmp_paths, false, batch))
+  {
+    kmyth_log(LOG_ERR, "unable to sync output files (%s) ... exiting",
+              strerror(errno));
+    return 1;
+  }
+
+  for (size_t i = 0; i < writer->count; i++)
+  {
+    if (writer->tmp_paths[i] == NULL)
+    {
+      continue;
+    }
+    if (rename(writer->tmp_paths[i], writer->out_paths[i]) != 0)
+    {
+      kmyth_log(LOG_ERR, "unable to write %s (%s) ... exiting",
+                writer->out_paths[i], strerror(errno));
+      return 1;
+    }
+    free(writer->tmp_paths[i]);
+    writer->tmp_paths[i] = NULL;
+  }
+
+  if (writer->sync &&
+      sync_output_files(writer, writer->out_paths, true, batch))
+  {
+    kmyth_log(LOG_ERR, "unable to sync output directories (%s) ... exiting",
+              strerror(errno));
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_output_writer_free()
+//############################################################################
+void kmyth_output_writer_free(kmyth_output_writer_t * writer)
+{
+  if (writer == NULL)
+  {
+    return;
+  }
+
+  for (size_t i = 0; i < writer->count; i++)
+  {
+    if (writer->tmp_paths != NULL && writer->tmp_paths[i] != NULL)
+    {
+      // never committed
+      unlink(writer->tmp_paths[i]);
+      free(writer->tmp_paths[i]);
+    }
+    if (writer->out_paths != NULL)
+    {
+      free(writer->out_paths[i]);
+    }
+  }
+  free(writer->out_paths);
+  free(writer->tmp_paths);
+  free(writer->devs);
+  writer->out_paths = NULL;
+  writer->tmp_paths = NULL;
+  writer->devs = NULL;
+  writer->count = 0;
+}
+
+//############################################################################
+// write_bytes_to_file_atomic()
+//############################################################################
+int write_bytes_to_file_atomic(char *output_path, uint8_t * bytes,
+                               size_t bytes_length, bool sync)
+{
+  kmyth_output_writer_t writer = { 0 };
+
+  if (kmyth_output_writer_init(&writer, 1, sync))
+  {
+    return 1;
+  }
+
+  int retval = (kmyth_output_writer_stage(&writer, 0, output_path,
+                                          bytes, bytes_length) ||
+                kmyth_output_writer_commit(&writer));
+
+  kmyth_output_writer_free(&writer);
+
+  return retval;
+}
+
+//############################################################################
+// replace_file_atomically()
+//############################################################################
+int replace_file_atomically(char *output_path, uint8_t * bytes,
+                            size_t bytes_length)
+{
+  struct stat st;
+
+  if (output_path == NULL || stat(output_path, &st) != 0 ||
+      !S_ISREG(st.st_mode))
+  {
+    kmyth_log(LOG_ERR, "invalid output path (%s) ... exiting", output_path);
+    return 1;
+  }
+
+  return write_bytes_to_file_atomic(output_path, bytes, bytes_length, true);
+}
+
 //############################################################################
 // print_to_stdout()
 //############################################################################
@@ -280,3 +856,59 @@ int print_to_stdout(unsigned char *data, size_t data_size)
   BIO_free_all(bdata);
   return 0;
 }
+
+//############################################################################
+// read_from_fd()
+//############################################################################
+int read_from_fd(int fd, uint8_t * buf, size_t buf_size, size_t * bytes_read)
+{
+  *bytes_read = 0;
+  while (*bytes_read < buf_size)
+  {
+    ssize_t len = read(fd, buf + *bytes_read, buf_size - *bytes_read);
+
+    if (len < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      kmyth_log(LOG_ERR, "read error (%s) ... exiting", strerror(errno));
+      return 1;
+    }
+    if (len == 0)
+    {
+      // end-of-file
+      break;
+    }
+    *bytes_read += (size_t) len;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// write_to_fd()
+//############################################################################
+int write_to_fd(int fd, uint8_t * bytes, size_t bytes_length)
+{
+  size_t written = 0;
+
+  while (written < bytes_length)
+  {
+    ssize_t len = write(fd, bytes + written, bytes_length - written);
+
+    if (len < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      kmyth_log(LOG_ERR, "write error (%s) ... exiting", strerror(errno));
+      return 1;
+    }
+    written += (size_t) len;
+  }
+
+  return 0;
+}
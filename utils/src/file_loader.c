@@ -0,0 +1,452 @@
+/**
+ * file_loader.c:
+ *
+ * C library reading many files at once (through io_uring, where the kernel
+ * supports it) supporting Kmyth batch operations
+ */
+
+#include "file_loader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define KMYTH_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+#include "defines.h"
+
+#include "file_io.h"
+#include "parallel_util.h"
+
+#include "alloc_stats.h"
+
+// largest single read submitted - a longer file is read in several
+#define KMYTH_LOADER_MAX_READ (1U << 30)
+
+// the files being loaded, shared with the workers reading them
+typedef struct
+{
+  char **paths;
+  uint8_t **datas;
+  size_t *data_lens;
+  int *results;
+} kmyth_load_work;
+
+//############################################################################
+// load_file_item()
+//############################################################################
+static int load_file_item(size_t i, void *arg)
+{
+  kmyth_load_work *work = (kmyth_load_work *) arg;
+
+  // already read (through io_uring)
+  if (work->results[i] == 0)
+  {
+    return 0;
+  }
+
+  work->results[i] = read_bytes_from_file(work->paths[i], &work->datas[i],
+                                          &work->data_lens[i]);
+  if (work->results[i])
+  {
+    work->datas[i] = NULL;
+    work->data_lens[i] = 0;
+  }
+
+  return work->results[i];
+}
+
+#ifdef KMYTH_HAVE_IO_URING
+
+// an io_uring instance, with its rings mapped
+typedef struct
+{
+  int fd;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+} kmyth_uring;
+
+//############################################################################
+// uring_teardown()
+//############################################################################
+static void uring_teardown(kmyth_uring * ring)
+{
+  if (ring->sqes != NULL)
+  {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring)
+  {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  if (ring->sq_ring != NULL)
+  {
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  }
+  if (ring->fd >= 0)
+  {
+    close(ring->fd);
+  }
+}
+
+//############################################################################
+// uring_setup()
+//############################################################################
+static int uring_setup(kmyth_uring * ring, unsigned entries)
+{
+  struct io_uring_params params;
+
+  memset(ring, 0, sizeof(kmyth_uring));
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0)
+  {
+    // e.g., an older kernel, or io_uring disabled
+    kmyth_log(LOG_DEBUG, "io_uring not available (%s)", strerror(errno));
+    return 1;
+  }
+
+  ring->sq_ring_size = params.sq_off.array +
+    params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = params.cq_off.cqes +
+    params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (ring->cq_ring_size > ring->sq_ring_size)
+    {
+      ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->cq_ring_size = ring->sq_ring_size;
+  }
+
+  void *sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd,
+                       IORING_OFF_SQ_RING);
+
+  if (sq_ring == MAP_FAILED)
+  {
+    uring_teardown(ring);
+    return 1;
+  }
+  ring->sq_ring = sq_ring;
+
+  void *cq_ring = sq_ring;
+
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+  {
+    cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED)
+    {
+      uring_teardown(ring);
+      return 1;
+    }
+  }
+  ring->cq_ring = cq_ring;
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  void *sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+  if (sqes == MAP_FAILED)
+  {
+    uring_teardown(ring);
+    return 1;
+  }
+  ring->sqes = (struct io_uring_sqe *) sqes;
+
+  uint8_t *sq = (uint8_t *) sq_ring;
+  uint8_t *cq = (uint8_t *) cq_ring;
+
+  ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+  ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  return 0;
+}
+
+//############################################################################
+// uring_queue_read()
+//############################################################################
+static void uring_queue_read(kmyth_uring * ring, int fd, uint8_t * buf,
+                             size_t len, size_t offset, int buf_index,
+                             size_t user_data)
+{
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = (buf_index >= 0) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) (uintptr_t) buf;
+  sqe->len = (len > KMYTH_LOADER_MAX_READ) ?
+    KMYTH_LOADER_MAX_READ : (uint32_t) len;
+  sqe->off = (uint64_t) offset;
+  if (buf_index >= 0)
+  {
+    sqe->buf_index = (uint16_t) buf_index;
+  }
+  sqe->user_data = (uint64_t) user_data;
+  ring->sq_array[index] = index;
+
+  // the kernel must see the entry before the new tail
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+//############################################################################
+// uring_load_group()
+//############################################################################
+static void uring_load_group(kmyth_uring * ring, kmyth_load_work * work,
+                             size_t first, size_t count)
+{
+  int *fds = calloc(count, sizeof(int));
+  int *buf_indices = calloc(count, sizeof(int));
+  size_t *done = calloc(count, sizeof(size_t));
+  struct iovec *iovs = calloc(count, sizeof(struct iovec));
+
+  if (fds == NULL || buf_indices == NULL || done == NULL || iovs == NULL)
+  {
+    free(fds);
+    free(buf_indices);
+    free(done);
+    free(iovs);
+    return;
+  }
+
+  // open (and size) the files, allocating the buffers they are read into
+  unsigned buf_count = 0;
+
+  for (size_t k = 0; k < count; k++)
+  {
+    size_t i = first + k;
+    struct stat st;
+
+    fds[k] = open(work->paths[i], O_RDONLY | O_CLOEXEC);
+    if (fds[k] < 0)
+    {
+      continue;
+    }
+    if (fstat(fds[k], &st) != 0 || !S_ISREG(st.st_mode))
+    {
+      close(fds[k]);
+      fds[k] = -1;
+      continue;
+    }
+
+    // as for read_bytes_from_file(), an empty file has no contents
+    if (st.st_size <= 0 || st.st_size > INT_MAX)
+    {
+      close(fds[k]);
+      fds[k] = -1;
+      work->results[i] = 0;
+      continue;
+    }
+
+    work->data_lens[i] = (size_t) st.st_size;
+    work->datas[i] = malloc(work->data_lens[i]);
+    if (work->datas[i] == NULL)
+    {
+      close(fds[k]);
+      fds[k] = -1;
+      work->data_lens[i] = 0;
+      continue;
+    }
+    buf_indices[k] = (int) buf_count;
+    iovs[buf_count].iov_base = work->datas[i];
+    iovs[buf_count].iov_len = work->data_lens[i];
+    buf_count++;
+  }
+
+  // registering the buffers saves the kernel mapping them for each read -
+  // if it fails (e.g., the locked memory limit), plain reads are used
+  bool fixed = (buf_count > 0 &&
+                syscall(__NR_io_uring_register, ring->fd,
+                        IORING_REGISTER_BUFFERS, iovs, buf_count) == 0);
+
+  // submit all of the reads together
+  unsigned to_submit = 0;
+  size_t inflight = 0;
+
+  for (size_t k = 0; k < count; k++)
+  {
+    if (fds[k] >= 0)
+    {
+      size_t i = first + k;
+
+      uring_queue_read(ring, fds[k], work->datas[i], work->data_lens[i], 0,
+                       fixed ? buf_indices[k] : -1, k);
+      to_submit++;
+      inflight++;
+    }
+  }
+
+  bool broken = false;
+
+  while (inflight > 0)
+  {
+    long ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, 1,
+                       IORING_ENTER_GETEVENTS, NULL, 0);
+
+    if (ret < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      broken = true;
+      break;
+    }
+    to_submit = 0;
+
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+      struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+      size_t k = (size_t) cqe->user_data;
+      size_t i = first + k;
+      int res = cqe->res;
+
+      head++;
+      inflight--;
+
+      if (res == -EINTR || res == -EAGAIN || res > 0)
+      {
+        done[k] += (res > 0) ? (size_t) res : 0;
+        if (done[k] < work->data_lens[i])
+        {
+          // a short (or interrupted) read - read the rest
+          uring_queue_read(ring, fds[k], work->datas[i] + done[k],
+                           work->data_lens[i] - done[k], done[k],
+                           fixed ? buf_indices[k] : -1, k);
+          to_submit++;
+          inflight++;
+        }
+        else
+        {
+          work->results[i] = 0;
+        }
+      }
+
+      // otherwise (an error, or a file that shrank) the read is left
+      // failed, and is retried by read_bytes_from_file()
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  if (fixed)
+  {
+    syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_BUFFERS,
+            NULL, 0);
+  }
+
+  for (size_t k = 0; k < count; k++)
+  {
+    size_t i = first + k;
+
+    if (fds[k] >= 0)
+    {
+      close(fds[k]);
+    }
+    if (work->results[i] != 0 && work->datas[i] != NULL)
+    {
+      // a buffer the kernel may still be reading into (if the ring itself
+      // failed) is given up rather than freed
+      if (!broken)
+      {
+        free(work->datas[i]);
+      }
+      work->datas[i] = NULL;
+      work->data_lens[i] = 0;
+    }
+  }
+
+  free(fds);
+  free(buf_indices);
+  free(done);
+  free(iovs);
+}
+
+#endif /* KMYTH_HAVE_IO_URING */
+
+//############################################################################
+// kmyth_load_files()
+//############################################################################
+int kmyth_load_files(char **paths, size_t count, size_t depth,
+                     uint8_t ** datas, size_t *data_lens, int *results)
+{
+  if (paths == NULL || count == 0 || datas == NULL || data_lens == NULL ||
+      results == NULL)
+  {
+    kmyth_log(LOG_ERR, "invalid file loader parameters ... exiting");
+    return 1;
+  }
+  if (depth == 0 || depth > KMYTH_LOADER_DEPTH)
+  {
+    depth = KMYTH_LOADER_DEPTH;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    datas[i] = NULL;
+    data_lens[i] = 0;
+    results[i] = 1;
+  }
+
+  kmyth_load_work work = {
+    .paths = paths,
+    .datas = datas,
+    .data_lens = data_lens,
+    .results = results
+  };
+
+#ifdef KMYTH_HAVE_IO_URING
+  kmyth_uring ring;
+
+  if (count > 1 && uring_setup(&ring, (unsigned) depth) == 0)
+  {
+    for (size_t first = 0; first < count; first += depth)
+    {
+      uring_load_group(&ring, &work, first,
+                       (count - first < depth) ? count - first : depth);
+    }
+    uring_teardown(&ring);
+  }
+#endif
+
+  // whatever was not read through io_uring (all of the files, without it)
+  // is read by the workers, which also report any errors
+  return kmyth_parallel_for(count, depth, load_file_item, &work);
+}
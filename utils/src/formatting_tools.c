@@ -10,13 +10,12 @@
 #include <string.h>
 #include <malloc.h>
 
-#include <openssl/bio.h>
-#include <openssl/buffer.h>
-#include <openssl/evp.h>
-
 #include "defines.h"
+#include "memory_util.h"
 #include <stdio.h>
 
+#include "alloc_stats.h"
+
 //############################################################################
 // get_block_bytes()
 //############################################################################
@@ -91,10 +90,79 @@ int get_block_bytes(char **contents,
 }
 
 //############################################################################
-// create_nkl_bytes()
+// get_block_view()
 //############################################################################
-int create_nkl_bytes(uint8_t * input, size_t input_length,
-                     uint8_t ** output, size_t * output_length)
+int get_block_view(uint8_t ** contents,
+                   size_t * remaining,
+                   uint8_t ** block, size_t * blocksize,
+                   char *delim, size_t delim_len,
+                   char *next_delim, size_t next_delim_len)
+{
+  // check that next (current) block begins with expected delimiter
+  if (delim_len > *remaining || memcmp(*contents, delim, delim_len))
+  {
+    kmyth_log(LOG_ERR, "unexpected delimiter ... exiting");
+    return 1;
+  }
+  *contents += delim_len;
+  (*remaining) -= delim_len;
+
+  // find the end of the block - all Kmyth delimiters start with a '-' and
+  // block contents (base64 data, cipher names) rarely contain one, so use
+  // memchr() to skip straight to candidate positions instead of comparing
+  // the full delimiter at every byte
+  uint8_t *start = *contents;
+  uint8_t *end = start + *remaining;
+  uint8_t *cur = start;
+
+  while (true)
+  {
+    if ((size_t) (end - cur) < next_delim_len)
+    {
+      kmyth_log(LOG_ERR, "unexpectedly reached end of file ... exiting");
+      return 1;
+    }
+    cur = memchr(cur, next_delim[0], (size_t) (end - cur));
+    if (cur == NULL || (size_t) (end - cur) < next_delim_len)
+    {
+      kmyth_log(LOG_ERR, "unexpectedly reached end of file ... exiting");
+      return 1;
+    }
+    if (!memcmp(cur, next_delim, next_delim_len))
+    {
+      break;
+    }
+    cur++;
+  }
+
+  size_t size = (size_t) (cur - start);
+
+  // check that the block is not empty
+  if (size == 0)
+  {
+    kmyth_log(LOG_ERR, "empty block ... exiting");
+    return 1;
+  }
+
+  // update output parameters before exiting
+  //   - *block      : start of block data (within the input buffer)
+  //   - *blocksize  : block data size (for block just parsed)
+  //   - *contents   : pointer to start of next block in .ski file buffer
+  //   - *remaining  : count of bytes yet to be parsed in .ski file buffer
+  *block = start;
+  *blocksize = size;
+  *contents += size;
+  *remaining -= size;
+
+  return 0;
+}
+
+//############################################################################
+// create_nkl_block()
+//############################################################################
+static int create_nkl_block(uint8_t * input, size_t input_length,
+                            const char *delim, uint8_t ** output,
+                            size_t * output_length)
 {
   // validate that all data to be written is non-NULL and non-empty
   if (input == NULL || input_length == 0)
@@ -119,8 +187,7 @@ int create_nkl_bytes(uint8_t * input, size_t input_length,
   uint8_t *out = NULL;
   size_t out_length = 0;
 
-  concat(&out, &out_length, (uint8_t *) KMYTH_DELIM_NKL_DATA,
-         strlen(KMYTH_DELIM_NKL_DATA));
+  concat(&out, &out_length, (uint8_t *) delim, strlen(delim));
   concat(&out, &out_length, nkl_data, nkl_data_size);
   free(nkl_data);
   nkl_data = NULL;
@@ -135,93 +202,500 @@ int create_nkl_bytes(uint8_t * input, size_t input_length,
 }
 
 //############################################################################
-// encodeBase64Data()
+// create_nkl_bytes()
 //############################################################################
-int encodeBase64Data(uint8_t * raw_data,
-                     size_t raw_data_size,
-                     uint8_t ** base64_data, size_t * base64_data_size)
+int create_nkl_bytes(uint8_t * input, size_t input_length,
+                     uint8_t ** output, size_t * output_length)
 {
-  // check that there is actually data to encode, return error if not
-  if (raw_data == NULL || raw_data_size == 0)
+  return create_nkl_block(input, input_length, KMYTH_DELIM_NKL_DATA, output,
+                          output_length);
+}
+
+//############################################################################
+// create_nkl_chunked_bytes()
+//############################################################################
+int create_nkl_chunked_bytes(uint8_t * input, size_t input_length,
+                             uint8_t ** output, size_t * output_length)
+{
+  return create_nkl_block(input, input_length, KMYTH_DELIM_NKL_CHUNKED_DATA,
+                          output, output_length);
+}
+
+//############################################################################
+// create_nkl_binary_header()
+//############################################################################
+void create_nkl_binary_header(size_t data_length, uint8_t flags,
+                              uint8_t * header)
+{
+  memcpy(header, KMYTH_NKL_BINARY_MAGIC, strlen(KMYTH_NKL_BINARY_MAGIC));
+  header[4] = KMYTH_NKL_BINARY_VERSION;
+  header[5] = flags;
+  header[6] = 0;
+  header[7] = 0;
+  for (int i = 0; i < 8; i++)
   {
-    kmyth_log(LOG_ERR, "no input data ... exiting");
+    header[8 + i] = (uint8_t) ((uint64_t) data_length >> (56 - 8 * i));
+  }
+}
+
+//############################################################################
+// is_nkl_binary()
+//############################################################################
+int is_nkl_binary(const uint8_t * input, size_t input_length)
+{
+  return (input != NULL && input_length >= strlen(KMYTH_NKL_BINARY_MAGIC)
+          && memcmp(input, KMYTH_NKL_BINARY_MAGIC,
+                    strlen(KMYTH_NKL_BINARY_MAGIC)) == 0);
+}
+
+//############################################################################
+// get_nkl_binary_view()
+//############################################################################
+int get_nkl_binary_view(uint8_t * input, size_t input_length,
+                        uint8_t ** data, size_t * data_length,
+                        uint8_t * flags)
+{
+  if (!is_nkl_binary(input, input_length)
+      || input_length < KMYTH_NKL_BINARY_HEADER_LEN)
+  {
+    kmyth_log(LOG_ERR, "not a binary .nkl ... exiting");
     return 1;
   }
-  if(raw_data_size > INT_MAX)
+  if (input[4] != KMYTH_NKL_BINARY_VERSION)
   {
-    kmyth_log(LOG_ERR, "raw data too large ... exiting");
+    kmyth_log(LOG_ERR, "unsupported binary .nkl version (%u) ... exiting",
+              input[4]);
     return 1;
   }
 
-  BIO *bio_mem = NULL;
-  BIO *bio64 = NULL;
-  BUF_MEM *bioptr = NULL;
+  uint64_t length = 0;
 
-  // create a base64 encoding filter BIO
-  if ((bio64 = BIO_new(BIO_f_base64())) == NULL)
+  for (int i = 0; i < 8; i++)
   {
-    kmyth_log(LOG_ERR, "create base64 filter BIO error ... exiting");
-    return 1;
+    length = (length << 8) | input[8 + i];
   }
 
-  // create a 'sink' BIO to write to memory
-  if ((bio_mem = BIO_new(BIO_s_mem())) == NULL)
+  // the data must fill the rest of the input exactly
+  if (length == 0 || length != input_length - KMYTH_NKL_BINARY_HEADER_LEN)
   {
-    kmyth_log(LOG_ERR, "create read/write memory sink BIO error" "... exiting");
-    BIO_free_all(bio64);
+    kmyth_log(LOG_ERR, "binary .nkl length mismatch ... exiting");
     return 1;
   }
 
-  // assemble the BIO chain in the order bio64 -> bio_mem
-  bio64 = BIO_push(bio64, bio_mem);
+  *data = input + KMYTH_NKL_BINARY_HEADER_LEN;
+  *data_length = (size_t) length;
+  *flags = input[5];
+
+  return 0;
+}
+
+// base-64 symbols, indexed by the 6-bit value they encode
+static const uint8_t base64_symbols[64] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// decoded (6-bit) value of each input byte, or one of the markers below
+#define BX 0x80                 // not a base-64 symbol
+#define BS 0x81                 // whitespace (skipped)
+#define BP 0x82                 // padding ('=')
+static const uint8_t base64_values[256] = {
+  BX, BX, BX, BX, BX, BX, BX, BX, BX, BS, BS, BS, BS, BS, BX, BX,
+  BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX,
+  BS, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, 62, BX, BX, BX, 63,
+  52, 53, 54, 55, 56, 57, 58, 59, 60, 61, BX, BX, BX, BP, BX, BX,
+  BX,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+  15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, BX, BX, BX, BX, BX,
+  BX, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+  41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, BX, BX, BX, BX, BX,
+  BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX,
+  BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX,
+  BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX,
+  BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX,
+  BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX,
+  BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX,
+  BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX,
+  BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX, BX
+};
+#undef BX
+#undef BS
+#undef BP
+
+#define BASE64_NOT_VALUE 0x80
+#define BASE64_SPACE 0x81
+#define BASE64_PAD 0x82
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KMYTH_BASE64_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#ifdef KMYTH_BASE64_SSSE3
+//############################################################################
+// have_ssse3()
+//############################################################################
+static int have_ssse3(void)
+{
+  static int supported = -1;
 
-  // write the input 'raw data' to the BIO chain
-  if (BIO_write(bio64, raw_data, (int)raw_data_size) != (int)raw_data_size)
+  if (supported < 0)
   {
-    kmyth_log(LOG_ERR, "BIO_write() error ... exiting");
-    BIO_free_all(bio64);
-    return 1;
+    __builtin_cpu_init();
+    supported = __builtin_cpu_supports("ssse3") ? 1 : 0;
+  }
+  return supported;
+}
+
+//############################################################################
+// base64_encode_ssse3()
+//############################################################################
+__attribute__ ((target("ssse3")))
+static size_t base64_encode_ssse3(const uint8_t * in, size_t in_len,
+                                  size_t readable, uint8_t * out)
+{
+  // Encodes 12 bytes into 16 symbols per step, returning the number of
+  // input bytes consumed (the rest are left for the scalar encoder). Each
+  // step loads 16 bytes, so readable (>= in_len) bounds the loads.
+  const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                        7, 6, 8, 7, 10, 9, 11, 10);
+  const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '+' - 62,
+                                        '/' - 63, 'A', 0, 0);
+  size_t i = 0;
+
+  for (; i + 12 <= in_len && i + 16 <= readable; i += 12)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+
+    // split each 3 byte group into four 6-bit values, one per byte
+    v = _mm_shuffle_epi8(v, shuffle);
+    __m128i hi = _mm_mulhi_epu16(_mm_and_si128(v,
+                                               _mm_set1_epi32(0x0FC0FC00)),
+                                 _mm_set1_epi32(0x04000040));
+    __m128i lo = _mm_mullo_epi16(_mm_and_si128(v,
+                                               _mm_set1_epi32(0x003F03F0)),
+                                 _mm_set1_epi32(0x01000010));
+    __m128i values = _mm_or_si128(hi, lo);
+
+    // map each value range (A-Z, a-z, 0-9, +, /) to its ASCII offset
+    __m128i range = _mm_subs_epu8(values, _mm_set1_epi8(51));
+    __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), values);
+
+    range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    _mm_storeu_si128((__m128i *) out,
+                     _mm_add_epi8(values, _mm_shuffle_epi8(offsets, range)));
+    out += 16;
+  }
+
+  return i;
+}
+
+//############################################################################
+// base64_decode_ssse3()
+//############################################################################
+__attribute__ ((target("ssse3")))
+static size_t base64_decode_ssse3(const uint8_t * in, size_t in_len,
+                                  uint8_t * out)
+{
+  // Decodes 16 symbols into 12 bytes per step, stopping at the first step
+  // that includes anything other than base-64 symbols (whitespace,
+  // padding, or invalid input) and returning the number of symbols
+  // consumed - the rest are left for the scalar decoder.
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+                                       0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                       0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                       0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                         0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                     14, 13, 12, -1, -1, -1, -1);
+  const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+  size_t i = 0;
+
+  for (; i + 16 <= in_len; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(v, 4), nibble_mask);
+    __m128i lo_nibbles = _mm_and_si128(v, nibble_mask);
+
+    // a symbol is valid if its nibbles' class bits don't overlap
+    __m128i invalid = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo_nibbles),
+                                    _mm_shuffle_epi8(lut_hi, hi_nibbles));
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(invalid, _mm_setzero_si128()))
+        != 0xFFFF)
+    {
+      break;
+    }
+
+    // map each symbol to its 6-bit value, then pack four values into
+    // three bytes
+    __m128i roll = _mm_shuffle_epi8(lut_roll,
+                                    _mm_add_epi8(_mm_cmpeq_epi8(v,
+                                                                _mm_set1_epi8
+                                                                ('/')),
+                                                 hi_nibbles));
+    __m128i values = _mm_add_epi8(v, roll);
+
+    values = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    values = _mm_madd_epi16(values, _mm_set1_epi32(0x00011000));
+    values = _mm_shuffle_epi8(values, pack);
+
+    uint32_t tail = (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(values, 8));
+
+    _mm_storel_epi64((__m128i *) out, values);
+    memcpy(out + 8, &tail, sizeof(tail));
+    out += 12;
   }
 
-  // ensure all written data is flushed all the way through chain
-  if (BIO_flush(bio64) != 1)
+  return i;
+}
+#endif
+
+//############################################################################
+// base64_encode()
+//############################################################################
+static size_t base64_encode(const uint8_t * in, size_t in_len, uint8_t * out)
+{
+  // Encodes in_len bytes in lines of (at most) KMYTH_BASE64_LINE_RAW_SIZE,
+  // each followed by a newline, returning the size of the encoded output
+  // (exactly KMYTH_BASE64_ENCODED_SIZE(in_len))
+  size_t out_len = 0;
+
+  for (size_t line = 0; line < in_len; line += KMYTH_BASE64_LINE_RAW_SIZE)
+  {
+    size_t line_len = in_len - line;
+
+    if (line_len > KMYTH_BASE64_LINE_RAW_SIZE)
+    {
+      line_len = KMYTH_BASE64_LINE_RAW_SIZE;
+    }
+
+    const uint8_t *src = in + line;
+    size_t i = 0;
+
+#ifdef KMYTH_BASE64_SSSE3
+    if (have_ssse3())
+    {
+      i = base64_encode_ssse3(src, line_len, in_len - line, out + out_len);
+      out_len += (i / 3) * 4;
+    }
+#endif
+
+    for (; i + 3 <= line_len; i += 3)
+    {
+      uint32_t v = (uint32_t) src[i] << 16 | (uint32_t) src[i + 1] << 8 |
+        src[i + 2];
+
+      out[out_len++] = base64_symbols[v >> 18];
+      out[out_len++] = base64_symbols[(v >> 12) & 0x3F];
+      out[out_len++] = base64_symbols[(v >> 6) & 0x3F];
+      out[out_len++] = base64_symbols[v & 0x3F];
+    }
+
+    // only the last line can end with a partial (padded) group
+    if (i < line_len)
+    {
+      uint32_t v = (uint32_t) src[i] << 16;
+
+      if (i + 1 < line_len)
+      {
+        v |= (uint32_t) src[i + 1] << 8;
+      }
+      out[out_len++] = base64_symbols[v >> 18];
+      out[out_len++] = base64_symbols[(v >> 12) & 0x3F];
+      out[out_len++] = (i + 1 < line_len) ?
+        base64_symbols[(v >> 6) & 0x3F] : '=';
+      out[out_len++] = '=';
+    }
+
+    out[out_len++] = '\n';
+  }
+
+  return out_len;
+}
+
+//############################################################################
+// base64_decode()
+//############################################################################
+static int base64_decode(const uint8_t * in, size_t in_len, uint8_t * out,
+                         size_t *out_len)
+{
+  // Decodes (at most KMYTH_BASE64_DECODED_MAX(in_len) bytes), skipping
+  // whitespace anywhere in the input. Padding may only complete the last
+  // symbol group, and only whitespace may follow it.
+  size_t i = 0;
+  size_t n = 0;
+  uint32_t group = 0;
+  size_t count = 0;
+  size_t padding = 0;
+
+  while (i < in_len)
+  {
+    // between groups, decode runs of symbols a whole group (or, with
+    // SSSE3, four groups) at a time
+    if (count == 0 && padding == 0)
+    {
+#ifdef KMYTH_BASE64_SSSE3
+      if (have_ssse3())
+      {
+        size_t used = base64_decode_ssse3(in + i, in_len - i, out + n);
+
+        i += used;
+        n += (used / 4) * 3;
+      }
+#endif
+      while (i + 4 <= in_len)
+      {
+        uint8_t a = base64_values[in[i]];
+        uint8_t b = base64_values[in[i + 1]];
+        uint8_t c = base64_values[in[i + 2]];
+        uint8_t d = base64_values[in[i + 3]];
+
+        if ((a | b | c | d) & BASE64_NOT_VALUE)
+        {
+          break;
+        }
+
+        uint32_t v = (uint32_t) a << 18 | (uint32_t) b << 12 |
+          (uint32_t) c << 6 | d;
+
+        out[n++] = (uint8_t) (v >> 16);
+        out[n++] = (uint8_t) (v >> 8);
+        out[n++] = (uint8_t) v;
+        i += 4;
+      }
+      if (i == in_len)
+      {
+        break;
+      }
+    }
+
+    uint8_t value = base64_values[in[i++]];
+
+    if (value == BASE64_SPACE)
+    {
+      continue;
+    }
+    if (value == BASE64_NOT_VALUE || (padding > 0 && value != BASE64_PAD))
+    {
+      return 1;
+    }
+    if (value == BASE64_PAD)
+    {
+      // a group holds at least two symbols ahead of any padding
+      if (count < 2)
+      {
+        return 1;
+      }
+      padding++;
+      value = 0;
+    }
+
+    group = (group << 6) | value;
+    if (++count < 4)
+    {
+      continue;
+    }
+
+    out[n++] = (uint8_t) (group >> 16);
+    if (padding < 2)
+    {
+      out[n++] = (uint8_t) (group >> 8);
+    }
+    if (padding < 1)
+    {
+      out[n++] = (uint8_t) group;
+    }
+    group = 0;
+    count = 0;
+
+    // nothing but whitespace may follow the padded (final) group
+    if (padding > 0)
+    {
+      for (; i < in_len; i++)
+      {
+        if (base64_values[in[i]] != BASE64_SPACE)
+        {
+          return 1;
+        }
+      }
+    }
+  }
+
+  // the input must end with a complete group
+  if (count != 0)
   {
-    kmyth_log(LOG_ERR, "BIO_flush() error ... exiting");
-    BIO_free_all(bio64);
     return 1;
   }
 
-  // compute memory size of encoded data
-  BIO_get_mem_ptr(bio64, &bioptr);
-  if (bioptr == NULL)
+  *out_len = n;
+  return 0;
+}
+
+//############################################################################
+// encodeBase64Data()
+//############################################################################
+int encodeBase64Data(uint8_t * raw_data,
+                     size_t raw_data_size,
+                     uint8_t ** base64_data, size_t * base64_data_size)
+{
+  // check that there is actually data to encode, return error if not
+  if (raw_data == NULL || raw_data_size == 0)
+  {
+    kmyth_log(LOG_ERR, "no input data ... exiting");
+    return 1;
+  }
+  if(raw_data_size > INT_MAX)
   {
-    kmyth_log(LOG_ERR, "no underlying BIO_MEM structure ... exiting");
-    BIO_free_all(bio64);
+    kmyth_log(LOG_ERR, "raw data too large ... exiting");
     return 1;
   }
-  *base64_data_size = bioptr->length;
 
   // allocate memory for 'base64_data' output parameter
   //   - memory allocated here because the encoded data size is known here
   //   - memory must be freed by the caller because the data passed back
-  *base64_data = (uint8_t *) malloc(*base64_data_size + 1);
+  size_t encoded_size = KMYTH_BASE64_ENCODED_SIZE(raw_data_size);
+
+  *base64_data = (uint8_t *) malloc(encoded_size + 1);
   if (*base64_data == NULL)
   {
     kmyth_log(LOG_ERR, "malloc error (%lu bytes) ... exiting",
-              base64_data_size);
-    BIO_free_all(bio64);
+              encoded_size + 1);
     return 1;
   }
 
-  // copy encoded data to output parameter and terminate with newline and
-  // null terminator
-  memcpy(*base64_data, bioptr->data, (*base64_data_size) - 1);
-  (*base64_data)[(*base64_data_size) - 1] = '\n';
+  // encoded data is newline terminated, followed by a null terminator
+  *base64_data_size = base64_encode(raw_data, raw_data_size, *base64_data);
   (*base64_data)[(*base64_data_size)] = '\0';
   kmyth_log(LOG_DEBUG, "encoded %lu bytes into %lu base-64 symbols",
             raw_data_size, *base64_data_size - 1);
-  // clean-up
-  BIO_free_all(bio64);
+  return 0;
+}
+
+//############################################################################
+// encodeBase64DataInto()
+//############################################################################
+int encodeBase64DataInto(uint8_t * raw_data,
+                         size_t raw_data_size,
+                         uint8_t * base64_data,
+                         size_t base64_data_max, size_t * base64_data_size)
+{
+  if (raw_data == NULL || raw_data_size == 0)
+  {
+    kmyth_log(LOG_ERR, "no input data ... exiting");
+    return 1;
+  }
+  if (base64_data == NULL ||
+      base64_data_max < KMYTH_BASE64_ENCODED_SIZE(raw_data_size))
+  {
+    kmyth_log(LOG_ERR, "base-64 output buffer too small ... exiting");
+    return 1;
+  }
+
+  *base64_data_size = base64_encode(raw_data, raw_data_size, base64_data);
   return 0;
 }
 
@@ -257,42 +731,144 @@ int decodeBase64Data(uint8_t * base64_data,
     return 1;
   }
 
-  // create a base64 decoding filter BIO
-  BIO *bio64 = NULL;
+  // decode into 'raw_data' output parameter and terminate with null
+  size_t decoded_size = 0;
+
+  if (base64_decode(base64_data, base64_data_size, *raw_data, &decoded_size))
+  {
+    kmyth_log(LOG_ERR, "error decoding base64 data ... exiting");
+    free(*raw_data);
+    *raw_data = NULL;
+    return 1;
+  }
+
+  (*raw_data)[decoded_size] = '\0';
+  *raw_data_size = decoded_size;
+  return 0;
+}
+
+//############################################################################
+// decodeBase64DataInto()
+//############################################################################
+int decodeBase64DataInto(uint8_t * base64_data,
+                         size_t base64_data_size,
+                         uint8_t * raw_data,
+                         size_t raw_data_max, size_t * raw_data_size)
+{
+  // check that there is actually data to decode, return error if not
+  if (base64_data == NULL || base64_data_size == 0 || raw_data == NULL)
+  {
+    kmyth_log(LOG_ERR, "no input data ... exiting");
+    return 1;
+  }
+
+  // check that size of input doesn't exceed limits, return error if it does
+  if (base64_data_size > INT_MAX)
+  {
+    kmyth_log(LOG_ERR,
+              "encoded data length (%lu bytes) > max (%d bytes) ... exiting",
+              base64_data_size, INT_MAX);
+    return 1;
+  }
+
+  // the decoder may write up to three bytes for every four input symbols
+  if (raw_data_max < KMYTH_BASE64_DECODED_MAX(base64_data_size))
+  {
+    kmyth_log(LOG_ERR, "output buffer (%lu bytes) too small ... exiting",
+              raw_data_max);
+    return 1;
+  }
 
-  if ((bio64 = BIO_new(BIO_f_base64())) == NULL)
+  if (base64_decode(base64_data, base64_data_size, raw_data, raw_data_size))
   {
-    kmyth_log(LOG_ERR, "create base64 filter BIO error ... exiting");
+    kmyth_log(LOG_ERR, "error decoding base64 data ... exiting");
     return 1;
   }
 
-  // create a 'source' BIO to read from memory
-  BIO *bio_mem = NULL;
+  return 0;
+}
+
+//############################################################################
+// decodeBase64Range()
+//############################################################################
+int decodeBase64Range(uint8_t * base64_data, size_t base64_data_size,
+                      size_t raw_data_size, size_t offset, size_t length,
+                      uint8_t * raw_data)
+{
+  if (base64_data == NULL || raw_data == NULL || length == 0)
+  {
+    kmyth_log(LOG_ERR, "no input data ... exiting");
+    return 1;
+  }
 
-  if ((bio_mem = BIO_new_mem_buf(base64_data, (int)base64_data_size)) == NULL)
+  if (offset > raw_data_size || length > raw_data_size - offset)
   {
-    kmyth_log(LOG_ERR, "create source BIO error ... exiting");
-    BIO_free_all(bio64);
+    kmyth_log(LOG_ERR, "range exceeds the encoded data size ... exiting");
     return 1;
   }
 
-  // assemble the BIO chain to base64 decode data read from memory
-  bio64 = BIO_push(bio64, bio_mem);
-  // read encoded data through chain, into 'raw_data' decoded output parameter
-  // and terminate with newline
-  int bytes_read = BIO_read(bio64, *raw_data, (int)base64_data_size);
+  // the encoded size, and the padding at the end of the last line, must
+  // both match the decoded data size exactly
+  size_t padding = (3 - raw_data_size % 3) % 3;
 
-  if (bytes_read < 0)
+  if (base64_data_size != KMYTH_BASE64_ENCODED_SIZE(raw_data_size) ||
+      base64_data_size < 5 || base64_data[base64_data_size - 1] != '\n' ||
+      (padding > 0) != (base64_data[base64_data_size - 2] == '=') ||
+      (padding > 1) != (base64_data[base64_data_size - 3] == '='))
   {
-    kmyth_log(LOG_ERR, "error reading bytes from BIO chain ... exiting");
-    BIO_free_all(bio64);
+    kmyth_log(LOG_ERR, "unexpected base64 data layout ... exiting");
     return 1;
   }
 
-  (*raw_data)[bytes_read] = '\0';
-  *raw_data_size = (size_t)bytes_read;
-  // clean-up
-  BIO_free_all(bio64);
+  // each line (except, possibly, the last) encodes a fixed number of bytes,
+  // so the lines holding the requested range can be decoded in isolation
+  uint8_t line_data[KMYTH_BASE64_LINE_RAW_SIZE + 3];
+  size_t line = offset / KMYTH_BASE64_LINE_RAW_SIZE;
+  size_t last_line = (offset + length - 1) / KMYTH_BASE64_LINE_RAW_SIZE;
+  size_t copied = 0;
+
+  for (; line <= last_line; line++)
+  {
+    size_t line_start = line * KMYTH_BASE64_LINE_RAW_SIZE;
+    size_t line_raw_size = raw_data_size - line_start;
+
+    if (line_raw_size > KMYTH_BASE64_LINE_RAW_SIZE)
+    {
+      line_raw_size = KMYTH_BASE64_LINE_RAW_SIZE;
+    }
+
+    uint8_t *symbols = base64_data + line * 65;
+    size_t symbols_len = ((line_raw_size + 2) / 3) * 4;
+    size_t line_len = 0;
+
+    if (symbols[symbols_len] != '\n')
+    {
+      kmyth_log(LOG_ERR, "unexpected base64 data layout ... exiting");
+      return 1;
+    }
+
+    if (base64_decode(symbols, symbols_len, line_data, &line_len) ||
+        line_len != line_raw_size)
+    {
+      kmyth_log(LOG_ERR, "error decoding base64 data ... exiting");
+      kmyth_clear(line_data, sizeof(line_data));
+      return 1;
+    }
+
+    // copy out the part of this line that falls within the requested range
+    size_t skip = (line_start < offset) ? offset - line_start : 0;
+    size_t count = line_raw_size - skip;
+
+    if (count > length - copied)
+    {
+      count = length - copied;
+    }
+    memcpy(raw_data + copied, line_data + skip, count);
+    copied += count;
+  }
+
+  kmyth_clear(line_data, sizeof(line_data));
+
   return 0;
 }
 
@@ -9,6 +9,28 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+#ifndef KMYTH_SGX
+#include "allocator.h"
+#include "kmyth_log.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// alignment of kmyth_arena_alloc() buffers
+#define KMYTH_ARENA_ALIGN 16
+
+// size classes of the secure heap: KMYTH_SECURE_HEAP_MIN_CLASS bytes,
+// doubling up to KMYTH_SECURE_HEAP_MIN_CLASS << (KMYTH_SECURE_HEAP_CLASSES-1)
+#define KMYTH_SECURE_HEAP_MIN_CLASS 16
+#define KMYTH_SECURE_HEAP_CLASSES 9
+
+// size of the header (holding the mapping's length) ahead of a buffer
+// that kmyth_secure_alloc() gave a mapping of its own
+#define KMYTH_SECURE_MAP_HEADER 16
 
 //############################################################################
 // kmyth_clear()
@@ -20,6 +42,22 @@ void kmyth_clear(void *v, size_t size)
 
   volatile unsigned char *p = v;
 
+  // bytes up to a word boundary, then whole words, then the rest
+  while (size > 0 && ((uintptr_t) p % sizeof(uint64_t)) != 0)
+  {
+    *p++ = '\0';
+    size--;
+  }
+
+  volatile uint64_t *w = (volatile uint64_t *) p;
+
+  while (size >= sizeof(uint64_t))
+  {
+    *w++ = 0;
+    size -= sizeof(uint64_t);
+  }
+
+  p = (volatile unsigned char *) w;
   while (size--)
     *p++ = '\0';
 }
@@ -32,7 +70,11 @@ void kmyth_clear_and_free(void *v, size_t size)
   if (v == NULL)
     return;
   kmyth_clear(v, size);
+#ifdef KMYTH_SGX
   free(v);
+#else
+  kmyth_free(v);
+#endif
 }
 
 //############################################################################
@@ -48,3 +90,387 @@ void *secure_memset(void *v, int c, size_t n)
 
   return v;
 }
+
+// The arena and the secure heap map (and lock) memory, which an enclave
+// can not do, so they are left out of enclave builds.
+#ifndef KMYTH_SGX
+
+// A slab of the secure heap, holding the slots of one size class. The
+// free slots' indices are kept on a stack, and which slots are allocated
+// in a bitmap, so the allocator does not keep anything in the (secret)
+// slots themselves.
+typedef struct
+{
+  uint8_t *base;
+  size_t slot_size;
+  uint32_t *free_slots;
+  size_t free_count;
+  uint64_t *allocated;
+} kmyth_secure_slab;
+
+// The secure heap: a guard page, then each class's slab followed by a
+// guard page. It is set up once, and never released.
+static struct
+{
+  uint8_t *map;
+  size_t map_len;
+  size_t slab_len;
+  kmyth_secure_slab slabs[KMYTH_SECURE_HEAP_CLASSES];
+} kmyth_secure_heap;
+static pthread_mutex_t kmyth_secure_heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//############################################################################
+// memory_page_size()
+//############################################################################
+static size_t memory_page_size(void)
+{
+  long page_size = sysconf(_SC_PAGESIZE);
+
+  return (page_size <= 0) ? 4096 : (size_t) page_size;
+}
+
+//############################################################################
+// kmyth_arena_init()
+//############################################################################
+int kmyth_arena_init(kmyth_arena * arena, size_t size)
+{
+  if (arena == NULL || size == 0)
+  {
+    return 1;
+  }
+
+  size_t page_size = memory_page_size();
+
+  if (size > SIZE_MAX - page_size)
+  {
+    return 1;
+  }
+  size = (size + page_size - 1) & ~(page_size - 1);
+
+  // the region is mapped (rather than allocated) so that locking it does
+  // not share pages with any other allocation
+  void *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (base == MAP_FAILED)
+  {
+    return 1;
+  }
+
+  arena->base = (uint8_t *) base;
+  arena->size = size;
+  arena->used = 0;
+
+  // locking may be refused (e.g., RLIMIT_MEMLOCK), which is not an error
+  arena->locked = (mlock(base, size) == 0);
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_arena_alloc()
+//############################################################################
+void *kmyth_arena_alloc(kmyth_arena * arena, size_t size)
+{
+  if (arena == NULL || arena->base == NULL || size == 0)
+  {
+    return NULL;
+  }
+
+  size_t start = (arena->used + KMYTH_ARENA_ALIGN - 1) &
+    ~((size_t) KMYTH_ARENA_ALIGN - 1);
+
+  if (start > arena->size || size > arena->size - start)
+  {
+    return NULL;
+  }
+  arena->used = start + size;
+
+  // the mapping starts zeroed, and every reset zeroes the used part again
+  return arena->base + start;
+}
+
+//############################################################################
+// kmyth_arena_reset()
+//############################################################################
+void kmyth_arena_reset(kmyth_arena * arena)
+{
+  if (arena == NULL || arena->base == NULL)
+  {
+    return;
+  }
+  secure_memset(arena->base, 0, arena->used);
+  arena->used = 0;
+}
+
+//############################################################################
+// kmyth_arena_free()
+//############################################################################
+void kmyth_arena_free(kmyth_arena * arena)
+{
+  if (arena == NULL || arena->base == NULL)
+  {
+    return;
+  }
+
+  kmyth_arena_reset(arena);
+  if (arena->locked)
+  {
+    munlock(arena->base, arena->size);
+  }
+  munmap(arena->base, arena->size);
+
+  arena->base = NULL;
+  arena->size = 0;
+  arena->locked = false;
+}
+
+//############################################################################
+// secure_heap_setup()
+//############################################################################
+static int secure_heap_setup(size_t size)
+{
+  if (kmyth_secure_heap.map != NULL)
+  {
+    return 0;
+  }
+
+  size_t page_size = memory_page_size();
+  size_t slab_len = size / KMYTH_SECURE_HEAP_CLASSES;
+
+  if (size == 0 || slab_len > (SIZE_MAX / 2) / KMYTH_SECURE_HEAP_CLASSES)
+  {
+    return 1;
+  }
+  slab_len = (slab_len + page_size - 1) & ~(page_size - 1);
+  if (slab_len == 0)
+  {
+    slab_len = page_size;
+  }
+
+  size_t map_len = page_size + KMYTH_SECURE_HEAP_CLASSES *
+    (slab_len + page_size);
+
+  // everything starts out inaccessible, and only the slabs are opened up,
+  // leaving the guard pages around them
+  uint8_t *map = mmap(NULL, map_len, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (map == MAP_FAILED)
+  {
+    return 1;
+  }
+  madvise(map, map_len, MADV_DONTDUMP);
+
+  for (size_t i = 0; i < KMYTH_SECURE_HEAP_CLASSES; i++)
+  {
+    kmyth_secure_slab *slab = &kmyth_secure_heap.slabs[i];
+
+    slab->base = map + page_size + i * (slab_len + page_size);
+    slab->slot_size = (size_t) KMYTH_SECURE_HEAP_MIN_CLASS << i;
+
+    size_t slots = slab_len / slab->slot_size;
+
+    slab->free_slots = malloc(slots * sizeof(uint32_t));
+    slab->allocated = calloc((slots + 63) / 64, sizeof(uint64_t));
+    if (slab->free_slots == NULL || slab->allocated == NULL ||
+        mprotect(slab->base, slab_len, PROT_READ | PROT_WRITE))
+    {
+      for (size_t j = 0; j <= i; j++)
+      {
+        free(kmyth_secure_heap.slabs[j].free_slots);
+        free(kmyth_secure_heap.slabs[j].allocated);
+      }
+      munmap(map, map_len);
+      memset(&kmyth_secure_heap, 0, sizeof(kmyth_secure_heap));
+      return 1;
+    }
+
+    // locking may be refused (e.g., RLIMIT_MEMLOCK), which is not an error
+    mlock(slab->base, slab_len);
+
+    // lower slots are handed out first
+    for (size_t j = 0; j < slots; j++)
+    {
+      slab->free_slots[j] = (uint32_t) (slots - 1 - j);
+    }
+    slab->free_count = slots;
+  }
+
+  kmyth_secure_heap.map = map;
+  kmyth_secure_heap.map_len = map_len;
+  kmyth_secure_heap.slab_len = slab_len;
+
+  return 0;
+}
+
+//############################################################################
+// secure_map_alloc()
+//############################################################################
+static void *secure_map_alloc(size_t size)
+{
+  size_t page_size = memory_page_size();
+
+  if (size > SIZE_MAX - KMYTH_SECURE_MAP_HEADER - 3 * page_size)
+  {
+    return NULL;
+  }
+
+  size_t data_len = (KMYTH_SECURE_MAP_HEADER + size + page_size - 1) &
+    ~(page_size - 1);
+  size_t map_len = data_len + 2 * page_size;
+  uint8_t *map = mmap(NULL, map_len, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (map == MAP_FAILED)
+  {
+    return NULL;
+  }
+
+  uint8_t *data = map + page_size;
+
+  if (mprotect(data, data_len, PROT_READ | PROT_WRITE))
+  {
+    munmap(map, map_len);
+    return NULL;
+  }
+  madvise(map, map_len, MADV_DONTDUMP);
+  mlock(data, data_len);
+
+  *(size_t *) data = map_len;
+
+  return data + KMYTH_SECURE_MAP_HEADER;
+}
+
+//############################################################################
+// kmyth_secure_heap_init()
+//############################################################################
+int kmyth_secure_heap_init(size_t size)
+{
+  pthread_mutex_lock(&kmyth_secure_heap_lock);
+  int retval = secure_heap_setup(size);
+
+  pthread_mutex_unlock(&kmyth_secure_heap_lock);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_secure_alloc()
+//############################################################################
+void *kmyth_secure_alloc(size_t size)
+{
+  if (size == 0)
+  {
+    return NULL;
+  }
+
+  const kmyth_allocator *allocator = kmyth_get_allocator();
+
+  if (allocator != NULL && allocator->secure_alloc != NULL)
+  {
+    return allocator->secure_alloc(size, allocator->arg);
+  }
+
+  pthread_mutex_lock(&kmyth_secure_heap_lock);
+  if (secure_heap_setup(KMYTH_SECURE_HEAP_DEFAULT_SIZE) == 0)
+  {
+    for (size_t i = 0; i < KMYTH_SECURE_HEAP_CLASSES; i++)
+    {
+      kmyth_secure_slab *slab = &kmyth_secure_heap.slabs[i];
+
+      if (size > slab->slot_size)
+      {
+        continue;
+      }
+      if (slab->free_count > 0)
+      {
+        uint32_t slot = slab->free_slots[--slab->free_count];
+
+        slab->allocated[slot / 64] |= (uint64_t) 1 << (slot % 64);
+        pthread_mutex_unlock(&kmyth_secure_heap_lock);
+
+        // (freed slots are wiped, so every slot is zero filled here)
+        return slab->base + (size_t) slot * slab->slot_size;
+      }
+      break;
+    }
+  }
+  pthread_mutex_unlock(&kmyth_secure_heap_lock);
+
+  return secure_map_alloc(size);
+}
+
+//############################################################################
+// kmyth_secure_free()
+//############################################################################
+void kmyth_secure_free(void *ptr)
+{
+  if (ptr == NULL)
+  {
+    return;
+  }
+
+  const kmyth_allocator *allocator = kmyth_get_allocator();
+
+  if (allocator != NULL && allocator->secure_free != NULL)
+  {
+    allocator->secure_free(ptr, allocator->arg);
+    return;
+  }
+
+  uint8_t *p = (uint8_t *) ptr;
+  size_t page_size = memory_page_size();
+
+  pthread_mutex_lock(&kmyth_secure_heap_lock);
+  if (kmyth_secure_heap.map != NULL && p >= kmyth_secure_heap.map &&
+      p < kmyth_secure_heap.map + kmyth_secure_heap.map_len)
+  {
+    // Only the start of an allocated slot may be freed: a pointer into a
+    // guard page, or part way into a slot, is not one kmyth_secure_alloc()
+    // returned, and a slot that is not allocated is being freed again.
+    size_t stride = kmyth_secure_heap.slab_len + page_size;
+    kmyth_secure_slab *slab = NULL;
+    size_t slot = 0;
+
+    if (p >= kmyth_secure_heap.map + page_size)
+    {
+      size_t off = (size_t) (p - kmyth_secure_heap.map) - page_size;
+      size_t slab_off = off % stride;
+
+      slab = &kmyth_secure_heap.slabs[off / stride];
+      slot = slab_off / slab->slot_size;
+      if (slab_off >= kmyth_secure_heap.slab_len ||
+          slab_off % slab->slot_size != 0 ||
+          !(slab->allocated[slot / 64] & ((uint64_t) 1 << (slot % 64))))
+      {
+        slab = NULL;
+      }
+    }
+    if (slab == NULL)
+    {
+      pthread_mutex_unlock(&kmyth_secure_heap_lock);
+      kmyth_log(LOG_ERR, "invalid secure heap pointer freed (%p) ... ignored",
+                ptr);
+      return;
+    }
+
+    kmyth_clear(slab->base + slot * slab->slot_size, slab->slot_size);
+    slab->allocated[slot / 64] &= ~((uint64_t) 1 << (slot % 64));
+    slab->free_slots[slab->free_count++] = (uint32_t) slot;
+    pthread_mutex_unlock(&kmyth_secure_heap_lock);
+    return;
+  }
+  pthread_mutex_unlock(&kmyth_secure_heap_lock);
+
+  // a buffer with a mapping of its own
+  uint8_t *data = p - KMYTH_SECURE_MAP_HEADER;
+  size_t map_len = *(size_t *) data;
+  size_t data_len = map_len - 2 * page_size;
+
+  kmyth_clear(data, data_len);
+  munlock(data, data_len);
+  munmap(data - page_size, map_len);
+}
+
+#endif /* KMYTH_SGX */
@@ -0,0 +1,215 @@
+/**
+ * parallel_util.c:
+ *
+ * C library containing a minimal worker pool supporting Kmyth batch
+ * operations, and a pool of pre-forked worker processes
+ */
+
+#include "parallel_util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  size_t next;
+  size_t count;
+  kmyth_parallel_fn fn;
+  void *arg;
+  bool failed;
+} parallel_work;
+
+//############################################################################
+// parallel_worker()
+//############################################################################
+static void *parallel_worker(void *work_arg)
+{
+  parallel_work *work = (parallel_work *) work_arg;
+
+  while (true)
+  {
+    pthread_mutex_lock(&work->lock);
+    size_t index = work->next;
+
+    if (index < work->count)
+    {
+      work->next++;
+    }
+    pthread_mutex_unlock(&work->lock);
+
+    if (index >= work->count)
+    {
+      break;
+    }
+
+    if (work->fn(index, work->arg) != 0)
+    {
+      pthread_mutex_lock(&work->lock);
+      work->failed = true;
+      pthread_mutex_unlock(&work->lock);
+    }
+  }
+
+  return NULL;
+}
+
+//############################################################################
+// kmyth_parallel_for()
+//############################################################################
+int kmyth_parallel_for(size_t count, size_t jobs, kmyth_parallel_fn fn,
+                       void *arg)
+{
+  if (fn == NULL)
+  {
+    return 1;
+  }
+
+  if (jobs > KMYTH_MAX_JOBS)
+  {
+    jobs = KMYTH_MAX_JOBS;
+  }
+  if (jobs > count)
+  {
+    jobs = count;
+  }
+
+  // nothing to gain from threads - just run everything here
+  if (jobs <= 1)
+  {
+    int retval = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+      if (fn(i, arg) != 0)
+      {
+        retval = 1;
+      }
+    }
+    return retval;
+  }
+
+  parallel_work work = {
+    .next = 0,
+    .count = count,
+    .fn = fn,
+    .arg = arg,
+    .failed = false
+  };
+
+  if (pthread_mutex_init(&work.lock, NULL) != 0)
+  {
+    return 1;
+  }
+
+  // the calling thread is one of the workers
+  pthread_t threads[KMYTH_MAX_JOBS];
+  size_t started = 0;
+
+  while (started < jobs - 1)
+  {
+    if (pthread_create(&threads[started], NULL, parallel_worker, &work) != 0)
+    {
+      break;
+    }
+    started++;
+  }
+
+  parallel_worker(&work);
+
+  for (size_t i = 0; i < started; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_mutex_destroy(&work.lock);
+
+  return work.failed ? 1 : 0;
+}
+
+//############################################################################
+// prefork_wait()
+//############################################################################
+static bool prefork_wait(pid_t pid)
+{
+  int status = 0;
+
+  while (waitpid(pid, &status, 0) == -1)
+  {
+    if (errno != EINTR)
+    {
+      return false;
+    }
+  }
+
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+//############################################################################
+// kmyth_prefork()
+//############################################################################
+int kmyth_prefork(size_t count, kmyth_parallel_fn fn, void *arg)
+{
+  if (fn == NULL || count == 0 || count > KMYTH_MAX_JOBS)
+  {
+    return 1;
+  }
+
+  pid_t workers[KMYTH_MAX_JOBS];
+  pid_t parent = getpid();
+  size_t started = 0;
+  bool failed = false;
+
+  // (anything buffered would otherwise be written by every worker too)
+  fflush(NULL);
+
+  while (started < count)
+  {
+    pid_t pid = fork();
+
+    if (pid == -1)
+    {
+      failed = true;
+      break;
+    }
+    if (pid == 0)
+    {
+      // the parent may have died before the signal was asked for
+      if (prctl(PR_SET_PDEATHSIG, SIGTERM) || getppid() != parent)
+      {
+        _exit(1);
+      }
+
+      int retval = fn(started, arg);
+
+      fflush(NULL);
+      _exit((retval == 0) ? 0 : 1);
+    }
+    workers[started++] = pid;
+  }
+
+  if (failed)
+  {
+    for (size_t i = 0; i < started; i++)
+    {
+      kill(workers[i], SIGTERM);
+    }
+  }
+
+  for (size_t i = 0; i < started; i++)
+  {
+    if (!prefork_wait(workers[i]))
+    {
+      failed = true;
+    }
+  }
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,350 @@
+/**
+ * trace.c:
+ *
+ * C library writing the optional trace spans of kmyth as OTLP/JSON (see
+ * trace.h)
+ */
+
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/rand.h>
+
+static FILE *trace_file = NULL;
+static char trace_service[KMYTH_SPAN_MAX_STR_LEN] = "kmyth";
+static bool trace_has_parent = false;
+static uint8_t trace_parent_trace_id[16];
+static uint8_t trace_parent_span_id[8];
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread kmyth_span_t *trace_current = NULL;
+
+//############################################################################
+// trace_now_ns()
+//############################################################################
+static uint64_t trace_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+//############################################################################
+// parse_hex()
+//############################################################################
+static int parse_hex(const char *hex, uint8_t * out, size_t out_len)
+{
+  bool nonzero = false;
+
+  for (size_t i = 0; i < out_len; i++)
+  {
+    unsigned int byte = 0;
+
+    if (sscanf(hex + 2 * i, "%2x", &byte) != 1 ||
+        strchr("0123456789abcdef", hex[2 * i]) == NULL ||
+        strchr("0123456789abcdef", hex[2 * i + 1]) == NULL)
+    {
+      return 1;
+    }
+    out[i] = (uint8_t) byte;
+    nonzero |= (byte != 0);
+  }
+
+  // all-zero IDs are invalid
+  return nonzero ? 0 : 1;
+}
+
+//############################################################################
+// parse_traceparent()
+//############################################################################
+static int parse_traceparent(const char *traceparent)
+{
+  // version 00: 00-<32 hex trace ID>-<16 hex parent ID>-<2 hex flags>
+  if (traceparent == NULL ||
+      strlen(traceparent) != KMYTH_TRACEPARENT_LEN - 1 ||
+      strncmp(traceparent, "00-", 3) != 0 || traceparent[35] != '-' ||
+      traceparent[52] != '-' ||
+      parse_hex(traceparent + 3, trace_parent_trace_id, 16) ||
+      parse_hex(traceparent + 36, trace_parent_span_id, 8))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+//############################################################################
+// kmyth_trace_init()
+//############################################################################
+int kmyth_trace_init(const char *service_name)
+{
+  const char *path = getenv(KMYTH_TRACE_FILE_ENV);
+
+  if (path == NULL || path[0] == '\0')
+  {
+    return 0;
+  }
+
+  pthread_mutex_lock(&trace_lock);
+  if (trace_file != NULL)
+  {
+    fclose(trace_file);
+  }
+  trace_file = fopen(path, "ae");
+  if (service_name != NULL)
+  {
+    snprintf(trace_service, sizeof(trace_service), "%s", service_name);
+  }
+  trace_has_parent =
+    (parse_traceparent(getenv(KMYTH_TRACEPARENT_ENV)) == 0);
+
+  int retval = (trace_file == NULL) ? 1 : 0;
+
+  pthread_mutex_unlock(&trace_lock);
+
+  return retval;
+}
+
+//############################################################################
+// kmyth_trace_shutdown()
+//############################################################################
+void kmyth_trace_shutdown(void)
+{
+  pthread_mutex_lock(&trace_lock);
+  if (trace_file != NULL)
+  {
+    fclose(trace_file);
+    trace_file = NULL;
+  }
+  pthread_mutex_unlock(&trace_lock);
+}
+
+//############################################################################
+// kmyth_trace_enabled()
+//############################################################################
+bool kmyth_trace_enabled(void)
+{
+  pthread_mutex_lock(&trace_lock);
+
+  bool enabled = (trace_file != NULL);
+
+  pthread_mutex_unlock(&trace_lock);
+
+  return enabled;
+}
+
+//############################################################################
+// kmyth_span_start()
+//############################################################################
+void kmyth_span_start(kmyth_span_t * span, const char *name)
+{
+  span->active = false;
+  span->attr_count = 0;
+  if (!kmyth_trace_enabled() || RAND_bytes(span->span_id, 8) != 1)
+  {
+    return;
+  }
+
+  span->name = name;
+  span->has_parent = true;
+  if (trace_current != NULL)
+  {
+    memcpy(span->trace_id, trace_current->trace_id, 16);
+    memcpy(span->parent_id, trace_current->span_id, 8);
+  }
+  else if (trace_has_parent)
+  {
+    memcpy(span->trace_id, trace_parent_trace_id, 16);
+    memcpy(span->parent_id, trace_parent_span_id, 8);
+  }
+  else if (RAND_bytes(span->trace_id, 16) == 1)
+  {
+    span->has_parent = false;
+  }
+  else
+  {
+    return;
+  }
+
+  span->outer = trace_current;
+  trace_current = span;
+  span->active = true;
+  span->start_ns = trace_now_ns();
+}
+
+//############################################################################
+// kmyth_span_set_str()
+//############################################################################
+void kmyth_span_set_str(kmyth_span_t * span, const char *key,
+                        const char *value, size_t len)
+{
+  if (span == NULL || !span->active || span->attr_count ==
+      KMYTH_SPAN_MAX_ATTRS || value == NULL)
+  {
+    return;
+  }
+
+  if (len >= KMYTH_SPAN_MAX_STR_LEN)
+  {
+    len = KMYTH_SPAN_MAX_STR_LEN - 1;
+  }
+  span->attrs[span->attr_count].key = key;
+  span->attrs[span->attr_count].is_int = false;
+  memcpy(span->attrs[span->attr_count].str_value, value, len);
+  span->attrs[span->attr_count].str_value[len] = '\0';
+  span->attr_count++;
+}
+
+//############################################################################
+// kmyth_span_set_int()
+//############################################################################
+void kmyth_span_set_int(kmyth_span_t * span, const char *key, int64_t value)
+{
+  if (span == NULL || !span->active ||
+      span->attr_count == KMYTH_SPAN_MAX_ATTRS)
+  {
+    return;
+  }
+
+  span->attrs[span->attr_count].key = key;
+  span->attrs[span->attr_count].is_int = true;
+  span->attrs[span->attr_count].int_value = value;
+  span->attr_count++;
+}
+
+//############################################################################
+// write_hex()
+//############################################################################
+static void write_hex(FILE * out, const uint8_t * bytes, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    fprintf(out, "%02x", bytes[i]);
+  }
+}
+
+//############################################################################
+// write_json_string()
+//############################################################################
+static void write_json_string(FILE * out, const char *s)
+{
+  fputc('"', out);
+  for (; *s != '\0'; s++)
+  {
+    unsigned char c = (unsigned char) *s;
+
+    if (c == '"' || c == '\\')
+    {
+      fprintf(out, "\\%c", c);
+    }
+    else if (c < 0x20 || c >= 0x7f)
+    {
+      fprintf(out, "\\u%04x", c);
+    }
+    else
+    {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+//############################################################################
+// kmyth_span_end()
+//############################################################################
+void kmyth_span_end(kmyth_span_t * span, int result)
+{
+  if (span == NULL || !span->active)
+  {
+    return;
+  }
+
+  uint64_t end_ns = trace_now_ns();
+
+  span->active = false;
+  trace_current = span->outer;
+
+  pthread_mutex_lock(&trace_lock);
+  if (trace_file == NULL)
+  {
+    pthread_mutex_unlock(&trace_lock);
+    return;
+  }
+
+  FILE *out = trace_file;
+
+  fprintf(out, "{\"resourceSpans\":[{\"resource\":{\"attributes\":"
+          "[{\"key\":\"service.name\",\"value\":{\"stringValue\":");
+  write_json_string(out, trace_service);
+  fprintf(out, "}}]},\"scopeSpans\":[{\"scope\":{\"name\":\"kmyth\"},"
+          "\"spans\":[{\"traceId\":\"");
+  write_hex(out, span->trace_id, 16);
+  fprintf(out, "\",\"spanId\":\"");
+  write_hex(out, span->span_id, 8);
+  fprintf(out, "\",");
+  if (span->has_parent)
+  {
+    fprintf(out, "\"parentSpanId\":\"");
+    write_hex(out, span->parent_id, 8);
+    fprintf(out, "\",");
+  }
+  fprintf(out, "\"name\":");
+  write_json_string(out, span->name);
+  fprintf(out, ",\"kind\":%d,\"startTimeUnixNano\":\"%llu\","
+          "\"endTimeUnixNano\":\"%llu\",\"attributes\":[",
+          (span->outer == NULL) ? 2 : 1,
+          (unsigned long long) span->start_ns, (unsigned long long) end_ns);
+  for (size_t i = 0; i < span->attr_count; i++)
+  {
+    fprintf(out, "%s{\"key\":", (i > 0) ? "," : "");
+    write_json_string(out, span->attrs[i].key);
+    if (span->attrs[i].is_int)
+    {
+      fprintf(out, ",\"value\":{\"intValue\":\"%lld\"}}",
+              (long long) span->attrs[i].int_value);
+    }
+    else
+    {
+      fprintf(out, ",\"value\":{\"stringValue\":");
+      write_json_string(out, span->attrs[i].str_value);
+      fprintf(out, "}}");
+    }
+  }
+  fprintf(out, "],\"status\":{\"code\":%d}}]}]}]}\n", (result == 0) ? 1 : 2);
+  fflush(out);
+
+  pthread_mutex_unlock(&trace_lock);
+}
+
+//############################################################################
+// kmyth_span_traceparent()
+//############################################################################
+int kmyth_span_traceparent(const kmyth_span_t * span, char *buf, size_t len)
+{
+  if (span == NULL || !span->active || buf == NULL ||
+      len < KMYTH_TRACEPARENT_LEN)
+  {
+    return 1;
+  }
+
+  char *p = buf;
+
+  p += sprintf(p, "00-");
+  for (size_t i = 0; i < 16; i++)
+  {
+    p += sprintf(p, "%02x", span->trace_id[i]);
+  }
+  *p++ = '-';
+  for (size_t i = 0; i < 8; i++)
+  {
+    p += sprintf(p, "%02x", span->span_id[i]);
+  }
+  sprintf(p, "-01");
+
+  return 0;
+}